@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Batched AV packet header decoding
+ * ---------------------------------
+ *
+ * The Takion thread drains bursts of AV packets from the socket. Instead of parsing and
+ * dispatching each of them on its own, it collects them in a ChiakiAvHeaderBatch, whose headers
+ * are decoded in one pass into arrays per field:
+ *
+ * - The header layout of the session's protocol version is picked once, the decoder reads the
+ *   fields of every packet at the offsets a table holds for video and audio in that version.
+ *   It produces the same fields as chiaki_takion_v7/v9/v12_av_packet_parse(), but also rejects
+ *   headers that claim more than the packet holds.
+ * - A ChiakiAvHeaderValidator then classifies every packet in one table-driven pass as good,
+ *   duplicate, stale or malformed, with the checks the receivers would otherwise only apply
+ *   after decrypting the payload: unit counts and indices, payload sizes and codecs, and the
+ *   frame and unit indices already seen.
+ *
+ * Only good packets have to be decrypted and handed to the receivers, which still validate them
+ * as before.
+ */
+
+#ifndef CHIAKI_AVHEADER_H
+#define CHIAKI_AVHEADER_H
+
+#include "common.h"
+#include "gkcrypt.h"
+#include "takion.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_AV_HEADER_BATCH_MAX 32
+
+// units of one video frame, source + fec, the frame processor accepts
+#define CHIAKI_AV_HEADER_VIDEO_UNITS_MAX 256
+
+typedef enum chiaki_av_header_format_t
+{
+	CHIAKI_AV_HEADER_FORMAT_V7,
+	CHIAKI_AV_HEADER_FORMAT_V9,
+	CHIAKI_AV_HEADER_FORMAT_V12
+} ChiakiAvHeaderFormat;
+
+/**
+ * @return CHIAKI_ERR_INVALID_DATA for a Takion protocol version without AV header layout
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_av_header_format_for_version(unsigned int version, ChiakiAvHeaderFormat *format);
+
+typedef enum chiaki_av_header_class_t
+{
+	CHIAKI_AV_HEADER_CLASS_GOOD,
+	CHIAKI_AV_HEADER_CLASS_DUPLICATE, // a unit or audio frame that was already received
+	CHIAKI_AV_HEADER_CLASS_STALE, // of a video frame older than the one being received, or audio far behind
+	CHIAKI_AV_HEADER_CLASS_MALFORMED,
+	CHIAKI_AV_HEADER_CLASS_COUNT
+} ChiakiAvHeaderClass;
+
+typedef enum chiaki_av_header_flag_t
+{
+	CHIAKI_AV_HEADER_FLAG_VIDEO = 1 << 0,
+	CHIAKI_AV_HEADER_FLAG_NALU_INFO_STRUCTS = 1 << 1,
+	CHIAKI_AV_HEADER_FLAG_HAPTICS = 1 << 2
+} ChiakiAvHeaderFlag;
+
+/**
+ * Packets and their decoded headers, one array per field.
+ */
+typedef struct chiaki_av_header_batch_t
+{
+	size_t count;
+	uint8_t *buf[CHIAKI_AV_HEADER_BATCH_MAX]; // not owned
+	size_t buf_size[CHIAKI_AV_HEADER_BATCH_MAX];
+
+	uint8_t cls[CHIAKI_AV_HEADER_BATCH_MAX]; // ChiakiAvHeaderClass
+	uint8_t flags[CHIAKI_AV_HEADER_BATCH_MAX]; // mask of ChiakiAvHeaderFlag
+	uint8_t codec[CHIAKI_AV_HEADER_BATCH_MAX];
+	uint8_t adaptive_stream_index[CHIAKI_AV_HEADER_BATCH_MAX];
+	uint8_t byte_at_0x2c[CHIAKI_AV_HEADER_BATCH_MAX];
+	uint16_t packet_index[CHIAKI_AV_HEADER_BATCH_MAX];
+	uint16_t frame_index[CHIAKI_AV_HEADER_BATCH_MAX];
+	uint16_t unit_index[CHIAKI_AV_HEADER_BATCH_MAX];
+	uint16_t units_total[CHIAKI_AV_HEADER_BATCH_MAX]; // source + fec
+	uint16_t units_fec[CHIAKI_AV_HEADER_BATCH_MAX]; // for audio, unit size and unit counts
+	uint16_t word_at_0x18[CHIAKI_AV_HEADER_BATCH_MAX];
+	uint16_t data_offset[CHIAKI_AV_HEADER_BATCH_MAX];
+	uint64_t key_pos[CHIAKI_AV_HEADER_BATCH_MAX];
+} ChiakiAvHeaderBatch;
+
+static inline void chiaki_av_header_batch_reset(ChiakiAvHeaderBatch *batch) { batch->count = 0; }
+static inline bool chiaki_av_header_batch_full(ChiakiAvHeaderBatch *batch) { return batch->count >= CHIAKI_AV_HEADER_BATCH_MAX; }
+
+/**
+ * Add a packet, which has to stay valid until the batch is reset. The batch must not be full.
+ */
+static inline void chiaki_av_header_batch_push(ChiakiAvHeaderBatch *batch, uint8_t *buf, size_t buf_size)
+{
+	batch->buf[batch->count] = buf;
+	batch->buf_size[batch->count] = buf_size;
+	batch->count++;
+}
+
+/**
+ * Decode the headers of all packets in the batch. Packets whose header can't be decoded are
+ * classified as malformed, all others as good.
+ *
+ * @param key_state for v9 and v12, the packets' key positions are requested from it in order, as
+ * their parsers do
+ */
+CHIAKI_EXPORT void chiaki_av_header_batch_decode(ChiakiAvHeaderBatch *batch, ChiakiAvHeaderFormat format, ChiakiKeyState *key_state);
+
+/**
+ * The packet at index as chiaki_takion_v7/v9/v12_av_packet_parse() would have returned it.
+ */
+CHIAKI_EXPORT void chiaki_av_header_batch_packet(ChiakiAvHeaderBatch *batch, size_t index, ChiakiTakionAVPacket *packet);
+
+/**
+ * Stream state the packets of consecutive batches are classified against.
+ */
+typedef struct chiaki_av_header_validator_t
+{
+	int32_t video_frame; // being received, -1 before the first
+	uint8_t video_units_seen[CHIAKI_AV_HEADER_VIDEO_UNITS_MAX / 8]; // of video_frame
+	struct
+	{
+		int32_t frame; // newest frame index, -1 before the first
+		uint64_t seen; // bit n: frame - n was received
+	} audio[2]; // audio, haptics
+	uint64_t classified[CHIAKI_AV_HEADER_CLASS_COUNT];
+} ChiakiAvHeaderValidator;
+
+CHIAKI_EXPORT void chiaki_av_header_validator_init(ChiakiAvHeaderValidator *validator);
+
+/**
+ * Classify the decoded packets of the batch, in order. Good packets update the stream state.
+ *
+ * @return the number of good packets
+ */
+CHIAKI_EXPORT size_t chiaki_av_header_validate(ChiakiAvHeaderValidator *validator, ChiakiAvHeaderBatch *batch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_AVHEADER_H
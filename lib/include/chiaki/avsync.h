@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * A/V synchronization
+ * -------------------
+ *
+ * Audio is the master clock: it plays continuously and is only ever sped up or slowed down
+ * by a fraction of a percent, video is presented relative to it.
+ *
+ * Audio and video units carry no timestamps, only their Takion frame indices. A unit's media
+ * time is its index times the unit duration, which maps it onto the console's clock up to an
+ * unknown offset per stream. That offset is estimated from arrivals: the lower envelope of
+ * arrival - media time over the last window_us is what a unit that crossed the network without
+ * queueing would have shown, so it stands in for the time the console sent the unit. Both
+ * streams are assumed to leave the console in sync; whatever they don't, e.g. the time a large
+ * video frame takes on the wire, remains as sync error and is calibrated with av_offset_us.
+ * The slope of the audio envelope is the drift of the console's clock against the local one.
+ *
+ * With that, for the audio being heard and for a video frame about to be presented, the
+ * latency since the console sent it is known. The engine outputs:
+ *
+ * - a hold for each video frame that is ahead of the audio, to present it that much later.
+ *   It is at most max_video_hold_us, a frame has to be presented before the next one arrives.
+ * - a resample ratio for the audio, holding the audio buffering at a target. The ratio
+ *   compensates the drift and moves the buffering towards the target slowly, instead of the
+ *   audible skips of a hard catch-up.
+ * - the audio target follows video that is persistently behind or ahead of the audio within
+ *   [audio_min_us, audio_max_us], so that the holds only have to absorb the jitter. The
+ *   minimum is raised by the spread of the audio arrivals, so late units don't run it dry.
+ *
+ * All times are passed in by the caller as monotonic microseconds, so the engine can be run
+ * on recorded timelines. All functions are thread-safe.
+ */
+
+#ifndef CHIAKI_AVSYNC_H
+#define CHIAKI_AVSYNC_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chiaki_av_sync_config_t
+{
+	uint32_t video_fps; // what the video frame indices count
+	int64_t av_offset_us; // > 0 presents video this much later relative to the audio
+	uint64_t audio_target_us; // buffering the resample ratio steers the audio to
+	uint64_t audio_min_us; // least buffering on top of the audio's arrival jitter, for video that is ahead
+	uint64_t audio_max_us; // most buffering the target may be raised to for video that is behind
+	uint64_t max_video_hold_us;
+	double max_ratio_deviation; // the resample ratio stays within 1 +/- this
+	double ratio_gain; // resample ratio change per second of buffering off target
+	uint64_t window_us; // arrival history the offsets and the drift are estimated over
+	uint64_t stale_us; // a stream not seen for this long starts over, a clock not updated is ignored
+} ChiakiAvSyncConfig;
+
+typedef struct chiaki_av_sync_stats_t
+{
+	int64_t audio_latency_us; // since the console sent the audio being heard
+	int64_t video_latency_us; // since the console sent the last presented frame, at its presentation
+	int64_t sync_error_us; // of the last presented frame, video - audio latency - av_offset_us, > 0 if video is behind
+	uint64_t sync_error_avg_us; // smoothed absolute sync error
+	uint64_t sync_error_max_us;
+	double drift_ppm; // how much faster the console's clock runs than the local one
+	uint64_t audio_jitter_us; // mean spread of the audio arrivals
+	double resample_ratio;
+	uint64_t audio_buffer_us; // smoothed
+	uint64_t audio_target_us; // after following the video
+	uint64_t video_hold_us; // last hold returned
+	uint64_t audio_frames;
+	uint64_t video_frames;
+	uint64_t presents;
+	uint64_t held; // presents that were held
+	uint64_t late; // presents more than half a frame behind the audio
+	uint64_t restarts; // streams that started over after a gap
+} ChiakiAvSyncStats;
+
+typedef struct chiaki_av_sync_t ChiakiAvSync;
+
+/**
+ * 60 fps, target 40 ms within [20 + jitter, 120] ms, holds up to 12 ms, ratio within 0.5%,
+ * estimated over 8 s, streams start over after 500 ms.
+ */
+CHIAKI_EXPORT void chiaki_av_sync_config_defaults(ChiakiAvSyncConfig *config);
+
+/**
+ * @return the engine, or NULL if config has no video_fps or memory could not be allocated
+ */
+CHIAKI_EXPORT ChiakiAvSync *chiaki_av_sync_new(const ChiakiAvSyncConfig *config);
+CHIAKI_EXPORT void chiaki_av_sync_free(ChiakiAvSync *sync);
+
+/**
+ * Forget both streams, e.g. when the session restarts. Stats are kept.
+ */
+CHIAKI_EXPORT void chiaki_av_sync_reset(ChiakiAvSync *sync);
+
+/**
+ * Change the audio buffering target, once the audio device's buffer size is known.
+ * min and max are moved to contain it.
+ */
+CHIAKI_EXPORT void chiaki_av_sync_set_audio_target(ChiakiAvSync *sync, uint64_t target_us, uint64_t min_us, uint64_t max_us);
+
+/**
+ * An audio unit was received and is about to be buffered for playback.
+ *
+ * @param frame_us duration of the unit
+ */
+CHIAKI_EXPORT void chiaki_av_sync_audio_frame(ChiakiAvSync *sync, uint16_t frame_index, uint64_t frame_us, uint64_t arrival_us);
+
+/**
+ * Report the audio buffered ahead of what is being heard now, including the device's queue.
+ * Call it after every unit was buffered.
+ *
+ * @return the resample ratio to play the next unit at, input frames consumed per output frame
+ */
+CHIAKI_EXPORT double chiaki_av_sync_audio_playout(ChiakiAvSync *sync, uint64_t buffered_us, uint64_t now_us);
+
+CHIAKI_EXPORT double chiaki_av_sync_resample_ratio(ChiakiAvSync *sync);
+
+/**
+ * A video frame was received and is about to be decoded.
+ */
+CHIAKI_EXPORT void chiaki_av_sync_video_frame(ChiakiAvSync *sync, uint16_t frame_index, uint64_t arrival_us);
+
+/**
+ * How much longer to hold the decoded frame before presenting it. Poll it until it returns 0,
+ * or present at now_us plus the result. 0 while there is no audio clock to sync to.
+ */
+CHIAKI_EXPORT uint64_t chiaki_av_sync_video_hold(ChiakiAvSync *sync, uint16_t frame_index, uint64_t now_us);
+
+/**
+ * The frame is being presented now, records its sync error.
+ */
+CHIAKI_EXPORT void chiaki_av_sync_video_presented(ChiakiAvSync *sync, uint16_t frame_index, uint64_t now_us);
+
+CHIAKI_EXPORT void chiaki_av_sync_stats(ChiakiAvSync *sync, ChiakiAvSyncStats *stats);
+
+#define CHIAKI_AV_RESAMPLER_CHANNELS_MAX 8
+
+/**
+ * Linear interpolating resampler for interleaved 16 bit audio, to play audio at the ratio
+ * chiaki_av_sync_audio_playout() asks for. At ratios this close to 1 linear interpolation is
+ * inaudible, and it keeps no more than one frame of history.
+ */
+typedef struct chiaki_av_resampler_t
+{
+	unsigned channels;
+	double pos; // of the next output frame, 0 is prev, 1 the first input frame
+	int16_t prev[CHIAKI_AV_RESAMPLER_CHANNELS_MAX];
+	bool primed;
+} ChiakiAvResampler;
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_av_resampler_init(ChiakiAvResampler *resampler, unsigned channels);
+
+/**
+ * Resample in_frames frames of in into out.
+ *
+ * @param ratio input frames consumed per output frame
+ * @param out_frames_max out has to hold in_frames / ratio + 1 frames, input that doesn't fit is dropped
+ * @return the number of frames written to out
+ */
+CHIAKI_EXPORT size_t chiaki_av_resampler_process(ChiakiAvResampler *resampler, double ratio,
+	const int16_t *in, size_t in_frames, int16_t *out, size_t out_frames_max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_AVSYNC_H
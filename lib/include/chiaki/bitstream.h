@@ -3,6 +3,7 @@
 #ifndef CHIAKI_BITSTREAM_H
 #define CHIAKI_BITSTREAM_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "common.h"
@@ -31,6 +32,7 @@ typedef struct chiaki_bitstream_t
 			struct
 			{
 				uint32_t log2_max_pic_order_cnt_lsb_minus4;
+				uint32_t max_sub_layers_minus1;
 			} sps;
 		} h265;
 	};
@@ -47,6 +49,7 @@ typedef struct chiaki_bitstream_slice_t
 {
 	ChiakiBitstreamSliceType slice_type;
 	unsigned reference_frame;
+	bool non_reference; // no other frame refers to this one, it can be dropped without breaking the reference chain
 } ChiakiBitstreamSlice;
 
 CHIAKI_EXPORT void chiaki_bitstream_init(ChiakiBitstream *bitstream, ChiakiLog *log, ChiakiCodec codec);
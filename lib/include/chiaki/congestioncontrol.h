@@ -19,6 +19,12 @@ typedef struct chiaki_congestion_control_t
 	ChiakiThread thread;
 	ChiakiBoolPredCond stop_cond;
 	double packet_loss;
+	/**
+	 * Packets counted since start, before the reported loss is capped. 32 bit so that other
+	 * threads can sample them without a lock.
+	 */
+	volatile uint32_t received_total;
+	volatile uint32_t lost_total;
 } ChiakiCongestionControl;
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionControl *control, ChiakiTakion *takion, ChiakiPacketStats *stats, ChiakiLog *log);
@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Connection profiles
+ * -------------------
+ *
+ * What a session found out about a console, kept per host so that the next connect to the
+ * same console can skip the round trips that found it out:
+ *
+ * - addr:          the address the last session connected to, for a console that discovery
+ *                  has not seen (again) yet.
+ * - target:        the RP version the console accepted. Requesting it right away saves the
+ *                  session request that would otherwise fail with a version mismatch first.
+ * - video_profile: the profile after the console's downgrades, e.g. 1080p on a base PS4.
+ * - mtu/rtt:       the Senkusha results. With them Senkusha is skipped.
+ * - remote_addr:   the peer address a PSN connection's holepunch selected.
+ * - history:       early-stream loss and throughput, for the LaunchSpec hints, see launchhints.h.
+ *                  Merged over sessions by chiaki_conn_profile_store_observe().
+ *
+ * Validity rules, checked by chiaki_conn_profile_store_lookup():
+ *
+ * - A profile not recorded again for max_age_ms is dropped.
+ * - target is only valid while the console reports the same system version as when it was
+ *   recorded, a firmware update may bring a new RP version.
+ * - mtu/rtt are only valid for link_max_age_ms and only when connecting to the same address.
+ * - video_profile is only valid for the same requested profile.
+ * - history is valid as long as the profile, it is not a hint the console could disagree with
+ *   and is left alone by chiaki_conn_profile_store_mismatch().
+ *
+ * Profiles are used optimistically: if the console disagrees, the session falls back to the
+ * full path on its own (a wrong target is answered with a version mismatch and retried).
+ * A connect that fails before streaming with hints applied reports them through
+ * chiaki_conn_profile_store_mismatch(), which drops them. After max_failures such connects
+ * in a row the whole profile is ignored until the next successful connect records it again.
+ *
+ * Profiles are kept in memory, they don't outlive the store. All functions are thread-safe.
+ */
+
+#ifndef CHIAKI_CONNPROFILE_H
+#define CHIAKI_CONNPROFILE_H
+
+#include "common.h"
+#include "session.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_CONN_PROFILE_KEY_SIZE 72 // "psn:" + 64 hex digits of a PSN device uid + \0
+#define CHIAKI_CONN_PROFILE_ADDR_SIZE 256
+#define CHIAKI_CONN_PROFILE_VERSION_SIZE 16 // discovery system-version, e.g. "07200005"
+
+typedef enum chiaki_conn_profile_part_t
+{
+	CHIAKI_CONN_PROFILE_PART_ADDR = 1 << 0,
+	CHIAKI_CONN_PROFILE_PART_TARGET = 1 << 1,
+	CHIAKI_CONN_PROFILE_PART_VIDEO = 1 << 2,
+	CHIAKI_CONN_PROFILE_PART_LINK = 1 << 3,
+	CHIAKI_CONN_PROFILE_PART_REMOTE = 1 << 4,
+	CHIAKI_CONN_PROFILE_PART_HISTORY = 1 << 5,
+	CHIAKI_CONN_PROFILE_PART_ALL = (1 << 6) - 1
+} ChiakiConnProfilePart;
+
+typedef struct chiaki_conn_profile_t
+{
+	char key[CHIAKI_CONN_PROFILE_KEY_SIZE]; // identifies the console, e.g. its MAC in hex
+	char system_version[CHIAKI_CONN_PROFILE_VERSION_SIZE]; // empty if not known
+	uint32_t parts; // mask of ChiakiConnProfilePart that are set below
+
+	char addr[CHIAKI_CONN_PROFILE_ADDR_SIZE];
+	ChiakiTarget target;
+	ChiakiConnectVideoProfile video_requested;
+	ChiakiConnectVideoProfile video_profile; // what video_requested was downgraded to
+	uint32_t mtu_in;
+	uint32_t mtu_out;
+	uint64_t rtt_us;
+	char remote_addr[CHIAKI_CONN_PROFILE_ADDR_SIZE];
+	ChiakiLinkHistory history;
+
+	// maintained by the store, ignored by chiaki_conn_profile_store_record()
+	uint64_t recorded_ms;
+	uint64_t link_recorded_ms;
+	unsigned failures;
+} ChiakiConnProfile;
+
+typedef struct chiaki_conn_profile_store_config_t
+{
+	size_t capacity; // profiles kept, the least recently used one is dropped first
+	uint64_t max_age_ms;
+	uint64_t link_max_age_ms;
+	unsigned max_failures;
+	/**
+	 * Monotonic clock in milliseconds, chiaki_time_now_monotonic_ms() if NULL.
+	 * Tests set this to step through the validity rules without sleeping.
+	 */
+	uint64_t (*now_ms)(void *user);
+	void *now_user;
+} ChiakiConnProfileStoreConfig;
+
+typedef struct chiaki_conn_profile_store_stats_t
+{
+	uint64_t lookups;
+	uint64_t hot; // lookups that returned at least one valid part
+	uint64_t misses; // no profile for the key
+	uint64_t expired; // profiles dropped because of max_age_ms
+	uint64_t ignored; // lookups refused because of max_failures
+	uint64_t mismatches;
+	uint64_t records;
+	uint64_t evictions;
+} ChiakiConnProfileStoreStats;
+
+typedef struct chiaki_conn_profile_store_t ChiakiConnProfileStore;
+
+/**
+ * 16 profiles, kept for 7 days, mtu/rtt for 10 min, ignored after 2 failed hot connects.
+ */
+CHIAKI_EXPORT void chiaki_conn_profile_store_config_defaults(ChiakiConnProfileStoreConfig *config);
+
+/**
+ * @return the store, or NULL if config has no capacity or memory could not be allocated
+ */
+CHIAKI_EXPORT ChiakiConnProfileStore *chiaki_conn_profile_store_new(const ChiakiConnProfileStoreConfig *config);
+CHIAKI_EXPORT void chiaki_conn_profile_store_free(ChiakiConnProfileStore *store);
+
+/**
+ * Record what a successful connect found out. Parts set in profile replace the stored ones,
+ * parts not set are kept. Resets the failure count.
+ *
+ * @return CHIAKI_ERR_INVALID_DATA if profile has no key
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_conn_profile_store_record(ChiakiConnProfileStore *store, const ChiakiConnProfile *profile);
+
+/**
+ * @param system_version what the console reports now, NULL or empty if not known
+ * @param addr the address about to be connected to, NULL or empty if not known
+ * @param profile if not NULL, filled with the stored profile, with parts set to the valid ones
+ * @return mask of ChiakiConnProfilePart that are valid, 0 if there is nothing to use
+ */
+CHIAKI_EXPORT uint32_t chiaki_conn_profile_store_lookup(ChiakiConnProfileStore *store, const char *key,
+	const char *system_version, const char *addr, ChiakiConnProfile *profile);
+
+/**
+ * A connect with the given parts applied failed before streaming. Drops these parts and
+ * counts the failure.
+ */
+CHIAKI_EXPORT void chiaki_conn_profile_store_mismatch(ChiakiConnProfileStore *store, const char *key, uint32_t parts);
+
+/**
+ * Merge what the first seconds of a stream with the console showed into its history, see
+ * chiaki_link_history_observe(). Creates the profile if there is none.
+ *
+ * @return CHIAKI_ERR_INVALID_DATA if key is empty
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_conn_profile_store_observe(ChiakiConnProfileStore *store, const char *key,
+	double loss, uint32_t throughput_kbps);
+
+CHIAKI_EXPORT void chiaki_conn_profile_store_forget(ChiakiConnProfileStore *store, const char *key);
+
+CHIAKI_EXPORT void chiaki_conn_profile_store_stats(ChiakiConnProfileStore *store, ChiakiConnProfileStoreStats *stats);
+
+/**
+ * Hand the valid parts of profile to a connect as hints: target_hint, the link hints, the link
+ * history and video_profile if it was requested the same way. addr and remote_addr are left to
+ * the caller.
+ *
+ * @return mask of the parts that were applied
+ */
+CHIAKI_EXPORT uint32_t chiaki_conn_profile_apply(const ChiakiConnProfile *profile, ChiakiConnectInfo *connect_info);
+
+/**
+ * Fill profile with what a session that got to streaming found out, key and the parts that
+ * are not known to the session are left alone. mtu/rtt are only set if Senkusha measured
+ * them in this session.
+ *
+ * @param video_requested the video profile the connect asked for
+ */
+CHIAKI_EXPORT void chiaki_conn_profile_from_session(ChiakiConnProfile *profile, ChiakiSession *session,
+	const ChiakiConnectVideoProfile *video_requested);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_CONNPROFILE_H
@@ -0,0 +1,183 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Cost accounting
+ * ---------------
+ *
+ * Where the CPU time and the allocations of a stream go, per thread and per subsystem, without
+ * an external profiler. A ChiakiCostAcct is attached to a session with
+ * chiaki_session_set_cost_acct(), and every thread that works for the session binds itself to
+ * it with chiaki_cost_thread_enter(), naming the subsystem it works for by default (its home).
+ * Objects that start threads, like ChiakiTakion or ChiakiGKCrypt, pass on the accountant that
+ * the thread starting them was bound to, so binding the session thread covers all of them.
+ *
+ * On a bound thread, CHIAKI_COST_SCOPE() charges the time of a block to another subsystem, e.g.
+ * FEC decoding on the Takion thread. The time of a thread outside of any scope is charged to
+ * its home. Scopes nest, the inner one's time is only charged to the inner subsystem.
+ *
+ * Allocations through chiaki_cost_malloc() and friends are charged to the innermost scope of
+ * the calling thread, or its home.
+ *
+ * There are two modes:
+ *
+ *   CHIAKI_COST_MODE_SAMPLED   Only one in sample_every outermost scopes reads the thread's CPU
+ *                              clock, the CPU time of a subsystem is estimated from those. No
+ *                              allocation histograms. Meant to be left on in production.
+ *   CHIAKI_COST_MODE_DETAILED  Every scope reads the clock twice, allocations are counted into
+ *                              byte histograms. For benchmarks.
+ *
+ * In both modes the CPU time of each thread is exact, read from its CPU clock: per-thread
+ * clocks on Linux, GetThreadTimes() on Windows, the thread's run clocks on the Vita. Where
+ * none of these exist, cpu_supported is false in the snapshot and scopes are timed with the
+ * monotonic clock.
+ *
+ * Counters are written by their thread only, and read without locking by
+ * chiaki_cost_acct_snapshot(), so a snapshot may be off by what happened while it was taken.
+ * Calls on a thread that isn't bound return right away.
+ */
+
+#ifndef CHIAKI_COSTACCT_H
+#define CHIAKI_COSTACCT_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_COST_THREADS_MAX 16
+#define CHIAKI_COST_DEPTH_MAX 4 // deeper scopes are charged to the innermost one of this depth
+#define CHIAKI_COST_NAME_SIZE 16
+#define CHIAKI_COST_HIST_BUCKETS 16
+#define CHIAKI_COST_SAMPLE_EVERY_DEFAULT 32
+
+typedef enum chiaki_cost_subsys_t
+{
+	CHIAKI_COST_OTHER = 0, // session and ctrl threads, anything not below
+	CHIAKI_COST_TAKION, // Takion receive thread: parsing, reordering, AV dispatch, frame assembly
+	CHIAKI_COST_GKCRYPT, // key streams, en- and decryption, GMACs
+	CHIAKI_COST_FEC,
+	CHIAKI_COST_BITSTREAM, // slice header parsing and rewriting
+	CHIAKI_COST_SEND_BUFFER, // Takion data resends and acks
+	CHIAKI_COST_FEEDBACK, // controller state and history sending
+	CHIAKI_COST_CONGESTION,
+	CHIAKI_COST_SUBSYS_COUNT
+} ChiakiCostSubsys;
+
+typedef enum chiaki_cost_mode_t
+{
+	CHIAKI_COST_MODE_SAMPLED,
+	CHIAKI_COST_MODE_DETAILED
+} ChiakiCostMode;
+
+typedef struct chiaki_cost_config_t
+{
+	ChiakiCostMode mode;
+	uint32_t sample_every; // CHIAKI_COST_MODE_SAMPLED only, 1 times every scope
+} ChiakiCostConfig;
+
+typedef struct chiaki_cost_subsys_stats_t
+{
+	uint64_t cpu_us; // estimated from scopes_timed in CHIAKI_COST_MODE_SAMPLED
+	uint64_t scopes;
+	uint64_t scopes_timed;
+	uint64_t allocs; // malloc, calloc and realloc
+	uint64_t alloc_bytes;
+	uint64_t frees;
+	uint64_t alloc_hist[CHIAKI_COST_HIST_BUCKETS]; // CHIAKI_COST_MODE_DETAILED only, see chiaki_cost_hist_bucket()
+} ChiakiCostSubsysStats;
+
+typedef struct chiaki_cost_thread_stats_t
+{
+	char name[CHIAKI_COST_NAME_SIZE];
+	ChiakiCostSubsys home;
+	bool bound; // false once it left
+	uint64_t cpu_us; // while bound
+} ChiakiCostThreadStats;
+
+typedef struct chiaki_cost_snapshot_t
+{
+	ChiakiCostMode mode;
+	bool cpu_supported;
+	uint64_t wall_us; // since chiaki_cost_acct_new()
+	uint64_t cpu_us; // of all threads
+	ChiakiCostSubsysStats subsys[CHIAKI_COST_SUBSYS_COUNT];
+	ChiakiCostThreadStats threads[CHIAKI_COST_THREADS_MAX];
+	size_t threads_count;
+	uint32_t threads_dropped; // bound while all CHIAKI_COST_THREADS_MAX were taken, not accounted
+} ChiakiCostSnapshot;
+
+typedef struct chiaki_cost_acct_t ChiakiCostAcct;
+
+/**
+ * CHIAKI_COST_MODE_SAMPLED, timing one in CHIAKI_COST_SAMPLE_EVERY_DEFAULT scopes.
+ */
+CHIAKI_EXPORT void chiaki_cost_config_defaults(ChiakiCostConfig *config);
+
+CHIAKI_EXPORT ChiakiCostAcct *chiaki_cost_acct_new(const ChiakiCostConfig *config);
+
+/**
+ * All threads must have left.
+ */
+CHIAKI_EXPORT void chiaki_cost_acct_free(ChiakiCostAcct *acct);
+
+CHIAKI_EXPORT void chiaki_cost_acct_snapshot(ChiakiCostAcct *acct, ChiakiCostSnapshot *snapshot);
+
+CHIAKI_EXPORT const char *chiaki_cost_subsys_string(ChiakiCostSubsys subsys);
+
+/**
+ * The histogram bucket of an allocation of size bytes: bucket i counts sizes up to 16 << i,
+ * the last one everything larger.
+ */
+CHIAKI_EXPORT size_t chiaki_cost_hist_bucket(size_t size);
+
+/**
+ * Bind the calling thread to acct until chiaki_cost_thread_leave(). Does nothing if acct is NULL.
+ * A thread that enters again for the same home after leaving, e.g. a pool worker running the
+ * jobs of several sessions, adds to its previous stats.
+ *
+ * @param name copied, truncated to CHIAKI_COST_NAME_SIZE - 1
+ */
+CHIAKI_EXPORT void chiaki_cost_thread_enter(ChiakiCostAcct *acct, ChiakiCostSubsys home, const char *name);
+CHIAKI_EXPORT void chiaki_cost_thread_leave(void);
+
+/**
+ * @return the accountant the calling thread is bound to, NULL if none
+ */
+CHIAKI_EXPORT ChiakiCostAcct *chiaki_cost_current(void);
+
+CHIAKI_EXPORT void chiaki_cost_scope_begin(ChiakiCostSubsys subsys);
+CHIAKI_EXPORT void chiaki_cost_scope_end(void);
+
+/**
+ * Charge the statement or block that follows to subsys:
+ *
+ *   CHIAKI_COST_SCOPE(CHIAKI_COST_FEC)
+ *       err = chiaki_fec_decoder_solve(&decoder, buf);
+ *
+ * Leaving the block with break, return or goto skips the end of the scope.
+ */
+#define CHIAKI_COST_SCOPE(subsys) \
+	for(int chiaki_cost_scope_once_ = (chiaki_cost_scope_begin(subsys), 1); \
+		chiaki_cost_scope_once_; \
+		chiaki_cost_scope_end(), chiaki_cost_scope_once_ = 0)
+
+/**
+ * malloc(), calloc(), realloc() and free() that count what they do on a bound thread.
+ * Memory from them may be freed with free() and vice versa, but it is only counted once both
+ * ends go through here.
+ */
+CHIAKI_EXPORT void *chiaki_cost_malloc(size_t size);
+CHIAKI_EXPORT void *chiaki_cost_calloc(size_t nmemb, size_t size);
+CHIAKI_EXPORT void *chiaki_cost_realloc(void *ptr, size_t size);
+CHIAKI_EXPORT void chiaki_cost_free(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_COSTACCT_H
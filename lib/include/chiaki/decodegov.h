@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Decode-pressure governor
+ * ------------------------
+ *
+ * A decoder that takes longer than the frame interval falls behind the stream: frames queue up in
+ * front of it, or overwrite each other before they are presented, and the latency grows until the
+ * picture freezes. The governor watches the headroom the decoder leaves and reacts in two steps:
+ *
+ * - shed: under pressure, frames nothing else refers to (H.264 nal_ref_idc 0, H.265 sub-layer
+ *   non-reference pictures, see ChiakiBitstreamSlice.non_reference) are dropped before they reach
+ *   the decoder. Dropping them never breaks the reference chain, the picture only skips a frame.
+ *   At most shed_run_max frames are shed in a row, so motion stays continuous.
+ * - escalate: if the decoder still can't keep up while shedding, because the stream has too few
+ *   non-reference frames or they don't save enough, a lower bitrate is due. The governor only
+ *   signals it, what to request is up to the caller.
+ *
+ * Pressure is entered when the smoothed decode time of the decoded frames exceeds shed_load of
+ * the frame interval, or when the decode time beyond the frame intervals, the backlog, exceeds
+ * backlog_frames intervals. It is left once both are back below clear_load and zero. Shedding is
+ * relieving the decoder if the smoothed cost per frame, with shed frames costing nothing, is back
+ * below shed_load. Pressure without that relief for escalate_after_us escalates, at most once per
+ * escalate_holdoff_us.
+ *
+ * Times are passed in by the caller as monotonic microseconds. The governor is not thread-safe,
+ * it is meant to be driven from the thread that decodes.
+ */
+
+#ifndef CHIAKI_DECODEGOV_H
+#define CHIAKI_DECODEGOV_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum chiaki_decode_pressure_t
+{
+	CHIAKI_DECODE_PRESSURE_NONE,
+	CHIAKI_DECODE_PRESSURE_SHED, // non-reference frames are shed
+	CHIAKI_DECODE_PRESSURE_ESCALATE // shedding did not relieve the decoder
+} ChiakiDecodePressure;
+
+CHIAKI_EXPORT const char *chiaki_decode_pressure_string(ChiakiDecodePressure pressure);
+
+typedef struct chiaki_decode_governor_config_t
+{
+	uint32_t fps;
+	double shed_load; // smoothed decode time per frame interval above which frames are shed
+	double clear_load; // below which shedding stops
+	double backlog_frames; // frame intervals of backlog above which frames are shed regardless of the load
+	uint32_t shed_run_max; // consecutive frames shed at most
+	uint64_t escalate_after_us; // pressure without relief for this long escalates
+	uint64_t escalate_holdoff_us;
+	double bitrate_factor; // an escalation suggests the current bitrate times this
+	uint32_t bitrate_min_kbps; // but not less
+} ChiakiDecodeGovernorConfig;
+
+/**
+ * 60 fps, shed above 90% and until below 75% of the frame interval or 1.5 intervals of backlog,
+ * at most 1 frame in a row, escalate after 2 s without relief and then every 10 s, suggesting
+ * 75% of the bitrate but at least 1000 kbps.
+ */
+CHIAKI_EXPORT void chiaki_decode_governor_config_defaults(ChiakiDecodeGovernorConfig *config);
+
+typedef struct chiaki_decode_governor_t
+{
+	ChiakiDecodeGovernorConfig config;
+	uint64_t frame_interval_us;
+	ChiakiDecodePressure pressure;
+	double decode_avg_us; // smoothed over the decoded frames
+	double cost_avg_us; // smoothed over all frames, shed ones costing nothing
+	uint64_t backlog_us;
+	bool unrelieved; // under pressure, and shedding is not relieving the decoder
+	uint64_t unrelieved_since_us;
+	uint64_t escalated_us; // last escalation, if any
+	bool escalation_pending;
+	uint32_t shed_run;
+
+	uint64_t frames;
+	uint64_t shed; // frames shed
+	uint64_t shed_missed; // frames under pressure that could not be shed as they are referenced, or the run was full
+	uint64_t escalations;
+	uint64_t pressure_episodes;
+	uint64_t backlog_max_us;
+} ChiakiDecodeGovernor;
+
+/**
+ * @return CHIAKI_ERR_INVALID_DATA if config has no fps
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_decode_governor_init(ChiakiDecodeGovernor *governor, const ChiakiDecodeGovernorConfig *config);
+
+/**
+ * Forget the pressure, e.g. when the stream restarts. Counters are kept.
+ */
+CHIAKI_EXPORT void chiaki_decode_governor_reset(ChiakiDecodeGovernor *governor);
+
+/**
+ * A frame is about to be decoded.
+ *
+ * @param non_reference whether no other frame refers to it
+ * @return true if the frame should be shed instead
+ */
+CHIAKI_EXPORT bool chiaki_decode_governor_frame(ChiakiDecodeGovernor *governor, bool non_reference, uint64_t now_us);
+
+/**
+ * A frame that was not shed was decoded, taking decode_us.
+ */
+CHIAKI_EXPORT void chiaki_decode_governor_decoded(ChiakiDecodeGovernor *governor, uint64_t decode_us, uint64_t now_us);
+
+/**
+ * @return true once per escalation, the caller should then request a lower bitrate
+ */
+CHIAKI_EXPORT bool chiaki_decode_governor_take_escalation(ChiakiDecodeGovernor *governor);
+
+/**
+ * The bitrate an escalation suggests for a stream at bitrate_kbps.
+ */
+CHIAKI_EXPORT uint32_t chiaki_decode_governor_target_kbps(const ChiakiDecodeGovernor *governor, uint32_t bitrate_kbps);
+
+/**
+ * Smoothed decode time of the decoded frames per frame interval.
+ */
+static inline double chiaki_decode_governor_load(const ChiakiDecodeGovernor *governor)
+{
+	return governor->decode_avg_us / (double)governor->frame_interval_us;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_DECODEGOV_H
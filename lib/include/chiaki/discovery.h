@@ -79,6 +79,11 @@ CHIAKI_EXPORT ChiakiTarget chiaki_discovery_host_system_version_target(ChiakiDis
 
 CHIAKI_EXPORT int chiaki_discovery_packet_fmt(char *buf, size_t buf_size, ChiakiDiscoveryPacket *packet);
 
+/**
+ * Parse a response to SRCH. The string members of response point into buf and addr_buf.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_srch_response_parse(ChiakiDiscoveryHost *response, struct sockaddr *addr, char *addr_buf, size_t addr_buf_size, char *buf, size_t buf_size);
+
 typedef struct chiaki_discovery_t
 {
 	ChiakiLog *log;
@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Asynchronous DNS resolver cache
+ * -------------------------------
+ *
+ * A remote connect resolves the same few PSN and STUN host names over and over, each one on
+ * the connect path. ChiakiDnsCache keeps the answers and resolves on a small pool of worker
+ * threads, so lookups can be started early (chiaki_dns_cache_prefetch()) and later ones are
+ * served from memory.
+ *
+ * - Entries live as long as the TTL the backend reports, clamped to [min_ttl_sec, max_ttl_sec].
+ *   A lookup in the last tenth of the TTL returns the cached answer and refreshes it in the
+ *   background.
+ * - A name the backend reports as nonexistent (no addresses) is cached for negative_ttl_sec.
+ * - If a refresh fails or times out, the previous answer is still returned for up to
+ *   stale_sec after it expired.
+ * - A and AAAA are queried as separate jobs, so with two or more workers they run in parallel.
+ *   Concurrent lookups of the same name wait for the query already in flight.
+ *
+ * The resolver itself is a ChiakiDnsBackend, chiaki_dns_getaddrinfo_backend() where the
+ * platform's getaddrinfo() works.
+ *
+ * All functions are thread-safe.
+ */
+
+#ifndef CHIAKI_DNSCACHE_H
+#define CHIAKI_DNSCACHE_H
+
+#include "common.h"
+#include "log.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_DNS_HOST_MAX 256
+#define CHIAKI_DNS_ADDRS_MAX 8
+#define CHIAKI_DNS_ADDR_STRLEN 46 // INET6_ADDRSTRLEN
+
+typedef enum chiaki_dns_family_t
+{
+	CHIAKI_DNS_FAMILY_IPV4 = 1 << 0, // A
+	CHIAKI_DNS_FAMILY_IPV6 = 1 << 1, // AAAA
+	CHIAKI_DNS_FAMILY_ANY = CHIAKI_DNS_FAMILY_IPV4 | CHIAKI_DNS_FAMILY_IPV6
+} ChiakiDnsFamily;
+
+typedef struct chiaki_dns_addr_t
+{
+	ChiakiDnsFamily family; // CHIAKI_DNS_FAMILY_IPV4 or CHIAKI_DNS_FAMILY_IPV6
+	uint8_t addr[16]; // network byte order, the first 4 bytes for IPv4
+} ChiakiDnsAddr;
+
+/**
+ * Resolve host for one family. Called on a worker thread without any cache lock held.
+ *
+ * @param family CHIAKI_DNS_FAMILY_IPV4 or CHIAKI_DNS_FAMILY_IPV6
+ * @param addrs room for *count addresses, *count is set to the number written
+ * @param ttl_sec set to the TTL of the answer, or left alone to use the cache's default_ttl_sec
+ * @return CHIAKI_ERR_SUCCESS if the query was answered, with *count 0 if the name has no
+ * addresses of that family, any other error if it could not be answered (timeout, no network)
+ */
+typedef ChiakiErrorCode (*ChiakiDnsResolveFunc)(void *user, const char *host, ChiakiDnsFamily family,
+	ChiakiDnsAddr *addrs, size_t *count, uint32_t *ttl_sec);
+
+typedef struct chiaki_dns_backend_t
+{
+	ChiakiDnsResolveFunc resolve;
+	void *user;
+} ChiakiDnsBackend;
+
+typedef struct chiaki_dns_cache_config_t
+{
+	ChiakiDnsBackend backend;
+	ChiakiLog *log;
+	size_t workers;
+	size_t capacity; // names kept, the least recently used one is dropped first
+	uint32_t default_ttl_sec; // for backends that don't report a TTL
+	uint32_t min_ttl_sec;
+	uint32_t max_ttl_sec;
+	uint32_t negative_ttl_sec;
+	uint32_t stale_sec;
+	/**
+	 * Monotonic clock in milliseconds, chiaki_time_now_monotonic_ms() if NULL.
+	 * Tests set this to step through TTLs without sleeping.
+	 */
+	uint64_t (*now_ms)(void *user);
+	void *now_user;
+} ChiakiDnsCacheConfig;
+
+typedef struct chiaki_dns_cache_stats_t
+{
+	uint64_t lookups;
+	uint64_t hits; // answered from a fresh entry without waiting
+	uint64_t negative_hits;
+	uint64_t stale_served; // answered from an expired entry after the refresh failed
+	uint64_t waits; // lookups that had to wait for a query
+	uint64_t coalesced; // waits that joined a query another caller started
+	uint64_t queries; // backend calls, counted once the answer is stored
+	uint64_t failures; // backend calls that returned an error
+	uint64_t prefetches;
+	uint64_t refreshes; // background refreshes near the end of the TTL
+	uint64_t evictions;
+} ChiakiDnsCacheStats;
+
+typedef struct chiaki_dns_cache_t ChiakiDnsCache;
+
+/**
+ * Two workers, 32 names, TTLs clamped to [30 s, 1 h], 30 s negative TTL, 10 min stale window
+ * and chiaki_dns_getaddrinfo_backend() where it is available.
+ */
+CHIAKI_EXPORT void chiaki_dns_cache_config_defaults(ChiakiDnsCacheConfig *config);
+
+/**
+ * @return the cache with its workers running, or NULL if config has no backend or
+ * memory/threads could not be allocated
+ */
+CHIAKI_EXPORT ChiakiDnsCache *chiaki_dns_cache_new(const ChiakiDnsCacheConfig *config);
+
+/**
+ * Stop the workers and free the cache. Waits for queries that are already running.
+ */
+CHIAKI_EXPORT void chiaki_dns_cache_free(ChiakiDnsCache *cache);
+
+/**
+ * Start resolving host for the given families unless a fresh answer is cached or a query is
+ * already running. Does not block.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_dns_cache_prefetch(ChiakiDnsCache *cache, const char *host, uint32_t families);
+
+/**
+ * Resolve host, from the cache if possible.
+ * IPv4 addresses come before IPv6 ones.
+ *
+ * @param families mask of ChiakiDnsFamily
+ * @param addrs room for *count addresses, *count is set to the number written
+ * @param timeout_ms how long to wait for queries that have to run
+ * @return CHIAKI_ERR_SUCCESS with at least one address,
+ * CHIAKI_ERR_HOST_UNREACH if the name has no addresses of the requested families,
+ * CHIAKI_ERR_TIMEOUT if no answer arrived in time and nothing was cached,
+ * the backend's error if the query failed and nothing was cached
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_dns_cache_lookup(ChiakiDnsCache *cache, const char *host, uint32_t families,
+	ChiakiDnsAddr *addrs, size_t *count, uint64_t timeout_ms);
+
+/**
+ * Drop all entries. Queries in flight still complete and are cached.
+ */
+CHIAKI_EXPORT void chiaki_dns_cache_flush(ChiakiDnsCache *cache);
+
+CHIAKI_EXPORT void chiaki_dns_cache_stats(ChiakiDnsCache *cache, ChiakiDnsCacheStats *stats);
+
+/**
+ * Backend resolving through getaddrinfo(), which reports no TTL.
+ * The returned backend has no user data. Not available on the Vita, whose getaddrinfo()
+ * cannot resolve names.
+ *
+ * @return false if the platform has no usable getaddrinfo()
+ */
+CHIAKI_EXPORT bool chiaki_dns_getaddrinfo_backend(ChiakiDnsBackend *backend);
+
+/**
+ * Format addr as text ("192.0.2.1", "2001:db8::1") into out, which must hold CHIAKI_DNS_ADDR_STRLEN.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_dns_addr_format(const ChiakiDnsAddr *addr, char *out, size_t out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_DNSCACHE_H
@@ -5,7 +5,9 @@
 
 #include "common.h"
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 #ifndef _WIN32
 #include <unistd.h>
 #endif
@@ -19,6 +21,95 @@ extern "C" {
 CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_encode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m);
 
+/*
+ * Progressive decoding
+ *
+ * chiaki_fec_decode() does all of its work once enough units are in, on the frame's critical path.
+ * A ChiakiFecDecoder is fed every unit of the frame as it arrives instead. As soon as source units
+ * are missing, it tracks as many fec rows as units are missing and eliminates every received source
+ * unit from them: a fec unit that already arrived is reduced in place, one that is still expected
+ * accumulates the source units' contributions ahead of it. Gaps just behind the highest source unit
+ * are left to reordering, and rows expected for a gap that a late unit fills are dropped again, so
+ * reordered frames without loss track no rows. When the last needed unit arrives, only
+ * the missing source units remain in the tracked rows, and chiaki_fec_decoder_solve() multiplies
+ * them with the inverse of a small matrix, which is cached for the frame's loss pattern.
+ *
+ * The decoder only reads frame_buf, so chiaki_fec_decode() can still decode a frame it gives up on.
+ */
+
+// missing source units decoded progressively, chiaki_fec_decode() takes over beyond
+#define CHIAKI_FEC_DECODER_ERASURES_MAX 16
+#define CHIAKI_FEC_DECODER_INVERSES_MAX 16
+
+// k + m
+#define CHIAKI_FEC_DECODER_UNITS_MAX 256
+
+typedef struct chiaki_fec_inverse_t
+{
+	unsigned int k;
+	unsigned int m;
+	unsigned int count; // 0 for an unused entry
+	uint8_t rows[CHIAKI_FEC_DECODER_ERASURES_MAX]; // fec rows, ascending
+	uint8_t cols[CHIAKI_FEC_DECODER_ERASURES_MAX]; // missing source units, ascending
+	uint8_t inverse[CHIAKI_FEC_DECODER_ERASURES_MAX * CHIAKI_FEC_DECODER_ERASURES_MAX];
+	uint64_t used;
+} ChiakiFecInverse;
+
+typedef struct chiaki_fec_decoder_t
+{
+	unsigned int k;
+	unsigned int m;
+	size_t unit_size;
+	size_t stride;
+
+	int *matrix; // m x k coding matrix, kept while k and m don't change
+	unsigned int matrix_k;
+	unsigned int matrix_m;
+
+	uint8_t received[CHIAKI_FEC_DECODER_UNITS_MAX / 8];
+	unsigned int source_received;
+	unsigned int source_end; // 1 + the highest source unit received
+	int fec_last; // highest fec row received, -1 before the first
+	bool gave_up; // more source units missing than can be tracked
+
+	unsigned int rows_count;
+	uint8_t rows[CHIAKI_FEC_DECODER_ERASURES_MAX];
+	bool rows_arrived[CHIAKI_FEC_DECODER_ERASURES_MAX];
+	uint8_t *rows_buf[CHIAKI_FEC_DECODER_ERASURES_MAX]; // into buf
+	uint8_t *buf;
+	size_t buf_stride;
+
+	ChiakiFecInverse inverses[CHIAKI_FEC_DECODER_INVERSES_MAX];
+	uint64_t inverses_tick;
+
+	uint64_t frames_solved;
+	uint64_t inverse_hits;
+	uint64_t inverse_misses;
+} ChiakiFecDecoder;
+
+CHIAKI_EXPORT void chiaki_fec_decoder_init(ChiakiFecDecoder *decoder);
+CHIAKI_EXPORT void chiaki_fec_decoder_fini(ChiakiFecDecoder *decoder);
+
+/**
+ * Start a frame of k source and m fec units, laid out in frame_buf as for chiaki_fec_decode().
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decoder_frame_begin(ChiakiFecDecoder *decoder, size_t unit_size, size_t stride, unsigned int k, unsigned int m);
+
+/**
+ * Account for unit index, which has just been written to frame_buf. Every unit must be put at most once.
+ */
+CHIAKI_EXPORT void chiaki_fec_decoder_put(ChiakiFecDecoder *decoder, const uint8_t *frame_buf, unsigned int index);
+
+/**
+ * Write the missing source units to frame_buf.
+ *
+ * frame_buf is only written on success, so chiaki_fec_decode() can take over after any error.
+ *
+ * @return CHIAKI_ERR_UNINITIALIZED if the decoder did not track enough fec units for the frame,
+ * which chiaki_fec_decode() may still be able to decode
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decoder_solve(ChiakiFecDecoder *decoder, uint8_t *frame_buf);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,6 +5,7 @@
 
 #include "common.h"
 #include "takion.h"
+#include "fec.h"
 #include "packetstats.h"
 
 #include <stdint.h>
@@ -29,6 +30,9 @@ CHIAKI_EXPORT void chiaki_stream_stats_reset(ChiakiStreamStats *stats);
 CHIAKI_EXPORT void chiaki_stream_stats_frame(ChiakiStreamStats *stats, uint64_t size);
 CHIAKI_EXPORT uint64_t chiaki_stream_stats_bitrate(ChiakiStreamStats *stats, uint64_t framerate);
 
+// source + fec units of one frame
+#define CHIAKI_FRAME_PROCESSOR_UNITS_MAX 256
+
 struct chiaki_frame_unit_t;
 typedef struct chiaki_frame_unit_t ChiakiFrameUnit;
 
@@ -37,16 +41,19 @@ typedef struct chiaki_frame_processor_t
 	ChiakiLog *log;
 	uint8_t *frame_buf;
 	size_t frame_buf_size;
+	uint32_t frame_buf_realloc_n; // for PIPE/FRAMEBUF_REALLOC
 	size_t buf_size_per_unit;
 	size_t buf_stride_per_unit;
 	unsigned int units_source_expected;
 	unsigned int units_fec_expected;
 	unsigned int units_source_received;
 	unsigned int units_fec_received;
-	ChiakiFrameUnit *unit_slots;
+	ChiakiFrameUnit *unit_slots; // only valid where units_received is set
 	size_t unit_slots_size;
+	uint64_t units_received[CHIAKI_FRAME_PROCESSOR_UNITS_MAX / 64]; // received or recovered
 	bool flushed; // whether we have already flushed the current frame, i.e. are only interested in stats, not data.
 	ChiakiStreamStats stream_stats;
+	ChiakiFecDecoder fec_decoder;
 } ChiakiFrameProcessor;
 
 typedef enum chiaki_frame_flush_result_t {
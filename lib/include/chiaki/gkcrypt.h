@@ -6,6 +6,8 @@
 #include "common.h"
 #include "log.h"
 #include "thread.h"
+#include "workerpool.h"
+#include "costacct.h"
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -38,6 +40,9 @@ typedef struct chiaki_gkcrypt_t {
 	ChiakiMutex key_buf_mutex;
 	ChiakiCond key_buf_cond;
 	ChiakiThread key_buf_thread;
+	ChiakiWorkerPool *key_buf_pool; // if set, the key stream is generated by key_buf_job instead of key_buf_thread
+	ChiakiWorkerJob key_buf_job;
+	ChiakiCostAcct *cost_acct; // of the thread that initialized it, charged for key stream generation
 
 	uint8_t iv[CHIAKI_GKCRYPT_BLOCK_SIZE];
 	uint8_t key_base[CHIAKI_GKCRYPT_BLOCK_SIZE];
@@ -54,6 +59,12 @@ struct chiaki_session_t;
  */
 CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret);
 
+/**
+ * Like chiaki_gkcrypt_init(), but if pool is not NULL, the ctr mode key stream is generated by jobs on pool
+ * charged to account instead of by a thread of its own.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init_pool(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, ChiakiWorkerPool *pool, ChiakiWorkerAccount *account, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret);
+
 CHIAKI_EXPORT void chiaki_gkcrypt_fini(ChiakiGKCrypt *gkcrypt);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gen_key_stream(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_get_key_stream(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, uint8_t *buf, size_t buf_size);
@@ -64,12 +75,12 @@ CHIAKI_EXPORT void chiaki_gkcrypt_gen_new_gmac_key(ChiakiGKCrypt *gkcrypt, uint6
 CHIAKI_EXPORT void chiaki_gkcrypt_gen_tmp_gmac_key(ChiakiGKCrypt *gkcrypt, uint64_t index, uint8_t *key_out);
 CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gmac(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, const uint8_t *buf, size_t buf_size, uint8_t *gmac_out);
 
-static inline ChiakiGKCrypt *chiaki_gkcrypt_new(ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
+static inline ChiakiGKCrypt *chiaki_gkcrypt_new_pool(ChiakiLog *log, size_t key_buf_chunks, ChiakiWorkerPool *pool, ChiakiWorkerAccount *account, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
 {
 	ChiakiGKCrypt *gkcrypt = CHIAKI_NEW(ChiakiGKCrypt);
 	if(!gkcrypt)
 		return NULL;
-	ChiakiErrorCode err = chiaki_gkcrypt_init(gkcrypt, log, key_buf_chunks, index, handshake_key, ecdh_secret);
+	ChiakiErrorCode err = chiaki_gkcrypt_init_pool(gkcrypt, log, key_buf_chunks, pool, account, index, handshake_key, ecdh_secret);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		free(gkcrypt);
@@ -78,6 +89,11 @@ static inline ChiakiGKCrypt *chiaki_gkcrypt_new(ChiakiLog *log, size_t key_buf_c
 	return gkcrypt;
 }
 
+static inline ChiakiGKCrypt *chiaki_gkcrypt_new(ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
+{
+	return chiaki_gkcrypt_new_pool(log, key_buf_chunks, NULL, NULL, index, handshake_key, ecdh_secret);
+}
+
 static inline void chiaki_gkcrypt_free(ChiakiGKCrypt *gkcrypt)
 {
 	if(!gkcrypt)
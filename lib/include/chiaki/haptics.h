@@ -0,0 +1,227 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Haptics
+ * -------
+ *
+ * The PS5 sends the DualSense's voice coil haptics as its own AV stream, in the packet layout of
+ * the audio: every packet carries source units, each one frame, and FEC units, which are copies of
+ * the frames before. A frame is 64 bytes of interleaved signed 8 bit stereo samples at 3 kHz, the
+ * waveforms driving the left and right actuator, 10.67 ms per frame.
+ *
+ * Haptics are felt, not heard: a frame that arrives late is worse than one that never arrives,
+ * and a frame that has to wait for the one before it may only wait for so long. The receiver
+ * therefore:
+ *
+ * - delivers frames in order. A frame after a gap is held for at most reorder_us, for the gap to
+ *   be filled by a late packet or the FEC copies of the next one, then the gap is given up.
+ * - drops frames that are more than latency_budget_us behind the stream or after their arrival
+ *   when they would be delivered, instead of playing them late. Frames carry no timestamps, so
+ *   the stream's clock is the frame index times the frame duration, offset by the lowest arrival -
+ *   media time over the last 2 s: when a frame would have arrived without any queueing on the way.
+ *   This catches frames held for a gap as well as the burst a stalled network lets through at once.
+ * - decodes every delivered frame into an amplitude envelope per actuator and maps it, together
+ *   with the vibration of the adaptive trigger effects, to the strengths of two rumble motors, for
+ *   controllers without voice coils or adaptive triggers.
+ *
+ * Every frame carries the time its packet arrived, so the latency from arrival to delivery is
+ * known and the frontend can report when it actuated an event to measure arrival to actuation.
+ *
+ * Frames, trigger effects, polls and resets have to come from one thread, the Takion thread in a
+ * session. The sinks are called on that thread, without the receiver's lock held. Stats, config
+ * changes and actuation reports may come from any thread. All times are passed in by the caller
+ * as monotonic microseconds, so the receiver can be run on recorded packet streams.
+ */
+
+#ifndef CHIAKI_HAPTICS_H
+#define CHIAKI_HAPTICS_H
+
+#include "common.h"
+#include "log.h"
+#include "seqnum.h"
+#include "takion.h"
+#include "audioreceiver.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_HAPTICS_SAMPLE_RATE 3000
+#define CHIAKI_HAPTICS_FRAME_SIZE 64
+#define CHIAKI_HAPTICS_FRAME_SAMPLES 32 // per actuator
+#define CHIAKI_HAPTICS_FRAME_US 10667
+#define CHIAKI_HAPTICS_ENVELOPE_POINTS 4
+#define CHIAKI_HAPTICS_POINT_US (CHIAKI_HAPTICS_FRAME_US / CHIAKI_HAPTICS_ENVELOPE_POINTS)
+#define CHIAKI_HAPTICS_LATENCY_BUCKETS 64
+#define CHIAKI_HAPTICS_LATENCY_BUCKET_US 1000
+
+typedef struct chiaki_haptics_config_t
+{
+	uint64_t reorder_us; // how long a frame after a gap is held for the gap to be filled
+	uint64_t latency_budget_us; // frames further behind the stream's clock are dropped instead of delivered
+	uint8_t gate; // envelope amplitudes up to this are silence
+	uint8_t motor_min; // weakest motor strength that is still felt, amplitudes above gate start here
+	uint16_t gain_percent; // of the envelope on the motors
+	uint16_t trigger_gain_percent; // of the trigger effects' vibration on the motors
+} ChiakiHapticsConfig;
+
+/**
+ * Amplitudes of one frame, 0 to 255, each point the peak of CHIAKI_HAPTICS_POINT_US of samples
+ * followed with a release of about 10 ms, so that slow waveforms don't flicker between points.
+ */
+typedef struct chiaki_haptics_envelope_t
+{
+	uint8_t left[CHIAKI_HAPTICS_ENVELOPE_POINTS];
+	uint8_t right[CHIAKI_HAPTICS_ENVELOPE_POINTS];
+} ChiakiHapticsEnvelope;
+
+/**
+ * Level of the envelope follower, carried from frame to frame.
+ */
+typedef struct chiaki_haptics_follower_t
+{
+	uint32_t level[2]; // left, right, amplitude << 8
+} ChiakiHapticsFollower;
+
+typedef struct chiaki_haptics_rumble_t
+{
+	uint8_t left; // low-frequency motor
+	uint8_t right; // high-frequency motor
+} ChiakiHapticsRumble;
+
+typedef struct chiaki_haptics_event_t
+{
+	bool has_frame; // false if only the trigger effects changed, the envelope is then all zero
+	ChiakiSeqNum16 frame_index;
+	uint64_t arrival_us; // of the packet carrying the frame, or of the trigger effects
+	uint64_t delivered_us;
+	ChiakiHapticsEnvelope envelope;
+	uint8_t trigger_left; // vibration of the trigger effects, see chiaki_haptics_trigger_intensity()
+	uint8_t trigger_right;
+	ChiakiHapticsRumble rumble[CHIAKI_HAPTICS_ENVELOPE_POINTS]; // each for CHIAKI_HAPTICS_POINT_US, the last one until the next event
+} ChiakiHapticsEvent;
+
+typedef void (*ChiakiHapticsSinkEvent)(const ChiakiHapticsEvent *event, void *user);
+
+/**
+ * Sink that receives the decoded haptics, e.g. to drive the rumble motors of a controller
+ * without voice coils. The raw frames keep going to the session's haptics sink.
+ */
+typedef struct chiaki_haptics_sink_t
+{
+	void *user;
+	ChiakiHapticsSinkEvent event_cb;
+} ChiakiHapticsSink;
+
+typedef struct chiaki_haptics_latency_t
+{
+	uint64_t count;
+	uint64_t mean_us;
+	uint64_t p50_us; // upper bound of the CHIAKI_HAPTICS_LATENCY_BUCKET_US bucket
+	uint64_t p99_us;
+	uint64_t max_us;
+} ChiakiHapticsLatency;
+
+typedef struct chiaki_haptics_stats_t
+{
+	uint64_t frames; // delivered
+	uint64_t redundant; // FEC copies and duplicates of frames already delivered
+	uint64_t reordered; // arrived after a gap and held
+	uint64_t recovered; // filled a gap while a later frame was held
+	uint64_t lost; // gaps given up
+	uint64_t late_dropped; // over the latency budget, or arrived after their gap was given up
+	uint64_t undecodable; // delivered raw, but not CHIAKI_HAPTICS_FRAME_SIZE
+	uint64_t restarts; // frames far behind the stream, which started over from them
+	uint64_t trigger_effects;
+	ChiakiHapticsLatency delivery; // arrival to delivery
+	ChiakiHapticsLatency lateness; // behind the stream's clock at delivery
+	ChiakiHapticsLatency actuation; // arrival to actuation, see chiaki_haptics_receiver_actuated()
+} ChiakiHapticsStats;
+
+typedef struct chiaki_haptics_receiver_t ChiakiHapticsReceiver;
+
+/**
+ * Hold for 12 ms, a frame and some jitter, drop frames 40 ms behind, gate at 8, motors from 40,
+ * full gain on the envelope and 60% on the trigger effects.
+ */
+CHIAKI_EXPORT void chiaki_haptics_config_defaults(ChiakiHapticsConfig *config);
+
+/**
+ * @param config NULL for chiaki_haptics_config_defaults()
+ * @param frame_sink receives the raw frames, read on every frame, so it may be changed until frames come in
+ * @param sink receives the events, same as frame_sink
+ */
+CHIAKI_EXPORT ChiakiHapticsReceiver *chiaki_haptics_receiver_new(ChiakiLog *log, const ChiakiHapticsConfig *config,
+	const ChiakiAudioSink *frame_sink, const ChiakiHapticsSink *sink);
+CHIAKI_EXPORT void chiaki_haptics_receiver_free(ChiakiHapticsReceiver *receiver);
+
+/**
+ * Forget the stream and the trigger effects, e.g. when a new stream connection starts.
+ * Stats are kept.
+ */
+CHIAKI_EXPORT void chiaki_haptics_receiver_reset(ChiakiHapticsReceiver *receiver);
+
+CHIAKI_EXPORT void chiaki_haptics_receiver_set_config(ChiakiHapticsReceiver *receiver, const ChiakiHapticsConfig *config);
+
+/**
+ * A haptics packet was received and decrypted.
+ */
+CHIAKI_EXPORT void chiaki_haptics_receiver_av_packet(ChiakiHapticsReceiver *receiver, ChiakiTakionAVPacket *packet, uint64_t arrival_us);
+
+/**
+ * The trigger effects changed. Emits an event without a frame if their vibration did.
+ *
+ * @param left,right the 10 parameter bytes of each effect
+ */
+CHIAKI_EXPORT void chiaki_haptics_receiver_trigger_effects(ChiakiHapticsReceiver *receiver,
+	uint8_t type_left, const uint8_t *left, uint8_t type_right, const uint8_t *right, uint64_t arrival_us);
+
+/**
+ * Give up gaps that held frames for longer than reorder_us, delivering what follows them.
+ * Frames and trigger effects poll as well. A stream connection calls it on every tick of its
+ * Takion thread.
+ */
+CHIAKI_EXPORT void chiaki_haptics_receiver_poll(ChiakiHapticsReceiver *receiver, uint64_t now_us);
+
+/**
+ * The frontend actuated an event now, records its arrival to actuation latency.
+ */
+CHIAKI_EXPORT void chiaki_haptics_receiver_actuated(ChiakiHapticsReceiver *receiver, const ChiakiHapticsEvent *event, uint64_t now_us);
+
+CHIAKI_EXPORT void chiaki_haptics_receiver_stats(ChiakiHapticsReceiver *receiver, ChiakiHapticsStats *stats);
+
+/**
+ * Decode a frame into its envelope.
+ *
+ * @param follower carried from the previous frame, zero to start
+ * @return CHIAKI_ERR_INVALID_DATA if buf_size is not CHIAKI_HAPTICS_FRAME_SIZE
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_haptics_envelope_decode(ChiakiHapticsFollower *follower, const uint8_t *buf, size_t buf_size, ChiakiHapticsEnvelope *envelope);
+
+/**
+ * How strongly an adaptive trigger effect vibrates, 0 to 255. Only the vibration effects count,
+ * 0x06 with the amplitude 0 to 8 in params[1], and 0x26 with the strongest of the 3 bit strengths
+ * in params[2..5] of the zones active in params[0..1], at a frequency in params[8] other than 0.
+ * Resistance effects can't be felt on a motor and are 0.
+ *
+ * @param params the 10 parameter bytes of the effect
+ */
+CHIAKI_EXPORT uint8_t chiaki_haptics_trigger_intensity(uint8_t type, const uint8_t *params);
+
+/**
+ * Map the envelope of a frame and the trigger effects' vibration to the rumble motors: each
+ * actuator's amplitude is gated, scaled by gain_percent and moved above motor_min, then mixed
+ * with its trigger's vibration by taking the stronger of both.
+ */
+CHIAKI_EXPORT void chiaki_haptics_rumble_map(const ChiakiHapticsConfig *config, const ChiakiHapticsEnvelope *envelope,
+	uint8_t trigger_left, uint8_t trigger_right, ChiakiHapticsRumble *rumble);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_HAPTICS_H
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Streaming JSON field scanner
+ * ----------------------------
+ *
+ * Pulls a handful of fields out of a JSON document in a single pass without building a tree
+ * or allocating. Fields are named by dot-separated paths, array elements by their index, e.g.
+ * "body.data.members.0.deviceUniqueId". Subtrees that no path leads into are skipped without
+ * looking at their keys, and the scan stops as soon as every path has been found.
+ *
+ * Values are returned as slices of the input. String slices exclude the quotes and are still
+ * escaped, use chiaki_json_unescape() to decode them.
+ *
+ * The scanner is a little more lenient than the JSON grammar: a key directly followed by ','
+ * or '}' without a value, which PSN sends for some session message fields, is read as null.
+ * Keys are compared byte by byte, so a path can't match a key written with escapes or
+ * containing '.'.
+ *
+ * A response arriving in pieces, e.g. through a curl write callback, can be collected with a
+ * ChiakiJsonFeed into a fixed buffer. The feed tracks string and bracket state over each new
+ * chunk only, so it knows when the document is complete without rescanning what it already has.
+ */
+
+#ifndef CHIAKI_JSONSCAN_H
+#define CHIAKI_JSONSCAN_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_JSON_SCAN_PATHS_MAX 32
+#define CHIAKI_JSON_SCAN_DEPTH_MAX 32
+
+typedef enum chiaki_json_type_t
+{
+	CHIAKI_JSON_TYPE_NONE = 0, // path not found
+	CHIAKI_JSON_TYPE_NULL,
+	CHIAKI_JSON_TYPE_BOOL,
+	CHIAKI_JSON_TYPE_NUMBER,
+	CHIAKI_JSON_TYPE_STRING,
+	CHIAKI_JSON_TYPE_OBJECT,
+	CHIAKI_JSON_TYPE_ARRAY
+} ChiakiJsonType;
+
+typedef struct chiaki_json_value_t
+{
+	ChiakiJsonType type;
+	const char *ptr; // into the scanned document
+	size_t len;
+	bool escaped; // string contains escape sequences
+} ChiakiJsonValue;
+
+typedef struct chiaki_json_feed_t
+{
+	char *buf;
+	size_t size;
+	size_t len; // buf[len] is always 0
+	size_t checked; // bytes seen by the completion tracking
+	size_t depth;
+	bool in_string;
+	bool escape;
+	bool complete;
+	bool truncated;
+	bool invalid;
+} ChiakiJsonFeed;
+
+/**
+ * Find the values of paths in json.
+ *
+ * @param values one per path, type is CHIAKI_JSON_TYPE_NONE for paths that were not found
+ * @return CHIAKI_ERR_SUCCESS, also if some paths were not found, CHIAKI_ERR_INVALID_DATA if the
+ *         document is malformed before the last path was found, CHIAKI_ERR_OVERFLOW for more
+ *         than CHIAKI_JSON_SCAN_PATHS_MAX paths
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_json_scan(const char *json, size_t json_len, const char *const *paths, ChiakiJsonValue *values, size_t count);
+
+/**
+ * Decode a string value into out as UTF-8 and zero-terminate it.
+ *
+ * @param out_len optional, receives the decoded length without the terminator
+ * @return CHIAKI_ERR_BUF_TOO_SMALL if out can't hold the result, CHIAKI_ERR_INVALID_DATA for a
+ *         non-string value or a broken escape sequence
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_json_unescape(const ChiakiJsonValue *value, char *out, size_t out_size, size_t *out_len);
+
+/**
+ * @return true if value is a string equal to str after decoding
+ */
+CHIAKI_EXPORT bool chiaki_json_value_streq(const ChiakiJsonValue *value, const char *str);
+
+/**
+ * Read an integral number value.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_json_value_int64(const ChiakiJsonValue *value, int64_t *out);
+
+/**
+ * Collect a document into buf, which keeps one byte for the terminator. Nothing is allocated.
+ */
+CHIAKI_EXPORT void chiaki_json_feed_init(ChiakiJsonFeed *feed, char *buf, size_t size);
+
+/**
+ * Append a chunk of the document.
+ *
+ * @return CHIAKI_ERR_BUF_TOO_SMALL if the chunk did not fit and its end was dropped, the feed
+ *         stays truncated from then on, CHIAKI_ERR_INVALID_DATA for a closing bracket that
+ *         closes nothing
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_json_feed_append(ChiakiJsonFeed *feed, const void *data, size_t len);
+
+/**
+ * @return true once the top-level object or array has been closed
+ */
+static inline bool chiaki_json_feed_complete(const ChiakiJsonFeed *feed)
+{
+	return feed->complete;
+}
+
+/**
+ * chiaki_json_scan() over what has been fed so far. On an incomplete document, the paths found
+ * before its end are filled in and CHIAKI_ERR_INVALID_DATA is returned unless all were found.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_json_feed_scan(const ChiakiJsonFeed *feed, const char *const *paths, ChiakiJsonValue *values, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_JSONSCAN_H
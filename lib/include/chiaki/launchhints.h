@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * LaunchSpec network hints
+ * ------------------------
+ *
+ * The LaunchSpec tells the console about the link before the stream starts: bwKbpsSent, bwLoss,
+ * mtu and rtt. The console's encoder rate control starts from them, so hints that promise more
+ * than the link delivers show up as loss in the first seconds of the stream, until the congestion
+ * reports have walked the encoder down.
+ *
+ * The hints are derived from what is known about the link at the time the LaunchSpec is sent:
+ *
+ * - mtu/rtt:   the Senkusha results of this session, or the hints it was started with.
+ * - history:   early-stream loss and throughput of earlier sessions with the same console,
+ *              kept in its connection profile, see connprofile.h.
+ *
+ * and a policy, which the client picks per latency mode:
+ *
+ * - bw_kbps:   the requested bitrate. If the history saw more loss than loss_cap_threshold, at
+ *              most bw_headroom of its throughput, but not below bw_min_kbps. A history without
+ *              loss never lowers it, the throughput of a clean link only says what the encoder
+ *              chose to send.
+ * - bw_loss:   the history's loss times loss_scale within [loss_min, loss_max], loss_default
+ *              without history.
+ * - rtt:       the rtt in ms, plus rtt_margin_ms.
+ *
+ * A zeroed policy sends what the LaunchSpec always sent: the requested bitrate and a loss of
+ * CHIAKI_LAUNCH_HINTS_LOSS_DEFAULT.
+ */
+
+#ifndef CHIAKI_LAUNCHHINTS_H
+#define CHIAKI_LAUNCHHINTS_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_LAUNCH_HINTS_LOSS_DEFAULT 0.001
+
+typedef struct chiaki_link_history_t
+{
+	uint32_t sessions; // observations merged, 0 if nothing is known
+	double loss; // smoothed early-stream packet loss, 0..1
+	uint32_t throughput_kbps; // smoothed early-stream throughput
+} ChiakiLinkHistory;
+
+/**
+ * Merge what the first seconds of a stream showed. The first observations are averaged, later
+ * ones weigh 1/4, so a link that changed is followed within a few sessions.
+ */
+CHIAKI_EXPORT void chiaki_link_history_observe(ChiakiLinkHistory *history, double loss, uint32_t throughput_kbps);
+
+typedef struct chiaki_launch_hints_policy_t
+{
+	double bw_headroom; // share of the history's throughput claimed on a lossy link, 0 to never lower the bitrate
+	double loss_cap_threshold; // history loss above which the bitrate is lowered
+	uint32_t bw_min_kbps;
+	double loss_default; // without history, 0 for CHIAKI_LAUNCH_HINTS_LOSS_DEFAULT
+	double loss_scale; // history loss is reported this much higher, 0 to ignore the history's loss
+	double loss_min;
+	double loss_max;
+	uint32_t rtt_margin_ms;
+} ChiakiLaunchHintsPolicy;
+
+/**
+ * Balanced: 90% of the throughput above 2% loss, at least 2 Mbps, loss reported 1.5 times within
+ * [0.1%, 5%], no rtt margin.
+ */
+CHIAKI_EXPORT void chiaki_launch_hints_policy_defaults(ChiakiLaunchHintsPolicy *policy);
+
+typedef enum chiaki_launch_hints_source_t
+{
+	CHIAKI_LAUNCH_HINTS_SOURCE_LINK_MEASURED = 1 << 0, // mtu/rtt from Senkusha in this session
+	CHIAKI_LAUNCH_HINTS_SOURCE_HISTORY = 1 << 1, // the history was used for bw_loss or bw_kbps
+	CHIAKI_LAUNCH_HINTS_SOURCE_BW_CAPPED = 1 << 2 // bw_kbps is below the requested bitrate
+} ChiakiLaunchHintsSource;
+
+typedef struct chiaki_launch_hints_t
+{
+	unsigned int bw_kbps;
+	double bw_loss;
+	unsigned int mtu;
+	unsigned int rtt_ms;
+	uint32_t sources; // mask of ChiakiLaunchHintsSource
+} ChiakiLaunchHints;
+
+/**
+ * @param history NULL or without sessions if nothing is known
+ * @param requested_kbps the bitrate of the requested video profile
+ */
+CHIAKI_EXPORT void chiaki_launch_hints_derive(const ChiakiLaunchHintsPolicy *policy, const ChiakiLinkHistory *history,
+	unsigned int requested_kbps, uint32_t mtu, uint64_t rtt_us, bool link_measured, ChiakiLaunchHints *hints);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_LAUNCHHINTS_H
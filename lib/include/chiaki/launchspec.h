@@ -23,6 +23,7 @@ typedef struct chiaki_launch_spec_t
 	unsigned int max_fps;
 	ChiakiCodec codec;
 	unsigned int bw_kbps_sent;
+	double bw_loss; // expected packet loss, 0..1
 } ChiakiLaunchSpec;
 
 CHIAKI_EXPORT int chiaki_launchspec_format(char *buf, size_t buf_size, ChiakiLaunchSpec *launch_spec);
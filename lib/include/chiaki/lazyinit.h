@@ -0,0 +1,151 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Lazy initialization
+ * -------------------
+ *
+ * Subsystems that are not needed for the first interactive frame are registered as units
+ * instead of being initialized eagerly at launch. Each unit declares the units it depends on
+ * and when it should run:
+ *
+ * - ON_DEMAND:  on the first chiaki_lazy_init_require() of it or of a unit depending on it.
+ * - BACKGROUND: on the thread started by chiaki_lazy_init_start(), in the order added.
+ * - IDLE:       by chiaki_lazy_init_run_idle() on the thread calling it, one at a time,
+ *               for work that has to stay on e.g. the UI thread but can wait for its first
+ *               frame.
+ *
+ * Whatever the mode, chiaki_lazy_init_require() initializes a unit and its dependencies right
+ * away on the calling thread, or waits for the thread that is already initializing it. Every
+ * unit is initialized exactly once, dependencies first. A unit whose init or dependency
+ * failed stays failed and reports that error.
+ *
+ * Dependencies can only name units that were added before, so the graph can't have cycles.
+ * BACKGROUND units can't depend on IDLE ones, the background thread would have to wait for
+ * the thread doing the IDLE work.
+ *
+ * With a ChiakiStartupProf, every init is recorded as a span named after the unit, on the
+ * lane of the thread that ran it.
+ */
+
+#ifndef CHIAKI_LAZYINIT_H
+#define CHIAKI_LAZYINIT_H
+
+#include "common.h"
+#include "startupprof.h"
+#include "thread.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_LAZY_INIT_UNITS_MAX 32
+#define CHIAKI_LAZY_INIT_DEP(id) (1u << (id))
+
+typedef enum chiaki_lazy_init_mode_t
+{
+	CHIAKI_LAZY_INIT_ON_DEMAND,
+	CHIAKI_LAZY_INIT_BACKGROUND,
+	CHIAKI_LAZY_INIT_IDLE
+} ChiakiLazyInitMode;
+
+typedef enum chiaki_lazy_unit_state_t
+{
+	CHIAKI_LAZY_UNIT_PENDING,
+	CHIAKI_LAZY_UNIT_RUNNING,
+	CHIAKI_LAZY_UNIT_DONE,
+	CHIAKI_LAZY_UNIT_FAILED
+} ChiakiLazyUnitState;
+
+typedef ChiakiErrorCode (*ChiakiLazyInitFunc)(void *user);
+typedef void (*ChiakiLazyFiniFunc)(void *user);
+
+typedef struct chiaki_lazy_unit_t
+{
+	const char *name; // not copied
+	ChiakiLazyInitMode mode;
+	uint32_t deps; // CHIAKI_LAZY_INIT_DEP() of the units this one needs
+	ChiakiLazyInitFunc init;
+	ChiakiLazyFiniFunc fini; // may be NULL
+	void *user;
+} ChiakiLazyUnit;
+
+typedef struct chiaki_lazy_unit_slot_t
+{
+	ChiakiLazyUnit unit;
+	ChiakiLazyUnitState state;
+	ChiakiErrorCode err;
+	uint64_t init_us;
+} ChiakiLazyUnitSlot;
+
+typedef struct chiaki_lazy_init_t
+{
+	ChiakiStartupProf *prof;
+	ChiakiMutex mutex;
+	ChiakiCond cond;
+	ChiakiLazyUnitSlot units[CHIAKI_LAZY_INIT_UNITS_MAX];
+	size_t units_count;
+	unsigned done_order[CHIAKI_LAZY_INIT_UNITS_MAX]; // for fini in reverse
+	size_t done_count;
+	uint64_t wait_us; // spent in chiaki_lazy_init_require() waiting for other threads
+	ChiakiThread thread;
+	bool thread_started;
+	bool stop;
+} ChiakiLazyInit;
+
+/**
+ * @param prof may be NULL
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_lazy_init_init(ChiakiLazyInit *li, ChiakiStartupProf *prof);
+
+/**
+ * Stop the background thread after the unit it is at, then fini all initialized units in
+ * the reverse order of their init.
+ */
+CHIAKI_EXPORT void chiaki_lazy_init_fini(ChiakiLazyInit *li);
+
+/**
+ * @param id set to the id of the unit, which is the number of units added before
+ * @return CHIAKI_ERR_OVERFLOW if CHIAKI_LAZY_INIT_UNITS_MAX units were added already,
+ * CHIAKI_ERR_INVALID_DATA if unit has no init, depends on a unit that was not added yet or is
+ * BACKGROUND and depends on an IDLE unit
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_lazy_init_add(ChiakiLazyInit *li, const ChiakiLazyUnit *unit, unsigned *id);
+
+/**
+ * Start initializing the BACKGROUND units on a HOUSEKEEPING thread.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_lazy_init_start(ChiakiLazyInit *li);
+
+/**
+ * Wait until the background thread has gone through all BACKGROUND units.
+ */
+CHIAKI_EXPORT void chiaki_lazy_init_wait(ChiakiLazyInit *li);
+
+/**
+ * Make sure unit id is initialized, initializing it and its dependencies on this thread or
+ * waiting for the thread that is already at it.
+ *
+ * @return the error of the init of the unit or of its first failed dependency
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_lazy_init_require(ChiakiLazyInit *li, unsigned id);
+
+/**
+ * Initialize the first pending IDLE unit on this thread.
+ *
+ * @return true if there was one, false if no IDLE unit is pending any more
+ */
+CHIAKI_EXPORT bool chiaki_lazy_init_run_idle(ChiakiLazyInit *li);
+
+CHIAKI_EXPORT ChiakiLazyUnitState chiaki_lazy_init_state(ChiakiLazyInit *li, unsigned id);
+
+CHIAKI_EXPORT const char *chiaki_lazy_unit_state_string(ChiakiLazyUnitState state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_LAZYINIT_H
@@ -0,0 +1,139 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Pre-decode bitstream conformance check
+ * --------------------------------------
+ *
+ * An access unit that is malformed or truncated is otherwise only noticed when the decoder fails
+ * on it, after a full decode attempt that may already have damaged its reference state. The
+ * checker walks an assembled H.264 or H.265 access unit in Annex B format before it is submitted:
+ *
+ * - start codes and emulation prevention: a byte scan, skipping eight bytes at once where none
+ *   of them can end a start code or an escape, and three where the third can't, classifies the
+ *   zero runs with a table. Inside a NAL
+ *   unit, 00 00 00 and 00 00 02 must not occur and 00 00 03 must be followed by a byte up to 03.
+ * - NAL headers: forbidden_zero_bit, NAL unit types reserved or not used by the stream, and for
+ *   H.264 nal_ref_idc, for H.265 nuh_layer_id and TemporalId, against the unit type.
+ * - parameter sets: SPS and PPS in the stream, or in the header of the video profile passed
+ *   through the checker, are parsed and remembered. Those that fail the range checks are not.
+ * - slice headers: the PPS and SPS a slice refers to, the ranges of the fields up to the slice
+ *   type, the picture order count, and the first macroblock or slice segment address against the
+ *   picture size. The first slice has to start the picture, the others have to follow in order.
+ *   The fields that name the picture, e.g. frame_num, have to agree between the slices.
+ *
+ * Slices are checked against the parameter sets only once any were seen, until then only the
+ * structure is checked. The result is a verdict and the extent of the damage:
+ *
+ * - OK: nothing wrong was found.
+ * - DAMAGED: the access unit is fine up to valid_size, which contains at least the first slice
+ *   of the picture. Decoding that part leaves the rest of the picture to concealment.
+ * - MALFORMED: nothing of it should be submitted.
+ */
+
+#ifndef CHIAKI_NALCHECK_H
+#define CHIAKI_NALCHECK_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_NAL_CHECK_SPS_MAX 32 // H.264 allows 32, H.265 16
+#define CHIAKI_NAL_CHECK_PPS_MAX 256 // H.264 allows 256, H.265 64
+
+typedef enum chiaki_nal_check_verdict_t
+{
+	CHIAKI_NAL_CHECK_OK,
+	CHIAKI_NAL_CHECK_DAMAGED,
+	CHIAKI_NAL_CHECK_MALFORMED,
+	CHIAKI_NAL_CHECK_VERDICT_COUNT
+} ChiakiNalCheckVerdict;
+
+typedef enum chiaki_nal_check_error_t
+{
+	CHIAKI_NAL_CHECK_ERROR_NONE,
+	CHIAKI_NAL_CHECK_ERROR_NO_START_CODE, // data before the first start code, or none at all
+	CHIAKI_NAL_CHECK_ERROR_EMULATION, // a zero run a NAL unit must not contain
+	CHIAKI_NAL_CHECK_ERROR_NAL_HEADER, // forbidden bit, layer or temporal id
+	CHIAKI_NAL_CHECK_ERROR_NAL_TYPE, // reserved, unspecified, or a reference indication the type forbids
+	CHIAKI_NAL_CHECK_ERROR_PARAMETER_SET, // SPS or PPS out of range
+	CHIAKI_NAL_CHECK_ERROR_UNKNOWN_PARAMETER_SET, // slice refers to a PPS or SPS not seen
+	CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER, // slice header field out of range, or cut off
+	CHIAKI_NAL_CHECK_ERROR_SLICE_ORDER, // first slice does not start the picture, or slices out of order
+	CHIAKI_NAL_CHECK_ERROR_SLICE_MISMATCH, // slices disagree about the picture
+	CHIAKI_NAL_CHECK_ERROR_COUNT
+} ChiakiNalCheckError;
+
+CHIAKI_EXPORT const char *chiaki_nal_check_verdict_string(ChiakiNalCheckVerdict verdict);
+CHIAKI_EXPORT const char *chiaki_nal_check_error_string(ChiakiNalCheckError error);
+
+typedef struct chiaki_nal_check_result_t
+{
+	ChiakiNalCheckVerdict verdict;
+	ChiakiNalCheckError error; // the first problem found
+	size_t error_offset; // of the start code of the NAL unit with the problem
+	size_t valid_size; // the access unit up to the damage, the whole if OK, 0 if MALFORMED
+	uint32_t nal_units;
+	uint32_t slices; // within valid_size
+	bool random_access; // the picture is IDR or IRAP
+	uint32_t pic_size; // macroblocks or CTBs of the picture, 0 if no parameter sets are known
+	uint32_t pic_size_valid; // of those, known to be covered by the slices within valid_size
+} ChiakiNalCheckResult;
+
+typedef struct chiaki_nal_check_sps_t
+{
+	bool valid;
+	bool frame_mbs_only; // H.264
+	bool separate_colour_plane;
+	uint8_t log2_max_frame_num; // H.264
+	uint8_t poc_type; // H.264
+	uint8_t log2_max_poc_lsb;
+	uint8_t pic_size_bits; // H.265, of slice_segment_address
+	uint32_t pic_size; // macroblocks or CTBs of a frame
+} ChiakiNalCheckSps;
+
+typedef struct chiaki_nal_check_pps_t
+{
+	bool valid;
+	uint8_t sps_id;
+	bool bottom_field_pic_order; // H.264
+	bool dependent_slice_segments; // H.265
+	bool output_flag_present; // H.265
+	uint8_t num_extra_slice_header_bits; // H.265
+} ChiakiNalCheckPps;
+
+typedef struct chiaki_nal_check_t
+{
+	ChiakiCodec codec;
+	bool params_known; // a valid SPS and PPS were seen
+	ChiakiNalCheckSps sps[CHIAKI_NAL_CHECK_SPS_MAX];
+	ChiakiNalCheckPps pps[CHIAKI_NAL_CHECK_PPS_MAX];
+
+	uint64_t checked;
+	uint64_t bytes;
+	uint64_t verdicts[CHIAKI_NAL_CHECK_VERDICT_COUNT];
+	uint64_t errors[CHIAKI_NAL_CHECK_ERROR_COUNT];
+} ChiakiNalCheck;
+
+CHIAKI_EXPORT void chiaki_nal_check_init(ChiakiNalCheck *check, ChiakiCodec codec);
+
+/**
+ * Forget the parameter sets, e.g. for a new stream. Counters are kept.
+ */
+CHIAKI_EXPORT void chiaki_nal_check_reset(ChiakiNalCheck *check);
+
+/**
+ * Check an access unit, or parameter sets, and remember the valid parameter sets in it.
+ */
+CHIAKI_EXPORT void chiaki_nal_check(ChiakiNalCheck *check, const uint8_t *buf, size_t buf_size, ChiakiNalCheckResult *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_NALCHECK_H
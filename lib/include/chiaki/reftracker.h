@@ -0,0 +1,134 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#ifndef CHIAKI_REFTRACKER_H
+#define CHIAKI_REFTRACKER_H
+
+#include "common.h"
+#include "seqnum.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Number of frames of history kept by ChiakiRefTracker, frames older than
+ * the newest tracked frame minus this are forgotten.
+ */
+#define CHIAKI_REF_TRACKER_WINDOW 128
+
+/**
+ * Maximum decoder DPB size the tracker can model
+ */
+#define CHIAKI_REF_TRACKER_REF_SLOTS_MAX 16
+
+/**
+ * Reference distance (as in ChiakiBitstreamSlice.reference_frame) of frames that need no reference
+ */
+#define CHIAKI_REF_TRACKER_NO_REF 0xff
+
+typedef enum chiaki_ref_tracker_verdict_t
+{
+	CHIAKI_REF_TRACKER_DECODABLE = 0, // reference is held by the decoder
+	CHIAKI_REF_TRACKER_RECOVERABLE, // reference missing, but an older one can be substituted
+	CHIAKI_REF_TRACKER_UNDECODABLE // no usable reference left, only an I frame helps
+} ChiakiRefTrackerVerdict;
+
+/**
+ * Bitmap history of which video frames were received, lost and decoded,
+ * plus a model of the references the decoder currently holds.
+ * All queries are O(1) bit tests on 128-bit ring bitmaps indexed by frame index.
+ */
+typedef struct chiaki_ref_tracker_t
+{
+	uint64_t received[CHIAKI_REF_TRACKER_WINDOW / 64]; // completely assembled
+	uint64_t lost[CHIAKI_REF_TRACKER_WINDOW / 64]; // skipped by a gap or failed to assemble/decode
+	uint64_t decoded[CHIAKI_REF_TRACKER_WINDOW / 64]; // successfully handed to the decoder
+	uint64_t refs[CHIAKI_REF_TRACKER_WINDOW / 64]; // currently held as reference by the decoder
+
+	ChiakiSeqNum16 head; // newest frame index tracked so far
+	bool head_valid;
+
+	ChiakiSeqNum16 ref_ring[CHIAKI_REF_TRACKER_REF_SLOTS_MAX]; // refs in decode order, for eviction
+	unsigned ref_ring_begin;
+	unsigned ref_count;
+	unsigned ref_slots; // decoder DPB size
+
+	unsigned typical_ref_distance; // last reference distance seen on a P frame, used for prediction
+} ChiakiRefTracker;
+
+/**
+ * @param ref_slots number of reference frames the decoder keeps, <= CHIAKI_REF_TRACKER_REF_SLOTS_MAX
+ */
+CHIAKI_EXPORT void chiaki_ref_tracker_init(ChiakiRefTracker *tracker, unsigned ref_slots);
+
+/**
+ * Forget all references, e.g. after the decode chain has been reset locally.
+ * Received/lost/decoded history is kept.
+ */
+CHIAKI_EXPORT void chiaki_ref_tracker_reset_refs(ChiakiRefTracker *tracker);
+
+CHIAKI_EXPORT void chiaki_ref_tracker_mark_received(ChiakiRefTracker *tracker, ChiakiSeqNum16 frame);
+
+/**
+ * Mark the inclusive range [start, end] as lost. Lost frames are dropped from the references.
+ */
+CHIAKI_EXPORT void chiaki_ref_tracker_mark_lost(ChiakiRefTracker *tracker, ChiakiSeqNum16 start, ChiakiSeqNum16 end);
+
+/**
+ * Mark frame as decoded. It becomes a reference, evicting the oldest one if the DPB is full.
+ */
+CHIAKI_EXPORT void chiaki_ref_tracker_mark_decoded(ChiakiRefTracker *tracker, ChiakiSeqNum16 frame);
+
+/**
+ * Remember the reference distance of the last P frame for chiaki_ref_tracker_predict().
+ */
+static inline void chiaki_ref_tracker_note_ref_distance(ChiakiRefTracker *tracker, unsigned ref_distance)
+{
+	if(ref_distance < tracker->ref_slots)
+		tracker->typical_ref_distance = ref_distance;
+}
+
+CHIAKI_EXPORT bool chiaki_ref_tracker_is_received(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame);
+CHIAKI_EXPORT bool chiaki_ref_tracker_is_lost(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame);
+CHIAKI_EXPORT bool chiaki_ref_tracker_is_decoded(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame);
+CHIAKI_EXPORT bool chiaki_ref_tracker_has_ref(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame);
+
+/**
+ * Find the nearest reference usable by frame at a distance of at least min_distance,
+ * where distance d means frame - d - 1 as in ChiakiBitstreamSlice.reference_frame.
+ *
+ * @param distance set to the distance of the found reference
+ * @return false if no reference within the DPB window qualifies
+ */
+CHIAKI_EXPORT bool chiaki_ref_tracker_find_ref(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame, unsigned min_distance, unsigned *distance);
+
+/**
+ * Classify frame, which references ref_distance (CHIAKI_REF_TRACKER_NO_REF for I frames).
+ */
+CHIAKI_EXPORT ChiakiRefTrackerVerdict chiaki_ref_tracker_verdict(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame, unsigned ref_distance);
+
+/**
+ * Like chiaki_ref_tracker_verdict(), but for a frame whose slice has not been parsed yet,
+ * assuming it uses the reference distance seen on the last P frame.
+ */
+static inline ChiakiRefTrackerVerdict chiaki_ref_tracker_predict(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame)
+{
+	return chiaki_ref_tracker_verdict(tracker, frame, tracker->typical_ref_distance);
+}
+
+/**
+ * Predict which of the count (<= 32) frames starting at first will be undecodable,
+ * assuming they all arrive intact and use the typical reference distance.
+ *
+ * @return bit i set if frame first + i is predicted CHIAKI_REF_TRACKER_UNDECODABLE
+ */
+CHIAKI_EXPORT uint32_t chiaki_ref_tracker_predict_undecodable(const ChiakiRefTracker *tracker, ChiakiSeqNum16 first, unsigned count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_REFTRACKER_H
@@ -16,6 +16,7 @@
  * 2. `chiaki_holepunch_session_init` to initialize a session with a valid OAuth2 token
  * 3. `chiaki_holepunch_session_create` to create a remote play session on the PSN server
  * 4. `chiaki_holepunch_session_start` to start the session for a specific device
+ *    (or `chiaki_holepunch_session_prepare` in place of UPnP discovery, 3., creating the offer and 4.)
  * 5. `chiaki_holepunch_session_punch_hole` called twice, to obtain the control and data sockets
  * 6. `chiaki_holepunch_session_fini` once the streaming session has terminated.
  */
@@ -70,6 +71,16 @@ typedef enum chiaki_holepunch_console_type_t
     CHIAKI_HOLEPUNCH_CONSOLE_TYPE_PS5 = 1
 } ChiakiHolepunchConsoleType;
 
+/** Steps of `chiaki_holepunch_session_prepare`, used to report which one failed. */
+typedef enum chiaki_holepunch_prepare_stage_t
+{
+    CHIAKI_HOLEPUNCH_PREPARE_STAGE_NONE = 0,
+    CHIAKI_HOLEPUNCH_PREPARE_STAGE_UPNP,
+    CHIAKI_HOLEPUNCH_PREPARE_STAGE_CREATE, // push server lookup, websocket or session creation
+    CHIAKI_HOLEPUNCH_PREPARE_STAGE_OFFER,
+    CHIAKI_HOLEPUNCH_PREPARE_STAGE_START
+} ChiakiHolepunchPrepareStage;
+
 /** Information about a device that can be used for remote play. */
 typedef struct chiaki_holepunch_device_info_t
 {
@@ -243,6 +254,29 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_start(
     ChiakiHolepunchSession session, const uint8_t* console_uid,
     ChiakiHolepunchConsoleType console_type);
 
+/**
+ * Run UPnP discovery, session creation, offer creation and session start as a dependency graph.
+ *
+ * Candidate gathering (UPnP, STUN) runs alongside the push server lookup, the websocket setup
+ * and session creation, and starting the session does not wait for the offer. The messages sent
+ * to PSN and the console keep the order of the individual calls. The timing of every step and
+ * the critical path are logged.
+ *
+ * This function must be called after `chiaki_holepunch_session_init`. If a step fails, the steps
+ * that were still running are canceled and everything done so far is undone, including a session
+ * already created on the PSN server and the websocket thread. Either way the session must be
+ * released with `chiaki_holepunch_session_fini`.
+ *
+ * @param[in] session Handle to the holepunching session
+ * @param[in] console_uid Unique identifier of the console to start the session for
+ * @param[in] console_type Type of console to start the session for
+ * @param[out] failed_stage Optional, set to the step that failed first
+ * @return CHIAKI_ERR_SUCCESS on success, otherwise the error of the step that failed first
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_prepare(
+    ChiakiHolepunchSession session, const uint8_t* console_uid,
+    ChiakiHolepunchConsoleType console_type, ChiakiHolepunchPrepareStage *failed_stage);
+
 /**
  * Punch a hole in the NAT for the control or data socket.
  *
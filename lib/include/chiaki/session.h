@@ -19,6 +19,9 @@
 #endif
 #include "remote/rudp.h"
 #include "regist.h"
+#include "launchhints.h"
+#include "workerpool.h"
+#include "costacct.h"
 
 #include <stdint.h>
 
@@ -85,6 +88,28 @@ typedef struct chiaki_connect_info_t
 	bool send_actual_start_bitrate; // When true, send requested bitrate via RP-StartBitrate
 	bool enable_keyboard;
 	bool enable_dualsense;
+	/**
+	 * Keep retrying a refused session request for up to this long, 0 to fail right away.
+	 * A console that just woke up from rest mode answers discovery as ready a moment before
+	 * its session port accepts connections.
+	 */
+	uint32_t session_request_retry_ms;
+	/**
+	 * What an earlier session with the same console found out, see connprofile.h.
+	 * target_hint is requested right away instead of the default RP version, unknown to use
+	 * the default. With mtu_in_hint, mtu_out_hint and rtt_hint_us all set, Senkusha is skipped.
+	 */
+	ChiakiTarget target_hint;
+	uint32_t mtu_in_hint;
+	uint32_t mtu_out_hint;
+	uint64_t rtt_hint_us;
+	/**
+	 * Early-stream loss and throughput of earlier sessions with the same console, and how the
+	 * LaunchSpec's network hints are derived from them, see launchhints.h. A zeroed policy sends
+	 * the fixed hints.
+	 */
+	ChiakiLinkHistory link_history;
+	ChiakiLaunchHintsPolicy launch_hints_policy;
 #if CHIAKI_CAN_USE_HOLEPUNCH
 	ChiakiHolepunchSession holepunch_session;
 #endif
@@ -186,11 +211,21 @@ typedef struct chiaki_event_t
 
 typedef void (*ChiakiEventCallback)(ChiakiEvent *event, void *user);
 
+/**
+ * What the video receiver knows about a sample passed to the video sample callback.
+ */
+typedef struct chiaki_video_sample_info_t
+{
+	ChiakiSeqNum16 frame_index; // for a header, of the frame that switched the profile
+	bool header; // only the parameter sets of a profile, must reach the decoder
+	bool non_reference; // no other frame refers to it, dropping it leaves the references intact
+} ChiakiVideoSampleInfo;
+
 /**
  * buf will always have an allocated padding of at least CHIAKI_VIDEO_BUFFER_PADDING_SIZE after buf_size
  * @return whether the sample was successfully pushed into the decoder. On false, a corrupt frame will be reported to get a new keyframe.
  */
-typedef bool (*ChiakiVideoSampleCallback)(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, void *user);
+typedef bool (*ChiakiVideoSampleCallback)(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered, const ChiakiVideoSampleInfo *info, void *user);
 
 
 
@@ -210,6 +245,12 @@ typedef struct chiaki_session_t
 		bool send_actual_start_bitrate;
 		bool enable_keyboard;
 		bool enable_dualsense;
+		uint32_t session_request_retry_ms;
+		uint32_t mtu_in_hint;
+		uint32_t mtu_out_hint;
+		uint64_t rtt_hint_us;
+		ChiakiLinkHistory link_history;
+		ChiakiLaunchHintsPolicy launch_hints_policy;
 		uint8_t psn_account_id[CHIAKI_PSN_ACCOUNT_ID_SIZE];
 		ChiakiControllerState cached_controller_state;
 		bool cached_controller_state_valid;
@@ -224,6 +265,8 @@ typedef struct chiaki_session_t
 	uint32_t mtu_in;
 	uint32_t mtu_out;
 	uint64_t rtt_us;
+	bool link_measured; // mtu_in, mtu_out and rtt_us come from Senkusha, not from hints or fallbacks
+	ChiakiLaunchHints launch_hints; // what the LaunchSpec told the console, set once it was sent
 	ChiakiECDH ecdh;
 
 	ChiakiQuitReason quit_reason;
@@ -235,6 +278,7 @@ typedef struct chiaki_session_t
 	void *video_sample_cb_user;
 	ChiakiAudioSink audio_sink;
 	ChiakiAudioSink haptics_sink;
+	ChiakiHapticsSink haptics_event_sink;
 	ChiakiCtrlDisplaySink display_sink;
 
 	ChiakiThread session_thread;
@@ -261,6 +305,10 @@ typedef struct chiaki_session_t
 
 	ChiakiLog *log;
 
+	ChiakiWorkerPool *worker_pool; // shared with other sessions, NULL for threads of its own
+	ChiakiWorkerAccount worker_account; // what this session ran on worker_pool, guarded by its mutex
+	ChiakiCostAcct *cost_acct; // NULL if not accounted
+
 	ChiakiStreamConnection stream_connection;
 
 	ChiakiControllerState controller_state;
@@ -315,6 +363,66 @@ static inline void chiaki_session_set_haptics_sink(ChiakiSession *session, Chiak
 	session->haptics_sink = *sink;
 }
 
+/**
+ * Receive the haptics decoded into envelopes and rumble motor strengths, see haptics.h.
+ * The raw frames keep going to the haptics sink.
+ *
+ * @param sink contents are copied
+ * @param config NULL to keep the current one, chiaki_haptics_config_defaults() at first
+ */
+static inline void chiaki_session_set_haptics_event_sink(ChiakiSession *session, ChiakiHapticsSink *sink, const ChiakiHapticsConfig *config)
+{
+	session->haptics_event_sink = *sink;
+	if(config)
+		chiaki_haptics_receiver_set_config(session->stream_connection.haptics_receiver, config);
+}
+
+/**
+ * Report that a haptics event was felt now, for the arrival to actuation latency in
+ * chiaki_session_get_haptics_stats(). Call it from the frontend once the motors or actuators
+ * were set, on any thread.
+ */
+static inline void chiaki_session_haptics_actuated(ChiakiSession *session, const ChiakiHapticsEvent *event, uint64_t now_us)
+{
+	chiaki_haptics_receiver_actuated(session->stream_connection.haptics_receiver, event, now_us);
+}
+
+static inline void chiaki_session_get_haptics_stats(ChiakiSession *session, ChiakiHapticsStats *stats)
+{
+	chiaki_haptics_receiver_stats(session->stream_connection.haptics_receiver, stats);
+}
+
+/**
+ * Run the background work of session that doesn't have to be on a thread of its own, i.e. the key
+ * stream generation, on pool, which may be shared by any number of sessions and must outlive them.
+ * Must be called before chiaki_session_start().
+ */
+static inline void chiaki_session_set_worker_pool(ChiakiSession *session, ChiakiWorkerPool *pool)
+{
+	session->worker_pool = pool;
+}
+
+/**
+ * What session ran on its worker pool so far, all zero if it has none.
+ */
+static inline void chiaki_session_get_worker_account(ChiakiSession *session, ChiakiWorkerAccount *account)
+{
+	if(session->worker_pool)
+		chiaki_worker_pool_account(session->worker_pool, &session->worker_account, account);
+	else
+		*account = session->worker_account;
+}
+
+/**
+ * Account the CPU time and allocations of all threads of session to acct, which may be shared by
+ * any number of sessions and must outlive them. See costacct.h.
+ * Must be called before chiaki_session_start().
+ */
+static inline void chiaki_session_set_cost_acct(ChiakiSession *session, ChiakiCostAcct *acct)
+{
+	session->cost_acct = acct;
+}
+
 /**
  * @param sink contents are copied
  */
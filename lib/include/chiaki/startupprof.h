@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Startup profiler
+ * ----------------
+ *
+ * Scoped timers for the time from app launch until it is interactive. Every span is a name,
+ * a start and a duration, recorded into a fixed array so that timing itself stays in the
+ * order of a clock read and a mutex. Spans are tagged with the ChiakiThreadRole of the thread
+ * that began them (the lane), spans on the same lane nest by time: the parent of a span is
+ * the innermost span of its lane that encloses it.
+ *
+ * The recorded spans are written out as a binary trace, all integers little-endian:
+ *
+ *   header  16 bytes:        "CKST" | u16 version (1) | u16 span count | u32 spans dropped
+ *                            | u32 reserved (0)
+ *   span    16 bytes + name: u64 start_us | u32 duration_us | u16 parent | u8 lane
+ *                            | u8 name length | name, not terminated
+ *
+ * start_us counts from chiaki_startup_prof_new(). parent is CHIAKI_STARTUP_SPAN_NONE for top
+ * level spans, duration_us is CHIAKI_STARTUP_DURATION_OPEN for spans that had not ended yet
+ * and 0 for marks.
+ *
+ * All functions are thread-safe and accept a NULL profiler, so call sites don't need to
+ * check whether profiling is on.
+ */
+
+#ifndef CHIAKI_STARTUPPROF_H
+#define CHIAKI_STARTUPPROF_H
+
+#include "common.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_STARTUP_NAME_SIZE 32
+#define CHIAKI_STARTUP_SPAN_NONE 0xffff
+#define CHIAKI_STARTUP_DURATION_OPEN UINT32_MAX
+#define CHIAKI_STARTUP_TRACE_VERSION 1
+#define CHIAKI_STARTUP_TRACE_HEADER_SIZE 16
+#define CHIAKI_STARTUP_TRACE_SPAN_SIZE 16 // without the name
+
+typedef struct chiaki_startup_span_t
+{
+	char name[CHIAKI_STARTUP_NAME_SIZE];
+	uint64_t start_us;
+	uint32_t duration_us;
+	uint16_t parent;
+	uint8_t lane; // ChiakiThreadRole
+} ChiakiStartupSpan;
+
+typedef struct chiaki_startup_prof_config_t
+{
+	size_t capacity; // spans recorded, later ones are counted as dropped. At most 0xfffe.
+	/**
+	 * Monotonic clock in microseconds, chiaki_time_now_monotonic_us() if NULL.
+	 */
+	uint64_t (*now_us)(void *user);
+	void *now_user;
+} ChiakiStartupProfConfig;
+
+typedef struct chiaki_startup_prof_t ChiakiStartupProf;
+
+/**
+ * 128 spans on the monotonic clock.
+ */
+CHIAKI_EXPORT void chiaki_startup_prof_config_defaults(ChiakiStartupProfConfig *config);
+
+/**
+ * @return the profiler, started now, or NULL if config has no capacity or memory could not
+ * be allocated
+ */
+CHIAKI_EXPORT ChiakiStartupProf *chiaki_startup_prof_new(const ChiakiStartupProfConfig *config);
+CHIAKI_EXPORT void chiaki_startup_prof_free(ChiakiStartupProf *prof);
+
+/**
+ * @param name copied, truncated to CHIAKI_STARTUP_NAME_SIZE - 1
+ * @return the span to pass to chiaki_startup_prof_end(), CHIAKI_STARTUP_SPAN_NONE if it was
+ * dropped
+ */
+CHIAKI_EXPORT uint16_t chiaki_startup_prof_begin(ChiakiStartupProf *prof, const char *name);
+CHIAKI_EXPORT void chiaki_startup_prof_end(ChiakiStartupProf *prof, uint16_t span);
+
+/**
+ * Record a point in time, e.g. the first interactive frame, as a span of duration 0.
+ */
+CHIAKI_EXPORT uint16_t chiaki_startup_prof_mark(ChiakiStartupProf *prof, const char *name);
+
+/**
+ * Time the statement or block that follows:
+ *
+ *   CHIAKI_STARTUP_SCOPE(prof, "config")
+ *       config_parse(&config);
+ *
+ * Leaving the block with break, return or goto skips the end of the span.
+ */
+#define CHIAKI_STARTUP_SCOPE(prof, name) \
+	for(uint16_t chiaki_startup_scope_span_ = chiaki_startup_prof_begin((prof), (name)), chiaki_startup_scope_once_ = 1; \
+		chiaki_startup_scope_once_; \
+		chiaki_startup_prof_end((prof), chiaki_startup_scope_span_), chiaki_startup_scope_once_ = 0)
+
+/**
+ * Copy the recorded spans with their parents resolved.
+ *
+ * @return the number of spans recorded, which may be more than count
+ */
+CHIAKI_EXPORT size_t chiaki_startup_prof_spans(ChiakiStartupProf *prof, ChiakiStartupSpan *spans, size_t count);
+
+/**
+ * @return the number of spans that did not fit
+ */
+CHIAKI_EXPORT uint32_t chiaki_startup_prof_dropped(ChiakiStartupProf *prof);
+
+/**
+ * Write the binary trace of all spans recorded so far.
+ *
+ * @param size in: size of buf, out: size of the trace, also on CHIAKI_ERR_BUF_TOO_SMALL
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_startup_prof_write_trace(ChiakiStartupProf *prof, uint8_t *buf, size_t *size);
+
+/**
+ * Read a binary trace written by chiaki_startup_prof_write_trace().
+ *
+ * @param count in: room in spans, out: the number of spans in the trace
+ * @param dropped if not NULL, set to the spans the profiler dropped
+ * @return CHIAKI_ERR_INVALID_DATA if buf is not a trace of a known version,
+ * CHIAKI_ERR_BUF_TOO_SMALL if the trace has more than *count spans
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_startup_trace_read(const uint8_t *buf, size_t size,
+	ChiakiStartupSpan *spans, size_t *count, uint32_t *dropped);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_STARTUPPROF_H
@@ -9,6 +9,7 @@
 #include "ecdh.h"
 #include "gkcrypt.h"
 #include "audioreceiver.h"
+#include "haptics.h"
 #include "videoreceiver.h"
 #include "congestioncontrol.h"
 
@@ -34,7 +35,7 @@ typedef struct chiaki_stream_connection_t
 	ChiakiPacketStats packet_stats;
 	ChiakiAudioReceiver *audio_receiver;
 	ChiakiVideoReceiver *video_receiver;
-	ChiakiAudioReceiver *haptics_receiver;
+	ChiakiHapticsReceiver *haptics_receiver; // lives as long as the stream connection, reset by every run
 
 	ChiakiFeedbackSender feedback_sender;
 	ChiakiCongestionControl congestion_control;
@@ -12,6 +12,7 @@
 #include "reorderqueue.h"
 #include "feedback.h"
 #include "takionsendbuffer.h"
+#include "costacct.h"
 
 #include <stdbool.h>
 
@@ -76,7 +77,8 @@ typedef enum {
 	CHIAKI_TAKION_EVENT_TYPE_DISCONNECT,
 	CHIAKI_TAKION_EVENT_TYPE_DATA,
 	CHIAKI_TAKION_EVENT_TYPE_DATA_ACK,
-	CHIAKI_TAKION_EVENT_TYPE_AV
+	CHIAKI_TAKION_EVENT_TYPE_AV,
+	CHIAKI_TAKION_EVENT_TYPE_TICK // every few ms on the takion thread, for timers of the receivers
 } ChiakiTakionEventType;
 
 typedef struct chiaki_takion_event_t
@@ -121,6 +123,7 @@ typedef struct chiaki_takion_t
 {
 	ChiakiLog *log;
 	uint8_t version;
+	ChiakiCostAcct *cost_acct; // of the thread that connected, passed on to all threads of takion
 
 	/**
 	 * Whether encryption should be used.
@@ -175,6 +178,12 @@ typedef struct chiaki_takion_t
 
 	bool enable_dualsense;
 
+	/**
+	 * Video packets of frames older than the one being received, dropped by the AV header
+	 * validator before they reach the video receiver. Takion thread only.
+	 */
+	uint64_t av_video_stale;
+
 	struct
 	{
 		uint64_t drops_since_log;
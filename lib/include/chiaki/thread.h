@@ -29,6 +29,7 @@ typedef struct chiaki_thread_t
 	ChiakiThreadFunc func;
 	void *arg;
 	void *ret;
+	int role;
 #elif defined(__PSVITA__)
 	SceUID thread_id;
 	void *ret;
@@ -44,6 +45,103 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_timedjoin(ChiakiThread *thread, void
 CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_name(ChiakiThread *thread, const char *name);
 
 
+/**
+ * Scheduling roles of the threads spawned by chiaki-lib and its frontends.
+ * The frontend maps each role to a ChiakiThreadPolicy, so that priorities and
+ * core pinning live in one table instead of being scattered over the code.
+ */
+typedef enum chiaki_thread_role_t
+{
+	CHIAKI_THREAD_ROLE_DEFAULT = 0,
+	CHIAKI_THREAD_ROLE_NETWORK, // takion receive path
+	CHIAKI_THREAD_ROLE_CRYPTO, // gkcrypt key stream generation
+	CHIAKI_THREAD_ROLE_DECODE, // video decode submission
+	CHIAKI_THREAD_ROLE_AUDIO, // audio output
+	CHIAKI_THREAD_ROLE_INPUT, // controller sampling and feedback sending
+	CHIAKI_THREAD_ROLE_HOUSEKEEPING, // ctrl, congestion control, discovery, resend timers, ...
+	CHIAKI_THREAD_ROLE_COUNT
+} ChiakiThreadRole;
+
+/**
+ * Leave the priority of the thread at the platform default
+ */
+#define CHIAKI_THREAD_PRIORITY_INHERIT INT32_MIN
+
+/**
+ * Let the scheduler run the thread on any core.
+ * On Linux and Windows this keeps the affinity inherited from the creating thread.
+ */
+#define CHIAKI_THREAD_CORE_MASK_ANY 0
+
+typedef struct chiaki_thread_policy_t
+{
+	/**
+	 * Platform-native priority: sceKernel priority on Vita (lower is more urgent),
+	 * nice value on Linux. CHIAKI_THREAD_PRIORITY_INHERIT keeps the default.
+	 */
+	int32_t priority;
+
+	/**
+	 * Bit n allows core n (USER_n on Vita), CHIAKI_THREAD_CORE_MASK_ANY allows all.
+	 */
+	uint32_t core_mask;
+
+	/**
+	 * Stack size in bytes, 0 for the platform default.
+	 * Only honored for threads created through chiaki_thread_create_role().
+	 */
+	size_t stack_size;
+} ChiakiThreadPolicy;
+
+typedef struct chiaki_thread_policy_table_t
+{
+	ChiakiThreadPolicy roles[CHIAKI_THREAD_ROLE_COUNT];
+} ChiakiThreadPolicyTable;
+
+typedef struct chiaki_thread_sched_info_t
+{
+	ChiakiThreadRole role;
+	int32_t priority; // CHIAKI_THREAD_PRIORITY_INHERIT if unknown
+	uint32_t core_mask; // allowed cores, CHIAKI_THREAD_CORE_MASK_ANY if unknown
+	int32_t cpu; // core the thread is currently running on, -1 if unknown
+} ChiakiThreadSchedInfo;
+
+CHIAKI_EXPORT const char *chiaki_thread_role_string(ChiakiThreadRole role);
+
+/**
+ * Fill table with policies that leave every role at the platform defaults.
+ */
+CHIAKI_EXPORT void chiaki_thread_policy_table_init(ChiakiThreadPolicyTable *table);
+
+/**
+ * Install the process-wide policy table. Must be called before any session is started,
+ * threads that are already running are not re-scheduled.
+ * @param table copied, NULL restores the defaults
+ */
+CHIAKI_EXPORT void chiaki_thread_policy_table_set(const ChiakiThreadPolicyTable *table);
+
+CHIAKI_EXPORT void chiaki_thread_policy_get(ChiakiThreadRole role, ChiakiThreadPolicy *policy);
+
+/**
+ * Like chiaki_thread_create(), but the new thread is created with the stack size, priority
+ * and core mask of role's policy and reports role from chiaki_thread_current_role().
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_create_role(ChiakiThread *thread, ChiakiThreadRole role, ChiakiThreadFunc func, void *arg);
+
+/**
+ * Apply the policy of role to the calling thread.
+ * Intended for threads that are not created by chiaki, e.g. callbacks from a platform audio API.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_apply_role(ChiakiThreadRole role);
+
+CHIAKI_EXPORT ChiakiThreadRole chiaki_thread_current_role(void);
+
+/**
+ * Query the role, priority and affinity the calling thread is actually running with.
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_sched_info_self(ChiakiThreadSchedInfo *info);
+
+
 typedef struct chiaki_mutex_t
 {
 #if defined(_WIN32)
@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * OAuth token lifecycle
+ * ---------------------
+ *
+ * Keeps an OAuth access token fresh without making the caller wait for it. A background thread
+ * refreshes the token a margin ahead of its expiry, so a connect finds a valid token instead of
+ * starting a refresh round trip first.
+ *
+ * - The refresh is scheduled at expiry - refresh_margin_sec - a random part of jitter_sec, so
+ *   clients that got their tokens at the same time don't all refresh at once. For short-lived
+ *   tokens the margin shrinks to half and the jitter to a quarter of the token's lifetime.
+ * - Only one refresh runs at a time. Callers that need a token while a refresh is running wait
+ *   for that refresh instead of starting another one.
+ * - A failed refresh is retried with exponential backoff between retry_min_sec and
+ *   retry_max_sec. If the token endpoint rejects the refresh token, scheduled retries stop
+ *   until new tokens are set.
+ * - Rotated tokens are handed to the persist callback on the lifecycle thread, after waiters
+ *   have been woken up, so saving them never delays a connect.
+ * - Expiry is tracked on the monotonic clock from the moment the token was received. The
+ *   token endpoint's expires_in is relative, so a device clock that is off or jumps doesn't
+ *   change when a token is considered expired. The wall clock is only used to convert to and
+ *   from the persisted expires_at_unix.
+ *
+ * All functions are thread-safe.
+ */
+
+#ifndef CHIAKI_TOKENLIFECYCLE_H
+#define CHIAKI_TOKENLIFECYCLE_H
+
+#include "common.h"
+#include "log.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Result of one refresh. Strings are allocated with malloc() by the refresh function, the
+ * lifecycle takes ownership of them.
+ */
+typedef struct chiaki_token_grant_t
+{
+	char *access_token;
+	char *refresh_token; // NULL if the endpoint did not rotate the refresh token
+	uint32_t expires_in_sec;
+	uint64_t server_time_unix; // from the response's Date header, 0 if unknown
+} ChiakiTokenGrant;
+
+/**
+ * Exchange refresh_token for new tokens. Called on the lifecycle thread without any lock held.
+ *
+ * @return CHIAKI_ERR_SUCCESS with grant filled,
+ * CHIAKI_ERR_HTTP_NONOK if the token endpoint rejected the refresh token (a new login is needed),
+ * any other error if the refresh could not be done right now (network, timeout, server error)
+ */
+typedef ChiakiErrorCode (*ChiakiTokenRefreshFunc)(void *user, const char *refresh_token, ChiakiTokenGrant *grant);
+
+/**
+ * Tokens as they should be persisted. The strings are only valid during the callback.
+ */
+typedef struct chiaki_token_set_t
+{
+	const char *access_token;
+	const char *refresh_token;
+	uint64_t expires_at_unix; // on the local wall clock
+} ChiakiTokenSet;
+
+typedef void (*ChiakiTokenPersistFunc)(void *user, const ChiakiTokenSet *tokens);
+
+typedef struct chiaki_token_lifecycle_config_t
+{
+	ChiakiTokenRefreshFunc refresh;
+	void *refresh_user;
+	ChiakiTokenPersistFunc persist; // may be NULL
+	void *persist_user;
+	ChiakiLog *log;
+	uint32_t refresh_margin_sec;
+	uint32_t jitter_sec;
+	uint32_t retry_min_sec;
+	uint32_t retry_max_sec;
+	uint32_t skew_warn_sec; // log when the server's clock differs from ours by more than this
+	/**
+	 * Clocks, chiaki_time_now_monotonic_ms(), time() and chiaki_random_32() if NULL.
+	 * Tests set these to step through expiry without sleeping.
+	 */
+	uint64_t (*now_ms)(void *user);
+	uint64_t (*now_unix)(void *user);
+	uint32_t (*random)(void *user);
+	void *clock_user;
+} ChiakiTokenLifecycleConfig;
+
+typedef enum chiaki_token_freshness_t
+{
+	CHIAKI_TOKEN_NONE, // no access token
+	CHIAKI_TOKEN_FRESH,
+	CHIAKI_TOKEN_REFRESH_DUE, // still valid, but within the refresh margin
+	CHIAKI_TOKEN_EXPIRED,
+	CHIAKI_TOKEN_REJECTED // the refresh token was rejected, a new login is needed
+} ChiakiTokenFreshness;
+
+typedef struct chiaki_token_status_t
+{
+	ChiakiTokenFreshness freshness;
+	uint64_t valid_ms; // time left until the access token expires
+	bool refreshing;
+	bool refresh_scheduled;
+	uint64_t refresh_in_ms; // time until the next scheduled refresh, if refresh_scheduled
+	unsigned failures; // consecutive failed refreshes
+	ChiakiErrorCode last_err; // of the last refresh
+	int64_t clock_skew_sec; // server clock - local wall clock, as of the last refresh
+} ChiakiTokenStatus;
+
+typedef struct chiaki_token_lifecycle_stats_t
+{
+	uint64_t refreshes; // successful
+	uint64_t scheduled; // refreshes started by the schedule
+	uint64_t on_demand; // refreshes started because a caller needed a token
+	uint64_t waits; // callers that had to wait for a refresh
+	uint64_t coalesced; // waits that joined a refresh already running
+	uint64_t failures;
+	uint64_t rejections;
+	uint64_t dropped; // refreshes of tokens that were replaced while they ran
+	uint64_t persists;
+} ChiakiTokenLifecycleStats;
+
+typedef struct chiaki_token_lifecycle_t ChiakiTokenLifecycle;
+
+/**
+ * Refresh 5 min ahead of expiry with up to 2 min of jitter, retry after 5 s doubling up to
+ * 5 min, warn about clock skew over 2 min. No refresh function is set.
+ */
+CHIAKI_EXPORT void chiaki_token_lifecycle_config_defaults(ChiakiTokenLifecycleConfig *config);
+
+/**
+ * @return the lifecycle with its thread running and no tokens, or NULL if config has no
+ * refresh function or memory/threads could not be allocated
+ */
+CHIAKI_EXPORT ChiakiTokenLifecycle *chiaki_token_lifecycle_new(const ChiakiTokenLifecycleConfig *config);
+
+/**
+ * Stop the thread and free the lifecycle. Waits for a refresh that is already running.
+ */
+CHIAKI_EXPORT void chiaki_token_lifecycle_free(ChiakiTokenLifecycle *lifecycle);
+
+/**
+ * Replace the tokens, e.g. with the ones loaded from the config or from a new login.
+ * Does not call persist. The result of a refresh running at the same time is dropped.
+ *
+ * @param expires_at_unix on the local wall clock, 0 if unknown (the token is treated as expired)
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_token_lifecycle_set(ChiakiTokenLifecycle *lifecycle,
+	const char *access_token, const char *refresh_token, uint64_t expires_at_unix);
+
+CHIAKI_EXPORT void chiaki_token_lifecycle_clear(ChiakiTokenLifecycle *lifecycle);
+
+/**
+ * Hold back scheduled refreshes, e.g. while streaming. Refreshes a caller asks for still run.
+ */
+CHIAKI_EXPORT void chiaki_token_lifecycle_hold(ChiakiTokenLifecycle *lifecycle, bool hold);
+
+/**
+ * Re-check the schedule now, e.g. after the device resumed from sleep.
+ */
+CHIAKI_EXPORT void chiaki_token_lifecycle_kick(ChiakiTokenLifecycle *lifecycle);
+
+/**
+ * The server rejected the access token even though it should still be valid (its clock is
+ * ahead of the expiry we computed). Treat it as expired and refresh in the background.
+ */
+CHIAKI_EXPORT void chiaki_token_lifecycle_invalidate(ChiakiTokenLifecycle *lifecycle);
+
+/**
+ * Make sure the access token is valid for at least min_valid_sec, refreshing it if not.
+ * Returns immediately if it is.
+ *
+ * @return CHIAKI_ERR_SUCCESS if the token is valid for min_valid_sec,
+ * CHIAKI_ERR_UNINITIALIZED if there is no refresh token,
+ * CHIAKI_ERR_TIMEOUT if the refresh did not finish within timeout_ms,
+ * the refresh function's error otherwise
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_token_lifecycle_ensure_fresh(ChiakiTokenLifecycle *lifecycle,
+	uint32_t min_valid_sec, uint64_t timeout_ms);
+
+/**
+ * Refresh now, whatever the token's state, or join the refresh already running.
+ * Errors as chiaki_token_lifecycle_ensure_fresh().
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_token_lifecycle_refresh(ChiakiTokenLifecycle *lifecycle, uint64_t timeout_ms);
+
+/**
+ * @param token set to a malloc()ed copy of the access token
+ * @return CHIAKI_ERR_UNINITIALIZED if there is none, even an expired one
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_token_lifecycle_access_token(ChiakiTokenLifecycle *lifecycle, char **token);
+
+CHIAKI_EXPORT void chiaki_token_lifecycle_status(ChiakiTokenLifecycle *lifecycle, ChiakiTokenStatus *status);
+
+CHIAKI_EXPORT void chiaki_token_lifecycle_stats(ChiakiTokenLifecycle *lifecycle, ChiakiTokenLifecycleStats *stats);
+
+CHIAKI_EXPORT const char *chiaki_token_freshness_string(ChiakiTokenFreshness freshness);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_TOKENLIFECYCLE_H
@@ -9,6 +9,7 @@
 #include "takion.h"
 #include "frameprocessor.h"
 #include "bitstream.h"
+#include "reftracker.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,7 +37,7 @@ typedef struct chiaki_video_receiver_t
 	ChiakiPacketStats *packet_stats;
 
 	int32_t frames_lost;
-	int32_t reference_frames[CHIAKI_VIDEO_RECEIVER_REF_SLOTS];
+	ChiakiRefTracker ref_tracker; // received/lost/decoded history and decoder references
 	ChiakiBitstream bitstream;
 	bool gap_report_pending;
 	uint16_t gap_report_start;
@@ -54,10 +55,12 @@ typedef struct chiaki_video_receiver_t
 	bool idr_request_pending;            // IDR requested, tracks state (never blocks decode)
 	uint64_t idr_request_start_ms;       // Timestamp for timeout detection
 	uint32_t old_frame_rejects_window;   // Phase 1: count late-packet rejections per 1s window
+	uint64_t av_video_stale_last;        // Takion's av_video_stale at the last window, its rejects join the window
 	uint64_t last_idr_request_ms;        // Phase 2: cooldown to prevent IDR flooding
 	uint32_t consecutive_missing_ref;    // Consecutive unrecovered missing-ref P-frames
 	uint32_t cascade_skip_count;         // Frames skipped during cascade (per 1s window, diagnostic only)
 	uint32_t cascade_reset_attempts;     // Local decode-chain resets while recovering from cascade
+	uint32_t predicted_idr_requests;     // IDR requests issued from ref tracker prediction (per 1s window)
 
 	// --- Diagnostic instrumentation (D2: Frame Cadence Jitter) ---
 	uint64_t prev_frame_first_packet_ms;  // Previous frame's first-packet timestamp
@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Wake and connect
+ * ----------------
+ *
+ * Brings a console out of rest mode and connects the moment it is ready, instead of waiting
+ * for the next round of broadcast discovery to notice that it woke up.
+ *
+ * 1. wake:    send WAKEUP and probe the console with unicast SRCH until it answers at all.
+ * 2. boot:    keep probing until it reports ready. WAKEUP is resent with backoff while it
+ *             still reports standby, in case the first one got lost.
+ * 3. connect: call the connect function right away, retrying with backoff while it fails.
+ *
+ * Probes start every probe_min_ms and back off to probe_max_ms, so the first probes after
+ * the wakeup are fast and a slow boot doesn't flood the network. A console that is already
+ * ready goes straight to connect after the first probe.
+ *
+ * Each step is timed, see ChiakiWakeTimeline. All of it runs on the thread calling
+ * chiaki_wake_orchestrator_run(), chiaki_wake_orchestrator_cancel() may be called from any
+ * other thread.
+ */
+
+#ifndef CHIAKI_WAKEORCHESTRATOR_H
+#define CHIAKI_WAKEORCHESTRATOR_H
+
+#include "common.h"
+#include "discovery.h"
+#include "log.h"
+#include "stoppipe.h"
+#include "thread.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum chiaki_wake_step_t
+{
+	CHIAKI_WAKE_STEP_WAKE,
+	CHIAKI_WAKE_STEP_BOOT,
+	CHIAKI_WAKE_STEP_CONNECT,
+	CHIAKI_WAKE_STEP_COUNT
+} ChiakiWakeStep;
+
+typedef struct chiaki_wake_step_timing_t
+{
+	uint64_t start_ms; // relative to the start of chiaki_wake_orchestrator_run()
+	uint64_t duration_ms;
+	unsigned attempts; // probes sent during wake and boot, connect calls during connect
+	bool started;
+	bool done;
+} ChiakiWakeStepTiming;
+
+typedef struct chiaki_wake_timeline_t
+{
+	ChiakiWakeStepTiming steps[CHIAKI_WAKE_STEP_COUNT];
+	uint64_t total_ms;
+	unsigned wakeups; // WAKEUP packets sent
+	unsigned responses; // discovery responses from the console
+	bool was_ready; // the first answer already reported ready, the console was not in rest mode
+} ChiakiWakeTimeline;
+
+/**
+ * Start the session with a console that just reported ready.
+ *
+ * @param host the console's discovery response, only valid during the call
+ * @return CHIAKI_ERR_SUCCESS if connected, CHIAKI_ERR_CANCELED to give up right away,
+ * any other error to be retried
+ */
+typedef ChiakiErrorCode (*ChiakiWakeConnectFunc)(void *user, const ChiakiDiscoveryHost *host);
+
+typedef struct chiaki_wake_config_t
+{
+	const char *host;
+	uint16_t port; // discovery port, 0 for the default one of ps4/ps5
+	bool ps5;
+	uint64_t user_credential; // the regist key interpreted as hex, see ChiakiDiscoveryPacket
+	uint32_t probe_min_ms;
+	uint32_t probe_max_ms;
+	uint32_t wakeup_retry_min_ms;
+	uint32_t wakeup_retry_max_ms;
+	uint32_t connect_retry_min_ms;
+	uint32_t connect_retry_max_ms;
+	unsigned connect_attempts;
+	uint64_t timeout_ms; // until the console reports ready
+	ChiakiWakeConnectFunc connect; // may be NULL to only wait until the console is ready
+	void *connect_user;
+} ChiakiWakeConfig;
+
+typedef struct chiaki_wake_orchestrator_t
+{
+	ChiakiLog *log;
+	ChiakiWakeConfig config;
+	char *host;
+	ChiakiStopPipe stop_pipe;
+	ChiakiMutex mutex;
+	ChiakiWakeStep step;
+	ChiakiWakeTimeline timeline;
+} ChiakiWakeOrchestrator;
+
+/**
+ * Probe every 50 ms backing off to 200 ms, resend WAKEUP after 1 s backing off to 4 s, retry
+ * connect after 50 ms backing off to 400 ms for 10 attempts, give up if the console is not
+ * ready after 60 s. Host, credential and connect function are not set.
+ */
+CHIAKI_EXPORT void chiaki_wake_config_defaults(ChiakiWakeConfig *config);
+
+/**
+ * @param config copied, including the host string
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_wake_orchestrator_init(ChiakiWakeOrchestrator *orchestrator, ChiakiLog *log, const ChiakiWakeConfig *config);
+CHIAKI_EXPORT void chiaki_wake_orchestrator_fini(ChiakiWakeOrchestrator *orchestrator);
+
+/**
+ * Wake the console and connect. Blocks until connected, failed or canceled.
+ * May only be called once per init.
+ *
+ * @param timeline if not NULL, filled with the timings of all steps, also on failure
+ * @return CHIAKI_ERR_SUCCESS if connected (or ready, without connect function),
+ * CHIAKI_ERR_TIMEOUT if the console did not report ready within timeout_ms,
+ * CHIAKI_ERR_CANCELED if canceled,
+ * the connect function's last error if all connect attempts failed
+ */
+CHIAKI_EXPORT ChiakiErrorCode chiaki_wake_orchestrator_run(ChiakiWakeOrchestrator *orchestrator, ChiakiWakeTimeline *timeline);
+
+/**
+ * Make a running or later chiaki_wake_orchestrator_run() return CHIAKI_ERR_CANCELED.
+ * A connect call that is already running is not interrupted.
+ */
+CHIAKI_EXPORT void chiaki_wake_orchestrator_cancel(ChiakiWakeOrchestrator *orchestrator);
+
+/**
+ * @return the step chiaki_wake_orchestrator_run() is currently at, e.g. for progress display
+ */
+CHIAKI_EXPORT ChiakiWakeStep chiaki_wake_orchestrator_step(ChiakiWakeOrchestrator *orchestrator);
+
+CHIAKI_EXPORT const char *chiaki_wake_step_string(ChiakiWakeStep step);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_WAKEORCHESTRATOR_H
@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Shared worker pool
+ * ------------------
+ *
+ * Every ChiakiSession runs its own ctrl, Takion, feedback and congestion control threads, and
+ * without a pool two more per session only to keep the gkcrypt key streams ahead of the
+ * packets. With dozens of sessions in one process, e.g. a load test, those mostly idle crypto
+ * threads outnumber the cores many times over. A ChiakiWorkerPool runs that background work
+ * for all sessions on a fixed set of threads instead.
+ *
+ * Work is submitted as a ChiakiWorkerJob embedded in its owner. A job is queued at most once:
+ * submitting it while it is queued does nothing, while it runs makes it run once more after.
+ * Jobs run in the order they were queued, so a job that has more to do than is fair should do a
+ * part and submit itself again. chiaki_worker_pool_cancel() returns once the job is neither
+ * queued nor running, after which its owner may go away.
+ *
+ * The time a job spent queued and running is charged to its ChiakiWorkerAccount, one per
+ * session, since pooled work can't be attributed by thread anymore.
+ *
+ * All functions are thread-safe.
+ */
+
+#ifndef CHIAKI_WORKERPOOL_H
+#define CHIAKI_WORKERPOOL_H
+
+#include "common.h"
+#include "log.h"
+#include "thread.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_WORKER_POOL_WORKERS_MAX 16
+
+typedef struct chiaki_worker_account_t
+{
+	uint64_t jobs; // runs, not submissions
+	uint64_t busy_us;
+	uint64_t wait_us; // from queued until a worker picked the job up
+	uint64_t wait_max_us;
+} ChiakiWorkerAccount;
+
+typedef void (*ChiakiWorkerJobFunc)(void *user);
+
+typedef enum chiaki_worker_job_state_t
+{
+	CHIAKI_WORKER_JOB_IDLE,
+	CHIAKI_WORKER_JOB_QUEUED,
+	CHIAKI_WORKER_JOB_RUNNING
+} ChiakiWorkerJobState;
+
+typedef struct chiaki_worker_job_t
+{
+	ChiakiWorkerJobFunc func;
+	void *user;
+	ChiakiWorkerAccount *account; // may be NULL
+
+	// owned by the pool
+	ChiakiWorkerJobState state;
+	bool rerun; // submitted while running
+	uint64_t queued_us;
+	struct chiaki_worker_job_t *next;
+} ChiakiWorkerJob;
+
+typedef struct chiaki_worker_pool_t
+{
+	ChiakiLog *log;
+	ChiakiMutex mutex;
+	ChiakiCond job_cond; // a job was queued, or stop
+	ChiakiCond done_cond; // a job finished running
+	bool stop;
+	ChiakiWorkerJob *queue_head;
+	ChiakiWorkerJob *queue_tail;
+	ChiakiThread workers[CHIAKI_WORKER_POOL_WORKERS_MAX];
+	unsigned int workers_count;
+
+	ChiakiWorkerAccount total;
+	uint64_t queued_max; // longest the queue got
+	uint64_t queued;
+} ChiakiWorkerPool;
+
+/**
+ * @param workers 1 to CHIAKI_WORKER_POOL_WORKERS_MAX
+ * @param role applied to the worker threads
+ */
+CHIAKI_EXPORT ChiakiWorkerPool *chiaki_worker_pool_new(unsigned int workers, ChiakiThreadRole role, ChiakiLog *log);
+
+/**
+ * Stop the workers. Jobs still queued are dropped, every job must have been cancelled or be idle.
+ */
+CHIAKI_EXPORT void chiaki_worker_pool_free(ChiakiWorkerPool *pool);
+
+CHIAKI_EXPORT void chiaki_worker_job_init(ChiakiWorkerJob *job, ChiakiWorkerJobFunc func, void *user, ChiakiWorkerAccount *account);
+
+/**
+ * Queue job unless it is already queued. If it is running, it runs once more when it is done.
+ */
+CHIAKI_EXPORT void chiaki_worker_pool_submit(ChiakiWorkerPool *pool, ChiakiWorkerJob *job);
+
+/**
+ * Take job out of the queue, or wait for it to finish running. Must not be called from the job.
+ */
+CHIAKI_EXPORT void chiaki_worker_pool_cancel(ChiakiWorkerPool *pool, ChiakiWorkerJob *job);
+
+/**
+ * Copy account, which jobs running on pool are charged to, consistently.
+ */
+CHIAKI_EXPORT void chiaki_worker_pool_account(ChiakiWorkerPool *pool, const ChiakiWorkerAccount *account, ChiakiWorkerAccount *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_WORKERPOOL_H
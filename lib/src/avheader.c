@@ -0,0 +1,292 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/avheader.h>
+#include <chiaki/seqnum.h>
+
+#include <string.h>
+
+// as in takion.c
+#define AV_PACKET_BASE_TYPE_MASK 0xf
+#define AV_PACKET_TYPE_VIDEO 2
+#define AV_PACKET_TYPE_AUDIO 3
+
+#define AV_HEADER_OFFSET_PACKET_INDEX 0x1
+#define AV_HEADER_OFFSET_FRAME_INDEX 0x3
+#define AV_HEADER_OFFSET_UNITS 0x5
+#define AV_HEADER_OFFSET_CODEC 0x9
+#define AV_HEADER_OFFSET_KEY_POS 0xe
+#define AV_HEADER_OFFSET_VIDEO_WORD 0x12
+#define AV_HEADER_OFFSET_ADAPTIVE_STREAM_INDEX 0x14
+#define AV_HEADER_OFFSET_BYTE_AT_0X2C 0x15
+#define AV_HEADER_NALU_INFO_STRUCTS_SIZE 3
+
+#define AUDIO_CODEC 5 // the only one the audio receiver plays
+
+/**
+ * Where a header of one protocol version and packet type keeps its fields, see av_packet_parse()
+ * and chiaki_takion_v7_av_packet_parse() in takion.c.
+ */
+typedef struct av_header_layout_t
+{
+	uint8_t min_size; // that the parser demands
+	uint8_t data_offset; // without the nalu info structs
+	uint8_t unit_shift;
+	uint16_t unit_mask;
+	uint8_t total_shift;
+	uint16_t total_mask;
+	uint16_t fec_mask;
+	bool byte_at_0x2c;
+	bool haptics_byte; // after the nalu info structs
+	bool key_pos_relative; // low 32 bits, extended by the key state
+} AvHeaderLayout;
+
+#define AV_LAYOUT_UNITS_VIDEO 0x15, 0x7ff, 0xa, 0x7ff, 0x3ff
+#define AV_LAYOUT_UNITS_AUDIO 0x18, 0xff, 0x10, 0xff, 0xffff
+
+// [format][is_video]
+static const AvHeaderLayout av_header_layouts[3][2] = {
+	[CHIAKI_AV_HEADER_FORMAT_V7] = {
+		{ 0x12, 0x12, AV_LAYOUT_UNITS_VIDEO, false, false, false },
+		{ 0x15, 0x15, AV_LAYOUT_UNITS_VIDEO, false, false, false }
+	},
+	[CHIAKI_AV_HEADER_FORMAT_V9] = {
+		{ 1 + CHIAKI_TAKION_V9_AV_HEADER_SIZE_AUDIO + 1, 0x13, AV_LAYOUT_UNITS_AUDIO, false, false, true },
+		{ 1 + CHIAKI_TAKION_V9_AV_HEADER_SIZE_VIDEO + 1, 0x15, AV_LAYOUT_UNITS_VIDEO, true, false, true }
+	},
+	[CHIAKI_AV_HEADER_FORMAT_V12] = {
+		{ 1 + CHIAKI_TAKION_V12_AV_HEADER_SIZE_AUDIO + 1, 0x13, AV_LAYOUT_UNITS_AUDIO, false, true, true },
+		{ 1 + CHIAKI_TAKION_V12_AV_HEADER_SIZE_VIDEO + 1, 0x15, AV_LAYOUT_UNITS_VIDEO, true, false, true }
+	}
+};
+
+static inline uint16_t read_u16(const uint8_t *buf)
+{
+	return (uint16_t)(((uint16_t)buf[0] << 8) | buf[1]);
+}
+
+static inline uint32_t read_u32(const uint8_t *buf)
+{
+	return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_av_header_format_for_version(unsigned int version, ChiakiAvHeaderFormat *format)
+{
+	switch(version)
+	{
+		case 7:
+			*format = CHIAKI_AV_HEADER_FORMAT_V7;
+			return CHIAKI_ERR_SUCCESS;
+		case 9:
+			*format = CHIAKI_AV_HEADER_FORMAT_V9;
+			return CHIAKI_ERR_SUCCESS;
+		case 12:
+			*format = CHIAKI_AV_HEADER_FORMAT_V12;
+			return CHIAKI_ERR_SUCCESS;
+		default:
+			return CHIAKI_ERR_INVALID_DATA;
+	}
+}
+
+CHIAKI_EXPORT void chiaki_av_header_batch_decode(ChiakiAvHeaderBatch *batch, ChiakiAvHeaderFormat format, ChiakiKeyState *key_state)
+{
+	const AvHeaderLayout *layouts = av_header_layouts[format];
+	for(size_t i = 0; i < batch->count; i++)
+	{
+		const uint8_t *buf = batch->buf[i];
+		size_t size = batch->buf_size[i];
+		batch->cls[i] = CHIAKI_AV_HEADER_CLASS_MALFORMED;
+		batch->flags[i] = 0;
+		if(!size)
+			continue;
+
+		uint8_t base_type = buf[0] & AV_PACKET_BASE_TYPE_MASK;
+		if(base_type != AV_PACKET_TYPE_VIDEO && base_type != AV_PACKET_TYPE_AUDIO)
+			continue;
+		bool video = base_type == AV_PACKET_TYPE_VIDEO;
+		bool nalu = (buf[0] >> 4) & 1;
+		const AvHeaderLayout *layout = &layouts[video];
+
+		size_t data_offset = layout->data_offset
+			+ (nalu ? AV_HEADER_NALU_INFO_STRUCTS_SIZE : 0)
+			+ (layout->haptics_byte ? 1 : 0);
+		if(size < layout->min_size || size < data_offset)
+			continue;
+
+		uint8_t flags = (video ? CHIAKI_AV_HEADER_FLAG_VIDEO : 0)
+			| (nalu ? CHIAKI_AV_HEADER_FLAG_NALU_INFO_STRUCTS : 0);
+		if(layout->haptics_byte && buf[data_offset - 1] == 0x02)
+			flags |= CHIAKI_AV_HEADER_FLAG_HAPTICS;
+		batch->flags[i] = flags;
+		batch->data_offset[i] = (uint16_t)data_offset;
+
+		batch->packet_index[i] = read_u16(buf + AV_HEADER_OFFSET_PACKET_INDEX);
+		batch->frame_index[i] = read_u16(buf + AV_HEADER_OFFSET_FRAME_INDEX);
+		uint32_t units = read_u32(buf + AV_HEADER_OFFSET_UNITS);
+		batch->unit_index[i] = (uint16_t)((units >> layout->unit_shift) & layout->unit_mask);
+		batch->units_total[i] = (uint16_t)(((units >> layout->total_shift) & layout->total_mask) + 1);
+		batch->units_fec[i] = (uint16_t)(units & layout->fec_mask);
+		batch->codec[i] = buf[AV_HEADER_OFFSET_CODEC];
+
+		uint32_t key_pos = read_u32(buf + AV_HEADER_OFFSET_KEY_POS);
+		batch->key_pos[i] = layout->key_pos_relative
+			? chiaki_key_state_request_pos(key_state, key_pos, true)
+			: key_pos;
+
+		if(video)
+		{
+			batch->word_at_0x18[i] = read_u16(buf + AV_HEADER_OFFSET_VIDEO_WORD);
+			batch->adaptive_stream_index[i] = buf[AV_HEADER_OFFSET_ADAPTIVE_STREAM_INDEX] >> 5;
+		}
+		else
+		{
+			batch->word_at_0x18[i] = 0;
+			batch->adaptive_stream_index[i] = 0;
+		}
+		batch->byte_at_0x2c[i] = layout->byte_at_0x2c ? buf[AV_HEADER_OFFSET_BYTE_AT_0X2C] : 0;
+
+		batch->cls[i] = CHIAKI_AV_HEADER_CLASS_GOOD;
+	}
+}
+
+CHIAKI_EXPORT void chiaki_av_header_batch_packet(ChiakiAvHeaderBatch *batch, size_t index, ChiakiTakionAVPacket *packet)
+{
+	memset(packet, 0, sizeof(*packet));
+	uint8_t flags = batch->flags[index];
+	packet->packet_index = batch->packet_index[index];
+	packet->frame_index = batch->frame_index[index];
+	packet->uses_nalu_info_structs = (flags & CHIAKI_AV_HEADER_FLAG_NALU_INFO_STRUCTS) != 0;
+	packet->is_video = (flags & CHIAKI_AV_HEADER_FLAG_VIDEO) != 0;
+	packet->is_haptics = (flags & CHIAKI_AV_HEADER_FLAG_HAPTICS) != 0;
+	packet->unit_index = batch->unit_index[index];
+	packet->units_in_frame_total = batch->units_total[index];
+	packet->units_in_frame_fec = batch->units_fec[index];
+	packet->codec = batch->codec[index];
+	packet->word_at_0x18 = batch->word_at_0x18[index];
+	packet->adaptive_stream_index = batch->adaptive_stream_index[index];
+	packet->byte_at_0x2c = batch->byte_at_0x2c[index];
+	packet->key_pos = batch->key_pos[index];
+	packet->data = batch->buf[index] + batch->data_offset[index];
+	packet->data_size = batch->buf_size[index] - batch->data_offset[index];
+}
+
+typedef enum av_header_dedup_t
+{
+	AV_HEADER_DEDUP_UNIT, // units of the frame being received, older frames are stale
+	AV_HEADER_DEDUP_FRAME // frame indices within a window behind the newest
+} AvHeaderDedup;
+
+/**
+ * What the receivers check of a packet, per stream.
+ */
+typedef struct av_header_rule_t
+{
+	uint16_t units_max;
+	uint8_t codec; // 0 for any
+	bool fec_within_total; // video: units_fec counts the fec units of units_total
+	bool audio_units; // audio: units_fec packs unit size and counts, the payload holds all units
+	AvHeaderDedup dedup;
+} AvHeaderRule;
+
+enum { AV_STREAM_VIDEO, AV_STREAM_AUDIO, AV_STREAM_HAPTICS, AV_STREAM_COUNT };
+
+static const AvHeaderRule av_header_rules[AV_STREAM_COUNT] = {
+	[AV_STREAM_VIDEO] = { CHIAKI_AV_HEADER_VIDEO_UNITS_MAX, 0, true, false, AV_HEADER_DEDUP_UNIT },
+	[AV_STREAM_AUDIO] = { 0x100, AUDIO_CODEC, false, true, AV_HEADER_DEDUP_FRAME },
+	[AV_STREAM_HAPTICS] = { 0x100, AUDIO_CODEC, false, true, AV_HEADER_DEDUP_FRAME }
+};
+
+CHIAKI_EXPORT void chiaki_av_header_validator_init(ChiakiAvHeaderValidator *validator)
+{
+	memset(validator, 0, sizeof(*validator));
+	validator->video_frame = -1;
+	validator->audio[0].frame = -1;
+	validator->audio[1].frame = -1;
+}
+
+static inline bool av_header_well_formed(const AvHeaderRule *rule, ChiakiAvHeaderBatch *batch, size_t i)
+{
+	size_t data_size = batch->buf_size[i] - batch->data_offset[i];
+	uint16_t total = batch->units_total[i];
+	uint16_t fec = batch->units_fec[i];
+	if(!data_size || total > rule->units_max)
+		return false;
+	if(rule->codec && batch->codec[i] != rule->codec)
+		return false;
+	if(rule->fec_within_total && (fec > total || batch->unit_index[i] >= total))
+		return false;
+	if(rule->audio_units)
+	{
+		uint16_t source_units = fec & 0xf;
+		uint16_t fec_units = (fec >> 4) & 0xf;
+		size_t unit_size = fec >> 8;
+		if(source_units + fec_units != total || data_size != unit_size * total)
+			return false;
+	}
+	return true;
+}
+
+static inline ChiakiAvHeaderClass av_header_dedup_unit(ChiakiAvHeaderValidator *validator, ChiakiSeqNum16 frame, uint16_t unit)
+{
+	if(validator->video_frame >= 0)
+	{
+		ChiakiSeqNum16 cur = (ChiakiSeqNum16)validator->video_frame;
+		if(chiaki_seq_num_16_lt(frame, cur))
+			return CHIAKI_AV_HEADER_CLASS_STALE;
+		if(frame == cur && (validator->video_units_seen[unit / 8] & (1 << (unit % 8))))
+			return CHIAKI_AV_HEADER_CLASS_DUPLICATE;
+	}
+	if(validator->video_frame < 0 || frame != (ChiakiSeqNum16)validator->video_frame)
+	{
+		validator->video_frame = frame;
+		memset(validator->video_units_seen, 0, sizeof(validator->video_units_seen));
+	}
+	validator->video_units_seen[unit / 8] |= (uint8_t)(1 << (unit % 8));
+	return CHIAKI_AV_HEADER_CLASS_GOOD;
+}
+
+static inline ChiakiAvHeaderClass av_header_dedup_frame(ChiakiAvHeaderValidator *validator, size_t stream, ChiakiSeqNum16 frame)
+{
+	int32_t *newest = &validator->audio[stream].frame;
+	uint64_t *seen = &validator->audio[stream].seen;
+	if(*newest < 0 || chiaki_seq_num_16_gt(frame, (ChiakiSeqNum16)*newest))
+	{
+		uint16_t ahead = *newest < 0 ? 64 : (uint16_t)(frame - (ChiakiSeqNum16)*newest);
+		*seen = ahead >= 64 ? 1 : (*seen << ahead) | 1;
+		*newest = frame;
+		return CHIAKI_AV_HEADER_CLASS_GOOD;
+	}
+	uint16_t behind = (uint16_t)((ChiakiSeqNum16)*newest - frame);
+	if(behind >= 64)
+		return CHIAKI_AV_HEADER_CLASS_STALE;
+	if(*seen & ((uint64_t)1 << behind))
+		return CHIAKI_AV_HEADER_CLASS_DUPLICATE;
+	*seen |= (uint64_t)1 << behind;
+	return CHIAKI_AV_HEADER_CLASS_GOOD;
+}
+
+CHIAKI_EXPORT size_t chiaki_av_header_validate(ChiakiAvHeaderValidator *validator, ChiakiAvHeaderBatch *batch)
+{
+	uint32_t classified[CHIAKI_AV_HEADER_CLASS_COUNT] = { 0 };
+	for(size_t i = 0; i < batch->count; i++)
+	{
+		ChiakiAvHeaderClass cls = (ChiakiAvHeaderClass)batch->cls[i];
+		if(cls == CHIAKI_AV_HEADER_CLASS_GOOD)
+		{
+			uint8_t flags = batch->flags[i];
+			size_t stream = (flags & CHIAKI_AV_HEADER_FLAG_VIDEO) ? AV_STREAM_VIDEO
+				: (flags & CHIAKI_AV_HEADER_FLAG_HAPTICS) ? AV_STREAM_HAPTICS : AV_STREAM_AUDIO;
+			const AvHeaderRule *rule = &av_header_rules[stream];
+			if(!av_header_well_formed(rule, batch, i))
+				cls = CHIAKI_AV_HEADER_CLASS_MALFORMED;
+			else if(rule->dedup == AV_HEADER_DEDUP_UNIT)
+				cls = av_header_dedup_unit(validator, batch->frame_index[i], batch->unit_index[i]);
+			else
+				cls = av_header_dedup_frame(validator, stream - AV_STREAM_AUDIO, batch->frame_index[i]);
+			batch->cls[i] = (uint8_t)cls;
+		}
+		classified[cls]++;
+	}
+	for(size_t c = 0; c < CHIAKI_AV_HEADER_CLASS_COUNT; c++)
+		validator->classified[c] += classified[c];
+	return classified[CHIAKI_AV_HEADER_CLASS_GOOD];
+}
@@ -0,0 +1,516 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/avsync.h>
+#include <chiaki/thread.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// the envelope window is kept as this many minima, each of window_us / AV_SYNC_BUCKETS
+#define AV_SYNC_BUCKETS 16
+// the drift is only estimated from at least this many minima
+#define AV_SYNC_SLOPE_BUCKETS_MIN 4
+
+typedef struct av_sync_bucket_t
+{
+	uint64_t start_us;
+	int64_t min; // arrival - media time
+	int64_t max;
+	uint64_t min_at_us;
+} AvSyncBucket;
+
+typedef struct av_sync_stream_t
+{
+	bool started;
+	uint16_t last_index;
+	int64_t index; // last_index unwrapped
+	uint64_t last_arrival_us;
+	AvSyncBucket buckets[AV_SYNC_BUCKETS];
+	size_t head; // newest bucket
+	size_t count;
+} AvSyncStream;
+
+struct chiaki_av_sync_t
+{
+	ChiakiAvSyncConfig config;
+	ChiakiMutex mutex;
+
+	AvSyncStream audio;
+	AvSyncStream video;
+	uint64_t audio_frame_us;
+	int64_t audio_media_end_us; // media time of the end of the last buffered audio unit
+	double slope; // of the audio envelope, local clock against the console's
+	double jitter_us; // of the audio arrivals
+
+	bool clock_valid; // audio_latency_us is known
+	uint64_t clock_at_us;
+	double audio_latency_us;
+	double buffer_us;
+	double target_us;
+	double ratio;
+
+	// first hold asked for the frame about to be presented
+	bool hold_valid;
+	uint16_t hold_index;
+	int64_t hold_error_us;
+	uint64_t hold_at_us;
+
+	// sync error the presented frames would have had without holds, smoothed
+	bool error_valid;
+	double error_us;
+	uint64_t error_at_us;
+
+	ChiakiAvSyncStats stats;
+};
+
+CHIAKI_EXPORT void chiaki_av_sync_config_defaults(ChiakiAvSyncConfig *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->video_fps = 60;
+	config->audio_target_us = 40000;
+	config->audio_min_us = 20000;
+	config->audio_max_us = 120000;
+	config->max_video_hold_us = 12000;
+	config->max_ratio_deviation = 0.005;
+	config->ratio_gain = 0.1;
+	config->window_us = 8000000;
+	config->stale_us = 500000;
+}
+
+static void stream_reset(AvSyncStream *stream)
+{
+	memset(stream, 0, sizeof(*stream));
+}
+
+static void sync_reset(ChiakiAvSync *sync)
+{
+	stream_reset(&sync->audio);
+	stream_reset(&sync->video);
+	sync->audio_frame_us = 0;
+	sync->audio_media_end_us = 0;
+	sync->slope = 0.0;
+	sync->jitter_us = 0.0;
+	sync->clock_valid = false;
+	sync->audio_latency_us = 0.0;
+	sync->buffer_us = 0.0;
+	sync->target_us = (double)sync->config.audio_target_us;
+	sync->ratio = 1.0;
+	sync->hold_valid = false;
+	sync->error_valid = false;
+}
+
+CHIAKI_EXPORT ChiakiAvSync *chiaki_av_sync_new(const ChiakiAvSyncConfig *config)
+{
+	if(!config->video_fps)
+		return NULL;
+	ChiakiAvSync *sync = calloc(1, sizeof(ChiakiAvSync));
+	if(!sync)
+		return NULL;
+	sync->config = *config;
+	if(sync->config.window_us < AV_SYNC_BUCKETS)
+		sync->config.window_us = AV_SYNC_BUCKETS;
+	if(chiaki_mutex_init(&sync->mutex, false) != CHIAKI_ERR_SUCCESS)
+	{
+		free(sync);
+		return NULL;
+	}
+	sync_reset(sync);
+	sync->stats.resample_ratio = 1.0;
+	return sync;
+}
+
+CHIAKI_EXPORT void chiaki_av_sync_free(ChiakiAvSync *sync)
+{
+	if(!sync)
+		return;
+	chiaki_mutex_fini(&sync->mutex);
+	free(sync);
+}
+
+CHIAKI_EXPORT void chiaki_av_sync_reset(ChiakiAvSync *sync)
+{
+	chiaki_mutex_lock(&sync->mutex);
+	sync_reset(sync);
+	chiaki_mutex_unlock(&sync->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_av_sync_set_audio_target(ChiakiAvSync *sync, uint64_t target_us, uint64_t min_us, uint64_t max_us)
+{
+	chiaki_mutex_lock(&sync->mutex);
+	sync->config.audio_target_us = target_us;
+	sync->config.audio_min_us = min_us < target_us ? min_us : target_us;
+	sync->config.audio_max_us = max_us > target_us ? max_us : target_us;
+	if(!sync->error_valid)
+		sync->target_us = (double)target_us;
+	chiaki_mutex_unlock(&sync->mutex);
+}
+
+static double clamp_double(double v, double min, double max)
+{
+	return v < min ? min : (v > max ? max : v);
+}
+
+/**
+ * Unwrap frame_index onto stream->index.
+ *
+ * @return false for a unit that is late or a duplicate
+ */
+static bool stream_advance(ChiakiAvSync *sync, AvSyncStream *stream, uint16_t frame_index, uint64_t arrival_us)
+{
+	if(stream->started && arrival_us < stream->last_arrival_us + sync->config.stale_us)
+	{
+		int16_t delta = (int16_t)(frame_index - stream->last_index);
+		if(delta <= 0)
+			return false;
+		stream->index += delta;
+	}
+	else
+	{
+		// after a gap the indices may have started over, and the old arrivals say nothing anymore
+		if(stream->started)
+			sync->stats.restarts++;
+		stream_reset(stream);
+		stream->started = true;
+		stream->index = frame_index;
+	}
+	stream->last_index = frame_index;
+	stream->last_arrival_us = arrival_us;
+	return true;
+}
+
+static void envelope_push(ChiakiAvSync *sync, AvSyncStream *stream, uint64_t arrival_us, int64_t offset_us)
+{
+	uint64_t bucket_us = sync->config.window_us / AV_SYNC_BUCKETS;
+	AvSyncBucket *bucket = &stream->buckets[stream->head];
+	if(stream->count && arrival_us < bucket->start_us + bucket_us)
+	{
+		if(offset_us < bucket->min)
+		{
+			bucket->min = offset_us;
+			bucket->min_at_us = arrival_us;
+		}
+		if(offset_us > bucket->max)
+			bucket->max = offset_us;
+		return;
+	}
+	stream->head = (stream->head + 1) % AV_SYNC_BUCKETS;
+	if(stream->count < AV_SYNC_BUCKETS)
+		stream->count++;
+	bucket = &stream->buckets[stream->head];
+	bucket->start_us = arrival_us;
+	bucket->min = offset_us;
+	bucket->max = offset_us;
+	bucket->min_at_us = arrival_us;
+}
+
+static const AvSyncBucket *envelope_bucket(const AvSyncStream *stream, size_t age)
+{
+	return &stream->buckets[(stream->head + AV_SYNC_BUCKETS - age) % AV_SYNC_BUCKETS];
+}
+
+/**
+ * Lower envelope of arrival - media time, projected to now_us along the drift.
+ */
+static double envelope_base(const ChiakiAvSync *sync, const AvSyncStream *stream, uint64_t now_us)
+{
+	double base = 0.0;
+	for(size_t i = 0; i < stream->count; i++)
+	{
+		const AvSyncBucket *bucket = envelope_bucket(stream, i);
+		double projected = (double)bucket->min + sync->slope * ((double)now_us - (double)bucket->min_at_us);
+		if(!i || projected < base)
+			base = projected;
+	}
+	return base;
+}
+
+/**
+ * Mean spread of the arrivals around the envelope, what the buffering has to cover.
+ */
+static double envelope_jitter(const AvSyncStream *stream)
+{
+	if(!stream->count)
+		return 0.0;
+	double sum = 0.0;
+	for(size_t i = 0; i < stream->count; i++)
+	{
+		const AvSyncBucket *bucket = envelope_bucket(stream, i);
+		sum += (double)(bucket->max - bucket->min);
+	}
+	return sum / (double)stream->count;
+}
+
+/**
+ * Least squares slope of the envelope minima, 0 while they span less than a quarter window.
+ */
+static double envelope_slope(const ChiakiAvSync *sync, const AvSyncStream *stream)
+{
+	if(stream->count < AV_SYNC_SLOPE_BUCKETS_MIN)
+		return 0.0;
+	const AvSyncBucket *oldest = envelope_bucket(stream, stream->count - 1);
+	const AvSyncBucket *newest = envelope_bucket(stream, 0);
+	if(newest->min_at_us - oldest->min_at_us < sync->config.window_us / 4)
+		return 0.0;
+	double x_mean = 0.0, y_mean = 0.0;
+	for(size_t i = 0; i < stream->count; i++)
+	{
+		const AvSyncBucket *bucket = envelope_bucket(stream, i);
+		x_mean += (double)(bucket->min_at_us - oldest->min_at_us);
+		y_mean += (double)(bucket->min - oldest->min);
+	}
+	x_mean /= (double)stream->count;
+	y_mean /= (double)stream->count;
+	double sxy = 0.0, sxx = 0.0;
+	for(size_t i = 0; i < stream->count; i++)
+	{
+		const AvSyncBucket *bucket = envelope_bucket(stream, i);
+		double dx = (double)(bucket->min_at_us - oldest->min_at_us) - x_mean;
+		double dy = (double)(bucket->min - oldest->min) - y_mean;
+		sxy += dx * dy;
+		sxx += dx * dx;
+	}
+	if(sxx <= 0.0)
+		return 0.0;
+	// more than the ratio can compensate is a discontinuity, not drift
+	double max = sync->config.max_ratio_deviation;
+	return clamp_double(sxy / sxx, -max, max);
+}
+
+CHIAKI_EXPORT void chiaki_av_sync_audio_frame(ChiakiAvSync *sync, uint16_t frame_index, uint64_t frame_us, uint64_t arrival_us)
+{
+	if(!frame_us)
+		return;
+	chiaki_mutex_lock(&sync->mutex);
+	if(frame_us != sync->audio_frame_us)
+	{
+		// media times of another unit duration don't line up with the envelope
+		stream_reset(&sync->audio);
+		sync->audio_frame_us = frame_us;
+		sync->clock_valid = false;
+	}
+	bool started = sync->audio.started;
+	if(!stream_advance(sync, &sync->audio, frame_index, arrival_us))
+		goto beach;
+	if(started && !sync->audio.count)
+		sync->clock_valid = false;
+	int64_t media_us = sync->audio.index * (int64_t)frame_us;
+	envelope_push(sync, &sync->audio, arrival_us, (int64_t)arrival_us - media_us);
+	sync->audio_media_end_us = media_us + (int64_t)frame_us;
+	sync->slope = envelope_slope(sync, &sync->audio);
+	sync->jitter_us = envelope_jitter(&sync->audio);
+	sync->stats.audio_frames++;
+beach:
+	chiaki_mutex_unlock(&sync->mutex);
+}
+
+static void update_target(ChiakiAvSync *sync, uint64_t now_us)
+{
+	const ChiakiAvSyncConfig *config = &sync->config;
+	// late audio units must not run the buffer dry
+	double min_us = (double)config->audio_min_us + sync->jitter_us;
+	double max_us = (double)config->audio_max_us;
+	if(min_us > max_us)
+		min_us = max_us;
+	if(!sync->error_valid || now_us >= sync->error_at_us + config->stale_us)
+	{
+		sync->error_valid = false;
+		sync->target_us = clamp_double((double)config->audio_target_us, min_us, max_us);
+		return;
+	}
+	// the audio latency moves with the buffering one to one, so this is where the error is 0
+	sync->target_us = clamp_double(sync->buffer_us + sync->error_us, min_us, max_us);
+}
+
+CHIAKI_EXPORT double chiaki_av_sync_audio_playout(ChiakiAvSync *sync, uint64_t buffered_us, uint64_t now_us)
+{
+	chiaki_mutex_lock(&sync->mutex);
+	if(!sync->audio.count)
+		goto beach;
+
+	double latency_us = (double)now_us - ((double)(sync->audio_media_end_us - (int64_t)buffered_us) + envelope_base(sync, &sync->audio, now_us));
+	if(!sync->clock_valid)
+	{
+		sync->audio_latency_us = latency_us;
+		sync->buffer_us = (double)buffered_us;
+	}
+	else
+	{
+		// the device drains in chunks, smooth out the sawtooth
+		sync->audio_latency_us += (latency_us - sync->audio_latency_us) / 8.0;
+		sync->buffer_us += ((double)buffered_us - sync->buffer_us) / 16.0;
+	}
+	sync->clock_valid = true;
+	sync->clock_at_us = now_us;
+
+	update_target(sync, now_us);
+	double max = sync->config.max_ratio_deviation;
+	double excess_s = (sync->buffer_us - sync->target_us) / 1000000.0;
+	sync->ratio = clamp_double(1.0 - sync->slope + sync->config.ratio_gain * excess_s, 1.0 - max, 1.0 + max);
+
+beach:;
+	double ratio = sync->ratio;
+	chiaki_mutex_unlock(&sync->mutex);
+	return ratio;
+}
+
+CHIAKI_EXPORT double chiaki_av_sync_resample_ratio(ChiakiAvSync *sync)
+{
+	chiaki_mutex_lock(&sync->mutex);
+	double ratio = sync->ratio;
+	chiaki_mutex_unlock(&sync->mutex);
+	return ratio;
+}
+
+CHIAKI_EXPORT void chiaki_av_sync_video_frame(ChiakiAvSync *sync, uint16_t frame_index, uint64_t arrival_us)
+{
+	chiaki_mutex_lock(&sync->mutex);
+	if(stream_advance(sync, &sync->video, frame_index, arrival_us))
+	{
+		int64_t media_us = sync->video.index * 1000000 / sync->config.video_fps;
+		envelope_push(sync, &sync->video, arrival_us, (int64_t)arrival_us - media_us);
+		sync->stats.video_frames++;
+	}
+	chiaki_mutex_unlock(&sync->mutex);
+}
+
+/**
+ * Sync error frame_index would have if presented at now_us.
+ *
+ * @return false if there is no audio clock or the frame is unknown
+ */
+static bool video_error(ChiakiAvSync *sync, uint16_t frame_index, uint64_t now_us, int64_t *latency_us, int64_t *error_us)
+{
+	if(!sync->clock_valid || now_us >= sync->clock_at_us + sync->config.stale_us || !sync->video.count)
+		return false;
+	int64_t index = sync->video.index + (int16_t)(frame_index - sync->video.last_index);
+	double sent_us = (double)(index * 1000000 / sync->config.video_fps) + envelope_base(sync, &sync->video, now_us);
+	*latency_us = (int64_t)((double)now_us - sent_us);
+	*error_us = (int64_t)((double)*latency_us - sync->audio_latency_us) - sync->config.av_offset_us;
+	return true;
+}
+
+CHIAKI_EXPORT uint64_t chiaki_av_sync_video_hold(ChiakiAvSync *sync, uint16_t frame_index, uint64_t now_us)
+{
+	chiaki_mutex_lock(&sync->mutex);
+	uint64_t hold_us = 0;
+	int64_t latency_us, error_us;
+	if(!video_error(sync, frame_index, now_us, &latency_us, &error_us))
+		goto beach;
+	if(!sync->hold_valid || sync->hold_index != frame_index)
+	{
+		sync->hold_valid = true;
+		sync->hold_index = frame_index;
+		sync->hold_error_us = error_us;
+		sync->hold_at_us = now_us;
+	}
+	// the whole hold of a frame is bounded, not each poll
+	uint64_t held_us = now_us - sync->hold_at_us;
+	if(error_us < 0 && held_us < sync->config.max_video_hold_us)
+	{
+		hold_us = (uint64_t)-error_us;
+		if(hold_us > sync->config.max_video_hold_us - held_us)
+			hold_us = sync->config.max_video_hold_us - held_us;
+	}
+beach:
+	sync->stats.video_hold_us = hold_us;
+	chiaki_mutex_unlock(&sync->mutex);
+	return hold_us;
+}
+
+CHIAKI_EXPORT void chiaki_av_sync_video_presented(ChiakiAvSync *sync, uint16_t frame_index, uint64_t now_us)
+{
+	chiaki_mutex_lock(&sync->mutex);
+	ChiakiAvSyncStats *stats = &sync->stats;
+	stats->presents++;
+	int64_t latency_us, error_us;
+	if(!video_error(sync, frame_index, now_us, &latency_us, &error_us))
+		goto beach;
+
+	int64_t unheld_error_us = error_us;
+	if(sync->hold_valid && sync->hold_index == frame_index)
+	{
+		unheld_error_us = sync->hold_error_us;
+		if(now_us > sync->hold_at_us && unheld_error_us < 0)
+			stats->held++;
+	}
+	if(!sync->error_valid)
+		sync->error_us = (double)unheld_error_us;
+	else
+		sync->error_us += ((double)unheld_error_us - sync->error_us) / 16.0;
+	sync->error_valid = true;
+	sync->error_at_us = now_us;
+
+	uint64_t abs_error_us = (uint64_t)(error_us < 0 ? -error_us : error_us);
+	stats->video_latency_us = latency_us;
+	stats->sync_error_us = error_us;
+	stats->sync_error_avg_us = stats->presents > 1
+		? (uint64_t)((int64_t)stats->sync_error_avg_us + ((int64_t)abs_error_us - (int64_t)stats->sync_error_avg_us) / 16)
+		: abs_error_us;
+	if(abs_error_us > stats->sync_error_max_us)
+		stats->sync_error_max_us = abs_error_us;
+	if(error_us > (int64_t)(500000 / sync->config.video_fps))
+		stats->late++;
+beach:
+	sync->hold_valid = false;
+	chiaki_mutex_unlock(&sync->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_av_sync_stats(ChiakiAvSync *sync, ChiakiAvSyncStats *stats)
+{
+	chiaki_mutex_lock(&sync->mutex);
+	*stats = sync->stats;
+	stats->audio_latency_us = (int64_t)sync->audio_latency_us;
+	stats->drift_ppm = -sync->slope * 1000000.0;
+	stats->audio_jitter_us = (uint64_t)sync->jitter_us;
+	stats->resample_ratio = sync->ratio;
+	stats->audio_buffer_us = sync->buffer_us > 0.0 ? (uint64_t)sync->buffer_us : 0;
+	stats->audio_target_us = (uint64_t)sync->target_us;
+	chiaki_mutex_unlock(&sync->mutex);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_av_resampler_init(ChiakiAvResampler *resampler, unsigned channels)
+{
+	memset(resampler, 0, sizeof(*resampler));
+	if(!channels || channels > CHIAKI_AV_RESAMPLER_CHANNELS_MAX)
+		return CHIAKI_ERR_INVALID_DATA;
+	resampler->channels = channels;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT size_t chiaki_av_resampler_process(ChiakiAvResampler *resampler, double ratio,
+	const int16_t *in, size_t in_frames, int16_t *out, size_t out_frames_max)
+{
+	if(!in_frames)
+		return 0;
+	if(ratio <= 0.0)
+		ratio = 1.0;
+	size_t channels = resampler->channels;
+	if(!resampler->primed)
+	{
+		// start right at the first input frame
+		memcpy(resampler->prev, in, channels * sizeof(int16_t));
+		resampler->pos = 1.0;
+		resampler->primed = true;
+	}
+
+	size_t out_frames = 0;
+	double pos = resampler->pos;
+	while(pos < (double)in_frames && out_frames < out_frames_max)
+	{
+		size_t i = (size_t)pos;
+		double frac = pos - (double)i;
+		const int16_t *a = i ? in + (i - 1) * channels : resampler->prev;
+		const int16_t *b = in + i * channels;
+		for(size_t c = 0; c < channels; c++)
+		{
+			double v = (double)a[c] + ((double)b[c] - (double)a[c]) * frac;
+			*out++ = (int16_t)(v < 0.0 ? v - 0.5 : v + 0.5);
+		}
+		out_frames++;
+		pos += ratio;
+	}
+	// input that did not fit into out is skipped
+	resampler->pos = pos < (double)in_frames ? 0.0 : pos - (double)in_frames;
+	memcpy(resampler->prev, in + (in_frames - 1) * channels, channels * sizeof(int16_t));
+	return out_frames;
+}
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
 #include <chiaki/bitstream.h>
+#include <chiaki/costacct.h>
 
 #include <string.h>
 
@@ -110,7 +111,7 @@ sps_start:
 	vl_rbsp_init(&rbsp, &vlc, ~0);
 
 	vl_rbsp_u(&rbsp, 4); // sps_video_parameter_set_id
-	vl_rbsp_u(&rbsp, 3); // sps_max_sub_layers_minus1
+	bitstream->h265.sps.max_sub_layers_minus1 = vl_rbsp_u(&rbsp, 3);
 	vl_rbsp_u(&rbsp, 1); // sps_temporal_id_nesting_flag
 
 	vl_rbsp_u(&rbsp, 2); // general_profile_space
@@ -164,7 +165,7 @@ static bool slice_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 	}
 
 	vl_vlc_eatbits(&vlc, 1); // forbidden_zero_bit
-	vl_vlc_eatbits(&vlc, 2); // nal_ref_idc
+	unsigned nal_ref_idc = vl_vlc_get_uimsbf(&vlc, 2);
 	unsigned nal_unit_type = vl_vlc_get_uimsbf(&vlc, 5);
 
 	if(nal_unit_type != 1 && nal_unit_type != 5)
@@ -172,6 +173,7 @@ static bool slice_h264(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 		CHIAKI_LOGW(bitstream->log, "parse_slice_h264: Unexpected NAL unit type %u", nal_unit_type);
 		return false;
 	}
+	slice->non_reference = nal_ref_idc == 0;
 
 	struct vl_rbsp rbsp;
 	vl_rbsp_init(&rbsp, &vlc, ~0);
@@ -238,13 +240,17 @@ static bool slice_h265(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 	vl_vlc_eatbits(&vlc, 1); // forbidden_zero_bit
 	unsigned nal_unit_type = vl_vlc_get_uimsbf(&vlc, 6);
 	vl_vlc_eatbits(&vlc, 6); // nuh_layer_id
-	vl_vlc_eatbits(&vlc, 3); // nuh_temporal_id_plus1
+	unsigned nuh_temporal_id_plus1 = vl_vlc_get_uimsbf(&vlc, 3);
 
-	if(nal_unit_type != 1 && nal_unit_type != 20)
+	if(nal_unit_type != 0 && nal_unit_type != 1 && nal_unit_type != 20)
 	{
 		CHIAKI_LOGW(bitstream->log, "parse_slice_h265: Unexpected NAL unit type %u", nal_unit_type);
 		return false;
 	}
+	// TRAIL_N (0) is a TRAIL_R (1) no other picture of its sub-layer refers to, pictures of
+	// higher sub-layers still may. Only in the highest sub-layer nothing refers to it at all.
+	slice->non_reference = nal_unit_type == 0
+		&& nuh_temporal_id_plus1 == bitstream->h265.sps.max_sub_layers_minus1 + 1;
 
 	struct vl_rbsp rbsp;
 	vl_rbsp_init(&rbsp, &vlc, ~0);
@@ -269,7 +275,7 @@ static bool slice_h265(ChiakiBitstream *bitstream, uint8_t *data, unsigned size,
 			break;
 	}
 
-	if(nal_unit_type == 1)
+	if(nal_unit_type != 20)
 	{
 		slice->reference_frame = 0xff;
 		vl_rbsp_u(&rbsp, bitstream->h265.sps.log2_max_pic_order_cnt_lsb_minus4 + 4); // slice_pic_order_cnt_lsb
@@ -314,7 +320,7 @@ static bool slice_set_reference_frame_h265(ChiakiBitstream *bitstream, uint8_t *
 	vl_vlc_eatbits(&vlc, 6); // nuh_layer_id
 	vl_vlc_eatbits(&vlc, 3); // nuh_temporal_id_plus1
 
-	if(nal_unit_type != 1)
+	if(nal_unit_type != 0 && nal_unit_type != 1)
 	{
 		CHIAKI_LOGW(bitstream->log, "slice_set_reference_frame_h265: Unexpected NAL unit type %u", nal_unit_type);
 		return false;
@@ -379,30 +385,40 @@ void chiaki_bitstream_init(ChiakiBitstream *bitstream, ChiakiLog *log, ChiakiCod
 
 bool chiaki_bitstream_header(ChiakiBitstream *bitstream, uint8_t *data, unsigned size)
 {
+	bool r;
+	chiaki_cost_scope_begin(CHIAKI_COST_BITSTREAM);
 	if(bitstream->codec == CHIAKI_CODEC_H264)
 	{
 		memset(&bitstream->h264, 0, sizeof(bitstream->h264));
-		return header_h264(bitstream, data, size);
+		r = header_h264(bitstream, data, size);
 	}
 	else
 	{
 		memset(&bitstream->h265, 0, sizeof(bitstream->h265));
-		return header_h265(bitstream, data, size);
+		r = header_h265(bitstream, data, size);
 	}
+	chiaki_cost_scope_end();
+	return r;
 }
 
 bool chiaki_bitstream_slice(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, ChiakiBitstreamSlice *slice)
 {
+	bool r;
+	chiaki_cost_scope_begin(CHIAKI_COST_BITSTREAM);
 	if(bitstream->codec == CHIAKI_CODEC_H264)
-		return slice_h264(bitstream, data, size, slice);
+		r = slice_h264(bitstream, data, size, slice);
 	else
-		return slice_h265(bitstream, data, size, slice);
+		r = slice_h265(bitstream, data, size, slice);
+	chiaki_cost_scope_end();
+	return r;
 }
 
 bool chiaki_bitstream_slice_set_reference_frame(ChiakiBitstream *bitstream, uint8_t *data, unsigned size, unsigned reference_frame)
 {
 	if(bitstream->codec == CHIAKI_CODEC_H264)
 		return false;
-	else
-		return slice_set_reference_frame_h265(bitstream, data, size, reference_frame);
+	chiaki_cost_scope_begin(CHIAKI_COST_BITSTREAM);
+	bool r = slice_set_reference_frame_h265(bitstream, data, size, reference_frame);
+	chiaki_cost_scope_end();
+	return r;
 }
@@ -13,10 +13,14 @@
 static void *congestion_control_thread_func(void *user)
 {
 	ChiakiCongestionControl *control = user;
+	chiaki_cost_thread_enter(control->takion ? control->takion->cost_acct : NULL, CHIAKI_COST_CONGESTION, "Chiaki Congest");
 
 	ChiakiErrorCode err = chiaki_bool_pred_cond_lock(&control->stop_cond);
 	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_cost_thread_leave();
 		return NULL;
+	}
 
 	while(true)
 	{
@@ -30,6 +34,8 @@ static void *congestion_control_thread_func(void *user)
 		uint64_t received = 0;
 		uint64_t lost = 0;
 		chiaki_packet_stats_get(control->stats, true, &received, &lost);
+		control->received_total += (uint32_t)received;
+		control->lost_total += (uint32_t)lost;
 
 		/* Clamp reported loss ratio to CONGESTION_MAX_REPORTED_LOSS so burst
 		 * spikes don't cause the PS5 to over-throttle its encoder.
@@ -62,6 +68,7 @@ static void *congestion_control_thread_func(void *user)
 	}
 
 	chiaki_bool_pred_cond_unlock(&control->stop_cond);
+	chiaki_cost_thread_leave();
 	return NULL;
 }
 
@@ -71,12 +78,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_congestion_control_start(ChiakiCongestionCo
 	control->stats = stats;
 	control->log = log;
 	control->packet_loss = 0;
+	control->received_total = 0;
+	control->lost_total = 0;
 
 	ChiakiErrorCode err = chiaki_bool_pred_cond_init(&control->stop_cond);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
 
-	err = chiaki_thread_create(&control->thread, congestion_control_thread_func, control);
+	err = chiaki_thread_create_role(&control->thread, CHIAKI_THREAD_ROLE_HOUSEKEEPING, congestion_control_thread_func, control);
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		chiaki_bool_pred_cond_fini(&control->stop_cond);
@@ -0,0 +1,341 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/connprofile.h>
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct conn_profile_entry_t
+{
+	ChiakiConnProfile profile;
+	uint64_t last_used;
+	bool used;
+} ConnProfileEntry;
+
+struct chiaki_conn_profile_store_t
+{
+	ChiakiConnProfileStoreConfig config;
+	ChiakiMutex mutex;
+	ConnProfileEntry *entries;
+	uint64_t use_clock;
+	ChiakiConnProfileStoreStats stats;
+};
+
+CHIAKI_EXPORT void chiaki_conn_profile_store_config_defaults(ChiakiConnProfileStoreConfig *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->capacity = 16;
+	config->max_age_ms = 7ULL * 24 * 60 * 60 * 1000;
+	config->link_max_age_ms = 10 * 60 * 1000;
+	config->max_failures = 2;
+}
+
+static uint64_t store_now_ms(ChiakiConnProfileStore *store)
+{
+	if(store->config.now_ms)
+		return store->config.now_ms(store->config.now_user);
+	return chiaki_time_now_monotonic_ms();
+}
+
+static bool str_empty(const char *s)
+{
+	return !s || !s[0];
+}
+
+static void str_copy(char *dst, size_t dst_size, const char *src)
+{
+	size_t len = strlen(src);
+	if(len >= dst_size)
+		len = dst_size - 1;
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
+static ConnProfileEntry *store_find(ChiakiConnProfileStore *store, const char *key)
+{
+	for(size_t i = 0; i < store->config.capacity; i++)
+	{
+		ConnProfileEntry *entry = &store->entries[i];
+		if(entry->used && !strcmp(entry->profile.key, key))
+			return entry;
+	}
+	return NULL;
+}
+
+static ConnProfileEntry *store_slot(ChiakiConnProfileStore *store)
+{
+	ConnProfileEntry *oldest = NULL;
+	for(size_t i = 0; i < store->config.capacity; i++)
+	{
+		ConnProfileEntry *entry = &store->entries[i];
+		if(!entry->used)
+			return entry;
+		if(!oldest || entry->last_used < oldest->last_used)
+			oldest = entry;
+	}
+	store->stats.evictions++;
+	return oldest;
+}
+
+CHIAKI_EXPORT ChiakiConnProfileStore *chiaki_conn_profile_store_new(const ChiakiConnProfileStoreConfig *config)
+{
+	if(!config->capacity)
+		return NULL;
+	ChiakiConnProfileStore *store = calloc(1, sizeof(ChiakiConnProfileStore));
+	if(!store)
+		return NULL;
+	store->config = *config;
+	store->entries = calloc(config->capacity, sizeof(ConnProfileEntry));
+	if(!store->entries)
+		goto error;
+	if(chiaki_mutex_init(&store->mutex, false) != CHIAKI_ERR_SUCCESS)
+		goto error;
+	return store;
+error:
+	free(store->entries);
+	free(store);
+	return NULL;
+}
+
+CHIAKI_EXPORT void chiaki_conn_profile_store_free(ChiakiConnProfileStore *store)
+{
+	if(!store)
+		return;
+	chiaki_mutex_fini(&store->mutex);
+	free(store->entries);
+	free(store);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_conn_profile_store_record(ChiakiConnProfileStore *store, const ChiakiConnProfile *profile)
+{
+	if(str_empty(profile->key) || strlen(profile->key) >= CHIAKI_CONN_PROFILE_KEY_SIZE)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	chiaki_mutex_lock(&store->mutex);
+	uint64_t now = store_now_ms(store);
+	ConnProfileEntry *entry = store_find(store, profile->key);
+	if(!entry)
+	{
+		entry = store_slot(store);
+		memset(entry, 0, sizeof(*entry));
+		entry->used = true;
+		str_copy(entry->profile.key, sizeof(entry->profile.key), profile->key);
+	}
+	ChiakiConnProfile *p = &entry->profile;
+
+	uint32_t parts = profile->parts & CHIAKI_CONN_PROFILE_PART_ALL;
+	if(parts & CHIAKI_CONN_PROFILE_PART_ADDR)
+	{
+		// mtu/rtt belong to the old path unless they were measured again
+		if(strcmp(p->addr, profile->addr) && !(parts & CHIAKI_CONN_PROFILE_PART_LINK))
+			p->parts &= ~CHIAKI_CONN_PROFILE_PART_LINK;
+		str_copy(p->addr, sizeof(p->addr), profile->addr);
+	}
+	if(parts & CHIAKI_CONN_PROFILE_PART_TARGET)
+		p->target = profile->target;
+	if(parts & CHIAKI_CONN_PROFILE_PART_VIDEO)
+	{
+		p->video_requested = profile->video_requested;
+		p->video_profile = profile->video_profile;
+	}
+	if(parts & CHIAKI_CONN_PROFILE_PART_LINK)
+	{
+		p->mtu_in = profile->mtu_in;
+		p->mtu_out = profile->mtu_out;
+		p->rtt_us = profile->rtt_us;
+		p->link_recorded_ms = now;
+	}
+	if(parts & CHIAKI_CONN_PROFILE_PART_REMOTE)
+		str_copy(p->remote_addr, sizeof(p->remote_addr), profile->remote_addr);
+	if(parts & CHIAKI_CONN_PROFILE_PART_HISTORY)
+		p->history = profile->history;
+	// the version the target was accepted with, keep the old one if it is not known this time
+	if(!str_empty(profile->system_version))
+		str_copy(p->system_version, sizeof(p->system_version), profile->system_version);
+	else if(parts & CHIAKI_CONN_PROFILE_PART_TARGET)
+		p->system_version[0] = '\0';
+	p->parts |= parts;
+	p->recorded_ms = now;
+	p->failures = 0;
+	entry->last_used = ++store->use_clock;
+	store->stats.records++;
+	chiaki_mutex_unlock(&store->mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static uint32_t profile_valid_parts(ChiakiConnProfileStore *store, const ChiakiConnProfile *p,
+	const char *system_version, const char *addr, uint64_t now)
+{
+	uint32_t valid = p->parts;
+	if((valid & CHIAKI_CONN_PROFILE_PART_TARGET)
+		&& !str_empty(system_version) && !str_empty(p->system_version)
+		&& strcmp(system_version, p->system_version))
+		valid &= ~CHIAKI_CONN_PROFILE_PART_TARGET;
+	if(valid & CHIAKI_CONN_PROFILE_PART_LINK)
+	{
+		// measured on another path, or the network may have changed since
+		bool same_path = str_empty(addr)
+			? (p->parts & CHIAKI_CONN_PROFILE_PART_ADDR) != 0
+			: ((p->parts & CHIAKI_CONN_PROFILE_PART_ADDR) && !strcmp(addr, p->addr));
+		if(!same_path || now - p->link_recorded_ms >= store->config.link_max_age_ms)
+			valid &= ~CHIAKI_CONN_PROFILE_PART_LINK;
+	}
+	return valid;
+}
+
+CHIAKI_EXPORT uint32_t chiaki_conn_profile_store_lookup(ChiakiConnProfileStore *store, const char *key,
+	const char *system_version, const char *addr, ChiakiConnProfile *profile)
+{
+	if(profile)
+		memset(profile, 0, sizeof(*profile));
+	if(str_empty(key))
+		return 0;
+
+	chiaki_mutex_lock(&store->mutex);
+	store->stats.lookups++;
+	uint64_t now = store_now_ms(store);
+	uint32_t valid = 0;
+	ConnProfileEntry *entry = store_find(store, key);
+	if(!entry)
+		store->stats.misses++;
+	else if(now - entry->profile.recorded_ms >= store->config.max_age_ms)
+	{
+		entry->used = false;
+		store->stats.expired++;
+	}
+	else if(store->config.max_failures && entry->profile.failures >= store->config.max_failures)
+		store->stats.ignored++;
+	else
+	{
+		valid = profile_valid_parts(store, &entry->profile, system_version, addr, now);
+		entry->last_used = ++store->use_clock;
+		if(profile)
+		{
+			*profile = entry->profile;
+			profile->parts = valid;
+		}
+		if(valid)
+			store->stats.hot++;
+	}
+	chiaki_mutex_unlock(&store->mutex);
+	return valid;
+}
+
+CHIAKI_EXPORT void chiaki_conn_profile_store_mismatch(ChiakiConnProfileStore *store, const char *key, uint32_t parts)
+{
+	if(str_empty(key))
+		return;
+	chiaki_mutex_lock(&store->mutex);
+	ConnProfileEntry *entry = store_find(store, key);
+	if(entry)
+	{
+		entry->profile.parts &= ~(parts & ~CHIAKI_CONN_PROFILE_PART_HISTORY);
+		entry->profile.failures++;
+		store->stats.mismatches++;
+	}
+	chiaki_mutex_unlock(&store->mutex);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_conn_profile_store_observe(ChiakiConnProfileStore *store, const char *key,
+	double loss, uint32_t throughput_kbps)
+{
+	if(str_empty(key) || strlen(key) >= CHIAKI_CONN_PROFILE_KEY_SIZE)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	chiaki_mutex_lock(&store->mutex);
+	ConnProfileEntry *entry = store_find(store, key);
+	if(!entry)
+	{
+		entry = store_slot(store);
+		memset(entry, 0, sizeof(*entry));
+		entry->used = true;
+		str_copy(entry->profile.key, sizeof(entry->profile.key), key);
+		entry->profile.recorded_ms = store_now_ms(store);
+	}
+	ChiakiConnProfile *p = &entry->profile;
+	if(!(p->parts & CHIAKI_CONN_PROFILE_PART_HISTORY))
+		memset(&p->history, 0, sizeof(p->history));
+	chiaki_link_history_observe(&p->history, loss, throughput_kbps);
+	p->parts |= CHIAKI_CONN_PROFILE_PART_HISTORY;
+	entry->last_used = ++store->use_clock;
+	chiaki_mutex_unlock(&store->mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_conn_profile_store_forget(ChiakiConnProfileStore *store, const char *key)
+{
+	if(str_empty(key))
+		return;
+	chiaki_mutex_lock(&store->mutex);
+	ConnProfileEntry *entry = store_find(store, key);
+	if(entry)
+		entry->used = false;
+	chiaki_mutex_unlock(&store->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_conn_profile_store_stats(ChiakiConnProfileStore *store, ChiakiConnProfileStoreStats *stats)
+{
+	chiaki_mutex_lock(&store->mutex);
+	*stats = store->stats;
+	chiaki_mutex_unlock(&store->mutex);
+}
+
+static bool video_profile_equal(const ChiakiConnectVideoProfile *a, const ChiakiConnectVideoProfile *b)
+{
+	return a->width == b->width && a->height == b->height && a->max_fps == b->max_fps
+		&& a->bitrate == b->bitrate && a->codec == b->codec;
+}
+
+CHIAKI_EXPORT uint32_t chiaki_conn_profile_apply(const ChiakiConnProfile *profile, ChiakiConnectInfo *connect_info)
+{
+	uint32_t applied = 0;
+	if((profile->parts & CHIAKI_CONN_PROFILE_PART_TARGET)
+		&& !chiaki_target_is_unknown(profile->target)
+		&& chiaki_target_is_ps5(profile->target) == connect_info->ps5)
+	{
+		connect_info->target_hint = profile->target;
+		applied |= CHIAKI_CONN_PROFILE_PART_TARGET;
+	}
+	if((profile->parts & CHIAKI_CONN_PROFILE_PART_LINK)
+		&& profile->mtu_in && profile->mtu_out && profile->rtt_us)
+	{
+		connect_info->mtu_in_hint = profile->mtu_in;
+		connect_info->mtu_out_hint = profile->mtu_out;
+		connect_info->rtt_hint_us = profile->rtt_us;
+		applied |= CHIAKI_CONN_PROFILE_PART_LINK;
+	}
+	if((profile->parts & CHIAKI_CONN_PROFILE_PART_HISTORY) && profile->history.sessions)
+	{
+		connect_info->link_history = profile->history;
+		applied |= CHIAKI_CONN_PROFILE_PART_HISTORY;
+	}
+	if((profile->parts & CHIAKI_CONN_PROFILE_PART_VIDEO)
+		&& video_profile_equal(&profile->video_requested, &connect_info->video_profile))
+	{
+		connect_info->video_profile = profile->video_profile;
+		applied |= CHIAKI_CONN_PROFILE_PART_VIDEO;
+	}
+	return applied;
+}
+
+CHIAKI_EXPORT void chiaki_conn_profile_from_session(ChiakiConnProfile *profile, ChiakiSession *session,
+	const ChiakiConnectVideoProfile *video_requested)
+{
+	profile->target = session->target;
+	profile->parts |= CHIAKI_CONN_PROFILE_PART_TARGET;
+	if(video_requested)
+	{
+		profile->video_requested = *video_requested;
+		profile->video_profile = session->connect_info.video_profile;
+		profile->parts |= CHIAKI_CONN_PROFILE_PART_VIDEO;
+	}
+	if(session->link_measured)
+	{
+		profile->mtu_in = session->mtu_in;
+		profile->mtu_out = session->mtu_out;
+		profile->rtt_us = session->rtt_us;
+		profile->parts |= CHIAKI_CONN_PROFILE_PART_LINK;
+	}
+}
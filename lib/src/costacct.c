@@ -0,0 +1,531 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/costacct.h>
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__PSVITA__)
+#include <psp2/kernel/threadmgr.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER)
+#define CHIAKI_THREAD_LOCAL __declspec(thread)
+#else
+#define CHIAKI_THREAD_LOCAL __thread
+#endif
+
+// counters have a single writer, their thread, and are read by snapshots without locking
+#if defined(_MSC_VER)
+#define COST_LOAD(p) (*(volatile uint64_t *)(p))
+#define COST_STORE(p, v) (*(volatile uint64_t *)(p) = (v))
+#else
+#define COST_LOAD(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define COST_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#endif
+#define COST_ADD(p, v) COST_STORE((p), COST_LOAD(p) + (v))
+
+#if !defined(_WIN32) && !defined(__PSVITA__) && !defined(__APPLE__) && !defined(__SWITCH__) \
+	&& defined(_POSIX_THREAD_CPUTIME) && _POSIX_THREAD_CPUTIME >= 0
+#define COST_POSIX_CPU_CLOCKS 1
+#endif
+
+typedef struct cost_clock_t
+{
+	bool valid;
+#if defined(_WIN32)
+	HANDLE thread;
+#elif defined(__PSVITA__)
+	SceUID thread_id;
+#elif defined(COST_POSIX_CPU_CLOCKS)
+	clockid_t clock;
+#endif
+} CostClock;
+
+typedef struct cost_counters_t
+{
+	uint64_t scopes;
+	uint64_t scopes_timed;
+	uint64_t timed_ns;
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+	uint64_t frees;
+	uint64_t alloc_hist[CHIAKI_COST_HIST_BUCKETS];
+} CostCounters;
+
+typedef struct cost_slot_t
+{
+	char name[CHIAKI_COST_NAME_SIZE];
+	ChiakiCostSubsys home;
+	uint64_t thread_key;
+	// the following are guarded by the mutex of the accountant
+	bool bound;
+	CostClock clock;
+	uint64_t cpu_ns_before; // of earlier bindings
+	uint64_t cpu_ns_enter;
+	CostCounters counters[CHIAKI_COST_SUBSYS_COUNT];
+} CostSlot;
+
+struct chiaki_cost_acct_t
+{
+	ChiakiCostConfig config;
+	ChiakiMutex mutex;
+	uint64_t origin_us;
+	uint64_t clock_read_ns; // what reading the CPU clock costs, taken out of timed scopes
+	CostSlot slots[CHIAKI_COST_THREADS_MAX];
+	size_t slots_count;
+	uint32_t threads_dropped;
+};
+
+typedef struct cost_frame_t
+{
+	ChiakiCostSubsys subsys;
+	uint64_t start_ns;
+	uint64_t child_ns; // timed in nested scopes
+} CostFrame;
+
+typedef struct cost_thread_t
+{
+	ChiakiCostAcct *acct;
+	CostSlot *slot;
+	unsigned int depth; // may be more than CHIAKI_COST_DEPTH_MAX
+	bool timing; // the outermost scope is timed
+	uint32_t countdown; // to the next timed outermost scope
+	CostFrame frames[CHIAKI_COST_DEPTH_MAX];
+} CostThread;
+
+static CHIAKI_THREAD_LOCAL CostThread cost_thread;
+
+static const bool cost_cpu_supported =
+#if defined(_WIN32) || defined(__PSVITA__) || defined(COST_POSIX_CPU_CLOCKS)
+	true;
+#else
+	false;
+#endif
+
+static uint64_t cost_thread_key(void)
+{
+#if defined(_WIN32)
+	return GetCurrentThreadId();
+#elif defined(__PSVITA__)
+	return (uint64_t)sceKernelGetThreadId();
+#else
+	return (uint64_t)(uintptr_t)pthread_self();
+#endif
+}
+
+#if defined(_WIN32)
+static uint64_t cost_win32_thread_ns(HANDLE thread)
+{
+	FILETIME creation, exit, kernel, user;
+	if(!GetThreadTimes(thread, &creation, &exit, &kernel, &user))
+		return 0;
+	uint64_t k = ((uint64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+	uint64_t u = ((uint64_t)user.dwHighDateTime << 32) | user.dwLowDateTime;
+	return (k + u) * 100;
+}
+#elif defined(__PSVITA__)
+static uint64_t cost_vita_thread_ns(SceUID thread_id)
+{
+	SceKernelThreadInfo info;
+	memset(&info, 0, sizeof(info));
+	info.size = sizeof(info);
+	if(sceKernelGetThreadInfo(thread_id, &info) < 0)
+		return 0;
+	return (uint64_t)info.runClocks * 1000;
+}
+#endif
+
+/**
+ * CPU time of the calling thread, for scopes.
+ */
+static uint64_t cost_self_now_ns(void)
+{
+#if defined(_WIN32)
+	return cost_win32_thread_ns(GetCurrentThread());
+#elif defined(__PSVITA__)
+	return cost_vita_thread_ns(sceKernelGetThreadId());
+#elif defined(COST_POSIX_CPU_CLOCKS)
+	struct timespec ts;
+	if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#else
+	return chiaki_time_now_monotonic_us() * 1000;
+#endif
+}
+
+/**
+ * Make clock read the CPU time of the calling thread, also from other threads.
+ */
+static void cost_clock_init_self(CostClock *clock)
+{
+	memset(clock, 0, sizeof(*clock));
+#if defined(_WIN32)
+	clock->thread = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, GetCurrentThreadId());
+	clock->valid = clock->thread != NULL;
+#elif defined(__PSVITA__)
+	clock->thread_id = sceKernelGetThreadId();
+	clock->valid = true;
+#elif defined(COST_POSIX_CPU_CLOCKS)
+	clock->valid = pthread_getcpuclockid(pthread_self(), &clock->clock) == 0;
+#endif
+}
+
+static void cost_clock_fini(CostClock *clock)
+{
+#if defined(_WIN32)
+	if(clock->thread)
+		CloseHandle(clock->thread);
+#endif
+	memset(clock, 0, sizeof(*clock));
+}
+
+/**
+ * @return the CPU time of the thread of clock, 0 if it can't be read
+ */
+static uint64_t cost_clock_read_ns(const CostClock *clock)
+{
+	if(!clock->valid)
+		return 0;
+#if defined(_WIN32)
+	return cost_win32_thread_ns(clock->thread);
+#elif defined(__PSVITA__)
+	return cost_vita_thread_ns(clock->thread_id);
+#elif defined(COST_POSIX_CPU_CLOCKS)
+	struct timespec ts;
+	if(clock_gettime(clock->clock, &ts) != 0)
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#else
+	return 0;
+#endif
+}
+
+/**
+ * A timed scope pays for reading the clock, about one read inside its own interval and one
+ * inside its parent's, which the scopes sampled mode doesn't time don't. With short scopes,
+ * like a GMAC, this would inflate the estimate several times.
+ */
+static uint64_t cost_clock_calibrate(void)
+{
+	uint64_t best = UINT64_MAX;
+	for(size_t i=0; i<16; i++)
+	{
+		uint64_t a = cost_self_now_ns();
+		uint64_t b = cost_self_now_ns();
+		if(b >= a && b - a < best)
+			best = b - a;
+	}
+	return best == UINT64_MAX ? 0 : best;
+}
+
+CHIAKI_EXPORT void chiaki_cost_config_defaults(ChiakiCostConfig *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->mode = CHIAKI_COST_MODE_SAMPLED;
+	config->sample_every = CHIAKI_COST_SAMPLE_EVERY_DEFAULT;
+}
+
+CHIAKI_EXPORT ChiakiCostAcct *chiaki_cost_acct_new(const ChiakiCostConfig *config)
+{
+	ChiakiCostAcct *acct = calloc(1, sizeof(ChiakiCostAcct));
+	if(!acct)
+		return NULL;
+	acct->config = *config;
+	if(acct->config.mode == CHIAKI_COST_MODE_DETAILED || !acct->config.sample_every)
+		acct->config.sample_every = 1;
+	if(chiaki_mutex_init(&acct->mutex, false) != CHIAKI_ERR_SUCCESS)
+	{
+		free(acct);
+		return NULL;
+	}
+	acct->origin_us = chiaki_time_now_monotonic_us();
+	acct->clock_read_ns = cost_clock_calibrate();
+	return acct;
+}
+
+CHIAKI_EXPORT void chiaki_cost_acct_free(ChiakiCostAcct *acct)
+{
+	if(!acct)
+		return;
+	for(size_t i=0; i<acct->slots_count; i++)
+		cost_clock_fini(&acct->slots[i].clock);
+	chiaki_mutex_fini(&acct->mutex);
+	free(acct);
+}
+
+CHIAKI_EXPORT const char *chiaki_cost_subsys_string(ChiakiCostSubsys subsys)
+{
+	switch(subsys)
+	{
+		case CHIAKI_COST_OTHER:
+			return "other";
+		case CHIAKI_COST_TAKION:
+			return "takion";
+		case CHIAKI_COST_GKCRYPT:
+			return "gkcrypt";
+		case CHIAKI_COST_FEC:
+			return "fec";
+		case CHIAKI_COST_BITSTREAM:
+			return "bitstream";
+		case CHIAKI_COST_SEND_BUFFER:
+			return "send_buffer";
+		case CHIAKI_COST_FEEDBACK:
+			return "feedback";
+		case CHIAKI_COST_CONGESTION:
+			return "congestion";
+		default:
+			return "unknown";
+	}
+}
+
+CHIAKI_EXPORT size_t chiaki_cost_hist_bucket(size_t size)
+{
+	size_t bucket = 0;
+	size_t limit = 16;
+	while(size > limit && bucket < CHIAKI_COST_HIST_BUCKETS - 1)
+	{
+		limit <<= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+CHIAKI_EXPORT void chiaki_cost_acct_snapshot(ChiakiCostAcct *acct, ChiakiCostSnapshot *snapshot)
+{
+	memset(snapshot, 0, sizeof(*snapshot));
+	snapshot->mode = acct->config.mode;
+	snapshot->cpu_supported = cost_cpu_supported;
+
+	uint64_t subsys_ns[CHIAKI_COST_SUBSYS_COUNT] = { 0 };
+	uint64_t cpu_ns = 0;
+
+	chiaki_mutex_lock(&acct->mutex);
+	snapshot->wall_us = chiaki_time_now_monotonic_us() - acct->origin_us;
+	snapshot->threads_count = acct->slots_count;
+	snapshot->threads_dropped = acct->threads_dropped;
+	for(size_t i=0; i<acct->slots_count; i++)
+	{
+		CostSlot *slot = &acct->slots[i];
+		uint64_t thread_ns = slot->cpu_ns_before;
+		if(slot->bound)
+		{
+			uint64_t now_ns = cost_clock_read_ns(&slot->clock);
+			if(now_ns > slot->cpu_ns_enter)
+				thread_ns += now_ns - slot->cpu_ns_enter;
+		}
+
+		ChiakiCostThreadStats *thread = &snapshot->threads[i];
+		memcpy(thread->name, slot->name, sizeof(thread->name));
+		thread->home = slot->home;
+		thread->bound = slot->bound;
+		thread->cpu_us = thread_ns / 1000;
+		cpu_ns += thread_ns;
+
+		// what wasn't in a scope was spent for the home subsystem
+		uint64_t scoped_ns = 0;
+		for(size_t s=0; s<CHIAKI_COST_SUBSYS_COUNT; s++)
+		{
+			const CostCounters *c = &slot->counters[s];
+			ChiakiCostSubsysStats *stats = &snapshot->subsys[s];
+			uint64_t scopes = COST_LOAD(&c->scopes);
+			uint64_t scopes_timed = COST_LOAD(&c->scopes_timed);
+			uint64_t timed_ns = COST_LOAD(&c->timed_ns);
+			stats->scopes += scopes;
+			stats->scopes_timed += scopes_timed;
+			stats->allocs += COST_LOAD(&c->allocs);
+			stats->alloc_bytes += COST_LOAD(&c->alloc_bytes);
+			stats->frees += COST_LOAD(&c->frees);
+			for(size_t b=0; b<CHIAKI_COST_HIST_BUCKETS; b++)
+				stats->alloc_hist[b] += COST_LOAD(&c->alloc_hist[b]);
+			if(!scopes_timed)
+				continue;
+			uint64_t estimate_ns = scopes == scopes_timed
+				? timed_ns
+				: (uint64_t)((double)timed_ns * (double)scopes / (double)scopes_timed);
+			subsys_ns[s] += estimate_ns;
+			scoped_ns += estimate_ns;
+		}
+		if(thread_ns > scoped_ns)
+			subsys_ns[slot->home] += thread_ns - scoped_ns;
+	}
+	chiaki_mutex_unlock(&acct->mutex);
+
+	snapshot->cpu_us = cpu_ns / 1000;
+	for(size_t s=0; s<CHIAKI_COST_SUBSYS_COUNT; s++)
+		snapshot->subsys[s].cpu_us = subsys_ns[s] / 1000;
+}
+
+CHIAKI_EXPORT void chiaki_cost_thread_enter(ChiakiCostAcct *acct, ChiakiCostSubsys home, const char *name)
+{
+	if(!acct)
+		return;
+	CostThread *t = &cost_thread;
+	if(t->slot)
+		chiaki_cost_thread_leave();
+
+	uint64_t key = cost_thread_key();
+	chiaki_mutex_lock(&acct->mutex);
+	CostSlot *slot = NULL;
+	for(size_t i=0; i<acct->slots_count; i++)
+	{
+		CostSlot *s = &acct->slots[i];
+		if(!s->bound && s->thread_key == key && s->home == home)
+		{
+			slot = s;
+			break;
+		}
+	}
+	if(!slot)
+	{
+		if(acct->slots_count == CHIAKI_COST_THREADS_MAX)
+		{
+			acct->threads_dropped++;
+			chiaki_mutex_unlock(&acct->mutex);
+			return;
+		}
+		slot = &acct->slots[acct->slots_count++];
+		strncpy(slot->name, name ? name : "", sizeof(slot->name) - 1);
+		slot->home = home;
+		slot->thread_key = key;
+	}
+	cost_clock_init_self(&slot->clock);
+	slot->cpu_ns_enter = cost_clock_read_ns(&slot->clock);
+	slot->bound = true;
+	chiaki_mutex_unlock(&acct->mutex);
+
+	memset(t, 0, sizeof(*t));
+	t->acct = acct;
+	t->slot = slot;
+	t->countdown = acct->config.sample_every;
+}
+
+CHIAKI_EXPORT void chiaki_cost_thread_leave(void)
+{
+	CostThread *t = &cost_thread;
+	if(!t->slot)
+		return;
+	ChiakiCostAcct *acct = t->acct;
+	CostSlot *slot = t->slot;
+	chiaki_mutex_lock(&acct->mutex);
+	uint64_t now_ns = cost_clock_read_ns(&slot->clock);
+	if(now_ns > slot->cpu_ns_enter)
+		slot->cpu_ns_before += now_ns - slot->cpu_ns_enter;
+	slot->bound = false;
+	cost_clock_fini(&slot->clock);
+	chiaki_mutex_unlock(&acct->mutex);
+	memset(t, 0, sizeof(*t));
+}
+
+CHIAKI_EXPORT ChiakiCostAcct *chiaki_cost_current(void)
+{
+	return cost_thread.acct;
+}
+
+CHIAKI_EXPORT void chiaki_cost_scope_begin(ChiakiCostSubsys subsys)
+{
+	CostThread *t = &cost_thread;
+	if(!t->slot)
+		return;
+	unsigned int depth = t->depth++;
+	if(depth >= CHIAKI_COST_DEPTH_MAX)
+		return;
+	if(!depth)
+	{
+		// nested scopes are timed along with their outermost one, so exclusive times add up
+		t->timing = --t->countdown == 0;
+		if(t->timing)
+			t->countdown = t->acct->config.sample_every;
+	}
+	CostFrame *frame = &t->frames[depth];
+	frame->subsys = subsys;
+	COST_ADD(&t->slot->counters[subsys].scopes, 1);
+	if(t->timing)
+	{
+		frame->child_ns = 0;
+		frame->start_ns = cost_self_now_ns();
+	}
+}
+
+CHIAKI_EXPORT void chiaki_cost_scope_end(void)
+{
+	CostThread *t = &cost_thread;
+	if(!t->slot || !t->depth)
+		return;
+	unsigned int depth = --t->depth;
+	if(depth >= CHIAKI_COST_DEPTH_MAX || !t->timing)
+		return;
+	CostFrame *frame = &t->frames[depth];
+	uint64_t ns = cost_self_now_ns() - frame->start_ns;
+	uint64_t excl_ns = frame->child_ns + t->acct->clock_read_ns;
+	CostCounters *c = &t->slot->counters[frame->subsys];
+	COST_ADD(&c->timed_ns, ns > excl_ns ? ns - excl_ns : 0);
+	COST_ADD(&c->scopes_timed, 1);
+	if(depth)
+		t->frames[depth - 1].child_ns += ns + t->acct->clock_read_ns;
+}
+
+static CostCounters *cost_thread_counters(CostThread *t)
+{
+	if(!t->depth)
+		return &t->slot->counters[t->slot->home];
+	unsigned int depth = t->depth < CHIAKI_COST_DEPTH_MAX ? t->depth : CHIAKI_COST_DEPTH_MAX;
+	return &t->slot->counters[t->frames[depth - 1].subsys];
+}
+
+static void cost_count_alloc(size_t size)
+{
+	CostThread *t = &cost_thread;
+	if(!t->slot)
+		return;
+	CostCounters *c = cost_thread_counters(t);
+	COST_ADD(&c->allocs, 1);
+	COST_ADD(&c->alloc_bytes, size);
+	if(t->acct->config.mode == CHIAKI_COST_MODE_DETAILED)
+		COST_ADD(&c->alloc_hist[chiaki_cost_hist_bucket(size)], 1);
+}
+
+CHIAKI_EXPORT void *chiaki_cost_malloc(size_t size)
+{
+	void *ptr = malloc(size);
+	if(ptr)
+		cost_count_alloc(size);
+	return ptr;
+}
+
+CHIAKI_EXPORT void *chiaki_cost_calloc(size_t nmemb, size_t size)
+{
+	void *ptr = calloc(nmemb, size);
+	if(ptr)
+		cost_count_alloc(nmemb * size);
+	return ptr;
+}
+
+CHIAKI_EXPORT void *chiaki_cost_realloc(void *ptr, size_t size)
+{
+	void *r = realloc(ptr, size);
+	if(r)
+		cost_count_alloc(size);
+	return r;
+}
+
+CHIAKI_EXPORT void chiaki_cost_free(void *ptr)
+{
+	if(!ptr)
+		return;
+	free(ptr);
+	CostThread *t = &cost_thread;
+	if(!t->slot)
+		return;
+	CostCounters *c = cost_thread_counters(t);
+	COST_ADD(&c->frees, 1);
+}
@@ -159,7 +159,7 @@ error_notif_pipe:
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_ctrl_start(ChiakiCtrl *ctrl)
 {
-	ChiakiErrorCode err = chiaki_thread_create(&ctrl->thread, ctrl_thread_func, ctrl);
+	ChiakiErrorCode err = chiaki_thread_create_role(&ctrl->thread, CHIAKI_THREAD_ROLE_HOUSEKEEPING, ctrl_thread_func, ctrl);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
 
@@ -306,6 +306,7 @@ static void ctrl_failed(ChiakiCtrl *ctrl, ChiakiQuitReason reason)
 static void *ctrl_thread_func(void *user)
 {
 	ChiakiCtrl *ctrl = user;
+	chiaki_cost_thread_enter(ctrl->session->cost_acct, CHIAKI_COST_OTHER, "Chiaki Ctrl");
 
 	ChiakiErrorCode err = chiaki_mutex_lock(&ctrl->notif_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
@@ -315,6 +316,7 @@ static void *ctrl_thread_func(void *user)
 	{
 		ctrl_failed(ctrl, CHIAKI_QUIT_REASON_CTRL_CONNECT_FAILED);
 		chiaki_mutex_unlock(&ctrl->notif_mutex);
+		chiaki_cost_thread_leave();
 		return NULL;
 	}
 
@@ -515,6 +517,7 @@ static void *ctrl_thread_func(void *user)
 		ctrl->sock = CHIAKI_INVALID_SOCKET;
 	}
 
+	chiaki_cost_thread_leave();
 	return NULL;
 }
 
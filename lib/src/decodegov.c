@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/decodegov.h>
+
+#include <string.h>
+
+// decode times are smoothed with weight 1 / DECODE_AVG_WEIGHT per frame
+#define DECODE_AVG_WEIGHT 8.0
+
+CHIAKI_EXPORT const char *chiaki_decode_pressure_string(ChiakiDecodePressure pressure)
+{
+	switch(pressure)
+	{
+		case CHIAKI_DECODE_PRESSURE_NONE:
+			return "none";
+		case CHIAKI_DECODE_PRESSURE_SHED:
+			return "shed";
+		case CHIAKI_DECODE_PRESSURE_ESCALATE:
+			return "escalate";
+		default:
+			return "unknown";
+	}
+}
+
+CHIAKI_EXPORT void chiaki_decode_governor_config_defaults(ChiakiDecodeGovernorConfig *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->fps = 60;
+	config->shed_load = 0.9;
+	config->clear_load = 0.75;
+	config->backlog_frames = 1.5;
+	config->shed_run_max = 1;
+	config->escalate_after_us = 2 * 1000 * 1000;
+	config->escalate_holdoff_us = 10 * 1000 * 1000;
+	config->bitrate_factor = 0.75;
+	config->bitrate_min_kbps = 1000;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_decode_governor_init(ChiakiDecodeGovernor *governor, const ChiakiDecodeGovernorConfig *config)
+{
+	if(!config->fps)
+		return CHIAKI_ERR_INVALID_DATA;
+	memset(governor, 0, sizeof(*governor));
+	governor->config = *config;
+	governor->frame_interval_us = 1000000 / config->fps;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_decode_governor_reset(ChiakiDecodeGovernor *governor)
+{
+	governor->pressure = CHIAKI_DECODE_PRESSURE_NONE;
+	governor->decode_avg_us = 0.0;
+	governor->cost_avg_us = 0.0;
+	governor->backlog_us = 0;
+	governor->unrelieved = false;
+	governor->escalation_pending = false;
+	governor->shed_run = 0;
+}
+
+static uint64_t backlog_limit_us(ChiakiDecodeGovernor *governor)
+{
+	return (uint64_t)(governor->config.backlog_frames * (double)governor->frame_interval_us);
+}
+
+static void smooth(double *avg, double sample)
+{
+	*avg += (sample - *avg) / DECODE_AVG_WEIGHT;
+}
+
+static void update_pressure(ChiakiDecodeGovernor *governor, uint64_t now_us)
+{
+	double interval = (double)governor->frame_interval_us;
+	bool backlogged = governor->backlog_us > backlog_limit_us(governor);
+
+	if(governor->pressure == CHIAKI_DECODE_PRESSURE_NONE)
+	{
+		if(governor->decode_avg_us <= governor->config.shed_load * interval && !backlogged)
+			return;
+		governor->pressure = CHIAKI_DECODE_PRESSURE_SHED;
+		governor->pressure_episodes++;
+		governor->unrelieved = false;
+		// the cost so far says nothing about what shedding achieves
+		governor->cost_avg_us = governor->decode_avg_us;
+	}
+	else if(governor->decode_avg_us < governor->config.clear_load * interval && !governor->backlog_us)
+	{
+		governor->pressure = CHIAKI_DECODE_PRESSURE_NONE;
+		governor->unrelieved = false;
+		return;
+	}
+
+	bool relieved = governor->cost_avg_us <= governor->config.shed_load * interval && !backlogged;
+	if(relieved)
+	{
+		governor->unrelieved = false;
+		governor->pressure = CHIAKI_DECODE_PRESSURE_SHED;
+		return;
+	}
+	if(!governor->unrelieved)
+	{
+		governor->unrelieved = true;
+		governor->unrelieved_since_us = now_us;
+		return;
+	}
+	if(now_us - governor->unrelieved_since_us < governor->config.escalate_after_us)
+		return;
+	if(governor->escalations && now_us - governor->escalated_us < governor->config.escalate_holdoff_us)
+		return;
+
+	governor->pressure = CHIAKI_DECODE_PRESSURE_ESCALATE;
+	governor->escalation_pending = true;
+	governor->escalations++;
+	governor->escalated_us = now_us;
+	governor->unrelieved_since_us = now_us;
+}
+
+CHIAKI_EXPORT bool chiaki_decode_governor_frame(ChiakiDecodeGovernor *governor, bool non_reference, uint64_t now_us)
+{
+	governor->frames++;
+	if(governor->pressure == CHIAKI_DECODE_PRESSURE_NONE)
+	{
+		governor->shed_run = 0;
+		return false;
+	}
+
+	if(!non_reference || governor->shed_run >= governor->config.shed_run_max)
+	{
+		governor->shed_missed++;
+		governor->shed_run = 0;
+		return false;
+	}
+
+	governor->shed++;
+	governor->shed_run++;
+	// the decoder gets a frame interval it does not have to spend
+	governor->backlog_us = governor->backlog_us > governor->frame_interval_us
+		? governor->backlog_us - governor->frame_interval_us : 0;
+	smooth(&governor->cost_avg_us, 0.0);
+	update_pressure(governor, now_us);
+	return true;
+}
+
+CHIAKI_EXPORT void chiaki_decode_governor_decoded(ChiakiDecodeGovernor *governor, uint64_t decode_us, uint64_t now_us)
+{
+	if(governor->decode_avg_us == 0.0)
+		governor->decode_avg_us = governor->cost_avg_us = (double)decode_us;
+	else
+	{
+		smooth(&governor->decode_avg_us, (double)decode_us);
+		smooth(&governor->cost_avg_us, (double)decode_us);
+	}
+
+	if(decode_us > governor->frame_interval_us)
+		governor->backlog_us += decode_us - governor->frame_interval_us;
+	else
+	{
+		uint64_t slack = governor->frame_interval_us - decode_us;
+		governor->backlog_us = governor->backlog_us > slack ? governor->backlog_us - slack : 0;
+	}
+	if(governor->backlog_us > governor->backlog_max_us)
+		governor->backlog_max_us = governor->backlog_us;
+
+	update_pressure(governor, now_us);
+}
+
+CHIAKI_EXPORT bool chiaki_decode_governor_take_escalation(ChiakiDecodeGovernor *governor)
+{
+	bool pending = governor->escalation_pending;
+	governor->escalation_pending = false;
+	return pending;
+}
+
+CHIAKI_EXPORT uint32_t chiaki_decode_governor_target_kbps(const ChiakiDecodeGovernor *governor, uint32_t bitrate_kbps)
+{
+	uint32_t target = (uint32_t)((double)bitrate_kbps * governor->config.bitrate_factor);
+	if(target < governor->config.bitrate_min_kbps)
+		target = governor->config.bitrate_min_kbps;
+	if(target > bitrate_kbps)
+		target = bitrate_kbps;
+	return target;
+}
@@ -72,7 +72,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_discovery_service_init(ChiakiDiscoveryServi
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_discovery;
 
-	err = chiaki_thread_create(&service->thread, discovery_service_thread_func, service);
+	err = chiaki_thread_create_role(&service->thread, CHIAKI_THREAD_ROLE_HOUSEKEEPING, discovery_service_thread_func, service);
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_stop_cond;
 
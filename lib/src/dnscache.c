@@ -0,0 +1,602 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/dnscache.h>
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#endif
+
+#define DNS_CACHE_WORKERS_MAX 8
+// after a failed query, lookups use what is cached instead of querying again for this long
+#define DNS_CACHE_RETRY_HOLDOFF_MS 5000
+// refresh in the background once less than 1/n of the TTL is left
+#define DNS_CACHE_REFRESH_FRACTION 10
+
+typedef enum dns_state_t
+{
+	DNS_STATE_EMPTY,
+	DNS_STATE_POSITIVE,
+	DNS_STATE_NEGATIVE
+} DnsState;
+
+typedef struct dns_answer_t
+{
+	DnsState state;
+	ChiakiDnsAddr addrs[CHIAKI_DNS_ADDRS_MAX];
+	size_t count;
+	uint64_t ttl_ms;
+	uint64_t expires_ms;
+	uint64_t retry_at_ms; // set after a failed query
+	ChiakiErrorCode last_err;
+	bool pending;
+	uint64_t generation; // bumped whenever a query for this answer completes
+} DnsAnswer;
+
+typedef struct dns_entry_t
+{
+	char host[CHIAKI_DNS_HOST_MAX];
+	uint64_t last_used;
+	size_t waiters;
+	DnsAnswer answers[2]; // IPv4, IPv6
+} DnsEntry;
+
+typedef struct dns_job_t
+{
+	DnsEntry *entry;
+	size_t family_index;
+} DnsJob;
+
+struct chiaki_dns_cache_t
+{
+	ChiakiDnsCacheConfig config;
+	ChiakiMutex mutex;
+	ChiakiCond job_cond;
+	ChiakiCond done_cond;
+
+	DnsEntry *entries;
+	size_t entries_count;
+	uint64_t use_clock;
+
+	// every answer has at most one job queued, so 2 * capacity never overflows
+	DnsJob *jobs;
+	size_t jobs_size;
+	size_t jobs_head;
+	size_t jobs_count;
+
+	ChiakiThread workers[DNS_CACHE_WORKERS_MAX];
+	size_t workers_count;
+	bool stop;
+
+	ChiakiDnsCacheStats stats;
+};
+
+static const ChiakiDnsFamily family_by_index[2] = { CHIAKI_DNS_FAMILY_IPV4, CHIAKI_DNS_FAMILY_IPV6 };
+
+CHIAKI_EXPORT void chiaki_dns_cache_config_defaults(ChiakiDnsCacheConfig *config)
+{
+	memset(config, 0, sizeof(*config));
+	chiaki_dns_getaddrinfo_backend(&config->backend);
+	config->workers = 2;
+	config->capacity = 32;
+	config->default_ttl_sec = 300;
+	config->min_ttl_sec = 30;
+	config->max_ttl_sec = 3600;
+	config->negative_ttl_sec = 30;
+	config->stale_sec = 600;
+}
+
+static uint64_t cache_now_ms(ChiakiDnsCache *cache)
+{
+	if(cache->config.now_ms)
+		return cache->config.now_ms(cache->config.now_user);
+	return chiaki_time_now_monotonic_ms();
+}
+
+static bool host_normalize(const char *host, char *out)
+{
+	size_t len = strlen(host);
+	if(!len || len >= CHIAKI_DNS_HOST_MAX)
+		return false;
+	for(size_t i = 0; i <= len; i++)
+	{
+		char c = host[i];
+		out[i] = (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+	}
+	// "host." and "host" are the same name
+	if(len > 1 && out[len - 1] == '.')
+		out[len - 1] = '\0';
+	return true;
+}
+
+static bool answer_fresh(const DnsAnswer *answer, uint64_t now)
+{
+	return answer->state != DNS_STATE_EMPTY && now < answer->expires_ms;
+}
+
+// referenced by a queued job or a waiting lookup, must stay where it is
+static bool entry_busy(const DnsEntry *entry)
+{
+	return entry->waiters || entry->answers[0].pending || entry->answers[1].pending;
+}
+
+static void job_push(ChiakiDnsCache *cache, DnsEntry *entry, size_t family_index)
+{
+	DnsAnswer *answer = &entry->answers[family_index];
+	answer->pending = true;
+	DnsJob *job = &cache->jobs[(cache->jobs_head + cache->jobs_count) % cache->jobs_size];
+	job->entry = entry;
+	job->family_index = family_index;
+	cache->jobs_count++;
+	chiaki_cond_signal(&cache->job_cond);
+}
+
+static DnsEntry *entry_get(ChiakiDnsCache *cache, const char *host)
+{
+	for(size_t i = 0; i < cache->entries_count; i++)
+	{
+		if(!strcmp(cache->entries[i].host, host))
+			return &cache->entries[i];
+	}
+
+	DnsEntry *entry = NULL;
+	if(cache->entries_count < cache->config.capacity)
+		entry = &cache->entries[cache->entries_count++];
+	else
+	{
+		// least recently used, but never one that is still in use
+		for(size_t i = 0; i < cache->entries_count; i++)
+		{
+			DnsEntry *e = &cache->entries[i];
+			if(entry_busy(e))
+				continue;
+			if(!entry || e->last_used < entry->last_used)
+				entry = e;
+		}
+		if(!entry)
+			return NULL;
+		if(entry->host[0])
+			cache->stats.evictions++;
+	}
+	memset(entry, 0, sizeof(*entry));
+	strcpy(entry->host, host);
+	return entry;
+}
+
+static uint64_t clamp_ttl_ms(ChiakiDnsCache *cache, uint32_t ttl_sec)
+{
+	if(ttl_sec < cache->config.min_ttl_sec)
+		ttl_sec = cache->config.min_ttl_sec;
+	if(ttl_sec > cache->config.max_ttl_sec)
+		ttl_sec = cache->config.max_ttl_sec;
+	return (uint64_t)ttl_sec * 1000;
+}
+
+static void *worker_thread_func(void *user)
+{
+	ChiakiDnsCache *cache = user;
+	char host[CHIAKI_DNS_HOST_MAX];
+	ChiakiDnsAddr addrs[CHIAKI_DNS_ADDRS_MAX];
+
+	chiaki_mutex_lock(&cache->mutex);
+	while(!cache->stop)
+	{
+		if(!cache->jobs_count)
+		{
+			chiaki_cond_wait(&cache->job_cond, &cache->mutex);
+			continue;
+		}
+		DnsJob job = cache->jobs[cache->jobs_head];
+		cache->jobs_head = (cache->jobs_head + 1) % cache->jobs_size;
+		cache->jobs_count--;
+		ChiakiDnsFamily family = family_by_index[job.family_index];
+		strcpy(host, job.entry->host);
+		chiaki_mutex_unlock(&cache->mutex);
+
+		size_t count = CHIAKI_DNS_ADDRS_MAX;
+		uint32_t ttl_sec = cache->config.default_ttl_sec;
+		uint64_t start_ms = chiaki_time_now_monotonic_ms();
+		ChiakiErrorCode err = cache->config.backend.resolve(cache->config.backend.user, host, family, addrs, &count, &ttl_sec);
+		uint64_t query_ms = chiaki_time_now_monotonic_ms() - start_ms;
+		if(count > CHIAKI_DNS_ADDRS_MAX)
+			count = CHIAKI_DNS_ADDRS_MAX;
+
+		chiaki_mutex_lock(&cache->mutex);
+		cache->stats.queries++;
+		uint64_t now = cache_now_ms(cache);
+		DnsAnswer *answer = &job.entry->answers[job.family_index];
+		answer->last_err = err;
+		if(err != CHIAKI_ERR_SUCCESS)
+		{
+			// keep what was there, it may still be served as stale
+			cache->stats.failures++;
+			answer->retry_at_ms = now + DNS_CACHE_RETRY_HOLDOFF_MS;
+			CHIAKI_LOGW(cache->config.log, "DNS cache: %s %s failed after %llu ms: %s",
+				host, family == CHIAKI_DNS_FAMILY_IPV4 ? "A" : "AAAA",
+				(unsigned long long)query_ms, chiaki_error_string(err));
+		}
+		else if(!count)
+		{
+			answer->state = DNS_STATE_NEGATIVE;
+			answer->count = 0;
+			answer->ttl_ms = (uint64_t)cache->config.negative_ttl_sec * 1000;
+			answer->expires_ms = now + answer->ttl_ms;
+			answer->retry_at_ms = 0;
+			CHIAKI_LOGV(cache->config.log, "DNS cache: %s %s has no addresses (%llu ms)",
+				host, family == CHIAKI_DNS_FAMILY_IPV4 ? "A" : "AAAA", (unsigned long long)query_ms);
+		}
+		else
+		{
+			answer->state = DNS_STATE_POSITIVE;
+			memcpy(answer->addrs, addrs, count * sizeof(ChiakiDnsAddr));
+			answer->count = count;
+			answer->ttl_ms = clamp_ttl_ms(cache, ttl_sec);
+			answer->expires_ms = now + answer->ttl_ms;
+			answer->retry_at_ms = 0;
+			CHIAKI_LOGV(cache->config.log, "DNS cache: %s %s resolved to %zu address(es), ttl %u s (%llu ms)",
+				host, family == CHIAKI_DNS_FAMILY_IPV4 ? "A" : "AAAA", count,
+				(unsigned)(answer->ttl_ms / 1000), (unsigned long long)query_ms);
+		}
+		answer->pending = false;
+		answer->generation++;
+		chiaki_cond_broadcast(&cache->done_cond);
+	}
+	chiaki_mutex_unlock(&cache->mutex);
+	return NULL;
+}
+
+CHIAKI_EXPORT ChiakiDnsCache *chiaki_dns_cache_new(const ChiakiDnsCacheConfig *config)
+{
+	if(!config->backend.resolve || !config->capacity || !config->workers)
+		return NULL;
+
+	ChiakiDnsCache *cache = calloc(1, sizeof(ChiakiDnsCache));
+	if(!cache)
+		return NULL;
+	cache->config = *config;
+	if(cache->config.workers > DNS_CACHE_WORKERS_MAX)
+		cache->config.workers = DNS_CACHE_WORKERS_MAX;
+	if(cache->config.max_ttl_sec < cache->config.min_ttl_sec)
+		cache->config.max_ttl_sec = cache->config.min_ttl_sec;
+
+	cache->entries = calloc(cache->config.capacity, sizeof(DnsEntry));
+	cache->jobs_size = cache->config.capacity * 2;
+	cache->jobs = calloc(cache->jobs_size, sizeof(DnsJob));
+	if(!cache->entries || !cache->jobs)
+		goto error_alloc;
+
+	if(chiaki_mutex_init(&cache->mutex, false) != CHIAKI_ERR_SUCCESS)
+		goto error_alloc;
+	if(chiaki_cond_init(&cache->job_cond, &cache->mutex) != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+	if(chiaki_cond_init(&cache->done_cond, &cache->mutex) != CHIAKI_ERR_SUCCESS)
+		goto error_job_cond;
+
+	for(; cache->workers_count < cache->config.workers; cache->workers_count++)
+	{
+		ChiakiThread *worker = &cache->workers[cache->workers_count];
+		if(chiaki_thread_create_role(worker, CHIAKI_THREAD_ROLE_HOUSEKEEPING, worker_thread_func, cache) != CHIAKI_ERR_SUCCESS)
+			goto error_workers;
+		chiaki_thread_set_name(worker, "Chiaki DNS");
+	}
+	return cache;
+
+error_workers:
+	chiaki_mutex_lock(&cache->mutex);
+	cache->stop = true;
+	chiaki_cond_broadcast(&cache->job_cond);
+	chiaki_mutex_unlock(&cache->mutex);
+	while(cache->workers_count > 0)
+		chiaki_thread_join(&cache->workers[--cache->workers_count], NULL);
+	chiaki_cond_fini(&cache->done_cond);
+error_job_cond:
+	chiaki_cond_fini(&cache->job_cond);
+error_mutex:
+	chiaki_mutex_fini(&cache->mutex);
+error_alloc:
+	free(cache->jobs);
+	free(cache->entries);
+	free(cache);
+	return NULL;
+}
+
+CHIAKI_EXPORT void chiaki_dns_cache_free(ChiakiDnsCache *cache)
+{
+	if(!cache)
+		return;
+	chiaki_mutex_lock(&cache->mutex);
+	cache->stop = true;
+	chiaki_cond_broadcast(&cache->job_cond);
+	chiaki_mutex_unlock(&cache->mutex);
+	for(size_t i = 0; i < cache->workers_count; i++)
+		chiaki_thread_join(&cache->workers[i], NULL);
+	chiaki_cond_fini(&cache->done_cond);
+	chiaki_cond_fini(&cache->job_cond);
+	chiaki_mutex_fini(&cache->mutex);
+	free(cache->jobs);
+	free(cache->entries);
+	free(cache);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_dns_cache_prefetch(ChiakiDnsCache *cache, const char *host, uint32_t families)
+{
+	char name[CHIAKI_DNS_HOST_MAX];
+	if(!host_normalize(host, name) || !(families & CHIAKI_DNS_FAMILY_ANY))
+		return CHIAKI_ERR_INVALID_DATA;
+
+	chiaki_mutex_lock(&cache->mutex);
+	DnsEntry *entry = entry_get(cache, name);
+	if(!entry)
+	{
+		chiaki_mutex_unlock(&cache->mutex);
+		return CHIAKI_ERR_OVERFLOW;
+	}
+	entry->last_used = ++cache->use_clock;
+	uint64_t now = cache_now_ms(cache);
+	bool started = false;
+	for(size_t i = 0; i < 2; i++)
+	{
+		DnsAnswer *answer = &entry->answers[i];
+		if(!(families & family_by_index[i]) || answer->pending || now < answer->retry_at_ms)
+			continue;
+		if(answer_fresh(answer, now) && answer->expires_ms - now > answer->ttl_ms / DNS_CACHE_REFRESH_FRACTION)
+			continue;
+		job_push(cache, entry, i);
+		started = true;
+	}
+	if(started)
+		cache->stats.prefetches++;
+	chiaki_mutex_unlock(&cache->mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static bool answers_pending(const DnsEntry *entry, const uint64_t *generations, uint32_t wait_mask)
+{
+	for(size_t i = 0; i < 2; i++)
+	{
+		if((wait_mask & family_by_index[i]) && entry->answers[i].generation == generations[i])
+			return true;
+	}
+	return false;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_dns_cache_lookup(ChiakiDnsCache *cache, const char *host, uint32_t families,
+	ChiakiDnsAddr *addrs, size_t *count, uint64_t timeout_ms)
+{
+	size_t addrs_size = *count;
+	*count = 0;
+	char name[CHIAKI_DNS_HOST_MAX];
+	if(!host_normalize(host, name) || !(families & CHIAKI_DNS_FAMILY_ANY))
+		return CHIAKI_ERR_INVALID_DATA;
+
+	chiaki_mutex_lock(&cache->mutex);
+	cache->stats.lookups++;
+	DnsEntry *entry = entry_get(cache, name);
+	if(!entry)
+	{
+		chiaki_mutex_unlock(&cache->mutex);
+		return CHIAKI_ERR_OVERFLOW;
+	}
+	entry->last_used = ++cache->use_clock;
+
+	uint64_t now = cache_now_ms(cache);
+	uint32_t wait_mask = 0;
+	bool joined = false;
+	uint64_t generations[2] = { 0 };
+	for(size_t i = 0; i < 2; i++)
+	{
+		if(!(families & family_by_index[i]))
+			continue;
+		DnsAnswer *answer = &entry->answers[i];
+		if(answer_fresh(answer, now))
+		{
+			if(answer->state == DNS_STATE_POSITIVE && !answer->pending
+				&& answer->expires_ms - now <= answer->ttl_ms / DNS_CACHE_REFRESH_FRACTION)
+			{
+				job_push(cache, entry, i);
+				cache->stats.refreshes++;
+			}
+			continue;
+		}
+		if(answer->pending)
+			joined = true;
+		else if(now < answer->retry_at_ms)
+			continue; // failed recently, answer from what is there
+		else
+			job_push(cache, entry, i);
+		wait_mask |= family_by_index[i];
+		generations[i] = answer->generation;
+	}
+
+	if(wait_mask)
+	{
+		cache->stats.waits++;
+		if(joined)
+			cache->stats.coalesced++;
+		entry->waiters++;
+		uint64_t deadline = chiaki_time_now_monotonic_ms() + timeout_ms;
+		while(answers_pending(entry, generations, wait_mask))
+		{
+			uint64_t t = chiaki_time_now_monotonic_ms();
+			if(t >= deadline)
+				break;
+			chiaki_cond_timedwait(&cache->done_cond, &cache->mutex, deadline - t);
+		}
+		entry->waiters--;
+		now = cache_now_ms(cache);
+	}
+
+	bool stale = false;
+	bool negative = false;
+	bool timed_out = false;
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	uint64_t stale_ms = (uint64_t)cache->config.stale_sec * 1000;
+	for(size_t i = 0; i < 2; i++)
+	{
+		if(!(families & family_by_index[i]))
+			continue;
+		DnsAnswer *answer = &entry->answers[i];
+		if(answer->state == DNS_STATE_POSITIVE && now < answer->expires_ms + stale_ms)
+		{
+			if(now >= answer->expires_ms)
+				stale = true;
+			for(size_t a = 0; a < answer->count && *count < addrs_size; a++)
+				addrs[(*count)++] = answer->addrs[a];
+		}
+		else if(answer->state == DNS_STATE_NEGATIVE && now < answer->expires_ms)
+			negative = true;
+		else if(answer->pending)
+			timed_out = true;
+		else if(answer->last_err != CHIAKI_ERR_SUCCESS)
+			err = answer->last_err;
+	}
+
+	if(*count)
+	{
+		if(stale)
+			cache->stats.stale_served++;
+		else if(!wait_mask)
+			cache->stats.hits++;
+		err = CHIAKI_ERR_SUCCESS;
+	}
+	else if(negative)
+	{
+		if(!wait_mask)
+			cache->stats.negative_hits++;
+		err = CHIAKI_ERR_HOST_UNREACH;
+	}
+	else if(timed_out)
+		err = CHIAKI_ERR_TIMEOUT;
+	else if(err == CHIAKI_ERR_SUCCESS)
+		err = CHIAKI_ERR_HOST_UNREACH; // answered, but stale data ran out
+	chiaki_mutex_unlock(&cache->mutex);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_dns_cache_flush(ChiakiDnsCache *cache)
+{
+	chiaki_mutex_lock(&cache->mutex);
+	for(size_t i = 0; i < cache->entries_count; i++)
+	{
+		DnsEntry *entry = &cache->entries[i];
+		if(entry_busy(entry))
+		{
+			// keep the entry and only drop the answers
+			for(size_t a = 0; a < 2; a++)
+			{
+				entry->answers[a].state = DNS_STATE_EMPTY;
+				entry->answers[a].count = 0;
+				entry->answers[a].retry_at_ms = 0;
+			}
+		}
+		else
+			memset(entry, 0, sizeof(*entry)); // empty host, reused before any live entry
+	}
+	chiaki_mutex_unlock(&cache->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_dns_cache_stats(ChiakiDnsCache *cache, ChiakiDnsCacheStats *stats)
+{
+	chiaki_mutex_lock(&cache->mutex);
+	*stats = cache->stats;
+	chiaki_mutex_unlock(&cache->mutex);
+}
+
+#ifndef __PSVITA__
+static ChiakiErrorCode getaddrinfo_resolve(void *user, const char *host, ChiakiDnsFamily family,
+	ChiakiDnsAddr *addrs, size_t *count, uint32_t *ttl_sec)
+{
+	(void)user;
+	(void)ttl_sec;
+	size_t addrs_size = *count;
+	*count = 0;
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = family == CHIAKI_DNS_FAMILY_IPV4 ? AF_INET : AF_INET6;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *result = NULL;
+	int r = getaddrinfo(host, NULL, &hints, &result);
+	if(r != 0)
+	{
+		switch(r)
+		{
+			case EAI_NONAME:
+#if defined(EAI_NODATA) && EAI_NODATA != EAI_NONAME
+			case EAI_NODATA:
+#endif
+#ifdef EAI_ADDRFAMILY
+			case EAI_ADDRFAMILY:
+#endif
+				return CHIAKI_ERR_SUCCESS;
+			case EAI_AGAIN:
+				return CHIAKI_ERR_TIMEOUT;
+			default:
+				return CHIAKI_ERR_NETWORK;
+		}
+	}
+
+	for(struct addrinfo *ai = result; ai && *count < addrs_size; ai = ai->ai_next)
+	{
+		ChiakiDnsAddr addr = { 0 };
+		if(ai->ai_family == AF_INET && family == CHIAKI_DNS_FAMILY_IPV4)
+		{
+			addr.family = CHIAKI_DNS_FAMILY_IPV4;
+			memcpy(addr.addr, &((struct sockaddr_in *)ai->ai_addr)->sin_addr, 4);
+		}
+		else if(ai->ai_family == AF_INET6 && family == CHIAKI_DNS_FAMILY_IPV6)
+		{
+			addr.family = CHIAKI_DNS_FAMILY_IPV6;
+			memcpy(addr.addr, &((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr, 16);
+		}
+		else
+			continue;
+		// getaddrinfo() lists an address once per socket type unless hints narrow it down
+		bool dup = false;
+		for(size_t i = 0; i < *count && !dup; i++)
+			dup = !memcmp(&addrs[i], &addr, sizeof(addr));
+		if(!dup)
+			addrs[(*count)++] = addr;
+	}
+	freeaddrinfo(result);
+	return CHIAKI_ERR_SUCCESS;
+}
+#endif
+
+CHIAKI_EXPORT bool chiaki_dns_getaddrinfo_backend(ChiakiDnsBackend *backend)
+{
+#ifdef __PSVITA__
+	backend->resolve = NULL;
+	backend->user = NULL;
+	return false;
+#else
+	backend->resolve = getaddrinfo_resolve;
+	backend->user = NULL;
+	return true;
+#endif
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_dns_addr_format(const ChiakiDnsAddr *addr, char *out, size_t out_size)
+{
+	int af;
+	if(addr->family == CHIAKI_DNS_FAMILY_IPV4)
+		af = AF_INET;
+	else if(addr->family == CHIAKI_DNS_FAMILY_IPV6)
+		af = AF_INET6;
+	else
+		return CHIAKI_ERR_INVALID_DATA;
+	if(!inet_ntop(af, addr->addr, out, out_size))
+		return CHIAKI_ERR_BUF_TOO_SMALL;
+	return CHIAKI_ERR_SUCCESS;
+}
@@ -1,9 +1,11 @@
 // SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
 
 #include <chiaki/fec.h>
+#include <chiaki/costacct.h>
 
 #include <jerasure.h>
 #include <cauchy.h>
+#include <galois.h>
 
 #include <string.h>
 #include <stdlib.h>
@@ -14,7 +16,7 @@ int *create_matrix(unsigned int k, unsigned int m)
 	return cauchy_original_coding_matrix(k, m, CHIAKI_FEC_WORDSIZE);
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count)
+static ChiakiErrorCode fec_decode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count)
 {
 	if(stride < unit_size)
 		return CHIAKI_ERR_INVALID_DATA;
@@ -24,7 +26,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(uint8_t *frame_buf, size_t unit_
 
 	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
 
-	int *jerasures = calloc(erasures_count + 1, sizeof(int));
+	int *jerasures = chiaki_cost_calloc(erasures_count + 1, sizeof(int));
 	if(!jerasures)
 	{
 		err = CHIAKI_ERR_MEMORY;
@@ -33,14 +35,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(uint8_t *frame_buf, size_t unit_
 	memcpy(jerasures, erasures, erasures_count * sizeof(int));
 	jerasures[erasures_count] = -1;
 
-	uint8_t **data_ptrs = calloc(k, sizeof(uint8_t *));
+	uint8_t **data_ptrs = chiaki_cost_calloc(k, sizeof(uint8_t *));
 	if(!data_ptrs)
 	{
 		err = CHIAKI_ERR_MEMORY;
 		goto error_jerasures;
 	}
 
-	uint8_t **coding_ptrs = calloc(m, sizeof(uint8_t *));
+	uint8_t **coding_ptrs = chiaki_cost_calloc(m, sizeof(uint8_t *));
 	if(!coding_ptrs)
 	{
 		err = CHIAKI_ERR_MEMORY;
@@ -64,13 +66,21 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(uint8_t *frame_buf, size_t unit_
 	else
 		err = CHIAKI_ERR_SUCCESS;
 
-	free(coding_ptrs);
+	chiaki_cost_free(coding_ptrs);
 error_data_ptrs:
-	free(data_ptrs);
+	chiaki_cost_free(data_ptrs);
 error_jerasures:
-	free(jerasures);
+	chiaki_cost_free(jerasures);
 error_matrix:
-	free(matrix);
+	free(matrix); // allocated by jerasure
+	return err;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decode(uint8_t *frame_buf, size_t unit_size, size_t stride, unsigned int k, unsigned int m, const unsigned int *erasures, size_t erasures_count)
+{
+	chiaki_cost_scope_begin(CHIAKI_COST_FEC);
+	ChiakiErrorCode err = fec_decode(frame_buf, unit_size, stride, k, m, erasures, erasures_count);
+	chiaki_cost_scope_end();
 	return err;
 }
 
@@ -84,14 +94,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_encode(uint8_t *frame_buf, size_t unit_
 
 	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
 
-	uint8_t **data_ptrs = calloc(k, sizeof(uint8_t *));
+	uint8_t **data_ptrs = chiaki_cost_calloc(k, sizeof(uint8_t *));
 	if(!data_ptrs)
 	{
 		err = CHIAKI_ERR_MEMORY;
 		goto error_matrix;
 	}
 
-	uint8_t **coding_ptrs = calloc(m, sizeof(uint8_t *));
+	uint8_t **coding_ptrs = chiaki_cost_calloc(m, sizeof(uint8_t *));
 	if(!coding_ptrs)
 	{
 		err = CHIAKI_ERR_MEMORY;
@@ -100,7 +110,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_encode(uint8_t *frame_buf, size_t unit_
 
 	for(size_t i=0; i<m; i++)
 	{
-		coding_ptrs[i] = calloc(unit_size, sizeof(uint8_t));
+		coding_ptrs[i] = chiaki_cost_calloc(unit_size, sizeof(uint8_t));
 		if(!coding_ptrs[i])
 			goto error_coding_ptrs;
 	}
@@ -118,12 +128,326 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_encode(uint8_t *frame_buf, size_t unit_
 		memcpy(frame_buf + k * unit_size + i * unit_size, coding_ptrs[i], unit_size);
 
 for(int i=0; i<m; i++)
-	free(coding_ptrs[i]);
+	chiaki_cost_free(coding_ptrs[i]);
 error_coding_ptrs:
-	free(coding_ptrs);
+	chiaki_cost_free(coding_ptrs);
 error_data_ptrs:
-	free(data_ptrs);
+	chiaki_cost_free(data_ptrs);
 error_matrix:
-	free(matrix);
+	free(matrix); // allocated by jerasure
+	return err;
+}
+
+#define FEC_DECODER_RECEIVED(decoder, index) (((decoder)->received[(index) / 8] >> ((index) % 8)) & 1)
+
+// gaps this close behind the highest source unit are taken as reordering rather than loss
+#define FEC_DECODER_REORDER_WINDOW 4
+
+CHIAKI_EXPORT void chiaki_fec_decoder_init(ChiakiFecDecoder *decoder)
+{
+	memset(decoder, 0, sizeof(*decoder));
+	decoder->fec_last = -1;
+}
+
+CHIAKI_EXPORT void chiaki_fec_decoder_fini(ChiakiFecDecoder *decoder)
+{
+	free(decoder->matrix);
+	chiaki_cost_free(decoder->buf);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decoder_frame_begin(ChiakiFecDecoder *decoder, size_t unit_size, size_t stride, unsigned int k, unsigned int m)
+{
+	// put and solve do nothing until a frame began successfully
+	decoder->k = 0;
+	if(stride < unit_size || !k || !m || k + m > CHIAKI_FEC_DECODER_UNITS_MAX)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	if(!decoder->matrix || decoder->matrix_k != k || decoder->matrix_m != m)
+	{
+		free(decoder->matrix);
+		decoder->matrix = create_matrix(k, m);
+		if(!decoder->matrix)
+			return CHIAKI_ERR_MEMORY;
+		decoder->matrix_k = k;
+		decoder->matrix_m = m;
+		// cached inverses don't depend on anything else
+	}
+
+	if(decoder->buf_stride < stride)
+	{
+		chiaki_cost_free(decoder->buf);
+		decoder->buf = chiaki_cost_malloc(CHIAKI_FEC_DECODER_ERASURES_MAX * stride);
+		if(!decoder->buf)
+		{
+			decoder->buf_stride = 0;
+			return CHIAKI_ERR_MEMORY;
+		}
+		decoder->buf_stride = stride;
+	}
+	for(size_t i=0; i<CHIAKI_FEC_DECODER_ERASURES_MAX; i++)
+		decoder->rows_buf[i] = decoder->buf + i * decoder->buf_stride;
+
+	decoder->unit_size = unit_size;
+	decoder->stride = stride;
+	memset(decoder->received, 0, sizeof(decoder->received));
+	decoder->source_received = 0;
+	decoder->source_end = 0;
+	decoder->fec_last = -1;
+	decoder->gave_up = false;
+	decoder->rows_count = 0;
+	decoder->m = m;
+	decoder->k = k;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static inline char *fec_decoder_unit(ChiakiFecDecoder *decoder, const uint8_t *frame_buf, unsigned int index)
+{
+	return (char *)(frame_buf + decoder->stride * index);
+}
+
+/**
+ * Source units that can't be received anymore or are late
+ */
+static unsigned int fec_decoder_missing(ChiakiFecDecoder *decoder)
+{
+	// fec units are sent after all source units
+	unsigned int end = decoder->fec_last >= 0 ? decoder->k : decoder->source_end;
+	return end - decoder->source_received;
+}
+
+/**
+ * Missing source units worth tracking fec rows for ahead of the fec units
+ */
+static unsigned int fec_decoder_lost(ChiakiFecDecoder *decoder)
+{
+	unsigned int missing = fec_decoder_missing(decoder);
+	// nothing is sent after the last source unit but fec units, so a gap can't be caught up with anymore
+	if(decoder->fec_last >= 0 || decoder->source_end == decoder->k)
+		return missing;
+	unsigned int start = decoder->source_end > FEC_DECODER_REORDER_WINDOW ? decoder->source_end - FEC_DECODER_REORDER_WINDOW : 0;
+	for(unsigned int i=start; i<decoder->source_end && missing; i++)
+		if(!FEC_DECODER_RECEIVED(decoder, i))
+			missing--;
+	return missing;
+}
+
+/**
+ * Start tracking a fec row, eliminating all source units received so far from it.
+ */
+static bool fec_decoder_track(ChiakiFecDecoder *decoder, const uint8_t *frame_buf, unsigned int row, bool arrived)
+{
+	if(decoder->rows_count >= CHIAKI_FEC_DECODER_ERASURES_MAX)
+		return false;
+	unsigned int slot = decoder->rows_count++;
+	uint8_t *dst = decoder->rows_buf[slot];
+	decoder->rows[slot] = (uint8_t)row;
+	decoder->rows_arrived[slot] = arrived;
+	if(arrived)
+		memcpy(dst, fec_decoder_unit(decoder, frame_buf, decoder->k + row), decoder->unit_size);
+	else
+		memset(dst, 0, decoder->unit_size);
+
+	const int *coefs = decoder->matrix + row * decoder->k;
+	for(unsigned int i=0; i<decoder->source_end; i++)
+	{
+		if(!FEC_DECODER_RECEIVED(decoder, i))
+			continue;
+		galois_w08_region_multiply(fec_decoder_unit(decoder, frame_buf, i), coefs[i], (int)decoder->unit_size, (char *)dst, 1);
+	}
+	return true;
+}
+
+static void fec_decoder_untrack(ChiakiFecDecoder *decoder, unsigned int slot)
+{
+	unsigned int last = --decoder->rows_count;
+	if(slot == last)
+		return;
+	uint8_t *buf = decoder->rows_buf[slot];
+	decoder->rows[slot] = decoder->rows[last];
+	decoder->rows_arrived[slot] = decoder->rows_arrived[last];
+	decoder->rows_buf[slot] = decoder->rows_buf[last];
+	decoder->rows_buf[last] = buf;
+}
+
+/**
+ * Track the fec rows expected next until there is one for every lost source unit,
+ * and stop tracking the ones that late source units made unnecessary.
+ */
+static void fec_decoder_speculate(ChiakiFecDecoder *decoder, const uint8_t *frame_buf)
+{
+	unsigned int missing = fec_decoder_lost(decoder);
+	if(missing > CHIAKI_FEC_DECODER_ERASURES_MAX)
+	{
+		decoder->gave_up = true;
+		return;
+	}
+	// every tracked row costs a multiply per source unit, untrack the highest expected ones first
+	for(unsigned int i=decoder->rows_count; i > 0 && decoder->rows_count > missing;)
+	{
+		i--;
+		if(!decoder->rows_arrived[i])
+			fec_decoder_untrack(decoder, i);
+	}
+	int row = decoder->fec_last;
+	for(unsigned int i=0; i<decoder->rows_count; i++)
+		if(decoder->rows[i] > row)
+			row = decoder->rows[i];
+	while(decoder->rows_count < missing)
+	{
+		row++;
+		if(row >= (int)decoder->m || !fec_decoder_track(decoder, frame_buf, (unsigned int)row, false))
+			return;
+	}
+}
+
+static void fec_decoder_put(ChiakiFecDecoder *decoder, const uint8_t *frame_buf, unsigned int index)
+{
+	if(!decoder->k || decoder->gave_up || index >= decoder->k + decoder->m || FEC_DECODER_RECEIVED(decoder, index))
+		return;
+	decoder->received[index / 8] |= 1 << (index % 8);
+
+	if(index < decoder->k)
+	{
+		decoder->source_received++;
+		if(index >= decoder->source_end)
+			decoder->source_end = index + 1;
+		for(unsigned int i=0; i<decoder->rows_count; i++)
+		{
+			int coef = decoder->matrix[decoder->rows[i] * decoder->k + index];
+			galois_w08_region_multiply(fec_decoder_unit(decoder, frame_buf, index), coef, (int)decoder->unit_size, (char *)decoder->rows_buf[i], 1);
+		}
+	}
+	else
+	{
+		unsigned int row = index - decoder->k;
+		if((int)row > decoder->fec_last)
+			decoder->fec_last = (int)row;
+		bool tracked = false;
+		unsigned int arrived = 0;
+		for(unsigned int i=0; i<decoder->rows_count;)
+		{
+			if(decoder->rows[i] == row)
+			{
+				galois_region_xor(fec_decoder_unit(decoder, frame_buf, index), (char *)decoder->rows_buf[i], (int)decoder->unit_size);
+				decoder->rows_arrived[i] = true;
+				tracked = true;
+			}
+			else if(!decoder->rows_arrived[i] && decoder->rows[i] < row)
+			{
+				// overtaken, most likely lost
+				fec_decoder_untrack(decoder, i);
+				continue;
+			}
+			if(decoder->rows_arrived[i])
+				arrived++;
+			i++;
+		}
+		if(!tracked && arrived < fec_decoder_missing(decoder))
+			fec_decoder_track(decoder, frame_buf, row, true);
+	}
+
+	fec_decoder_speculate(decoder, frame_buf);
+}
+
+CHIAKI_EXPORT void chiaki_fec_decoder_put(ChiakiFecDecoder *decoder, const uint8_t *frame_buf, unsigned int index)
+{
+	chiaki_cost_scope_begin(CHIAKI_COST_FEC);
+	fec_decoder_put(decoder, frame_buf, index);
+	chiaki_cost_scope_end();
+}
+
+static const ChiakiFecInverse *fec_decoder_inverse(ChiakiFecDecoder *decoder, const uint8_t *rows, const uint8_t *cols, unsigned int count)
+{
+	ChiakiFecInverse *lru = decoder->inverses;
+	for(size_t i=0; i<CHIAKI_FEC_DECODER_INVERSES_MAX; i++)
+	{
+		ChiakiFecInverse *inverse = &decoder->inverses[i];
+		if(inverse->count == count && inverse->k == decoder->k && inverse->m == decoder->m
+			&& !memcmp(inverse->rows, rows, count) && !memcmp(inverse->cols, cols, count))
+		{
+			inverse->used = ++decoder->inverses_tick;
+			decoder->inverse_hits++;
+			return inverse;
+		}
+		if(inverse->used < lru->used)
+			lru = inverse;
+	}
+	decoder->inverse_misses++;
+
+	int mat[CHIAKI_FEC_DECODER_ERASURES_MAX * CHIAKI_FEC_DECODER_ERASURES_MAX];
+	int inv[CHIAKI_FEC_DECODER_ERASURES_MAX * CHIAKI_FEC_DECODER_ERASURES_MAX];
+	for(unsigned int r=0; r<count; r++)
+		for(unsigned int c=0; c<count; c++)
+			mat[r * count + c] = decoder->matrix[rows[r] * decoder->k + cols[c]];
+	if(jerasure_invert_matrix(mat, inv, (int)count, CHIAKI_FEC_WORDSIZE) < 0)
+		return NULL;
+
+	lru->k = decoder->k;
+	lru->m = decoder->m;
+	lru->count = count;
+	memcpy(lru->rows, rows, count);
+	memcpy(lru->cols, cols, count);
+	for(unsigned int i=0; i<count * count; i++)
+		lru->inverse[i] = (uint8_t)inv[i];
+	lru->used = ++decoder->inverses_tick;
+	return lru;
+}
+
+static ChiakiErrorCode fec_decoder_solve(ChiakiFecDecoder *decoder, uint8_t *frame_buf)
+{
+	if(!decoder->k || decoder->gave_up)
+		return CHIAKI_ERR_UNINITIALIZED;
+	unsigned int count = decoder->k - decoder->source_received;
+	if(!count)
+		return CHIAKI_ERR_SUCCESS;
+	if(count > CHIAKI_FEC_DECODER_ERASURES_MAX)
+		return CHIAKI_ERR_UNINITIALIZED;
+
+	// the arrived rows, ascending, so loss patterns map to the same inverse
+	uint8_t rows[CHIAKI_FEC_DECODER_ERASURES_MAX];
+	uint8_t *rows_buf[CHIAKI_FEC_DECODER_ERASURES_MAX];
+	unsigned int rows_count = 0;
+	for(unsigned int i=0; i<decoder->rows_count; i++)
+	{
+		if(!decoder->rows_arrived[i])
+			continue;
+		unsigned int j = rows_count++;
+		for(; j > 0 && rows[j - 1] > decoder->rows[i]; j--)
+		{
+			rows[j] = rows[j - 1];
+			rows_buf[j] = rows_buf[j - 1];
+		}
+		rows[j] = decoder->rows[i];
+		rows_buf[j] = decoder->rows_buf[i];
+	}
+	if(rows_count < count)
+		return CHIAKI_ERR_UNINITIALIZED;
+
+	uint8_t cols[CHIAKI_FEC_DECODER_ERASURES_MAX];
+	unsigned int cols_count = 0;
+	for(unsigned int i=0; i<decoder->k && cols_count < count; i++)
+		if(!FEC_DECODER_RECEIVED(decoder, i))
+			cols[cols_count++] = (uint8_t)i;
+
+	const ChiakiFecInverse *inverse = fec_decoder_inverse(decoder, rows, cols, count);
+	if(!inverse)
+		return CHIAKI_ERR_FEC_FAILED;
+
+	// the tracked rows only hold the missing units now
+	for(unsigned int c=0; c<count; c++)
+	{
+		char *dst = fec_decoder_unit(decoder, frame_buf, cols[c]);
+		for(unsigned int r=0; r<count; r++)
+			galois_w08_region_multiply((char *)rows_buf[r], inverse->inverse[c * count + r], (int)decoder->unit_size, dst, r > 0);
+	}
+	decoder->frames_solved++;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_fec_decoder_solve(ChiakiFecDecoder *decoder, uint8_t *frame_buf)
+{
+	chiaki_cost_scope_begin(CHIAKI_COST_FEC);
+	ChiakiErrorCode err = fec_decoder_solve(decoder, frame_buf);
+	chiaki_cost_scope_end();
 	return err;
 }
@@ -33,7 +33,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_feedback_sender_init(ChiakiFeedbackSender *
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_mutex;
 
-	err = chiaki_thread_create(&feedback_sender->thread, feedback_sender_thread_func, feedback_sender);
+	err = chiaki_thread_create_role(&feedback_sender->thread, CHIAKI_THREAD_ROLE_INPUT, feedback_sender_thread_func, feedback_sender);
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_cond;
 
@@ -245,10 +245,14 @@ static bool state_cond_check(void *user)
 static void *feedback_sender_thread_func(void *user)
 {
 	ChiakiFeedbackSender *feedback_sender = user;
+	chiaki_cost_thread_enter(feedback_sender->takion->cost_acct, CHIAKI_COST_FEEDBACK, "Chiaki Feedback");
 
 	ChiakiErrorCode err = chiaki_mutex_lock(&feedback_sender->state_mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_cost_thread_leave();
 		return NULL;
+	}
 
 	uint64_t next_timeout = FEEDBACK_STATE_TIMEOUT_MIN_MS;
 	while(true)
@@ -292,5 +296,6 @@ static void *feedback_sender_thread_func(void *user)
 
 	chiaki_mutex_unlock(&feedback_sender->state_mutex);
 
+	chiaki_cost_thread_leave();
 	return NULL;
 }
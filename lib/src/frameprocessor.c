@@ -3,6 +3,7 @@
 #include <chiaki/frameprocessor.h>
 #include <chiaki/fec.h>
 #include <chiaki/video.h>
+#include <chiaki/costacct.h>
 
 #include <jerasure.h>
 
@@ -36,18 +37,71 @@ CHIAKI_EXPORT uint64_t chiaki_stream_stats_bitrate(ChiakiStreamStats *stats, uin
 	return (stats->bytes * 8 * framerate) / stats->frames;
 }
 
-#define UNIT_SLOTS_MAX 256
+#define UNIT_SLOTS_MAX CHIAKI_FRAME_PROCESSOR_UNITS_MAX
 
 struct chiaki_frame_unit_t
 {
 	size_t data_size;
+	uint64_t checksum;
 };
 
+static inline bool unit_received(ChiakiFrameProcessor *frame_processor, size_t index)
+{
+	return (frame_processor->units_received[index / 64] >> (index % 64)) & 1;
+}
+
+static inline void unit_set_received(ChiakiFrameProcessor *frame_processor, size_t index)
+{
+	frame_processor->units_received[index / 64] |= 1ull << (index % 64);
+}
+
+/**
+ * Units in [0, count) that are not received, as a mask per word of units_received
+ */
+static inline uint64_t units_missing_word(ChiakiFrameProcessor *frame_processor, size_t word, size_t count)
+{
+	uint64_t missing = ~frame_processor->units_received[word];
+	size_t end = count - word * 64;
+	if(end < 64)
+		missing &= (1ull << end) - 1;
+	return missing;
+}
+
+static inline uint64_t checksum_mix(uint64_t h, uint64_t v)
+{
+	h = (h ^ v) * 0xff51afd7ed558ccdull;
+	return h ^ (h >> 32);
+}
+
+/**
+ * Fingerprint of a unit's payload to detect conflicting duplicates: its size and three 8 byte samples.
+ * Packets are authenticated, so a conflicting duplicate is a unit of another frame that ended up
+ * at the same index, not a few flipped bits, and the samples differ.
+ */
+static uint64_t unit_checksum(const uint8_t *data, size_t size)
+{
+	uint64_t h = checksum_mix(0x9e3779b97f4a7c15ull, size);
+	if(size < 24)
+	{
+		for(size_t i=0; i<size; i++)
+			h = checksum_mix(h, data[i]);
+		return h;
+	}
+	uint64_t sample;
+	memcpy(&sample, data, sizeof(sample));
+	h = checksum_mix(h, sample);
+	memcpy(&sample, data + size / 2 - sizeof(sample) / 2, sizeof(sample));
+	h = checksum_mix(h, sample);
+	memcpy(&sample, data + size - sizeof(sample), sizeof(sample));
+	return checksum_mix(h, sample);
+}
+
 CHIAKI_EXPORT void chiaki_frame_processor_init(ChiakiFrameProcessor *frame_processor, ChiakiLog *log)
 {
 	frame_processor->log = log;
 	frame_processor->frame_buf = NULL;
 	frame_processor->frame_buf_size = 0;
+	frame_processor->frame_buf_realloc_n = 0;
 	frame_processor->buf_size_per_unit = 0;
 	frame_processor->buf_stride_per_unit = 0;
 	frame_processor->units_source_expected = 0;
@@ -62,12 +116,14 @@ CHIAKI_EXPORT void chiaki_frame_processor_init(ChiakiFrameProcessor *frame_proce
 	 * counters that chiaki_stream_stats_reset() intentionally leaves untouched. */
 	frame_processor->stream_stats.frames_total = 0;
 	frame_processor->stream_stats.bytes_total = 0;
+	chiaki_fec_decoder_init(&frame_processor->fec_decoder);
 }
 
 CHIAKI_EXPORT void chiaki_frame_processor_fini(ChiakiFrameProcessor *frame_processor)
 {
-	free(frame_processor->frame_buf);
-	free(frame_processor->unit_slots);
+	chiaki_cost_free(frame_processor->frame_buf);
+	chiaki_cost_free(frame_processor->unit_slots);
+	chiaki_fec_decoder_fini(&frame_processor->fec_decoder);
 }
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_alloc_frame(ChiakiFrameProcessor *frame_processor, ChiakiTakionAVPacket *packet)
@@ -116,12 +172,12 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_alloc_frame(ChiakiFrameProc
 		void *new_ptr = NULL;
 		if(frame_processor->unit_slots)
 		{
-			new_ptr = realloc(frame_processor->unit_slots, unit_slots_size_required * sizeof(ChiakiFrameUnit));
+			new_ptr = chiaki_cost_realloc(frame_processor->unit_slots, unit_slots_size_required * sizeof(ChiakiFrameUnit));
 			if(!new_ptr)
-				free(frame_processor->unit_slots);
+				chiaki_cost_free(frame_processor->unit_slots);
 		}
 		else
-			new_ptr = malloc(unit_slots_size_required * sizeof(ChiakiFrameUnit));
+			new_ptr = chiaki_cost_malloc(unit_slots_size_required * sizeof(ChiakiFrameUnit));
 
 		frame_processor->unit_slots = new_ptr;
 		if(!new_ptr)
@@ -132,23 +188,20 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_alloc_frame(ChiakiFrameProc
 		else
 			frame_processor->unit_slots_size = unit_slots_size_required;
 	}
-	memset(frame_processor->unit_slots, 0, frame_processor->unit_slots_size * sizeof(ChiakiFrameUnit));
+	memset(frame_processor->units_received, 0, sizeof(frame_processor->units_received));
 
 	if(frame_processor->unit_slots_size > SIZE_MAX / frame_processor->buf_stride_per_unit)
 		return CHIAKI_ERR_OVERFLOW;
 	size_t frame_buf_size_required = frame_processor->unit_slots_size * frame_processor->buf_stride_per_unit;
 	if(frame_processor->frame_buf_size < frame_buf_size_required)
 	{
-		free(frame_processor->frame_buf);
-		/* PIPE/FRAMEBUF_REALLOC: program-lifetime counter; even across reconnects, growth should stay n=1 */
-		{
-			static uint32_t framebuf_realloc_n = 0;
-			framebuf_realloc_n++;
-			CHIAKI_LOGD(frame_processor->log,
-				"PIPE/FRAMEBUF_REALLOC n=%u size=%lu",
-				framebuf_realloc_n, (unsigned long)frame_buf_size_required);
-		}
-		frame_processor->frame_buf = malloc(frame_buf_size_required + CHIAKI_VIDEO_BUFFER_PADDING_SIZE);
+		chiaki_cost_free(frame_processor->frame_buf);
+		/* PIPE/FRAMEBUF_REALLOC: per-stream counter; growth should stay n=1 */
+		frame_processor->frame_buf_realloc_n++;
+		CHIAKI_LOGD(frame_processor->log,
+			"PIPE/FRAMEBUF_REALLOC n=%u size=%lu",
+			frame_processor->frame_buf_realloc_n, (unsigned long)frame_buf_size_required);
+		frame_processor->frame_buf = chiaki_cost_malloc(frame_buf_size_required + CHIAKI_VIDEO_BUFFER_PADDING_SIZE);
 		if(!frame_processor->frame_buf)
 		{
 			frame_processor->frame_buf_size = 0;
@@ -158,6 +211,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_alloc_frame(ChiakiFrameProc
 	}
 	memset(frame_processor->frame_buf, 0, frame_buf_size_required + CHIAKI_VIDEO_BUFFER_PADDING_SIZE);
 
+	// without it, FEC falls back to chiaki_fec_decode()
+	ChiakiErrorCode err = chiaki_fec_decoder_frame_begin(&frame_processor->fec_decoder,
+			frame_processor->buf_size_per_unit, frame_processor->buf_stride_per_unit,
+			frame_processor->units_source_expected, frame_processor->units_fec_expected);
+	if(err != CHIAKI_ERR_SUCCESS)
+		CHIAKI_LOGW(frame_processor->log, "Progressive FEC unavailable for frame: %s", chiaki_error_string(err));
+
 	return CHIAKI_ERR_SUCCESS;
 }
 
@@ -182,38 +242,35 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_frame_processor_put_unit(ChiakiFrameProcess
 	}
 
 	ChiakiFrameUnit *unit = frame_processor->unit_slots + packet->unit_index;
-	if(unit->data_size)
+	uint64_t checksum = unit_checksum(packet->data, packet->data_size);
+	if(unit_received(frame_processor, packet->unit_index))
 	{
 		// Duplicates are expected on lossy/reordered UDP paths after retransmit.
 		// Accept only identical duplicates to avoid masking corrupted payloads.
+		// The checksum also covers frames that were flushed and compacted already.
 		if(unit->data_size != packet->data_size)
 		{
 			CHIAKI_LOGE(frame_processor->log, "Conflicting duplicate unit size");
 			return CHIAKI_ERR_INVALID_DATA;
 		}
-		if(!frame_processor->flushed)
+		if(unit->checksum != checksum)
 		{
-			uint8_t *existing = frame_processor->frame_buf + packet->unit_index * frame_processor->buf_stride_per_unit;
-			if(memcmp(existing, packet->data, packet->data_size) != 0)
-			{
-				CHIAKI_LOGE(frame_processor->log, "Conflicting duplicate unit payload");
-				return CHIAKI_ERR_INVALID_DATA;
-			}
+			CHIAKI_LOGE(frame_processor->log, "Conflicting duplicate unit payload");
+			return CHIAKI_ERR_INVALID_DATA;
 		}
-		// When flushed==true, frame_buf may already be compacted and no longer
-		// mapped 1:1 to per-unit slots. In that state we can't safely compare
-		// payload bytes here, so we keep first-arrival data-size validation only.
 		CHIAKI_LOGW(frame_processor->log, "Received duplicate unit");
 		return CHIAKI_ERR_SUCCESS;
-	} else {
-		unit->data_size = packet->data_size;
 	}
+	unit_set_received(frame_processor, packet->unit_index);
+	unit->data_size = packet->data_size;
+	unit->checksum = checksum;
 
 	if(!frame_processor->flushed)
 	{
 		memcpy(frame_processor->frame_buf + packet->unit_index * frame_processor->buf_stride_per_unit,
 				packet->data,
 				packet->data_size);
+		chiaki_fec_decoder_put(&frame_processor->fec_decoder, frame_processor->frame_buf, packet->unit_index);
 	}
 
 	if(packet->unit_index < frame_processor->units_source_expected)
@@ -231,42 +288,54 @@ CHIAKI_EXPORT void chiaki_frame_processor_report_packet_stats(ChiakiFrameProcess
 	chiaki_packet_stats_push_generation(packet_stats, received, expected - received);
 }
 
-static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_processor)
+static ChiakiErrorCode chiaki_frame_processor_fec_decode(ChiakiFrameProcessor *frame_processor)
 {
-	CHIAKI_LOGI(frame_processor->log, "Frame Processor received %u+%u / %u+%u units, attempting FEC",
-				frame_processor->units_source_received, frame_processor->units_fec_received,
-				frame_processor->units_source_expected, frame_processor->units_fec_expected);
-
-
-	size_t erasures_count = (frame_processor->units_source_expected + frame_processor->units_fec_expected)
-			- (frame_processor->units_source_received + frame_processor->units_fec_received);
-	unsigned int *erasures = calloc(erasures_count, sizeof(unsigned int));
+	size_t units_count = frame_processor->units_source_expected + frame_processor->units_fec_expected;
+	size_t words_count = (units_count + 63) / 64;
+	size_t erasures_count = 0;
+	for(size_t w=0; w<words_count; w++)
+		erasures_count += __builtin_popcountll(units_missing_word(frame_processor, w, units_count));
+	assert(erasures_count == units_count
+			- (frame_processor->units_source_received + frame_processor->units_fec_received));
+
+	unsigned int *erasures = chiaki_cost_calloc(erasures_count, sizeof(unsigned int));
 	if(!erasures)
 		return CHIAKI_ERR_MEMORY;
 
 	size_t erasure_index = 0;
-	for(size_t i=0; i<frame_processor->units_source_expected + frame_processor->units_fec_expected; i++)
+	for(size_t w=0; w<words_count; w++)
 	{
-		ChiakiFrameUnit *slot = frame_processor->unit_slots + i;
-		if(!slot->data_size)
-		{
-			if(erasure_index >= erasures_count)
-			{
-				// should never happen by design, but too scary not to check
-				assert(false);
-				free(erasures);
-				return CHIAKI_ERR_UNKNOWN;
-			}
-			erasures[erasure_index++] = (unsigned int)i;
-		}
+		for(uint64_t missing = units_missing_word(frame_processor, w, units_count); missing; missing &= missing - 1)
+			erasures[erasure_index++] = (unsigned int)(w * 64 + __builtin_ctzll(missing));
 	}
-	assert(erasure_index == erasures_count);
 
 	ChiakiErrorCode err = chiaki_fec_decode(frame_processor->frame_buf,
 			frame_processor->buf_size_per_unit, frame_processor->buf_stride_per_unit,
 			frame_processor->units_source_expected, frame_processor->units_fec_expected,
 			erasures, erasures_count);
 
+	chiaki_cost_free(erasures);
+	return err;
+}
+
+static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_processor)
+{
+	CHIAKI_LOGI(frame_processor->log, "Frame Processor received %u+%u / %u+%u units, attempting FEC",
+				frame_processor->units_source_received, frame_processor->units_fec_received,
+				frame_processor->units_source_expected, frame_processor->units_fec_expected);
+
+	// most of the work was done while the units arrived
+	bool progressive = true;
+	ChiakiErrorCode err = chiaki_fec_decoder_solve(&frame_processor->fec_decoder, frame_processor->frame_buf);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		// the decoder leaves frame_buf alone unless it succeeds, so the full decode sees the received units
+		if(err != CHIAKI_ERR_UNINITIALIZED)
+			CHIAKI_LOGW(frame_processor->log, "Progressive FEC failed, falling back to full decode");
+		progressive = false;
+		err = chiaki_frame_processor_fec_decode(frame_processor);
+	}
+
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		err = CHIAKI_ERR_FEC_FAILED;
@@ -274,27 +343,32 @@ static ChiakiErrorCode chiaki_frame_processor_fec(ChiakiFrameProcessor *frame_pr
 	}
 	else
 	{
-		err = CHIAKI_ERR_SUCCESS;
-		CHIAKI_LOGI(frame_processor->log, "FEC successful");
+		CHIAKI_LOGI(frame_processor->log, "FEC successful%s", progressive ? " (progressive)" : "");
 
-		// restore unit sizes
-		for(size_t i=0; i<frame_processor->units_source_expected; i++)
+		// restore sizes of the recovered units
+		size_t source_count = frame_processor->units_source_expected;
+		for(size_t w=0; w<(source_count + 63) / 64; w++)
 		{
-			ChiakiFrameUnit *slot = frame_processor->unit_slots + i;
-			uint8_t *buf_ptr = frame_processor->frame_buf + frame_processor->buf_stride_per_unit * i;
-			uint16_t padding = ntohs(*((chiaki_unaligned_uint16_t *)buf_ptr));
-			if(padding >= frame_processor->buf_size_per_unit)
+			for(uint64_t missing = units_missing_word(frame_processor, w, source_count); missing; missing &= missing - 1)
 			{
-				CHIAKI_LOGE(frame_processor->log, "Padding in unit (%#x) is larger or equals to the whole unit size (%#llx)",
-							(unsigned int)padding, frame_processor->buf_size_per_unit);
-				chiaki_log_hexdump(frame_processor->log, CHIAKI_LOG_DEBUG, buf_ptr, 0x50);
-				continue;
+				size_t i = w * 64 + __builtin_ctzll(missing);
+				ChiakiFrameUnit *slot = frame_processor->unit_slots + i;
+				uint8_t *buf_ptr = frame_processor->frame_buf + frame_processor->buf_stride_per_unit * i;
+				uint16_t padding = ntohs(*((chiaki_unaligned_uint16_t *)buf_ptr));
+				if(padding >= frame_processor->buf_size_per_unit)
+				{
+					CHIAKI_LOGE(frame_processor->log, "Padding in unit (%#x) is larger or equals to the whole unit size (%#llx)",
+								(unsigned int)padding, frame_processor->buf_size_per_unit);
+					chiaki_log_hexdump(frame_processor->log, CHIAKI_LOG_DEBUG, buf_ptr, 0x50);
+					continue;
+				}
+				slot->data_size = frame_processor->buf_size_per_unit - padding;
+				slot->checksum = unit_checksum(buf_ptr, slot->data_size);
+				unit_set_received(frame_processor, i);
 			}
-			slot->data_size = frame_processor->buf_size_per_unit - padding;
 		}
 	}
 
-	free(erasures);
 	return err;
 }
 
@@ -321,7 +395,7 @@ CHIAKI_EXPORT ChiakiFrameProcessorFlushResult chiaki_frame_processor_flush(Chiak
 	for(size_t i=0; i<frame_processor->units_source_expected; i++)
 	{
 		ChiakiFrameUnit *unit = frame_processor->unit_slots + i;
-		if(!unit->data_size)
+		if(!unit_received(frame_processor, i))
 		{
 			CHIAKI_LOGW(frame_processor->log, "Missing unit %#llx", (unsigned long long)i);
 			continue;
@@ -342,6 +416,7 @@ CHIAKI_EXPORT ChiakiFrameProcessorFlushResult chiaki_frame_processor_flush(Chiak
 	}
 
 	chiaki_stream_stats_frame(&frame_processor->stream_stats, (uint64_t)cur);
+	frame_processor->flushed = true;
 
 	*frame = frame_processor->frame_buf;
 	*frame_size = cur;
@@ -20,15 +20,24 @@
 #include "utils.h"
 
 #define KEY_BUF_CHUNK_SIZE 0x1000
+// chunks a pooled job generates before it queues up again behind the other sessions
+#define KEY_BUF_POOL_CHUNKS_PER_RUN 8
 
 static ChiakiErrorCode gkcrypt_gen_key_iv(ChiakiGKCrypt *gkcrypt, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret);
 
 static void *gkcrypt_thread_func(void *user);
+static void gkcrypt_key_buf_job(void *user);
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
+{
+	return chiaki_gkcrypt_init_pool(gkcrypt, log, key_buf_chunks, NULL, NULL, index, handshake_key, ecdh_secret);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init_pool(ChiakiGKCrypt *gkcrypt, ChiakiLog *log, size_t key_buf_chunks, ChiakiWorkerPool *pool, ChiakiWorkerAccount *account, uint8_t index, const uint8_t *handshake_key, const uint8_t *ecdh_secret)
 {
 	gkcrypt->log = log;
 	gkcrypt->index = index;
+	gkcrypt->cost_acct = chiaki_cost_current();
 
 	gkcrypt->key_buf_size = key_buf_chunks * KEY_BUF_CHUNK_SIZE;
 	gkcrypt->key_buf_populated = 0;
@@ -36,6 +45,8 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, Chiaki
 	gkcrypt->key_buf_start_offset = 0;
 	gkcrypt->last_key_pos = 0;
 	gkcrypt->key_buf_thread_stop = false;
+	gkcrypt->key_buf_pool = key_buf_chunks ? pool : NULL;
+	chiaki_worker_job_init(&gkcrypt->key_buf_job, gkcrypt_key_buf_job, gkcrypt, account);
 
 	ChiakiErrorCode err;
 	if(gkcrypt->key_buf_size)
@@ -70,9 +81,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_init(ChiakiGKCrypt *gkcrypt, Chiaki
 	gkcrypt->key_gmac_index_current = 0;
 	memcpy(gkcrypt->key_gmac_current, gkcrypt->key_gmac_base, sizeof(gkcrypt->key_gmac_current));
 
-	if(gkcrypt->key_buf)
+	if(gkcrypt->key_buf_pool)
 	{
-		err = chiaki_thread_create(&gkcrypt->key_buf_thread, gkcrypt_thread_func, gkcrypt);
+		// populate the buffer right away, like the thread would
+		chiaki_worker_pool_submit(gkcrypt->key_buf_pool, &gkcrypt->key_buf_job);
+	}
+	else if(gkcrypt->key_buf)
+	{
+		err = chiaki_thread_create_role(&gkcrypt->key_buf_thread, CHIAKI_THREAD_ROLE_CRYPTO, gkcrypt_thread_func, gkcrypt);
 		if(err != CHIAKI_ERR_SUCCESS)
 			goto error_key_buf_cond;
 
@@ -100,8 +116,13 @@ CHIAKI_EXPORT void chiaki_gkcrypt_fini(ChiakiGKCrypt *gkcrypt)
 		chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
 		gkcrypt->key_buf_thread_stop = true;
 		chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
-		chiaki_cond_signal(&gkcrypt->key_buf_cond);
-		chiaki_thread_join(&gkcrypt->key_buf_thread, NULL);
+		if(gkcrypt->key_buf_pool)
+			chiaki_worker_pool_cancel(gkcrypt->key_buf_pool, &gkcrypt->key_buf_job);
+		else
+		{
+			chiaki_cond_signal(&gkcrypt->key_buf_cond);
+			chiaki_thread_join(&gkcrypt->key_buf_thread, NULL);
+		}
 		chiaki_cond_fini(&gkcrypt->key_buf_cond);
 		chiaki_mutex_fini(&gkcrypt->key_buf_mutex);
 		chiaki_aligned_free(gkcrypt->key_buf);
@@ -325,7 +346,12 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_get_key_stream(ChiakiGKCrypt *gkcry
 	}
 
 	if(signal)
-		chiaki_cond_signal(&gkcrypt->key_buf_cond);
+	{
+		if(gkcrypt->key_buf_pool)
+			chiaki_worker_pool_submit(gkcrypt->key_buf_pool, &gkcrypt->key_buf_job);
+		else
+			chiaki_cond_signal(&gkcrypt->key_buf_cond);
+	}
 
 	return err;
 }
@@ -335,24 +361,33 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_decrypt(ChiakiGKCrypt *gkcrypt, uin
 	uint64_t padding_pre = key_pos % CHIAKI_GKCRYPT_BLOCK_SIZE;
 	size_t full_size = ((padding_pre + buf_size + CHIAKI_GKCRYPT_BLOCK_SIZE - 1) / CHIAKI_GKCRYPT_BLOCK_SIZE) * CHIAKI_GKCRYPT_BLOCK_SIZE;
 
-	uint8_t *key_stream = malloc(full_size);
+	chiaki_cost_scope_begin(CHIAKI_COST_GKCRYPT);
+	ChiakiErrorCode err = CHIAKI_ERR_MEMORY;
+	uint8_t *key_stream = chiaki_cost_malloc(full_size);
 	if(!key_stream)
-		return CHIAKI_ERR_MEMORY;
-
-	ChiakiErrorCode err = chiaki_gkcrypt_get_key_stream(gkcrypt, key_pos - padding_pre, key_stream, full_size);
-	if(err != CHIAKI_ERR_SUCCESS)
-	{
-		free(key_stream);
-		return err;
-	}
+		goto beach;
 
-	xor_bytes(buf, key_stream + padding_pre, buf_size);
-	free(key_stream);
+	err = chiaki_gkcrypt_get_key_stream(gkcrypt, key_pos - padding_pre, key_stream, full_size);
+	if(err == CHIAKI_ERR_SUCCESS)
+		xor_bytes(buf, key_stream + padding_pre, buf_size);
+	chiaki_cost_free(key_stream);
 
-	return CHIAKI_ERR_SUCCESS;
+beach:
+	chiaki_cost_scope_end();
+	return err;
 }
 
+static ChiakiErrorCode gkcrypt_gmac(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, const uint8_t *buf, size_t buf_size, uint8_t *gmac_out);
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_gkcrypt_gmac(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, const uint8_t *buf, size_t buf_size, uint8_t *gmac_out)
+{
+	chiaki_cost_scope_begin(CHIAKI_COST_GKCRYPT);
+	ChiakiErrorCode err = gkcrypt_gmac(gkcrypt, key_pos, buf, buf_size, gmac_out);
+	chiaki_cost_scope_end();
+	return err;
+}
+
+static ChiakiErrorCode gkcrypt_gmac(ChiakiGKCrypt *gkcrypt, uint64_t key_pos, const uint8_t *buf, size_t buf_size, uint8_t *gmac_out)
 {
 	uint8_t iv[CHIAKI_GKCRYPT_BLOCK_SIZE];
 	counter_add(iv, gkcrypt->iv, key_pos / 0x10);
@@ -495,10 +530,47 @@ static ChiakiErrorCode gkcrypt_generate_next_chunk(ChiakiGKCrypt *gkcrypt)
 	return err;
 }
 
+/**
+ * Make room in the buffer if necessary and generate the next chunk.
+ * Must be called with key_buf_mutex locked and key_buf_mutex_pred() true.
+ */
+static ChiakiErrorCode gkcrypt_key_buf_step(ChiakiGKCrypt *gkcrypt)
+{
+	/*
+	CHIAKI_LOGV(gkcrypt->log, "GKCrypt %d key buf size %#llx, start offset: %#llx, populated: %#llx, min key pos: %#llx, last key pos: %#llx, generating next chunk",
+				(int)gkcrypt->index,
+				(unsigned long long)gkcrypt->key_buf_size,
+				(unsigned long long)gkcrypt->key_buf_start_offset,
+				(unsigned long long)gkcrypt->key_buf_populated,
+				(unsigned long long)gkcrypt->key_buf_key_pos_min,
+				(unsigned long long)gkcrypt->last_key_pos);
+	*/
+
+	if(gkcrypt->last_key_pos > gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated)
+	{
+		// skip ahead if the last key pos is already beyond our buffer
+		uint64_t key_pos = (gkcrypt->last_key_pos / KEY_BUF_CHUNK_SIZE) * KEY_BUF_CHUNK_SIZE;
+		CHIAKI_LOGW(gkcrypt->log, "Already requested a higher key pos than in the buffer, skipping ahead from min %#llx to %#llx",
+					(unsigned long long)gkcrypt->key_buf_key_pos_min,
+					(unsigned long long)key_pos);
+		gkcrypt->key_buf_key_pos_min = key_pos;
+		gkcrypt->key_buf_start_offset = 0;
+		gkcrypt->key_buf_populated = 0;
+	}
+	else if(gkcrypt->key_buf_populated == gkcrypt->key_buf_size)
+	{
+		gkcrypt->key_buf_start_offset = (gkcrypt->key_buf_start_offset + KEY_BUF_CHUNK_SIZE) % gkcrypt->key_buf_size;
+		gkcrypt->key_buf_key_pos_min += KEY_BUF_CHUNK_SIZE;
+		gkcrypt->key_buf_populated -= KEY_BUF_CHUNK_SIZE;
+	}
+	return gkcrypt_generate_next_chunk(gkcrypt);
+}
+
 static void *gkcrypt_thread_func(void *user)
 {
 	ChiakiGKCrypt *gkcrypt = user;
 	CHIAKI_LOGV(gkcrypt->log, "GKCrypt %d thread starting", (int)gkcrypt->index);
+	chiaki_cost_thread_enter(gkcrypt->cost_acct, CHIAKI_COST_GKCRYPT, "Chiaki GKCrypt");
 
 	ChiakiErrorCode err = chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
 	assert(err == CHIAKI_ERR_SUCCESS);
@@ -509,42 +581,43 @@ static void *gkcrypt_thread_func(void *user)
 		if(gkcrypt->key_buf_thread_stop || err != CHIAKI_ERR_SUCCESS)
 			break;
 
-		/*
-		CHIAKI_LOGV(gkcrypt->log, "GKCrypt %d key buf size %#llx, start offset: %#llx, populated: %#llx, min key pos: %#llx, last key pos: %#llx, generating next chunk",
-					(int)gkcrypt->index,
-					(unsigned long long)gkcrypt->key_buf_size,
-					(unsigned long long)gkcrypt->key_buf_start_offset,
-					(unsigned long long)gkcrypt->key_buf_populated,
-					(unsigned long long)gkcrypt->key_buf_key_pos_min,
-					(unsigned long long)gkcrypt->last_key_pos);
-		*/
-
-		if(gkcrypt->last_key_pos > gkcrypt->key_buf_key_pos_min + gkcrypt->key_buf_populated)
-		{
-			// skip ahead if the last key pos is already beyond our buffer
-			uint64_t key_pos = (gkcrypt->last_key_pos / KEY_BUF_CHUNK_SIZE) * KEY_BUF_CHUNK_SIZE;
-			CHIAKI_LOGW(gkcrypt->log, "Already requested a higher key pos than in the buffer, skipping ahead from min %#llx to %#llx",
-						(unsigned long long)gkcrypt->key_buf_key_pos_min,
-						(unsigned long long)key_pos);
-			gkcrypt->key_buf_key_pos_min = key_pos;
-			gkcrypt->key_buf_start_offset = 0;
-			gkcrypt->key_buf_populated = 0;
-		}
-		else if(gkcrypt->key_buf_populated == gkcrypt->key_buf_size)
-		{
-			gkcrypt->key_buf_start_offset = (gkcrypt->key_buf_start_offset + KEY_BUF_CHUNK_SIZE) % gkcrypt->key_buf_size;
-			gkcrypt->key_buf_key_pos_min += KEY_BUF_CHUNK_SIZE;
-			gkcrypt->key_buf_populated -= KEY_BUF_CHUNK_SIZE;
-		}
-		err = gkcrypt_generate_next_chunk(gkcrypt);
+		err = gkcrypt_key_buf_step(gkcrypt);
 		if(err != CHIAKI_ERR_SUCCESS)
 			break;
 	}
 
 	chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
+	chiaki_cost_thread_leave();
 	return NULL;
 }
 
+/**
+ * The pooled counterpart of gkcrypt_thread_func(), generating a few chunks at a time.
+ */
+static void gkcrypt_key_buf_job(void *user)
+{
+	ChiakiGKCrypt *gkcrypt = user;
+	bool more = false;
+	// workers run the jobs of all sessions, so they are bound only for the run
+	chiaki_cost_thread_enter(gkcrypt->cost_acct, CHIAKI_COST_GKCRYPT, "Chiaki Worker");
+
+	chiaki_mutex_lock(&gkcrypt->key_buf_mutex);
+	for(size_t i=0; i<KEY_BUF_POOL_CHUNKS_PER_RUN; i++)
+	{
+		if(gkcrypt->key_buf_thread_stop || !key_buf_mutex_pred(gkcrypt))
+			break;
+		if(gkcrypt_key_buf_step(gkcrypt) != CHIAKI_ERR_SUCCESS)
+			break;
+		more = i + 1 == KEY_BUF_POOL_CHUNKS_PER_RUN;
+	}
+	more = more && !gkcrypt->key_buf_thread_stop && key_buf_mutex_pred(gkcrypt);
+	chiaki_mutex_unlock(&gkcrypt->key_buf_mutex);
+	chiaki_cost_thread_leave();
+
+	if(more)
+		chiaki_worker_pool_submit(gkcrypt->key_buf_pool, &gkcrypt->key_buf_job);
+}
+
 CHIAKI_EXPORT void chiaki_key_state_init(ChiakiKeyState *state)
 {
 	state->prev = 0;
@@ -0,0 +1,628 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/haptics.h>
+#include <chiaki/thread.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// frames held after gaps at most, a frame further ahead gives up the oldest gaps
+#define HAPTICS_HOLD 8
+// a frame this far behind the next one means the stream started over
+#define HAPTICS_RESTART_FRAMES 1024
+// frames and events one call can emit: the units of a packet and everything held before it
+#define HAPTICS_OUT_MAX (0x1e + HAPTICS_HOLD + 1)
+// envelope follower release per sample, level -= level >> HAPTICS_RELEASE_SHIFT, about 10 ms
+#define HAPTICS_RELEASE_SHIFT 5
+// the stream's clock is the lowest offset of this many buckets, 2 s in all
+#define HAPTICS_CLOCK_BUCKETS 8
+#define HAPTICS_CLOCK_BUCKET_US 250000
+
+typedef struct haptics_slot_t
+{
+	bool used;
+	ChiakiSeqNum16 frame_index;
+	uint64_t arrival_us;
+	uint8_t size;
+	uint8_t buf[0xff];
+} HapticsSlot;
+
+typedef struct haptics_latency_hist_t
+{
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+	uint64_t buckets[CHIAKI_HAPTICS_LATENCY_BUCKETS];
+} HapticsLatencyHist;
+
+typedef struct haptics_clock_bucket_t
+{
+	uint64_t start_us;
+	int64_t min; // arrival - media time
+} HapticsClockBucket;
+
+typedef struct haptics_out_t
+{
+	bool has_frame; // buf goes to the frame sink
+	bool has_event;
+	uint8_t size;
+	uint8_t buf[0xff];
+	ChiakiHapticsEvent event;
+} HapticsOut;
+
+struct chiaki_haptics_receiver_t
+{
+	ChiakiLog *log;
+	const ChiakiAudioSink *frame_sink;
+	const ChiakiHapticsSink *sink;
+	ChiakiMutex mutex;
+	ChiakiHapticsConfig config;
+
+	bool started;
+	bool startup; // whether the frame indices have definitely not wrapped yet
+	ChiakiSeqNum16 next; // next frame to deliver
+	int64_t next_media; // next unwrapped, counting from the first frame
+	uint64_t passed; // bit i set if frame next - 1 - i was delivered, clear if it was given up or dropped
+	HapticsSlot slots[HAPTICS_HOLD]; // frames after next, by frame_index % HAPTICS_HOLD
+	size_t held;
+	ChiakiHapticsFollower follower;
+	HapticsClockBucket clock[HAPTICS_CLOCK_BUCKETS];
+	size_t clock_head; // newest bucket
+	size_t clock_count;
+	uint8_t trigger_left;
+	uint8_t trigger_right;
+
+	ChiakiHapticsStats stats;
+	HapticsLatencyHist delivery;
+	HapticsLatencyHist lateness;
+	HapticsLatencyHist actuation;
+
+	// filled under the lock, emitted after it was released, only touched by the input thread
+	HapticsOut out[HAPTICS_OUT_MAX];
+	size_t out_count;
+};
+
+CHIAKI_EXPORT void chiaki_haptics_config_defaults(ChiakiHapticsConfig *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->reorder_us = 12000;
+	config->latency_budget_us = 40000;
+	config->gate = 8;
+	config->motor_min = 40;
+	config->gain_percent = 100;
+	config->trigger_gain_percent = 60;
+}
+
+static void stream_reset(ChiakiHapticsReceiver *receiver)
+{
+	receiver->started = false;
+	receiver->startup = true;
+	receiver->next = 0;
+	receiver->next_media = 0;
+	receiver->passed = 0;
+	for(size_t i=0; i<HAPTICS_HOLD; i++)
+		receiver->slots[i].used = false;
+	receiver->held = 0;
+	memset(&receiver->follower, 0, sizeof(receiver->follower));
+	receiver->clock_head = 0;
+	receiver->clock_count = 0;
+}
+
+CHIAKI_EXPORT ChiakiHapticsReceiver *chiaki_haptics_receiver_new(ChiakiLog *log, const ChiakiHapticsConfig *config,
+	const ChiakiAudioSink *frame_sink, const ChiakiHapticsSink *sink)
+{
+	ChiakiHapticsReceiver *receiver = calloc(1, sizeof(ChiakiHapticsReceiver));
+	if(!receiver)
+		return NULL;
+	receiver->log = log;
+	receiver->frame_sink = frame_sink;
+	receiver->sink = sink;
+	if(config)
+		receiver->config = *config;
+	else
+		chiaki_haptics_config_defaults(&receiver->config);
+	if(chiaki_mutex_init(&receiver->mutex, false) != CHIAKI_ERR_SUCCESS)
+	{
+		free(receiver);
+		return NULL;
+	}
+	stream_reset(receiver);
+	return receiver;
+}
+
+CHIAKI_EXPORT void chiaki_haptics_receiver_free(ChiakiHapticsReceiver *receiver)
+{
+	if(!receiver)
+		return;
+	chiaki_mutex_fini(&receiver->mutex);
+	free(receiver);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_receiver_reset(ChiakiHapticsReceiver *receiver)
+{
+	chiaki_mutex_lock(&receiver->mutex);
+	stream_reset(receiver);
+	receiver->trigger_left = 0;
+	receiver->trigger_right = 0;
+	chiaki_mutex_unlock(&receiver->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_receiver_set_config(ChiakiHapticsReceiver *receiver, const ChiakiHapticsConfig *config)
+{
+	chiaki_mutex_lock(&receiver->mutex);
+	receiver->config = *config;
+	chiaki_mutex_unlock(&receiver->mutex);
+}
+
+static void latency_push(HapticsLatencyHist *hist, uint64_t latency_us)
+{
+	hist->count++;
+	hist->sum_us += latency_us;
+	if(latency_us > hist->max_us)
+		hist->max_us = latency_us;
+	uint64_t bucket = latency_us / CHIAKI_HAPTICS_LATENCY_BUCKET_US;
+	if(bucket >= CHIAKI_HAPTICS_LATENCY_BUCKETS)
+		bucket = CHIAKI_HAPTICS_LATENCY_BUCKETS - 1;
+	hist->buckets[bucket]++;
+}
+
+static uint64_t latency_percentile(const HapticsLatencyHist *hist, unsigned percent)
+{
+	uint64_t rank = (hist->count * percent + 99) / 100;
+	uint64_t seen = 0;
+	for(size_t i=0; i<CHIAKI_HAPTICS_LATENCY_BUCKETS - 1; i++)
+	{
+		seen += hist->buckets[i];
+		if(seen >= rank)
+		{
+			uint64_t upper_us = (i + 1) * CHIAKI_HAPTICS_LATENCY_BUCKET_US;
+			return upper_us < hist->max_us ? upper_us : hist->max_us;
+		}
+	}
+	return hist->max_us;
+}
+
+static void latency_summary(const HapticsLatencyHist *hist, ChiakiHapticsLatency *latency)
+{
+	memset(latency, 0, sizeof(*latency));
+	if(!hist->count)
+		return;
+	latency->count = hist->count;
+	latency->mean_us = hist->sum_us / hist->count;
+	latency->p50_us = latency_percentile(hist, 50);
+	latency->p99_us = latency_percentile(hist, 99);
+	latency->max_us = hist->max_us;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_haptics_envelope_decode(ChiakiHapticsFollower *follower, const uint8_t *buf, size_t buf_size, ChiakiHapticsEnvelope *envelope)
+{
+	if(buf_size != CHIAKI_HAPTICS_FRAME_SIZE)
+		return CHIAKI_ERR_INVALID_DATA;
+	const size_t point_samples = CHIAKI_HAPTICS_FRAME_SAMPLES / CHIAKI_HAPTICS_ENVELOPE_POINTS;
+	for(size_t c=0; c<2; c++)
+	{
+		uint32_t level = follower->level[c];
+		uint8_t *points = c ? envelope->right : envelope->left;
+		for(size_t p=0; p<CHIAKI_HAPTICS_ENVELOPE_POINTS; p++)
+		{
+			uint32_t peak = 0;
+			for(size_t s=0; s<point_samples; s++)
+			{
+				int sample = (int8_t)buf[((p * point_samples + s) << 1) + c];
+				uint32_t v = (uint32_t)(sample < 0 ? -sample : sample) << 8;
+				level -= level >> HAPTICS_RELEASE_SHIFT;
+				if(v > level)
+					level = v;
+				if(level > peak)
+					peak = level;
+			}
+			// 128 << 8 is full scale
+			uint32_t amplitude = (peak * 255) / (128 << 8);
+			points[p] = amplitude > 255 ? 255 : (uint8_t)amplitude;
+		}
+		follower->level[c] = level;
+	}
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT uint8_t chiaki_haptics_trigger_intensity(uint8_t type, const uint8_t *params)
+{
+	switch(type)
+	{
+		case 0x06:
+		{
+			if(!params[0])
+				return 0;
+			unsigned amplitude = params[1] > 8 ? 8 : params[1];
+			return (uint8_t)(amplitude * 255 / 8);
+		}
+		case 0x26:
+		{
+			if(!params[8])
+				return 0;
+			uint16_t zones = (uint16_t)params[0] | ((uint16_t)params[1] << 8);
+			uint32_t strengths = (uint32_t)params[2] | ((uint32_t)params[3] << 8)
+				| ((uint32_t)params[4] << 16) | ((uint32_t)params[5] << 24);
+			unsigned strongest = 0;
+			for(unsigned zone=0; zone<10; zone++)
+			{
+				if(!(zones & (1 << zone)))
+					continue;
+				// stored as strength - 1, so an active zone is at least 1 of 8
+				unsigned strength = ((strengths >> (zone * 3)) & 7) + 1;
+				if(strength > strongest)
+					strongest = strength;
+			}
+			return (uint8_t)(strongest * 255 / 8);
+		}
+		default:
+			return 0;
+	}
+}
+
+static uint8_t rumble_motor(const ChiakiHapticsConfig *config, uint8_t amplitude, uint8_t trigger)
+{
+	uint32_t motor = 0;
+	if(amplitude > config->gate)
+	{
+		uint32_t scaled = (uint32_t)(amplitude - config->gate) * config->gain_percent / 100;
+		motor = config->motor_min + scaled * (255 - config->motor_min) / (255 - config->gate);
+		if(motor > 255)
+			motor = 255;
+	}
+	uint32_t trigger_motor = (uint32_t)trigger * config->trigger_gain_percent / 100;
+	if(trigger_motor > 255)
+		trigger_motor = 255;
+	return (uint8_t)(trigger_motor > motor ? trigger_motor : motor);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_rumble_map(const ChiakiHapticsConfig *config, const ChiakiHapticsEnvelope *envelope,
+	uint8_t trigger_left, uint8_t trigger_right, ChiakiHapticsRumble *rumble)
+{
+	for(size_t p=0; p<CHIAKI_HAPTICS_ENVELOPE_POINTS; p++)
+	{
+		rumble[p].left = rumble_motor(config, envelope->left[p], trigger_left);
+		rumble[p].right = rumble_motor(config, envelope->right[p], trigger_right);
+	}
+}
+
+static HapticsOut *out_push(ChiakiHapticsReceiver *receiver)
+{
+	if(receiver->out_count == HAPTICS_OUT_MAX)
+		return NULL;
+	HapticsOut *out = &receiver->out[receiver->out_count++];
+	out->has_frame = false;
+	out->has_event = false;
+	return out;
+}
+
+static void out_emit(ChiakiHapticsReceiver *receiver)
+{
+	for(size_t i=0; i<receiver->out_count; i++)
+	{
+		HapticsOut *out = &receiver->out[i];
+		if(out->has_frame && receiver->frame_sink && receiver->frame_sink->frame_cb)
+			receiver->frame_sink->frame_cb(out->buf, out->size, receiver->frame_sink->user);
+		if(out->has_event && receiver->sink && receiver->sink->event_cb)
+			receiver->sink->event_cb(&out->event, receiver->sink->user);
+	}
+	receiver->out_count = 0;
+}
+
+static int64_t media_time_us(int64_t media_index)
+{
+	return media_index * CHIAKI_HAPTICS_FRAME_SAMPLES * 1000000 / CHIAKI_HAPTICS_SAMPLE_RATE;
+}
+
+static void clock_push(ChiakiHapticsReceiver *receiver, int64_t media_index, uint64_t arrival_us)
+{
+	int64_t offset = (int64_t)arrival_us - media_time_us(media_index);
+	HapticsClockBucket *head = &receiver->clock[receiver->clock_head];
+	if(receiver->clock_count && arrival_us < head->start_us + HAPTICS_CLOCK_BUCKET_US)
+	{
+		if(offset < head->min)
+			head->min = offset;
+		return;
+	}
+	if(receiver->clock_count)
+		receiver->clock_head = (receiver->clock_head + 1) % HAPTICS_CLOCK_BUCKETS;
+	if(receiver->clock_count < HAPTICS_CLOCK_BUCKETS)
+		receiver->clock_count++;
+	head = &receiver->clock[receiver->clock_head];
+	head->start_us = arrival_us;
+	head->min = offset;
+}
+
+/**
+ * How far the frame is behind the stream's clock at now_us. Buckets from before a pause in the
+ * stream are left out, the console may not have counted on while it sent nothing.
+ */
+static uint64_t clock_lateness(ChiakiHapticsReceiver *receiver, int64_t media_index, uint64_t now_us)
+{
+	int64_t base = INT64_MAX;
+	for(size_t i=0; i<receiver->clock_count; i++)
+	{
+		const HapticsClockBucket *bucket = &receiver->clock[(receiver->clock_head + HAPTICS_CLOCK_BUCKETS - i) % HAPTICS_CLOCK_BUCKETS];
+		if(bucket->start_us + (HAPTICS_CLOCK_BUCKETS + 1) * HAPTICS_CLOCK_BUCKET_US <= now_us)
+			break;
+		if(bucket->min < base)
+			base = bucket->min;
+	}
+	if(base == INT64_MAX)
+		return 0;
+	int64_t lateness = (int64_t)now_us - (base + media_time_us(media_index));
+	return lateness > 0 ? (uint64_t)lateness : 0;
+}
+
+/**
+ * @return whether the frame was delivered, false if it was over the latency budget, behind the
+ * stream's clock or since it arrived. The latter holds the budget when the clock has nothing left
+ * to go by, after a pause.
+ */
+static bool frame_deliver(ChiakiHapticsReceiver *receiver, HapticsSlot *slot, uint64_t now_us)
+{
+	uint64_t latency_us = now_us > slot->arrival_us ? now_us - slot->arrival_us : 0;
+	uint64_t lateness_us = clock_lateness(receiver, receiver->next_media, now_us);
+	if(lateness_us > receiver->config.latency_budget_us || latency_us > receiver->config.latency_budget_us)
+	{
+		receiver->stats.late_dropped++;
+		return false;
+	}
+	HapticsOut *out = out_push(receiver);
+	if(!out)
+	{
+		receiver->stats.late_dropped++;
+		return false;
+	}
+	receiver->stats.frames++;
+	latency_push(&receiver->delivery, latency_us);
+	latency_push(&receiver->lateness, lateness_us);
+
+	out->has_frame = true;
+	out->size = slot->size;
+	memcpy(out->buf, slot->buf, slot->size);
+
+	ChiakiHapticsEvent *event = &out->event;
+	if(chiaki_haptics_envelope_decode(&receiver->follower, slot->buf, slot->size, &event->envelope) != CHIAKI_ERR_SUCCESS)
+	{
+		receiver->stats.undecodable++;
+		return true;
+	}
+	out->has_event = true;
+	event->has_frame = true;
+	event->frame_index = slot->frame_index;
+	event->arrival_us = slot->arrival_us;
+	event->delivered_us = now_us;
+	event->trigger_left = receiver->trigger_left;
+	event->trigger_right = receiver->trigger_right;
+	chiaki_haptics_rumble_map(&receiver->config, &event->envelope, receiver->trigger_left, receiver->trigger_right, event->rumble);
+	return true;
+}
+
+static void stream_advance(ChiakiHapticsReceiver *receiver, bool delivered)
+{
+	receiver->passed = (receiver->passed << 1) | (delivered ? 1 : 0);
+	receiver->next++;
+	receiver->next_media++;
+}
+
+static void stream_drain(ChiakiHapticsReceiver *receiver, uint64_t now_us)
+{
+	while(receiver->held)
+	{
+		HapticsSlot *slot = &receiver->slots[receiver->next % HAPTICS_HOLD];
+		if(!slot->used || slot->frame_index != receiver->next)
+			break;
+		bool delivered = frame_deliver(receiver, slot, now_us);
+		slot->used = false;
+		receiver->held--;
+		stream_advance(receiver, delivered);
+	}
+}
+
+/**
+ * Give up the gap at next and deliver what follows it.
+ */
+static void stream_give_up(ChiakiHapticsReceiver *receiver, uint64_t now_us)
+{
+	receiver->stats.lost++;
+	stream_advance(receiver, false);
+	stream_drain(receiver, now_us);
+}
+
+static void stream_expire(ChiakiHapticsReceiver *receiver, uint64_t now_us)
+{
+	while(receiver->held)
+	{
+		uint64_t oldest_us = UINT64_MAX;
+		for(size_t i=0; i<HAPTICS_HOLD; i++)
+		{
+			if(receiver->slots[i].used && receiver->slots[i].arrival_us < oldest_us)
+				oldest_us = receiver->slots[i].arrival_us;
+		}
+		if(now_us < oldest_us + receiver->config.reorder_us)
+			break;
+		stream_give_up(receiver, now_us);
+	}
+}
+
+static void stream_frame(ChiakiHapticsReceiver *receiver, ChiakiSeqNum16 frame_index, const uint8_t *buf, uint8_t size, uint64_t arrival_us)
+{
+	if(!receiver->started)
+	{
+		receiver->started = true;
+		receiver->next = frame_index;
+		receiver->passed = 0;
+	}
+
+	int32_t ahead = (int16_t)(frame_index - receiver->next);
+	if(ahead < 0)
+	{
+		if(ahead >= -64 && (receiver->passed >> (-ahead - 1)) & 1)
+		{
+			receiver->stats.redundant++;
+			return;
+		}
+		if(ahead >= -HAPTICS_RESTART_FRAMES)
+		{
+			receiver->stats.late_dropped++;
+			return;
+		}
+		CHIAKI_LOGW(receiver->log, "Haptics frame %#x far behind %#x, starting over", (unsigned)frame_index, (unsigned)receiver->next);
+		receiver->stats.restarts++;
+		stream_reset(receiver);
+		receiver->started = true;
+		receiver->next = frame_index;
+		ahead = 0;
+	}
+
+	if(ahead >= HAPTICS_HOLD)
+	{
+		// too far ahead to hold, give up gaps until it fits
+		while(receiver->held && ahead >= HAPTICS_HOLD)
+		{
+			stream_give_up(receiver, arrival_us);
+			ahead = (int16_t)(frame_index - receiver->next);
+		}
+		if(ahead >= HAPTICS_HOLD)
+		{
+			// a burst this long won't be filled anymore, play on from here
+			uint32_t skip = (uint32_t)ahead;
+			receiver->stats.lost += skip;
+			receiver->passed = skip >= 64 ? 0 : receiver->passed << skip;
+			receiver->next += (ChiakiSeqNum16)skip;
+			receiver->next_media += skip;
+			ahead = 0;
+		}
+	}
+
+	HapticsSlot *slot = &receiver->slots[frame_index % HAPTICS_HOLD];
+	if(slot->used)
+	{
+		receiver->stats.redundant++;
+		return;
+	}
+	clock_push(receiver, receiver->next_media + ahead, arrival_us);
+	if(ahead)
+		receiver->stats.reordered++;
+	else if(receiver->held)
+		receiver->stats.recovered++;
+	slot->used = true;
+	slot->frame_index = frame_index;
+	slot->arrival_us = arrival_us;
+	slot->size = size;
+	memcpy(slot->buf, buf, size);
+	receiver->held++;
+	stream_drain(receiver, arrival_us);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_receiver_av_packet(ChiakiHapticsReceiver *receiver, ChiakiTakionAVPacket *packet, uint64_t arrival_us)
+{
+	if(packet->codec != 5)
+	{
+		CHIAKI_LOGE(receiver->log, "Received Haptics Packet with unknown Codec");
+		return;
+	}
+
+	uint8_t source_units_count = chiaki_takion_av_packet_audio_source_units_count(packet);
+	uint8_t fec_units_count = chiaki_takion_av_packet_audio_fec_units_count(packet);
+	uint8_t unit_size = chiaki_takion_av_packet_audio_unit_size(packet);
+
+	if(!packet->data_size)
+	{
+		CHIAKI_LOGE(receiver->log, "Haptics AV Packet is empty");
+		return;
+	}
+
+	if((uint16_t)fec_units_count + (uint16_t)source_units_count != packet->units_in_frame_total)
+	{
+		CHIAKI_LOGE(receiver->log, "Source Units + FEC Units != Total Units in Haptics AV Packet");
+		return;
+	}
+
+	if(packet->data_size != (size_t)unit_size * (size_t)packet->units_in_frame_total)
+	{
+		CHIAKI_LOGE(receiver->log, "Haptics AV Packet size mismatch %#llx vs %#llx",
+			(unsigned long long)packet->data_size,
+			(unsigned long long)(unit_size * packet->units_in_frame_total));
+		return;
+	}
+
+	chiaki_mutex_lock(&receiver->mutex);
+
+	stream_expire(receiver, arrival_us);
+
+	if(packet->frame_index > (1 << 15))
+		receiver->startup = false;
+
+	// the FEC units are copies of the frames before the source units, oldest first,
+	// so they go first to fill gaps before anything after them has to be held
+	for(size_t fec_index=0; fec_index<fec_units_count; fec_index++)
+	{
+		// first packets will contain the same frame multiple times, ignore those
+		if(receiver->startup && packet->frame_index + fec_index < (size_t)fec_units_count + 1)
+			continue;
+		ChiakiSeqNum16 frame_index = packet->frame_index - fec_units_count + fec_index;
+		stream_frame(receiver, frame_index, packet->data + unit_size * (source_units_count + fec_index), unit_size, arrival_us);
+	}
+	for(size_t i=0; i<source_units_count; i++)
+		stream_frame(receiver, packet->frame_index + i, packet->data + unit_size * i, unit_size, arrival_us);
+
+	chiaki_mutex_unlock(&receiver->mutex);
+	out_emit(receiver);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_receiver_trigger_effects(ChiakiHapticsReceiver *receiver,
+	uint8_t type_left, const uint8_t *left, uint8_t type_right, const uint8_t *right, uint64_t arrival_us)
+{
+	uint8_t trigger_left = chiaki_haptics_trigger_intensity(type_left, left);
+	uint8_t trigger_right = chiaki_haptics_trigger_intensity(type_right, right);
+
+	chiaki_mutex_lock(&receiver->mutex);
+	stream_expire(receiver, arrival_us);
+	receiver->stats.trigger_effects++;
+	if(trigger_left != receiver->trigger_left || trigger_right != receiver->trigger_right)
+	{
+		receiver->trigger_left = trigger_left;
+		receiver->trigger_right = trigger_right;
+		HapticsOut *out = out_push(receiver);
+		if(out)
+		{
+			out->has_event = true;
+			ChiakiHapticsEvent *event = &out->event;
+			memset(event, 0, sizeof(*event));
+			event->arrival_us = arrival_us;
+			event->delivered_us = arrival_us;
+			event->trigger_left = trigger_left;
+			event->trigger_right = trigger_right;
+			chiaki_haptics_rumble_map(&receiver->config, &event->envelope, trigger_left, trigger_right, event->rumble);
+		}
+	}
+	chiaki_mutex_unlock(&receiver->mutex);
+	out_emit(receiver);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_receiver_poll(ChiakiHapticsReceiver *receiver, uint64_t now_us)
+{
+	chiaki_mutex_lock(&receiver->mutex);
+	stream_expire(receiver, now_us);
+	chiaki_mutex_unlock(&receiver->mutex);
+	out_emit(receiver);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_receiver_actuated(ChiakiHapticsReceiver *receiver, const ChiakiHapticsEvent *event, uint64_t now_us)
+{
+	chiaki_mutex_lock(&receiver->mutex);
+	latency_push(&receiver->actuation, now_us > event->arrival_us ? now_us - event->arrival_us : 0);
+	chiaki_mutex_unlock(&receiver->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_haptics_receiver_stats(ChiakiHapticsReceiver *receiver, ChiakiHapticsStats *stats)
+{
+	chiaki_mutex_lock(&receiver->mutex);
+	*stats = receiver->stats;
+	latency_summary(&receiver->delivery, &stats->delivery);
+	latency_summary(&receiver->lateness, &stats->lateness);
+	latency_summary(&receiver->actuation, &stats->actuation);
+	chiaki_mutex_unlock(&receiver->mutex);
+}
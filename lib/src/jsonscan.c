@@ -0,0 +1,617 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/jsonscan.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum
+{
+	SCAN_OK,
+	SCAN_DONE, // every path was found
+	SCAN_ERROR
+} ScanResult;
+
+typedef struct json_scanner_t
+{
+	const char *p;
+	const char *end;
+	ChiakiJsonValue *values;
+	size_t remaining;
+} JsonScanner;
+
+static void skip_ws(JsonScanner *s)
+{
+	while(s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r'))
+		s->p++;
+}
+
+/**
+ * s->p must point at the opening quote, out receives the contents without quotes.
+ */
+static ScanResult scan_string(JsonScanner *s, ChiakiJsonValue *out)
+{
+	const char *start = ++s->p;
+	bool escaped = false;
+	// Most strings have no escapes, find the closing quote with memchr then
+	const char *quote = memchr(s->p, '"', s->end - s->p);
+	if(!quote)
+		return SCAN_ERROR;
+	const char *backslash = memchr(s->p, '\\', quote - s->p);
+	if(!backslash)
+	{
+		out->type = CHIAKI_JSON_TYPE_STRING;
+		out->ptr = start;
+		out->len = quote - start;
+		out->escaped = false;
+		s->p = quote + 1;
+		return SCAN_OK;
+	}
+	s->p = backslash;
+	while(s->p < s->end)
+	{
+		char c = *s->p;
+		if(c == '"')
+		{
+			out->type = CHIAKI_JSON_TYPE_STRING;
+			out->ptr = start;
+			out->len = s->p - start;
+			out->escaped = escaped;
+			s->p++;
+			return SCAN_OK;
+		}
+		if(c == '\\')
+		{
+			escaped = true;
+			s->p += 2;
+			continue;
+		}
+		s->p++;
+	}
+	return SCAN_ERROR;
+}
+
+static ScanResult scan_literal(JsonScanner *s, const char *literal, ChiakiJsonType type, ChiakiJsonValue *out)
+{
+	size_t len = strlen(literal);
+	if((size_t)(s->end - s->p) < len || memcmp(s->p, literal, len) != 0)
+		return SCAN_ERROR;
+	out->type = type;
+	out->ptr = s->p;
+	out->len = len;
+	s->p += len;
+	return SCAN_OK;
+}
+
+static bool is_number_char(char c)
+{
+	return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+static ScanResult scan_primitive(JsonScanner *s, ChiakiJsonValue *out)
+{
+	switch(*s->p)
+	{
+		case '"':
+			return scan_string(s, out);
+		case 't':
+			return scan_literal(s, "true", CHIAKI_JSON_TYPE_BOOL, out);
+		case 'f':
+			return scan_literal(s, "false", CHIAKI_JSON_TYPE_BOOL, out);
+		case 'n':
+			return scan_literal(s, "null", CHIAKI_JSON_TYPE_NULL, out);
+		default:
+			break;
+	}
+	const char *start = s->p;
+	while(s->p < s->end && is_number_char(*s->p))
+		s->p++;
+	if(s->p == start)
+		return SCAN_ERROR;
+	out->type = CHIAKI_JSON_TYPE_NUMBER;
+	out->ptr = start;
+	out->len = s->p - start;
+	return SCAN_OK;
+}
+
+/**
+ * Skip a value no path leads into. Containers are only checked for balanced brackets.
+ */
+static ScanResult skip_value(JsonScanner *s, ChiakiJsonValue *out)
+{
+	skip_ws(s);
+	if(s->p >= s->end)
+		return SCAN_ERROR;
+	if(*s->p != '{' && *s->p != '[')
+		return scan_primitive(s, out);
+
+	const char *start = s->p;
+	out->type = *s->p == '{' ? CHIAKI_JSON_TYPE_OBJECT : CHIAKI_JSON_TYPE_ARRAY;
+	size_t depth = 0;
+	while(s->p < s->end)
+	{
+		switch(*s->p)
+		{
+			case '"':
+			{
+				ChiakiJsonValue str;
+				if(scan_string(s, &str) != SCAN_OK)
+					return SCAN_ERROR;
+				continue;
+			}
+			case '{':
+			case '[':
+				depth++;
+				break;
+			case '}':
+			case ']':
+				if(--depth == 0)
+				{
+					s->p++;
+					out->ptr = start;
+					out->len = s->p - start;
+					return SCAN_OK;
+				}
+				break;
+			default:
+				break;
+		}
+		s->p++;
+	}
+	return SCAN_ERROR;
+}
+
+static size_t path_component_len(const char *component)
+{
+	size_t len = 0;
+	while(component[len] && component[len] != '.')
+		len++;
+	return len;
+}
+
+static bool path_component_is_index(const char *component, size_t len, size_t index)
+{
+	if(!len)
+		return false;
+	size_t v = 0;
+	for(size_t i = 0; i < len; i++)
+	{
+		if(component[i] < '0' || component[i] > '9')
+			return false;
+		v = v * 10 + (component[i] - '0');
+	}
+	return v == index;
+}
+
+static ScanResult scan_container(JsonScanner *s, unsigned depth, uint32_t live, const char *const *next, ChiakiJsonValue *out);
+
+static ScanResult scan_value(JsonScanner *s, unsigned depth, uint32_t live, const char *const *next, ChiakiJsonValue *out)
+{
+	if(!live)
+		return skip_value(s, out);
+	skip_ws(s);
+	if(s->p >= s->end)
+		return SCAN_ERROR;
+	if(*s->p != '{' && *s->p != '[')
+		return scan_primitive(s, out);
+	if(depth >= CHIAKI_JSON_SCAN_DEPTH_MAX)
+		return SCAN_ERROR;
+	return scan_container(s, depth, live, next, out);
+}
+
+/**
+ * Scan an object or array that at least one path leads into.
+ *
+ * @param live bit i set: the first depth components of path i matched the keys leading here
+ * @param next the remaining components for every live path
+ */
+static ScanResult scan_container(JsonScanner *s, unsigned depth, uint32_t live, const char *const *next, ChiakiJsonValue *out)
+{
+	const char *start = s->p;
+	bool array = *s->p == '[';
+	char close = array ? ']' : '}';
+	const char *child_next[CHIAKI_JSON_SCAN_PATHS_MAX];
+	s->p++;
+	skip_ws(s);
+	if(s->p < s->end && *s->p == close)
+	{
+		s->p++;
+		goto done;
+	}
+
+	for(size_t index = 0;; index++)
+	{
+		ChiakiJsonValue key = { 0 };
+		skip_ws(s);
+		if(!array)
+		{
+			if(s->p >= s->end || *s->p != '"' || scan_string(s, &key) != SCAN_OK)
+				return SCAN_ERROR;
+			skip_ws(s);
+			if(s->p >= s->end || *s->p != ':')
+				return SCAN_ERROR;
+			s->p++;
+		}
+
+		uint32_t child_live = 0;
+		uint32_t terminal = 0;
+		for(uint32_t bits = live; bits; bits &= bits - 1)
+		{
+			size_t i = 0;
+			while(!(bits & (1u << i)))
+				i++;
+			const char *component = next[i];
+			size_t len = path_component_len(component);
+			bool match = array
+				? path_component_is_index(component, len, index)
+				: len == key.len && memcmp(component, key.ptr, len) == 0;
+			if(!match)
+				continue;
+			if(!component[len])
+				terminal |= 1u << i;
+			else
+			{
+				child_live |= 1u << i;
+				child_next[i] = component + len + 1;
+			}
+		}
+
+		ChiakiJsonValue value = { 0 };
+		skip_ws(s);
+		if(!array && s->p < s->end && (*s->p == ',' || *s->p == '}'))
+		{
+			// Key without a value
+			value.type = CHIAKI_JSON_TYPE_NULL;
+			value.ptr = s->p;
+		}
+		else
+		{
+			ScanResult r = scan_value(s, depth + 1, child_live, child_next, &value);
+			if(r != SCAN_OK)
+				return r;
+		}
+
+		for(uint32_t bits = terminal; bits; bits &= bits - 1)
+		{
+			size_t i = 0;
+			while(!(bits & (1u << i)))
+				i++;
+			if(s->values[i].type != CHIAKI_JSON_TYPE_NONE)
+				continue; // duplicate key, the first one counts
+			s->values[i] = value;
+			if(--s->remaining == 0)
+				return SCAN_DONE;
+		}
+
+		skip_ws(s);
+		if(s->p >= s->end)
+			return SCAN_ERROR;
+		if(*s->p == ',')
+		{
+			s->p++;
+			continue;
+		}
+		if(*s->p != close)
+			return SCAN_ERROR;
+		s->p++;
+		break;
+	}
+
+done:
+	out->type = array ? CHIAKI_JSON_TYPE_ARRAY : CHIAKI_JSON_TYPE_OBJECT;
+	out->ptr = start;
+	out->len = s->p - start;
+	return SCAN_OK;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_json_scan(const char *json, size_t json_len, const char *const *paths, ChiakiJsonValue *values, size_t count)
+{
+	if(count > CHIAKI_JSON_SCAN_PATHS_MAX)
+		return CHIAKI_ERR_OVERFLOW;
+
+	JsonScanner s;
+	s.p = json;
+	s.end = json + json_len;
+	s.values = values;
+	s.remaining = 0;
+
+	uint32_t live = 0;
+	for(size_t i = 0; i < count; i++)
+	{
+		memset(&values[i], 0, sizeof(values[i]));
+		if(!paths[i][0])
+			continue;
+		live |= 1u << i;
+		s.remaining++;
+	}
+	if(!live)
+		return CHIAKI_ERR_SUCCESS;
+
+	ChiakiJsonValue root = { 0 };
+	ScanResult r = scan_value(&s, 0, live, paths, &root);
+	return r == SCAN_ERROR ? CHIAKI_ERR_INVALID_DATA : CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_json_feed_init(ChiakiJsonFeed *feed, char *buf, size_t size)
+{
+	memset(feed, 0, sizeof(*feed));
+	feed->buf = buf;
+	feed->size = size;
+	if(size)
+		buf[0] = '\0';
+}
+
+/**
+ * Advance the string and bracket state over the bytes appended since the last call.
+ */
+static void feed_track(ChiakiJsonFeed *feed)
+{
+	const char *p = feed->buf + feed->checked;
+	const char *end = feed->buf + feed->len;
+	size_t depth = feed->depth;
+	bool in_string = feed->in_string;
+	if(feed->escape && p < end)
+	{
+		feed->escape = false;
+		p++;
+	}
+	while(p < end)
+	{
+		if(in_string)
+		{
+			// Like scan_string, find the quote first and only then look for escapes before it
+			const char *quote = memchr(p, '"', end - p);
+			const char *backslash = memchr(p, '\\', (quote ? quote : end) - p);
+			if(backslash)
+			{
+				p = backslash + 2;
+				if(p > end)
+				{
+					feed->escape = true;
+					p = end;
+				}
+				continue;
+			}
+			if(!quote)
+			{
+				p = end;
+				break;
+			}
+			in_string = false;
+			p = quote + 1;
+			continue;
+		}
+		char c = *p++;
+		if(c == '"')
+			in_string = true;
+		else if(c == '{' || c == '[')
+			depth++;
+		else if(c == '}' || c == ']')
+		{
+			if(!depth)
+			{
+				feed->invalid = true;
+				break;
+			}
+			if(--depth == 0)
+			{
+				feed->complete = true;
+				break;
+			}
+		}
+	}
+	feed->checked = p - feed->buf;
+	feed->depth = depth;
+	feed->in_string = in_string;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_json_feed_append(ChiakiJsonFeed *feed, const void *data, size_t len)
+{
+	size_t room = feed->size ? feed->size - 1 - feed->len : 0;
+	size_t take = len < room ? len : room;
+	if(take)
+	{
+		memcpy(feed->buf + feed->len, data, take);
+		feed->len += take;
+		feed->buf[feed->len] = '\0';
+		if(!feed->complete && !feed->invalid)
+			feed_track(feed);
+	}
+	if(take < len)
+		feed->truncated = true;
+	if(feed->invalid)
+		return CHIAKI_ERR_INVALID_DATA;
+	return feed->truncated ? CHIAKI_ERR_BUF_TOO_SMALL : CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_json_feed_scan(const ChiakiJsonFeed *feed, const char *const *paths, ChiakiJsonValue *values, size_t count)
+{
+	return chiaki_json_scan(feed->buf, feed->len, paths, values, count);
+}
+
+static bool parse_hex4(const char *p, const char *end, uint32_t *out)
+{
+	if(end - p < 4)
+		return false;
+	uint32_t v = 0;
+	for(size_t i = 0; i < 4; i++)
+	{
+		char c = p[i];
+		v <<= 4;
+		if(c >= '0' && c <= '9')
+			v |= c - '0';
+		else if(c >= 'a' && c <= 'f')
+			v |= c - 'a' + 10;
+		else if(c >= 'A' && c <= 'F')
+			v |= c - 'A' + 10;
+		else
+			return false;
+	}
+	*out = v;
+	return true;
+}
+
+static size_t utf8_encode(uint32_t cp, char *out)
+{
+	if(cp < 0x80)
+	{
+		out[0] = (char)cp;
+		return 1;
+	}
+	if(cp < 0x800)
+	{
+		out[0] = (char)(0xc0 | (cp >> 6));
+		out[1] = (char)(0x80 | (cp & 0x3f));
+		return 2;
+	}
+	if(cp < 0x10000)
+	{
+		out[0] = (char)(0xe0 | (cp >> 12));
+		out[1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+		out[2] = (char)(0x80 | (cp & 0x3f));
+		return 3;
+	}
+	out[0] = (char)(0xf0 | (cp >> 18));
+	out[1] = (char)(0x80 | ((cp >> 12) & 0x3f));
+	out[2] = (char)(0x80 | ((cp >> 6) & 0x3f));
+	out[3] = (char)(0x80 | (cp & 0x3f));
+	return 4;
+}
+
+/**
+ * Decode the character at *p into out and advance *p.
+ *
+ * @return the number of bytes written to out, 0 for a broken escape sequence
+ */
+static size_t decode_char(const char **p, const char *end, char out[4])
+{
+	const char *c = *p;
+	if(*c != '\\')
+	{
+		out[0] = *c;
+		*p = c + 1;
+		return 1;
+	}
+	if(end - c < 2)
+		return 0;
+	*p = c + 2;
+	switch(c[1])
+	{
+		case '"': out[0] = '"'; return 1;
+		case '\\': out[0] = '\\'; return 1;
+		case '/': out[0] = '/'; return 1;
+		case 'b': out[0] = '\b'; return 1;
+		case 'f': out[0] = '\f'; return 1;
+		case 'n': out[0] = '\n'; return 1;
+		case 'r': out[0] = '\r'; return 1;
+		case 't': out[0] = '\t'; return 1;
+		case 'u':
+			break;
+		default:
+			return 0;
+	}
+	uint32_t cp;
+	if(!parse_hex4(c + 2, end, &cp))
+		return 0;
+	*p = c + 6;
+	if(cp >= 0xd800 && cp <= 0xdbff)
+	{
+		uint32_t lo;
+		if(end - *p >= 6 && (*p)[0] == '\\' && (*p)[1] == 'u' && parse_hex4(*p + 2, end, &lo)
+			&& lo >= 0xdc00 && lo <= 0xdfff)
+		{
+			cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+			*p += 6;
+		}
+		else
+			cp = 0xfffd; // unpaired surrogate
+	}
+	else if(cp >= 0xdc00 && cp <= 0xdfff)
+		cp = 0xfffd;
+	return utf8_encode(cp, out);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_json_unescape(const ChiakiJsonValue *value, char *out, size_t out_size, size_t *out_len)
+{
+	if(value->type != CHIAKI_JSON_TYPE_STRING)
+		return CHIAKI_ERR_INVALID_DATA;
+	if(!value->escaped)
+	{
+		if(value->len >= out_size)
+			return CHIAKI_ERR_BUF_TOO_SMALL;
+		memcpy(out, value->ptr, value->len);
+		out[value->len] = '\0';
+		if(out_len)
+			*out_len = value->len;
+		return CHIAKI_ERR_SUCCESS;
+	}
+
+	const char *p = value->ptr;
+	const char *end = value->ptr + value->len;
+	size_t len = 0;
+	while(p < end)
+	{
+		// Copy everything up to the next escape in one go
+		const char *backslash = memchr(p, '\\', end - p);
+		size_t run = (backslash ? backslash : end) - p;
+		if(len + run >= out_size)
+			return CHIAKI_ERR_BUF_TOO_SMALL;
+		memcpy(out + len, p, run);
+		len += run;
+		p += run;
+		if(p == end)
+			break;
+
+		char buf[4];
+		size_t n = decode_char(&p, end, buf);
+		if(!n)
+			return CHIAKI_ERR_INVALID_DATA;
+		if(len + n >= out_size)
+			return CHIAKI_ERR_BUF_TOO_SMALL;
+		memcpy(out + len, buf, n);
+		len += n;
+	}
+	out[len] = '\0';
+	if(out_len)
+		*out_len = len;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT bool chiaki_json_value_streq(const ChiakiJsonValue *value, const char *str)
+{
+	if(value->type != CHIAKI_JSON_TYPE_STRING)
+		return false;
+	if(!value->escaped)
+		return strlen(str) == value->len && memcmp(value->ptr, str, value->len) == 0;
+
+	const char *p = value->ptr;
+	const char *end = value->ptr + value->len;
+	while(p < end)
+	{
+		char buf[4];
+		size_t n = decode_char(&p, end, buf);
+		if(!n || strncmp(str, buf, n) != 0)
+			return false;
+		str += n;
+	}
+	return *str == '\0';
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_json_value_int64(const ChiakiJsonValue *value, int64_t *out)
+{
+	char buf[24];
+	if(value->type != CHIAKI_JSON_TYPE_NUMBER || value->len >= sizeof(buf))
+		return CHIAKI_ERR_INVALID_DATA;
+	memcpy(buf, value->ptr, value->len);
+	buf[value->len] = '\0';
+	char *endptr;
+	errno = 0;
+	long long v = strtoll(buf, &endptr, 10);
+	if(*endptr != '\0')
+		return CHIAKI_ERR_INVALID_DATA;
+	if(errno == ERANGE)
+		return CHIAKI_ERR_OVERFLOW;
+	*out = (int64_t)v;
+	return CHIAKI_ERR_SUCCESS;
+}
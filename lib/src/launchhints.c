@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/launchhints.h>
+
+#include <string.h>
+
+// later observations weigh 1 / LINK_HISTORY_WEIGHT
+#define LINK_HISTORY_WEIGHT 4
+
+CHIAKI_EXPORT void chiaki_link_history_observe(ChiakiLinkHistory *history, double loss, uint32_t throughput_kbps)
+{
+	if(loss < 0.0)
+		loss = 0.0;
+	else if(loss > 1.0)
+		loss = 1.0;
+	uint32_t weight = history->sessions < LINK_HISTORY_WEIGHT ? history->sessions + 1 : LINK_HISTORY_WEIGHT;
+	history->loss += (loss - history->loss) / weight;
+	history->throughput_kbps = (uint32_t)((int64_t)history->throughput_kbps
+		+ ((int64_t)throughput_kbps - (int64_t)history->throughput_kbps) / weight);
+	if(history->sessions < UINT32_MAX)
+		history->sessions++;
+}
+
+CHIAKI_EXPORT void chiaki_launch_hints_policy_defaults(ChiakiLaunchHintsPolicy *policy)
+{
+	memset(policy, 0, sizeof(*policy));
+	policy->bw_headroom = 0.9;
+	policy->loss_cap_threshold = 0.02;
+	policy->bw_min_kbps = 2000;
+	policy->loss_default = CHIAKI_LAUNCH_HINTS_LOSS_DEFAULT;
+	policy->loss_scale = 1.5;
+	policy->loss_min = 0.001;
+	policy->loss_max = 0.05;
+	policy->rtt_margin_ms = 0;
+}
+
+CHIAKI_EXPORT void chiaki_launch_hints_derive(const ChiakiLaunchHintsPolicy *policy, const ChiakiLinkHistory *history,
+	unsigned int requested_kbps, uint32_t mtu, uint64_t rtt_us, bool link_measured, ChiakiLaunchHints *hints)
+{
+	memset(hints, 0, sizeof(*hints));
+	bool have_history = history && history->sessions;
+
+	hints->mtu = mtu;
+	hints->rtt_ms = (unsigned int)(rtt_us / 1000) + policy->rtt_margin_ms;
+	if(link_measured)
+		hints->sources |= CHIAKI_LAUNCH_HINTS_SOURCE_LINK_MEASURED;
+
+	hints->bw_kbps = requested_kbps;
+	if(have_history && policy->bw_headroom > 0.0 && history->throughput_kbps
+		&& history->loss > policy->loss_cap_threshold)
+	{
+		unsigned int cap = (unsigned int)(history->throughput_kbps * policy->bw_headroom);
+		if(cap < policy->bw_min_kbps)
+			cap = policy->bw_min_kbps;
+		if(cap < hints->bw_kbps)
+		{
+			hints->bw_kbps = cap;
+			hints->sources |= CHIAKI_LAUNCH_HINTS_SOURCE_HISTORY | CHIAKI_LAUNCH_HINTS_SOURCE_BW_CAPPED;
+		}
+	}
+
+	hints->bw_loss = policy->loss_default > 0.0 ? policy->loss_default : CHIAKI_LAUNCH_HINTS_LOSS_DEFAULT;
+	if(have_history && policy->loss_scale > 0.0)
+	{
+		double loss = history->loss * policy->loss_scale;
+		if(loss < policy->loss_min)
+			loss = policy->loss_min;
+		if(policy->loss_max > 0.0 && loss > policy->loss_max)
+			loss = policy->loss_max;
+		hints->bw_loss = loss;
+		hints->sources |= CHIAKI_LAUNCH_HINTS_SOURCE_HISTORY;
+	}
+}
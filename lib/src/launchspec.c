@@ -22,9 +22,9 @@ static const char launchspec_fmt[] =
 		"],"
 		"\"network\":{"
 			"\"bwKbpsSent\":%u," // 3
-			"\"bwLoss\":0.001000,"
-			"\"mtu\":%u," // 4
-			"\"rtt\":%u," // 5
+			"\"bwLoss\":%f," // 4
+			"\"mtu\":%u," // 5
+			"\"rtt\":%u," // 6
 			"\"ports\":[53,2053]"
 		"},"
 		"\"slotId\":1,"
@@ -50,7 +50,7 @@ static const char launchspec_fmt[] =
 			"\"connectedControllers\":[\"xinput\",\"ds3\",\"ds4\"],"
 			"\"yuvCoefficient\":\"bt601\","
 			"\"videoEncoderProfile\":\"hw4.1\","
-			"\"audioEncoderProfile\":\"audio1\"" // 6
+			"\"audioEncoderProfile\":\"audio1\"" // 7
 			"%s"
 		"},"
 		"\"userProfile\":{"
@@ -59,9 +59,9 @@ static const char launchspec_fmt[] =
 			"\"region\":\"US\","
 			"\"languagesUsed\":[\"en\",\"jp\"]"
 		"},"
-		"%s" // 7
 		"%s" // 8
-		"\"handshakeKey\":\"%s\"" // 9
+		"%s" // 9
+		"\"handshakeKey\":\"%s\"" // 10
 	"}";
 
 CHIAKI_EXPORT int chiaki_launchspec_format(char *buf, size_t buf_size, ChiakiLaunchSpec *launch_spec)
@@ -87,7 +87,7 @@ CHIAKI_EXPORT int chiaki_launchspec_format(char *buf, size_t buf_size, ChiakiLau
 
 	int written = snprintf(buf, buf_size, launchspec_fmt,
 			launch_spec->width, launch_spec->height, launch_spec->max_fps,
-			launch_spec->bw_kbps_sent, launch_spec->mtu, launch_spec->rtt,
+			launch_spec->bw_kbps_sent, launch_spec->bw_loss, launch_spec->mtu, launch_spec->rtt,
 			extras[0], extras[1], extras[2], handshake_key_b64);
 	if(written < 0 || written >= buf_size)
 		return -1;
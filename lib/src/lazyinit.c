@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/lazyinit.h>
+#include <chiaki/time.h>
+
+#include <string.h>
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_lazy_init_init(ChiakiLazyInit *li, ChiakiStartupProf *prof)
+{
+	memset(li, 0, sizeof(*li));
+	li->prof = prof;
+	ChiakiErrorCode err = chiaki_mutex_init(&li->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	err = chiaki_cond_init(&li->cond, &li->mutex);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_mutex_fini(&li->mutex);
+		return err;
+	}
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_lazy_init_fini(ChiakiLazyInit *li)
+{
+	chiaki_mutex_lock(&li->mutex);
+	li->stop = true;
+	chiaki_mutex_unlock(&li->mutex);
+	chiaki_lazy_init_wait(li);
+
+	for(size_t i = li->done_count; i-- > 0;)
+	{
+		ChiakiLazyUnit *unit = &li->units[li->done_order[i]].unit;
+		if(unit->fini)
+			unit->fini(unit->user);
+	}
+	chiaki_cond_fini(&li->cond);
+	chiaki_mutex_fini(&li->mutex);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_lazy_init_add(ChiakiLazyInit *li, const ChiakiLazyUnit *unit, unsigned *id)
+{
+	if(!unit->init)
+		return CHIAKI_ERR_INVALID_DATA;
+	chiaki_mutex_lock(&li->mutex);
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	size_t count = li->units_count;
+	if(count == CHIAKI_LAZY_INIT_UNITS_MAX)
+	{
+		err = CHIAKI_ERR_OVERFLOW;
+		goto beach;
+	}
+	if(unit->deps >> count)
+	{
+		err = CHIAKI_ERR_INVALID_DATA;
+		goto beach;
+	}
+	if(unit->mode == CHIAKI_LAZY_INIT_BACKGROUND)
+	{
+		for(size_t d = 0; d < count; d++)
+		{
+			if((unit->deps & CHIAKI_LAZY_INIT_DEP(d)) && li->units[d].unit.mode == CHIAKI_LAZY_INIT_IDLE)
+			{
+				err = CHIAKI_ERR_INVALID_DATA;
+				goto beach;
+			}
+		}
+	}
+	ChiakiLazyUnitSlot *slot = &li->units[count];
+	memset(slot, 0, sizeof(*slot));
+	slot->unit = *unit;
+	slot->state = CHIAKI_LAZY_UNIT_PENDING;
+	li->units_count++;
+	if(id)
+		*id = (unsigned)count;
+beach:
+	chiaki_mutex_unlock(&li->mutex);
+	return err;
+}
+
+/**
+ * Initialize unit id and its dependencies, li->mutex must be held. It is released while
+ * an init runs and while waiting for another thread's init.
+ */
+static ChiakiErrorCode unit_require_locked(ChiakiLazyInit *li, unsigned id)
+{
+	ChiakiLazyUnitSlot *slot = &li->units[id];
+	while(true)
+	{
+		switch(slot->state)
+		{
+			case CHIAKI_LAZY_UNIT_DONE:
+				return CHIAKI_ERR_SUCCESS;
+			case CHIAKI_LAZY_UNIT_FAILED:
+				return slot->err;
+			case CHIAKI_LAZY_UNIT_RUNNING:
+			{
+				uint64_t wait_start_us = chiaki_time_now_monotonic_us();
+				chiaki_cond_wait(&li->cond, &li->mutex);
+				li->wait_us += chiaki_time_now_monotonic_us() - wait_start_us;
+				continue;
+			}
+			case CHIAKI_LAZY_UNIT_PENDING:
+				break;
+		}
+
+		// dependencies have lower ids, so waiting for them never closes a cycle
+		bool deps_done = true;
+		for(unsigned d = 0; d < id; d++)
+		{
+			if(!(slot->unit.deps & CHIAKI_LAZY_INIT_DEP(d)))
+				continue;
+			ChiakiErrorCode err = unit_require_locked(li, d);
+			if(err != CHIAKI_ERR_SUCCESS)
+			{
+				if(slot->state == CHIAKI_LAZY_UNIT_PENDING)
+				{
+					slot->state = CHIAKI_LAZY_UNIT_FAILED;
+					slot->err = err;
+					chiaki_cond_broadcast(&li->cond);
+				}
+				deps_done = false;
+				break;
+			}
+		}
+		// the mutex may have been released for the dependencies, another thread may be at this unit now
+		if(!deps_done || slot->state != CHIAKI_LAZY_UNIT_PENDING)
+			continue;
+
+		slot->state = CHIAKI_LAZY_UNIT_RUNNING;
+		chiaki_mutex_unlock(&li->mutex);
+		uint64_t start_us = chiaki_time_now_monotonic_us();
+		uint16_t span = chiaki_startup_prof_begin(li->prof, slot->unit.name);
+		ChiakiErrorCode err = slot->unit.init(slot->unit.user);
+		chiaki_startup_prof_end(li->prof, span);
+		uint64_t init_us = chiaki_time_now_monotonic_us() - start_us;
+		chiaki_mutex_lock(&li->mutex);
+
+		slot->init_us = init_us;
+		slot->err = err;
+		if(err == CHIAKI_ERR_SUCCESS)
+		{
+			slot->state = CHIAKI_LAZY_UNIT_DONE;
+			li->done_order[li->done_count++] = id;
+		}
+		else
+			slot->state = CHIAKI_LAZY_UNIT_FAILED;
+		chiaki_cond_broadcast(&li->cond);
+		return err;
+	}
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_lazy_init_require(ChiakiLazyInit *li, unsigned id)
+{
+	chiaki_mutex_lock(&li->mutex);
+	ChiakiErrorCode err = id < li->units_count ? unit_require_locked(li, id) : CHIAKI_ERR_INVALID_DATA;
+	chiaki_mutex_unlock(&li->mutex);
+	return err;
+}
+
+static void *background_thread_func(void *user)
+{
+	ChiakiLazyInit *li = user;
+	chiaki_mutex_lock(&li->mutex);
+	for(unsigned id = 0; id < li->units_count && !li->stop; id++)
+	{
+		if(li->units[id].unit.mode == CHIAKI_LAZY_INIT_BACKGROUND)
+			unit_require_locked(li, id);
+	}
+	chiaki_mutex_unlock(&li->mutex);
+	return NULL;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_lazy_init_start(ChiakiLazyInit *li)
+{
+	if(li->thread_started)
+		return CHIAKI_ERR_SUCCESS;
+	ChiakiErrorCode err = chiaki_thread_create_role(&li->thread, CHIAKI_THREAD_ROLE_HOUSEKEEPING, background_thread_func, li);
+	if(err != CHIAKI_ERR_SUCCESS)
+		return err;
+	chiaki_thread_set_name(&li->thread, "Chiaki Lazy Init");
+	li->thread_started = true;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_lazy_init_wait(ChiakiLazyInit *li)
+{
+	if(!li->thread_started)
+		return;
+	chiaki_thread_join(&li->thread, NULL);
+	li->thread_started = false;
+}
+
+CHIAKI_EXPORT bool chiaki_lazy_init_run_idle(ChiakiLazyInit *li)
+{
+	chiaki_mutex_lock(&li->mutex);
+	bool ran = false;
+	for(unsigned id = 0; id < li->units_count; id++)
+	{
+		ChiakiLazyUnitSlot *slot = &li->units[id];
+		if(slot->unit.mode != CHIAKI_LAZY_INIT_IDLE || slot->state != CHIAKI_LAZY_UNIT_PENDING)
+			continue;
+		unit_require_locked(li, id);
+		ran = true;
+		break;
+	}
+	chiaki_mutex_unlock(&li->mutex);
+	return ran;
+}
+
+CHIAKI_EXPORT ChiakiLazyUnitState chiaki_lazy_init_state(ChiakiLazyInit *li, unsigned id)
+{
+	chiaki_mutex_lock(&li->mutex);
+	ChiakiLazyUnitState state = id < li->units_count ? li->units[id].state : CHIAKI_LAZY_UNIT_FAILED;
+	chiaki_mutex_unlock(&li->mutex);
+	return state;
+}
+
+CHIAKI_EXPORT const char *chiaki_lazy_unit_state_string(ChiakiLazyUnitState state)
+{
+	switch(state)
+	{
+		case CHIAKI_LAZY_UNIT_PENDING:
+			return "pending";
+		case CHIAKI_LAZY_UNIT_RUNNING:
+			return "running";
+		case CHIAKI_LAZY_UNIT_DONE:
+			return "done";
+		case CHIAKI_LAZY_UNIT_FAILED:
+			return "failed";
+		default:
+			return "unknown";
+	}
+}
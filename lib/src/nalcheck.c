@@ -0,0 +1,826 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/nalcheck.h>
+
+#include <string.h>
+
+// level 6.2 limits with room to spare
+#define H264_PIC_SIZE_MAX 139264
+#define H265_PIC_SAMPLES_MAX 16384
+
+// NAL unit type properties
+#define NAL_ALLOWED (1 << 0)
+#define NAL_SLICE (1 << 1)
+#define NAL_RANDOM_ACCESS (1 << 2) // H.264 IDR, H.265 IRAP
+#define NAL_IDR (1 << 3)
+#define NAL_SPS (1 << 4)
+#define NAL_PPS (1 << 5)
+#define NAL_REF (1 << 6) // H.264: nal_ref_idc must not be 0
+#define NAL_NO_REF (1 << 7) // H.264: nal_ref_idc must be 0
+#define NAL_TEMPORAL_ID_0 (1 << 8) // H.265: TemporalId must be 0
+
+// types 2-4 (data partitioning) and the extensions from 13 on are not part of the streams
+static const uint16_t h264_nal_types[32] = {
+	[1] = NAL_ALLOWED | NAL_SLICE,
+	[5] = NAL_ALLOWED | NAL_SLICE | NAL_RANDOM_ACCESS | NAL_IDR | NAL_REF,
+	[6] = NAL_ALLOWED | NAL_NO_REF, // SEI
+	[7] = NAL_ALLOWED | NAL_SPS | NAL_REF,
+	[8] = NAL_ALLOWED | NAL_PPS | NAL_REF,
+	[9] = NAL_ALLOWED | NAL_NO_REF, // access unit delimiter
+	[10] = NAL_ALLOWED | NAL_NO_REF, // end of sequence
+	[11] = NAL_ALLOWED | NAL_NO_REF, // end of stream
+	[12] = NAL_ALLOWED | NAL_NO_REF, // filler
+};
+
+static const uint16_t h265_nal_types[64] = {
+	[0] = NAL_ALLOWED | NAL_SLICE, // TRAIL_N
+	[1] = NAL_ALLOWED | NAL_SLICE, // TRAIL_R
+	[2] = NAL_ALLOWED | NAL_SLICE, // TSA_N
+	[3] = NAL_ALLOWED | NAL_SLICE,
+	[4] = NAL_ALLOWED | NAL_SLICE, // STSA_N
+	[5] = NAL_ALLOWED | NAL_SLICE,
+	[6] = NAL_ALLOWED | NAL_SLICE, // RADL_N
+	[7] = NAL_ALLOWED | NAL_SLICE,
+	[8] = NAL_ALLOWED | NAL_SLICE, // RASL_N
+	[9] = NAL_ALLOWED | NAL_SLICE,
+	[16] = NAL_ALLOWED | NAL_SLICE | NAL_RANDOM_ACCESS | NAL_TEMPORAL_ID_0, // BLA_W_LP
+	[17] = NAL_ALLOWED | NAL_SLICE | NAL_RANDOM_ACCESS | NAL_TEMPORAL_ID_0,
+	[18] = NAL_ALLOWED | NAL_SLICE | NAL_RANDOM_ACCESS | NAL_TEMPORAL_ID_0,
+	[19] = NAL_ALLOWED | NAL_SLICE | NAL_RANDOM_ACCESS | NAL_IDR | NAL_TEMPORAL_ID_0, // IDR_W_RADL
+	[20] = NAL_ALLOWED | NAL_SLICE | NAL_RANDOM_ACCESS | NAL_IDR | NAL_TEMPORAL_ID_0, // IDR_N_LP
+	[21] = NAL_ALLOWED | NAL_SLICE | NAL_RANDOM_ACCESS | NAL_TEMPORAL_ID_0, // CRA
+	[32] = NAL_ALLOWED | NAL_TEMPORAL_ID_0, // VPS
+	[33] = NAL_ALLOWED | NAL_SPS | NAL_TEMPORAL_ID_0,
+	[34] = NAL_ALLOWED | NAL_PPS,
+	[35] = NAL_ALLOWED, // access unit delimiter
+	[36] = NAL_ALLOWED, // end of sequence
+	[37] = NAL_ALLOWED | NAL_TEMPORAL_ID_0, // end of bitstream
+	[38] = NAL_ALLOWED, // filler
+	[39] = NAL_ALLOWED, // prefix SEI
+	[40] = NAL_ALLOWED, // suffix SEI
+};
+
+// what the byte after a 00 00 run means
+typedef enum
+{
+	ZERO_RUN_MORE, // 00: a longer run, trailing zeros before a start code or an error
+	ZERO_RUN_START_CODE, // 01
+	ZERO_RUN_FORBIDDEN, // 02
+	ZERO_RUN_ESCAPE // 03: emulation prevention
+} ZeroRunClass;
+
+static const uint8_t zero_run_class[4] = { ZERO_RUN_MORE, ZERO_RUN_START_CODE, ZERO_RUN_FORBIDDEN, ZERO_RUN_ESCAPE };
+
+CHIAKI_EXPORT const char *chiaki_nal_check_verdict_string(ChiakiNalCheckVerdict verdict)
+{
+	switch(verdict)
+	{
+		case CHIAKI_NAL_CHECK_OK:
+			return "ok";
+		case CHIAKI_NAL_CHECK_DAMAGED:
+			return "damaged";
+		case CHIAKI_NAL_CHECK_MALFORMED:
+			return "malformed";
+		default:
+			return "unknown";
+	}
+}
+
+CHIAKI_EXPORT const char *chiaki_nal_check_error_string(ChiakiNalCheckError error)
+{
+	switch(error)
+	{
+		case CHIAKI_NAL_CHECK_ERROR_NONE:
+			return "none";
+		case CHIAKI_NAL_CHECK_ERROR_NO_START_CODE:
+			return "no_start_code";
+		case CHIAKI_NAL_CHECK_ERROR_EMULATION:
+			return "emulation";
+		case CHIAKI_NAL_CHECK_ERROR_NAL_HEADER:
+			return "nal_header";
+		case CHIAKI_NAL_CHECK_ERROR_NAL_TYPE:
+			return "nal_type";
+		case CHIAKI_NAL_CHECK_ERROR_PARAMETER_SET:
+			return "parameter_set";
+		case CHIAKI_NAL_CHECK_ERROR_UNKNOWN_PARAMETER_SET:
+			return "unknown_parameter_set";
+		case CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER:
+			return "slice_header";
+		case CHIAKI_NAL_CHECK_ERROR_SLICE_ORDER:
+			return "slice_order";
+		case CHIAKI_NAL_CHECK_ERROR_SLICE_MISMATCH:
+			return "slice_mismatch";
+		default:
+			return "unknown";
+	}
+}
+
+CHIAKI_EXPORT void chiaki_nal_check_init(ChiakiNalCheck *check, ChiakiCodec codec)
+{
+	memset(check, 0, sizeof(*check));
+	check->codec = codec;
+}
+
+CHIAKI_EXPORT void chiaki_nal_check_reset(ChiakiNalCheck *check)
+{
+	check->params_known = false;
+	memset(check->sps, 0, sizeof(check->sps));
+	memset(check->pps, 0, sizeof(check->pps));
+}
+
+/**
+ * Find the end of the NAL unit starting at pos, right after its start code.
+ *
+ * @param end set to the end of the NAL unit, without trailing zeros
+ * @param next set to the first byte after the next start code, or buf_size
+ * @return false if the NAL unit contains a zero run it must not
+ */
+static bool scan_nal(const uint8_t *buf, size_t buf_size, size_t pos, size_t *end, size_t *next)
+{
+	size_t i = pos;
+	while(i + 2 < buf_size)
+	{
+		if(i + 10 <= buf_size)
+		{
+			// eight candidates for the third byte at once, none of them up to 03 is the common case
+			uint64_t w;
+			memcpy(&w, buf + i + 2, sizeof(w));
+			if(!((w - 0x0404040404040404ull) & ~w & 0x8080808080808080ull))
+			{
+				i += 8;
+				continue;
+			}
+		}
+		uint8_t c = buf[i + 2];
+		if(c > 3)
+		{
+			// no 00 00 0x can start at i, i + 1 or i + 2
+			i += 3;
+			continue;
+		}
+		if(buf[i + 1])
+		{
+			i += 2;
+			continue;
+		}
+		if(buf[i])
+		{
+			i++;
+			continue;
+		}
+		switch(zero_run_class[c])
+		{
+			case ZERO_RUN_START_CODE:
+				*end = i;
+				*next = i + 3;
+				return true;
+			case ZERO_RUN_MORE:
+			{
+				size_t j = i + 3;
+				while(j < buf_size && !buf[j])
+					j++;
+				if(j < buf_size && buf[j] != 1)
+					return false;
+				*end = i;
+				*next = j < buf_size ? j + 1 : buf_size;
+				return true;
+			}
+			case ZERO_RUN_FORBIDDEN:
+				return false;
+			case ZERO_RUN_ESCAPE:
+				if(i + 3 < buf_size && buf[i + 3] > 3)
+					return false;
+				i += 3;
+				break;
+		}
+	}
+	*end = buf_size;
+	// a NAL unit can't end in 00, those are trailing zeros
+	while(*end > pos && !buf[*end - 1])
+		(*end)--;
+	*next = buf_size;
+	return true;
+}
+
+/**
+ * Bit reader over the RBSP of a NAL unit, skipping emulation prevention bytes.
+ * Reading past the end sets overrun and yields zeros.
+ */
+typedef struct rbsp_reader_t
+{
+	const uint8_t *buf;
+	size_t size;
+	size_t pos;
+	unsigned zeros;
+	uint64_t cache;
+	unsigned cache_bits;
+	bool overrun;
+	bool invalid; // an exp-golomb code longer than 32 bits
+} RbspReader;
+
+static void rbsp_init(RbspReader *r, const uint8_t *buf, size_t size)
+{
+	memset(r, 0, sizeof(*r));
+	r->buf = buf;
+	r->size = size;
+}
+
+static void rbsp_fill(RbspReader *r)
+{
+	while(r->cache_bits <= 56)
+	{
+		if(r->pos >= r->size)
+			return;
+		uint8_t b = r->buf[r->pos++];
+		if(r->zeros >= 2 && b == 3)
+		{
+			r->zeros = 0;
+			continue;
+		}
+		r->zeros = b ? 0 : r->zeros + 1;
+		r->cache |= (uint64_t)b << (56 - r->cache_bits);
+		r->cache_bits += 8;
+	}
+}
+
+static uint32_t rbsp_u(RbspReader *r, unsigned bits)
+{
+	if(!bits)
+		return 0;
+	if(r->cache_bits < bits)
+	{
+		rbsp_fill(r);
+		if(r->cache_bits < bits)
+		{
+			r->overrun = true;
+			r->cache = 0;
+			r->cache_bits = 0;
+			return 0;
+		}
+	}
+	uint32_t v = (uint32_t)(r->cache >> (64 - bits));
+	r->cache <<= bits;
+	r->cache_bits -= bits;
+	return v;
+}
+
+static uint32_t rbsp_ue(RbspReader *r)
+{
+	unsigned leading_zeros = 0;
+	while(!rbsp_u(r, 1))
+	{
+		if(r->overrun)
+			return 0;
+		if(++leading_zeros > 31)
+		{
+			r->invalid = true;
+			return 0;
+		}
+	}
+	return (uint32_t)((1ull << leading_zeros) - 1 + rbsp_u(r, leading_zeros));
+}
+
+static int32_t rbsp_se(RbspReader *r)
+{
+	uint32_t v = rbsp_ue(r);
+	return (v & 1) ? (int32_t)((v + 1) / 2) : -(int32_t)(v / 2);
+}
+
+static bool rbsp_ok(RbspReader *r)
+{
+	return !r->overrun && !r->invalid;
+}
+
+static bool h264_skip_scaling_list(RbspReader *r, unsigned size)
+{
+	int32_t last = 8, next = 8;
+	for(unsigned j=0; j<size; j++)
+	{
+		if(next)
+		{
+			int32_t delta = rbsp_se(r);
+			if(delta < -128 || delta > 127)
+				return false;
+			next = (last + delta + 256) % 256;
+		}
+		last = next ? next : last;
+	}
+	return true;
+}
+
+static bool h264_sps(ChiakiNalCheck *check, RbspReader *r)
+{
+	ChiakiNalCheckSps sps;
+	memset(&sps, 0, sizeof(sps));
+	unsigned profile_idc = rbsp_u(r, 8);
+	rbsp_u(r, 8); // constraint_set_flags, reserved_zero_2bits
+	rbsp_u(r, 8); // level_idc
+	uint32_t sps_id = rbsp_ue(r);
+	if(sps_id >= 32)
+		return false;
+
+	if(profile_idc == 100 || profile_idc == 110 || profile_idc == 122 || profile_idc == 244
+		|| profile_idc == 44 || profile_idc == 83 || profile_idc == 86 || profile_idc == 118
+		|| profile_idc == 128 || profile_idc == 138 || profile_idc == 139 || profile_idc == 134
+		|| profile_idc == 135)
+	{
+		uint32_t chroma_format_idc = rbsp_ue(r);
+		if(chroma_format_idc > 3)
+			return false;
+		if(chroma_format_idc == 3)
+			sps.separate_colour_plane = rbsp_u(r, 1);
+		if(rbsp_ue(r) > 6 || rbsp_ue(r) > 6) // bit_depth_luma_minus8, bit_depth_chroma_minus8
+			return false;
+		rbsp_u(r, 1); // qpprime_y_zero_transform_bypass_flag
+		if(rbsp_u(r, 1)) // seq_scaling_matrix_present_flag
+		{
+			unsigned lists = chroma_format_idc == 3 ? 12 : 8;
+			for(unsigned i=0; i<lists; i++)
+			{
+				if(rbsp_u(r, 1) && !h264_skip_scaling_list(r, i < 6 ? 16 : 64))
+					return false;
+			}
+		}
+	}
+
+	uint32_t log2_max_frame_num_minus4 = rbsp_ue(r);
+	if(log2_max_frame_num_minus4 > 12)
+		return false;
+	sps.log2_max_frame_num = (uint8_t)(log2_max_frame_num_minus4 + 4);
+	uint32_t poc_type = rbsp_ue(r);
+	if(poc_type > 2)
+		return false;
+	sps.poc_type = (uint8_t)poc_type;
+	if(poc_type == 0)
+	{
+		uint32_t log2_max_poc_lsb_minus4 = rbsp_ue(r);
+		if(log2_max_poc_lsb_minus4 > 12)
+			return false;
+		sps.log2_max_poc_lsb = (uint8_t)(log2_max_poc_lsb_minus4 + 4);
+	}
+	else if(poc_type == 1)
+	{
+		rbsp_u(r, 1); // delta_pic_order_always_zero_flag
+		rbsp_se(r); // offset_for_non_ref_pic
+		rbsp_se(r); // offset_for_top_to_bottom_field
+		uint32_t cycle = rbsp_ue(r);
+		if(cycle > 255)
+			return false;
+		for(uint32_t i=0; i<cycle && rbsp_ok(r); i++)
+			rbsp_se(r); // offset_for_ref_frame
+	}
+	if(rbsp_ue(r) > 16) // max_num_ref_frames
+		return false;
+	rbsp_u(r, 1); // gaps_in_frame_num_value_allowed_flag
+	uint32_t width_mbs = rbsp_ue(r) + 1;
+	uint32_t height_map_units = rbsp_ue(r) + 1;
+	sps.frame_mbs_only = rbsp_u(r, 1);
+	if(!rbsp_ok(r))
+		return false;
+	uint64_t pic_size = (uint64_t)width_mbs * height_map_units * (sps.frame_mbs_only ? 1 : 2);
+	if(pic_size > H264_PIC_SIZE_MAX)
+		return false;
+	sps.pic_size = (uint32_t)pic_size;
+	sps.valid = true;
+	check->sps[sps_id] = sps;
+	return true;
+}
+
+static bool h264_pps(ChiakiNalCheck *check, RbspReader *r)
+{
+	ChiakiNalCheckPps pps;
+	memset(&pps, 0, sizeof(pps));
+	uint32_t pps_id = rbsp_ue(r);
+	uint32_t sps_id = rbsp_ue(r);
+	if(pps_id >= 256 || sps_id >= 32)
+		return false;
+	pps.sps_id = (uint8_t)sps_id;
+	rbsp_u(r, 1); // entropy_coding_mode_flag
+	pps.bottom_field_pic_order = rbsp_u(r, 1);
+	if(rbsp_ue(r) > 7) // num_slice_groups_minus1
+		return false;
+	if(!rbsp_ok(r))
+		return false;
+	pps.valid = true;
+	check->pps[pps_id] = pps;
+	return true;
+}
+
+static bool h265_sps(ChiakiNalCheck *check, RbspReader *r)
+{
+	ChiakiNalCheckSps sps;
+	memset(&sps, 0, sizeof(sps));
+	rbsp_u(r, 4); // sps_video_parameter_set_id
+	unsigned max_sub_layers_minus1 = rbsp_u(r, 3);
+	if(max_sub_layers_minus1 > 6)
+		return false;
+	rbsp_u(r, 1); // sps_temporal_id_nesting_flag
+
+	// profile_tier_level
+	rbsp_u(r, 32); // general_profile_space .. general_profile_compatibility_flag[0..4]
+	rbsp_u(r, 32);
+	rbsp_u(r, 24);
+	rbsp_u(r, 8); // general_level_idc
+	bool sub_layer_profile_present[8], sub_layer_level_present[8];
+	for(unsigned i=0; i<max_sub_layers_minus1; i++)
+	{
+		sub_layer_profile_present[i] = rbsp_u(r, 1);
+		sub_layer_level_present[i] = rbsp_u(r, 1);
+	}
+	if(max_sub_layers_minus1 > 0)
+		for(unsigned i=max_sub_layers_minus1; i<8; i++)
+			rbsp_u(r, 2); // reserved_zero_2bits
+	for(unsigned i=0; i<max_sub_layers_minus1; i++)
+	{
+		if(sub_layer_profile_present[i])
+		{
+			rbsp_u(r, 32);
+			rbsp_u(r, 32);
+			rbsp_u(r, 24);
+		}
+		if(sub_layer_level_present[i])
+			rbsp_u(r, 8);
+	}
+
+	uint32_t sps_id = rbsp_ue(r);
+	if(sps_id >= 16)
+		return false;
+	uint32_t chroma_format_idc = rbsp_ue(r);
+	if(chroma_format_idc > 3)
+		return false;
+	if(chroma_format_idc == 3)
+		sps.separate_colour_plane = rbsp_u(r, 1);
+	uint32_t width = rbsp_ue(r);
+	uint32_t height = rbsp_ue(r);
+	if(!width || !height || width > H265_PIC_SAMPLES_MAX || height > H265_PIC_SAMPLES_MAX)
+		return false;
+	if(rbsp_u(r, 1)) // conformance_window_flag
+	{
+		rbsp_ue(r);
+		rbsp_ue(r);
+		rbsp_ue(r);
+		rbsp_ue(r);
+	}
+	if(rbsp_ue(r) > 8 || rbsp_ue(r) > 8) // bit_depth_luma_minus8, bit_depth_chroma_minus8
+		return false;
+	uint32_t log2_max_poc_lsb_minus4 = rbsp_ue(r);
+	if(log2_max_poc_lsb_minus4 > 12)
+		return false;
+	sps.log2_max_poc_lsb = (uint8_t)(log2_max_poc_lsb_minus4 + 4);
+	bool ordering_info_present = rbsp_u(r, 1);
+	for(unsigned i=ordering_info_present ? 0 : max_sub_layers_minus1; i<=max_sub_layers_minus1; i++)
+	{
+		if(rbsp_ue(r) > 15) // sps_max_dec_pic_buffering_minus1
+			return false;
+		rbsp_ue(r); // sps_max_num_reorder_pics
+		rbsp_ue(r); // sps_max_latency_increase_plus1
+	}
+	uint32_t log2_min_cb_minus3 = rbsp_ue(r);
+	uint32_t log2_diff_max_min_cb = rbsp_ue(r);
+	if(!rbsp_ok(r) || log2_min_cb_minus3 > 3 || log2_diff_max_min_cb > 3)
+		return false;
+	uint32_t ctb_log2 = log2_min_cb_minus3 + 3 + log2_diff_max_min_cb;
+	if(ctb_log2 < 4 || ctb_log2 > 6)
+		return false;
+	uint32_t ctb = 1u << ctb_log2;
+	sps.pic_size = ((width + ctb - 1) >> ctb_log2) * ((height + ctb - 1) >> ctb_log2);
+	while((1u << sps.pic_size_bits) < sps.pic_size)
+		sps.pic_size_bits++;
+	sps.valid = true;
+	check->sps[sps_id] = sps;
+	return true;
+}
+
+static bool h265_pps(ChiakiNalCheck *check, RbspReader *r)
+{
+	ChiakiNalCheckPps pps;
+	memset(&pps, 0, sizeof(pps));
+	uint32_t pps_id = rbsp_ue(r);
+	uint32_t sps_id = rbsp_ue(r);
+	if(pps_id >= 64 || sps_id >= 16)
+		return false;
+	pps.sps_id = (uint8_t)sps_id;
+	pps.dependent_slice_segments = rbsp_u(r, 1);
+	pps.output_flag_present = rbsp_u(r, 1);
+	pps.num_extra_slice_header_bits = (uint8_t)rbsp_u(r, 3);
+	if(!rbsp_ok(r))
+		return false;
+	pps.valid = true;
+	check->pps[pps_id] = pps;
+	return true;
+}
+
+// fields that name the picture, equal in all its slices
+typedef struct picture_id_t
+{
+	uint32_t nal_type_or_ref; // H.264: whether it is a reference, H.265: nal_unit_type
+	bool idr;
+	uint32_t frame_num;
+	uint32_t idr_pic_id;
+	uint32_t poc_lsb;
+	uint32_t field;
+} PictureId;
+
+typedef struct slice_state_t
+{
+	uint32_t slices;
+	uint32_t address; // of the last slice
+	uint32_t next_address; // of the slice being checked, once read and in range, else 0
+	PictureId picture;
+	const ChiakiNalCheckSps *sps; // of the first slice, NULL if not checked against parameter sets
+} SliceState;
+
+static ChiakiNalCheckError params_for_slice(ChiakiNalCheck *check, uint32_t pps_id, const ChiakiNalCheckSps **sps)
+{
+	*sps = NULL;
+	if(!check->params_known)
+		return CHIAKI_NAL_CHECK_ERROR_NONE;
+	if(pps_id >= CHIAKI_NAL_CHECK_PPS_MAX || !check->pps[pps_id].valid)
+		return CHIAKI_NAL_CHECK_ERROR_UNKNOWN_PARAMETER_SET;
+	const ChiakiNalCheckSps *s = &check->sps[check->pps[pps_id].sps_id];
+	if(!s->valid)
+		return CHIAKI_NAL_CHECK_ERROR_UNKNOWN_PARAMETER_SET;
+	*sps = s;
+	return CHIAKI_NAL_CHECK_ERROR_NONE;
+}
+
+static ChiakiNalCheckError slice_order(SliceState *state, bool starts_picture, uint32_t address, const PictureId *picture)
+{
+	if(!state->slices)
+	{
+		if(!starts_picture)
+			return CHIAKI_NAL_CHECK_ERROR_SLICE_ORDER;
+		state->picture = *picture;
+	}
+	else
+	{
+		if(starts_picture || address <= state->address)
+			return CHIAKI_NAL_CHECK_ERROR_SLICE_ORDER;
+		if(memcmp(&state->picture, picture, sizeof(*picture)))
+			return CHIAKI_NAL_CHECK_ERROR_SLICE_MISMATCH;
+	}
+	state->address = address;
+	return CHIAKI_NAL_CHECK_ERROR_NONE;
+}
+
+static ChiakiNalCheckError h264_slice(ChiakiNalCheck *check, RbspReader *r, unsigned nal_ref_idc, uint16_t type_flags, SliceState *state)
+{
+	uint32_t first_mb = rbsp_ue(r);
+	uint32_t slice_type = rbsp_ue(r);
+	uint32_t pps_id = rbsp_ue(r);
+	if(!rbsp_ok(r) || slice_type > 9 || pps_id >= 256)
+		return CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER;
+	bool idr = type_flags & NAL_IDR;
+	if(idr && slice_type % 5 != 2 && slice_type % 5 != 4)
+		return CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER;
+
+	PictureId picture;
+	memset(&picture, 0, sizeof(picture));
+	picture.nal_type_or_ref = nal_ref_idc != 0;
+	picture.idr = idr;
+
+	const ChiakiNalCheckSps *sps;
+	ChiakiNalCheckError err = params_for_slice(check, pps_id, &sps);
+	if(err != CHIAKI_NAL_CHECK_ERROR_NONE)
+		return err;
+	if(sps)
+	{
+		if(first_mb >= sps->pic_size)
+			return CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER;
+		state->next_address = first_mb;
+		if(sps->separate_colour_plane && rbsp_u(r, 2) > 2) // colour_plane_id
+			return CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER;
+		picture.frame_num = rbsp_u(r, sps->log2_max_frame_num);
+		if(idr && picture.frame_num)
+			return CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER;
+		bool field_pic = false;
+		if(!sps->frame_mbs_only)
+		{
+			field_pic = rbsp_u(r, 1);
+			picture.field = field_pic ? 1 + rbsp_u(r, 1) : 0; // bottom_field_flag
+			if(field_pic && first_mb >= sps->pic_size / 2)
+				return CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER;
+		}
+		if(idr)
+		{
+			picture.idr_pic_id = rbsp_ue(r);
+			if(picture.idr_pic_id > 65535)
+				return CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER;
+		}
+		if(sps->poc_type == 0)
+		{
+			picture.poc_lsb = rbsp_u(r, sps->log2_max_poc_lsb);
+			if(check->pps[pps_id].bottom_field_pic_order && !field_pic)
+				rbsp_se(r); // delta_pic_order_cnt_bottom
+		}
+		if(!rbsp_ok(r))
+			return CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER;
+		if(!state->slices)
+			state->sps = sps;
+		else if(sps != state->sps)
+			return CHIAKI_NAL_CHECK_ERROR_SLICE_MISMATCH;
+	}
+	return slice_order(state, first_mb == 0, first_mb, &picture);
+}
+
+static ChiakiNalCheckError h265_slice(ChiakiNalCheck *check, RbspReader *r, unsigned nal_type, uint16_t type_flags, SliceState *state)
+{
+	bool first_slice_segment = rbsp_u(r, 1);
+	if(type_flags & NAL_RANDOM_ACCESS)
+		rbsp_u(r, 1); // no_output_of_prior_pics_flag
+	uint32_t pps_id = rbsp_ue(r);
+	if(!rbsp_ok(r) || pps_id >= 64)
+		return CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER;
+
+	PictureId picture;
+	memset(&picture, 0, sizeof(picture));
+	picture.nal_type_or_ref = nal_type;
+	picture.idr = type_flags & NAL_IDR;
+
+	const ChiakiNalCheckSps *sps;
+	ChiakiNalCheckError err = params_for_slice(check, pps_id, &sps);
+	if(err != CHIAKI_NAL_CHECK_ERROR_NONE)
+		return err;
+	if(!sps)
+		return slice_order(state, first_slice_segment, state->slices ? state->address + 1 : 0, &picture);
+
+	const ChiakiNalCheckPps *pps = &check->pps[pps_id];
+	uint32_t address = 0;
+	bool dependent = false;
+	if(!first_slice_segment)
+	{
+		if(pps->dependent_slice_segments)
+			dependent = rbsp_u(r, 1);
+		address = rbsp_u(r, sps->pic_size_bits);
+		if(!address || address >= sps->pic_size)
+			return CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER;
+		state->next_address = address;
+	}
+	if(!dependent)
+	{
+		rbsp_u(r, pps->num_extra_slice_header_bits); // slice_reserved_flag
+		uint32_t slice_type = rbsp_ue(r);
+		if(slice_type > 2 || ((type_flags & NAL_RANDOM_ACCESS) && slice_type != 2))
+			return CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER;
+		if(pps->output_flag_present)
+			rbsp_u(r, 1); // pic_output_flag
+		if(sps->separate_colour_plane && rbsp_u(r, 2) > 2) // colour_plane_id
+			return CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER;
+		if(!picture.idr)
+			picture.poc_lsb = rbsp_u(r, sps->log2_max_poc_lsb);
+	}
+	else if(!state->slices)
+		return CHIAKI_NAL_CHECK_ERROR_SLICE_ORDER;
+	else
+		picture.poc_lsb = state->picture.poc_lsb; // not repeated in dependent segments
+	if(!rbsp_ok(r))
+		return CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER;
+	if(!state->slices)
+		state->sps = sps;
+	else if(sps != state->sps)
+		return CHIAKI_NAL_CHECK_ERROR_SLICE_MISMATCH;
+	return slice_order(state, first_slice_segment, address, &picture);
+}
+
+/**
+ * Check one NAL unit, remembering valid parameter sets.
+ */
+static ChiakiNalCheckError check_nal(ChiakiNalCheck *check, const uint8_t *nal, size_t size, SliceState *state, bool *slice, bool *random_access)
+{
+	bool h265 = chiaki_codec_is_h265(check->codec);
+	size_t header_size = h265 ? 2 : 1;
+	if(size < header_size)
+		return CHIAKI_NAL_CHECK_ERROR_NAL_HEADER;
+	if(nal[0] & 0x80) // forbidden_zero_bit
+		return CHIAKI_NAL_CHECK_ERROR_NAL_HEADER;
+
+	unsigned nal_type;
+	uint16_t flags;
+	unsigned nal_ref_idc = 0;
+	if(h265)
+	{
+		nal_type = (nal[0] >> 1) & 0x3f;
+		unsigned layer_id = ((nal[0] & 1) << 5) | (nal[1] >> 3);
+		unsigned temporal_id_plus1 = nal[1] & 7;
+		if(layer_id || !temporal_id_plus1)
+			return CHIAKI_NAL_CHECK_ERROR_NAL_HEADER;
+		flags = h265_nal_types[nal_type];
+		if((flags & NAL_TEMPORAL_ID_0) && temporal_id_plus1 != 1)
+			return CHIAKI_NAL_CHECK_ERROR_NAL_HEADER;
+	}
+	else
+	{
+		nal_type = nal[0] & 0x1f;
+		nal_ref_idc = (nal[0] >> 5) & 3;
+		flags = h264_nal_types[nal_type];
+		if(((flags & NAL_REF) && !nal_ref_idc) || ((flags & NAL_NO_REF) && nal_ref_idc))
+			return CHIAKI_NAL_CHECK_ERROR_NAL_TYPE;
+	}
+	if(!(flags & NAL_ALLOWED))
+		return CHIAKI_NAL_CHECK_ERROR_NAL_TYPE;
+
+	*slice = flags & NAL_SLICE;
+	if(!(flags & (NAL_SLICE | NAL_SPS | NAL_PPS)))
+		return CHIAKI_NAL_CHECK_ERROR_NONE;
+
+	RbspReader r;
+	rbsp_init(&r, nal + header_size, size - header_size);
+	if(flags & NAL_SPS)
+	{
+		if(!(h265 ? h265_sps(check, &r) : h264_sps(check, &r)))
+			return CHIAKI_NAL_CHECK_ERROR_PARAMETER_SET;
+		return CHIAKI_NAL_CHECK_ERROR_NONE;
+	}
+	if(flags & NAL_PPS)
+	{
+		if(!(h265 ? h265_pps(check, &r) : h264_pps(check, &r)))
+			return CHIAKI_NAL_CHECK_ERROR_PARAMETER_SET;
+		for(size_t i=0; i<CHIAKI_NAL_CHECK_SPS_MAX && !check->params_known; i++)
+			check->params_known = check->sps[i].valid;
+		return CHIAKI_NAL_CHECK_ERROR_NONE;
+	}
+
+	*random_access = flags & NAL_RANDOM_ACCESS;
+	return h265
+		? h265_slice(check, &r, nal_type, flags, state)
+		: h264_slice(check, &r, nal_ref_idc, flags, state);
+}
+
+CHIAKI_EXPORT void chiaki_nal_check(ChiakiNalCheck *check, const uint8_t *buf, size_t buf_size, ChiakiNalCheckResult *result)
+{
+	memset(result, 0, sizeof(*result));
+	check->checked++;
+	check->bytes += buf_size;
+
+	SliceState state;
+	memset(&state, 0, sizeof(state));
+	ChiakiNalCheckError err = CHIAKI_NAL_CHECK_ERROR_NONE;
+	uint32_t damaged_address = 0;
+
+	// leading_zero_8bits, then the first start code
+	size_t pos = 0;
+	while(pos < buf_size && !buf[pos])
+		pos++;
+	if(pos < 2 || pos >= buf_size || buf[pos] != 1)
+		err = CHIAKI_NAL_CHECK_ERROR_NO_START_CODE;
+	else
+		pos++;
+
+	size_t nal_start_code = pos >= 3 ? pos - 3 : 0;
+	while(err == CHIAKI_NAL_CHECK_ERROR_NONE && pos < buf_size)
+	{
+		size_t end, next;
+		bool clean = scan_nal(buf, buf_size, pos, &end, &next);
+		result->nal_units++;
+		bool slice = false;
+		if(!clean)
+			err = CHIAKI_NAL_CHECK_ERROR_EMULATION;
+		else
+		{
+			SliceState before = state;
+			state.next_address = 0;
+			err = check_nal(check, buf + pos, end - pos, &state, &slice, &result->random_access);
+			if(err != CHIAKI_NAL_CHECK_ERROR_NONE && slice)
+			{
+				damaged_address = state.next_address;
+				state = before;
+			}
+		}
+		if(err != CHIAKI_NAL_CHECK_ERROR_NONE)
+		{
+			result->error_offset = nal_start_code;
+			break;
+		}
+		if(slice)
+			state.slices++;
+		nal_start_code = next >= 3 ? next - 3 : 0;
+		pos = next;
+	}
+
+	result->error = err;
+	result->slices = state.slices;
+	if(state.sps)
+		result->pic_size = state.sps->pic_size;
+	if(err == CHIAKI_NAL_CHECK_ERROR_NONE)
+	{
+		result->verdict = CHIAKI_NAL_CHECK_OK;
+		result->valid_size = buf_size;
+		result->pic_size_valid = state.slices ? result->pic_size : 0;
+	}
+	else if(state.slices)
+	{
+		result->verdict = CHIAKI_NAL_CHECK_DAMAGED;
+		result->valid_size = result->error_offset;
+		// the address of a damaged slice, if it could be read, tells where the valid slices end,
+		// else they are known to cover what is before the last of them
+		if(result->pic_size)
+			result->pic_size_valid = damaged_address > state.address ? damaged_address : state.address;
+	}
+	else
+	{
+		result->verdict = CHIAKI_NAL_CHECK_MALFORMED;
+		result->valid_size = 0;
+	}
+	check->verdicts[result->verdict]++;
+	check->errors[err]++;
+}
@@ -0,0 +1,308 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/reftracker.h>
+
+#include <string.h>
+
+#define WINDOW CHIAKI_REF_TRACKER_WINDOW
+#define WINDOW_MASK (CHIAKI_REF_TRACKER_WINDOW - 1)
+
+static inline unsigned slot_of(ChiakiSeqNum16 frame)
+{
+	return (unsigned)frame & WINDOW_MASK;
+}
+
+static inline bool bit_get(const uint64_t *bits, ChiakiSeqNum16 frame)
+{
+	unsigned slot = slot_of(frame);
+	return (bits[slot >> 6] >> (slot & 63)) & 1;
+}
+
+static inline void bit_set(uint64_t *bits, ChiakiSeqNum16 frame)
+{
+	unsigned slot = slot_of(frame);
+	bits[slot >> 6] |= (uint64_t)1 << (slot & 63);
+}
+
+static inline void bit_clear(uint64_t *bits, ChiakiSeqNum16 frame)
+{
+	unsigned slot = slot_of(frame);
+	bits[slot >> 6] &= ~((uint64_t)1 << (slot & 63));
+}
+
+/**
+ * Bits [start, start + n) of a 128 bit ring, returned in bits [0, n). n <= 64.
+ */
+static inline uint64_t ring_extract(const uint64_t *bits, unsigned start, unsigned n)
+{
+	unsigned word = (start >> 6) & 1;
+	unsigned off = start & 63;
+	uint64_t r = bits[word] >> off;
+	if(off)
+		r |= bits[word ^ 1] << (64 - off);
+	return n >= 64 ? r : r & (((uint64_t)1 << n) - 1);
+}
+
+static inline int highest_bit(uint64_t v)
+{
+#if defined(__GNUC__)
+	return 63 - __builtin_clzll(v);
+#else
+	int r = 0;
+	while(v >>= 1)
+		r++;
+	return r;
+#endif
+}
+
+static inline bool in_window(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame)
+{
+	return tracker->head_valid && (ChiakiSeqNum16)(tracker->head - frame) < WINDOW;
+}
+
+static void ref_ring_remove_at(ChiakiRefTracker *tracker, unsigned i)
+{
+	for(; i + 1 < tracker->ref_count; i++)
+	{
+		tracker->ref_ring[(tracker->ref_ring_begin + i) % CHIAKI_REF_TRACKER_REF_SLOTS_MAX] =
+			tracker->ref_ring[(tracker->ref_ring_begin + i + 1) % CHIAKI_REF_TRACKER_REF_SLOTS_MAX];
+	}
+	tracker->ref_count--;
+}
+
+static void ref_remove(ChiakiRefTracker *tracker, ChiakiSeqNum16 frame)
+{
+	if(!bit_get(tracker->refs, frame))
+		return;
+	bit_clear(tracker->refs, frame);
+	for(unsigned i=0; i<tracker->ref_count; i++)
+	{
+		if(tracker->ref_ring[(tracker->ref_ring_begin + i) % CHIAKI_REF_TRACKER_REF_SLOTS_MAX] == frame)
+		{
+			ref_ring_remove_at(tracker, i);
+			return;
+		}
+	}
+}
+
+/**
+ * Move head forward to frame, clearing the slots that are reused for the new frames.
+ * @return whether frame is inside the window afterwards
+ */
+static bool advance(ChiakiRefTracker *tracker, ChiakiSeqNum16 frame)
+{
+	if(!tracker->head_valid)
+	{
+		tracker->head = frame;
+		tracker->head_valid = true;
+		return true;
+	}
+	if(!chiaki_seq_num_16_gt(frame, tracker->head))
+		return in_window(tracker, frame);
+
+	unsigned steps = (ChiakiSeqNum16)(frame - tracker->head);
+	if(steps >= WINDOW)
+	{
+		memset(tracker->received, 0, sizeof(tracker->received));
+		memset(tracker->lost, 0, sizeof(tracker->lost));
+		memset(tracker->decoded, 0, sizeof(tracker->decoded));
+		memset(tracker->refs, 0, sizeof(tracker->refs));
+		tracker->ref_count = 0;
+		tracker->ref_ring_begin = 0;
+	}
+	else
+	{
+		for(unsigned i=1; i<=steps; i++)
+		{
+			ChiakiSeqNum16 f = (ChiakiSeqNum16)(tracker->head + i);
+			bit_clear(tracker->received, f);
+			bit_clear(tracker->lost, f);
+			bit_clear(tracker->decoded, f);
+			bit_clear(tracker->refs, f);
+		}
+	}
+	tracker->head = frame;
+
+	// refs whose slot was just recycled fell out of the window
+	for(unsigned i=0; i<tracker->ref_count;)
+	{
+		ChiakiSeqNum16 ref = tracker->ref_ring[(tracker->ref_ring_begin + i) % CHIAKI_REF_TRACKER_REF_SLOTS_MAX];
+		if(!in_window(tracker, ref))
+			ref_ring_remove_at(tracker, i);
+		else
+			i++;
+	}
+	return true;
+}
+
+CHIAKI_EXPORT void chiaki_ref_tracker_init(ChiakiRefTracker *tracker, unsigned ref_slots)
+{
+	memset(tracker, 0, sizeof(*tracker));
+	if(ref_slots > CHIAKI_REF_TRACKER_REF_SLOTS_MAX)
+		ref_slots = CHIAKI_REF_TRACKER_REF_SLOTS_MAX;
+	if(ref_slots < 1)
+		ref_slots = 1;
+	tracker->ref_slots = ref_slots;
+	tracker->typical_ref_distance = 0;
+}
+
+CHIAKI_EXPORT void chiaki_ref_tracker_reset_refs(ChiakiRefTracker *tracker)
+{
+	memset(tracker->refs, 0, sizeof(tracker->refs));
+	tracker->ref_count = 0;
+	tracker->ref_ring_begin = 0;
+}
+
+CHIAKI_EXPORT void chiaki_ref_tracker_mark_received(ChiakiRefTracker *tracker, ChiakiSeqNum16 frame)
+{
+	if(!advance(tracker, frame))
+		return;
+	bit_set(tracker->received, frame);
+	bit_clear(tracker->lost, frame);
+}
+
+CHIAKI_EXPORT void chiaki_ref_tracker_mark_lost(ChiakiRefTracker *tracker, ChiakiSeqNum16 start, ChiakiSeqNum16 end)
+{
+	unsigned span = (unsigned)(ChiakiSeqNum16)(end - start) + 1;
+	if(span > WINDOW)
+	{
+		start = (ChiakiSeqNum16)(end - (WINDOW - 1));
+		span = WINDOW;
+	}
+	advance(tracker, end);
+	for(unsigned i=0; i<span; i++)
+	{
+		ChiakiSeqNum16 f = (ChiakiSeqNum16)(start + i);
+		if(!in_window(tracker, f))
+			continue;
+		bit_set(tracker->lost, f);
+		bit_clear(tracker->decoded, f);
+		ref_remove(tracker, f);
+	}
+}
+
+CHIAKI_EXPORT void chiaki_ref_tracker_mark_decoded(ChiakiRefTracker *tracker, ChiakiSeqNum16 frame)
+{
+	if(!advance(tracker, frame))
+		return;
+	bit_set(tracker->decoded, frame);
+	bit_clear(tracker->lost, frame);
+	if(bit_get(tracker->refs, frame))
+		return;
+
+	if(tracker->ref_count >= tracker->ref_slots)
+	{
+		ChiakiSeqNum16 oldest = tracker->ref_ring[tracker->ref_ring_begin];
+		bit_clear(tracker->refs, oldest);
+		tracker->ref_ring_begin = (tracker->ref_ring_begin + 1) % CHIAKI_REF_TRACKER_REF_SLOTS_MAX;
+		tracker->ref_count--;
+	}
+	tracker->ref_ring[(tracker->ref_ring_begin + tracker->ref_count) % CHIAKI_REF_TRACKER_REF_SLOTS_MAX] = frame;
+	tracker->ref_count++;
+	bit_set(tracker->refs, frame);
+}
+
+CHIAKI_EXPORT bool chiaki_ref_tracker_is_received(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame)
+{
+	return in_window(tracker, frame) && bit_get(tracker->received, frame);
+}
+
+CHIAKI_EXPORT bool chiaki_ref_tracker_is_lost(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame)
+{
+	return in_window(tracker, frame) && bit_get(tracker->lost, frame);
+}
+
+CHIAKI_EXPORT bool chiaki_ref_tracker_is_decoded(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame)
+{
+	return in_window(tracker, frame) && bit_get(tracker->decoded, frame);
+}
+
+CHIAKI_EXPORT bool chiaki_ref_tracker_has_ref(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame)
+{
+	return in_window(tracker, frame) && bit_get(tracker->refs, frame);
+}
+
+/**
+ * Mask of the ref_slots candidate references of frame, bit p <=> frame - ref_slots + p,
+ * i.e. distance ref_slots - 1 - p. Candidates outside the window are masked out.
+ */
+static uint64_t candidate_refs(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame)
+{
+	if(!tracker->head_valid || !tracker->ref_count)
+		return 0;
+	unsigned n = tracker->ref_slots;
+	ChiakiSeqNum16 oldest = (ChiakiSeqNum16)(frame - n);
+	uint64_t bits = ring_extract(tracker->refs, slot_of(oldest), n);
+
+	// candidates newer than head alias old slots
+	int32_t newest_ahead = (int16_t)(ChiakiSeqNum16)((ChiakiSeqNum16)(frame - 1) - tracker->head);
+	if(newest_ahead >= (int32_t)n)
+		return 0;
+	if(newest_ahead > 0)
+		bits &= ((uint64_t)1 << (n - newest_ahead)) - 1;
+
+	// candidates older than the window are gone
+	int32_t oldest_behind = (int16_t)(ChiakiSeqNum16)(tracker->head - oldest);
+	if(oldest_behind >= (int32_t)WINDOW)
+	{
+		unsigned stale = (unsigned)(oldest_behind - (WINDOW - 1));
+		if(stale >= n)
+			return 0;
+		bits &= ~(((uint64_t)1 << stale) - 1);
+	}
+	return bits;
+}
+
+CHIAKI_EXPORT bool chiaki_ref_tracker_find_ref(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame, unsigned min_distance, unsigned *distance)
+{
+	unsigned n = tracker->ref_slots;
+	if(min_distance >= n)
+		return false;
+	uint64_t bits = candidate_refs(tracker, frame);
+	// keep distances >= min_distance, i.e. p <= n - 1 - min_distance
+	bits &= ((uint64_t)1 << (n - min_distance)) - 1;
+	if(!bits)
+		return false;
+	if(distance)
+		*distance = n - 1 - (unsigned)highest_bit(bits);
+	return true;
+}
+
+CHIAKI_EXPORT ChiakiRefTrackerVerdict chiaki_ref_tracker_verdict(const ChiakiRefTracker *tracker, ChiakiSeqNum16 frame, unsigned ref_distance)
+{
+	if(ref_distance == CHIAKI_REF_TRACKER_NO_REF)
+		return CHIAKI_REF_TRACKER_DECODABLE;
+	if(chiaki_ref_tracker_has_ref(tracker, (ChiakiSeqNum16)(frame - ref_distance - 1)))
+		return CHIAKI_REF_TRACKER_DECODABLE;
+	if(chiaki_ref_tracker_find_ref(tracker, frame, ref_distance + 1, NULL))
+		return CHIAKI_REF_TRACKER_RECOVERABLE;
+	return CHIAKI_REF_TRACKER_UNDECODABLE;
+}
+
+CHIAKI_EXPORT uint32_t chiaki_ref_tracker_predict_undecodable(const ChiakiRefTracker *tracker, ChiakiSeqNum16 first, unsigned count)
+{
+	if(count > 32)
+		count = 32;
+	uint32_t usable = 0; // bit i: frame first + i is predicted to end up as a reference
+	uint32_t undecodable = 0;
+	unsigned d = tracker->typical_ref_distance;
+	for(unsigned i=0; i<count; i++)
+	{
+		ChiakiSeqNum16 frame = (ChiakiSeqNum16)(first + i);
+		bool ok = false;
+		// the typical reference first, then any older substitute within the DPB window
+		for(unsigned dist = d; dist < tracker->ref_slots && !ok; dist++)
+		{
+			int32_t j = (int32_t)i - (int32_t)dist - 1;
+			if(j >= 0)
+				ok = (usable >> j) & 1;
+			else
+				ok = chiaki_ref_tracker_has_ref(tracker, (ChiakiSeqNum16)(frame - dist - 1));
+		}
+		if(ok)
+			usable |= (uint32_t)1 << i;
+		else
+			undecodable |= (uint32_t)1 << i;
+	}
+	return undecodable;
+}
@@ -60,12 +60,16 @@
 #include <chiaki/stoppipe.h>
 #include <chiaki/thread.h>
 #include <chiaki/base64.h>
+#include <chiaki/jsonscan.h>
 #include <chiaki/random.h>
 #include <chiaki/sock.h>
 #include <chiaki/time.h>
 
 #include "../utils.h"
 #include "stun.h"
+#include "httpclient.h"
+#include "signalgraph.h"
+#include "notifqueue.h"
 
 #define UUIDV4_STR_LEN 37
 #define SECOND_US 1000000L
@@ -101,10 +105,6 @@ _Static_assert(WEBSOCKET_PONG_TIMEOUT_SEC < WEBSOCKET_PING_INTERVAL_SEC,
 #define EXTRA_CANDIDATE_ADDRESSES 3
 #define ENABLE_IPV6 false
 
-#if defined(__PSVITA__)
-#define VITA_PSN_CA_BUNDLE_PATH "app0:/assets/psn-ca-bundle.pem"
-#endif
-
 #if defined(__PSVITA__)
 #include "vita_dns.h"
 #endif
@@ -158,17 +158,6 @@ static const char session_command_url[] = "https://web.np.playstation.com/api/cl
 static const char session_message_url_fmt[] = "https://web.np.playstation.com/api/sessionManager/v1/remotePlaySessions/%s/sessionMessage";
 static const char delete_messsage_url_fmt[] = "https://web.np.playstation.com/api/sessionManager/v1/remotePlaySessions/%s/members/me";
 
-static void curl_apply_platform_tls_defaults(CURL *curl)
-{
-#if defined(__PSVITA__)
-    curl_easy_setopt(curl, CURLOPT_CAINFO, VITA_PSN_CA_BUNDLE_PATH);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
-#else
-    (void)curl;
-#endif
-}
-
 // JSON payloads for requests.
 // Implemented as string templates due to the broken JSON used by the official app, which we're
 // trying to emulate.
@@ -262,39 +251,6 @@ static void log_psn_remote_client_profile(ChiakiLog *log)
                 psn_remote_client_profile.local_peer_platform);
 }
 
-typedef enum notification_type_t
-{
-    NOTIFICATION_TYPE_UNKNOWN = 0,
-    // psn:sessionManager:sys:remotePlaySession:created
-    NOTIFICATION_TYPE_SESSION_CREATED = 1 << 0,
-    // psn:sessionManager:sys:rps:members:created
-    NOTIFICATION_TYPE_MEMBER_CREATED = 1 << 1,
-    // psn:sessionManager:sys:rps:members:deleted
-    NOTIFICATION_TYPE_MEMBER_DELETED = 1 << 2,
-    // psn:sessionManager:sys:rps:customData1:updated
-    NOTIFICATION_TYPE_CUSTOM_DATA1_UPDATED = 1 << 3,
-    // psn:sessionManager:sys:rps:sessionMessage:created
-    NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED = 1 << 4,
-    // psn:sessionManager:sys:remotePlaySession:deleted
-    NOTIFICATION_TYPE_SESSION_DELETED = 1 << 5
-} NotificationType;
-
-typedef struct notification_t
-{
-    struct notification_t *next;
-
-    NotificationType type;
-    json_object* json;
-    char* json_buf;
-    size_t json_buf_size;
-} Notification;
-
-typedef struct notification_queue_t
-{
-    Notification *front, *rear;
-
-} NotificationQueue;
-
 typedef enum session_state_t
 {
     SESSION_STATE_INIT = 0,
@@ -356,6 +312,7 @@ typedef struct session_t
     uint64_t account_id;
     char *online_id;
     char session_id[UUIDV4_STR_LEN];
+    bool session_created; // on the PSN server, until deleted again
     char pushctx_id[UUIDV4_STR_LEN];
 
     uint16_t sid_local;
@@ -385,12 +342,13 @@ typedef struct session_t
     uint16_t ctrl_port;
     char client_local_ip[INET6_ADDRSTRLEN];
 
-    CURLSH* curl_share;
+    ChiakiHttpClient *http;
 
     char* ws_fqdn;
     ChiakiThread ws_thread;
     NotificationQueue* ws_notification_queue;
     bool ws_thread_should_stop;
+    bool ws_thread_running; // created and not joined yet, the thread clears ws_open itself
     bool ws_open;
     ChiakiErrorCode ws_connect_err;
     long ws_connect_http_code;
@@ -418,15 +376,6 @@ typedef struct session_t
     ChiakiLog *log;
 } Session;
 
-typedef enum session_message_action_t
-{
-    SESSION_MESSAGE_ACTION_UNKNOWN = 0,
-    SESSION_MESSAGE_ACTION_OFFER = 1,
-    SESSION_MESSAGE_ACTION_RESULT = 1 << 2,
-    SESSION_MESSAGE_ACTION_ACCEPT = 1 << 3,
-    SESSION_MESSAGE_ACTION_TERMINATE = 1 << 4,
-} SessionMessageAction;
-
 typedef struct http_response_data_t
 {
     char* data;
@@ -460,6 +409,9 @@ typedef struct connection_request_t
     size_t num_candidates;
     uint8_t default_route_mac_addr[6];
     uint8_t local_hashed_id[20];
+    // candidates serialized ahead of time, only set for our own prepared offer
+    char *candidates_json;
+    size_t candidates_json_len;
 } ConnectionRequest;
 
 typedef struct session_message_t
@@ -481,7 +433,6 @@ static void hex_to_bytes(const char* hex_str, uint8_t* bytes, size_t max_len);
 static void bytes_to_hex(const uint8_t* bytes, size_t len, char* hex_str, size_t max_len);
 static void random_uuidv4(char* out);
 static void *websocket_thread_func(void *user);
-static NotificationType parse_notification_type(ChiakiLog *log, json_object* json);
 static ChiakiErrorCode send_prepared_offer(Session *session);
 static ChiakiErrorCode send_offer(Session *session, int req_id, Candidate *local_console_candidate, Candidate *local_candidates, Candidate *candidates_received, size_t num_candidates);
 static ChiakiErrorCode send_accept(Session *session, int req_id, Candidate *selected_candidate);
@@ -506,18 +457,13 @@ static ChiakiErrorCode check_candidates(
     Session *session, Candidate *local_candidates, Candidate *candidates_received, size_t num_candidates, chiaki_socket_t *out,
     Candidate *out_candidate);
 
-static json_object* session_message_get_payload(ChiakiLog *log, json_object *session_message);
+static json_object* session_message_get_payload(ChiakiLog *log, Notification *notif);
 // static SessionMessageAction get_session_message_action(json_object *payload);
 static ChiakiErrorCode wait_for_notification(
     Session *session, Notification** out,
     uint16_t types, uint64_t timeout_ms);
 static ChiakiErrorCode clear_notification(
     Session *session, Notification *notification);
-static void notification_queue_free(NotificationQueue* queue);
-static NotificationQueue *createNq();
-static void dequeueNq(NotificationQueue *nq);
-static void enqueueNq(NotificationQueue *nq, Notification *notif);
-static Notification* newNotification(NotificationType type, json_object *json, char* json_buf, size_t json_buf_size);
 static void remove_substring(char *str, char *substring);
 static int ws_curl_debug_cb(CURL *handle, curl_infotype type, char *data,
                             size_t size, void *userptr);
@@ -529,6 +475,8 @@ static ChiakiErrorCode wait_for_session_message_ack(
     Session *session, int req_id, uint64_t timeout_ms);
 static ChiakiErrorCode session_message_parse(
     ChiakiLog *log, json_object *message_json, SessionMessage **out);
+static ChiakiErrorCode session_candidates_serialize(
+    Session *session, ConnectionRequest *req, char **out, size_t *out_len);
 static ChiakiErrorCode session_message_serialize(
     Session *session, SessionMessage *message, char **out, size_t *out_len);
 static ChiakiErrorCode short_message_serialize(
@@ -549,13 +497,13 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_list_devices(
     ChiakiHolepunchDeviceInfo **devices, size_t *device_count,
     ChiakiLog *log)
 {
-    CURL *curl = curl_easy_init();
+    ChiakiHttpClient *http = chiaki_http_client_shared();
+    CURL *curl = http ? chiaki_http_client_acquire(http) : NULL;
     if(!curl)
     {
         CHIAKI_LOGE(log, "Curl could not init");
         return CHIAKI_ERR_MEMORY;
     }
-    curl_apply_platform_tls_defaults(curl);
     char url[133];
 
     char *platform;
@@ -569,7 +517,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_list_devices(
     char* oauth_header = NULL;
     ChiakiErrorCode err = make_oauth2_header(&oauth_header, psn_oauth2_token);
     if(err != CHIAKI_ERR_SUCCESS)
+    {
+        chiaki_http_client_release(http, curl);
         return err;
+    }
 
     HttpResponseData response_data = {
         .data = malloc(0),
@@ -593,7 +544,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_list_devices(
     if (vita_resolve)
         curl_easy_setopt(curl, CURLOPT_RESOLVE, vita_resolve);
 #endif
-    CURLcode res = curl_easy_perform(curl);
+    CURLcode res = chiaki_http_client_perform(http, curl, log, "list_devices", NULL);
 #if defined(__PSVITA__)
     curl_slist_free_all(vita_resolve);
 #endif
@@ -771,7 +722,7 @@ cleanup_json_tokener:
 cleanup:
     free(oauth_header);
     free(response_data.data);
-    curl_easy_cleanup(curl);
+    chiaki_http_client_release(http, curl);
     return err;
 }
 
@@ -868,7 +819,7 @@ CHIAKI_EXPORT Session* chiaki_holepunch_session_init(
     session->log = log;
 
     session->ws_fqdn = NULL;
-    session->ws_notification_queue = createNq();
+    session->ws_notification_queue = chiaki_notification_queue_new();
     if(!session->ws_notification_queue)
     {
         free(session->oauth_header);
@@ -878,6 +829,7 @@ CHIAKI_EXPORT Session* chiaki_holepunch_session_init(
     session->local_candidates = NULL;
     session->our_offer_msg = NULL;
     session->ws_thread_should_stop = false;
+    session->ws_thread_running = false;
     session->ws_open = false;
     session->ws_connect_err = CHIAKI_ERR_SUCCESS;
     session->ws_connect_http_code = 0;
@@ -887,6 +839,7 @@ CHIAKI_EXPORT Session* chiaki_holepunch_session_init(
     session->online_id = NULL;
     session->main_should_stop = false;
     memset(&session->session_id, 0, sizeof(session->session_id));
+    session->session_created = false;
     memset(&session->console_uid, 0, sizeof(session->console_uid));
     memset(&session->hashed_id_console, 0, sizeof(session->hashed_id_console));
     memset(&session->custom_data1, 0, sizeof(session->custom_data1));
@@ -918,8 +871,8 @@ CHIAKI_EXPORT Session* chiaki_holepunch_session_init(
     err = chiaki_cond_init(&session->state_cond, &session->state_mutex);
     assert(err == CHIAKI_ERR_SUCCESS);
 
-    session->curl_share = curl_share_init();
-    assert(session->curl_share != NULL);
+    session->http = chiaki_http_client_shared();
+    assert(session->http != NULL);
     log_psn_remote_client_profile(session->log);
 
     chiaki_mutex_lock(&session->state_mutex);
@@ -971,22 +924,16 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_upnp_discover(Session *session)
     return CHIAKI_ERR_SUCCESS;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create(Session* session)
+/**
+ * Start the websocket thread and wait until the push connection is open.
+ * The thread is stopped again if opening fails.
+ */
+static ChiakiErrorCode session_ws_open(Session *session)
 {
-    ChiakiErrorCode err = get_websocket_fqdn(session, &session->ws_fqdn);
+    ChiakiErrorCode err = chiaki_thread_create_role(&session->ws_thread, CHIAKI_THREAD_ROLE_HOUSEKEEPING, websocket_thread_func, session);
     if (err != CHIAKI_ERR_SUCCESS)
-        goto cleanup_curlsh;
-    if(session->main_should_stop)
-    {
-        session->main_should_stop = false;
-        CHIAKI_LOGI(session->log, "chiaki_holepunch_session_create: canceled");
-        err = CHIAKI_ERR_CANCELED;
-        goto cleanup_curlsh;
-    }
-
-    err = chiaki_thread_create(&session->ws_thread, websocket_thread_func, session);
-    if (err != CHIAKI_ERR_SUCCESS)
-        goto cleanup_curlsh;
+        return err;
+    session->ws_thread_running = true;
     chiaki_thread_set_name(&session->ws_thread, "Chiaki Holepunch WS");
     CHIAKI_LOGV(session->log, "chiaki_holepunch_session_create: Created websocket thread");
 
@@ -1019,9 +966,23 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create(Session* session)
         }
     }
     chiaki_mutex_unlock(&session->state_mutex);
-    if (err != CHIAKI_ERR_SUCCESS)
-        goto cleanup_thread;
+    if (err == CHIAKI_ERR_SUCCESS)
+        return err;
 
+    session->ws_thread_should_stop = true;
+    chiaki_thread_join(&session->ws_thread, NULL);
+    session->ws_thread_running = false;
+    session->ws_open = false;
+    return err;
+}
+
+/**
+ * Create the session on the PSN server and wait until it has been created and we have joined it.
+ * Requires the websocket to be open, since the notifications arrive through it.
+ */
+static ChiakiErrorCode session_create_remote(Session *session)
+{
+    ChiakiErrorCode err;
     if(session->main_should_stop)
     {
         session->main_should_stop = false;
@@ -1032,6 +993,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create(Session* session)
     err = http_create_session(session);
     if (err != CHIAKI_ERR_SUCCESS)
         goto cleanup_thread;
+    session->session_created = true;
     CHIAKI_LOGV(session->log, "chiaki_holepunch_session_create: Sent holepunch session creation request");
     if(session->main_should_stop)
     {
@@ -1073,31 +1035,35 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create(Session* session)
             session->state |= SESSION_STATE_CREATED;
             CHIAKI_LOGV(session->log, "chiaki_holepunch_session_create: Holepunch session created.");
             // Get the user's online id
-            json_object *online_id_json = NULL;
-            json_pointer_get(notif->json, "/to/onlineId", &online_id_json);
-            if (!online_id_json || !json_object_is_type(online_id_json, json_type_string))
+            static const char *const online_id_path[] = { "to.onlineId" };
+            ChiakiJsonValue online_id;
+            chiaki_json_scan(notif->json_buf, notif->json_buf_size, online_id_path, &online_id, 1);
+            if (online_id.type != CHIAKI_JSON_TYPE_STRING)
             {
                 CHIAKI_LOGE(session->log, "chiaki_holepunch_session_create: JSON does not contain member with online Id of user");
-                const char *json_str = json_object_to_json_string_ext(notif->json, JSON_C_TO_STRING_PRETTY);
-                CHIAKI_LOGV(session->log, "chiaki_holepunch_session_create: JSON was:\n%s", json_str);
-                err = CHIAKI_ERR_UNKNOWN;
-                break;
-            }
-            const char *online_id = json_object_get_string(online_id_json);
-            if (!online_id_json)
-            {
-                CHIAKI_LOGE(session->log, "chiaki_holepunch_session_create: could not extra PSN online id string.");
+                CHIAKI_LOGV(session->log, "chiaki_holepunch_session_create: JSON was:\n%s", notif->json_buf);
                 err = CHIAKI_ERR_UNKNOWN;
+                chiaki_mutex_unlock(&session->state_mutex);
                 goto cleanup_thread;
             }
-            session->online_id = malloc((strlen(online_id) + 1) * sizeof(char));
+            // Decoding never makes the string longer
+            session->online_id = malloc(online_id.len + 1);
             if(!session->online_id)
             {
                 CHIAKI_LOGE(session->log, "chiaki_holepunch_session_create: could not allocate space for PSN online id string.");
                 err = CHIAKI_ERR_MEMORY;
+                chiaki_mutex_unlock(&session->state_mutex);
+                goto cleanup_thread;
+            }
+            if (chiaki_json_unescape(&online_id, session->online_id, online_id.len + 1, NULL) != CHIAKI_ERR_SUCCESS)
+            {
+                CHIAKI_LOGE(session->log, "chiaki_holepunch_session_create: could not extra PSN online id string.");
+                free(session->online_id);
+                session->online_id = NULL;
+                err = CHIAKI_ERR_UNKNOWN;
+                chiaki_mutex_unlock(&session->state_mutex);
                 goto cleanup_thread;
             }
-            strcpy(session->online_id, online_id);
         }
         else if (notif->type == NOTIFICATION_TYPE_MEMBER_CREATED)
         {
@@ -1108,6 +1074,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create(Session* session)
         {
             CHIAKI_LOGE(session->log, "chiaki_holepunch_session_create: Got unexpected notification of type %d", notif->type);
             err = CHIAKI_ERR_UNKNOWN;
+            chiaki_mutex_unlock(&session->state_mutex);
             goto cleanup_thread;
         }
         if(session->main_should_stop)
@@ -1115,6 +1082,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create(Session* session)
             session->main_should_stop = false;
             CHIAKI_LOGI(session->log, "chiaki_holepunch_session_create: canceled");
             err = CHIAKI_ERR_CANCELED;
+            chiaki_mutex_unlock(&session->state_mutex);
             goto cleanup_thread;
         }
         http_check_session(session, true);
@@ -1127,13 +1095,95 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create(Session* session)
     return err;
 
 cleanup_thread:
+    // A session that made it to the server is left to session_delete_remote(), which can delete
+    // it without the websocket
     session->ws_thread_should_stop = true;
     chiaki_thread_join(&session->ws_thread, NULL);
+    session->ws_thread_running = false;
     session->ws_open = false;
-cleanup_curlsh:
     return err;
 }
 
+/**
+ * Delete the session from the PSN server if it was created there. The deletion notifications
+ * are only awaited while the websocket is open.
+ */
+static void session_delete_remote(Session *session)
+{
+    if(!session->session_created)
+        return;
+    ChiakiErrorCode err = deleteSession(session);
+    if(err != CHIAKI_ERR_SUCCESS)
+        CHIAKI_LOGE(session->log, "Couldn't remove our holepunch session gracefully from PlayStation servers.");
+    session->session_created = false;
+    if(!session->ws_open)
+        return;
+    bool finished = false;
+    Notification *notif = NULL;
+    int notif_query = NOTIFICATION_TYPE_MEMBER_DELETED | NOTIFICATION_TYPE_SESSION_DELETED;
+    while (!finished)
+    {
+        err = wait_for_notification(session, &notif, notif_query, SESSION_DELETION_TIMEOUT_SEC * 1000);
+        if (err == CHIAKI_ERR_TIMEOUT)
+        {
+            CHIAKI_LOGE(session->log, "session_delete_remote: Timed out waiting for holepunch session deletion notifications.");
+            break;
+        }
+        else if (err != CHIAKI_ERR_SUCCESS)
+        {
+            CHIAKI_LOGE(session->log, "session_delete_remote: Failed to wait for holepunch session deletion notifications.");
+            break;
+        }
+
+        if (notif->type == NOTIFICATION_TYPE_MEMBER_DELETED || notif->type == NOTIFICATION_TYPE_SESSION_DELETED)
+        {
+            chiaki_mutex_lock(&session->state_mutex);
+            session->state |= SESSION_STATE_DELETED;
+            chiaki_mutex_unlock(&session->state_mutex);
+            log_session_state(session);
+            CHIAKI_LOGI(session->log, "session_delete_remote: Holepunch session deleted.");
+            finished = true;
+        }
+        else
+        {
+            CHIAKI_LOGE(session->log, "session_delete_remote: Got unexpected notification of type %d", notif->type);
+            break;
+        }
+        clear_notification(session, notif);
+    }
+}
+
+/**
+ * Stop the websocket thread if it is still running.
+ */
+static void session_ws_close(Session *session)
+{
+    if(!session->ws_thread_running)
+        return;
+    session->ws_thread_should_stop = true;
+    chiaki_stop_pipe_stop(&session->select_pipe);
+    chiaki_thread_join(&session->ws_thread, NULL);
+    session->ws_thread_running = false;
+    session->ws_open = false;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create(Session* session)
+{
+    ChiakiErrorCode err = get_websocket_fqdn(session, &session->ws_fqdn);
+    if (err != CHIAKI_ERR_SUCCESS)
+        return err;
+    if(session->main_should_stop)
+    {
+        session->main_should_stop = false;
+        CHIAKI_LOGI(session->log, "chiaki_holepunch_session_create: canceled");
+        return CHIAKI_ERR_CANCELED;
+    }
+    err = session_ws_open(session);
+    if (err != CHIAKI_ERR_SUCCESS)
+        return err;
+    return session_create_remote(session);
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_start(
     Session* session, const uint8_t* device_uid,
     ChiakiHolepunchConsoleType console_type)
@@ -1213,20 +1263,22 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_start(
         if (notif->type == NOTIFICATION_TYPE_MEMBER_CREATED)
         {
             // Check if the session now contains the console we requested
-            json_object *member_duid_json = NULL;
-            json_pointer_get(notif->json, "/body/data/members/0/deviceUniqueId", &member_duid_json);
-            if (!member_duid_json || !json_object_is_type(member_duid_json, json_type_string))
+            static const char *const member_duid_path[] = { "body.data.members.0.deviceUniqueId" };
+            ChiakiJsonValue member_duid_json;
+            chiaki_json_scan(notif->json_buf, notif->json_buf_size, member_duid_path, &member_duid_json, 1);
+            if (member_duid_json.type != CHIAKI_JSON_TYPE_STRING)
             {
                 CHIAKI_LOGE(session->log, "chiaki_holepunch_session_start: JSON does not contain member with a deviceUniqueId string field!");
-                const char *json_str = json_object_to_json_string_ext(notif->json, JSON_C_TO_STRING_PRETTY);
-                CHIAKI_LOGV(session->log, "chiaki_holepunch_session_start: JSON was:\n%s", json_str);
+                CHIAKI_LOGV(session->log, "chiaki_holepunch_session_start: JSON was:\n%s", notif->json_buf);
                 err = CHIAKI_ERR_UNKNOWN;
                 break;
             }
-            const char *member_duid = json_object_get_string(member_duid_json);
-            if (strlen(member_duid) != 64)
+            char member_duid[65];
+            size_t member_duid_len = 0;
+            if (chiaki_json_unescape(&member_duid_json, member_duid, sizeof(member_duid), &member_duid_len) != CHIAKI_ERR_SUCCESS
+                || member_duid_len != 64)
             {
-                CHIAKI_LOGE(session->log, "chiaki_holepunch_session_start: \"deviceUniqueId\" has unexpected length, got %d, expected 64", strlen(member_duid));
+                CHIAKI_LOGE(session->log, "chiaki_holepunch_session_start: \"deviceUniqueId\" has unexpected length, got %zu, expected 64", member_duid_json.len);
                 err = CHIAKI_ERR_UNKNOWN;
                 break;
             }
@@ -1246,20 +1298,22 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_start(
             session->state |= SESSION_STATE_CONSOLE_JOINED;
         } else if (notif->type == NOTIFICATION_TYPE_CUSTOM_DATA1_UPDATED)
         {
-            json_object *custom_data1_json = NULL;
-            json_pointer_get(notif->json, "/body/data/customData1", &custom_data1_json);
-            if (!custom_data1_json || !json_object_is_type(custom_data1_json, json_type_string))
+            static const char *const custom_data1_path[] = { "body.data.customData1" };
+            ChiakiJsonValue custom_data1_json;
+            chiaki_json_scan(notif->json_buf, notif->json_buf_size, custom_data1_path, &custom_data1_json, 1);
+            if (custom_data1_json.type != CHIAKI_JSON_TYPE_STRING)
             {
                 CHIAKI_LOGE(session->log, "chiaki_holepunch_session_start: JSON does not contain \"customData1\" string field");
-                const char *json_str = json_object_to_json_string_ext(notif->json, JSON_C_TO_STRING_PRETTY);
-                CHIAKI_LOGV(session->log, "chiaki_holepunch_session_start: JSON was:\n%s", json_str);
+                CHIAKI_LOGV(session->log, "chiaki_holepunch_session_start: JSON was:\n%s", notif->json_buf);
                 err = CHIAKI_ERR_UNKNOWN;
                 break;
             }
-            const char *custom_data1 = json_object_get_string(custom_data1_json);
-            if (strlen(custom_data1) != 32)
+            char custom_data1[33];
+            size_t custom_data1_len = 0;
+            if (chiaki_json_unescape(&custom_data1_json, custom_data1, sizeof(custom_data1), &custom_data1_len) != CHIAKI_ERR_SUCCESS
+                || custom_data1_len != 32)
             {
-                CHIAKI_LOGE(session->log, "chiaki_holepunch_session_start: \"customData1\" has unexpected length, got %d, expected 32", strlen(custom_data1));
+                CHIAKI_LOGE(session->log, "chiaki_holepunch_session_start: \"customData1\" has unexpected length, got %zu, expected 32", custom_data1_json.len);
                 err = CHIAKI_ERR_UNKNOWN;
                 break;
             }
@@ -1283,6 +1337,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_start(
             session->main_should_stop = false;
             CHIAKI_LOGI(session->log, "chiaki_holepunch_session_start: canceled");
             err = CHIAKI_ERR_CANCELED;
+            chiaki_mutex_unlock(&session->state_mutex);
             return err;
         }
         http_check_session(session, false);
@@ -1291,7 +1346,188 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_start(
         log_session_state(session);
         chiaki_mutex_unlock(&session->state_mutex);
     }
-    chiaki_mutex_unlock(&session->state_mutex);
+    // Left the loop early through one of the error paths above, which hold the lock
+    if (!finished)
+        chiaki_mutex_unlock(&session->state_mutex);
+    return err;
+}
+
+typedef struct prepare_context_t
+{
+    Session *session;
+    const uint8_t *console_uid;
+    ChiakiHolepunchConsoleType console_type;
+} PrepareContext;
+
+static ChiakiErrorCode prepare_stage_upnp(void *user)
+{
+    PrepareContext *ctx = user;
+    return chiaki_holepunch_upnp_discover(ctx->session);
+}
+
+static ChiakiErrorCode prepare_stage_ws_fqdn(void *user)
+{
+    PrepareContext *ctx = user;
+    return get_websocket_fqdn(ctx->session, &ctx->session->ws_fqdn);
+}
+
+static ChiakiErrorCode prepare_stage_ws_open(void *user)
+{
+    PrepareContext *ctx = user;
+    if(ctx->session->main_should_stop)
+    {
+        CHIAKI_LOGI(ctx->session->log, "chiaki_holepunch_session_prepare: canceled");
+        return CHIAKI_ERR_CANCELED;
+    }
+    return session_ws_open(ctx->session);
+}
+
+static ChiakiErrorCode prepare_stage_create(void *user)
+{
+    PrepareContext *ctx = user;
+    return session_create_remote(ctx->session);
+}
+
+static ChiakiErrorCode prepare_stage_offer(void *user)
+{
+    PrepareContext *ctx = user;
+    return chiaki_holepunch_session_create_offer(ctx->session);
+}
+
+static ChiakiErrorCode prepare_stage_start(void *user)
+{
+    PrepareContext *ctx = user;
+    return chiaki_holepunch_session_start(ctx->session, ctx->console_uid, ctx->console_type);
+}
+
+static void prepare_cancel(void *user)
+{
+    // Stages consume main_should_stop when they notice it, so raise it again for the
+    // stages that are still running.
+    PrepareContext *ctx = user;
+    ctx->session->main_should_stop = true;
+    chiaki_mutex_lock(&ctx->session->notif_mutex);
+    chiaki_cond_broadcast(&ctx->session->notif_cond);
+    chiaki_mutex_unlock(&ctx->session->notif_mutex);
+    chiaki_mutex_lock(&ctx->session->state_mutex);
+    chiaki_cond_broadcast(&ctx->session->state_cond);
+    chiaki_mutex_unlock(&ctx->session->state_mutex);
+}
+
+/**
+ * Undo chiaki_holepunch_session_create_offer(), whichever step of it failed.
+ */
+static void session_release_offer(Session *session)
+{
+#if CHIAKI_CAN_USE_MINIUPNPC
+    if(session->gw.data && session->local_port_ctrl != 0)
+        upnp_delete_udp_port_mapping(session->log, &session->gw, session->local_port_ctrl);
+#endif
+    session->local_port_ctrl = 0;
+    if(!CHIAKI_SOCKET_IS_INVALID(session->ipv4_sock))
+    {
+        CHIAKI_SOCKET_CLOSE(session->ipv4_sock);
+        session->ipv4_sock = CHIAKI_INVALID_SOCKET;
+    }
+    if(!CHIAKI_SOCKET_IS_INVALID(session->ipv6_sock))
+    {
+        CHIAKI_SOCKET_CLOSE(session->ipv6_sock);
+        session->ipv6_sock = CHIAKI_INVALID_SOCKET;
+    }
+    if(session->our_offer_msg)
+    {
+        session_message_free(session->our_offer_msg);
+        session->our_offer_msg = NULL;
+    }
+    free(session->local_candidates);
+    session->local_candidates = NULL;
+}
+
+static void prepare_undo_ws_open(void *user)
+{
+    PrepareContext *ctx = user;
+    session_ws_close(ctx->session);
+}
+
+static void prepare_undo_create(void *user)
+{
+    PrepareContext *ctx = user;
+    session_delete_remote(ctx->session);
+}
+
+static void prepare_undo_offer(void *user)
+{
+    PrepareContext *ctx = user;
+    session_release_offer(ctx->session);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_prepare(
+    Session *session, const uint8_t *console_uid,
+    ChiakiHolepunchConsoleType console_type, ChiakiHolepunchPrepareStage *failed_stage)
+{
+    if(failed_stage)
+        *failed_stage = CHIAKI_HOLEPUNCH_PREPARE_STAGE_NONE;
+    // The offer only looks at the console type for IPv6 candidates, set it before it runs
+    session->console_type = console_type;
+    PrepareContext ctx = {
+        .session = session,
+        .console_uid = console_uid,
+        .console_type = console_type,
+    };
+
+    ChiakiSignalGraph graph;
+    ChiakiErrorCode err = chiaki_signal_graph_init(&graph, session->log);
+    if(err != CHIAKI_ERR_SUCCESS)
+        return err;
+    chiaki_signal_graph_set_cancel_cb(&graph, prepare_cancel, &ctx);
+    int upnp = chiaki_signal_graph_add(&graph, "upnp", prepare_stage_upnp, &ctx, 0);
+    int ws_fqdn = chiaki_signal_graph_add(&graph, "ws_fqdn", prepare_stage_ws_fqdn, &ctx, 0);
+    // PSN pushes the session notifications through the websocket, so it has to be open first
+    int ws_open = chiaki_signal_graph_add(&graph, "ws_open", prepare_stage_ws_open, &ctx, 1u << ws_fqdn);
+    int create = chiaki_signal_graph_add(&graph, "create", prepare_stage_create, &ctx, 1u << ws_open);
+    int offer = chiaki_signal_graph_add(&graph, "offer", prepare_stage_offer, &ctx, 1u << upnp);
+    // The offer is only sent after the console's offer arrived, so starting doesn't wait for it
+    int start = chiaki_signal_graph_add(&graph, "start", prepare_stage_start, &ctx, 1u << create);
+    assert(upnp >= 0 && ws_fqdn >= 0 && ws_open >= 0 && create >= 0 && offer >= 0 && start >= 0);
+    // A failing stage cancels the others wherever they are, e.g. create after the session
+    // already exists on the server, so each stage is undone from whatever state it reached.
+    // Starting is undone with the session.
+    chiaki_signal_graph_set_undo(&graph, ws_open, prepare_undo_ws_open);
+    chiaki_signal_graph_set_undo(&graph, create, prepare_undo_create);
+    chiaki_signal_graph_set_undo(&graph, offer, prepare_undo_offer);
+
+    err = chiaki_signal_graph_run(&graph, true);
+    chiaki_signal_graph_log(&graph, err == CHIAKI_ERR_SUCCESS ? CHIAKI_LOG_INFO : CHIAKI_LOG_WARNING);
+
+    if(err != CHIAKI_ERR_SUCCESS)
+    {
+        // Report the stage that failed first, the others were canceled because of it
+        ChiakiSignalStage *first = NULL;
+        for(size_t i = 0; i < graph.stages_count; i++)
+        {
+            ChiakiSignalStage *stage = &graph.stages[i];
+            if(stage->state == CHIAKI_SIGNAL_STAGE_FAILED && (!first || stage->end_us < first->end_us))
+                first = stage;
+        }
+        int first_index = first ? (int)(first - graph.stages) : -1;
+        if(failed_stage)
+        {
+            if(first_index == upnp)
+                *failed_stage = CHIAKI_HOLEPUNCH_PREPARE_STAGE_UPNP;
+            else if(first_index == offer)
+                *failed_stage = CHIAKI_HOLEPUNCH_PREPARE_STAGE_OFFER;
+            else if(first_index == start)
+                *failed_stage = CHIAKI_HOLEPUNCH_PREPARE_STAGE_START;
+            else
+                *failed_stage = CHIAKI_HOLEPUNCH_PREPARE_STAGE_CREATE;
+        }
+        // Stages consume the flag, but the ones that failed because of the cancel callback
+        // may have left it set. Clear it before undoing, deleting the session waits for
+        // notifications.
+        session->main_should_stop = false;
+        chiaki_signal_graph_undo(&graph);
+    }
+    chiaki_signal_graph_fini(&graph);
     return err;
 }
 
@@ -1313,13 +1549,12 @@ static ChiakiErrorCode http_ps4_session_wakeup(Session *session)
         .size = 0,
     };
 
-    CURL *curl = curl_easy_init();
+    CURL *curl = chiaki_http_client_acquire(session->http);
     if(!curl)
     {
         CHIAKI_LOGE(session->log, "Curl could not init");
         return CHIAKI_ERR_MEMORY;
     }
-    curl_apply_platform_tls_defaults(curl);
 
     struct curl_slist *headers = NULL;
     headers = curl_slist_append(headers, session->oauth_header);
@@ -1330,7 +1565,6 @@ static ChiakiErrorCode http_ps4_session_wakeup(Session *session)
              psn_remote_client_profile.command_user_agent);
     headers = curl_slist_append(headers, command_user_agent);
 
-    curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, 2L);
     curl_easy_setopt(curl, CURLOPT_URL, user_profile_url);
@@ -1345,7 +1579,7 @@ static ChiakiErrorCode http_ps4_session_wakeup(Session *session)
     if (vita_resolve)
         curl_easy_setopt(curl, CURLOPT_RESOLVE, vita_resolve);
 #endif
-    CURLcode res = curl_easy_perform(curl);
+    CURLcode res = chiaki_http_client_perform(session->http, curl, session->log, "ps4_user_profile", NULL);
 #if defined(__PSVITA__)
     curl_slist_free_all(vita_resolve);
 #endif
@@ -1425,7 +1659,7 @@ static ChiakiErrorCode http_ps4_session_wakeup(Session *session)
     if(!(ptr == (host_url_starter + strlen(host_url_starter))))
         strcpy(host_url, ptr);
 
-    curl_easy_cleanup(curl);
+    chiaki_http_client_release(session->http, curl);
     free(response_data.data);
     response_data.data = malloc(0);
     response_data.size = 0;
@@ -1446,7 +1680,7 @@ static ChiakiErrorCode http_ps4_session_wakeup(Session *session)
         psn_remote_client_profile.wakeup_protocol_version,
         session->session_id);
 
-    curl = curl_easy_init();
+    curl = chiaki_http_client_acquire(session->http);
     if(!curl)
     {
         CHIAKI_LOGE(session->log, "Curl could not init");
@@ -1454,7 +1688,6 @@ static ChiakiErrorCode http_ps4_session_wakeup(Session *session)
         json_tokener_free(tok);
         return CHIAKI_ERR_MEMORY;
     }
-    curl_apply_platform_tls_defaults(curl);
 
     char host_url_string[134];
     snprintf(host_url_string, sizeof(host_url_string), "Host: %s", host_url);
@@ -1464,7 +1697,6 @@ static ChiakiErrorCode http_ps4_session_wakeup(Session *session)
     headers = curl_slist_append(headers, "Content-Type: application/json; charset=utf-8");
     headers = curl_slist_append(headers, command_user_agent);
 
-    curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     curl_easy_setopt(curl, CURLOPT_URL, url);
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
@@ -1480,7 +1712,7 @@ static ChiakiErrorCode http_ps4_session_wakeup(Session *session)
     if (vita_resolve2)
         curl_easy_setopt(curl, CURLOPT_RESOLVE, vita_resolve2);
 #endif
-    res = curl_easy_perform(curl);
+    res = chiaki_http_client_perform(session->http, curl, session->log, "ps4_wakeup", NULL);
 #if defined(__PSVITA__)
     curl_slist_free_all(vita_resolve2);
 #endif
@@ -1515,7 +1747,7 @@ cleanup_json:
 cleanup_json_tokener:
     json_tokener_free(tok);
 cleanup:
-    curl_easy_cleanup(curl);
+    chiaki_http_client_release(session->http, curl);
     free(response_data.data);
 
     return err;
@@ -1840,49 +2072,8 @@ cleanup:
 
 CHIAKI_EXPORT void chiaki_holepunch_session_fini(Session* session)
 {
-    if(session->ws_open)
-    {
-        ChiakiErrorCode err = deleteSession(session);
-        if(err != CHIAKI_ERR_SUCCESS)
-            CHIAKI_LOGE(session->log, "Couldn't remove our holepunch session gracefully from PlayStation servers.");
-        bool finished = false;
-        Notification *notif = NULL;
-        int notif_query = NOTIFICATION_TYPE_MEMBER_DELETED | NOTIFICATION_TYPE_SESSION_DELETED;
-        while (!finished)
-        {
-            err = wait_for_notification(session, &notif, notif_query, SESSION_DELETION_TIMEOUT_SEC * 1000);
-            if (err == CHIAKI_ERR_TIMEOUT)
-            {
-                CHIAKI_LOGE(session->log, "chiaki_holepunch_session_fini: Timed out waiting for holepunch session deletion notifications.");
-                break;
-            }
-            else if (err != CHIAKI_ERR_SUCCESS)
-            {
-                CHIAKI_LOGE(session->log, "chiaki_holepunch_session_fini: Failed to wait for holepunch session deletion notifications.");
-                break;
-            }
-
-            if (notif->type == NOTIFICATION_TYPE_MEMBER_DELETED || notif->type == NOTIFICATION_TYPE_SESSION_DELETED)
-            {
-                chiaki_mutex_lock(&session->state_mutex);
-                session->state |= SESSION_STATE_DELETED;
-                chiaki_mutex_unlock(&session->state_mutex);
-                log_session_state(session);
-                CHIAKI_LOGI(session->log, "chiaki_holepunch_session_fini: Holepunch session deleted.");
-                finished = true;
-            }
-            else
-            {
-                CHIAKI_LOGE(session->log, "chiaki_holepunch_session_fini: Got unexpected notification of type %d", notif->type);
-                err = CHIAKI_ERR_UNKNOWN;
-                break;
-            }
-            clear_notification(session, notif);
-        }
-        session->ws_thread_should_stop = true;
-        chiaki_stop_pipe_stop(&session->select_pipe);
-        chiaki_thread_join(&session->ws_thread, NULL);
-    }
+    session_delete_remote(session);
+    session_ws_close(session);
     if(session->gw.data)
     {
 #if CHIAKI_CAN_USE_MINIUPNPC
@@ -1910,14 +2101,13 @@ CHIAKI_EXPORT void chiaki_holepunch_session_fini(Session* session)
         free(session->session_id_header);
     if (session->online_id)
         free(session->online_id);
-    if (session->curl_share)
-        curl_share_cleanup(session->curl_share);
     if (session->ws_fqdn)
         free(session->ws_fqdn);
     if (session->ws_notification_queue)
     {
         chiaki_mutex_lock(&session->notif_mutex);
-        notification_queue_free(session->ws_notification_queue);
+        chiaki_notification_queue_free(session->ws_notification_queue);
+        session->ws_notification_queue = NULL;
         chiaki_mutex_unlock(&session->notif_mutex);
     }
     if(session->our_offer_msg)
@@ -1955,14 +2145,13 @@ CHIAKI_EXPORT void chiaki_holepunch_session_discard(Session* session)
         free(session->session_id_header);
     if(session->online_id)
         free(session->online_id);
-    if(session->curl_share)
-        curl_share_cleanup(session->curl_share);
     if(session->ws_fqdn)
         free(session->ws_fqdn);
     if(session->ws_notification_queue)
     {
         chiaki_mutex_lock(&session->notif_mutex);
-        notification_queue_free(session->ws_notification_queue);
+        chiaki_notification_queue_free(session->ws_notification_queue);
+        session->ws_notification_queue = NULL;
         chiaki_mutex_unlock(&session->notif_mutex);
     }
     if(session->our_offer_msg)
@@ -1996,14 +2185,6 @@ CHIAKI_EXPORT void chiaki_holepunch_main_thread_cancel(Session *session, bool st
     chiaki_cond_signal(&session->state_cond);
 }
 
-void notification_queue_free(NotificationQueue *nq)
-{
-    while(nq->front != NULL)
-    {
-        dequeueNq(nq);
-    }
-}
-
 static ChiakiErrorCode make_oauth2_header(char** out, const char* token)
 {
     size_t oauth_header_len = sizeof(oauth_header_fmt) + strlen(token) + 1;
@@ -2040,17 +2221,15 @@ static ChiakiErrorCode get_websocket_fqdn(Session *session, char **fqdn)
         .size = 0,
     };
 
-    CURL *curl = curl_easy_init();
+    CURL *curl = chiaki_http_client_acquire(session->http);
     if(!curl)
     {
         CHIAKI_LOGE(session->log, "Curl could not init");
         return CHIAKI_ERR_MEMORY;
     }
-    curl_apply_platform_tls_defaults(curl);
     struct curl_slist *headers = NULL;
     headers = curl_slist_append(headers, session->oauth_header);
 
-    curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     curl_easy_setopt(curl, CURLOPT_URL, ws_fqdn_api_url);
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
@@ -2063,7 +2242,7 @@ static ChiakiErrorCode get_websocket_fqdn(Session *session, char **fqdn)
     if (vita_resolve)
         curl_easy_setopt(curl, CURLOPT_RESOLVE, vita_resolve);
 #endif
-    CURLcode res = curl_easy_perform(curl);
+    CURLcode res = chiaki_http_client_perform(session->http, curl, session->log, "websocket_fqdn", NULL);
 #if defined(__PSVITA__)
     curl_slist_free_all(vita_resolve);
 #endif
@@ -2084,39 +2263,41 @@ static ChiakiErrorCode get_websocket_fqdn(Session *session, char **fqdn)
         goto cleanup;
     }
 
-    json_tokener *tok = json_tokener_new();
-    if(!tok)
-    {
-        CHIAKI_LOGE(session->log, "Couldn't create new json tokener");
-        goto cleanup;
-    }
-    json_object *json = json_tokener_parse_ex(tok, response_data.data, response_data.size);
-    if (json == NULL)
+    static const char *const fqdn_path[] = { "fqdn" };
+    ChiakiJsonValue fqdn_json;
+    if (chiaki_json_scan(response_data.data, response_data.size, fqdn_path, &fqdn_json, 1) != CHIAKI_ERR_SUCCESS)
     {
         CHIAKI_LOGE(session->log, "get_websocket_fqdn: Parsing JSON failed");
         err = CHIAKI_ERR_UNKNOWN;
-        goto cleanup_json_tokener;
+        goto cleanup;
     }
-    json_object *fqdn_json;
-    if (!json_object_object_get_ex(json, "fqdn", &fqdn_json))
+    if (fqdn_json.type == CHIAKI_JSON_TYPE_NONE)
     {
         CHIAKI_LOGE(session->log, "get_websocket_fqdn: JSON does not contain \"fqdn\" field");
         err = CHIAKI_ERR_UNKNOWN;
-        goto cleanup_json;
-    } else if (!json_object_is_type(fqdn_json, json_type_string))
+        goto cleanup;
+    } else if (fqdn_json.type != CHIAKI_JSON_TYPE_STRING)
     {
         CHIAKI_LOGE(session->log, "get_websocket_fqdn: JSON \"fqdn\" field is not a string");
         err = CHIAKI_ERR_UNKNOWN;
-        goto cleanup_json;
+        goto cleanup;
+    }
+    *fqdn = malloc(fqdn_json.len + 1);
+    if (!*fqdn)
+    {
+        err = CHIAKI_ERR_MEMORY;
+        goto cleanup;
+    }
+    if (chiaki_json_unescape(&fqdn_json, *fqdn, fqdn_json.len + 1, NULL) != CHIAKI_ERR_SUCCESS)
+    {
+        CHIAKI_LOGE(session->log, "get_websocket_fqdn: JSON \"fqdn\" field is not a valid string");
+        free(*fqdn);
+        *fqdn = NULL;
+        err = CHIAKI_ERR_UNKNOWN;
     }
-    *fqdn = strdup(json_object_get_string(fqdn_json));
 
-cleanup_json:
-    json_object_put(json);
-cleanup_json_tokener:
-    json_tokener_free(tok);
 cleanup:
-    curl_easy_cleanup(curl);
+    chiaki_http_client_release(session->http, curl);
     free(response_data.data);
     return err;
 }
@@ -2329,7 +2510,7 @@ static void* websocket_thread_func(void *user) {
         CHIAKI_LOGE(session->log, "Curl could not init");
         goto fail_before_curl;
     }
-    curl_apply_platform_tls_defaults(curl);
+    chiaki_http_client_attach(session->http, curl);
     struct curl_slist *headers = NULL;
     {
         struct curl_slist *tmp = curl_slist_append(headers, session->oauth_header);
@@ -2358,7 +2539,6 @@ static void* websocket_thread_func(void *user) {
                      psn_remote_client_profile.reconnection);
 
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     curl_easy_setopt(curl, CURLOPT_URL, ws_url);
     curl_easy_setopt(curl, CURLOPT_CONNECT_ONLY, 2L);
@@ -2444,20 +2624,10 @@ cleanup_headers:
     uint64_t now = 0;
     uint64_t last_ping_sent = 0;
 
-    json_tokener *tok = json_tokener_new();
-    if(!tok)
-    {
-        CHIAKI_LOGE(session->log, "Couldn't create new json tokener");
-        goto cleanup;
-    }
-
     const struct curl_ws_frame *meta;
     char *buf = malloc(WEBSOCKET_MAX_FRAME_SIZE);
     if(!buf)
-    {
-        json_tokener_free(tok);
         goto cleanup;
-    }
     size_t rlen;
     size_t wlen;
     bool expecting_pong = false;
@@ -2535,25 +2705,24 @@ cleanup_headers:
         if (meta->flags & CURLWS_TEXT || meta->flags & CURLWS_BINARY)
         {
             CHIAKI_LOGV(session->log, "websocket_thread_func: Received WebSocket frame with %d bytes of payload.", rlen);
-            json_object *json = json_tokener_parse_ex(tok, buf, rlen);
-            if (json == NULL)
+            Notification *notif = NULL;
+            err = chiaki_notification_new(buf, rlen, &notif);
+            if (err == CHIAKI_ERR_MEMORY)
+                goto cleanup_json;
+            if (err != CHIAKI_ERR_SUCCESS)
             {
                 CHIAKI_LOGE(session->log, "websocket_thread_func: Parsing JSON from payload failed");
                 CHIAKI_LOGV(session->log, "websocket_thread_func: Payload was:\n%s", buf);
                 continue;
             }
-            CHIAKI_LOGV(session->log, json_object_to_json_string_ext(json, JSON_C_TO_STRING_PRETTY));
-
-            NotificationType type = parse_notification_type(session->log, json);
-            char *json_buf = malloc(rlen);
-            if(!json_buf)
-                goto cleanup_json;
-            memcpy(json_buf, buf, rlen);
-            size_t json_buf_size = rlen;
-            CHIAKI_LOGV(session->log, "Received notification of type %d", type);
-            Notification *notif = newNotification(type, json, json_buf, json_buf_size);
-            if(!notif)
-                goto cleanup_json;
+            CHIAKI_LOGV(session->log, "%s", notif->json_buf);
+            if (notif->type == NOTIFICATION_TYPE_UNKNOWN)
+            {
+                CHIAKI_LOGW(session->log, "websocket_thread_func: Ignoring notification of unknown type");
+                chiaki_notification_free(notif);
+                continue;
+            }
+            CHIAKI_LOGV(session->log, "Received notification of type %s", chiaki_notification_type_name(notif->type));
 
             // Automatically ACK OFFER session messages if we're not currently explicitly
             // waiting on offers
@@ -2566,36 +2735,32 @@ cleanup_headers:
                  // At this point all offers were received and we don't care for new ones anymore
                 || session->state & SESSION_STATE_DATA_OFFER_RECEIVED;
             chiaki_mutex_unlock(&session->state_mutex);
-            if (should_ack_offers && notif->type == NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED)
+            if (should_ack_offers && notif->type == NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED
+                && notif->msg_action == SESSION_MESSAGE_ACTION_OFFER)
             {
-                SessionMessage *msg = NULL;
-                json_object *payload = session_message_get_payload(session->log, json);
-                err = session_message_parse(session->log, payload, &msg);
-                json_object_put(payload);
-                if (err != CHIAKI_ERR_SUCCESS)
-                {
-                    CHIAKI_LOGE(session->log, "websocket_thread_func: Failed to parse session message for ACKing.");
-                    continue;
-                }
-                if (msg->action == SESSION_MESSAGE_ACTION_OFFER)
+                // action and reqId were already pulled out, no need to parse the whole offer
+                if (notif->msg_req_id < 0)
+                    CHIAKI_LOGE(session->log, "websocket_thread_func: Session message to ACK has no request ID.");
+                else
                 {
                     SessionMessage ack_msg = {
                         .action = SESSION_MESSAGE_ACTION_RESULT,
-                        .req_id = msg->req_id,
+                        .req_id = (uint16_t)notif->msg_req_id,
                         .error = 0,
                         .conn_request = NULL,
                         .notification = NULL,
                     };
                     http_send_session_message(session, &ack_msg, true);
                 }
-                session_message_free(msg);
             }
             ChiakiErrorCode mutex_err = chiaki_mutex_lock(&session->notif_mutex);
             assert(mutex_err == CHIAKI_ERR_SUCCESS);
-            enqueueNq(session->ws_notification_queue, notif);
+            // notif belongs to the queue once pushed
+            NotificationType type = notif->type;
+            chiaki_notification_queue_push(session->ws_notification_queue, notif);
             chiaki_cond_signal(&session->notif_cond);
             chiaki_mutex_unlock(&session->notif_mutex);
-            if (notif->type == NOTIFICATION_TYPE_SESSION_DELETED)
+            if (type == NOTIFICATION_TYPE_SESSION_DELETED)
             {
                 CHIAKI_LOGI(session->log, "websocket_thread_func: Holepunch session was deleted on PSN server, exiting....");
                 goto cleanup_json;
@@ -2604,7 +2769,6 @@ cleanup_headers:
     }
 
 cleanup_json:
-    json_tokener_free(tok);
     free(buf);
 cleanup:
     curl_easy_cleanup(curl);
@@ -2630,57 +2794,16 @@ fail_before_curl:
         }
         session->ws_connect_err = CHIAKI_ERR_UNKNOWN;
         session->state |= SESSION_STATE_WS_FAILED;
-        log_session_state(session);
-        ChiakiErrorCode signal_err = chiaki_cond_signal(&session->state_cond);
-        if (signal_err != CHIAKI_ERR_SUCCESS) {
-            CHIAKI_LOGE(session->log, "fail_before_curl: chiaki_cond_signal failed (%d); caller may hang", signal_err);
-        }
-        ChiakiErrorCode unlock_err = chiaki_mutex_unlock(&session->state_mutex);
-        if (unlock_err != CHIAKI_ERR_SUCCESS) {
-            CHIAKI_LOGE(session->log, "fail_before_curl: chiaki_mutex_unlock failed (%d)", unlock_err);
-        }
-        return NULL;
-    }
-}
-
-static NotificationType parse_notification_type(
-    ChiakiLog *log, json_object* json
-) {
-    json_object* datatype;
-    if (!json_object_object_get_ex(json, "dataType", &datatype))
-    {
-        CHIAKI_LOGE(log, "parse_notification_type: JSON does not contain \"datatype\" field\n");
-        return NOTIFICATION_TYPE_UNKNOWN;
-    } else if (!json_object_is_type(datatype, json_type_string))
-    {
-        CHIAKI_LOGE(log, "parse_notification_type: JSON \"datatype\" field is not a string\n");
-        return NOTIFICATION_TYPE_UNKNOWN;
-    }
-    const char* datatype_str = json_object_get_string(datatype);
-
-    if (strcmp(datatype_str, "psn:sessionManager:sys:remotePlaySession:created") == 0)
-    {
-        return NOTIFICATION_TYPE_SESSION_CREATED;
-    } else if (strcmp(datatype_str, "psn:sessionManager:sys:rps:members:created") == 0)
-    {
-        return NOTIFICATION_TYPE_MEMBER_CREATED;
-    } else if (strcmp(datatype_str, "psn:sessionManager:sys:rps:customData1:updated") == 0)
-    {
-        return NOTIFICATION_TYPE_CUSTOM_DATA1_UPDATED;
-    } else if (strcmp(datatype_str, "psn:sessionManager:sys:rps:sessionMessage:created") == 0)
-    {
-        return NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED;
-    } else if (strcmp(datatype_str, "psn:sessionManager:sys:rps:members:deleted") == 0)
-    {
-        return NOTIFICATION_TYPE_MEMBER_DELETED;
-    } else if (strcmp(datatype_str, "psn:sessionManager:sys:remotePlaySession:deleted") == 0)
-    {
-        return NOTIFICATION_TYPE_SESSION_DELETED;
-    }else
-    {
-        CHIAKI_LOGW(log, "parse_notification_type: Unknown notification type \"%s\"", datatype_str);
-        CHIAKI_LOGV(log, "parse_notification_type: JSON was:\n%s", json_object_to_json_string_ext(json, JSON_C_TO_STRING_PRETTY));
-        return NOTIFICATION_TYPE_UNKNOWN;
+        log_session_state(session);
+        ChiakiErrorCode signal_err = chiaki_cond_signal(&session->state_cond);
+        if (signal_err != CHIAKI_ERR_SUCCESS) {
+            CHIAKI_LOGE(session->log, "fail_before_curl: chiaki_cond_signal failed (%d); caller may hang", signal_err);
+        }
+        ChiakiErrorCode unlock_err = chiaki_mutex_unlock(&session->state_mutex);
+        if (unlock_err != CHIAKI_ERR_SUCCESS) {
+            CHIAKI_LOGE(session->log, "fail_before_curl: chiaki_mutex_unlock failed (%d)", unlock_err);
+        }
+        return NULL;
     }
 }
 
@@ -2800,7 +2923,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_holepunch_session_create_offer(Session *ses
         .action = SESSION_MESSAGE_ACTION_OFFER,
         .req_id = our_offer_msg_req_id,
         .error = 0,
-        .conn_request = malloc(sizeof(ConnectionRequest)),
+        .conn_request = calloc(1, sizeof(ConnectionRequest)),
         .notification = NULL,
     };
     if(!msg.conn_request)
@@ -3101,7 +3224,15 @@ cleanup:
         if(!session->our_offer_msg)
             err = CHIAKI_ERR_MEMORY;
         else
+        {
             memcpy(session->our_offer_msg, &msg, sizeof(SessionMessage));
+            // The candidates don't change until the offer is sent, so serialize them now
+            // instead of between receiving the console's offer and answering it.
+            // If this fails they are serialized when sending.
+            ConnectionRequest *req = session->our_offer_msg->conn_request;
+            if(session_candidates_serialize(session, req, &req->candidates_json, &req->candidates_json_len) != CHIAKI_ERR_SUCCESS)
+                req->candidates_json = NULL;
+        }
     }
     else if(msg.conn_request)
     {
@@ -3198,7 +3329,7 @@ static ChiakiErrorCode send_offer(Session *session, int req_id, Candidate *local
         .action = SESSION_MESSAGE_ACTION_OFFER,
         .req_id = req_id,
         .error = 0,
-        .conn_request = malloc(sizeof(ConnectionRequest)),
+        .conn_request = calloc(1, sizeof(ConnectionRequest)),
         .notification = NULL,
     };
 
@@ -3640,18 +3771,16 @@ static ChiakiErrorCode http_create_session(Session *session)
         .size = 0,
     };
 
-    CURL* curl = curl_easy_init();
+    CURL *curl = chiaki_http_client_acquire(session->http);
     if(!curl)
     {
         CHIAKI_LOGE(session->log, "Curl could not init");
         return CHIAKI_ERR_MEMORY;
     }
-    curl_apply_platform_tls_defaults(curl);
     struct curl_slist *headers = NULL;
     headers = curl_slist_append(headers, session->oauth_header);
     headers = curl_slist_append(headers, "Content-Type: application/json; charset=utf-8");
 
-    curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     curl_easy_setopt(curl, CURLOPT_URL, session_create_url);
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
@@ -3666,7 +3795,7 @@ static ChiakiErrorCode http_create_session(Session *session)
     if (vita_resolve)
         curl_easy_setopt(curl, CURLOPT_RESOLVE, vita_resolve);
 #endif
-    CURLcode res = curl_easy_perform(curl);
+    CURLcode res = chiaki_http_client_perform(session->http, curl, session->log, "create_session", NULL);
 #if defined(__PSVITA__)
     curl_slist_free_all(vita_resolve);
 #endif
@@ -3686,60 +3815,60 @@ static ChiakiErrorCode http_create_session(Session *session)
         goto cleanup;
     }
 
-    json_tokener *tok = json_tokener_new();
-    if(!tok)
-    {
-        CHIAKI_LOGE(session->log, "Couldn't create new json tokener");
-        goto cleanup;
-    }
     CHIAKI_LOGV(session->log, "http_create_session: Received JSON:\n%s", response_data.data);
-    json_object *json = json_tokener_parse_ex(tok, response_data.data, response_data.size);
-    if (json == NULL)
+    static const char *const paths[] = {
+        "remotePlaySessions.0.sessionId",
+        "remotePlaySessions.0.members.0.accountId"
+    };
+    ChiakiJsonValue values[2];
+    if (chiaki_json_scan(response_data.data, response_data.size, paths, values, 2) != CHIAKI_ERR_SUCCESS)
     {
         CHIAKI_LOGE(session->log, "http_create_session: Parsing JSON failed");
         err = CHIAKI_ERR_UNKNOWN;
-        goto cleanup_json_tokener;
+        goto cleanup;
     }
+    const ChiakiJsonValue *session_id_json = &values[0];
+    const ChiakiJsonValue *account_id_json = &values[1];
 
-    json_object* session_id_json;
-    json_pointer_get(json, "/remotePlaySessions/0/sessionId", &session_id_json);
-    json_object* account_id_json;
-    json_pointer_get(json, "/remotePlaySessions/0/members/0/accountId", &account_id_json);
-
+    int64_t account_id = 0;
     bool schema_bad =
-        session_id_json == NULL
-        || !json_object_is_type(session_id_json, json_type_string)
-        || account_id_json == NULL
-        || (!json_object_is_type(account_id_json, json_type_string)
-            && !json_object_is_type(account_id_json, json_type_int));
+        session_id_json->type != CHIAKI_JSON_TYPE_STRING
+        || (account_id_json->type != CHIAKI_JSON_TYPE_STRING
+            && account_id_json->type != CHIAKI_JSON_TYPE_NUMBER);
+    if (!schema_bad && account_id_json->type == CHIAKI_JSON_TYPE_NUMBER)
+        schema_bad = chiaki_json_value_int64(account_id_json, &account_id) != CHIAKI_ERR_SUCCESS;
     if (schema_bad)
     {
         CHIAKI_LOGE(session->log, "http_create_session: Unexpected JSON schema, could not parse sessionId and accountId.");
-        CHIAKI_LOGV(session->log, json_object_to_json_string_ext(json, JSON_C_TO_STRING_PRETTY));
         err = CHIAKI_ERR_UNKNOWN;
-        goto cleanup_json;
+        goto cleanup;
     }
-    const char* session_id = json_object_get_string(session_id_json);
-    if (strlen(session_id) != 36)
+    if (account_id_json->type == CHIAKI_JSON_TYPE_STRING)
     {
-        CHIAKI_LOGE(session->log, "http_create_session: Unexpected JSON schema, sessionId is not a UUIDv4, was '%s'.", session_id);
-        CHIAKI_LOGV(session->log, json_object_to_json_string_ext(json, JSON_C_TO_STRING_PRETTY));
+        // Account ids are usually sent as decimal strings
+        char account_id_str[24];
+        if (chiaki_json_unescape(account_id_json, account_id_str, sizeof(account_id_str), NULL) == CHIAKI_ERR_SUCCESS)
+            account_id = strtoll(account_id_str, NULL, 10);
+    }
+    char session_id[37];
+    size_t session_id_len = 0;
+    if (chiaki_json_unescape(session_id_json, session_id, sizeof(session_id), &session_id_len) != CHIAKI_ERR_SUCCESS
+        || session_id_len != 36)
+    {
+        CHIAKI_LOGE(session->log, "http_create_session: Unexpected JSON schema, sessionId is not a UUIDv4, was '%.*s'.",
+            (int)session_id_json->len, session_id_json->ptr);
         err = CHIAKI_ERR_UNKNOWN;
-        goto cleanup_json;
+        goto cleanup;
     }
-    memcpy(session->session_id, json_object_get_string(session_id_json), 36);
+    memcpy(session->session_id, session_id, 36);
     make_session_id_header(&session->session_id_header, session->session_id);
 
-    session->account_id = json_object_get_int64(account_id_json);
+    session->account_id = account_id;
 
-cleanup_json:
-    json_object_put(json);
-cleanup_json_tokener:
-    json_tokener_free(tok);
 cleanup:
     free(session_create_json);
     free(response_data.data);
-    curl_easy_cleanup(curl);
+    chiaki_http_client_release(session->http, curl);
 
     return err;
 }
@@ -3751,19 +3880,17 @@ static ChiakiErrorCode http_check_session(Session *session, bool viewurl)
         .size = 0,
     };
 
-    CURL* curl = curl_easy_init();
+    CURL *curl = chiaki_http_client_acquire(session->http);
     if(!curl)
     {
         free(response_data.data);
         CHIAKI_LOGE(session->log, "Curl could not init");
         return CHIAKI_ERR_MEMORY;
     }
-    curl_apply_platform_tls_defaults(curl);
     struct curl_slist *headers = NULL;
     headers = curl_slist_append(headers, session->oauth_header);
     headers = curl_slist_append(headers, session->session_id_header);
 
-    curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     curl_easy_setopt(curl, CURLOPT_URL, viewurl ? session_view_url : session_create_url);
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
@@ -3778,7 +3905,7 @@ static ChiakiErrorCode http_check_session(Session *session, bool viewurl)
     if (vita_resolve)
         curl_easy_setopt(curl, CURLOPT_RESOLVE, vita_resolve);
 #endif
-    CURLcode res = curl_easy_perform(curl);
+    CURLcode res = chiaki_http_client_perform(session->http, curl, session->log, "check_session", NULL);
 #if defined(__PSVITA__)
     curl_slist_free_all(vita_resolve);
 #endif
@@ -3819,7 +3946,7 @@ cleanup_json_tokener:
     json_tokener_free(tok);
 cleanup:
     free(response_data.data);
-    curl_easy_cleanup(curl);
+    chiaki_http_client_release(session->http, curl);
     return err;
 }
 
@@ -3860,13 +3987,12 @@ static ChiakiErrorCode http_start_session(Session *session)
         .size = 0,
     };
 
-    CURL *curl = curl_easy_init();
+    CURL *curl = chiaki_http_client_acquire(session->http);
     if(!curl)
     {
         CHIAKI_LOGE(session->log, "Curl could not init");
         return CHIAKI_ERR_MEMORY;
     }
-    curl_apply_platform_tls_defaults(curl);
 
     struct curl_slist *headers = NULL;
     headers = curl_slist_append(headers, session->oauth_header);
@@ -3875,7 +4001,6 @@ static ChiakiErrorCode http_start_session(Session *session)
              psn_remote_client_profile.command_user_agent);
     headers = curl_slist_append(headers, command_user_agent);
 
-    curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     curl_easy_setopt(curl, CURLOPT_URL, session_command_url);
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
@@ -3892,7 +4017,7 @@ static ChiakiErrorCode http_start_session(Session *session)
     if (vita_resolve)
         curl_easy_setopt(curl, CURLOPT_RESOLVE, vita_resolve);
 #endif
-    CURLcode res = curl_easy_perform(curl);
+    CURLcode res = chiaki_http_client_perform(session->http, curl, session->log, "start_session", NULL);
 #if defined(__PSVITA__)
     curl_slist_free_all(vita_resolve);
 #endif
@@ -3921,7 +4046,7 @@ static ChiakiErrorCode http_start_session(Session *session)
     chiaki_mutex_unlock(&session->state_mutex);
 
 cleanup:
-    curl_easy_cleanup(curl);
+    chiaki_http_client_release(session->http, curl);
     free(response_data.data);
 
     return err;
@@ -3952,29 +4077,35 @@ static ChiakiErrorCode http_send_session_message(Session *session, SessionMessag
     char *payload_str = NULL;
     size_t payload_len = 0;
     if(short_msg)
-        short_message_serialize(session, message, &payload_str, &payload_len);
+        err = short_message_serialize(session, message, &payload_str, &payload_len);
     else
-        session_message_serialize(session, message, &payload_str, &payload_len);
+        err = session_message_serialize(session, message, &payload_str, &payload_len);
+    if(err != CHIAKI_ERR_SUCCESS)
+    {
+        CHIAKI_LOGE(session->log, "http_send_session_message: Serializing session message failed: %s", chiaki_error_string(err));
+        free(response_data.data);
+        return err;
+    }
     char msg_buf[sizeof(session_message_envelope_fmt) * 2 + payload_len];
     snprintf(
         msg_buf, sizeof(msg_buf), session_message_envelope_fmt,
         payload_str, session->account_id, console_uid_str,
         session->console_type == CHIAKI_HOLEPUNCH_CONSOLE_TYPE_PS4 ? "PS4" : "PS5"
     );
+    free(payload_str);
     CHIAKI_LOGV(session->log, "Message to send: %s", msg_buf);
-    CURL *curl = curl_easy_init();
+    CURL *curl = chiaki_http_client_acquire(session->http);
     if(!curl)
     {
         CHIAKI_LOGE(session->log, "Curl could not init");
+        free(response_data.data);
         return CHIAKI_ERR_MEMORY;
     }
-    curl_apply_platform_tls_defaults(curl);
 
     struct curl_slist *headers = NULL;
     headers = curl_slist_append(headers, session->oauth_header);
     headers = curl_slist_append(headers, "Content-Type: application/json; charset=utf-8");
 
-    curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     curl_easy_setopt(curl, CURLOPT_URL, url);
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
@@ -3988,7 +4119,7 @@ static ChiakiErrorCode http_send_session_message(Session *session, SessionMessag
     if (vita_resolve)
         curl_easy_setopt(curl, CURLOPT_RESOLVE, vita_resolve);
 #endif
-    CURLcode res = curl_easy_perform(curl);
+    CURLcode res = chiaki_http_client_perform(session->http, curl, session->log, "session_message", NULL);
 #if defined(__PSVITA__)
     curl_slist_free_all(vita_resolve);
 #endif
@@ -4010,7 +4141,8 @@ static ChiakiErrorCode http_send_session_message(Session *session, SessionMessag
     }
 
 cleanup:
-    curl_easy_cleanup(curl);
+    chiaki_http_client_release(session->http, curl);
+    free(response_data.data);
     return err;
 }
 
@@ -4032,19 +4164,17 @@ static ChiakiErrorCode deleteSession(Session *session)
     char url[128] = {0};
     snprintf(url, sizeof(url), delete_messsage_url_fmt, session->session_id);
 
-    CURL *curl = curl_easy_init();
+    CURL *curl = chiaki_http_client_acquire(session->http);
     if(!curl)
     {
         CHIAKI_LOGE(session->log, "Curl could not init");
         return CHIAKI_ERR_MEMORY;
     }
-    curl_apply_platform_tls_defaults(curl);
 
     struct curl_slist *headers = NULL;
     headers = curl_slist_append(headers, session->oauth_header);
     headers = curl_slist_append(headers, "Content-Type: application/json; charset=utf-8");
 
-    curl_easy_setopt(curl, CURLOPT_SHARE, session->curl_share);
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     curl_easy_setopt(curl, CURLOPT_URL, url);
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
@@ -4058,7 +4188,7 @@ static ChiakiErrorCode deleteSession(Session *session)
     if (vita_resolve)
         curl_easy_setopt(curl, CURLOPT_RESOLVE, vita_resolve);
 #endif
-    CURLcode res = curl_easy_perform(curl);
+    CURLcode res = chiaki_http_client_perform(session->http, curl, session->log, "delete_session", NULL);
 #if defined(__PSVITA__)
     curl_slist_free_all(vita_resolve);
 #endif
@@ -4079,7 +4209,7 @@ static ChiakiErrorCode deleteSession(Session *session)
     }
 
 cleanup:
-    curl_easy_cleanup(curl);
+    chiaki_http_client_release(session->http, curl);
     return err;
 
 }
@@ -5296,52 +5426,29 @@ static ChiakiErrorCode decode_customdata1(const char *customdata1, uint8_t *out,
  * Get the SessionMessage json from the payload field of the message that arrivved over the websocket
  *
  * @param[in] log Pointer to a ChiakiLog object for logging
- * @param session_message The payload field json that is transformed into the session message json via parsing
+ * @param notif The session message notification, its payload was already decoded when it arrived
 */
 
-static json_object* session_message_get_payload(ChiakiLog *log, json_object *session_message)
+static json_object* session_message_get_payload(ChiakiLog *log, Notification *notif)
 {
-    json_object *payload_json;
-    if (json_pointer_get(session_message, "/body/data/sessionMessage/payload", &payload_json) < 0)
-    {
-        CHIAKI_LOGE(log, "session_message_get_payload: Failed to get payload");
-        CHIAKI_LOGV(log, json_object_to_json_string_ext(session_message, JSON_C_TO_STRING_PRETTY));
-        return NULL;
-    }
-
-    if (!json_object_is_type(payload_json, json_type_string))
+    if (!notif->msg_body)
     {
-        CHIAKI_LOGE(log, "session_message_get_payload: Payload is not a string");
-        CHIAKI_LOGV(log, json_object_to_json_string_ext(session_message, JSON_C_TO_STRING_PRETTY));
-        return NULL;
-    }
-
-    const char* payload_str = json_object_get_string(payload_json);
-
-    char* body = strstr(payload_str, "body=");
-    if (body == NULL) {
         CHIAKI_LOGE(log, "session_message_get_payload: Failed to find body of payload");
-        CHIAKI_LOGV(log, payload_str);
+        CHIAKI_LOGV(log, "%s", notif->json_buf);
         return NULL;
     }
 
-
-    char *json = body + 5;
+    const char *json = notif->msg_body;
     // The JSON for a session message is kind of peculiar, as it's sometimes invalid JSON.
     // This happens when there is no value for the `localPeerAddr` field. Instead of the value
     // being `undefined` or the empty object, the field simply doesn't have a value, i.e. the
     // colon is immediately followed by a comma. This obviously breaks our parser, so we fix
     // the JSON if the field value is missing.
     json_object *message_json;
-    char *peeraddr_key = "\"localPeerAddr\":";
-    char *peeraddr_start = strstr(json, peeraddr_key);
+    const char *peeraddr_key = "\"localPeerAddr\":";
+    const char *peeraddr_start = strstr(json, peeraddr_key);
 
-    // No localPeerAddr, nothing to fix
-    if (peeraddr_start == NULL)
-        return json_tokener_parse(json);
-
-    char *peeraddr_end = peeraddr_start + strlen(peeraddr_key);
-    if (*peeraddr_end == '{')
+    if (peeraddr_start == NULL || peeraddr_start[strlen(peeraddr_key)] == '{')
     {
         // Valid JSON, we can parse without modifications
         message_json = json_tokener_parse(json);
@@ -5349,28 +5456,26 @@ static json_object* session_message_get_payload(ChiakiLog *log, json_object *ses
     else
     {
         // Insert empty object as key for localPeerAddr key
+        const char *peeraddr_end = peeraddr_start + strlen(peeraddr_key);
         size_t prefix_len = peeraddr_end - json;
-        size_t suffix_len = strlen(peeraddr_end);
-        char fixed_json[strlen(json) + 3]; // {} + \0
-        memset(fixed_json, 0, sizeof(fixed_json));
-        strncpy(fixed_json, json, prefix_len);
+        size_t suffix_len = notif->msg_body_len - prefix_len;
+        char *fixed_json = malloc(notif->msg_body_len + 3); // {} + \0
+        if (!fixed_json)
+            return NULL;
+        memcpy(fixed_json, json, prefix_len);
         fixed_json[prefix_len] = '{';
         fixed_json[prefix_len + 1] = '}';
-        strncpy(fixed_json + prefix_len + 2, peeraddr_end, suffix_len);
+        memcpy(fixed_json + prefix_len + 2, peeraddr_end, suffix_len);
+        fixed_json[prefix_len + 2 + suffix_len] = '\0';
 
         message_json = json_tokener_parse(fixed_json);
         if(message_json == NULL)
-        {
             CHIAKI_LOGE(log, "Couldn't parse the following fixed json: %s", fixed_json);
-            CHIAKI_LOGE(log, json_object_to_json_string_ext(payload_json, JSON_C_TO_STRING_PRETTY));
-        }
+        free(fixed_json);
+        return message_json;
     }
-        // check if parse fails
-        if(message_json == NULL)
-        {
-            CHIAKI_LOGE(log, "Couldn't parse the following json: %s", json);
-            CHIAKI_LOGE(log, json_object_to_json_string_ext(payload_json, JSON_C_TO_STRING_PRETTY));
-        }
+    if(message_json == NULL)
+        CHIAKI_LOGE(log, "Couldn't parse the following json: %s", json);
 
     return message_json;
 }
@@ -5396,8 +5501,12 @@ static json_object* session_message_get_payload(ChiakiLog *log, json_object *ses
 /**
  * Wait for notification to arrive
  *
+ * The notification stays queued until it is cleared with clear_notification(). Only the fronts
+ * of the channels for the requested types are looked at, so notifications of other types don't
+ * cost anything.
+ *
  * @param[in] session Pointer to the session context
- * @param[out] out The new Notification object that's been created from the arrived json over the websocket
+ * @param[out] out The oldest queued notification of one of the requested types
  * @param[in] types The types of notifications to look for (ORed together if multiple)
  * @param[in] timeout_ms The amount of time to wait before timing out
 */
@@ -5405,74 +5514,49 @@ static ChiakiErrorCode wait_for_notification(
     Session *session, Notification** out,
     uint16_t types, uint64_t timeout_ms)
 {
-    uint64_t waiting_since = chiaki_time_now_monotonic_us();
-    uint64_t now = waiting_since;
-    Notification *last_known = NULL;
+    uint64_t deadline = chiaki_time_now_monotonic_us() + timeout_ms * MILLISECONDS_US;
 
     ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
     chiaki_mutex_lock(&session->notif_mutex);
-    while (true) {
-        while (session->ws_notification_queue->rear == last_known || session->ws_notification_queue->rear == NULL)
+    while (true)
+    {
+        Notification *notif = chiaki_notification_queue_peek(session->ws_notification_queue, types);
+        if (notif)
         {
-            err = chiaki_cond_timedwait(&session->notif_cond, &session->notif_mutex, timeout_ms);
-            if (err == CHIAKI_ERR_TIMEOUT)
-            {
-                now = chiaki_time_now_monotonic_us();
-                if ((now - waiting_since) > (timeout_ms * MILLISECONDS_US))
-                {
-                    CHIAKI_LOGE(session->log, "wait_for_notification: Timed out waiting for holepunch session messages");
-                    err = CHIAKI_ERR_TIMEOUT;
-                    goto cleanup;
-                }
-            }
-            if(session->main_should_stop)
-            {
-                session->main_should_stop = false;
-                err = CHIAKI_ERR_CANCELED;
-                goto cleanup;
-            }
-            assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_TIMEOUT);
+            CHIAKI_LOGV(session->log, "wait_for_notification: Found notification of type %s", chiaki_notification_type_name(notif->type));
+            *out = notif;
+            err = CHIAKI_ERR_SUCCESS;
+            break;
         }
-        Notification *notif;
-        if(last_known)
-            notif = last_known->next;
-        else
-            notif = session->ws_notification_queue->front;
-        while (notif != NULL && notif != last_known)
+        uint64_t now = chiaki_time_now_monotonic_us();
+        if (now >= deadline)
         {
-            if (notif->type & types)
-            {
-                CHIAKI_LOGV(session->log, "wait_for_notification: Found notification of type %d", notif->type);
-                *out = notif;
-                err = CHIAKI_ERR_SUCCESS;
-                goto cleanup;
-            }
-            last_known = notif;
-            notif = notif->next;
+            CHIAKI_LOGE(session->log, "wait_for_notification: Timed out waiting for holepunch session messages");
+            err = CHIAKI_ERR_TIMEOUT;
+            break;
+        }
+        err = chiaki_cond_timedwait(&session->notif_cond, &session->notif_mutex,
+            (deadline - now + MILLISECONDS_US - 1) / MILLISECONDS_US);
+        if(session->main_should_stop)
+        {
+            session->main_should_stop = false;
+            err = CHIAKI_ERR_CANCELED;
+            break;
         }
+        assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_TIMEOUT);
     }
-
-cleanup:
     chiaki_mutex_unlock(&session->notif_mutex);
     return err;
 }
 
+/**
+ * Remove a handled notification, together with every notification that arrived before it.
+*/
 static ChiakiErrorCode clear_notification(
     Session *session, Notification *notification)
 {
-    bool found = false;
-    NotificationQueue *nq = session->ws_notification_queue;
     chiaki_mutex_lock(&session->notif_mutex);
-    while (nq->rear != NULL)
-    {
-        if(nq->front == notification)
-        {
-            found = true;
-            dequeueNq(nq);
-            break;
-        }
-        dequeueNq(nq);
-    }
+    bool found = chiaki_notification_queue_clear(session->ws_notification_queue, notification);
     chiaki_mutex_unlock(&session->notif_mutex);
     if (found)
         return CHIAKI_ERR_SUCCESS;
@@ -5480,9 +5564,31 @@ static ChiakiErrorCode clear_notification(
         return CHIAKI_ERR_UNKNOWN;
 }
 
+/**
+ * Wait for the next session message notification until deadline (monotonic us).
+*/
+static ChiakiErrorCode wait_for_session_message_notification(
+    Session *session, Notification **out, uint64_t deadline)
+{
+    uint64_t now = chiaki_time_now_monotonic_us();
+    uint64_t timeout_ms = now < deadline ? (deadline - now) / MILLISECONDS_US : 0;
+    ChiakiErrorCode err = wait_for_notification(session, out, NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED, timeout_ms);
+    if (err != CHIAKI_ERR_SUCCESS)
+        return err;
+    if(session->main_should_stop)
+    {
+        session->main_should_stop = false;
+        return CHIAKI_ERR_CANCELED;
+    }
+    return CHIAKI_ERR_SUCCESS;
+}
+
 /**
  * Wait for a SessionMessage to arrive
  *
+ * Messages with other actions are dropped. The action was already pulled out when the message
+ * arrived, so only the message that is returned gets parsed.
+ *
  * @param[in] session Pointer to the session context
  * @param[out] out The new SessionMessage object that's been created from the arrived json over the websocket
  * @param[in] types The types of messages to look for (ORed together if multiple)
@@ -5492,14 +5598,11 @@ static ChiakiErrorCode wait_for_session_message(
     Session *session, SessionMessage** out,
     uint16_t types, uint64_t timeout_ms)
 {
-    ChiakiErrorCode err;
-    bool finished = false;
-    Notification *notif = NULL;
-    SessionMessage *msg = NULL;
-    uint32_t notif_query = NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED;
-    while (!finished)
+    uint64_t deadline = chiaki_time_now_monotonic_us() + timeout_ms * MILLISECONDS_US;
+    while (true)
     {
-        err = wait_for_notification(session, &notif, notif_query, SESSION_START_TIMEOUT_SEC * 1000);
+        Notification *notif = NULL;
+        ChiakiErrorCode err = wait_for_session_message_notification(session, &notif, deadline);
         if (err == CHIAKI_ERR_TIMEOUT)
         {
             CHIAKI_LOGE(session->log, "Timed out waiting for holepunch session message notification.");
@@ -5510,13 +5613,14 @@ static ChiakiErrorCode wait_for_session_message(
             CHIAKI_LOGE(session->log, "Failed to wait for holepunch session message notification.");
             return err;
         }
-        if(session->main_should_stop)
+        if (!(notif->msg_action & types))
         {
-            session->main_should_stop = false;
-            err = CHIAKI_ERR_CANCELED;
-            return err;
+            CHIAKI_LOGV(session->log, "Ignoring holepunch session message with action %d", notif->msg_action);
+            clear_notification(session, notif);
+            continue;
         }
-        json_object *payload = session_message_get_payload(session->log, notif->json);
+        SessionMessage *msg = NULL;
+        json_object *payload = session_message_get_payload(session->log, notif);
         err = session_message_parse(session->log, payload, &msg);
         json_object_put(payload);
         if (err != CHIAKI_ERR_SUCCESS)
@@ -5524,22 +5628,18 @@ static ChiakiErrorCode wait_for_session_message(
             CHIAKI_LOGE(session->log, "Failed to parse holepunch session message");
             return err;
         }
-        if (!(msg->action & types))
-        {
-            CHIAKI_LOGV(session->log, "Ignoring holepunch session message with action %d", msg->action);
-            clear_notification(session, notif);
-            continue;
-        }
-        finished = true;
+        msg->notification = notif;
+        *out = msg;
+        return CHIAKI_ERR_SUCCESS;
     }
-    msg->notification = notif;
-    *out = msg;
-    return CHIAKI_ERR_SUCCESS;
 }
 
 /**
  * Wait for an ack for a SessionMessage
  *
+ * Acks are matched by the request ID pulled out when they arrived, without parsing them. Other
+ * messages and acks for other requests are dropped.
+ *
  * @param[in] session Pointer to the session context
  * @param[in] req_id The request id of the message to be acked (will also be the request id of the ack)
  * @param[in] timeout_ms The amount of time to wait before timing out
@@ -5548,13 +5648,11 @@ static ChiakiErrorCode wait_for_session_message(
 static ChiakiErrorCode wait_for_session_message_ack(
     Session *session, int req_id, uint64_t timeout_ms)
 {
-    ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
-    SessionMessage *msg = NULL;
-    uint32_t msg_query = SESSION_MESSAGE_ACTION_RESULT;
-    bool finished = false;
-    while (!finished)
+    uint64_t deadline = chiaki_time_now_monotonic_us() + timeout_ms * MILLISECONDS_US;
+    while (true)
     {
-        err = wait_for_session_message(session, &msg, msg_query, SESSION_START_TIMEOUT_SEC * 1000);
+        Notification *notif = NULL;
+        ChiakiErrorCode err = wait_for_session_message_notification(session, &notif, deadline);
         if (err == CHIAKI_ERR_TIMEOUT)
         {
             CHIAKI_LOGE(session->log, "wait_for_session_message_ack: Timed out waiting for holepunch session connection offer ACK notification.");
@@ -5565,24 +5663,15 @@ static ChiakiErrorCode wait_for_session_message_ack(
             CHIAKI_LOGE(session->log, "wait_for_session_message_ack: Failed to wait for holepunch session connection offer ACK notification.");
             return err;
         }
-        if(session->main_should_stop)
-        {
-            session->main_should_stop = false;
-            err = CHIAKI_ERR_CANCELED;
-            return err;
-        }
-        if (msg->req_id != req_id)
-        {
-            CHIAKI_LOGE(session->log, "wait_for_session_message_ack: Got ACK for unexpected request ID %d", msg->req_id);
-            continue;
-        }
-        finished = true;
-        chiaki_mutex_lock(&session->notif_mutex);
-        session_message_free(msg);
-        chiaki_mutex_unlock(&session->notif_mutex);
+        bool acked = chiaki_notification_is_ack(notif, req_id);
+        if (!acked && notif->msg_action == SESSION_MESSAGE_ACTION_RESULT)
+            CHIAKI_LOGE(session->log, "wait_for_session_message_ack: Got ACK for unexpected request ID %d", (int)notif->msg_req_id);
+        else if (!acked)
+            CHIAKI_LOGV(session->log, "Ignoring holepunch session message with action %d", notif->msg_action);
+        clear_notification(session, notif);
+        if (acked)
+            return CHIAKI_ERR_SUCCESS;
     }
-
-    return err;
 }
 
 /**
@@ -5819,82 +5908,101 @@ cleanup:
 }
 
 /**
- * Serialize a session message into a array to send over the websocket
+ * Serialize the candidates of a connection request into a JSON array
+ *
+ * Split out of session_message_serialize() so the candidates of our own offer can be
+ * serialized while the offer is prepared, off the critical path of the hole punch.
  *
  * @param[in] session Pointer to the session context
- * @param[in] message Pointer to the session message to serialize
- * @param[out] out Pointer to the the serialized msg array
- * @param[out] out_len Pointer to the sizse of the serialized msg array
+ * @param[in] req Pointer to the connection request
+ * @param[out] out Pointer to the allocated, null-terminated JSON array
+ * @param[out] out_len Pointer to the length of the JSON array, without the null terminator
 */
-static ChiakiErrorCode session_message_serialize(
-    Session *session, SessionMessage *message, char **out, size_t *out_len)
+static ChiakiErrorCode session_candidates_serialize(
+    Session *session, ConnectionRequest *req, char **out, size_t *out_len)
 {
-    ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
-
-    // Since the official remote play app doesn't send valid JSON half the time,
-    // we can't use a proper JSON library to serialize the message. Instead, we
-    // use snprintf to build the JSON string manually.
-    char localpeeraddr_json[128] = {0};
-    size_t localpeeraddr_len = snprintf(
-        localpeeraddr_json, sizeof(localpeeraddr_json), session_localpeeraddr_fmt,
-        session->account_id, psn_remote_client_profile.local_peer_platform);
-
     size_t candidate_str_len = sizeof(session_connrequest_candidate_fmt) * 2;
-    char *candidates_json = calloc(1, candidate_str_len * message->conn_request->num_candidates + 3);
+    char *candidates_json = calloc(1, candidate_str_len * req->num_candidates + 3);
     if(!candidates_json)
         return CHIAKI_ERR_MEMORY;
-    *(candidates_json) = '[';
-    size_t candidates_len = 1;
-    char *candidate_str = calloc(1, candidate_str_len);
-    if(!candidate_str)
+    size_t candidates_len = 0;
+    candidates_json[candidates_len++] = '[';
+    for (size_t i=0; i < req->num_candidates; i++)
     {
-        free(candidates_json);
-        return CHIAKI_ERR_MEMORY;
-    }
-    for (int i=0; i < message->conn_request->num_candidates; i++)
-    {
-        Candidate candidate = message->conn_request->candidates[i];
-        char candidate_type[8] = {0};
-        switch(candidate.type)
+        Candidate *candidate = &req->candidates[i];
+        const char *candidate_type;
+        switch(candidate->type)
         {
             case CANDIDATE_TYPE_LOCAL:
-                strcpy(candidate_type, "LOCAL");
+                candidate_type = "LOCAL";
                 break;
             case CANDIDATE_TYPE_STATIC:
-                strcpy(candidate_type, "STATIC");
+                candidate_type = "STATIC";
                 break;
             case CANDIDATE_TYPE_STUN:
-                strcpy(candidate_type, "STUN");
+                candidate_type = "STUN";
                 break;
             case CANDIDATE_TYPE_DERIVED:
-                strcpy(candidate_type, "DERIVED");
+                candidate_type = "DERIVED";
                 break;
             default:
-                CHIAKI_LOGE(session->log, "Undefined candidate type %d", candidate.type);
+                CHIAKI_LOGE(session->log, "Undefined candidate type %d", candidate->type);
+                free(candidates_json);
                 return CHIAKI_ERR_INVALID_DATA;
         }
-        memset(candidate_str, 0, candidate_str_len);
-        size_t candidate_len = snprintf(
-            candidate_str, candidate_str_len, session_connrequest_candidate_fmt,
-            candidate_type, candidate.addr, candidate.addr_mapped, candidate.port,
-            candidate.port_mapped);
-        snprintf(candidates_json + candidates_len, candidate_len, "%s", candidate_str);
-        // Take into account that char arrays are null-terminated
-        if(i < (message->conn_request->num_candidates - 1))
-        {
-            *(candidates_json + candidates_len + candidate_len - 1) = '}';
-            *(candidates_json + candidates_len + candidate_len) = ',';
-            candidates_len += candidate_len + 1;
-        }
-        else
+        if(i > 0)
+            candidates_json[candidates_len++] = ',';
+        int candidate_len = snprintf(
+            candidates_json + candidates_len, candidate_str_len, session_connrequest_candidate_fmt,
+            candidate_type, candidate->addr, candidate->addr_mapped, candidate->port,
+            candidate->port_mapped);
+        if(candidate_len < 0 || (size_t)candidate_len >= candidate_str_len)
         {
-            *(candidates_json + candidates_len + candidate_len - 1) = '}';
-            candidates_len += candidate_len;
+            free(candidates_json);
+            return CHIAKI_ERR_BUF_TOO_SMALL;
         }
+        candidates_len += candidate_len;
+    }
+    candidates_json[candidates_len++] = ']';
+    candidates_json[candidates_len] = '\0';
+
+    *out = candidates_json;
+    *out_len = candidates_len;
+    return CHIAKI_ERR_SUCCESS;
+}
+
+/**
+ * Serialize a session message into a array to send over the websocket
+ *
+ * @param[in] session Pointer to the session context
+ * @param[in] message Pointer to the session message to serialize
+ * @param[out] out Pointer to the the serialized msg array
+ * @param[out] out_len Pointer to the sizse of the serialized msg array
+*/
+static ChiakiErrorCode session_message_serialize(
+    Session *session, SessionMessage *message, char **out, size_t *out_len)
+{
+    ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+
+    // Since the official remote play app doesn't send valid JSON half the time,
+    // we can't use a proper JSON library to serialize the message. Instead, we
+    // use snprintf to build the JSON string manually.
+    char localpeeraddr_json[128] = {0};
+    size_t localpeeraddr_len = snprintf(
+        localpeeraddr_json, sizeof(localpeeraddr_json), session_localpeeraddr_fmt,
+        session->account_id, psn_remote_client_profile.local_peer_platform);
+
+    char *candidates_json = message->conn_request->candidates_json;
+    size_t candidates_len = message->conn_request->candidates_json_len + 1;
+    char *candidates_json_owned = NULL;
+    if(!candidates_json)
+    {
+        err = session_candidates_serialize(session, message->conn_request, &candidates_json_owned, &candidates_len);
+        if(err != CHIAKI_ERR_SUCCESS)
+            return err;
+        candidates_json = candidates_json_owned;
+        candidates_len++;
     }
-    *(candidates_json + candidates_len) = ']';
-    *(candidates_json + candidates_len + 1) = '\0';
-    candidates_len += 2;
 
     char localhashedid_str[29] = {0};
     uint8_t zero_bytes0[sizeof(message->conn_request->local_hashed_id)] = {0};
@@ -5914,8 +6022,7 @@ static ChiakiErrorCode session_message_serialize(
         1, connreq_json_len);
     if(!connreq_json)
     {
-        free(candidates_json);
-        free(candidate_str);
+        free(candidates_json_owned);
         return CHIAKI_ERR_MEMORY;
     }
     char mac_addr[1] = { '\0' };
@@ -5960,8 +6067,7 @@ static ChiakiErrorCode session_message_serialize(
     *out_len = msg_len;
 
 cleanup:
-    free(candidate_str);
-    free(candidates_json);
+    free(candidates_json_owned);
     free(connreq_json);
 
     return err;
@@ -6032,6 +6138,7 @@ static ChiakiErrorCode session_message_free(SessionMessage *message)
     {
         if (message->conn_request->candidates != NULL)
             free(message->conn_request->candidates);
+        free(message->conn_request->candidates_json);
         free(message->conn_request);
     }
     message->notification = NULL;
@@ -6058,13 +6165,12 @@ static ChiakiErrorCode get_stun_servers(Session *session)
 #endif
     ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
     const char STUN_HOSTS_URL[] = "https://raw.githubusercontent.com/pradt2/always-online-stun/master/valid_hosts.txt";
-    CURL *curl = curl_easy_init();
+    CURL *curl = chiaki_http_client_acquire(session->http);
     if(!curl)
     {
         CHIAKI_LOGE(session->log, "Curl could not init");
         return CHIAKI_ERR_MEMORY;
     }
-    curl_apply_platform_tls_defaults(curl);
 
     HttpResponseData response_data = {
         .data = malloc(0),
@@ -6077,7 +6183,7 @@ static ChiakiErrorCode get_stun_servers(Session *session)
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
 
-    CURLcode res = curl_easy_perform(curl);
+    CURLcode res = chiaki_http_client_perform(session->http, curl, session->log, "stun_servers", NULL);
     if (res != CURLE_OK)
     {
         if (res == CURLE_HTTP_RETURNED_ERROR)
@@ -6147,16 +6253,15 @@ static ChiakiErrorCode get_stun_servers(Session *session)
     free(response_data.data);
     response_data.data = malloc(0);
     response_data.size = 0;
-    curl_easy_cleanup(curl);
+    chiaki_http_client_release(session->http, curl);
     curl = NULL;
     const char STUN_HOSTS_URL_IPV6[] = "https://raw.githubusercontent.com/pradt2/always-online-stun/master/valid_ipv6s.txt";
-    curl = curl_easy_init();
+    curl = chiaki_http_client_acquire(session->http);
     if(!curl)
     {
         CHIAKI_LOGE(session->log, "Curl could not init");
         return CHIAKI_ERR_MEMORY;
     }
-    curl_apply_platform_tls_defaults(curl);
 
     curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, 2L);
@@ -6164,7 +6269,7 @@ static ChiakiErrorCode get_stun_servers(Session *session)
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_write_cb);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&response_data);
 
-    res = curl_easy_perform(curl);
+    res = chiaki_http_client_perform(session->http, curl, session->log, "stun_servers_ipv6", NULL);
     if (res != CURLE_OK)
     {
         if (res == CURLE_HTTP_RETURNED_ERROR)
@@ -6231,7 +6336,7 @@ static ChiakiErrorCode get_stun_servers(Session *session)
 
 cleanup:
     free(response_data.data);
-    curl_easy_cleanup(curl);
+    chiaki_http_client_release(session->http, curl);
     return err;
 }
 
@@ -6308,86 +6413,6 @@ static void print_candidate(ChiakiLog *log, Candidate *candidate)
     CHIAKI_LOGV(log, "Mapped Port: %u", candidate->port_mapped);
 }
 
-/**
- * Create a notification queue for holding notifications for a session.
- *
- * @return nq Pointer to a NotificationQueue to be used for the session.
-*/
-
-static NotificationQueue *createNq()
-{
-    NotificationQueue *nq = (NotificationQueue*)malloc(sizeof(NotificationQueue));
-    if(!nq)
-        return NULL;
-    nq->front = nq->rear = NULL;
-    return nq;
-}
-
-/**
- * Delete a notification from the queue
- *
- * @param nq the notification queue to dequeue from
-*/
-
-static void dequeueNq(NotificationQueue *nq)
-{
-    if(nq->front == NULL)
-        return;
-
-    Notification *notif = nq->front;
-
-    nq->front = nq->front->next;
-
-    if(nq->front == NULL)
-        nq->rear = NULL;
-
-    json_object_put(notif->json);
-    notif->json = NULL;
-    free(notif->json_buf);
-    notif->json_buf = NULL;
-    free(notif);
-}
-
-/**
- * Adds a notification to the queue.
- *
- * @param nq Notification queue to add to
- * @param[in] notif Notification to add to the queue
-*/
-
-static void enqueueNq(NotificationQueue *nq, Notification*notif)
-{
-    if(nq->rear == NULL)
-    {
-        nq->front = nq->rear = notif;
-        return;
-    }
-    nq->rear->next = notif;
-    nq->rear = notif;
-}
-
-/**
- * Creates a notification
- *
- * @param[in] type The type of notification
- * @param[in] json The pointer to the json object of the notification
- * @param[in] json_buf A pointer to the char representation of the json
- * @param[in] json_buf_size The length of the char representation of the json
- * @return notif Created notification
-*/
-static Notification* newNotification(NotificationType type, json_object *json, char* json_buf, size_t json_buf_size)
-{
-    Notification *notif = (Notification *)malloc(sizeof(Notification));
-    if(!notif)
-        return NULL;
-    notif->type = type;
-    notif->json = json;
-    notif->json_buf = json_buf;
-    notif->json_buf_size = json_buf_size;
-    notif->next = NULL;
-    return notif;
-}
-
 /**
  * Removes a substring from a string
  *
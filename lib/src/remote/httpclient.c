@@ -0,0 +1,297 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/common.h>
+
+#if CHIAKI_CAN_USE_HOLEPUNCH
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#endif
+
+#include <chiaki/thread.h>
+
+#include "httpclient.h"
+
+#define HTTP_CLIENT_DNS_CACHE_TIMEOUT_SEC 300L
+#define HTTP_CLIENT_KEEPIDLE_SEC 30L
+#define HTTP_CLIENT_KEEPINTVL_SEC 15L
+
+#if defined(__PSVITA__)
+#define VITA_PSN_CA_BUNDLE_PATH "app0:/assets/psn-ca-bundle.pem"
+#endif
+
+// CURLINFO_*_TIME_T in microseconds
+#define HTTP_CLIENT_HAS_TIME_T (LIBCURL_VERSION_NUM >= 0x073d00)
+
+struct chiaki_http_client_t
+{
+    CURLSH *share;
+    ChiakiMutex share_locks[CURL_LOCK_DATA_LAST];
+    bool http2;
+
+    ChiakiMutex mutex;
+    CURL *idle[CHIAKI_HTTP_CLIENT_POOL_SIZE];
+    size_t idle_count;
+    ChiakiHttpClientStats stats;
+};
+
+static ChiakiHttpClient *shared_client;
+
+static void share_lock_cb(CURL *curl, curl_lock_data data, curl_lock_access access, void *user)
+{
+    (void)curl;
+    (void)access;
+    ChiakiHttpClient *client = user;
+    if((unsigned)data >= CURL_LOCK_DATA_LAST)
+        return;
+    chiaki_mutex_lock(&client->share_locks[data]);
+}
+
+static void share_unlock_cb(CURL *curl, curl_lock_data data, void *user)
+{
+    (void)curl;
+    ChiakiHttpClient *client = user;
+    if((unsigned)data >= CURL_LOCK_DATA_LAST)
+        return;
+    chiaki_mutex_unlock(&client->share_locks[data]);
+}
+
+ChiakiHttpClient *chiaki_http_client_new(void)
+{
+    ChiakiHttpClient *client = calloc(1, sizeof(ChiakiHttpClient));
+    if(!client)
+        return NULL;
+
+    size_t locks_init = 0;
+    for(; locks_init < CURL_LOCK_DATA_LAST; locks_init++)
+    {
+        if(chiaki_mutex_init(&client->share_locks[locks_init], false) != CHIAKI_ERR_SUCCESS)
+            goto error_locks;
+    }
+    if(chiaki_mutex_init(&client->mutex, false) != CHIAKI_ERR_SUCCESS)
+        goto error_locks;
+
+    client->share = curl_share_init();
+    if(!client->share)
+        goto error_mutex;
+    curl_share_setopt(client->share, CURLSHOPT_LOCKFUNC, share_lock_cb);
+    curl_share_setopt(client->share, CURLSHOPT_UNLOCKFUNC, share_unlock_cb);
+    curl_share_setopt(client->share, CURLSHOPT_USERDATA, client);
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(client->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    // Not CURL_LOCK_DATA_CONNECT: libcurl doesn't support a connection cache shared between
+    // threads, and the websocket, the signalling stages and device listing run at once. Each
+    // pooled handle keeps its own connections alive between the requests it performs.
+
+#ifdef CURL_VERSION_HTTP2
+    curl_version_info_data *info = curl_version_info(CURLVERSION_NOW);
+    client->http2 = info && (info->features & CURL_VERSION_HTTP2);
+#endif
+    return client;
+
+error_mutex:
+    chiaki_mutex_fini(&client->mutex);
+error_locks:
+    while(locks_init > 0)
+        chiaki_mutex_fini(&client->share_locks[--locks_init]);
+    free(client);
+    return NULL;
+}
+
+void chiaki_http_client_free(ChiakiHttpClient *client)
+{
+    if(!client)
+        return;
+    // easy handles must go before the share they are attached to
+    for(size_t i = 0; i < client->idle_count; i++)
+        curl_easy_cleanup(client->idle[i]);
+    curl_share_cleanup(client->share);
+    chiaki_mutex_fini(&client->mutex);
+    for(size_t i = 0; i < CURL_LOCK_DATA_LAST; i++)
+        chiaki_mutex_fini(&client->share_locks[i]);
+    free(client);
+}
+
+ChiakiHttpClient *chiaki_http_client_shared(void)
+{
+#if defined(_MSC_VER)
+    ChiakiHttpClient *client = InterlockedCompareExchangePointer((PVOID volatile *)&shared_client, NULL, NULL);
+#else
+    ChiakiHttpClient *client = __atomic_load_n(&shared_client, __ATOMIC_ACQUIRE);
+#endif
+    if(client)
+        return client;
+
+    client = chiaki_http_client_new();
+    if(!client)
+        return NULL;
+
+    // Two threads may race to create it, the loser frees its copy
+#if defined(_MSC_VER)
+    ChiakiHttpClient *existing = InterlockedCompareExchangePointer((PVOID volatile *)&shared_client, client, NULL);
+#else
+    ChiakiHttpClient *existing = NULL;
+    __atomic_compare_exchange_n(&shared_client, &existing, client, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#endif
+    if(existing)
+    {
+        chiaki_http_client_free(client);
+        return existing;
+    }
+    return client;
+}
+
+void chiaki_http_client_attach(ChiakiHttpClient *client, CURL *curl)
+{
+    curl_easy_setopt(curl, CURLOPT_SHARE, client->share);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+#if defined(__PSVITA__)
+    curl_easy_setopt(curl, CURLOPT_CAINFO, VITA_PSN_CA_BUNDLE_PATH);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
+#endif
+}
+
+CURL *chiaki_http_client_acquire(ChiakiHttpClient *client)
+{
+    CURL *curl = NULL;
+    chiaki_mutex_lock(&client->mutex);
+    if(client->idle_count > 0)
+        curl = client->idle[--client->idle_count];
+    chiaki_mutex_unlock(&client->mutex);
+
+    if(curl)
+        curl_easy_reset(curl);
+    else
+    {
+        curl = curl_easy_init();
+        if(!curl)
+            return NULL;
+    }
+
+    chiaki_http_client_attach(client, curl);
+    curl_easy_setopt(curl, CURLOPT_TCP_NODELAY, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, HTTP_CLIENT_KEEPIDLE_SEC);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, HTTP_CLIENT_KEEPINTVL_SEC);
+    curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, HTTP_CLIENT_DNS_CACHE_TIMEOUT_SEC);
+    if(client->http2)
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    return curl;
+}
+
+void chiaki_http_client_release(ChiakiHttpClient *client, CURL *curl)
+{
+    if(!curl)
+        return;
+    chiaki_mutex_lock(&client->mutex);
+    if(client->idle_count < CHIAKI_HTTP_CLIENT_POOL_SIZE)
+    {
+        client->idle[client->idle_count++] = curl;
+        curl = NULL;
+    }
+    chiaki_mutex_unlock(&client->mutex);
+    if(curl)
+        curl_easy_cleanup(curl);
+}
+
+static uint64_t info_time_us(CURL *curl, CURLINFO info_t, CURLINFO info_double)
+{
+#if HTTP_CLIENT_HAS_TIME_T
+    (void)info_double;
+    curl_off_t us = 0;
+    if(curl_easy_getinfo(curl, info_t, &us) != CURLE_OK || us < 0)
+        return 0;
+    return (uint64_t)us;
+#else
+    (void)info_t;
+    double s = 0.0;
+    if(curl_easy_getinfo(curl, info_double, &s) != CURLE_OK || s < 0.0)
+        return 0;
+    return (uint64_t)(s * 1e6);
+#endif
+}
+
+#if HTTP_CLIENT_HAS_TIME_T
+#define INFO_TIME_US(curl, name) info_time_us(curl, CURLINFO_##name##_T, CURLINFO_##name)
+#else
+#define INFO_TIME_US(curl, name) info_time_us(curl, (CURLINFO)0, CURLINFO_##name)
+#endif
+
+static uint64_t time_delta(uint64_t end, uint64_t start)
+{
+    return end > start ? end - start : 0;
+}
+
+CURLcode chiaki_http_client_perform(ChiakiHttpClient *client, CURL *curl, ChiakiLog *log,
+    const char *tag, ChiakiHttpTiming *timing)
+{
+    CURLcode res = curl_easy_perform(curl);
+
+    // All CURLINFO times are cumulative from the start of the transfer
+    uint64_t namelookup = INFO_TIME_US(curl, NAMELOOKUP_TIME);
+    uint64_t connect = INFO_TIME_US(curl, CONNECT_TIME);
+    uint64_t appconnect = INFO_TIME_US(curl, APPCONNECT_TIME);
+    uint64_t pretransfer = INFO_TIME_US(curl, PRETRANSFER_TIME);
+    uint64_t starttransfer = INFO_TIME_US(curl, STARTTRANSFER_TIME);
+    long connects = 0;
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+
+    ChiakiHttpTiming t;
+    memset(&t, 0, sizeof(t));
+    t.reused = res == CURLE_OK && connects == 0;
+    if(!t.reused)
+    {
+        t.dns_us = namelookup;
+        t.connect_us = time_delta(connect, namelookup);
+        t.tls_us = appconnect ? time_delta(appconnect, connect) : 0;
+    }
+    t.ttfb_us = starttransfer ? time_delta(starttransfer, pretransfer) : 0;
+    t.total_us = INFO_TIME_US(curl, TOTAL_TIME);
+    curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &t.http_version);
+    if(timing)
+        *timing = t;
+
+    bool http2 = false;
+#ifdef CURL_HTTP_VERSION_2_0
+    http2 = t.http_version == CURL_HTTP_VERSION_2_0;
+#endif
+
+    chiaki_mutex_lock(&client->mutex);
+    client->stats.requests++;
+    if(res != CURLE_OK)
+        client->stats.failures++;
+    if(t.reused)
+        client->stats.reused++;
+    if(http2)
+        client->stats.http2++;
+    client->stats.dns_us += t.dns_us;
+    client->stats.connect_us += t.connect_us;
+    client->stats.tls_us += t.tls_us;
+    client->stats.ttfb_us += t.ttfb_us;
+    client->stats.total_us += t.total_us;
+    chiaki_mutex_unlock(&client->mutex);
+
+    if(log)
+        CHIAKI_LOGV(log, "HTTP %s: %s, %s, dns %.1f ms, connect %.1f ms, tls %.1f ms, ttfb %.1f ms, total %.1f ms",
+            tag ? tag : "request",
+            t.reused ? "reused" : "new connection",
+            http2 ? "HTTP/2" : "HTTP/1.1",
+            t.dns_us / 1000.0, t.connect_us / 1000.0, t.tls_us / 1000.0,
+            t.ttfb_us / 1000.0, t.total_us / 1000.0);
+    return res;
+}
+
+void chiaki_http_client_stats(ChiakiHttpClient *client, ChiakiHttpClientStats *stats)
+{
+    chiaki_mutex_lock(&client->mutex);
+    *stats = client->stats;
+    chiaki_mutex_unlock(&client->mutex);
+}
+
+#endif
@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Pooled HTTPS client for the PSN REST endpoints
+ * ----------------------------------------------
+ *
+ * A remote connect issues a burst of small requests against two or three PSN hosts
+ * (serveraddr, session create/start/check, session messages, delete). Doing a fresh
+ * curl_easy_init() for each of them paid DNS, TCP and a full TLS handshake every time.
+ *
+ * ChiakiHttpClient keeps a curl share handle that shares the DNS cache and TLS sessions
+ * between all of its easy handles, plus a small pool of idle easy handles, each keeping its own
+ * connections alive for the next request. Requests acquire a handle with the common defaults
+ * already applied (platform TLS settings, TCP keep-alive, HTTP/2 over TLS when libcurl supports
+ * it), perform it through chiaki_http_client_perform() to get a DNS/connect/TLS/TTFB breakdown
+ * and release it back afterwards.
+ *
+ * All functions are thread-safe. The connection cache is not shared, libcurl does not support
+ * that across threads.
+ */
+
+#ifndef CHIAKI_HTTPCLIENT_H
+#define CHIAKI_HTTPCLIENT_H
+
+#include <chiaki/common.h>
+#include <chiaki/log.h>
+
+#include <curl/curl.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_HTTP_CLIENT_POOL_SIZE 4
+
+typedef struct chiaki_http_client_t ChiakiHttpClient;
+
+/**
+ * Where the time of one request went, in microseconds.
+ * On a reused connection dns_us, connect_us and tls_us are 0.
+ */
+typedef struct chiaki_http_timing_t
+{
+    uint64_t dns_us;
+    uint64_t connect_us; // TCP handshake, after DNS
+    uint64_t tls_us; // TLS handshake, after TCP
+    uint64_t ttfb_us; // request sent until the first response byte
+    uint64_t total_us;
+    long http_version; // CURL_HTTP_VERSION_*
+    bool reused; // no new connection was opened
+} ChiakiHttpTiming;
+
+typedef struct chiaki_http_client_stats_t
+{
+    uint64_t requests;
+    uint64_t failures;
+    uint64_t reused;
+    uint64_t http2;
+    // Sums over all requests, divide by requests for the mean
+    uint64_t dns_us;
+    uint64_t connect_us;
+    uint64_t tls_us;
+    uint64_t ttfb_us;
+    uint64_t total_us;
+} ChiakiHttpClientStats;
+
+ChiakiHttpClient *chiaki_http_client_new(void);
+void chiaki_http_client_free(ChiakiHttpClient *client);
+
+/**
+ * The process-wide client used by holepunch sessions and the device list.
+ * Created on first use and kept until exit, so connections opened while listing
+ * devices are still warm when the session is set up.
+ *
+ * @return the client or NULL if it could not be allocated
+ */
+ChiakiHttpClient *chiaki_http_client_shared(void);
+
+/**
+ * Take an easy handle from the pool, or create one if it is empty.
+ * The handle is reset and has the share and the client defaults applied.
+ * Callers set their request options on top and must not change CURLOPT_SHARE.
+ *
+ * @return the handle or NULL on allocation failure
+ */
+CURL *chiaki_http_client_acquire(ChiakiHttpClient *client);
+
+/**
+ * Return a handle taken with chiaki_http_client_acquire().
+ * Pointers the caller passed as options (headers, write data) may be freed afterwards.
+ */
+void chiaki_http_client_release(ChiakiHttpClient *client, CURL *curl);
+
+/**
+ * Attach a handle that is not from the pool (e.g. a long lived websocket) to the share,
+ * so it resolves and resumes TLS sessions through the same caches.
+ */
+void chiaki_http_client_attach(ChiakiHttpClient *client, CURL *curl);
+
+/**
+ * curl_easy_perform() plus timing collection.
+ * The breakdown is logged verbosely under tag and added to the client stats.
+ *
+ * @param timing optional, filled with the breakdown of this request
+ */
+CURLcode chiaki_http_client_perform(ChiakiHttpClient *client, CURL *curl, ChiakiLog *log,
+    const char *tag, ChiakiHttpTiming *timing);
+
+void chiaki_http_client_stats(ChiakiHttpClient *client, ChiakiHttpClientStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_HTTPCLIENT_H
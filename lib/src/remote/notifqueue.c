@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/jsonscan.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "notifqueue.h"
+
+static const struct
+{
+    NotificationType type;
+    const char *data_type;
+    const char *name;
+} notification_types[] = {
+    { NOTIFICATION_TYPE_SESSION_CREATED, "psn:sessionManager:sys:remotePlaySession:created", "session_created" },
+    { NOTIFICATION_TYPE_MEMBER_CREATED, "psn:sessionManager:sys:rps:members:created", "member_created" },
+    { NOTIFICATION_TYPE_MEMBER_DELETED, "psn:sessionManager:sys:rps:members:deleted", "member_deleted" },
+    { NOTIFICATION_TYPE_CUSTOM_DATA1_UPDATED, "psn:sessionManager:sys:rps:customData1:updated", "custom_data1_updated" },
+    { NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED, "psn:sessionManager:sys:rps:sessionMessage:created", "session_message_created" },
+    { NOTIFICATION_TYPE_SESSION_DELETED, "psn:sessionManager:sys:remotePlaySession:deleted", "session_deleted" },
+};
+
+#define NOTIFICATION_TYPES_COUNT (sizeof(notification_types) / sizeof(notification_types[0]))
+
+const char *chiaki_notification_type_name(NotificationType type)
+{
+    for(size_t i = 0; i < NOTIFICATION_TYPES_COUNT; i++)
+    {
+        if(notification_types[i].type == type)
+            return notification_types[i].name;
+    }
+    return "unknown";
+}
+
+static size_t notification_channel(NotificationType type)
+{
+    size_t channel = 0;
+    while(!(type & (1u << channel)))
+        channel++;
+    return channel;
+}
+
+/**
+ * Pull action and reqId out of a session message. The payload string looks like
+ * "ver=1.0, type=text, body={...}" and is decoded into the space after the frame.
+ */
+static void notification_scan_session_message(Notification *notif, const ChiakiJsonValue *payload)
+{
+    char *decoded = notif->json_buf + notif->json_buf_size + 1;
+    size_t decoded_len;
+    if(chiaki_json_unescape(payload, decoded, payload->len + 1, &decoded_len) != CHIAKI_ERR_SUCCESS)
+        return;
+    char *body = strstr(decoded, "body=");
+    if(!body)
+        return;
+    notif->msg_body = body + 5;
+    notif->msg_body_len = decoded_len - (notif->msg_body - decoded);
+
+    static const char *const paths[] = { "action", "reqId" };
+    ChiakiJsonValue values[2];
+    if(chiaki_json_scan(notif->msg_body, notif->msg_body_len, paths, values, 2) != CHIAKI_ERR_SUCCESS)
+        return;
+    if(chiaki_json_value_streq(&values[0], "OFFER"))
+        notif->msg_action = SESSION_MESSAGE_ACTION_OFFER;
+    else if(chiaki_json_value_streq(&values[0], "RESULT"))
+        notif->msg_action = SESSION_MESSAGE_ACTION_RESULT;
+    else if(chiaki_json_value_streq(&values[0], "ACCEPT"))
+        notif->msg_action = SESSION_MESSAGE_ACTION_ACCEPT;
+    else if(chiaki_json_value_streq(&values[0], "TERMINATE"))
+        notif->msg_action = SESSION_MESSAGE_ACTION_TERMINATE;
+    int64_t req_id;
+    if(chiaki_json_value_int64(&values[1], &req_id) == CHIAKI_ERR_SUCCESS && req_id >= 0 && req_id <= INT32_MAX)
+        notif->msg_req_id = (int32_t)req_id;
+}
+
+ChiakiErrorCode chiaki_notification_new(const char *buf, size_t len, Notification **out)
+{
+    // dataType usually comes first, so this stops right after it
+    static const char *const data_type_path[] = { "dataType" };
+    ChiakiJsonValue data_type;
+    ChiakiErrorCode err = chiaki_json_scan(buf, len, data_type_path, &data_type, 1);
+    if(err != CHIAKI_ERR_SUCCESS)
+        return err;
+    if(data_type.type != CHIAKI_JSON_TYPE_STRING)
+        return CHIAKI_ERR_INVALID_DATA;
+
+    NotificationType type = NOTIFICATION_TYPE_UNKNOWN;
+    for(size_t i = 0; i < NOTIFICATION_TYPES_COUNT; i++)
+    {
+        if(chiaki_json_value_streq(&data_type, notification_types[i].data_type))
+        {
+            type = notification_types[i].type;
+            break;
+        }
+    }
+
+    ChiakiJsonValue payload = { 0 };
+    if(type == NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED)
+    {
+        static const char *const payload_path[] = { "body.data.sessionMessage.payload" };
+        err = chiaki_json_scan(buf, len, payload_path, &payload, 1);
+        if(err != CHIAKI_ERR_SUCCESS)
+            return err;
+    }
+
+    // Room for the decoded payload, which is never longer than the escaped one
+    bool session_message = payload.type == CHIAKI_JSON_TYPE_STRING;
+    size_t extra = session_message ? payload.len + 1 : 0;
+    Notification *notif = malloc(sizeof(Notification) + len + 1 + extra);
+    if(!notif)
+        return CHIAKI_ERR_MEMORY;
+    memset(notif, 0, sizeof(Notification));
+    notif->type = type;
+    notif->msg_req_id = -1;
+    notif->json_buf_size = len;
+    memcpy(notif->json_buf, buf, len);
+    notif->json_buf[len] = '\0';
+    if(session_message)
+    {
+        // Re-point the payload into our copy, the caller's buffer may be reused
+        payload.ptr = notif->json_buf + (payload.ptr - buf);
+        notification_scan_session_message(notif, &payload);
+    }
+    *out = notif;
+    return CHIAKI_ERR_SUCCESS;
+}
+
+void chiaki_notification_free(Notification *notif)
+{
+    free(notif);
+}
+
+NotificationQueue *chiaki_notification_queue_new(void)
+{
+    return calloc(1, sizeof(NotificationQueue));
+}
+
+void chiaki_notification_queue_free(NotificationQueue *nq)
+{
+    if(!nq)
+        return;
+    for(size_t i = 0; i < NOTIFICATION_CHANNELS; i++)
+    {
+        Notification *notif = nq->channels[i].front;
+        while(notif)
+        {
+            Notification *next = notif->next;
+            chiaki_notification_free(notif);
+            notif = next;
+        }
+    }
+    free(nq);
+}
+
+void chiaki_notification_queue_push(NotificationQueue *nq, Notification *notif)
+{
+    if(notif->type == NOTIFICATION_TYPE_UNKNOWN)
+    {
+        chiaki_notification_free(notif);
+        return;
+    }
+    NotificationChannel *ch = &nq->channels[notification_channel(notif->type)];
+    notif->next = NULL;
+    notif->seq = nq->next_seq++;
+    if(ch->rear)
+        ch->rear->next = notif;
+    else
+        ch->front = notif;
+    ch->rear = notif;
+    nq->pending |= notif->type;
+}
+
+Notification *chiaki_notification_queue_peek(NotificationQueue *nq, uint32_t types)
+{
+    Notification *oldest = NULL;
+    for(uint32_t bits = nq->pending & types; bits; bits &= bits - 1)
+    {
+        Notification *front = nq->channels[notification_channel(bits)].front;
+        if(!oldest || front->seq < oldest->seq)
+            oldest = front;
+    }
+    return oldest;
+}
+
+static void channel_pop(NotificationQueue *nq, size_t channel)
+{
+    NotificationChannel *ch = &nq->channels[channel];
+    Notification *notif = ch->front;
+    ch->front = notif->next;
+    if(!ch->front)
+    {
+        ch->rear = NULL;
+        nq->pending &= ~(1u << channel);
+    }
+    chiaki_notification_free(notif);
+}
+
+bool chiaki_notification_queue_clear(NotificationQueue *nq, Notification *notif)
+{
+    if(notif->type == NOTIFICATION_TYPE_UNKNOWN)
+        return false;
+    NotificationChannel *ch = &nq->channels[notification_channel(notif->type)];
+    Notification *it = ch->front;
+    while(it && it != notif)
+        it = it->next;
+    if(!it)
+        return false;
+
+    uint64_t seq = notif->seq;
+    for(size_t i = 0; i < NOTIFICATION_CHANNELS; i++)
+    {
+        while(nq->channels[i].front && nq->channels[i].front->seq <= seq)
+            channel_pop(nq, i);
+    }
+    return true;
+}
+
+bool chiaki_notification_is_ack(const Notification *notif, int32_t req_id)
+{
+    return notif->type == NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED
+        && notif->msg_action == SESSION_MESSAGE_ACTION_RESULT
+        && notif->msg_req_id == req_id;
+}
@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Typed queue for PSN push notifications
+ * --------------------------------------
+ *
+ * Every frame on the push notification websocket is one JSON notification. Only a few of its
+ * fields matter to the holepunch state machine: the dataType and, for session messages, the
+ * action and reqId inside the payload string. chiaki_notification_new() pulls those out with
+ * the streaming scanner and keeps the frame in the same allocation, no json-c tree is built.
+ *
+ * The queue keeps one FIFO channel per notification type and a bitmask of non-empty channels,
+ * so looking for the oldest notification of a set of types only compares the channel fronts.
+ * A sequence number keeps the arrival order across channels.
+ *
+ * Not thread-safe, holepunch.c guards it with notif_mutex.
+ */
+
+#ifndef CHIAKI_NOTIFQUEUE_H
+#define CHIAKI_NOTIFQUEUE_H
+
+#include <chiaki/common.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum notification_type_t
+{
+    NOTIFICATION_TYPE_UNKNOWN = 0,
+    // psn:sessionManager:sys:remotePlaySession:created
+    NOTIFICATION_TYPE_SESSION_CREATED = 1 << 0,
+    // psn:sessionManager:sys:rps:members:created
+    NOTIFICATION_TYPE_MEMBER_CREATED = 1 << 1,
+    // psn:sessionManager:sys:rps:members:deleted
+    NOTIFICATION_TYPE_MEMBER_DELETED = 1 << 2,
+    // psn:sessionManager:sys:rps:customData1:updated
+    NOTIFICATION_TYPE_CUSTOM_DATA1_UPDATED = 1 << 3,
+    // psn:sessionManager:sys:rps:sessionMessage:created
+    NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED = 1 << 4,
+    // psn:sessionManager:sys:remotePlaySession:deleted
+    NOTIFICATION_TYPE_SESSION_DELETED = 1 << 5
+} NotificationType;
+
+#define NOTIFICATION_CHANNELS 6
+
+typedef enum session_message_action_t
+{
+    SESSION_MESSAGE_ACTION_UNKNOWN = 0,
+    SESSION_MESSAGE_ACTION_OFFER = 1,
+    SESSION_MESSAGE_ACTION_RESULT = 1 << 2,
+    SESSION_MESSAGE_ACTION_ACCEPT = 1 << 3,
+    SESSION_MESSAGE_ACTION_TERMINATE = 1 << 4,
+} SessionMessageAction;
+
+typedef struct notification_t
+{
+    struct notification_t *next;
+    uint64_t seq; // arrival order, assigned by the queue
+
+    NotificationType type;
+    // Only for NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED
+    SessionMessageAction msg_action;
+    int32_t msg_req_id; // -1 if missing
+    const char *msg_body; // decoded payload after "body=", NULL if there is none
+    size_t msg_body_len;
+
+    size_t json_buf_size;
+    char json_buf[]; // the frame as received, zero-terminated
+} Notification;
+
+typedef struct notification_channel_t
+{
+    Notification *front, *rear;
+} NotificationChannel;
+
+typedef struct notification_queue_t
+{
+    NotificationChannel channels[NOTIFICATION_CHANNELS];
+    uint32_t pending; // NotificationType bits of the non-empty channels
+    uint64_t next_seq;
+} NotificationQueue;
+
+/**
+ * Create a notification from a websocket frame. Frames of an unknown dataType still give a
+ * notification with NOTIFICATION_TYPE_UNKNOWN so the caller can log it.
+ *
+ * @return CHIAKI_ERR_INVALID_DATA if the frame is not JSON with a dataType string
+ */
+ChiakiErrorCode chiaki_notification_new(const char *buf, size_t len, Notification **out);
+void chiaki_notification_free(Notification *notif);
+const char *chiaki_notification_type_name(NotificationType type);
+
+NotificationQueue *chiaki_notification_queue_new(void);
+void chiaki_notification_queue_free(NotificationQueue *nq);
+
+/**
+ * Append notif to the channel of its type and take ownership of it.
+ * Notifications of an unknown type are freed right away.
+ */
+void chiaki_notification_queue_push(NotificationQueue *nq, Notification *notif);
+
+/**
+ * @param types NotificationType bits
+ * @return the oldest queued notification of one of types or NULL, it stays queued
+ */
+Notification *chiaki_notification_queue_peek(NotificationQueue *nq, uint32_t types);
+
+/**
+ * Remove and free notif and every notification that arrived before it, of any type.
+ *
+ * @return false if notif was not queued, nothing is removed then
+ */
+bool chiaki_notification_queue_clear(NotificationQueue *nq, Notification *notif);
+
+/**
+ * @return true if notif is the RESULT session message acknowledging our request req_id
+ */
+bool chiaki_notification_is_ack(const Notification *notif, int32_t req_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_NOTIFQUEUE_H
@@ -54,7 +54,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_rudp_send_buffer_init(ChiakiRudpSendBuffer
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_mutex;
 
-	err = chiaki_thread_create(&send_buffer->thread, rudp_send_buffer_thread_func, send_buffer);
+	err = chiaki_thread_create_role(&send_buffer->thread, CHIAKI_THREAD_ROLE_HOUSEKEEPING, rudp_send_buffer_thread_func, send_buffer);
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_cond;
 
@@ -0,0 +1,322 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/time.h>
+
+#include <string.h>
+
+#include "signalgraph.h"
+
+ChiakiErrorCode chiaki_signal_graph_init(ChiakiSignalGraph *graph, ChiakiLog *log)
+{
+    memset(graph, 0, sizeof(*graph));
+    graph->log = log;
+    ChiakiErrorCode err = chiaki_mutex_init(&graph->mutex, false);
+    if(err != CHIAKI_ERR_SUCCESS)
+        return err;
+    err = chiaki_cond_init(&graph->cond, &graph->mutex);
+    if(err != CHIAKI_ERR_SUCCESS)
+    {
+        chiaki_mutex_fini(&graph->mutex);
+        return err;
+    }
+    return CHIAKI_ERR_SUCCESS;
+}
+
+void chiaki_signal_graph_fini(ChiakiSignalGraph *graph)
+{
+    chiaki_cond_fini(&graph->cond);
+    chiaki_mutex_fini(&graph->mutex);
+}
+
+int chiaki_signal_graph_add(ChiakiSignalGraph *graph, const char *name, ChiakiSignalStageFunc func, void *user, uint32_t deps)
+{
+    size_t index = graph->stages_count;
+    if(index >= CHIAKI_SIGNAL_GRAPH_STAGES_MAX || (deps >> index) != 0)
+        return -1;
+    ChiakiSignalStage *stage = &graph->stages[index];
+    memset(stage, 0, sizeof(*stage));
+    stage->name = name;
+    stage->func = func;
+    stage->user = user;
+    stage->deps = deps;
+    stage->graph = graph;
+    graph->stages_count++;
+    return (int)index;
+}
+
+void chiaki_signal_graph_set_cancel_cb(ChiakiSignalGraph *graph, ChiakiSignalCancelFunc cb, void *user)
+{
+    graph->cancel_cb = cb;
+    graph->cancel_user = user;
+}
+
+void chiaki_signal_graph_set_undo(ChiakiSignalGraph *graph, int stage, ChiakiSignalUndoFunc undo)
+{
+    if(stage >= 0 && (size_t)stage < graph->stages_count)
+        graph->stages[stage].undo = undo;
+}
+
+static uint64_t graph_now_us(ChiakiSignalGraph *graph)
+{
+    return chiaki_time_now_monotonic_us() - graph->start_us;
+}
+
+/**
+ * Record the result of a stage. Returns true if this was the first failure and the graph
+ * should be canceled. Must be called with the mutex held.
+ */
+static bool stage_finish(ChiakiSignalStage *stage, ChiakiErrorCode err)
+{
+    ChiakiSignalGraph *graph = stage->graph;
+    stage->end_us = graph_now_us(graph);
+    stage->err = err;
+    stage->state = err == CHIAKI_ERR_SUCCESS ? CHIAKI_SIGNAL_STAGE_DONE : CHIAKI_SIGNAL_STAGE_FAILED;
+    if(err == CHIAKI_ERR_SUCCESS || graph->canceled)
+        return false;
+    graph->canceled = true;
+    return true;
+}
+
+static void *stage_thread_func(void *user)
+{
+    ChiakiSignalStage *stage = user;
+    ChiakiSignalGraph *graph = stage->graph;
+    ChiakiErrorCode err = stage->func(stage->user);
+
+    chiaki_mutex_lock(&graph->mutex);
+    bool cancel = stage_finish(stage, err);
+    chiaki_mutex_unlock(&graph->mutex);
+    if(cancel && graph->cancel_cb)
+        graph->cancel_cb(graph->cancel_user);
+
+    chiaki_mutex_lock(&graph->mutex);
+    chiaki_cond_broadcast(&graph->cond);
+    chiaki_mutex_unlock(&graph->mutex);
+    return NULL;
+}
+
+typedef enum
+{
+    DEPS_WAITING,
+    DEPS_DONE,
+    DEPS_FAILED
+} DepsStatus;
+
+static DepsStatus stage_deps_status(ChiakiSignalGraph *graph, ChiakiSignalStage *stage)
+{
+    DepsStatus status = DEPS_DONE;
+    for(size_t i = 0; i < graph->stages_count; i++)
+    {
+        if(!(stage->deps & (1u << i)))
+            continue;
+        switch(graph->stages[i].state)
+        {
+            case CHIAKI_SIGNAL_STAGE_DONE:
+                break;
+            case CHIAKI_SIGNAL_STAGE_FAILED:
+            case CHIAKI_SIGNAL_STAGE_SKIPPED:
+                return DEPS_FAILED;
+            default:
+                status = DEPS_WAITING;
+                break;
+        }
+    }
+    return status;
+}
+
+static void mark_critical_path(ChiakiSignalGraph *graph, bool parallel)
+{
+    if(!parallel)
+    {
+        // Every stage that ran had to wait for the one before it
+        for(size_t i = 0; i < graph->stages_count; i++)
+            graph->stages[i].critical = graph->stages[i].state != CHIAKI_SIGNAL_STAGE_SKIPPED;
+        return;
+    }
+
+    // Start at the stage that finished last, then keep following the dependency that
+    // finished last, which is the one the stage had to wait for.
+    ChiakiSignalStage *stage = NULL;
+    for(size_t i = 0; i < graph->stages_count; i++)
+    {
+        ChiakiSignalStage *s = &graph->stages[i];
+        if(s->state == CHIAKI_SIGNAL_STAGE_SKIPPED)
+            continue;
+        if(!stage || s->end_us >= stage->end_us)
+            stage = s;
+    }
+    while(stage)
+    {
+        stage->critical = true;
+        ChiakiSignalStage *pred = NULL;
+        for(size_t i = 0; i < graph->stages_count; i++)
+        {
+            if(!(stage->deps & (1u << i)))
+                continue;
+            ChiakiSignalStage *s = &graph->stages[i];
+            if(!pred || s->end_us > pred->end_us)
+                pred = s;
+        }
+        stage = pred;
+    }
+}
+
+static ChiakiErrorCode run_sequential(ChiakiSignalGraph *graph)
+{
+    for(size_t i = 0; i < graph->stages_count; i++)
+    {
+        ChiakiSignalStage *stage = &graph->stages[i];
+        if(stage_deps_status(graph, stage) != DEPS_DONE)
+        {
+            stage->state = CHIAKI_SIGNAL_STAGE_SKIPPED;
+            stage->start_us = stage->end_us = graph_now_us(graph);
+            continue;
+        }
+        stage->state = CHIAKI_SIGNAL_STAGE_RUNNING;
+        stage->start_us = graph_now_us(graph);
+        ChiakiErrorCode err = stage->func(stage->user);
+        if(stage_finish(stage, err) && graph->cancel_cb)
+            graph->cancel_cb(graph->cancel_user);
+    }
+    return CHIAKI_ERR_SUCCESS;
+}
+
+static ChiakiErrorCode run_parallel(ChiakiSignalGraph *graph)
+{
+    ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+    chiaki_mutex_lock(&graph->mutex);
+    for(;;)
+    {
+        size_t unfinished = 0;
+        for(size_t i = 0; i < graph->stages_count; i++)
+        {
+            ChiakiSignalStage *stage = &graph->stages[i];
+            if(stage->state == CHIAKI_SIGNAL_STAGE_RUNNING)
+            {
+                unfinished++;
+                continue;
+            }
+            if(stage->state != CHIAKI_SIGNAL_STAGE_PENDING)
+                continue;
+            DepsStatus deps = stage_deps_status(graph, stage);
+            if(deps == DEPS_WAITING)
+            {
+                unfinished++;
+                continue;
+            }
+            if(deps == DEPS_FAILED)
+            {
+                stage->state = CHIAKI_SIGNAL_STAGE_SKIPPED;
+                stage->start_us = stage->end_us = graph_now_us(graph);
+                continue;
+            }
+            stage->state = CHIAKI_SIGNAL_STAGE_RUNNING;
+            stage->start_us = graph_now_us(graph);
+            ChiakiErrorCode thread_err = chiaki_thread_create_role(&stage->thread, CHIAKI_THREAD_ROLE_HOUSEKEEPING, stage_thread_func, stage);
+            if(thread_err != CHIAKI_ERR_SUCCESS)
+            {
+                CHIAKI_LOGE(graph->log, "Signal graph: failed to start stage %s", stage->name);
+                bool cancel = stage_finish(stage, thread_err);
+                if(cancel && graph->cancel_cb)
+                {
+                    chiaki_mutex_unlock(&graph->mutex);
+                    graph->cancel_cb(graph->cancel_user);
+                    chiaki_mutex_lock(&graph->mutex);
+                }
+                continue;
+            }
+            stage->thread_started = true;
+            chiaki_thread_set_name(&stage->thread, stage->name);
+            unfinished++;
+        }
+        if(!unfinished)
+            break;
+        err = chiaki_cond_wait(&graph->cond, &graph->mutex);
+        if(err != CHIAKI_ERR_SUCCESS)
+            break;
+    }
+    chiaki_mutex_unlock(&graph->mutex);
+
+    for(size_t i = 0; i < graph->stages_count; i++)
+    {
+        ChiakiSignalStage *stage = &graph->stages[i];
+        if(stage->thread_started)
+        {
+            chiaki_thread_join(&stage->thread, NULL);
+            stage->thread_started = false;
+        }
+    }
+    return err;
+}
+
+ChiakiErrorCode chiaki_signal_graph_run(ChiakiSignalGraph *graph, bool parallel)
+{
+    for(size_t i = 0; i < graph->stages_count; i++)
+    {
+        ChiakiSignalStage *stage = &graph->stages[i];
+        stage->state = CHIAKI_SIGNAL_STAGE_PENDING;
+        stage->err = CHIAKI_ERR_SUCCESS;
+        stage->start_us = stage->end_us = 0;
+        stage->critical = false;
+    }
+    graph->canceled = false;
+    graph->start_us = chiaki_time_now_monotonic_us();
+
+    ChiakiErrorCode err = parallel ? run_parallel(graph) : run_sequential(graph);
+    graph->total_us = graph_now_us(graph);
+    if(err != CHIAKI_ERR_SUCCESS)
+        return err;
+    mark_critical_path(graph, parallel);
+
+    // Report the failure that happened first, later ones are usually its consequence
+    ChiakiSignalStage *failed = NULL;
+    for(size_t i = 0; i < graph->stages_count; i++)
+    {
+        ChiakiSignalStage *stage = &graph->stages[i];
+        if(stage->state == CHIAKI_SIGNAL_STAGE_FAILED && (!failed || stage->end_us < failed->end_us))
+            failed = stage;
+    }
+    return failed ? failed->err : CHIAKI_ERR_SUCCESS;
+}
+
+void chiaki_signal_graph_undo(ChiakiSignalGraph *graph)
+{
+    bool undone[CHIAKI_SIGNAL_GRAPH_STAGES_MAX] = { 0 };
+    for(;;)
+    {
+        // Stages only start once their dependencies ended, ties go to the one added last
+        ChiakiSignalStage *latest = NULL;
+        for(size_t i = 0; i < graph->stages_count; i++)
+        {
+            ChiakiSignalStage *stage = &graph->stages[i];
+            if(undone[i] || stage->state == CHIAKI_SIGNAL_STAGE_PENDING || stage->state == CHIAKI_SIGNAL_STAGE_SKIPPED)
+                continue;
+            if(!latest || stage->start_us >= latest->start_us)
+                latest = stage;
+        }
+        if(!latest)
+            break;
+        undone[latest - graph->stages] = true;
+        if(latest->undo)
+        {
+            CHIAKI_LOGV(graph->log, "Signal graph: undoing %s", latest->name);
+            latest->undo(latest->user);
+        }
+    }
+}
+
+void chiaki_signal_graph_log(ChiakiSignalGraph *graph, ChiakiLogLevel level)
+{
+    static const char *state_names[] = { "pending", "running", "done", "failed", "skipped" };
+    chiaki_log(graph->log, level, "Signal graph: %zu stages in %.1f ms", graph->stages_count, graph->total_us / 1000.0);
+    for(size_t i = 0; i < graph->stages_count; i++)
+    {
+        ChiakiSignalStage *stage = &graph->stages[i];
+        chiaki_log(graph->log, level, "Signal graph: %c %-14s %-7s start %8.1f ms, took %8.1f ms",
+            stage->critical ? '*' : ' ',
+            stage->name,
+            state_names[stage->state],
+            stage->start_us / 1000.0,
+            (stage->end_us - stage->start_us) / 1000.0);
+    }
+}
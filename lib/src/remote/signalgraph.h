@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+/*
+ * Dependency graph scheduler for holepunch signalling
+ * ---------------------------------------------------
+ *
+ * A remote connect is a handful of blocking steps (PSN REST calls, websocket setup, UPnP,
+ * STUN, notification waits). Only some of them depend on each other, so instead of running
+ * them back to back each step is added as a stage with the stages it needs, and
+ * chiaki_signal_graph_run() starts every stage on its own thread as soon as its dependencies
+ * are done. A failing stage skips everything that depends on it and invokes the cancel
+ * callback, so stages that are still running can give up early. After a failed run,
+ * chiaki_signal_graph_undo() reverts every stage that started, including the ones that were
+ * canceled halfway.
+ *
+ * Stage timings are kept relative to the start of the run. Afterwards the critical path,
+ * the chain of stages that determined the total time, is marked and can be logged.
+ */
+
+#ifndef CHIAKI_SIGNALGRAPH_H
+#define CHIAKI_SIGNALGRAPH_H
+
+#include <chiaki/common.h>
+#include <chiaki/log.h>
+#include <chiaki/thread.h>
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHIAKI_SIGNAL_GRAPH_STAGES_MAX 16
+
+typedef ChiakiErrorCode (*ChiakiSignalStageFunc)(void *user);
+typedef void (*ChiakiSignalCancelFunc)(void *user);
+typedef void (*ChiakiSignalUndoFunc)(void *user);
+
+typedef enum chiaki_signal_stage_state_t
+{
+    CHIAKI_SIGNAL_STAGE_PENDING,
+    CHIAKI_SIGNAL_STAGE_RUNNING,
+    CHIAKI_SIGNAL_STAGE_DONE,
+    CHIAKI_SIGNAL_STAGE_FAILED,
+    CHIAKI_SIGNAL_STAGE_SKIPPED // a dependency failed
+} ChiakiSignalStageState;
+
+typedef struct chiaki_signal_graph_t ChiakiSignalGraph;
+
+typedef struct chiaki_signal_stage_t
+{
+    const char *name;
+    ChiakiSignalStageFunc func;
+    void *user;
+    uint32_t deps; // bit i set: depends on stage i
+    ChiakiSignalUndoFunc undo;
+
+    ChiakiSignalStageState state;
+    ChiakiErrorCode err;
+    // microseconds since the start of the run
+    uint64_t start_us;
+    uint64_t end_us;
+    bool critical;
+
+    ChiakiSignalGraph *graph;
+    ChiakiThread thread;
+    bool thread_started;
+} ChiakiSignalStage;
+
+struct chiaki_signal_graph_t
+{
+    ChiakiLog *log;
+    ChiakiSignalStage stages[CHIAKI_SIGNAL_GRAPH_STAGES_MAX];
+    size_t stages_count;
+    ChiakiSignalCancelFunc cancel_cb;
+    void *cancel_user;
+
+    ChiakiMutex mutex;
+    ChiakiCond cond;
+    uint64_t start_us; // monotonic
+    uint64_t total_us;
+    bool canceled;
+};
+
+ChiakiErrorCode chiaki_signal_graph_init(ChiakiSignalGraph *graph, ChiakiLog *log);
+void chiaki_signal_graph_fini(ChiakiSignalGraph *graph);
+
+/**
+ * Add a stage. Dependencies can only name stages added before, which keeps the graph acyclic.
+ *
+ * @param deps bitmask of stage indices returned by earlier calls
+ * @return the index of the new stage, or -1 if the graph is full or deps is invalid
+ */
+int chiaki_signal_graph_add(ChiakiSignalGraph *graph, const char *name, ChiakiSignalStageFunc func, void *user, uint32_t deps);
+
+/**
+ * Called once, from the thread of the first stage that fails, while other stages may still run.
+ */
+void chiaki_signal_graph_set_cancel_cb(ChiakiSignalGraph *graph, ChiakiSignalCancelFunc cb, void *user);
+
+/**
+ * Set the function that reverts whatever the stage got done, called with the stage's user.
+ * It must cope with a stage that failed or gave up at any point.
+ */
+void chiaki_signal_graph_set_undo(ChiakiSignalGraph *graph, int stage, ChiakiSignalUndoFunc undo);
+
+/**
+ * Run all stages and wait for them.
+ *
+ * @param parallel false runs the stages one after another on the calling thread, in the order
+ *                 they were added, for platforms short on threads and for comparison
+ * @return CHIAKI_ERR_SUCCESS or the error of the first stage that failed
+ */
+ChiakiErrorCode chiaki_signal_graph_run(ChiakiSignalGraph *graph, bool parallel);
+
+/**
+ * Call the undo function of every stage that started in the last run, the latest started
+ * first, so a stage is reverted before the stages it depends on.
+ */
+void chiaki_signal_graph_undo(ChiakiSignalGraph *graph);
+
+/**
+ * Log every stage with its timing, critical path stages marked with '*'.
+ */
+void chiaki_signal_graph_log(ChiakiSignalGraph *graph, ChiakiLogLevel level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CHIAKI_SIGNALGRAPH_H
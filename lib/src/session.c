@@ -6,6 +6,7 @@
 #include <chiaki/http.h>
 #include <chiaki/base64.h>
 #include <chiaki/random.h>
+#include <chiaki/time.h>
 
 #include <stdlib.h>
 #include <string.h>
@@ -31,6 +32,8 @@
 #define SESSION_PORT					9295
 
 #define SESSION_EXPECT_TIMEOUT_MS		5000
+#define SESSION_REQUEST_RETRY_MIN_MS	100
+#define SESSION_REQUEST_RETRY_MAX_MS	1000
 #define STREAM_CONNECTION_SWITCH_EXPECT_TIMEOUT_MS 2000
 
 static void *session_thread_func(void *arg);
@@ -180,6 +183,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	session->log = log;
 	session->quit_reason = CHIAKI_QUIT_REASON_NONE;
 	session->target = connect_info->ps5 ? CHIAKI_TARGET_PS5_1 : CHIAKI_TARGET_PS4_10;
+	if(!chiaki_target_is_unknown(connect_info->target_hint)
+		&& chiaki_target_is_ps5(connect_info->target_hint) == connect_info->ps5
+		&& chiaki_rp_version_string(connect_info->target_hint))
+		session->target = connect_info->target_hint;
 #if CHIAKI_CAN_USE_HOLEPUNCH
 	session->holepunch_session = connect_info->holepunch_session;
 #endif
@@ -264,6 +271,12 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_session_init(ChiakiSession *session, Chiaki
 	session->connect_info.send_actual_start_bitrate = connect_info->send_actual_start_bitrate;
 	session->connect_info.enable_keyboard = connect_info->enable_keyboard;
 	session->connect_info.enable_dualsense = connect_info->enable_dualsense;
+	session->connect_info.session_request_retry_ms = connect_info->session_request_retry_ms;
+	session->connect_info.mtu_in_hint = connect_info->mtu_in_hint;
+	session->connect_info.mtu_out_hint = connect_info->mtu_out_hint;
+	session->connect_info.rtt_hint_us = connect_info->rtt_hint_us;
+	session->connect_info.link_history = connect_info->link_history;
+	session->connect_info.launch_hints_policy = connect_info->launch_hints_policy;
 	chiaki_controller_state_set_idle(&session->connect_info.cached_controller_state);
 	session->connect_info.cached_controller_state_valid = false;
 	session->stream_restart_requested = false;
@@ -316,7 +329,7 @@ CHIAKI_EXPORT void chiaki_session_fini(ChiakiSession *session)
 
 CHIAKI_EXPORT ChiakiErrorCode chiaki_session_start(ChiakiSession *session)
 {
-	ChiakiErrorCode err = chiaki_thread_create(&session->session_thread, session_thread_func, session);
+	ChiakiErrorCode err = chiaki_thread_create_role(&session->session_thread, CHIAKI_THREAD_ROLE_HOUSEKEEPING, session_thread_func, session);
 	if(err != CHIAKI_ERR_SUCCESS)
 		return err;
 	chiaki_thread_set_name(&session->session_thread, "Chiaki Session");
@@ -469,6 +482,7 @@ static bool session_check_state_pred_regist(void *user)
 static void *session_thread_func(void *arg)
 {
 	ChiakiSession *session = (ChiakiSession *)arg;
+	chiaki_cost_thread_enter(session->cost_acct, CHIAKI_COST_OTHER, "Chiaki Session");
 
 	chiaki_mutex_lock(&session->state_mutex);
 
@@ -523,6 +537,23 @@ static void *session_thread_func(void *arg)
 	ChiakiTarget server_target = CHIAKI_TARGET_PS4_UNKNOWN;
 	ChiakiErrorCode err = session_thread_request_session(session, &server_target);
 
+	uint64_t retry_until_ms = chiaki_time_now_monotonic_ms() + session->connect_info.session_request_retry_ms;
+	uint64_t retry_delay_ms = SESSION_REQUEST_RETRY_MIN_MS;
+	while(err != CHIAKI_ERR_SUCCESS
+		&& session->quit_reason == CHIAKI_QUIT_REASON_SESSION_REQUEST_CONNECTION_REFUSED
+		&& chiaki_time_now_monotonic_ms() + retry_delay_ms <= retry_until_ms)
+	{
+		// Console is up but its services are still starting
+		CHIAKI_LOGI(session->log, "Session request refused, retrying in %llu ms", (unsigned long long)retry_delay_ms);
+		chiaki_cond_timedwait_pred(&session->state_cond, &session->state_mutex, retry_delay_ms, session_check_state_pred, session);
+		CHECK_STOP(quit);
+		retry_delay_ms *= 2;
+		if(retry_delay_ms > SESSION_REQUEST_RETRY_MAX_MS)
+			retry_delay_ms = SESSION_REQUEST_RETRY_MAX_MS;
+		session->quit_reason = CHIAKI_QUIT_REASON_NONE;
+		err = session_thread_request_session(session, &server_target);
+	}
+
 	if(err == CHIAKI_ERR_VERSION_MISMATCH && !chiaki_target_is_unknown(server_target))
 	{
 		CHIAKI_LOGI(session->log, "Attempting to re-request session with Server's RP-Version");
@@ -649,33 +680,48 @@ ctrl_failed:
 			QUIT(quit_ctrl);
 		}
 
+		session->link_measured = false;
+		if(session->connect_info.mtu_in_hint && session->connect_info.mtu_out_hint && session->connect_info.rtt_hint_us)
+		{
+			session->mtu_in = session->connect_info.mtu_in_hint;
+			session->mtu_out = session->connect_info.mtu_out_hint;
+			session->rtt_us = session->connect_info.rtt_hint_us;
+			CHIAKI_LOGI(session->log, "Skipping Senkusha, using MTU in = %u, out = %u, RTT = %.3f ms from an earlier session",
+				(unsigned int)session->mtu_in, (unsigned int)session->mtu_out, (float)session->rtt_us * 0.001f);
+		}
+		else
+		{
 #ifdef ENABLE_SENKUSHA
-		CHIAKI_LOGI(session->log, "Starting Senkusha");
+			CHIAKI_LOGI(session->log, "Starting Senkusha");
 
-		ChiakiSenkusha senkusha;
-		err = chiaki_senkusha_init(&senkusha, session);
-		if(err != CHIAKI_ERR_SUCCESS)
-			QUIT(quit_ctrl);
+			ChiakiSenkusha senkusha;
+			err = chiaki_senkusha_init(&senkusha, session);
+			if(err != CHIAKI_ERR_SUCCESS)
+				QUIT(quit_ctrl);
 
-		err = chiaki_senkusha_run(&senkusha, &session->mtu_in, &session->mtu_out, &session->rtt_us, data_sock);
-		chiaki_senkusha_fini(&senkusha);
+			err = chiaki_senkusha_run(&senkusha, &session->mtu_in, &session->mtu_out, &session->rtt_us, data_sock);
+			chiaki_senkusha_fini(&senkusha);
 
-		if(err == CHIAKI_ERR_SUCCESS)
-			CHIAKI_LOGI(session->log, "Senkusha completed successfully");
-		else if(err == CHIAKI_ERR_CANCELED)
-			QUIT(quit_ctrl);
-		else
-		{
-			CHIAKI_LOGE(session->log, "Senkusha failed, but we still try to connect with fallback values");
-			session->mtu_in = 1454;
-			session->mtu_out = 1454;
-			/* 5ms is a conservative LAN fallback; 1ms was a stale placeholder
-			 * that caused downstream timing decisions to be unrealistically tight.
-			 * TODO: PSN/relay paths probably want ~30000us — track per-session-type
-			 * fallback in a follow-up. */
-			session->rtt_us = 5000;
-		}
+			if(err == CHIAKI_ERR_SUCCESS)
+			{
+				CHIAKI_LOGI(session->log, "Senkusha completed successfully");
+				session->link_measured = true;
+			}
+			else if(err == CHIAKI_ERR_CANCELED)
+				QUIT(quit_ctrl);
+			else
+			{
+				CHIAKI_LOGE(session->log, "Senkusha failed, but we still try to connect with fallback values");
+				session->mtu_in = 1454;
+				session->mtu_out = 1454;
+				/* 5ms is a conservative LAN fallback; 1ms was a stale placeholder
+				 * that caused downstream timing decisions to be unrealistically tight.
+				 * TODO: PSN/relay paths probably want ~30000us — track per-session-type
+				 * fallback in a follow-up. */
+				session->rtt_us = 5000;
+			}
 #endif
+		}
 		if(session->rudp)
 		{
 			session->stream_connection_switch_received = false;
@@ -769,6 +815,7 @@ quit:
 	quit_event.quit.reason = session->quit_reason;
 	quit_event.quit.reason_str = session->quit_reason_str;
 	chiaki_session_send_event(session, &quit_event);
+	chiaki_cost_thread_leave();
 	return NULL;
 
 #undef CHECK_STOP
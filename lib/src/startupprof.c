@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/startupprof.h>
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAGIC "CKST"
+
+struct chiaki_startup_prof_t
+{
+	ChiakiStartupProfConfig config;
+	ChiakiMutex mutex;
+	uint64_t origin_us;
+	ChiakiStartupSpan *spans;
+	size_t count;
+	uint32_t dropped;
+};
+
+CHIAKI_EXPORT void chiaki_startup_prof_config_defaults(ChiakiStartupProfConfig *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->capacity = 128;
+}
+
+static uint64_t prof_now_us(ChiakiStartupProf *prof)
+{
+	if(prof->config.now_us)
+		return prof->config.now_us(prof->config.now_user);
+	return chiaki_time_now_monotonic_us();
+}
+
+CHIAKI_EXPORT ChiakiStartupProf *chiaki_startup_prof_new(const ChiakiStartupProfConfig *config)
+{
+	if(!config->capacity)
+		return NULL;
+	ChiakiStartupProf *prof = calloc(1, sizeof(ChiakiStartupProf));
+	if(!prof)
+		return NULL;
+	prof->config = *config;
+	if(prof->config.capacity > CHIAKI_STARTUP_SPAN_NONE - 1)
+		prof->config.capacity = CHIAKI_STARTUP_SPAN_NONE - 1;
+	prof->spans = calloc(prof->config.capacity, sizeof(ChiakiStartupSpan));
+	if(!prof->spans)
+		goto error;
+	if(chiaki_mutex_init(&prof->mutex, false) != CHIAKI_ERR_SUCCESS)
+		goto error;
+	prof->origin_us = prof_now_us(prof);
+	return prof;
+error:
+	free(prof->spans);
+	free(prof);
+	return NULL;
+}
+
+CHIAKI_EXPORT void chiaki_startup_prof_free(ChiakiStartupProf *prof)
+{
+	if(!prof)
+		return;
+	chiaki_mutex_fini(&prof->mutex);
+	free(prof->spans);
+	free(prof);
+}
+
+static uint16_t prof_add(ChiakiStartupProf *prof, const char *name, uint32_t duration_us)
+{
+	if(!prof)
+		return CHIAKI_STARTUP_SPAN_NONE;
+	uint64_t now = prof_now_us(prof);
+	uint8_t lane = (uint8_t)chiaki_thread_current_role();
+	chiaki_mutex_lock(&prof->mutex);
+	uint16_t span = CHIAKI_STARTUP_SPAN_NONE;
+	if(prof->count < prof->config.capacity)
+	{
+		span = (uint16_t)prof->count++;
+		ChiakiStartupSpan *s = &prof->spans[span];
+		size_t len = name ? strlen(name) : 0;
+		if(len >= sizeof(s->name))
+			len = sizeof(s->name) - 1;
+		if(len)
+			memcpy(s->name, name, len);
+		s->name[len] = '\0';
+		s->start_us = now - prof->origin_us;
+		s->duration_us = duration_us;
+		s->parent = CHIAKI_STARTUP_SPAN_NONE;
+		s->lane = lane;
+	}
+	else
+		prof->dropped++;
+	chiaki_mutex_unlock(&prof->mutex);
+	return span;
+}
+
+CHIAKI_EXPORT uint16_t chiaki_startup_prof_begin(ChiakiStartupProf *prof, const char *name)
+{
+	return prof_add(prof, name, CHIAKI_STARTUP_DURATION_OPEN);
+}
+
+CHIAKI_EXPORT uint16_t chiaki_startup_prof_mark(ChiakiStartupProf *prof, const char *name)
+{
+	return prof_add(prof, name, 0);
+}
+
+CHIAKI_EXPORT void chiaki_startup_prof_end(ChiakiStartupProf *prof, uint16_t span)
+{
+	if(!prof || span == CHIAKI_STARTUP_SPAN_NONE)
+		return;
+	uint64_t now = prof_now_us(prof);
+	chiaki_mutex_lock(&prof->mutex);
+	if(span < prof->count && prof->spans[span].duration_us == CHIAKI_STARTUP_DURATION_OPEN)
+	{
+		uint64_t duration = now - prof->origin_us - prof->spans[span].start_us;
+		// the longest closed duration, OPEN is taken
+		prof->spans[span].duration_us = duration < CHIAKI_STARTUP_DURATION_OPEN
+			? (uint32_t)duration : CHIAKI_STARTUP_DURATION_OPEN - 1;
+	}
+	chiaki_mutex_unlock(&prof->mutex);
+}
+
+static uint64_t span_end_us(const ChiakiStartupSpan *s)
+{
+	if(s->duration_us == CHIAKI_STARTUP_DURATION_OPEN)
+		return UINT64_MAX;
+	return s->start_us + s->duration_us;
+}
+
+/**
+ * The innermost earlier span of the same lane that encloses span i. Spans are stored in the
+ * order they began, so only the ones before i can enclose it.
+ */
+static uint16_t span_parent(const ChiakiStartupSpan *spans, size_t i)
+{
+	const ChiakiStartupSpan *s = &spans[i];
+	uint64_t end = span_end_us(s);
+	for(size_t j = i; j-- > 0;)
+	{
+		const ChiakiStartupSpan *p = &spans[j];
+		if(p->lane != s->lane || p->duration_us == 0)
+			continue;
+		if(p->start_us <= s->start_us && span_end_us(p) >= end)
+			return (uint16_t)j;
+	}
+	return CHIAKI_STARTUP_SPAN_NONE;
+}
+
+/**
+ * Copy with parents resolved, prof->mutex must be held.
+ */
+static size_t prof_snapshot(ChiakiStartupProf *prof, ChiakiStartupSpan *spans, size_t count)
+{
+	if(count > prof->count)
+		count = prof->count;
+	for(size_t i = 0; i < count; i++)
+	{
+		spans[i] = prof->spans[i];
+		spans[i].parent = span_parent(prof->spans, i);
+	}
+	return prof->count;
+}
+
+CHIAKI_EXPORT size_t chiaki_startup_prof_spans(ChiakiStartupProf *prof, ChiakiStartupSpan *spans, size_t count)
+{
+	if(!prof)
+		return 0;
+	chiaki_mutex_lock(&prof->mutex);
+	size_t r = prof_snapshot(prof, spans, count);
+	chiaki_mutex_unlock(&prof->mutex);
+	return r;
+}
+
+CHIAKI_EXPORT uint32_t chiaki_startup_prof_dropped(ChiakiStartupProf *prof)
+{
+	if(!prof)
+		return 0;
+	chiaki_mutex_lock(&prof->mutex);
+	uint32_t r = prof->dropped;
+	chiaki_mutex_unlock(&prof->mutex);
+	return r;
+}
+
+static uint8_t *put_le(uint8_t *p, uint64_t v, size_t bytes)
+{
+	for(size_t i = 0; i < bytes; i++)
+		*p++ = (uint8_t)(v >> (8 * i));
+	return p;
+}
+
+static uint64_t get_le(const uint8_t *p, size_t bytes)
+{
+	uint64_t v = 0;
+	for(size_t i = 0; i < bytes; i++)
+		v |= (uint64_t)p[i] << (8 * i);
+	return v;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_startup_prof_write_trace(ChiakiStartupProf *prof, uint8_t *buf, size_t *size)
+{
+	if(!prof)
+		return CHIAKI_ERR_UNINITIALIZED;
+	chiaki_mutex_lock(&prof->mutex);
+	size_t needed = CHIAKI_STARTUP_TRACE_HEADER_SIZE;
+	for(size_t i = 0; i < prof->count; i++)
+		needed += CHIAKI_STARTUP_TRACE_SPAN_SIZE + strlen(prof->spans[i].name);
+	if(needed > *size)
+	{
+		chiaki_mutex_unlock(&prof->mutex);
+		*size = needed;
+		return CHIAKI_ERR_BUF_TOO_SMALL;
+	}
+
+	uint8_t *p = buf;
+	memcpy(p, TRACE_MAGIC, 4);
+	p = put_le(p + 4, CHIAKI_STARTUP_TRACE_VERSION, 2);
+	p = put_le(p, prof->count, 2);
+	p = put_le(p, prof->dropped, 4);
+	p = put_le(p, 0, 4);
+	for(size_t i = 0; i < prof->count; i++)
+	{
+		const ChiakiStartupSpan *s = &prof->spans[i];
+		size_t name_len = strlen(s->name);
+		p = put_le(p, s->start_us, 8);
+		p = put_le(p, s->duration_us, 4);
+		p = put_le(p, span_parent(prof->spans, i), 2);
+		p = put_le(p, s->lane, 1);
+		p = put_le(p, name_len, 1);
+		memcpy(p, s->name, name_len);
+		p += name_len;
+	}
+	chiaki_mutex_unlock(&prof->mutex);
+	*size = needed;
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_startup_trace_read(const uint8_t *buf, size_t size,
+	ChiakiStartupSpan *spans, size_t *count, uint32_t *dropped)
+{
+	if(size < CHIAKI_STARTUP_TRACE_HEADER_SIZE || memcmp(buf, TRACE_MAGIC, 4)
+		|| get_le(buf + 4, 2) != CHIAKI_STARTUP_TRACE_VERSION)
+		return CHIAKI_ERR_INVALID_DATA;
+	size_t span_count = (size_t)get_le(buf + 6, 2);
+	if(dropped)
+		*dropped = (uint32_t)get_le(buf + 8, 4);
+	if(span_count > *count)
+	{
+		*count = span_count;
+		return CHIAKI_ERR_BUF_TOO_SMALL;
+	}
+
+	const uint8_t *p = buf + CHIAKI_STARTUP_TRACE_HEADER_SIZE;
+	const uint8_t *end = buf + size;
+	for(size_t i = 0; i < span_count; i++)
+	{
+		if(end - p < CHIAKI_STARTUP_TRACE_SPAN_SIZE)
+			return CHIAKI_ERR_INVALID_DATA;
+		ChiakiStartupSpan *s = &spans[i];
+		s->start_us = get_le(p, 8);
+		s->duration_us = (uint32_t)get_le(p + 8, 4);
+		s->parent = (uint16_t)get_le(p + 12, 2);
+		s->lane = p[14];
+		size_t name_len = p[15];
+		p += CHIAKI_STARTUP_TRACE_SPAN_SIZE;
+		if(name_len >= sizeof(s->name) || (size_t)(end - p) < name_len
+			|| (s->parent != CHIAKI_STARTUP_SPAN_NONE && s->parent >= i))
+			return CHIAKI_ERR_INVALID_DATA;
+		memcpy(s->name, p, name_len);
+		s->name[name_len] = '\0';
+		p += name_len;
+	}
+	*count = span_count;
+	return CHIAKI_ERR_SUCCESS;
+}
@@ -89,11 +89,18 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnecti
 
 	stream_connection->video_receiver = NULL;
 	stream_connection->audio_receiver = NULL;
-	stream_connection->haptics_receiver = NULL;
+
+	// kept across runs, so its stats and config outlive a single stream
+	stream_connection->haptics_receiver = chiaki_haptics_receiver_new(session->log, NULL, &session->haptics_sink, &session->haptics_event_sink);
+	if(!stream_connection->haptics_receiver)
+	{
+		err = CHIAKI_ERR_MEMORY;
+		goto error_packet_stats;
+	}
 
 	err = chiaki_mutex_init(&stream_connection->feedback_sender_mutex, false);
 	if(err != CHIAKI_ERR_SUCCESS)
-		goto error_packet_stats;
+		goto error_haptics_receiver;
 
 	stream_connection->state = STATE_IDLE;
 	stream_connection->state_finished = false;
@@ -115,6 +122,9 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_init(ChiakiStreamConnecti
 
 	return CHIAKI_ERR_SUCCESS;
 
+error_haptics_receiver:
+	chiaki_haptics_receiver_free(stream_connection->haptics_receiver);
+	stream_connection->haptics_receiver = NULL;
 error_packet_stats:
 	chiaki_packet_stats_fini(&stream_connection->packet_stats);
 error_state_cond:
@@ -142,6 +152,9 @@ CHIAKI_EXPORT void chiaki_stream_connection_fini(ChiakiStreamConnection *stream_
 #endif
 		chiaki_congestion_control_stop(&stream_connection->congestion_control);
 
+	chiaki_haptics_receiver_free(stream_connection->haptics_receiver);
+	stream_connection->haptics_receiver = NULL;
+
 	chiaki_packet_stats_fini(&stream_connection->packet_stats);
 	stream_connection->magic = 0;
 
@@ -218,20 +231,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_stream_connection_run(ChiakiStreamConnectio
 		return CHIAKI_ERR_UNKNOWN;
 	}
 
-	stream_connection->haptics_receiver = chiaki_audio_receiver_new(session, NULL);
-	if(!stream_connection->haptics_receiver)
-	{
-		CHIAKI_LOGE(session->log, "StreamConnection failed to initialize Haptics Receiver");
-		err = CHIAKI_ERR_UNKNOWN;
-		goto err_audio_receiver;
-	}
+	chiaki_haptics_receiver_reset(stream_connection->haptics_receiver);
 
 	stream_connection->video_receiver = chiaki_video_receiver_new(session, &stream_connection->packet_stats);
 	if(!stream_connection->video_receiver)
 	{
 		CHIAKI_LOGE(session->log, "StreamConnection failed to initialize Video Receiver");
 		err = CHIAKI_ERR_UNKNOWN;
-		goto err_haptics_receiver;
+		goto err_audio_receiver;
 	}
 
 	stream_connection->state = STATE_TAKION_CONNECT;
@@ -402,10 +409,6 @@ err_video_receiver:
 	chiaki_video_receiver_free(stream_connection->video_receiver);
 	stream_connection->video_receiver = NULL;
 
-err_haptics_receiver:
-	chiaki_audio_receiver_free(stream_connection->haptics_receiver);
-	stream_connection->haptics_receiver = NULL;
-
 err_audio_receiver:
 	chiaki_audio_receiver_free(stream_connection->audio_receiver);
 	stream_connection->audio_receiver = NULL;
@@ -446,6 +449,9 @@ static void stream_connection_takion_cb(ChiakiTakionEvent *event, void *user)
 		case CHIAKI_TAKION_EVENT_TYPE_AV:
 			stream_connection_takion_av(stream_connection, event->av);
 			break;
+		case CHIAKI_TAKION_EVENT_TYPE_TICK:
+			chiaki_haptics_receiver_poll(stream_connection->haptics_receiver, chiaki_time_now_monotonic_us());
+			break;
 		default:
 			break;
 	}
@@ -521,6 +527,10 @@ static void stream_connection_takion_data_trigger_effects(ChiakiStreamConnection
 	event.trigger_effects.type_right = buf[2];
 	memcpy(&event.trigger_effects.left, buf + 5, 10);
 	memcpy(&event.trigger_effects.right, buf + 15, 10);
+	chiaki_haptics_receiver_trigger_effects(stream_connection->haptics_receiver,
+			event.trigger_effects.type_left, event.trigger_effects.left,
+			event.trigger_effects.type_right, event.trigger_effects.right,
+			chiaki_time_now_monotonic_us());
 	chiaki_session_send_event(stream_connection->session, &event);
 }
 
@@ -609,17 +619,19 @@ static ChiakiErrorCode stream_connection_init_crypt(ChiakiStreamConnection *stre
 {
 	ChiakiSession *session = stream_connection->session;
 
-	stream_connection->gkcrypt_local = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 2, session->handshake_key, stream_connection->ecdh_secret);
+	stream_connection->gkcrypt_local = chiaki_gkcrypt_new_pool(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT,
+			session->worker_pool, &session->worker_account, 2, session->handshake_key, stream_connection->ecdh_secret);
 	if(!stream_connection->gkcrypt_local)
 	{
 		CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to initialize local GKCrypt with index 2");
 		return CHIAKI_ERR_UNKNOWN;
 	}
-	stream_connection->gkcrypt_remote = chiaki_gkcrypt_new(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT, 3, session->handshake_key, stream_connection->ecdh_secret);
+	stream_connection->gkcrypt_remote = chiaki_gkcrypt_new_pool(stream_connection->log, CHIAKI_GKCRYPT_KEY_BUF_BLOCKS_DEFAULT,
+			session->worker_pool, &session->worker_account, 3, session->handshake_key, stream_connection->ecdh_secret);
 	if(!stream_connection->gkcrypt_remote)
 	{
 		CHIAKI_LOGE(stream_connection->log, "StreamConnection failed to initialize remote GKCrypt with index 3");
-		free(stream_connection->gkcrypt_local);
+		chiaki_gkcrypt_free(stream_connection->gkcrypt_local);
 		stream_connection->gkcrypt_local = NULL;
 		return CHIAKI_ERR_UNKNOWN;
 	}
@@ -894,17 +906,31 @@ static ChiakiErrorCode stream_connection_send_big(ChiakiStreamConnection *stream
 {
 	ChiakiSession *session = stream_connection->session;
 
+	ChiakiLaunchHints *hints = &session->launch_hints;
+	chiaki_launch_hints_derive(&session->connect_info.launch_hints_policy, &session->connect_info.link_history,
+			session->connect_info.video_profile.bitrate, session->mtu_in, session->rtt_us, session->link_measured,
+			hints);
+	const ChiakiLinkHistory *history = &session->connect_info.link_history;
+	CHIAKI_LOGI(stream_connection->log, "LaunchSpec hints: bw %u kbps (requested %u%s), loss %.4f, mtu %u, rtt %u ms (%s), "
+			"history of %u sessions: loss %.4f, %u kbps",
+			hints->bw_kbps, session->connect_info.video_profile.bitrate,
+			(hints->sources & CHIAKI_LAUNCH_HINTS_SOURCE_BW_CAPPED) ? ", capped by history" : "",
+			hints->bw_loss, hints->mtu, hints->rtt_ms,
+			(hints->sources & CHIAKI_LAUNCH_HINTS_SOURCE_LINK_MEASURED) ? "measured" : "hinted",
+			(unsigned int)history->sessions, history->loss, (unsigned int)history->throughput_kbps);
+
 	ChiakiLaunchSpec launch_spec;
 	launch_spec.target = session->target;
-	launch_spec.mtu = session->mtu_in;
-	launch_spec.rtt = session->rtt_us / 1000;
+	launch_spec.mtu = hints->mtu;
+	launch_spec.rtt = hints->rtt_ms;
 	launch_spec.handshake_key = session->handshake_key;
 
 	launch_spec.width = session->connect_info.video_profile.width;
 	launch_spec.height = session->connect_info.video_profile.height;
 	launch_spec.max_fps = session->connect_info.video_profile.max_fps;
 	launch_spec.codec = session->connect_info.video_profile.codec;
-	launch_spec.bw_kbps_sent = session->connect_info.video_profile.bitrate;
+	launch_spec.bw_kbps_sent = hints->bw_kbps;
+	launch_spec.bw_loss = hints->bw_loss;
 
 	union
 	{
@@ -1137,7 +1163,7 @@ static void stream_connection_takion_av(ChiakiStreamConnection *stream_connectio
 	if(packet->is_video)
 		chiaki_video_receiver_av_packet(stream_connection->video_receiver, packet);
 	else if(packet->is_haptics)
-	    chiaki_audio_receiver_av_packet(stream_connection->haptics_receiver, packet);
+		chiaki_haptics_receiver_av_packet(stream_connection->haptics_receiver, packet, chiaki_time_now_monotonic_us());
 	else
 		chiaki_audio_receiver_av_packet(stream_connection->audio_receiver, packet);
 }
@@ -2,11 +2,13 @@
 
 #include "chiaki/feedback.h"
 #include <chiaki/takion.h>
+#include <chiaki/avheader.h>
 #include <chiaki/congestioncontrol.h>
 #include <chiaki/random.h>
 #include <chiaki/gkcrypt.h>
 #include <chiaki/time.h>
 #include <chiaki/streamconnection.h>
+#include <chiaki/costacct.h>
 
 #include <fcntl.h>
 #include <stdbool.h>
@@ -70,6 +72,17 @@
  * time. */
 #define TAKION_RECV_DRAIN_MAX 256
 
+/* AV packets are received straight into the slots of a batch and decoded,
+ * validated and dispatched together once it is full, before a control
+ * packet and at the end of a drain. See avheader.h. */
+typedef struct takion_av_batch_t
+{
+	ChiakiAvHeaderFormat format;
+	ChiakiAvHeaderBatch headers;
+	ChiakiAvHeaderValidator validator;
+	uint8_t bufs[CHIAKI_AV_HEADER_BATCH_MAX][TAKION_RECV_BUF_SIZE];
+} TakionAvBatch;
+
 // Adaptive jitter buffer constants
 #define TAKION_JITTER_MIN_THRESHOLD_US  2000   // 2ms: responsive gap timeout floor
 #ifdef __PSVITA__
@@ -101,6 +114,8 @@
 
 #define TAKION_EXPECT_TIMEOUT_MS 5000
 
+#define TAKION_TICK_MS 4
+
 /**
  * Base type of Takion packets. Lower nibble of the first byte in datagrams.
  */
@@ -215,7 +230,8 @@ typedef struct chiaki_takion_postponed_packet_t
 } ChiakiTakionPostponedPacket;
 
 static void *takion_thread_func(void *user);
-static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size, uint32_t *recv_malloc_calls);
+static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size, uint32_t *recv_malloc_calls, TakionAvBatch *av_batch);
+static void takion_flush_av_batch(ChiakiTakion *takion, TakionAvBatch *av_batch);
 static ChiakiErrorCode takion_handle_packet_mac(ChiakiTakion *takion, uint8_t base_type, uint8_t *buf, size_t buf_size);
 static void takion_handle_packet_message(ChiakiTakion *takion, uint8_t *buf, size_t buf_size, uint32_t *recv_malloc_calls);
 static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *packet_buf, size_t packet_buf_size, uint8_t type_b, uint8_t *payload, size_t payload_size, uint32_t *recv_malloc_calls);
@@ -240,6 +256,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 	ChiakiErrorCode ret = CHIAKI_ERR_SUCCESS;
 
 	takion->log = info->log;
+	takion->cost_acct = chiaki_cost_current();
 	takion->close_socket = info->close_socket;
 	takion->version = info->protocol_version;
 	CHIAKI_LOGI(takion->log, "Init Takion");
@@ -266,6 +283,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 	CHIAKI_LOGI(takion->log, "Mutex1 created");
 	takion->key_pos_local = 0;
 	takion->gkcrypt_remote = NULL;
+	takion->av_video_stale = 0;
 	takion->cb = info->cb;
 	takion->cb_user = info->cb_user;
 #ifdef VITARPS5_ENHANCED_RECOVERY
@@ -525,7 +543,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_connect(ChiakiTakion *takion, Chiaki
 		}
 	}
 
-	err = chiaki_thread_create(&takion->thread, takion_thread_func, takion);
+	err = chiaki_thread_create_role(&takion->thread, CHIAKI_THREAD_ROLE_NETWORK, takion_thread_func, takion);
 
 	chiaki_thread_set_name(&takion->thread, "Chiaki Takion");
 
@@ -681,7 +699,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_message_data(ChiakiTakion *taki
 		return err;
 
 	size_t packet_size = 1 + TAKION_MESSAGE_HEADER_SIZE + 9 + buf_size;
-	uint8_t *packet_buf = malloc(packet_size);
+	uint8_t *packet_buf = chiaki_cost_malloc(packet_size);
 	if(!packet_buf)
 		return CHIAKI_ERR_MEMORY;
 	packet_buf[0] = TAKION_PACKET_TYPE_CONTROL;
@@ -706,7 +724,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_message_data(ChiakiTakion *taki
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(takion->log, "Takion failed to send data packet: %s", chiaki_error_string(err));
-		free(packet_buf);
+		chiaki_cost_free(packet_buf);
 		return err;
 	}
 
@@ -729,7 +747,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_message_data_cont(ChiakiTakion
 		return err;
 
 	size_t packet_size = 1 + TAKION_MESSAGE_HEADER_SIZE + 8 + buf_size;
-	uint8_t *packet_buf = malloc(packet_size);
+	uint8_t *packet_buf = chiaki_cost_malloc(packet_size);
 	if(!packet_buf)
 		return CHIAKI_ERR_MEMORY;
 	packet_buf[0] = TAKION_PACKET_TYPE_CONTROL;
@@ -753,7 +771,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_message_data_cont(ChiakiTakion
 	if(err != CHIAKI_ERR_SUCCESS)
 	{
 		CHIAKI_LOGE(takion->log, "Takion failed to send data packet: %s", chiaki_error_string(err));
-		free(packet_buf);
+		chiaki_cost_free(packet_buf);
 		return err;
 	}
 
@@ -897,7 +915,7 @@ beach:
 CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_feedback_history(ChiakiTakion *takion, ChiakiSeqNum16 seq_num, uint8_t *payload, size_t payload_size)
 {
 	size_t buf_size = 0xc + payload_size;
-	uint8_t *buf = malloc(buf_size);
+	uint8_t *buf = chiaki_cost_malloc(buf_size);
 	if(!buf)
 		return CHIAKI_ERR_MEMORY;
 	buf[0] = TAKION_PACKET_TYPE_FEEDBACK_HISTORY;
@@ -907,7 +925,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_feedback_history(ChiakiTakion *
 	*((chiaki_unaligned_uint32_t *)(buf + 8)) = 0; // gmac
 	memcpy(buf + 0xc, payload, payload_size);
 	ChiakiErrorCode err = takion_send_feedback_packet(takion, buf, buf_size);
-	free(buf);
+	chiaki_cost_free(buf);
 	return err;
 }
 
@@ -1093,8 +1111,8 @@ static void takion_data_drop(uint64_t seq_num, void *elem_user, void *cb_user)
 	{
 		if(entry)
 		{
-			free(entry->packet_buf);
-			free(entry);
+			chiaki_cost_free(entry->packet_buf);
+			chiaki_cost_free(entry);
 		}
 		return;
 	}
@@ -1116,23 +1134,14 @@ static void takion_data_drop(uint64_t seq_num, void *elem_user, void *cb_user)
 			(unsigned long long)seq_num);
 		return;
 	}
-	free(entry->packet_buf);
-	free(entry);
+	chiaki_cost_free(entry->packet_buf);
+	chiaki_cost_free(entry);
 }
 
 static void *takion_thread_func(void *user)
 {
 	ChiakiTakion *takion = user;
-
-#ifdef __PSVITA__
-	/* Pin network recv+decode thread to USER_0 at prio 64. H.264 decode
-	 * (sceAvcdecDecode) runs synchronously on this thread, so it belongs
-	 * on USER_0 alongside the decode work. USER_2 = audio. The one-time
-	 * re-pin in vita_h264_decode_frame() (video.c) is now redundant but
-	 * harmless. */
-	sceKernelChangeThreadPriority(SCE_KERNEL_THREAD_ID_SELF, 64);
-	sceKernelChangeThreadCpuAffinityMask(SCE_KERNEL_THREAD_ID_SELF, SCE_KERNEL_CPU_MASK_USER_0);
-#endif
+	chiaki_cost_thread_enter(takion->cost_acct, CHIAKI_COST_TAKION, "Chiaki Takion");
 
 	uint32_t seq_num_remote_initial;
 	if(takion_handshake(takion, &seq_num_remote_initial) != CHIAKI_ERR_SUCCESS)
@@ -1192,11 +1201,41 @@ static void *takion_thread_func(void *user)
 
 	bool crypt_available = takion->gkcrypt_remote ? true : false;
 	uint8_t recvbuf[TAKION_RECV_BUF_SIZE];
+
+	// Without the batch, AV packets are parsed and dispatched one by one.
+	TakionAvBatch *av_batch = chiaki_cost_malloc(sizeof(TakionAvBatch));
+	if(av_batch && chiaki_av_header_format_for_version(takion->version, &av_batch->format) != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_cost_free(av_batch);
+		av_batch = NULL;
+	}
+	if(av_batch)
+	{
+		chiaki_av_header_batch_reset(&av_batch->headers);
+		chiaki_av_header_validator_init(&av_batch->validator);
+	}
+	else
+		CHIAKI_LOGW(takion->log, "Takion failed to set up AV header batching, parsing AV packets one by one");
 	ChiakiErrorCode err;
 	ChiakiErrorCode drain_err;
+	uint64_t tick_last_ms = chiaki_time_now_monotonic_ms();
 
 	while(true)
 	{
+		{
+			uint64_t tick_now_ms = chiaki_time_now_monotonic_ms();
+			if(tick_now_ms - tick_last_ms >= TAKION_TICK_MS)
+			{
+				tick_last_ms = tick_now_ms;
+				if(takion->cb)
+				{
+					ChiakiTakionEvent event = { 0 };
+					event.type = CHIAKI_TAKION_EVENT_TYPE_TICK;
+					takion->cb(&event, takion->cb_user);
+				}
+			}
+		}
+
 		if(takion_take_drop_data_queue_request(takion))
 		{
 			uint32_t flushed_seq = takion_drop_data_queue_locked(takion);
@@ -1234,24 +1273,31 @@ static void *takion_thread_func(void *user)
 			for(size_t i=0; i<takion->postponed_packets_count; i++)
 			{
 				ChiakiTakionPostponedPacket *packet = &takion->postponed_packets[i];
-				takion_handle_packet(takion, packet->buf, packet->buf_size, &recv_malloc_calls);
+				takion_handle_packet(takion, packet->buf, packet->buf_size, &recv_malloc_calls, NULL);
 				/* Free the heap copy made in takion_postpone_packet.
 				 * takion_handle_packet no longer owns or frees borrowed bufs. */
-				free(packet->buf);
+				chiaki_cost_free(packet->buf);
 				packet->buf = NULL;
 			}
-			free(takion->postponed_packets);
+			chiaki_cost_free(takion->postponed_packets);
 			takion->postponed_packets = NULL;
 			takion->postponed_packets_size = 0;
 			takion->postponed_packets_count = 0;
 		}
 
 		{
+			// AV packets stay in the batch slot they were received into
+			uint8_t *buf = av_batch ? av_batch->bufs[av_batch->headers.count] : recvbuf;
 			size_t received_size = TAKION_RECV_BUF_SIZE;
-			err = takion_recv(takion, recvbuf, &received_size, UINT64_MAX);
+			// wake up for the next tick if nothing comes
+			uint64_t tick_elapsed_ms = chiaki_time_now_monotonic_ms() - tick_last_ms;
+			uint64_t timeout_ms = tick_elapsed_ms < TAKION_TICK_MS ? TAKION_TICK_MS - tick_elapsed_ms : 0;
+			err = takion_recv(takion, buf, &received_size, timeout_ms);
+			if(err == CHIAKI_ERR_TIMEOUT)
+				continue;
 			if(err != CHIAKI_ERR_SUCCESS)
 				break;
-			takion_handle_packet(takion, recvbuf, received_size, &recv_malloc_calls);
+			takion_handle_packet(takion, buf, received_size, &recv_malloc_calls, av_batch);
 		}
 
 		// Drain any additional buffered packets without blocking.
@@ -1263,13 +1309,15 @@ static void *takion_thread_func(void *user)
 			int drain_i;
 			for(drain_i = 0; drain_i < TAKION_RECV_DRAIN_MAX; drain_i++)
 			{
+				uint8_t *buf = av_batch ? av_batch->bufs[av_batch->headers.count] : recvbuf;
 				size_t drain_size = TAKION_RECV_BUF_SIZE;
-				drain_err = takion_recv(takion, recvbuf, &drain_size, 0);
+				drain_err = takion_recv(takion, buf, &drain_size, 0);
 				if(drain_err != CHIAKI_ERR_SUCCESS)
 					break;
-				takion_handle_packet(takion, recvbuf, drain_size, &recv_malloc_calls);
+				takion_handle_packet(takion, buf, drain_size, &recv_malloc_calls, av_batch);
 				drain_count++;
 			}
+			takion_flush_av_batch(takion, av_batch);
 			/* D3: Track drain batch statistics */
 			takion->jitter_stats.drain_cycles++;
 			takion->jitter_stats.drain_total_count += drain_count;
@@ -1286,6 +1334,16 @@ static void *takion_thread_func(void *user)
 				CHIAKI_LOGD(takion->log,
 					"PIPE/RECV_MALLOC_BURST count=%u over_ms=%llu",
 					recv_malloc_calls, (unsigned long long)rm_elapsed);
+				if(av_batch)
+				{
+					const uint64_t *classified = av_batch->validator.classified;
+					CHIAKI_LOGD(takion->log,
+						"PIPE/AV_HEADER good=%llu duplicate=%llu stale=%llu malformed=%llu",
+						(unsigned long long)classified[CHIAKI_AV_HEADER_CLASS_GOOD],
+						(unsigned long long)classified[CHIAKI_AV_HEADER_CLASS_DUPLICATE],
+						(unsigned long long)classified[CHIAKI_AV_HEADER_CLASS_STALE],
+						(unsigned long long)classified[CHIAKI_AV_HEADER_CLASS_MALFORMED]);
+				}
 				recv_malloc_calls = 0;
 				recv_malloc_report_ms = rm_now;
 			}
@@ -1327,6 +1385,7 @@ static void *takion_thread_func(void *user)
 
 	// chiaki_congestion_control_stop(&congestion_control);
 
+	chiaki_cost_free(av_batch);
 	chiaki_takion_send_buffer_fini(&takion->send_buffer);
 
 error_reoder_queue:
@@ -1348,6 +1407,7 @@ beach:
 		CHIAKI_SOCKET_CLOSE(takion->sock);
 		takion->sock = CHIAKI_INVALID_SOCKET;
 	}
+	chiaki_cost_thread_leave();
 	return NULL;
 }
 
@@ -1423,7 +1483,7 @@ static void takion_postpone_packet(ChiakiTakion *takion, uint8_t *buf, size_t bu
 
 	if(!takion->postponed_packets)
 	{
-		takion->postponed_packets = calloc(TAKION_POSTPONE_PACKETS_SIZE, sizeof(ChiakiTakionPostponedPacket));
+		takion->postponed_packets = chiaki_cost_calloc(TAKION_POSTPONE_PACKETS_SIZE, sizeof(ChiakiTakionPostponedPacket));
 		if(!takion->postponed_packets)
 			return;
 		takion->postponed_packets_size = TAKION_POSTPONE_PACKETS_SIZE;
@@ -1438,7 +1498,7 @@ static void takion_postpone_packet(ChiakiTakion *takion, uint8_t *buf, size_t bu
 
 	/* Retain a private heap copy of the borrowed packet buffer so the caller's
 	 * stack buffer can be reused for the next recv immediately. */
-	copy = malloc(buf_size);
+	copy = chiaki_cost_malloc(buf_size);
 	if(!copy)
 	{
 		CHIAKI_LOGE(takion->log, "Postpone: failed to alloc copy of size %#llx", (unsigned long long)buf_size);
@@ -1458,8 +1518,10 @@ static void takion_postpone_packet(ChiakiTakion *takion, uint8_t *buf, size_t bu
  *            the buffer past this call make their own heap copy internally.
  * @param recv_malloc_calls counter threaded from takion_thread_func; incremented
  *        at each retain-copy malloc site so the caller can report churn.
+ * @param av_batch NULL to dispatch AV packets right away. Otherwise buf must be
+ *        its next free slot, which an AV packet is added to the batch in.
  */
-static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size, uint32_t *recv_malloc_calls)
+static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_size, uint32_t *recv_malloc_calls, TakionAvBatch *av_batch)
 {
 	assert(buf_size > 0);
 	uint8_t base_type = (uint8_t)(buf[0] & TAKION_PACKET_BASE_TYPE_MASK);
@@ -1470,12 +1532,20 @@ static void takion_handle_packet(ChiakiTakion *takion, uint8_t *buf, size_t buf_
 	switch(base_type)
 	{
 		case TAKION_PACKET_TYPE_CONTROL:
+			// keep the AV packets received before it ahead of it
+			takion_flush_av_batch(takion, av_batch);
 			takion_handle_packet_message(takion, buf, buf_size, recv_malloc_calls);
 			break;
 		case TAKION_PACKET_TYPE_VIDEO:
 		case TAKION_PACKET_TYPE_AUDIO:
 			if(takion->enable_crypt && !takion->gkcrypt_remote)
 				takion_postpone_packet(takion, buf, buf_size, recv_malloc_calls);
+			else if(av_batch)
+			{
+				chiaki_av_header_batch_push(&av_batch->headers, buf, buf_size);
+				if(chiaki_av_header_batch_full(&av_batch->headers))
+					takion_flush_av_batch(takion, av_batch);
+			}
 			else
 				takion_handle_packet_av(takion, base_type, buf, buf_size);
 			break;
@@ -1515,8 +1585,8 @@ static void takion_free_data_entry(TakionDataPacketEntry *entry)
 {
 	if(!entry)
 		return;
-	free(entry->packet_buf);
-	free(entry);
+	chiaki_cost_free(entry->packet_buf);
+	chiaki_cost_free(entry);
 }
 
 /**
@@ -1771,16 +1841,16 @@ static void takion_handle_packet_message_data(ChiakiTakion *takion, uint8_t *pac
 		return;
 	}
 
-	entry = malloc(sizeof(TakionDataPacketEntry));
+	entry = chiaki_cost_malloc(sizeof(TakionDataPacketEntry));
 	if(!entry)
 		return;
 
 	/* Retain a private heap copy so the caller's stack recv buffer can be
 	 * reused immediately. Rebase payload into the copy. */
-	copy_buf = malloc(packet_buf_size);
+	copy_buf = chiaki_cost_malloc(packet_buf_size);
 	if(!copy_buf)
 	{
-		free(entry);
+		chiaki_cost_free(entry);
 		return;
 	}
 	(*recv_malloc_calls)++;
@@ -2073,6 +2143,39 @@ static void takion_handle_packet_av(ChiakiTakion *takion, uint8_t base_type, uin
 	}
 }
 
+/**
+ * Decode, validate and dispatch the AV packets in the batch. Duplicate, stale
+ * and malformed packets are dropped before their payload is decrypted.
+ */
+static void takion_flush_av_batch(ChiakiTakion *takion, TakionAvBatch *av_batch)
+{
+	if(!av_batch || !av_batch->headers.count)
+		return;
+
+	ChiakiAvHeaderBatch *headers = &av_batch->headers;
+	chiaki_av_header_batch_decode(headers, av_batch->format, &takion->key_state);
+	chiaki_av_header_validate(&av_batch->validator, headers);
+
+	for(size_t i = 0; i < headers->count; i++)
+	{
+		if(headers->cls[i] == CHIAKI_AV_HEADER_CLASS_STALE && (headers->flags[i] & CHIAKI_AV_HEADER_FLAG_VIDEO))
+			takion->av_video_stale++;
+		if(headers->cls[i] != CHIAKI_AV_HEADER_CLASS_GOOD)
+			continue;
+		ChiakiTakionAVPacket packet;
+		chiaki_av_header_batch_packet(headers, i, &packet);
+		if(takion->cb)
+		{
+			ChiakiTakionEvent event = { 0 };
+			event.type = CHIAKI_TAKION_EVENT_TYPE_AV;
+			event.av = &packet;
+			takion->cb(&event, takion->cb_user);
+		}
+	}
+
+	chiaki_av_header_batch_reset(headers);
+}
+
 static ChiakiErrorCode av_packet_parse(bool v12, ChiakiTakionAVPacket *packet, ChiakiKeyState *key_state, uint8_t *buf, size_t buf_size)
 {
 	memset(packet, 0, sizeof(ChiakiTakionAVPacket));
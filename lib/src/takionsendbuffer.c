@@ -6,6 +6,7 @@
 #include <chiaki/takion.h>
 #include <chiaki/time.h>
 #include <chiaki/streamconnection.h>
+#include <chiaki/costacct.h>
 
 #include <string.h>
 #include <assert.h>
@@ -34,7 +35,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_init(ChiakiTakionSendBuf
 	send_buffer->takion = takion;
 	send_buffer->log = takion ? takion->log : NULL;
 
-	send_buffer->packets = calloc(size, sizeof(ChiakiTakionSendBufferPacket));
+	send_buffer->packets = chiaki_cost_calloc(size, sizeof(ChiakiTakionSendBufferPacket));
 	if(!send_buffer->packets)
 		return CHIAKI_ERR_MEMORY;
 	send_buffer->packets_size = size;
@@ -50,7 +51,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_init(ChiakiTakionSendBuf
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_mutex;
 
-	err = chiaki_thread_create(&send_buffer->thread, takion_send_buffer_thread_func, send_buffer);
+	err = chiaki_thread_create_role(&send_buffer->thread, CHIAKI_THREAD_ROLE_HOUSEKEEPING, takion_send_buffer_thread_func, send_buffer);
 	if(err != CHIAKI_ERR_SUCCESS)
 		goto error_cond;
 
@@ -62,7 +63,7 @@ error_cond:
 error_mutex:
 	chiaki_mutex_fini(&send_buffer->mutex);
 error_packets:
-	free(send_buffer->packets);
+	chiaki_cost_free(send_buffer->packets);
 	return err;
 }
 
@@ -75,14 +76,14 @@ CHIAKI_EXPORT void chiaki_takion_send_buffer_fini(ChiakiTakionSendBuffer *send_b
 	assert(err == CHIAKI_ERR_SUCCESS);
 
 	for(size_t i=0; i<send_buffer->packets_count; i++)
-		free(send_buffer->packets[i].buf);
+		chiaki_cost_free(send_buffer->packets[i].buf);
 
 	chiaki_cond_fini(&send_buffer->cond);
 	chiaki_mutex_fini(&send_buffer->mutex);
-	free(send_buffer->packets);
+	chiaki_cost_free(send_buffer->packets);
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_push(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, uint8_t *buf, size_t buf_size)
+static ChiakiErrorCode takion_send_buffer_push(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, uint8_t *buf, size_t buf_size)
 {
 	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -129,12 +130,20 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_push(ChiakiTakionSendBuf
 
 beach:
 	if(err != CHIAKI_ERR_SUCCESS)
-		free(buf);
+		chiaki_cost_free(buf);
 	chiaki_mutex_unlock(&send_buffer->mutex);
 	return err;
 }
 
-CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, ChiakiSeqNum32 *acked_seq_nums, size_t *acked_seq_nums_count)
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_push(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, uint8_t *buf, size_t buf_size)
+{
+	chiaki_cost_scope_begin(CHIAKI_COST_SEND_BUFFER);
+	ChiakiErrorCode err = takion_send_buffer_push(send_buffer, seq_num, buf, buf_size);
+	chiaki_cost_scope_end();
+	return err;
+}
+
+static ChiakiErrorCode takion_send_buffer_ack(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, ChiakiSeqNum32 *acked_seq_nums, size_t *acked_seq_nums_count)
 {
 	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
@@ -153,7 +162,7 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuff
 			if(acked_seq_nums)
 				acked_seq_nums[(*acked_seq_nums_count)++] = send_buffer->packets[i].seq_num;
 
-			free(send_buffer->packets[i].buf);
+			chiaki_cost_free(send_buffer->packets[i].buf);
 			if(shift_start == SIZE_MAX)
 			{
 				// first shift
@@ -196,6 +205,14 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuff
 	return err;
 }
 
+CHIAKI_EXPORT ChiakiErrorCode chiaki_takion_send_buffer_ack(ChiakiTakionSendBuffer *send_buffer, ChiakiSeqNum32 seq_num, ChiakiSeqNum32 *acked_seq_nums, size_t *acked_seq_nums_count)
+{
+	chiaki_cost_scope_begin(CHIAKI_COST_SEND_BUFFER);
+	ChiakiErrorCode err = takion_send_buffer_ack(send_buffer, seq_num, acked_seq_nums, acked_seq_nums_count);
+	chiaki_cost_scope_end();
+	return err;
+}
+
 static void takion_send_buffer_resend(ChiakiTakionSendBuffer *send_buffer);
 
 static bool takion_send_buffer_check_pred_packets(void *user)
@@ -213,10 +230,14 @@ static bool takion_send_buffer_check_pred_no_packets(void *user)
 static void *takion_send_buffer_thread_func(void *user)
 {
 	ChiakiTakionSendBuffer *send_buffer = user;
+	chiaki_cost_thread_enter(send_buffer->takion ? send_buffer->takion->cost_acct : NULL, CHIAKI_COST_SEND_BUFFER, "Chiaki Send Buf");
 
 	ChiakiErrorCode err = chiaki_mutex_lock(&send_buffer->mutex);
 	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_cost_thread_leave();
 		return NULL;
+	}
 
 	while(true)
 	{
@@ -235,6 +256,7 @@ static void *takion_send_buffer_thread_func(void *user)
 	}
 	chiaki_mutex_unlock(&send_buffer->mutex);
 
+	chiaki_cost_thread_leave();
 	return NULL;
 }
 
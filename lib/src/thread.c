@@ -18,13 +18,57 @@
 #include <psp2/kernel/error.h>
 #endif
 
+#if defined(__linux__) && !defined(__PSVITA__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(_MSC_VER)
+#define CHIAKI_THREAD_LOCAL __declspec(thread)
+#else
+#define CHIAKI_THREAD_LOCAL __thread
+#endif
+
+#ifdef __PSVITA__
+#define VITA_THREAD_PRIORITY_DEFAULT 0x10000100
+#define VITA_THREAD_STACK_SIZE_DEFAULT 0x10000
+#define VITA_CPU_MASK_SHIFT 16 // SCE_KERNEL_CPU_MASK_USER_0 == 1 << 16
+#endif
+
+static ChiakiThreadPolicyTable policy_table;
+static bool policy_table_installed = false;
+static CHIAKI_THREAD_LOCAL ChiakiThreadRole current_role = CHIAKI_THREAD_ROLE_DEFAULT;
+
+static ChiakiErrorCode thread_apply_policy_self(const ChiakiThreadPolicy *policy);
+
 #if _WIN32
 static DWORD WINAPI win32_thread_func(LPVOID param)
 {
 	ChiakiThread *thread = (ChiakiThread *)param;
+	current_role = thread->role;
 	thread->ret = thread->func(thread->arg);
 	return 0;
 }
+#elif !defined(__PSVITA__)
+typedef struct pthread_start_t
+{
+	ChiakiThreadFunc func;
+	void *arg;
+	ChiakiThreadRole role;
+	ChiakiThreadPolicy policy;
+} PThreadStart;
+
+static void *pthread_role_wrap(void *user)
+{
+	PThreadStart start = *(PThreadStart *)user;
+	free(user);
+	current_role = start.role;
+	// best effort: a thread that could not be re-prioritized should still run
+	thread_apply_policy_self(&start.policy);
+	return start.func(start.arg);
+}
 #endif
 
 #ifdef __SWITCH__
@@ -41,38 +85,112 @@ int64_t get_thread_limit()
 #endif
 
 #ifdef __PSVITA__
-// small buffer to hold thread/mutex/condition var names
-static char name_buffer[256];
+// kernel object names are only for debugging, the address is unique enough
+#define VITA_OBJECT_NAME_SIZE 16
 
 // container for function + arguments to be run in a thread
 typedef struct {
    void* arg;
    ChiakiThreadFunc func;
+   ChiakiThreadRole role;
 } sce_thread_args_struct;
 
 // tiny trampoline function to call a one-argument int-returning function
 static int psp_thread_wrap(SceSize args, void *argp) {
    sce_thread_args_struct* sthread_args = (sce_thread_args_struct*)argp;
+   current_role = sthread_args->role;
    return (int)sthread_args->func(sthread_args->arg);
 }
 #endif
 
+CHIAKI_EXPORT const char *chiaki_thread_role_string(ChiakiThreadRole role)
+{
+	switch(role)
+	{
+		case CHIAKI_THREAD_ROLE_DEFAULT:
+			return "default";
+		case CHIAKI_THREAD_ROLE_NETWORK:
+			return "network";
+		case CHIAKI_THREAD_ROLE_CRYPTO:
+			return "crypto";
+		case CHIAKI_THREAD_ROLE_DECODE:
+			return "decode";
+		case CHIAKI_THREAD_ROLE_AUDIO:
+			return "audio";
+		case CHIAKI_THREAD_ROLE_INPUT:
+			return "input";
+		case CHIAKI_THREAD_ROLE_HOUSEKEEPING:
+			return "housekeeping";
+		default:
+			return "unknown";
+	}
+}
+
+CHIAKI_EXPORT void chiaki_thread_policy_table_init(ChiakiThreadPolicyTable *table)
+{
+	for(size_t i=0; i<CHIAKI_THREAD_ROLE_COUNT; i++)
+	{
+		table->roles[i].priority = CHIAKI_THREAD_PRIORITY_INHERIT;
+		table->roles[i].core_mask = CHIAKI_THREAD_CORE_MASK_ANY;
+		table->roles[i].stack_size = 0;
+	}
+}
+
+CHIAKI_EXPORT void chiaki_thread_policy_table_set(const ChiakiThreadPolicyTable *table)
+{
+	if(table)
+		policy_table = *table;
+	else
+		chiaki_thread_policy_table_init(&policy_table);
+	policy_table_installed = true;
+}
+
+CHIAKI_EXPORT void chiaki_thread_policy_get(ChiakiThreadRole role, ChiakiThreadPolicy *policy)
+{
+	if(!policy_table_installed || role < 0 || role >= CHIAKI_THREAD_ROLE_COUNT)
+	{
+		policy->priority = CHIAKI_THREAD_PRIORITY_INHERIT;
+		policy->core_mask = CHIAKI_THREAD_CORE_MASK_ANY;
+		policy->stack_size = 0;
+		return;
+	}
+	*policy = policy_table.roles[role];
+}
+
 CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_create(ChiakiThread *thread, ChiakiThreadFunc func, void *arg)
 {
+	return chiaki_thread_create_role(thread, CHIAKI_THREAD_ROLE_DEFAULT, func, arg);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_create_role(ChiakiThread *thread, ChiakiThreadRole role, ChiakiThreadFunc func, void *arg)
+{
+	ChiakiThreadPolicy policy;
+	chiaki_thread_policy_get(role, &policy);
 #if _WIN32
 	thread->func = func;
 	thread->arg = arg;
 	thread->ret = NULL;
-	thread->thread = CreateThread(NULL, 0, win32_thread_func, thread, 0, 0);
+	thread->role = role;
+	thread->thread = CreateThread(NULL, policy.stack_size, win32_thread_func, thread, 0, 0);
 	if(!thread->thread)
 		return CHIAKI_ERR_THREAD;
+	if(policy.core_mask != CHIAKI_THREAD_CORE_MASK_ANY)
+		SetThreadAffinityMask(thread->thread, (DWORD_PTR)policy.core_mask);
 #elif defined(__PSVITA__)
-	snprintf(name_buffer, sizeof(name_buffer), "0x%08X", (unsigned int) thread);
+	char name[VITA_OBJECT_NAME_SIZE];
+	snprintf(name, sizeof(name), "0x%08X", (unsigned int) thread);
 	thread->thread_id = sceKernelCreateThread(
-		name_buffer, psp_thread_wrap, 0x10000100, 0x10000, 0, 0, NULL);
+		name, psp_thread_wrap,
+		policy.priority != CHIAKI_THREAD_PRIORITY_INHERIT ? policy.priority : VITA_THREAD_PRIORITY_DEFAULT,
+		policy.stack_size ? (SceSize)policy.stack_size : VITA_THREAD_STACK_SIZE_DEFAULT,
+		0, (int)(policy.core_mask << VITA_CPU_MASK_SHIFT), NULL);
+	if (thread->thread_id < 0) {
+		return CHIAKI_ERR_THREAD;
+	}
 	sce_thread_args_struct sthread_args;
 	sthread_args.arg = arg;
 	sthread_args.func = func;
+	sthread_args.role = role;
 	if (sceKernelStartThread(thread->thread_id, sizeof(sthread_args), &sthread_args) < 0) {
 		return CHIAKI_ERR_THREAD;
 	}
@@ -81,9 +199,116 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_create(ChiakiThread *thread, ChiakiT
 	if(get_thread_limit() <= 1)
 		return CHIAKI_ERR_THREAD;
 #endif
-	int r = pthread_create(&thread->thread, NULL, func, arg);
+	PThreadStart *start = CHIAKI_NEW(PThreadStart);
+	if(!start)
+		return CHIAKI_ERR_MEMORY;
+	start->func = func;
+	start->arg = arg;
+	start->role = role;
+	start->policy = policy;
+
+	pthread_attr_t attr;
+	pthread_attr_t *attr_ptr = NULL;
+	if(policy.stack_size)
+	{
+		if(pthread_attr_init(&attr) == 0)
+		{
+			attr_ptr = &attr;
+			pthread_attr_setstacksize(attr_ptr, policy.stack_size);
+		}
+	}
+	int r = pthread_create(&thread->thread, attr_ptr, pthread_role_wrap, start);
+	if(attr_ptr)
+		pthread_attr_destroy(attr_ptr);
 	if(r != 0)
+	{
+		free(start);
 		return CHIAKI_ERR_THREAD;
+	}
+#endif
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static ChiakiErrorCode thread_apply_policy_self(const ChiakiThreadPolicy *policy)
+{
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+#if defined(__PSVITA__)
+	if(policy->priority != CHIAKI_THREAD_PRIORITY_INHERIT
+			&& sceKernelChangeThreadPriority(SCE_KERNEL_THREAD_ID_SELF, policy->priority) < 0)
+		err = CHIAKI_ERR_THREAD;
+	if(sceKernelChangeThreadCpuAffinityMask(SCE_KERNEL_THREAD_ID_SELF, (int)(policy->core_mask << VITA_CPU_MASK_SHIFT)) < 0)
+		err = CHIAKI_ERR_THREAD;
+#elif defined(_WIN32)
+	if(policy->core_mask != CHIAKI_THREAD_CORE_MASK_ANY
+			&& !SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)policy->core_mask))
+		err = CHIAKI_ERR_THREAD;
+#elif defined(__linux__)
+	pid_t tid = (pid_t)syscall(SYS_gettid);
+	if(policy->priority != CHIAKI_THREAD_PRIORITY_INHERIT
+			&& setpriority(PRIO_PROCESS, (id_t)tid, policy->priority) != 0)
+		err = CHIAKI_ERR_THREAD;
+	if(policy->core_mask != CHIAKI_THREAD_CORE_MASK_ANY)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for(int i=0; i<32; i++)
+		{
+			if(policy->core_mask & (1u << i))
+				CPU_SET(i, &set);
+		}
+		if(sched_setaffinity(0, sizeof(set), &set) != 0)
+			err = CHIAKI_ERR_THREAD;
+	}
+#else
+	(void)policy;
+#endif
+	return err;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_apply_role(ChiakiThreadRole role)
+{
+	ChiakiThreadPolicy policy;
+	chiaki_thread_policy_get(role, &policy);
+	current_role = role;
+	return thread_apply_policy_self(&policy);
+}
+
+CHIAKI_EXPORT ChiakiThreadRole chiaki_thread_current_role(void)
+{
+	return current_role;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_sched_info_self(ChiakiThreadSchedInfo *info)
+{
+	info->role = current_role;
+	info->priority = CHIAKI_THREAD_PRIORITY_INHERIT;
+	info->core_mask = CHIAKI_THREAD_CORE_MASK_ANY;
+	info->cpu = -1;
+#if defined(__PSVITA__)
+	SceKernelThreadInfo ti;
+	ti.size = sizeof(ti);
+	if(sceKernelGetThreadInfo(sceKernelGetThreadId(), &ti) < 0)
+		return CHIAKI_ERR_THREAD;
+	info->priority = ti.currentPriority;
+	info->core_mask = ((uint32_t)ti.currentCpuAffinityMask) >> VITA_CPU_MASK_SHIFT;
+	info->cpu = ti.currentCpuId;
+#elif defined(__linux__)
+	pid_t tid = (pid_t)syscall(SYS_gettid);
+	errno = 0;
+	int prio = getpriority(PRIO_PROCESS, (id_t)tid);
+	if(errno == 0)
+		info->priority = prio;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if(sched_getaffinity(0, sizeof(set), &set) == 0)
+	{
+		for(int i=0; i<32; i++)
+		{
+			if(CPU_ISSET(i, &set))
+				info->core_mask |= 1u << i;
+		}
+	}
+	info->cpu = sched_getcpu();
 #endif
 	return CHIAKI_ERR_SUCCESS;
 }
@@ -130,7 +355,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_thread_set_name(ChiakiThread *thread, const
 	free(wstr);
 #else
 #if defined(__GLIBC__) && !defined(__PSVITA__)
-	int r = pthread_setname_np(thread->thread, name);
+	// Linux allows 15 chars, longer names would fail with ERANGE
+	char short_name[16];
+	snprintf(short_name, sizeof(short_name), "%s", name);
+	int r = pthread_setname_np(thread->thread, short_name);
 	if(r != 0)
 		return CHIAKI_ERR_THREAD;
 #else
@@ -147,9 +375,10 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_mutex_init(ChiakiMutex *mutex, bool rec)
 	InitializeCriticalSection(&mutex->cs);
 	(void)rec; // always recursive
 #elif defined(__PSVITA__)
-	snprintf(name_buffer, sizeof(name_buffer), "0x%08X", (unsigned int) mutex);
+	char name[VITA_OBJECT_NAME_SIZE];
+	snprintf(name, sizeof(name), "0x%08X", (unsigned int) mutex);
 	mutex->mutex_id = sceKernelCreateMutex(
-		name_buffer, rec ? SCE_KERNEL_MUTEX_ATTR_RECURSIVE : 0, 0, 0);
+		name, rec ? SCE_KERNEL_MUTEX_ATTR_RECURSIVE : 0, 0, 0);
 	if (mutex->mutex_id < 0) {
 		return CHIAKI_ERR_UNKNOWN;
 	}
@@ -247,8 +476,9 @@ CHIAKI_EXPORT ChiakiErrorCode chiaki_cond_init(ChiakiCond *cond, ChiakiMutex *mu
 #if _WIN32
 	InitializeConditionVariable(&cond->cond);
 #elif defined(__PSVITA__)
-	snprintf(name_buffer, sizeof(name_buffer), "0x%08X", ((unsigned int) cond) + 1);
-	cond->cond_id = sceKernelCreateCond(name_buffer, 0, mutex->mutex_id, 0);
+	char name[VITA_OBJECT_NAME_SIZE];
+	snprintf(name, sizeof(name), "0x%08X", ((unsigned int) cond) + 1);
+	cond->cond_id = sceKernelCreateCond(name, 0, mutex->mutex_id, 0);
 	if (cond->cond_id < 0) {
 		return CHIAKI_ERR_UNKNOWN;
 	}
@@ -0,0 +1,567 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/tokenlifecycle.h>
+#include <chiaki/random.h>
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// the thread re-checks the schedule at least this often, in case the clock jumped or stood still
+#define TOKEN_LIFECYCLE_WAKE_MAX_MS 60000
+// a wall clock before 2020-01-01 has not been set, expires_at_unix can't be converted with it
+#define TOKEN_LIFECYCLE_WALL_CLOCK_MIN_UNIX 1577836800ULL
+
+struct chiaki_token_lifecycle_t
+{
+	ChiakiTokenLifecycleConfig config;
+	ChiakiMutex mutex;
+	ChiakiMutex persist_mutex; // orders persist calls with set() and clear(), taken before mutex
+	ChiakiCond wake_cond;
+	ChiakiCond done_cond;
+	ChiakiThread thread;
+	bool stop;
+
+	char *access_token;
+	char *refresh_token;
+	uint64_t issued_ms; // monotonic
+	uint64_t expires_ms; // monotonic
+	uint64_t expires_at_unix;
+	uint64_t generation; // bumped whenever the tokens are replaced from outside
+
+	bool scheduled;
+	uint64_t refresh_at_ms;
+	bool held;
+	bool demand;
+	bool refreshing;
+	bool rejected;
+	uint64_t attempts; // finished refreshes, successful or not
+	unsigned failures;
+	uint64_t failed_at_ms;
+	ChiakiErrorCode last_err;
+	int64_t clock_skew_sec;
+
+	ChiakiTokenLifecycleStats stats;
+};
+
+CHIAKI_EXPORT void chiaki_token_lifecycle_config_defaults(ChiakiTokenLifecycleConfig *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->refresh_margin_sec = 300;
+	config->jitter_sec = 120;
+	config->retry_min_sec = 5;
+	config->retry_max_sec = 300;
+	config->skew_warn_sec = 120;
+}
+
+CHIAKI_EXPORT const char *chiaki_token_freshness_string(ChiakiTokenFreshness freshness)
+{
+	switch(freshness)
+	{
+		case CHIAKI_TOKEN_NONE: return "none";
+		case CHIAKI_TOKEN_FRESH: return "fresh";
+		case CHIAKI_TOKEN_REFRESH_DUE: return "refresh due";
+		case CHIAKI_TOKEN_EXPIRED: return "expired";
+		case CHIAKI_TOKEN_REJECTED: return "rejected";
+		default: return "unknown";
+	}
+}
+
+static uint64_t lifecycle_now_ms(ChiakiTokenLifecycle *lifecycle)
+{
+	if(lifecycle->config.now_ms)
+		return lifecycle->config.now_ms(lifecycle->config.clock_user);
+	return chiaki_time_now_monotonic_ms();
+}
+
+static uint64_t lifecycle_now_unix(ChiakiTokenLifecycle *lifecycle)
+{
+	if(lifecycle->config.now_unix)
+		return lifecycle->config.now_unix(lifecycle->config.clock_user);
+	time_t t = time(NULL);
+	return t == (time_t)-1 ? 0 : (uint64_t)t;
+}
+
+static uint32_t lifecycle_random(ChiakiTokenLifecycle *lifecycle)
+{
+	if(lifecycle->config.random)
+		return lifecycle->config.random(lifecycle->config.clock_user);
+	return chiaki_random_32();
+}
+
+static char *dup_token(const char *token)
+{
+	return token && token[0] ? strdup(token) : NULL;
+}
+
+// refresh margin for the current token, at most half its lifetime
+static uint64_t margin_ms(ChiakiTokenLifecycle *lifecycle)
+{
+	uint64_t margin = (uint64_t)lifecycle->config.refresh_margin_sec * 1000;
+	uint64_t lifetime = lifecycle->expires_ms - lifecycle->issued_ms;
+	return margin < lifetime / 2 ? margin : lifetime / 2;
+}
+
+static uint64_t valid_ms(ChiakiTokenLifecycle *lifecycle, uint64_t now)
+{
+	if(!lifecycle->access_token || now >= lifecycle->expires_ms)
+		return 0;
+	return lifecycle->expires_ms - now;
+}
+
+static void schedule(ChiakiTokenLifecycle *lifecycle, uint64_t now)
+{
+	lifecycle->scheduled = false;
+	if(!lifecycle->refresh_token || lifecycle->rejected)
+		return;
+	lifecycle->scheduled = true;
+
+	if(lifecycle->failures)
+	{
+		uint64_t backoff = lifecycle->config.retry_min_sec;
+		for(unsigned i = 1; i < lifecycle->failures && backoff < lifecycle->config.retry_max_sec; i++)
+			backoff *= 2;
+		if(backoff > lifecycle->config.retry_max_sec)
+			backoff = lifecycle->config.retry_max_sec;
+		lifecycle->refresh_at_ms = lifecycle->failed_at_ms + backoff * 1000;
+		return;
+	}
+
+	if(!valid_ms(lifecycle, now))
+	{
+		lifecycle->refresh_at_ms = now;
+		return;
+	}
+
+	uint64_t lifetime = lifecycle->expires_ms - lifecycle->issued_ms;
+	uint64_t jitter_max = (uint64_t)lifecycle->config.jitter_sec * 1000;
+	if(jitter_max > lifetime / 4)
+		jitter_max = lifetime / 4;
+	uint64_t jitter = jitter_max ? lifecycle_random(lifecycle) % (jitter_max + 1) : 0;
+	uint64_t lead = margin_ms(lifecycle) + jitter;
+	lifecycle->refresh_at_ms = lifecycle->expires_ms - lead > lifecycle->issued_ms
+		? lifecycle->expires_ms - lead
+		: lifecycle->issued_ms;
+}
+
+static void persist(ChiakiTokenLifecycle *lifecycle)
+{
+	if(!lifecycle->config.persist)
+		return;
+	uint64_t generation = lifecycle->generation;
+	char *access_token = dup_token(lifecycle->access_token);
+	char *refresh_token = dup_token(lifecycle->refresh_token);
+	ChiakiTokenSet tokens = {
+		.access_token = access_token ? access_token : "",
+		.refresh_token = refresh_token ? refresh_token : "",
+		.expires_at_unix = lifecycle->expires_at_unix
+	};
+	// runs after the waiters were woken up, they don't wait for the disk
+	chiaki_mutex_unlock(&lifecycle->mutex);
+	chiaki_mutex_lock(&lifecycle->persist_mutex);
+	chiaki_mutex_lock(&lifecycle->mutex);
+	// tokens set in between are newer, don't overwrite them with ours
+	bool current = generation == lifecycle->generation;
+	chiaki_mutex_unlock(&lifecycle->mutex);
+	if(current)
+		lifecycle->config.persist(lifecycle->config.persist_user, &tokens);
+	chiaki_mutex_unlock(&lifecycle->persist_mutex);
+	chiaki_mutex_lock(&lifecycle->mutex);
+	if(current)
+		lifecycle->stats.persists++;
+	free(access_token);
+	free(refresh_token);
+}
+
+static void refresh_run(ChiakiTokenLifecycle *lifecycle)
+{
+	uint64_t generation = lifecycle->generation;
+	char *refresh_token = strdup(lifecycle->refresh_token);
+	uint64_t start_ms = lifecycle_now_ms(lifecycle);
+	uint64_t start_unix = lifecycle_now_unix(lifecycle);
+	lifecycle->refreshing = true;
+	chiaki_mutex_unlock(&lifecycle->mutex);
+
+	ChiakiTokenGrant grant = { 0 };
+	ChiakiErrorCode err = refresh_token
+		? lifecycle->config.refresh(lifecycle->config.refresh_user, refresh_token, &grant)
+		: CHIAKI_ERR_MEMORY;
+	free(refresh_token);
+	if(err == CHIAKI_ERR_SUCCESS && (!grant.access_token || !grant.access_token[0] || !grant.expires_in_sec))
+		err = CHIAKI_ERR_INVALID_RESPONSE;
+	uint64_t end_unix = lifecycle_now_unix(lifecycle);
+
+	chiaki_mutex_lock(&lifecycle->mutex);
+	lifecycle->refreshing = false;
+	lifecycle->attempts++;
+	uint64_t now = lifecycle_now_ms(lifecycle);
+	bool stale = generation != lifecycle->generation;
+	if(stale)
+	{
+		// set() or clear() replaced the tokens while we were refreshing the old ones
+		CHIAKI_LOGV(lifecycle->config.log, "Token lifecycle: dropping refresh of replaced tokens");
+		lifecycle->stats.dropped++;
+		free(grant.access_token);
+		free(grant.refresh_token);
+		chiaki_cond_broadcast(&lifecycle->done_cond);
+		return;
+	}
+
+	lifecycle->last_err = err;
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		free(grant.access_token);
+		free(grant.refresh_token);
+		lifecycle->stats.failures++;
+		if(err == CHIAKI_ERR_HTTP_NONOK)
+		{
+			lifecycle->rejected = true;
+			lifecycle->stats.rejections++;
+			schedule(lifecycle, now);
+			CHIAKI_LOGE(lifecycle->config.log, "Token lifecycle: refresh token rejected, login required");
+		}
+		else
+		{
+			lifecycle->failures++;
+			lifecycle->failed_at_ms = now;
+			schedule(lifecycle, now);
+			CHIAKI_LOGW(lifecycle->config.log, "Token lifecycle: refresh failed (%s), attempt %u, retrying in %llu s",
+				chiaki_error_string(err), lifecycle->failures,
+				(unsigned long long)((lifecycle->refresh_at_ms - now) / 1000));
+		}
+		chiaki_cond_broadcast(&lifecycle->done_cond);
+		return;
+	}
+
+	free(lifecycle->access_token);
+	lifecycle->access_token = grant.access_token;
+	if(grant.refresh_token && grant.refresh_token[0])
+	{
+		free(lifecycle->refresh_token);
+		lifecycle->refresh_token = grant.refresh_token;
+	}
+	else
+		free(grant.refresh_token);
+	// expires_in counts from when the server answered, which is after we asked
+	lifecycle->issued_ms = start_ms;
+	lifecycle->expires_ms = start_ms + (uint64_t)grant.expires_in_sec * 1000;
+	lifecycle->expires_at_unix = start_unix + grant.expires_in_sec;
+	if(grant.server_time_unix && end_unix)
+	{
+		lifecycle->clock_skew_sec = (int64_t)grant.server_time_unix - (int64_t)end_unix;
+		int64_t skew_abs = lifecycle->clock_skew_sec < 0 ? -lifecycle->clock_skew_sec : lifecycle->clock_skew_sec;
+		if(skew_abs > (int64_t)lifecycle->config.skew_warn_sec)
+			CHIAKI_LOGW(lifecycle->config.log, "Token lifecycle: local clock is %lld s off the token server's, "
+				"tracking expiry relative to now", (long long)-lifecycle->clock_skew_sec);
+	}
+	lifecycle->failures = 0;
+	lifecycle->rejected = false;
+	lifecycle->stats.refreshes++;
+	schedule(lifecycle, now);
+	CHIAKI_LOGI(lifecycle->config.log, "Token lifecycle: refreshed in %llu ms, valid for %u s, next refresh in %llu s",
+		(unsigned long long)(now - start_ms), (unsigned)grant.expires_in_sec,
+		(unsigned long long)((lifecycle->refresh_at_ms > now ? lifecycle->refresh_at_ms - now : 0) / 1000));
+	chiaki_cond_broadcast(&lifecycle->done_cond);
+	persist(lifecycle);
+}
+
+static void *lifecycle_thread_func(void *user)
+{
+	ChiakiTokenLifecycle *lifecycle = user;
+
+	chiaki_mutex_lock(&lifecycle->mutex);
+	while(!lifecycle->stop)
+	{
+		uint64_t now = lifecycle_now_ms(lifecycle);
+		bool due = lifecycle->scheduled && !lifecycle->held && now >= lifecycle->refresh_at_ms;
+		if(lifecycle->demand || due)
+		{
+			bool demand = lifecycle->demand;
+			lifecycle->demand = false;
+			if(!lifecycle->refresh_token)
+			{
+				// cleared after the caller asked
+				lifecycle->attempts++;
+				lifecycle->last_err = CHIAKI_ERR_UNINITIALIZED;
+				chiaki_cond_broadcast(&lifecycle->done_cond);
+				continue;
+			}
+			if(demand)
+				lifecycle->stats.on_demand++;
+			else
+				lifecycle->stats.scheduled++;
+			refresh_run(lifecycle);
+			continue;
+		}
+
+		uint64_t wait_ms = TOKEN_LIFECYCLE_WAKE_MAX_MS;
+		if(lifecycle->scheduled && !lifecycle->held && lifecycle->refresh_at_ms - now < wait_ms)
+			wait_ms = lifecycle->refresh_at_ms - now;
+		chiaki_cond_timedwait(&lifecycle->wake_cond, &lifecycle->mutex, wait_ms);
+	}
+	chiaki_mutex_unlock(&lifecycle->mutex);
+	return NULL;
+}
+
+CHIAKI_EXPORT ChiakiTokenLifecycle *chiaki_token_lifecycle_new(const ChiakiTokenLifecycleConfig *config)
+{
+	if(!config->refresh)
+		return NULL;
+
+	ChiakiTokenLifecycle *lifecycle = calloc(1, sizeof(ChiakiTokenLifecycle));
+	if(!lifecycle)
+		return NULL;
+	lifecycle->config = *config;
+	if(!lifecycle->config.retry_min_sec)
+		lifecycle->config.retry_min_sec = 1;
+	if(lifecycle->config.retry_max_sec < lifecycle->config.retry_min_sec)
+		lifecycle->config.retry_max_sec = lifecycle->config.retry_min_sec;
+
+	if(chiaki_mutex_init(&lifecycle->mutex, false) != CHIAKI_ERR_SUCCESS)
+		goto error_alloc;
+	if(chiaki_mutex_init(&lifecycle->persist_mutex, false) != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+	if(chiaki_cond_init(&lifecycle->wake_cond, &lifecycle->mutex) != CHIAKI_ERR_SUCCESS)
+		goto error_persist_mutex;
+	if(chiaki_cond_init(&lifecycle->done_cond, &lifecycle->mutex) != CHIAKI_ERR_SUCCESS)
+		goto error_wake_cond;
+	if(chiaki_thread_create_role(&lifecycle->thread, CHIAKI_THREAD_ROLE_HOUSEKEEPING, lifecycle_thread_func, lifecycle) != CHIAKI_ERR_SUCCESS)
+		goto error_done_cond;
+	chiaki_thread_set_name(&lifecycle->thread, "Chiaki Token");
+	return lifecycle;
+
+error_done_cond:
+	chiaki_cond_fini(&lifecycle->done_cond);
+error_wake_cond:
+	chiaki_cond_fini(&lifecycle->wake_cond);
+error_persist_mutex:
+	chiaki_mutex_fini(&lifecycle->persist_mutex);
+error_mutex:
+	chiaki_mutex_fini(&lifecycle->mutex);
+error_alloc:
+	free(lifecycle);
+	return NULL;
+}
+
+CHIAKI_EXPORT void chiaki_token_lifecycle_free(ChiakiTokenLifecycle *lifecycle)
+{
+	if(!lifecycle)
+		return;
+	chiaki_mutex_lock(&lifecycle->mutex);
+	lifecycle->stop = true;
+	chiaki_cond_signal(&lifecycle->wake_cond);
+	chiaki_cond_broadcast(&lifecycle->done_cond);
+	chiaki_mutex_unlock(&lifecycle->mutex);
+	chiaki_thread_join(&lifecycle->thread, NULL);
+	chiaki_cond_fini(&lifecycle->done_cond);
+	chiaki_cond_fini(&lifecycle->wake_cond);
+	chiaki_mutex_fini(&lifecycle->persist_mutex);
+	chiaki_mutex_fini(&lifecycle->mutex);
+	free(lifecycle->access_token);
+	free(lifecycle->refresh_token);
+	free(lifecycle);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_token_lifecycle_set(ChiakiTokenLifecycle *lifecycle,
+	const char *access_token, const char *refresh_token, uint64_t expires_at_unix)
+{
+	char *access_copy = dup_token(access_token);
+	char *refresh_copy = dup_token(refresh_token);
+	if((access_token && access_token[0] && !access_copy) || (refresh_token && refresh_token[0] && !refresh_copy))
+	{
+		free(access_copy);
+		free(refresh_copy);
+		return CHIAKI_ERR_MEMORY;
+	}
+
+	uint64_t now_unix = lifecycle_now_unix(lifecycle);
+	chiaki_mutex_lock(&lifecycle->persist_mutex);
+	chiaki_mutex_lock(&lifecycle->mutex);
+	uint64_t now = lifecycle_now_ms(lifecycle);
+	free(lifecycle->access_token);
+	free(lifecycle->refresh_token);
+	lifecycle->access_token = access_copy;
+	lifecycle->refresh_token = refresh_copy;
+	lifecycle->generation++;
+	lifecycle->rejected = false;
+	lifecycle->failures = 0;
+	lifecycle->last_err = CHIAKI_ERR_SUCCESS;
+
+	// from here on only the monotonic clock counts
+	uint64_t remaining_sec = 0;
+	if(now_unix < TOKEN_LIFECYCLE_WALL_CLOCK_MIN_UNIX)
+		CHIAKI_LOGW(lifecycle->config.log, "Token lifecycle: wall clock not set, treating token as expired");
+	else if(expires_at_unix > now_unix)
+		remaining_sec = expires_at_unix - now_unix;
+	lifecycle->issued_ms = now;
+	lifecycle->expires_ms = now + remaining_sec * 1000;
+	lifecycle->expires_at_unix = expires_at_unix;
+	schedule(lifecycle, now);
+	if(lifecycle->scheduled)
+		CHIAKI_LOGV(lifecycle->config.log, "Token lifecycle: token valid for %llu s, refresh in %llu s",
+			(unsigned long long)remaining_sec,
+			(unsigned long long)((lifecycle->refresh_at_ms > now ? lifecycle->refresh_at_ms - now : 0) / 1000));
+	chiaki_cond_signal(&lifecycle->wake_cond);
+	chiaki_mutex_unlock(&lifecycle->mutex);
+	chiaki_mutex_unlock(&lifecycle->persist_mutex);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+CHIAKI_EXPORT void chiaki_token_lifecycle_clear(ChiakiTokenLifecycle *lifecycle)
+{
+	chiaki_mutex_lock(&lifecycle->persist_mutex);
+	chiaki_mutex_lock(&lifecycle->mutex);
+	free(lifecycle->access_token);
+	free(lifecycle->refresh_token);
+	lifecycle->access_token = NULL;
+	lifecycle->refresh_token = NULL;
+	lifecycle->expires_at_unix = 0;
+	lifecycle->generation++;
+	lifecycle->rejected = false;
+	lifecycle->failures = 0;
+	lifecycle->scheduled = false;
+	chiaki_mutex_unlock(&lifecycle->mutex);
+	chiaki_mutex_unlock(&lifecycle->persist_mutex);
+}
+
+CHIAKI_EXPORT void chiaki_token_lifecycle_hold(ChiakiTokenLifecycle *lifecycle, bool hold)
+{
+	chiaki_mutex_lock(&lifecycle->mutex);
+	lifecycle->held = hold;
+	chiaki_cond_signal(&lifecycle->wake_cond);
+	chiaki_mutex_unlock(&lifecycle->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_token_lifecycle_kick(ChiakiTokenLifecycle *lifecycle)
+{
+	chiaki_mutex_lock(&lifecycle->mutex);
+	chiaki_cond_signal(&lifecycle->wake_cond);
+	chiaki_mutex_unlock(&lifecycle->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_token_lifecycle_invalidate(ChiakiTokenLifecycle *lifecycle)
+{
+	chiaki_mutex_lock(&lifecycle->mutex);
+	uint64_t now = lifecycle_now_ms(lifecycle);
+	if(lifecycle->access_token && lifecycle->expires_ms > now)
+	{
+		CHIAKI_LOGW(lifecycle->config.log, "Token lifecycle: token rejected %llu s before its expiry, refreshing",
+			(unsigned long long)((lifecycle->expires_ms - now) / 1000));
+		lifecycle->expires_ms = now;
+	}
+	if(lifecycle->refresh_token && !lifecycle->rejected && !lifecycle->refreshing)
+	{
+		lifecycle->failures = 0;
+		lifecycle->demand = true;
+		chiaki_cond_signal(&lifecycle->wake_cond);
+	}
+	chiaki_mutex_unlock(&lifecycle->mutex);
+}
+
+static ChiakiErrorCode wait_refresh(ChiakiTokenLifecycle *lifecycle, bool force, uint64_t min_valid_ms, uint64_t timeout_ms)
+{
+	chiaki_mutex_lock(&lifecycle->mutex);
+	if(!force && lifecycle->access_token && valid_ms(lifecycle, lifecycle_now_ms(lifecycle)) >= min_valid_ms)
+	{
+		chiaki_mutex_unlock(&lifecycle->mutex);
+		return CHIAKI_ERR_SUCCESS;
+	}
+	if(!lifecycle->refresh_token)
+	{
+		chiaki_mutex_unlock(&lifecycle->mutex);
+		return CHIAKI_ERR_UNINITIALIZED;
+	}
+	if(!force && lifecycle->rejected)
+	{
+		chiaki_mutex_unlock(&lifecycle->mutex);
+		return CHIAKI_ERR_HTTP_NONOK;
+	}
+
+	// single flight: join the refresh that is running or already asked for
+	lifecycle->stats.waits++;
+	if(lifecycle->refreshing || lifecycle->demand)
+		lifecycle->stats.coalesced++;
+	else
+	{
+		lifecycle->demand = true;
+		chiaki_cond_signal(&lifecycle->wake_cond);
+	}
+	uint64_t target = lifecycle->attempts + 1;
+
+	uint64_t deadline = chiaki_time_now_monotonic_ms() + timeout_ms;
+	while(lifecycle->attempts < target && !lifecycle->stop)
+	{
+		uint64_t t = chiaki_time_now_monotonic_ms();
+		if(t >= deadline)
+			break;
+		chiaki_cond_timedwait(&lifecycle->done_cond, &lifecycle->mutex, deadline - t);
+	}
+
+	ChiakiErrorCode err;
+	if(lifecycle->attempts < target)
+		err = lifecycle->stop ? CHIAKI_ERR_CANCELED : CHIAKI_ERR_TIMEOUT;
+	else if(!force && lifecycle->access_token && valid_ms(lifecycle, lifecycle_now_ms(lifecycle)) >= min_valid_ms)
+		err = CHIAKI_ERR_SUCCESS;
+	else if(!lifecycle->refresh_token)
+		err = CHIAKI_ERR_UNINITIALIZED;
+	else
+		err = lifecycle->last_err;
+	chiaki_mutex_unlock(&lifecycle->mutex);
+	return err;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_token_lifecycle_ensure_fresh(ChiakiTokenLifecycle *lifecycle,
+	uint32_t min_valid_sec, uint64_t timeout_ms)
+{
+	return wait_refresh(lifecycle, false, (uint64_t)min_valid_sec * 1000, timeout_ms);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_token_lifecycle_refresh(ChiakiTokenLifecycle *lifecycle, uint64_t timeout_ms)
+{
+	return wait_refresh(lifecycle, true, 0, timeout_ms);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_token_lifecycle_access_token(ChiakiTokenLifecycle *lifecycle, char **token)
+{
+	ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+	chiaki_mutex_lock(&lifecycle->mutex);
+	if(!lifecycle->access_token)
+		err = CHIAKI_ERR_UNINITIALIZED;
+	else if(!(*token = strdup(lifecycle->access_token)))
+		err = CHIAKI_ERR_MEMORY;
+	chiaki_mutex_unlock(&lifecycle->mutex);
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_token_lifecycle_status(ChiakiTokenLifecycle *lifecycle, ChiakiTokenStatus *status)
+{
+	memset(status, 0, sizeof(*status));
+	chiaki_mutex_lock(&lifecycle->mutex);
+	uint64_t now = lifecycle_now_ms(lifecycle);
+	status->valid_ms = valid_ms(lifecycle, now);
+	if(!lifecycle->access_token)
+		status->freshness = lifecycle->rejected ? CHIAKI_TOKEN_REJECTED : CHIAKI_TOKEN_NONE;
+	else if(!status->valid_ms)
+		status->freshness = lifecycle->rejected ? CHIAKI_TOKEN_REJECTED : CHIAKI_TOKEN_EXPIRED;
+	else if(status->valid_ms <= margin_ms(lifecycle))
+		status->freshness = CHIAKI_TOKEN_REFRESH_DUE;
+	else
+		status->freshness = CHIAKI_TOKEN_FRESH;
+	status->refreshing = lifecycle->refreshing;
+	status->refresh_scheduled = lifecycle->scheduled;
+	if(lifecycle->scheduled && lifecycle->refresh_at_ms > now)
+		status->refresh_in_ms = lifecycle->refresh_at_ms - now;
+	status->failures = lifecycle->failures;
+	status->last_err = lifecycle->last_err;
+	status->clock_skew_sec = lifecycle->clock_skew_sec;
+	chiaki_mutex_unlock(&lifecycle->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_token_lifecycle_stats(ChiakiTokenLifecycle *lifecycle, ChiakiTokenLifecycleStats *stats)
+{
+	chiaki_mutex_lock(&lifecycle->mutex);
+	*stats = lifecycle->stats;
+	chiaki_mutex_unlock(&lifecycle->mutex);
+}
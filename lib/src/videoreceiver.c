@@ -21,33 +21,6 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 #define IDR_REQUEST_TIMEOUT_MS 1000
 #define CASCADE_SKIP_THRESHOLD 3
 
-static void add_ref_frame(ChiakiVideoReceiver *video_receiver, int32_t frame)
-{
-	if(video_receiver->reference_frames[0] != -1)
-	{
-		memmove(&video_receiver->reference_frames[1], &video_receiver->reference_frames[0],
-			sizeof(int32_t) * (RECEIVER_REF_SLOTS - 1));
-		video_receiver->reference_frames[0] = frame;
-		return;
-	}
-	for(int i = RECEIVER_REF_SLOTS - 1; i >= 0; i--)
-	{
-		if(video_receiver->reference_frames[i] == -1)
-		{
-			video_receiver->reference_frames[i] = frame;
-			return;
-		}
-	}
-}
-
-static bool have_ref_frame(ChiakiVideoReceiver *video_receiver, int32_t frame)
-{
-	for(int i = 0; i < RECEIVER_REF_SLOTS; i++)
-		if(video_receiver->reference_frames[i] == frame)
-			return true;
-	return false;
-}
-
 static bool seq16_inclusive_ge(ChiakiSeqNum16 a, ChiakiSeqNum16 b)
 {
 	return a == b || chiaki_seq_num_16_gt(a, b);
@@ -159,7 +132,7 @@ static void video_receiver_maybe_request_idr(ChiakiVideoReceiver *video_receiver
 
 static void video_receiver_apply_cascade_reset(ChiakiVideoReceiver *video_receiver)
 {
-	memset(video_receiver->reference_frames, -1, sizeof(video_receiver->reference_frames));
+	chiaki_ref_tracker_reset_refs(&video_receiver->ref_tracker);
 	video_receiver->consecutive_missing_ref = 0;
 	video_receiver->cascade_reset_attempts++;
 	CHIAKI_LOGW(video_receiver->log,
@@ -183,7 +156,7 @@ CHIAKI_EXPORT void chiaki_video_receiver_init(ChiakiVideoReceiver *video_receive
 	video_receiver->packet_stats = packet_stats;
 
 	video_receiver->frames_lost = 0;
-	memset(video_receiver->reference_frames, -1, sizeof(video_receiver->reference_frames));
+	chiaki_ref_tracker_init(&video_receiver->ref_tracker, RECEIVER_REF_SLOTS);
 	chiaki_bitstream_init(&video_receiver->bitstream, video_receiver->log, video_receiver->session->connect_info.video_profile.codec);
 	video_receiver->gap_report_pending = false;
 	video_receiver->gap_report_start = 0;
@@ -201,10 +174,12 @@ CHIAKI_EXPORT void chiaki_video_receiver_init(ChiakiVideoReceiver *video_receive
 	video_receiver->idr_request_pending = false;
 	video_receiver->idr_request_start_ms = 0;
 	video_receiver->old_frame_rejects_window = 0;
+	video_receiver->av_video_stale_last = 0;
 	video_receiver->last_idr_request_ms = 0;
 	video_receiver->consecutive_missing_ref = 0;
 	video_receiver->cascade_skip_count = 0;
 	video_receiver->cascade_reset_attempts = 0;
+	video_receiver->predicted_idr_requests = 0;
 	video_receiver->prev_frame_first_packet_ms = 0;
 	video_receiver->cadence_min_ms = 0;
 	video_receiver->cadence_max_ms = 0;
@@ -276,7 +251,12 @@ CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_re
 		ChiakiVideoProfile *profile = video_receiver->profiles + video_receiver->profile_cur;
 		CHIAKI_LOGI(video_receiver->log, "Switched to profile %d, resolution: %ux%u", video_receiver->profile_cur, profile->width, profile->height);
 		if(video_receiver->session->video_sample_cb)
-			video_receiver->session->video_sample_cb(profile->header, profile->header_sz, 0, false, video_receiver->session->video_sample_cb_user);
+		{
+			ChiakiVideoSampleInfo info = { 0 };
+			info.frame_index = frame_index;
+			info.header = true;
+			video_receiver->session->video_sample_cb(profile->header, profile->header_sz, 0, false, &info, video_receiver->session->video_sample_cb_user);
+		}
 		if(!chiaki_bitstream_header(&video_receiver->bitstream, profile->header, profile->header_sz))
 			CHIAKI_LOGE(video_receiver->log, "Failed to parse video header");
 	}
@@ -324,6 +304,15 @@ CHIAKI_EXPORT void chiaki_video_receiver_av_packet(ChiakiVideoReceiver *video_re
 			video_receiver->gap_report_end = gap_state.end;
 			video_receiver->gap_report_deadline_ms = gap_state.deadline_ms;
 			flush_pending_gap_report(video_receiver, now_ms, false);
+
+			// If the gap took every usable reference with it, the incoming frame
+			// cannot decode. Ask for an IDR now instead of after assembling it.
+			chiaki_ref_tracker_mark_lost(&video_receiver->ref_tracker, next_frame_expected, gap_end);
+			if(chiaki_ref_tracker_predict(&video_receiver->ref_tracker, frame_index) == CHIAKI_REF_TRACKER_UNDECODABLE)
+			{
+				video_receiver->predicted_idr_requests++;
+				video_receiver_maybe_request_idr(video_receiver, now_ms, "predicted_undecodable");
+			}
 		}
 
 		video_receiver->frame_index_cur = frame_index;
@@ -427,6 +416,8 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 					(int)next_frame_expected,
 					(int)video_receiver->frame_index_cur);
 		}
+		chiaki_ref_tracker_mark_lost(&video_receiver->ref_tracker,
+			(ChiakiSeqNum16)video_receiver->frame_index_cur, (ChiakiSeqNum16)video_receiver->frame_index_cur);
 		video_receiver->frame_index_prev = video_receiver->frame_index_cur;
 		CHIAKI_LOGW(video_receiver->log, "Failed to complete frame %d", (int)video_receiver->frame_index_cur);
 		return CHIAKI_ERR_UNKNOWN;
@@ -434,10 +425,14 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 
 	bool succ = flush_result != CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED;
 	bool recovered = false;
+	chiaki_ref_tracker_mark_received(&video_receiver->ref_tracker, (ChiakiSeqNum16)video_receiver->frame_index_cur);
 
 	ChiakiBitstreamSlice slice;
+	ChiakiVideoSampleInfo info = { 0 };
+	info.frame_index = (ChiakiSeqNum16)video_receiver->frame_index_cur;
 	if(chiaki_bitstream_slice(&video_receiver->bitstream, frame, frame_size, &slice))
 	{
+		info.non_reference = slice.non_reference;
 		if(slice.slice_type == CHIAKI_BITSTREAM_SLICE_I)
 		{
 			video_receiver->consecutive_missing_ref = 0;
@@ -465,25 +460,26 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 		if(slice.slice_type == CHIAKI_BITSTREAM_SLICE_P)
 		{
 			ChiakiSeqNum16 ref_frame_index = video_receiver->frame_index_cur - slice.reference_frame - 1;
-			if(slice.reference_frame != 0xff && !have_ref_frame(video_receiver, ref_frame_index))
+			chiaki_ref_tracker_note_ref_distance(&video_receiver->ref_tracker, slice.reference_frame);
+			if(slice.reference_frame != 0xff && !chiaki_ref_tracker_has_ref(&video_receiver->ref_tracker, ref_frame_index))
 			{
-				for(unsigned i = slice.reference_frame + 1; i < RECEIVER_REF_SLOTS; i++)
+				unsigned alt_distance;
+				if(chiaki_ref_tracker_find_ref(&video_receiver->ref_tracker, (ChiakiSeqNum16)video_receiver->frame_index_cur,
+						slice.reference_frame + 1, &alt_distance))
 				{
-					ChiakiSeqNum16 ref_frame_index_new = video_receiver->frame_index_cur - i - 1;
-					if(have_ref_frame(video_receiver, ref_frame_index_new))
+					ChiakiSeqNum16 ref_frame_index_new = video_receiver->frame_index_cur - alt_distance - 1;
+					if(chiaki_bitstream_slice_set_reference_frame(&video_receiver->bitstream, frame, frame_size, alt_distance))
 					{
-						if(chiaki_bitstream_slice_set_reference_frame(&video_receiver->bitstream, frame, frame_size, i))
-						{
-							recovered = true;
-							video_receiver->consecutive_missing_ref = 0;
-							CHIAKI_LOGW(video_receiver->log, "Missing reference frame %d for decoding frame %d -> changed to %d", (int)ref_frame_index, (int)video_receiver->frame_index_cur, (int)ref_frame_index_new);
-						}
-						break;
+						recovered = true;
+						video_receiver->consecutive_missing_ref = 0;
+						CHIAKI_LOGW(video_receiver->log, "Missing reference frame %d for decoding frame %d -> changed to %d", (int)ref_frame_index, (int)video_receiver->frame_index_cur, (int)ref_frame_index_new);
 					}
 				}
 				if(!recovered)
 				{
 					succ = false;
+					chiaki_ref_tracker_mark_lost(&video_receiver->ref_tracker,
+						(ChiakiSeqNum16)video_receiver->frame_index_cur, (ChiakiSeqNum16)video_receiver->frame_index_cur);
 					video_receiver->frames_lost = saturating_add_u32(video_receiver->frames_lost, 1U);
 					chiaki_stream_connection_report_missing_ref(&video_receiver->session->stream_connection);
 					video_receiver->consecutive_missing_ref++;
@@ -503,7 +499,7 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 	if(succ && video_receiver->session->video_sample_cb)
 	{
 		uint64_t submit_start_ms = chiaki_time_now_monotonic_ms();
-		bool cb_succ = video_receiver->session->video_sample_cb(frame, frame_size, video_receiver->frames_lost, recovered, video_receiver->session->video_sample_cb_user);
+		bool cb_succ = video_receiver->session->video_sample_cb(frame, frame_size, video_receiver->frames_lost, recovered, &info, video_receiver->session->video_sample_cb_user);
 		uint64_t submit_end_ms = chiaki_time_now_monotonic_ms();
 		video_receiver->frames_lost = 0;
 		if(!cb_succ)
@@ -513,7 +509,7 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 		}
 		else
 		{
-			add_ref_frame(video_receiver, video_receiver->frame_index_cur);
+			chiaki_ref_tracker_mark_decoded(&video_receiver->ref_tracker, (ChiakiSeqNum16)video_receiver->frame_index_cur);
 			video_receiver->consecutive_missing_ref = 0;
 			CHIAKI_LOGV(video_receiver->log, "Added reference %c frame %d", slice.slice_type == CHIAKI_BITSTREAM_SLICE_I ? 'I' : 'P', (int)video_receiver->frame_index_cur);
 		}
@@ -541,12 +537,18 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 		uint64_t avg_submit_ms = frames > 0 ? video_receiver->stage_submit_total_ms / frames : 0;
 		uint64_t cadence_avg_ms = video_receiver->cadence_count > 0 ?
 			video_receiver->cadence_total_ms / video_receiver->cadence_count : 0;
+		// old frame packets mostly don't get here anymore, Takion drops them before
+		uint64_t av_video_stale = video_receiver->session->stream_connection.takion.av_video_stale;
+		if(av_video_stale >= video_receiver->av_video_stale_last)
+			video_receiver->old_frame_rejects_window += (uint32_t)(av_video_stale - video_receiver->av_video_stale_last);
+		video_receiver->av_video_stale_last = av_video_stale;
 		CHIAKI_LOGD(video_receiver->log,
-			"PIPE/STAGE frames=%u drops=%u skips=%u old_rejects=%u avg_assemble_ms=%llu avg_submit_ms=%llu cadence_min=%llu cadence_max=%llu cadence_avg=%llu",
+			"PIPE/STAGE frames=%u drops=%u skips=%u old_rejects=%u predicted_idr=%u avg_assemble_ms=%llu avg_submit_ms=%llu cadence_min=%llu cadence_max=%llu cadence_avg=%llu",
 			frames,
 			video_receiver->stage_window_drops,
 			video_receiver->cascade_skip_count,
 			video_receiver->old_frame_rejects_window,
+			video_receiver->predicted_idr_requests,
 			(unsigned long long)avg_assemble_ms,
 			(unsigned long long)avg_submit_ms,
 			(unsigned long long)video_receiver->cadence_min_ms,
@@ -573,6 +575,7 @@ static ChiakiErrorCode chiaki_video_receiver_flush_frame(ChiakiVideoReceiver *vi
 		video_receiver->stage_window_drops = 0;
 		video_receiver->old_frame_rejects_window = 0;
 		video_receiver->cascade_skip_count = 0;
+		video_receiver->predicted_idr_requests = 0;
 		video_receiver->cadence_min_ms = 0;
 		video_receiver->cadence_max_ms = 0;
 		video_receiver->cadence_total_ms = 0;
@@ -0,0 +1,392 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/wakeorchestrator.h>
+#include <chiaki/time.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#endif
+
+CHIAKI_EXPORT void chiaki_wake_config_defaults(ChiakiWakeConfig *config)
+{
+	memset(config, 0, sizeof(*config));
+	config->probe_min_ms = 50;
+	config->probe_max_ms = 200;
+	config->wakeup_retry_min_ms = 1000;
+	config->wakeup_retry_max_ms = 4000;
+	config->connect_retry_min_ms = 50;
+	config->connect_retry_max_ms = 400;
+	config->connect_attempts = 10;
+	config->timeout_ms = 60000;
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_wake_orchestrator_init(ChiakiWakeOrchestrator *orchestrator, ChiakiLog *log, const ChiakiWakeConfig *config)
+{
+	if(!config->host)
+		return CHIAKI_ERR_INVALID_DATA;
+
+	memset(orchestrator, 0, sizeof(*orchestrator));
+	orchestrator->log = log;
+	orchestrator->config = *config;
+	if(!orchestrator->config.probe_min_ms)
+		orchestrator->config.probe_min_ms = 1;
+	if(orchestrator->config.probe_max_ms < orchestrator->config.probe_min_ms)
+		orchestrator->config.probe_max_ms = orchestrator->config.probe_min_ms;
+	if(!orchestrator->config.wakeup_retry_min_ms)
+		orchestrator->config.wakeup_retry_min_ms = 1;
+	if(orchestrator->config.wakeup_retry_max_ms < orchestrator->config.wakeup_retry_min_ms)
+		orchestrator->config.wakeup_retry_max_ms = orchestrator->config.wakeup_retry_min_ms;
+	if(orchestrator->config.connect_retry_max_ms < orchestrator->config.connect_retry_min_ms)
+		orchestrator->config.connect_retry_max_ms = orchestrator->config.connect_retry_min_ms;
+	if(!orchestrator->config.connect_attempts)
+		orchestrator->config.connect_attempts = 1;
+
+	orchestrator->host = strdup(config->host);
+	if(!orchestrator->host)
+		return CHIAKI_ERR_MEMORY;
+	orchestrator->config.host = orchestrator->host;
+
+	ChiakiErrorCode err = chiaki_stop_pipe_init(&orchestrator->stop_pipe);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_host;
+
+	err = chiaki_mutex_init(&orchestrator->mutex, false);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto error_stop_pipe;
+
+	orchestrator->step = CHIAKI_WAKE_STEP_WAKE;
+	return CHIAKI_ERR_SUCCESS;
+
+error_stop_pipe:
+	chiaki_stop_pipe_fini(&orchestrator->stop_pipe);
+error_host:
+	free(orchestrator->host);
+	orchestrator->host = NULL;
+	return err;
+}
+
+CHIAKI_EXPORT void chiaki_wake_orchestrator_fini(ChiakiWakeOrchestrator *orchestrator)
+{
+	chiaki_mutex_fini(&orchestrator->mutex);
+	chiaki_stop_pipe_fini(&orchestrator->stop_pipe);
+	free(orchestrator->host);
+	orchestrator->host = NULL;
+}
+
+CHIAKI_EXPORT void chiaki_wake_orchestrator_cancel(ChiakiWakeOrchestrator *orchestrator)
+{
+	chiaki_stop_pipe_stop(&orchestrator->stop_pipe);
+}
+
+CHIAKI_EXPORT ChiakiWakeStep chiaki_wake_orchestrator_step(ChiakiWakeOrchestrator *orchestrator)
+{
+	chiaki_mutex_lock(&orchestrator->mutex);
+	ChiakiWakeStep step = orchestrator->step;
+	chiaki_mutex_unlock(&orchestrator->mutex);
+	return step;
+}
+
+CHIAKI_EXPORT const char *chiaki_wake_step_string(ChiakiWakeStep step)
+{
+	switch(step)
+	{
+		case CHIAKI_WAKE_STEP_WAKE:
+			return "wake";
+		case CHIAKI_WAKE_STEP_BOOT:
+			return "boot";
+		case CHIAKI_WAKE_STEP_CONNECT:
+			return "connect";
+		default:
+			return "unknown";
+	}
+}
+
+static uint64_t backoff(uint64_t delay_ms, uint64_t max_ms)
+{
+	delay_ms *= 2;
+	return delay_ms > max_ms ? max_ms : delay_ms;
+}
+
+/**
+ * Finish the current step and start the next one, both at now_ms.
+ * Must be called with mutex locked.
+ */
+static void step_advance(ChiakiWakeOrchestrator *orchestrator, ChiakiWakeStep next, uint64_t now_ms)
+{
+	ChiakiWakeStepTiming *cur = &orchestrator->timeline.steps[orchestrator->step];
+	cur->duration_ms = now_ms - cur->start_ms;
+	cur->done = true;
+	orchestrator->step = next;
+	ChiakiWakeStepTiming *timing = &orchestrator->timeline.steps[next];
+	timing->start_ms = now_ms;
+	timing->started = true;
+}
+
+static void count_attempt(ChiakiWakeOrchestrator *orchestrator)
+{
+	chiaki_mutex_lock(&orchestrator->mutex);
+	orchestrator->timeline.steps[orchestrator->step].attempts++;
+	chiaki_mutex_unlock(&orchestrator->mutex);
+}
+
+static ChiakiErrorCode wake_resolve(ChiakiWakeOrchestrator *orchestrator, struct sockaddr_in6 *addr, socklen_t *addr_len)
+{
+	struct addrinfo *addrinfos;
+	int r = getaddrinfo(orchestrator->host, NULL, NULL, &addrinfos);
+	if(r != 0)
+	{
+		CHIAKI_LOGE(orchestrator->log, "Wake failed to getaddrinfo for %s", orchestrator->host);
+		return CHIAKI_ERR_NETWORK;
+	}
+	*addr_len = 0;
+	for(struct addrinfo *ai=addrinfos; ai; ai=ai->ai_next)
+	{
+		if(ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+			continue;
+		if(ai->ai_addrlen > sizeof(*addr))
+			continue;
+		memset(addr, 0, sizeof(*addr));
+		memcpy(addr, ai->ai_addr, ai->ai_addrlen);
+		*addr_len = (socklen_t)ai->ai_addrlen;
+		break;
+	}
+	freeaddrinfo(addrinfos);
+
+	if(!*addr_len)
+	{
+		CHIAKI_LOGE(orchestrator->log, "Wake failed to get a suitable address for %s", orchestrator->host);
+		return CHIAKI_ERR_UNKNOWN;
+	}
+
+	uint16_t port = orchestrator->config.port;
+	if(!port)
+		port = orchestrator->config.ps5 ? CHIAKI_DISCOVERY_PORT_PS5 : CHIAKI_DISCOVERY_PORT_PS4;
+	if(((struct sockaddr *)addr)->sa_family == AF_INET)
+		((struct sockaddr_in *)addr)->sin_port = htons(port);
+	else
+		addr->sin6_port = htons(port);
+	return CHIAKI_ERR_SUCCESS;
+}
+
+static bool wake_addr_match(const struct sockaddr *a, const struct sockaddr *b)
+{
+	if(a->sa_family != b->sa_family)
+		return false;
+	if(a->sa_family == AF_INET)
+		return ((const struct sockaddr_in *)a)->sin_addr.s_addr == ((const struct sockaddr_in *)b)->sin_addr.s_addr;
+	if(a->sa_family == AF_INET6)
+		return !memcmp(&((const struct sockaddr_in6 *)a)->sin6_addr, &((const struct sockaddr_in6 *)b)->sin6_addr, sizeof(struct in6_addr));
+	return false;
+}
+
+/**
+ * Wakeup and probe until the console reports ready. host points into buf and addr_buf afterwards.
+ */
+static ChiakiErrorCode wake_until_ready(ChiakiWakeOrchestrator *orchestrator, ChiakiDiscovery *discovery,
+	struct sockaddr *addr, socklen_t addr_len, uint64_t start_ms,
+	char *buf, size_t buf_size, char *addr_buf, size_t addr_buf_size, ChiakiDiscoveryHost *host)
+{
+	const ChiakiWakeConfig *config = &orchestrator->config;
+
+	ChiakiDiscoveryPacket srch = { 0 };
+	srch.cmd = CHIAKI_DISCOVERY_CMD_SRCH;
+	srch.protocol_version = config->ps5 ? CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS5 : CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS4;
+	ChiakiDiscoveryPacket wakeup = srch;
+	wakeup.cmd = CHIAKI_DISCOVERY_CMD_WAKEUP;
+	wakeup.user_credential = config->user_credential;
+
+	uint64_t deadline_ms = start_ms + config->timeout_ms;
+	uint64_t probe_delay_ms = config->probe_min_ms;
+	uint64_t next_probe_ms = start_ms;
+	uint64_t wakeup_delay_ms = config->wakeup_retry_min_ms;
+	uint64_t next_wakeup_ms = start_ms;
+
+	while(true)
+	{
+		uint64_t now_ms = chiaki_time_now_monotonic_ms();
+		if(now_ms >= deadline_ms)
+		{
+			CHIAKI_LOGE(orchestrator->log, "Wake timed out, %s did not report ready after %llu ms",
+				orchestrator->host, (unsigned long long)(now_ms - start_ms));
+			return CHIAKI_ERR_TIMEOUT;
+		}
+
+		// WAKEUP goes out before the first SRCH, so a console in rest mode answers the probes
+		// as soon as it can
+		if(now_ms >= next_wakeup_ms)
+		{
+			if(chiaki_discovery_send(discovery, &wakeup, addr, addr_len) == CHIAKI_ERR_SUCCESS)
+			{
+				chiaki_mutex_lock(&orchestrator->mutex);
+				orchestrator->timeline.wakeups++;
+				chiaki_mutex_unlock(&orchestrator->mutex);
+			}
+			next_wakeup_ms = now_ms + wakeup_delay_ms;
+			wakeup_delay_ms = backoff(wakeup_delay_ms, config->wakeup_retry_max_ms);
+		}
+
+		if(now_ms >= next_probe_ms)
+		{
+			if(chiaki_discovery_send(discovery, &srch, addr, addr_len) == CHIAKI_ERR_SUCCESS)
+				count_attempt(orchestrator);
+			next_probe_ms = now_ms + probe_delay_ms;
+			probe_delay_ms = backoff(probe_delay_ms, config->probe_max_ms);
+		}
+
+		uint64_t wait_until_ms = next_probe_ms;
+		if(next_wakeup_ms < wait_until_ms)
+			wait_until_ms = next_wakeup_ms;
+		if(deadline_ms < wait_until_ms)
+			wait_until_ms = deadline_ms;
+		ChiakiErrorCode err = chiaki_stop_pipe_select_single(&orchestrator->stop_pipe, discovery->socket, false,
+			wait_until_ms > now_ms ? wait_until_ms - now_ms : 0);
+		if(err == CHIAKI_ERR_TIMEOUT)
+			continue;
+		if(err != CHIAKI_ERR_SUCCESS)
+			return err;
+
+		struct sockaddr_in6 from;
+		socklen_t from_len = sizeof(from);
+		int n = recvfrom(discovery->socket, buf, buf_size - 1, 0, (struct sockaddr *)&from, &from_len);
+		if(n <= 0)
+			continue; // unicast probes to a console that isn't listening yet may come back as ICMP errors
+		buf[n] = '\0';
+		if(!wake_addr_match((struct sockaddr *)&from, addr))
+			continue;
+		if(chiaki_discovery_srch_response_parse(host, (struct sockaddr *)&from, addr_buf, addr_buf_size, buf, (size_t)n) != CHIAKI_ERR_SUCCESS)
+		{
+			CHIAKI_LOGI(orchestrator->log, "Wake got an invalid discovery response");
+			continue;
+		}
+
+		now_ms = chiaki_time_now_monotonic_ms();
+		bool ready = host->state == CHIAKI_DISCOVERY_HOST_STATE_READY;
+		chiaki_mutex_lock(&orchestrator->mutex);
+		orchestrator->timeline.responses++;
+		if(orchestrator->step == CHIAKI_WAKE_STEP_WAKE)
+		{
+			orchestrator->timeline.was_ready = ready;
+			step_advance(orchestrator, CHIAKI_WAKE_STEP_BOOT, now_ms - start_ms);
+			CHIAKI_LOGI(orchestrator->log, "Wake: %s answered after %llu ms, %s",
+				orchestrator->host, (unsigned long long)(now_ms - start_ms),
+				chiaki_discovery_host_state_string(host->state));
+		}
+		if(ready)
+			step_advance(orchestrator, CHIAKI_WAKE_STEP_CONNECT, now_ms - start_ms);
+		chiaki_mutex_unlock(&orchestrator->mutex);
+
+		if(ready)
+			return CHIAKI_ERR_SUCCESS;
+	}
+}
+
+static ChiakiErrorCode wake_connect(ChiakiWakeOrchestrator *orchestrator, const ChiakiDiscoveryHost *host, uint64_t start_ms)
+{
+	const ChiakiWakeConfig *config = &orchestrator->config;
+	uint64_t delay_ms = config->connect_retry_min_ms;
+	ChiakiErrorCode err;
+	for(unsigned attempt=1; ; attempt++)
+	{
+		count_attempt(orchestrator);
+		err = config->connect(config->connect_user, host);
+		if(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_CANCELED || attempt >= config->connect_attempts)
+			break;
+
+		CHIAKI_LOGI(orchestrator->log, "Wake connect attempt %u failed: %s, retrying in %llu ms",
+			attempt, chiaki_error_string(err), (unsigned long long)delay_ms);
+		if(chiaki_stop_pipe_sleep(&orchestrator->stop_pipe, delay_ms) != CHIAKI_ERR_TIMEOUT)
+		{
+			err = CHIAKI_ERR_CANCELED;
+			break;
+		}
+		delay_ms = backoff(delay_ms, config->connect_retry_max_ms);
+	}
+
+	if(err == CHIAKI_ERR_SUCCESS)
+	{
+		chiaki_mutex_lock(&orchestrator->mutex);
+		ChiakiWakeStepTiming *timing = &orchestrator->timeline.steps[CHIAKI_WAKE_STEP_CONNECT];
+		timing->duration_ms = chiaki_time_now_monotonic_ms() - start_ms - timing->start_ms;
+		timing->done = true;
+		chiaki_mutex_unlock(&orchestrator->mutex);
+	}
+	return err;
+}
+
+static void wake_log_timeline(ChiakiWakeOrchestrator *orchestrator, const ChiakiWakeTimeline *timeline, ChiakiErrorCode err)
+{
+	const ChiakiWakeStepTiming *wake = &timeline->steps[CHIAKI_WAKE_STEP_WAKE];
+	const ChiakiWakeStepTiming *boot = &timeline->steps[CHIAKI_WAKE_STEP_BOOT];
+	const ChiakiWakeStepTiming *connect = &timeline->steps[CHIAKI_WAKE_STEP_CONNECT];
+	CHIAKI_LOGI(orchestrator->log, "Wake %s after %llu ms: wake %llu ms (%u probes, %u wakeups), boot %llu ms (%u probes), connect %llu ms (%u attempts)",
+		err == CHIAKI_ERR_SUCCESS ? "done" : chiaki_error_string(err),
+		(unsigned long long)timeline->total_ms,
+		(unsigned long long)wake->duration_ms, wake->attempts, timeline->wakeups,
+		(unsigned long long)boot->duration_ms, boot->attempts,
+		(unsigned long long)connect->duration_ms, connect->attempts);
+}
+
+CHIAKI_EXPORT ChiakiErrorCode chiaki_wake_orchestrator_run(ChiakiWakeOrchestrator *orchestrator, ChiakiWakeTimeline *timeline)
+{
+	uint64_t start_ms = chiaki_time_now_monotonic_ms();
+
+	chiaki_mutex_lock(&orchestrator->mutex);
+	memset(&orchestrator->timeline, 0, sizeof(orchestrator->timeline));
+	orchestrator->step = CHIAKI_WAKE_STEP_WAKE;
+	orchestrator->timeline.steps[CHIAKI_WAKE_STEP_WAKE].started = true;
+	chiaki_mutex_unlock(&orchestrator->mutex);
+
+	struct sockaddr_in6 addr;
+	socklen_t addr_len;
+	ChiakiErrorCode err = wake_resolve(orchestrator, &addr, &addr_len);
+	if(err != CHIAKI_ERR_SUCCESS)
+		goto done;
+
+	ChiakiDiscovery discovery;
+	err = chiaki_discovery_init(&discovery, orchestrator->log, ((struct sockaddr *)&addr)->sa_family);
+	if(err != CHIAKI_ERR_SUCCESS)
+	{
+		CHIAKI_LOGE(orchestrator->log, "Wake failed to init discovery: %s", chiaki_error_string(err));
+		goto done;
+	}
+
+	// The connect function gets the response, so it has to stay around until then
+	char buf[512];
+	char addr_buf[64];
+	ChiakiDiscoveryHost host;
+	err = wake_until_ready(orchestrator, &discovery, (struct sockaddr *)&addr, addr_len, start_ms,
+		buf, sizeof(buf), addr_buf, sizeof(addr_buf), &host);
+	chiaki_discovery_fini(&discovery);
+
+	if(err == CHIAKI_ERR_SUCCESS && orchestrator->config.connect)
+		err = wake_connect(orchestrator, &host, start_ms);
+
+done:
+	chiaki_mutex_lock(&orchestrator->mutex);
+	ChiakiWakeTimeline *result = &orchestrator->timeline;
+	result->total_ms = chiaki_time_now_monotonic_ms() - start_ms;
+	for(size_t i=0; i<CHIAKI_WAKE_STEP_COUNT; i++)
+	{
+		ChiakiWakeStepTiming *timing = &result->steps[i];
+		if(timing->started && !timing->done)
+			timing->duration_ms = result->total_ms - timing->start_ms;
+	}
+	if(!orchestrator->config.connect && err == CHIAKI_ERR_SUCCESS)
+		result->steps[CHIAKI_WAKE_STEP_CONNECT].done = true;
+	ChiakiWakeTimeline copy = *result;
+	chiaki_mutex_unlock(&orchestrator->mutex);
+
+	wake_log_timeline(orchestrator, &copy, err);
+	if(timeline)
+		*timeline = copy;
+	return err;
+}
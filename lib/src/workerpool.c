@@ -0,0 +1,204 @@
+// SPDX-License-Identifier: LicenseRef-AGPL-3.0-only-OpenSSL
+
+#include <chiaki/workerpool.h>
+#include <chiaki/time.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+static void account_charge(ChiakiWorkerAccount *account, uint64_t wait_us, uint64_t busy_us)
+{
+	account->jobs++;
+	account->busy_us += busy_us;
+	account->wait_us += wait_us;
+	if(wait_us > account->wait_max_us)
+		account->wait_max_us = wait_us;
+}
+
+static void queue_push(ChiakiWorkerPool *pool, ChiakiWorkerJob *job)
+{
+	job->state = CHIAKI_WORKER_JOB_QUEUED;
+	job->queued_us = chiaki_time_now_monotonic_us();
+	job->next = NULL;
+	if(pool->queue_tail)
+		pool->queue_tail->next = job;
+	else
+		pool->queue_head = job;
+	pool->queue_tail = job;
+	pool->queued++;
+	if(pool->queued > pool->queued_max)
+		pool->queued_max = pool->queued;
+	chiaki_cond_signal(&pool->job_cond);
+}
+
+static void *worker_thread_func(void *user)
+{
+	ChiakiWorkerPool *pool = user;
+
+	chiaki_mutex_lock(&pool->mutex);
+	while(!pool->stop)
+	{
+		ChiakiWorkerJob *job = pool->queue_head;
+		if(!job)
+		{
+			chiaki_cond_wait(&pool->job_cond, &pool->mutex);
+			continue;
+		}
+		pool->queue_head = job->next;
+		if(!pool->queue_head)
+			pool->queue_tail = NULL;
+		pool->queued--;
+		job->next = NULL;
+		job->state = CHIAKI_WORKER_JOB_RUNNING;
+		job->rerun = false;
+		uint64_t start_us = chiaki_time_now_monotonic_us();
+		uint64_t wait_us = start_us - job->queued_us;
+		chiaki_mutex_unlock(&pool->mutex);
+
+		job->func(job->user);
+		uint64_t busy_us = chiaki_time_now_monotonic_us() - start_us;
+
+		chiaki_mutex_lock(&pool->mutex);
+		account_charge(&pool->total, wait_us, busy_us);
+		if(job->account)
+			account_charge(job->account, wait_us, busy_us);
+		// to the back, so one busy session can't starve the others
+		if(job->rerun)
+			queue_push(pool, job);
+		else
+			job->state = CHIAKI_WORKER_JOB_IDLE;
+		chiaki_cond_broadcast(&pool->done_cond);
+	}
+	chiaki_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+CHIAKI_EXPORT ChiakiWorkerPool *chiaki_worker_pool_new(unsigned int workers, ChiakiThreadRole role, ChiakiLog *log)
+{
+	if(!workers)
+		return NULL;
+	if(workers > CHIAKI_WORKER_POOL_WORKERS_MAX)
+		workers = CHIAKI_WORKER_POOL_WORKERS_MAX;
+
+	ChiakiWorkerPool *pool = calloc(1, sizeof(ChiakiWorkerPool));
+	if(!pool)
+		return NULL;
+	pool->log = log;
+
+	if(chiaki_mutex_init(&pool->mutex, false) != CHIAKI_ERR_SUCCESS)
+		goto error_alloc;
+	if(chiaki_cond_init(&pool->job_cond, &pool->mutex) != CHIAKI_ERR_SUCCESS)
+		goto error_mutex;
+	if(chiaki_cond_init(&pool->done_cond, &pool->mutex) != CHIAKI_ERR_SUCCESS)
+		goto error_job_cond;
+
+	for(; pool->workers_count < workers; pool->workers_count++)
+	{
+		ChiakiThread *worker = &pool->workers[pool->workers_count];
+		if(chiaki_thread_create_role(worker, role, worker_thread_func, pool) != CHIAKI_ERR_SUCCESS)
+			goto error_workers;
+		chiaki_thread_set_name(worker, "Chiaki Worker");
+	}
+	CHIAKI_LOGI(log, "Worker pool started with %u threads", pool->workers_count);
+	return pool;
+
+error_workers:
+	CHIAKI_LOGE(log, "Worker pool failed to create worker thread %u", pool->workers_count);
+	chiaki_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	chiaki_cond_broadcast(&pool->job_cond);
+	chiaki_mutex_unlock(&pool->mutex);
+	while(pool->workers_count > 0)
+		chiaki_thread_join(&pool->workers[--pool->workers_count], NULL);
+	chiaki_cond_fini(&pool->done_cond);
+error_job_cond:
+	chiaki_cond_fini(&pool->job_cond);
+error_mutex:
+	chiaki_mutex_fini(&pool->mutex);
+error_alloc:
+	free(pool);
+	return NULL;
+}
+
+CHIAKI_EXPORT void chiaki_worker_pool_free(ChiakiWorkerPool *pool)
+{
+	if(!pool)
+		return;
+	chiaki_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	chiaki_cond_broadcast(&pool->job_cond);
+	chiaki_mutex_unlock(&pool->mutex);
+	for(size_t i = 0; i < pool->workers_count; i++)
+		chiaki_thread_join(&pool->workers[i], NULL);
+	if(pool->queue_head)
+		CHIAKI_LOGW(pool->log, "Worker pool freed with %llu jobs still queued", (unsigned long long)pool->queued);
+	chiaki_cond_fini(&pool->done_cond);
+	chiaki_cond_fini(&pool->job_cond);
+	chiaki_mutex_fini(&pool->mutex);
+	free(pool);
+}
+
+CHIAKI_EXPORT void chiaki_worker_job_init(ChiakiWorkerJob *job, ChiakiWorkerJobFunc func, void *user, ChiakiWorkerAccount *account)
+{
+	memset(job, 0, sizeof(*job));
+	job->func = func;
+	job->user = user;
+	job->account = account;
+	job->state = CHIAKI_WORKER_JOB_IDLE;
+}
+
+CHIAKI_EXPORT void chiaki_worker_pool_submit(ChiakiWorkerPool *pool, ChiakiWorkerJob *job)
+{
+	chiaki_mutex_lock(&pool->mutex);
+	switch(job->state)
+	{
+		case CHIAKI_WORKER_JOB_IDLE:
+			queue_push(pool, job);
+			break;
+		case CHIAKI_WORKER_JOB_QUEUED:
+			break;
+		case CHIAKI_WORKER_JOB_RUNNING:
+			job->rerun = true;
+			break;
+	}
+	chiaki_mutex_unlock(&pool->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_worker_pool_cancel(ChiakiWorkerPool *pool, ChiakiWorkerJob *job)
+{
+	chiaki_mutex_lock(&pool->mutex);
+	for(;;)
+	{
+		if(job->state == CHIAKI_WORKER_JOB_RUNNING)
+		{
+			job->rerun = false;
+			chiaki_cond_wait(&pool->done_cond, &pool->mutex);
+			continue;
+		}
+		if(job->state == CHIAKI_WORKER_JOB_QUEUED)
+		{
+			ChiakiWorkerJob **link = &pool->queue_head;
+			ChiakiWorkerJob *prev = NULL;
+			while(*link != job)
+			{
+				prev = *link;
+				link = &(*link)->next;
+			}
+			*link = job->next;
+			if(pool->queue_tail == job)
+				pool->queue_tail = prev;
+			pool->queued--;
+			job->next = NULL;
+			job->state = CHIAKI_WORKER_JOB_IDLE;
+		}
+		break;
+	}
+	chiaki_mutex_unlock(&pool->mutex);
+}
+
+CHIAKI_EXPORT void chiaki_worker_pool_account(ChiakiWorkerPool *pool, const ChiakiWorkerAccount *account, ChiakiWorkerAccount *out)
+{
+	chiaki_mutex_lock(&pool->mutex);
+	*out = *account;
+	chiaki_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,288 @@
+/*
+ * avsync_tests.c — Unit tests for ChiakiAvSync and ChiakiAvResampler
+ * (lib/src/avsync.c).
+ *
+ * Timelines are generated on a virtual clock: the console sends 10 ms audio
+ * units and 60 fps video frames, which arrive after a fixed delay plus an
+ * optional jitter pattern, and optionally on a drifting clock. Covers the
+ * offset estimate, holds, the drift and resample ratio, the audio target
+ * following the video, restarts and index wraparound.
+ * test/bench/avsync_bench.c measures the sync error over impaired networks.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chiaki/avsync.h>
+
+#define AUDIO_FRAME_US 10000
+#define NET_DELAY_US 5000
+#define T0_US 1000000ULL
+
+static ChiakiAvSync *new_sync(void) {
+  ChiakiAvSyncConfig config;
+  chiaki_av_sync_config_defaults(&config);
+  ChiakiAvSync *sync = chiaki_av_sync_new(&config);
+  assert(sync);
+  return sync;
+}
+
+static int64_t abs64(int64_t v) {
+  return v < 0 ? -v : v;
+}
+
+/* Local arrival of something the console sent at sent_us on its own clock,
+ * drift_ppm faster than the local one. */
+static uint64_t arrival(uint64_t sent_us, double drift_ppm, uint64_t jitter_us) {
+  return T0_US + (uint64_t)((double)sent_us / (1.0 + drift_ppm / 1e6)) + NET_DELAY_US + jitter_us;
+}
+
+/* Sends audio and video for the console's time [from_us, to_us), playing the
+ * audio out with buffered_us in the device after every unit. Video is
+ * reported but not presented. */
+static void run(ChiakiAvSync *sync, uint64_t from_us, uint64_t to_us, double drift_ppm, uint64_t buffered_us,
+                uint64_t jitter_us) {
+  uint64_t a = from_us / AUDIO_FRAME_US, v = from_us * 60 / 1000000;
+  while (true) {
+    uint64_t a_sent = a * AUDIO_FRAME_US, v_sent = v * 1000000 / 60;
+    if (a_sent >= to_us && v_sent >= to_us)
+      break;
+    if (a_sent <= v_sent) {
+      uint64_t t = arrival(a_sent, drift_ppm, (a % 7) * jitter_us / 6);
+      chiaki_av_sync_audio_frame(sync, (uint16_t)a, AUDIO_FRAME_US, t);
+      chiaki_av_sync_audio_playout(sync, buffered_us, t);
+      a++;
+    } else {
+      chiaki_av_sync_video_frame(sync, (uint16_t)v, arrival(v_sent, drift_ppm, (v % 5) * jitter_us / 4));
+      v++;
+    }
+  }
+}
+
+static void test_offset_and_hold(void) {
+  ChiakiAvSync *sync = new_sync();
+  // before any audio there is nothing to sync to
+  chiaki_av_sync_video_frame(sync, 0, arrival(0, 0, 0));
+  assert(chiaki_av_sync_video_hold(sync, 0, arrival(0, 0, 0)) == 0);
+
+  run(sync, 0, 1000000, 0, 40000, 0);
+  ChiakiAvSyncStats stats;
+  chiaki_av_sync_stats(sync, &stats);
+  // the last unit ends 10 ms after it was sent, 40 ms are buffered before it
+  assert(abs64(stats.audio_latency_us - 30000) < 100);
+  assert(stats.audio_frames == 100);
+  assert(stats.video_frames == 60);
+
+  // frame 60 presented right when it arrives is 30 ms ahead of the audio
+  uint64_t t = arrival(1000000, 0, 0);
+  chiaki_av_sync_video_frame(sync, 60, t);
+  assert(chiaki_av_sync_video_hold(sync, 60, t) == 12000);
+  assert(chiaki_av_sync_video_hold(sync, 60, t + 5000) == 7000);
+  assert(chiaki_av_sync_video_hold(sync, 60, t + 12000) == 0);
+  chiaki_av_sync_video_presented(sync, 60, t + 12000);
+  chiaki_av_sync_stats(sync, &stats);
+  assert(stats.presents == 1 && stats.held == 1 && stats.late == 0);
+  assert(abs64(stats.sync_error_us + 18000) < 100);
+  assert(abs64(stats.video_latency_us - 12000) < 100);
+
+  // a frame behind the audio is not held and counted late
+  t = arrival(1000000 + 16667, 0, 0) + 45000;
+  chiaki_av_sync_video_frame(sync, 61, t);
+  assert(chiaki_av_sync_video_hold(sync, 61, t) == 0);
+  chiaki_av_sync_video_presented(sync, 61, t);
+  chiaki_av_sync_stats(sync, &stats);
+  assert(stats.held == 1 && stats.late == 1);
+  assert(abs64(stats.sync_error_us - 15000) < 100);
+  chiaki_av_sync_free(sync);
+}
+
+static void test_envelope(void) {
+  // jitter only ever adds delay, the envelope finds the undelayed arrivals
+  ChiakiAvSync *sync = new_sync();
+  run(sync, 0, 2000000, 0, 40000, 6000);
+  uint64_t t = arrival(2000000, 0, 0);
+  chiaki_av_sync_audio_frame(sync, 200, AUDIO_FRAME_US, t);
+  chiaki_av_sync_audio_playout(sync, 40000, t);
+  chiaki_av_sync_video_frame(sync, 120, t);
+  // audio about 30 ms behind plus the smoothed jitter of the playouts before
+  uint64_t hold = chiaki_av_sync_video_hold(sync, 120, t + 20000);
+  chiaki_av_sync_video_presented(sync, 120, t + 20000 + hold);
+  ChiakiAvSyncStats stats;
+  chiaki_av_sync_stats(sync, &stats);
+  assert(hold == 12000);
+  assert(abs64(stats.sync_error_us) < 3000);
+  assert(abs64(stats.drift_ppm) < 5.0);
+  chiaki_av_sync_free(sync);
+}
+
+static void test_drift(void) {
+  ChiakiAvSync *sync = new_sync();
+  // the console's clock runs 200 ppm fast, its audio piles up locally
+  run(sync, 0, 20000000, 200, 40000, 2000);
+  ChiakiAvSyncStats stats;
+  chiaki_av_sync_stats(sync, &stats);
+  assert(abs64((int64_t)(stats.drift_ppm - 200.0)) < 10);
+  // buffered at the target, the ratio only compensates the drift
+  assert(stats.resample_ratio > 1.00019 && stats.resample_ratio < 1.00021);
+  chiaki_av_sync_free(sync);
+
+  sync = new_sync();
+  run(sync, 0, 20000000, -300, 40000, 0);
+  chiaki_av_sync_stats(sync, &stats);
+  assert(abs64((int64_t)(stats.drift_ppm + 300.0)) < 10);
+  assert(stats.resample_ratio < 0.99971 && stats.resample_ratio > 0.99969);
+  chiaki_av_sync_free(sync);
+}
+
+static void test_ratio(void) {
+  ChiakiAvSync *sync = new_sync();
+  run(sync, 0, 1000000, 0, 60000, 0);
+  // 20 ms over target drains at 0.2%
+  double ratio = chiaki_av_sync_resample_ratio(sync);
+  assert(ratio > 1.0019 && ratio < 1.0021);
+  // far over target it stays within 0.5%
+  run(sync, 1000000, 2000000, 0, 500000, 0);
+  assert(chiaki_av_sync_resample_ratio(sync) == 1.0 + 0.005);
+  // an empty buffer fills at 0.4%
+  run(sync, 2000000, 4000000, 0, 0, 0);
+  ratio = chiaki_av_sync_resample_ratio(sync);
+  assert(ratio > 0.9959 && ratio < 0.9961);
+  chiaki_av_sync_free(sync);
+}
+
+/* Presents every frame late_us after it arrives, playing audio out with
+ * however much the resample ratio leaves buffered. */
+static void run_presenting(ChiakiAvSync *sync, uint64_t seconds, uint64_t late_us, uint64_t *buffered_us) {
+  double buffered = (double)*buffered_us;
+  for (uint64_t v = 0; v < seconds * 60; v++) {
+    uint64_t v_sent = v * 1000000 / 60;
+    for (uint64_t a = (v_sent + AUDIO_FRAME_US - 1) / AUDIO_FRAME_US; a * AUDIO_FRAME_US < v_sent + 16667; a++) {
+      uint64_t t = arrival(a * AUDIO_FRAME_US, 0, 0);
+      chiaki_av_sync_audio_frame(sync, (uint16_t)a, AUDIO_FRAME_US, t);
+      double ratio = chiaki_av_sync_audio_playout(sync, (uint64_t)buffered, t);
+      buffered += AUDIO_FRAME_US / ratio - AUDIO_FRAME_US;
+    }
+    uint64_t t = arrival(v_sent, 0, 0);
+    chiaki_av_sync_video_frame(sync, (uint16_t)v, t);
+    t += late_us;
+    t += chiaki_av_sync_video_hold(sync, (uint16_t)v, t);
+    chiaki_av_sync_video_presented(sync, (uint16_t)v, t);
+  }
+  *buffered_us = (uint64_t)buffered;
+}
+
+static void test_target_follows_video(void) {
+  // video 50 ms behind arrival, audio buffers 40 ms: raise the audio latency
+  ChiakiAvSync *sync = new_sync();
+  uint64_t buffered = 40000;
+  run_presenting(sync, 30, 50000, &buffered);
+  ChiakiAvSyncStats stats;
+  chiaki_av_sync_stats(sync, &stats);
+  assert(stats.audio_target_us > 55000 && stats.audio_target_us < 65000);
+  assert(buffered > 55000 && buffered < 65000);
+  assert(abs64(stats.sync_error_us) < 2000);
+  chiaki_av_sync_free(sync);
+
+  // video right away, audio buffers 80 ms: lower the target, to no less than 20 ms
+  sync = new_sync();
+  buffered = 80000;
+  run_presenting(sync, 30, 0, &buffered);
+  chiaki_av_sync_stats(sync, &stats);
+  assert(stats.audio_target_us == 20000);
+  assert(buffered < 25000);
+  assert(stats.held > 1000);
+  chiaki_av_sync_free(sync);
+}
+
+static void test_restart(void) {
+  ChiakiAvSync *sync = new_sync();
+  run(sync, 0, 1000000, 0, 40000, 0);
+  // the stream stalls for a second, then starts over from index 0
+  uint64_t t = arrival(2000000, 0, 0);
+  chiaki_av_sync_video_frame(sync, 0, t);
+  assert(chiaki_av_sync_video_hold(sync, 0, t) == 0);
+  chiaki_av_sync_audio_frame(sync, 0, AUDIO_FRAME_US, t);
+  chiaki_av_sync_audio_playout(sync, 40000, t);
+  ChiakiAvSyncStats stats;
+  chiaki_av_sync_stats(sync, &stats);
+  assert(stats.restarts == 2);
+  assert(abs64(stats.audio_latency_us - 30000) < 100);
+  // late and duplicate units are ignored
+  chiaki_av_sync_audio_frame(sync, 0, AUDIO_FRAME_US, t + 10);
+  chiaki_av_sync_audio_frame(sync, 65535, AUDIO_FRAME_US, t + 20);
+  chiaki_av_sync_stats(sync, &stats);
+  assert(stats.audio_frames == 101);
+
+  chiaki_av_sync_reset(sync);
+  assert(chiaki_av_sync_video_hold(sync, 1, t + 20000) == 0);
+  chiaki_av_sync_free(sync);
+}
+
+static void test_wrap(void) {
+  // 11 minutes of audio wrap its 16 bit indices
+  ChiakiAvSync *sync = new_sync();
+  run(sync, 650000000, 660000000, 0, 40000, 0);
+  ChiakiAvSyncStats stats;
+  chiaki_av_sync_stats(sync, &stats);
+  assert(stats.restarts == 0);
+  assert(abs64(stats.audio_latency_us - 30000) < 100);
+  chiaki_av_sync_free(sync);
+}
+
+static void test_resampler(void) {
+  ChiakiAvResampler rs;
+  assert(chiaki_av_resampler_init(&rs, 0) == CHIAKI_ERR_INVALID_DATA);
+  assert(chiaki_av_resampler_init(&rs, 2) == CHIAKI_ERR_SUCCESS);
+  int16_t in[2 * 480], out[2 * 1024];
+  // at ratio 1 the input comes out as is, one frame late
+  int16_t expected = 0;
+  for (int call = 0; call < 5; call++) {
+    for (int i = 0; i < 480; i++) {
+      in[2 * i] = (int16_t)(call * 480 + i);
+      in[2 * i + 1] = (int16_t)-(call * 480 + i);
+    }
+    size_t n = chiaki_av_resampler_process(&rs, 1.0, in, 480, out, 1024);
+    assert(n == (call ? 480u : 479u));
+    for (size_t i = 0; i < n; i++) {
+      assert(out[2 * i] == expected && out[2 * i + 1] == -expected);
+      expected++;
+    }
+  }
+
+  // halving and doubling interpolate linearly
+  assert(chiaki_av_resampler_init(&rs, 1) == CHIAKI_ERR_SUCCESS);
+  for (int i = 0; i < 480; i++)
+    in[i] = (int16_t)(i * 10);
+  assert(chiaki_av_resampler_process(&rs, 2.0, in, 480, out, 1024) == 240);
+  assert(out[0] == 0 && out[1] == 20 && out[239] == 4780);
+  assert(chiaki_av_resampler_init(&rs, 1) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_av_resampler_process(&rs, 0.5, in, 480, out, 1024) == 958);
+  assert(out[0] == 0 && out[1] == 5 && out[2] == 10 && out[957] == 4785);
+
+  // over many calls the output rate is the input rate over the ratio
+  assert(chiaki_av_resampler_init(&rs, 1) == CHIAKI_ERR_SUCCESS);
+  size_t total = 0;
+  for (int call = 0; call < 1000; call++)
+    total += chiaki_av_resampler_process(&rs, 1.005, in, 480, out, 1024);
+  assert(abs64((int64_t)total - (int64_t)(480000 / 1.005)) <= 1);
+
+  // what does not fit is dropped
+  assert(chiaki_av_resampler_init(&rs, 1) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_av_resampler_process(&rs, 1.0, in, 480, out, 100) == 100);
+  assert(chiaki_av_resampler_process(&rs, 1.0, in, 480, out, 1024) == 480);
+  assert(out[0] == 4790 && out[1] == 0);
+}
+
+void run_avsync_tests(void) {
+  test_offset_and_hold();
+  test_envelope();
+  test_drift();
+  test_ratio();
+  test_target_follows_video();
+  test_restart();
+  test_wrap();
+  test_resampler();
+}
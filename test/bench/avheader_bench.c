@@ -0,0 +1,491 @@
+/*
+ * avheader_bench.c — Batched AV header decoding against the per-packet parsers
+ * (vitarps5_avheader).
+ *
+ * Fuzz: packets of every header format, well-formed, mutated, truncated and
+ * random, go through chiaki_takion_v7/v9/v12_av_packet_parse() and, in
+ * batches of random size, through chiaki_av_header_batch_decode(). Where the
+ * parser fails, the batch has to classify the packet as malformed. Where it
+ * succeeds, the batch has to decode the same fields and key position, unless
+ * the parser returned a payload past the end of the packet (the v9 and v12
+ * audio headers with nalu info structs are not length checked), which the
+ * batch classifies as malformed. Then the validator is checked on a scripted
+ * stream with duplicates, stale and malformed packets.
+ *
+ * Bench: a v12 stream of 60 fps video and audio with 2% duplicates and 1%
+ * reordered packets is parsed one packet at a time, as takion.c did, and in
+ * batches of CHIAKI_AV_HEADER_BATCH_MAX with validation. Reports ns per packet
+ * and how many packets the validation keeps from being decrypted.
+ *
+ * Usage: vitarps5_avheader [--fuzz N] [--packets N] [--seed N]
+ * Exits 1 on any mismatch.
+ */
+
+#define _GNU_SOURCE
+
+#include <chiaki/avheader.h>
+#include <chiaki/takion.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PACKET_BUF_SIZE 1500
+#define VIDEO_PAYLOAD_SIZE 1184
+#define AUDIO_UNIT_SIZE 80
+#define AUDIO_UNITS 3 /* 1 source, 2 fec */
+#define BENCH_ROUNDS 5
+
+typedef struct {
+  uint64_t s;
+} Rng;
+
+static uint64_t rng_next(Rng *r) {
+  r->s ^= r->s >> 12;
+  r->s ^= r->s << 25;
+  r->s ^= r->s >> 27;
+  return r->s * 0x2545F4914F6CDD1Dull;
+}
+
+static uint32_t rng_range(Rng *r, uint32_t n) { return (uint32_t)(rng_next(r) % n); }
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static const char *format_names[] = {"v7", "v9", "v12"};
+static const ChiakiTakionAVPacketParse format_parsers[] = {
+    chiaki_takion_v7_av_packet_parse,
+    chiaki_takion_v9_av_packet_parse,
+    chiaki_takion_v12_av_packet_parse,
+};
+
+static void put_u16(uint8_t *buf, uint16_t v) {
+  buf[0] = (uint8_t)(v >> 8);
+  buf[1] = (uint8_t)v;
+}
+
+static void put_u32(uint8_t *buf, uint32_t v) {
+  put_u16(buf, (uint16_t)(v >> 16));
+  put_u16(buf + 2, (uint16_t)v);
+}
+
+typedef struct {
+  bool video, nalu, haptics;
+  uint16_t packet_index, frame_index, unit_index, units_total, units_fec;
+  uint8_t codec, adaptive_stream_index;
+  uint32_t key_pos;
+} Header;
+
+/* Writes the header as the console sends it, returns the payload offset. */
+static size_t write_header(ChiakiAvHeaderFormat format, const Header *h, uint8_t *buf) {
+  bool v7 = format == CHIAKI_AV_HEADER_FORMAT_V7;
+  memset(buf, 0, 0x1a);
+  buf[0] = (uint8_t)((h->video ? 2 : 3) | (h->nalu ? 0x10 : 0));
+  put_u16(buf + 1, h->packet_index);
+  put_u16(buf + 3, h->frame_index);
+  uint16_t total = (uint16_t)(h->units_total - 1);
+  if (h->video || v7)
+    put_u32(buf + 5, (h->units_fec & 0x3ffu) | ((total & 0x7ffu) << 0xa) | ((uint32_t)(h->unit_index & 0x7ff) << 0x15));
+  else
+    put_u32(buf + 5, h->units_fec | ((uint32_t)(total & 0xff) << 0x10) | ((uint32_t)(h->unit_index & 0xff) << 0x18));
+  buf[9] = h->codec;
+  put_u32(buf + 0xe, h->key_pos);
+  size_t offset;
+  if (h->video) {
+    buf[0x14] = (uint8_t)(h->adaptive_stream_index << 5);
+    offset = 0x15;
+  } else {
+    offset = v7 ? 0x12 : 0x13;
+  }
+  if (h->nalu)
+    offset += 3;
+  if (format == CHIAKI_AV_HEADER_FORMAT_V12 && !h->video)
+    buf[offset++] = h->haptics ? 0x02 : 0x00;
+  return offset;
+}
+
+/* ---- fuzz --------------------------------------------------------------- */
+
+typedef struct {
+  uint64_t packets, malformed, overruns, mismatches;
+} FuzzStats;
+
+static size_t fuzz_packet(Rng *rng, ChiakiAvHeaderFormat format, uint32_t *key_pos, uint8_t *buf) {
+  for (size_t i = 0; i < PACKET_BUF_SIZE; i++)
+    buf[i] = (uint8_t)rng_next(rng);
+  uint32_t kind = rng_range(rng, 10);
+  if (kind == 0)
+    return rng_range(rng, 48); /* random bytes */
+
+  Header h = {
+      .video = rng_range(rng, 2) == 0,
+      .nalu = rng_range(rng, 4) == 0,
+      .haptics = rng_range(rng, 4) == 0,
+      .packet_index = (uint16_t)rng_next(rng),
+      .frame_index = (uint16_t)rng_next(rng),
+      .codec = rng_range(rng, 4) ? 5 : (uint8_t)rng_next(rng),
+      .adaptive_stream_index = (uint8_t)rng_range(rng, 8),
+  };
+  *key_pos += rng_range(rng, 0x10000);
+  h.key_pos = *key_pos;
+  if (h.video) {
+    h.units_total = (uint16_t)(1 + rng_range(rng, 300));
+    h.units_fec = (uint16_t)rng_range(rng, h.units_total + 2);
+    h.unit_index = (uint16_t)rng_range(rng, h.units_total + 2);
+  } else {
+    uint16_t source = (uint16_t)rng_range(rng, 4), fec = (uint16_t)rng_range(rng, 4);
+    h.units_total = (uint16_t)(source + fec ? source + fec : 1);
+    h.units_fec = (uint16_t)((AUDIO_UNIT_SIZE << 8) | (fec << 4) | source);
+    h.unit_index = (uint16_t)rng_range(rng, 8);
+  }
+  size_t size = write_header(format, &h, buf);
+  if (!h.video)
+    size += rng_range(rng, 4) ? (size_t)AUDIO_UNIT_SIZE * h.units_total : rng_range(rng, 64);
+  else
+    size += rng_range(rng, VIDEO_PAYLOAD_SIZE);
+
+  if (kind == 1) /* truncated */
+    size = rng_range(rng, (uint32_t)size + 1);
+  else if (kind == 2) /* a few bytes flipped */
+    for (uint32_t n = 1 + rng_range(rng, 3); n; n--)
+      buf[rng_range(rng, 0x1a)] ^= (uint8_t)(1 + rng_range(rng, 255));
+  return size;
+}
+
+#define FUZZ_CHECK(field)                                                                                      \
+  if (expected.field != got.field) {                                                                           \
+    fprintf(stderr, "avheader: %s packet %llu: " #field " %llu != %llu\n", format_names[format],                \
+            (unsigned long long)stats->packets, (unsigned long long)expected.field,                             \
+            (unsigned long long)got.field);                                                                     \
+    ok = false;                                                                                                 \
+  }
+
+static bool fuzz_compare(ChiakiAvHeaderFormat format, ChiakiErrorCode err, ChiakiTakionAVPacket expected,
+                         ChiakiAvHeaderBatch *batch, size_t i, FuzzStats *stats) {
+  bool overrun = err == CHIAKI_ERR_SUCCESS && (expected.data < batch->buf[i] ||
+                                               expected.data > batch->buf[i] + batch->buf_size[i] ||
+                                               expected.data_size > batch->buf_size[i]);
+  if (err != CHIAKI_ERR_SUCCESS || overrun) {
+    stats->malformed++;
+    stats->overruns += overrun;
+    if (batch->cls[i] != CHIAKI_AV_HEADER_CLASS_MALFORMED) {
+      fprintf(stderr, "avheader: %s packet %llu: parser %s, batch decoded it\n", format_names[format],
+              (unsigned long long)stats->packets, overrun ? "overran" : "failed");
+      return false;
+    }
+    return true;
+  }
+  if (batch->cls[i] != CHIAKI_AV_HEADER_CLASS_GOOD) {
+    fprintf(stderr, "avheader: %s packet %llu: parser succeeded, batch classified it %u\n", format_names[format],
+            (unsigned long long)stats->packets, (unsigned)batch->cls[i]);
+    return false;
+  }
+  ChiakiTakionAVPacket got;
+  chiaki_av_header_batch_packet(batch, i, &got);
+  bool ok = true;
+  FUZZ_CHECK(packet_index)
+  FUZZ_CHECK(frame_index)
+  FUZZ_CHECK(uses_nalu_info_structs)
+  FUZZ_CHECK(is_video)
+  FUZZ_CHECK(is_haptics)
+  FUZZ_CHECK(unit_index)
+  FUZZ_CHECK(units_in_frame_total)
+  FUZZ_CHECK(units_in_frame_fec)
+  FUZZ_CHECK(codec)
+  FUZZ_CHECK(word_at_0x18)
+  FUZZ_CHECK(adaptive_stream_index)
+  FUZZ_CHECK(byte_at_0x2c)
+  FUZZ_CHECK(key_pos)
+  FUZZ_CHECK(data_size)
+  if (expected.data != got.data) {
+    fprintf(stderr, "avheader: %s packet %llu: data offset differs\n", format_names[format],
+            (unsigned long long)stats->packets);
+    ok = false;
+  }
+  return ok;
+}
+
+static bool fuzz_format(ChiakiAvHeaderFormat format, uint64_t count, Rng *rng, FuzzStats *stats) {
+  static uint8_t bufs[CHIAKI_AV_HEADER_BATCH_MAX][PACKET_BUF_SIZE];
+  static ChiakiAvHeaderBatch batch;
+  ChiakiKeyState parser_key_state, batch_key_state;
+  chiaki_key_state_init(&parser_key_state);
+  chiaki_key_state_init(&batch_key_state);
+  uint32_t key_pos = 0xfff00000; /* crosses the 32 bit wrap */
+  bool ok = true;
+
+  while (count) {
+    size_t n = 1 + rng_range(rng, CHIAKI_AV_HEADER_BATCH_MAX);
+    if (n > count)
+      n = (size_t)count;
+    chiaki_av_header_batch_reset(&batch);
+    for (size_t i = 0; i < n; i++)
+      chiaki_av_header_batch_push(&batch, bufs[i], fuzz_packet(rng, format, &key_pos, bufs[i]));
+    chiaki_av_header_batch_decode(&batch, format, &batch_key_state);
+    for (size_t i = 0; i < n; i++) {
+      ChiakiTakionAVPacket expected;
+      ChiakiKeyState key_state_before = parser_key_state;
+      ChiakiErrorCode err = format_parsers[format](&expected, &parser_key_state, bufs[i], batch.buf_size[i]);
+      ok &= fuzz_compare(format, err, expected, &batch, i, stats);
+      if (err == CHIAKI_ERR_SUCCESS && batch.cls[i] == CHIAKI_AV_HEADER_CLASS_MALFORMED)
+        parser_key_state = key_state_before; /* an overrun the batch didn't take a key position for */
+      stats->packets++;
+    }
+    count -= n;
+    if (!ok)
+      break;
+  }
+  return ok;
+}
+
+/* ---- validation --------------------------------------------------------- */
+
+static void push_video(ChiakiAvHeaderBatch *batch, uint8_t *buf, uint16_t frame, uint16_t unit, uint16_t total,
+                       uint16_t fec, size_t payload) {
+  Header h = {.video = true, .frame_index = frame, .unit_index = unit, .units_total = total, .units_fec = fec};
+  chiaki_av_header_batch_push(batch, buf, write_header(CHIAKI_AV_HEADER_FORMAT_V12, &h, buf) + payload);
+}
+
+static void push_audio(ChiakiAvHeaderBatch *batch, uint8_t *buf, uint16_t frame, uint8_t codec) {
+  Header h = {.frame_index = frame,
+              .units_total = AUDIO_UNITS,
+              .units_fec = (AUDIO_UNIT_SIZE << 8) | ((AUDIO_UNITS - 1) << 4) | 1,
+              .codec = codec};
+  chiaki_av_header_batch_push(batch, buf, write_header(CHIAKI_AV_HEADER_FORMAT_V12, &h, buf) + AUDIO_UNIT_SIZE * AUDIO_UNITS);
+}
+
+static bool validate_scripted(void) {
+  static uint8_t bufs[CHIAKI_AV_HEADER_BATCH_MAX][PACKET_BUF_SIZE];
+  static ChiakiAvHeaderBatch batch;
+  ChiakiAvHeaderValidator validator;
+  ChiakiKeyState key_state;
+  chiaki_av_header_validator_init(&validator);
+  chiaki_key_state_init(&key_state);
+  chiaki_av_header_batch_reset(&batch);
+
+  size_t b = 0;
+  push_video(&batch, bufs[b++], 10, 0, 4, 1, 100); /* good */
+  push_video(&batch, bufs[b++], 10, 1, 4, 1, 100); /* good */
+  push_video(&batch, bufs[b++], 10, 1, 4, 1, 100); /* duplicate */
+  push_video(&batch, bufs[b++], 10, 4, 4, 1, 100); /* unit index past the frame */
+  push_video(&batch, bufs[b++], 10, 0, 2, 3, 100); /* more fec than units */
+  push_video(&batch, bufs[b++], 10, 2, 300, 1, 100); /* more units than slots */
+  push_video(&batch, bufs[b++], 10, 2, 4, 1, 0); /* empty */
+  push_video(&batch, bufs[b++], 11, 0, 4, 1, 100); /* good, next frame */
+  push_video(&batch, bufs[b++], 10, 3, 4, 1, 100); /* stale */
+  push_video(&batch, bufs[b++], 11, 0, 4, 1, 100); /* duplicate */
+  push_video(&batch, bufs[b++], 0xffff, 0, 4, 1, 100); /* stale across the wrap */
+  push_audio(&batch, bufs[b++], 500, 5); /* good */
+  push_audio(&batch, bufs[b++], 502, 5); /* good */
+  push_audio(&batch, bufs[b++], 501, 5); /* good, reordered */
+  push_audio(&batch, bufs[b++], 502, 5); /* duplicate */
+  push_audio(&batch, bufs[b++], 400, 5); /* stale */
+  push_audio(&batch, bufs[b++], 503, 3); /* unknown codec */
+  chiaki_av_header_batch_push(&batch, bufs[b], 0x10); /* too short */
+  bufs[b++][0] = 2;
+
+  static const uint8_t expected[] = {
+      CHIAKI_AV_HEADER_CLASS_GOOD,      CHIAKI_AV_HEADER_CLASS_GOOD,      CHIAKI_AV_HEADER_CLASS_DUPLICATE,
+      CHIAKI_AV_HEADER_CLASS_MALFORMED, CHIAKI_AV_HEADER_CLASS_MALFORMED, CHIAKI_AV_HEADER_CLASS_MALFORMED,
+      CHIAKI_AV_HEADER_CLASS_MALFORMED, CHIAKI_AV_HEADER_CLASS_GOOD,      CHIAKI_AV_HEADER_CLASS_STALE,
+      CHIAKI_AV_HEADER_CLASS_DUPLICATE, CHIAKI_AV_HEADER_CLASS_STALE,     CHIAKI_AV_HEADER_CLASS_GOOD,
+      CHIAKI_AV_HEADER_CLASS_GOOD,      CHIAKI_AV_HEADER_CLASS_GOOD,      CHIAKI_AV_HEADER_CLASS_DUPLICATE,
+      CHIAKI_AV_HEADER_CLASS_STALE,     CHIAKI_AV_HEADER_CLASS_MALFORMED, CHIAKI_AV_HEADER_CLASS_MALFORMED,
+  };
+  if (b != sizeof(expected)) {
+    fprintf(stderr, "avheader: validation script has %zu packets, expected %zu\n", b, sizeof(expected));
+    return false;
+  }
+
+  chiaki_av_header_batch_decode(&batch, CHIAKI_AV_HEADER_FORMAT_V12, &key_state);
+  size_t good = chiaki_av_header_validate(&validator, &batch);
+  bool ok = good == 6;
+  for (size_t i = 0; i < b; i++) {
+    if (batch.cls[i] != expected[i]) {
+      fprintf(stderr, "avheader: validation packet %zu classified %u, expected %u\n", i, (unsigned)batch.cls[i],
+              (unsigned)expected[i]);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+/* ---- bench -------------------------------------------------------------- */
+
+typedef struct {
+  uint8_t *bufs; /* count * PACKET_BUF_SIZE */
+  size_t *sizes;
+  size_t count;
+} Stream;
+
+static void stream_build(Stream *s, size_t count, Rng *rng) {
+  s->bufs = malloc(count * PACKET_BUF_SIZE);
+  s->sizes = malloc(count * sizeof(size_t));
+  if (!s->bufs || !s->sizes)
+    abort();
+  s->count = count;
+  uint16_t frame = 1, audio_frame = 1, packet_index = 0, unit = 0;
+  uint32_t key_pos = 0;
+  const uint16_t units = 20, fec = 4;
+  for (size_t i = 0; i < count; i++) {
+    uint8_t *buf = s->bufs + i * PACKET_BUF_SIZE;
+    Header h = {.packet_index = packet_index++, .key_pos = key_pos, .codec = 5};
+    size_t payload;
+    if (i % 8 == 7) {
+      h.frame_index = audio_frame++;
+      h.units_total = AUDIO_UNITS;
+      h.units_fec = (AUDIO_UNIT_SIZE << 8) | ((AUDIO_UNITS - 1) << 4) | 1;
+      payload = AUDIO_UNIT_SIZE * AUDIO_UNITS;
+    } else {
+      h.video = true;
+      h.frame_index = frame;
+      h.unit_index = unit;
+      h.units_total = units;
+      h.units_fec = fec;
+      payload = VIDEO_PAYLOAD_SIZE;
+      if (++unit == units) {
+        unit = 0;
+        frame++;
+      }
+    }
+    key_pos += (uint32_t)payload;
+    s->sizes[i] = write_header(CHIAKI_AV_HEADER_FORMAT_V12, &h, buf) + payload;
+    if (i && rng_range(rng, 100) < 2) { /* duplicate of the previous packet */
+      memcpy(buf, buf - PACKET_BUF_SIZE, PACKET_BUF_SIZE);
+      s->sizes[i] = s->sizes[i - 1];
+    } else if (i > 4 && rng_range(rng, 100) < 1) { /* late */
+      memcpy(buf, buf - 4 * PACKET_BUF_SIZE, PACKET_BUF_SIZE);
+      s->sizes[i] = s->sizes[i - 4];
+    }
+  }
+}
+
+static void stream_free(Stream *s) {
+  free(s->bufs);
+  free(s->sizes);
+}
+
+static volatile uint64_t bench_sink;
+
+/* Both paths copy every packet into their receive buffer first, like recv() does. */
+static uint64_t bench_per_packet(const Stream *s) {
+  static uint8_t recvbuf[PACKET_BUF_SIZE];
+  ChiakiKeyState key_state;
+  chiaki_key_state_init(&key_state);
+  ChiakiTakionAVPacketParse parse = chiaki_takion_v12_av_packet_parse;
+  uint64_t sink = 0;
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < s->count; i++) {
+    ChiakiTakionAVPacket packet;
+    memcpy(recvbuf, s->bufs + i * PACKET_BUF_SIZE, s->sizes[i]);
+    if (parse(&packet, &key_state, recvbuf, s->sizes[i]) == CHIAKI_ERR_SUCCESS)
+      sink += packet.unit_index + packet.data_size;
+  }
+  uint64_t elapsed = now_ns() - start;
+  bench_sink = sink;
+  return elapsed;
+}
+
+static uint64_t bench_batched(const Stream *s, ChiakiAvHeaderValidator *validator, uint64_t *good) {
+  static uint8_t slots[CHIAKI_AV_HEADER_BATCH_MAX][PACKET_BUF_SIZE];
+  static ChiakiAvHeaderBatch batch;
+  ChiakiKeyState key_state;
+  chiaki_key_state_init(&key_state);
+  chiaki_av_header_validator_init(validator);
+  uint64_t sink = 0;
+  *good = 0;
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < s->count;) {
+    chiaki_av_header_batch_reset(&batch);
+    for (; i < s->count && !chiaki_av_header_batch_full(&batch); i++) {
+      uint8_t *slot = slots[batch.count];
+      memcpy(slot, s->bufs + i * PACKET_BUF_SIZE, s->sizes[i]);
+      chiaki_av_header_batch_push(&batch, slot, s->sizes[i]);
+    }
+    chiaki_av_header_batch_decode(&batch, CHIAKI_AV_HEADER_FORMAT_V12, &key_state);
+    *good += chiaki_av_header_validate(validator, &batch);
+    for (size_t j = 0; j < batch.count; j++) {
+      if (batch.cls[j] != CHIAKI_AV_HEADER_CLASS_GOOD)
+        continue;
+      ChiakiTakionAVPacket packet;
+      chiaki_av_header_batch_packet(&batch, j, &packet);
+      sink += packet.unit_index + packet.data_size;
+    }
+  }
+  uint64_t elapsed = now_ns() - start;
+  bench_sink = sink;
+  return elapsed;
+}
+
+static void bench(size_t packets, Rng *rng) {
+  Stream s;
+  stream_build(&s, packets, rng);
+  uint64_t best_single = UINT64_MAX, best_batched = UINT64_MAX, good = 0;
+  ChiakiAvHeaderValidator validator;
+  for (int r = 0; r < BENCH_ROUNDS; r++) {
+    uint64_t t = bench_per_packet(&s);
+    if (t < best_single)
+      best_single = t;
+    t = bench_batched(&s, &validator, &good);
+    if (t < best_batched)
+      best_batched = t;
+  }
+  printf("BENCH avheader path=per_packet packets=%zu ns_per_packet=%.1f\n", s.count, (double)best_single / s.count);
+  printf("BENCH avheader path=batched packets=%zu ns_per_packet=%.1f good=%llu duplicate=%llu stale=%llu "
+         "malformed=%llu decrypt_skipped_pct=%.2f\n",
+         s.count, (double)best_batched / s.count, (unsigned long long)good,
+         (unsigned long long)validator.classified[CHIAKI_AV_HEADER_CLASS_DUPLICATE],
+         (unsigned long long)validator.classified[CHIAKI_AV_HEADER_CLASS_STALE],
+         (unsigned long long)validator.classified[CHIAKI_AV_HEADER_CLASS_MALFORMED],
+         100.0 * (double)(s.count - good) / s.count);
+  stream_free(&s);
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t fuzz = 100000;
+  size_t packets = 1000000;
+  uint64_t seed = 0xa7;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    if (strcmp(arg, "--fuzz") == 0)
+      fuzz = strtoull(val, NULL, 0);
+    else if (strcmp(arg, "--packets") == 0)
+      packets = (size_t)strtoull(val, NULL, 0);
+    else if (strcmp(arg, "--seed") == 0)
+      seed = strtoull(val, NULL, 0);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+
+  Rng rng = {seed ? seed : 1};
+  bool ok = true;
+  for (int format = CHIAKI_AV_HEADER_FORMAT_V7; format <= CHIAKI_AV_HEADER_FORMAT_V12; format++) {
+    FuzzStats stats = {0};
+    bool format_ok = fuzz_format((ChiakiAvHeaderFormat)format, fuzz, &rng, &stats);
+    printf("FUZZ avheader format=%s packets=%llu malformed=%llu parser_overruns=%llu %s\n", format_names[format],
+           (unsigned long long)stats.packets, (unsigned long long)stats.malformed,
+           (unsigned long long)stats.overruns, format_ok ? "ok" : "MISMATCH");
+    ok &= format_ok;
+  }
+  bool validation_ok = validate_scripted();
+  printf("VALIDATE avheader %s\n", validation_ok ? "ok" : "FAILED");
+  ok &= validation_ok;
+
+  if (packets)
+    bench(packets, &rng);
+  return ok ? 0 : 1;
+}
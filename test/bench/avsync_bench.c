@@ -0,0 +1,402 @@
+/*
+ * avsync_bench.c — Lip-sync error with and without ChiakiAvSync.
+ *
+ * A console whose clock runs DRIFT_PPM fast sends two minutes of 10 ms audio
+ * units and 60 fps video frames of VIDEO_PACKETS packets. The packet timeline
+ * is recorded through a Netsim per scenario (the test/netsim/scenarios files
+ * and a clean LAN), then the same arrivals are played out by a model of the
+ * Vita's media path in two modes:
+ *
+ *   baseline  audio goes straight to the device, video is presented on the
+ *             first UI tick after it was decoded
+ *   sync      audio is resampled at the engine's ratio, video is held for
+ *             as long as the engine asks
+ *
+ * The model: the audio device drains 48 kHz on the local clock once a device
+ * buffer is queued, and audio.c's hard catch-up drops everything but one
+ * device buffer when more than its ring holds. Video decodes in 5-9 ms into a
+ * single frame slot, the UI thread polls every millisecond.
+ *
+ * Every presented frame's sync error is the console time of the audio being
+ * heard minus that of the frame, 0 when in sync. Reports the absolute error
+ * percentiles, the mean, catch-up skips and underruns, which are audible.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chiaki/avsync.h>
+
+#include "../netsim/netsim.h"
+#include "bench.h"
+
+#define SECONDS 120
+#define DRIFT_PPM 100.0
+#define AUDIO_FRAME_US 10000
+#define AUDIO_RATE 48000
+#define AUDIO_FRAME_SAMPLES 480
+#define AUDIO_PACKET_SIZE 240
+#define VIDEO_FPS 60
+#define VIDEO_PACKETS 16
+#define VIDEO_PACKET_SIZE 1300
+#define VIDEO_PACKET_SPACING_US 50
+#define VIDEO_FEC_PACKETS 2 /* a frame missing no more than this is recovered */
+#define DEVICE_BUFFER_SAMPLES 960
+#define RING_SAMPLES (8 * AUDIO_FRAME_SAMPLES)
+#define UI_TICK_US 1000
+#define SEGMENTS_MAX 1024
+#define CAPACITY 65536
+
+#define AUDIO_UNITS (SECONDS * 1000000 / AUDIO_FRAME_US)
+#define VIDEO_FRAMES (SECONDS * VIDEO_FPS)
+#define SAMPLE_US (1000000.0 / AUDIO_RATE)
+
+typedef struct {
+  const char *name;
+  const char *file; /* in AVSYNC_BENCH_SCENARIO_DIR, or NULL for text */
+  const char *text;
+} AvScenario;
+
+static const AvScenario scenarios[] = {
+    {"lan", NULL, "delay = 2ms\njitter = 1ms\ndist = normal\n"},
+    {"wifi_burst", "wifi_burst.scn", NULL},
+    {"remote_wan", "remote_wan.scn", NULL},
+};
+
+/* ---- recorded timeline --------------------------------------------------- */
+
+typedef struct {
+  uint64_t *audio_arrival; /* UINT64_MAX if lost */
+  uint64_t *video_arrival; /* of the last packet */
+  uint32_t *video_received; /* mask of received packets */
+  uint32_t *record_unit;   /* per trace record, audio unit or VIDEO_BIT | frame * VIDEO_PACKETS + packet */
+} Timeline;
+
+#define VIDEO_BIT 0x80000000u
+
+typedef struct {
+  uint64_t t_us;
+  bool video;
+  uint32_t index;
+} Event;
+
+static void deliver(size_t index, uint64_t sent_us, uint64_t received_us, void *user) {
+  (void)sent_us;
+  Timeline *tl = user;
+  uint32_t unit = tl->record_unit[index];
+  if (unit & VIDEO_BIT) {
+    uint32_t frame = (unit & ~VIDEO_BIT) / VIDEO_PACKETS;
+    uint32_t bit = 1u << (unit % VIDEO_PACKETS);
+    if (!(tl->video_received[frame] & bit) && received_us > tl->video_arrival[frame])
+      tl->video_arrival[frame] = received_us;
+    tl->video_received[frame] |= bit;
+  } else if (received_us < tl->audio_arrival[unit]) {
+    tl->audio_arrival[unit] = received_us;
+  }
+}
+
+/* Local send time of what the console sends at sent_us on its clock. */
+static uint64_t local_send_us(uint64_t sent_us) {
+  return (uint64_t)((double)sent_us / (1.0 + DRIFT_PPM / 1e6));
+}
+
+static bool record_timeline(const NetsimScenario *scenario, Timeline *tl) {
+  size_t records = AUDIO_UNITS + VIDEO_FRAMES * VIDEO_PACKETS;
+  NetsimTrace trace = {calloc(records, sizeof(NetsimTraceRecord)), 0};
+  tl->audio_arrival = malloc(AUDIO_UNITS * sizeof(uint64_t));
+  tl->video_arrival = calloc(VIDEO_FRAMES, sizeof(uint64_t));
+  tl->video_received = calloc(VIDEO_FRAMES, sizeof(uint32_t));
+  tl->record_unit = malloc(records * sizeof(uint32_t));
+  if (!trace.records || !tl->audio_arrival || !tl->video_arrival || !tl->video_received || !tl->record_unit)
+    abort();
+  for (size_t i = 0; i < AUDIO_UNITS; i++)
+    tl->audio_arrival[i] = UINT64_MAX;
+  // both streams in send order
+  size_t a = 0, v = 0;
+  while (a < AUDIO_UNITS || v < VIDEO_FRAMES) {
+    uint64_t a_sent = a * AUDIO_FRAME_US, v_sent = v * 1000000 / VIDEO_FPS;
+    if (v == VIDEO_FRAMES || (a < AUDIO_UNITS && a_sent <= v_sent)) {
+      trace.records[trace.count] = (NetsimTraceRecord){local_send_us(a_sent), AUDIO_PACKET_SIZE};
+      tl->record_unit[trace.count++] = (uint32_t)a++;
+      continue;
+    }
+    for (size_t p = 0; p < VIDEO_PACKETS; p++) {
+      trace.records[trace.count] =
+          (NetsimTraceRecord){local_send_us(v_sent) + p * VIDEO_PACKET_SPACING_US, VIDEO_PACKET_SIZE};
+      tl->record_unit[trace.count++] = VIDEO_BIT | (uint32_t)(v * VIDEO_PACKETS + p);
+    }
+    v++;
+  }
+  // a video frame's packets may overlap the next audio unit's send time
+  for (size_t i = 1; i < trace.count; i++) {
+    if (trace.records[i].time_us < trace.records[i - 1].time_us)
+      trace.records[i].time_us = trace.records[i - 1].time_us;
+  }
+  Netsim sim;
+  if (!netsim_init(&sim, &scenario->phases[0].params, scenario->seed, CAPACITY, 0))
+    abort();
+  netsim_trace_replay(&sim, &trace, scenario, deliver, tl);
+  netsim_fini(&sim);
+  netsim_trace_fini(&trace);
+  return true;
+}
+
+static int event_cmp(const void *a, const void *b) {
+  const Event *x = a, *y = b;
+  if (x->t_us != y->t_us)
+    return (x->t_us > y->t_us) - (x->t_us < y->t_us);
+  return (int)x->video - (int)y->video;
+}
+
+static size_t timeline_events(const Timeline *tl, Event *events) {
+  size_t count = 0;
+  for (uint32_t a = 0; a < AUDIO_UNITS; a++) {
+    if (tl->audio_arrival[a] != UINT64_MAX)
+      events[count++] = (Event){tl->audio_arrival[a], false, a};
+  }
+  for (uint32_t v = 0; v < VIDEO_FRAMES; v++) {
+    if (VIDEO_PACKETS - __builtin_popcount(tl->video_received[v]) <= VIDEO_FEC_PACKETS)
+      events[count++] = (Event){tl->video_arrival[v], true, v};
+  }
+  qsort(events, count, sizeof(Event), event_cmp);
+  return count;
+}
+
+/* ---- audio device -------------------------------------------------------- */
+
+typedef struct {
+  double count;    /* samples left */
+  double ts_us;    /* console time of the next sample */
+  double step_us;  /* console time per sample */
+} Segment;
+
+typedef struct {
+  Segment segments[SEGMENTS_MAX];
+  size_t head;
+  size_t len;
+  double samples;
+  uint64_t at_us;
+  bool playing;
+  uint64_t underruns;
+  uint64_t skips;
+} Device;
+
+static void device_discard(Device *dev, double samples) {
+  while (samples > 0.0 && dev->len) {
+    Segment *s = &dev->segments[dev->head];
+    double take = s->count < samples ? s->count : samples;
+    s->count -= take;
+    s->ts_us += take * s->step_us;
+    dev->samples -= take;
+    samples -= take;
+    if (s->count <= 1e-9) {
+      dev->head = (dev->head + 1) % SEGMENTS_MAX;
+      dev->len--;
+    }
+  }
+  if (!dev->len)
+    dev->samples = 0.0;
+}
+
+static void device_advance(Device *dev, uint64_t now_us) {
+  if (dev->playing) {
+    double drain = (double)(now_us - dev->at_us) / SAMPLE_US;
+    if (drain >= dev->samples) {
+      dev->playing = false;
+      dev->underruns++;
+    }
+    device_discard(dev, drain);
+  }
+  dev->at_us = now_us;
+}
+
+static void device_push(Device *dev, double samples, double ts_us, double step_us) {
+  if (dev->len == SEGMENTS_MAX)
+    abort();
+  dev->segments[(dev->head + dev->len++) % SEGMENTS_MAX] = (Segment){samples, ts_us, step_us};
+  dev->samples += samples;
+  if (dev->samples > RING_SAMPLES + DEVICE_BUFFER_SAMPLES) {
+    device_discard(dev, dev->samples - DEVICE_BUFFER_SAMPLES);
+    dev->skips++;
+  }
+  if (!dev->playing && dev->samples >= DEVICE_BUFFER_SAMPLES)
+    dev->playing = true;
+}
+
+static bool device_heard(const Device *dev, double *ts_us) {
+  if (!dev->playing || !dev->len)
+    return false;
+  *ts_us = dev->segments[dev->head].ts_us;
+  return true;
+}
+
+/* ---- playout ------------------------------------------------------------- */
+
+typedef struct {
+  uint64_t *abs_error_us;
+  size_t presents;
+  double error_sum_us;
+  uint64_t drops;
+  uint64_t underruns;
+  uint64_t skips;
+  double ratio_min;
+  double ratio_max;
+  ChiakiAvSyncStats stats;
+} PlayoutResult;
+
+static uint64_t decode_us(uint32_t frame) {
+  return 5000 + (frame * 2654435761u) % 4000;
+}
+
+static void playout(const Event *events, size_t count, bool sync_mode, PlayoutResult *result) {
+  ChiakiAvSyncConfig config;
+  chiaki_av_sync_config_defaults(&config);
+  config.video_fps = VIDEO_FPS;
+  ChiakiAvSync *sync = chiaki_av_sync_new(&config);
+  ChiakiAvResampler resampler;
+  if (!sync || chiaki_av_resampler_init(&resampler, 2) != CHIAKI_ERR_SUCCESS)
+    abort();
+  // what vita_audio_init() sets for 480 sample units
+  chiaki_av_sync_set_audio_target(sync, 2 * DEVICE_BUFFER_SAMPLES * 1000000ULL / AUDIO_RATE,
+                                  DEVICE_BUFFER_SAMPLES * 1000000ULL / AUDIO_RATE + 10000,
+                                  RING_SAMPLES * 1000000ULL / AUDIO_RATE);
+  static int16_t pcm_in[2 * AUDIO_FRAME_SAMPLES], pcm_out[4 * AUDIO_FRAME_SAMPLES];
+  static Device dev;
+  memset(&dev, 0, sizeof(dev));
+  memset(result, 0, sizeof(*result));
+  result->abs_error_us = malloc(VIDEO_FRAMES * sizeof(uint64_t));
+  if (!result->abs_error_us)
+    abort();
+  result->ratio_min = result->ratio_max = 1.0;
+  double ratio = 1.0;
+  int32_t last_audio = -1;
+  // the frame being decoded, and the decoded one waiting for the UI thread
+  bool decoding = false, ready = false;
+  uint32_t decoding_frame = 0, ready_frame = 0;
+  uint64_t decoded_us = 0;
+  dev.at_us = events[0].t_us;
+
+  size_t e = 0;
+  for (uint64_t tick = events[0].t_us; e < count || decoding || ready; tick += UI_TICK_US) {
+    for (; e < count && events[e].t_us <= tick; e++) {
+      const Event *ev = &events[e];
+      device_advance(&dev, ev->t_us);
+      if (ev->video) {
+        chiaki_av_sync_video_frame(sync, (uint16_t)ev->index, ev->t_us);
+        // decodes run one after the other, each overwriting the frame not yet presented
+        uint64_t start_us = ev->t_us;
+        if (decoding) {
+          result->drops += ready;
+          ready = true;
+          ready_frame = decoding_frame;
+          if (decoded_us > start_us)
+            start_us = decoded_us;
+        }
+        decoding = true;
+        decoding_frame = ev->index;
+        decoded_us = start_us + decode_us(ev->index);
+        continue;
+      }
+      // the audio receiver drops units older than the last one
+      if ((int32_t)ev->index <= last_audio)
+        continue;
+      last_audio = (int32_t)ev->index;
+      double ts_us = (double)ev->index * AUDIO_FRAME_US;
+      if (!sync_mode) {
+        device_push(&dev, AUDIO_FRAME_SAMPLES, ts_us, SAMPLE_US);
+        continue;
+      }
+      chiaki_av_sync_audio_frame(sync, (uint16_t)ev->index, AUDIO_FRAME_US, ev->t_us);
+      // the first output frame sits at pos - 1 input frames into the unit
+      double first_us = ts_us + (resampler.primed ? resampler.pos - 1.0 : 0.0) * SAMPLE_US;
+      size_t out = chiaki_av_resampler_process(&resampler, ratio, pcm_in, AUDIO_FRAME_SAMPLES, pcm_out,
+                                               2 * AUDIO_FRAME_SAMPLES);
+      device_push(&dev, (double)out, first_us, ratio * SAMPLE_US);
+      ratio = chiaki_av_sync_audio_playout(sync, (uint64_t)(dev.samples * SAMPLE_US), ev->t_us);
+      if (ratio < result->ratio_min)
+        result->ratio_min = ratio;
+      if (ratio > result->ratio_max)
+        result->ratio_max = ratio;
+    }
+    device_advance(&dev, tick);
+    if (decoding && decoded_us <= tick) {
+      result->drops += ready;
+      ready = true;
+      ready_frame = decoding_frame;
+      decoding = false;
+    }
+    if (!ready)
+      continue;
+    if (sync_mode && chiaki_av_sync_video_hold(sync, (uint16_t)ready_frame, tick))
+      continue;
+    ready = false;
+    if (sync_mode)
+      chiaki_av_sync_video_presented(sync, (uint16_t)ready_frame, tick);
+    double heard_us;
+    if (!device_heard(&dev, &heard_us))
+      continue;
+    double error_us = heard_us - (double)ready_frame * 1000000.0 / VIDEO_FPS;
+    result->error_sum_us += error_us;
+    result->abs_error_us[result->presents++] = (uint64_t)(error_us < 0 ? -error_us : error_us);
+  }
+  result->underruns = dev.underruns;
+  result->skips = dev.skips;
+  chiaki_av_sync_stats(sync, &result->stats);
+  chiaki_av_sync_free(sync);
+}
+
+static void report(const char *scenario, bool sync_mode, PlayoutResult *r) {
+  double mean_us = r->presents ? r->error_sum_us / (double)r->presents : 0.0;
+  printf("BENCH avsync scenario=%s mode=%s presents=%zu drops=%llu err_mean_us=%.0f err_p50_us=%llu "
+         "err_p95_us=%llu err_p99_us=%llu skips=%llu underruns=%llu",
+         scenario, sync_mode ? "sync" : "baseline", r->presents, (unsigned long long)r->drops, mean_us,
+         (unsigned long long)bench_percentile(r->abs_error_us, r->presents, 50),
+         (unsigned long long)bench_percentile(r->abs_error_us, r->presents, 95),
+         (unsigned long long)bench_percentile(r->abs_error_us, r->presents, 99), (unsigned long long)r->skips,
+         (unsigned long long)r->underruns);
+  if (sync_mode)
+    printf(" drift_ppm=%.1f true_drift_ppm=%.1f ratio_min=%.4f ratio_max=%.4f held=%llu audio_target_us=%llu",
+           r->stats.drift_ppm, DRIFT_PPM, r->ratio_min, r->ratio_max, (unsigned long long)r->stats.held,
+           (unsigned long long)r->stats.audio_target_us);
+  printf("\n");
+  free(r->abs_error_us);
+}
+
+void run_avsync_bench(void) {
+  Event *events = malloc((AUDIO_UNITS + VIDEO_FRAMES) * sizeof(Event));
+  if (!events)
+    abort();
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    const AvScenario *s = &scenarios[i];
+    NetsimScenario scenario;
+    char err[128];
+    bool ok;
+    if (s->file) {
+      char path[512];
+      snprintf(path, sizeof(path), "%s/%s", AVSYNC_BENCH_SCENARIO_DIR, s->file);
+      ok = netsim_scenario_load(&scenario, path, err, sizeof(err));
+    } else {
+      ok = netsim_scenario_parse(&scenario, s->text, err, sizeof(err));
+    }
+    if (!ok) {
+      fprintf(stderr, "avsync: scenario %s: %s\n", s->name, err);
+      continue;
+    }
+    Timeline tl;
+    record_timeline(&scenario, &tl);
+    size_t count = timeline_events(&tl, events);
+    PlayoutResult result;
+    playout(events, count, false, &result);
+    report(s->name, false, &result);
+    playout(events, count, true, &result);
+    report(s->name, true, &result);
+    free(tl.audio_arrival);
+    free(tl.video_arrival);
+    free(tl.video_received);
+    free(tl.record_unit);
+  }
+  free(events);
+}
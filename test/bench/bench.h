@@ -0,0 +1,30 @@
+#pragma once
+
+/*
+ * Shared helpers for the vitarps5_bench host benchmarks.
+ *
+ * Every benchmark exposes `void run_<name>_bench(void)` and is registered in
+ * bench_main.c. Results are printed one line per measurement as
+ * "BENCH <name> key=value ..." so runs can be diffed or grepped.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static inline int bench_u64_cmp(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* Sorts samples in place and returns the value at percentile p (0..100). */
+static inline uint64_t bench_percentile(uint64_t *samples, size_t count, double p) {
+  if (!count)
+    return 0;
+  qsort(samples, count, sizeof(*samples), bench_u64_cmp);
+  size_t idx = (size_t)((p / 100.0) * (double)(count - 1) + 0.5);
+  if (idx >= count)
+    idx = count - 1;
+  return samples[idx];
+}
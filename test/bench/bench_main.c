@@ -0,0 +1,58 @@
+/*
+ * bench_main.c — Entry point of the vitarps5_bench host benchmarks.
+ *
+ * Usage: vitarps5_bench [name...]
+ * Without arguments every benchmark runs, otherwise only the named ones.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+void run_threadrole_bench(void);
+void run_netsim_bench(void);
+void run_notifqueue_bench(void);
+void run_jsonscan_bench(void);
+void run_startup_bench(void);
+void run_glyph_cache_bench(void);
+void run_avsync_bench(void);
+void run_launchhints_bench(void);
+void run_decodegov_bench(void);
+void run_nalcheck_bench(void);
+
+typedef struct {
+  const char *name;
+  void (*run)(void);
+} BenchEntry;
+
+static const BenchEntry benches[] = {
+    {"threadrole", run_threadrole_bench},
+    {"netsim", run_netsim_bench},
+    {"notifqueue", run_notifqueue_bench},
+    {"jsonscan", run_jsonscan_bench},
+    {"startup", run_startup_bench},
+    {"glyph_cache", run_glyph_cache_bench},
+    {"avsync", run_avsync_bench},
+    {"launchhints", run_launchhints_bench},
+    {"decodegov", run_decodegov_bench},
+    {"nalcheck", run_nalcheck_bench},
+};
+
+int main(int argc, char *argv[]) {
+  size_t count = sizeof(benches) / sizeof(benches[0]);
+  int ran = 0;
+  for (size_t i = 0; i < count; i++) {
+    bool selected = argc < 2;
+    for (int a = 1; a < argc && !selected; a++)
+      selected = strcmp(argv[a], benches[i].name) == 0;
+    if (!selected)
+      continue;
+    benches[i].run();
+    ran++;
+  }
+  if (!ran) {
+    fprintf(stderr, "no benchmark matched\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,519 @@
+/*
+ * costacct_bench.c — Accuracy and overhead of the cost accounting
+ * (lib/src/costacct.c, vitarps5_costacct).
+ *
+ * CPU: threads bound to a ChiakiCostAcct burn CPU, part of it inside
+ * CHIAKI_COST_SCOPE(CHIAKI_COST_FEC) with an inner CHIAKI_COST_BITSTREAM
+ * scope. Each thread's CPU time from the snapshot must match what
+ * getrusage(RUSAGE_THREAD) saw between binding and leaving, their sum what
+ * getrusage(RUSAGE_SELF) saw for the process, and the time charged to the
+ * scoped subsystems what the threads measured around their scopes. In
+ * CHIAKI_COST_MODE_DETAILED every scope is timed, in
+ * CHIAKI_COST_MODE_SAMPLED the estimate from one in sample_every scopes must
+ * still be close.
+ *
+ * Allocations: a bound thread runs a random sequence of chiaki_cost_malloc(),
+ * calloc(), realloc() and free() inside and outside of scopes. malloc and
+ * friends are wrapped at link time (see test/CMakeLists.txt) and the wrappers
+ * count calls, bytes and histogram buckets per subsystem on that thread; the
+ * snapshot must match them exactly.
+ *
+ * Then a line per mode reports what a scope costs:
+ *
+ *   BENCH costacct_overhead mode=.. ns_per_scope=.. ns_per_alloc=..
+ *
+ * Usage: vitarps5_costacct [--threads N] [--ms N] [--seed N]
+ * Exits 1 on any mismatch.
+ */
+
+#define _GNU_SOURCE
+
+#include <chiaki/costacct.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#define THREADS_MAX 8
+#define ALLOC_OPS 20000
+#define ALLOC_LIVE_MAX 64
+#define OVERHEAD_SCOPES 2000000
+
+// getrusage() of a thread is as exact as its CPU clock on current kernels, the slack covers
+// the accountant's own reads happening a little before or after
+#define CPU_SLACK_PCT 3
+#define CPU_SLACK_US 3000
+#define SAMPLED_SLACK_PCT 10
+
+/* ---- allocation hook ----------------------------------------------------- */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+typedef struct {
+  uint64_t allocs;
+  uint64_t alloc_bytes;
+  uint64_t frees;
+  uint64_t alloc_hist[CHIAKI_COST_HIST_BUCKETS];
+} HookCounters;
+
+// only the checking thread counts, and only while hook_subsys is set
+static __thread HookCounters hook_counters[CHIAKI_COST_SUBSYS_COUNT];
+static __thread int hook_subsys = -1;
+
+static void hook_alloc(size_t size) {
+  if (hook_subsys < 0)
+    return;
+  HookCounters *c = &hook_counters[hook_subsys];
+  c->allocs++;
+  c->alloc_bytes += size;
+  c->alloc_hist[chiaki_cost_hist_bucket(size)]++;
+}
+
+void *__wrap_malloc(size_t size) {
+  void *p = __real_malloc(size);
+  if (p)
+    hook_alloc(size);
+  return p;
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+  void *p = __real_calloc(nmemb, size);
+  if (p)
+    hook_alloc(nmemb * size);
+  return p;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  void *p = __real_realloc(ptr, size);
+  if (p)
+    hook_alloc(size);
+  return p;
+}
+
+void __wrap_free(void *ptr) {
+  if (ptr && hook_subsys >= 0)
+    hook_counters[hook_subsys].frees++;
+  __real_free(ptr);
+}
+
+/* ---- helpers ------------------------------------------------------------- */
+
+static int failures;
+
+#define CHECK(cond, ...)                                                       \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "COSTACCT FAIL: " __VA_ARGS__);                          \
+      fputc('\n', stderr);                                                     \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+static uint64_t thread_cpu_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t mono_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t rusage_us(int who) {
+  struct rusage ru;
+  getrusage(who, &ru);
+  return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + (uint64_t)ru.ru_utime.tv_usec +
+         (uint64_t)ru.ru_stime.tv_usec;
+}
+
+// a scope measured with two reads of the clock seems longer by about one read
+static uint64_t clock_read_ns;
+
+static void calibrate_clock_read(void) {
+  clock_read_ns = UINT64_MAX;
+  for (int i = 0; i < 16; i++) {
+    uint64_t a = thread_cpu_ns();
+    uint64_t b = thread_cpu_ns();
+    if (b - a < clock_read_ns)
+      clock_read_ns = b - a;
+  }
+}
+
+static uint64_t measured_since(uint64_t t0) {
+  uint64_t ns = thread_cpu_ns() - t0;
+  return ns > clock_read_ns ? ns - clock_read_ns : 0;
+}
+
+static __thread volatile uint64_t burn_sink;
+
+static void burn_ns(uint64_t ns) {
+  uint64_t end = thread_cpu_ns() + ns;
+  uint64_t x = burn_sink;
+  while (thread_cpu_ns() < end) {
+    for (int i = 0; i < 64; i++)
+      x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+  }
+  burn_sink = x;
+}
+
+static bool close_to(uint64_t a, uint64_t b, unsigned pct, uint64_t slack) {
+  uint64_t d = a > b ? a - b : b - a;
+  uint64_t m = a > b ? a : b;
+  return d <= m * pct / 100 + slack;
+}
+
+static uint64_t rng_next(uint64_t *s) {
+  *s ^= *s << 13;
+  *s ^= *s >> 7;
+  *s ^= *s << 17;
+  return *s;
+}
+
+/* ---- CPU accuracy -------------------------------------------------------- */
+
+typedef struct {
+  ChiakiCostAcct *acct;
+  ChiakiCostSubsys home;
+  uint64_t burn_ns;
+  uint64_t scope_ns; // length of one outer scope
+  // measured by the thread itself
+  uint64_t rusage_us;
+  uint64_t fec_ns;
+  uint64_t bitstream_ns;
+} CpuWorker;
+
+static void *cpu_worker_func(void *user) {
+  CpuWorker *w = user;
+  char name[16];
+  snprintf(name, sizeof(name), "Cost %s", chiaki_cost_subsys_string(w->home));
+  chiaki_cost_thread_enter(w->acct, w->home, name);
+  uint64_t ru0 = rusage_us(RUSAGE_THREAD);
+  uint64_t start = thread_cpu_ns();
+
+  // a third in FEC scopes, a quarter of those in an inner bitstream scope, the rest at home
+  while (thread_cpu_ns() - start < w->burn_ns) {
+    burn_ns(w->scope_ns);
+    uint64_t t0 = thread_cpu_ns();
+    CHIAKI_COST_SCOPE(CHIAKI_COST_FEC) {
+      burn_ns(w->scope_ns * 3 / 8);
+      uint64_t b0 = thread_cpu_ns();
+      CHIAKI_COST_SCOPE(CHIAKI_COST_BITSTREAM)
+        burn_ns(w->scope_ns / 8);
+      w->bitstream_ns += measured_since(b0);
+      burn_ns(w->scope_ns * 3 / 8);
+    }
+    w->fec_ns += measured_since(t0);
+    burn_ns(w->scope_ns);
+  }
+
+  w->rusage_us = rusage_us(RUSAGE_THREAD) - ru0;
+  chiaki_cost_thread_leave();
+  return NULL;
+}
+
+static void check_cpu(ChiakiCostMode mode, unsigned threads, unsigned ms, uint64_t scope_ns) {
+  const char *mode_str = mode == CHIAKI_COST_MODE_DETAILED ? "detailed" : "sampled";
+  ChiakiCostConfig config;
+  chiaki_cost_config_defaults(&config);
+  config.mode = mode;
+  ChiakiCostAcct *acct = chiaki_cost_acct_new(&config);
+  CHECK(acct, "chiaki_cost_acct_new");
+  if (!acct)
+    return;
+
+  static const ChiakiCostSubsys homes[] = {CHIAKI_COST_TAKION, CHIAKI_COST_GKCRYPT, CHIAKI_COST_SEND_BUFFER,
+                                           CHIAKI_COST_FEEDBACK};
+  CpuWorker workers[THREADS_MAX];
+  pthread_t tids[THREADS_MAX];
+  uint64_t self0 = rusage_us(RUSAGE_SELF);
+  for (unsigned i = 0; i < threads; i++) {
+    memset(&workers[i], 0, sizeof(workers[i]));
+    workers[i].acct = acct;
+    workers[i].home = homes[i % (sizeof(homes) / sizeof(homes[0]))];
+    workers[i].burn_ns = (uint64_t)ms * 1000000;
+    workers[i].scope_ns = scope_ns;
+    pthread_create(&tids[i], NULL, cpu_worker_func, &workers[i]);
+  }
+  for (unsigned i = 0; i < threads; i++)
+    pthread_join(tids[i], NULL);
+  uint64_t self_us = rusage_us(RUSAGE_SELF) - self0;
+
+  ChiakiCostSnapshot snap;
+  chiaki_cost_acct_snapshot(acct, &snap);
+  CHECK(snap.cpu_supported, "no per-thread CPU clocks");
+  CHECK(snap.mode == mode, "mode");
+  CHECK(snap.threads_count == threads, "%s: threads_count=%zu", mode_str, snap.threads_count);
+
+  uint64_t fec_ns = 0, bitstream_ns = 0, rusage_sum_us = 0;
+  for (unsigned i = 0; i < threads; i++) {
+    fec_ns += workers[i].fec_ns;
+    bitstream_ns += workers[i].bitstream_ns;
+    rusage_sum_us += workers[i].rusage_us;
+  }
+  uint64_t snap_threads_us = 0;
+  for (size_t i = 0; i < snap.threads_count; i++) {
+    CHECK(!snap.threads[i].bound, "%s: thread %s still bound", mode_str, snap.threads[i].name);
+    snap_threads_us += snap.threads[i].cpu_us;
+  }
+  // rounded to us per thread
+  CHECK(close_to(snap_threads_us, snap.cpu_us, 0, snap.threads_count),
+        "%s: threads sum %llu != cpu_us %llu", mode_str, (unsigned long long)snap_threads_us,
+        (unsigned long long)snap.cpu_us);
+
+  // every thread against its own getrusage(RUSAGE_THREAD), matched by home
+  for (unsigned i = 0; i < threads; i++) {
+    bool matched = false;
+    for (size_t j = 0; j < snap.threads_count && !matched; j++) {
+      if (snap.threads[j].home != workers[i].home)
+        continue;
+      matched = close_to(snap.threads[j].cpu_us, workers[i].rusage_us, CPU_SLACK_PCT, CPU_SLACK_US);
+    }
+    CHECK(matched, "%s: no thread of home %s close to getrusage %llu us", mode_str,
+          chiaki_cost_subsys_string(workers[i].home), (unsigned long long)workers[i].rusage_us);
+  }
+  CHECK(close_to(snap.cpu_us, rusage_sum_us, CPU_SLACK_PCT, CPU_SLACK_US * threads),
+        "%s: cpu_us=%llu getrusage(RUSAGE_THREAD) sum=%llu", mode_str, (unsigned long long)snap.cpu_us,
+        (unsigned long long)rusage_sum_us);
+  // the process also ran the main thread, which only waited
+  CHECK(snap.cpu_us <= self_us + CPU_SLACK_US && close_to(snap.cpu_us, self_us, CPU_SLACK_PCT * 2, CPU_SLACK_US * 4),
+        "%s: cpu_us=%llu getrusage(RUSAGE_SELF)=%llu", mode_str, (unsigned long long)snap.cpu_us,
+        (unsigned long long)self_us);
+
+  // scoped time is exclusive: FEC without its inner bitstream scopes
+  unsigned pct = mode == CHIAKI_COST_MODE_DETAILED ? CPU_SLACK_PCT : SAMPLED_SLACK_PCT;
+  uint64_t fec_us = (fec_ns - bitstream_ns) / 1000;
+  CHECK(close_to(snap.subsys[CHIAKI_COST_FEC].cpu_us, fec_us, pct, CPU_SLACK_US),
+        "%s: fec cpu_us=%llu measured=%llu", mode_str, (unsigned long long)snap.subsys[CHIAKI_COST_FEC].cpu_us,
+        (unsigned long long)fec_us);
+  CHECK(close_to(snap.subsys[CHIAKI_COST_BITSTREAM].cpu_us, bitstream_ns / 1000, pct, CPU_SLACK_US),
+        "%s: bitstream cpu_us=%llu measured=%llu", mode_str,
+        (unsigned long long)snap.subsys[CHIAKI_COST_BITSTREAM].cpu_us, (unsigned long long)(bitstream_ns / 1000));
+  uint64_t subsys_sum_us = 0;
+  for (size_t s = 0; s < CHIAKI_COST_SUBSYS_COUNT; s++)
+    subsys_sum_us += snap.subsys[s].cpu_us;
+  CHECK(close_to(subsys_sum_us, snap.cpu_us, pct, CPU_SLACK_US),
+        "%s: subsystems sum %llu cpu_us=%llu", mode_str, (unsigned long long)subsys_sum_us,
+        (unsigned long long)snap.cpu_us);
+  uint64_t scopes = snap.subsys[CHIAKI_COST_FEC].scopes;
+  CHECK(scopes && snap.subsys[CHIAKI_COST_BITSTREAM].scopes == scopes, "%s: scopes fec=%llu bitstream=%llu",
+        mode_str, (unsigned long long)scopes, (unsigned long long)snap.subsys[CHIAKI_COST_BITSTREAM].scopes);
+  if (mode == CHIAKI_COST_MODE_DETAILED)
+    CHECK(snap.subsys[CHIAKI_COST_FEC].scopes_timed == scopes, "detailed: not every scope timed");
+  else
+    CHECK(snap.subsys[CHIAKI_COST_FEC].scopes_timed < scopes, "sampled: every scope timed");
+
+  printf("COSTACCT cpu mode=%s threads=%u cpu_us=%llu rusage_us=%llu fec_us=%llu/%llu bitstream_us=%llu/%llu "
+         "scopes=%llu timed=%llu\n",
+         mode_str, threads, (unsigned long long)snap.cpu_us, (unsigned long long)rusage_sum_us,
+         (unsigned long long)snap.subsys[CHIAKI_COST_FEC].cpu_us, (unsigned long long)fec_us,
+         (unsigned long long)snap.subsys[CHIAKI_COST_BITSTREAM].cpu_us, (unsigned long long)(bitstream_ns / 1000),
+         (unsigned long long)scopes, (unsigned long long)snap.subsys[CHIAKI_COST_FEC].scopes_timed);
+  chiaki_cost_acct_free(acct);
+}
+
+/* ---- allocation accuracy ------------------------------------------------- */
+
+typedef struct {
+  ChiakiCostAcct *acct;
+  uint64_t seed;
+} AllocWorker;
+
+static size_t random_size(uint64_t *rng) {
+  // mostly packet sized, some tiny, some frame sized
+  switch (rng_next(rng) % 4) {
+  case 0:
+    return 1 + rng_next(rng) % 32;
+  case 3:
+    return 1 + rng_next(rng) % (1 << 20);
+  default:
+    return 1 + rng_next(rng) % 2048;
+  }
+}
+
+static void *alloc_worker_func(void *user) {
+  AllocWorker *w = user;
+  static const ChiakiCostSubsys scoped[] = {CHIAKI_COST_FEC, CHIAKI_COST_GKCRYPT, CHIAKI_COST_SEND_BUFFER};
+  void *live[ALLOC_LIVE_MAX] = {0};
+  uint64_t rng = w->seed | 1;
+
+  memset(hook_counters, 0, sizeof(hook_counters));
+  chiaki_cost_thread_enter(w->acct, CHIAKI_COST_TAKION, "Cost alloc");
+  for (int op = 0; op < ALLOC_OPS; op++) {
+    // a third outside of scopes, charged to the home
+    unsigned which = (unsigned)(rng_next(&rng) % 3);
+    ChiakiCostSubsys subsys = which ? scoped[rng_next(&rng) % 3] : CHIAKI_COST_TAKION;
+    if (which)
+      chiaki_cost_scope_begin(subsys);
+    hook_subsys = (int)subsys;
+
+    void **slot = &live[rng_next(&rng) % ALLOC_LIVE_MAX];
+    size_t size = random_size(&rng);
+    switch (rng_next(&rng) % 4) {
+    case 0:
+      chiaki_cost_free(*slot);
+      *slot = chiaki_cost_malloc(size);
+      break;
+    case 1:
+      chiaki_cost_free(*slot);
+      *slot = chiaki_cost_calloc(1 + size % 8, size / 8 + 1);
+      break;
+    case 2: {
+      void *p = chiaki_cost_realloc(*slot, size);
+      if (p)
+        *slot = p;
+      break;
+    }
+    default:
+      chiaki_cost_free(*slot);
+      *slot = NULL;
+      break;
+    }
+
+    hook_subsys = -1;
+    if (which)
+      chiaki_cost_scope_end();
+  }
+  hook_subsys = CHIAKI_COST_TAKION;
+  for (size_t i = 0; i < ALLOC_LIVE_MAX; i++)
+    chiaki_cost_free(live[i]);
+  hook_subsys = -1;
+  chiaki_cost_thread_leave();
+
+  // not bound anymore, neither counted
+  free(chiaki_cost_malloc(64));
+  return NULL;
+}
+
+static HookCounters alloc_expected[CHIAKI_COST_SUBSYS_COUNT];
+
+static void *alloc_worker_main(void *user) {
+  alloc_worker_func(user);
+  memcpy(alloc_expected, hook_counters, sizeof(alloc_expected));
+  return NULL;
+}
+
+static void check_alloc(ChiakiCostMode mode, uint64_t seed) {
+  const char *mode_str = mode == CHIAKI_COST_MODE_DETAILED ? "detailed" : "sampled";
+  ChiakiCostConfig config;
+  chiaki_cost_config_defaults(&config);
+  config.mode = mode;
+  ChiakiCostAcct *acct = chiaki_cost_acct_new(&config);
+  CHECK(acct, "chiaki_cost_acct_new");
+  if (!acct)
+    return;
+
+  AllocWorker w = {acct, seed};
+  pthread_t tid;
+  pthread_create(&tid, NULL, alloc_worker_main, &w);
+  pthread_join(tid, NULL);
+
+  ChiakiCostSnapshot snap;
+  chiaki_cost_acct_snapshot(acct, &snap);
+  uint64_t allocs = 0, bytes = 0;
+  for (size_t s = 0; s < CHIAKI_COST_SUBSYS_COUNT; s++) {
+    const ChiakiCostSubsysStats *st = &snap.subsys[s];
+    const HookCounters *e = &alloc_expected[s];
+    const char *name = chiaki_cost_subsys_string((ChiakiCostSubsys)s);
+    CHECK(st->allocs == e->allocs, "%s %s: allocs=%llu hook=%llu", mode_str, name, (unsigned long long)st->allocs,
+          (unsigned long long)e->allocs);
+    CHECK(st->alloc_bytes == e->alloc_bytes, "%s %s: alloc_bytes=%llu hook=%llu", mode_str, name,
+          (unsigned long long)st->alloc_bytes, (unsigned long long)e->alloc_bytes);
+    CHECK(st->frees == e->frees, "%s %s: frees=%llu hook=%llu", mode_str, name, (unsigned long long)st->frees,
+          (unsigned long long)e->frees);
+    for (size_t b = 0; b < CHIAKI_COST_HIST_BUCKETS; b++) {
+      uint64_t want = mode == CHIAKI_COST_MODE_DETAILED ? e->alloc_hist[b] : 0;
+      CHECK(st->alloc_hist[b] == want, "%s %s: bucket %zu=%llu want %llu", mode_str, name, b,
+            (unsigned long long)st->alloc_hist[b], (unsigned long long)want);
+    }
+    allocs += st->allocs;
+    bytes += st->alloc_bytes;
+  }
+  CHECK(allocs > ALLOC_OPS / 2, "%s: only %llu allocs", mode_str, (unsigned long long)allocs);
+  printf("COSTACCT alloc mode=%s allocs=%llu bytes=%llu\n", mode_str, (unsigned long long)allocs,
+         (unsigned long long)bytes);
+  chiaki_cost_acct_free(acct);
+}
+
+/* ---- overhead ------------------------------------------------------------ */
+
+static void report_overhead(const char *mode_str, ChiakiCostAcct *acct) {
+  chiaki_cost_thread_enter(acct, CHIAKI_COST_TAKION, "Cost overhead");
+  uint64_t t0 = mono_ns();
+  for (int i = 0; i < OVERHEAD_SCOPES; i++) {
+    CHIAKI_COST_SCOPE(CHIAKI_COST_FEC)
+      burn_sink++;
+  }
+  uint64_t t1 = mono_ns();
+  for (int i = 0; i < OVERHEAD_SCOPES / 10; i++)
+    chiaki_cost_free(chiaki_cost_malloc(256));
+  uint64_t t2 = mono_ns();
+  chiaki_cost_thread_leave();
+  printf("BENCH costacct_overhead mode=%s ns_per_scope=%.1f ns_per_alloc=%.1f\n", mode_str,
+         (double)(t1 - t0) / OVERHEAD_SCOPES, (double)(t2 - t1) / (OVERHEAD_SCOPES / 10));
+}
+
+static void check_overhead(void) {
+  report_overhead("unbound", NULL);
+  ChiakiCostConfig config;
+  chiaki_cost_config_defaults(&config);
+  ChiakiCostAcct *acct = chiaki_cost_acct_new(&config);
+  report_overhead("sampled", acct);
+  chiaki_cost_acct_free(acct);
+  config.mode = CHIAKI_COST_MODE_DETAILED;
+  acct = chiaki_cost_acct_new(&config);
+  report_overhead("detailed", acct);
+  chiaki_cost_acct_free(acct);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned threads = 4;
+  unsigned ms = 300;
+  uint64_t seed = 0xc057;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    if (strcmp(arg, "--threads") == 0)
+      threads = (unsigned)atoi(val);
+    else if (strcmp(arg, "--ms") == 0)
+      ms = (unsigned)atoi(val);
+    else if (strcmp(arg, "--seed") == 0)
+      seed = strtoull(val, NULL, 0);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+  if (!threads || threads > THREADS_MAX || !ms) {
+    fprintf(stderr, "invalid options\n");
+    return 2;
+  }
+
+  calibrate_clock_read();
+  // long scopes when every one is timed, short ones for the sampled estimate
+  check_cpu(CHIAKI_COST_MODE_DETAILED, threads, ms, 200000);
+  check_cpu(CHIAKI_COST_MODE_SAMPLED, threads, ms, 8000);
+  check_alloc(CHIAKI_COST_MODE_DETAILED, seed);
+  check_alloc(CHIAKI_COST_MODE_SAMPLED, seed);
+  check_overhead();
+
+  if (failures) {
+    fprintf(stderr, "COSTACCT %d failures\n", failures);
+    return 1;
+  }
+  return 0;
+}
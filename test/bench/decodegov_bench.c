@@ -0,0 +1,204 @@
+/*
+ * decodegov_bench.c — Latency and visual continuity under decode pressure,
+ * with and without ChiakiDecodeGovernor.
+ *
+ * A console sends SECONDS of 60 fps video at REQUESTED_KBPS. The scene is
+ * calm, then high-motion from MOTION_START_S to MOTION_END_S with a heavier
+ * burst every other second, and every frame's complexity varies by +/-15%.
+ * The frames are decoded one after the other on the thread that receives
+ * them, like the Vita does in host_video_cb(). The decoder is a model: a frame
+ * costs DECODE_BASE_US times its complexity and the square root of the
+ * bitrate share, divided by the CPU share the decoder gets. ffmpeg and a
+ * recorded stream are not part of the host build, the model stands in for
+ * them, with CPU shares down to what a busy Linux client leaves.
+ *
+ * Streams differ in the frames nothing refers to:
+ *
+ *   all_ref   every frame is a reference, what the PS5 sends today
+ *   nonref_4  every 4th frame is non-reference
+ *   nonref_2  every other frame, a two-layer hierarchical P stream
+ *
+ * Policies:
+ *
+ *   decode_all  every frame is decoded, as before the governor
+ *   governor    chiaki_decode_governor_config_defaults(); an escalation restarts
+ *               the stream at the suggested bitrate, which takes RESTART_GAP_US
+ *               without frames, like the Vita's soft restart
+ *
+ * A display shows the newest decoded frame at every 60 Hz vsync. Reports the
+ * latency from a frame's arrival until it is decoded, the share of frames
+ * shown, the longest run of frames never shown and the longest time the
+ * picture stood still, which is what a viewer sees as a freeze.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chiaki/decodegov.h>
+
+#include "bench.h"
+
+#define SECONDS 20
+#define FPS 60
+#define FRAME_US (1000000 / FPS)
+#define FRAMES (SECONDS * FPS)
+#define REQUESTED_KBPS 10000
+#define DECODE_BASE_US 8000.0
+#define MOTION_START_S 5
+#define MOTION_END_S 15
+#define MOTION_COMPLEXITY 1.9
+#define BURST_COMPLEXITY 2.4
+#define BURST_US (500 * 1000ULL)
+#define IDR_COMPLEXITY 3.0
+#define RESTART_GAP_US (400 * 1000ULL)
+
+typedef struct {
+  const char *name;
+  int non_reference_every; /* 0 for none */
+} GopPattern;
+
+static const GopPattern gops[] = {
+    {"all_ref", 0},
+    {"nonref_4", 4},
+    {"nonref_2", 2},
+};
+
+static const double cpu_shares[] = {1.0, 0.8, 0.65};
+
+typedef struct {
+  uint64_t latency_p50_us;
+  uint64_t latency_p95_us;
+  uint64_t latency_max_us;
+  double shown_pct;
+  uint32_t max_skip;
+  uint64_t freeze_max_us;
+  uint64_t shed;
+  uint64_t escalations;
+  uint32_t kbps_end;
+} RunResult;
+
+static double complexity[FRAMES];
+static uint64_t done_us[FRAMES]; /* 0 if the frame was not decoded */
+static uint64_t latency_samples[FRAMES];
+
+static uint64_t rng_next(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static void build_scene(uint64_t seed) {
+  uint64_t rng = seed;
+  for (int i = 0; i < FRAMES; i++) {
+    uint64_t t = (uint64_t)i * FRAME_US;
+    double c = 1.0;
+    if (t >= MOTION_START_S * 1000000ULL && t < MOTION_END_S * 1000000ULL) {
+      bool burst = (t / 1000000ULL) % 2 == 0 && t % 1000000ULL < BURST_US;
+      c = burst ? BURST_COMPLEXITY : MOTION_COMPLEXITY;
+    }
+    double noise = (double)(rng_next(&rng) % 3001) / 10000.0 - 0.15;
+    complexity[i] = c * (1.0 + noise);
+  }
+  complexity[0] = IDR_COMPLEXITY;
+}
+
+static RunResult run(const GopPattern *gop, double cpu, bool governed) {
+  ChiakiDecodeGovernorConfig config;
+  chiaki_decode_governor_config_defaults(&config);
+  config.fps = FPS;
+  ChiakiDecodeGovernor governor;
+  chiaki_decode_governor_init(&governor, &config);
+
+  uint32_t kbps = REQUESTED_KBPS;
+  uint64_t decoder_free_us = 0, resume_us = 0;
+  size_t latencies = 0;
+  memset(done_us, 0, sizeof(done_us));
+
+  for (int i = 0; i < FRAMES; i++) {
+    uint64_t arrival = (uint64_t)i * FRAME_US;
+    if (arrival < resume_us)
+      continue; /* sent while the stream restarts */
+    uint64_t start = arrival > decoder_free_us ? arrival : decoder_free_us;
+    bool non_reference = gop->non_reference_every && (i + 1) % gop->non_reference_every == 0;
+    if (governed && chiaki_decode_governor_frame(&governor, non_reference, start))
+      continue;
+
+    double bitrate_share = sqrt((double)kbps / (double)REQUESTED_KBPS);
+    uint64_t cost = (uint64_t)(DECODE_BASE_US * complexity[i] * bitrate_share / cpu);
+    uint64_t done = start + cost;
+    done_us[i] = done;
+    latency_samples[latencies++] = done - arrival;
+    decoder_free_us = done;
+    if (!governed)
+      continue;
+
+    chiaki_decode_governor_decoded(&governor, cost, done);
+    if (chiaki_decode_governor_take_escalation(&governor)) {
+      uint32_t target = chiaki_decode_governor_target_kbps(&governor, kbps);
+      if (target < kbps) {
+        kbps = target;
+        resume_us = done + RESTART_GAP_US;
+        chiaki_decode_governor_reset(&governor);
+      }
+    }
+  }
+
+  /* Every vsync shows the newest frame decoded by then. */
+  int shown = 0, last = -1, next = 0;
+  uint32_t max_skip = 0;
+  uint64_t last_change_us = 0, freeze_max_us = 0;
+  uint64_t end_us = (uint64_t)FRAMES * FRAME_US + 1000000ULL;
+  for (uint64_t vsync = FRAME_US / 2; vsync < end_us; vsync += FRAME_US) {
+    int newest = -1;
+    while (next < FRAMES && (!done_us[next] || done_us[next] <= vsync)) {
+      if (done_us[next])
+        newest = next;
+      next++;
+    }
+    if (newest < 0)
+      continue;
+    uint32_t skipped = (uint32_t)(newest - last - 1);
+    if (skipped > max_skip)
+      max_skip = skipped;
+    if (last >= 0 && vsync - last_change_us > freeze_max_us)
+      freeze_max_us = vsync - last_change_us;
+    last = newest;
+    last_change_us = vsync;
+    shown++;
+  }
+
+  RunResult r;
+  r.latency_p50_us = bench_percentile(latency_samples, latencies, 50);
+  r.latency_p95_us = bench_percentile(latency_samples, latencies, 95);
+  r.latency_max_us = latencies ? latency_samples[latencies - 1] : 0;
+  r.shown_pct = 100.0 * shown / FRAMES;
+  r.max_skip = max_skip;
+  r.freeze_max_us = freeze_max_us;
+  r.shed = governor.shed;
+  r.escalations = governor.escalations;
+  r.kbps_end = kbps;
+  return r;
+}
+
+void run_decodegov_bench(void) {
+  build_scene(0x5eed1234abcdULL);
+  for (size_t c = 0; c < sizeof(cpu_shares) / sizeof(cpu_shares[0]); c++) {
+    for (size_t g = 0; g < sizeof(gops) / sizeof(gops[0]); g++) {
+      for (int governed = 0; governed < 2; governed++) {
+        RunResult r = run(&gops[g], cpu_shares[c], governed);
+        printf("BENCH decodegov cpu=%.2f gop=%s policy=%s latency_p50_ms=%.1f latency_p95_ms=%.1f "
+               "latency_max_ms=%.1f shown_pct=%.1f max_skip=%u freeze_max_ms=%.1f shed=%llu "
+               "escalations=%llu kbps_end=%u\n",
+               cpu_shares[c], gops[g].name, governed ? "governor" : "decode_all",
+               r.latency_p50_us / 1000.0, r.latency_p95_us / 1000.0, r.latency_max_us / 1000.0,
+               r.shown_pct, r.max_skip, r.freeze_max_us / 1000.0, (unsigned long long)r.shed,
+               (unsigned long long)r.escalations, r.kbps_end);
+      }
+    }
+  }
+}
@@ -0,0 +1,554 @@
+/*
+ * fec_bench.c — Progressive FEC decoding against the one-shot decode
+ * (vitarps5_fec).
+ *
+ * Frames of k source and m fec units are encoded with chiaki_fec_encode() and
+ * arrive in order with a loss pattern applied. The one-shot path copies every
+ * unit into the frame buffer and, once k units are in, builds the erasure list
+ * and runs chiaki_fec_decode(), as ChiakiFrameProcessor did. The progressive
+ * path puts every unit into a ChiakiFecDecoder as it arrives and calls
+ * chiaki_fec_decoder_solve() once k units are in.
+ *
+ * Reports per frame type and loss pattern the latency from the arrival of the
+ * last needed unit to the decoded frame (p50/p99/max), the CPU time spent per
+ * frame over all of its units, and for the progressive path how often the
+ * inverse came from the cache. Both paths must restore every source unit.
+ * Then frames with random loss and reordering go through ChiakiFrameProcessor,
+ * whose flushed frames must match the encoded payloads.
+ *
+ * Reordered frames without loss must leave no fec rows tracked in the decoder,
+ * whether a unit is swapped with its successor or held back far enough to
+ * look lost for a while.
+ *
+ * --crosscheck N decodes N frames of random k, m, loss and reordering with
+ * both paths from the same received units, the progressive one falling back to
+ * chiaki_fec_decode() on any error of chiaki_fec_decoder_solve() as the frame
+ * processor does, and requires both to restore the same source units.
+ *
+ * Usage: vitarps5_fec [--frames N] [--crosscheck N] [--seed N]
+ * Exits 1 on any mismatch.
+ */
+
+#include <chiaki/common.h>
+#include <chiaki/fec.h>
+#include <chiaki/frameprocessor.h>
+#include <chiaki/log.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+#define UNIT_SIZE 1184
+#define UNIT_STRIDE (((UNIT_SIZE + 0xf) / 0x10) * 0x10)
+#define UNITS_MAX 256
+#define MIXED_LOSS_PCT 5
+#define REORDER_PCT 10
+
+typedef struct {
+  uint64_t s;
+} Rng;
+
+static uint64_t rng_next(Rng *r) {
+  r->s ^= r->s >> 12;
+  r->s ^= r->s << 25;
+  r->s ^= r->s >> 27;
+  return r->s * 0x2545F4914F6CDD1Dull;
+}
+
+static uint32_t rng_range(Rng *r, uint32_t n) { return (uint32_t)(rng_next(r) % n); }
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+typedef struct {
+  const char *name;
+  unsigned k, m;
+} FrameType;
+
+/* P-frames and IDRs as in soak.c, and an IDR at a high bitrate */
+static const FrameType frame_types[] = {
+    {"p", 12, 4},
+    {"idr", 40, 10},
+    {"idr_hi", 120, 30},
+};
+
+typedef enum { LOSS_SINGLE, LOSS_TAIL, LOSS_PAIR, LOSS_BURST4, LOSS_MIXED, LOSS_COUNT } LossPattern;
+
+static const char *loss_names[] = {"single", "tail", "pair", "burst4", "mixed"};
+
+typedef struct {
+  unsigned k, m;
+  uint8_t *units; /* encoded, k + m strides */
+  size_t wire_size[UNITS_MAX];
+} Frame;
+
+static bool frame_build(Frame *f, Rng *rng, unsigned k, unsigned m) {
+  f->k = k;
+  f->m = m;
+  f->units = calloc((size_t)(k + m), UNIT_STRIDE);
+  if (!f->units)
+    return false;
+  for (unsigned i = 0; i < k; i++) {
+    uint8_t *unit = f->units + (size_t)i * UNIT_STRIDE;
+    size_t payload = i + 1 < k ? UNIT_SIZE - 2 - rng_range(rng, 64) : 1 + rng_range(rng, UNIT_SIZE - 2);
+    size_t padding = UNIT_SIZE - (payload + 2);
+    unit[0] = (uint8_t)(padding >> 8);
+    unit[1] = (uint8_t)padding;
+    for (size_t j = 0; j < payload; j++)
+      unit[2 + j] = (uint8_t)rng_next(rng);
+    f->wire_size[i] = payload + 2;
+  }
+  for (unsigned i = k; i < k + m; i++)
+    f->wire_size[i] = UNIT_SIZE;
+  return chiaki_fec_encode(f->units, UNIT_SIZE, UNIT_STRIDE, k, m) == CHIAKI_ERR_SUCCESS;
+}
+
+/* Marks lost units, at most m and at least one source unit. */
+static void loss_draw(LossPattern pattern, unsigned k, unsigned m, Rng *rng, bool *lost) {
+  memset(lost, 0, (k + m) * sizeof(bool));
+  switch (pattern) {
+  case LOSS_SINGLE:
+    lost[rng_range(rng, k)] = true;
+    break;
+  case LOSS_TAIL:
+    lost[k - 1] = true;
+    break;
+  case LOSS_PAIR:
+    lost[rng_range(rng, k)] = true;
+    for (;;) {
+      unsigned i = rng_range(rng, k);
+      if (!lost[i]) {
+        lost[i] = true;
+        break;
+      }
+    }
+    break;
+  case LOSS_BURST4: {
+    unsigned count = m < 4 ? m : 4;
+    unsigned start = rng_range(rng, k - count + 1);
+    for (unsigned i = 0; i < count; i++)
+      lost[start + i] = true;
+    break;
+  }
+  default:
+    for (;;) {
+      unsigned source = 0, total = 0;
+      for (unsigned i = 0; i < k + m; i++) {
+        lost[i] = rng_range(rng, 100) < MIXED_LOSS_PCT;
+        total += lost[i];
+        source += lost[i] && i < k;
+      }
+      if (source && total <= m)
+        break;
+    }
+    break;
+  }
+}
+
+/*
+ * Units in arrival order up to and including the one completing k, with
+ * reorder_pct of them swapped with their successor.
+ */
+static unsigned arrivals_build(const bool *lost, unsigned k, unsigned m, Rng *rng, unsigned reorder_pct,
+                               unsigned *order) {
+  unsigned count = 0;
+  for (unsigned i = 0; i < k + m; i++)
+    if (!lost[i])
+      order[count++] = i;
+  for (unsigned i = 0; reorder_pct && i + 1 < count; i++) {
+    if (rng_range(rng, 100) < reorder_pct) {
+      unsigned tmp = order[i];
+      order[i] = order[i + 1];
+      order[i + 1] = tmp;
+      i++;
+    }
+  }
+  return count < k ? count : k;
+}
+
+static bool frame_check(const Frame *f, const uint8_t *buf) {
+  for (unsigned i = 0; i < f->k; i++)
+    if (memcmp(f->units + (size_t)i * UNIT_STRIDE, buf + (size_t)i * UNIT_STRIDE, UNIT_SIZE) != 0)
+      return false;
+  return true;
+}
+
+typedef struct {
+  uint64_t *latency;
+  uint64_t cpu_total;
+  size_t count;
+} PathStats;
+
+static bool run_oneshot(const Frame *f, const unsigned *order, unsigned arrivals, uint8_t *buf, PathStats *stats) {
+  unsigned n = f->k + f->m;
+  memset(buf, 0, (size_t)n * UNIT_STRIDE);
+  bool received[UNITS_MAX] = {0};
+  uint64_t cpu = 0, latency = 0;
+  for (unsigned a = 0; a < arrivals; a++) {
+    unsigned i = order[a];
+    uint64_t t0 = now_ns();
+    memcpy(buf + (size_t)i * UNIT_STRIDE, f->units + (size_t)i * UNIT_STRIDE, f->wire_size[i]);
+    received[i] = true;
+    if (a + 1 == arrivals) {
+      size_t erasures_count = n - arrivals;
+      unsigned *erasures = calloc(erasures_count, sizeof(unsigned));
+      if (!erasures)
+        abort();
+      size_t e = 0;
+      for (unsigned j = 0; j < n; j++)
+        if (!received[j])
+          erasures[e++] = j;
+      ChiakiErrorCode err = chiaki_fec_decode(buf, UNIT_SIZE, UNIT_STRIDE, f->k, f->m, erasures, erasures_count);
+      free(erasures);
+      if (err != CHIAKI_ERR_SUCCESS)
+        return false;
+      latency = now_ns() - t0;
+    }
+    cpu += now_ns() - t0;
+  }
+  stats->latency[stats->count++] = latency;
+  stats->cpu_total += cpu;
+  return frame_check(f, buf);
+}
+
+static bool run_progressive(ChiakiFecDecoder *decoder, const Frame *f, const unsigned *order, unsigned arrivals,
+                            uint8_t *buf, PathStats *stats, bool *progressive) {
+  memset(buf, 0, (size_t)(f->k + f->m) * UNIT_STRIDE);
+  uint64_t t0 = now_ns();
+  if (chiaki_fec_decoder_frame_begin(decoder, UNIT_SIZE, UNIT_STRIDE, f->k, f->m) != CHIAKI_ERR_SUCCESS)
+    return false;
+  uint64_t cpu = now_ns() - t0, latency = 0;
+  *progressive = true;
+  for (unsigned a = 0; a < arrivals; a++) {
+    unsigned i = order[a];
+    t0 = now_ns();
+    memcpy(buf + (size_t)i * UNIT_STRIDE, f->units + (size_t)i * UNIT_STRIDE, f->wire_size[i]);
+    chiaki_fec_decoder_put(decoder, buf, i);
+    if (a + 1 == arrivals) {
+      ChiakiErrorCode err = chiaki_fec_decoder_solve(decoder, buf);
+      if (err != CHIAKI_ERR_SUCCESS) {
+        /* the frame processor falls back to chiaki_fec_decode(), see verify_crosscheck() */
+        *progressive = false;
+        return true;
+      }
+      latency = now_ns() - t0;
+    }
+    cpu += now_ns() - t0;
+  }
+  stats->latency[stats->count++] = latency;
+  stats->cpu_total += cpu;
+  return frame_check(f, buf);
+}
+
+static void print_path(const char *type, const char *loss, const char *path, PathStats *stats, const char *extra) {
+  size_t count = stats->count;
+  double cpu = count ? (double)stats->cpu_total / count / 1000.0 : 0.0;
+  uint64_t max = count ? bench_percentile(stats->latency, count, 100) : 0;
+  printf("BENCH fec frame=%s loss=%s path=%s frames=%zu last_unit_p50_us=%.2f last_unit_p99_us=%.2f "
+         "last_unit_max_us=%.2f cpu_per_frame_us=%.2f%s\n",
+         type, loss, path, count, bench_percentile(stats->latency, count, 50) / 1000.0,
+         bench_percentile(stats->latency, count, 99) / 1000.0, max / 1000.0, cpu, extra);
+}
+
+static bool bench_frame_type(const FrameType *type, size_t frames, Rng *rng) {
+  Frame f;
+  if (!frame_build(&f, rng, type->k, type->m))
+    abort();
+  uint8_t *buf = malloc((size_t)(type->k + type->m) * UNIT_STRIDE);
+  uint64_t *latency_oneshot = malloc(frames * sizeof(uint64_t));
+  uint64_t *latency_progressive = malloc(frames * sizeof(uint64_t));
+  if (!buf || !latency_oneshot || !latency_progressive)
+    abort();
+  ChiakiFecDecoder decoder;
+  chiaki_fec_decoder_init(&decoder);
+  bool ok = true;
+
+  for (int pattern = 0; pattern < LOSS_COUNT; pattern++) {
+    PathStats oneshot = {latency_oneshot, 0, 0};
+    PathStats progressive = {latency_progressive, 0, 0};
+    uint64_t hits = decoder.inverse_hits, misses = decoder.inverse_misses;
+    size_t fallbacks = 0;
+    for (size_t n = 0; n < frames; n++) {
+      bool lost[UNITS_MAX];
+      unsigned order[UNITS_MAX];
+      loss_draw((LossPattern)pattern, type->k, type->m, rng, lost);
+      unsigned arrivals = arrivals_build(lost, type->k, type->m, rng, 0, order);
+      bool decoded_progressively;
+      if (!run_oneshot(&f, order, arrivals, buf, &oneshot)) {
+        fprintf(stderr, "fec: one-shot decode of %s/%s frame %zu failed\n", type->name, loss_names[pattern], n);
+        ok = false;
+      }
+      if (!run_progressive(&decoder, &f, order, arrivals, buf, &progressive, &decoded_progressively)) {
+        fprintf(stderr, "fec: progressive decode of %s/%s frame %zu failed\n", type->name, loss_names[pattern], n);
+        ok = false;
+      }
+      if (!decoded_progressively)
+        fallbacks++;
+    }
+    hits = decoder.inverse_hits - hits;
+    misses = decoder.inverse_misses - misses;
+    char extra[96];
+    snprintf(extra, sizeof(extra), " inverse_hit_pct=%.1f fallbacks=%zu",
+             hits + misses ? 100.0 * (double)hits / (double)(hits + misses) : 0.0, fallbacks);
+    print_path(type->name, loss_names[pattern], "oneshot", &oneshot, "");
+    print_path(type->name, loss_names[pattern], "progressive", &progressive, extra);
+  }
+
+  chiaki_fec_decoder_fini(&decoder);
+  free(latency_progressive);
+  free(latency_oneshot);
+  free(buf);
+  free(f.units);
+  return ok;
+}
+
+/* Random loss and reordering through ChiakiFrameProcessor, whose flushed frame must hold every payload. */
+static bool verify_frame_processor(size_t frames, Rng *rng) {
+  ChiakiLog log;
+  chiaki_log_init(&log, 0, NULL, NULL);
+  ChiakiFrameProcessor fp;
+  chiaki_frame_processor_init(&fp, &log);
+  uint8_t *expected = malloc((size_t)UNITS_MAX * UNIT_SIZE);
+  if (!expected)
+    abort();
+  bool ok = true;
+  size_t recovered = 0;
+
+  for (size_t n = 0; n < frames && ok; n++) {
+    const FrameType *type = &frame_types[n % (sizeof(frame_types) / sizeof(frame_types[0]))];
+    Frame f;
+    if (!frame_build(&f, rng, type->k, type->m))
+      abort();
+    size_t expected_size = 0;
+    for (unsigned i = 0; i < f.k; i++) {
+      memcpy(expected + expected_size, f.units + (size_t)i * UNIT_STRIDE + 2, f.wire_size[i] - 2);
+      expected_size += f.wire_size[i] - 2;
+    }
+    bool lost[UNITS_MAX];
+    unsigned order[UNITS_MAX];
+    loss_draw(LOSS_MIXED, f.k, f.m, rng, lost);
+    unsigned arrivals = arrivals_build(lost, f.k, f.m, rng, REORDER_PCT, order);
+
+    for (unsigned a = 0; a < arrivals; a++) {
+      unsigned i = order[a];
+      ChiakiTakionAVPacket packet;
+      memset(&packet, 0, sizeof(packet));
+      packet.is_video = true;
+      packet.frame_index = (uint16_t)n;
+      packet.unit_index = (uint16_t)i;
+      packet.units_in_frame_total = (uint16_t)(f.k + f.m);
+      packet.units_in_frame_fec = (uint16_t)f.m;
+      packet.data = f.units + (size_t)i * UNIT_STRIDE;
+      packet.data_size = f.wire_size[i];
+      if (a == 0 && chiaki_frame_processor_alloc_frame(&fp, &packet) != CHIAKI_ERR_SUCCESS)
+        ok = false;
+      chiaki_frame_processor_put_unit(&fp, &packet);
+    }
+    uint8_t *frame;
+    size_t frame_size;
+    ChiakiFrameProcessorFlushResult result = chiaki_frame_processor_flush(&fp, &frame, &frame_size);
+    if (result != CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_SUCCESS || frame_size != expected_size ||
+        memcmp(frame, expected, expected_size) != 0) {
+      fprintf(stderr, "fec: frame processor frame %zu (%s) result %d size %zu/%zu\n", n, type->name, (int)result,
+              frame_size, expected_size);
+      ok = false;
+    }
+    recovered++;
+    free(f.units);
+  }
+
+  printf("VERIFY fec frame_processor frames=%zu progressive=%llu %s\n", recovered,
+         (unsigned long long)fp.fec_decoder.frames_solved, ok ? "ok" : "MISMATCH");
+  chiaki_frame_processor_fini(&fp);
+  free(expected);
+  return ok;
+}
+
+/* Lossless frames with swaps and with one unit held back, rows_count must be 0 once all source units are in. */
+static bool verify_reorder_lossless(size_t frames, Rng *rng) {
+  uint8_t *buf = malloc((size_t)UNITS_MAX * UNIT_STRIDE);
+  if (!buf)
+    abort();
+  ChiakiFecDecoder decoder;
+  chiaki_fec_decoder_init(&decoder);
+  bool ok = true;
+  unsigned rows_peak = 0;
+
+  for (size_t n = 0; n < frames; n++) {
+    const FrameType *type = &frame_types[n % (sizeof(frame_types) / sizeof(frame_types[0]))];
+    Frame f;
+    if (!frame_build(&f, rng, type->k, type->m))
+      abort();
+    /* only source units, a fec unit swapped ahead of the last one would complete the frame */
+    bool lost[UNITS_MAX] = {0};
+    for (unsigned i = f.k; i < f.k + f.m; i++)
+      lost[i] = true;
+    unsigned order[UNITS_MAX];
+    unsigned arrivals = arrivals_build(lost, f.k, f.m, rng, 4 * REORDER_PCT, order);
+    if (n % 2) {
+      /* hold one source unit back by up to 16 units */
+      unsigned from = rng_range(rng, f.k - 1);
+      unsigned to = from + 1 + rng_range(rng, 16);
+      if (to >= f.k)
+        to = f.k - 1;
+      unsigned held = order[from];
+      memmove(order + from, order + from + 1, (to - from) * sizeof(unsigned));
+      order[to] = held;
+    }
+
+    memset(buf, 0, (size_t)(f.k + f.m) * UNIT_STRIDE);
+    if (chiaki_fec_decoder_frame_begin(&decoder, UNIT_SIZE, UNIT_STRIDE, f.k, f.m) != CHIAKI_ERR_SUCCESS)
+      abort();
+    for (unsigned a = 0; a < arrivals; a++) {
+      unsigned i = order[a];
+      memcpy(buf + (size_t)i * UNIT_STRIDE, f.units + (size_t)i * UNIT_STRIDE, f.wire_size[i]);
+      chiaki_fec_decoder_put(&decoder, buf, i);
+      if (decoder.rows_count > rows_peak)
+        rows_peak = decoder.rows_count;
+    }
+    if (decoder.rows_count || chiaki_fec_decoder_solve(&decoder, buf) != CHIAKI_ERR_SUCCESS || !frame_check(&f, buf)) {
+      fprintf(stderr, "fec: reordered lossless frame %zu (%s) left %u rows tracked\n", n, type->name,
+              decoder.rows_count);
+      ok = false;
+    }
+    free(f.units);
+  }
+
+  printf("VERIFY fec reorder_lossless frames=%zu rows_peak=%u %s\n", frames, rows_peak, ok ? "ok" : "MISMATCH");
+  chiaki_fec_decoder_fini(&decoder);
+  free(buf);
+  return ok;
+}
+
+/*
+ * Same received units through both paths over random frame shapes, up to m units lost anywhere
+ * in the frame and reordering of up to 4 * REORDER_PCT, with one decoder for all frames so its
+ * inverse cache sees every shape.
+ */
+static bool verify_crosscheck(size_t frames, Rng *rng) {
+  uint8_t *oneshot = malloc((size_t)UNITS_MAX * UNIT_STRIDE);
+  uint8_t *progressive = malloc((size_t)UNITS_MAX * UNIT_STRIDE);
+  if (!oneshot || !progressive)
+    abort();
+  ChiakiFecDecoder decoder;
+  chiaki_fec_decoder_init(&decoder);
+  bool ok = true;
+  size_t solved = 0, uninitialized = 0, solve_errors = 0;
+
+  for (size_t n = 0; n < frames; n++) {
+    unsigned k = 1 + rng_range(rng, 160);
+    unsigned m = 1 + rng_range(rng, k / 2 + 1);
+    if (k + m > UNITS_MAX)
+      m = UNITS_MAX - k;
+    Frame f;
+    if (!frame_build(&f, rng, k, m))
+      abort();
+    unsigned n_units = k + m;
+
+    /* mostly as many losses as the progressive decoder tracks, sometimes more */
+    bool lost[UNITS_MAX] = {0};
+    unsigned lost_count = 1 + rng_range(rng, m < 20 ? m : 20);
+    for (unsigned l = 0; l < lost_count;) {
+      unsigned i = rng_range(rng, n_units);
+      if (!lost[i]) {
+        lost[i] = true;
+        l++;
+      }
+    }
+    unsigned order[UNITS_MAX];
+    unsigned arrivals = arrivals_build(lost, k, m, rng, rng_range(rng, 4 * REORDER_PCT), order);
+
+    bool received[UNITS_MAX] = {0};
+    memset(oneshot, 0, (size_t)n_units * UNIT_STRIDE);
+    memset(progressive, 0, (size_t)n_units * UNIT_STRIDE);
+    if (chiaki_fec_decoder_frame_begin(&decoder, UNIT_SIZE, UNIT_STRIDE, k, m) != CHIAKI_ERR_SUCCESS)
+      abort();
+    for (unsigned a = 0; a < arrivals; a++) {
+      unsigned i = order[a];
+      memcpy(oneshot + (size_t)i * UNIT_STRIDE, f.units + (size_t)i * UNIT_STRIDE, f.wire_size[i]);
+      memcpy(progressive + (size_t)i * UNIT_STRIDE, f.units + (size_t)i * UNIT_STRIDE, f.wire_size[i]);
+      chiaki_fec_decoder_put(&decoder, progressive, i);
+      received[i] = true;
+    }
+    unsigned erasures[UNITS_MAX];
+    size_t erasures_count = 0;
+    for (unsigned i = 0; i < n_units; i++)
+      if (!received[i])
+        erasures[erasures_count++] = i;
+
+    ChiakiErrorCode err_oneshot = chiaki_fec_decode(oneshot, UNIT_SIZE, UNIT_STRIDE, k, m, erasures, erasures_count);
+    ChiakiErrorCode err = chiaki_fec_decoder_solve(&decoder, progressive);
+    if (err == CHIAKI_ERR_SUCCESS)
+      solved++;
+    else {
+      if (err == CHIAKI_ERR_UNINITIALIZED)
+        uninitialized++;
+      else
+        solve_errors++;
+      err = chiaki_fec_decode(progressive, UNIT_SIZE, UNIT_STRIDE, k, m, erasures, erasures_count);
+    }
+
+    if (err_oneshot != CHIAKI_ERR_SUCCESS || err != CHIAKI_ERR_SUCCESS || !frame_check(&f, oneshot) ||
+        memcmp(oneshot, progressive, (size_t)k * UNIT_STRIDE) != 0) {
+      fprintf(stderr, "fec: crosscheck frame %zu k=%u m=%u lost=%u oneshot=%d progressive=%d\n", n, k, m, lost_count,
+              (int)err_oneshot, (int)err);
+      ok = false;
+    }
+    free(f.units);
+  }
+
+  printf("VERIFY fec crosscheck frames=%zu progressive=%zu fallback_uninitialized=%zu fallback_error=%zu "
+         "inverse_hits=%llu inverse_misses=%llu %s\n",
+         frames, solved, uninitialized, solve_errors, (unsigned long long)decoder.inverse_hits,
+         (unsigned long long)decoder.inverse_misses, ok ? "ok" : "MISMATCH");
+  chiaki_fec_decoder_fini(&decoder);
+  free(progressive);
+  free(oneshot);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  size_t frames = 2000;
+  size_t crosscheck = 2000;
+  uint64_t seed = 0xfec;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    if (strcmp(arg, "--frames") == 0)
+      frames = (size_t)strtoull(val, NULL, 0);
+    else if (strcmp(arg, "--crosscheck") == 0)
+      crosscheck = (size_t)strtoull(val, NULL, 0);
+    else if (strcmp(arg, "--seed") == 0)
+      seed = strtoull(val, NULL, 0);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+
+  if (chiaki_lib_init() != CHIAKI_ERR_SUCCESS) {
+    fprintf(stderr, "chiaki_lib_init failed\n");
+    return 1;
+  }
+
+  Rng rng = {seed ? seed : 1};
+  bool ok = verify_frame_processor(frames < 300 ? frames : 300, &rng);
+  ok &= verify_reorder_lossless(frames < 300 ? frames : 300, &rng);
+  ok &= verify_crosscheck(crosscheck, &rng);
+  for (size_t i = 0; frames && i < sizeof(frame_types) / sizeof(frame_types[0]); i++)
+    ok &= bench_frame_type(&frame_types[i], frames, &rng);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,264 @@
+/*
+ * glyph_cache_bench.c — Cold against warm UI text prewarm.
+ *
+ * Replays what ui_text_prewarm() does to the vita2d atlases of both UI fonts,
+ * with the prewarm sizes and charset of vita/src/ui/ui_text.c:
+ *
+ *   cold  FreeType rasterizes every glyph at 2x supersample into a
+ *         1024x1024 coverage atlas, keyed by glyph index like
+ *         texture_atlas.c, and the glyphs are written to the cache file
+ *   warm  the font file is hashed for the key, the cache file bulk-loaded
+ *         and every glyph copied into the atlas; the charset is then looked
+ *         up in the font's cmap like the measure-only prewarm pass
+ *
+ * Only the atlas writes differ from the device, where they go to GPU-mapped
+ * texture memory. Without FreeType only the warm load is measured, on the
+ * cache file of a synthetic glyph set.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chiaki/time.h>
+
+#ifdef VITARPS5_HAVE_FREETYPE
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#endif
+
+#include "ui/ui_glyph_cache.h"
+
+#include "bench.h"
+
+#define ROUNDS 50
+#define ATLAS_SIZE 1024
+#define SUPERSAMPLE 2
+
+/* UI_FONT_PREWARM_SIZES and UI_FONT_PREWARM_MONO_SIZES in ui_text.c */
+static const int regular_sizes[] = {14, 16, 18, 20, 24, 28, 40};
+static const int mono_sizes[] = {14, 16, 18};
+
+/* UI_FONT_PREWARM_CHARSET in ui_text.c, as codepoints */
+static const uint32_t extended_charset[] = {0x00B0, 0x00B7, 0x00D7, 0x2026, 0x2192,
+                                            0x2248, 0x25A1, 0x25B3, 0x25CB, 0x2715};
+#define CHARSET_SIZE (0x7f - 0x20 + sizeof(extended_charset) / sizeof(extended_charset[0]))
+
+typedef struct {
+  const char *name;
+  const char *font_path;
+  const int *sizes;
+  size_t size_count;
+  char cache_path[256];
+} BenchFont;
+
+/* Row packer standing in for bin_packing_2d.c. */
+typedef struct {
+  uint8_t *pixels;
+  int pen_x;
+  int pen_y;
+  int row_h;
+  size_t glyphs;
+} Atlas;
+
+static void atlas_reset(Atlas *atlas) {
+  atlas->pen_x = atlas->pen_y = atlas->row_h = 0;
+  atlas->glyphs = 0;
+}
+
+static bool atlas_insert(Atlas *atlas, const uint8_t *coverage, int w, int h) {
+  if (atlas->pen_x + w > ATLAS_SIZE) {
+    atlas->pen_x = 0;
+    atlas->pen_y += atlas->row_h;
+    atlas->row_h = 0;
+  }
+  if (atlas->pen_y + h > ATLAS_SIZE)
+    return false;
+  for (int y = 0; y < h; y++)
+    memcpy(atlas->pixels + (size_t)(atlas->pen_y + y) * ATLAS_SIZE + atlas->pen_x, coverage + (size_t)y * w,
+           (size_t)w);
+  atlas->pen_x += w;
+  if (h > atlas->row_h)
+    atlas->row_h = h;
+  atlas->glyphs++;
+  return true;
+}
+
+static GlyphCacheKey bench_key(const BenchFont *font) {
+  GlyphCacheKey key = {GLYPH_CACHE_HASH_SEED, GLYPH_CACHE_HASH_SEED};
+  if (!glyph_cache_hash_file(font->font_path, &key.font_hash))
+    key.font_hash = 0;
+  key.glyph_set_hash = glyph_cache_hash(key.glyph_set_hash, font->sizes, font->size_count * sizeof(int));
+  return key;
+}
+
+#ifdef VITARPS5_HAVE_FREETYPE
+
+static uint32_t charset_at(size_t i) {
+  return i < 0x7f - 0x20 ? (uint32_t)(0x20 + i) : extended_charset[i - (0x7f - 0x20)];
+}
+
+/* Returns the microseconds of a full cold prewarm, cache write included. */
+static uint64_t cold_prewarm(const BenchFont *font, Atlas *atlas, size_t *glyphs) {
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  FT_Library library;
+  FT_Face face;
+  if (FT_Init_FreeType(&library) || FT_New_Face(library, font->font_path, 0, &face))
+    abort();
+  GlyphCacheKey key = bench_key(font);
+  GlyphCache *cache = glyph_cache_new(&key);
+  if (!cache)
+    abort();
+  atlas_reset(atlas);
+  for (size_t s = 0; s < font->size_count; s++) {
+    int glyph_size = font->sizes[s] * SUPERSAMPLE;
+    FT_Set_Pixel_Sizes(face, 0, (FT_UInt)glyph_size);
+    for (size_t c = 0; c < CHARSET_SIZE; c++) {
+      FT_UInt glyph_index = FT_Get_Char_Index(face, charset_at(c));
+      // the atlas keeps the first size a glyph was rasterized at
+      if (glyph_cache_find(cache, glyph_index))
+        continue;
+      if (FT_Load_Glyph(face, glyph_index, FT_LOAD_RENDER | FT_LOAD_TARGET_NORMAL))
+        abort();
+      FT_GlyphSlot slot = face->glyph;
+      const FT_Bitmap *bitmap = &slot->bitmap;
+      int w = (int)bitmap->width, h = (int)bitmap->rows;
+      uint8_t *coverage = malloc((size_t)w * h + 1);
+      if (!coverage)
+        abort();
+      for (int y = 0; y < h; y++)
+        memcpy(coverage + (size_t)y * w, bitmap->buffer + (size_t)y * bitmap->pitch, (size_t)w);
+      if (!atlas_insert(atlas, coverage, w, h))
+        abort();
+      GlyphCacheEntry e = {glyph_index,
+                           (uint16_t)glyph_size,
+                           (uint16_t)w,
+                           (uint16_t)h,
+                           (int16_t)slot->bitmap_left,
+                           (int16_t)slot->bitmap_top,
+                           (int32_t)(slot->advance.x << 10),
+                           (int32_t)(slot->advance.y << 10),
+                           coverage};
+      if (!glyph_cache_add(cache, &e))
+        abort();
+      free(coverage);
+    }
+  }
+  remove(font->cache_path);
+  if (!glyph_cache_flush_file(cache, font->cache_path))
+    abort();
+  *glyphs = glyph_cache_count(cache);
+  glyph_cache_free(cache);
+  FT_Done_Face(face);
+  FT_Done_FreeType(library);
+  return chiaki_time_now_monotonic_us() - start_us;
+}
+
+#else
+
+/* Stand-in glyphs of the size a 28 px glyph has, for the warm load. */
+static void write_synthetic_cache(const BenchFont *font) {
+  GlyphCacheKey key = bench_key(font);
+  GlyphCache *cache = glyph_cache_new(&key);
+  static uint8_t coverage[22 * 30];
+  if (!cache)
+    abort();
+  for (size_t i = 0; i < sizeof(coverage); i++)
+    coverage[i] = (uint8_t)(i * 13);
+  for (uint32_t c = 0; c < CHARSET_SIZE; c++) {
+    GlyphCacheEntry e = {c + 3, 28, 22, 30, 1, 28, 24 << 16, 0, coverage};
+    if (!glyph_cache_add(cache, &e))
+      abort();
+  }
+  remove(font->cache_path);
+  if (!glyph_cache_flush_file(cache, font->cache_path))
+    abort();
+  glyph_cache_free(cache);
+}
+
+#endif
+
+static uint64_t warm_prewarm(const BenchFont *font, Atlas *atlas, size_t *glyphs) {
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  GlyphCacheKey key = bench_key(font);
+  GlyphCache *cache = glyph_cache_new(&key);
+  if (!cache)
+    abort();
+  glyph_cache_load_file(cache, font->cache_path);
+  atlas_reset(atlas);
+  for (size_t i = 0; i < glyph_cache_count(cache); i++) {
+    const GlyphCacheEntry *e = glyph_cache_entry(cache, i);
+    if (!atlas_insert(atlas, e->coverage, e->width, e->height))
+      abort();
+  }
+#ifdef VITARPS5_HAVE_FREETYPE
+  FT_Library library;
+  FT_Face face;
+  if (FT_Init_FreeType(&library) || FT_New_Face(library, font->font_path, 0, &face))
+    abort();
+  for (size_t s = 0; s < font->size_count; s++) {
+    for (size_t c = 0; c < CHARSET_SIZE; c++) {
+      if (!glyph_cache_find(cache, FT_Get_Char_Index(face, charset_at(c))))
+        abort();
+    }
+  }
+  FT_Done_Face(face);
+  FT_Done_FreeType(library);
+#endif
+  *glyphs = glyph_cache_count(cache);
+  glyph_cache_free(cache);
+  return chiaki_time_now_monotonic_us() - start_us;
+}
+
+static void bench_font(BenchFont *font, Atlas *atlas) {
+  snprintf(font->cache_path, sizeof(font->cache_path), "%s/glyphs-%s.bin", GLYPH_CACHE_BENCH_DIR, font->name);
+  uint64_t warm[ROUNDS];
+  size_t glyphs = 0;
+  long file_bytes = 0;
+#ifdef VITARPS5_HAVE_FREETYPE
+  uint64_t cold[ROUNDS];
+  for (int r = 0; r < ROUNDS; r++)
+    cold[r] = cold_prewarm(font, atlas, &glyphs);
+#else
+  write_synthetic_cache(font);
+#endif
+  FILE *fp = fopen(font->cache_path, "rb");
+  if (fp) {
+    fseek(fp, 0, SEEK_END);
+    file_bytes = ftell(fp);
+    fclose(fp);
+  }
+  for (int r = 0; r < ROUNDS; r++)
+    warm[r] = warm_prewarm(font, atlas, &glyphs);
+  uint64_t warm_p50 = bench_percentile(warm, ROUNDS, 50);
+  printf("BENCH glyph_cache font=%s sizes=%zu glyphs=%zu file_bytes=%ld warm_p50_us=%llu warm_p99_us=%llu", font->name,
+         font->size_count, glyphs, file_bytes, (unsigned long long)warm_p50,
+         (unsigned long long)bench_percentile(warm, ROUNDS, 99));
+#ifdef VITARPS5_HAVE_FREETYPE
+  uint64_t cold_p50 = bench_percentile(cold, ROUNDS, 50);
+  printf(" cold_p50_us=%llu cold_p99_us=%llu speedup=%.1f", (unsigned long long)cold_p50,
+         (unsigned long long)bench_percentile(cold, ROUNDS, 99), warm_p50 ? (double)cold_p50 / warm_p50 : 0.0);
+#else
+  printf(" cold=no_freetype");
+#endif
+  printf("\n");
+  remove(font->cache_path);
+}
+
+void run_glyph_cache_bench(void) {
+  Atlas atlas = {0};
+  atlas.pixels = malloc((size_t)ATLAS_SIZE * ATLAS_SIZE);
+  if (!atlas.pixels)
+    abort();
+  BenchFont fonts[] = {
+      {"regular", GLYPH_CACHE_BENCH_FONT_DIR "/Roboto-Regular.ttf", regular_sizes,
+       sizeof(regular_sizes) / sizeof(regular_sizes[0]), ""},
+      {"mono", GLYPH_CACHE_BENCH_FONT_DIR "/RobotoMono-Regular.ttf", mono_sizes,
+       sizeof(mono_sizes) / sizeof(mono_sizes[0]), ""},
+  };
+  for (size_t i = 0; i < sizeof(fonts) / sizeof(fonts[0]); i++)
+    bench_font(&fonts[i], &atlas);
+  free(atlas.pixels);
+}
@@ -0,0 +1,714 @@
+/*
+ * haptics_bench.c — Recorded haptics packet streams through ChiakiHapticsReceiver
+ * (vitarps5_haptics).
+ *
+ * Every stream in test/haptics is replayed on its recorded arrival times in
+ * two paths:
+ *
+ *   direct    what haptics went through before, ChiakiAudioReceiver: a frame
+ *             newer than the last one is played right away, anything else is
+ *             dropped
+ *   receiver  ChiakiHapticsReceiver with the default config
+ *
+ * A frontend is modelled that writes an output report to the controller every
+ * OUTPUT_PERIOD_US, actuating an event on the first report after it was
+ * delivered and reporting it with chiaki_haptics_receiver_actuated().
+ *
+ * Reports per stream and path the frames played, the frames that arrived but
+ * were not played, for coming after a later one or too late, the frames that
+ * never arrived, and the lateness of the played frames: how far they were
+ * behind the stream's clock, the frame index times the frame duration offset
+ * to the earliest arrival in the stream. For the receiver also its own counts,
+ * arrival to delivery and arrival to actuation. Checks that the receiver plays
+ * every frame at most once, in order, with the recorded bytes and within the
+ * latency budget.
+ *
+ * Streams are text, one record per line, '#' starts a comment:
+ *
+ *   A <arrival_us> <frame_index> <units_in_frame_fec> <data>
+ *   T <arrival_us> <type_left> <left> <type_right> <right>
+ *
+ * A is a decrypted haptics packet as it goes into
+ * chiaki_haptics_receiver_av_packet(), units_in_frame_fec in hex as in
+ * ChiakiTakionAVPacket, data in hex. T is a trigger effects change, the types
+ * in hex and their 10 parameter bytes in hex. --generate writes a stream of a
+ * modelled console sending a few haptic effects and trigger changes over a
+ * network model, that is how the streams in test/haptics were made.
+ *
+ * Usage: vitarps5_haptics [--dir DIR] [STREAM...]
+ *        vitarps5_haptics --generate OUT [--network lan|wifi] [--seconds N] [--seed N]
+ * Exits 1 on any mismatch.
+ */
+
+#define _GNU_SOURCE
+
+#include <chiaki/haptics.h>
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+#define OUTPUT_PERIOD_US 4000
+#define FRAME_SAMPLES CHIAKI_HAPTICS_FRAME_SAMPLES
+#define UNIT_SIZE CHIAKI_HAPTICS_FRAME_SIZE
+
+static const char *default_streams[] = {"lan.hpt", "wifi_burst.hpt"};
+
+typedef struct {
+  uint64_t s;
+} Rng;
+
+static uint64_t rng_next(Rng *r) {
+  r->s ^= r->s >> 12;
+  r->s ^= r->s << 25;
+  r->s ^= r->s >> 27;
+  return r->s * 0x2545F4914F6CDD1Dull;
+}
+
+static uint32_t rng_range(Rng *r, uint32_t n) { return (uint32_t)(rng_next(r) % n); }
+
+typedef struct {
+  bool trigger;
+  uint64_t arrival_us;
+  uint16_t frame_index;
+  uint16_t units_in_frame_fec;
+  uint8_t *data;
+  size_t data_size;
+  uint8_t type_left, type_right;
+  uint8_t left[10], right[10];
+} Record;
+
+typedef struct {
+  Record *records;
+  size_t count;
+  // recorded bytes of every frame, by media index from the first one
+  int64_t media_first;
+  size_t media_count;
+  uint8_t *frames;
+  bool *frames_known;
+} Stream;
+
+static int hex_nibble(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+static bool hex_decode(const char *hex, uint8_t *out, size_t size) {
+  if (strlen(hex) != size * 2)
+    return false;
+  for (size_t i = 0; i < size; i++) {
+    int hi = hex_nibble(hex[2 * i]), lo = hex_nibble(hex[2 * i + 1]);
+    if (hi < 0 || lo < 0)
+      return false;
+    out[i] = (uint8_t)(hi << 4 | lo);
+  }
+  return true;
+}
+
+static void stream_fini(Stream *s) {
+  for (size_t i = 0; i < s->count; i++)
+    free(s->records[i].data);
+  free(s->records);
+  free(s->frames);
+  free(s->frames_known);
+  memset(s, 0, sizeof(*s));
+}
+
+static bool record_parse(Record *r, char *line) {
+  memset(r, 0, sizeof(*r));
+  char *save = NULL;
+  char *tag = strtok_r(line, " \t\r\n", &save);
+  char *arrival = strtok_r(NULL, " \t\r\n", &save);
+  if (!tag || !arrival)
+    return false;
+  r->arrival_us = strtoull(arrival, NULL, 10);
+  if (strcmp(tag, "T") == 0) {
+    r->trigger = true;
+    char *fields[4];
+    for (int i = 0; i < 4; i++)
+      if (!(fields[i] = strtok_r(NULL, " \t\r\n", &save)))
+        return false;
+    r->type_left = (uint8_t)strtoul(fields[0], NULL, 16);
+    r->type_right = (uint8_t)strtoul(fields[2], NULL, 16);
+    return hex_decode(fields[1], r->left, 10) && hex_decode(fields[3], r->right, 10);
+  }
+  if (strcmp(tag, "A") != 0)
+    return false;
+  char *index = strtok_r(NULL, " \t\r\n", &save);
+  char *fec = strtok_r(NULL, " \t\r\n", &save);
+  char *data = strtok_r(NULL, " \t\r\n", &save);
+  if (!index || !fec || !data)
+    return false;
+  r->frame_index = (uint16_t)strtoul(index, NULL, 10);
+  r->units_in_frame_fec = (uint16_t)strtoul(fec, NULL, 16);
+  r->data_size = strlen(data) / 2;
+  r->data = malloc(r->data_size ? r->data_size : 1);
+  return r->data && hex_decode(data, r->data, r->data_size);
+}
+
+static unsigned record_units(const Record *r) {
+  return (r->units_in_frame_fec & 0xf) + ((r->units_in_frame_fec >> 4) & 0xf);
+}
+
+static size_t record_unit_size(const Record *r) { return r->units_in_frame_fec >> 8; }
+
+/* Unwraps the frame indices of the stream's source units in arrival order. */
+static int64_t media_unwrap(uint16_t frame_index, bool *started, uint16_t *last, int64_t *last_media) {
+  if (!*started) {
+    *started = true;
+    *last = frame_index;
+    *last_media = 0;
+    return 0;
+  }
+  int64_t media = *last_media + (int16_t)(frame_index - *last);
+  if (media > *last_media) {
+    *last = frame_index;
+    *last_media = media;
+  }
+  return media;
+}
+
+/* Collects the recorded bytes of every frame, the FEC copies have to match their sources. */
+static bool stream_index(Stream *s) {
+  bool started = false;
+  uint16_t last = 0;
+  int64_t last_media = 0, min = INT64_MAX, max = INT64_MIN;
+  for (int pass = 0; pass < 2; pass++) {
+    started = false;
+    for (size_t i = 0; i < s->count; i++) {
+      const Record *r = &s->records[i];
+      if (r->trigger)
+        continue;
+      unsigned source = r->units_in_frame_fec & 0xf, fec = (r->units_in_frame_fec >> 4) & 0xf;
+      size_t unit_size = record_unit_size(r);
+      if (unit_size != UNIT_SIZE || r->data_size != unit_size * record_units(r))
+        return false;
+      int64_t media = media_unwrap(r->frame_index, &started, &last, &last_media);
+      for (unsigned u = 0; u < source + fec; u++) {
+        int64_t m = u < source ? media + u : media - fec + (u - source);
+        if (!pass) {
+          min = m < min ? m : min;
+          max = m > max ? m : max;
+          continue;
+        }
+        size_t slot = (size_t)(m - s->media_first);
+        const uint8_t *unit = r->data + unit_size * u;
+        if (s->frames_known[slot] && memcmp(s->frames + slot * UNIT_SIZE, unit, UNIT_SIZE) != 0)
+          return false;
+        memcpy(s->frames + slot * UNIT_SIZE, unit, UNIT_SIZE);
+        s->frames_known[slot] = true;
+      }
+    }
+    if (!pass) {
+      if (min > max)
+        return false;
+      s->media_first = min;
+      s->media_count = (size_t)(max - min + 1);
+      s->frames = calloc(s->media_count, UNIT_SIZE);
+      s->frames_known = calloc(s->media_count, sizeof(bool));
+      if (!s->frames || !s->frames_known)
+        return false;
+    }
+  }
+  return true;
+}
+
+static bool stream_load(Stream *s, const char *path) {
+  memset(s, 0, sizeof(*s));
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+  size_t cap = 0;
+  char *line = NULL;
+  size_t line_cap = 0;
+  bool ok = true;
+  while (getline(&line, &line_cap, f) >= 0) {
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+    if (s->count == cap) {
+      size_t new_cap = cap ? cap * 2 : 256;
+      Record *records = realloc(s->records, new_cap * sizeof(Record));
+      if (!records) {
+        ok = false;
+        break;
+      }
+      s->records = records;
+      cap = new_cap;
+    }
+    Record *r = &s->records[s->count];
+    bool parsed = record_parse(r, line);
+    s->count++;
+    if (!parsed || (s->count > 1 && r->arrival_us < s->records[s->count - 2].arrival_us)) {
+      ok = false;
+      break;
+    }
+  }
+  free(line);
+  fclose(f);
+  if (ok)
+    ok = stream_index(s);
+  if (!ok)
+    stream_fini(s);
+  return ok;
+}
+
+/* The stream's clock: the earliest arrival - media time of any source unit. */
+static int64_t stream_clock_base(const Stream *s) {
+  bool started = false;
+  uint16_t last = 0;
+  int64_t last_media = 0, base = INT64_MAX;
+  for (size_t i = 0; i < s->count; i++) {
+    const Record *r = &s->records[i];
+    if (r->trigger)
+      continue;
+    int64_t media = media_unwrap(r->frame_index, &started, &last, &last_media);
+    int64_t offset = (int64_t)r->arrival_us - media * FRAME_SAMPLES * 1000000 / CHIAKI_HAPTICS_SAMPLE_RATE;
+    if (offset < base)
+      base = offset;
+  }
+  return base;
+}
+
+static uint64_t stream_lateness(int64_t base, int64_t media, uint64_t now_us) {
+  int64_t due = base + media * FRAME_SAMPLES * 1000000 / CHIAKI_HAPTICS_SAMPLE_RATE;
+  return (int64_t)now_us > due ? (uint64_t)((int64_t)now_us - due) : 0;
+}
+
+typedef struct {
+  const char *name;
+  size_t played;
+  bool *played_frames; // by media index from media_first
+  uint64_t *lateness;
+} PathResult;
+
+static bool path_init(PathResult *p, const char *name, const Stream *s) {
+  memset(p, 0, sizeof(*p));
+  p->name = name;
+  p->played_frames = calloc(s->media_count, sizeof(bool));
+  p->lateness = calloc(s->media_count, sizeof(uint64_t));
+  return p->played_frames && p->lateness;
+}
+
+static void path_fini(PathResult *p) {
+  free(p->played_frames);
+  free(p->lateness);
+}
+
+static void path_report(const char *stream, const Stream *s, PathResult *p, const ChiakiHapticsStats *stats) {
+  size_t skipped = 0, missing = 0;
+  for (size_t m = 0; m < s->media_count; m++) {
+    if (!s->frames_known[m])
+      missing++;
+    else if (!p->played_frames[m])
+      skipped++;
+  }
+  uint64_t p50 = bench_percentile(p->lateness, p->played, 50.0);
+  uint64_t p99 = bench_percentile(p->lateness, p->played, 99.0);
+  uint64_t max = p->played ? p->lateness[p->played - 1] : 0;
+  printf("BENCH haptics stream=%s path=%s played=%zu skipped=%zu missing=%zu lateness_p50_us=%" PRIu64
+         " lateness_p99_us=%" PRIu64 " lateness_max_us=%" PRIu64,
+         stream, p->name, p->played, skipped, missing, p50, p99, max);
+  if (stats)
+    printf(" held=%" PRIu64 " recovered=%" PRIu64 " lost=%" PRIu64 " late_dropped=%" PRIu64
+           " delivery_p99_us=%" PRIu64 " delivery_max_us=%" PRIu64 " actuation_p50_us=%" PRIu64
+           " actuation_p99_us=%" PRIu64,
+           stats->reordered, stats->recovered, stats->lost, stats->late_dropped, stats->delivery.p99_us,
+           stats->delivery.max_us, stats->actuation.p50_us, stats->actuation.p99_us);
+  printf("\n");
+}
+
+/* ChiakiAudioReceiver's policy, frames not newer than the last one played are dropped. */
+static void replay_direct(const char *name, const Stream *s) {
+  PathResult p;
+  if (!path_init(&p, "direct", s)) {
+    path_fini(&p);
+    return;
+  }
+  int64_t base = stream_clock_base(s);
+  bool started = false, media_started = false, startup = true;
+  uint16_t prev = 0, last = 0;
+  int64_t last_media = 0;
+  for (size_t i = 0; i < s->count; i++) {
+    const Record *r = &s->records[i];
+    if (r->trigger)
+      continue;
+    unsigned source = r->units_in_frame_fec & 0xf, fec = (r->units_in_frame_fec >> 4) & 0xf;
+    int64_t media = media_unwrap(r->frame_index, &media_started, &last, &last_media);
+    if (r->frame_index > (1 << 15))
+      startup = false;
+    for (unsigned u = 0; u < source + fec; u++) {
+      uint16_t frame_index;
+      int64_t m;
+      if (u < source) {
+        frame_index = (uint16_t)(r->frame_index + u);
+        m = media + u;
+      } else {
+        unsigned fec_index = u - source;
+        if (startup && r->frame_index + fec_index < fec + 1)
+          continue;
+        frame_index = (uint16_t)(r->frame_index - fec + fec_index);
+        m = media - fec + fec_index;
+      }
+      if (started && !chiaki_seq_num_16_gt(frame_index, prev))
+        continue;
+      started = true;
+      prev = frame_index;
+      p.played_frames[m - s->media_first] = true;
+      p.lateness[p.played++] = stream_lateness(base, m, r->arrival_us);
+    }
+  }
+  path_report(name, s, &p, NULL);
+  path_fini(&p);
+}
+
+typedef struct {
+  const Stream *stream;
+  ChiakiHapticsReceiver *receiver;
+  ChiakiHapticsConfig config;
+  int64_t base;
+  uint16_t first_index; // media index 0
+  bool started;
+  uint16_t last_index;
+  int64_t last_media;
+  uint8_t frame[UNIT_SIZE];
+  size_t frame_size;
+  PathResult result;
+  bool ok;
+} Replay;
+
+static void replay_frame(uint8_t *buf, size_t buf_size, void *user) {
+  Replay *rp = user;
+  if (buf_size > sizeof(rp->frame)) {
+    rp->ok = false;
+    return;
+  }
+  memcpy(rp->frame, buf, buf_size);
+  rp->frame_size = buf_size;
+}
+
+static void replay_event(const ChiakiHapticsEvent *event, void *user) {
+  Replay *rp = user;
+  uint64_t actuated_us = (event->delivered_us / OUTPUT_PERIOD_US + 1) * OUTPUT_PERIOD_US;
+  chiaki_haptics_receiver_actuated(rp->receiver, event, actuated_us);
+  if (!event->has_frame)
+    return;
+  int64_t media = rp->started ? rp->last_media + (int16_t)(event->frame_index - rp->last_index)
+                              : (int16_t)(event->frame_index - rp->first_index);
+  if (rp->started && media <= rp->last_media) {
+    fprintf(stderr, "frame %u delivered out of order or twice\n", event->frame_index);
+    rp->ok = false;
+  }
+  rp->started = true;
+  rp->last_index = event->frame_index;
+  rp->last_media = media;
+
+  const Stream *s = rp->stream;
+  size_t slot = (size_t)(media - s->media_first);
+  if (media < s->media_first || slot >= s->media_count || !s->frames_known[slot] || rp->frame_size != UNIT_SIZE ||
+      memcmp(rp->frame, s->frames + slot * UNIT_SIZE, UNIT_SIZE) != 0) {
+    fprintf(stderr, "frame %u delivered with other bytes than recorded\n", event->frame_index);
+    rp->ok = false;
+    return;
+  }
+  // the receiver's clock only looks back 2 s, so it may be a little later than this one
+  uint64_t lateness = stream_lateness(rp->base, media, event->delivered_us);
+  if (lateness > rp->config.latency_budget_us + CHIAKI_HAPTICS_FRAME_US) {
+    fprintf(stderr, "frame %u delivered %" PRIu64 " us late\n", event->frame_index, lateness);
+    rp->ok = false;
+  }
+  rp->result.played_frames[slot] = true;
+  rp->result.lateness[rp->result.played++] = lateness;
+}
+
+static bool replay_receiver(const char *name, const Stream *s) {
+  Replay rp;
+  memset(&rp, 0, sizeof(rp));
+  rp.stream = s;
+  rp.ok = true;
+  rp.base = stream_clock_base(s);
+  for (size_t i = 0; i < s->count; i++) {
+    if (!s->records[i].trigger) {
+      rp.first_index = s->records[i].frame_index;
+      break;
+    }
+  }
+  chiaki_haptics_config_defaults(&rp.config);
+  ChiakiAudioSink frame_sink = {&rp, NULL, replay_frame};
+  ChiakiHapticsSink sink = {&rp, replay_event};
+  rp.receiver = chiaki_haptics_receiver_new(NULL, &rp.config, &frame_sink, &sink);
+  if (!rp.receiver || !path_init(&rp.result, "receiver", s)) {
+    chiaki_haptics_receiver_free(rp.receiver);
+    path_fini(&rp.result);
+    return false;
+  }
+
+  for (size_t i = 0; i < s->count; i++) {
+    const Record *r = &s->records[i];
+    if (r->trigger) {
+      chiaki_haptics_receiver_trigger_effects(rp.receiver, r->type_left, r->left, r->type_right, r->right, r->arrival_us);
+      continue;
+    }
+    ChiakiTakionAVPacket packet;
+    memset(&packet, 0, sizeof(packet));
+    packet.is_haptics = true;
+    packet.codec = 5;
+    packet.frame_index = r->frame_index;
+    packet.units_in_frame_total = (uint16_t)record_units(r);
+    packet.units_in_frame_fec = r->units_in_frame_fec;
+    packet.data = r->data;
+    packet.data_size = r->data_size;
+    chiaki_haptics_receiver_av_packet(rp.receiver, &packet, r->arrival_us);
+  }
+  chiaki_haptics_receiver_poll(rp.receiver, s->records[s->count - 1].arrival_us + 1000000);
+
+  ChiakiHapticsStats stats;
+  chiaki_haptics_receiver_stats(rp.receiver, &stats);
+  if (stats.frames != rp.result.played || stats.undecodable || stats.restarts) {
+    fprintf(stderr, "stats frames=%" PRIu64 " undecodable=%" PRIu64 " restarts=%" PRIu64 ", %zu played\n",
+            stats.frames, stats.undecodable, stats.restarts, rp.result.played);
+    rp.ok = false;
+  }
+  path_report(name, s, &rp.result, &stats);
+  chiaki_haptics_receiver_free(rp.receiver);
+  path_fini(&rp.result);
+  return rp.ok;
+}
+
+/* A console sending a few haptic effects, on both actuators in frames of FRAME_SAMPLES. */
+static double effect_sample(unsigned channel, double t) {
+  double amp = 0.0, freq = 0.0;
+  if (t >= 0.5 && t < 1.2) {
+    amp = 40.0; // engine
+    freq = 60.0;
+  } else if (t >= 1.2 && t < 1.5) {
+    amp = (channel ? 90.0 : 120.0) * exp(-(t - 1.2) / 0.1); // explosion
+    freq = 150.0;
+  } else if (t >= 2.0 && t < 2.6) {
+    double step = fmod(t - 2.0, 0.15); // footsteps, alternating
+    unsigned foot = (unsigned)((t - 2.0) / 0.15) % 2;
+    if (step < 0.03 && foot == channel) {
+      amp = 100.0;
+      freq = 200.0;
+    }
+  }
+  return amp * sin(2.0 * M_PI * freq * t);
+}
+
+typedef struct {
+  uint64_t send_us;
+  uint64_t arrival_us;
+  char *line;
+} GenLine;
+
+static int gen_line_cmp(const void *a, const void *b) {
+  const GenLine *x = a, *y = b;
+  if (x->arrival_us != y->arrival_us)
+    return x->arrival_us < y->arrival_us ? -1 : 1;
+  return (x->send_us > y->send_us) - (x->send_us < y->send_us);
+}
+
+static uint64_t network_arrival(bool wifi, Rng *rng, uint64_t send_us, uint64_t *prev_arrival_us, bool reliable, bool *lost) {
+  *lost = false;
+  if (!wifi) {
+    uint64_t arrival = send_us + 800 + rng_range(rng, 300);
+    if (arrival <= *prev_arrival_us)
+      arrival = *prev_arrival_us + 1;
+    *prev_arrival_us = arrival;
+    return arrival;
+  }
+  // stalls of 70 ms at 0.9 s and 2.3 s release everything queued at once
+  static const uint64_t stalls_us[] = {900000, 2300000};
+  for (size_t i = 0; i < sizeof(stalls_us) / sizeof(stalls_us[0]); i++) {
+    if (send_us >= stalls_us[i] && send_us < stalls_us[i] + 70000)
+      return stalls_us[i] + 70000 + 2000 + (send_us - stalls_us[i]) / 50;
+  }
+  if (!reliable && rng_range(rng, 100) < 3) {
+    *lost = true;
+    return 0;
+  }
+  uint64_t arrival = send_us + 2000 + rng_range(rng, 3000);
+  if (!reliable && rng_range(rng, 100) < 3)
+    arrival += 15000; // overtaken by the next one
+  return arrival;
+}
+
+static int generate(const char *out_path, bool wifi, unsigned seconds, uint64_t seed) {
+  Rng rng = {seed ? seed : 1};
+  size_t frames = (size_t)seconds * CHIAKI_HAPTICS_SAMPLE_RATE / FRAME_SAMPLES;
+  const unsigned fec = 1;
+  // wraps within the first second
+  const uint16_t first_index = 65400;
+  GenLine *lines = calloc(frames + 8, sizeof(GenLine));
+  uint8_t *units = calloc(frames, UNIT_SIZE);
+  if (!lines || !units)
+    return 1;
+  for (size_t f = 0; f < frames; f++) {
+    for (unsigned s = 0; s < FRAME_SAMPLES; s++) {
+      double t = (double)(f * FRAME_SAMPLES + s) / CHIAKI_HAPTICS_SAMPLE_RATE;
+      for (unsigned c = 0; c < 2; c++) {
+        long v = lround(effect_sample(c, t));
+        v = v > 127 ? 127 : v < -128 ? -128 : v;
+        units[f * UNIT_SIZE + s * 2 + c] = (uint8_t)(int8_t)v;
+      }
+    }
+  }
+
+  size_t count = 0;
+  uint64_t prev_arrival_us = 0;
+  char *buf = malloc(64 + (1 + fec) * UNIT_SIZE * 2);
+  if (!buf)
+    return 1;
+  unsigned burst = 0;
+  for (size_t f = 0; f < frames; f++) {
+    uint64_t send_us = (uint64_t)f * FRAME_SAMPLES * 1000000 / CHIAKI_HAPTICS_SAMPLE_RATE;
+    bool lost;
+    uint64_t arrival_us = network_arrival(wifi, &rng, send_us, &prev_arrival_us, false, &lost);
+    // a frame and its FEC copy both lost, only the receiver's hold can recover one of them
+    if (wifi && !burst && rng_range(&rng, 100) < 1)
+      burst = 2;
+    if (burst) {
+      burst--;
+      lost = true;
+    }
+    if (lost)
+      continue;
+    unsigned copies = f < fec ? (unsigned)f : fec;
+    int n = sprintf(buf, "A %" PRIu64 " %u %x ", arrival_us, (unsigned)(uint16_t)(first_index + f),
+                    (unsigned)((UNIT_SIZE << 8) | (copies << 4) | 1));
+    char *p = buf + n;
+    const uint8_t *unit = units + f * UNIT_SIZE;
+    for (size_t i = 0; i < UNIT_SIZE; i++, p += 2)
+      sprintf(p, "%02x", unit[i]);
+    for (unsigned c = 0; c < copies; c++) {
+      unit = units + (f - copies + c) * UNIT_SIZE;
+      for (size_t i = 0; i < UNIT_SIZE; i++, p += 2)
+        sprintf(p, "%02x", unit[i]);
+    }
+    lines[count++] = (GenLine){send_us, arrival_us, strdup(buf)};
+  }
+
+  // trigger effects: vibrating right trigger, resistance on the left, all off
+  static const struct {
+    uint64_t send_us;
+    uint8_t type_left, left[10], type_right, right[10];
+  } triggers[] = {
+      {300000, 0x05, {0}, 0x26, {0xff, 0x03, 0xb6, 0x6d, 0xdb, 0x36, 0, 0, 40, 0}},
+      {1000000, 0x21, {0x00, 0x01, 0x49, 0x92, 0x24, 0x09, 0, 0, 0, 0}, 0x26, {0xff, 0x03, 0xb6, 0x6d, 0xdb, 0x36, 0, 0, 40, 0}},
+      {2200000, 0x05, {0}, 0x05, {0}},
+  };
+  for (size_t i = 0; i < sizeof(triggers) / sizeof(triggers[0]); i++) {
+    if (triggers[i].send_us >= (uint64_t)seconds * 1000000)
+      continue;
+    bool lost;
+    uint64_t arrival_us = network_arrival(wifi, &rng, triggers[i].send_us, &prev_arrival_us, true, &lost);
+    char *p = buf + sprintf(buf, "T %" PRIu64 " %02x ", arrival_us, triggers[i].type_left);
+    for (size_t j = 0; j < 10; j++, p += 2)
+      sprintf(p, "%02x", triggers[i].left[j]);
+    p += sprintf(p, " %02x ", triggers[i].type_right);
+    for (size_t j = 0; j < 10; j++, p += 2)
+      sprintf(p, "%02x", triggers[i].right[j]);
+    lines[count++] = (GenLine){triggers[i].send_us, arrival_us, strdup(buf)};
+  }
+  free(buf);
+  free(units);
+  qsort(lines, count, sizeof(GenLine), gen_line_cmp);
+
+  FILE *f = fopen(out_path, "w");
+  if (!f)
+    return 1;
+  fprintf(f, "# Haptics packet stream, see test/bench/haptics_bench.c for the format.\n");
+  fprintf(f, "# vitarps5_haptics --generate --network %s --seconds %u --seed %" PRIu64 "\n", wifi ? "wifi" : "lan",
+          seconds, seed);
+  fprintf(f, "# %s\n", wifi ? "2-5 ms delay, 3% loss, 1% two in a row, 3% overtaken, 70 ms stalls at 0.9 s and 2.3 s"
+                            : "0.8-1.1 ms delay in order, no loss");
+  for (size_t i = 0; i < count; i++) {
+    fprintf(f, "%s\n", lines[i].line);
+    free(lines[i].line);
+  }
+  free(lines);
+  return fclose(f) == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[]) {
+  const char *dir = HAPTICS_BENCH_STREAM_DIR;
+  const char *generate_path = NULL;
+  bool wifi = false;
+  unsigned seconds = 3;
+  uint64_t seed = 1;
+  const char **streams = default_streams;
+  size_t streams_count = sizeof(default_streams) / sizeof(default_streams[0]);
+  const char **args = calloc((size_t)argc, sizeof(char *));
+  size_t args_count = 0;
+  if (!args)
+    return 1;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strncmp(arg, "--", 2) != 0) {
+      args[args_count++] = arg;
+      continue;
+    }
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      free(args);
+      return 2;
+    }
+    if (strcmp(arg, "--dir") == 0)
+      dir = val;
+    else if (strcmp(arg, "--generate") == 0)
+      generate_path = val;
+    else if (strcmp(arg, "--network") == 0)
+      wifi = strcmp(val, "wifi") == 0;
+    else if (strcmp(arg, "--seconds") == 0)
+      seconds = (unsigned)strtoul(val, NULL, 0);
+    else if (strcmp(arg, "--seed") == 0)
+      seed = strtoull(val, NULL, 0);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      free(args);
+      return 2;
+    }
+    i++;
+  }
+  if (generate_path) {
+    free(args);
+    return generate(generate_path, wifi, seconds, seed);
+  }
+  if (args_count) {
+    streams = args;
+    streams_count = args_count;
+    dir = NULL;
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < streams_count; i++) {
+    char path[1024];
+    if (dir)
+      snprintf(path, sizeof(path), "%s/%s", dir, streams[i]);
+    else
+      snprintf(path, sizeof(path), "%s", streams[i]);
+    const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+    Stream s;
+    if (!stream_load(&s, path)) {
+      fprintf(stderr, "failed to load %s\n", path);
+      ok = false;
+      continue;
+    }
+    replay_direct(name, &s);
+    ok &= replay_receiver(name, &s);
+    stream_fini(&s);
+  }
+  free(args);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,273 @@
+/*
+ * jsonscan_bench.c — Throughput of the streaming JSON scanner on PSN responses.
+ *
+ * Four measurements:
+ *
+ *   corpus  chiaki_json_scan() of each json_corpus.h document for its paths
+ *   keys    the three fields of an OAuth token response in one scan, against
+ *           the strstr-per-key lookup psn_auth.c used before
+ *   skip    one field behind a device list of 64 consoles, so nearly all of
+ *           the document is skipped without looking at keys
+ *   feed    a 64-console device list arriving in 1 KiB curl chunks, collected
+ *           through a ChiakiJsonFeed into a fixed buffer and scanned, against
+ *           growing a buffer with realloc per chunk the way auth_write_cb did
+ *
+ * Built with json-c available, keys and skip also parse with json-c for scale.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chiaki/jsonscan.h>
+#include <chiaki/time.h>
+
+#ifdef VITARPS5_HAVE_JSONC
+#include <json-c/json_pointer.h>
+#include <json-c/json_tokener.h>
+#endif
+
+#include "../json_corpus.h"
+#include "bench.h"
+
+#define CORPUS_ROUNDS 100000
+#define KEYS_ROUNDS 500000
+#define SKIP_ROUNDS 5000
+#define FEED_ROUNDS 5000
+#define DEVICE_LIST_CONSOLES 64
+#define FEED_CHUNK 1024
+
+static size_t corpus_path_count(const JsonCorpusDoc *doc) {
+  size_t n = 0;
+  while (n < JSON_CORPUS_PATHS_MAX && doc->paths[n])
+    n++;
+  return n;
+}
+
+static void bench_corpus(void) {
+  for (size_t d = 0; d < JSON_CORPUS_DOCS; d++) {
+    const JsonCorpusDoc *doc = &json_corpus[d];
+    size_t len = strlen(doc->json);
+    size_t count = corpus_path_count(doc);
+    ChiakiJsonValue values[JSON_CORPUS_PATHS_MAX];
+    uint64_t checksum = 0;
+    uint64_t start_us = chiaki_time_now_monotonic_us();
+    for (int r = 0; r < CORPUS_ROUNDS; r++) {
+      if (chiaki_json_scan(doc->json, len, doc->paths, values, count) != CHIAKI_ERR_SUCCESS)
+        abort();
+      checksum += values[0].len;
+    }
+    uint64_t elapsed_us = chiaki_time_now_monotonic_us() - start_us;
+    if (!elapsed_us)
+      elapsed_us = 1;
+    printf("BENCH jsonscan stage=corpus doc=%s bytes=%zu paths=%zu ns_per_doc=%.1f mb_per_s=%.1f "
+           "checksum=%llx\n",
+           doc->name, len, count, elapsed_us * 1000.0 / CORPUS_ROUNDS,
+           (double)len * CORPUS_ROUNDS / elapsed_us, (unsigned long long)checksum);
+  }
+}
+
+/* The lookup psn_auth.c did per key: strstr for the quoted key, then copy the string. */
+static bool strstr_get_string(const char *json, const char *key, char *out, size_t out_size) {
+  char key_expr[96];
+  snprintf(key_expr, sizeof(key_expr), "\"%s\"", key);
+  const char *p = strstr(json, key_expr);
+  if (!p)
+    return false;
+  p += strlen(key_expr);
+  while (*p == ' ')
+    p++;
+  if (*p++ != ':')
+    return false;
+  while (*p == ' ')
+    p++;
+  if (*p++ != '"')
+    return false;
+  size_t o = 0;
+  while (*p && *p != '"' && o + 1 < out_size) {
+    if (*p == '\\')
+      p++;
+    out[o++] = *p++;
+  }
+  out[o] = '\0';
+  return *p == '"';
+}
+
+static bool strstr_get_uint64(const char *json, const char *key, uint64_t *out) {
+  char key_expr[96];
+  snprintf(key_expr, sizeof(key_expr), "\"%s\":", key);
+  const char *p = strstr(json, key_expr);
+  if (!p)
+    return false;
+  *out = strtoull(p + strlen(key_expr), NULL, 10);
+  return true;
+}
+
+static void bench_keys(void) {
+  const char *json = json_corpus[0].json;
+  size_t len = strlen(json);
+  static const char *const paths[] = {"access_token", "refresh_token", "expires_in"};
+  char access[64];
+  char refresh[64];
+  uint64_t checksum = 0;
+
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  for (int r = 0; r < KEYS_ROUNDS; r++) {
+    ChiakiJsonValue values[3];
+    int64_t expires_in = 0;
+    if (chiaki_json_scan(json, len, paths, values, 3) != CHIAKI_ERR_SUCCESS ||
+        chiaki_json_unescape(&values[0], access, sizeof(access), NULL) != CHIAKI_ERR_SUCCESS ||
+        chiaki_json_unescape(&values[1], refresh, sizeof(refresh), NULL) != CHIAKI_ERR_SUCCESS ||
+        chiaki_json_value_int64(&values[2], &expires_in) != CHIAKI_ERR_SUCCESS)
+      abort();
+    checksum += (uint64_t)expires_in + (uint8_t)access[0] + (uint8_t)refresh[0];
+  }
+  uint64_t scan_us = chiaki_time_now_monotonic_us() - start_us;
+
+  start_us = chiaki_time_now_monotonic_us();
+  for (int r = 0; r < KEYS_ROUNDS; r++) {
+    uint64_t expires_in = 0;
+    if (!strstr_get_string(json, "access_token", access, sizeof(access)) ||
+        !strstr_get_string(json, "refresh_token", refresh, sizeof(refresh)) ||
+        !strstr_get_uint64(json, "expires_in", &expires_in))
+      abort();
+    checksum += expires_in + (uint8_t)access[0] + (uint8_t)refresh[0];
+  }
+  uint64_t strstr_us = chiaki_time_now_monotonic_us() - start_us;
+
+  printf("BENCH jsonscan stage=keys bytes=%zu scan_ns=%.1f strstr_ns=%.1f", len,
+         scan_us * 1000.0 / KEYS_ROUNDS, strstr_us * 1000.0 / KEYS_ROUNDS);
+#ifdef VITARPS5_HAVE_JSONC
+  start_us = chiaki_time_now_monotonic_us();
+  for (int r = 0; r < KEYS_ROUNDS / 10; r++) {
+    json_object *root = json_tokener_parse(json);
+    json_object *obj = NULL;
+    if (!root || json_pointer_get(root, "/access_token", &obj) != 0)
+      abort();
+    checksum += (uint8_t)json_object_get_string(obj)[0];
+    json_object_put(root);
+  }
+  uint64_t jsonc_us = chiaki_time_now_monotonic_us() - start_us;
+  printf(" json_c_ns=%.1f", jsonc_us * 1000.0 / (KEYS_ROUNDS / 10));
+#endif
+  printf(" checksum=%llx\n", (unsigned long long)checksum);
+}
+
+/* {"clients":[...]} with count consoles shaped like the device list entries. */
+static char *make_device_list(size_t count, size_t *len_out) {
+  static const char entry[] =
+      "{\"duid\":\"" JSON_CORPUS_DUID "\",\"device\":{\"name\":\"PS5-%03zu\",\"enabledFeatures\":"
+      "[\"remotePlay\",\"remotePlayStreaming\"],\"platform\":\"PS5\",\"online\":true,\"standby\":null}}";
+  size_t cap = 64 + count * (sizeof(entry) + 8);
+  char *json = malloc(cap);
+  if (!json)
+    abort();
+  size_t len = (size_t)snprintf(json, cap, "{\"clients\":[");
+  for (size_t i = 0; i < count; i++) {
+    if (i)
+      json[len++] = ',';
+    len += (size_t)snprintf(json + len, cap - len, entry, i);
+  }
+  len += (size_t)snprintf(json + len, cap - len, "],\"total\":%zu}", count);
+  *len_out = len;
+  return json;
+}
+
+static void bench_skip(void) {
+  size_t len;
+  char *json = make_device_list(DEVICE_LIST_CONSOLES, &len);
+  static const char *const paths[] = {"total"};
+  uint64_t checksum = 0;
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  for (int r = 0; r < SKIP_ROUNDS; r++) {
+    ChiakiJsonValue value;
+    int64_t total = 0;
+    if (chiaki_json_scan(json, len, paths, &value, 1) != CHIAKI_ERR_SUCCESS ||
+        chiaki_json_value_int64(&value, &total) != CHIAKI_ERR_SUCCESS)
+      abort();
+    checksum += (uint64_t)total;
+  }
+  uint64_t scan_us = chiaki_time_now_monotonic_us() - start_us;
+  printf("BENCH jsonscan stage=skip bytes=%zu scan_us=%.2f mb_per_s=%.1f", len,
+         (double)scan_us / SKIP_ROUNDS, (double)len * SKIP_ROUNDS / scan_us);
+#ifdef VITARPS5_HAVE_JSONC
+  start_us = chiaki_time_now_monotonic_us();
+  for (int r = 0; r < SKIP_ROUNDS; r++) {
+    json_object *root = json_tokener_parse(json);
+    json_object *obj = NULL;
+    if (!root || json_pointer_get(root, "/total", &obj) != 0)
+      abort();
+    checksum += (uint64_t)json_object_get_int64(obj);
+    json_object_put(root);
+  }
+  uint64_t jsonc_us = chiaki_time_now_monotonic_us() - start_us;
+  printf(" json_c_us=%.2f", (double)jsonc_us / SKIP_ROUNDS);
+#endif
+  printf(" checksum=%llx\n", (unsigned long long)checksum);
+  free(json);
+}
+
+static void bench_feed(void) {
+  size_t len;
+  char *json = make_device_list(DEVICE_LIST_CONSOLES, &len);
+  static const char *const paths[] = {"clients.63.device.name"};
+  char *buf = malloc(len + 1);
+  if (!buf)
+    abort();
+  uint64_t checksum = 0;
+
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  for (int r = 0; r < FEED_ROUNDS; r++) {
+    ChiakiJsonFeed feed;
+    chiaki_json_feed_init(&feed, buf, len + 1);
+    for (size_t off = 0; off < len; off += FEED_CHUNK) {
+      size_t n = len - off < FEED_CHUNK ? len - off : FEED_CHUNK;
+      if (chiaki_json_feed_append(&feed, json + off, n) != CHIAKI_ERR_SUCCESS)
+        abort();
+    }
+    ChiakiJsonValue value;
+    if (!chiaki_json_feed_complete(&feed) ||
+        chiaki_json_feed_scan(&feed, paths, &value, 1) != CHIAKI_ERR_SUCCESS)
+      abort();
+    checksum += value.len;
+  }
+  uint64_t feed_us = chiaki_time_now_monotonic_us() - start_us;
+
+  start_us = chiaki_time_now_monotonic_us();
+  for (int r = 0; r < FEED_ROUNDS; r++) {
+    char *grown = NULL;
+    size_t grown_len = 0;
+    for (size_t off = 0; off < len; off += FEED_CHUNK) {
+      size_t n = len - off < FEED_CHUNK ? len - off : FEED_CHUNK;
+      char *next = realloc(grown, grown_len + n + 1);
+      if (!next)
+        abort();
+      grown = next;
+      memcpy(grown + grown_len, json + off, n);
+      grown_len += n;
+      grown[grown_len] = '\0';
+    }
+    ChiakiJsonValue value;
+    if (chiaki_json_scan(grown, grown_len, paths, &value, 1) != CHIAKI_ERR_SUCCESS)
+      abort();
+    checksum += value.len;
+    free(grown);
+  }
+  uint64_t realloc_us = chiaki_time_now_monotonic_us() - start_us;
+
+  printf("BENCH jsonscan stage=feed bytes=%zu chunk=%d feed_us=%.2f realloc_us=%.2f mb_per_s=%.1f "
+         "checksum=%llx\n",
+         len, FEED_CHUNK, (double)feed_us / FEED_ROUNDS, (double)realloc_us / FEED_ROUNDS,
+         (double)len * FEED_ROUNDS / feed_us, (unsigned long long)checksum);
+  free(buf);
+  free(json);
+}
+
+void run_jsonscan_bench(void) {
+  bench_corpus();
+  bench_keys();
+  bench_skip();
+  bench_feed();
+}
@@ -0,0 +1,201 @@
+/*
+ * launchhints_bench.c — Early-stream loss against the LaunchSpec hints.
+ *
+ * A console streams REQUESTED_KBPS at 60 fps through a Netsim per scenario
+ * (the test/netsim/scenarios files and three inline links), SESSIONS times in
+ * a row. Every session starts its encoder from the hints chiaki_launch_hints_derive()
+ * gives for the link history the earlier sessions left behind, and every
+ * session's first WINDOW_US are merged into that history, like the Vita's
+ * host_profile_observe() does. Policies:
+ *
+ *   fixed         a zeroed policy: the requested bitrate and 0.1% loss,
+ *                 what the LaunchSpec always sent
+ *   balanced      chiaki_launch_hints_policy_defaults()
+ *   conservative  the Vita's ultra-low latency policy
+ *
+ * The console's rate control is not documented; the model starts the encoder
+ * at bwKbpsSent and tolerates the loss bwLoss announced plus LOSS_TOLERANCE. Every REPORT_US the congestion report's loss, capped at 10% like
+ * congestioncontrol.c, either backs the rate off by 15% or, below the
+ * tolerance, raises it by 2% of the request. Reports take effect without the
+ * rtt.
+ *
+ * Reports per session the hints, the early-stream loss and throughput, and
+ * the p95 one-way delay, which shows the bottleneck queue an encoder started
+ * above the link's capacity builds.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chiaki/launchhints.h>
+
+#include "../netsim/netsim.h"
+#include "bench.h"
+
+#define REQUESTED_KBPS 10000
+#define FPS 60
+#define PACKET_SIZE 1400
+#define PACKET_SPACING_US 20
+#define WINDOW_US (10 * 1000 * 1000ULL)
+#define REPORT_US (200 * 1000ULL)
+#define SESSIONS 4
+#define ENCODER_MIN_KBPS 1000
+#define REPORTED_LOSS_MAX 0.10
+#define LOSS_TOLERANCE 0.01
+#define CAPACITY 65536
+#define DELAY_SAMPLES_MAX 200000
+
+typedef struct {
+  const char *name;
+  const char *file; /* in LAUNCHHINTS_BENCH_SCENARIO_DIR, or NULL for text */
+  const char *text;
+} HintsScenario;
+
+static const HintsScenario scenarios[] = {
+    {"lan", NULL, "delay = 2ms\njitter = 1ms\ndist = normal\nbw = 50mbps\n"},
+    /* a DSL upstream below the requested bitrate */
+    {"constrained", NULL, "delay = 15ms\njitter = 2ms\nbw = 6mbps\nqueue = 60ms\n"},
+    /* random loss on a link with room to spare */
+    {"lossy", NULL, "delay = 5ms\njitter = 2ms\nloss = 3%\nbw = 30mbps\n"},
+    {"wifi_burst", "wifi_burst.scn", NULL},
+    {"remote_wan", "remote_wan.scn", NULL},
+};
+
+typedef struct {
+  const char *name;
+  ChiakiLaunchHintsPolicy policy;
+} HintsPolicy;
+
+typedef struct {
+  double loss;
+  uint32_t throughput_kbps;
+  uint64_t delay_p95_us;
+} SessionResult;
+
+static uint64_t delay_samples[DELAY_SAMPLES_MAX];
+
+static void drain(Netsim *sim, uint64_t now_us, size_t *delays) {
+  NetsimPacket packet;
+  while (netsim_pop(sim, now_us, &packet)) {
+    if (*delays < DELAY_SAMPLES_MAX)
+      delay_samples[(*delays)++] = packet.due_us - (uint64_t)(uintptr_t)packet.user;
+  }
+}
+
+/* One session's early-stream window on the link, the encoder starting from hints. */
+static SessionResult run_session(const NetsimScenario *scenario, uint64_t seed, const ChiakiLaunchHints *hints) {
+  Netsim sim;
+  if (!netsim_init(&sim, &scenario->phases[0].params, seed, CAPACITY, 0))
+    abort();
+  double rate_kbps = hints->bw_kbps < REQUESTED_KBPS ? hints->bw_kbps : REQUESTED_KBPS;
+  double tolerance = hints->bw_loss + LOSS_TOLERANCE;
+  uint64_t frame_us = 1000000 / FPS;
+  uint64_t sent = 0, dropped = 0, delivered_bytes = 0;
+  uint64_t report_sent = 0, report_dropped = 0, next_report_us = REPORT_US;
+  size_t delays = 0;
+  size_t phase = SIZE_MAX;
+
+  for (uint64_t t = 0; t < WINDOW_US; t += frame_us) {
+    size_t p = netsim_scenario_phase_at(scenario, t);
+    if (p != phase) {
+      phase = p;
+      netsim_set_params(&sim, &scenario->phases[p].params);
+    }
+    drain(&sim, t, &delays);
+
+    uint64_t bytes = (uint64_t)(rate_kbps * 1000.0 / 8.0 / FPS);
+    for (uint64_t i = 0; bytes; i++) {
+      uint32_t size = bytes > PACKET_SIZE ? PACKET_SIZE : (uint32_t)bytes;
+      bytes -= size;
+      uint64_t at = t + i * PACKET_SPACING_US;
+      sent++;
+      report_sent++;
+      if (netsim_push(&sim, at, NULL, size, (void *)(uintptr_t)at)) {
+        delivered_bytes += size;
+      } else {
+        dropped++;
+        report_dropped++;
+      }
+    }
+
+    if (t + frame_us >= next_report_us) {
+      next_report_us += REPORT_US;
+      double loss = report_sent ? (double)report_dropped / (double)report_sent : 0.0;
+      if (loss > REPORTED_LOSS_MAX)
+        loss = REPORTED_LOSS_MAX;
+      if (loss > tolerance) {
+        rate_kbps *= 0.85;
+        if (rate_kbps < ENCODER_MIN_KBPS)
+          rate_kbps = ENCODER_MIN_KBPS;
+      } else {
+        rate_kbps += REQUESTED_KBPS * 0.02;
+        if (rate_kbps > REQUESTED_KBPS)
+          rate_kbps = REQUESTED_KBPS;
+      }
+      report_sent = report_dropped = 0;
+    }
+  }
+  drain(&sim, UINT64_MAX, &delays);
+  netsim_fini(&sim);
+
+  SessionResult r;
+  r.loss = sent ? (double)dropped / (double)sent : 0.0;
+  r.throughput_kbps = (uint32_t)(delivered_bytes * 8 * 1000 / WINDOW_US);
+  r.delay_p95_us = bench_percentile(delay_samples, delays, 95);
+  return r;
+}
+
+static void bench_policy(const char *scenario_name, const NetsimScenario *scenario, const HintsPolicy *policy) {
+  ChiakiLinkHistory history;
+  memset(&history, 0, sizeof(history));
+  for (int s = 0; s < SESSIONS; s++) {
+    ChiakiLaunchHints hints;
+    chiaki_launch_hints_derive(&policy->policy, &history, REQUESTED_KBPS, 1454, 10000, true, &hints);
+    SessionResult r = run_session(scenario, scenario->seed + (uint64_t)s, &hints);
+    chiaki_link_history_observe(&history, r.loss, r.throughput_kbps);
+    printf("BENCH launchhints scenario=%s policy=%s session=%d hint_kbps=%u hint_loss=%.4f early_loss_pct=%.2f "
+           "early_kbps=%u delay_p95_ms=%.1f\n",
+           scenario_name, policy->name, s + 1, hints.bw_kbps, hints.bw_loss, r.loss * 100.0, r.throughput_kbps,
+           r.delay_p95_us / 1000.0);
+  }
+}
+
+void run_launchhints_bench(void) {
+  HintsPolicy policies[3];
+  memset(policies, 0, sizeof(policies));
+  policies[0].name = "fixed";
+  policies[1].name = "balanced";
+  chiaki_launch_hints_policy_defaults(&policies[1].policy);
+  /* host_launch_hints_policy_for_mode(VITA_LATENCY_MODE_ULTRA_LOW) */
+  policies[2].name = "conservative";
+  chiaki_launch_hints_policy_defaults(&policies[2].policy);
+  policies[2].policy.bw_headroom = 0.8;
+  policies[2].policy.loss_cap_threshold = 0.01;
+  policies[2].policy.bw_min_kbps = 800;
+  policies[2].policy.loss_scale = 2.0;
+  policies[2].policy.loss_min = 0.002;
+  policies[2].policy.loss_max = 0.08;
+
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    const HintsScenario *s = &scenarios[i];
+    NetsimScenario scenario;
+    char err[256];
+    bool ok;
+    if (s->file) {
+      char path[512];
+      snprintf(path, sizeof(path), "%s/%s", LAUNCHHINTS_BENCH_SCENARIO_DIR, s->file);
+      ok = netsim_scenario_load(&scenario, path, err, sizeof(err));
+    } else {
+      ok = netsim_scenario_parse(&scenario, s->text, err, sizeof(err));
+    }
+    if (!ok) {
+      fprintf(stderr, "launchhints: scenario %s: %s\n", s->name, err);
+      continue;
+    }
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++)
+      bench_policy(s->name, &scenario, &policies[p]);
+  }
+}
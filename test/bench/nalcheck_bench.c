@@ -0,0 +1,165 @@
+/*
+ * nalcheck_bench.c — Throughput of the pre-decode conformance checker.
+ *
+ * Synthetic H.264 access units like the PS5 sends at 720p: an IDR of
+ * IDR_BYTES with SPS and PPS, then P pictures of P_BYTES, each in SLICES
+ * slices. Slice data is random like entropy-coded data, with
+ * ZERO_RUN_EVERY bytes between runs of zeros so escapes occur as well. Reports the time
+ * per access unit and the throughput of chiaki_nal_check(), against a plain
+ * scan for start codes with memchr() as the floor any Annex B parser pays.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chiaki/nalcheck.h>
+#include <chiaki/time.h>
+
+#include "bench.h"
+
+#define ROUNDS 2000
+#define SLICES 4
+#define IDR_BYTES (120 * 1024)
+#define P_BYTES (24 * 1024)
+#define ZERO_RUN_EVERY 512
+
+static uint64_t rng_next(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+/* Escaped slice data: no 00 00 0x with x up to 3 except 00 00 03 0x. */
+static size_t put_payload(uint8_t *out, size_t bytes, uint64_t *rng) {
+  size_t size = 0;
+  unsigned zeros = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    uint64_t r = rng_next(rng);
+    uint8_t b = (r >> 16) % ZERO_RUN_EVERY < 3 ? 0 : (uint8_t)r;
+    if (zeros >= 2 && b <= 3) {
+      out[size++] = 3;
+      zeros = 0;
+    }
+    out[size++] = b;
+    zeros = b ? 0 : zeros + 1;
+  }
+  out[size++] = 0x80;  // rbsp_stop_one_bit
+  return size;
+}
+
+static size_t put(uint8_t *out, const uint8_t *bytes, size_t size) {
+  memcpy(out, bytes, size);
+  return size;
+}
+
+/* Slice headers for the 1280x720 SPS below, first_mb 0, 900, 1800, 2700. */
+static const uint8_t sps[] = {0, 0, 0, 1, 0x67, 0x64, 0x00, 0x2a, 0xac, 0xda, 0x01, 0x40, 0x16, 0xe4};
+static const uint8_t pps[] = {0, 0, 0, 1, 0x68, 0xee, 0x3c, 0x80};
+static const uint8_t idr_headers[SLICES][7] = {
+    {0x65, 0x88, 0x84, 0x08},
+    {0x65, 0x00, 0x70, 0xa2, 0x21, 0x02},
+    {0x65, 0x00, 0x38, 0x48, 0x88, 0x40, 0x80},
+    {0x65, 0x00, 0x15, 0x1a, 0x22, 0x10, 0x20},
+};
+static const size_t idr_header_sizes[SLICES] = {4, 6, 7, 7};
+static const uint8_t p_headers[SLICES][6] = {
+    {0x41, 0x9a, 0x21, 0x40},
+    {0x41, 0x00, 0x70, 0xa6, 0x88, 0x50},
+    {0x41, 0x00, 0x38, 0x49, 0xa2, 0x14},
+    {0x41, 0x00, 0x15, 0x1a, 0x68, 0x85},
+};
+static const size_t p_header_sizes[SLICES] = {4, 6, 6, 6};
+
+static size_t build_au(uint8_t *out, bool idr, uint64_t seed) {
+  uint64_t rng = seed;
+  size_t size = 0;
+  if (idr) {
+    size += put(out + size, sps, sizeof(sps));
+    size += put(out + size, pps, sizeof(pps));
+  }
+  size_t slice_bytes = (idr ? IDR_BYTES : P_BYTES) / SLICES;
+  for (int i = 0; i < SLICES; i++) {
+    size += put(out + size, (const uint8_t[]){0, 0, 1}, 3);
+    if (idr)
+      size += put(out + size, idr_headers[i], idr_header_sizes[i]);
+    else
+      size += put(out + size, p_headers[i], p_header_sizes[i]);
+    size += put_payload(out + size, slice_bytes, &rng);
+  }
+  return size;
+}
+
+static size_t count_start_codes(const uint8_t *buf, size_t size) {
+  size_t count = 0;
+  const uint8_t *p = buf, *end = buf + size;
+  while ((p = memchr(p, 1, (size_t)(end - p)))) {
+    if (p - buf >= 2 && !p[-1] && !p[-2])
+      count++;
+    p++;
+  }
+  return count;
+}
+
+void run_nalcheck_bench(void) {
+  uint8_t *idr = malloc(IDR_BYTES * 2);
+  uint8_t *p = malloc(P_BYTES * 2);
+  if (!idr || !p) {
+    free(idr);
+    free(p);
+    return;
+  }
+  size_t idr_size = build_au(idr, true, 0x5eed0001ULL);
+  size_t p_size = build_au(p, false, 0x5eed0002ULL);
+
+  ChiakiNalCheck check;
+  chiaki_nal_check_init(&check, CHIAKI_CODEC_H264);
+  ChiakiNalCheckResult r;
+  chiaki_nal_check(&check, idr, idr_size, &r);
+  if (r.verdict != CHIAKI_NAL_CHECK_OK || r.slices != SLICES) {
+    printf("BENCH nalcheck error=%s\n", chiaki_nal_check_error_string(r.error));
+    free(idr);
+    free(p);
+    return;
+  }
+  chiaki_nal_check(&check, p, p_size, &r);
+  if (r.verdict != CHIAKI_NAL_CHECK_OK || r.slices != SLICES) {
+    printf("BENCH nalcheck error=%s\n", chiaki_nal_check_error_string(r.error));
+    free(idr);
+    free(p);
+    return;
+  }
+
+  struct {
+    const char *name;
+    const uint8_t *buf;
+    size_t size;
+  } aus[] = {{"idr", idr, idr_size}, {"p", p, p_size}};
+  for (size_t a = 0; a < sizeof(aus) / sizeof(aus[0]); a++) {
+    uint64_t start_us = chiaki_time_now_monotonic_us();
+    uint32_t slices = 0;
+    for (int i = 0; i < ROUNDS; i++) {
+      chiaki_nal_check(&check, aus[a].buf, aus[a].size, &r);
+      slices += r.slices;
+    }
+    uint64_t check_us = chiaki_time_now_monotonic_us() - start_us;
+
+    start_us = chiaki_time_now_monotonic_us();
+    size_t start_codes = 0;
+    for (int i = 0; i < ROUNDS; i++)
+      start_codes += count_start_codes(aus[a].buf, aus[a].size);
+    uint64_t memchr_us = chiaki_time_now_monotonic_us() - start_us;
+
+    double bytes = (double)aus[a].size * ROUNDS;
+    printf("BENCH nalcheck au=%s bytes=%zu slices=%u us_per_au=%.2f mb_per_s=%.0f "
+           "memchr_us_per_au=%.2f memchr_mb_per_s=%.0f start_codes=%zu\n",
+           aus[a].name, aus[a].size, slices / ROUNDS, (double)check_us / ROUNDS,
+           check_us ? bytes / (double)check_us : 0.0, (double)memchr_us / ROUNDS,
+           memchr_us ? bytes / (double)memchr_us : 0.0, start_codes / ROUNDS);
+  }
+  free(idr);
+  free(p);
+}
@@ -0,0 +1,128 @@
+/*
+ * netsim_bench.c — Throughput of the network impairment simulator.
+ *
+ * Pushes PACKETS packets through a Netsim per profile on a virtual clock at
+ * 100k packets per simulated second and pops everything due after each push,
+ * the pattern of a socket shim or trace replay. Reports wall-clock millions
+ * of packets per second, with and without payload copies, and for a full
+ * trace replay under a two-phase scenario.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chiaki/time.h>
+
+#include "../netsim/netsim.h"
+#include "bench.h"
+
+#define PACKETS 4000000
+#define PACKET_INTERVAL_US 10
+#define PAYLOAD_SIZE 1200
+#define CAPACITY 65536
+
+typedef struct {
+  const char *name;
+  const char *spec;
+  bool payload;
+} NetsimProfile;
+
+static const NetsimProfile profiles[] = {
+    {"clean", "", false},
+    {"delay", "delay=20ms", false},
+    {"wifi", "loss=0.5%,burst_enter=0.5%,burst_exit=20%,burst_loss=50%,delay=4ms,jitter=3ms,dist=normal,"
+             "reorder=0.5%,duplicate=0.1%",
+     false},
+    {"wifi_payload", "loss=0.5%,burst_enter=0.5%,burst_exit=20%,burst_loss=50%,delay=4ms,jitter=3ms,dist=normal,"
+                     "reorder=0.5%,duplicate=0.1%",
+     true},
+    {"capped", "bw=1000mbps,queue=50ms,delay=10ms,jitter=1ms,dist=pareto", false},
+};
+
+static void bench_profile(const NetsimProfile *profile, const uint8_t *payload) {
+  NetsimParams params;
+  memset(&params, 0, sizeof(params));
+  if (!netsim_params_parse(&params, profile->spec)) {
+    printf("BENCH netsim profile=%s error=spec\n", profile->name);
+    return;
+  }
+  Netsim sim;
+  if (!netsim_init(&sim, &params, 1, CAPACITY, profile->payload ? PAYLOAD_SIZE : 0)) {
+    printf("BENCH netsim profile=%s error=alloc\n", profile->name);
+    return;
+  }
+  NetsimPacket packet;
+  uint64_t checksum = 0;
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  for (uint64_t i = 0; i < PACKETS; i++) {
+    uint64_t now = i * PACKET_INTERVAL_US;
+    netsim_push(&sim, now, profile->payload ? payload : NULL, PAYLOAD_SIZE, (void *)(uintptr_t)i);
+    while (netsim_pop(&sim, now, &packet))
+      checksum += (uintptr_t)packet.user + (packet.data ? packet.data[packet.size - 1] : 0);
+  }
+  while (netsim_pop(&sim, UINT64_MAX, &packet))
+    checksum += (uintptr_t)packet.user;
+  uint64_t elapsed_us = chiaki_time_now_monotonic_us() - start_us;
+  printf("BENCH netsim profile=%s packets=%d mpps=%.2f ns_per_packet=%.1f out=%llu lost=%llu dropped=%llu "
+         "checksum=%llx\n",
+         profile->name, PACKETS, (double)PACKETS / (double)elapsed_us, elapsed_us * 1000.0 / PACKETS,
+         (unsigned long long)sim.stats.out, (unsigned long long)sim.stats.lost,
+         (unsigned long long)sim.stats.queue_dropped, (unsigned long long)checksum);
+  netsim_fini(&sim);
+}
+
+static void count_delivery(size_t index, uint64_t sent_us, uint64_t received_us, void *user) {
+  uint64_t *latency_sum = user;
+  (void)index;
+  *latency_sum += received_us - sent_us;
+}
+
+static void bench_trace_replay(void) {
+  NetsimTrace trace;
+  trace.count = PACKETS;
+  trace.records = malloc(PACKETS * sizeof(NetsimTraceRecord));
+  if (!trace.records)
+    return;
+  /* Video-like bursts: 60 frames per second of ~40 packets each. */
+  uint64_t t = 0;
+  for (size_t i = 0; i < PACKETS; i++) {
+    if (i % 40 == 0)
+      t += 16666;
+    trace.records[i].time_us = t + (i % 40) * 20;
+    trace.records[i].size = PAYLOAD_SIZE;
+  }
+  NetsimScenario scenario;
+  char err[128];
+  netsim_scenario_parse(&scenario,
+                        "delay = 5ms\njitter = 2ms\n[phase]\nduration = 30s\n"
+                        "[phase]\nduration = 10s\nburst_enter = 1%\nburst_exit = 25%\nburst_loss = 70%\n",
+                        err, sizeof(err));
+  scenario.loop = true;
+  Netsim sim;
+  if (!netsim_init(&sim, &scenario.phases[0].params, scenario.seed, CAPACITY, 0)) {
+    free(trace.records);
+    return;
+  }
+  uint64_t latency_sum = 0;
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  netsim_trace_replay(&sim, &trace, &scenario, count_delivery, &latency_sum);
+  uint64_t elapsed_us = chiaki_time_now_monotonic_us() - start_us;
+  printf("BENCH netsim profile=trace_replay packets=%d mpps=%.2f sim_seconds=%.1f out=%llu lost=%llu "
+         "mean_latency_us=%.1f\n",
+         PACKETS, (double)PACKETS / (double)elapsed_us, (double)t / 1e6, (unsigned long long)sim.stats.out,
+         (unsigned long long)sim.stats.lost, sim.stats.out ? (double)latency_sum / sim.stats.out : 0.0);
+  netsim_fini(&sim);
+  free(trace.records);
+}
+
+void run_netsim_bench(void) {
+  uint8_t payload[PAYLOAD_SIZE];
+  for (size_t i = 0; i < sizeof(payload); i++)
+    payload[i] = (uint8_t)i;
+  for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++)
+    bench_profile(&profiles[i], payload);
+  bench_trace_replay();
+}
@@ -0,0 +1,165 @@
+/*
+ * notifqueue_bench.c — PSN push notification intake at high rates.
+ *
+ * Three measurements:
+ *
+ *   scan    chiaki_notification_new() on a mix of captured frame shapes,
+ *           which is all the websocket thread does per frame now
+ *   peek    looking up the oldest notification of one type behind a
+ *           backlog of other types, through the typed channels and through
+ *           a single list walked from the front the way the old queue did
+ *   stream  push, wait and clear a connect's worth of notifications in a
+ *           loop, the websocket thread and state machine back to back
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chiaki/time.h>
+
+#include "remote/notifqueue.h"
+#include "bench.h"
+
+#define SCAN_ROUNDS 200000
+#define PEEK_LOOKUPS 200000
+#define STREAM_ROUNDS 100000
+
+#define FRAME_PREFIX "{\"dataType\":\"psn:sessionManager:sys:"
+#define SESSION_ID "\"sessionId\":\"0b3f1a52-6c1e-4c59-9d43-2f1e7c0d5a11\""
+
+static const char *const frames[] = {
+    FRAME_PREFIX "remotePlaySession:created\",\"body\":{\"data\":{\"remotePlaySessions\":[{" SESSION_ID
+                 "}]}},\"to\":{\"accountId\":\"1234567890123456789\",\"onlineId\":\"VitaPlayer\"}}",
+    FRAME_PREFIX "rps:members:created\",\"body\":{\"data\":{" SESSION_ID ",\"members\":[{\"accountId\":"
+                 "\"6574123908714563321\",\"platform\":\"PROSPERO\",\"deviceUniqueId\":"
+                 "\"00112233445566778899aabbccddeeff00112233445566778899aabbccddeeff\"}]}}}",
+    FRAME_PREFIX "rps:customData1:updated\",\"body\":{\"data\":{" SESSION_ID
+                 ",\"customData1\":\"QkJCQkJCQkJCQkJCQkJCQkJCQkJCQkI=\"}}}",
+    FRAME_PREFIX "rps:sessionMessage:created\",\"body\":{\"data\":{" SESSION_ID ",\"sessionMessage\":{\"channel\":"
+                 "\"remote_play:1\",\"payload\":\"ver=1.0, type=text, body={\\\"action\\\":\\\"OFFER\\\",\\\"reqId\\\":"
+                 "1,\\\"error\\\":0,\\\"connRequest\\\":{\\\"sid\\\":2214839129,\\\"peerSid\\\":0,\\\"skey\\\":"
+                 "\\\"c2tleXNrZXlza2V5c2tleQ==\\\",\\\"natType\\\":2,\\\"candidate\\\":[{\\\"type\\\":\\\"LOCAL\\\","
+                 "\\\"addr\\\":\\\"192.168.1.20\\\",\\\"mappedAddr\\\":\\\"0.0.0.0\\\",\\\"port\\\":9303,"
+                 "\\\"mappedPort\\\":0},{\\\"type\\\":\\\"STATIC\\\",\\\"addr\\\":\\\"203.0.113.9\\\",\\\"mappedAddr\\\":"
+                 "\\\"203.0.113.9\\\",\\\"port\\\":9303,\\\"mappedPort\\\":9303}],\\\"defaultRouteMacAddr\\\":"
+                 "\\\"00:11:22:33:44:55\\\",\\\"localPeerAddr\\\":,\\\"localHashedId\\\":"
+                 "\\\"aGFzaGVkaWRoYXNoZWRpZA==\\\"}}\",\"from\":{\"accountId\":\"6574123908714563321\"}}}}}",
+    FRAME_PREFIX "rps:sessionMessage:created\",\"body\":{\"data\":{" SESSION_ID ",\"sessionMessage\":{\"channel\":"
+                 "\"remote_play:1\",\"payload\":\"ver=1.0, type=text, body={\\\"action\\\":\\\"RESULT\\\",\\\"reqId\\\":"
+                 "7,\\\"error\\\":0,\\\"connRequest\\\":{}}\",\"from\":{\"accountId\":\"6574123908714563321\"}}}}}",
+    FRAME_PREFIX "rps:members:deleted\",\"body\":{\"data\":{" SESSION_ID ",\"members\":[{\"accountId\":"
+                 "\"6574123908714563321\"}]}}}",
+};
+
+#define FRAMES (sizeof(frames) / sizeof(frames[0]))
+
+static Notification *make(size_t frame) {
+  Notification *notif = NULL;
+  if (chiaki_notification_new(frames[frame], strlen(frames[frame]), &notif) != CHIAKI_ERR_SUCCESS)
+    abort();
+  return notif;
+}
+
+static void bench_scan(void) {
+  size_t bytes = 0;
+  uint64_t checksum = 0;
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  for (int r = 0; r < SCAN_ROUNDS; r++) {
+    for (size_t i = 0; i < FRAMES; i++) {
+      Notification *notif = make(i);
+      checksum += notif->type + notif->msg_action + (uint32_t)notif->msg_req_id;
+      bytes += notif->json_buf_size;
+      chiaki_notification_free(notif);
+    }
+  }
+  uint64_t elapsed_us = chiaki_time_now_monotonic_us() - start_us;
+  uint64_t count = (uint64_t)SCAN_ROUNDS * FRAMES;
+  printf("BENCH notifqueue stage=scan frames=%llu ns_per_frame=%.1f mb_per_s=%.1f checksum=%llx\n",
+         (unsigned long long)count, elapsed_us * 1000.0 / count, bytes / (double)elapsed_us,
+         (unsigned long long)checksum);
+}
+
+/* Oldest notification of types in a single arrival-ordered list, walked from the front. */
+static Notification *linear_peek(Notification *const *list, size_t count, uint32_t types) {
+  for (size_t i = 0; i < count; i++) {
+    if (list[i]->type & types)
+      return list[i];
+  }
+  return NULL;
+}
+
+static void bench_peek(size_t backlog) {
+  // backlog member notifications, then the session message being waited for
+  NotificationQueue *nq = chiaki_notification_queue_new();
+  Notification **list = malloc((backlog + 1) * sizeof(Notification *));
+  if (!nq || !list)
+    abort();
+  for (size_t i = 0; i < backlog; i++) {
+    list[i] = make(1);
+    chiaki_notification_queue_push(nq, list[i]);
+  }
+  list[backlog] = make(4);
+  chiaki_notification_queue_push(nq, list[backlog]);
+
+  uint64_t found = 0;
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  for (int i = 0; i < PEEK_LOOKUPS; i++)
+    found += chiaki_notification_queue_peek(nq, NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED) == list[backlog];
+  uint64_t channels_us = chiaki_time_now_monotonic_us() - start_us;
+
+  start_us = chiaki_time_now_monotonic_us();
+  for (int i = 0; i < PEEK_LOOKUPS; i++)
+    found += linear_peek(list, backlog + 1, NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED) == list[backlog];
+  uint64_t linear_us = chiaki_time_now_monotonic_us() - start_us;
+
+  printf("BENCH notifqueue stage=peek backlog=%zu channels_ns=%.1f linear_ns=%.1f found=%llu\n", backlog,
+         channels_us * 1000.0 / PEEK_LOOKUPS, linear_us * 1000.0 / PEEK_LOOKUPS, (unsigned long long)found);
+  free(list);
+  chiaki_notification_queue_free(nq);
+}
+
+static void bench_stream(void) {
+  // Per round: every frame arrives, then the state machine waits for and clears each type
+  // in arrival order, as a connect does.
+  static const uint32_t waits[] = {
+      NOTIFICATION_TYPE_SESSION_CREATED | NOTIFICATION_TYPE_MEMBER_CREATED,
+      NOTIFICATION_TYPE_MEMBER_CREATED | NOTIFICATION_TYPE_CUSTOM_DATA1_UPDATED,
+      NOTIFICATION_TYPE_MEMBER_CREATED | NOTIFICATION_TYPE_CUSTOM_DATA1_UPDATED,
+      NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED,
+      NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED,
+      NOTIFICATION_TYPE_MEMBER_DELETED | NOTIFICATION_TYPE_SESSION_DELETED,
+  };
+  NotificationQueue *nq = chiaki_notification_queue_new();
+  if (!nq)
+    abort();
+  uint64_t acks = 0;
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  for (int r = 0; r < STREAM_ROUNDS; r++) {
+    for (size_t i = 0; i < FRAMES; i++)
+      chiaki_notification_queue_push(nq, make(i));
+    for (size_t i = 0; i < sizeof(waits) / sizeof(waits[0]); i++) {
+      Notification *notif = chiaki_notification_queue_peek(nq, waits[i]);
+      if (!notif)
+        abort();
+      acks += chiaki_notification_is_ack(notif, 7);
+      chiaki_notification_queue_clear(nq, notif);
+    }
+  }
+  uint64_t elapsed_us = chiaki_time_now_monotonic_us() - start_us;
+  uint64_t count = (uint64_t)STREAM_ROUNDS * FRAMES;
+  printf("BENCH notifqueue stage=stream notifications=%llu per_s=%.0f ns_per_notification=%.1f acks=%llu\n",
+         (unsigned long long)count, count * 1e6 / elapsed_us, elapsed_us * 1000.0 / count,
+         (unsigned long long)acks);
+  chiaki_notification_queue_free(nq);
+}
+
+void run_notifqueue_bench(void) {
+  bench_scan();
+  bench_peek(0);
+  bench_peek(100);
+  bench_peek(1000);
+  bench_stream();
+}
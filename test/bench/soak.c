@@ -0,0 +1,1125 @@
+/*
+ * soak.c — Long-run soak of the video/audio receive path (vitarps5_soak).
+ *
+ * By default a stand-in console emits FEC-protected video frames and audio
+ * sequence numbers straight into the real chiaki-lib receive stages (frame
+ * processor, FEC, reference tracker, gap reporting, packet stats) under
+ * virtual time, so a day of streaming runs in minutes on a headless Linux
+ * box. The run crosses many 16-bit frame/packet index wraps and includes
+ * session restarts, random loss, duplicates, reordering and multi-frame loss
+ * bursts. This mode deliberately leaves out everything around those stages:
+ * no Takion, no gkcrypt, no video/audio receiver, no session threads and no
+ * sockets; its receive path mirrors the receivers' bookkeeping instead.
+ *
+ * Once per window (default one simulated hour) a "SOAK" line reports RSS,
+ * live/total allocation counts, per-stage latency percentiles and stream
+ * counters. The first window is the warm-up baseline; the run fails (exit 1)
+ * if memory, allocation rate or stage latency drift away from it, or if any
+ * counter goes insane.
+ *
+ * With --loopback the whole client stack is soaked instead: a real
+ * ChiakiSession (ctrl, Takion, gkcrypt, stream connection, video and audio
+ * receivers) streams from the stand-in host of test/standin over 127.0.0.1,
+ * impaired by --shape. Time is wall-clock here, so --hours and
+ * --window-hours are real hours and --fps does not apply. Each "SOAK
+ * loopback" window reports RSS, allocations, the p50/p99 interval between
+ * delivered video frames, the client's frame counters, the stream
+ * connection's drop/FEC diagnostics and the stand-in's send counters, with
+ * the same drift checks against the first window.
+ *
+ * Usage: vitarps5_soak [--hours N] [--window-hours N] [--restart-hours N]
+ *                      [--seed N] [--fps N] [--latency-factor F]
+ *                      [--loopback] [--shape SPEC]
+ *
+ * Allocation counting relies on linking with -Wl,--wrap=malloc,... (see
+ * test/CMakeLists.txt).
+ */
+
+#define _GNU_SOURCE
+
+#include <chiaki/fec.h>
+#include <chiaki/frameprocessor.h>
+#include <chiaki/packetstats.h>
+#include <chiaki/reftracker.h>
+#include <chiaki/takion.h>
+
+#include <chiaki/session.h>
+#include <chiaki/time.h>
+
+#include "standin.h"
+#include "videoreceiver_gap.h"
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SOAK_UNIT_SIZE 1184
+#define SOAK_UNIT_STRIDE (((SOAK_UNIT_SIZE + 0xf) / 0x10) * 0x10)
+#define SOAK_TEMPLATES 32
+#define SOAK_IDR_TEMPLATE 0
+#define SOAK_UNITS_MAX 64
+#define SOAK_IDR_INTERVAL_FRAMES 1800
+#define SOAK_IDR_RTT_FRAMES 3
+#define SOAK_IDR_MIN_INTERVAL_MS 200
+#define SOAK_GAP_HOLD_MS 24
+#define SOAK_REF_SLOTS 4
+#define SOAK_AUDIO_PACKET_US 10000
+#define SOAK_STATS_INTERVAL_US 200000
+
+#define SOAK_RSS_SLACK_KB 4096
+#define SOAK_LIVE_ALLOC_SLACK 64
+#define SOAK_LATENCY_FLOOR_NS 50000
+
+#define SOAK_LOOPBACK_CONNECT_TIMEOUT_US 10000000
+#define SOAK_LOOPBACK_LIVE_ALLOC_SLACK 2048
+#define SOAK_LOOPBACK_INTERVAL_FLOOR_NS 20000000
+
+/* ---- allocation accounting ---------------------------------------------- */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+/* Relaxed atomics: the loopback mode allocates from the session's threads. */
+static atomic_ullong alloc_calls;
+static atomic_llong alloc_live;
+
+static void alloc_count(void) {
+  atomic_fetch_add_explicit(&alloc_calls, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&alloc_live, 1, memory_order_relaxed);
+}
+
+void *__wrap_malloc(size_t size) {
+  void *p = __real_malloc(size);
+  if (p)
+    alloc_count();
+  return p;
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+  void *p = __real_calloc(nmemb, size);
+  if (p)
+    alloc_count();
+  return p;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  void *p = __real_realloc(ptr, size);
+  if (!ptr) {
+    if (p)
+      alloc_count();
+  } else if (!size) {
+    atomic_fetch_sub_explicit(&alloc_live, 1, memory_order_relaxed);
+  } else if (p) {
+    atomic_fetch_add_explicit(&alloc_calls, 1, memory_order_relaxed);
+  }
+  return p;
+}
+
+void __wrap_free(void *ptr) {
+  if (ptr)
+    atomic_fetch_sub_explicit(&alloc_live, 1, memory_order_relaxed);
+  __real_free(ptr);
+}
+
+static uint64_t rss_kb(void) {
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (!f)
+    return 0;
+  unsigned long size = 0, resident = 0;
+  if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+    resident = 0;
+  fclose(f);
+  return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE) / 1024;
+}
+
+/* ---- latency histograms ------------------------------------------------- */
+
+/* Log-linear buckets: 8 sub-buckets per power of two, exact below 8ns. */
+#define HIST_SUB_BITS 3
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+typedef struct {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total;
+  uint64_t max;
+} LatencyHist;
+
+static unsigned hist_bucket(uint64_t v) {
+  if (v < (1u << HIST_SUB_BITS))
+    return (unsigned)v;
+  unsigned msb = 63 - (unsigned)__builtin_clzll(v);
+  unsigned shift = msb - HIST_SUB_BITS;
+  return ((shift + 1) << HIST_SUB_BITS) + (unsigned)((v >> shift) & ((1u << HIST_SUB_BITS) - 1));
+}
+
+static uint64_t hist_bucket_value(unsigned b) {
+  if (b < (1u << HIST_SUB_BITS))
+    return b;
+  unsigned shift = (b >> HIST_SUB_BITS) - 1;
+  return ((uint64_t)(1u << HIST_SUB_BITS) + (b & ((1u << HIST_SUB_BITS) - 1))) << shift;
+}
+
+static void hist_add(LatencyHist *h, uint64_t ns) {
+  h->counts[hist_bucket(ns)]++;
+  h->total++;
+  if (ns > h->max)
+    h->max = ns;
+}
+
+static uint64_t hist_percentile(const LatencyHist *h, double p) {
+  if (!h->total)
+    return 0;
+  uint64_t target = (uint64_t)((p / 100.0) * (double)h->total + 0.5);
+  if (target < 1)
+    target = 1;
+  uint64_t seen = 0;
+  for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+    seen += h->counts[b];
+    if (seen >= target)
+      return hist_bucket_value(b);
+  }
+  return h->max;
+}
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+typedef enum {
+  STAGE_ASSEMBLE, /* alloc_frame + put_unit, per packet */
+  STAGE_FLUSH,    /* flush incl. FEC, per frame */
+  STAGE_TRACK,    /* gap reporting + reference tracking, per frame */
+  STAGE_STATS,    /* packet stats push/get */
+  STAGE_COUNT
+} SoakStage;
+
+static const char *stage_names[STAGE_COUNT] = {"assemble", "flush", "track", "stats"};
+
+/* ---- deterministic randomness ------------------------------------------- */
+
+typedef struct {
+  uint64_t s;
+} SoakRng;
+
+static uint64_t rng_next(SoakRng *r) {
+  r->s ^= r->s >> 12;
+  r->s ^= r->s << 25;
+  r->s ^= r->s >> 27;
+  return r->s * 0x2545F4914F6CDD1Dull;
+}
+
+static uint32_t rng_range(SoakRng *r, uint32_t n) { return (uint32_t)(rng_next(r) % n); }
+
+static bool rng_chance(SoakRng *r, uint32_t per_million) {
+  return rng_range(r, 1000000) < per_million;
+}
+
+/* ---- stand-in console --------------------------------------------------- */
+
+typedef struct {
+  unsigned k, m;
+  uint8_t *units; /* (k + m) * SOAK_UNIT_STRIDE, source units zero padded */
+  size_t wire_size[SOAK_UNITS_MAX];
+  size_t frame_size;
+  uint64_t checksum;
+} SoakTemplate;
+
+typedef struct {
+  SoakTemplate templates[SOAK_TEMPLATES];
+  uint8_t sent_template[0x10000]; /* oracle: template used per frame index */
+  ChiakiSeqNum16 frame_index;
+  ChiakiSeqNum16 packet_index;
+  ChiakiSeqNum16 audio_index;
+  uint64_t idr_due_frame;
+  uint64_t frames_since_idr;
+} SoakConsole;
+
+static uint64_t fnv1a(uint64_t h, const uint8_t *buf, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    h ^= buf[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+static bool template_build(SoakTemplate *t, SoakRng *rng, unsigned k, unsigned m) {
+  t->k = k;
+  t->m = m;
+  t->units = calloc((size_t)(k + m), SOAK_UNIT_STRIDE);
+  if (!t->units)
+    return false;
+  t->frame_size = 0;
+  t->checksum = 0xcbf29ce484222325ull;
+  for (unsigned i = 0; i < k; i++) {
+    uint8_t *unit = t->units + (size_t)i * SOAK_UNIT_STRIDE;
+    size_t payload = i + 1 < k ? SOAK_UNIT_SIZE - 2 - rng_range(rng, 64)
+                               : 1 + rng_range(rng, SOAK_UNIT_SIZE - 2);
+    uint16_t padding = htons((uint16_t)(SOAK_UNIT_SIZE - (payload + 2)));
+    memcpy(unit, &padding, sizeof(padding));
+    for (size_t j = 0; j < payload; j++)
+      unit[2 + j] = (uint8_t)rng_next(rng);
+    t->wire_size[i] = payload + 2;
+    t->frame_size += payload;
+    t->checksum = fnv1a(t->checksum, unit + 2, payload);
+  }
+  for (unsigned i = k; i < k + m; i++)
+    t->wire_size[i] = SOAK_UNIT_SIZE;
+  return chiaki_fec_encode(t->units, SOAK_UNIT_SIZE, SOAK_UNIT_STRIDE, k, m) == CHIAKI_ERR_SUCCESS;
+}
+
+static bool console_init(SoakConsole *c, SoakRng *rng) {
+  memset(c, 0, sizeof(*c));
+  for (unsigned i = 0; i < SOAK_TEMPLATES; i++) {
+    unsigned k = i == SOAK_IDR_TEMPLATE ? 40 : 3 + rng_range(rng, 10);
+    unsigned m = i == SOAK_IDR_TEMPLATE ? 10 : 1 + k / 4;
+    if (!template_build(&c->templates[i], rng, k, m))
+      return false;
+  }
+  return true;
+}
+
+static void console_fini(SoakConsole *c) {
+  for (unsigned i = 0; i < SOAK_TEMPLATES; i++)
+    free(c->templates[i].units);
+}
+
+/* A new session starts at frame 1 and audio 0 with an arbitrary packet index. */
+static void console_restart(SoakConsole *c, SoakRng *rng) {
+  c->frame_index = 1;
+  c->packet_index = (ChiakiSeqNum16)rng_next(rng);
+  c->audio_index = 0;
+  c->idr_due_frame = 0;
+  c->frames_since_idr = 0;
+}
+
+/* ---- impaired channel ---------------------------------------------------- */
+
+typedef struct {
+  bool bad;              /* Gilbert-Elliott state */
+  uint64_t burst_end_us; /* all packets dropped until then */
+  uint64_t next_burst_us;
+  uint64_t dups;
+} SoakChannel;
+
+static bool channel_drop(SoakChannel *ch, SoakRng *rng, uint64_t now_us) {
+  if (now_us >= ch->next_burst_us) {
+    ch->burst_end_us = now_us + 50000 + rng_range(rng, 450000);
+    ch->next_burst_us = now_us + 30000000ull + rng_range(rng, 90000000);
+  }
+  if (now_us < ch->burst_end_us)
+    return true;
+  if (ch->bad) {
+    if (rng_chance(rng, 200000))
+      ch->bad = false;
+  } else if (rng_chance(rng, 500)) {
+    ch->bad = true;
+  }
+  return rng_chance(rng, ch->bad ? 400000 : 1000);
+}
+
+/* ---- receive path --------------------------------------------------------
+ * Mirrors the bookkeeping of chiaki_video_receiver_av_packet() and
+ * chiaki_audio_receiver_av_packet() around the real lib stages, without a
+ * session or decoder attached. */
+
+typedef struct {
+  uint64_t frames_flushed;
+  uint64_t frames_fec;
+  uint64_t frames_lost;
+  uint64_t frames_fec_failed;
+  uint64_t frames_undecodable;
+  uint64_t frames_substituted;
+  uint64_t old_frame_rejects;
+  uint64_t checksum_errors;
+  uint64_t idr_requests;
+  uint64_t gap_reports;
+  uint64_t units_accepted;
+} SoakCounters;
+
+typedef struct {
+  ChiakiLog log;
+  ChiakiFrameProcessor frame_processor;
+  ChiakiPacketStats packet_stats;
+  ChiakiRefTracker ref_tracker;
+  ChiakiVideoGapReportState gap;
+  int32_t frame_index_cur;
+  int32_t frame_index_prev;
+  int32_t frame_index_prev_complete;
+  uint64_t idr_last_ms;
+  bool idr_requested;
+  uint64_t stats_received;
+  uint64_t stats_lost;
+  uint64_t stream_frames_total_last;
+  uint64_t stream_bytes_total_last;
+  SoakCounters counters;
+  LatencyHist *hist;
+} SoakReceiver;
+
+static bool receiver_init(SoakReceiver *r, LatencyHist *hist) {
+  chiaki_log_init(&r->log, 0, NULL, NULL);
+  chiaki_frame_processor_init(&r->frame_processor, &r->log);
+  if (chiaki_packet_stats_init(&r->packet_stats) != CHIAKI_ERR_SUCCESS)
+    return false;
+  chiaki_ref_tracker_init(&r->ref_tracker, SOAK_REF_SLOTS);
+  memset(&r->gap, 0, sizeof(r->gap));
+  r->frame_index_cur = -1;
+  r->frame_index_prev = -1;
+  r->frame_index_prev_complete = 0;
+  r->idr_last_ms = 0;
+  r->idr_requested = false;
+  r->stats_received = 0;
+  r->stats_lost = 0;
+  r->stream_frames_total_last = 0;
+  r->stream_bytes_total_last = 0;
+  r->hist = hist;
+  return true;
+}
+
+static void receiver_fini(SoakReceiver *r) {
+  chiaki_frame_processor_fini(&r->frame_processor);
+  chiaki_packet_stats_fini(&r->packet_stats);
+}
+
+static void receiver_request_idr(SoakReceiver *r, uint64_t now_ms) {
+  if (r->idr_last_ms && now_ms - r->idr_last_ms < SOAK_IDR_MIN_INTERVAL_MS)
+    return;
+  r->idr_last_ms = now_ms;
+  r->idr_requested = true;
+  r->counters.idr_requests++;
+}
+
+static void receiver_flush_frame(SoakReceiver *r, const SoakConsole *console, uint64_t now_ms) {
+  ChiakiSeqNum16 frame_index = (ChiakiSeqNum16)r->frame_index_cur;
+  uint8_t *frame;
+  size_t frame_size;
+
+  uint64_t t0 = now_ns();
+  ChiakiFrameProcessorFlushResult result = chiaki_frame_processor_flush(&r->frame_processor, &frame, &frame_size);
+  uint64_t t1 = now_ns();
+  hist_add(&r->hist[STAGE_FLUSH], t1 - t0);
+
+  r->frame_index_prev = r->frame_index_cur;
+  if (result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FAILED ||
+      result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED) {
+    r->counters.frames_lost++;
+    /* a failed FEC still compacts and counts the partial frame */
+    if (result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_FAILED)
+      r->counters.frames_fec_failed++;
+    chiaki_ref_tracker_mark_lost(&r->ref_tracker, frame_index, frame_index);
+    receiver_request_idr(r, now_ms);
+    hist_add(&r->hist[STAGE_TRACK], now_ns() - t1);
+    return;
+  }
+
+  r->counters.frames_flushed++;
+  if (result == CHIAKI_FRAME_PROCESSOR_FLUSH_RESULT_FEC_SUCCESS)
+    r->counters.frames_fec++;
+
+  const SoakTemplate *t = &console->templates[console->sent_template[frame_index]];
+  if (frame_size != t->frame_size || fnv1a(0xcbf29ce484222325ull, frame, frame_size) != t->checksum)
+    r->counters.checksum_errors++;
+
+  uint64_t t2 = now_ns();
+  chiaki_ref_tracker_mark_received(&r->ref_tracker, frame_index);
+  bool idr = console->sent_template[frame_index] == SOAK_IDR_TEMPLATE;
+  unsigned ref_distance = idr ? CHIAKI_REF_TRACKER_NO_REF : 0;
+  if (!idr)
+    chiaki_ref_tracker_note_ref_distance(&r->ref_tracker, ref_distance);
+  ChiakiRefTrackerVerdict verdict = chiaki_ref_tracker_verdict(&r->ref_tracker, frame_index, ref_distance);
+  if (verdict == CHIAKI_REF_TRACKER_UNDECODABLE) {
+    r->counters.frames_undecodable++;
+    chiaki_ref_tracker_mark_lost(&r->ref_tracker, frame_index, frame_index);
+    receiver_request_idr(r, now_ms);
+  } else {
+    if (idr)
+      chiaki_ref_tracker_reset_refs(&r->ref_tracker);
+    else if (verdict == CHIAKI_REF_TRACKER_RECOVERABLE)
+      r->counters.frames_substituted++;
+    chiaki_ref_tracker_mark_decoded(&r->ref_tracker, frame_index);
+    r->frame_index_prev_complete = r->frame_index_cur;
+  }
+  hist_add(&r->hist[STAGE_TRACK], now_ns() - t2);
+}
+
+static void receiver_video_packet(SoakReceiver *r, const SoakConsole *console, ChiakiTakionAVPacket *packet, uint64_t now_ms) {
+  if (r->gap.pending && now_ms >= r->gap.deadline_ms) {
+    r->gap.pending = false;
+    r->counters.gap_reports++;
+  }
+
+  ChiakiSeqNum16 frame_index = packet->frame_index;
+  if (r->frame_index_cur >= 0 && chiaki_seq_num_16_lt(frame_index, (ChiakiSeqNum16)r->frame_index_cur)) {
+    r->counters.old_frame_rejects++;
+    return;
+  }
+
+  uint64_t t0 = now_ns();
+  if (r->frame_index_cur < 0 || chiaki_seq_num_16_gt(frame_index, (ChiakiSeqNum16)r->frame_index_cur)) {
+    chiaki_frame_processor_report_packet_stats(&r->frame_processor, &r->packet_stats);
+    if (r->frame_index_cur >= 0 && r->frame_index_prev != r->frame_index_cur)
+      receiver_flush_frame(r, console, now_ms);
+
+    uint64_t t1 = now_ns();
+    ChiakiSeqNum16 next_frame_expected = (ChiakiSeqNum16)(r->frame_index_prev_complete + 1);
+    if (chiaki_seq_num_16_gt(frame_index, next_frame_expected) && !(frame_index == 1 && r->frame_index_cur < 0)) {
+      ChiakiSeqNum16 gap_end = (ChiakiSeqNum16)(frame_index - 1);
+      ChiakiSeqNum16 flush_start, flush_end;
+      if (chiaki_video_gap_report_update(&r->gap, next_frame_expected, gap_end, now_ms, SOAK_GAP_HOLD_MS,
+                                         &flush_start, &flush_end) == CHIAKI_VIDEO_GAP_UPDATE_FLUSH_PREVIOUS)
+        r->counters.gap_reports++;
+      chiaki_ref_tracker_mark_lost(&r->ref_tracker, next_frame_expected, gap_end);
+      if (chiaki_ref_tracker_predict(&r->ref_tracker, frame_index) == CHIAKI_REF_TRACKER_UNDECODABLE)
+        receiver_request_idr(r, now_ms);
+    }
+    hist_add(&r->hist[STAGE_TRACK], now_ns() - t1);
+
+    r->frame_index_cur = frame_index;
+    t0 = now_ns();
+    chiaki_frame_processor_alloc_frame(&r->frame_processor, packet);
+  }
+
+  unsigned received_before = r->frame_processor.units_source_received + r->frame_processor.units_fec_received;
+  chiaki_frame_processor_put_unit(&r->frame_processor, packet);
+  if (r->frame_processor.units_source_received + r->frame_processor.units_fec_received != received_before)
+    r->counters.units_accepted++;
+  hist_add(&r->hist[STAGE_ASSEMBLE], now_ns() - t0);
+
+  if (r->frame_index_cur != r->frame_index_prev && chiaki_frame_processor_flush_possible(&r->frame_processor))
+    receiver_flush_frame(r, console, now_ms);
+}
+
+static void receiver_audio_packet(SoakReceiver *r, ChiakiSeqNum16 seq) {
+  uint64_t t0 = now_ns();
+  chiaki_packet_stats_push_seq(&r->packet_stats, seq);
+  hist_add(&r->hist[STAGE_STATS], now_ns() - t0);
+}
+
+/* Like the congestion control thread, drain the packet stats periodically. */
+static void receiver_poll_stats(SoakReceiver *r) {
+  uint64_t received, lost;
+  uint64_t t0 = now_ns();
+  chiaki_packet_stats_get(&r->packet_stats, true, &received, &lost);
+  hist_add(&r->hist[STAGE_STATS], now_ns() - t0);
+  r->stats_received += received;
+  r->stats_lost += lost;
+}
+
+/* ---- driver -------------------------------------------------------------- */
+
+typedef struct {
+  double hours;
+  double restart_hours;
+  double window_hours;
+  double latency_factor;
+  unsigned fps;
+  uint64_t seed;
+  bool loopback;
+  NetsimParams shape;
+} SoakOptions;
+
+typedef struct {
+  uint64_t rss_kb;
+  int64_t alloc_live;
+  double allocs_per_frame;
+  uint64_t p50[STAGE_COUNT];
+  uint64_t p99[STAGE_COUNT];
+} SoakWindow;
+
+typedef struct {
+  /* sent by the console in the current session */
+  uint64_t frames;
+  uint64_t units;
+  uint64_t units_delivered;
+  uint64_t audio;
+  uint64_t audio_delivered;
+  uint64_t bytes;
+} SoakSent;
+
+static int failures;
+
+#define SOAK_CHECK(cond, ...)                                                  \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "SOAK FAIL: " __VA_ARGS__);                              \
+      fputc('\n', stderr);                                                     \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+/* Counters must be consistent at any point of a session. */
+static void check_counters(SoakReceiver *r, const SoakSent *sent, unsigned window_n) {
+  const SoakCounters *c = &r->counters;
+  const ChiakiStreamStats *stream = &r->frame_processor.stream_stats;
+  SOAK_CHECK(c->checksum_errors == 0, "window=%u checksum_errors=%llu", window_n, (unsigned long long)c->checksum_errors);
+  SOAK_CHECK(stream->frames_total == c->frames_flushed + c->frames_fec_failed,
+             "window=%u frames_total=%llu flushed=%llu fec_failed=%llu", window_n,
+             (unsigned long long)stream->frames_total, (unsigned long long)c->frames_flushed,
+             (unsigned long long)c->frames_fec_failed);
+  SOAK_CHECK(stream->frames_total >= r->stream_frames_total_last && stream->bytes_total >= r->stream_bytes_total_last,
+             "window=%u stream totals went backwards", window_n);
+  SOAK_CHECK(stream->bytes_total <= sent->bytes, "window=%u bytes_total=%llu > sent=%llu", window_n,
+             (unsigned long long)stream->bytes_total, (unsigned long long)sent->bytes);
+  SOAK_CHECK(c->frames_flushed + c->frames_lost <= sent->frames, "window=%u flushed+lost=%llu > sent=%llu", window_n,
+             (unsigned long long)(c->frames_flushed + c->frames_lost), (unsigned long long)sent->frames);
+  SOAK_CHECK(c->units_accepted <= sent->units_delivered, "window=%u units_accepted=%llu > delivered=%llu", window_n,
+             (unsigned long long)c->units_accepted, (unsigned long long)sent->units_delivered);
+  SOAK_CHECK(r->ref_tracker.ref_count <= r->ref_tracker.ref_slots, "window=%u ref_count=%u", window_n,
+             r->ref_tracker.ref_count);
+  /* Packet stats lag by one video frame, so allow one frame worth of units. */
+  uint64_t sent_packets = sent->units + sent->audio;
+  SOAK_CHECK(r->stats_received <= sent->units_delivered + sent->audio_delivered,
+             "window=%u stats_received=%llu > delivered=%llu", window_n, (unsigned long long)r->stats_received,
+             (unsigned long long)(sent->units_delivered + sent->audio_delivered));
+  SOAK_CHECK(r->stats_lost <= sent_packets, "window=%u stats_lost=%llu > sent=%llu", window_n,
+             (unsigned long long)r->stats_lost, (unsigned long long)sent_packets);
+  r->stream_frames_total_last = stream->frames_total;
+  r->stream_bytes_total_last = stream->bytes_total;
+}
+
+static void window_capture(SoakWindow *w, LatencyHist *hist, uint64_t allocs, uint64_t frames) {
+  w->rss_kb = rss_kb();
+  w->alloc_live = atomic_load(&alloc_live);
+  w->allocs_per_frame = frames ? (double)allocs / (double)frames : 0.0;
+  for (unsigned s = 0; s < STAGE_COUNT; s++) {
+    w->p50[s] = hist_percentile(&hist[s], 50.0);
+    w->p99[s] = hist_percentile(&hist[s], 99.0);
+  }
+}
+
+static void window_print(unsigned window_n, double sim_hours, const SoakWindow *w, const SoakReceiver *r) {
+  const SoakCounters *c = &r->counters;
+  printf("SOAK window=%u sim_hours=%.2f rss_kb=%llu live_allocs=%lld allocs_per_frame=%.3f", window_n, sim_hours,
+         (unsigned long long)w->rss_kb,
+         (long long)w->alloc_live, w->allocs_per_frame);
+  for (unsigned s = 0; s < STAGE_COUNT; s++)
+    printf(" %s_p50_ns=%llu %s_p99_ns=%llu", stage_names[s], (unsigned long long)w->p50[s], stage_names[s],
+           (unsigned long long)w->p99[s]);
+  printf(" flushed=%llu fec=%llu lost=%llu undecodable=%llu substituted=%llu idr=%llu gaps=%llu old=%llu"
+         " bitrate_kbps=%llu\n",
+         (unsigned long long)c->frames_flushed, (unsigned long long)c->frames_fec, (unsigned long long)c->frames_lost,
+         (unsigned long long)c->frames_undecodable, (unsigned long long)c->frames_substituted,
+         (unsigned long long)c->idr_requests, (unsigned long long)c->gap_reports,
+         (unsigned long long)c->old_frame_rejects,
+         (unsigned long long)(chiaki_stream_stats_bitrate((ChiakiStreamStats *)&r->frame_processor.stream_stats, 60) / 1000));
+  fflush(stdout);
+}
+
+static void check_memory_drift(unsigned window_n, const SoakWindow *base, const SoakWindow *w, int64_t live_slack) {
+  SOAK_CHECK(w->rss_kb <= base->rss_kb + SOAK_RSS_SLACK_KB, "window=%u rss_kb=%llu baseline=%llu", window_n,
+             (unsigned long long)w->rss_kb, (unsigned long long)base->rss_kb);
+  SOAK_CHECK(w->alloc_live <= base->alloc_live + live_slack, "window=%u live_allocs=%lld baseline=%lld",
+             window_n, (long long)w->alloc_live, (long long)base->alloc_live);
+  SOAK_CHECK(w->allocs_per_frame <= base->allocs_per_frame * 2.0 + 1.0, "window=%u allocs_per_frame=%.3f baseline=%.3f",
+             window_n, w->allocs_per_frame, base->allocs_per_frame);
+}
+
+static void check_drift(unsigned window_n, const SoakWindow *base, const SoakWindow *w, double latency_factor) {
+  check_memory_drift(window_n, base, w, SOAK_LIVE_ALLOC_SLACK);
+  for (unsigned s = 0; s < STAGE_COUNT; s++) {
+    uint64_t limit = (uint64_t)((double)base->p99[s] * latency_factor);
+    if (limit < base->p99[s] + SOAK_LATENCY_FLOOR_NS)
+      limit = base->p99[s] + SOAK_LATENCY_FLOOR_NS;
+    SOAK_CHECK(w->p99[s] <= limit, "window=%u %s_p99_ns=%llu limit=%llu", window_n, stage_names[s],
+               (unsigned long long)w->p99[s], (unsigned long long)limit);
+  }
+}
+
+static int soak_run(const SoakOptions *opt) {
+  SoakRng rng = {opt->seed ? opt->seed : 1};
+  static SoakConsole console;
+  if (!console_init(&console, &rng)) {
+    fprintf(stderr, "SOAK FAIL: console init\n");
+    return 1;
+  }
+
+  static LatencyHist hist[STAGE_COUNT];
+  SoakReceiver receiver;
+  SoakChannel channel = {0};
+  channel.next_burst_us = 30000000ull;
+  SoakSent sent = {0};
+
+  console_restart(&console, &rng);
+  if (!receiver_init(&receiver, hist)) {
+    fprintf(stderr, "SOAK FAIL: receiver init\n");
+    return 1;
+  }
+
+  const uint64_t frame_us = 1000000ull / opt->fps;
+  const uint64_t hour_us = 3600ull * 1000000ull;
+  const uint64_t window_us = (uint64_t)(opt->window_hours * (double)hour_us);
+  const uint64_t end_us = (uint64_t)(opt->hours * (double)hour_us);
+  const uint64_t restart_us = opt->restart_hours > 0 ? (uint64_t)(opt->restart_hours * (double)hour_us) : 0;
+  uint64_t next_restart_us = restart_us ? restart_us : UINT64_MAX;
+  uint64_t next_window_us = window_us < end_us ? window_us : end_us;
+  uint64_t next_audio_us = 0, next_stats_us = SOAK_STATS_INTERVAL_US;
+  uint64_t frame_count = 0, window_frames = 0, window_allocs_start = atomic_load(&alloc_calls);
+  unsigned window_n = 0, restarts = 0, wraps = 0;
+  SoakWindow base = {0}, window;
+
+  uint8_t order[SOAK_UNITS_MAX];
+  for (uint64_t now_us = 0; now_us < end_us; now_us += frame_us) {
+    uint64_t now_ms = now_us / 1000;
+
+    if (now_us >= next_restart_us) {
+      receiver_poll_stats(&receiver);
+      check_counters(&receiver, &sent, window_n);
+      SoakCounters keep = receiver.counters;
+      receiver_fini(&receiver);
+      console_restart(&console, &rng);
+      receiver_init(&receiver, hist);
+      /* Event counters accumulate across sessions, the sanity bounds restart. */
+      receiver.counters = (SoakCounters){.idr_requests = keep.idr_requests, .gap_reports = keep.gap_reports};
+      memset(&sent, 0, sizeof(sent));
+      next_restart_us += restart_us;
+      restarts++;
+    }
+
+    /* console side: pick the frame type */
+    unsigned tid;
+    if (receiver.idr_requested && !console.idr_due_frame) {
+      console.idr_due_frame = frame_count + SOAK_IDR_RTT_FRAMES;
+      receiver.idr_requested = false;
+    }
+    if (console.frame_index == 1 || console.frames_since_idr >= SOAK_IDR_INTERVAL_FRAMES ||
+        (console.idr_due_frame && frame_count >= console.idr_due_frame)) {
+      tid = SOAK_IDR_TEMPLATE;
+      console.idr_due_frame = 0;
+      console.frames_since_idr = 0;
+    } else {
+      tid = 1 + (unsigned)(frame_count % (SOAK_TEMPLATES - 1));
+      console.frames_since_idr++;
+    }
+    const SoakTemplate *t = &console.templates[tid];
+    console.sent_template[console.frame_index] = (uint8_t)tid;
+
+    /* channel: loss, duplicates and adjacent reordering within the frame */
+    unsigned n = t->k + t->m;
+    for (unsigned i = 0; i < n; i++)
+      order[i] = (uint8_t)i;
+    for (unsigned i = 0; i + 1 < n; i++) {
+      if (rng_chance(&rng, 10000)) {
+        uint8_t tmp = order[i];
+        order[i] = order[i + 1];
+        order[i + 1] = tmp;
+      }
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+      unsigned unit = order[i];
+      ChiakiTakionAVPacket packet = {0};
+      packet.packet_index = (ChiakiSeqNum16)(console.packet_index + unit);
+      packet.frame_index = console.frame_index;
+      packet.is_video = true;
+      packet.unit_index = unit;
+      packet.units_in_frame_total = n;
+      packet.units_in_frame_fec = t->m;
+      packet.data = t->units + (size_t)unit * SOAK_UNIT_STRIDE;
+      packet.data_size = t->wire_size[unit];
+      sent.units++;
+      if (channel_drop(&channel, &rng, now_us))
+        continue;
+      sent.units_delivered++;
+      receiver_video_packet(&receiver, &console, &packet, now_ms);
+      if (rng_chance(&rng, 1000)) {
+        channel.dups++;
+        receiver_video_packet(&receiver, &console, &packet, now_ms);
+      }
+    }
+    sent.frames++;
+    sent.bytes += t->frame_size;
+
+    for (; next_audio_us <= now_us; next_audio_us += SOAK_AUDIO_PACKET_US) {
+      sent.audio++;
+      if (!channel_drop(&channel, &rng, now_us)) {
+        sent.audio_delivered++;
+        receiver_audio_packet(&receiver, console.audio_index);
+      }
+      console.audio_index++;
+    }
+
+    if (now_us >= next_stats_us) {
+      receiver_poll_stats(&receiver);
+      next_stats_us += SOAK_STATS_INTERVAL_US;
+    }
+
+    ChiakiSeqNum16 prev_frame_index = console.frame_index;
+    console.frame_index++;
+    console.packet_index = (ChiakiSeqNum16)(console.packet_index + n);
+    if (console.frame_index < prev_frame_index)
+      wraps++;
+    frame_count++;
+    window_frames++;
+
+    if (now_us + frame_us >= next_window_us) {
+      window_n++;
+      receiver_poll_stats(&receiver);
+      check_counters(&receiver, &sent, window_n);
+      window_capture(&window, hist, atomic_load(&alloc_calls) - window_allocs_start, window_frames);
+      window_print(window_n, (double)(now_us + frame_us) / (double)hour_us, &window, &receiver);
+      chiaki_stream_stats_reset(&receiver.frame_processor.stream_stats);
+      if (window_n == 1)
+        base = window;
+      else
+        check_drift(window_n, &base, &window, opt->latency_factor);
+      memset(hist, 0, sizeof(hist));
+      window_allocs_start = atomic_load(&alloc_calls);
+      window_frames = 0;
+      next_window_us += window_us;
+      if (next_window_us > end_us)
+        next_window_us = end_us;
+    }
+  }
+
+  receiver_fini(&receiver);
+  console_fini(&console);
+
+  printf("SOAK done hours=%.2f frames=%llu restarts=%u frame_index_wraps=%u dups=%llu live_allocs=%lld failures=%d\n",
+         opt->hours, (unsigned long long)frame_count, restarts, wraps, (unsigned long long)channel.dups,
+         (long long)atomic_load(&alloc_live), failures);
+  return failures ? 1 : 0;
+}
+
+/* ---- loopback mode -------------------------------------------------------
+ * The same windows and drift checks around a real ChiakiSession streaming
+ * from the stand-in host, in wall-clock time. */
+
+typedef struct {
+  atomic_ullong video_frames;
+  atomic_ullong frames_lost;
+  atomic_ullong frames_recovered;
+  atomic_ullong video_bytes;
+  atomic_ullong audio_frames;
+  atomic_bool quit;
+  /* interval between delivered video frames, written by the takion thread */
+  pthread_mutex_t interval_mutex;
+  LatencyHist interval;
+  uint64_t last_frame_ns;
+} LoopbackClient;
+
+/* Stream connection diagnostics, sampled under diag_mutex. */
+typedef struct {
+  uint32_t drop_events;
+  uint32_t drop_packets;
+  uint32_t fec_fail_events;
+  uint32_t missing_ref_events;
+  uint32_t corrupt_burst_events;
+  uint32_t sendbuf_overflow_events;
+} LoopbackDiag;
+
+static bool loopback_on_video(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered,
+                              const ChiakiVideoSampleInfo *info, void *user) {
+  LoopbackClient *c = user;
+  (void)buf;
+  (void)info;
+  uint64_t t = now_ns();
+  pthread_mutex_lock(&c->interval_mutex);
+  if (c->last_frame_ns)
+    hist_add(&c->interval, t - c->last_frame_ns);
+  c->last_frame_ns = t;
+  pthread_mutex_unlock(&c->interval_mutex);
+  atomic_fetch_add(&c->video_frames, 1);
+  atomic_fetch_add(&c->video_bytes, buf_size);
+  if (frames_lost > 0)
+    atomic_fetch_add(&c->frames_lost, (unsigned long long)frames_lost);
+  if (frame_recovered)
+    atomic_fetch_add(&c->frames_recovered, 1);
+  return true;
+}
+
+static void loopback_on_audio_header(ChiakiAudioHeader *header, void *user) {
+  (void)header;
+  (void)user;
+}
+
+static void loopback_on_audio_frame(uint8_t *buf, size_t buf_size, void *user) {
+  LoopbackClient *c = user;
+  (void)buf;
+  (void)buf_size;
+  atomic_fetch_add(&c->audio_frames, 1);
+}
+
+static void loopback_on_event(ChiakiEvent *event, void *user) {
+  LoopbackClient *c = user;
+  if (event->type == CHIAKI_EVENT_QUIT) {
+    fprintf(stderr, "session quit: %s\n", chiaki_quit_reason_string(event->quit.reason));
+    atomic_store(&c->quit, true);
+  }
+}
+
+static void loopback_diag(ChiakiSession *session, LoopbackDiag *d) {
+  ChiakiStreamConnection *sc = &session->stream_connection;
+  chiaki_mutex_lock(&sc->diag_mutex);
+  d->drop_events = sc->drop_events;
+  d->drop_packets = sc->drop_packets;
+  d->fec_fail_events = sc->av_fec_fail_events;
+  d->missing_ref_events = sc->av_missing_ref_events;
+  d->corrupt_burst_events = sc->av_corrupt_burst_events;
+  d->sendbuf_overflow_events = sc->av_sendbuf_overflow_events;
+  chiaki_mutex_unlock(&sc->diag_mutex);
+}
+
+/* Starts a session against the stand-in and waits for its first video frame. */
+static bool loopback_session_start(ChiakiSession *session, ChiakiConnectInfo *info, ChiakiLog *log,
+                                   LoopbackClient *client, ChiakiAudioSink *audio_sink) {
+  atomic_store(&client->quit, false);
+  pthread_mutex_lock(&client->interval_mutex);
+  client->last_frame_ns = 0;
+  pthread_mutex_unlock(&client->interval_mutex);
+  if (chiaki_session_init(session, info, log) != CHIAKI_ERR_SUCCESS) {
+    fprintf(stderr, "SOAK FAIL: chiaki_session_init\n");
+    return false;
+  }
+  chiaki_session_set_event_cb(session, loopback_on_event, client);
+  chiaki_session_set_video_sample_cb(session, loopback_on_video, client);
+  chiaki_session_set_audio_sink(session, audio_sink);
+  if (chiaki_session_start(session) != CHIAKI_ERR_SUCCESS) {
+    fprintf(stderr, "SOAK FAIL: chiaki_session_start\n");
+    chiaki_session_fini(session);
+    return false;
+  }
+  unsigned long long frames0 = atomic_load(&client->video_frames);
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  while (!atomic_load(&client->quit) && atomic_load(&client->video_frames) == frames0 &&
+         chiaki_time_now_monotonic_us() - start_us < SOAK_LOOPBACK_CONNECT_TIMEOUT_US)
+    usleep(1000);
+  if (atomic_load(&client->video_frames) == frames0) {
+    fprintf(stderr, "SOAK FAIL: no video within %u s\n", SOAK_LOOPBACK_CONNECT_TIMEOUT_US / 1000000);
+    chiaki_session_stop(session);
+    chiaki_session_join(session);
+    chiaki_session_fini(session);
+    return false;
+  }
+  return true;
+}
+
+static void loopback_session_stop(ChiakiSession *session) {
+  chiaki_session_stop(session);
+  chiaki_session_join(session);
+  chiaki_session_fini(session);
+}
+
+static int soak_loopback_run(const SoakOptions *opt) {
+  if (chiaki_lib_init() != CHIAKI_ERR_SUCCESS) {
+    fprintf(stderr, "SOAK FAIL: chiaki_lib_init\n");
+    return 1;
+  }
+  ChiakiLog log;
+  chiaki_log_init(&log, CHIAKI_LOG_ERROR | CHIAKI_LOG_WARNING, chiaki_log_cb_print, NULL);
+
+  StandinConfig config;
+  standin_config_defaults(&config);
+  config.shape = opt->shape;
+  config.seed = opt->seed;
+  config.log = &log;
+  StandinHost *host = standin_host_new(&config);
+  if (!host || !standin_host_start(host)) {
+    fprintf(stderr, "SOAK FAIL: stand-in host start\n");
+    standin_host_free(host);
+    return 1;
+  }
+
+  ChiakiConnectInfo info;
+  memset(&info, 0, sizeof(info));
+  info.ps5 = config.ps5;
+  info.host = config.bind_addr;
+  memcpy(info.morning, config.morning, sizeof(info.morning));
+  chiaki_connect_video_profile_preset(&info.video_profile, CHIAKI_VIDEO_RESOLUTION_PRESET_720p,
+                                      CHIAKI_VIDEO_FPS_PRESET_60);
+
+  static LoopbackClient client;
+  pthread_mutex_init(&client.interval_mutex, NULL);
+  ChiakiAudioSink audio_sink = {&client, loopback_on_audio_header, loopback_on_audio_frame};
+  ChiakiSession session;
+  if (!loopback_session_start(&session, &info, &log, &client, &audio_sink)) {
+    standin_host_free(host);
+    return 1;
+  }
+
+  const uint64_t hour_us = 3600ull * 1000000ull;
+  const uint64_t window_us = (uint64_t)(opt->window_hours * (double)hour_us);
+  const uint64_t end_us = (uint64_t)(opt->hours * (double)hour_us);
+  const uint64_t restart_us = opt->restart_hours > 0 ? (uint64_t)(opt->restart_hours * (double)hour_us) : 0;
+  uint64_t next_restart_us = restart_us ? restart_us : UINT64_MAX;
+  uint64_t next_window_us = window_us < end_us ? window_us : end_us;
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  unsigned long long window_frames_start = atomic_load(&client.video_frames);
+  unsigned long long window_bytes_start = atomic_load(&client.video_bytes);
+  uint64_t window_allocs_start = atomic_load(&alloc_calls);
+  uint64_t window_start_us = 0;
+  unsigned window_n = 0, restarts = 0;
+  LoopbackDiag diag_last = {0};
+  SoakWindow base = {0}, window;
+  uint64_t base_interval_p99 = 0;
+  bool session_up = true;
+
+  for (;;) {
+    uint64_t now_us = chiaki_time_now_monotonic_us() - start_us;
+    if (atomic_load(&client.quit)) {
+      SOAK_CHECK(false, "window=%u session quit while streaming", window_n + 1);
+      break;
+    }
+
+    if (now_us >= next_restart_us && now_us < end_us) {
+      loopback_session_stop(&session);
+      session_up = false;
+      memset(&diag_last, 0, sizeof(diag_last));
+      if (!loopback_session_start(&session, &info, &log, &client, &audio_sink)) {
+        failures++;
+        break;
+      }
+      session_up = true;
+      next_restart_us += restart_us;
+      restarts++;
+      continue;
+    }
+
+    if (now_us < next_window_us) {
+      usleep(10000);
+      continue;
+    }
+
+    window_n++;
+    unsigned long long frames = atomic_load(&client.video_frames);
+    unsigned long long bytes = atomic_load(&client.video_bytes);
+    unsigned long long lost = atomic_load(&client.frames_lost);
+    unsigned long long recovered = atomic_load(&client.frames_recovered);
+    unsigned long long window_frames = frames - window_frames_start;
+    LoopbackDiag diag;
+    loopback_diag(&session, &diag);
+    StandinStats st;
+    standin_host_stats(host, &st);
+
+    window.rss_kb = rss_kb();
+    window.alloc_live = atomic_load(&alloc_live);
+    window.allocs_per_frame =
+        window_frames ? (double)(atomic_load(&alloc_calls) - window_allocs_start) / (double)window_frames : 0.0;
+    pthread_mutex_lock(&client.interval_mutex);
+    uint64_t interval_p50 = hist_percentile(&client.interval, 50.0);
+    uint64_t interval_p99 = hist_percentile(&client.interval, 99.0);
+    memset(&client.interval, 0, sizeof(client.interval));
+    pthread_mutex_unlock(&client.interval_mutex);
+    double seconds = (double)(now_us - window_start_us) / 1e6;
+
+    printf("SOAK loopback window=%u hours=%.4f rss_kb=%llu live_allocs=%lld allocs_per_frame=%.3f"
+           " interval_p50_ns=%llu interval_p99_ns=%llu fps=%.2f mbps=%.2f frames=%llu lost=%llu recovered=%llu"
+           " audio=%llu drop_events=%u drop_packets=%u fec_fail=%u missing_ref=%u corrupt_bursts=%u"
+           " sendbuf_overflows=%u sent_frames=%llu shaped_dropped=%llu idr_requests=%llu restarts=%u\n",
+           window_n, (double)now_us / (double)hour_us, (unsigned long long)window.rss_kb,
+           (long long)window.alloc_live, window.allocs_per_frame, (unsigned long long)interval_p50,
+           (unsigned long long)interval_p99, seconds > 0 ? window_frames / seconds : 0.0,
+           seconds > 0 ? (bytes - window_bytes_start) * 8.0 / seconds / 1e6 : 0.0, frames, lost, recovered,
+           atomic_load(&client.audio_frames), diag.drop_events, diag.drop_packets, diag.fec_fail_events,
+           diag.missing_ref_events, diag.corrupt_burst_events, diag.sendbuf_overflow_events,
+           (unsigned long long)st.video_frames, (unsigned long long)st.shaped_dropped,
+           (unsigned long long)st.idr_requests, restarts);
+    fflush(stdout);
+
+    SOAK_CHECK(window_frames > 0, "window=%u no video frames", window_n);
+    /* The stand-in publishes its stats after sending, one frame may be ahead. */
+    SOAK_CHECK(frames <= st.video_frames + 1, "window=%u frames=%llu > sent=%llu", window_n, frames,
+               (unsigned long long)st.video_frames);
+    SOAK_CHECK(recovered <= frames, "window=%u recovered=%llu > frames=%llu", window_n, recovered, frames);
+    SOAK_CHECK(st.mac_errors == 0, "window=%u stand-in mac_errors=%llu", window_n, (unsigned long long)st.mac_errors);
+    /* The 32-bit diagnostics must only grow within a session. */
+    SOAK_CHECK(diag.drop_events >= diag_last.drop_events && diag.drop_packets >= diag_last.drop_packets &&
+                   diag.fec_fail_events >= diag_last.fec_fail_events &&
+                   diag.missing_ref_events >= diag_last.missing_ref_events &&
+                   diag.corrupt_burst_events >= diag_last.corrupt_burst_events &&
+                   diag.sendbuf_overflow_events >= diag_last.sendbuf_overflow_events,
+               "window=%u stream connection diagnostics went backwards", window_n);
+    diag_last = diag;
+
+    if (window_n == 1) {
+      base = window;
+      base_interval_p99 = interval_p99;
+    } else {
+      check_memory_drift(window_n, &base, &window, SOAK_LOOPBACK_LIVE_ALLOC_SLACK);
+      uint64_t limit = (uint64_t)((double)base_interval_p99 * opt->latency_factor);
+      if (limit < base_interval_p99 + SOAK_LOOPBACK_INTERVAL_FLOOR_NS)
+        limit = base_interval_p99 + SOAK_LOOPBACK_INTERVAL_FLOOR_NS;
+      SOAK_CHECK(interval_p99 <= limit, "window=%u interval_p99_ns=%llu limit=%llu", window_n,
+                 (unsigned long long)interval_p99, (unsigned long long)limit);
+    }
+
+    window_frames_start = frames;
+    window_bytes_start = bytes;
+    window_allocs_start = atomic_load(&alloc_calls);
+    window_start_us = now_us;
+    if (next_window_us >= end_us)
+      break;
+    next_window_us += window_us;
+    if (next_window_us > end_us)
+      next_window_us = end_us;
+  }
+
+  if (session_up)
+    loopback_session_stop(&session);
+  standin_host_free(host);
+  pthread_mutex_destroy(&client.interval_mutex);
+
+  printf("SOAK loopback done hours=%.4f frames=%llu lost=%llu restarts=%u live_allocs=%lld failures=%d\n", opt->hours,
+         atomic_load(&client.video_frames), atomic_load(&client.frames_lost), restarts,
+         (long long)atomic_load(&alloc_live), failures);
+  return failures ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+  SoakOptions opt = {
+      .hours = 24.0,
+      .restart_hours = 5.0,
+      .window_hours = 1.0,
+      .latency_factor = 3.0,
+      .fps = 60,
+      .seed = 0x50a4,
+  };
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--loopback") == 0) {
+      opt.loopback = true;
+      continue;
+    }
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    if (strcmp(arg, "--hours") == 0)
+      opt.hours = atof(val);
+    else if (strcmp(arg, "--window-hours") == 0)
+      opt.window_hours = atof(val);
+    else if (strcmp(arg, "--restart-hours") == 0)
+      opt.restart_hours = atof(val);
+    else if (strcmp(arg, "--latency-factor") == 0)
+      opt.latency_factor = atof(val);
+    else if (strcmp(arg, "--fps") == 0)
+      opt.fps = (unsigned)atoi(val);
+    else if (strcmp(arg, "--seed") == 0)
+      opt.seed = strtoull(val, NULL, 0);
+    else if (strcmp(arg, "--shape") == 0) {
+      if (!netsim_params_parse(&opt.shape, val)) {
+        fprintf(stderr, "invalid --shape %s\n", val);
+        return 2;
+      }
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+  if (opt.hours <= 0 || opt.window_hours <= 0 || !opt.fps) {
+    fprintf(stderr, "invalid options\n");
+    return 2;
+  }
+  return opt.loopback ? soak_loopback_run(&opt) : soak_run(&opt);
+}
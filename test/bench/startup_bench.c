@@ -0,0 +1,143 @@
+/*
+ * startup_bench.c — What the startup profiler and lazy init add to launch.
+ *
+ * Four measurements:
+ *
+ *   span        chiaki_startup_prof_begin() + chiaki_startup_prof_end()
+ *   require     chiaki_lazy_init_require() of a unit that is already done,
+ *               what every first-use check costs after startup
+ *   chain       requiring the last of 32 units that each depend on the one
+ *               before, empty inits, so only the scheduling is timed
+ *   background  chiaki_lazy_init_start() until the first background unit
+ *               runs, and until all 32 have run
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chiaki/lazyinit.h>
+#include <chiaki/startupprof.h>
+#include <chiaki/time.h>
+
+#include "bench.h"
+
+#define SPAN_ROUNDS 200
+#define SPANS_PER_ROUND 1000
+#define REQUIRE_ROUNDS 1000000
+#define CHAIN_ROUNDS 2000
+#define BACKGROUND_ROUNDS 500
+
+static volatile uint64_t first_init_us;
+
+static ChiakiErrorCode empty_init(void *user) {
+  (void)user;
+  return CHIAKI_ERR_SUCCESS;
+}
+
+static ChiakiErrorCode stamp_init(void *user) {
+  (void)user;
+  if (!first_init_us)
+    first_init_us = chiaki_time_now_monotonic_us();
+  return CHIAKI_ERR_SUCCESS;
+}
+
+static void add_chain(ChiakiLazyInit *li, ChiakiLazyInitMode mode, ChiakiLazyInitFunc init) {
+  for (unsigned i = 0; i < CHIAKI_LAZY_INIT_UNITS_MAX; i++) {
+    ChiakiLazyUnit unit = {"unit", mode, i ? CHIAKI_LAZY_INIT_DEP(i - 1) : 0, init, NULL, NULL};
+    if (chiaki_lazy_init_add(li, &unit, NULL) != CHIAKI_ERR_SUCCESS)
+      abort();
+  }
+}
+
+static void bench_span(void) {
+  ChiakiStartupProfConfig config;
+  chiaki_startup_prof_config_defaults(&config);
+  config.capacity = SPANS_PER_ROUND;
+  uint64_t elapsed_us = 0;
+  for (int r = 0; r < SPAN_ROUNDS; r++) {
+    ChiakiStartupProf *prof = chiaki_startup_prof_new(&config);
+    if (!prof)
+      abort();
+    uint64_t start_us = chiaki_time_now_monotonic_us();
+    for (int i = 0; i < SPANS_PER_ROUND; i++)
+      chiaki_startup_prof_end(prof, chiaki_startup_prof_begin(prof, "span"));
+    elapsed_us += chiaki_time_now_monotonic_us() - start_us;
+    chiaki_startup_prof_free(prof);
+  }
+  printf("BENCH startup stage=span spans=%d ns_per_span=%.1f\n", SPAN_ROUNDS * SPANS_PER_ROUND,
+         (double)elapsed_us * 1000.0 / (SPAN_ROUNDS * SPANS_PER_ROUND));
+}
+
+static void bench_require(void) {
+  ChiakiLazyInit li;
+  if (chiaki_lazy_init_init(&li, NULL) != CHIAKI_ERR_SUCCESS)
+    abort();
+  add_chain(&li, CHIAKI_LAZY_INIT_ON_DEMAND, empty_init);
+  unsigned last = CHIAKI_LAZY_INIT_UNITS_MAX - 1;
+  chiaki_lazy_init_require(&li, last);
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  for (int i = 0; i < REQUIRE_ROUNDS; i++)
+    chiaki_lazy_init_require(&li, last);
+  uint64_t elapsed_us = chiaki_time_now_monotonic_us() - start_us;
+  chiaki_lazy_init_fini(&li);
+  printf("BENCH startup stage=require calls=%d ns_per_call=%.1f\n", REQUIRE_ROUNDS,
+         (double)elapsed_us * 1000.0 / REQUIRE_ROUNDS);
+}
+
+static void bench_chain(bool profiled) {
+  uint64_t samples[CHAIN_ROUNDS];
+  ChiakiStartupProfConfig config;
+  chiaki_startup_prof_config_defaults(&config);
+  for (int r = 0; r < CHAIN_ROUNDS; r++) {
+    ChiakiStartupProf *prof = profiled ? chiaki_startup_prof_new(&config) : NULL;
+    ChiakiLazyInit li;
+    if (chiaki_lazy_init_init(&li, prof) != CHIAKI_ERR_SUCCESS)
+      abort();
+    add_chain(&li, CHIAKI_LAZY_INIT_ON_DEMAND, empty_init);
+    uint64_t start_us = chiaki_time_now_monotonic_us();
+    chiaki_lazy_init_require(&li, CHIAKI_LAZY_INIT_UNITS_MAX - 1);
+    samples[r] = chiaki_time_now_monotonic_us() - start_us;
+    chiaki_lazy_init_fini(&li);
+    chiaki_startup_prof_free(prof);
+  }
+  uint64_t p50 = bench_percentile(samples, CHAIN_ROUNDS, 50);
+  uint64_t p99 = bench_percentile(samples, CHAIN_ROUNDS, 99);
+  printf("BENCH startup stage=chain profiled=%d units=%d p50_us=%llu p99_us=%llu ns_per_unit=%.1f\n", profiled ? 1 : 0,
+         CHIAKI_LAZY_INIT_UNITS_MAX, (unsigned long long)p50, (unsigned long long)p99,
+         (double)p50 * 1000.0 / CHIAKI_LAZY_INIT_UNITS_MAX);
+}
+
+static void bench_background(void) {
+  uint64_t first[BACKGROUND_ROUNDS];
+  uint64_t all[BACKGROUND_ROUNDS];
+  for (int r = 0; r < BACKGROUND_ROUNDS; r++) {
+    ChiakiLazyInit li;
+    if (chiaki_lazy_init_init(&li, NULL) != CHIAKI_ERR_SUCCESS)
+      abort();
+    add_chain(&li, CHIAKI_LAZY_INIT_BACKGROUND, stamp_init);
+    first_init_us = 0;
+    uint64_t start_us = chiaki_time_now_monotonic_us();
+    if (chiaki_lazy_init_start(&li) != CHIAKI_ERR_SUCCESS)
+      abort();
+    chiaki_lazy_init_wait(&li);
+    all[r] = chiaki_time_now_monotonic_us() - start_us;
+    first[r] = first_init_us - start_us;
+    chiaki_lazy_init_fini(&li);
+  }
+  printf("BENCH startup stage=background units=%d first_p50_us=%llu first_p99_us=%llu all_p50_us=%llu "
+         "all_p99_us=%llu\n",
+         CHIAKI_LAZY_INIT_UNITS_MAX, (unsigned long long)bench_percentile(first, BACKGROUND_ROUNDS, 50),
+         (unsigned long long)bench_percentile(first, BACKGROUND_ROUNDS, 99),
+         (unsigned long long)bench_percentile(all, BACKGROUND_ROUNDS, 50),
+         (unsigned long long)bench_percentile(all, BACKGROUND_ROUNDS, 99));
+}
+
+void run_startup_bench(void) {
+  bench_span();
+  bench_require();
+  bench_chain(false);
+  bench_chain(true);
+  bench_background();
+}
@@ -0,0 +1,148 @@
+/*
+ * threadrole_bench.c — Wake-to-run scheduling latency per thread role.
+ *
+ * One waiter thread per role is created through chiaki_thread_create_role()
+ * and woken SAMPLES times via a condition variable while DEFAULT-role spinner
+ * threads keep every core busy. The time between signal and the waiter running
+ * is reported as p50/p99/max per role.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+
+#include "bench.h"
+
+#define SAMPLES 2000
+#define MAX_SPINNERS 64
+
+typedef struct {
+  ChiakiMutex mutex;
+  ChiakiCond cond;
+  bool posted;
+  bool done;
+  bool quit;
+  uint64_t posted_us;
+  uint64_t samples[SAMPLES];
+  size_t count;
+} Waker;
+
+static volatile bool spin_stop;
+
+static void *spinner_thread(void *user) {
+  (void)user;
+  volatile uint64_t x = 0;
+  while (!spin_stop)
+    x++;
+  return NULL;
+}
+
+static bool waker_posted(void *user) {
+  Waker *w = user;
+  return w->posted || w->quit;
+}
+
+static void *waiter_thread(void *user) {
+  Waker *w = user;
+  chiaki_mutex_lock(&w->mutex);
+  while (true) {
+    chiaki_cond_wait_pred(&w->cond, &w->mutex, waker_posted, w);
+    if (w->quit)
+      break;
+    uint64_t now_us = chiaki_time_now_monotonic_us();
+    if (w->count < SAMPLES)
+      w->samples[w->count++] = now_us - w->posted_us;
+    w->posted = false;
+    w->done = true;
+    chiaki_cond_broadcast(&w->cond);
+  }
+  chiaki_mutex_unlock(&w->mutex);
+  return NULL;
+}
+
+static bool waker_done(void *user) {
+  return ((Waker *)user)->done;
+}
+
+static void bench_role(ChiakiThreadRole role) {
+  static Waker w;
+  w.posted = w.done = w.quit = false;
+  w.count = 0;
+  chiaki_mutex_init(&w.mutex, false);
+  chiaki_cond_init(&w.cond, &w.mutex);
+
+  ChiakiThread thread;
+  if (chiaki_thread_create_role(&thread, role, waiter_thread, &w) != CHIAKI_ERR_SUCCESS) {
+    fprintf(stderr, "failed to create %s waiter\n", chiaki_thread_role_string(role));
+    return;
+  }
+
+  for (size_t i = 0; i < SAMPLES; i++) {
+    usleep(500);
+    chiaki_mutex_lock(&w.mutex);
+    w.done = false;
+    w.posted = true;
+    w.posted_us = chiaki_time_now_monotonic_us();
+    chiaki_cond_broadcast(&w.cond);
+    chiaki_cond_wait_pred(&w.cond, &w.mutex, waker_done, &w);
+    chiaki_mutex_unlock(&w.mutex);
+  }
+
+  chiaki_mutex_lock(&w.mutex);
+  w.quit = true;
+  chiaki_cond_broadcast(&w.cond);
+  chiaki_mutex_unlock(&w.mutex);
+  chiaki_thread_join(&thread, NULL);
+
+  uint64_t p50 = bench_percentile(w.samples, w.count, 50.0);
+  uint64_t p99 = bench_percentile(w.samples, w.count, 99.0);
+  uint64_t max = w.count ? w.samples[w.count - 1] : 0;
+  printf("BENCH threadrole role=%s samples=%zu wake_p50_us=%llu wake_p99_us=%llu wake_max_us=%llu\n",
+         chiaki_thread_role_string(role), w.count, (unsigned long long)p50, (unsigned long long)p99,
+         (unsigned long long)max);
+
+  chiaki_cond_fini(&w.cond);
+  chiaki_mutex_fini(&w.mutex);
+}
+
+void run_threadrole_bench(void) {
+  // Nice values: latency-critical roles stay at 0, background work yields,
+  // the synthetic load runs at the lowest priority.
+  ChiakiThreadPolicyTable table;
+  chiaki_thread_policy_table_init(&table);
+  table.roles[CHIAKI_THREAD_ROLE_DEFAULT].priority = 19;
+  table.roles[CHIAKI_THREAD_ROLE_NETWORK].priority = 0;
+  table.roles[CHIAKI_THREAD_ROLE_DECODE].priority = 0;
+  table.roles[CHIAKI_THREAD_ROLE_AUDIO].priority = 0;
+  table.roles[CHIAKI_THREAD_ROLE_INPUT].priority = 0;
+  table.roles[CHIAKI_THREAD_ROLE_CRYPTO].priority = 5;
+  table.roles[CHIAKI_THREAD_ROLE_HOUSEKEEPING].priority = 10;
+  chiaki_thread_policy_table_set(&table);
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t spinner_count = cores > 0 ? (size_t)cores * 2 : 2;
+  if (spinner_count > MAX_SPINNERS)
+    spinner_count = MAX_SPINNERS;
+  ChiakiThread spinners[MAX_SPINNERS];
+  size_t spinners_started = 0;
+  spin_stop = false;
+  for (size_t i = 0; i < spinner_count; i++) {
+    if (chiaki_thread_create(&spinners[i], spinner_thread, NULL) == CHIAKI_ERR_SUCCESS)
+      spinners_started++;
+    else
+      break;
+  }
+  printf("BENCH threadrole load_spinners=%zu\n", spinners_started);
+
+  for (int role = CHIAKI_THREAD_ROLE_NETWORK; role < CHIAKI_THREAD_ROLE_COUNT; role++)
+    bench_role((ChiakiThreadRole)role);
+
+  spin_stop = true;
+  for (size_t i = 0; i < spinners_started; i++)
+    chiaki_thread_join(&spinners[i], NULL);
+  chiaki_thread_policy_table_set(NULL);
+}
@@ -19,6 +19,11 @@ void chiaki_log(ChiakiLog *log, ChiakiLogLevel level, const char *fmt, ...) {
   (void)fmt;
 }
 
+const char *chiaki_error_string(ChiakiErrorCode code) {
+  (void)code;
+  return "error";
+}
+
 void host_free(VitaChiakiHost *host) {
   if (!host)
     return;
@@ -455,6 +460,24 @@ static void test_registered_hosts_require_required_fields(void) {
 void run_packet_path_tests(void);
 void run_json_escape_tests(void);
 void run_token_crypto_tests(void);
+void run_threadrole_tests(void);
+void run_reftracker_tests(void);
+void run_netsim_tests(void);
+void run_signalgraph_tests(void);
+void run_jsonscan_tests(void);
+void run_notifqueue_tests(void);
+void run_dnscache_tests(void);
+void run_tokenlifecycle_tests(void);
+void run_connprofile_tests(void);
+void run_startup_tests(void);
+void run_glyph_cache_tests(void);
+void run_avsync_tests(void);
+void run_launchhints_tests(void);
+void run_decodegov_tests(void);
+void run_nalcheck_tests(void);
+void run_workerpool_tests(void);
+void run_costacct_tests(void);
+void run_haptics_tests(void);
 
 int main(void) {
   test_legacy_section_migration();
@@ -468,6 +491,24 @@ int main(void) {
   run_packet_path_tests();
   run_json_escape_tests();
   run_token_crypto_tests();
+  run_threadrole_tests();
+  run_reftracker_tests();
+  run_netsim_tests();
+  run_signalgraph_tests();
+  run_jsonscan_tests();
+  run_notifqueue_tests();
+  run_dnscache_tests();
+  run_tokenlifecycle_tests();
+  run_connprofile_tests();
+  run_startup_tests();
+  run_glyph_cache_tests();
+  run_avsync_tests();
+  run_launchhints_tests();
+  run_decodegov_tests();
+  run_nalcheck_tests();
+  run_workerpool_tests();
+  run_costacct_tests();
+  run_haptics_tests();
   reset_config_file();
   puts("vitarps5 config tests passed");
   return 0;
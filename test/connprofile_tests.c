@@ -0,0 +1,256 @@
+/*
+ * connprofile_tests.c — Unit tests for ChiakiConnProfileStore
+ * (lib/src/connprofile.c).
+ *
+ * The store runs on a fake clock, so max_age_ms and link_max_age_ms are
+ * stepped through without sleeping. Covers the validity rules (system
+ * version, path, requested video profile), mismatch fallback, the link
+ * history and eviction.
+ * test/standin/reconnect_bench.c times cold and hot reconnects against a
+ * stand-in console on loopback.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <chiaki/connprofile.h>
+
+#define MINUTE_MS (60 * 1000ULL)
+
+static uint64_t fake_now_ms(void *user) {
+  return *(uint64_t *)user;
+}
+
+static ChiakiConnProfileStore *new_store(uint64_t *now) {
+  ChiakiConnProfileStoreConfig config;
+  chiaki_conn_profile_store_config_defaults(&config);
+  config.capacity = 2;
+  config.now_ms = fake_now_ms;
+  config.now_user = now;
+  ChiakiConnProfileStore *store = chiaki_conn_profile_store_new(&config);
+  assert(store);
+  return store;
+}
+
+static void video_profile(ChiakiConnectVideoProfile *profile, unsigned height, unsigned fps, unsigned bitrate) {
+  memset(profile, 0, sizeof(*profile));
+  profile->width = height * 16 / 9;
+  profile->height = height;
+  profile->max_fps = fps;
+  profile->bitrate = bitrate;
+  profile->codec = CHIAKI_CODEC_H264;
+}
+
+/* What a base PS4 on 9.0 firmware at 192.168.1.20 leaves behind after a
+ * stream, 1080p requested and downgraded to 720p. */
+static void good_profile(ChiakiConnProfile *profile, const char *key) {
+  memset(profile, 0, sizeof(*profile));
+  strcpy(profile->key, key);
+  strcpy(profile->system_version, "09000000");
+  strcpy(profile->addr, "192.168.1.20");
+  profile->target = CHIAKI_TARGET_PS4_9;
+  video_profile(&profile->video_requested, 1080, 60, 15000);
+  video_profile(&profile->video_profile, 720, 60, 10000);
+  profile->mtu_in = 1454;
+  profile->mtu_out = 1400;
+  profile->rtt_us = 2500;
+  profile->parts = CHIAKI_CONN_PROFILE_PART_ADDR | CHIAKI_CONN_PROFILE_PART_TARGET | CHIAKI_CONN_PROFILE_PART_VIDEO |
+                   CHIAKI_CONN_PROFILE_PART_LINK;
+}
+
+static void test_record_and_apply(void) {
+  uint64_t now = 1000;
+  ChiakiConnProfileStore *store = new_store(&now);
+  ChiakiConnProfile profile;
+  assert(chiaki_conn_profile_store_lookup(store, "aabbccddeeff", NULL, NULL, &profile) == 0);
+
+  good_profile(&profile, "aabbccddeeff");
+  assert(chiaki_conn_profile_store_record(store, &profile) == CHIAKI_ERR_SUCCESS);
+
+  ChiakiConnProfile hot;
+  uint32_t valid = chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", "192.168.1.20", &hot);
+  assert(valid == profile.parts);
+  assert(hot.parts == valid);
+  assert(!strcmp(hot.addr, "192.168.1.20"));
+  assert(hot.target == CHIAKI_TARGET_PS4_9);
+
+  ChiakiConnectInfo info;
+  memset(&info, 0, sizeof(info));
+  video_profile(&info.video_profile, 1080, 60, 15000);
+  uint32_t applied = chiaki_conn_profile_apply(&hot, &info);
+  assert(applied == (CHIAKI_CONN_PROFILE_PART_TARGET | CHIAKI_CONN_PROFILE_PART_VIDEO | CHIAKI_CONN_PROFILE_PART_LINK));
+  assert(info.target_hint == CHIAKI_TARGET_PS4_9);
+  assert(info.mtu_in_hint == 1454 && info.mtu_out_hint == 1400 && info.rtt_hint_us == 2500);
+  assert(info.video_profile.height == 720 && info.video_profile.bitrate == 10000);
+
+  // A PS5 connect never takes a PS4 target.
+  memset(&info, 0, sizeof(info));
+  info.ps5 = true;
+  assert(!(chiaki_conn_profile_apply(&hot, &info) & CHIAKI_CONN_PROFILE_PART_TARGET));
+  assert(info.target_hint == CHIAKI_TARGET_PS4_UNKNOWN);
+
+  // Another requested profile keeps the request.
+  memset(&info, 0, sizeof(info));
+  video_profile(&info.video_profile, 540, 30, 6000);
+  assert(!(chiaki_conn_profile_apply(&hot, &info) & CHIAKI_CONN_PROFILE_PART_VIDEO));
+  assert(info.video_profile.height == 540 && info.video_profile.bitrate == 6000);
+
+  profile.key[0] = '\0';
+  assert(chiaki_conn_profile_store_record(store, &profile) == CHIAKI_ERR_INVALID_DATA);
+  chiaki_conn_profile_store_free(store);
+}
+
+static void test_validity(void) {
+  uint64_t now = 1000;
+  ChiakiConnProfileStore *store = new_store(&now);
+  ChiakiConnProfile profile;
+  good_profile(&profile, "aabbccddeeff");
+  assert(chiaki_conn_profile_store_record(store, &profile) == CHIAKI_ERR_SUCCESS);
+
+  // A firmware update may bring a new RP version.
+  uint32_t valid = chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "10000000", "192.168.1.20", NULL);
+  assert(!(valid & CHIAKI_CONN_PROFILE_PART_TARGET));
+  assert(valid & CHIAKI_CONN_PROFILE_PART_LINK);
+  // Unknown now (no discovery answer yet): trust the recorded one.
+  valid = chiaki_conn_profile_store_lookup(store, "aabbccddeeff", NULL, "192.168.1.20", NULL);
+  assert(valid & CHIAKI_CONN_PROFILE_PART_TARGET);
+
+  // mtu/rtt belong to the path they were measured on.
+  valid = chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", "203.0.113.7", NULL);
+  assert(!(valid & CHIAKI_CONN_PROFILE_PART_LINK));
+  assert(valid & CHIAKI_CONN_PROFILE_PART_ADDR);
+  // Without an address of its own the caller connects to the recorded one.
+  valid = chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", NULL, NULL);
+  assert(valid & CHIAKI_CONN_PROFILE_PART_LINK);
+
+  // ...and only for a while.
+  now += 10 * MINUTE_MS;
+  valid = chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", "192.168.1.20", NULL);
+  assert(!(valid & CHIAKI_CONN_PROFILE_PART_LINK));
+  assert(valid & CHIAKI_CONN_PROFILE_PART_TARGET);
+
+  // A hot reconnect that skipped Senkusha records no link, the measurement stays old.
+  ChiakiConnProfile again;
+  good_profile(&again, "aabbccddeeff");
+  again.parts &= ~CHIAKI_CONN_PROFILE_PART_LINK;
+  assert(chiaki_conn_profile_store_record(store, &again) == CHIAKI_ERR_SUCCESS);
+  valid = chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", "192.168.1.20", NULL);
+  assert(!(valid & CHIAKI_CONN_PROFILE_PART_LINK));
+
+  // Measured again, then the console moved: the old measurement goes with the old address.
+  assert(chiaki_conn_profile_store_record(store, &profile) == CHIAKI_ERR_SUCCESS);
+  strcpy(again.addr, "192.168.1.30");
+  assert(chiaki_conn_profile_store_record(store, &again) == CHIAKI_ERR_SUCCESS);
+  valid = chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", NULL, NULL);
+  assert(!(valid & CHIAKI_CONN_PROFILE_PART_LINK));
+  ChiakiConnProfile hot;
+  chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", NULL, &hot);
+  assert(!strcmp(hot.addr, "192.168.1.30"));
+
+  // Not recorded again for max_age_ms: dropped.
+  now += 7 * 24 * 60 * MINUTE_MS;
+  assert(chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", NULL, NULL) == 0);
+  ChiakiConnProfileStoreStats stats;
+  chiaki_conn_profile_store_stats(store, &stats);
+  assert(stats.expired == 1);
+  assert(chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", NULL, NULL) == 0);
+  chiaki_conn_profile_store_stats(store, &stats);
+  assert(stats.misses == 1);
+  chiaki_conn_profile_store_free(store);
+}
+
+static void test_mismatch(void) {
+  uint64_t now = 1000;
+  ChiakiConnProfileStore *store = new_store(&now);
+  ChiakiConnProfile profile;
+  good_profile(&profile, "aabbccddeeff");
+  assert(chiaki_conn_profile_store_record(store, &profile) == CHIAKI_ERR_SUCCESS);
+
+  // The hot connect failed: what it relied on is dropped, the rest stays.
+  chiaki_conn_profile_store_mismatch(store, "aabbccddeeff",
+                                     CHIAKI_CONN_PROFILE_PART_LINK | CHIAKI_CONN_PROFILE_PART_TARGET);
+  uint32_t valid = chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", "192.168.1.20", NULL);
+  assert(valid == (CHIAKI_CONN_PROFILE_PART_ADDR | CHIAKI_CONN_PROFILE_PART_VIDEO));
+
+  // Failing twice in a row, the profile is ignored...
+  chiaki_conn_profile_store_mismatch(store, "aabbccddeeff", CHIAKI_CONN_PROFILE_PART_VIDEO);
+  assert(chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", "192.168.1.20", NULL) == 0);
+  ChiakiConnProfileStoreStats stats;
+  chiaki_conn_profile_store_stats(store, &stats);
+  assert(stats.ignored == 1 && stats.mismatches == 2);
+
+  // ...until a full connect records it again.
+  assert(chiaki_conn_profile_store_record(store, &profile) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", "192.168.1.20", NULL) == profile.parts);
+
+  chiaki_conn_profile_store_forget(store, "aabbccddeeff");
+  assert(chiaki_conn_profile_store_lookup(store, "aabbccddeeff", NULL, NULL, NULL) == 0);
+  chiaki_conn_profile_store_free(store);
+}
+
+static void test_history(void) {
+  uint64_t now = 1000;
+  ChiakiConnProfileStore *store = new_store(&now);
+  assert(chiaki_conn_profile_store_observe(store, "", 0.01, 8000) == CHIAKI_ERR_INVALID_DATA);
+
+  // Observed before anything else was recorded: the profile is created for it.
+  assert(chiaki_conn_profile_store_observe(store, "aabbccddeeff", 0.04, 8000) == CHIAKI_ERR_SUCCESS);
+  ChiakiConnProfile hot;
+  assert(chiaki_conn_profile_store_lookup(store, "aabbccddeeff", NULL, NULL, &hot) == CHIAKI_CONN_PROFILE_PART_HISTORY);
+  assert(hot.history.sessions == 1 && hot.history.throughput_kbps == 8000);
+
+  // A record without history keeps it, the next observation is merged.
+  ChiakiConnProfile profile;
+  good_profile(&profile, "aabbccddeeff");
+  assert(chiaki_conn_profile_store_record(store, &profile) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_conn_profile_store_observe(store, "aabbccddeeff", 0.0, 12000) == CHIAKI_ERR_SUCCESS);
+  uint32_t valid = chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", "192.168.1.20", &hot);
+  assert(valid == (profile.parts | CHIAKI_CONN_PROFILE_PART_HISTORY));
+  assert(hot.history.sessions == 2 && hot.history.throughput_kbps == 10000);
+  assert(hot.history.loss > 0.0199 && hot.history.loss < 0.0201);
+
+  ChiakiConnectInfo info;
+  memset(&info, 0, sizeof(info));
+  video_profile(&info.video_profile, 1080, 60, 15000);
+  uint32_t applied = chiaki_conn_profile_apply(&hot, &info);
+  assert(applied & CHIAKI_CONN_PROFILE_PART_HISTORY);
+  assert(info.link_history.sessions == 2 && info.link_history.throughput_kbps == 10000);
+
+  // A failed hot connect says nothing about the history.
+  chiaki_conn_profile_store_mismatch(store, "aabbccddeeff", applied);
+  valid = chiaki_conn_profile_store_lookup(store, "aabbccddeeff", "09000000", "192.168.1.20", NULL);
+  assert(valid == (CHIAKI_CONN_PROFILE_PART_ADDR | CHIAKI_CONN_PROFILE_PART_HISTORY));
+  chiaki_conn_profile_store_free(store);
+}
+
+static void test_eviction(void) {
+  uint64_t now = 1000;
+  ChiakiConnProfileStore *store = new_store(&now);
+  ChiakiConnProfile profile;
+  good_profile(&profile, "console-a");
+  assert(chiaki_conn_profile_store_record(store, &profile) == CHIAKI_ERR_SUCCESS);
+  good_profile(&profile, "console-b");
+  assert(chiaki_conn_profile_store_record(store, &profile) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_conn_profile_store_lookup(store, "console-a", NULL, NULL, NULL));
+  // The third console pushes out the least recently used one, b.
+  good_profile(&profile, "console-c");
+  assert(chiaki_conn_profile_store_record(store, &profile) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_conn_profile_store_lookup(store, "console-a", NULL, NULL, NULL));
+  assert(chiaki_conn_profile_store_lookup(store, "console-b", NULL, NULL, NULL) == 0);
+  assert(chiaki_conn_profile_store_lookup(store, "console-c", NULL, NULL, NULL));
+
+  ChiakiConnProfileStoreStats stats;
+  chiaki_conn_profile_store_stats(store, &stats);
+  assert(stats.evictions == 1 && stats.records == 3);
+  chiaki_conn_profile_store_free(store);
+}
+
+void run_connprofile_tests(void) {
+  test_record_and_apply();
+  test_validity();
+  test_mismatch();
+  test_history();
+  test_eviction();
+}
@@ -0,0 +1,206 @@
+/*
+ * costacct_tests.c — Unit tests for the cost accounting
+ * (lib/src/costacct.c).
+ *
+ * Covers the allocation histogram buckets, calls on unbound threads doing
+ * nothing, scopes and allocations being charged to the innermost scope or the
+ * home of the thread, a thread entering again for the same home adding to its
+ * slot, and threads beyond CHIAKI_COST_THREADS_MAX being dropped.
+ * test/bench/costacct_bench.c checks the times against getrusage().
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chiaki/costacct.h>
+#include <chiaki/thread.h>
+
+static ChiakiCostAcct *acct_new(ChiakiCostMode mode) {
+  ChiakiCostConfig config;
+  chiaki_cost_config_defaults(&config);
+  assert(config.mode == CHIAKI_COST_MODE_SAMPLED);
+  assert(config.sample_every == CHIAKI_COST_SAMPLE_EVERY_DEFAULT);
+  config.mode = mode;
+  ChiakiCostAcct *acct = chiaki_cost_acct_new(&config);
+  assert(acct);
+  return acct;
+}
+
+static void test_hist_bucket(void) {
+  assert(chiaki_cost_hist_bucket(0) == 0);
+  assert(chiaki_cost_hist_bucket(16) == 0);
+  assert(chiaki_cost_hist_bucket(17) == 1);
+  assert(chiaki_cost_hist_bucket(32) == 1);
+  assert(chiaki_cost_hist_bucket(1500) == 7);
+  assert(chiaki_cost_hist_bucket((size_t)16 << 14) == 14);
+  assert(chiaki_cost_hist_bucket(((size_t)16 << 14) + 1) == CHIAKI_COST_HIST_BUCKETS - 1);
+  assert(chiaki_cost_hist_bucket(SIZE_MAX) == CHIAKI_COST_HIST_BUCKETS - 1);
+  assert(strcmp(chiaki_cost_subsys_string(CHIAKI_COST_SEND_BUFFER), "send_buffer") == 0);
+}
+
+static void test_unbound(void) {
+  ChiakiCostAcct *acct = acct_new(CHIAKI_COST_MODE_DETAILED);
+  assert(!chiaki_cost_current());
+  chiaki_cost_thread_enter(NULL, CHIAKI_COST_OTHER, "none");
+  assert(!chiaki_cost_current());
+  CHIAKI_COST_SCOPE(CHIAKI_COST_FEC)
+    free(chiaki_cost_malloc(32));
+  chiaki_cost_scope_end(); // unbalanced, ignored
+  chiaki_cost_thread_leave();
+
+  ChiakiCostSnapshot snap;
+  chiaki_cost_acct_snapshot(acct, &snap);
+  assert(snap.threads_count == 0);
+  for (size_t s = 0; s < CHIAKI_COST_SUBSYS_COUNT; s++)
+    assert(!snap.subsys[s].scopes && !snap.subsys[s].allocs);
+  chiaki_cost_acct_free(acct);
+}
+
+static void test_scopes_and_allocs(void) {
+  ChiakiCostAcct *acct = acct_new(CHIAKI_COST_MODE_DETAILED);
+  chiaki_cost_thread_enter(acct, CHIAKI_COST_TAKION, "Cost test");
+  assert(chiaki_cost_current() == acct);
+
+  void *home = chiaki_cost_malloc(100);
+  CHIAKI_COST_SCOPE(CHIAKI_COST_FEC) {
+    void *fec = chiaki_cost_calloc(4, 8);
+    CHIAKI_COST_SCOPE(CHIAKI_COST_BITSTREAM) {
+      void *bs = chiaki_cost_realloc(NULL, 2000);
+      chiaki_cost_free(bs);
+    }
+    chiaki_cost_free(fec);
+  }
+  // deeper than CHIAKI_COST_DEPTH_MAX is charged to the innermost tracked scope
+  for (int i = 0; i < CHIAKI_COST_DEPTH_MAX + 2; i++)
+    chiaki_cost_scope_begin(i ? CHIAKI_COST_GKCRYPT : CHIAKI_COST_FEC);
+  chiaki_cost_free(chiaki_cost_malloc(1));
+  for (int i = 0; i < CHIAKI_COST_DEPTH_MAX + 2; i++)
+    chiaki_cost_scope_end();
+  chiaki_cost_free(home);
+  chiaki_cost_free(NULL);
+
+  ChiakiCostSnapshot snap;
+  chiaki_cost_acct_snapshot(acct, &snap);
+  assert(snap.mode == CHIAKI_COST_MODE_DETAILED);
+  assert(snap.threads_count == 1 && snap.threads[0].bound);
+  assert(strcmp(snap.threads[0].name, "Cost test") == 0);
+  assert(snap.threads[0].home == CHIAKI_COST_TAKION);
+
+  const ChiakiCostSubsysStats *takion = &snap.subsys[CHIAKI_COST_TAKION];
+  const ChiakiCostSubsysStats *fec = &snap.subsys[CHIAKI_COST_FEC];
+  const ChiakiCostSubsysStats *bs = &snap.subsys[CHIAKI_COST_BITSTREAM];
+  const ChiakiCostSubsysStats *gk = &snap.subsys[CHIAKI_COST_GKCRYPT];
+  assert(takion->scopes == 0 && takion->allocs == 1 && takion->alloc_bytes == 100 && takion->frees == 1);
+  assert(takion->alloc_hist[chiaki_cost_hist_bucket(100)] == 1);
+  assert(fec->scopes == 2 && fec->scopes_timed == 2);
+  assert(fec->allocs == 1 && fec->alloc_bytes == 32 && fec->frees == 1);
+  assert(bs->scopes == 1 && bs->allocs == 1 && bs->alloc_bytes == 2000 && bs->frees == 1);
+  assert(bs->alloc_hist[chiaki_cost_hist_bucket(2000)] == 1);
+  assert(gk->scopes == CHIAKI_COST_DEPTH_MAX - 1 && gk->allocs == 1 && gk->frees == 1);
+
+  // leaving keeps the stats, entering again for the same home adds to them
+  chiaki_cost_thread_leave();
+  assert(!chiaki_cost_current());
+  chiaki_cost_thread_enter(acct, CHIAKI_COST_TAKION, "Cost test");
+  CHIAKI_COST_SCOPE(CHIAKI_COST_FEC) {}
+  chiaki_cost_thread_enter(acct, CHIAKI_COST_OTHER, "Cost other"); // leaves the first binding
+  chiaki_cost_thread_leave();
+  chiaki_cost_acct_snapshot(acct, &snap);
+  assert(snap.threads_count == 2);
+  assert(!snap.threads[0].bound && !snap.threads[1].bound);
+  assert(snap.subsys[CHIAKI_COST_FEC].scopes == 3);
+  chiaki_cost_acct_free(acct);
+}
+
+static void test_sampled(void) {
+  ChiakiCostAcct *acct = acct_new(CHIAKI_COST_MODE_SAMPLED);
+  chiaki_cost_thread_enter(acct, CHIAKI_COST_OTHER, "Cost sampled");
+  for (int i = 0; i < CHIAKI_COST_SAMPLE_EVERY_DEFAULT * 4; i++) {
+    CHIAKI_COST_SCOPE(CHIAKI_COST_FEC) {
+      // nested scopes are timed along with their outermost one
+      CHIAKI_COST_SCOPE(CHIAKI_COST_BITSTREAM)
+        chiaki_cost_free(chiaki_cost_malloc(64));
+    }
+  }
+  chiaki_cost_thread_leave();
+
+  ChiakiCostSnapshot snap;
+  chiaki_cost_acct_snapshot(acct, &snap);
+  assert(snap.mode == CHIAKI_COST_MODE_SAMPLED);
+  assert(snap.subsys[CHIAKI_COST_FEC].scopes == CHIAKI_COST_SAMPLE_EVERY_DEFAULT * 4);
+  assert(snap.subsys[CHIAKI_COST_FEC].scopes_timed == 4);
+  assert(snap.subsys[CHIAKI_COST_BITSTREAM].scopes_timed == 4);
+  assert(snap.subsys[CHIAKI_COST_BITSTREAM].allocs == CHIAKI_COST_SAMPLE_EVERY_DEFAULT * 4);
+  for (size_t b = 0; b < CHIAKI_COST_HIST_BUCKETS; b++)
+    assert(!snap.subsys[CHIAKI_COST_BITSTREAM].alloc_hist[b]);
+  chiaki_cost_acct_free(acct);
+}
+
+typedef struct {
+  ChiakiCostAcct *acct;
+  ChiakiMutex *mutex;
+  ChiakiCond *cond;
+  int *entered;
+  bool *release;
+} Binder;
+
+static void *binder_func(void *user) {
+  Binder *b = user;
+  chiaki_cost_thread_enter(b->acct, CHIAKI_COST_FEEDBACK, "Cost binder");
+  chiaki_mutex_lock(b->mutex);
+  (*b->entered)++;
+  chiaki_cond_broadcast(b->cond);
+  while (!*b->release)
+    chiaki_cond_wait(b->cond, b->mutex);
+  chiaki_mutex_unlock(b->mutex);
+  chiaki_cost_thread_leave();
+  return NULL;
+}
+
+static void test_threads_max(void) {
+  enum { BINDERS = CHIAKI_COST_THREADS_MAX + 3 };
+  ChiakiCostAcct *acct = acct_new(CHIAKI_COST_MODE_SAMPLED);
+  ChiakiMutex mutex;
+  ChiakiCond cond;
+  chiaki_mutex_init(&mutex, false);
+  chiaki_cond_init(&cond, &mutex);
+  int entered = 0;
+  bool release = false;
+  Binder binders[BINDERS];
+  ChiakiThread threads[BINDERS];
+  for (int i = 0; i < BINDERS; i++) {
+    binders[i] = (Binder){acct, &mutex, &cond, &entered, &release};
+    ChiakiErrorCode err = chiaki_thread_create(&threads[i], binder_func, &binders[i]);
+    assert(err == CHIAKI_ERR_SUCCESS);
+  }
+  // all bound at once, so none can take over the slot of another
+  chiaki_mutex_lock(&mutex);
+  while (entered < BINDERS)
+    chiaki_cond_wait(&cond, &mutex);
+  ChiakiCostSnapshot snap;
+  chiaki_cost_acct_snapshot(acct, &snap);
+  release = true;
+  chiaki_cond_broadcast(&cond);
+  chiaki_mutex_unlock(&mutex);
+  for (int i = 0; i < BINDERS; i++)
+    chiaki_thread_join(&threads[i], NULL);
+
+  assert(snap.threads_count == CHIAKI_COST_THREADS_MAX);
+  assert(snap.threads_dropped == BINDERS - CHIAKI_COST_THREADS_MAX);
+  for (size_t i = 0; i < snap.threads_count; i++)
+    assert(snap.threads[i].bound && snap.threads[i].home == CHIAKI_COST_FEEDBACK);
+  chiaki_cond_fini(&cond);
+  chiaki_mutex_fini(&mutex);
+  chiaki_cost_acct_free(acct);
+}
+
+void run_costacct_tests(void) {
+  test_hist_bucket();
+  test_unbound();
+  test_scopes_and_allocs();
+  test_sampled();
+  test_threads_max();
+}
@@ -0,0 +1,202 @@
+/*
+ * decodegov_tests.c — Unit tests for the decode-pressure governor
+ * (lib/src/decodegov.c) and the non-reference flag it sheds by
+ * (lib/src/bitstream.c).
+ *
+ * Covers a decoder with headroom never shedding, shedding limited to
+ * non-reference frames and to shed_run_max in a row, shedding that relieves
+ * the decoder not escalating, pressure without relief escalating once per
+ * holdoff, a backlog spike, and the bitrate an escalation suggests.
+ * test/bench/decodegov_bench.c measures latency and continuity on a modeled
+ * decoder.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <chiaki/bitstream.h>
+#include <chiaki/decodegov.h>
+
+#define FRAME_US 16666
+
+static ChiakiDecodeGovernor governor_defaults(void) {
+  ChiakiDecodeGovernorConfig config;
+  chiaki_decode_governor_config_defaults(&config);
+  ChiakiDecodeGovernor governor;
+  assert(chiaki_decode_governor_init(&governor, &config) == CHIAKI_ERR_SUCCESS);
+  return governor;
+}
+
+/* Runs frames every FRAME_US from *now_us. Frame i is non-reference if
+ * non_reference_every divides i + 1, 0 for none. Returns the frames shed. */
+static uint64_t run(ChiakiDecodeGovernor *governor, uint64_t *now_us, int frames,
+                    uint64_t decode_us, int non_reference_every) {
+  uint64_t shed = 0;
+  for (int i = 0; i < frames; i++) {
+    bool non_reference = non_reference_every && (i + 1) % non_reference_every == 0;
+    if (chiaki_decode_governor_frame(governor, non_reference, *now_us))
+      shed++;
+    else
+      chiaki_decode_governor_decoded(governor, decode_us, *now_us);
+    *now_us += FRAME_US;
+  }
+  return shed;
+}
+
+static void test_init(void) {
+  ChiakiDecodeGovernorConfig config;
+  chiaki_decode_governor_config_defaults(&config);
+  config.fps = 0;
+  ChiakiDecodeGovernor governor;
+  assert(chiaki_decode_governor_init(&governor, &config) == CHIAKI_ERR_INVALID_DATA);
+  governor = governor_defaults();
+  assert(governor.frame_interval_us == FRAME_US);
+  assert(governor.pressure == CHIAKI_DECODE_PRESSURE_NONE);
+  assert(strcmp(chiaki_decode_pressure_string(CHIAKI_DECODE_PRESSURE_SHED), "shed") == 0);
+}
+
+static void test_headroom_never_sheds(void) {
+  ChiakiDecodeGovernor governor = governor_defaults();
+  uint64_t now_us = 0;
+  assert(run(&governor, &now_us, 600, 12000, 2) == 0);
+  assert(governor.pressure == CHIAKI_DECODE_PRESSURE_NONE);
+  assert(governor.backlog_us == 0 && governor.pressure_episodes == 0);
+  assert(!chiaki_decode_governor_take_escalation(&governor));
+}
+
+static void test_sheds_only_non_reference(void) {
+  ChiakiDecodeGovernor governor = governor_defaults();
+  uint64_t now_us = 0;
+  // Every frame droppable, the decoder over budget: every other frame is shed.
+  uint64_t shed = run(&governor, &now_us, 120, 20000, 1);
+  assert(governor.pressure != CHIAKI_DECODE_PRESSURE_NONE);
+  assert(shed > 50 && shed <= 60);
+  assert(governor.shed_run <= governor.config.shed_run_max);
+
+  // Only reference frames: nothing can be shed, all are missed.
+  governor = governor_defaults();
+  now_us = 0;
+  assert(run(&governor, &now_us, 120, 20000, 0) == 0);
+  assert(governor.pressure != CHIAKI_DECODE_PRESSURE_NONE);
+  assert(governor.shed_missed > 100);
+
+  // Longer runs when allowed.
+  ChiakiDecodeGovernorConfig config;
+  chiaki_decode_governor_config_defaults(&config);
+  config.shed_run_max = 3;
+  assert(chiaki_decode_governor_init(&governor, &config) == CHIAKI_ERR_SUCCESS);
+  now_us = 0;
+  run(&governor, &now_us, 30, 40000, 0);
+  for (int i = 0; i < 3; i++)
+    assert(chiaki_decode_governor_frame(&governor, true, now_us));
+  assert(!chiaki_decode_governor_frame(&governor, true, now_us));
+}
+
+static void test_relieved_does_not_escalate(void) {
+  ChiakiDecodeGovernor governor = governor_defaults();
+  uint64_t now_us = 0;
+  // 20 ms per decoded frame, every other frame droppable: 10 ms per frame.
+  uint64_t shed = run(&governor, &now_us, 600, 20000, 2);
+  assert(shed > 250);
+  assert(governor.pressure == CHIAKI_DECODE_PRESSURE_SHED);
+  assert(governor.escalations == 0 && !chiaki_decode_governor_take_escalation(&governor));
+  assert(governor.backlog_us < FRAME_US);
+
+  // The decoder recovers: pressure ends, nothing is shed anymore.
+  run(&governor, &now_us, 60, 8000, 2);
+  assert(governor.pressure == CHIAKI_DECODE_PRESSURE_NONE);
+  assert(run(&governor, &now_us, 60, 8000, 2) == 0);
+}
+
+static void test_unrelieved_escalates(void) {
+  ChiakiDecodeGovernor governor = governor_defaults();
+  uint64_t now_us = 0;
+  // 20 ms per frame, one in ten droppable: 18 ms per frame, not enough.
+  run(&governor, &now_us, 60, 20000, 10);
+  assert(governor.escalations == 0);
+  run(&governor, &now_us, 120, 20000, 10);
+  assert(governor.escalations == 1);
+  assert(governor.pressure == CHIAKI_DECODE_PRESSURE_ESCALATE);
+  assert(chiaki_decode_governor_take_escalation(&governor));
+  assert(!chiaki_decode_governor_take_escalation(&governor));
+
+  // Held off for escalate_holdoff_us, then again.
+  run(&governor, &now_us, 60 * 8, 20000, 10);
+  assert(governor.escalations == 1);
+  run(&governor, &now_us, 60 * 4, 20000, 10);
+  assert(governor.escalations == 2);
+
+  // A reset forgets the pressure, not the counters.
+  chiaki_decode_governor_reset(&governor);
+  assert(governor.pressure == CHIAKI_DECODE_PRESSURE_NONE && !governor.escalation_pending);
+  assert(governor.escalations == 2);
+}
+
+static void test_backlog_spike(void) {
+  ChiakiDecodeGovernor governor = governor_defaults();
+  uint64_t now_us = 0;
+  run(&governor, &now_us, 60, 10000, 2);
+  // One slow frame leaves the average within budget, but the decoder behind.
+  chiaki_decode_governor_frame(&governor, false, now_us);
+  chiaki_decode_governor_decoded(&governor, 45000, now_us);
+  assert(chiaki_decode_governor_load(&governor) < governor.config.shed_load);
+  assert(governor.backlog_us > 25000 && governor.backlog_max_us == governor.backlog_us);
+  assert(governor.pressure == CHIAKI_DECODE_PRESSURE_SHED);
+  now_us += FRAME_US;
+  assert(chiaki_decode_governor_frame(&governor, true, now_us));
+  assert(governor.backlog_us < 25000);
+}
+
+static void test_target_kbps(void) {
+  ChiakiDecodeGovernor governor = governor_defaults();
+  assert(chiaki_decode_governor_target_kbps(&governor, 10000) == 7500);
+  assert(chiaki_decode_governor_target_kbps(&governor, 1200) == 1000);
+  assert(chiaki_decode_governor_target_kbps(&governor, 800) == 800);
+}
+
+static void test_bitstream_non_reference(void) {
+  ChiakiBitstream bitstream;
+  chiaki_bitstream_init(&bitstream, NULL, CHIAKI_CODEC_H264);
+  bitstream.h264.sps.log2_max_frame_num_minus4 = 0;
+  /* P slice: first_mb_in_slice 0, slice_type 5, pps 0, frame_num 0,
+   * no num_ref_idx override, no ref_pic_list_modification. */
+  uint8_t slice[] = {0x00, 0x00, 0x00, 0x01, 0x21, 0x9a, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00};
+  ChiakiBitstreamSlice parsed;
+  assert(chiaki_bitstream_slice(&bitstream, slice, sizeof(slice), &parsed));
+  assert(parsed.slice_type == CHIAKI_BITSTREAM_SLICE_P && !parsed.non_reference);
+  slice[4] = 0x01;  // nal_ref_idc 0
+  assert(chiaki_bitstream_slice(&bitstream, slice, sizeof(slice), &parsed));
+  assert(parsed.slice_type == CHIAKI_BITSTREAM_SLICE_P && parsed.non_reference);
+
+  /* H.265 TRAIL_N (0) and TRAIL_R (1): first slice segment, pps 0, P slice,
+   * poc lsb 0 in 4 bits, short-term RPS from the SPS. */
+  chiaki_bitstream_init(&bitstream, NULL, CHIAKI_CODEC_H265);
+  bitstream.h265.sps.log2_max_pic_order_cnt_lsb_minus4 = 0;
+  bitstream.h265.sps.max_sub_layers_minus1 = 0;
+  uint8_t slice_h265[] = {0x00, 0x00, 0x00, 0x01, 0x00, 0x01, 0xd0, 0x60, 0x00, 0x00, 0x00, 0x00};
+  assert(chiaki_bitstream_slice(&bitstream, slice_h265, sizeof(slice_h265), &parsed));
+  assert(parsed.slice_type == CHIAKI_BITSTREAM_SLICE_P && parsed.non_reference);
+  // with two sub-layers, only a TRAIL_N of the higher one is left alone
+  bitstream.h265.sps.max_sub_layers_minus1 = 1;
+  assert(chiaki_bitstream_slice(&bitstream, slice_h265, sizeof(slice_h265), &parsed));
+  assert(parsed.slice_type == CHIAKI_BITSTREAM_SLICE_P && !parsed.non_reference);
+  slice_h265[5] = 0x02;  // nuh_temporal_id_plus1 2
+  assert(chiaki_bitstream_slice(&bitstream, slice_h265, sizeof(slice_h265), &parsed));
+  assert(parsed.slice_type == CHIAKI_BITSTREAM_SLICE_P && parsed.non_reference);
+  slice_h265[4] = 0x02;  // TRAIL_R
+  assert(chiaki_bitstream_slice(&bitstream, slice_h265, sizeof(slice_h265), &parsed));
+  assert(parsed.slice_type == CHIAKI_BITSTREAM_SLICE_P && !parsed.non_reference);
+}
+
+void run_decodegov_tests(void) {
+  test_init();
+  test_headroom_never_sheds();
+  test_sheds_only_non_reference();
+  test_relieved_does_not_escalate();
+  test_unrelieved_escalates();
+  test_backlog_spike();
+  test_target_kbps();
+  test_bitstream_non_reference();
+}
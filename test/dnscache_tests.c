@@ -0,0 +1,502 @@
+/*
+ * dnscache_tests.c — Unit tests for ChiakiDnsCache (lib/src/dnscache.c).
+ *
+ * A fake backend answers from a small zone table and the cache runs on a
+ * fake clock, so TTL expiry, negative caching and stale fallback are stepped
+ * through without sleeping. Queries can be held at a gate to check that
+ * A/AAAA run in parallel and that concurrent lookups share one query.
+ * test/standin/dns_bench.c repeats the TTL, fallback and concurrency checks
+ * against a real DNS server on loopback.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <chiaki/dnscache.h>
+#include <chiaki/thread.h>
+
+#define FAKE_RECORDS_MAX 8
+#define WAIT_MS 2000
+
+static void sleep_ms(uint32_t ms) {
+#ifdef _WIN32
+  Sleep(ms);
+#else
+  struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+#endif
+}
+
+typedef struct {
+  const char *host;
+  const char *v4; /* NULL: no A record */
+  const char *v6; /* NULL: no AAAA record */
+  uint32_t ttl_sec;
+} FakeRecord;
+
+typedef struct {
+  ChiakiMutex mutex;
+  ChiakiCond cond;
+  FakeRecord records[FAKE_RECORDS_MAX];
+  size_t records_count;
+  ChiakiErrorCode fail; /* returned for every query when set */
+  bool gate_closed;     /* queries block until the gate opens */
+  int queries_v4;
+  int queries_v6;
+  int in_flight;
+  int max_in_flight;
+  uint64_t now_ms;
+} FakeDns;
+
+static bool parse_addr(const char *text, ChiakiDnsFamily family, ChiakiDnsAddr *out) {
+  /* a.b.c.d for IPv4, the last byte only for IPv6 ("::n") */
+  memset(out, 0, sizeof(*out));
+  out->family = family;
+  if (family == CHIAKI_DNS_FAMILY_IPV6) {
+    out->addr[0] = 0x20;
+    out->addr[1] = 0x01;
+    out->addr[2] = 0x0d;
+    out->addr[3] = 0xb8;
+    out->addr[15] = (uint8_t)strtoul(text + 2, NULL, 10);
+    return true;
+  }
+  const char *p = text;
+  for (int i = 0; i < 4; i++) {
+    char *end;
+    out->addr[i] = (uint8_t)strtoul(p, &end, 10);
+    p = end + 1;
+  }
+  return true;
+}
+
+static ChiakiErrorCode fake_resolve(void *user, const char *host, ChiakiDnsFamily family, ChiakiDnsAddr *addrs,
+                                    size_t *count, uint32_t *ttl_sec) {
+  FakeDns *dns = user;
+  chiaki_mutex_lock(&dns->mutex);
+  if (family == CHIAKI_DNS_FAMILY_IPV4)
+    dns->queries_v4++;
+  else
+    dns->queries_v6++;
+  dns->in_flight++;
+  if (dns->in_flight > dns->max_in_flight)
+    dns->max_in_flight = dns->in_flight;
+  chiaki_cond_broadcast(&dns->cond);
+  while (dns->gate_closed)
+    chiaki_cond_wait(&dns->cond, &dns->mutex);
+
+  ChiakiErrorCode err = dns->fail;
+  size_t n = 0;
+  if (err == CHIAKI_ERR_SUCCESS) {
+    for (size_t i = 0; i < dns->records_count; i++) {
+      const FakeRecord *r = &dns->records[i];
+      if (strcmp(r->host, host))
+        continue;
+      const char *text = family == CHIAKI_DNS_FAMILY_IPV4 ? r->v4 : r->v6;
+      if (text && n < *count)
+        parse_addr(text, family, &addrs[n++]);
+      *ttl_sec = r->ttl_sec;
+    }
+  }
+  *count = n;
+  dns->in_flight--;
+  chiaki_cond_broadcast(&dns->cond);
+  chiaki_mutex_unlock(&dns->mutex);
+  return err;
+}
+
+static uint64_t fake_now(void *user) {
+  FakeDns *dns = user;
+  chiaki_mutex_lock(&dns->mutex);
+  uint64_t now = dns->now_ms;
+  chiaki_mutex_unlock(&dns->mutex);
+  return now;
+}
+
+static void fake_init(FakeDns *dns) {
+  memset(dns, 0, sizeof(*dns));
+  assert(chiaki_mutex_init(&dns->mutex, false) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_cond_init(&dns->cond, &dns->mutex) == CHIAKI_ERR_SUCCESS);
+  dns->now_ms = 1000000;
+  dns->records[dns->records_count++] = (FakeRecord){"web.np.playstation.com", "203.0.113.10", "::10", 300};
+  dns->records[dns->records_count++] = (FakeRecord){"stun.l.google.com", "203.0.113.20", NULL, 1};
+  dns->records[dns->records_count++] = (FakeRecord){"asm.np.community.playstation.net", "203.0.113.30", NULL, 60};
+}
+
+static void fake_fini(FakeDns *dns) {
+  chiaki_cond_fini(&dns->cond);
+  chiaki_mutex_fini(&dns->mutex);
+}
+
+static void fake_advance(FakeDns *dns, uint64_t ms) {
+  chiaki_mutex_lock(&dns->mutex);
+  dns->now_ms += ms;
+  chiaki_mutex_unlock(&dns->mutex);
+}
+
+static void fake_set_gate(FakeDns *dns, bool closed) {
+  chiaki_mutex_lock(&dns->mutex);
+  dns->gate_closed = closed;
+  chiaki_cond_broadcast(&dns->cond);
+  chiaki_mutex_unlock(&dns->mutex);
+}
+
+static void fake_set_fail(FakeDns *dns, ChiakiErrorCode fail) {
+  chiaki_mutex_lock(&dns->mutex);
+  dns->fail = fail;
+  chiaki_mutex_unlock(&dns->mutex);
+}
+
+/* Wait until n queries are held at the gate. */
+static void fake_wait_in_flight(FakeDns *dns, int n) {
+  chiaki_mutex_lock(&dns->mutex);
+  while (dns->in_flight < n)
+    assert(chiaki_cond_timedwait(&dns->cond, &dns->mutex, WAIT_MS) == CHIAKI_ERR_SUCCESS);
+  chiaki_mutex_unlock(&dns->mutex);
+}
+
+/* Wait until the cache has stored the answers of n queries. */
+static void cache_wait_queries(ChiakiDnsCache *cache, uint64_t n) {
+  ChiakiDnsCacheStats stats;
+  for (int i = 0; i < WAIT_MS; i++) {
+    chiaki_dns_cache_stats(cache, &stats);
+    if (stats.queries >= n)
+      return;
+    sleep_ms(1);
+  }
+  assert(!"queries did not complete");
+}
+
+static int fake_queries(FakeDns *dns) {
+  chiaki_mutex_lock(&dns->mutex);
+  int n = dns->queries_v4 + dns->queries_v6;
+  chiaki_mutex_unlock(&dns->mutex);
+  return n;
+}
+
+static ChiakiDnsCache *cache_new(FakeDns *dns, size_t capacity) {
+  ChiakiDnsCacheConfig config;
+  chiaki_dns_cache_config_defaults(&config);
+  config.backend.resolve = fake_resolve;
+  config.backend.user = dns;
+  config.capacity = capacity;
+  config.now_ms = fake_now;
+  config.now_user = dns;
+  ChiakiDnsCache *cache = chiaki_dns_cache_new(&config);
+  assert(cache);
+  return cache;
+}
+
+static ChiakiErrorCode lookup(ChiakiDnsCache *cache, const char *host, uint32_t families, ChiakiDnsAddr *addrs,
+                              size_t *count) {
+  *count = CHIAKI_DNS_ADDRS_MAX;
+  return chiaki_dns_cache_lookup(cache, host, families, addrs, count, WAIT_MS);
+}
+
+static void test_ttl(void) {
+  FakeDns dns;
+  fake_init(&dns);
+  ChiakiDnsCache *cache = cache_new(&dns, 8);
+  ChiakiDnsAddr addrs[CHIAKI_DNS_ADDRS_MAX];
+  size_t count;
+  char text[CHIAKI_DNS_ADDR_STRLEN];
+
+  assert(lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(count == 1);
+  assert(chiaki_dns_addr_format(&addrs[0], text, sizeof(text)) == CHIAKI_ERR_SUCCESS);
+  assert(!strcmp(text, "203.0.113.10"));
+  assert(fake_queries(&dns) == 1);
+
+  // Case and a trailing dot don't make a new name.
+  fake_advance(&dns, 100 * 1000);
+  assert(lookup(cache, "Web.NP.PlayStation.com.", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(fake_queries(&dns) == 1);
+
+  // In the last tenth of the TTL the answer is served and refreshed behind it.
+  fake_advance(&dns, 175 * 1000);
+  assert(lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  cache_wait_queries(cache, 2);
+  assert(fake_queries(&dns) == 2);
+
+  // The refresh restarted the TTL.
+  fake_advance(&dns, 200 * 1000);
+  assert(lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(fake_queries(&dns) == 2);
+
+  // Past it, the lookup waits for a new query.
+  fake_advance(&dns, 101 * 1000);
+  assert(lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(fake_queries(&dns) == 3);
+
+  // A 1 s TTL is raised to min_ttl_sec.
+  assert(lookup(cache, "stun.l.google.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  fake_advance(&dns, 20 * 1000);
+  assert(lookup(cache, "stun.l.google.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(fake_queries(&dns) == 4);
+
+  ChiakiDnsCacheStats stats;
+  chiaki_dns_cache_stats(cache, &stats);
+  assert(stats.lookups == 7);
+  assert(stats.hits == 4);
+  assert(stats.waits == 3);
+  assert(stats.refreshes == 1);
+  assert(stats.queries == 4);
+  chiaki_dns_cache_free(cache);
+  fake_fini(&dns);
+}
+
+static void test_families(void) {
+  FakeDns dns;
+  fake_init(&dns);
+  ChiakiDnsCache *cache = cache_new(&dns, 8);
+  ChiakiDnsAddr addrs[CHIAKI_DNS_ADDRS_MAX];
+  size_t count;
+  char text[CHIAKI_DNS_ADDR_STRLEN];
+
+  assert(lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_ANY, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(count == 2);
+  assert(addrs[0].family == CHIAKI_DNS_FAMILY_IPV4);
+  assert(addrs[1].family == CHIAKI_DNS_FAMILY_IPV6);
+  assert(chiaki_dns_addr_format(&addrs[1], text, sizeof(text)) == CHIAKI_ERR_SUCCESS);
+  assert(!strcmp(text, "2001:db8::a"));
+  assert(dns.queries_v4 == 1 && dns.queries_v6 == 1);
+
+  // The name has no AAAA, which is cached like a missing name.
+  assert(lookup(cache, "asm.np.community.playstation.net", CHIAKI_DNS_FAMILY_ANY, addrs, &count) ==
+         CHIAKI_ERR_SUCCESS);
+  assert(count == 1 && addrs[0].family == CHIAKI_DNS_FAMILY_IPV4);
+  assert(lookup(cache, "asm.np.community.playstation.net", CHIAKI_DNS_FAMILY_IPV6, addrs, &count) ==
+         CHIAKI_ERR_HOST_UNREACH);
+  assert(count == 0);
+  assert(fake_queries(&dns) == 4);
+
+  // Only the buffer's worth of addresses is returned.
+  count = 1;
+  assert(chiaki_dns_cache_lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_ANY, addrs, &count, WAIT_MS) ==
+         CHIAKI_ERR_SUCCESS);
+  assert(count == 1 && addrs[0].family == CHIAKI_DNS_FAMILY_IPV4);
+
+  count = CHIAKI_DNS_ADDRS_MAX;
+  assert(chiaki_dns_cache_lookup(cache, "", CHIAKI_DNS_FAMILY_ANY, addrs, &count, WAIT_MS) ==
+         CHIAKI_ERR_INVALID_DATA);
+  assert(chiaki_dns_cache_lookup(cache, "web.np.playstation.com", 0, addrs, &count, WAIT_MS) ==
+         CHIAKI_ERR_INVALID_DATA);
+  chiaki_dns_cache_free(cache);
+  fake_fini(&dns);
+}
+
+static void test_negative(void) {
+  FakeDns dns;
+  fake_init(&dns);
+  ChiakiDnsCache *cache = cache_new(&dns, 8);
+  ChiakiDnsAddr addrs[CHIAKI_DNS_ADDRS_MAX];
+  size_t count;
+
+  assert(lookup(cache, "nxdomain.example", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_HOST_UNREACH);
+  assert(lookup(cache, "nxdomain.example", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_HOST_UNREACH);
+  assert(fake_queries(&dns) == 1);
+
+  // negative_ttl_sec is 30 s, then the name is asked for again.
+  fake_advance(&dns, 31 * 1000);
+  assert(lookup(cache, "nxdomain.example", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_HOST_UNREACH);
+  assert(fake_queries(&dns) == 2);
+
+  ChiakiDnsCacheStats stats;
+  chiaki_dns_cache_stats(cache, &stats);
+  assert(stats.negative_hits == 1);
+  chiaki_dns_cache_free(cache);
+  fake_fini(&dns);
+}
+
+static void test_stale_fallback(void) {
+  FakeDns dns;
+  fake_init(&dns);
+  ChiakiDnsCache *cache = cache_new(&dns, 8);
+  ChiakiDnsAddr addrs[CHIAKI_DNS_ADDRS_MAX];
+  size_t count;
+
+  assert(lookup(cache, "asm.np.community.playstation.net", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) ==
+         CHIAKI_ERR_SUCCESS);
+
+  // Expired and the resolver is unreachable: the old answer still goes out.
+  fake_set_fail(&dns, CHIAKI_ERR_NETWORK);
+  fake_advance(&dns, 61 * 1000);
+  assert(lookup(cache, "asm.np.community.playstation.net", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) ==
+         CHIAKI_ERR_SUCCESS);
+  assert(count == 1 && addrs[0].addr[3] == 30);
+  assert(fake_queries(&dns) == 2);
+
+  // Right after the failure it is not asked again.
+  assert(lookup(cache, "asm.np.community.playstation.net", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) ==
+         CHIAKI_ERR_SUCCESS);
+  assert(fake_queries(&dns) == 2);
+
+  // Past the stale window there is nothing left to fall back to.
+  fake_advance(&dns, 600 * 1000);
+  assert(lookup(cache, "asm.np.community.playstation.net", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) ==
+         CHIAKI_ERR_NETWORK);
+  assert(count == 0);
+
+  // A name that was never resolved fails with the backend's error.
+  assert(lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_NETWORK);
+
+  // Once the resolver is back the entry recovers.
+  fake_set_fail(&dns, CHIAKI_ERR_SUCCESS);
+  fake_advance(&dns, 6 * 1000);
+  assert(lookup(cache, "asm.np.community.playstation.net", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) ==
+         CHIAKI_ERR_SUCCESS);
+
+  ChiakiDnsCacheStats stats;
+  chiaki_dns_cache_stats(cache, &stats);
+  assert(stats.stale_served == 2);
+  assert(stats.failures == 3);
+  chiaki_dns_cache_free(cache);
+  fake_fini(&dns);
+}
+
+static void test_timeout(void) {
+  FakeDns dns;
+  fake_init(&dns);
+  ChiakiDnsCache *cache = cache_new(&dns, 8);
+  ChiakiDnsAddr addrs[CHIAKI_DNS_ADDRS_MAX];
+  size_t count = CHIAKI_DNS_ADDRS_MAX;
+
+  fake_set_gate(&dns, true);
+  assert(chiaki_dns_cache_lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count, 20) ==
+         CHIAKI_ERR_TIMEOUT);
+  assert(count == 0);
+  fake_set_gate(&dns, false);
+
+  // The late answer is cached and the next lookup doesn't query again.
+  cache_wait_queries(cache, 1);
+  assert(lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(fake_queries(&dns) == 1);
+  chiaki_dns_cache_free(cache);
+  fake_fini(&dns);
+}
+
+typedef struct {
+  ChiakiDnsCache *cache;
+  ChiakiErrorCode err;
+  size_t count;
+} LookupThread;
+
+static void *lookup_thread_func(void *user) {
+  LookupThread *t = user;
+  ChiakiDnsAddr addrs[CHIAKI_DNS_ADDRS_MAX];
+  t->err = lookup(t->cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_ANY, addrs, &t->count);
+  return NULL;
+}
+
+static void test_concurrent_lookups(void) {
+  FakeDns dns;
+  fake_init(&dns);
+  ChiakiDnsCache *cache = cache_new(&dns, 8);
+
+  fake_set_gate(&dns, true);
+  ChiakiThread threads[4];
+  LookupThread args[4];
+  for (size_t i = 0; i < 4; i++) {
+    args[i] = (LookupThread){cache, CHIAKI_ERR_UNKNOWN, 0};
+    assert(chiaki_thread_create(&threads[i], lookup_thread_func, &args[i]) == CHIAKI_ERR_SUCCESS);
+  }
+
+  // A and AAAA are both held at the gate at the same time.
+  fake_wait_in_flight(&dns, 2);
+  ChiakiDnsCacheStats stats;
+  for (int i = 0; i < 1000; i++) {
+    chiaki_dns_cache_stats(cache, &stats);
+    if (stats.waits == 4)
+      break;
+    sleep_ms(1);
+  }
+  fake_set_gate(&dns, false);
+  for (size_t i = 0; i < 4; i++) {
+    assert(chiaki_thread_join(&threads[i], NULL) == CHIAKI_ERR_SUCCESS);
+    assert(args[i].err == CHIAKI_ERR_SUCCESS);
+    assert(args[i].count == 2);
+  }
+
+  assert(dns.max_in_flight == 2);
+  assert(dns.queries_v4 == 1 && dns.queries_v6 == 1);
+  chiaki_dns_cache_stats(cache, &stats);
+  assert(stats.waits == 4);
+  assert(stats.coalesced == 3);
+  chiaki_dns_cache_free(cache);
+  fake_fini(&dns);
+}
+
+static void test_prefetch(void) {
+  FakeDns dns;
+  fake_init(&dns);
+  ChiakiDnsCache *cache = cache_new(&dns, 8);
+  ChiakiDnsAddr addrs[CHIAKI_DNS_ADDRS_MAX];
+  size_t count;
+
+  assert(chiaki_dns_cache_prefetch(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_dns_cache_prefetch(cache, "stun.l.google.com", CHIAKI_DNS_FAMILY_IPV4) == CHIAKI_ERR_SUCCESS);
+  cache_wait_queries(cache, 2);
+
+  // Nothing left to do for a fresh entry.
+  assert(chiaki_dns_cache_prefetch(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4) == CHIAKI_ERR_SUCCESS);
+  assert(lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(lookup(cache, "stun.l.google.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(fake_queries(&dns) == 2);
+
+  ChiakiDnsCacheStats stats;
+  chiaki_dns_cache_stats(cache, &stats);
+  assert(stats.prefetches == 2);
+  assert(stats.hits == 2);
+  assert(stats.waits == 0);
+
+  // Flushing drops the answers.
+  chiaki_dns_cache_flush(cache);
+  assert(lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(fake_queries(&dns) == 3);
+  chiaki_dns_cache_free(cache);
+  fake_fini(&dns);
+}
+
+static void test_eviction(void) {
+  FakeDns dns;
+  fake_init(&dns);
+  ChiakiDnsCache *cache = cache_new(&dns, 2);
+  ChiakiDnsAddr addrs[CHIAKI_DNS_ADDRS_MAX];
+  size_t count;
+
+  assert(lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(lookup(cache, "stun.l.google.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  // The third name pushes out the least recently used one, stun.
+  assert(lookup(cache, "asm.np.community.playstation.net", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) ==
+         CHIAKI_ERR_SUCCESS);
+  assert(lookup(cache, "web.np.playstation.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(fake_queries(&dns) == 3);
+  assert(lookup(cache, "stun.l.google.com", CHIAKI_DNS_FAMILY_IPV4, addrs, &count) == CHIAKI_ERR_SUCCESS);
+  assert(fake_queries(&dns) == 4);
+
+  ChiakiDnsCacheStats stats;
+  chiaki_dns_cache_stats(cache, &stats);
+  assert(stats.evictions == 2);
+  chiaki_dns_cache_free(cache);
+  fake_fini(&dns);
+}
+
+void run_dnscache_tests(void) {
+  test_ttl();
+  test_families();
+  test_negative();
+  test_stale_fallback();
+  test_timeout();
+  test_concurrent_lookups();
+  test_prefetch();
+  test_eviction();
+}
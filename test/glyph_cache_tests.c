@@ -0,0 +1,217 @@
+/*
+ * glyph_cache_tests.c — Unit tests for the persisted glyph atlas
+ * (vita/src/ui/ui_glyph_cache.c).
+ *
+ * Round-trips glyphs through GLYPH_CACHE_FILENAME and checks that appends,
+ * key mismatches, truncated and corrupted files load what they should and
+ * that the next flush leaves a file that loads completely.
+ * test/bench/glyph_cache_bench.c times cold and warm prewarms.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ui/ui_glyph_cache.h"
+
+static const GlyphCacheKey test_key = {0x1111222233334444ULL, 0x5555666677778888ULL};
+
+/* A w x h glyph whose coverage is derived from its index. */
+static GlyphCacheEntry make_glyph(uint32_t glyph_index, uint16_t w, uint16_t h, uint8_t *coverage) {
+  for (size_t i = 0; i < (size_t)w * h; i++)
+    coverage[i] = (uint8_t)(glyph_index * 31 + i);
+  GlyphCacheEntry e = {glyph_index, 28, w, h, 1, (int16_t)h, (int32_t)(w + 2) << 16, 0, coverage};
+  return e;
+}
+
+static void add_glyph(GlyphCache *cache, uint32_t glyph_index, uint16_t w, uint16_t h) {
+  uint8_t coverage[64 * 64];
+  GlyphCacheEntry e = make_glyph(glyph_index, w, h, coverage);
+  assert(glyph_cache_add(cache, &e));
+}
+
+static void assert_glyph(const GlyphCacheEntry *e, uint32_t glyph_index, uint16_t w, uint16_t h) {
+  uint8_t coverage[64 * 64];
+  GlyphCacheEntry expected = make_glyph(glyph_index, w, h, coverage);
+  assert(e);
+  assert(e->glyph_index == glyph_index && e->glyph_size == expected.glyph_size);
+  assert(e->width == w && e->height == h);
+  assert(e->bitmap_left == expected.bitmap_left && e->bitmap_top == expected.bitmap_top);
+  assert(e->advance_x == expected.advance_x && e->advance_y == expected.advance_y);
+  assert(memcmp(e->coverage, coverage, (size_t)w * h) == 0);
+}
+
+static long file_size(void) {
+  FILE *fp = fopen(GLYPH_CACHE_FILENAME, "rb");
+  assert(fp);
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fclose(fp);
+  return size;
+}
+
+static GlyphCache *load(const GlyphCacheKey *key, size_t expected_count) {
+  GlyphCache *cache = glyph_cache_new(key);
+  assert(cache);
+  assert(glyph_cache_load_file(cache, GLYPH_CACHE_FILENAME) == expected_count);
+  assert(glyph_cache_count(cache) == expected_count);
+  assert(glyph_cache_pending(cache) == 0);
+  return cache;
+}
+
+/* Write a fresh cache of three glyphs, the last one empty like a space. */
+static void write_three(void) {
+  remove(GLYPH_CACHE_FILENAME);
+  GlyphCache *cache = load(&test_key, 0);
+  add_glyph(cache, 36, 10, 12);
+  add_glyph(cache, 1200, 7, 9);
+  add_glyph(cache, 3, 0, 0);
+  assert(glyph_cache_pending(cache) == 3);
+  assert(glyph_cache_flush_file(cache, GLYPH_CACHE_FILENAME));
+  assert(glyph_cache_pending(cache) == 0);
+  assert(file_size() == (long)glyph_cache_serialize(cache, NULL, 0));
+  glyph_cache_free(cache);
+}
+
+static void test_roundtrip(void) {
+  write_three();
+  GlyphCache *cache = load(&test_key, 3);
+  // insertion order is kept, preloading in it packs the atlas the same way
+  assert_glyph(glyph_cache_entry(cache, 0), 36, 10, 12);
+  assert_glyph(glyph_cache_entry(cache, 1), 1200, 7, 9);
+  assert_glyph(glyph_cache_entry(cache, 2), 3, 0, 0);
+  assert(glyph_cache_entry(cache, 3) == NULL);
+  assert(glyph_cache_find(cache, 1200) == glyph_cache_entry(cache, 1));
+  assert(glyph_cache_find(cache, 37) == NULL);
+  // nothing new, the file is left alone
+  assert(glyph_cache_flush_file(cache, GLYPH_CACHE_FILENAME));
+  glyph_cache_free(cache);
+}
+
+static void test_append(void) {
+  write_three();
+  long before = file_size();
+  GlyphCache *cache = load(&test_key, 3);
+  add_glyph(cache, 77, 20, 30);
+  // the atlas keeps its first rasterization, so does the cache
+  add_glyph(cache, 36, 5, 5);
+  assert(glyph_cache_pending(cache) == 1);
+  assert(glyph_cache_flush_file(cache, GLYPH_CACHE_FILENAME));
+  assert(file_size() == before + GLYPH_CACHE_RECORD_HEADER_SIZE + 20 * 30);
+  glyph_cache_free(cache);
+
+  cache = load(&test_key, 4);
+  assert_glyph(glyph_cache_find(cache, 36), 36, 10, 12);
+  assert_glyph(glyph_cache_entry(cache, 3), 77, 20, 30);
+  glyph_cache_free(cache);
+}
+
+static void test_key_mismatch(void) {
+  write_three();
+  // the font file changed
+  GlyphCacheKey key = test_key;
+  key.font_hash ^= 1;
+  GlyphCache *cache = load(&key, 0);
+  add_glyph(cache, 40, 8, 8);
+  assert(glyph_cache_flush_file(cache, GLYPH_CACHE_FILENAME));
+  glyph_cache_free(cache);
+
+  cache = load(&key, 1);
+  assert_glyph(glyph_cache_entry(cache, 0), 40, 8, 8);
+  glyph_cache_free(cache);
+  cache = load(&test_key, 0);
+  glyph_cache_free(cache);
+}
+
+static void rewrite_file(long keep, long flip) {
+  FILE *fp = fopen(GLYPH_CACHE_FILENAME, "rb");
+  assert(fp);
+  uint8_t buf[4096];
+  size_t size = fread(buf, 1, sizeof(buf), fp);
+  fclose(fp);
+  assert(keep <= (long)size && flip < keep);
+  if (flip >= 0)
+    buf[flip] ^= 0x40;
+  fp = fopen(GLYPH_CACHE_FILENAME, "wb");
+  assert(fp);
+  assert(fwrite(buf, 1, (size_t)keep, fp) == (size_t)keep);
+  fclose(fp);
+}
+
+static void test_damaged(void) {
+  const long first = GLYPH_CACHE_HEADER_SIZE + GLYPH_CACHE_RECORD_HEADER_SIZE + 10 * 12;
+  const long second = first + GLYPH_CACHE_RECORD_HEADER_SIZE + 7 * 9;
+
+  // an append cut short keeps the complete records before it
+  write_three();
+  rewrite_file(second + 5, -1);
+  GlyphCache *cache = load(&test_key, 2);
+  assert_glyph(glyph_cache_entry(cache, 1), 1200, 7, 9);
+  // no append after the damage, the flush rewrites the file
+  add_glyph(cache, 3, 0, 0);
+  assert(glyph_cache_flush_file(cache, GLYPH_CACHE_FILENAME));
+  assert(file_size() == (long)glyph_cache_serialize(cache, NULL, 0));
+  glyph_cache_free(cache);
+  cache = load(&test_key, 3);
+  glyph_cache_free(cache);
+
+  // a flipped coverage byte in the second record
+  write_three();
+  rewrite_file(file_size(), first + GLYPH_CACHE_RECORD_HEADER_SIZE + 3);
+  cache = load(&test_key, 1);
+  assert(glyph_cache_find(cache, 1200) == NULL);
+  // even with nothing new, the good prefix is written back
+  assert(glyph_cache_flush_file(cache, GLYPH_CACHE_FILENAME));
+  assert(file_size() == first);
+  glyph_cache_free(cache);
+
+  // a flipped header byte
+  write_three();
+  rewrite_file(file_size(), 9);
+  cache = load(&test_key, 0);
+  glyph_cache_free(cache);
+}
+
+static void test_limits(void) {
+  GlyphCache *cache = glyph_cache_new(&test_key);
+  assert(cache);
+  static uint8_t coverage[(GLYPH_CACHE_MAX_GLYPH_DIM + 1) * 4];
+  GlyphCacheEntry e = {1, 28, GLYPH_CACHE_MAX_GLYPH_DIM + 1, 4, 0, 0, 0, 0, coverage};
+  assert(!glyph_cache_add(cache, &e));
+  e.width = GLYPH_CACHE_MAX_GLYPH_DIM;
+  e.glyph_size = 0;
+  assert(!glyph_cache_add(cache, &e));
+  assert(glyph_cache_count(cache) == 0);
+
+  // grows past the initial capacity and index size
+  for (uint32_t i = 0; i < 1000; i++)
+    add_glyph(cache, i * 7919, 2, 3);
+  assert(glyph_cache_count(cache) == 1000);
+  for (uint32_t i = 0; i < 1000; i++)
+    assert_glyph(glyph_cache_find(cache, i * 7919), i * 7919, 2, 3);
+  assert(glyph_cache_find(cache, 1) == NULL);
+
+  size_t size = glyph_cache_serialize(cache, NULL, 0);
+  assert(size == GLYPH_CACHE_HEADER_SIZE + 1000 * (GLYPH_CACHE_RECORD_HEADER_SIZE + 6));
+  uint8_t *buf = malloc(size);
+  assert(buf);
+  assert(glyph_cache_serialize(cache, buf, size - 1) == 0);
+  assert(glyph_cache_serialize(cache, buf, size) == size);
+  glyph_cache_free(cache);
+
+  cache = glyph_cache_new(&test_key);
+  assert(glyph_cache_load(cache, buf, size) == 1000);
+  glyph_cache_free(cache);
+}
+
+void run_glyph_cache_tests(void) {
+  test_roundtrip();
+  test_append();
+  test_key_mismatch();
+  test_damaged();
+  test_limits();
+  remove(GLYPH_CACHE_FILENAME);
+}
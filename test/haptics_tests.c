@@ -0,0 +1,377 @@
+/*
+ * haptics_tests.c — Unit tests for the haptics receiver
+ * (lib/src/haptics.c).
+ *
+ * Covers the envelope follower, the trigger effect intensities and the rumble
+ * mapping, frames being delivered once and in order with their FEC copies
+ * counted as redundant, a lost packet recovered from the copies in the next
+ * one, gaps given up after reorder_us and frames behind the stream's clock by
+ * more than the latency budget being dropped, also when the stream paused for
+ * longer than its clock looks back, trigger effect events and the latency
+ * stats.
+ * test/bench/haptics_bench.c replays recorded packet streams through it.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <chiaki/haptics.h>
+
+#define EVENTS_MAX 256
+
+typedef struct {
+  ChiakiHapticsEvent events[EVENTS_MAX];
+  size_t events_count;
+  size_t frames_count;
+  uint8_t last_frame[CHIAKI_HAPTICS_FRAME_SIZE];
+} Recorder;
+
+static void recorder_event(const ChiakiHapticsEvent *event, void *user) {
+  Recorder *r = user;
+  assert(r->events_count < EVENTS_MAX);
+  r->events[r->events_count++] = *event;
+}
+
+static void recorder_frame(uint8_t *buf, size_t buf_size, void *user) {
+  Recorder *r = user;
+  assert(buf_size <= sizeof(r->last_frame));
+  memcpy(r->last_frame, buf, buf_size);
+  r->frames_count++;
+}
+
+typedef struct {
+  Recorder rec;
+  ChiakiAudioSink frame_sink;
+  ChiakiHapticsSink sink;
+  ChiakiHapticsReceiver *receiver;
+} Fixture;
+
+static void fixture_init(Fixture *f, const ChiakiHapticsConfig *config) {
+  memset(f, 0, sizeof(*f));
+  f->frame_sink.user = &f->rec;
+  f->frame_sink.frame_cb = recorder_frame;
+  f->sink.user = &f->rec;
+  f->sink.event_cb = recorder_event;
+  f->receiver = chiaki_haptics_receiver_new(NULL, config, &f->frame_sink, &f->sink);
+  assert(f->receiver);
+}
+
+// a square wave of amplitude on both actuators, the first sample tells the frames apart
+static void frame_fill(uint8_t *buf, uint16_t frame_index, int8_t amplitude) {
+  for (size_t i = 0; i < CHIAKI_HAPTICS_FRAME_SIZE; i++)
+    buf[i] = (uint8_t)((i / 2) % 2 ? -amplitude : amplitude);
+  buf[0] = (uint8_t)(frame_index & 0x3f);
+}
+
+// the packet carrying frame_index and fec copies of the frames before it
+static void send_packet(Fixture *f, uint16_t frame_index, uint8_t fec, uint64_t arrival_us) {
+  uint8_t data[(1 + 15) * CHIAKI_HAPTICS_FRAME_SIZE];
+  frame_fill(data, frame_index, 100);
+  for (uint8_t i = 0; i < fec; i++)
+    frame_fill(data + CHIAKI_HAPTICS_FRAME_SIZE * (1 + i), (uint16_t)(frame_index - fec + i), 100);
+  ChiakiTakionAVPacket packet;
+  memset(&packet, 0, sizeof(packet));
+  packet.is_haptics = true;
+  packet.codec = 5;
+  packet.frame_index = frame_index;
+  packet.units_in_frame_total = 1 + fec;
+  packet.units_in_frame_fec = (uint16_t)((CHIAKI_HAPTICS_FRAME_SIZE << 8) | (fec << 4) | 1);
+  packet.data = data;
+  packet.data_size = (size_t)CHIAKI_HAPTICS_FRAME_SIZE * (1 + fec);
+  chiaki_haptics_receiver_av_packet(f->receiver, &packet, arrival_us);
+}
+
+static void test_envelope(void) {
+  uint8_t buf[CHIAKI_HAPTICS_FRAME_SIZE];
+  ChiakiHapticsFollower follower;
+  memset(&follower, 0, sizeof(follower));
+  ChiakiHapticsEnvelope env;
+  memset(buf, 0, sizeof(buf));
+  assert(chiaki_haptics_envelope_decode(&follower, buf, sizeof(buf) - 1, &env) == CHIAKI_ERR_INVALID_DATA);
+  assert(chiaki_haptics_envelope_decode(&follower, buf, sizeof(buf), &env) == CHIAKI_ERR_SUCCESS);
+  for (size_t p = 0; p < CHIAKI_HAPTICS_ENVELOPE_POINTS; p++)
+    assert(!env.left[p] && !env.right[p]);
+
+  // full scale on the left only, -128 is the loudest sample
+  for (size_t i = 0; i < sizeof(buf); i += 2)
+    buf[i] = (uint8_t)(int8_t)-128;
+  assert(chiaki_haptics_envelope_decode(&follower, buf, sizeof(buf), &env) == CHIAKI_ERR_SUCCESS);
+  for (size_t p = 0; p < CHIAKI_HAPTICS_ENVELOPE_POINTS; p++)
+    assert(env.left[p] == 255 && env.right[p] == 0);
+
+  // silence after it releases over about 10 ms instead of dropping to 0
+  memset(buf, 0, sizeof(buf));
+  assert(chiaki_haptics_envelope_decode(&follower, buf, sizeof(buf), &env) == CHIAKI_ERR_SUCCESS);
+  assert(env.left[0] > 200);
+  for (size_t p = 1; p < CHIAKI_HAPTICS_ENVELOPE_POINTS; p++)
+    assert(env.left[p] < env.left[p - 1]);
+  assert(env.left[CHIAKI_HAPTICS_ENVELOPE_POINTS - 1] > 60 && env.left[CHIAKI_HAPTICS_ENVELOPE_POINTS - 1] < 140);
+  for (int i = 0; i < 8; i++)
+    chiaki_haptics_envelope_decode(&follower, buf, sizeof(buf), &env);
+  assert(env.left[CHIAKI_HAPTICS_ENVELOPE_POINTS - 1] == 0);
+}
+
+static void test_trigger_intensity(void) {
+  uint8_t params[10];
+  memset(params, 0, sizeof(params));
+  assert(chiaki_haptics_trigger_intensity(0x26, params) == 0);
+
+  // zones 2 and 9 active, zone 2 at strength 3 of 8, zone 9 at 6 of 8, zone 0 at 8 but inactive
+  uint16_t zones = (1 << 2) | (1 << 9);
+  uint32_t strengths = (7u << 0) | (2u << 6) | (5u << 27);
+  params[0] = zones & 0xff;
+  params[1] = zones >> 8;
+  for (int i = 0; i < 4; i++)
+    params[2 + i] = (uint8_t)(strengths >> (8 * i));
+  assert(chiaki_haptics_trigger_intensity(0x26, params) == 0); // no frequency
+  params[8] = 30;
+  assert(chiaki_haptics_trigger_intensity(0x26, params) == 6 * 255 / 8);
+  params[0] = params[1] = 0;
+  assert(chiaki_haptics_trigger_intensity(0x26, params) == 0);
+
+  memset(params, 0, sizeof(params));
+  params[0] = 40; // frequency
+  params[1] = 4;
+  assert(chiaki_haptics_trigger_intensity(0x06, params) == 4 * 255 / 8);
+  params[1] = 200;
+  assert(chiaki_haptics_trigger_intensity(0x06, params) == 255);
+
+  // resistance
+  memset(params, 0xff, sizeof(params));
+  assert(chiaki_haptics_trigger_intensity(0x21, params) == 0);
+  assert(chiaki_haptics_trigger_intensity(0x25, params) == 0);
+  assert(chiaki_haptics_trigger_intensity(0x05, params) == 0);
+}
+
+static void test_rumble_map(void) {
+  ChiakiHapticsConfig config;
+  chiaki_haptics_config_defaults(&config);
+  ChiakiHapticsEnvelope env;
+  memset(&env, 0, sizeof(env));
+  env.left[1] = config.gate;
+  env.left[2] = config.gate + 1;
+  env.left[3] = 255;
+  env.right[3] = 128;
+  ChiakiHapticsRumble rumble[CHIAKI_HAPTICS_ENVELOPE_POINTS];
+  chiaki_haptics_rumble_map(&config, &env, 0, 0, rumble);
+  assert(rumble[0].left == 0 && rumble[1].left == 0);
+  assert(rumble[2].left == config.motor_min);
+  assert(rumble[3].left == 255);
+  assert(rumble[3].right > config.motor_min && rumble[3].right < 255);
+  assert(rumble[0].right == 0);
+
+  // the trigger's vibration is mixed in by taking the stronger one
+  chiaki_haptics_rumble_map(&config, &env, 0, 200, rumble);
+  for (size_t p = 0; p < CHIAKI_HAPTICS_ENVELOPE_POINTS; p++)
+    assert(rumble[p].right >= 200 * config.trigger_gain_percent / 100);
+  assert(rumble[0].right == 200 * config.trigger_gain_percent / 100);
+  assert(rumble[0].left == 0);
+
+  config.gain_percent = 50;
+  chiaki_haptics_rumble_map(&config, &env, 0, 0, rumble);
+  assert(rumble[3].left < 255 && rumble[3].left > config.motor_min);
+}
+
+static void test_in_order_with_fec(void) {
+  Fixture f;
+  fixture_init(&f, NULL);
+  for (uint16_t i = 0; i < 20; i++)
+    send_packet(&f, (uint16_t)(100 + i), 2, 1000 + i * 10000);
+  // joining mid-stream starts from the oldest copy in the first packet
+  assert(f.rec.events_count == 22 && f.rec.frames_count == 22);
+  for (size_t i = 0; i < 22; i++) {
+    const ChiakiHapticsEvent *e = &f.rec.events[i];
+    assert(e->has_frame && e->frame_index == 98 + i);
+    assert(e->arrival_us == 1000 + (i < 2 ? 0 : i - 2) * 10000 && e->delivered_us == e->arrival_us);
+    assert(e->rumble[0].left > 0 && e->rumble[0].left == e->rumble[0].right);
+  }
+  assert(f.rec.last_frame[0] == (119 & 0x3f));
+
+  ChiakiHapticsStats stats;
+  chiaki_haptics_receiver_stats(f.receiver, &stats);
+  assert(stats.frames == 22 && stats.lost == 0 && stats.reordered == 0);
+  assert(stats.redundant == 19 * 2 && stats.late_dropped == 0);
+  assert(stats.delivery.count == 22 && stats.delivery.max_us == 0);
+
+  // the copies in the first packets of a stream from 0 are the same frame, they are skipped
+  chiaki_haptics_receiver_reset(f.receiver);
+  send_packet(&f, 0, 2, 300000);
+  send_packet(&f, 1, 2, 310000);
+  assert(f.rec.events_count == 24 && f.rec.events[22].frame_index == 0 && f.rec.events[23].frame_index == 1);
+  chiaki_haptics_receiver_free(f.receiver);
+}
+
+static void test_recovered_from_fec(void) {
+  Fixture f;
+  fixture_init(&f, NULL);
+  send_packet(&f, 10, 0, 0);
+  // 11 is lost, 12 carries its copy
+  send_packet(&f, 12, 1, 20000);
+  send_packet(&f, 13, 1, 30000);
+  assert(f.rec.events_count == 4);
+  for (size_t i = 0; i < 4; i++)
+    assert(f.rec.events[i].frame_index == 10 + i);
+  assert(f.rec.events[1].arrival_us == 20000);
+
+  // 15 before 14, which fills the gap when it comes late
+  send_packet(&f, 15, 0, 50000);
+  assert(f.rec.events_count == 4);
+  send_packet(&f, 14, 0, 52000);
+  assert(f.rec.events_count == 6);
+  assert(f.rec.events[4].frame_index == 14 && f.rec.events[5].frame_index == 15);
+  assert(f.rec.events[5].arrival_us == 50000 && f.rec.events[5].delivered_us == 52000);
+
+  ChiakiHapticsStats stats;
+  chiaki_haptics_receiver_stats(f.receiver, &stats);
+  assert(stats.frames == 6 && stats.lost == 0);
+  assert(stats.reordered == 1 && stats.recovered == 1);
+  assert(stats.redundant == 1);
+  // percentiles are bucket upper bounds up to the max
+  assert(stats.delivery.max_us == 2000 && stats.delivery.p99_us == 2000 && stats.delivery.p50_us == 1000);
+  chiaki_haptics_receiver_free(f.receiver);
+}
+
+static void test_gap_given_up(void) {
+  ChiakiHapticsConfig config;
+  chiaki_haptics_config_defaults(&config);
+  Fixture f;
+  fixture_init(&f, &config);
+  send_packet(&f, 0, 0, 0);
+  send_packet(&f, 2, 0, 20000);
+  send_packet(&f, 3, 0, 30000);
+  assert(f.rec.events_count == 1);
+  chiaki_haptics_receiver_poll(f.receiver, 20000 + config.reorder_us - 1);
+  assert(f.rec.events_count == 1);
+  chiaki_haptics_receiver_poll(f.receiver, 20000 + config.reorder_us);
+  assert(f.rec.events_count == 3);
+  assert(f.rec.events[1].frame_index == 2 && f.rec.events[2].frame_index == 3);
+
+  // 1 after its gap was given up is too late
+  send_packet(&f, 1, 0, 40000);
+  assert(f.rec.events_count == 3);
+
+  // a frame further ahead than can be held gives up everything before it
+  send_packet(&f, 6, 0, 50000);
+  send_packet(&f, 100, 0, 60000);
+  assert(f.rec.events_count == 5);
+  assert(f.rec.events[3].frame_index == 6 && f.rec.events[4].frame_index == 100);
+  send_packet(&f, 101, 0, 70000);
+  assert(f.rec.events_count == 6);
+
+  ChiakiHapticsStats stats;
+  chiaki_haptics_receiver_stats(f.receiver, &stats);
+  assert(stats.frames == 6);
+  assert(stats.lost == 1 + 2 + 93);
+  assert(stats.late_dropped == 1);
+  assert(stats.reordered == 3);
+
+  // far behind starts over
+  send_packet(&f, 10, 0, 80000);
+  chiaki_haptics_receiver_stats(f.receiver, &stats);
+  assert(stats.late_dropped == 2 && stats.restarts == 0);
+  send_packet(&f, (uint16_t)(101 - 2000), 0, 90000);
+  chiaki_haptics_receiver_stats(f.receiver, &stats);
+  assert(stats.restarts == 1 && stats.frames == 7);
+  chiaki_haptics_receiver_free(f.receiver);
+}
+
+static void test_latency_budget(void) {
+  ChiakiHapticsConfig config;
+  chiaki_haptics_config_defaults(&config);
+  config.reorder_us = 30000;
+  config.latency_budget_us = 20000;
+  Fixture f;
+  fixture_init(&f, &config);
+  // on the stream's clock, frame i is due at i * 32 / 3 ms
+  send_packet(&f, 0, 0, 0);
+  send_packet(&f, 2, 0, 21333);
+  send_packet(&f, 3, 0, 32000);
+  // given up at 51333, 2 is 30 ms behind and dropped, 3 is 19.3 ms behind and still good
+  chiaki_haptics_receiver_poll(f.receiver, 51333);
+  assert(f.rec.events_count == 2 && f.rec.frames_count == 2);
+  assert(f.rec.events[1].frame_index == 3);
+
+  // a stalled network lets 4 to 7 through at once, only 7 is within the budget
+  for (uint16_t i = 4; i < 8; i++)
+    send_packet(&f, i, 0, 92000);
+  assert(f.rec.events_count == 3 && f.rec.events[2].frame_index == 7);
+
+  ChiakiHapticsStats stats;
+  chiaki_haptics_receiver_stats(f.receiver, &stats);
+  assert(stats.lost == 1 && stats.late_dropped == 1 + 3 && stats.frames == 3);
+  assert(stats.delivery.max_us == 19333 && stats.delivery.p99_us == 19333);
+  assert(stats.lateness.max_us == 19333 && stats.lateness.count == 3);
+  chiaki_haptics_receiver_free(f.receiver);
+}
+
+static void test_held_over_pause(void) {
+  Fixture f;
+  fixture_init(&f, NULL);
+  for (uint16_t i = 0; i < 4; i++)
+    send_packet(&f, i, 0, i * 10667);
+  // 4 is lost and 5 held, then the stream pauses for 3 s without a poll
+  send_packet(&f, 5, 0, 53333);
+  assert(f.rec.events_count == 4);
+  send_packet(&f, 6, 0, 53333 + 3000000);
+  // no clock bucket is left to tell, 5 is dropped for its arrival 3 s ago, 6 is on time
+  assert(f.rec.events_count == 5 && f.rec.events[4].frame_index == 6);
+
+  ChiakiHapticsStats stats;
+  chiaki_haptics_receiver_stats(f.receiver, &stats);
+  assert(stats.frames == 5 && stats.lost == 1 && stats.late_dropped == 1);
+  assert(stats.delivery.max_us == 0);
+  chiaki_haptics_receiver_free(f.receiver);
+}
+
+static void test_trigger_effects_and_actuation(void) {
+  Fixture f;
+  fixture_init(&f, NULL);
+  uint8_t off[10] = {0};
+  uint8_t vibrate[10] = {40, 8};
+  chiaki_haptics_receiver_trigger_effects(f.receiver, 0x05, off, 0x06, vibrate, 500);
+  assert(f.rec.events_count == 1);
+  const ChiakiHapticsEvent *e = &f.rec.events[0];
+  assert(!e->has_frame && e->arrival_us == 500);
+  assert(e->trigger_left == 0 && e->trigger_right == 255);
+  assert(e->rumble[0].left == 0 && e->rumble[0].right == 255 * 60 / 100);
+
+  // nothing to feel changed
+  chiaki_haptics_receiver_trigger_effects(f.receiver, 0x21, vibrate, 0x06, vibrate, 600);
+  assert(f.rec.events_count == 1);
+
+  send_packet(&f, 0, 0, 1000);
+  assert(f.rec.events_count == 2);
+  assert(f.rec.events[1].has_frame && f.rec.events[1].trigger_right == 255);
+  chiaki_haptics_receiver_actuated(f.receiver, &f.rec.events[1], 1000 + 7500);
+  chiaki_haptics_receiver_actuated(f.receiver, &f.rec.events[0], 1500);
+
+  ChiakiHapticsStats stats;
+  chiaki_haptics_receiver_stats(f.receiver, &stats);
+  assert(stats.trigger_effects == 2);
+  assert(stats.actuation.count == 2);
+  assert(stats.actuation.mean_us == (7500 + 1000) / 2);
+  assert(stats.actuation.p50_us == 2000 && stats.actuation.p99_us == 7500 && stats.actuation.max_us == 7500);
+
+  // reset forgets the stream and the triggers, keeps the stats
+  chiaki_haptics_receiver_reset(f.receiver);
+  send_packet(&f, 500, 0, 2000);
+  assert(f.rec.events_count == 3);
+  assert(f.rec.events[2].frame_index == 500 && f.rec.events[2].trigger_right == 0);
+  chiaki_haptics_receiver_stats(f.receiver, &stats);
+  assert(stats.frames == 2 && stats.lost == 0);
+  chiaki_haptics_receiver_free(f.receiver);
+}
+
+void run_haptics_tests(void) {
+  test_envelope();
+  test_trigger_intensity();
+  test_rumble_map();
+  test_in_order_with_fec();
+  test_recovered_from_fec();
+  test_gap_given_up();
+  test_latency_budget();
+  test_held_over_pause();
+  test_trigger_effects_and_actuation();
+}
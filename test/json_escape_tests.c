@@ -1,13 +1,9 @@
-/* json_escape_tests.c — Unit tests for the JSON \uXXXX / UTF-8 helpers that
- * live in vita/src/psn_auth.c.
+/* json_escape_tests.c — Unit tests for JSON string decoding as PSN auth
+ * uses it: vita/src/psn_auth.c reads token responses with chiaki_json_scan()
+ * and decodes them with chiaki_json_unescape() (lib/src/jsonscan.c).
  *
- * Because those helpers are declared static inside a translation unit that
- * depends on libcurl and other Vita-specific headers not available on the host
- * build machine, the helper functions are duplicated here verbatim.  The
- * helpers have no external dependencies beyond the C standard library.
- *
- * If the helpers in psn_auth.c are ever changed, this file must be updated to
- * match so that the tests continue to reflect actual production behaviour.
+ * \uXXXX escapes decode to UTF-8 and surrogate pairs combine into one
+ * codepoint.  Unpaired surrogates decode to U+FFFD, as json-c does.
  *
  * Tests are registered in run_json_escape_tests() at the bottom of the file
  * and called from main() in config_vita_tests.c.
@@ -20,238 +16,32 @@
 #include <stdlib.h>
 #include <string.h>
 
-/* =========================================================================
- * Helpers duplicated from vita/src/psn_auth.c (static linkage copy).
- * Keep in sync with the originals.
- * ========================================================================= */
-
-/* Minimal json_find_key_value stub sufficient for testing json_get_string_len
- * and json_get_string: given a key, returns a pointer to the first '"' of
- * the string value in a flat {"key":"value"} JSON object.  Not a general JSON
- * parser — enough for the tests below. */
-static const char *json_find_key_value_test(const char *json, const char *key) {
-  if (!json || !key)
-    return NULL;
-  /* Find "key": pattern */
-  size_t klen = strlen(key);
-  const char *p = json;
-  while (*p) {
-    if (*p == '"') {
-      const char *start = p + 1;
-      const char *end = strchr(start, '"');
-      if (!end)
-        return NULL;
-      if ((size_t)(end - start) == klen && memcmp(start, key, klen) == 0) {
-        /* Found the key — skip whitespace and colon */
-        p = end + 1;
-        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
-          p++;
-        if (*p != ':')
-          return NULL;
-        p++;
-        while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
-          p++;
-        return p;
-      }
-    }
-    p++;
-  }
-  return NULL;
-}
-
-/* --- helper implementations (verbatim copy from psn_auth.c) --- */
-
-static bool json_parse_hex4(const char **pp, unsigned int *out_val) {
-  const char *p = *pp;
-  unsigned int v = 0;
-  int i;
-  for (i = 0; i < 4; i++) {
-    unsigned char c = (unsigned char)p[i];
-    unsigned int digit;
-    if (c >= '0' && c <= '9')
-      digit = c - '0';
-    else if (c >= 'a' && c <= 'f')
-      digit = 10 + (c - 'a');
-    else if (c >= 'A' && c <= 'F')
-      digit = 10 + (c - 'A');
-    else
-      return false;
-    v = (v << 4) | digit;
-  }
-  *out_val = v;
-  *pp = p + 4;
-  return true;
-}
-
-static int json_utf8_len(unsigned long cp) {
-  if (cp <= 0x7FUL)
-    return 1;
-  if (cp <= 0x7FFUL)
-    return 2;
-  if (cp <= 0xFFFFUL)
-    return 3;
-  return 4;
-}
-
-static int json_utf8_encode(unsigned long cp, unsigned char *buf) {
-  if (cp <= 0x7FUL) {
-    buf[0] = (unsigned char)cp;
-    return 1;
-  }
-  if (cp <= 0x7FFUL) {
-    buf[0] = (unsigned char)(0xC0u | (cp >> 6));
-    buf[1] = (unsigned char)(0x80u | (cp & 0x3Fu));
-    return 2;
-  }
-  if (cp <= 0xFFFFUL) {
-    buf[0] = (unsigned char)(0xE0u | (cp >> 12));
-    buf[1] = (unsigned char)(0x80u | ((cp >> 6) & 0x3Fu));
-    buf[2] = (unsigned char)(0x80u | (cp & 0x3Fu));
-    return 3;
-  }
-  buf[0] = (unsigned char)(0xF0u | (cp >> 18));
-  buf[1] = (unsigned char)(0x80u | ((cp >> 12) & 0x3Fu));
-  buf[2] = (unsigned char)(0x80u | ((cp >> 6) & 0x3Fu));
-  buf[3] = (unsigned char)(0x80u | (cp & 0x3Fu));
-  return 4;
-}
-
-static bool json_decode_unicode_escape(const char **pp, unsigned long *out_cp) {
-  unsigned int hi;
-  if (!json_parse_hex4(pp, &hi))
-    return false;
-
-  if (hi >= 0xD800u && hi <= 0xDBFFu) {
-    if ((*pp)[0] != '\\' || (*pp)[1] != 'u')
-      return false;
-    *pp += 2;
-    unsigned int lo;
-    if (!json_parse_hex4(pp, &lo))
-      return false;
-    if (lo < 0xDC00u || lo > 0xDFFFu)
-      return false;
-    *out_cp = 0x10000UL + (((unsigned long)(hi - 0xD800u)) << 10)
-              + (unsigned long)(lo - 0xDC00u);
-    return true;
-  }
-
-  if (hi >= 0xDC00u && hi <= 0xDFFFu)
-    return false;
+#include <chiaki/jsonscan.h>
 
-  *out_cp = (unsigned long)hi;
-  return true;
+/* Top-level string field `key` of json, the way psn_auth.c looks it up. */
+static bool find_string(const char *json, const char *key, ChiakiJsonValue *value) {
+  const char *const paths[] = {key};
+  return chiaki_json_scan(json, strlen(json), paths, value, 1) == CHIAKI_ERR_SUCCESS &&
+         value->type == CHIAKI_JSON_TYPE_STRING;
 }
 
-/* Wrappers that use json_find_key_value_test so we can test with simple JSON
- * strings directly without needing the full psn_auth.c link. */
+/* Decoded length of the field, which never exceeds its escaped length. */
 static bool test_json_get_string_len(const char *json, const char *key, size_t *out_len) {
-  if (!out_len)
-    return false;
-  *out_len = 0;
-  const char *p = json_find_key_value_test(json, key);
-  if (!p || *p != '"')
-    return false;
-
-  p++;
-  size_t len = 0;
-  while (*p && *p != '"') {
-    if (*p == '\\') {
-      p++;
-      if (!*p)
-        return false;
-      if (*p == 'u') {
-        p++;
-        unsigned long cp;
-        if (!json_decode_unicode_escape(&p, &cp))
-          return false;
-        len += (size_t)json_utf8_len(cp);
-      } else {
-        len++;
-        p++;
-      }
-      continue;
-    }
-    len++;
-    p++;
-  }
-  if (*p != '"')
+  ChiakiJsonValue value;
+  if (!find_string(json, key, &value))
     return false;
-  *out_len = len;
-  return true;
+  char *scratch = malloc(value.len + 1);
+  assert(scratch);
+  bool ok = chiaki_json_unescape(&value, scratch, value.len + 1, out_len) == CHIAKI_ERR_SUCCESS;
+  free(scratch);
+  return ok;
 }
 
 static bool test_json_get_string(const char *json, const char *key, char *out, size_t out_size) {
-  if (!out || out_size == 0)
-    return false;
-  out[0] = '\0';
-  const char *p = json_find_key_value_test(json, key);
-  if (!p || *p != '"')
+  ChiakiJsonValue value;
+  if (!find_string(json, key, &value))
     return false;
-
-  p++;
-  size_t o = 0;
-  while (*p && *p != '"') {
-    if (*p == '\\') {
-      p++;
-      if (!*p)
-        return false;
-      if (*p == 'u') {
-        p++;
-        unsigned long cp;
-        if (!json_decode_unicode_escape(&p, &cp))
-          return false;
-        unsigned char utf8[4];
-        int nb = json_utf8_encode(cp, utf8);
-        int i;
-        /* Emit UTF-8 bytes; fail if they would not fit.  Unlike the
-         * single-char and plain-ASCII overflow paths (which break with p
-         * still pointing at the unwritten character so *p != '"'), here p
-         * has already been advanced past the full \uXXXX sequence by
-         * json_decode_unicode_escape.  A break would leave p after the
-         * escape, causing *p == '"' to report success despite silent
-         * truncation — so return false instead. */
-        if (o + (size_t)nb + 1 > out_size)
-          return false;
-        for (i = 0; i < nb; i++)
-          out[o++] = (char)utf8[i];
-        continue;
-      }
-      if (o + 1 >= out_size)
-        break;
-      switch (*p) {
-        case '"':
-        case '\\':
-        case '/':
-          out[o++] = *p;
-          break;
-        case 'b':
-          out[o++] = '\b';
-          break;
-        case 'f':
-          out[o++] = '\f';
-          break;
-        case 'n':
-          out[o++] = '\n';
-          break;
-        case 'r':
-          out[o++] = '\r';
-          break;
-        case 't':
-          out[o++] = '\t';
-          break;
-        default:
-          out[o++] = *p;
-          break;
-      }
-      p++;
-      continue;
-    }
-    if (o + 1 >= out_size)
-      break;
-    out[o++] = *p++;
-  }
-  out[o] = '\0';
-  return *p == '"';
+  return chiaki_json_unescape(&value, out, out_size, NULL) == CHIAKI_ERR_SUCCESS;
 }
 
 /* =========================================================================
@@ -338,19 +128,28 @@ static void test_mixed_unicode_and_ascii(void) {
   check_roundtrip(json, "v", (const char *)expected, 9);
 }
 
-/* Lone high surrogate (no following \uDCxx) must return false. */
-static void test_lone_high_surrogate_fails(void) {
-  check_failure("{\"v\":\"\\uD83D\"}", "v");
+/* Lone high surrogate (no following \uDCxx) decodes to U+FFFD. */
+static void test_lone_high_surrogate_replaced(void) {
+  const unsigned char expected[] = { 0xEF, 0xBF, 0xBD };
+  check_roundtrip("{\"v\":\"\\uD83D\"}", "v", (const char *)expected, 3);
 }
 
-/* High surrogate followed by a non-surrogate codepoint must return false. */
-static void test_high_surrogate_wrong_low_fails(void) {
-  check_failure("{\"v\":\"\\uD83D\\u0041\"}", "v");
+/* High surrogate followed by a non-surrogate codepoint: U+FFFD, then the
+ * codepoint itself. */
+static void test_high_surrogate_wrong_low_replaced(void) {
+  const unsigned char expected[] = { 0xEF, 0xBF, 0xBD, 'A' };
+  check_roundtrip("{\"v\":\"\\uD83D\\u0041\"}", "v", (const char *)expected, 4);
 }
 
-/* Lone low surrogate must return false. */
-static void test_lone_low_surrogate_fails(void) {
-  check_failure("{\"v\":\"\\uDE00\"}", "v");
+/* Lone low surrogate decodes to U+FFFD. */
+static void test_lone_low_surrogate_replaced(void) {
+  const unsigned char expected[] = { 0xEF, 0xBF, 0xBD };
+  check_roundtrip("{\"v\":\"\\uDE00\"}", "v", (const char *)expected, 3);
+}
+
+/* Escapes JSON does not define must return false. */
+static void test_unknown_escape_fails(void) {
+  check_failure("{\"v\":\"\\x41\"}", "v");
 }
 
 /* \u followed by non-hex characters must return false. */
@@ -374,34 +173,37 @@ static void test_truncated_unicode_escape_fails(void) {
   assert(!test_json_get_string(json, "v", buf, sizeof(buf)));
 }
 
-/* len + 1 == exact buffer size invariant: json_get_string_len gives the byte
+/* len + 1 == exact buffer size invariant: the decoded length gives the byte
  * count such that a buffer of len+1 is always exactly sufficient. */
 static void test_len_plus_one_is_exact_buffer_size(void) {
   const char *json = "{\"v\":\"\\uD83D\\uDE00 caf\\u00E9\"}";
-  /* Expected: 4-byte emoji + ' ' + 'c' 'a' 'f' + 2-byte é = 9 bytes */
+  /* Expected: 4-byte emoji + ' ' + 'c' 'a' 'f' + 2-byte é = 10 bytes */
   size_t len = 0;
   assert(test_json_get_string_len(json, "v", &len));
-  assert(len == 9);
+  assert(len == 10);
 
-  char buf[10]; /* len+1 */
+  char buf[11]; /* len+1 */
   assert(test_json_get_string(json, "v", buf, sizeof(buf)));
-  assert(buf[9] == '\0');
+  assert(buf[10] == '\0');
 
   const unsigned char expected[] = {
     0xF0, 0x9F, 0x98, 0x80, ' ', 'c', 'a', 'f', 0xC3, 0xA9
   };
-  assert(memcmp(buf, expected, 9) == 0);
+  assert(memcmp(buf, expected, 10) == 0);
+
+  /* One byte less must not fit. */
+  assert(!test_json_get_string(json, "v", buf, 10));
 }
 
 /* U+0000 (null codepoint, \u0000) — edge case: encodes to 1 UTF-8 byte (0x00).
- * The sizer must count it; the copier can't write it into the string body
- * because it would terminate the C string early.  This is a known limitation
- * of null-terminated output and is acceptable — the important thing is that
- * the helpers don't crash or miscount. */
+ * The decoded length counts it, but in the output it terminates the C string
+ * early.  This is a known limitation of null-terminated output and is
+ * acceptable — the important thing is that decoding doesn't crash or
+ * miscount. */
 static void test_null_codepoint_edge_case(void) {
   /* \u0000 in the middle of a token: "a\u0000b" → 3 decoded bytes but the
-   * output string looks like "a" because of C string semantics.  The sizer
-   * must still return 3 and the copier must return true. */
+   * output string looks like "a" because of C string semantics.  The length
+   * must still be 3 and decoding must succeed. */
   const char *json = "{\"v\":\"a\\u0000b\"}";
   size_t len = 0;
   assert(test_json_get_string_len(json, "v", &len));
@@ -417,11 +219,9 @@ static void test_null_codepoint_edge_case(void) {
 
 /* Regression: \uXXXX overflow at end-of-string must return false, not true.
  *
- * When the buffer is too small to hold the decoded UTF-8 bytes of a \uXXXX
- * escape that appears just before the closing '"', the post-loop check
- * '*p == '"'' would have incorrectly returned true under the old break path
- * because json_decode_unicode_escape had already advanced p past the escape.
- * The fix changes that path to return false. */
+ * The old hand-rolled decoder in psn_auth.c once reported success with a
+ * silently truncated result when the UTF-8 bytes of a \uXXXX escape just
+ * before the closing '"' did not fit. */
 static void test_unicode_escape_overflow_returns_false(void) {
   /* \u00E9 = U+00E9 LATIN SMALL LETTER E WITH ACUTE → 2-byte UTF-8.
    * A buffer of size 1 (only room for the NUL terminator) cannot hold even a
@@ -463,9 +263,10 @@ void run_json_escape_tests(void) {
   test_u20ac_three_byte_utf8();
   test_surrogate_pair_emoji();
   test_mixed_unicode_and_ascii();
-  test_lone_high_surrogate_fails();
-  test_high_surrogate_wrong_low_fails();
-  test_lone_low_surrogate_fails();
+  test_lone_high_surrogate_replaced();
+  test_high_surrogate_wrong_low_replaced();
+  test_lone_low_surrogate_replaced();
+  test_unknown_escape_fails();
   test_non_hex_unicode_escape_fails();
   test_truncated_unicode_escape_fails();
   test_len_plus_one_is_exact_buffer_size();
@@ -0,0 +1,497 @@
+/*
+ * jsonscan_tests.c — Unit tests for the streaming JSON field scanner
+ * (lib/src/jsonscan.c).
+ *
+ * Besides the hand-written cases, every document of json_corpus.h is checked
+ * against its expected values, against json-c when the build found it, fed in
+ * every chunking and mutated at random. The fuzz cases scan exact-size copies
+ * without a terminator so that sanitizer builds catch any read past the end.
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chiaki/jsonscan.h>
+
+#ifdef VITARPS5_HAVE_JSONC
+#include <json-c/json_pointer.h>
+#include <json-c/json_tokener.h>
+#endif
+
+#include "json_corpus.h"
+
+#define FUZZ_ITERATIONS 20000
+
+static ChiakiErrorCode scan(const char *json, const char *const *paths, ChiakiJsonValue *values, size_t count) {
+  return chiaki_json_scan(json, strlen(json), paths, values, count);
+}
+
+static void test_nested_paths(void) {
+  const char *json = "{\"a\":1,\"body\":{\"list\":[{\"id\":\"x\"},{\"id\":\"y\",\"n\":-42}],"
+                     "\"flag\":true,\"none\":null,\"obj\":{\"k\":[1,2]}}}";
+  const char *const paths[] = {"body.list.1.id", "body.list.1.n", "a", "body.flag", "body.none", "body.obj",
+                               "body.missing", "body.list.2.id"};
+  ChiakiJsonValue v[8];
+  assert(scan(json, paths, v, 8) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_json_value_streq(&v[0], "y"));
+  int64_t n = 0;
+  assert(chiaki_json_value_int64(&v[1], &n) == CHIAKI_ERR_SUCCESS && n == -42);
+  assert(chiaki_json_value_int64(&v[2], &n) == CHIAKI_ERR_SUCCESS && n == 1);
+  assert(v[3].type == CHIAKI_JSON_TYPE_BOOL && v[3].len == 4);
+  assert(v[4].type == CHIAKI_JSON_TYPE_NULL);
+  assert(v[5].type == CHIAKI_JSON_TYPE_OBJECT && v[5].len == strlen("{\"k\":[1,2]}"));
+  assert(memcmp(v[5].ptr, "{\"k\":[1,2]}", v[5].len) == 0);
+  assert(v[6].type == CHIAKI_JSON_TYPE_NONE);
+  assert(v[7].type == CHIAKI_JSON_TYPE_NONE);
+}
+
+static void test_stops_when_all_found(void) {
+  // Everything after the last wanted field is never looked at.
+  const char *json = "{\"dataType\":\"t\",\"body\": this is not json";
+  const char *const paths[] = {"dataType"};
+  ChiakiJsonValue v;
+  assert(scan(json, paths, &v, 1) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_json_value_streq(&v, "t"));
+
+  // But a missing field means reading it all.
+  const char *const missing[] = {"dataType", "other"};
+  ChiakiJsonValue v2[2];
+  assert(scan(json, missing, v2, 2) == CHIAKI_ERR_INVALID_DATA);
+}
+
+static void test_skipped_subtrees(void) {
+  // Brackets and quotes inside strings of skipped values must not confuse the skipper.
+  const char *json = "{\"skip\":{\"s\":\"}]\\\"{[\",\"a\":[[],{},\"\\\\\"]},\"key.with.dots\":1,\"want\":\"ok\"}";
+  const char *const paths[] = {"want", "key"};
+  ChiakiJsonValue v[2];
+  assert(scan(json, paths, v, 2) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_json_value_streq(&v[0], "ok"));
+  assert(v[1].type == CHIAKI_JSON_TYPE_NONE);
+}
+
+static void test_missing_value_is_null(void) {
+  // PSN session messages leave out the value of localPeerAddr.
+  const char *json = "{\"localPeerAddr\":,\"reqId\":3,\"last\":}";
+  const char *const paths[] = {"localPeerAddr", "reqId", "last"};
+  ChiakiJsonValue v[3];
+  assert(scan(json, paths, v, 3) == CHIAKI_ERR_SUCCESS);
+  assert(v[0].type == CHIAKI_JSON_TYPE_NULL && v[0].len == 0);
+  int64_t n = 0;
+  assert(chiaki_json_value_int64(&v[1], &n) == CHIAKI_ERR_SUCCESS && n == 3);
+  assert(v[2].type == CHIAKI_JSON_TYPE_NULL);
+}
+
+static void test_duplicate_keys(void) {
+  const char *json = "{\"k\":\"first\",\"k\":\"second\"}";
+  const char *const paths[] = {"k"};
+  ChiakiJsonValue v;
+  assert(scan(json, paths, &v, 1) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_json_value_streq(&v, "first"));
+}
+
+static void test_unescape(void) {
+  const char *json = "{\"s\":\"a\\\"b\\\\c\\/d\\n\\u00e9\\u20ac\\ud83d\\ude00\\ud800x\"}";
+  const char *const paths[] = {"s"};
+  ChiakiJsonValue v;
+  assert(scan(json, paths, &v, 1) == CHIAKI_ERR_SUCCESS);
+  assert(v.escaped);
+  const char *expected = "a\"b\\c/d\n\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\xef\xbf\xbdx";
+  char out[64];
+  size_t len = 0;
+  assert(chiaki_json_unescape(&v, out, sizeof(out), &len) == CHIAKI_ERR_SUCCESS);
+  assert(len == strlen(expected) && strcmp(out, expected) == 0);
+  assert(chiaki_json_value_streq(&v, expected));
+  assert(!chiaki_json_value_streq(&v, "a\"b"));
+
+  // Exactly fitting, then one byte short
+  char small[32];
+  assert(chiaki_json_unescape(&v, small, len + 1, NULL) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_json_unescape(&v, small, len, NULL) == CHIAKI_ERR_BUF_TOO_SMALL);
+
+  const char *bad = "{\"s\":\"\\x\",\"t\":\"\\u12\"}";
+  const char *const bad_paths[] = {"s", "t"};
+  ChiakiJsonValue bv[2];
+  assert(scan(bad, bad_paths, bv, 2) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_json_unescape(&bv[0], out, sizeof(out), NULL) == CHIAKI_ERR_INVALID_DATA);
+  assert(chiaki_json_unescape(&bv[1], out, sizeof(out), NULL) == CHIAKI_ERR_INVALID_DATA);
+}
+
+static void test_numbers(void) {
+  const char *json = "{\"f\":1.5,\"big\":99999999999999999999,\"max\":9223372036854775807,\"s\":\"1\"}";
+  const char *const paths[] = {"f", "big", "max", "s"};
+  ChiakiJsonValue v[4];
+  int64_t n = 0;
+  assert(scan(json, paths, v, 4) == CHIAKI_ERR_SUCCESS);
+  assert(v[0].type == CHIAKI_JSON_TYPE_NUMBER);
+  assert(chiaki_json_value_int64(&v[0], &n) == CHIAKI_ERR_INVALID_DATA);
+  assert(chiaki_json_value_int64(&v[1], &n) == CHIAKI_ERR_OVERFLOW);
+  assert(chiaki_json_value_int64(&v[2], &n) == CHIAKI_ERR_SUCCESS && n == INT64_MAX);
+  assert(chiaki_json_value_int64(&v[3], &n) == CHIAKI_ERR_INVALID_DATA);
+}
+
+static void test_malformed(void) {
+  const char *const paths[] = {"a.b"};
+  ChiakiJsonValue v;
+  const char *docs[] = {"", "{", "{\"a\":{\"b\"", "{\"a\" 1}", "{\"a\":{\"b\":tru}}", "{\"a\":[1 2]}",
+                        "{\"a\":{\"b\":\"unterminated}}"};
+  for (size_t i = 0; i < sizeof(docs) / sizeof(docs[0]); i++)
+    assert(scan(docs[i], paths, &v, 1) == CHIAKI_ERR_INVALID_DATA);
+
+  // Not an object at the top: valid, nothing found
+  assert(scan("[1,2]", paths, &v, 1) == CHIAKI_ERR_SUCCESS && v.type == CHIAKI_JSON_TYPE_NONE);
+
+  // Nesting deeper than the limit along a wanted path
+  char deep[2 * CHIAKI_JSON_SCAN_DEPTH_MAX + 8];
+  size_t n = 0;
+  for (size_t i = 0; i <= CHIAKI_JSON_SCAN_DEPTH_MAX; i++)
+    deep[n++] = '[';
+  for (size_t i = 0; i <= CHIAKI_JSON_SCAN_DEPTH_MAX; i++)
+    deep[n++] = ']';
+  deep[n] = '\0';
+  const char *const deep_path[] = {"0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0"};
+  assert(scan(deep, deep_path, &v, 1) == CHIAKI_ERR_INVALID_DATA);
+
+  const char *too_many[CHIAKI_JSON_SCAN_PATHS_MAX + 1];
+  ChiakiJsonValue values[CHIAKI_JSON_SCAN_PATHS_MAX + 1];
+  for (size_t i = 0; i < CHIAKI_JSON_SCAN_PATHS_MAX + 1; i++)
+    too_many[i] = "a";
+  assert(scan("{}", too_many, values, CHIAKI_JSON_SCAN_PATHS_MAX + 1) == CHIAKI_ERR_OVERFLOW);
+}
+
+static size_t path_count(const JsonCorpusDoc *doc) {
+  size_t n = 0;
+  while (n < JSON_CORPUS_PATHS_MAX && doc->paths[n])
+    n++;
+  return n;
+}
+
+/* Copy without a terminator, reads past len are caught by ASan. */
+static char *exact_copy(const char *data, size_t len) {
+  char *copy = malloc(len ? len : 1);
+  assert(copy);
+  memcpy(copy, data, len);
+  return copy;
+}
+
+/* Render a value the way json_corpus.h writes expectations. */
+static void render(const ChiakiJsonValue *v, char *out, size_t out_size) {
+  switch (v->type) {
+  case CHIAKI_JSON_TYPE_STRING:
+    assert(chiaki_json_unescape(v, out, out_size, NULL) == CHIAKI_ERR_SUCCESS);
+    break;
+  case CHIAKI_JSON_TYPE_OBJECT:
+    snprintf(out, out_size, "{...}");
+    break;
+  case CHIAKI_JSON_TYPE_ARRAY:
+    snprintf(out, out_size, "[...]");
+    break;
+  default:
+    assert(v->len < out_size);
+    memcpy(out, v->ptr, v->len);
+    out[v->len] = '\0';
+    break;
+  }
+}
+
+static void test_corpus(void) {
+  for (size_t d = 0; d < JSON_CORPUS_DOCS; d++) {
+    const JsonCorpusDoc *doc = &json_corpus[d];
+    size_t len = strlen(doc->json);
+    size_t count = path_count(doc);
+    char *json = exact_copy(doc->json, len);
+    ChiakiJsonValue v[JSON_CORPUS_PATHS_MAX];
+    assert(chiaki_json_scan(json, len, doc->paths, v, count) == CHIAKI_ERR_SUCCESS);
+    for (size_t i = 0; i < count; i++) {
+      if (!doc->expected[i]) {
+        assert(v[i].type == CHIAKI_JSON_TYPE_NONE);
+        continue;
+      }
+      char rendered[256];
+      render(&v[i], rendered, sizeof(rendered));
+      if (strcmp(rendered, doc->expected[i]) != 0) {
+        fprintf(stderr, "%s %s: got '%s' expected '%s'\n", doc->name, doc->paths[i], rendered,
+                doc->expected[i]);
+        assert(0);
+      }
+      if (v[i].type == CHIAKI_JSON_TYPE_STRING)
+        assert(chiaki_json_value_streq(&v[i], doc->expected[i]));
+    }
+    free(json);
+  }
+}
+
+#ifdef VITARPS5_HAVE_JSONC
+/* Every corpus path must read the same through json-c's tree and pointers. */
+static void test_corpus_matches_json_c(void) {
+  for (size_t d = 0; d < JSON_CORPUS_DOCS; d++) {
+    const JsonCorpusDoc *doc = &json_corpus[d];
+    size_t count = path_count(doc);
+    json_object *root = json_tokener_parse(doc->json);
+    assert(root);
+    ChiakiJsonValue v[JSON_CORPUS_PATHS_MAX];
+    assert(chiaki_json_scan(doc->json, strlen(doc->json), doc->paths, v, count) == CHIAKI_ERR_SUCCESS);
+    for (size_t i = 0; i < count; i++) {
+      char pointer[128] = "/";
+      size_t n = 1;
+      for (const char *c = doc->paths[i]; *c && n + 1 < sizeof(pointer); c++)
+        pointer[n++] = *c == '.' ? '/' : *c;
+      pointer[n] = '\0';
+
+      json_object *obj = NULL;
+      if (json_pointer_get(root, pointer, &obj) != 0) {
+        assert(v[i].type == CHIAKI_JSON_TYPE_NONE);
+        continue;
+      }
+      char ours[256];
+      switch (json_object_get_type(obj)) {
+      case json_type_null:
+        assert(v[i].type == CHIAKI_JSON_TYPE_NULL);
+        break;
+      case json_type_boolean:
+        assert(v[i].type == CHIAKI_JSON_TYPE_BOOL);
+        render(&v[i], ours, sizeof(ours));
+        assert(strcmp(ours, json_object_get_boolean(obj) ? "true" : "false") == 0);
+        break;
+      case json_type_int: {
+        int64_t n64 = 0;
+        assert(chiaki_json_value_int64(&v[i], &n64) == CHIAKI_ERR_SUCCESS);
+        assert(n64 == json_object_get_int64(obj));
+        break;
+      }
+      case json_type_double:
+        assert(v[i].type == CHIAKI_JSON_TYPE_NUMBER);
+        break;
+      case json_type_string: {
+        size_t ours_len = 0;
+        assert(chiaki_json_unescape(&v[i], ours, sizeof(ours), &ours_len) == CHIAKI_ERR_SUCCESS);
+        assert(ours_len == json_object_get_string_len(obj));
+        assert(memcmp(ours, json_object_get_string(obj), ours_len) == 0);
+        break;
+      }
+      case json_type_object:
+        assert(v[i].type == CHIAKI_JSON_TYPE_OBJECT);
+        break;
+      case json_type_array:
+        assert(v[i].type == CHIAKI_JSON_TYPE_ARRAY);
+        break;
+      }
+    }
+    json_object_put(root);
+  }
+}
+#endif
+
+static void assert_same_scan(const ChiakiJsonValue *a, const ChiakiJsonValue *b, size_t count,
+                             const char *base_a, const char *base_b) {
+  for (size_t i = 0; i < count; i++) {
+    assert(a[i].type == b[i].type);
+    if (a[i].type == CHIAKI_JSON_TYPE_NONE)
+      continue;
+    assert(a[i].ptr - base_a == b[i].ptr - base_b);
+    assert(a[i].len == b[i].len && a[i].escaped == b[i].escaped);
+  }
+}
+
+/* Offset just past the last closing bracket, where the feed must report completion. */
+static size_t complete_offset(const char *json) {
+  size_t end = strlen(json);
+  while (end && json[end - 1] != '}' && json[end - 1] != ']')
+    end--;
+  return end;
+}
+
+static void test_feed_chunks(void) {
+  for (size_t d = 0; d < JSON_CORPUS_DOCS; d++) {
+    const JsonCorpusDoc *doc = &json_corpus[d];
+    size_t len = strlen(doc->json);
+    size_t count = path_count(doc);
+    size_t done_at = complete_offset(doc->json);
+    ChiakiJsonValue whole[JSON_CORPUS_PATHS_MAX];
+    assert(chiaki_json_scan(doc->json, len, doc->paths, whole, count) == CHIAKI_ERR_SUCCESS);
+
+    for (size_t chunk = 1; chunk <= 7; chunk++) {
+      char *buf = malloc(len + 1);
+      assert(buf);
+      ChiakiJsonFeed feed;
+      chiaki_json_feed_init(&feed, buf, len + 1);
+      for (size_t off = 0; off < len; off += chunk) {
+        size_t n = len - off < chunk ? len - off : chunk;
+        assert(chiaki_json_feed_append(&feed, doc->json + off, n) == CHIAKI_ERR_SUCCESS);
+        assert(chiaki_json_feed_complete(&feed) == (off + n >= done_at));
+        assert(feed.buf[feed.len] == '\0');
+      }
+      assert(feed.len == len && memcmp(buf, doc->json, len) == 0);
+      ChiakiJsonValue fed[JSON_CORPUS_PATHS_MAX];
+      assert(chiaki_json_feed_scan(&feed, doc->paths, fed, count) == CHIAKI_ERR_SUCCESS);
+      assert_same_scan(fed, whole, count, buf, doc->json);
+      free(buf);
+    }
+  }
+}
+
+static void test_feed_limits(void) {
+  // A body larger than the buffer: the tail is dropped, fields before the cut are still read.
+  const JsonCorpusDoc *token = &json_corpus[0];
+  char buf[64];
+  ChiakiJsonFeed feed;
+  chiaki_json_feed_init(&feed, buf, sizeof(buf));
+  assert(chiaki_json_feed_append(&feed, token->json, strlen(token->json)) == CHIAKI_ERR_BUF_TOO_SMALL);
+  assert(feed.truncated && feed.len == sizeof(buf) - 1 && buf[feed.len] == '\0');
+  assert(!chiaki_json_feed_complete(&feed));
+  assert(chiaki_json_feed_append(&feed, "}", 1) == CHIAKI_ERR_BUF_TOO_SMALL);
+  const char *const paths[] = {"access_token", "expires_in"};
+  ChiakiJsonValue v[2];
+  assert(chiaki_json_feed_scan(&feed, paths, v, 1) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_json_value_streq(&v[0], "e8b9c6d2-5a3f-4b71-9c0e-7f2a1d3b4c5e"));
+  assert(chiaki_json_feed_scan(&feed, paths, v, 2) == CHIAKI_ERR_INVALID_DATA);
+  assert(v[0].type == CHIAKI_JSON_TYPE_STRING && v[1].type == CHIAKI_JSON_TYPE_NONE);
+
+  // Brackets and escaped quotes inside strings don't count, split anywhere
+  const char *tricky = "{\"a\":\"}]\\\"{\",\"b\":[\"\\\\\"]}";
+  size_t tricky_len = strlen(tricky);
+  for (size_t split = 0; split <= tricky_len; split++) {
+    char tbuf[64];
+    chiaki_json_feed_init(&feed, tbuf, sizeof(tbuf));
+    assert(chiaki_json_feed_append(&feed, tricky, split) == CHIAKI_ERR_SUCCESS);
+    assert(chiaki_json_feed_complete(&feed) == (split == tricky_len));
+    assert(chiaki_json_feed_append(&feed, tricky + split, tricky_len - split) == CHIAKI_ERR_SUCCESS);
+    assert(chiaki_json_feed_complete(&feed));
+  }
+
+  chiaki_json_feed_init(&feed, buf, sizeof(buf));
+  assert(chiaki_json_feed_append(&feed, " ]", 2) == CHIAKI_ERR_INVALID_DATA);
+  assert(chiaki_json_feed_append(&feed, "{}", 2) == CHIAKI_ERR_INVALID_DATA);
+
+  // A zero-size buffer takes nothing
+  chiaki_json_feed_init(&feed, NULL, 0);
+  assert(chiaki_json_feed_append(&feed, "{}", 2) == CHIAKI_ERR_BUF_TOO_SMALL);
+  assert(feed.len == 0);
+}
+
+static uint32_t fuzz_next(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+/* Everything the scanner hands out must stay inside the document and decode safely. */
+static void check_fuzz_values(const char *json, size_t len, const ChiakiJsonValue *v, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (v[i].type == CHIAKI_JSON_TYPE_NONE)
+      continue;
+    assert(v[i].ptr >= json && v[i].ptr + v[i].len <= json + len);
+    if (v[i].type == CHIAKI_JSON_TYPE_STRING) {
+      char *out = malloc(v[i].len + 1);
+      assert(out);
+      size_t out_len = 0;
+      ChiakiErrorCode err = chiaki_json_unescape(&v[i], out, v[i].len + 1, &out_len);
+      assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_INVALID_DATA);
+      if (err == CHIAKI_ERR_SUCCESS)
+        assert(out_len <= v[i].len && out[out_len] == '\0');
+      free(out);
+      (void)chiaki_json_value_streq(&v[i], "x");
+    }
+    int64_t n;
+    (void)chiaki_json_value_int64(&v[i], &n);
+  }
+}
+
+/* Scan json whole and through a feed in random chunks, both must agree. */
+static void fuzz_one(uint32_t *rng, const char *data, size_t len, const char *const *paths, size_t count) {
+  char *json = exact_copy(data, len);
+  ChiakiJsonValue whole[JSON_CORPUS_PATHS_MAX];
+  ChiakiErrorCode err = chiaki_json_scan(json, len, paths, whole, count);
+  assert(err == CHIAKI_ERR_SUCCESS || err == CHIAKI_ERR_INVALID_DATA);
+  check_fuzz_values(json, len, whole, count);
+
+  char *buf = malloc(len + 1);
+  assert(buf);
+  ChiakiJsonFeed feed;
+  chiaki_json_feed_init(&feed, buf, len + 1);
+  for (size_t off = 0; off < len;) {
+    size_t n = 1 + fuzz_next(rng) % 16;
+    if (n > len - off)
+      n = len - off;
+    ChiakiErrorCode feed_err = chiaki_json_feed_append(&feed, json + off, n);
+    assert(feed_err == CHIAKI_ERR_SUCCESS || feed_err == CHIAKI_ERR_INVALID_DATA);
+    off += n;
+  }
+  assert(feed.len == len && !feed.truncated);
+  ChiakiJsonValue fed[JSON_CORPUS_PATHS_MAX];
+  assert(chiaki_json_feed_scan(&feed, paths, fed, count) == err);
+  assert_same_scan(fed, whole, count, buf, json);
+  free(buf);
+  free(json);
+}
+
+static void test_fuzz_mutations(void) {
+  static const char alphabet[] = "{}[]\":,\\u0aeE-+.tfn \x01\xff";
+  uint32_t rng = 0x9e3779b9u;
+  char scratch[2048];
+  for (int iter = 0; iter < FUZZ_ITERATIONS; iter++) {
+    const JsonCorpusDoc *doc = &json_corpus[fuzz_next(&rng) % JSON_CORPUS_DOCS];
+    size_t len = strlen(doc->json);
+    assert(len <= sizeof(scratch));
+    memcpy(scratch, doc->json, len);
+    int mutations = 1 + fuzz_next(&rng) % 4;
+    for (int m = 0; m < mutations && len; m++) {
+      size_t at = fuzz_next(&rng) % len;
+      switch (fuzz_next(&rng) % 4) {
+      case 0: // replace with a structural character
+        scratch[at] = alphabet[fuzz_next(&rng) % (sizeof(alphabet) - 1)];
+        break;
+      case 1: // replace with any byte
+        scratch[at] = (char)fuzz_next(&rng);
+        break;
+      case 2: // delete
+        memmove(scratch + at, scratch + at + 1, len - at - 1);
+        len--;
+        break;
+      default: // truncate
+        len = at;
+        break;
+      }
+    }
+    fuzz_one(&rng, scratch, len, doc->paths, path_count(doc));
+  }
+}
+
+static void test_fuzz_random(void) {
+  static const char alphabet[] = "{}[]\":,\\ua0-1.etrufalsn";
+  static const char *const paths[] = {"a", "a.0", "0", "0.a", "u.1.e", ""};
+  uint32_t rng = 0x2545f491u;
+  char doc[64];
+  for (int iter = 0; iter < FUZZ_ITERATIONS; iter++) {
+    size_t len = fuzz_next(&rng) % sizeof(doc);
+    for (size_t i = 0; i < len; i++)
+      doc[i] = alphabet[fuzz_next(&rng) % (sizeof(alphabet) - 1)];
+    if (len)
+      doc[0] = (fuzz_next(&rng) & 1) ? '{' : '[';
+    fuzz_one(&rng, doc, len, paths, sizeof(paths) / sizeof(paths[0]));
+  }
+}
+
+void run_jsonscan_tests(void) {
+  test_nested_paths();
+  test_stops_when_all_found();
+  test_skipped_subtrees();
+  test_missing_value_is_null();
+  test_duplicate_keys();
+  test_unescape();
+  test_numbers();
+  test_malformed();
+  test_corpus();
+#ifdef VITARPS5_HAVE_JSONC
+  test_corpus_matches_json_c();
+#endif
+  test_feed_chunks();
+  test_feed_limits();
+  test_fuzz_mutations();
+  test_fuzz_random();
+}
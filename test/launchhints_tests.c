@@ -0,0 +1,142 @@
+/*
+ * launchhints_tests.c — Unit tests for the LaunchSpec network hints
+ * (lib/src/launchhints.c) and their place in the LaunchSpec json
+ * (lib/src/launchspec.c).
+ *
+ * Covers the zeroed policy sending the old fixed hints, the loss derived from
+ * the history, the bitrate cap that only a lossy history may apply, and the
+ * history's smoothing. test/bench/launchhints_bench.c maps the hints to
+ * early-stream loss on netsim scenarios.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <chiaki/launchhints.h>
+#include <chiaki/launchspec.h>
+#include <chiaki/session.h>
+
+static ChiakiLinkHistory history_of(double loss, uint32_t throughput_kbps) {
+  ChiakiLinkHistory history;
+  memset(&history, 0, sizeof(history));
+  chiaki_link_history_observe(&history, loss, throughput_kbps);
+  return history;
+}
+
+static void test_zeroed_policy(void) {
+  ChiakiLaunchHintsPolicy policy;
+  memset(&policy, 0, sizeof(policy));
+  ChiakiLinkHistory history = history_of(0.2, 3000);
+  ChiakiLaunchHints hints;
+  chiaki_launch_hints_derive(&policy, &history, 15000, 1454, 2900, true, &hints);
+  assert(hints.bw_kbps == 15000);
+  assert(hints.bw_loss == CHIAKI_LAUNCH_HINTS_LOSS_DEFAULT);
+  assert(hints.mtu == 1454 && hints.rtt_ms == 2);
+  assert(hints.sources == CHIAKI_LAUNCH_HINTS_SOURCE_LINK_MEASURED);
+}
+
+static void test_loss_from_history(void) {
+  ChiakiLaunchHintsPolicy policy;
+  chiaki_launch_hints_policy_defaults(&policy);
+  ChiakiLaunchHints hints;
+
+  // Nothing known: the default loss, the requested bitrate.
+  chiaki_launch_hints_derive(&policy, NULL, 15000, 1454, 5000, false, &hints);
+  assert(hints.bw_kbps == 15000 && hints.bw_loss == policy.loss_default);
+  assert(hints.rtt_ms == 5 && hints.sources == 0);
+
+  // A clean link reports the floor, a lossy one its scaled loss, capped.
+  ChiakiLinkHistory history = history_of(0.0, 14000);
+  chiaki_launch_hints_derive(&policy, &history, 15000, 1454, 5000, true, &hints);
+  assert(hints.bw_loss == policy.loss_min && hints.bw_kbps == 15000);
+  assert(hints.sources == (CHIAKI_LAUNCH_HINTS_SOURCE_LINK_MEASURED | CHIAKI_LAUNCH_HINTS_SOURCE_HISTORY));
+  history = history_of(0.01, 14000);
+  chiaki_launch_hints_derive(&policy, &history, 15000, 1454, 5000, true, &hints);
+  assert(hints.bw_loss > 0.0149 && hints.bw_loss < 0.0151 && hints.bw_kbps == 15000);
+  history = history_of(0.5, 14000);
+  chiaki_launch_hints_derive(&policy, &history, 15000, 1454, 5000, true, &hints);
+  assert(hints.bw_loss == policy.loss_max);
+
+  policy.rtt_margin_ms = 10;
+  chiaki_launch_hints_derive(&policy, &history, 15000, 1454, 5000, true, &hints);
+  assert(hints.rtt_ms == 15);
+}
+
+static void test_bitrate_cap(void) {
+  ChiakiLaunchHintsPolicy policy;
+  chiaki_launch_hints_policy_defaults(&policy);
+  ChiakiLaunchHints hints;
+
+  // Lossy at 8 Mbps: claim 90% of it.
+  ChiakiLinkHistory history = history_of(0.05, 8000);
+  chiaki_launch_hints_derive(&policy, &history, 15000, 1454, 5000, true, &hints);
+  assert(hints.bw_kbps == 7200);
+  assert(hints.sources & CHIAKI_LAUNCH_HINTS_SOURCE_BW_CAPPED);
+
+  // Clean at 8 Mbps says nothing about the link, no ratchet down.
+  history = history_of(0.005, 8000);
+  chiaki_launch_hints_derive(&policy, &history, 15000, 1454, 5000, true, &hints);
+  assert(hints.bw_kbps == 15000 && !(hints.sources & CHIAKI_LAUNCH_HINTS_SOURCE_BW_CAPPED));
+
+  // Never below the floor, never above the request.
+  history = history_of(0.3, 500);
+  chiaki_launch_hints_derive(&policy, &history, 15000, 1454, 5000, true, &hints);
+  assert(hints.bw_kbps == policy.bw_min_kbps);
+  chiaki_launch_hints_derive(&policy, &history, 1500, 1454, 5000, true, &hints);
+  assert(hints.bw_kbps == 1500 && !(hints.sources & CHIAKI_LAUNCH_HINTS_SOURCE_BW_CAPPED));
+
+  policy.bw_headroom = 0.0;
+  history = history_of(0.05, 8000);
+  chiaki_launch_hints_derive(&policy, &history, 15000, 1454, 5000, true, &hints);
+  assert(hints.bw_kbps == 15000);
+}
+
+static void test_history_smoothing(void) {
+  ChiakiLinkHistory history;
+  memset(&history, 0, sizeof(history));
+  // The first four observations are averaged...
+  chiaki_link_history_observe(&history, 0.04, 8000);
+  chiaki_link_history_observe(&history, 0.0, 12000);
+  assert(history.sessions == 2 && history.throughput_kbps == 10000);
+  assert(history.loss > 0.0199 && history.loss < 0.0201);
+  chiaki_link_history_observe(&history, 0.0, 10000);
+  chiaki_link_history_observe(&history, 0.0, 10000);
+  assert(history.loss > 0.0099 && history.loss < 0.0101);
+  // ...later ones weigh a quarter.
+  chiaki_link_history_observe(&history, 0.08, 14000);
+  assert(history.sessions == 5 && history.throughput_kbps == 11000);
+  assert(history.loss > 0.0274 && history.loss < 0.0276);
+  // Out of range input is clamped.
+  memset(&history, 0, sizeof(history));
+  chiaki_link_history_observe(&history, 3.0, 1000);
+  assert(history.loss == 1.0);
+}
+
+static void test_launchspec_json(void) {
+  uint8_t handshake_key[CHIAKI_HANDSHAKE_KEY_SIZE] = {0};
+  ChiakiLaunchSpec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.target = CHIAKI_TARGET_PS5_1;
+  spec.mtu = 1454;
+  spec.rtt = 3;
+  spec.handshake_key = handshake_key;
+  spec.width = 1280;
+  spec.height = 720;
+  spec.max_fps = 60;
+  spec.codec = CHIAKI_CODEC_H264;
+  spec.bw_kbps_sent = 7200;
+  spec.bw_loss = 0.015;
+  char json[1024];
+  assert(chiaki_launchspec_format(json, sizeof(json), &spec) > 0);
+  assert(strstr(json, "\"bwKbpsSent\":7200,\"bwLoss\":0.015000,\"mtu\":1454,\"rtt\":3,"));
+}
+
+void run_launchhints_tests(void) {
+  test_zeroed_policy();
+  test_loss_from_history();
+  test_bitrate_cap();
+  test_history_smoothing();
+  test_launchspec_json();
+}
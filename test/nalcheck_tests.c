@@ -0,0 +1,627 @@
+/*
+ * nalcheck_tests.c — Unit tests for the pre-decode conformance checker
+ * (lib/src/nalcheck.c).
+ *
+ * Access units are written here bit by bit, with emulation prevention, so
+ * every field is known. Covers valid H.264 and H.265 pictures, checking
+ * without parameter sets, truncated slice headers, forbidden zero runs,
+ * slices out of order or disagreeing, broken NAL headers and parameter
+ * sets, and a deterministic mutation fuzz of both codecs: whatever the
+ * damage, the checker stays within the buffer and what it calls valid
+ * checks OK on its own. test/bench/nalcheck_bench.c measures throughput.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <chiaki/nalcheck.h>
+
+#define AU_MAX 8192
+#define RBSP_MAX 2048
+
+typedef struct {
+  uint8_t buf[RBSP_MAX];
+  size_t bits;
+} BitWriter;
+
+typedef struct {
+  uint8_t buf[AU_MAX];
+  size_t size;
+} AccessUnit;
+
+static void bw_u(BitWriter *w, unsigned bits, uint32_t v) {
+  for (unsigned i = bits; i > 0; i--) {
+    assert(w->bits < RBSP_MAX * 8);
+    if ((v >> (i - 1)) & 1)
+      w->buf[w->bits / 8] |= (uint8_t)(0x80 >> (w->bits % 8));
+    w->bits++;
+  }
+}
+
+static void bw_ue(BitWriter *w, uint32_t v) {
+  uint64_t code = (uint64_t)v + 1;
+  unsigned len = 0;
+  while ((code >> len) > 1)
+    len++;
+  bw_u(w, len, 0);
+  bw_u(w, 1, 1);
+  bw_u(w, len, (uint32_t)(code & ((1ull << len) - 1)));
+}
+
+static void bw_se(BitWriter *w, int32_t v) {
+  bw_ue(w, v > 0 ? (uint32_t)(2 * v - 1) : (uint32_t)(-2 * v));
+}
+
+static uint64_t rng_next(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+/* Slice data: bytes heavy in zeros, so emulation prevention is exercised. */
+static void bw_payload(BitWriter *w, size_t bytes, uint64_t *rng) {
+  for (size_t i = 0; i < bytes; i++) {
+    uint64_t r = rng_next(rng);
+    bw_u(w, 8, (r & 3) ? 0 : (uint32_t)(r >> 8) & 0xff);
+  }
+}
+
+/* Appends a NAL unit with a 4-byte start code: the header bytes, then the
+ * RBSP with its stop bit, escaped. */
+static void au_nal(AccessUnit *au, const uint8_t *header, size_t header_size, BitWriter *w) {
+  bw_u(w, 1, 1);
+  while (w->bits % 8)
+    bw_u(w, 1, 0);
+  static const uint8_t start_code[] = {0, 0, 0, 1};
+  memcpy(au->buf + au->size, start_code, 4);
+  au->size += 4;
+  memcpy(au->buf + au->size, header, header_size);
+  au->size += header_size;
+  unsigned zeros = 0;
+  for (size_t i = 0; i < w->bits / 8; i++) {
+    uint8_t b = w->buf[i];
+    if (zeros >= 2 && b <= 3) {
+      au->buf[au->size++] = 3;
+      zeros = 0;
+    }
+    au->buf[au->size++] = b;
+    zeros = b ? 0 : zeros + 1;
+    assert(au->size < AU_MAX - 16);
+  }
+  memset(w, 0, sizeof(*w));
+}
+
+/* H.264: 1280x720 High profile, 3600 macroblocks, frame_num in 4 bits, POC
+ * lsb in 6. */
+#define H264_PIC_SIZE 3600
+
+static void h264_params(AccessUnit *au) {
+  BitWriter w;
+  memset(&w, 0, sizeof(w));
+  bw_u(&w, 8, 100);  // profile_idc
+  bw_u(&w, 8, 0);
+  bw_u(&w, 8, 42);  // level_idc
+  bw_ue(&w, 0);  // sps_id
+  bw_ue(&w, 1);  // chroma_format_idc
+  bw_ue(&w, 0);
+  bw_ue(&w, 0);
+  bw_u(&w, 1, 0);
+  bw_u(&w, 1, 0);  // no scaling matrix
+  bw_ue(&w, 0);  // log2_max_frame_num_minus4
+  bw_ue(&w, 0);  // poc type
+  bw_ue(&w, 2);  // log2_max_poc_lsb_minus4
+  bw_ue(&w, 1);  // max_num_ref_frames
+  bw_u(&w, 1, 0);
+  bw_ue(&w, 79);  // 80 macroblocks wide
+  bw_ue(&w, 44);  // 45 high
+  bw_u(&w, 1, 1);  // frame_mbs_only
+  bw_u(&w, 1, 1);
+  bw_u(&w, 1, 0);
+  bw_u(&w, 1, 0);
+  au_nal(au, (const uint8_t[]){0x67}, 1, &w);
+
+  bw_ue(&w, 0);  // pps_id
+  bw_ue(&w, 0);  // sps_id
+  bw_u(&w, 1, 1);  // CABAC
+  bw_u(&w, 1, 0);
+  bw_ue(&w, 0);  // one slice group
+  bw_ue(&w, 0);
+  bw_ue(&w, 0);
+  bw_u(&w, 3, 0);
+  bw_se(&w, 0);
+  bw_se(&w, 0);
+  bw_se(&w, 0);
+  bw_u(&w, 3, 4);
+  au_nal(au, (const uint8_t[]){0x68}, 1, &w);
+}
+
+static void h264_slice(AccessUnit *au, bool idr, uint32_t first_mb, uint32_t frame_num,
+                       uint32_t pps_id, size_t payload, uint64_t *rng) {
+  BitWriter w;
+  memset(&w, 0, sizeof(w));
+  bw_ue(&w, first_mb);
+  bw_ue(&w, idr ? 7 : 5);  // I or P, all slices the same type
+  bw_ue(&w, pps_id);
+  bw_u(&w, 4, frame_num);
+  if (idr)
+    bw_ue(&w, 0);  // idr_pic_id
+  bw_u(&w, 6, (frame_num * 2) & 0x3f);  // pic_order_cnt_lsb
+  bw_payload(&w, payload, rng);
+  au_nal(au, (const uint8_t[]){idr ? 0x65 : 0x41}, 1, &w);
+}
+
+/* SPS and PPS, then an IDR picture in three slices. Offsets of the slices'
+ * start codes are returned in slice_offsets. */
+static void h264_idr_au(AccessUnit *au, size_t slice_offsets[3], uint64_t seed) {
+  uint64_t rng = seed;
+  au->size = 0;
+  h264_params(au);
+  static const uint32_t first_mbs[] = {0, 1200, 2400};
+  for (int i = 0; i < 3; i++) {
+    if (slice_offsets)
+      slice_offsets[i] = au->size;
+    h264_slice(au, true, first_mbs[i], 0, 0, 300, &rng);
+  }
+}
+
+static ChiakiNalCheckResult check_au(ChiakiNalCheck *check, const AccessUnit *au) {
+  ChiakiNalCheckResult result;
+  chiaki_nal_check(check, au->buf, au->size, &result);
+  return result;
+}
+
+static void test_strings(void) {
+  assert(strcmp(chiaki_nal_check_verdict_string(CHIAKI_NAL_CHECK_DAMAGED), "damaged") == 0);
+  assert(strcmp(chiaki_nal_check_error_string(CHIAKI_NAL_CHECK_ERROR_SLICE_ORDER), "slice_order") == 0);
+}
+
+static void test_h264_valid(void) {
+  ChiakiNalCheck check;
+  chiaki_nal_check_init(&check, CHIAKI_CODEC_H264);
+  AccessUnit au;
+  h264_idr_au(&au, NULL, 1);
+  ChiakiNalCheckResult r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_OK && r.error == CHIAKI_NAL_CHECK_ERROR_NONE);
+  assert(r.valid_size == au.size && r.nal_units == 5 && r.slices == 3);
+  assert(r.random_access && r.pic_size == H264_PIC_SIZE && r.pic_size_valid == H264_PIC_SIZE);
+  assert(check.params_known && check.sps[0].valid && check.pps[0].valid);
+
+  // A P picture behind an access unit delimiter, with trailing zeros.
+  uint64_t rng = 2;
+  au.size = 0;
+  BitWriter w;
+  memset(&w, 0, sizeof(w));
+  bw_u(&w, 3, 1);
+  au_nal(&au, (const uint8_t[]){0x09}, 1, &w);
+  h264_slice(&au, false, 0, 1, 0, 500, &rng);
+  h264_slice(&au, false, 1800, 1, 0, 500, &rng);
+  memset(au.buf + au.size, 0, 6);
+  au.size += 6;
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_OK && r.slices == 2 && !r.random_access);
+
+  // Parameter sets alone, like the header of a video profile.
+  au.size = 0;
+  h264_params(&au);
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_OK && r.slices == 0 && r.pic_size_valid == 0);
+  assert(check.checked == 3 && check.verdicts[CHIAKI_NAL_CHECK_OK] == 3);
+}
+
+static void test_h264_without_params(void) {
+  // Only the structure is checked until parameter sets are seen.
+  ChiakiNalCheck check;
+  chiaki_nal_check_init(&check, CHIAKI_CODEC_H264);
+  uint64_t rng = 3;
+  AccessUnit au = {0};
+  h264_slice(&au, false, 0, 5, 7, 200, &rng);
+  h264_slice(&au, false, 100, 5, 7, 200, &rng);
+  ChiakiNalCheckResult r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_OK && r.slices == 2 && r.pic_size == 0);
+
+  au.size = 0;
+  h264_slice(&au, false, 100, 5, 7, 200, &rng);
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_MALFORMED && r.error == CHIAKI_NAL_CHECK_ERROR_SLICE_ORDER);
+  assert(r.valid_size == 0);
+
+  // Once they are known, slices have to refer to them.
+  au.size = 0;
+  h264_params(&au);
+  h264_slice(&au, false, 0, 5, 7, 200, &rng);
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_MALFORMED);
+  assert(r.error == CHIAKI_NAL_CHECK_ERROR_UNKNOWN_PARAMETER_SET);
+
+  // Reset forgets them.
+  chiaki_nal_check_reset(&check);
+  assert(!check.params_known);
+  au.size = 0;
+  h264_slice(&au, false, 0, 5, 7, 200, &rng);
+  assert(check_au(&check, &au).verdict == CHIAKI_NAL_CHECK_OK);
+}
+
+static void test_h264_truncated(void) {
+  ChiakiNalCheck check;
+  chiaki_nal_check_init(&check, CHIAKI_CODEC_H264);
+  AccessUnit au;
+  size_t slices[3];
+  h264_idr_au(&au, slices, 4);
+
+  // Cut in the header of the third slice: the first two are fine.
+  au.size = slices[2] + 6;
+  ChiakiNalCheckResult r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_DAMAGED && r.error == CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER);
+  assert(r.error_offset == slices[2] + 1 && r.valid_size == r.error_offset);
+  assert(r.slices == 2 && r.pic_size_valid == 1200);
+
+  // What is valid checks OK on its own.
+  au.size = r.valid_size;
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_OK && r.slices == 2);
+
+  // Cut in the first slice's header: nothing to decode.
+  au.size = slices[0] + 5;
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_MALFORMED && r.valid_size == 0);
+
+  // Cut in the SPS.
+  au.size = 8;
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_MALFORMED && r.error == CHIAKI_NAL_CHECK_ERROR_PARAMETER_SET);
+}
+
+static void test_h264_emulation(void) {
+  ChiakiNalCheck check;
+  chiaki_nal_check_init(&check, CHIAKI_CODEC_H264);
+  AccessUnit au;
+  size_t slices[3];
+  const uint8_t forbidden[][4] = {
+      {0x00, 0x00, 0x02, 0x80},
+      {0x00, 0x00, 0x00, 0x80},
+      {0x00, 0x00, 0x03, 0x80},
+  };
+  for (size_t i = 0; i < sizeof(forbidden) / sizeof(forbidden[0]); i++) {
+    h264_idr_au(&au, slices, 5);
+    memcpy(au.buf + slices[1] + 100, forbidden[i], 4);
+    ChiakiNalCheckResult r = check_au(&check, &au);
+    assert(r.verdict == CHIAKI_NAL_CHECK_DAMAGED && r.error == CHIAKI_NAL_CHECK_ERROR_EMULATION);
+    assert(r.slices == 1 && r.valid_size == slices[1] + 1 && r.pic_size_valid == 0);
+  }
+
+  // 00 00 00 before a start code is a trailing zero, before anything else not.
+  h264_idr_au(&au, slices, 5);
+  assert(check_au(&check, &au).verdict == CHIAKI_NAL_CHECK_OK);
+  memcpy(au.buf + au.size, (const uint8_t[]){0, 0, 0, 0, 0x80}, 5);
+  au.size += 5;
+  ChiakiNalCheckResult r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_DAMAGED && r.error == CHIAKI_NAL_CHECK_ERROR_EMULATION);
+  assert(r.slices == 2 && r.valid_size == slices[2] + 1);
+}
+
+static void test_h264_slices(void) {
+  ChiakiNalCheck check;
+  chiaki_nal_check_init(&check, CHIAKI_CODEC_H264);
+  uint64_t rng = 6;
+  AccessUnit au = {0};
+  h264_params(&au);
+  ChiakiNalCheckResult r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_OK);
+
+  // Out of order: the third slice starts before the second.
+  au.size = 0;
+  h264_slice(&au, false, 0, 1, 0, 100, &rng);
+  h264_slice(&au, false, 2400, 1, 0, 100, &rng);
+  size_t third = au.size;
+  h264_slice(&au, false, 1200, 1, 0, 100, &rng);
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_DAMAGED && r.error == CHIAKI_NAL_CHECK_ERROR_SLICE_ORDER);
+  assert(r.valid_size == third + 1 && r.slices == 2 && r.pic_size_valid == 2400);
+
+  // Slices of different pictures.
+  au.size = 0;
+  h264_slice(&au, false, 0, 1, 0, 100, &rng);
+  size_t second = au.size;
+  h264_slice(&au, false, 1200, 2, 0, 100, &rng);
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_DAMAGED && r.error == CHIAKI_NAL_CHECK_ERROR_SLICE_MISMATCH);
+  assert(r.valid_size == second + 1 && r.pic_size_valid == 1200);
+
+  // Beyond the picture.
+  au.size = 0;
+  h264_slice(&au, false, 0, 1, 0, 100, &rng);
+  h264_slice(&au, false, H264_PIC_SIZE, 1, 0, 100, &rng);
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_DAMAGED && r.error == CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER);
+  assert(r.pic_size_valid == 0);
+
+  // An IDR with a frame_num.
+  au.size = 0;
+  h264_slice(&au, true, 0, 3, 0, 100, &rng);
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_MALFORMED && r.error == CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER);
+}
+
+static void test_h264_headers(void) {
+  ChiakiNalCheck check;
+  chiaki_nal_check_init(&check, CHIAKI_CODEC_H264);
+  AccessUnit au;
+  size_t slices[3];
+  struct {
+    uint8_t header;
+    ChiakiNalCheckError error;
+  } cases[] = {
+      {0xe5, CHIAKI_NAL_CHECK_ERROR_NAL_HEADER},  // forbidden_zero_bit
+      {0x05, CHIAKI_NAL_CHECK_ERROR_NAL_TYPE},  // IDR with nal_ref_idc 0
+      {0x62, CHIAKI_NAL_CHECK_ERROR_NAL_TYPE},  // data partitioning
+      {0x70, CHIAKI_NAL_CHECK_ERROR_NAL_TYPE},  // reserved
+      {0x00, CHIAKI_NAL_CHECK_ERROR_NAL_TYPE},  // unspecified, e.g. zeroed data
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    h264_idr_au(&au, slices, 7);
+    au.buf[slices[1] + 4] = cases[i].header;
+    ChiakiNalCheckResult r = check_au(&check, &au);
+    assert(r.verdict == CHIAKI_NAL_CHECK_DAMAGED && r.error == cases[i].error);
+    assert(r.slices == 1);
+  }
+
+  // Data before the first start code, or no start code at all.
+  h264_idr_au(&au, slices, 7);
+  au.buf[0] = 0x10;
+  assert(check_au(&check, &au).error == CHIAKI_NAL_CHECK_ERROR_NO_START_CODE);
+  ChiakiNalCheckResult r;
+  chiaki_nal_check(&check, (const uint8_t[]){0, 0, 0, 0}, 4, &r);
+  assert(r.verdict == CHIAKI_NAL_CHECK_MALFORMED && r.error == CHIAKI_NAL_CHECK_ERROR_NO_START_CODE);
+  chiaki_nal_check(&check, NULL, 0, &r);
+  assert(r.verdict == CHIAKI_NAL_CHECK_MALFORMED);
+
+  // An SPS out of range is not remembered.
+  chiaki_nal_check_init(&check, CHIAKI_CODEC_H264);
+  BitWriter w;
+  memset(&w, 0, sizeof(w));
+  bw_u(&w, 8, 66);
+  bw_u(&w, 16, 0);
+  bw_ue(&w, 0);
+  bw_ue(&w, 13);  // log2_max_frame_num_minus4
+  au.size = 0;
+  au_nal(&au, (const uint8_t[]){0x67}, 1, &w);
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_MALFORMED && r.error == CHIAKI_NAL_CHECK_ERROR_PARAMETER_SET);
+  assert(!check.sps[0].valid && !check.params_known);
+  assert(check.errors[CHIAKI_NAL_CHECK_ERROR_PARAMETER_SET] == 1);
+}
+
+/* H.265: 1280x720 with 64x64 CTBs, 20x12 = 240 CTBs, addresses in 8 bits,
+ * POC lsb in 8. */
+#define H265_PIC_SIZE 240
+
+static void h265_params(AccessUnit *au) {
+  BitWriter w;
+  memset(&w, 0, sizeof(w));
+  bw_u(&w, 16, 0x0cff);  // content does not matter
+  au_nal(au, (const uint8_t[]){0x40, 0x01}, 2, &w);
+
+  bw_u(&w, 4, 0);  // vps_id
+  bw_u(&w, 3, 0);  // max_sub_layers_minus1
+  bw_u(&w, 1, 1);
+  bw_u(&w, 8, 0x01);  // Main profile
+  bw_u(&w, 32, 0x60000000);
+  bw_u(&w, 32, 0x90000000);
+  bw_u(&w, 16, 0);
+  bw_u(&w, 8, 120);  // level 4
+  bw_ue(&w, 0);  // sps_id
+  bw_ue(&w, 1);  // 4:2:0
+  bw_ue(&w, 1280);
+  bw_ue(&w, 720);
+  bw_u(&w, 1, 0);
+  bw_ue(&w, 0);
+  bw_ue(&w, 0);
+  bw_ue(&w, 4);  // log2_max_poc_lsb_minus4
+  bw_u(&w, 1, 1);
+  bw_ue(&w, 4);
+  bw_ue(&w, 0);
+  bw_ue(&w, 0);
+  bw_ue(&w, 0);  // 8x8 minimum coding blocks
+  bw_ue(&w, 3);  // 64x64 CTBs
+  bw_ue(&w, 0);
+  au_nal(au, (const uint8_t[]){0x42, 0x01}, 2, &w);
+
+  bw_ue(&w, 0);  // pps_id
+  bw_ue(&w, 0);  // sps_id
+  bw_u(&w, 1, 0);
+  bw_u(&w, 1, 0);
+  bw_u(&w, 3, 0);
+  bw_u(&w, 2, 1);
+  au_nal(au, (const uint8_t[]){0x44, 0x01}, 2, &w);
+}
+
+/* nal_type 19 is an IDR, I slices; others TRAIL_R, P slices. */
+static void h265_slice(AccessUnit *au, unsigned nal_type, unsigned temporal_id, uint32_t address,
+                       uint32_t slice_type, uint32_t poc, size_t payload, uint64_t *rng) {
+  BitWriter w;
+  memset(&w, 0, sizeof(w));
+  bool irap = nal_type >= 16 && nal_type <= 23;
+  bw_u(&w, 1, address == 0);
+  if (irap)
+    bw_u(&w, 1, 0);
+  bw_ue(&w, 0);  // pps_id
+  if (address)
+    bw_u(&w, 8, address);
+  bw_ue(&w, slice_type);
+  if (nal_type != 19 && nal_type != 20)
+    bw_u(&w, 8, poc);
+  bw_payload(&w, payload, rng);
+  au_nal(au, (const uint8_t[]){(uint8_t)(nal_type << 1), (uint8_t)(temporal_id + 1)}, 2, &w);
+}
+
+static void h265_idr_au(AccessUnit *au, size_t slice_offsets[3], uint64_t seed) {
+  uint64_t rng = seed;
+  au->size = 0;
+  h265_params(au);
+  static const uint32_t addresses[] = {0, 80, 160};
+  for (int i = 0; i < 3; i++) {
+    if (slice_offsets)
+      slice_offsets[i] = au->size;
+    h265_slice(au, 19, 0, addresses[i], 2, 0, 300, &rng);
+  }
+}
+
+static void test_h265(void) {
+  ChiakiNalCheck check;
+  chiaki_nal_check_init(&check, CHIAKI_CODEC_H265);
+  AccessUnit au;
+  size_t slices[3];
+  h265_idr_au(&au, slices, 8);
+  ChiakiNalCheckResult r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_OK && r.nal_units == 6 && r.slices == 3);
+  assert(r.random_access && r.pic_size == H265_PIC_SIZE && r.pic_size_valid == H265_PIC_SIZE);
+  assert(check.sps[0].pic_size_bits == 8 && check.sps[0].log2_max_poc_lsb == 8);
+
+  // A P picture in two slices, at TemporalId 1.
+  uint64_t rng = 9;
+  au.size = 0;
+  h265_slice(&au, 1, 1, 0, 1, 4, 400, &rng);
+  h265_slice(&au, 1, 1, 120, 1, 4, 400, &rng);
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_OK && r.slices == 2 && !r.random_access);
+
+  // Slices disagreeing about the POC, or the NAL unit type.
+  au.size = 0;
+  h265_slice(&au, 1, 0, 0, 1, 4, 100, &rng);
+  h265_slice(&au, 1, 0, 120, 1, 5, 100, &rng);
+  assert(check_au(&check, &au).error == CHIAKI_NAL_CHECK_ERROR_SLICE_MISMATCH);
+  au.size = 0;
+  h265_slice(&au, 1, 0, 0, 1, 4, 100, &rng);
+  h265_slice(&au, 0, 0, 120, 1, 4, 100, &rng);
+  assert(check_au(&check, &au).error == CHIAKI_NAL_CHECK_ERROR_SLICE_MISMATCH);
+
+  // An IRAP picture of P slices, or above TemporalId 0.
+  au.size = 0;
+  h265_slice(&au, 19, 0, 0, 1, 0, 100, &rng);
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_MALFORMED && r.error == CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER);
+  au.size = 0;
+  h265_slice(&au, 19, 1, 0, 2, 0, 100, &rng);
+  assert(check_au(&check, &au).error == CHIAKI_NAL_CHECK_ERROR_NAL_HEADER);
+
+  // An address beyond the picture, then reserved types and layers.
+  au.size = 0;
+  h265_slice(&au, 1, 0, 0, 1, 4, 100, &rng);
+  h265_slice(&au, 1, 0, H265_PIC_SIZE, 1, 4, 100, &rng);
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_DAMAGED && r.error == CHIAKI_NAL_CHECK_ERROR_SLICE_HEADER);
+
+  h265_idr_au(&au, slices, 8);
+  au.buf[slices[2] + 4] = 22 << 1;  // reserved IRAP
+  assert(check_au(&check, &au).error == CHIAKI_NAL_CHECK_ERROR_NAL_TYPE);
+  h265_idr_au(&au, slices, 8);
+  au.buf[slices[2] + 5] = 0x09;  // nuh_layer_id 1
+  r = check_au(&check, &au);
+  assert(r.verdict == CHIAKI_NAL_CHECK_DAMAGED && r.error == CHIAKI_NAL_CHECK_ERROR_NAL_HEADER);
+  assert(r.slices == 2 && r.pic_size_valid == 80);
+}
+
+/* Mutates au in one of the ways a lossy transport or a broken reassembly
+ * would: flipped bits, a zeroed run, a cut, a dropped or repeated stretch. */
+static void mutate(AccessUnit *au, uint64_t *rng) {
+  size_t pos = (size_t)(rng_next(rng) % au->size);
+  size_t len = 1 + (size_t)(rng_next(rng) % 64);
+  if (pos + len > au->size)
+    len = au->size - pos;
+  switch (rng_next(rng) % 5) {
+  case 0:
+    for (int i = 0; i < 4; i++)
+      au->buf[(size_t)(rng_next(rng) % au->size)] ^= (uint8_t)(1 << (rng_next(rng) % 8));
+    break;
+  case 1:
+    memset(au->buf + pos, 0, len);
+    break;
+  case 2:
+    au->size = pos;
+    break;
+  case 3:
+    memmove(au->buf + pos, au->buf + pos + len, au->size - pos - len);
+    au->size -= len;
+    break;
+  case 4:
+    if (au->size + len < AU_MAX) {
+      memmove(au->buf + pos + len, au->buf + pos, au->size - pos);
+      au->size += len;
+    }
+    break;
+  }
+}
+
+static void fuzz(ChiakiCodec codec, uint64_t seed) {
+  uint64_t rng = seed;
+  AccessUnit params = {0}, au, prefix;
+  if (codec == CHIAKI_CODEC_H264)
+    h264_params(&params);
+  else
+    h265_params(&params);
+  uint64_t verdicts[CHIAKI_NAL_CHECK_VERDICT_COUNT] = {0};
+
+  for (int round = 0; round < 3000; round++) {
+    ChiakiNalCheck check;
+    chiaki_nal_check_init(&check, codec);
+    ChiakiNalCheckResult r;
+    chiaki_nal_check(&check, params.buf, params.size, &r);
+    assert(r.verdict == CHIAKI_NAL_CHECK_OK && check.params_known);
+
+    if (codec == CHIAKI_CODEC_H264)
+      h264_idr_au(&au, NULL, rng_next(&rng));
+    else
+      h265_idr_au(&au, NULL, rng_next(&rng));
+    int mutations = 1 + (int)(rng_next(&rng) % 3);
+    for (int m = 0; m < mutations && au.size; m++)
+      mutate(&au, &rng);
+
+    r = check_au(&check, &au);
+    verdicts[r.verdict]++;
+    assert(r.valid_size <= au.size && r.pic_size_valid <= r.pic_size);
+    switch (r.verdict) {
+    case CHIAKI_NAL_CHECK_OK:
+      assert(r.valid_size == au.size && r.error == CHIAKI_NAL_CHECK_ERROR_NONE);
+      break;
+    case CHIAKI_NAL_CHECK_DAMAGED:
+      assert(r.slices >= 1 && r.valid_size == r.error_offset && r.valid_size < au.size);
+      assert(r.error != CHIAKI_NAL_CHECK_ERROR_NONE);
+      // The valid part checks OK on its own.
+      memcpy(prefix.buf, au.buf, r.valid_size);
+      prefix.size = r.valid_size;
+      chiaki_nal_check_init(&check, codec);
+      chiaki_nal_check(&check, params.buf, params.size, &r);
+      r = check_au(&check, &prefix);
+      assert(r.verdict == CHIAKI_NAL_CHECK_OK && r.slices >= 1);
+      break;
+    case CHIAKI_NAL_CHECK_MALFORMED:
+      assert(r.valid_size == 0 && r.error != CHIAKI_NAL_CHECK_ERROR_NONE);
+      break;
+    default:
+      assert(false);
+    }
+  }
+  // Most damage is caught: a mutation confined to slice data is the exception.
+  assert(verdicts[CHIAKI_NAL_CHECK_DAMAGED] + verdicts[CHIAKI_NAL_CHECK_MALFORMED] > 1500);
+  assert(verdicts[CHIAKI_NAL_CHECK_DAMAGED] > 300);
+}
+
+static void test_fuzz(void) {
+  fuzz(CHIAKI_CODEC_H264, 0x1234567887654321ULL);
+  fuzz(CHIAKI_CODEC_H265, 0x0badc0ffee123457ULL);
+}
+
+void run_nalcheck_tests(void) {
+  test_strings();
+  test_h264_valid();
+  test_h264_without_params();
+  test_h264_truncated();
+  test_h264_emulation();
+  test_h264_slices();
+  test_h264_headers();
+  test_h265();
+  test_fuzz();
+}
@@ -0,0 +1,228 @@
+/*
+ * netsim.c — Core of the deterministic network impairment simulator.
+ *
+ * In-flight packets live in a min-heap of small entries keyed on
+ * (due_us, order); payloads, when carried, sit in a fixed slot arena so the
+ * hot path never allocates. The RNG is xorshift64*, seeded per simulator.
+ */
+
+#include "netsim.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NETSIM_PARETO_CAP 10.0
+#define NETSIM_TWO_PI 6.283185307179586
+#define NETSIM_REORDER_DEFAULT_US 5000
+#define NETSIM_QUEUE_DEFAULT_US 200000
+
+static uint64_t netsim_rand(Netsim *sim) {
+  uint64_t x = sim->rng;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  sim->rng = x;
+  return x * 0x2545f4914f6cdd1dull;
+}
+
+/* Uniform in [0, 1). */
+static double netsim_unit(Netsim *sim) {
+  return (double)(netsim_rand(sim) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static bool netsim_chance(Netsim *sim, double p) {
+  return p > 0.0 && (p >= 1.0 || netsim_unit(sim) < p);
+}
+
+static bool netsim_link_lost(Netsim *sim) {
+  const NetsimParams *p = &sim->params;
+  if (p->burst_enter > 0.0) {
+    if (sim->bad) {
+      if (netsim_chance(sim, p->burst_exit))
+        sim->bad = false;
+    } else if (netsim_chance(sim, p->burst_enter)) {
+      sim->bad = true;
+    }
+    if (sim->bad && netsim_chance(sim, p->burst_loss))
+      return true;
+  }
+  return netsim_chance(sim, p->loss);
+}
+
+static uint64_t netsim_jitter_us(Netsim *sim) {
+  const NetsimParams *p = &sim->params;
+  if (!p->jitter_us)
+    return 0;
+  double j = (double)p->jitter_us;
+  switch (p->dist) {
+  case NETSIM_DELAY_NORMAL: {
+    /* Box-Muller, one sample per call keeps the stream simple to reproduce. */
+    double u1 = 1.0 - netsim_unit(sim);
+    double u2 = netsim_unit(sim);
+    return (uint64_t)fabs(j * sqrt(-2.0 * log(u1)) * cos(NETSIM_TWO_PI * u2));
+  }
+  case NETSIM_DELAY_PARETO: {
+    double x = 1.0 / sqrt(1.0 - netsim_unit(sim)) - 1.0;
+    if (x > NETSIM_PARETO_CAP)
+      x = NETSIM_PARETO_CAP;
+    return (uint64_t)(j * x);
+  }
+  case NETSIM_DELAY_UNIFORM:
+  default:
+    return netsim_rand(sim) % ((uint64_t)p->jitter_us + 1);
+  }
+}
+
+static bool entry_less(const NetsimEntry *a, const NetsimEntry *b) {
+  return a->due_us < b->due_us || (a->due_us == b->due_us && a->order < b->order);
+}
+
+static void heap_push(Netsim *sim, const NetsimEntry *e) {
+  NetsimEntry *heap = sim->heap;
+  size_t i = sim->heap_size++;
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (!entry_less(e, &heap[parent]))
+      break;
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i] = *e;
+}
+
+static void heap_pop(Netsim *sim, NetsimEntry *out) {
+  NetsimEntry *heap = sim->heap;
+  *out = heap[0];
+  NetsimEntry last = heap[--sim->heap_size];
+  size_t n = sim->heap_size;
+  size_t i = 0;
+  for (;;) {
+    size_t c = 2 * i + 1;
+    if (c >= n)
+      break;
+    if (c + 1 < n && entry_less(&heap[c + 1], &heap[c]))
+      c++;
+    if (!entry_less(&heap[c], &last))
+      break;
+    heap[i] = heap[c];
+    i = c;
+  }
+  heap[i] = last;
+}
+
+bool netsim_init(Netsim *sim, const NetsimParams *params, uint64_t seed, size_t capacity, size_t payload_max) {
+  memset(sim, 0, sizeof(*sim));
+  netsim_set_params(sim, params);
+  sim->rng = seed ? seed : 0x5eed;
+  sim->capacity = capacity;
+  sim->payload_max = payload_max;
+  sim->heap = calloc(capacity, sizeof(NetsimEntry));
+  sim->free_slots = calloc(capacity, sizeof(uint32_t));
+  if (payload_max)
+    sim->payload = malloc(capacity * payload_max);
+  if (!capacity || !sim->heap || !sim->free_slots || (payload_max && !sim->payload)) {
+    netsim_fini(sim);
+    return false;
+  }
+  for (size_t i = 0; i < capacity; i++)
+    sim->free_slots[i] = (uint32_t)(capacity - 1 - i);
+  sim->free_count = capacity;
+  return true;
+}
+
+void netsim_fini(Netsim *sim) {
+  free(sim->heap);
+  free(sim->free_slots);
+  free(sim->payload);
+  sim->heap = NULL;
+  sim->free_slots = NULL;
+  sim->payload = NULL;
+  sim->heap_size = 0;
+  sim->free_count = 0;
+}
+
+void netsim_set_params(Netsim *sim, const NetsimParams *params) {
+  sim->params = *params;
+  if (!sim->params.queue_us)
+    sim->params.queue_us = NETSIM_QUEUE_DEFAULT_US;
+  if (sim->params.reorder > 0.0 && !sim->params.reorder_us)
+    sim->params.reorder_us = NETSIM_REORDER_DEFAULT_US;
+  if (!sim->params.burst_enter)
+    sim->bad = false;
+}
+
+static bool netsim_enqueue(Netsim *sim, uint64_t link_us, const uint8_t *data, size_t size, void *user) {
+  const NetsimParams *p = &sim->params;
+  if (netsim_link_lost(sim)) {
+    sim->stats.lost++;
+    return false;
+  }
+  if (!sim->free_count) {
+    sim->stats.queue_dropped++;
+    return false;
+  }
+  NetsimEntry e;
+  e.due_us = link_us + p->delay_us + netsim_jitter_us(sim);
+  if (netsim_chance(sim, p->reorder)) {
+    e.due_us += p->reorder_us;
+    sim->stats.reordered++;
+  }
+  e.order = sim->order++;
+  e.size = (uint32_t)size;
+  e.slot = sim->free_slots[--sim->free_count];
+  e.user = user;
+  if (sim->payload && data)
+    memcpy(sim->payload + (size_t)e.slot * sim->payload_max, data, size);
+  heap_push(sim, &e);
+  return true;
+}
+
+bool netsim_push(Netsim *sim, uint64_t now_us, const uint8_t *data, size_t size, void *user) {
+  const NetsimParams *p = &sim->params;
+  sim->stats.in++;
+  if (sim->payload && size > sim->payload_max) {
+    sim->stats.queue_dropped++;
+    return false;
+  }
+
+  /* Bottleneck: the packet leaves the queue once everything ahead of it has
+   * been serialized. A backlog above queue_us is tail-dropped. */
+  uint64_t link_us = now_us;
+  uint64_t wire_size = size > sim->payload_header ? size - sim->payload_header : 0;
+  if (p->bandwidth_kbps) {
+    uint64_t start_us = sim->link_free_us > now_us ? sim->link_free_us : now_us;
+    if (start_us - now_us > p->queue_us) {
+      sim->stats.queue_dropped++;
+      return false;
+    }
+    sim->link_free_us = start_us + (wire_size * 8000 + p->bandwidth_kbps - 1) / p->bandwidth_kbps;
+    link_us = sim->link_free_us;
+  }
+
+  bool delivered = netsim_enqueue(sim, link_us, data, size, user);
+  if (netsim_chance(sim, p->duplicate)) {
+    sim->stats.duplicated++;
+    delivered |= netsim_enqueue(sim, link_us, data, size, user);
+  }
+  return delivered;
+}
+
+bool netsim_pop(Netsim *sim, uint64_t now_us, NetsimPacket *packet) {
+  if (!sim->heap_size || sim->heap[0].due_us > now_us)
+    return false;
+  NetsimEntry e;
+  heap_pop(sim, &e);
+  sim->free_slots[sim->free_count++] = e.slot;
+  packet->data = sim->payload ? sim->payload + (size_t)e.slot * sim->payload_max : NULL;
+  packet->size = e.size;
+  packet->user = e.user;
+  packet->due_us = e.due_us;
+  sim->stats.out++;
+  sim->stats.bytes_out += e.size > sim->payload_header ? e.size - sim->payload_header : 0;
+  return true;
+}
+
+uint64_t netsim_next_due_us(const Netsim *sim) {
+  return sim->heap_size ? sim->heap[0].due_us : UINT64_MAX;
+}
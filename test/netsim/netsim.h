@@ -0,0 +1,192 @@
+#pragma once
+
+/*
+ * Deterministic network impairment simulator for tests and benchmarks.
+ *
+ * A Netsim models one direction of a link. Packets are pushed in with the
+ * current (virtual) time and popped out once they are due; the simulator
+ * never reads a clock itself, so a run is fully reproducible from its seed
+ * and the push times, and a virtual clock can jump straight to
+ * netsim_next_due_us().
+ *
+ * Each packet first waits in a tail-drop bottleneck queue (bandwidth_kbps,
+ * queue_us), then is lost on the link with the independent and
+ * Gilbert-Elliott probabilities, then gets delay_us plus a jitter sample from
+ * the chosen distribution, plus reorder_us for a share of packets. A share of
+ * packets is duplicated, each copy drawing its own delay. Jitter can reorder
+ * packets, as netem does.
+ *
+ * netsim_params_parse() reads "key=value,..." specs, netsim_scenario_*()
+ * reads scenario files with timed phases, netsim_trace_*() replays packet
+ * traces and netsim_udp_*() puts a Netsim in front of a UDP socket.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
+
+typedef enum {
+  NETSIM_DELAY_UNIFORM = 0, /* delay + U[0, jitter] */
+  NETSIM_DELAY_NORMAL,      /* delay + |N(0, jitter)| */
+  NETSIM_DELAY_PARETO,      /* delay + jitter * (Pareto(alpha 2) - 1), capped at 10 * jitter */
+} NetsimDelayDist;
+
+typedef struct {
+  double loss;         /* independent loss probability, 0..1 */
+  double burst_enter;  /* Gilbert-Elliott P(good -> bad) per packet, 0 disables */
+  double burst_exit;   /* P(bad -> good) per packet */
+  double burst_loss;   /* loss probability in the bad state */
+  uint32_t delay_us;   /* fixed one-way delay */
+  uint32_t jitter_us;  /* scale of the extra delay, see NetsimDelayDist */
+  NetsimDelayDist dist;
+  double duplicate;    /* probability that a packet is delivered twice */
+  double reorder;      /* probability that a packet is held back by reorder_us */
+  uint32_t reorder_us; /* default 5 ms when reorder is set */
+  uint32_t bandwidth_kbps; /* 0 = unlimited */
+  uint32_t queue_us;       /* bottleneck queue limit before tail drop, default 200 ms */
+} NetsimParams;
+
+typedef struct {
+  uint64_t in;
+  uint64_t out;
+  uint64_t lost;          /* link loss, independent or burst */
+  uint64_t queue_dropped; /* bottleneck tail drop or simulator full */
+  uint64_t duplicated;
+  uint64_t reordered;
+  uint64_t bytes_out;
+} NetsimStats;
+
+typedef struct {
+  uint64_t due_us;
+  uint64_t order;
+  uint32_t size;
+  uint32_t slot;
+  void *user;
+} NetsimEntry;
+
+typedef struct {
+  NetsimParams params;
+  uint64_t rng;
+  bool bad;
+  uint64_t link_free_us;
+  uint64_t order;
+
+  size_t capacity;
+  size_t payload_max;
+  uint8_t *payload;   /* capacity * payload_max bytes, NULL if payload_max == 0 */
+  size_t payload_header; /* leading payload bytes not charged to the link, for shims */
+  NetsimEntry *heap;  /* min-heap on (due_us, order) */
+  size_t heap_size;
+  uint32_t *free_slots;
+  size_t free_count;
+
+  NetsimStats stats;
+} Netsim;
+
+typedef struct {
+  const uint8_t *data; /* NULL when the simulator carries no payload */
+  size_t size;
+  void *user;
+  uint64_t due_us;
+} NetsimPacket;
+
+/* capacity bounds the packets in flight, payload_max the bytes copied per
+ * packet (0 to only carry size and user). Returns false on allocation failure. */
+bool netsim_init(Netsim *sim, const NetsimParams *params, uint64_t seed, size_t capacity, size_t payload_max);
+void netsim_fini(Netsim *sim);
+/* Changes the impairment without touching packets already in flight. */
+void netsim_set_params(Netsim *sim, const NetsimParams *params);
+
+/* Packet in. data may be NULL. Returns false if no copy of the packet is in
+ * flight, i.e. it was dropped. */
+bool netsim_push(Netsim *sim, uint64_t now_us, const uint8_t *data, size_t size, void *user);
+/* Packet out. Returns the earliest packet due by now_us; its data stays valid
+ * until the next push. */
+bool netsim_pop(Netsim *sim, uint64_t now_us, NetsimPacket *packet);
+/* Due time of the next packet, UINT64_MAX if none is in flight. */
+uint64_t netsim_next_due_us(const Netsim *sim);
+static inline size_t netsim_in_flight(const Netsim *sim) { return sim->heap_size; }
+
+/* ---- specs and scenarios (netsim_scenario.c) ----------------------------- */
+
+/*
+ * Applies "key=value[,key=value...]" on top of params. Keys: loss,
+ * burst_enter, burst_exit, burst_loss, delay, jitter, dist
+ * (uniform|normal|pareto), duplicate, reorder, reorder_delay, bw, queue.
+ * Probabilities accept a "%" suffix, times "us", "ms" (default) or "s",
+ * bw "kbps" (default) or "mbps".
+ */
+bool netsim_params_parse(NetsimParams *params, const char *spec);
+
+#define NETSIM_SCENARIO_PHASES_MAX 32
+
+typedef struct {
+  NetsimParams params;
+  uint64_t duration_us; /* 0 = until the end */
+} NetsimPhase;
+
+typedef struct {
+  uint64_t seed;
+  bool loop; /* restart from the first phase after the last one */
+  NetsimPhase phases[NETSIM_SCENARIO_PHASES_MAX];
+  size_t phases_count;
+} NetsimScenario;
+
+/*
+ * Scenario text: "key = value" lines, "#" comments. Top-level keys are seed,
+ * loop and any params key. "[phase]" starts a phase that inherits the
+ * previous one and may set "duration". A file without phases is a single
+ * phase. On failure err describes the offending line.
+ */
+bool netsim_scenario_parse(NetsimScenario *scenario, const char *text, char *err, size_t err_size);
+bool netsim_scenario_load(NetsimScenario *scenario, const char *path, char *err, size_t err_size);
+/* Phase index active elapsed_us after the start. */
+size_t netsim_scenario_phase_at(const NetsimScenario *scenario, uint64_t elapsed_us);
+
+/* ---- trace replay (netsim_trace.c) --------------------------------------- */
+
+typedef struct {
+  uint64_t time_us;
+  uint32_t size;
+} NetsimTraceRecord;
+
+typedef struct {
+  NetsimTraceRecord *records;
+  size_t count;
+} NetsimTrace;
+
+/* Text trace, one "<time_us> <size>" line per packet in time order. */
+bool netsim_trace_load(NetsimTrace *trace, const char *path);
+void netsim_trace_fini(NetsimTrace *trace);
+
+/* Called for every delivered packet with the index of its trace record. */
+typedef void (*NetsimTraceDeliver)(size_t index, uint64_t sent_us, uint64_t received_us, void *user);
+
+/* Pushes the trace through sim on a virtual clock and drains it. When
+ * scenario is set, its phases are applied from the first record's time. */
+void netsim_trace_replay(Netsim *sim, const NetsimTrace *trace, const NetsimScenario *scenario,
+                         NetsimTraceDeliver deliver, void *user);
+
+/* ---- UDP socket shim (netsim_udp.c) -------------------------------------- */
+
+#ifndef _WIN32
+
+#define NETSIM_UDP_PACKET_MAX 1500
+
+typedef struct {
+  Netsim sim;
+} NetsimUdp;
+
+bool netsim_udp_init(NetsimUdp *udp, const NetsimParams *params, uint64_t seed, size_t capacity);
+void netsim_udp_fini(NetsimUdp *udp);
+/* Impairs one datagram on its way out of fd. */
+void netsim_udp_sendto(NetsimUdp *udp, uint64_t now_us, int fd, const struct sockaddr *addr, socklen_t addr_len,
+                       const uint8_t *buf, size_t size);
+/* Sends everything due by now_us. Returns the next due time or UINT64_MAX. */
+uint64_t netsim_udp_flush(NetsimUdp *udp, uint64_t now_us);
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ * netsim_scenario.c — Impairment specs and scenario files.
+ *
+ * Example scenario, a Wi-Fi link that degrades for ten seconds:
+ *
+ *   seed = 7
+ *   delay = 4ms
+ *   jitter = 2ms
+ *   dist = normal
+ *
+ *   [phase]
+ *   duration = 20s
+ *
+ *   [phase]
+ *   duration = 10s
+ *   burst_enter = 1%
+ *   burst_exit = 20%
+ *   burst_loss = 60%
+ *   bw = 8mbps
+ *
+ *   [phase]
+ *   burst_enter = 0
+ */
+
+#include "netsim.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static char *trim(char *s) {
+  while (isspace((unsigned char)*s))
+    s++;
+  char *end = s + strlen(s);
+  while (end > s && isspace((unsigned char)end[-1]))
+    *--end = '\0';
+  return s;
+}
+
+static bool parse_number(const char *value, double *out, const char **suffix) {
+  char *end;
+  double v = strtod(value, &end);
+  if (end == value || v < 0.0)
+    return false;
+  while (isspace((unsigned char)*end))
+    end++;
+  *out = v;
+  *suffix = end;
+  return true;
+}
+
+static bool parse_prob(const char *value, double *out) {
+  const char *suffix;
+  double v;
+  if (!parse_number(value, &v, &suffix))
+    return false;
+  if (!strcmp(suffix, "%"))
+    v /= 100.0;
+  else if (*suffix)
+    return false;
+  if (v > 1.0)
+    return false;
+  *out = v;
+  return true;
+}
+
+static bool parse_time_us(const char *value, uint64_t *out) {
+  const char *suffix;
+  double v;
+  if (!parse_number(value, &v, &suffix))
+    return false;
+  if (!strcmp(suffix, "us"))
+    ;
+  else if (!*suffix || !strcmp(suffix, "ms"))
+    v *= 1e3;
+  else if (!strcmp(suffix, "s"))
+    v *= 1e6;
+  else
+    return false;
+  *out = (uint64_t)(v + 0.5);
+  return true;
+}
+
+static bool parse_time_us32(const char *value, uint32_t *out) {
+  uint64_t v;
+  if (!parse_time_us(value, &v) || v > UINT32_MAX)
+    return false;
+  *out = (uint32_t)v;
+  return true;
+}
+
+static bool parse_kbps(const char *value, uint32_t *out) {
+  const char *suffix;
+  double v;
+  if (!parse_number(value, &v, &suffix))
+    return false;
+  if (!strcasecmp(suffix, "mbps"))
+    v *= 1e3;
+  else if (*suffix && strcasecmp(suffix, "kbps"))
+    return false;
+  if (v > UINT32_MAX)
+    return false;
+  *out = (uint32_t)(v + 0.5);
+  return true;
+}
+
+static bool params_set(NetsimParams *p, const char *key, const char *value) {
+  if (!strcasecmp(key, "loss"))
+    return parse_prob(value, &p->loss);
+  if (!strcasecmp(key, "burst_enter"))
+    return parse_prob(value, &p->burst_enter);
+  if (!strcasecmp(key, "burst_exit"))
+    return parse_prob(value, &p->burst_exit);
+  if (!strcasecmp(key, "burst_loss"))
+    return parse_prob(value, &p->burst_loss);
+  if (!strcasecmp(key, "delay"))
+    return parse_time_us32(value, &p->delay_us);
+  if (!strcasecmp(key, "jitter"))
+    return parse_time_us32(value, &p->jitter_us);
+  if (!strcasecmp(key, "duplicate"))
+    return parse_prob(value, &p->duplicate);
+  if (!strcasecmp(key, "reorder"))
+    return parse_prob(value, &p->reorder);
+  if (!strcasecmp(key, "reorder_delay"))
+    return parse_time_us32(value, &p->reorder_us);
+  if (!strcasecmp(key, "bw"))
+    return parse_kbps(value, &p->bandwidth_kbps);
+  if (!strcasecmp(key, "queue"))
+    return parse_time_us32(value, &p->queue_us);
+  if (!strcasecmp(key, "dist")) {
+    if (!strcasecmp(value, "uniform"))
+      p->dist = NETSIM_DELAY_UNIFORM;
+    else if (!strcasecmp(value, "normal"))
+      p->dist = NETSIM_DELAY_NORMAL;
+    else if (!strcasecmp(value, "pareto"))
+      p->dist = NETSIM_DELAY_PARETO;
+    else
+      return false;
+    return true;
+  }
+  return false;
+}
+
+bool netsim_params_parse(NetsimParams *params, const char *spec) {
+  char buf[512];
+  if (strlen(spec) >= sizeof(buf))
+    return false;
+  strcpy(buf, spec);
+  NetsimParams p = *params;
+  char *save = NULL;
+  for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    char *eq = strchr(tok, '=');
+    if (!eq)
+      return false;
+    *eq = '\0';
+    if (!params_set(&p, trim(tok), trim(eq + 1)))
+      return false;
+  }
+  *params = p;
+  return true;
+}
+
+bool netsim_scenario_parse(NetsimScenario *scenario, const char *text, char *err, size_t err_size) {
+  memset(scenario, 0, sizeof(*scenario));
+  scenario->seed = 1;
+  NetsimParams base;
+  memset(&base, 0, sizeof(base));
+  NetsimPhase *phase = NULL;
+
+  unsigned line_no = 0;
+  const char *line = text;
+  while (line && *line) {
+    line_no++;
+    const char *nl = strchr(line, '\n');
+    size_t len = nl ? (size_t)(nl - line) : strlen(line);
+    char buf[256];
+    if (len >= sizeof(buf)) {
+      snprintf(err, err_size, "line %u: too long", line_no);
+      return false;
+    }
+    memcpy(buf, line, len);
+    buf[len] = '\0';
+    line = nl ? nl + 1 : NULL;
+
+    char *hash = strchr(buf, '#');
+    if (hash)
+      *hash = '\0';
+    char *s = trim(buf);
+    if (!*s)
+      continue;
+
+    if (!strcasecmp(s, "[phase]")) {
+      if (scenario->phases_count == NETSIM_SCENARIO_PHASES_MAX) {
+        snprintf(err, err_size, "line %u: more than %d phases", line_no, NETSIM_SCENARIO_PHASES_MAX);
+        return false;
+      }
+      NetsimPhase *next = &scenario->phases[scenario->phases_count++];
+      next->params = phase ? phase->params : base;
+      next->duration_us = 0;
+      phase = next;
+      continue;
+    }
+
+    char *eq = strchr(s, '=');
+    if (!eq) {
+      snprintf(err, err_size, "line %u: expected key = value", line_no);
+      return false;
+    }
+    *eq = '\0';
+    const char *key = trim(s);
+    const char *value = trim(eq + 1);
+    bool ok = true;
+    if (!strcasecmp(key, "duration")) {
+      ok = phase && parse_time_us(value, &phase->duration_us);
+    } else if (!strcasecmp(key, "seed")) {
+      char *end;
+      scenario->seed = strtoull(value, &end, 0);
+      ok = !phase && end != value && !*end;
+    } else if (!strcasecmp(key, "loop")) {
+      scenario->loop = !strcasecmp(value, "true") || !strcmp(value, "1");
+      ok = !phase && (scenario->loop || !strcasecmp(value, "false") || !strcmp(value, "0"));
+    } else {
+      ok = params_set(phase ? &phase->params : &base, key, value);
+    }
+    if (!ok) {
+      snprintf(err, err_size, "line %u: invalid %s", line_no, key);
+      return false;
+    }
+  }
+
+  if (!scenario->phases_count) {
+    scenario->phases[0].params = base;
+    scenario->phases_count = 1;
+  }
+  return true;
+}
+
+bool netsim_scenario_load(NetsimScenario *scenario, const char *path, char *err, size_t err_size) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    snprintf(err, err_size, "cannot open %s", path);
+    return false;
+  }
+  char *text = NULL;
+  long size = -1;
+  if (fseek(f, 0, SEEK_END) == 0)
+    size = ftell(f);
+  if (size >= 0 && fseek(f, 0, SEEK_SET) == 0)
+    text = malloc((size_t)size + 1);
+  bool ok = text && fread(text, 1, (size_t)size, f) == (size_t)size;
+  fclose(f);
+  if (!ok) {
+    free(text);
+    snprintf(err, err_size, "cannot read %s", path);
+    return false;
+  }
+  text[size] = '\0';
+  ok = netsim_scenario_parse(scenario, text, err, err_size);
+  free(text);
+  return ok;
+}
+
+size_t netsim_scenario_phase_at(const NetsimScenario *scenario, uint64_t elapsed_us) {
+  uint64_t total_us = 0;
+  for (size_t i = 0; i < scenario->phases_count; i++) {
+    if (!scenario->phases[i].duration_us) {
+      total_us = 0;
+      break;
+    }
+    total_us += scenario->phases[i].duration_us;
+  }
+  if (scenario->loop && total_us)
+    elapsed_us %= total_us;
+  for (size_t i = 0; i < scenario->phases_count; i++) {
+    uint64_t d = scenario->phases[i].duration_us;
+    if (!d || elapsed_us < d)
+      return i;
+    elapsed_us -= d;
+  }
+  return scenario->phases_count - 1;
+}
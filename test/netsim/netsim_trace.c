@@ -0,0 +1,89 @@
+/*
+ * netsim_trace.c — Replays recorded packet traces through a Netsim.
+ *
+ * Traces only carry send time and size; the replay runs on a virtual clock
+ * that jumps from record to record, so a minute of capture replays in
+ * milliseconds and the delivery schedule depends only on the seed.
+ */
+
+#include "netsim.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool netsim_trace_load(NetsimTrace *trace, const char *path) {
+  memset(trace, 0, sizeof(*trace));
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+  size_t cap = 0;
+  char line[128];
+  bool ok = true;
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+    uint64_t time_us;
+    uint32_t size;
+    if (sscanf(line, "%" SCNu64 " %" SCNu32, &time_us, &size) != 2 ||
+        (trace->count && time_us < trace->records[trace->count - 1].time_us)) {
+      ok = false;
+      break;
+    }
+    if (trace->count == cap) {
+      size_t new_cap = cap ? cap * 2 : 1024;
+      NetsimTraceRecord *records = realloc(trace->records, new_cap * sizeof(NetsimTraceRecord));
+      if (!records) {
+        ok = false;
+        break;
+      }
+      trace->records = records;
+      cap = new_cap;
+    }
+    trace->records[trace->count].time_us = time_us;
+    trace->records[trace->count].size = size;
+    trace->count++;
+  }
+  fclose(f);
+  if (!ok)
+    netsim_trace_fini(trace);
+  return ok;
+}
+
+void netsim_trace_fini(NetsimTrace *trace) {
+  free(trace->records);
+  trace->records = NULL;
+  trace->count = 0;
+}
+
+static void drain(Netsim *sim, const NetsimTrace *trace, uint64_t now_us, NetsimTraceDeliver deliver, void *user) {
+  NetsimPacket packet;
+  while (netsim_pop(sim, now_us, &packet)) {
+    size_t index = (size_t)(uintptr_t)packet.user;
+    if (deliver)
+      deliver(index, trace->records[index].time_us, packet.due_us, user);
+  }
+}
+
+void netsim_trace_replay(Netsim *sim, const NetsimTrace *trace, const NetsimScenario *scenario,
+                         NetsimTraceDeliver deliver, void *user) {
+  if (!trace->count)
+    return;
+  uint64_t start_us = trace->records[0].time_us;
+  size_t phase = SIZE_MAX;
+  for (size_t i = 0; i < trace->count; i++) {
+    const NetsimTraceRecord *r = &trace->records[i];
+    drain(sim, trace, r->time_us, deliver, user);
+    if (scenario) {
+      size_t p = netsim_scenario_phase_at(scenario, r->time_us - start_us);
+      if (p != phase) {
+        netsim_set_params(sim, &scenario->phases[p].params);
+        phase = p;
+      }
+    }
+    netsim_push(sim, r->time_us, NULL, r->size, (void *)(uintptr_t)i);
+  }
+  while (netsim_in_flight(sim))
+    drain(sim, trace, netsim_next_due_us(sim), deliver, user);
+}
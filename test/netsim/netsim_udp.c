@@ -0,0 +1,58 @@
+/*
+ * netsim_udp.c — Puts a Netsim in front of a UDP socket.
+ *
+ * Instead of calling sendto() directly, a sender hands datagrams to
+ * netsim_udp_sendto() and calls netsim_udp_flush() from its poll loop,
+ * sleeping until the returned due time at most. The destination travels with
+ * the payload, so one shim can serve several sockets and peers.
+ */
+
+#include "netsim.h"
+
+#include <string.h>
+
+typedef struct {
+  int fd;
+  socklen_t addr_len;
+  struct sockaddr_storage addr;
+} NetsimUdpHeader;
+
+bool netsim_udp_init(NetsimUdp *udp, const NetsimParams *params, uint64_t seed, size_t capacity) {
+  if (!netsim_init(&udp->sim, params, seed, capacity, sizeof(NetsimUdpHeader) + NETSIM_UDP_PACKET_MAX))
+    return false;
+  udp->sim.payload_header = sizeof(NetsimUdpHeader);
+  return true;
+}
+
+void netsim_udp_fini(NetsimUdp *udp) {
+  netsim_fini(&udp->sim);
+}
+
+void netsim_udp_sendto(NetsimUdp *udp, uint64_t now_us, int fd, const struct sockaddr *addr, socklen_t addr_len,
+                       const uint8_t *buf, size_t size) {
+  if (size > NETSIM_UDP_PACKET_MAX || addr_len > sizeof(struct sockaddr_storage)) {
+    udp->sim.stats.in++;
+    udp->sim.stats.queue_dropped++;
+    return;
+  }
+  uint8_t packet[sizeof(NetsimUdpHeader) + NETSIM_UDP_PACKET_MAX];
+  NetsimUdpHeader header;
+  memset(&header, 0, sizeof(header));
+  header.fd = fd;
+  header.addr_len = addr_len;
+  memcpy(&header.addr, addr, addr_len);
+  memcpy(packet, &header, sizeof(header));
+  memcpy(packet + sizeof(header), buf, size);
+  netsim_push(&udp->sim, now_us, packet, sizeof(header) + size, NULL);
+}
+
+uint64_t netsim_udp_flush(NetsimUdp *udp, uint64_t now_us) {
+  NetsimPacket packet;
+  while (netsim_pop(&udp->sim, now_us, &packet)) {
+    NetsimUdpHeader header;
+    memcpy(&header, packet.data, sizeof(header));
+    size_t size = packet.size - sizeof(header);
+    sendto(header.fd, packet.data + sizeof(header), size, 0, (const struct sockaddr *)&header.addr, header.addr_len);
+  }
+  return netsim_next_due_us(&udp->sim);
+}
@@ -0,0 +1,238 @@
+/*
+ * netsim_tests.c — Unit tests for the network impairment simulator
+ * (test/netsim).
+ *
+ * Everything runs on a virtual clock, so timing assertions are exact and
+ * statistical ones use enough packets to stay far from their bounds.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "netsim/netsim.h"
+
+static NetsimParams clean_params(void) {
+  NetsimParams p;
+  memset(&p, 0, sizeof(p));
+  return p;
+}
+
+static void test_clean_link_passes_in_order(void) {
+  NetsimParams p = clean_params();
+  Netsim sim;
+  assert(netsim_init(&sim, &p, 1, 64, 16));
+  for (uint32_t i = 0; i < 32; i++) {
+    uint8_t data[4] = {(uint8_t)i};
+    assert(netsim_push(&sim, 1000, data, sizeof(data), (void *)(uintptr_t)i));
+  }
+  NetsimPacket packet;
+  for (uint32_t i = 0; i < 32; i++) {
+    assert(netsim_pop(&sim, 1000, &packet));
+    assert((uintptr_t)packet.user == i);
+    assert(packet.data[0] == i);
+    assert(packet.size == 4);
+    assert(packet.due_us == 1000);
+  }
+  assert(!netsim_pop(&sim, 1000, &packet));
+  assert(netsim_next_due_us(&sim) == UINT64_MAX);
+  assert(sim.stats.in == 32 && sim.stats.out == 32 && sim.stats.bytes_out == 128);
+  netsim_fini(&sim);
+}
+
+static void test_fixed_delay_and_bandwidth(void) {
+  NetsimParams p = clean_params();
+  p.delay_us = 5000;
+  p.bandwidth_kbps = 8000; /* 1 byte per microsecond */
+  p.queue_us = 3000;
+  Netsim sim;
+  assert(netsim_init(&sim, &p, 1, 64, 0));
+  /* 1000-byte packets take 1 ms each on the link. */
+  for (int i = 0; i < 4; i++)
+    assert(netsim_push(&sim, 0, NULL, 1000, NULL));
+  /* The backlog is now 4 ms, above the 3 ms queue: tail drop. */
+  assert(!netsim_push(&sim, 0, NULL, 1000, NULL));
+  assert(sim.stats.queue_dropped == 1);
+
+  NetsimPacket packet;
+  assert(netsim_next_due_us(&sim) == 6000);
+  assert(!netsim_pop(&sim, 5999, &packet));
+  for (int i = 0; i < 4; i++) {
+    assert(netsim_pop(&sim, UINT64_MAX, &packet));
+    assert(packet.due_us == 6000 + (uint64_t)i * 1000);
+  }
+  netsim_fini(&sim);
+}
+
+static void test_same_seed_same_schedule(void) {
+  NetsimParams p = clean_params();
+  assert(netsim_params_parse(&p, "loss=2%,burst_enter=1%,burst_exit=30%,burst_loss=50%,delay=10ms,jitter=3ms,"
+                                 "dist=pareto,duplicate=1%,reorder=1%,bw=20mbps"));
+  Netsim a, b;
+  assert(netsim_init(&a, &p, 42, 4096, 0));
+  assert(netsim_init(&b, &p, 42, 4096, 0));
+  NetsimPacket pa, pb;
+  for (uint64_t t = 0; t < 2000000; t += 500) {
+    assert(netsim_push(&a, t, NULL, 1200, (void *)(uintptr_t)t) == netsim_push(&b, t, NULL, 1200, (void *)(uintptr_t)t));
+    for (;;) {
+      bool ha = netsim_pop(&a, t, &pa);
+      bool hb = netsim_pop(&b, t, &pb);
+      assert(ha == hb);
+      if (!ha)
+        break;
+      assert(pa.user == pb.user && pa.due_us == pb.due_us);
+    }
+  }
+  assert(!memcmp(&a.stats, &b.stats, sizeof(a.stats)));
+  assert(a.stats.lost && a.stats.duplicated && a.stats.reordered);
+  netsim_fini(&a);
+  netsim_fini(&b);
+}
+
+static void test_gilbert_elliott_loss_is_bursty(void) {
+  NetsimParams p = clean_params();
+  p.burst_enter = 0.01;
+  p.burst_exit = 0.2;
+  p.burst_loss = 1.0;
+  Netsim sim;
+  assert(netsim_init(&sim, &p, 7, 16, 0));
+  const int n = 200000;
+  int runs = 0;
+  bool prev_lost = false;
+  NetsimPacket packet;
+  for (int i = 0; i < n; i++) {
+    bool lost = !netsim_push(&sim, (uint64_t)i, NULL, 100, NULL);
+    if (lost && !prev_lost)
+      runs++;
+    prev_lost = lost;
+    while (netsim_pop(&sim, (uint64_t)i, &packet))
+      ;
+  }
+  /* Stationary bad share is enter / (enter + exit) ~ 4.8%, mean burst 5. */
+  double rate = (double)sim.stats.lost / n;
+  assert(rate > 0.03 && rate < 0.07);
+  double mean_burst = (double)sim.stats.lost / runs;
+  assert(mean_burst > 3.5 && mean_burst < 6.5);
+  netsim_fini(&sim);
+}
+
+static void test_duplicate_delivers_twice(void) {
+  NetsimParams p = clean_params();
+  p.duplicate = 1.0;
+  Netsim sim;
+  assert(netsim_init(&sim, &p, 3, 8, 8));
+  uint8_t data[3] = {1, 2, 3};
+  assert(netsim_push(&sim, 0, data, sizeof(data), NULL));
+  NetsimPacket packet;
+  assert(netsim_pop(&sim, 0, &packet) && packet.size == 3 && packet.data[2] == 3);
+  assert(netsim_pop(&sim, 0, &packet) && packet.size == 3 && packet.data[2] == 3);
+  assert(!netsim_pop(&sim, 0, &packet));
+  assert(sim.stats.duplicated == 1);
+  netsim_fini(&sim);
+}
+
+static void test_full_simulator_drops(void) {
+  NetsimParams p = clean_params();
+  p.delay_us = 1000;
+  Netsim sim;
+  assert(netsim_init(&sim, &p, 1, 4, 0));
+  for (int i = 0; i < 4; i++)
+    assert(netsim_push(&sim, 0, NULL, 10, NULL));
+  assert(!netsim_push(&sim, 0, NULL, 10, NULL));
+  assert(sim.stats.queue_dropped == 1);
+  assert(netsim_in_flight(&sim) == 4);
+  netsim_fini(&sim);
+}
+
+static void test_params_parse_units_and_errors(void) {
+  NetsimParams p = clean_params();
+  assert(netsim_params_parse(&p, "loss=1.5%, delay=250us, jitter=0.5s, bw=2.5mbps, queue=50"));
+  assert(p.loss > 0.0149 && p.loss < 0.0151);
+  assert(p.delay_us == 250);
+  assert(p.jitter_us == 500000);
+  assert(p.bandwidth_kbps == 2500);
+  assert(p.queue_us == 50000);
+  NetsimParams before = p;
+  assert(!netsim_params_parse(&p, "delay=5,bogus=1"));
+  assert(!netsim_params_parse(&p, "loss=150%"));
+  assert(!netsim_params_parse(&p, "delay=5parsecs"));
+  assert(!netsim_params_parse(&p, "dist=cauchy"));
+  assert(!memcmp(&p, &before, sizeof(p)));
+}
+
+static void test_scenario_phases(void) {
+  static const char text[] =
+      "# degraded Wi-Fi\n"
+      "seed = 9\n"
+      "loop = true\n"
+      "delay = 4ms\n"
+      "\n"
+      "[phase]\n"
+      "duration = 2s\n"
+      "\n"
+      "[phase]\n"
+      "duration = 1s\n"
+      "loss = 10%   # inherits delay\n";
+  NetsimScenario sc;
+  char err[128];
+  assert(netsim_scenario_parse(&sc, text, err, sizeof(err)));
+  assert(sc.seed == 9 && sc.loop);
+  assert(sc.phases_count == 2);
+  assert(sc.phases[0].params.delay_us == 4000 && sc.phases[0].params.loss == 0.0);
+  assert(sc.phases[1].params.delay_us == 4000 && sc.phases[1].params.loss > 0.09);
+  assert(netsim_scenario_phase_at(&sc, 0) == 0);
+  assert(netsim_scenario_phase_at(&sc, 1999999) == 0);
+  assert(netsim_scenario_phase_at(&sc, 2000000) == 1);
+  assert(netsim_scenario_phase_at(&sc, 3000000) == 0);
+
+  assert(netsim_scenario_parse(&sc, "jitter = 2ms\n", err, sizeof(err)));
+  assert(sc.phases_count == 1 && sc.phases[0].params.jitter_us == 2000);
+  assert(netsim_scenario_phase_at(&sc, UINT64_MAX / 2) == 0);
+
+  assert(!netsim_scenario_parse(&sc, "delay = 1\nduration = 1s\n", err, sizeof(err)));
+  assert(!strncmp(err, "line 2", 6));
+  assert(!netsim_scenario_parse(&sc, "[phase]\nseed = 3\n", err, sizeof(err)));
+}
+
+static void count_delivered(size_t index, uint64_t sent_us, uint64_t received_us, void *user) {
+  size_t *count = user;
+  (void)index;
+  assert(received_us >= sent_us + 1000);
+  (*count)++;
+}
+
+static void test_trace_replay_with_scenario(void) {
+  NetsimTraceRecord records[1000];
+  for (size_t i = 0; i < 1000; i++) {
+    records[i].time_us = 1000000 + i * 1000;
+    records[i].size = 1000;
+  }
+  NetsimTrace trace = {records, 1000};
+  NetsimScenario sc;
+  char err[128];
+  /* Clean for 500 ms, then everything is lost. */
+  assert(netsim_scenario_parse(&sc, "delay = 1ms\n[phase]\nduration = 500ms\n[phase]\nloss = 100%\n", err,
+                               sizeof(err)));
+  NetsimParams p = clean_params();
+  Netsim sim;
+  assert(netsim_init(&sim, &p, sc.seed, 64, 0));
+  size_t delivered = 0;
+  netsim_trace_replay(&sim, &trace, &sc, count_delivered, &delivered);
+  assert(delivered == 500);
+  assert(sim.stats.lost == 500);
+  assert(netsim_in_flight(&sim) == 0);
+  netsim_fini(&sim);
+}
+
+void run_netsim_tests(void) {
+  test_clean_link_passes_in_order();
+  test_fixed_delay_and_bandwidth();
+  test_same_seed_same_schedule();
+  test_gilbert_elliott_loss_is_bursty();
+  test_duplicate_delivers_twice();
+  test_full_simulator_drops();
+  test_params_parse_units_and_errors();
+  test_scenario_phases();
+  test_trace_replay_with_scenario();
+}
@@ -0,0 +1,227 @@
+/*
+ * notifqueue_tests.c — Unit tests for the typed PSN notification queue
+ * (lib/src/remote/notifqueue.c).
+ *
+ * The frames below follow what the push notification websocket delivers
+ * during a remote connect (account IDs, session IDs and keys replaced), and
+ * are replayed in order the way websocket_thread_func queues them and the
+ * holepunch state machine consumes them.
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <chiaki/jsonscan.h>
+
+#include "remote/notifqueue.h"
+
+#define SESSION_ID "0b3f1a52-6c1e-4c59-9d43-2f1e7c0d5a11"
+#define FROM "\"from\":{\"accountId\":\"6574123908714563321\",\"platform\":\"PROSPERO\"}"
+
+static const char frame_session_created[] =
+    "{\"dataType\":\"psn:sessionManager:sys:remotePlaySession:created\",\"body\":{\"data\":{\"remotePlaySessions\":"
+    "[{\"sessionId\":\"" SESSION_ID "\"}]}},\"to\":{\"accountId\":\"1234567890123456789\","
+    "\"onlineId\":\"Vita\\u00e9Player\"}}";
+
+static const char frame_client_joined[] =
+    "{\"dataType\":\"psn:sessionManager:sys:rps:members:created\",\"body\":{\"data\":{\"sessionId\":\"" SESSION_ID
+    "\",\"members\":[{\"accountId\":\"1234567890123456789\",\"platform\":\"REMOTE_PLAY\"}]}}}";
+
+static const char frame_console_joined[] =
+    "{\"dataType\":\"psn:sessionManager:sys:rps:members:created\",\"body\":{\"data\":{\"sessionId\":\"" SESSION_ID
+    "\",\"members\":[{\"accountId\":\"6574123908714563321\",\"platform\":\"PROSPERO\",\"deviceUniqueId\":"
+    "\"00112233445566778899aabbccddeeff00112233445566778899aabbccddeeff\"}]}}}";
+
+static const char frame_custom_data1[] =
+    "{\"dataType\":\"psn:sessionManager:sys:rps:customData1:updated\",\"body\":{\"data\":{\"sessionId\":\"" SESSION_ID
+    "\",\"customData1\":\"QkJCQkJCQkJCQkJCQkJCQkJCQkJCQkI=\"}}}";
+
+// The console leaves out the value of localPeerAddr, the payload carries the escaped body.
+static const char frame_console_offer[] =
+    "{\"dataType\":\"psn:sessionManager:sys:rps:sessionMessage:created\",\"body\":{\"data\":{\"sessionId\":\"" SESSION_ID
+    "\",\"sessionMessage\":{\"channel\":\"remote_play:1\",\"payload\":\"ver=1.0, type=text, body={\\\"action\\\":"
+    "\\\"OFFER\\\",\\\"reqId\\\":1,\\\"error\\\":0,\\\"connRequest\\\":{\\\"sid\\\":2214839129,\\\"peerSid\\\":0,"
+    "\\\"skey\\\":\\\"c2tleXNrZXlza2V5c2tleQ==\\\",\\\"natType\\\":2,\\\"candidate\\\":[{\\\"type\\\":\\\"LOCAL\\\","
+    "\\\"addr\\\":\\\"192.168.1.20\\\",\\\"mappedAddr\\\":\\\"0.0.0.0\\\",\\\"port\\\":9303,\\\"mappedPort\\\":0}],"
+    "\\\"defaultRouteMacAddr\\\":\\\"00:11:22:33:44:55\\\",\\\"localPeerAddr\\\":,\\\"localHashedId\\\":"
+    "\\\"aGFzaGVkaWRoYXNoZWRpZA==\\\"}}\"," FROM "}}}}";
+
+static const char frame_ack[] =
+    "{\"dataType\":\"psn:sessionManager:sys:rps:sessionMessage:created\",\"body\":{\"data\":{\"sessionId\":\"" SESSION_ID
+    "\",\"sessionMessage\":{\"channel\":\"remote_play:1\",\"payload\":\"ver=1.0, type=text, body={\\\"action\\\":"
+    "\\\"RESULT\\\",\\\"reqId\\\":7,\\\"error\\\":0,\\\"connRequest\\\":{}}\"," FROM "}}}}";
+
+static const char frame_unknown[] =
+    "{\"dataType\":\"psn:sessionManager:sys:rps:customData2:updated\",\"body\":{\"data\":{}}}";
+
+static const char frame_console_accept[] =
+    "{\"dataType\":\"psn:sessionManager:sys:rps:sessionMessage:created\",\"body\":{\"data\":{\"sessionId\":\"" SESSION_ID
+    "\",\"sessionMessage\":{\"channel\":\"remote_play:1\",\"payload\":\"ver=1.0, type=text, body={\\\"action\\\":"
+    "\\\"ACCEPT\\\",\\\"reqId\\\":2,\\\"error\\\":0,\\\"connRequest\\\":{\\\"sid\\\":2214839129,\\\"peerSid\\\":7}}\","
+    FROM "}}}}";
+
+static const char frame_member_deleted[] =
+    "{\"dataType\":\"psn:sessionManager:sys:rps:members:deleted\",\"body\":{\"data\":{\"sessionId\":\"" SESSION_ID
+    "\",\"members\":[{\"accountId\":\"6574123908714563321\"}]}}}";
+
+static const char frame_session_deleted[] =
+    "{\"dataType\":\"psn:sessionManager:sys:remotePlaySession:deleted\",\"body\":{\"data\":{\"sessionId\":\"" SESSION_ID
+    "\"}}}";
+
+static Notification *replay(NotificationQueue *nq, const char *frame) {
+  Notification *notif = NULL;
+  assert(chiaki_notification_new(frame, strlen(frame), &notif) == CHIAKI_ERR_SUCCESS);
+  chiaki_notification_queue_push(nq, notif);
+  return notif;
+}
+
+static void test_frames_are_scanned(void) {
+  Notification *notif = NULL;
+  assert(chiaki_notification_new(frame_session_created, strlen(frame_session_created), &notif) ==
+         CHIAKI_ERR_SUCCESS);
+  assert(notif->type == NOTIFICATION_TYPE_SESSION_CREATED);
+  assert(notif->msg_body == NULL && notif->msg_req_id == -1);
+  assert(strcmp(notif->json_buf, frame_session_created) == 0);
+  assert(notif->json_buf_size == strlen(frame_session_created));
+  chiaki_notification_free(notif);
+
+  assert(chiaki_notification_new(frame_console_offer, strlen(frame_console_offer), &notif) == CHIAKI_ERR_SUCCESS);
+  assert(notif->type == NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED);
+  assert(notif->msg_action == SESSION_MESSAGE_ACTION_OFFER);
+  assert(notif->msg_req_id == 1);
+  // The body is decoded, the missing value is left for session_message_get_payload to fix
+  assert(strncmp(notif->msg_body, "{\"action\":\"OFFER\"", 17) == 0);
+  assert(strstr(notif->msg_body, "\"localPeerAddr\":,") != NULL);
+  assert(notif->msg_body_len == strlen(notif->msg_body));
+  assert(notif->msg_body[notif->msg_body_len - 1] == '}');
+  chiaki_notification_free(notif);
+
+  assert(chiaki_notification_new(frame_unknown, strlen(frame_unknown), &notif) == CHIAKI_ERR_SUCCESS);
+  assert(notif->type == NOTIFICATION_TYPE_UNKNOWN);
+  chiaki_notification_free(notif);
+
+  const char *broken[] = {"", "not json", "{\"body\":{}}", "{\"dataType\":5}", "{\"dataType\":"};
+  for (size_t i = 0; i < sizeof(broken) / sizeof(broken[0]); i++) {
+    notif = NULL;
+    assert(chiaki_notification_new(broken[i], strlen(broken[i]), &notif) == CHIAKI_ERR_INVALID_DATA);
+    assert(notif == NULL);
+  }
+
+  // A session message without body= still queues, just without a body
+  const char *no_body = "{\"dataType\":\"psn:sessionManager:sys:rps:sessionMessage:created\",\"body\":{\"data\":"
+                        "{\"sessionMessage\":{\"payload\":\"ver=1.0\"}}}}";
+  assert(chiaki_notification_new(no_body, strlen(no_body), &notif) == CHIAKI_ERR_SUCCESS);
+  assert(notif->msg_body == NULL && notif->msg_action == SESSION_MESSAGE_ACTION_UNKNOWN);
+  chiaki_notification_free(notif);
+}
+
+static void test_replay_connect(void) {
+  NotificationQueue *nq = chiaki_notification_queue_new();
+  assert(nq);
+
+  // Creating the session
+  Notification *created = replay(nq, frame_session_created);
+  Notification *client = replay(nq, frame_client_joined);
+  uint32_t create_query = NOTIFICATION_TYPE_SESSION_CREATED | NOTIFICATION_TYPE_MEMBER_CREATED;
+  assert(chiaki_notification_queue_peek(nq, create_query) == created);
+  const char *const online_id_path[] = {"to.onlineId"};
+  ChiakiJsonValue online_id;
+  assert(chiaki_json_scan(created->json_buf, created->json_buf_size, online_id_path, &online_id, 1) ==
+         CHIAKI_ERR_SUCCESS);
+  assert(chiaki_json_value_streq(&online_id, "Vita\xc3\xa9Player"));
+  assert(chiaki_notification_queue_clear(nq, created));
+  assert(chiaki_notification_queue_peek(nq, create_query) == client);
+  assert(chiaki_notification_queue_clear(nq, client));
+  assert(!chiaki_notification_queue_peek(nq, create_query));
+  assert(nq->pending == 0);
+
+  // Starting it, customData1 arrives before the console joins
+  Notification *custom = replay(nq, frame_custom_data1);
+  Notification *console = replay(nq, frame_console_joined);
+  uint32_t start_query = NOTIFICATION_TYPE_MEMBER_CREATED | NOTIFICATION_TYPE_CUSTOM_DATA1_UPDATED;
+  assert(chiaki_notification_queue_peek(nq, NOTIFICATION_TYPE_MEMBER_CREATED) == console);
+  assert(chiaki_notification_queue_peek(nq, start_query) == custom);
+  assert(chiaki_notification_queue_clear(nq, custom));
+  const char *const duid_path[] = {"body.data.members.0.deviceUniqueId"};
+  ChiakiJsonValue duid;
+  assert(chiaki_json_scan(console->json_buf, console->json_buf_size, duid_path, &duid, 1) == CHIAKI_ERR_SUCCESS);
+  assert(duid.type == CHIAKI_JSON_TYPE_STRING && duid.len == 64);
+  assert(chiaki_notification_queue_clear(nq, console));
+
+  // Punching the control hole: offer from the console, ack for our offer 7, accept
+  Notification *offer = replay(nq, frame_console_offer);
+  Notification *ack = replay(nq, frame_ack);
+  replay(nq, frame_unknown); // dropped right away
+  Notification *accept = replay(nq, frame_console_accept);
+  assert(chiaki_notification_queue_peek(nq, NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED) == offer);
+  assert(!chiaki_notification_is_ack(offer, 1));
+  assert(!chiaki_notification_is_ack(ack, 1));
+  assert(chiaki_notification_is_ack(ack, 7));
+  assert(accept->msg_action == SESSION_MESSAGE_ACTION_ACCEPT && accept->msg_req_id == 2);
+  assert(chiaki_notification_queue_clear(nq, offer));
+  assert(chiaki_notification_queue_clear(nq, ack));
+  assert(chiaki_notification_queue_peek(nq, NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED) == accept);
+  assert(chiaki_notification_queue_clear(nq, accept));
+
+  // Teardown
+  Notification *member_deleted = replay(nq, frame_member_deleted);
+  Notification *session_deleted = replay(nq, frame_session_deleted);
+  uint32_t fini_query = NOTIFICATION_TYPE_MEMBER_DELETED | NOTIFICATION_TYPE_SESSION_DELETED;
+  assert(chiaki_notification_queue_peek(nq, fini_query) == member_deleted);
+  assert(chiaki_notification_queue_peek(nq, NOTIFICATION_TYPE_SESSION_DELETED) == session_deleted);
+  assert(chiaki_notification_queue_clear(nq, member_deleted));
+  assert(nq->pending == NOTIFICATION_TYPE_SESSION_DELETED);
+
+  // Whatever is left is freed with the queue
+  replay(nq, frame_console_offer);
+  chiaki_notification_queue_free(nq);
+}
+
+static void test_clear_drops_older(void) {
+  NotificationQueue *nq = chiaki_notification_queue_new();
+  assert(nq);
+  Notification *deleted = replay(nq, frame_member_deleted);
+  Notification *offer = replay(nq, frame_console_offer);
+  Notification *custom = replay(nq, frame_custom_data1);
+  Notification *accept = replay(nq, frame_console_accept);
+  assert(deleted->seq < offer->seq && offer->seq < custom->seq && custom->seq < accept->seq);
+
+  // Clearing the offer takes the older member notification with it, newer ones stay
+  assert(chiaki_notification_queue_clear(nq, offer));
+  assert(!chiaki_notification_queue_peek(nq, NOTIFICATION_TYPE_MEMBER_DELETED));
+  assert(chiaki_notification_queue_peek(nq, NOTIFICATION_TYPE_CUSTOM_DATA1_UPDATED) == custom);
+  assert(chiaki_notification_queue_peek(nq, NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED) == accept);
+
+  // Clearing something that isn't queued does nothing
+  Notification *stray = NULL;
+  assert(chiaki_notification_new(frame_ack, strlen(frame_ack), &stray) == CHIAKI_ERR_SUCCESS);
+  assert(!chiaki_notification_queue_clear(nq, stray));
+  chiaki_notification_free(stray);
+  assert(nq->pending == (NOTIFICATION_TYPE_CUSTOM_DATA1_UPDATED | NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED));
+
+  assert(chiaki_notification_queue_clear(nq, accept));
+  assert(nq->pending == 0);
+  chiaki_notification_queue_free(nq);
+}
+
+static void test_peek_scales_with_backlog(void) {
+  // A long backlog of other types doesn't hide the one notification being waited for.
+  NotificationQueue *nq = chiaki_notification_queue_new();
+  assert(nq);
+  for (int i = 0; i < 1000; i++)
+    replay(nq, frame_client_joined);
+  Notification *ack = replay(nq, frame_ack);
+  assert(chiaki_notification_queue_peek(nq, NOTIFICATION_TYPE_SESSION_MESSAGE_CREATED) == ack);
+  assert(chiaki_notification_queue_peek(nq, NOTIFICATION_TYPE_SESSION_DELETED) == NULL);
+  assert(chiaki_notification_queue_clear(nq, ack));
+  assert(nq->pending == 0);
+  chiaki_notification_queue_free(nq);
+}
+
+void run_notifqueue_tests(void) {
+  test_frames_are_scanned();
+  test_replay_connect();
+  test_clear_drops_older();
+  test_peek_scales_with_backlog();
+}
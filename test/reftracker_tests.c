@@ -0,0 +1,171 @@
+/*
+ * reftracker_tests.c — Unit tests for ChiakiRefTracker (lib/src/reftracker.c).
+ *
+ * Streams are simulated as synthetic GOPs: an I frame followed by P frames
+ * that reference the previous frame (distance 0) unless stated otherwise.
+ * Loss patterns are applied by skipping frames the way the video receiver
+ * does: mark the gap lost, decode whatever is decodable.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <chiaki/reftracker.h>
+
+#define DPB 8
+
+/* Feed one frame through the tracker like chiaki_video_receiver_flush_frame does.
+ * Returns the verdict the frame got. */
+static ChiakiRefTrackerVerdict feed_frame(ChiakiRefTracker *t, ChiakiSeqNum16 frame, unsigned ref_distance) {
+  chiaki_ref_tracker_mark_received(t, frame);
+  if (ref_distance != CHIAKI_REF_TRACKER_NO_REF)
+    chiaki_ref_tracker_note_ref_distance(t, ref_distance);
+  ChiakiRefTrackerVerdict v = chiaki_ref_tracker_verdict(t, frame, ref_distance);
+  if (v == CHIAKI_REF_TRACKER_UNDECODABLE)
+    chiaki_ref_tracker_mark_lost(t, frame, frame);
+  else
+    chiaki_ref_tracker_mark_decoded(t, frame);
+  return v;
+}
+
+static void feed_gop(ChiakiRefTracker *t, ChiakiSeqNum16 first, unsigned count) {
+  assert(feed_frame(t, first, CHIAKI_REF_TRACKER_NO_REF) == CHIAKI_REF_TRACKER_DECODABLE);
+  for (unsigned i = 1; i < count; i++)
+    assert(feed_frame(t, (ChiakiSeqNum16)(first + i), 0) == CHIAKI_REF_TRACKER_DECODABLE);
+}
+
+static void test_clean_gop_is_decodable(void) {
+  ChiakiRefTracker t;
+  chiaki_ref_tracker_init(&t, DPB);
+  feed_gop(&t, 1, 30);
+  assert(chiaki_ref_tracker_is_received(&t, 30));
+  assert(chiaki_ref_tracker_is_decoded(&t, 30));
+  assert(!chiaki_ref_tracker_is_lost(&t, 30));
+  assert(chiaki_ref_tracker_predict(&t, 31) == CHIAKI_REF_TRACKER_DECODABLE);
+  assert(chiaki_ref_tracker_predict_undecodable(&t, 31, 16) == 0);
+}
+
+static void test_dpb_evicts_oldest_reference(void) {
+  ChiakiRefTracker t;
+  chiaki_ref_tracker_init(&t, DPB);
+  feed_gop(&t, 100, DPB + 1);
+  // 100..108 decoded, only the last DPB stay references.
+  assert(!chiaki_ref_tracker_has_ref(&t, 100));
+  assert(chiaki_ref_tracker_is_decoded(&t, 100));
+  for (ChiakiSeqNum16 f = 101; f <= 108; f++)
+    assert(chiaki_ref_tracker_has_ref(&t, f));
+  assert(t.ref_count == DPB);
+}
+
+static void test_single_loss_is_recoverable(void) {
+  ChiakiRefTracker t;
+  chiaki_ref_tracker_init(&t, DPB);
+  feed_gop(&t, 1, 10);
+  chiaki_ref_tracker_mark_lost(&t, 11, 11);
+  assert(chiaki_ref_tracker_is_lost(&t, 11));
+
+  // 12 references 11, the nearest substitute is 10 at distance 1.
+  assert(chiaki_ref_tracker_predict(&t, 12) == CHIAKI_REF_TRACKER_RECOVERABLE);
+  unsigned distance = 0;
+  assert(chiaki_ref_tracker_find_ref(&t, 12, 1, &distance));
+  assert(distance == 1);
+  assert(chiaki_ref_tracker_predict_undecodable(&t, 12, 8) == 0);
+}
+
+static void test_burst_loss_predicts_undecodable(void) {
+  ChiakiRefTracker t;
+  chiaki_ref_tracker_init(&t, DPB);
+  feed_gop(&t, 1, 20);
+  // A burst as long as the DPB leaves nothing to reference.
+  chiaki_ref_tracker_mark_lost(&t, 21, 21 + DPB - 1);
+  ChiakiSeqNum16 next = 21 + DPB;
+  assert(chiaki_ref_tracker_predict(&t, next) == CHIAKI_REF_TRACKER_UNDECODABLE);
+  assert(chiaki_ref_tracker_predict_undecodable(&t, next, 4) == 0xf);
+
+  // One frame shorter and the oldest reference is still usable.
+  chiaki_ref_tracker_init(&t, DPB);
+  feed_gop(&t, 1, 20);
+  chiaki_ref_tracker_mark_lost(&t, 21, 21 + DPB - 2);
+  assert(chiaki_ref_tracker_predict(&t, 21 + DPB - 1) == CHIAKI_REF_TRACKER_RECOVERABLE);
+  unsigned distance = 0;
+  assert(chiaki_ref_tracker_find_ref(&t, 21 + DPB - 1, 0, &distance));
+  assert(distance == DPB - 1);
+}
+
+static void test_undecodable_until_i_frame(void) {
+  ChiakiRefTracker t;
+  chiaki_ref_tracker_init(&t, DPB);
+  feed_gop(&t, 1, 10);
+  chiaki_ref_tracker_reset_refs(&t);
+  assert(feed_frame(&t, 11, 0) == CHIAKI_REF_TRACKER_UNDECODABLE);
+  assert(feed_frame(&t, 12, 0) == CHIAKI_REF_TRACKER_UNDECODABLE);
+  assert(chiaki_ref_tracker_is_received(&t, 12) && chiaki_ref_tracker_is_lost(&t, 12));
+  assert(feed_frame(&t, 13, CHIAKI_REF_TRACKER_NO_REF) == CHIAKI_REF_TRACKER_DECODABLE);
+  assert(feed_frame(&t, 14, 0) == CHIAKI_REF_TRACKER_DECODABLE);
+}
+
+static void test_longer_reference_distance_gop(void) {
+  // Every P frame references two frames back (distance 1), so each loss only
+  // breaks the chain it belongs to.
+  ChiakiRefTracker t;
+  chiaki_ref_tracker_init(&t, DPB);
+  feed_frame(&t, 1, CHIAKI_REF_TRACKER_NO_REF);
+  feed_frame(&t, 2, CHIAKI_REF_TRACKER_NO_REF);
+  for (ChiakiSeqNum16 f = 3; f <= 10; f++)
+    assert(feed_frame(&t, f, 1) == CHIAKI_REF_TRACKER_DECODABLE);
+  chiaki_ref_tracker_mark_lost(&t, 11, 11);
+  // 12 references 10, unaffected by the loss of 11.
+  assert(chiaki_ref_tracker_predict(&t, 12) == CHIAKI_REF_TRACKER_DECODABLE);
+  // 13 references 11 and has to fall back.
+  assert(chiaki_ref_tracker_predict(&t, 13) == CHIAKI_REF_TRACKER_RECOVERABLE);
+}
+
+static void test_wraparound(void) {
+  ChiakiRefTracker t;
+  chiaki_ref_tracker_init(&t, DPB);
+  feed_gop(&t, 65530, 12); // 65530..65535, 0..5
+  assert(chiaki_ref_tracker_has_ref(&t, 65535));
+  assert(chiaki_ref_tracker_has_ref(&t, 5));
+  assert(!chiaki_ref_tracker_has_ref(&t, 65531));
+  chiaki_ref_tracker_mark_lost(&t, 6, 6);
+  unsigned distance = 0;
+  assert(chiaki_ref_tracker_find_ref(&t, 7, 1, &distance));
+  assert(distance == 1);
+
+  // Reference across the wrap point.
+  chiaki_ref_tracker_init(&t, DPB);
+  feed_gop(&t, 65533, 3); // 65533..65535
+  chiaki_ref_tracker_mark_lost(&t, 0, 0);
+  assert(chiaki_ref_tracker_find_ref(&t, 1, 1, &distance));
+  assert(distance == 1); // frame 65535
+}
+
+static void test_window_forgets_old_frames(void) {
+  ChiakiRefTracker t;
+  chiaki_ref_tracker_init(&t, DPB);
+  feed_gop(&t, 10, 5);
+  // Jump far ahead: history and references are gone, slots must not alias.
+  chiaki_ref_tracker_mark_lost(&t, 15, 14 + CHIAKI_REF_TRACKER_WINDOW + 2);
+  assert(!chiaki_ref_tracker_is_decoded(&t, 10));
+  assert(!chiaki_ref_tracker_has_ref(&t, 14));
+  assert(t.ref_count == 0);
+  assert(chiaki_ref_tracker_predict(&t, 14 + CHIAKI_REF_TRACKER_WINDOW + 3) == CHIAKI_REF_TRACKER_UNDECODABLE);
+
+  // Frames ahead of the newest tracked frame are never reported.
+  chiaki_ref_tracker_init(&t, DPB);
+  feed_gop(&t, 1, 3);
+  assert(!chiaki_ref_tracker_is_decoded(&t, (ChiakiSeqNum16)(3 + CHIAKI_REF_TRACKER_WINDOW)));
+  assert(!chiaki_ref_tracker_is_received(&t, 4));
+}
+
+void run_reftracker_tests(void) {
+  test_clean_gop_is_decodable();
+  test_dpb_evicts_oldest_reference();
+  test_single_loss_is_recoverable();
+  test_burst_loss_predicts_undecodable();
+  test_undecodable_until_i_frame();
+  test_longer_reference_distance_gop();
+  test_wraparound();
+  test_window_forgets_old_frames();
+}
@@ -0,0 +1,260 @@
+/*
+ * signalgraph_tests.c — Unit tests for ChiakiSignalGraph
+ * (lib/src/remote/signalgraph.c).
+ *
+ * Stages sleep for a few milliseconds to stand in for PSN round trips, so
+ * overlap and ordering can be checked from the recorded timings. The
+ * tolerances are loose enough for a loaded CI machine.
+ */
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "remote/signalgraph.h"
+
+#define STAGE_MS 30
+
+static void sleep_ms(uint32_t ms) {
+#ifdef _WIN32
+  Sleep(ms);
+#else
+  struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+#endif
+}
+
+typedef struct {
+  uint32_t sleep_ms;
+  ChiakiErrorCode result;
+  bool wait_for_cancel; /* sleep until canceled instead of sleep_ms */
+  atomic_bool *canceled;
+  int runs;
+  int undone; /* position among the undo calls, 0 if not undone */
+} TestStage;
+
+static int undo_calls;
+
+static void test_undo_func(void *user) {
+  TestStage *s = user;
+  s->undone = ++undo_calls;
+}
+
+static ChiakiErrorCode test_stage_func(void *user) {
+  TestStage *s = user;
+  s->runs++;
+  if (s->wait_for_cancel) {
+    for (int i = 0; i < 500 && !*s->canceled; i++)
+      sleep_ms(2);
+    return *s->canceled ? CHIAKI_ERR_CANCELED : CHIAKI_ERR_SUCCESS;
+  }
+  if (s->sleep_ms)
+    sleep_ms(s->sleep_ms);
+  return s->result;
+}
+
+static int cancel_calls;
+static atomic_bool cancel_flag;
+
+static void test_cancel_cb(void *user) {
+  (void)user;
+  cancel_calls++;
+  cancel_flag = true;
+}
+
+static uint64_t ms(uint64_t us) { return us / 1000; }
+
+static void test_independent_stages_overlap(void) {
+  ChiakiSignalGraph g;
+  assert(chiaki_signal_graph_init(&g, NULL) == CHIAKI_ERR_SUCCESS);
+  TestStage a = {STAGE_MS, CHIAKI_ERR_SUCCESS}, b = {STAGE_MS, CHIAKI_ERR_SUCCESS}, c = {STAGE_MS, CHIAKI_ERR_SUCCESS};
+  assert(chiaki_signal_graph_add(&g, "a", test_stage_func, &a, 0) == 0);
+  assert(chiaki_signal_graph_add(&g, "b", test_stage_func, &b, 0) == 1);
+  assert(chiaki_signal_graph_add(&g, "c", test_stage_func, &c, 0) == 2);
+  assert(chiaki_signal_graph_run(&g, true) == CHIAKI_ERR_SUCCESS);
+  assert(a.runs == 1 && b.runs == 1 && c.runs == 1);
+  for (size_t i = 0; i < 3; i++)
+    assert(g.stages[i].state == CHIAKI_SIGNAL_STAGE_DONE);
+  // Run back to back this would take 3 * STAGE_MS.
+  assert(ms(g.total_us) < 2 * STAGE_MS);
+
+  // The same graph run sequentially does add up.
+  assert(chiaki_signal_graph_run(&g, false) == CHIAKI_ERR_SUCCESS);
+  assert(a.runs == 2 && b.runs == 2 && c.runs == 2);
+  assert(ms(g.total_us) >= 3 * STAGE_MS - 3);
+  assert(g.stages[1].start_us >= g.stages[0].end_us);
+  assert(g.stages[2].start_us >= g.stages[1].end_us);
+  chiaki_signal_graph_fini(&g);
+}
+
+static void test_dependencies_are_respected(void) {
+  // a -> c, b -> c, c -> d; a is the slow branch.
+  ChiakiSignalGraph g;
+  assert(chiaki_signal_graph_init(&g, NULL) == CHIAKI_ERR_SUCCESS);
+  TestStage a = {2 * STAGE_MS, CHIAKI_ERR_SUCCESS}, b = {STAGE_MS / 3, CHIAKI_ERR_SUCCESS};
+  TestStage c = {STAGE_MS / 3, CHIAKI_ERR_SUCCESS}, d = {STAGE_MS / 3, CHIAKI_ERR_SUCCESS};
+  int ia = chiaki_signal_graph_add(&g, "a", test_stage_func, &a, 0);
+  int ib = chiaki_signal_graph_add(&g, "b", test_stage_func, &b, 0);
+  int ic = chiaki_signal_graph_add(&g, "c", test_stage_func, &c, (1u << ia) | (1u << ib));
+  int id = chiaki_signal_graph_add(&g, "d", test_stage_func, &d, 1u << ic);
+  assert(chiaki_signal_graph_run(&g, true) == CHIAKI_ERR_SUCCESS);
+  assert(g.stages[ic].start_us >= g.stages[ia].end_us);
+  assert(g.stages[ic].start_us >= g.stages[ib].end_us);
+  assert(g.stages[id].start_us >= g.stages[ic].end_us);
+
+  // The slow branch is the critical path, b finished early and is not.
+  assert(g.stages[ia].critical);
+  assert(!g.stages[ib].critical);
+  assert(g.stages[ic].critical);
+  assert(g.stages[id].critical);
+  chiaki_signal_graph_fini(&g);
+}
+
+static void test_invalid_dependencies_are_rejected(void) {
+  ChiakiSignalGraph g;
+  assert(chiaki_signal_graph_init(&g, NULL) == CHIAKI_ERR_SUCCESS);
+  TestStage a = {0, CHIAKI_ERR_SUCCESS};
+  // Nothing to depend on yet, and a stage can't depend on itself.
+  assert(chiaki_signal_graph_add(&g, "a", test_stage_func, &a, 1u << 0) == -1);
+  assert(chiaki_signal_graph_add(&g, "a", test_stage_func, &a, 0) == 0);
+  assert(chiaki_signal_graph_add(&g, "b", test_stage_func, &a, 1u << 1) == -1);
+  for (int i = 1; i < CHIAKI_SIGNAL_GRAPH_STAGES_MAX; i++)
+    assert(chiaki_signal_graph_add(&g, "x", test_stage_func, &a, 1u << 0) == i);
+  assert(chiaki_signal_graph_add(&g, "full", test_stage_func, &a, 0) == -1);
+  chiaki_signal_graph_fini(&g);
+}
+
+static void test_failure_skips_dependents_and_cancels(void) {
+  // fail -> dependent; slow runs beside them and gives up when canceled.
+  ChiakiSignalGraph g;
+  assert(chiaki_signal_graph_init(&g, NULL) == CHIAKI_ERR_SUCCESS);
+  cancel_calls = 0;
+  cancel_flag = false;
+  chiaki_signal_graph_set_cancel_cb(&g, test_cancel_cb, NULL);
+  TestStage fail = {STAGE_MS / 3, CHIAKI_ERR_HTTP_NONOK};
+  TestStage dependent = {0, CHIAKI_ERR_SUCCESS};
+  TestStage slow = {0, CHIAKI_ERR_SUCCESS, true, &cancel_flag};
+  int ifail = chiaki_signal_graph_add(&g, "fail", test_stage_func, &fail, 0);
+  int idep = chiaki_signal_graph_add(&g, "dependent", test_stage_func, &dependent, 1u << ifail);
+  int islow = chiaki_signal_graph_add(&g, "slow", test_stage_func, &slow, 0);
+  int iafter = chiaki_signal_graph_add(&g, "after_dependent", test_stage_func, &dependent, 1u << idep);
+
+  // The first failure is reported, not the cancellation it caused.
+  assert(chiaki_signal_graph_run(&g, true) == CHIAKI_ERR_HTTP_NONOK);
+  assert(cancel_calls == 1);
+  assert(g.stages[ifail].state == CHIAKI_SIGNAL_STAGE_FAILED);
+  assert(g.stages[idep].state == CHIAKI_SIGNAL_STAGE_SKIPPED);
+  assert(g.stages[iafter].state == CHIAKI_SIGNAL_STAGE_SKIPPED);
+  assert(dependent.runs == 0);
+  assert(g.stages[islow].state == CHIAKI_SIGNAL_STAGE_FAILED);
+  assert(g.stages[islow].err == CHIAKI_ERR_CANCELED);
+  // slow would have waited a second without the cancel callback.
+  assert(ms(g.total_us) < 500);
+  chiaki_signal_graph_fini(&g);
+}
+
+static void test_sequential_failure(void) {
+  ChiakiSignalGraph g;
+  assert(chiaki_signal_graph_init(&g, NULL) == CHIAKI_ERR_SUCCESS);
+  cancel_calls = 0;
+  cancel_flag = false;
+  chiaki_signal_graph_set_cancel_cb(&g, test_cancel_cb, NULL);
+  TestStage ok = {0, CHIAKI_ERR_SUCCESS}, fail = {0, CHIAKI_ERR_TIMEOUT}, dependent = {0, CHIAKI_ERR_SUCCESS};
+  int iok = chiaki_signal_graph_add(&g, "ok", test_stage_func, &ok, 0);
+  int ifail = chiaki_signal_graph_add(&g, "fail", test_stage_func, &fail, 1u << iok);
+  int idep = chiaki_signal_graph_add(&g, "dependent", test_stage_func, &dependent, 1u << ifail);
+  int iindep = chiaki_signal_graph_add(&g, "independent", test_stage_func, &ok, 1u << iok);
+  assert(chiaki_signal_graph_run(&g, false) == CHIAKI_ERR_TIMEOUT);
+  assert(cancel_calls == 1);
+  assert(g.stages[idep].state == CHIAKI_SIGNAL_STAGE_SKIPPED);
+  // Stages that don't depend on the failure still run, cancellation is up to them.
+  assert(g.stages[iindep].state == CHIAKI_SIGNAL_STAGE_DONE);
+  assert(ok.runs == 2);
+  chiaki_signal_graph_fini(&g);
+}
+
+/* Stands in for holepunch session creation: the session exists on the server once the request went out. */
+typedef struct {
+  TestStage stage;
+  bool created;
+  bool deleted;
+} CreateStage;
+
+static ChiakiErrorCode test_create_func(void *user) {
+  CreateStage *c = user;
+  c->created = true;
+  return test_stage_func(&c->stage);
+}
+
+static void test_create_undo(void *user) {
+  CreateStage *c = user;
+  c->deleted = c->created;
+  test_undo_func(&c->stage);
+}
+
+static void test_undo_after_failure_in_flight(void) {
+  // The holepunch prepare graph: upnp -> offer, ws_open -> create -> start. offer fails while create
+  // waits for its notifications, so create was canceled after it created the session on the server.
+  ChiakiSignalGraph g;
+  assert(chiaki_signal_graph_init(&g, NULL) == CHIAKI_ERR_SUCCESS);
+  cancel_calls = 0;
+  cancel_flag = false;
+  undo_calls = 0;
+  chiaki_signal_graph_set_cancel_cb(&g, test_cancel_cb, NULL);
+  TestStage upnp = {0, CHIAKI_ERR_SUCCESS}, ws_open = {STAGE_MS / 3, CHIAKI_ERR_SUCCESS};
+  TestStage offer = {STAGE_MS, CHIAKI_ERR_NETWORK}, start = {0, CHIAKI_ERR_SUCCESS};
+  CreateStage create = {{0, CHIAKI_ERR_SUCCESS, true, &cancel_flag}};
+  int iupnp = chiaki_signal_graph_add(&g, "upnp", test_stage_func, &upnp, 0);
+  int iws = chiaki_signal_graph_add(&g, "ws_open", test_stage_func, &ws_open, 0);
+  int icreate = chiaki_signal_graph_add(&g, "create", test_create_func, &create, 1u << iws);
+  int ioffer = chiaki_signal_graph_add(&g, "offer", test_stage_func, &offer, 1u << iupnp);
+  int istart = chiaki_signal_graph_add(&g, "start", test_stage_func, &start, 1u << icreate);
+  chiaki_signal_graph_set_undo(&g, iws, test_undo_func);
+  chiaki_signal_graph_set_undo(&g, icreate, test_create_undo);
+  chiaki_signal_graph_set_undo(&g, ioffer, test_undo_func);
+  chiaki_signal_graph_set_undo(&g, istart, test_undo_func);
+
+  assert(chiaki_signal_graph_run(&g, true) == CHIAKI_ERR_NETWORK);
+  assert(g.stages[icreate].state == CHIAKI_SIGNAL_STAGE_FAILED);
+  assert(g.stages[icreate].err == CHIAKI_ERR_CANCELED);
+  assert(g.stages[istart].state == CHIAKI_SIGNAL_STAGE_SKIPPED);
+  assert(undo_calls == 0);
+
+  chiaki_signal_graph_undo(&g);
+  // Every stage that started is undone, the canceled one too, and nothing that never ran.
+  assert(undo_calls == 3);
+  assert(create.created && create.deleted);
+  assert(offer.undone && ws_open.undone && create.stage.undone);
+  assert(!start.undone && !upnp.undone);
+  // create goes before the websocket it needs
+  assert(create.stage.undone < ws_open.undone);
+
+  // Sequentially create finishes before offer even starts and start still runs after it,
+  // everything is undone in reverse.
+  undo_calls = 0;
+  create.stage.wait_for_cancel = false;
+  create.created = create.deleted = false;
+  offer.undone = ws_open.undone = create.stage.undone = 0;
+  assert(chiaki_signal_graph_run(&g, false) == CHIAKI_ERR_NETWORK);
+  chiaki_signal_graph_undo(&g);
+  assert(undo_calls == 4);
+  assert(create.deleted);
+  assert(start.undone == 1 && offer.undone == 2 && create.stage.undone == 3 && ws_open.undone == 4);
+  chiaki_signal_graph_fini(&g);
+}
+
+void run_signalgraph_tests(void) {
+  test_independent_stages_overlap();
+  test_dependencies_are_respected();
+  test_invalid_dependencies_are_rejected();
+  test_failure_skips_dependents_and_cancels();
+  test_sequential_failure();
+  test_undo_after_failure_in_flight();
+}
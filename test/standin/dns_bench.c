@@ -0,0 +1,382 @@
+/*
+ * dns_bench.c — ChiakiDnsCache against the stand-in DNS server
+ * (vitarps5_dns).
+ *
+ * First checks the cache end to end over real DNS messages on loopback,
+ * failing with a non-zero exit status if any check does not hold:
+ *
+ *   ttl          the TTL from the answer decides when the name is asked again
+ *   fallback     SERVFAIL and a dropped query fall back to the expired answer,
+ *                NXDOMAIN is cached, an unanswered new name times out
+ *   concurrency  lookups of one name from 8 threads share a single A and a
+ *                single AAAA query, and both are in flight at the same time
+ *
+ * Expiry is stepped with an offset on the cache clock instead of sleeping.
+ *
+ * Then replays the name lookups of one remote connect (device list, push
+ * server address and websocket host, session calls, two STUN servers, the
+ * punch messages) with every query taking --rtt, in three modes:
+ *
+ *   direct      every call resolves, what vita_curl_add_resolve() and
+ *               vita_resolve_sin() did before
+ *   cached      through a new cache, so only the first lookup of each name waits
+ *   prefetched  the known PSN and STUN names are prefetched first, as the
+ *               Vita client does at start, and the connect begins after that
+ *
+ *   BENCH dns mode=.. runs=.. rtt_ms=.. lookups=.. queries=.. connect_ms=..
+ *         reconnect_ms=..
+ *
+ * connect_ms is the mean time spent resolving in one connect, reconnect_ms a
+ * second connect through the same cache.
+ *
+ * Usage: vitarps5_dns [--runs N] [--rtt MS] [--verbose]
+ */
+
+#define _GNU_SOURCE
+
+#include "dns_standin.h"
+
+#include <chiaki/dnscache.h>
+#include <chiaki/log.h>
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WEB_HOST "web.np.playstation.com"
+#define PUSH_HOST "mobile-pushcl.np.communication.playstation.net"
+#define WS_HOST "us-west-2.pushcl.np.communication.playstation.net"
+#define LOOKUP_TIMEOUT_MS 2000
+#define CONCURRENT_LOOKUPS 8
+
+static const DnsStandinRecord records[] = {
+    {WEB_HOST, "203.0.113.10", "2001:db8::10", 300},
+    {PUSH_HOST, "203.0.113.11", NULL, 60},
+    {WS_HOST, "203.0.113.12", NULL, 60},
+    {"asm.np.community.playstation.net", "203.0.113.13", NULL, 300},
+    {"stun.moonlight-stream.org", "203.0.113.20", NULL, 300},
+    {"stun.l.google.com", "203.0.113.21", "2001:db8::21", 300},
+    {"short-ttl.test", "203.0.113.99", NULL, 5},
+};
+
+#define RECORDS_COUNT (sizeof(records) / sizeof(records[0]))
+
+/* The names the Vita client prefetches at start, see vita_dns_prefetch_known_hosts(). */
+static const char *const prefetch_hosts[] = {
+    WEB_HOST, PUSH_HOST, "asm.np.community.playstation.net", "stun.moonlight-stream.org", "stun.l.google.com",
+};
+
+/* Lookups of one remote connect, in the order holepunch.c makes them. */
+static const char *const connect_sequence[] = {
+    WEB_HOST,                    /* device list */
+    PUSH_HOST,                   /* push server address */
+    WS_HOST,                     /* websocket */
+    WEB_HOST,                    /* session create */
+    WEB_HOST,                    /* start command */
+    WEB_HOST,                    /* session view */
+    "stun.moonlight-stream.org", /* external address */
+    "stun.l.google.com",         /* allocation increment */
+    WEB_HOST,                    /* offer */
+    WEB_HOST,                    /* ack */
+    WEB_HOST,                    /* member delete */
+};
+
+#define PREFETCH_HOSTS (sizeof(prefetch_hosts) / sizeof(prefetch_hosts[0]))
+#define CONNECT_LOOKUPS (sizeof(connect_sequence) / sizeof(connect_sequence[0]))
+
+static atomic_uint_fast64_t clock_offset_ms;
+
+static uint64_t offset_now_ms(void *user) {
+  (void)user;
+  return chiaki_time_now_monotonic_ms() + atomic_load(&clock_offset_ms);
+}
+
+static ChiakiDnsCache *cache_new(DnsStandinClient *client, ChiakiLog *log) {
+  ChiakiDnsCacheConfig config;
+  chiaki_dns_cache_config_defaults(&config);
+  config.backend.resolve = dns_standin_resolve;
+  config.backend.user = client;
+  config.log = log;
+  config.min_ttl_sec = 1;
+  config.now_ms = offset_now_ms;
+  return chiaki_dns_cache_new(&config);
+}
+
+static ChiakiErrorCode lookup(ChiakiDnsCache *cache, const char *host, uint32_t families, size_t *count) {
+  ChiakiDnsAddr addrs[CHIAKI_DNS_ADDRS_MAX];
+  *count = CHIAKI_DNS_ADDRS_MAX;
+  return chiaki_dns_cache_lookup(cache, host, families, addrs, count, LOOKUP_TIMEOUT_MS);
+}
+
+#define CHECK(cond)                                                         \
+  do {                                                                      \
+    if (!(cond)) {                                                          \
+      fprintf(stderr, "dns check failed: %s (line %d)\n", #cond, __LINE__); \
+      ok = false;                                                           \
+      goto out;                                                             \
+    }                                                                       \
+  } while (0)
+
+static bool check_ttl(DnsStandin *standin, DnsStandinClient *client, ChiakiLog *log) {
+  bool ok = true;
+  size_t count;
+  DnsStandinStats s;
+  ChiakiDnsCache *cache = cache_new(client, log);
+  CHECK(cache);
+
+  CHECK(lookup(cache, "short-ttl.test", CHIAKI_DNS_FAMILY_IPV4, &count) == CHIAKI_ERR_SUCCESS && count == 1);
+  CHECK(lookup(cache, "short-ttl.test", CHIAKI_DNS_FAMILY_IPV4, &count) == CHIAKI_ERR_SUCCESS);
+  atomic_fetch_add(&clock_offset_ms, 4000);
+  CHECK(lookup(cache, "short-ttl.test", CHIAKI_DNS_FAMILY_IPV4, &count) == CHIAKI_ERR_SUCCESS);
+  dns_standin_stats(standin, &s);
+  CHECK(s.queries_a == 1);
+
+  /* the record says 5 s */
+  atomic_fetch_add(&clock_offset_ms, 2000);
+  CHECK(lookup(cache, "short-ttl.test", CHIAKI_DNS_FAMILY_IPV4, &count) == CHIAKI_ERR_SUCCESS);
+  dns_standin_stats(standin, &s);
+  CHECK(s.queries_a == 2);
+
+out:
+  chiaki_dns_cache_free(cache);
+  printf("CHECK dns ttl=%s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static bool check_fallback(DnsStandin *standin, DnsStandinClient *client, ChiakiLog *log) {
+  bool ok = true;
+  size_t count;
+  DnsStandinStats s;
+  ChiakiDnsCacheStats cs;
+  ChiakiDnsCache *cache = cache_new(client, log);
+  CHECK(cache);
+
+  CHECK(lookup(cache, WEB_HOST, CHIAKI_DNS_FAMILY_IPV4, &count) == CHIAKI_ERR_SUCCESS);
+  atomic_fetch_add(&clock_offset_ms, 301 * 1000);
+  dns_standin_set_mode(standin, DNS_STANDIN_SERVFAIL);
+  CHECK(lookup(cache, WEB_HOST, CHIAKI_DNS_FAMILY_IPV4, &count) == CHIAKI_ERR_SUCCESS && count == 1);
+
+  /* past the retry hold-off, the resolver stops answering at all */
+  atomic_fetch_add(&clock_offset_ms, 6000);
+  dns_standin_set_mode(standin, DNS_STANDIN_DROP);
+  CHECK(lookup(cache, WEB_HOST, CHIAKI_DNS_FAMILY_IPV4, &count) == CHIAKI_ERR_SUCCESS && count == 1);
+  CHECK(lookup(cache, "asm.np.community.playstation.net", CHIAKI_DNS_FAMILY_IPV4, &count) == CHIAKI_ERR_TIMEOUT);
+  dns_standin_stats(standin, &s);
+  CHECK(s.servfail == 1 && s.dropped == 2);
+
+  dns_standin_set_mode(standin, DNS_STANDIN_ANSWER);
+  CHECK(lookup(cache, "nxdomain.test", CHIAKI_DNS_FAMILY_IPV4, &count) == CHIAKI_ERR_HOST_UNREACH);
+  CHECK(lookup(cache, "nxdomain.test", CHIAKI_DNS_FAMILY_IPV4, &count) == CHIAKI_ERR_HOST_UNREACH);
+  dns_standin_stats(standin, &s);
+  CHECK(s.nxdomain == 1);
+
+  chiaki_dns_cache_stats(cache, &cs);
+  CHECK(cs.stale_served == 2 && cs.negative_hits == 1 && cs.failures == 3);
+
+out:
+  dns_standin_set_mode(standin, DNS_STANDIN_ANSWER);
+  chiaki_dns_cache_free(cache);
+  printf("CHECK dns fallback=%s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+typedef struct {
+  ChiakiDnsCache *cache;
+  ChiakiErrorCode err;
+  size_t count;
+} LookupThread;
+
+static void *lookup_thread_func(void *user) {
+  LookupThread *t = user;
+  t->err = lookup(t->cache, WEB_HOST, CHIAKI_DNS_FAMILY_ANY, &t->count);
+  return NULL;
+}
+
+static bool check_concurrency(DnsStandin *standin, DnsStandinClient *client, ChiakiLog *log) {
+  bool ok = true;
+  DnsStandinStats before, after;
+  ChiakiDnsCacheStats cs;
+  ChiakiThread threads[CONCURRENT_LOOKUPS];
+  LookupThread args[CONCURRENT_LOOKUPS];
+  size_t started = 0;
+  ChiakiDnsCache *cache = cache_new(client, log);
+  CHECK(cache);
+
+  dns_standin_stats(standin, &before);
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  for (; started < CONCURRENT_LOOKUPS; started++) {
+    args[started] = (LookupThread){cache, CHIAKI_ERR_UNKNOWN, 0};
+    CHECK(chiaki_thread_create(&threads[started], lookup_thread_func, &args[started]) == CHIAKI_ERR_SUCCESS);
+  }
+  for (size_t i = 0; i < started; i++) {
+    chiaki_thread_join(&threads[i], NULL);
+    CHECK(args[i].err == CHIAKI_ERR_SUCCESS && args[i].count == 2);
+  }
+  started = 0;
+  double elapsed_ms = (chiaki_time_now_monotonic_us() - start_us) / 1000.0;
+  dns_standin_stats(standin, &after);
+  chiaki_dns_cache_stats(cache, &cs);
+  printf("CHECK dns concurrency lookups=%d queries=%llu max_outstanding=%u coalesced=%llu elapsed_ms=%.1f\n",
+         CONCURRENT_LOOKUPS, (unsigned long long)(after.queries - before.queries), after.max_outstanding,
+         (unsigned long long)cs.coalesced, elapsed_ms);
+  CHECK(after.queries_a - before.queries_a == 1 && after.queries_aaaa - before.queries_aaaa == 1);
+  CHECK(after.max_outstanding >= 2);
+
+out:
+  for (size_t i = 0; i < started; i++)
+    chiaki_thread_join(&threads[i], NULL);
+  chiaki_dns_cache_free(cache);
+  printf("CHECK dns concurrency=%s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+#undef CHECK
+
+typedef enum { MODE_DIRECT, MODE_CACHED, MODE_PREFETCHED } BenchMode;
+
+static const char *const mode_names[] = {"direct", "cached", "prefetched"};
+
+/* Resolves connect_sequence, returns the time it took in microseconds or 0 on failure. */
+static uint64_t run_connect(ChiakiDnsCache *cache, DnsStandinClient *client) {
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  for (size_t i = 0; i < CONNECT_LOOKUPS; i++) {
+    ChiakiDnsAddr addrs[CHIAKI_DNS_ADDRS_MAX];
+    size_t count = CHIAKI_DNS_ADDRS_MAX;
+    uint32_t ttl_sec;
+    ChiakiErrorCode err =
+        cache ? chiaki_dns_cache_lookup(cache, connect_sequence[i], CHIAKI_DNS_FAMILY_IPV4, addrs, &count,
+                                        LOOKUP_TIMEOUT_MS)
+              : dns_standin_resolve(client, connect_sequence[i], CHIAKI_DNS_FAMILY_IPV4, addrs, &count, &ttl_sec);
+    if (err != CHIAKI_ERR_SUCCESS || !count) {
+      fprintf(stderr, "lookup of %s failed: %s\n", connect_sequence[i], chiaki_error_string(err));
+      return 0;
+    }
+  }
+  uint64_t elapsed_us = chiaki_time_now_monotonic_us() - start_us;
+  return elapsed_us ? elapsed_us : 1;
+}
+
+static bool wait_prefetched(ChiakiDnsCache *cache) {
+  ChiakiDnsCacheStats stats;
+  for (int i = 0; i < LOOKUP_TIMEOUT_MS; i++) {
+    chiaki_dns_cache_stats(cache, &stats);
+    if (stats.queries >= PREFETCH_HOSTS)
+      return true;
+    struct timespec ts = {0, 1000000L};
+    nanosleep(&ts, NULL);
+  }
+  return false;
+}
+
+static bool bench_mode(BenchMode mode, unsigned runs, double rtt_ms, DnsStandin *standin, DnsStandinClient *client,
+                       ChiakiLog *log) {
+  uint64_t connect_us = 0, reconnect_us = 0;
+  DnsStandinStats before, after;
+  dns_standin_stats(standin, &before);
+  for (unsigned r = 0; r < runs; r++) {
+    ChiakiDnsCache *cache = NULL;
+    if (mode != MODE_DIRECT) {
+      cache = cache_new(client, log);
+      if (!cache)
+        return false;
+    }
+    if (mode == MODE_PREFETCHED) {
+      for (size_t i = 0; i < PREFETCH_HOSTS; i++)
+        chiaki_dns_cache_prefetch(cache, prefetch_hosts[i], CHIAKI_DNS_FAMILY_IPV4);
+      if (!wait_prefetched(cache)) {
+        chiaki_dns_cache_free(cache);
+        return false;
+      }
+    }
+    uint64_t first = run_connect(cache, client);
+    uint64_t second = first ? run_connect(cache, client) : 0;
+    chiaki_dns_cache_free(cache);
+    if (!first || !second)
+      return false;
+    connect_us += first;
+    reconnect_us += second;
+  }
+  dns_standin_stats(standin, &after);
+  printf("BENCH dns mode=%s runs=%u rtt_ms=%.1f lookups=%zu queries=%.1f connect_ms=%.2f reconnect_ms=%.2f\n",
+         mode_names[mode], runs, rtt_ms, CONNECT_LOOKUPS, (double)(after.queries - before.queries) / runs,
+         connect_us / 1000.0 / runs, reconnect_us / 1000.0 / runs);
+  return true;
+}
+
+static DnsStandin *standin_start(uint32_t delay_us) {
+  DnsStandinConfig config;
+  dns_standin_config_defaults(&config);
+  config.delay_us = delay_us;
+  config.records = records;
+  config.records_count = RECORDS_COUNT;
+  DnsStandin *standin = dns_standin_new(&config);
+  if (standin && !dns_standin_start(standin)) {
+    dns_standin_free(standin);
+    standin = NULL;
+  }
+  if (!standin)
+    fprintf(stderr, "failed to start the DNS stand-in\n");
+  return standin;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned runs = 3;
+  double rtt_ms = 30.0;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--verbose") == 0) {
+      verbose = true;
+      continue;
+    }
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    if (strcmp(arg, "--runs") == 0)
+      runs = (unsigned)atoi(val);
+    else if (strcmp(arg, "--rtt") == 0)
+      rtt_ms = atof(val);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+  if (!runs || rtt_ms < 0.0) {
+    fprintf(stderr, "invalid options\n");
+    return 2;
+  }
+
+  ChiakiLog log;
+  chiaki_log_init(&log, verbose ? CHIAKI_LOG_ALL : CHIAKI_LOG_ERROR, chiaki_log_cb_print, NULL);
+
+  /* the checks use a short delay of their own, the dropped query waits for the client timeout */
+  DnsStandin *standin = standin_start(20 * 1000);
+  if (!standin)
+    return 1;
+  DnsStandinClient client = {dns_standin_port(standin), 200};
+  bool ok = check_ttl(standin, &client, &log);
+  ok = check_fallback(standin, &client, &log) && ok;
+  ok = check_concurrency(standin, &client, &log) && ok;
+  dns_standin_free(standin);
+
+  standin = standin_start((uint32_t)(rtt_ms * 1000.0));
+  if (!standin)
+    return 1;
+  client.port = dns_standin_port(standin);
+  client.timeout_ms = (uint32_t)rtt_ms * 4 + 200;
+  for (BenchMode mode = MODE_DIRECT; mode <= MODE_PREFETCHED; mode++) {
+    if (!bench_mode(mode, runs, rtt_ms, standin, &client, &log)) {
+      fprintf(stderr, "bench mode %s failed\n", mode_names[mode]);
+      ok = false;
+    }
+  }
+  dns_standin_free(standin);
+  return ok ? 0 : 1;
+}
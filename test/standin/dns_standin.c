@@ -0,0 +1,454 @@
+/*
+ * dns_standin.c — Stand-in DNS server and UDP client backend, see dns_standin.h.
+ *
+ * One thread receives queries and sends replies once their delay has passed.
+ * Only what a stub resolver asks is understood: one question, QTYPE A or
+ * AAAA, class IN, no EDNS.
+ */
+
+#define _GNU_SOURCE
+
+#include "dns_standin.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DNS_STANDIN_MSG_MAX 512
+#define DNS_STANDIN_PENDING_MAX 64
+#define DNS_HEADER_SIZE 12
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN 1
+#define DNS_RCODE_SERVFAIL 2
+#define DNS_RCODE_NXDOMAIN 3
+
+typedef struct {
+  uint64_t due_us;
+  struct sockaddr_in to;
+  uint8_t msg[DNS_STANDIN_MSG_MAX];
+  size_t len;
+} DnsStandinReply;
+
+struct dns_standin_t {
+  DnsStandinConfig config;
+  int fd;
+  uint16_t port;
+  int stop_pipe[2];
+  pthread_t thread;
+  bool started;
+
+  pthread_mutex_t mutex; /* mode and stats */
+  DnsStandinMode mode;
+  DnsStandinStats stats;
+
+  /* only touched by the server thread */
+  DnsStandinReply pending[DNS_STANDIN_PENDING_MAX];
+  size_t pending_count;
+};
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+  put_u16(p, (uint16_t)(v >> 16));
+  put_u16(p + 2, (uint16_t)v);
+}
+
+/* Writes the dotted name of the question at msg + *off into name, advances *off past it. */
+static bool read_name(const uint8_t *msg, size_t len, size_t *off, char *name, size_t name_size) {
+  size_t o = *off, n = 0;
+  while (o < len && msg[o]) {
+    size_t label = msg[o++];
+    if (label > 63 || o + label > len || n + label + 2 > name_size)
+      return false;
+    if (n)
+      name[n++] = '.';
+    memcpy(name + n, msg + o, label);
+    n += label;
+    o += label;
+  }
+  if (o >= len)
+    return false;
+  name[n] = '\0';
+  *off = o + 1;
+  return true;
+}
+
+/* Skips a possibly compressed name in an answer. */
+static bool skip_name(const uint8_t *msg, size_t len, size_t *off) {
+  size_t o = *off;
+  while (o < len) {
+    uint8_t label = msg[o];
+    if (!label) {
+      *off = o + 1;
+      return true;
+    }
+    if ((label & 0xc0) == 0xc0) {
+      *off = o + 2;
+      return o + 2 <= len;
+    }
+    o += 1 + label;
+  }
+  return false;
+}
+
+static const DnsStandinRecord *find_record(DnsStandin *standin, const char *name) {
+  for (size_t i = 0; i < standin->config.records_count; i++) {
+    if (strcasecmp(standin->config.records[i].name, name) == 0)
+      return &standin->config.records[i];
+  }
+  return NULL;
+}
+
+/* Builds the reply to query in place. Returns false if it is not a query this server understands. */
+static bool build_reply(DnsStandin *standin, DnsStandinMode mode, const uint8_t *query, size_t query_len,
+                        DnsStandinReply *reply) {
+  if (query_len < DNS_HEADER_SIZE || query_len > DNS_STANDIN_MSG_MAX || (query[2] & 0x80) ||
+      get_u16(query + 4) != 1)
+    return false;
+  char name[256];
+  size_t off = DNS_HEADER_SIZE;
+  if (!read_name(query, query_len, &off, name, sizeof(name)) || off + 4 > query_len)
+    return false;
+  uint16_t qtype = get_u16(query + off);
+  if (get_u16(query + off + 2) != DNS_CLASS_IN || (qtype != DNS_TYPE_A && qtype != DNS_TYPE_AAAA))
+    return false;
+  size_t question_end = off + 4;
+
+  pthread_mutex_lock(&standin->mutex);
+  standin->stats.queries++;
+  if (qtype == DNS_TYPE_A)
+    standin->stats.queries_a++;
+  else
+    standin->stats.queries_aaaa++;
+  pthread_mutex_unlock(&standin->mutex);
+
+  /* header and question are echoed back */
+  memcpy(reply->msg, query, question_end);
+  reply->len = question_end;
+  uint8_t *h = reply->msg;
+  h[2] = 0x80 | (query[2] & 0x01); /* QR, copy RD */
+  h[3] = 0x80;                     /* RA */
+  put_u16(h + 6, 0);
+  put_u16(h + 8, 0);
+  put_u16(h + 10, 0);
+
+  const DnsStandinRecord *record = find_record(standin, name);
+  if (mode == DNS_STANDIN_SERVFAIL) {
+    h[3] |= DNS_RCODE_SERVFAIL;
+    pthread_mutex_lock(&standin->mutex);
+    standin->stats.servfail++;
+    pthread_mutex_unlock(&standin->mutex);
+    return true;
+  }
+  if (!record) {
+    h[3] |= DNS_RCODE_NXDOMAIN;
+    pthread_mutex_lock(&standin->mutex);
+    standin->stats.nxdomain++;
+    pthread_mutex_unlock(&standin->mutex);
+    return true;
+  }
+
+  const char *text = qtype == DNS_TYPE_A ? record->ipv4 : record->ipv6;
+  if (!text)
+    return true; /* NODATA */
+  uint8_t rdata[16];
+  size_t rdlen = qtype == DNS_TYPE_A ? 4 : 16;
+  if (inet_pton(qtype == DNS_TYPE_A ? AF_INET : AF_INET6, text, rdata) != 1)
+    return true;
+  uint8_t *a = reply->msg + reply->len;
+  put_u16(a, 0xc000 | DNS_HEADER_SIZE); /* pointer to the question name */
+  put_u16(a + 2, qtype);
+  put_u16(a + 4, DNS_CLASS_IN);
+  put_u32(a + 6, record->ttl_sec);
+  put_u16(a + 10, (uint16_t)rdlen);
+  memcpy(a + 12, rdata, rdlen);
+  reply->len += 12 + rdlen;
+  put_u16(h + 6, 1);
+  return true;
+}
+
+static void send_due(DnsStandin *standin) {
+  uint64_t now = now_us();
+  size_t kept = 0;
+  for (size_t i = 0; i < standin->pending_count; i++) {
+    DnsStandinReply *r = &standin->pending[i];
+    if (r->due_us <= now) {
+      sendto(standin->fd, r->msg, r->len, 0, (struct sockaddr *)&r->to, sizeof(r->to));
+      continue;
+    }
+    if (kept != i)
+      standin->pending[kept] = *r;
+    kept++;
+  }
+  standin->pending_count = kept;
+}
+
+static int next_timeout_ms(DnsStandin *standin) {
+  if (!standin->pending_count)
+    return -1;
+  uint64_t now = now_us(), next = UINT64_MAX;
+  for (size_t i = 0; i < standin->pending_count; i++) {
+    if (standin->pending[i].due_us < next)
+      next = standin->pending[i].due_us;
+  }
+  if (next <= now)
+    return 0;
+  return (int)((next - now + 999) / 1000);
+}
+
+static void receive_query(DnsStandin *standin) {
+  uint8_t query[DNS_STANDIN_MSG_MAX];
+  struct sockaddr_in from;
+  socklen_t from_len = sizeof(from);
+  ssize_t n = recvfrom(standin->fd, query, sizeof(query), 0, (struct sockaddr *)&from, &from_len);
+  if (n <= 0)
+    return;
+
+  pthread_mutex_lock(&standin->mutex);
+  DnsStandinMode mode = standin->mode;
+  if (mode == DNS_STANDIN_DROP)
+    standin->stats.dropped++;
+  pthread_mutex_unlock(&standin->mutex);
+  if (mode == DNS_STANDIN_DROP || standin->pending_count == DNS_STANDIN_PENDING_MAX)
+    return;
+
+  DnsStandinReply *reply = &standin->pending[standin->pending_count];
+  if (!build_reply(standin, mode, query, (size_t)n, reply))
+    return;
+  reply->to = from;
+  reply->due_us = now_us() + standin->config.delay_us;
+  standin->pending_count++;
+
+  pthread_mutex_lock(&standin->mutex);
+  if (standin->pending_count > standin->stats.max_outstanding)
+    standin->stats.max_outstanding = (uint32_t)standin->pending_count;
+  pthread_mutex_unlock(&standin->mutex);
+}
+
+static void *server_thread(void *arg) {
+  DnsStandin *standin = arg;
+  for (;;) {
+    struct pollfd pfds[2] = {{standin->fd, POLLIN, 0}, {standin->stop_pipe[0], POLLIN, 0}};
+    int r = poll(pfds, 2, next_timeout_ms(standin));
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0 || (pfds[1].revents & POLLIN))
+      break;
+    if (pfds[0].revents & POLLIN)
+      receive_query(standin);
+    send_due(standin);
+  }
+  return NULL;
+}
+
+void dns_standin_config_defaults(DnsStandinConfig *config) {
+  memset(config, 0, sizeof(*config));
+  config->bind_addr = "127.0.0.1";
+}
+
+DnsStandin *dns_standin_new(const DnsStandinConfig *config) {
+  DnsStandin *standin = calloc(1, sizeof(*standin));
+  if (!standin)
+    return NULL;
+  standin->config = *config;
+  standin->fd = -1;
+  standin->stop_pipe[0] = standin->stop_pipe[1] = -1;
+  pthread_mutex_init(&standin->mutex, NULL);
+
+  if (pipe(standin->stop_pipe) < 0)
+    goto error;
+  standin->fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (standin->fd < 0)
+    goto error;
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(config->port);
+  if (inet_pton(AF_INET, config->bind_addr ? config->bind_addr : "127.0.0.1", &addr.sin_addr) != 1)
+    goto error;
+  if (bind(standin->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    goto error;
+  socklen_t addr_len = sizeof(addr);
+  if (getsockname(standin->fd, (struct sockaddr *)&addr, &addr_len) < 0)
+    goto error;
+  standin->port = ntohs(addr.sin_port);
+  return standin;
+
+error:
+  dns_standin_free(standin);
+  return NULL;
+}
+
+bool dns_standin_start(DnsStandin *standin) {
+  if (pthread_create(&standin->thread, NULL, server_thread, standin) != 0)
+    return false;
+  standin->started = true;
+  return true;
+}
+
+uint16_t dns_standin_port(DnsStandin *standin) {
+  return standin->port;
+}
+
+void dns_standin_set_mode(DnsStandin *standin, DnsStandinMode mode) {
+  pthread_mutex_lock(&standin->mutex);
+  standin->mode = mode;
+  pthread_mutex_unlock(&standin->mutex);
+}
+
+void dns_standin_stats(DnsStandin *standin, DnsStandinStats *stats) {
+  pthread_mutex_lock(&standin->mutex);
+  *stats = standin->stats;
+  pthread_mutex_unlock(&standin->mutex);
+}
+
+void dns_standin_free(DnsStandin *standin) {
+  if (!standin)
+    return;
+  if (standin->stop_pipe[1] >= 0 && write(standin->stop_pipe[1], "x", 1) != 1)
+    fprintf(stderr, "dns_standin: failed to signal stop\n");
+  if (standin->started)
+    pthread_join(standin->thread, NULL);
+  if (standin->fd >= 0)
+    close(standin->fd);
+  if (standin->stop_pipe[0] >= 0)
+    close(standin->stop_pipe[0]);
+  if (standin->stop_pipe[1] >= 0)
+    close(standin->stop_pipe[1]);
+  pthread_mutex_destroy(&standin->mutex);
+  free(standin);
+}
+
+static size_t build_query(uint16_t id, const char *host, uint16_t qtype, uint8_t *msg) {
+  memset(msg, 0, DNS_HEADER_SIZE);
+  put_u16(msg, id);
+  msg[2] = 0x01; /* RD */
+  put_u16(msg + 4, 1);
+  size_t len = DNS_HEADER_SIZE;
+  const char *label = host;
+  while (*label) {
+    const char *dot = strchr(label, '.');
+    size_t n = dot ? (size_t)(dot - label) : strlen(label);
+    if (!n || n > 63 || len + n + 6 > DNS_STANDIN_MSG_MAX)
+      return 0;
+    msg[len++] = (uint8_t)n;
+    memcpy(msg + len, label, n);
+    len += n;
+    label += n + (dot ? 1 : 0);
+  }
+  msg[len++] = 0;
+  put_u16(msg + len, qtype);
+  put_u16(msg + len + 2, DNS_CLASS_IN);
+  return len + 4;
+}
+
+ChiakiErrorCode dns_standin_resolve(void *user, const char *host, ChiakiDnsFamily family, ChiakiDnsAddr *addrs,
+                                    size_t *count, uint32_t *ttl_sec) {
+  const DnsStandinClient *client = user;
+  size_t addrs_size = *count;
+  *count = 0;
+  uint16_t qtype = family == CHIAKI_DNS_FAMILY_IPV4 ? DNS_TYPE_A : DNS_TYPE_AAAA;
+  uint16_t id = (uint16_t)(now_us() ^ (uintptr_t)&id);
+  uint8_t msg[DNS_STANDIN_MSG_MAX];
+  size_t len = build_query(id, host, qtype, msg);
+  if (!len)
+    return CHIAKI_ERR_INVALID_DATA;
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+    return CHIAKI_ERR_NETWORK;
+  struct sockaddr_in server;
+  memset(&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_port = htons(client->port);
+  server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ChiakiErrorCode err = CHIAKI_ERR_NETWORK;
+  if (connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0 || send(fd, msg, len, 0) != (ssize_t)len)
+    goto out;
+
+  uint64_t deadline = now_us() + (uint64_t)client->timeout_ms * 1000;
+  ssize_t n;
+  for (;;) {
+    uint64_t now = now_us();
+    if (now >= deadline) {
+      err = CHIAKI_ERR_TIMEOUT;
+      goto out;
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    int r = poll(&pfd, 1, (int)((deadline - now + 999) / 1000));
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      continue;
+    n = recv(fd, msg, sizeof(msg), 0);
+    if (n >= DNS_HEADER_SIZE && get_u16(msg) == id && (msg[2] & 0x80))
+      break;
+  }
+
+  uint8_t rcode = msg[3] & 0x0f;
+  if (rcode == DNS_RCODE_NXDOMAIN) {
+    err = CHIAKI_ERR_SUCCESS;
+    goto out;
+  }
+  if (rcode != 0)
+    goto out;
+
+  size_t off = DNS_HEADER_SIZE;
+  err = CHIAKI_ERR_INVALID_RESPONSE;
+  for (uint16_t q = get_u16(msg + 4); q; q--) {
+    if (!skip_name(msg, (size_t)n, &off) || off + 4 > (size_t)n)
+      goto out;
+    off += 4;
+  }
+  uint32_t min_ttl = UINT32_MAX;
+  for (uint16_t a = get_u16(msg + 6); a; a--) {
+    if (!skip_name(msg, (size_t)n, &off) || off + 10 > (size_t)n)
+      goto out;
+    uint16_t type = get_u16(msg + off);
+    uint32_t ttl = ((uint32_t)get_u16(msg + off + 4) << 16) | get_u16(msg + off + 6);
+    uint16_t rdlen = get_u16(msg + off + 8);
+    off += 10;
+    if (off + rdlen > (size_t)n)
+      goto out;
+    size_t addr_len = family == CHIAKI_DNS_FAMILY_IPV4 ? 4 : 16;
+    if (type == qtype && rdlen == addr_len && *count < addrs_size) {
+      ChiakiDnsAddr *addr = &addrs[(*count)++];
+      memset(addr, 0, sizeof(*addr));
+      addr->family = family;
+      memcpy(addr->addr, msg + off, addr_len);
+      if (ttl < min_ttl)
+        min_ttl = ttl;
+    }
+    off += rdlen;
+  }
+  if (*count)
+    *ttl_sec = min_ttl;
+  err = CHIAKI_ERR_SUCCESS;
+
+out:
+  close(fd);
+  return err;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+/*
+ * Stand-in DNS server for the resolver cache checks and benchmark (Linux only).
+ *
+ * Answers A and AAAA queries over UDP from a fixed record table. Names that
+ * are not in the table get NXDOMAIN, a name without a record of the asked
+ * type gets an empty NOERROR answer. The server can be switched to SERVFAIL
+ * or to dropping every query to exercise fallback paths.
+ *
+ * Resolver latency is modelled by holding each reply for delay_us. Replies
+ * are scheduled rather than slept on, so concurrent queries overlap the way
+ * they would against a real recursive resolver, and max_outstanding shows how
+ * many were in flight at once.
+ *
+ * dns_standin_resolve() is a ChiakiDnsBackend talking to the server (or any
+ * DNS server on 127.0.0.1) over UDP and reporting the TTL from the answer.
+ */
+
+#include <chiaki/dnscache.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+  DNS_STANDIN_ANSWER,
+  DNS_STANDIN_SERVFAIL,
+  DNS_STANDIN_DROP
+} DnsStandinMode;
+
+typedef struct {
+  const char *name;
+  const char *ipv4; /* NULL: no A record */
+  const char *ipv6; /* NULL: no AAAA record */
+  uint32_t ttl_sec;
+} DnsStandinRecord;
+
+typedef struct {
+  const char *bind_addr; /* default 127.0.0.1 */
+  uint16_t port;         /* 0 picks a free port, see dns_standin_port() */
+  uint32_t delay_us;
+  const DnsStandinRecord *records;
+  size_t records_count;
+} DnsStandinConfig;
+
+typedef struct {
+  uint64_t queries;
+  uint64_t queries_a;
+  uint64_t queries_aaaa;
+  uint64_t nxdomain;
+  uint64_t servfail;
+  uint64_t dropped;
+  uint32_t max_outstanding; /* most replies held back at the same time */
+} DnsStandinStats;
+
+typedef struct dns_standin_t DnsStandin;
+
+void dns_standin_config_defaults(DnsStandinConfig *config);
+
+/* Binds the socket. The record table is referenced, not copied. Returns NULL on failure. */
+DnsStandin *dns_standin_new(const DnsStandinConfig *config);
+bool dns_standin_start(DnsStandin *standin);
+uint16_t dns_standin_port(DnsStandin *standin);
+void dns_standin_set_mode(DnsStandin *standin, DnsStandinMode mode);
+void dns_standin_stats(DnsStandin *standin, DnsStandinStats *stats);
+void dns_standin_free(DnsStandin *standin);
+
+typedef struct {
+  uint16_t port;
+  uint32_t timeout_ms;
+} DnsStandinClient;
+
+/* ChiakiDnsResolveFunc, user is a DnsStandinClient. */
+ChiakiErrorCode dns_standin_resolve(void *user, const char *host, ChiakiDnsFamily family, ChiakiDnsAddr *addrs,
+                                    size_t *count, uint32_t *ttl_sec);
@@ -0,0 +1,249 @@
+/*
+ * loopback_bench.c — End-to-end stream benchmark against the stand-in host
+ * (vitarps5_loopback).
+ *
+ * Starts a stand-in host on 127.0.0.1 and connects a real ChiakiSession to
+ * it, so the whole client path (session request, ctrl, Takion handshake,
+ * ECDH, gkcrypt, FEC, frame processor, audio receiver) runs against known
+ * input. After --seconds of streaming a single line is printed:
+ *
+ *   BENCH loopback seconds=.. video_frames=.. fps=.. frames_lost=..
+ *         frames_recovered=.. audio_frames=.. mbps=.. shaped_dropped=..
+ *         idr_requests=.. connect_ms=..
+ *
+ * With --cost, the session's threads are accounted to a ChiakiCostAcct in
+ * the given mode and once the session has stopped a line per subsystem and
+ * per thread follows:
+ *
+ *   BENCH loopback_cost subsys=.. cpu_us=.. scopes=.. allocs=.. alloc_bytes=..
+ *   BENCH loopback_cost thread=.. home=.. cpu_us=..
+ *
+ * The exit status is non-zero if the client never started streaming or no
+ * video arrived, which makes the short run usable as a smoke test.
+ *
+ * Usage: vitarps5_loopback [--seconds N] [--shape SPEC] [--scenario FILE]
+ *                          [--ps4] [--seed N] [--cost sampled|detailed]
+ *                          [--video FILE.h264] [--audio FILE.opus] [--verbose]
+ */
+
+#define _GNU_SOURCE
+
+#include "standin.h"
+
+#include <chiaki/costacct.h>
+#include <chiaki/session.h>
+#include <chiaki/time.h>
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOOPBACK_CONNECT_TIMEOUT_US 10000000
+
+typedef struct {
+  atomic_ullong video_frames;
+  atomic_ullong frames_lost;
+  atomic_ullong frames_recovered;
+  atomic_ullong video_bytes;
+  atomic_ullong audio_frames;
+  atomic_bool quit;
+} LoopbackCounters;
+
+static bool on_video(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered,
+                     const ChiakiVideoSampleInfo *info, void *user) {
+  LoopbackCounters *c = user;
+  (void)buf;
+  (void)info;
+  atomic_fetch_add(&c->video_frames, 1);
+  atomic_fetch_add(&c->video_bytes, buf_size);
+  if (frames_lost > 0)
+    atomic_fetch_add(&c->frames_lost, (unsigned long long)frames_lost);
+  if (frame_recovered)
+    atomic_fetch_add(&c->frames_recovered, 1);
+  return true;
+}
+
+static void on_audio_header(ChiakiAudioHeader *header, void *user) {
+  (void)header;
+  (void)user;
+}
+
+static void on_audio_frame(uint8_t *buf, size_t buf_size, void *user) {
+  LoopbackCounters *c = user;
+  (void)buf;
+  (void)buf_size;
+  atomic_fetch_add(&c->audio_frames, 1);
+}
+
+static void print_cost(ChiakiCostAcct *acct) {
+  ChiakiCostSnapshot snap;
+  chiaki_cost_acct_snapshot(acct, &snap);
+  for (size_t s = 0; s < CHIAKI_COST_SUBSYS_COUNT; s++) {
+    const ChiakiCostSubsysStats *st = &snap.subsys[s];
+    printf("BENCH loopback_cost subsys=%s cpu_us=%llu scopes=%llu allocs=%llu alloc_bytes=%llu\n",
+           chiaki_cost_subsys_string((ChiakiCostSubsys)s), (unsigned long long)st->cpu_us,
+           (unsigned long long)st->scopes, (unsigned long long)st->allocs, (unsigned long long)st->alloc_bytes);
+  }
+  for (size_t i = 0; i < snap.threads_count; i++)
+    printf("BENCH loopback_cost thread=\"%s\" home=%s cpu_us=%llu\n", snap.threads[i].name,
+           chiaki_cost_subsys_string(snap.threads[i].home), (unsigned long long)snap.threads[i].cpu_us);
+}
+
+static void on_event(ChiakiEvent *event, void *user) {
+  LoopbackCounters *c = user;
+  if (event->type == CHIAKI_EVENT_QUIT) {
+    fprintf(stderr, "session quit: %s\n", chiaki_quit_reason_string(event->quit.reason));
+    atomic_store(&c->quit, true);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  StandinConfig config;
+  standin_config_defaults(&config);
+  NetsimScenario scenario;
+  double seconds = 10.0;
+  bool verbose = false;
+  bool cost = false;
+  ChiakiCostConfig cost_config;
+  chiaki_cost_config_defaults(&cost_config);
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--ps4") == 0) {
+      config.ps5 = false;
+      continue;
+    }
+    if (strcmp(arg, "--verbose") == 0) {
+      verbose = true;
+      continue;
+    }
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    if (strcmp(arg, "--seconds") == 0)
+      seconds = atof(val);
+    else if (strcmp(arg, "--shape") == 0) {
+      if (!netsim_params_parse(&config.shape, val)) {
+        fprintf(stderr, "invalid --shape %s\n", val);
+        return 2;
+      }
+    } else if (strcmp(arg, "--scenario") == 0) {
+      char err[128];
+      if (!netsim_scenario_load(&scenario, val, err, sizeof(err))) {
+        fprintf(stderr, "invalid --scenario: %s\n", err);
+        return 2;
+      }
+      config.scenario = &scenario;
+    } else if (strcmp(arg, "--seed") == 0)
+      config.seed = strtoull(val, NULL, 0);
+    else if (strcmp(arg, "--video") == 0)
+      config.video_path = val;
+    else if (strcmp(arg, "--audio") == 0)
+      config.audio_path = val;
+    else if (strcmp(arg, "--cost") == 0) {
+      cost = true;
+      if (strcmp(val, "detailed") == 0)
+        cost_config.mode = CHIAKI_COST_MODE_DETAILED;
+      else if (strcmp(val, "sampled") != 0) {
+        fprintf(stderr, "invalid --cost %s\n", val);
+        return 2;
+      }
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+  if (seconds <= 0.0) {
+    fprintf(stderr, "invalid options\n");
+    return 2;
+  }
+
+  if (chiaki_lib_init() != CHIAKI_ERR_SUCCESS) {
+    fprintf(stderr, "chiaki_lib_init failed\n");
+    return 1;
+  }
+  ChiakiLog log;
+  chiaki_log_init(&log, verbose ? CHIAKI_LOG_ALL : CHIAKI_LOG_ERROR | CHIAKI_LOG_WARNING, chiaki_log_cb_print, NULL);
+  config.log = &log;
+
+  StandinHost *host = standin_host_new(&config);
+  if (!host || !standin_host_start(host)) {
+    fprintf(stderr, "failed to start the stand-in host\n");
+    standin_host_free(host);
+    return 1;
+  }
+
+  ChiakiConnectInfo info;
+  memset(&info, 0, sizeof(info));
+  info.ps5 = config.ps5;
+  info.host = config.bind_addr;
+  memcpy(info.morning, config.morning, sizeof(info.morning));
+  chiaki_connect_video_profile_preset(&info.video_profile, CHIAKI_VIDEO_RESOLUTION_PRESET_720p,
+                                      CHIAKI_VIDEO_FPS_PRESET_60);
+
+  LoopbackCounters counters;
+  memset(&counters, 0, sizeof(counters));
+  ChiakiCostAcct *cost_acct = cost ? chiaki_cost_acct_new(&cost_config) : NULL;
+  ChiakiSession session;
+  if (chiaki_session_init(&session, &info, &log) != CHIAKI_ERR_SUCCESS) {
+    fprintf(stderr, "chiaki_session_init failed\n");
+    chiaki_cost_acct_free(cost_acct);
+    standin_host_free(host);
+    return 1;
+  }
+  chiaki_session_set_cost_acct(&session, cost_acct);
+  chiaki_session_set_event_cb(&session, on_event, &counters);
+  chiaki_session_set_video_sample_cb(&session, on_video, &counters);
+  ChiakiAudioSink audio_sink = {&counters, on_audio_header, on_audio_frame};
+  chiaki_session_set_audio_sink(&session, &audio_sink);
+
+  int status = 1;
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  if (chiaki_session_start(&session) != CHIAKI_ERR_SUCCESS) {
+    fprintf(stderr, "chiaki_session_start failed\n");
+    goto cleanup;
+  }
+
+  while (!atomic_load(&counters.quit) && !atomic_load(&counters.video_frames) &&
+         chiaki_time_now_monotonic_us() - start_us < LOOPBACK_CONNECT_TIMEOUT_US)
+    usleep(1000);
+  uint64_t connect_us = chiaki_time_now_monotonic_us() - start_us;
+  if (!atomic_load(&counters.video_frames)) {
+    fprintf(stderr, "no video within %u s\n", LOOPBACK_CONNECT_TIMEOUT_US / 1000000);
+    goto stop;
+  }
+
+  unsigned long long frames0 = atomic_load(&counters.video_frames);
+  unsigned long long bytes0 = atomic_load(&counters.video_bytes);
+  uint64_t run_start_us = chiaki_time_now_monotonic_us();
+  while (!atomic_load(&counters.quit) && chiaki_time_now_monotonic_us() - run_start_us < (uint64_t)(seconds * 1e6))
+    usleep(10000);
+  double elapsed = (double)(chiaki_time_now_monotonic_us() - run_start_us) / 1e6;
+
+  StandinStats st;
+  standin_host_stats(host, &st);
+  unsigned long long frames = atomic_load(&counters.video_frames) - frames0;
+  unsigned long long bytes = atomic_load(&counters.video_bytes) - bytes0;
+  printf("BENCH loopback seconds=%.2f video_frames=%llu fps=%.2f frames_lost=%llu frames_recovered=%llu "
+         "audio_frames=%llu mbps=%.2f shaped_dropped=%llu idr_requests=%llu connect_ms=%.1f\n",
+         elapsed, frames, frames / elapsed, atomic_load(&counters.frames_lost),
+         atomic_load(&counters.frames_recovered), atomic_load(&counters.audio_frames), bytes * 8.0 / elapsed / 1e6,
+         (unsigned long long)st.shaped_dropped, (unsigned long long)st.idr_requests, connect_us / 1000.0);
+  status = frames && !atomic_load(&counters.quit) ? 0 : 1;
+
+stop:
+  chiaki_session_stop(&session);
+  chiaki_session_join(&session);
+  if (cost_acct)
+    print_cost(cost_acct);
+cleanup:
+  chiaki_session_fini(&session);
+  chiaki_cost_acct_free(cost_acct);
+  standin_host_free(host);
+  return status;
+}
@@ -0,0 +1,379 @@
+/*
+ * multisession_bench.c — Many concurrent sessions in one process
+ * (vitarps5_multisession).
+ *
+ * For each count N of --sessions, starts N stand-in hosts on 127.0.0.2,
+ * 127.0.0.3, ... and connects one ChiakiSession to each, once with every
+ * session generating its key streams on threads of its own and once with all
+ * of them sharing a ChiakiWorkerPool of --pool-threads. After --seconds of
+ * streaming one line per run is printed:
+ *
+ *   BENCH multisession mode=.. sessions=.. threads_per_session=..
+ *         cpu_ms_per_session_per_s=.. fps=.. lateness_p50_ms=..
+ *         lateness_p99_ms=.. frames_lost=.. pool_jobs_per_session=..
+ *         pool_busy_ms_per_session=.. pool_wait_max_ms=..
+ *
+ * The CPU time is what all threads named "Chiaki ..." used, from
+ * /proc/self/task, divided by N, so the shared workers are included and the
+ * stand-in hosts, which share the process, are not. Lateness is how much later
+ * than on a perfect 1/fps schedule a frame reached the video callback, lost
+ * frames counting as slots, relative to the earliest frame of the session. It
+ * includes the hosts' own scheduling in the same process, so compare the
+ * modes against each other rather than against a single stream.
+ *
+ * The exit status is non-zero if any session didn't stream.
+ *
+ * Usage: vitarps5_multisession [--sessions 1,4,16] [--seconds N]
+ *                              [--pool-threads N] [--mode pool|threads|both]
+ *                              [--kbps N] [--verbose]
+ */
+
+#define _GNU_SOURCE
+
+#include "standin.h"
+
+#include <chiaki/session.h>
+#include <chiaki/time.h>
+#include <chiaki/workerpool.h>
+
+#include <dirent.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MULTI_SESSIONS_MAX 64
+#define MULTI_CONNECT_TIMEOUT_US 20000000
+#define MULTI_FPS 60
+
+typedef struct {
+  StandinHost *host;
+  char addr[16];
+  ChiakiSession session;
+  bool session_init;
+  atomic_ullong video_frames;
+  atomic_ullong frames_lost;
+  atomic_bool quit;
+  /* written by the video callback only while recording */
+  atomic_bool recording;
+  uint64_t first_us;
+  uint64_t slot;
+  int64_t *lateness_us; /* against the schedule of the first frame */
+  size_t lateness_count;
+  size_t lateness_size;
+} MultiSession;
+
+static bool on_video(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered,
+                     const ChiakiVideoSampleInfo *info, void *user) {
+  MultiSession *s = user;
+  (void)buf;
+  (void)info;
+  (void)buf_size;
+  (void)frame_recovered;
+  atomic_fetch_add(&s->video_frames, 1);
+  if (frames_lost > 0)
+    atomic_fetch_add(&s->frames_lost, (unsigned long long)frames_lost);
+  if (!atomic_load(&s->recording))
+    return true;
+
+  uint64_t now_us = chiaki_time_now_monotonic_us();
+  if (!s->first_us) {
+    s->first_us = now_us;
+    s->slot = 0;
+  } else
+    s->slot += 1 + (frames_lost > 0 ? (uint64_t)frames_lost : 0);
+  if (s->lateness_count < s->lateness_size)
+    s->lateness_us[s->lateness_count++] = (int64_t)(now_us - s->first_us) - (int64_t)(s->slot * (1000000 / MULTI_FPS));
+  return true;
+}
+
+static void on_audio_header(ChiakiAudioHeader *header, void *user) {
+  (void)header;
+  (void)user;
+}
+
+static void on_audio_frame(uint8_t *buf, size_t buf_size, void *user) {
+  (void)buf;
+  (void)buf_size;
+  (void)user;
+}
+
+static void on_event(ChiakiEvent *event, void *user) {
+  MultiSession *s = user;
+  if (event->type == CHIAKI_EVENT_QUIT) {
+    fprintf(stderr, "%s: session quit: %s\n", s->addr, chiaki_quit_reason_string(event->quit.reason));
+    atomic_store(&s->quit, true);
+  }
+}
+
+/* CPU ticks and count of the threads whose name starts with "Chiaki". */
+static unsigned long long chiaki_threads_cpu(unsigned *threads) {
+  unsigned long long ticks = 0;
+  *threads = 0;
+  DIR *dir = opendir("/proc/self/task");
+  if (!dir)
+    return 0;
+  struct dirent *de;
+  while ((de = readdir(dir))) {
+    if (de->d_name[0] == '.')
+      continue;
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%s/stat", de->d_name);
+    FILE *f = fopen(path, "r");
+    if (!f)
+      continue;
+    char line[1024];
+    size_t n = fread(line, 1, sizeof(line) - 1, f);
+    fclose(f);
+    line[n] = '\0';
+    // pid (comm) state ..., comm may contain spaces
+    char *open = strchr(line, '(');
+    char *close = strrchr(line, ')');
+    if (!open || !close || strncmp(open + 1, "Chiaki", 6) != 0)
+      continue;
+    unsigned long long utime, stime;
+    if (sscanf(close + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2)
+      continue;
+    ticks += utime + stime;
+    (*threads)++;
+  }
+  closedir(dir);
+  return ticks;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void multi_sessions_stop(MultiSession *sessions, unsigned count) {
+  for (unsigned i = 0; i < count; i++)
+    if (sessions[i].session_init)
+      chiaki_session_stop(&sessions[i].session);
+  for (unsigned i = 0; i < count; i++) {
+    MultiSession *s = &sessions[i];
+    if (s->session_init) {
+      chiaki_session_join(&s->session);
+      chiaki_session_fini(&s->session);
+    }
+    standin_host_free(s->host);
+    free(s->lateness_us);
+  }
+}
+
+static bool run(unsigned count, bool pooled, unsigned pool_threads, double seconds, unsigned kbps, ChiakiLog *log) {
+  MultiSession *sessions = calloc(count, sizeof(MultiSession));
+  if (!sessions)
+    return false;
+  ChiakiWorkerPool *pool = NULL;
+  if (pooled) {
+    pool = chiaki_worker_pool_new(pool_threads, CHIAKI_THREAD_ROLE_CRYPTO, log);
+    if (!pool) {
+      free(sessions);
+      return false;
+    }
+  }
+
+  bool ok = false;
+  size_t lateness_size = (size_t)(seconds * MULTI_FPS * 2) + 16;
+  for (unsigned i = 0; i < count; i++) {
+    MultiSession *s = &sessions[i];
+    snprintf(s->addr, sizeof(s->addr), "127.0.0.%u", 2 + i);
+    s->lateness_size = lateness_size;
+    s->lateness_us = calloc(lateness_size, sizeof(int64_t));
+    StandinConfig config;
+    standin_config_defaults(&config);
+    config.bind_addr = s->addr;
+    config.synth_kbps = kbps;
+    config.fps = MULTI_FPS;
+    config.seed = 1 + i;
+    config.log = log;
+    s->host = standin_host_new(&config);
+    if (!s->lateness_us || !s->host || !standin_host_start(s->host)) {
+      fprintf(stderr, "%s: failed to start the stand-in host\n", s->addr);
+      goto stop;
+    }
+
+    ChiakiConnectInfo info;
+    memset(&info, 0, sizeof(info));
+    info.ps5 = config.ps5;
+    info.host = s->addr;
+    memcpy(info.morning, config.morning, sizeof(info.morning));
+    chiaki_connect_video_profile_preset(&info.video_profile, CHIAKI_VIDEO_RESOLUTION_PRESET_720p,
+                                        CHIAKI_VIDEO_FPS_PRESET_60);
+    if (chiaki_session_init(&s->session, &info, log) != CHIAKI_ERR_SUCCESS) {
+      fprintf(stderr, "%s: chiaki_session_init failed\n", s->addr);
+      goto stop;
+    }
+    s->session_init = true;
+    chiaki_session_set_event_cb(&s->session, on_event, s);
+    chiaki_session_set_video_sample_cb(&s->session, on_video, s);
+    ChiakiAudioSink audio_sink = {s, on_audio_header, on_audio_frame};
+    chiaki_session_set_audio_sink(&s->session, &audio_sink);
+    chiaki_session_set_worker_pool(&s->session, pool);
+    if (chiaki_session_start(&s->session) != CHIAKI_ERR_SUCCESS) {
+      fprintf(stderr, "%s: chiaki_session_start failed\n", s->addr);
+      chiaki_session_fini(&s->session);
+      s->session_init = false;
+      goto stop;
+    }
+  }
+
+  uint64_t start_us = chiaki_time_now_monotonic_us();
+  for (unsigned i = 0; i < count; i++) {
+    MultiSession *s = &sessions[i];
+    while (!atomic_load(&s->quit) && !atomic_load(&s->video_frames) &&
+           chiaki_time_now_monotonic_us() - start_us < MULTI_CONNECT_TIMEOUT_US)
+      usleep(1000);
+    if (!atomic_load(&s->video_frames)) {
+      fprintf(stderr, "%s: no video within %u s\n", s->addr, MULTI_CONNECT_TIMEOUT_US / 1000000);
+      goto stop;
+    }
+  }
+
+  unsigned long long frames0 = 0, lost0 = 0;
+  for (unsigned i = 0; i < count; i++) {
+    frames0 += atomic_load(&sessions[i].video_frames);
+    lost0 += atomic_load(&sessions[i].frames_lost);
+    atomic_store(&sessions[i].recording, true);
+  }
+  unsigned threads;
+  unsigned long long ticks0 = chiaki_threads_cpu(&threads);
+  uint64_t run_start_us = chiaki_time_now_monotonic_us();
+  usleep((useconds_t)(seconds * 1e6));
+  for (unsigned i = 0; i < count; i++)
+    atomic_store(&sessions[i].recording, false);
+  double elapsed = (double)(chiaki_time_now_monotonic_us() - run_start_us) / 1e6;
+  unsigned long long ticks = chiaki_threads_cpu(&threads) - ticks0;
+
+  unsigned long long frames = 0, lost = 0;
+  size_t samples = 0;
+  ok = true;
+  for (unsigned i = 0; i < count; i++) {
+    MultiSession *s = &sessions[i];
+    frames += atomic_load(&s->video_frames);
+    lost += atomic_load(&s->frames_lost);
+    if (atomic_load(&s->quit))
+      ok = false;
+    samples += s->lateness_count;
+  }
+  frames -= frames0;
+  lost -= lost0;
+
+  uint64_t *all = calloc(samples ? samples : 1, sizeof(uint64_t));
+  size_t n = 0;
+  for (unsigned i = 0; all && i < count; i++) {
+    MultiSession *s = &sessions[i];
+    if (!s->lateness_count)
+      continue;
+    int64_t min = s->lateness_us[0];
+    for (size_t k = 1; k < s->lateness_count; k++)
+      if (s->lateness_us[k] < min)
+        min = s->lateness_us[k];
+    for (size_t k = 0; k < s->lateness_count; k++)
+      all[n++] = (uint64_t)(s->lateness_us[k] - min);
+  }
+  double p50 = 0.0, p99 = 0.0;
+  if (all && n) {
+    qsort(all, n, sizeof(uint64_t), cmp_u64);
+    p50 = all[n / 2] / 1000.0;
+    p99 = all[n * 99 / 100] / 1000.0;
+  }
+  free(all);
+
+  ChiakiWorkerAccount total = {0};
+  for (unsigned i = 0; i < count; i++) {
+    ChiakiWorkerAccount account;
+    chiaki_session_get_worker_account(&sessions[i].session, &account);
+    total.jobs += account.jobs;
+    total.busy_us += account.busy_us;
+    if (account.wait_max_us > total.wait_max_us)
+      total.wait_max_us = account.wait_max_us;
+  }
+
+  double cpu_ms = ticks * 1000.0 / (double)sysconf(_SC_CLK_TCK);
+  printf("BENCH multisession mode=%s sessions=%u threads_per_session=%.1f cpu_ms_per_session_per_s=%.2f "
+         "fps=%.2f lateness_p50_ms=%.2f lateness_p99_ms=%.2f frames_lost=%llu pool_jobs_per_session=%.0f "
+         "pool_busy_ms_per_session=%.1f pool_wait_max_ms=%.2f\n",
+         pooled ? "pool" : "threads", count, (double)threads / count, cpu_ms / count / elapsed,
+         frames / elapsed / count, p50, p99, lost, (double)total.jobs / count, total.busy_us / 1000.0 / count,
+         total.wait_max_us / 1000.0);
+  fflush(stdout);
+
+stop:
+  multi_sessions_stop(sessions, count);
+  free(sessions);
+  chiaki_worker_pool_free(pool);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned counts[16] = {1, 4, 16};
+  size_t counts_count = 3;
+  double seconds = 5.0;
+  unsigned pool_threads = 2;
+  unsigned kbps = 5000;
+  bool mode_pool = true, mode_threads = true;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--verbose") == 0) {
+      verbose = true;
+      continue;
+    }
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    if (strcmp(arg, "--sessions") == 0) {
+      counts_count = 0;
+      const char *p = val;
+      while (*p && counts_count < sizeof(counts) / sizeof(counts[0])) {
+        char *end;
+        unsigned long v = strtoul(p, &end, 10);
+        if (end == p || !v || v > MULTI_SESSIONS_MAX) {
+          fprintf(stderr, "invalid --sessions %s\n", val);
+          return 2;
+        }
+        counts[counts_count++] = (unsigned)v;
+        p = *end == ',' ? end + 1 : end;
+      }
+    } else if (strcmp(arg, "--seconds") == 0)
+      seconds = atof(val);
+    else if (strcmp(arg, "--pool-threads") == 0)
+      pool_threads = (unsigned)atoi(val);
+    else if (strcmp(arg, "--kbps") == 0)
+      kbps = (unsigned)atoi(val);
+    else if (strcmp(arg, "--mode") == 0) {
+      mode_pool = strcmp(val, "threads") != 0;
+      mode_threads = strcmp(val, "pool") != 0;
+    } else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+  if (seconds <= 0.0 || !counts_count || !pool_threads || !kbps) {
+    fprintf(stderr, "invalid options\n");
+    return 2;
+  }
+
+  if (chiaki_lib_init() != CHIAKI_ERR_SUCCESS) {
+    fprintf(stderr, "chiaki_lib_init failed\n");
+    return 1;
+  }
+  ChiakiLog log;
+  chiaki_log_init(&log, verbose ? CHIAKI_LOG_ALL : CHIAKI_LOG_ERROR, chiaki_log_cb_print, NULL);
+
+  int status = 0;
+  for (size_t c = 0; c < counts_count; c++) {
+    if (mode_threads && !run(counts[c], false, pool_threads, seconds, kbps, &log))
+      status = 1;
+    if (mode_pool && !run(counts[c], true, pool_threads, seconds, kbps, &log))
+      status = 1;
+  }
+  return status;
+}
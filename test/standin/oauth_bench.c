@@ -0,0 +1,461 @@
+/*
+ * oauth_bench.c — ChiakiTokenLifecycle against the stand-in PSN token
+ * endpoint (vitarps5_oauth).
+ *
+ * The refresh function posts refresh_token grants through ChiakiHttpClient to
+ * the local TLS stand-in, with the PSN auth host pointed at it, and reads the
+ * response with chiaki_json_scan() the way psn_auth.c does. Checks, one line
+ * each:
+ *
+ *   CHECK expiry     short-lived tokens are refreshed before they expire,
+ *                    rotated refresh tokens are persisted, the old one is
+ *                    turned down by the endpoint
+ *   CHECK failure    503 backs off and keeps the access token, invalid_grant
+ *                    stops the schedule and reports the token as rejected
+ *   CHECK skew       a server clock two hours ahead is reported, but expiry
+ *                    still follows expires_in
+ *
+ * Then the time from "connect" to the first authorized PSN request with a
+ * token that ran out while the app was idle:
+ *
+ *   BENCH oauth mode=reactive|proactive runs=.. rtt_ms=.. connect_ms=..
+ *         best_ms=.. refreshes=..
+ *
+ * reactive holds the lifecycle, so the refresh happens when connect asks for
+ * the token (what psn_auth_refresh_token_if_needed() did before), proactive
+ * lets it refresh in the background first. The exit status is non-zero if a
+ * check failed.
+ *
+ * Usage: vitarps5_oauth [--runs N] [--rtt MS] [--lifetime S] [--verbose]
+ */
+
+#define _GNU_SOURCE
+
+#include "psn_standin.h"
+
+#include <chiaki/jsonscan.h>
+#include <chiaki/log.h>
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+#include <chiaki/tokenlifecycle.h>
+
+#include "remote/httpclient.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define AUTH_HOST "auth.api.sonyentertainmentnetwork.com"
+#define WEB_HOST "web.np.playstation.com"
+#define TOKEN_URL "https://" AUTH_HOST "/2.0/oauth/token"
+#define DEVICES_URL "https://" WEB_HOST "/api/cloudAssistedNavigation/v2/users/me/clients?platform=PS5"
+
+typedef struct {
+  ChiakiHttpClient *http;
+  struct curl_slist *connect_to;
+  ChiakiLog *log;
+
+  ChiakiMutex mutex; /* the persisted tokens */
+  int persists;
+  char access_token[64];
+  char refresh_token[64];
+  uint64_t expires_at_unix;
+} OAuthBench;
+
+static void sleep_ms(uint32_t ms) {
+  struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+}
+
+static size_t feed_cb(char *ptr, size_t size, size_t nmemb, void *user) {
+  chiaki_json_feed_append(user, ptr, size * nmemb);
+  return size * nmemb;
+}
+
+static size_t date_cb(char *buffer, size_t size, size_t nitems, void *user) {
+  size_t len = size * nitems;
+  if (len > 5 && strncasecmp(buffer, "Date:", 5) == 0) {
+    char value[64];
+    size_t value_len = len - 5 < sizeof(value) - 1 ? len - 5 : sizeof(value) - 1;
+    memcpy(value, buffer + 5, value_len);
+    value[value_len] = '\0';
+    time_t t = curl_getdate(value, NULL);
+    if (t > 0)
+      *(uint64_t *)user = (uint64_t)t;
+  }
+  return len;
+}
+
+static char *dup_json_string(const ChiakiJsonValue *value) {
+  char buf[256];
+  if (chiaki_json_unescape(value, buf, sizeof(buf), NULL) != CHIAKI_ERR_SUCCESS)
+    return NULL;
+  return strdup(buf);
+}
+
+/* ChiakiTokenRefreshFunc with the error mapping of psn_auth.c. */
+static ChiakiErrorCode refresh_cb(void *user, const char *refresh_token, ChiakiTokenGrant *grant) {
+  OAuthBench *bench = user;
+  CURL *curl = chiaki_http_client_acquire(bench->http);
+  if (!curl)
+    return CHIAKI_ERR_MEMORY;
+  char form[256];
+  snprintf(form, sizeof(form), "grant_type=refresh_token&refresh_token=%s&scope=psn%%3Aclientapp", refresh_token);
+  char buf[1024];
+  ChiakiJsonFeed feed;
+  chiaki_json_feed_init(&feed, buf, sizeof(buf));
+  uint64_t server_time = 0;
+  curl_easy_setopt(curl, CURLOPT_URL, TOKEN_URL);
+  curl_easy_setopt(curl, CURLOPT_CONNECT_TO, bench->connect_to);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+  curl_easy_setopt(curl, CURLOPT_USERPWD, "standin-client:standin-secret");
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, form);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, feed_cb);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &feed);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, date_cb);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, &server_time);
+  CURLcode res = chiaki_http_client_perform(bench->http, curl, bench->log, "oauth_token", NULL);
+  long http_code = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+  chiaki_http_client_release(bench->http, curl);
+  if (res != CURLE_OK)
+    return CHIAKI_ERR_NETWORK;
+  if (http_code == 400 || http_code == 401)
+    return CHIAKI_ERR_HTTP_NONOK;
+  if (http_code != 200)
+    return CHIAKI_ERR_INVALID_RESPONSE;
+
+  static const char *const paths[] = {"access_token", "refresh_token", "expires_in"};
+  ChiakiJsonValue values[3];
+  int64_t expires_in = 0;
+  if (chiaki_json_feed_scan(&feed, paths, values, 3) != CHIAKI_ERR_SUCCESS ||
+      chiaki_json_value_int64(&values[2], &expires_in) != CHIAKI_ERR_SUCCESS || expires_in <= 0)
+    return CHIAKI_ERR_INVALID_RESPONSE;
+  grant->access_token = dup_json_string(&values[0]);
+  if (values[1].type == CHIAKI_JSON_TYPE_STRING)
+    grant->refresh_token = dup_json_string(&values[1]);
+  grant->expires_in_sec = (uint32_t)expires_in;
+  grant->server_time_unix = server_time;
+  return grant->access_token ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_INVALID_RESPONSE;
+}
+
+static void persist_cb(void *user, const ChiakiTokenSet *tokens) {
+  OAuthBench *bench = user;
+  chiaki_mutex_lock(&bench->mutex);
+  bench->persists++;
+  snprintf(bench->access_token, sizeof(bench->access_token), "%s", tokens->access_token);
+  snprintf(bench->refresh_token, sizeof(bench->refresh_token), "%s", tokens->refresh_token);
+  bench->expires_at_unix = tokens->expires_at_unix;
+  chiaki_mutex_unlock(&bench->mutex);
+}
+
+static int persisted_count(OAuthBench *bench) {
+  chiaki_mutex_lock(&bench->mutex);
+  int n = bench->persists;
+  chiaki_mutex_unlock(&bench->mutex);
+  return n;
+}
+
+static size_t discard_cb(char *ptr, size_t size, size_t nmemb, void *user) {
+  (void)ptr;
+  (void)user;
+  return size * nmemb;
+}
+
+/* What a remote connect does first: take the token and list the devices. */
+static bool connect_request(OAuthBench *bench, ChiakiTokenLifecycle *lifecycle) {
+  if (chiaki_token_lifecycle_ensure_fresh(lifecycle, 60, 10000) != CHIAKI_ERR_SUCCESS)
+    return false;
+  char *token = NULL;
+  if (chiaki_token_lifecycle_access_token(lifecycle, &token) != CHIAKI_ERR_SUCCESS)
+    return false;
+  char auth[128];
+  snprintf(auth, sizeof(auth), "Authorization: Bearer %s", token);
+  free(token);
+  CURL *curl = chiaki_http_client_acquire(bench->http);
+  if (!curl)
+    return false;
+  struct curl_slist *headers = curl_slist_append(NULL, auth);
+  curl_easy_setopt(curl, CURLOPT_URL, DEVICES_URL);
+  curl_easy_setopt(curl, CURLOPT_CONNECT_TO, bench->connect_to);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+  curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_cb);
+  CURLcode res = chiaki_http_client_perform(bench->http, curl, bench->log, "list_devices", NULL);
+  curl_slist_free_all(headers);
+  chiaki_http_client_release(bench->http, curl);
+  return res == CURLE_OK;
+}
+
+typedef struct {
+  PsnStandin *standin;
+  OAuthBench bench;
+  ChiakiTokenLifecycle *lifecycle;
+} Fixture;
+
+static bool fixture_init(Fixture *f, uint32_t rtt_us, uint32_t lifetime_sec, int64_t skew_sec, ChiakiLog *log) {
+  memset(f, 0, sizeof(*f));
+  PsnStandinConfig config;
+  psn_standin_config_defaults(&config);
+  config.rtt_us = rtt_us;
+  config.token_lifetime_sec = lifetime_sec;
+  config.clock_skew_sec = skew_sec;
+  f->standin = psn_standin_new(&config);
+  if (!f->standin || !psn_standin_start(f->standin)) {
+    fprintf(stderr, "failed to start the PSN stand-in\n");
+    psn_standin_free(f->standin);
+    return false;
+  }
+  char auth_to[128], web_to[128];
+  snprintf(auth_to, sizeof(auth_to), AUTH_HOST ":443:127.0.0.1:%u", psn_standin_port(f->standin));
+  snprintf(web_to, sizeof(web_to), WEB_HOST ":443:127.0.0.1:%u", psn_standin_port(f->standin));
+  f->bench.connect_to = curl_slist_append(NULL, auth_to);
+  f->bench.connect_to = curl_slist_append(f->bench.connect_to, web_to);
+  f->bench.http = chiaki_http_client_new();
+  f->bench.log = log;
+  chiaki_mutex_init(&f->bench.mutex, false);
+
+  ChiakiTokenLifecycleConfig lc;
+  chiaki_token_lifecycle_config_defaults(&lc);
+  lc.refresh = refresh_cb;
+  lc.refresh_user = &f->bench;
+  lc.persist = persist_cb;
+  lc.persist_user = &f->bench;
+  lc.log = log;
+  lc.retry_min_sec = 1;
+  lc.retry_max_sec = 4;
+  f->lifecycle = chiaki_token_lifecycle_new(&lc);
+  return f->bench.http && f->lifecycle;
+}
+
+static void fixture_fini(Fixture *f) {
+  chiaki_token_lifecycle_free(f->lifecycle);
+  chiaki_http_client_free(f->bench.http);
+  curl_slist_free_all(f->bench.connect_to);
+  chiaki_mutex_fini(&f->bench.mutex);
+  psn_standin_free(f->standin);
+}
+
+/* Waits until the lifecycle has done n refreshes. */
+static bool wait_refreshes(ChiakiTokenLifecycle *lifecycle, uint64_t n, uint32_t timeout_ms) {
+  ChiakiTokenLifecycleStats stats;
+  for (uint32_t waited = 0; waited <= timeout_ms; waited += 5) {
+    chiaki_token_lifecycle_stats(lifecycle, &stats);
+    if (stats.refreshes >= n)
+      return true;
+    sleep_ms(5);
+  }
+  return false;
+}
+
+static bool check_expiry(uint32_t rtt_us, uint32_t lifetime_sec, ChiakiLog *log) {
+  Fixture f;
+  bool ok = fixture_init(&f, rtt_us, lifetime_sec, 0, log);
+  /* a login handed us only a refresh token, the first refresh is immediate */
+  ok = ok && chiaki_token_lifecycle_set(f.lifecycle, NULL, PSN_STANDIN_REFRESH_TOKEN, 0) == CHIAKI_ERR_SUCCESS;
+  ok = ok && wait_refreshes(f.lifecycle, 1, 5000);
+
+  /* sample the token over two lifetimes, it must never be seen expired */
+  unsigned expired_samples = 0;
+  uint64_t end_ms = chiaki_time_now_monotonic_ms() + 2000ULL * lifetime_sec;
+  while (ok && chiaki_time_now_monotonic_ms() < end_ms) {
+    ChiakiTokenStatus status;
+    chiaki_token_lifecycle_status(f.lifecycle, &status);
+    if (status.freshness == CHIAKI_TOKEN_EXPIRED || status.freshness == CHIAKI_TOKEN_NONE)
+      expired_samples++;
+    sleep_ms(20);
+  }
+  ChiakiTokenLifecycleStats stats;
+  chiaki_token_lifecycle_stats(f.lifecycle, &stats);
+  ok = ok && stats.refreshes >= 2 && !expired_samples && persisted_count(&f.bench) >= 2;
+
+  /* the endpoint rotated the refresh token, the first one is dead now */
+  ChiakiTokenGrant grant = {0};
+  ChiakiErrorCode replay = refresh_cb(&f.bench, PSN_STANDIN_REFRESH_TOKEN, &grant);
+  chiaki_mutex_lock(&f.bench.mutex);
+  bool rotated = strcmp(f.bench.refresh_token, PSN_STANDIN_REFRESH_TOKEN) != 0;
+  chiaki_mutex_unlock(&f.bench.mutex);
+  ok = ok && replay == CHIAKI_ERR_HTTP_NONOK && rotated;
+  ok = ok && connect_request(&f.bench, f.lifecycle);
+
+  printf("CHECK expiry lifetime_s=%u refreshes=%llu scheduled=%llu persists=%d expired_samples=%u replay=%s %s\n",
+         lifetime_sec, (unsigned long long)stats.refreshes, (unsigned long long)stats.scheduled,
+         persisted_count(&f.bench), expired_samples, chiaki_error_string(replay), ok ? "ok" : "FAILED");
+  fixture_fini(&f);
+  return ok;
+}
+
+static bool check_failure(uint32_t rtt_us, ChiakiLog *log) {
+  Fixture f;
+  bool ok = fixture_init(&f, rtt_us, 3600, 0, log);
+  ok = ok && chiaki_token_lifecycle_set(f.lifecycle, NULL, PSN_STANDIN_REFRESH_TOKEN, 0) == CHIAKI_ERR_SUCCESS;
+  ok = ok && wait_refreshes(f.lifecycle, 1, 5000);
+
+  /* the endpoint is down: the caller gets the error, the access token stays, retry in 1 s */
+  psn_standin_set_oauth_mode(f.standin, PSN_STANDIN_OAUTH_UNAVAILABLE);
+  ChiakiErrorCode down = chiaki_token_lifecycle_refresh(f.lifecycle, 5000);
+  ChiakiTokenStatus status;
+  chiaki_token_lifecycle_status(f.lifecycle, &status);
+  ok = ok && down == CHIAKI_ERR_INVALID_RESPONSE && status.freshness == CHIAKI_TOKEN_FRESH &&
+       status.failures == 1 && status.refresh_scheduled && status.refresh_in_ms <= 1000;
+  ok = ok && connect_request(&f.bench, f.lifecycle);
+
+  /* it comes back: the scheduled retry picks the refresh up by itself */
+  psn_standin_set_oauth_mode(f.standin, PSN_STANDIN_OAUTH_OK);
+  ok = ok && wait_refreshes(f.lifecycle, 2, 5000);
+  chiaki_token_lifecycle_status(f.lifecycle, &status);
+  ok = ok && status.failures == 0;
+
+  /* invalid_grant: no more retries, the connect flow is told to log in again */
+  psn_standin_set_oauth_mode(f.standin, PSN_STANDIN_OAUTH_REJECT);
+  ChiakiErrorCode rejected = chiaki_token_lifecycle_refresh(f.lifecycle, 5000);
+  chiaki_token_lifecycle_status(f.lifecycle, &status);
+  ok = ok && rejected == CHIAKI_ERR_HTTP_NONOK && !status.refresh_scheduled;
+  ok = ok && chiaki_token_lifecycle_ensure_fresh(f.lifecycle, 7200, 5000) == CHIAKI_ERR_HTTP_NONOK;
+
+  PsnStandinStats st;
+  psn_standin_stats(f.standin, &st);
+  ChiakiTokenLifecycleStats stats;
+  chiaki_token_lifecycle_stats(f.lifecycle, &stats);
+  ok = ok && stats.rejections == 1 && st.token_rejected == 1;
+  printf("CHECK failure unavailable=%s rejected=%s token_requests=%llu failures=%llu rejections=%llu %s\n",
+         chiaki_error_string(down), chiaki_error_string(rejected), (unsigned long long)st.token_requests,
+         (unsigned long long)stats.failures, (unsigned long long)stats.rejections, ok ? "ok" : "FAILED");
+  fixture_fini(&f);
+  return ok;
+}
+
+static bool check_skew(uint32_t rtt_us, ChiakiLog *log) {
+  Fixture f;
+  bool ok = fixture_init(&f, rtt_us, 600, 7200, log);
+  ok = ok && chiaki_token_lifecycle_set(f.lifecycle, NULL, PSN_STANDIN_REFRESH_TOKEN, 0) == CHIAKI_ERR_SUCCESS;
+  ok = ok && wait_refreshes(f.lifecycle, 1, 5000);
+  ChiakiTokenStatus status;
+  chiaki_token_lifecycle_status(f.lifecycle, &status);
+  /* the Date header has second resolution */
+  ok = ok && status.clock_skew_sec >= 7198 && status.clock_skew_sec <= 7202;
+  ok = ok && status.freshness == CHIAKI_TOKEN_FRESH && status.valid_ms > 590000 && status.valid_ms <= 600000;
+  chiaki_mutex_lock(&f.bench.mutex);
+  int64_t persisted_in = (int64_t)f.bench.expires_at_unix - (int64_t)time(NULL);
+  chiaki_mutex_unlock(&f.bench.mutex);
+  ok = ok && persisted_in > 590 && persisted_in <= 600;
+  printf("CHECK skew clock_skew_s=%lld valid_ms=%llu persisted_expires_in_s=%lld %s\n",
+         (long long)status.clock_skew_sec, (unsigned long long)status.valid_ms, (long long)persisted_in,
+         ok ? "ok" : "FAILED");
+  fixture_fini(&f);
+  return ok;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static bool bench_connect(bool proactive, unsigned runs, uint32_t rtt_us, ChiakiLog *log) {
+  Fixture f;
+  bool ok = fixture_init(&f, rtt_us, 3600, 0, log);
+  ok = ok && chiaki_token_lifecycle_set(f.lifecycle, NULL, PSN_STANDIN_REFRESH_TOKEN, 0) == CHIAKI_ERR_SUCCESS;
+  ok = ok && wait_refreshes(f.lifecycle, 1, 5000);
+  /* warm the connections, both modes start from the same pool state */
+  ok = ok && connect_request(&f.bench, f.lifecycle);
+  uint64_t *samples = calloc(runs, sizeof(uint64_t));
+  ok = ok && samples;
+  if (!proactive)
+    chiaki_token_lifecycle_hold(f.lifecycle, true);
+
+  for (unsigned i = 0; ok && i < runs; i++) {
+    ChiakiTokenLifecycleStats before;
+    chiaki_token_lifecycle_stats(f.lifecycle, &before);
+    int persists = persisted_count(&f.bench);
+    /* the app sat idle past the token's expiry */
+    chiaki_mutex_lock(&f.bench.mutex);
+    char access[64], refresh[64];
+    snprintf(access, sizeof(access), "%s", f.bench.access_token);
+    snprintf(refresh, sizeof(refresh), "%s", f.bench.refresh_token);
+    chiaki_mutex_unlock(&f.bench.mutex);
+    chiaki_token_lifecycle_set(f.lifecycle, access, refresh, (uint64_t)time(NULL) - 10);
+    if (proactive)
+      ok = wait_refreshes(f.lifecycle, before.refreshes + 1, 5000) &&
+           chiaki_token_lifecycle_ensure_fresh(f.lifecycle, 60, 0) == CHIAKI_ERR_SUCCESS;
+    uint64_t start_us = chiaki_time_now_monotonic_us();
+    ok = ok && connect_request(&f.bench, f.lifecycle);
+    samples[i] = chiaki_time_now_monotonic_us() - start_us;
+    /* persisting runs after the waiters are woken, the next run needs the rotated token */
+    for (int w = 0; ok && w < 1000 && persisted_count(&f.bench) <= persists; w++)
+      sleep_ms(1);
+  }
+
+  ChiakiTokenLifecycleStats stats;
+  chiaki_token_lifecycle_stats(f.lifecycle, &stats);
+  uint64_t sum = 0;
+  for (unsigned i = 0; ok && i < runs; i++)
+    sum += samples[i];
+  if (ok)
+    qsort(samples, runs, sizeof(uint64_t), cmp_u64);
+  printf("BENCH oauth mode=%s runs=%u rtt_ms=%.1f connect_ms=%.2f best_ms=%.2f refreshes=%llu on_demand=%llu\n",
+         proactive ? "proactive" : "reactive", runs, rtt_us / 1000.0, ok ? sum / 1000.0 / runs : 0.0,
+         ok ? samples[0] / 1000.0 : 0.0, (unsigned long long)stats.refreshes,
+         (unsigned long long)stats.on_demand);
+  fflush(stdout);
+  free(samples);
+  fixture_fini(&f);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned runs = 10;
+  double rtt_ms = 20.0;
+  unsigned lifetime_sec = 4;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--verbose") == 0) {
+      verbose = true;
+      continue;
+    }
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    if (strcmp(arg, "--runs") == 0)
+      runs = (unsigned)atoi(val);
+    else if (strcmp(arg, "--rtt") == 0)
+      rtt_ms = atof(val);
+    else if (strcmp(arg, "--lifetime") == 0)
+      lifetime_sec = (unsigned)atoi(val);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+  if (!runs || rtt_ms < 0.0 || lifetime_sec < 2) {
+    fprintf(stderr, "invalid options\n");
+    return 2;
+  }
+
+  if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+    fprintf(stderr, "curl_global_init failed\n");
+    return 1;
+  }
+  ChiakiLog log;
+  chiaki_log_init(&log, verbose ? CHIAKI_LOG_ALL : CHIAKI_LOG_ERROR, chiaki_log_cb_print, NULL);
+
+  uint32_t rtt_us = (uint32_t)(rtt_ms * 1000.0);
+  bool ok = check_expiry(rtt_us, lifetime_sec, &log);
+  ok = check_failure(rtt_us, &log) && ok;
+  ok = check_skew(rtt_us, &log) && ok;
+  ok = bench_connect(false, runs, rtt_us, &log) && ok;
+  ok = bench_connect(true, runs, rtt_us, &log) && ok;
+  curl_global_cleanup();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,276 @@
+/*
+ * psn_connect_bench.c — Remote connect signalling, sequential against
+ * pipelined, with the stand-in PSN server (vitarps5_psn_connect).
+ *
+ * Builds the same stage graph chiaki_holepunch_session_prepare() runs
+ * (upnp, ws_fqdn -> ws_open -> create -> start, upnp -> offer) on
+ * ChiakiSignalGraph. The REST calls go through ChiakiHttpClient to the
+ * local TLS stand-in, the parts that need PSN push or a real console are
+ * modelled:
+ *
+ *   upnp     SSDP discovery, --upnp MS
+ *   ws_open  a request on its own connection, like the websocket upgrade
+ *   create   session create, one RTT for the push notification, session view
+ *   offer    two STUN round trips
+ *   start    start command, --console MS for the console to join, session view
+ *
+ * Each run is followed by the offer and ack session messages of the hole
+ * punch. The graph is run on the calling thread in insertion order (the
+ * previous call sequence) and in parallel, one line per mode:
+ *
+ *   BENCH psn_connect mode=.. runs=.. rtt_ms=.. prepare_ms=.. connect_ms=..
+ *         best_ms=.. critical=stage>stage>..
+ *
+ * prepare_ms is the mean time of the graph, connect_ms includes the punch
+ * messages, critical is the critical path of the last run.
+ *
+ * Usage: vitarps5_psn_connect [--runs N] [--rtt MS] [--upnp MS] [--console MS] [--verbose]
+ */
+
+#define _GNU_SOURCE
+
+#include "psn_standin.h"
+
+#include <chiaki/log.h>
+#include <chiaki/time.h>
+
+#include "remote/httpclient.h"
+#include "remote/signalgraph.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WEB_HOST "web.np.playstation.com"
+#define PUSH_HOST "mobile-pushcl.np.communication.playstation.net"
+#define SESSION_PATH "/api/sessionManager/v1/remotePlaySessions"
+#define SESSION_ID "0b3f1a52-6c1e-4c59-9d43-2f1e7c0d5a11"
+
+typedef struct {
+  ChiakiHttpClient *http;
+  struct curl_slist *connect_to;
+  ChiakiLog *log;
+  uint32_t rtt_ms;
+  uint32_t upnp_ms;
+  uint32_t console_ms;
+} ConnectBench;
+
+static void sleep_ms(uint32_t ms) {
+  struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+}
+
+static size_t discard_cb(char *ptr, size_t size, size_t nmemb, void *user) {
+  (void)ptr;
+  (void)user;
+  return size * nmemb;
+}
+
+static ChiakiErrorCode request(ConnectBench *b, ChiakiHttpClient *http, const char *tag, const char *method,
+                               const char *url, const char *body) {
+  CURL *curl = chiaki_http_client_acquire(http);
+  if (!curl)
+    return CHIAKI_ERR_MEMORY;
+  struct curl_slist *headers = curl_slist_append(NULL, "Authorization: Bearer standin");
+  headers = curl_slist_append(headers, "Content-Type: application/json; charset=utf-8");
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+  curl_easy_setopt(curl, CURLOPT_CONNECT_TO, b->connect_to);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+  curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_cb);
+  if (strcmp(method, "GET") != 0)
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+  if (body)
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+  CURLcode res = chiaki_http_client_perform(http, curl, b->log, tag, NULL);
+  if (res != CURLE_OK)
+    fprintf(stderr, "%s failed: %s\n", tag, curl_easy_strerror(res));
+  curl_slist_free_all(headers);
+  chiaki_http_client_release(http, curl);
+  return res == CURLE_OK ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_NETWORK;
+}
+
+static ChiakiErrorCode stage_upnp(void *user) {
+  ConnectBench *b = user;
+  sleep_ms(b->upnp_ms);
+  return CHIAKI_ERR_SUCCESS;
+}
+
+static ChiakiErrorCode stage_ws_fqdn(void *user) {
+  ConnectBench *b = user;
+  return request(b, b->http, "websocket_fqdn", "GET", "https://" PUSH_HOST "/np/serveraddr?version=2.1", NULL);
+}
+
+static ChiakiErrorCode stage_ws_open(void *user) {
+  // The websocket has a connection of its own, so it always pays for a handshake
+  ConnectBench *b = user;
+  ChiakiHttpClient *ws = chiaki_http_client_new();
+  if (!ws)
+    return CHIAKI_ERR_MEMORY;
+  ChiakiErrorCode err = request(b, ws, "websocket_open", "GET", "https://" PUSH_HOST "/np/serveraddr?version=2.1", NULL);
+  chiaki_http_client_free(ws);
+  return err;
+}
+
+static ChiakiErrorCode stage_create(void *user) {
+  ConnectBench *b = user;
+  ChiakiErrorCode err = request(b, b->http, "create_session", "POST", "https://" WEB_HOST SESSION_PATH,
+                                "{\"remotePlaySessions\":[{\"members\":[{\"accountId\":\"me\"}]}]}");
+  if (err != CHIAKI_ERR_SUCCESS)
+    return err;
+  sleep_ms(b->rtt_ms); // SESSION_CREATED and MEMBER_CREATED pushed back
+  return request(b, b->http, "check_session", "GET", "https://" WEB_HOST SESSION_PATH "?view=v1.0", NULL);
+}
+
+static ChiakiErrorCode stage_offer(void *user) {
+  ConnectBench *b = user;
+  sleep_ms(2 * b->rtt_ms); // STUN binding requests, port allocation probe
+  return CHIAKI_ERR_SUCCESS;
+}
+
+static ChiakiErrorCode stage_start(void *user) {
+  ConnectBench *b = user;
+  ChiakiErrorCode err = request(b, b->http, "start_session", "POST",
+                                "https://" WEB_HOST "/api/cloudAssistedNavigation/v2/users/me/commands",
+                                "{\"commandDetail\":{\"commandType\":\"remotePlay\"}}");
+  if (err != CHIAKI_ERR_SUCCESS)
+    return err;
+  sleep_ms(b->console_ms); // console joins, customData1 pushed back
+  return request(b, b->http, "check_session", "GET", "https://" WEB_HOST SESSION_PATH "?view=v1.0", NULL);
+}
+
+static ChiakiErrorCode punch_messages(ConnectBench *b) {
+  static const char *url = "https://" WEB_HOST SESSION_PATH "/" SESSION_ID "/sessionMessage";
+  ChiakiErrorCode err = request(b, b->http, "session_message", "POST", url, "{\"payload\":\"ack\"}");
+  if (err != CHIAKI_ERR_SUCCESS)
+    return err;
+  return request(b, b->http, "session_message", "POST", url, "{\"payload\":\"offer\"}");
+}
+
+/* Returns false if a stage or request failed. */
+static bool run_mode(bool parallel, unsigned runs, ConnectBench *b) {
+  ChiakiSignalGraph graph;
+  if (chiaki_signal_graph_init(&graph, b->log) != CHIAKI_ERR_SUCCESS)
+    return false;
+  int upnp = chiaki_signal_graph_add(&graph, "upnp", stage_upnp, b, 0);
+  int ws_fqdn = chiaki_signal_graph_add(&graph, "ws_fqdn", stage_ws_fqdn, b, 0);
+  int ws_open = chiaki_signal_graph_add(&graph, "ws_open", stage_ws_open, b, 1u << ws_fqdn);
+  int create = chiaki_signal_graph_add(&graph, "create", stage_create, b, 1u << ws_open);
+  chiaki_signal_graph_add(&graph, "offer", stage_offer, b, 1u << upnp);
+  chiaki_signal_graph_add(&graph, "start", stage_start, b, 1u << create);
+
+  bool ok = true;
+  uint64_t prepare_us = 0, connect_us = 0, best_us = UINT64_MAX;
+  for (unsigned r = 0; ok && r < runs; r++) {
+    uint64_t start_us = chiaki_time_now_monotonic_us();
+    ok = chiaki_signal_graph_run(&graph, parallel) == CHIAKI_ERR_SUCCESS;
+    prepare_us += graph.total_us;
+    ok = ok && punch_messages(b) == CHIAKI_ERR_SUCCESS;
+    uint64_t elapsed_us = chiaki_time_now_monotonic_us() - start_us;
+    connect_us += elapsed_us;
+    if (elapsed_us < best_us)
+      best_us = elapsed_us;
+    chiaki_signal_graph_log(&graph, CHIAKI_LOG_VERBOSE);
+  }
+
+  char critical[128] = {0};
+  size_t len = 0;
+  for (size_t i = 0; i < graph.stages_count; i++) {
+    if (!graph.stages[i].critical)
+      continue;
+    len += snprintf(critical + len, sizeof(critical) - len, "%s%s", len ? ">" : "", graph.stages[i].name);
+    if (len >= sizeof(critical))
+      break;
+  }
+  chiaki_signal_graph_fini(&graph);
+
+  printf("BENCH psn_connect mode=%s runs=%u rtt_ms=%u prepare_ms=%.2f connect_ms=%.2f best_ms=%.2f critical=%s\n",
+         parallel ? "parallel" : "sequential", runs, b->rtt_ms, prepare_us / 1000.0 / runs,
+         connect_us / 1000.0 / runs, ok ? best_us / 1000.0 : 0.0, critical);
+  fflush(stdout);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned runs = 5;
+  double rtt_ms = 20.0, upnp_ms = 150.0, console_ms = 250.0;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--verbose") == 0) {
+      verbose = true;
+      continue;
+    }
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    if (strcmp(arg, "--runs") == 0)
+      runs = (unsigned)atoi(val);
+    else if (strcmp(arg, "--rtt") == 0)
+      rtt_ms = atof(val);
+    else if (strcmp(arg, "--upnp") == 0)
+      upnp_ms = atof(val);
+    else if (strcmp(arg, "--console") == 0)
+      console_ms = atof(val);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+  if (!runs || rtt_ms < 0.0 || upnp_ms < 0.0 || console_ms < 0.0) {
+    fprintf(stderr, "invalid options\n");
+    return 2;
+  }
+
+  if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+    fprintf(stderr, "curl_global_init failed\n");
+    return 1;
+  }
+  ChiakiLog log;
+  chiaki_log_init(&log, verbose ? CHIAKI_LOG_ALL : CHIAKI_LOG_ERROR | CHIAKI_LOG_WARNING, chiaki_log_cb_print, NULL);
+
+  PsnStandinConfig config;
+  psn_standin_config_defaults(&config);
+  config.rtt_us = (uint32_t)(rtt_ms * 1000.0);
+  PsnStandin *standin = psn_standin_new(&config);
+  if (!standin || !psn_standin_start(standin)) {
+    fprintf(stderr, "failed to start the PSN stand-in\n");
+    psn_standin_free(standin);
+    curl_global_cleanup();
+    return 1;
+  }
+  char web_to[128], push_to[128];
+  snprintf(web_to, sizeof(web_to), WEB_HOST ":443:127.0.0.1:%u", psn_standin_port(standin));
+  snprintf(push_to, sizeof(push_to), PUSH_HOST ":443:127.0.0.1:%u", psn_standin_port(standin));
+
+  ConnectBench b = {
+      .http = chiaki_http_client_new(),
+      .connect_to = curl_slist_append(curl_slist_append(NULL, web_to), push_to),
+      .log = &log,
+      .rtt_ms = (uint32_t)rtt_ms,
+      .upnp_ms = (uint32_t)upnp_ms,
+      .console_ms = (uint32_t)console_ms,
+  };
+  bool ok = b.http != NULL;
+  if (ok) {
+    // Both modes run on a warm pool, so only the scheduling differs
+    ok = run_mode(false, runs, &b);
+    ok = run_mode(true, runs, &b) && ok;
+  }
+
+  chiaki_http_client_free(b.http);
+  curl_slist_free_all(b.connect_to);
+  PsnStandinStats st;
+  psn_standin_stats(standin, &st);
+  psn_standin_free(standin);
+  curl_global_cleanup();
+  return ok && !st.not_found ? 0 : 1;
+}
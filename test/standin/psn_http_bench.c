@@ -0,0 +1,226 @@
+/*
+ * psn_http_bench.c — PSN request sequence of a remote connect against the
+ * stand-in PSN server (vitarps5_psn_http).
+ *
+ * Replays the REST calls holepunch.c makes for one remote connect (device
+ * list, push server address, session create, start command, session view,
+ * offer and ack messages, member delete) through ChiakiHttpClient, with both
+ * PSN host names pointed at a local TLS stand-in. Two modes are run:
+ *
+ *   cold    a new client per request, which is what the per-call
+ *           curl_easy_init() code did
+ *   pooled  one client for every sequence, the way holepunch uses the
+ *           shared client
+ *
+ * and one line per mode is printed:
+ *
+ *   BENCH psn_http mode=.. sequences=.. rtt_ms=.. first_ms=.. sequence_ms=..
+ *         dns_ms=.. connect_ms=.. tls_ms=.. ttfb_ms=.. reused=../..
+ *         http2=.. handshakes=.. resumed=..
+ *
+ * first_ms is the first sequence, sequence_ms the mean of the rest, the
+ * per-phase numbers are means per request. The exit status is non-zero if
+ * any request failed or the pooled mode reused nothing.
+ *
+ * Usage: vitarps5_psn_http [--sequences N] [--rtt MS] [--verbose]
+ */
+
+#define _GNU_SOURCE
+
+#include "psn_standin.h"
+
+#include <chiaki/log.h>
+#include <chiaki/time.h>
+
+#include "remote/httpclient.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WEB_HOST "web.np.playstation.com"
+#define PUSH_HOST "mobile-pushcl.np.communication.playstation.net"
+#define SESSION_PATH "/api/sessionManager/v1/remotePlaySessions"
+#define SESSION_ID "0b3f1a52-6c1e-4c59-9d43-2f1e7c0d5a11"
+
+typedef struct {
+  const char *tag;
+  const char *method;
+  const char *url;
+  const char *body;
+} PsnStep;
+
+static const PsnStep connect_sequence[] = {
+    {"list_devices", "GET",
+     "https://" WEB_HOST "/api/cloudAssistedNavigation/v2/users/me/clients?platform=PS5&includeFields=device", NULL},
+    {"websocket_fqdn", "GET", "https://" PUSH_HOST "/np/serveraddr?version=2.1", NULL},
+    {"create_session", "POST", "https://" WEB_HOST SESSION_PATH,
+     "{\"remotePlaySessions\":[{\"members\":[{\"accountId\":\"me\",\"pushContexts\":[{\"pushContextId\":\"x\"}]}]}]}"},
+    {"start_session", "POST", "https://" WEB_HOST "/api/cloudAssistedNavigation/v2/users/me/commands",
+     "{\"commandDetail\":{\"commandType\":\"remotePlay\"}}"},
+    {"check_session", "GET", "https://" WEB_HOST SESSION_PATH "?view=v1.0", NULL},
+    {"session_message", "POST", "https://" WEB_HOST SESSION_PATH "/" SESSION_ID "/sessionMessage",
+     "{\"channel\":\"remote_play:1\",\"payload\":\"offer\"}"},
+    {"session_message", "POST", "https://" WEB_HOST SESSION_PATH "/" SESSION_ID "/sessionMessage",
+     "{\"channel\":\"remote_play:1\",\"payload\":\"ack\"}"},
+    {"delete_session", "DELETE", "https://" WEB_HOST SESSION_PATH "/" SESSION_ID "/members/me", NULL},
+};
+
+#define STEPS (sizeof(connect_sequence) / sizeof(connect_sequence[0]))
+
+static size_t discard_cb(char *ptr, size_t size, size_t nmemb, void *user) {
+  (void)ptr;
+  (void)user;
+  return size * nmemb;
+}
+
+static bool run_step(ChiakiHttpClient *client, const PsnStep *step, struct curl_slist *connect_to, ChiakiLog *log) {
+  CURL *curl = chiaki_http_client_acquire(client);
+  if (!curl)
+    return false;
+  struct curl_slist *headers = curl_slist_append(NULL, "Authorization: Bearer standin");
+  headers = curl_slist_append(headers, "Content-Type: application/json; charset=utf-8");
+  curl_easy_setopt(curl, CURLOPT_URL, step->url);
+  curl_easy_setopt(curl, CURLOPT_CONNECT_TO, connect_to);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+  curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_cb);
+  if (strcmp(step->method, "GET") != 0)
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, step->method);
+  if (step->body)
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, step->body);
+  CURLcode res = chiaki_http_client_perform(client, curl, log, step->tag, NULL);
+  if (res != CURLE_OK)
+    fprintf(stderr, "%s failed: %s\n", step->tag, curl_easy_strerror(res));
+  curl_slist_free_all(headers);
+  chiaki_http_client_release(client, curl);
+  return res == CURLE_OK;
+}
+
+static void stats_add(ChiakiHttpClientStats *sum, const ChiakiHttpClientStats *s) {
+  sum->requests += s->requests;
+  sum->failures += s->failures;
+  sum->reused += s->reused;
+  sum->http2 += s->http2;
+  sum->dns_us += s->dns_us;
+  sum->connect_us += s->connect_us;
+  sum->tls_us += s->tls_us;
+  sum->ttfb_us += s->ttfb_us;
+  sum->total_us += s->total_us;
+}
+
+/* Returns false if a request failed. */
+static bool run_mode(bool pooled, unsigned sequences, uint32_t rtt_us, ChiakiLog *log) {
+  PsnStandinConfig config;
+  psn_standin_config_defaults(&config);
+  config.rtt_us = rtt_us;
+  PsnStandin *standin = psn_standin_new(&config);
+  if (!standin || !psn_standin_start(standin)) {
+    fprintf(stderr, "failed to start the PSN stand-in\n");
+    psn_standin_free(standin);
+    return false;
+  }
+  char web_to[128], push_to[128];
+  snprintf(web_to, sizeof(web_to), WEB_HOST ":443:127.0.0.1:%u", psn_standin_port(standin));
+  snprintf(push_to, sizeof(push_to), PUSH_HOST ":443:127.0.0.1:%u", psn_standin_port(standin));
+  struct curl_slist *connect_to = curl_slist_append(NULL, web_to);
+  connect_to = curl_slist_append(connect_to, push_to);
+
+  ChiakiHttpClient *shared = pooled ? chiaki_http_client_new() : NULL;
+  ChiakiHttpClientStats sum;
+  memset(&sum, 0, sizeof(sum));
+  bool ok = !pooled || shared;
+  uint64_t first_us = 0, rest_us = 0;
+  for (unsigned s = 0; ok && s < sequences; s++) {
+    uint64_t start_us = chiaki_time_now_monotonic_us();
+    for (size_t i = 0; ok && i < STEPS; i++) {
+      ChiakiHttpClient *client = pooled ? shared : chiaki_http_client_new();
+      if (!client) {
+        ok = false;
+        break;
+      }
+      ok = run_step(client, &connect_sequence[i], connect_to, log);
+      if (!pooled) {
+        ChiakiHttpClientStats st;
+        chiaki_http_client_stats(client, &st);
+        stats_add(&sum, &st);
+        chiaki_http_client_free(client);
+      }
+    }
+    uint64_t elapsed_us = chiaki_time_now_monotonic_us() - start_us;
+    if (s == 0)
+      first_us = elapsed_us;
+    else
+      rest_us += elapsed_us;
+  }
+  if (pooled && shared) {
+    chiaki_http_client_stats(shared, &sum);
+    chiaki_http_client_free(shared);
+  }
+  curl_slist_free_all(connect_to);
+
+  PsnStandinStats st;
+  psn_standin_stats(standin, &st);
+  psn_standin_free(standin);
+
+  double n = sum.requests ? (double)sum.requests : 1.0;
+  printf("BENCH psn_http mode=%s sequences=%u rtt_ms=%.1f first_ms=%.2f sequence_ms=%.2f dns_ms=%.3f "
+         "connect_ms=%.3f tls_ms=%.3f ttfb_ms=%.3f reused=%llu/%llu http2=%llu handshakes=%llu resumed=%llu\n",
+         pooled ? "pooled" : "cold", sequences, rtt_us / 1000.0, first_us / 1000.0,
+         sequences > 1 ? rest_us / 1000.0 / (sequences - 1) : first_us / 1000.0, sum.dns_us / n / 1000.0,
+         sum.connect_us / n / 1000.0, sum.tls_us / n / 1000.0, sum.ttfb_us / n / 1000.0,
+         (unsigned long long)sum.reused, (unsigned long long)sum.requests, (unsigned long long)sum.http2,
+         (unsigned long long)st.handshakes, (unsigned long long)st.resumed);
+  fflush(stdout);
+  if (!ok || sum.failures || st.not_found)
+    return false;
+  return !pooled || sum.reused > 0;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned sequences = 20;
+  double rtt_ms = 20.0;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--verbose") == 0) {
+      verbose = true;
+      continue;
+    }
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    if (strcmp(arg, "--sequences") == 0)
+      sequences = (unsigned)atoi(val);
+    else if (strcmp(arg, "--rtt") == 0)
+      rtt_ms = atof(val);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+  if (!sequences || rtt_ms < 0.0) {
+    fprintf(stderr, "invalid options\n");
+    return 2;
+  }
+
+  if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+    fprintf(stderr, "curl_global_init failed\n");
+    return 1;
+  }
+  ChiakiLog log;
+  chiaki_log_init(&log, verbose ? CHIAKI_LOG_ALL : CHIAKI_LOG_ERROR | CHIAKI_LOG_WARNING, chiaki_log_cb_print, NULL);
+
+  uint32_t rtt_us = (uint32_t)(rtt_ms * 1000.0);
+  bool ok = run_mode(false, sequences, rtt_us, &log);
+  ok = run_mode(true, sequences, rtt_us, &log) && ok;
+  curl_global_cleanup();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,509 @@
+/*
+ * psn_standin.c — Stand-in PSN REST server, see psn_standin.h.
+ *
+ * One thread accepts, one thread per connection serves keep-alive requests
+ * until the client closes or the server is freed.
+ */
+
+#define _GNU_SOURCE
+
+#include "psn_standin.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#define PSN_STANDIN_MAX_CONNS 32
+#define PSN_STANDIN_BUF_SIZE 16384
+#define PSN_STANDIN_IDLE_TIMEOUT_MS 30000
+
+typedef struct {
+  PsnStandin *standin;
+  int fd;
+  bool used;
+  bool done; /* the thread has returned and can be joined */
+  pthread_t thread;
+  char buf[PSN_STANDIN_BUF_SIZE];
+  size_t len;
+} PsnStandinConn;
+
+struct psn_standin_t {
+  PsnStandinConfig config;
+  SSL_CTX *ctx;
+  int listen_fd;
+  uint16_t port;
+  int stop_pipe[2];
+  pthread_t accept_thread;
+  bool started;
+
+  pthread_mutex_t mutex; /* conns, stats and the OAuth state */
+  PsnStandinConn conns[PSN_STANDIN_MAX_CONNS];
+  PsnStandinStats stats;
+  PsnStandinOAuthMode oauth_mode;
+  unsigned token_generation; /* standin-refresh-<generation> is the valid refresh token */
+};
+
+static const char session_json[] =
+    "{\"remotePlaySessions\":[{\"sessionId\":\"0b3f1a52-6c1e-4c59-9d43-2f1e7c0d5a11\","
+    "\"members\":[{\"accountId\":\"4242424242424242\",\"deviceUniqueId\":\"me\",\"platform\":\"PS5\","
+    "\"pushContexts\":[{\"pushContextId\":\"standin\"}]}]}]}";
+static const char devices_json[] =
+    "{\"clients\":[{\"duid\":\"00000007000100100000000000000000000000000000000000000000000000aa\","
+    "\"device\":{\"enabledFeatures\":[\"remotePlay\"],\"name\":\"Stand-in PS5\",\"platform\":\"PS5\"}}]}";
+static const char serveraddr_json[] = "{\"fqdn\":\"standin-push.invalid\",\"keepAliveStatus\":{\"interval\":60}}";
+
+void psn_standin_config_defaults(PsnStandinConfig *config) {
+  memset(config, 0, sizeof(*config));
+  config->bind_addr = "127.0.0.1";
+  config->token_lifetime_sec = 3600;
+}
+
+static void stats_add(PsnStandin *standin, uint64_t *field) {
+  pthread_mutex_lock(&standin->mutex);
+  (*field)++;
+  pthread_mutex_unlock(&standin->mutex);
+}
+
+static bool make_certificate(SSL_CTX *ctx) {
+  bool ok = false;
+  EVP_PKEY *pkey = NULL;
+  X509 *x509 = NULL;
+  EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+  if (!kctx || EVP_PKEY_keygen_init(kctx) <= 0 ||
+      EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) <= 0 || EVP_PKEY_keygen(kctx, &pkey) <= 0)
+    goto out;
+
+  x509 = X509_new();
+  if (!x509)
+    goto out;
+  X509_set_version(x509, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+  X509_gmtime_adj(X509_getm_notBefore(x509), -60);
+  X509_gmtime_adj(X509_getm_notAfter(x509), 24 * 3600);
+  X509_set_pubkey(x509, pkey);
+  X509_NAME *name = X509_get_subject_name(x509);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"psn-standin", -1, -1, 0);
+  X509_set_issuer_name(x509, name);
+  if (!X509_sign(x509, pkey, EVP_sha256()))
+    goto out;
+  ok = SSL_CTX_use_certificate(ctx, x509) == 1 && SSL_CTX_use_PrivateKey(ctx, pkey) == 1;
+
+out:
+  X509_free(x509);
+  EVP_PKEY_free(pkey);
+  EVP_PKEY_CTX_free(kctx);
+  return ok;
+}
+
+/* Waits until fd is readable or the server stops. */
+static bool wait_readable(PsnStandin *standin, int fd) {
+  struct pollfd pfds[2] = {{fd, POLLIN, 0}, {standin->stop_pipe[0], POLLIN, 0}};
+  for (;;) {
+    int r = poll(pfds, 2, PSN_STANDIN_IDLE_TIMEOUT_MS);
+    if (r < 0 && errno == EINTR)
+      continue;
+    return r > 0 && !(pfds[1].revents & POLLIN) && (pfds[0].revents & (POLLIN | POLLHUP));
+  }
+}
+
+static bool conn_fill(PsnStandinConn *c, SSL *ssl) {
+  if (c->len >= sizeof(c->buf))
+    return false;
+  if (!SSL_pending(ssl) && !wait_readable(c->standin, c->fd))
+    return false;
+  int r = SSL_read(ssl, c->buf + c->len, (int)(sizeof(c->buf) - c->len));
+  if (r <= 0)
+    return false;
+  c->len += (size_t)r;
+  return true;
+}
+
+typedef struct {
+  char method[8];
+  char path[512];
+  const char *body;
+  size_t body_len;
+  size_t consumed; /* header and body bytes at the front of the buffer */
+} PsnStandinRequest;
+
+static bool conn_read_request(PsnStandinConn *c, SSL *ssl, PsnStandinRequest *req) {
+  char *end;
+  while (!(end = memmem(c->buf, c->len, "\r\n\r\n", 4))) {
+    if (!conn_fill(c, ssl))
+      return false;
+  }
+  size_t header_len = (size_t)(end - c->buf) + 4;
+  char line[sizeof(req->path) + 32];
+  size_t line_len = strcspn(c->buf, "\r");
+  if (line_len >= sizeof(line))
+    return false;
+  memcpy(line, c->buf, line_len);
+  line[line_len] = '\0';
+  if (sscanf(line, "%7s %511s", req->method, req->path) != 2)
+    return false;
+
+  size_t content_length = 0;
+  char saved = c->buf[header_len - 1];
+  c->buf[header_len - 1] = '\0';
+  const char *cl = strcasestr(c->buf, "\r\nContent-Length:");
+  if (cl)
+    content_length = strtoul(cl + strlen("\r\nContent-Length:"), NULL, 10);
+  c->buf[header_len - 1] = saved;
+  if (header_len + content_length > sizeof(c->buf))
+    return false;
+  while (c->len < header_len + content_length) {
+    if (!conn_fill(c, ssl))
+      return false;
+  }
+  req->body = c->buf + header_len;
+  req->body_len = content_length;
+  req->consumed = header_len + content_length;
+  return true;
+}
+
+static bool path_is(const char *path, const char *prefix, const char *suffix) {
+  size_t path_len = strcspn(path, "?");
+  size_t prefix_len = strlen(prefix);
+  size_t suffix_len = suffix ? strlen(suffix) : 0;
+  if (path_len < prefix_len + suffix_len || strncmp(path, prefix, prefix_len) != 0)
+    return false;
+  if (!suffix)
+    return path_len == prefix_len;
+  return strncmp(path + path_len - suffix_len, suffix, suffix_len) == 0;
+}
+
+/* Copies the value of name out of an application/x-www-form-urlencoded body.
+ * The stand-in's tokens need no decoding. */
+static bool form_value(const PsnStandinRequest *req, const char *name, char *out, size_t out_size) {
+  size_t name_len = strlen(name);
+  const char *p = req->body;
+  const char *end = req->body + req->body_len;
+  while (p < end) {
+    const char *amp = memchr(p, '&', (size_t)(end - p));
+    const char *param_end = amp ? amp : end;
+    if ((size_t)(param_end - p) > name_len && strncmp(p, name, name_len) == 0 && p[name_len] == '=') {
+      size_t len = (size_t)(param_end - p) - name_len - 1;
+      if (len >= out_size)
+        return false;
+      memcpy(out, p + name_len + 1, len);
+      out[len] = '\0';
+      return true;
+    }
+    p = param_end + 1;
+  }
+  return false;
+}
+
+static int route_token(PsnStandin *standin, const PsnStandinRequest *req, char *scratch, size_t scratch_size,
+                       const char **body) {
+  static const char invalid_grant[] =
+      "{\"error\":\"invalid_grant\",\"error_description\":\"Invalid refresh token\"}";
+  char grant_type[32];
+  char refresh_token[64];
+  char expected[64];
+  pthread_mutex_lock(&standin->mutex);
+  standin->stats.token_requests++;
+  PsnStandinOAuthMode mode = standin->oauth_mode;
+  snprintf(expected, sizeof(expected), "standin-refresh-%u", standin->token_generation);
+  if (mode == PSN_STANDIN_OAUTH_UNAVAILABLE) {
+    pthread_mutex_unlock(&standin->mutex);
+    *body = "{\"error\":\"temporarily_unavailable\"}";
+    return 503;
+  }
+  if (mode == PSN_STANDIN_OAUTH_REJECT || !form_value(req, "grant_type", grant_type, sizeof(grant_type)) ||
+      strcmp(grant_type, "refresh_token") != 0 ||
+      !form_value(req, "refresh_token", refresh_token, sizeof(refresh_token)) ||
+      strcmp(refresh_token, expected) != 0) {
+    standin->stats.token_rejected++;
+    pthread_mutex_unlock(&standin->mutex);
+    *body = invalid_grant;
+    return 400;
+  }
+  unsigned generation = ++standin->token_generation;
+  standin->stats.token_issued++;
+  pthread_mutex_unlock(&standin->mutex);
+  snprintf(scratch, scratch_size,
+           "{\"access_token\":\"standin-access-%u\",\"token_type\":\"bearer\",\"expires_in\":%u,"
+           "\"refresh_token\":\"standin-refresh-%u\",\"scope\":\"psn:clientapp\"}",
+           generation, standin->config.token_lifetime_sec, generation);
+  *body = scratch;
+  return 200;
+}
+
+static int route(PsnStandin *standin, const PsnStandinRequest *req, char *scratch, size_t scratch_size,
+                 const char **body) {
+  bool get = strcmp(req->method, "GET") == 0;
+  bool post = strcmp(req->method, "POST") == 0;
+  *body = "";
+  if (post && path_is(req->path, "/2.0/oauth/token", NULL))
+    return route_token(standin, req, scratch, scratch_size, body);
+  if (get && path_is(req->path, "/np/serveraddr", NULL)) {
+    *body = serveraddr_json;
+    return 200;
+  }
+  if (get && path_is(req->path, "/api/cloudAssistedNavigation/v2/users/me/clients", NULL)) {
+    *body = devices_json;
+    return 200;
+  }
+  if (post && path_is(req->path, "/api/cloudAssistedNavigation/v2/users/me/commands", NULL)) {
+    *body = "{}";
+    return 200;
+  }
+  if ((get || post) && path_is(req->path, "/api/sessionManager/v1/remotePlaySessions", NULL)) {
+    *body = session_json;
+    return 200;
+  }
+  if (post && path_is(req->path, "/api/sessionManager/v1/remotePlaySessions/", "/sessionMessage"))
+    return 204;
+  if (strcmp(req->method, "DELETE") == 0 && path_is(req->path, "/api/sessionManager/v1/remotePlaySessions/", "/members/me"))
+    return 204;
+  return 404;
+}
+
+static const char *status_reason(int status) {
+  switch (status) {
+    case 200:
+      return "OK";
+    case 204:
+      return "No Content";
+    case 400:
+      return "Bad Request";
+    case 503:
+      return "Service Unavailable";
+    default:
+      return "Not Found";
+  }
+}
+
+static bool conn_respond(PsnStandin *standin, SSL *ssl, int status, const char *body) {
+  char date[64];
+  time_t now = time(NULL) + (time_t)standin->config.clock_skew_sec;
+  struct tm tm;
+  gmtime_r(&now, &tm);
+  strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  char head[320];
+  size_t body_len = strlen(body);
+  int head_len = snprintf(head, sizeof(head),
+                          "HTTP/1.1 %d %s\r\nDate: %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n"
+                          "Connection: keep-alive\r\n\r\n",
+                          status, status_reason(status), date, status == 204 ? (size_t)0 : body_len);
+  if (SSL_write(ssl, head, head_len) != head_len)
+    return false;
+  if (status != 204 && body_len && SSL_write(ssl, body, (int)body_len) != (int)body_len)
+    return false;
+  return true;
+}
+
+static void *conn_thread(void *arg) {
+  PsnStandinConn *c = arg;
+  PsnStandin *standin = c->standin;
+  SSL *ssl = SSL_new(standin->ctx);
+  if (!ssl)
+    goto out;
+  SSL_set_fd(ssl, c->fd);
+
+  if (standin->config.rtt_us)
+    usleep(standin->config.rtt_us);
+  if (SSL_accept(ssl) != 1)
+    goto out;
+  stats_add(standin, &standin->stats.handshakes);
+  if (SSL_session_reused(ssl))
+    stats_add(standin, &standin->stats.resumed);
+
+  PsnStandinRequest req;
+  while (conn_read_request(c, ssl, &req)) {
+    const char *body;
+    char scratch[512];
+    int status = route(standin, &req, scratch, sizeof(scratch), &body);
+    stats_add(standin, &standin->stats.requests);
+    if (status == 404)
+      stats_add(standin, &standin->stats.not_found);
+    memmove(c->buf, c->buf + req.consumed, c->len - req.consumed);
+    c->len -= req.consumed;
+    if (standin->config.rtt_us)
+      usleep(standin->config.rtt_us);
+    if (!conn_respond(standin, ssl, status, body))
+      break;
+  }
+  SSL_shutdown(ssl);
+
+out:
+  SSL_free(ssl);
+  ERR_clear_error();
+  pthread_mutex_lock(&standin->mutex);
+  c->done = true;
+  pthread_mutex_unlock(&standin->mutex);
+  return NULL;
+}
+
+/* Joins finished connections so their slots can be reused. */
+static void reap_conns(PsnStandin *standin) {
+  for (size_t i = 0; i < PSN_STANDIN_MAX_CONNS; i++) {
+    PsnStandinConn *c = &standin->conns[i];
+    pthread_mutex_lock(&standin->mutex);
+    bool done = c->used && c->done;
+    pthread_mutex_unlock(&standin->mutex);
+    if (!done)
+      continue;
+    pthread_join(c->thread, NULL);
+    close(c->fd);
+    c->fd = -1;
+    pthread_mutex_lock(&standin->mutex);
+    c->used = false;
+    c->done = false;
+    pthread_mutex_unlock(&standin->mutex);
+  }
+}
+
+static void *accept_thread(void *arg) {
+  PsnStandin *standin = arg;
+  for (;;) {
+    struct pollfd pfds[2] = {{standin->listen_fd, POLLIN, 0}, {standin->stop_pipe[0], POLLIN, 0}};
+    int r = poll(pfds, 2, -1);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0 || (pfds[1].revents & POLLIN))
+      break;
+    reap_conns(standin);
+    int fd = accept(standin->listen_fd, NULL, NULL);
+    if (fd < 0)
+      continue;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    PsnStandinConn *c = NULL;
+    pthread_mutex_lock(&standin->mutex);
+    for (size_t i = 0; i < PSN_STANDIN_MAX_CONNS; i++) {
+      if (!standin->conns[i].used) {
+        c = &standin->conns[i];
+        c->used = true;
+        break;
+      }
+    }
+    if (c)
+      standin->stats.connections++;
+    pthread_mutex_unlock(&standin->mutex);
+    if (!c) {
+      close(fd);
+      continue;
+    }
+    c->standin = standin;
+    c->fd = fd;
+    c->len = 0;
+    if (pthread_create(&c->thread, NULL, conn_thread, c) != 0) {
+      close(fd);
+      c->fd = -1;
+      pthread_mutex_lock(&standin->mutex);
+      c->used = false;
+      pthread_mutex_unlock(&standin->mutex);
+    }
+  }
+  return NULL;
+}
+
+PsnStandin *psn_standin_new(const PsnStandinConfig *config) {
+  PsnStandin *standin = calloc(1, sizeof(*standin));
+  if (!standin)
+    return NULL;
+  standin->config = *config;
+  standin->listen_fd = -1;
+  standin->stop_pipe[0] = standin->stop_pipe[1] = -1;
+  pthread_mutex_init(&standin->mutex, NULL);
+  for (size_t i = 0; i < PSN_STANDIN_MAX_CONNS; i++)
+    standin->conns[i].fd = -1;
+
+  standin->ctx = SSL_CTX_new(TLS_server_method());
+  if (!standin->ctx || !make_certificate(standin->ctx))
+    goto error;
+  SSL_CTX_set_session_id_context(standin->ctx, (const unsigned char *)"psn", 3);
+  SSL_CTX_set_session_cache_mode(standin->ctx, SSL_SESS_CACHE_SERVER);
+
+  if (pipe(standin->stop_pipe) < 0)
+    goto error;
+  standin->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (standin->listen_fd < 0)
+    goto error;
+  int one = 1;
+  setsockopt(standin->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(config->port);
+  if (inet_pton(AF_INET, config->bind_addr ? config->bind_addr : "127.0.0.1", &addr.sin_addr) != 1)
+    goto error;
+  if (bind(standin->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(standin->listen_fd, 16) < 0)
+    goto error;
+  socklen_t addr_len = sizeof(addr);
+  if (getsockname(standin->listen_fd, (struct sockaddr *)&addr, &addr_len) < 0)
+    goto error;
+  standin->port = ntohs(addr.sin_port);
+  return standin;
+
+error:
+  psn_standin_free(standin);
+  return NULL;
+}
+
+bool psn_standin_start(PsnStandin *standin) {
+  if (pthread_create(&standin->accept_thread, NULL, accept_thread, standin) != 0)
+    return false;
+  standin->started = true;
+  return true;
+}
+
+uint16_t psn_standin_port(PsnStandin *standin) {
+  return standin->port;
+}
+
+void psn_standin_stats(PsnStandin *standin, PsnStandinStats *stats) {
+  pthread_mutex_lock(&standin->mutex);
+  *stats = standin->stats;
+  pthread_mutex_unlock(&standin->mutex);
+}
+
+void psn_standin_set_oauth_mode(PsnStandin *standin, PsnStandinOAuthMode mode) {
+  pthread_mutex_lock(&standin->mutex);
+  standin->oauth_mode = mode;
+  pthread_mutex_unlock(&standin->mutex);
+}
+
+void psn_standin_free(PsnStandin *standin) {
+  if (!standin)
+    return;
+  if (standin->stop_pipe[1] >= 0 && write(standin->stop_pipe[1], "x", 1) != 1)
+    fprintf(stderr, "psn_standin: failed to signal stop\n");
+  if (standin->started)
+    pthread_join(standin->accept_thread, NULL);
+  for (size_t i = 0; i < PSN_STANDIN_MAX_CONNS; i++) {
+    PsnStandinConn *c = &standin->conns[i];
+    if (!c->used || c->fd < 0)
+      continue;
+    shutdown(c->fd, SHUT_RDWR);
+    pthread_join(c->thread, NULL);
+    close(c->fd);
+  }
+  if (standin->listen_fd >= 0)
+    close(standin->listen_fd);
+  if (standin->stop_pipe[0] >= 0)
+    close(standin->stop_pipe[0]);
+  if (standin->stop_pipe[1] >= 0)
+    close(standin->stop_pipe[1]);
+  SSL_CTX_free(standin->ctx);
+  pthread_mutex_destroy(&standin->mutex);
+  free(standin);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+/*
+ * Stand-in PSN REST server for connect benchmarks (Linux only).
+ *
+ * A small HTTPS/1.1 server with a throwaway self-signed certificate that
+ * answers the endpoints a remote connect hits (device list, push server
+ * address, session create/view, start command, session messages, member
+ * delete) with canned JSON. Keep-alive and TLS session resumption are
+ * supported, so the client's connection reuse shows up in the numbers.
+ *
+ * Wide-area latency is modelled by sleeping rtt_us before the TLS handshake
+ * (the ClientHello round trip) and before each response, so a new connection
+ * costs two round trips on top of the request and a reused one costs one.
+ *
+ * POST /2.0/oauth/token answers refresh_token grants like the PSN token
+ * endpoint: the refresh token is rotated on every refresh and only the latest
+ * one is accepted (400 invalid_grant otherwise), the first one is
+ * PSN_STANDIN_REFRESH_TOKEN. Every response carries a Date header, shifted by
+ * clock_skew_sec to play a server whose clock differs from ours.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PSN_STANDIN_REFRESH_TOKEN "standin-refresh-0"
+
+typedef enum {
+  PSN_STANDIN_OAUTH_OK,
+  PSN_STANDIN_OAUTH_UNAVAILABLE, /* 503 for every token request */
+  PSN_STANDIN_OAUTH_REJECT       /* 400 invalid_grant for every token request */
+} PsnStandinOAuthMode;
+
+typedef struct {
+  const char *bind_addr; /* default 127.0.0.1 */
+  uint16_t port;         /* 0 picks a free port, see psn_standin_port() */
+  uint32_t rtt_us;
+  uint32_t token_lifetime_sec; /* expires_in of issued access tokens, default 3600 */
+  int64_t clock_skew_sec;      /* added to the Date header */
+} PsnStandinConfig;
+
+typedef struct {
+  uint64_t connections;
+  uint64_t handshakes;
+  uint64_t resumed; /* handshakes that resumed a TLS session */
+  uint64_t requests;
+  uint64_t not_found;
+  uint64_t token_requests;
+  uint64_t token_issued;
+  uint64_t token_rejected; /* 400 invalid_grant */
+} PsnStandinStats;
+
+typedef struct psn_standin_t PsnStandin;
+
+void psn_standin_config_defaults(PsnStandinConfig *config);
+
+/* Creates the certificate and binds the listener. Returns NULL on failure. */
+PsnStandin *psn_standin_new(const PsnStandinConfig *config);
+bool psn_standin_start(PsnStandin *standin);
+uint16_t psn_standin_port(PsnStandin *standin);
+void psn_standin_stats(PsnStandin *standin, PsnStandinStats *stats);
+/* Can be switched while clients are connected. */
+void psn_standin_set_oauth_mode(PsnStandin *standin, PsnStandinOAuthMode mode);
+/* Closes all connections and joins their threads. */
+void psn_standin_free(PsnStandin *standin);
@@ -0,0 +1,525 @@
+/*
+ * reconnect_bench.c — Reconnects with and without ChiakiConnProfileStore
+ * against a stand-in console (vitarps5_reconnect).
+ *
+ * The stand-in is the wake stand-in (wake_standin.h) kept awake, a PS4 on
+ * 9.0 firmware that answers a session request for another RP version with a
+ * version mismatch. A connect goes through the steps of the session thread
+ * that a connection profile can skip, each costing round trips to the
+ * stand-in whose answers are held for --rtt:
+ *
+ *   discovery  SRCH until the console answers, for its address, request
+ *              port and system version
+ *   request    session request, the default RP version first and the
+ *              console's one after a mismatch, as session.c does
+ *   link       Senkusha: its handshake, echo pings and the MTU searches,
+ *              SENKUSHA_ROUND_TRIPS sequential pings to the stand-in
+ *
+ * A cold connect runs all of them. A hot connect looks the console up in the
+ * store, applies the profile the way host.c does (chiaki_conn_profile_apply())
+ * and goes straight to the recorded address with the recorded RP version,
+ * skipping link with valid mtu/rtt hints. Every successful connect records
+ * what it found out.
+ *
+ * First checks the fallbacks, failing with a non-zero exit status if any
+ * check does not hold:
+ *
+ *   hot       after one cold connect, a hot one is a single session request
+ *   firmware  after a firmware update the recorded RP version is answered
+ *             with a mismatch, retried with the console's one and recorded
+ *   moved     the console got another address: the hot connect is refused,
+ *             reported as a mismatch and the cold connect records the new one
+ *
+ * Then times --runs reconnects per mode:
+ *
+ *   BENCH reconnect mode=cold|hot runs=.. rtt_ms=.. discovery_ms=..
+ *         request_ms=.. link_ms=.. total_ms=.. srch=.. requests=.. pings=..
+ *
+ * all means over the runs.
+ *
+ * Usage: vitarps5_reconnect [--runs N] [--rtt MS] [--verbose]
+ */
+
+#define _GNU_SOURCE
+
+#include "wake_standin.h"
+
+#include <chiaki/connprofile.h>
+#include <chiaki/discovery.h>
+#include <chiaki/log.h>
+#include <chiaki/time.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define CONSOLE_KEY "0123456789ab" /* the stand-in's MAC, as host.c keys profiles */
+#define CONSOLE_SYSTEM_VERSION "09000000"
+#define CONSOLE_TARGET CHIAKI_TARGET_PS4_9
+#define UPDATED_SYSTEM_VERSION "10000000"
+#define UPDATED_TARGET CHIAKI_TARGET_PS4_10
+#define DEFAULT_TARGET CHIAKI_TARGET_PS4_10 /* what session.c requests for a PS4 without a hint */
+/* Takion handshake and BIG/BANG, 10 echo pings, two MTU binary searches over 576..1454 */
+#define SENKUSHA_ROUND_TRIPS (3 + 10 + 2 * 10)
+#define REPLY_TIMEOUT_MS 2000
+
+typedef struct {
+  const char *addr;
+  uint16_t discovery_port;
+  uint16_t session_port;
+} ConsoleAddr;
+
+typedef struct {
+  uint64_t discovery_ms;
+  uint64_t request_ms;
+  uint64_t link_ms;
+  uint64_t total_ms;
+  unsigned srch;
+  unsigned requests;
+  unsigned pings;
+  uint32_t applied; /* profile parts the connect relied on */
+} ReconnectTimeline;
+
+static void console_addr_format(const ConsoleAddr *console, char *out, size_t out_size) {
+  snprintf(out, out_size, "%s:%u:%u", console->addr, (unsigned)console->discovery_port,
+           (unsigned)console->session_port);
+}
+
+static bool console_addr_parse(const char *s, ConsoleAddr *console, char *addr_buf, size_t addr_buf_size) {
+  unsigned discovery_port, session_port;
+  const char *colon = strchr(s, ':');
+  if (!colon || (size_t)(colon - s) >= addr_buf_size ||
+      sscanf(colon + 1, "%u:%u", &discovery_port, &session_port) != 2)
+    return false;
+  memcpy(addr_buf, s, (size_t)(colon - s));
+  addr_buf[colon - s] = '\0';
+  console->addr = addr_buf;
+  console->discovery_port = (uint16_t)discovery_port;
+  console->session_port = (uint16_t)session_port;
+  return true;
+}
+
+static bool sockaddr_of(const char *addr, uint16_t port, struct sockaddr_in *out) {
+  memset(out, 0, sizeof(*out));
+  out->sin_family = AF_INET;
+  out->sin_port = htons(port);
+  return inet_pton(AF_INET, addr, &out->sin_addr) == 1;
+}
+
+/* SRCH until the console answers. Fills system_version. */
+static ChiakiErrorCode discover(ChiakiLog *log, const ConsoleAddr *console, char *system_version,
+                                size_t system_version_size, ReconnectTimeline *timeline) {
+  struct sockaddr_in to;
+  if (!sockaddr_of(console->addr, console->discovery_port, &to))
+    return CHIAKI_ERR_PARSE_ADDR;
+  ChiakiDiscovery discovery;
+  ChiakiErrorCode err = chiaki_discovery_init(&discovery, log, AF_INET);
+  if (err != CHIAKI_ERR_SUCCESS)
+    return err;
+  ChiakiDiscoveryPacket srch = {0};
+  srch.cmd = CHIAKI_DISCOVERY_CMD_SRCH;
+  srch.protocol_version = CHIAKI_DISCOVERY_PROTOCOL_VERSION_PS4;
+  err = CHIAKI_ERR_TIMEOUT;
+  for (int attempt = 0; attempt < 3 && err == CHIAKI_ERR_TIMEOUT; attempt++) {
+    if (chiaki_discovery_send(&discovery, &srch, (struct sockaddr *)&to, sizeof(to)) != CHIAKI_ERR_SUCCESS) {
+      err = CHIAKI_ERR_NETWORK;
+      break;
+    }
+    timeline->srch++;
+    struct pollfd pfd = {discovery.socket, POLLIN, 0};
+    if (poll(&pfd, 1, REPLY_TIMEOUT_MS / 3) <= 0)
+      continue;
+    char buf[512];
+    char addr_buf[64];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t n = recvfrom(discovery.socket, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&from, &from_len);
+    if (n <= 0)
+      continue;
+    buf[n] = '\0';
+    ChiakiDiscoveryHost host;
+    if (chiaki_discovery_srch_response_parse(&host, (struct sockaddr *)&from, addr_buf, sizeof(addr_buf), buf,
+                                             (size_t)n) != CHIAKI_ERR_SUCCESS ||
+        host.host_request_port != console->session_port)
+      continue;
+    snprintf(system_version, system_version_size, "%s", host.system_version ? host.system_version : "");
+    err = CHIAKI_ERR_SUCCESS;
+  }
+  chiaki_discovery_fini(&discovery);
+  return err;
+}
+
+/* One session request. On a mismatch *server_target is set to the console's RP version. */
+static ChiakiErrorCode request_once(const ConsoleAddr *console, ChiakiTarget target, ChiakiTarget *server_target) {
+  struct sockaddr_in to;
+  if (!sockaddr_of(console->addr, console->session_port, &to))
+    return CHIAKI_ERR_PARSE_ADDR;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return CHIAKI_ERR_NETWORK;
+  ChiakiErrorCode err = CHIAKI_ERR_NETWORK;
+  if (connect(fd, (struct sockaddr *)&to, sizeof(to)) < 0) {
+    if (errno == ECONNREFUSED)
+      err = CHIAKI_ERR_CONNECTION_REFUSED;
+    goto out;
+  }
+  char request[256];
+  int len = snprintf(request, sizeof(request),
+                     "GET /sie/ps4/rp/sess/init HTTP/1.1\r\n"
+                     "Host: %s:9295\r\n"
+                     "RP-Version: %s\r\n"
+                     "\r\n",
+                     console->addr, chiaki_rp_version_string(target));
+  if (send(fd, request, (size_t)len, MSG_NOSIGNAL) != (ssize_t)len)
+    goto out;
+  char response[512];
+  struct pollfd pfd = {fd, POLLIN, 0};
+  ssize_t n = poll(&pfd, 1, REPLY_TIMEOUT_MS) > 0 ? recv(fd, response, sizeof(response) - 1, 0) : -1;
+  if (n <= 0)
+    goto out;
+  response[n] = '\0';
+  if (strncmp(response, "HTTP/1.1 200", 12) == 0) {
+    err = CHIAKI_ERR_SUCCESS;
+    goto out;
+  }
+  err = CHIAKI_ERR_HTTP_NONOK;
+  const char *v = strcasestr(response, "\nRP-Version:");
+  if (v && strstr(response, "80108b11")) {
+    char version[16];
+    if (sscanf(v + strlen("\nRP-Version:"), " %15[^\r\n]", version) == 1) {
+      *server_target = chiaki_rp_version_parse(version, false);
+      err = CHIAKI_ERR_VERSION_MISMATCH;
+    }
+  }
+
+out:
+  close(fd);
+  return err;
+}
+
+/* Session request with the version fallback of session.c. Sets *target to the accepted one. */
+static ChiakiErrorCode request_session(const ConsoleAddr *console, ChiakiTarget *target,
+                                       ReconnectTimeline *timeline) {
+  ChiakiTarget server_target = CHIAKI_TARGET_PS4_UNKNOWN;
+  timeline->requests++;
+  ChiakiErrorCode err = request_once(console, *target, &server_target);
+  if (err == CHIAKI_ERR_VERSION_MISMATCH && !chiaki_target_is_unknown(server_target)) {
+    *target = server_target;
+    timeline->requests++;
+    err = request_once(console, *target, &server_target);
+  }
+  return err;
+}
+
+/* Senkusha stand-in: sequential pings, returns the mean RTT. */
+static ChiakiErrorCode measure_link(const ConsoleAddr *console, uint64_t *rtt_us, ReconnectTimeline *timeline) {
+  struct sockaddr_in to;
+  if (!sockaddr_of(console->addr, console->discovery_port, &to))
+    return CHIAKI_ERR_PARSE_ADDR;
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+    return CHIAKI_ERR_NETWORK;
+  ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+  uint64_t sum_us = 0;
+  for (unsigned i = 0; i < SENKUSHA_ROUND_TRIPS; i++) {
+    char ping[32], pong[32];
+    int len = snprintf(ping, sizeof(ping), "PING %u", i);
+    uint64_t sent_us = chiaki_time_now_monotonic_us();
+    timeline->pings++;
+    if (sendto(fd, ping, (size_t)len, 0, (struct sockaddr *)&to, sizeof(to)) != len) {
+      err = CHIAKI_ERR_NETWORK;
+      break;
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    ssize_t n = poll(&pfd, 1, REPLY_TIMEOUT_MS) > 0 ? recv(fd, pong, sizeof(pong), 0) : -1;
+    if (n != len || strncmp(pong, "PONG ", 5) || memcmp(pong + 5, ping + 5, (size_t)len - 5)) {
+      err = CHIAKI_ERR_TIMEOUT;
+      break;
+    }
+    sum_us += chiaki_time_now_monotonic_us() - sent_us;
+  }
+  close(fd);
+  *rtt_us = sum_us / SENKUSHA_ROUND_TRIPS;
+  if (!*rtt_us)
+    *rtt_us = 1;
+  return err;
+}
+
+/*
+ * Connect to the console, discovered at discovery_console unless the store has a hot profile.
+ * Records the profile on success, reports a mismatch if a hot connect failed.
+ */
+static ChiakiErrorCode reconnect(ChiakiLog *log, ChiakiConnProfileStore *store, const ConsoleAddr *discovery_console,
+                                 ReconnectTimeline *timeline) {
+  memset(timeline, 0, sizeof(*timeline));
+  uint64_t start_ms = chiaki_time_now_monotonic_ms();
+
+  ChiakiConnProfile hot;
+  uint32_t valid = store ? chiaki_conn_profile_store_lookup(store, CONSOLE_KEY, NULL, NULL, &hot) : 0;
+  ChiakiConnectInfo info;
+  memset(&info, 0, sizeof(info));
+  ConsoleAddr console = *discovery_console;
+  char addr_buf[64];
+  char system_version[CHIAKI_CONN_PROFILE_VERSION_SIZE] = "";
+  if ((valid & CHIAKI_CONN_PROFILE_PART_ADDR) && console_addr_parse(hot.addr, &console, addr_buf, sizeof(addr_buf))) {
+    timeline->applied = CHIAKI_CONN_PROFILE_PART_ADDR | chiaki_conn_profile_apply(&hot, &info);
+  } else {
+    ChiakiErrorCode err = discover(log, &console, system_version, sizeof(system_version), timeline);
+    if (err != CHIAKI_ERR_SUCCESS)
+      return err;
+  }
+  uint64_t discovered_ms = chiaki_time_now_monotonic_ms();
+  timeline->discovery_ms = discovered_ms - start_ms;
+
+  ChiakiTarget target = chiaki_target_is_unknown(info.target_hint) ? DEFAULT_TARGET : info.target_hint;
+  ChiakiErrorCode err = request_session(&console, &target, timeline);
+  uint64_t requested_ms = chiaki_time_now_monotonic_ms();
+  timeline->request_ms = requested_ms - discovered_ms;
+  if (err != CHIAKI_ERR_SUCCESS) {
+    if (timeline->applied)
+      chiaki_conn_profile_store_mismatch(store, CONSOLE_KEY, timeline->applied);
+    return err;
+  }
+
+  ChiakiConnProfile profile;
+  memset(&profile, 0, sizeof(profile));
+  snprintf(profile.key, sizeof(profile.key), "%s", CONSOLE_KEY);
+  snprintf(profile.system_version, sizeof(profile.system_version), "%s", system_version);
+  console_addr_format(&console, profile.addr, sizeof(profile.addr));
+  profile.target = target;
+  profile.parts = CHIAKI_CONN_PROFILE_PART_ADDR | CHIAKI_CONN_PROFILE_PART_TARGET;
+  if (!info.mtu_in_hint) {
+    err = measure_link(&console, &profile.rtt_us, timeline);
+    if (err != CHIAKI_ERR_SUCCESS)
+      return err;
+    profile.mtu_in = profile.mtu_out = 1454;
+    profile.parts |= CHIAKI_CONN_PROFILE_PART_LINK;
+  }
+  timeline->link_ms = chiaki_time_now_monotonic_ms() - requested_ms;
+  timeline->total_ms = chiaki_time_now_monotonic_ms() - start_ms;
+  if (store)
+    chiaki_conn_profile_store_record(store, &profile);
+  return CHIAKI_ERR_SUCCESS;
+}
+
+static WakeStandin *console_new(const char *bind_addr, const char *system_version, ChiakiTarget target,
+                                uint16_t discovery_port, uint16_t session_port, double rtt_ms, ConsoleAddr *console) {
+  WakeStandinConfig config;
+  wake_standin_config_defaults(&config);
+  config.bind_addr = bind_addr;
+  config.discovery_port = discovery_port;
+  config.session_port = session_port;
+  config.ps5 = false;
+  config.awake = true;
+  config.system_version = system_version;
+  config.rp_version = chiaki_rp_version_string(target);
+  config.reply_delay_us = (uint32_t)(rtt_ms * 1000.0);
+  WakeStandin *standin = wake_standin_new(&config);
+  if (!standin) {
+    fprintf(stderr, "failed to start the stand-in console on %s\n", bind_addr);
+    return NULL;
+  }
+  console->addr = bind_addr;
+  console->discovery_port = wake_standin_discovery_port(standin);
+  console->session_port = wake_standin_session_port(standin);
+  return standin;
+}
+
+static ChiakiConnProfileStore *store_new(void) {
+  ChiakiConnProfileStoreConfig config;
+  chiaki_conn_profile_store_config_defaults(&config);
+  ChiakiConnProfileStore *store = chiaki_conn_profile_store_new(&config);
+  if (!store)
+    fprintf(stderr, "failed to create the profile store\n");
+  return store;
+}
+
+#define CHECK(cond)                                                               \
+  do {                                                                            \
+    if (!(cond)) {                                                                \
+      fprintf(stderr, "reconnect check failed: %s (line %d)\n", #cond, __LINE__); \
+      ok = false;                                                                 \
+      goto out;                                                                   \
+    }                                                                             \
+  } while (0)
+
+static bool check_hot(ChiakiLog *log) {
+  bool ok = true;
+  ConsoleAddr console;
+  ReconnectTimeline t;
+  WakeStandinStats s;
+  ChiakiConnProfileStore *store = store_new();
+  WakeStandin *standin = console_new("127.0.0.1", CONSOLE_SYSTEM_VERSION, CONSOLE_TARGET, 0, 0, 0, &console);
+  CHECK(store && standin);
+
+  CHECK(reconnect(log, store, &console, &t) == CHIAKI_ERR_SUCCESS);
+  CHECK(t.srch == 1 && t.requests == 2 && t.pings == SENKUSHA_ROUND_TRIPS && !t.applied);
+  CHECK(reconnect(log, store, &console, &t) == CHIAKI_ERR_SUCCESS);
+  CHECK(t.srch == 0 && t.requests == 1 && t.pings == 0);
+  CHECK(t.applied == (CHIAKI_CONN_PROFILE_PART_ADDR | CHIAKI_CONN_PROFILE_PART_TARGET | CHIAKI_CONN_PROFILE_PART_LINK));
+  wake_standin_stats(standin, &s);
+  CHECK(s.session_requests == 2 && s.session_mismatches == 1);
+
+out:
+  wake_standin_free(standin);
+  chiaki_conn_profile_store_free(store);
+  printf("CHECK reconnect hot=%s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static bool check_firmware(ChiakiLog *log) {
+  bool ok = true;
+  ConsoleAddr console;
+  ReconnectTimeline t;
+  WakeStandinStats s;
+  ChiakiConnProfile profile;
+  ChiakiConnProfileStore *store = store_new();
+  WakeStandin *standin = console_new("127.0.0.1", CONSOLE_SYSTEM_VERSION, CONSOLE_TARGET, 0, 0, 0, &console);
+  CHECK(store && standin);
+  CHECK(reconnect(log, store, &console, &t) == CHIAKI_ERR_SUCCESS);
+
+  /* updated and back on the same ports */
+  wake_standin_free(standin);
+  standin = console_new("127.0.0.1", UPDATED_SYSTEM_VERSION, UPDATED_TARGET, console.discovery_port,
+                        console.session_port, 0, &console);
+  CHECK(standin);
+  CHECK(reconnect(log, store, &console, &t) == CHIAKI_ERR_SUCCESS);
+  CHECK(t.requests == 2 && (t.applied & CHIAKI_CONN_PROFILE_PART_TARGET));
+  CHECK(chiaki_conn_profile_store_lookup(store, CONSOLE_KEY, NULL, NULL, &profile) &&
+        profile.target == UPDATED_TARGET);
+  CHECK(reconnect(log, store, &console, &t) == CHIAKI_ERR_SUCCESS);
+  CHECK(t.requests == 1);
+  wake_standin_stats(standin, &s);
+  CHECK(s.session_mismatches == 1 && s.session_requests == 2);
+
+out:
+  wake_standin_free(standin);
+  chiaki_conn_profile_store_free(store);
+  printf("CHECK reconnect firmware=%s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static bool check_moved(ChiakiLog *log) {
+  bool ok = true;
+  ConsoleAddr console, moved;
+  ReconnectTimeline t;
+  ChiakiConnProfile profile;
+  ChiakiConnProfileStoreStats stats;
+  ChiakiConnProfileStore *store = store_new();
+  WakeStandin *standin = console_new("127.0.0.1", CONSOLE_SYSTEM_VERSION, CONSOLE_TARGET, 0, 0, 0, &console);
+  CHECK(store && standin);
+  CHECK(reconnect(log, store, &console, &t) == CHIAKI_ERR_SUCCESS);
+
+  wake_standin_free(standin);
+  standin = console_new("127.0.0.2", CONSOLE_SYSTEM_VERSION, CONSOLE_TARGET, 0, 0, 0, &moved);
+  CHECK(standin);
+  CHECK(reconnect(log, store, &moved, &t) == CHIAKI_ERR_CONNECTION_REFUSED);
+  CHECK(t.applied & CHIAKI_CONN_PROFILE_PART_ADDR);
+  chiaki_conn_profile_store_stats(store, &stats);
+  CHECK(stats.mismatches == 1);
+
+  /* the address is dropped, so the next connect discovers the console again */
+  CHECK(reconnect(log, store, &moved, &t) == CHIAKI_ERR_SUCCESS);
+  CHECK(t.srch == 1 && !(t.applied & CHIAKI_CONN_PROFILE_PART_ADDR));
+  CHECK(chiaki_conn_profile_store_lookup(store, CONSOLE_KEY, NULL, NULL, &profile) & CHIAKI_CONN_PROFILE_PART_LINK);
+  CHECK(!strncmp(profile.addr, "127.0.0.2:", 10) && profile.failures == 0);
+  CHECK(reconnect(log, store, &moved, &t) == CHIAKI_ERR_SUCCESS);
+  CHECK(t.srch == 0 && t.requests == 1 && t.pings == 0);
+
+out:
+  wake_standin_free(standin);
+  chiaki_conn_profile_store_free(store);
+  printf("CHECK reconnect moved=%s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+#undef CHECK
+
+static bool bench_mode(bool hot, unsigned runs, double rtt_ms, ChiakiLog *log) {
+  ConsoleAddr console;
+  WakeStandin *standin = console_new("127.0.0.1", CONSOLE_SYSTEM_VERSION, CONSOLE_TARGET, 0, 0, rtt_ms, &console);
+  ChiakiConnProfileStore *store = hot ? store_new() : NULL;
+  bool ok = standin && (!hot || store);
+  ReconnectTimeline t, sum;
+  memset(&sum, 0, sizeof(sum));
+  /* the first connect of the hot mode fills the store and is not counted */
+  if (ok && hot && reconnect(log, store, &console, &t) != CHIAKI_ERR_SUCCESS)
+    ok = false;
+  for (unsigned r = 0; ok && r < runs; r++) {
+    ChiakiErrorCode err = reconnect(log, store, &console, &t);
+    if (err != CHIAKI_ERR_SUCCESS) {
+      fprintf(stderr, "reconnect failed: %s\n", chiaki_error_string(err));
+      ok = false;
+      break;
+    }
+    sum.discovery_ms += t.discovery_ms;
+    sum.request_ms += t.request_ms;
+    sum.link_ms += t.link_ms;
+    sum.total_ms += t.total_ms;
+    sum.srch += t.srch;
+    sum.requests += t.requests;
+    sum.pings += t.pings;
+  }
+  if (ok)
+    printf("BENCH reconnect mode=%s runs=%u rtt_ms=%.1f discovery_ms=%.1f request_ms=%.1f link_ms=%.1f "
+           "total_ms=%.1f srch=%.1f requests=%.1f pings=%.1f\n",
+           hot ? "hot" : "cold", runs, rtt_ms, (double)sum.discovery_ms / runs, (double)sum.request_ms / runs,
+           (double)sum.link_ms / runs, (double)sum.total_ms / runs, (double)sum.srch / runs,
+           (double)sum.requests / runs, (double)sum.pings / runs);
+  wake_standin_free(standin);
+  chiaki_conn_profile_store_free(store);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned runs = 8;
+  double rtt_ms = 2.0;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--verbose") == 0) {
+      verbose = true;
+      continue;
+    }
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    if (strcmp(arg, "--runs") == 0)
+      runs = (unsigned)atoi(val);
+    else if (strcmp(arg, "--rtt") == 0)
+      rtt_ms = atof(val);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+  if (!runs || rtt_ms < 0.0) {
+    fprintf(stderr, "invalid options\n");
+    return 2;
+  }
+
+  ChiakiLog log;
+  chiaki_log_init(&log, verbose ? CHIAKI_LOG_ALL : CHIAKI_LOG_ERROR, chiaki_log_cb_print, NULL);
+
+  bool ok = check_hot(&log);
+  ok = check_firmware(&log) && ok;
+  ok = check_moved(&log) && ok;
+
+  for (int hot = 0; hot <= 1; hot++) {
+    if (!bench_mode(hot, runs, rtt_ms, &log)) {
+      fprintf(stderr, "bench mode %s failed\n", hot ? "hot" : "cold");
+      ok = false;
+    }
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+/*
+ * Stand-in PlayStation host for loopback benchmarks (Linux only).
+ *
+ * Implements just enough of the console side of Remote Play for chiaki-lib to
+ * connect and stream: the session request and ctrl connection over HTTP on
+ * TCP 9295, the Takion handshake on UDP 9296, BANG with ECDH and STREAMINFO,
+ * and an AV sender that packetizes a prerecorded H.264 Annex-B and Opus
+ * stream into FEC-protected, gkcrypt encrypted Takion AV packets. Outgoing
+ * packets pass through a netsim impairment (test/netsim) that can add loss,
+ * delay, jitter, duplication, reordering and a bandwidth cap. Senkusha (UDP 9297) is not served: chiaki-lib only
+ * runs it when built with ENABLE_SENKUSHA.
+ *
+ * This is test tooling. It does not try to reproduce console behaviour beyond
+ * what the client needs, and it serves one client at a time.
+ */
+
+#include <chiaki/log.h>
+
+#include "../netsim/netsim.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define STANDIN_AUTH_SIZE 0x10
+
+typedef struct {
+  const char *bind_addr; /* default 127.0.0.1 */
+  bool ps5;                              /* server type reported in the ctrl response */
+  uint8_t morning[STANDIN_AUTH_SIZE];    /* must match the client's ChiakiConnectInfo.morning */
+
+  const char *video_path; /* H.264 Annex-B elementary stream, NULL for synthetic */
+  const char *audio_path; /* be16-length-prefixed Opus packets, NULL for synthetic */
+  bool loop;              /* restart media at EOF instead of disconnecting */
+  unsigned width;
+  unsigned height;
+  unsigned fps;
+  unsigned unit_size;    /* video FEC unit size in bytes */
+  double fec_ratio;      /* FEC units per source unit */
+  unsigned audio_fec;    /* previous audio frames repeated in each packet, 0..15 */
+  unsigned synth_kbps;   /* bitrate of the synthetic video stream */
+  unsigned synth_gop;    /* frames between synthetic IDRs */
+
+  NetsimParams shape;               /* impairment of host -> client datagrams */
+  const NetsimScenario *scenario;   /* overrides shape and seed when set */
+  uint64_t seed;
+  ChiakiLog *log;
+} StandinConfig;
+
+typedef struct {
+  uint64_t sessions;
+  uint64_t ctrl_connections;
+  uint64_t stream_connections;
+  uint64_t video_frames;
+  uint64_t video_packets;
+  uint64_t audio_packets;
+  uint64_t bytes_sent;
+  uint64_t shaped_dropped;
+  uint64_t idr_requests;
+  uint64_t data_messages_in;
+  uint64_t mac_errors;
+  uint64_t heartbeats_in;
+} StandinStats;
+
+typedef struct standin_host_t StandinHost;
+
+void standin_config_defaults(StandinConfig *config);
+
+/* Loads media and binds all sockets. Returns NULL on failure. */
+StandinHost *standin_host_new(const StandinConfig *config);
+bool standin_host_start(StandinHost *host);
+void standin_host_stop(StandinHost *host);
+void standin_host_free(StandinHost *host);
+
+void standin_host_stats(StandinHost *host, StandinStats *stats);
+/* True while a stream connection is up and AV is being sent. */
+bool standin_host_streaming(StandinHost *host);
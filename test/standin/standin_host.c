@@ -0,0 +1,860 @@
+/*
+ * standin_host.c — Session, ctrl and stream logic of the stand-in host.
+ *
+ * Two threads: the TCP thread answers session requests and keeps the ctrl
+ * connection alive, the UDP thread owns the stream Takion, handles BIG,
+ * sends BANG and STREAMINFO and then paces video and audio out through the
+ * netsim shim. Everything the UDP thread touches is private to it; counters are
+ * published to StandinStats under stats_mutex once per loop iteration.
+ */
+
+#define _GNU_SOURCE
+
+#include "standin_priv.h"
+
+#include <chiaki/audio.h>
+#include <chiaki/base64.h>
+#include <chiaki/ecdh.h>
+#include <chiaki/fec.h>
+#include <chiaki/random.h>
+#include <chiaki/rpcrypt.h>
+#include <chiaki/session.h>
+#include <chiaki/time.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <takion.pb.h>
+#include <pb_decode.h>
+#include <pb_encode.h>
+
+#include "pb_utils.h"
+
+#define CTRL_MESSAGE_TYPE_SESSION_ID 0x33
+#define CTRL_MESSAGE_TYPE_HEARTBEAT_REQ 0xfe
+#define CTRL_HEARTBEAT_INTERVAL_US 5000000
+#define HTTP_REQUEST_TIMEOUT_MS 2000
+
+#define AV_PACKET_TYPE_VIDEO 2
+#define AV_PACKET_TYPE_AUDIO 3
+#define AV_FLAG_NALU_INFO_STRUCTS 0x10
+#define AV_VIDEO_HEADER_SIZE 0x18 /* with nalu info structs */
+#define AV_AUDIO_CODEC_OPUS 5
+#define AUDIO_PACKET_INTERVAL_US 10000
+#define VIDEO_UNITS_MAX 256 /* UNIT_SLOTS_MAX in frameprocessor.c */
+
+#define UDP_POLL_MAX_US 100000
+
+struct standin_host_t {
+  StandinConfig config;
+  StandinMedia media;
+  NetsimUdp netsim;
+  size_t scenario_phase;
+  uint64_t scenario_start_us;
+  StandinTakion stream;
+  int listen_fd;
+  int ctrl_fd;
+  int stop_pipe[2];
+  pthread_t tcp_thread;
+  pthread_t udp_thread;
+  bool threads_running;
+
+  /* Written by the TCP thread on session request, read by the UDP thread
+   * to decrypt the LaunchSpec. */
+  pthread_mutex_t session_mutex;
+  ChiakiTarget target;
+  ChiakiRPCrypt rpcrypt;
+  bool rpcrypt_valid;
+
+  /* TCP thread only */
+  uint64_t ctrl_counter;
+  uint64_t ctrl_heartbeat_us;
+
+  /* UDP thread only */
+  ChiakiECDH ecdh;
+  bool ecdh_valid;
+  bool v12;
+  bool streaming;
+  uint64_t next_video_us;
+  uint64_t next_audio_us;
+  size_t video_cursor;
+  size_t audio_cursor;
+  uint16_t video_frame_index;
+  uint16_t video_packet_index;
+  uint16_t audio_frame_index;
+  uint16_t audio_packet_index;
+  uint8_t *fec_buf;
+  size_t fec_stride;
+  uint64_t video_frames;
+  uint64_t video_packets;
+  uint64_t audio_packets;
+  uint64_t idr_requests;
+  uint64_t heartbeats_in;
+  uint64_t stream_connections;
+
+  pthread_mutex_t stats_mutex;
+  StandinStats stats;
+  bool stats_streaming;
+};
+
+void standin_config_defaults(StandinConfig *config) {
+  memset(config, 0, sizeof(*config));
+  config->bind_addr = "127.0.0.1";
+  config->ps5 = true;
+  config->loop = true;
+  config->width = 1280;
+  config->height = 720;
+  config->fps = 60;
+  config->unit_size = 1184;
+  config->fec_ratio = 0.2;
+  config->audio_fec = 2;
+  config->synth_kbps = 10000;
+  config->synth_gop = 120;
+  config->seed = 1;
+}
+
+/* ---- helpers ------------------------------------------------------------- */
+
+static void put_be16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+static bool write_all(int fd, const void *buf, size_t size) {
+  const uint8_t *p = buf;
+  while (size) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= (size_t)n;
+  }
+  return true;
+}
+
+/* ---- session request and ctrl (TCP thread) ------------------------------- */
+
+static bool read_http_request(int fd, char *buf, size_t buf_size) {
+  size_t size = 0;
+  while (size + 1 < buf_size) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, HTTP_REQUEST_TIMEOUT_MS) <= 0)
+      return false;
+    ssize_t n = recv(fd, buf + size, buf_size - 1 - size, 0);
+    if (n <= 0)
+      return false;
+    size += (size_t)n;
+    buf[size] = '\0';
+    if (strstr(buf, "\r\n\r\n"))
+      return true;
+  }
+  return false;
+}
+
+static bool http_header_value(const char *request, const char *key, char *out, size_t out_size) {
+  size_t key_len = strlen(key);
+  for (const char *line = strstr(request, "\r\n"); line; line = strstr(line, "\r\n")) {
+    line += 2;
+    if (strncasecmp(line, key, key_len) || line[key_len] != ':')
+      continue;
+    const char *v = line + key_len + 1;
+    while (*v == ' ')
+      v++;
+    size_t len = strcspn(v, "\r\n");
+    if (len >= out_size)
+      return false;
+    memcpy(out, v, len);
+    out[len] = '\0';
+    return true;
+  }
+  return false;
+}
+
+static void host_handle_session_request(StandinHost *host, int fd, const char *request) {
+  char rp_version[32] = "";
+  http_header_value(request, "RP-Version", rp_version, sizeof(rp_version));
+  ChiakiTarget target = chiaki_rp_version_parse(rp_version, host->config.ps5);
+  if (chiaki_target_is_unknown(target))
+    target = host->config.ps5 ? CHIAKI_TARGET_PS5_1 : CHIAKI_TARGET_PS4_10;
+
+  uint8_t nonce[CHIAKI_RPCRYPT_KEY_SIZE];
+  char nonce_b64[32];
+  chiaki_random_bytes_crypt(nonce, sizeof(nonce));
+  chiaki_base64_encode(nonce, sizeof(nonce), nonce_b64, sizeof(nonce_b64));
+
+  pthread_mutex_lock(&host->session_mutex);
+  host->target = target;
+  chiaki_rpcrypt_init_auth(&host->rpcrypt, target, nonce, host->config.morning);
+  host->rpcrypt_valid = true;
+  pthread_mutex_unlock(&host->session_mutex);
+
+  char response[256];
+  int len = snprintf(response, sizeof(response),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Length: 0\r\n"
+                     "RP-Version: %s\r\n"
+                     "RP-Nonce: %s\r\n"
+                     "\r\n",
+                     chiaki_rp_version_string(target), nonce_b64);
+  write_all(fd, response, (size_t)len);
+
+  pthread_mutex_lock(&host->stats_mutex);
+  host->stats.sessions++;
+  pthread_mutex_unlock(&host->stats_mutex);
+  CHIAKI_LOGI(host->config.log, "Stand-in answered session request (%s)", chiaki_rp_version_string(target));
+}
+
+static bool ctrl_send(StandinHost *host, uint16_t type, const uint8_t *payload, size_t size) {
+  uint8_t buf[8 + 64];
+  if (size > sizeof(buf) - 8)
+    return false;
+  put_be32(buf, (uint32_t)size);
+  put_be16(buf + 4, type);
+  put_be16(buf + 6, 0);
+  if (size) {
+    pthread_mutex_lock(&host->session_mutex);
+    chiaki_rpcrypt_encrypt(&host->rpcrypt, host->ctrl_counter++, payload, buf + 8, size);
+    pthread_mutex_unlock(&host->session_mutex);
+  }
+  return write_all(host->ctrl_fd, buf, 8 + size);
+}
+
+static void host_handle_ctrl_request(StandinHost *host, int fd) {
+  pthread_mutex_lock(&host->session_mutex);
+  bool ok = host->rpcrypt_valid;
+  uint8_t server_type[0x10] = {host->config.ps5 ? 2 : 0};
+  if (ok)
+    chiaki_rpcrypt_encrypt(&host->rpcrypt, 0, server_type, server_type, sizeof(server_type));
+  pthread_mutex_unlock(&host->session_mutex);
+  if (!ok) {
+    static const char forbidden[] = "HTTP/1.1 403 Forbidden\r\nContent-Length: 0\r\n\r\n";
+    write_all(fd, forbidden, sizeof(forbidden) - 1);
+    close(fd);
+    return;
+  }
+
+  char server_type_b64[32];
+  chiaki_base64_encode(server_type, sizeof(server_type), server_type_b64, sizeof(server_type_b64));
+  char response[256];
+  int len = snprintf(response, sizeof(response),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Length: 0\r\n"
+                     "RP-Server-Type: %s\r\n"
+                     "\r\n",
+                     server_type_b64);
+  if (host->ctrl_fd >= 0)
+    close(host->ctrl_fd);
+  host->ctrl_fd = fd;
+  host->ctrl_counter = 1;
+  host->ctrl_heartbeat_us = chiaki_time_now_monotonic_us() + CTRL_HEARTBEAT_INTERVAL_US;
+
+  static const char alnum[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  uint8_t session_id[1 + 32];
+  session_id[0] = 0x4a;
+  for (size_t i = 1; i < sizeof(session_id); i++)
+    session_id[i] = (uint8_t)alnum[chiaki_random_32() % (sizeof(alnum) - 1)];
+
+  if (!write_all(fd, response, (size_t)len) ||
+      !ctrl_send(host, CTRL_MESSAGE_TYPE_SESSION_ID, session_id, sizeof(session_id))) {
+    close(fd);
+    host->ctrl_fd = -1;
+    return;
+  }
+
+  pthread_mutex_lock(&host->stats_mutex);
+  host->stats.ctrl_connections++;
+  pthread_mutex_unlock(&host->stats_mutex);
+  CHIAKI_LOGI(host->config.log, "Stand-in ctrl connected");
+}
+
+static void host_accept(StandinHost *host) {
+  int fd = accept(host->listen_fd, NULL, NULL);
+  if (fd < 0)
+    return;
+  char request[2048];
+  if (!read_http_request(fd, request, sizeof(request))) {
+    close(fd);
+    return;
+  }
+  if (strncmp(request, "GET ", 4) != 0) {
+    close(fd);
+    return;
+  }
+  const char *path_end = strchr(request + 4, ' ');
+  size_t path_len = path_end ? (size_t)(path_end - (request + 4)) : 0;
+  if (path_len >= 5 && !strncmp(request + 4 + path_len - 5, "/ctrl", 5)) {
+    host_handle_ctrl_request(host, fd);
+    return;
+  }
+  if ((path_len >= 5 && !strncmp(request + 4 + path_len - 5, "/init", 5)) ||
+      (path_len >= 8 && !strncmp(request + 4 + path_len - 8, "/session", 8))) {
+    host_handle_session_request(host, fd, request);
+  } else {
+    static const char not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    write_all(fd, not_found, sizeof(not_found) - 1);
+  }
+  close(fd);
+}
+
+static void *host_tcp_thread(void *user) {
+  StandinHost *host = user;
+  for (;;) {
+    struct pollfd pfds[3] = {
+        {host->stop_pipe[0], POLLIN, 0},
+        {host->listen_fd, POLLIN, 0},
+        {host->ctrl_fd, POLLIN, 0},
+    };
+    nfds_t nfds = host->ctrl_fd >= 0 ? 3 : 2;
+    int timeout_ms = 1000;
+    if (host->ctrl_fd >= 0) {
+      uint64_t now = chiaki_time_now_monotonic_us();
+      timeout_ms = host->ctrl_heartbeat_us > now ? (int)((host->ctrl_heartbeat_us - now) / 1000) + 1 : 0;
+    }
+    if (poll(pfds, nfds, timeout_ms) < 0 && errno != EINTR)
+      break;
+    if (pfds[0].revents)
+      break;
+    if (pfds[1].revents & POLLIN)
+      host_accept(host);
+    if (host->ctrl_fd >= 0 && pfds[2].revents) {
+      /* Client ctrl messages (features, heartbeat replies) are not needed. */
+      uint8_t discard[1024];
+      if (recv(host->ctrl_fd, discard, sizeof(discard), MSG_DONTWAIT) <= 0) {
+        CHIAKI_LOGI(host->config.log, "Stand-in ctrl disconnected");
+        close(host->ctrl_fd);
+        host->ctrl_fd = -1;
+      }
+    }
+    if (host->ctrl_fd >= 0 && chiaki_time_now_monotonic_us() >= host->ctrl_heartbeat_us) {
+      ctrl_send(host, CTRL_MESSAGE_TYPE_HEARTBEAT_REQ, NULL, 0);
+      host->ctrl_heartbeat_us += CTRL_HEARTBEAT_INTERVAL_US;
+    }
+  }
+  if (host->ctrl_fd >= 0)
+    close(host->ctrl_fd);
+  host->ctrl_fd = -1;
+  return NULL;
+}
+
+/* ---- stream connection (UDP thread) -------------------------------------- */
+
+static bool host_send_protobuf(StandinHost *host, uint64_t now_us, const tkproto_TakionMessage *msg) {
+  uint8_t buf[1400];
+  pb_ostream_t stream = pb_ostream_from_buffer(buf, sizeof(buf));
+  if (!pb_encode(&stream, tkproto_TakionMessage_fields, msg)) {
+    CHIAKI_LOGE(host->config.log, "Stand-in protobuf encoding failed");
+    return false;
+  }
+  return standin_takion_send_data(&host->stream, now_us, 1, CHIAKI_TAKION_MESSAGE_DATA_TYPE_PROTOBUF, buf,
+                                  stream.bytes_written);
+}
+
+static void host_stream_end(StandinHost *host) {
+  host->streaming = false;
+  if (host->ecdh_valid)
+    chiaki_ecdh_fini(&host->ecdh);
+  host->ecdh_valid = false;
+  standin_takion_reset(&host->stream);
+}
+
+static void host_send_disconnect(StandinHost *host, uint64_t now_us, const char *reason) {
+  tkproto_TakionMessage msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.type = tkproto_TakionMessage_PayloadType_DISCONNECT;
+  msg.has_disconnect_payload = true;
+  msg.disconnect_payload.reason.arg = (void *)reason;
+  msg.disconnect_payload.reason.funcs.encode = chiaki_pb_encode_string;
+  host_send_protobuf(host, now_us, &msg);
+  netsim_udp_flush(&host->netsim, UINT64_MAX);
+}
+
+/* LaunchSpec is base64 of the JSON (with its NUL) xor'ed with the rpcrypt key
+ * stream at counter 0. Only the handshake key is needed from it. */
+static bool host_launch_spec_handshake_key(StandinHost *host, const char *b64, size_t b64_size, uint8_t *key) {
+  uint8_t enc[2048], ks[2048];
+  size_t size = sizeof(enc);
+  if (chiaki_base64_decode(b64, b64_size, enc, &size) != CHIAKI_ERR_SUCCESS || !size)
+    return false;
+  memset(ks, 0, size);
+  pthread_mutex_lock(&host->session_mutex);
+  bool ok = host->rpcrypt_valid &&
+            chiaki_rpcrypt_encrypt(&host->rpcrypt, 0, ks, ks, size) == CHIAKI_ERR_SUCCESS;
+  host->v12 = chiaki_target_is_ps5(host->target);
+  pthread_mutex_unlock(&host->session_mutex);
+  if (!ok)
+    return false;
+  char json[2048];
+  for (size_t i = 0; i < size; i++)
+    json[i] = (char)(enc[i] ^ ks[i]);
+  json[size - 1] = '\0';
+
+  static const char tag[] = "\"handshakeKey\":\"";
+  const char *p = strstr(json, tag);
+  if (!p)
+    return false;
+  p += sizeof(tag) - 1;
+  size_t len = strcspn(p, "\"");
+  size_t key_size = CHIAKI_HANDSHAKE_KEY_SIZE;
+  return chiaki_base64_decode(p, len, key, &key_size) == CHIAKI_ERR_SUCCESS && key_size == CHIAKI_HANDSHAKE_KEY_SIZE;
+}
+
+static bool encode_resolution(pb_ostream_t *stream, const pb_field_t *field, void *const *arg) {
+  StandinHost *host = *arg;
+  ChiakiPBBuf header = {host->media.header_size, host->media.header};
+  tkproto_ResolutionPayload resolution;
+  memset(&resolution, 0, sizeof(resolution));
+  resolution.width = host->config.width;
+  resolution.height = host->config.height;
+  resolution.video_header.arg = &header;
+  resolution.video_header.funcs.encode = chiaki_pb_encode_buf;
+  if (!pb_encode_tag_for_field(stream, field))
+    return false;
+  return pb_encode_submessage(stream, tkproto_ResolutionPayload_fields, &resolution);
+}
+
+static void host_handle_big(StandinHost *host, uint64_t now_us, const uint8_t *buf, size_t size) {
+  char launch_spec[2048];
+  ChiakiPBDecodeBuf launch_spec_buf = {sizeof(launch_spec) - 1, 0, (uint8_t *)launch_spec};
+  uint8_t client_pub_key[128];
+  ChiakiPBDecodeBuf client_pub_key_buf = {sizeof(client_pub_key), 0, client_pub_key};
+  uint8_t client_sig[32];
+  ChiakiPBDecodeBuf client_sig_buf = {sizeof(client_sig), 0, client_sig};
+
+  tkproto_TakionMessage msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.big_payload.launch_spec.arg = &launch_spec_buf;
+  msg.big_payload.launch_spec.funcs.decode = chiaki_pb_decode_buf;
+  msg.big_payload.ecdh_pub_key.arg = &client_pub_key_buf;
+  msg.big_payload.ecdh_pub_key.funcs.decode = chiaki_pb_decode_buf;
+  msg.big_payload.ecdh_sig.arg = &client_sig_buf;
+  msg.big_payload.ecdh_sig.funcs.decode = chiaki_pb_decode_buf;
+  pb_istream_t stream = pb_istream_from_buffer(buf, size);
+  if (!pb_decode(&stream, tkproto_TakionMessage_fields, &msg) || !msg.has_big_payload) {
+    CHIAKI_LOGE(host->config.log, "Stand-in failed to decode BIG");
+    return;
+  }
+
+  uint8_t handshake_key[CHIAKI_HANDSHAKE_KEY_SIZE];
+  if (!host_launch_spec_handshake_key(host, launch_spec, launch_spec_buf.size, handshake_key)) {
+    CHIAKI_LOGE(host->config.log, "Stand-in failed to read the handshake key from the LaunchSpec");
+    return;
+  }
+
+  if (host->ecdh_valid)
+    chiaki_ecdh_fini(&host->ecdh);
+  host->ecdh_valid = chiaki_ecdh_init(&host->ecdh) == CHIAKI_ERR_SUCCESS;
+  uint8_t pub_key[128], sig[32], secret[CHIAKI_ECDH_SECRET_SIZE];
+  ChiakiPBBuf pub_key_buf = {sizeof(pub_key), pub_key};
+  ChiakiPBBuf sig_buf = {sizeof(sig), sig};
+  if (!host->ecdh_valid ||
+      chiaki_ecdh_get_local_pub_key(&host->ecdh, pub_key, &pub_key_buf.size, handshake_key, sig, &sig_buf.size) !=
+          CHIAKI_ERR_SUCCESS ||
+      chiaki_ecdh_derive_secret(&host->ecdh, secret, client_pub_key, client_pub_key_buf.size, handshake_key,
+                                client_sig, client_sig_buf.size) != CHIAKI_ERR_SUCCESS) {
+    CHIAKI_LOGE(host->config.log, "Stand-in ECDH failed");
+    return;
+  }
+
+  memset(&msg, 0, sizeof(msg));
+  msg.type = tkproto_TakionMessage_PayloadType_BANG;
+  msg.has_bang_payload = true;
+  msg.bang_payload.server_version = host->v12 ? 12 : 9;
+  msg.bang_payload.token = chiaki_random_32();
+  msg.bang_payload.encrypted_key_accepted = true;
+  msg.bang_payload.version_accepted = true;
+  msg.bang_payload.session_key.arg = "standin";
+  msg.bang_payload.session_key.funcs.encode = chiaki_pb_encode_string;
+  msg.bang_payload.ecdh_pub_key.arg = &pub_key_buf;
+  msg.bang_payload.ecdh_pub_key.funcs.encode = chiaki_pb_encode_buf;
+  msg.bang_payload.ecdh_sig.arg = &sig_buf;
+  msg.bang_payload.ecdh_sig.funcs.encode = chiaki_pb_encode_buf;
+  if (!host_send_protobuf(host, now_us, &msg))
+    return;
+
+  /* Our local key is the client's remote one and vice versa. */
+  ChiakiGKCrypt *local = chiaki_gkcrypt_new(host->config.log, 0, 3, handshake_key, secret);
+  ChiakiGKCrypt *remote = chiaki_gkcrypt_new(host->config.log, 0, 2, handshake_key, secret);
+  if (!local || !remote) {
+    chiaki_gkcrypt_free(local);
+    chiaki_gkcrypt_free(remote);
+    return;
+  }
+  standin_takion_set_crypt(&host->stream, local, remote);
+
+  uint8_t audio_header[CHIAKI_AUDIO_HEADER_SIZE];
+  ChiakiAudioHeader audio;
+  chiaki_audio_header_set(&audio, 2, 16, 48000, 480);
+  chiaki_audio_header_save(&audio, audio_header);
+  ChiakiPBBuf audio_header_buf = {sizeof(audio_header), audio_header};
+
+  memset(&msg, 0, sizeof(msg));
+  msg.type = tkproto_TakionMessage_PayloadType_STREAMINFO;
+  msg.has_stream_info_payload = true;
+  msg.stream_info_payload.resolution.arg = host;
+  msg.stream_info_payload.resolution.funcs.encode = encode_resolution;
+  msg.stream_info_payload.audio_header.arg = &audio_header_buf;
+  msg.stream_info_payload.audio_header.funcs.encode = chiaki_pb_encode_buf;
+  host_send_protobuf(host, now_us, &msg);
+  CHIAKI_LOGI(host->config.log, "Stand-in sent BANG and STREAMINFO");
+}
+
+static void host_start_av(StandinHost *host, uint64_t now_us) {
+  if (host->streaming)
+    return;
+  host->streaming = true;
+  host->stream_connections++;
+  host->next_video_us = now_us;
+  host->next_audio_us = now_us;
+  host->video_cursor = standin_media_next_idr(&host->media, 0);
+  host->audio_cursor = 0;
+  host->video_frame_index = 1;
+  host->audio_frame_index = 1;
+  host->video_packet_index = 0;
+  host->audio_packet_index = 0;
+  CHIAKI_LOGI(host->config.log, "Stand-in streaming");
+}
+
+static void host_takion_data(StandinTakion *takion, uint8_t data_type, const uint8_t *buf, size_t size, void *user) {
+  StandinHost *host = user;
+  if (data_type != CHIAKI_TAKION_MESSAGE_DATA_TYPE_PROTOBUF)
+    return;
+  uint64_t now_us = chiaki_time_now_monotonic_us();
+
+  tkproto_TakionMessage msg;
+  memset(&msg, 0, sizeof(msg));
+  pb_istream_t stream = pb_istream_from_buffer(buf, size);
+  if (!pb_decode(&stream, tkproto_TakionMessage_fields, &msg))
+    return;
+  switch (msg.type) {
+  case tkproto_TakionMessage_PayloadType_BIG:
+    host_handle_big(host, now_us, buf, size);
+    break;
+  case tkproto_TakionMessage_PayloadType_STREAMINFOACK:
+    host_start_av(host, now_us);
+    break;
+  case tkproto_TakionMessage_PayloadType_HEARTBEAT:
+    host->heartbeats_in++;
+    break;
+  case tkproto_TakionMessage_PayloadType_IDRREQUEST:
+    host->idr_requests++;
+    host->video_cursor = standin_media_next_idr(&host->media, host->video_cursor);
+    break;
+  case tkproto_TakionMessage_PayloadType_DISCONNECT:
+    CHIAKI_LOGI(host->config.log, "Stand-in client disconnected");
+    host_stream_end(host);
+    break;
+  default:
+    (void)takion;
+    break;
+  }
+}
+
+/* ---- AV ------------------------------------------------------------------ */
+
+static void av_header(uint8_t *packet, uint8_t type, uint16_t packet_index, uint16_t frame_index, uint32_t units,
+                      uint8_t codec) {
+  memset(packet, 0, AV_VIDEO_HEADER_SIZE);
+  packet[0] = type;
+  put_be16(packet + 1, packet_index);
+  put_be16(packet + 3, frame_index);
+  put_be32(packet + 5, units);
+  packet[9] = codec;
+}
+
+/*
+ * One frame becomes k source units of [be16 padding][payload] and m FEC
+ * units over the unit_size-padded source units, as the frame processor
+ * expects. Frames too large for the unit slots are skipped.
+ */
+static void host_send_video_frame(StandinHost *host, uint64_t now_us) {
+  const StandinFrame *frame = &host->media.frames[host->video_cursor];
+  size_t unit_size = host->config.unit_size;
+  size_t chunk = unit_size - 2;
+  size_t k = (frame->size + chunk - 1) / chunk;
+  size_t m = host->config.fec_ratio > 0.0 ? (size_t)(k * host->config.fec_ratio + 0.999) : 0;
+  if (host->config.fec_ratio > 0.0 && !m)
+    m = 1;
+  if (k + m > VIDEO_UNITS_MAX) {
+    CHIAKI_LOGW(host->config.log, "Stand-in skipping frame %zu of %zu bytes, too many units", host->video_cursor,
+                frame->size);
+    return;
+  }
+
+  for (size_t i = 0; i < k; i++) {
+    uint8_t *unit = host->fec_buf + i * host->fec_stride;
+    size_t part = frame->size - i * chunk < chunk ? frame->size - i * chunk : chunk;
+    memset(unit, 0, host->fec_stride);
+    put_be16(unit, (uint16_t)(unit_size - 2 - part));
+    memcpy(unit + 2, frame->data + i * chunk, part);
+  }
+  if (m && chiaki_fec_encode(host->fec_buf, unit_size, host->fec_stride, (unsigned)k, (unsigned)m) !=
+               CHIAKI_ERR_SUCCESS) {
+    CHIAKI_LOGE(host->config.log, "Stand-in FEC encoding failed");
+    return;
+  }
+
+  uint8_t packet[STANDIN_PACKET_MAX];
+  for (size_t i = 0; i < k + m; i++) {
+    const uint8_t *unit = host->fec_buf + i * host->fec_stride;
+    size_t unit_wire = unit_size;
+    if (i < k) {
+      size_t part = frame->size - i * chunk < chunk ? frame->size - i * chunk : chunk;
+      unit_wire = part + 2;
+    }
+    uint32_t units = ((uint32_t)i << 21) | ((uint32_t)(k + m - 1) << 10) | (uint32_t)m;
+    av_header(packet, AV_PACKET_TYPE_VIDEO | AV_FLAG_NALU_INFO_STRUCTS, host->video_packet_index++,
+              host->video_frame_index, units, 0);
+    memcpy(packet + AV_VIDEO_HEADER_SIZE, unit, unit_wire);
+    if (standin_takion_send_av(&host->stream, now_us, packet, AV_VIDEO_HEADER_SIZE + unit_wire, AV_VIDEO_HEADER_SIZE))
+      host->video_packets++;
+  }
+  host->video_frames++;
+}
+
+static void host_send_audio(StandinHost *host, uint64_t now_us) {
+  const StandinMedia *media = &host->media;
+  size_t unit_size = media->audio_unit_size;
+  unsigned fec = host->config.audio_fec;
+  size_t header_size = host->v12 ? 0x14 : 0x13;
+  uint8_t packet[STANDIN_PACKET_MAX];
+  if (header_size + unit_size * (1 + fec) > sizeof(packet))
+    return;
+
+  uint32_t fec16 = ((uint32_t)unit_size << 8) | (fec << 4) | 1;
+  av_header(packet, AV_PACKET_TYPE_AUDIO, host->audio_packet_index++, host->audio_frame_index, (fec << 16) | fec16,
+            AV_AUDIO_CODEC_OPUS);
+  /* v12 carries a haptics marker before the data; 0 is regular audio. */
+  uint8_t *data = packet + header_size;
+  memcpy(data, media->audio[host->audio_cursor], unit_size);
+  for (unsigned i = 0; i < fec; i++) {
+    size_t back = fec - i;
+    size_t idx = (host->audio_cursor + media->audio_count * (back / media->audio_count + 1) - back) %
+                 media->audio_count;
+    memcpy(data + unit_size * (1 + i), media->audio[idx], unit_size);
+  }
+  size_t size = header_size + unit_size * (1 + fec);
+  if (standin_takion_send_av(&host->stream, now_us, packet, size, header_size))
+    host->audio_packets++;
+  host->audio_frame_index++;
+}
+
+/* Returns false when non-looping media ran out. */
+static bool host_pump_av(StandinHost *host, uint64_t now_us) {
+  uint64_t frame_us = 1000000 / host->config.fps;
+  while (host->streaming && host->next_video_us <= now_us) {
+    host_send_video_frame(host, now_us);
+    host->video_frame_index++;
+    host->next_video_us += frame_us;
+    if (++host->video_cursor == host->media.frames_count) {
+      if (!host->config.loop)
+        return false;
+      host->video_cursor = 0;
+    }
+  }
+  while (host->streaming && host->next_audio_us <= now_us) {
+    host_send_audio(host, now_us);
+    host->next_audio_us += AUDIO_PACKET_INTERVAL_US;
+    if (++host->audio_cursor == host->media.audio_count)
+      host->audio_cursor = 0;
+  }
+  return true;
+}
+
+static void host_publish_stats(StandinHost *host) {
+  pthread_mutex_lock(&host->stats_mutex);
+  host->stats.stream_connections = host->stream_connections;
+  host->stats.video_frames = host->video_frames;
+  host->stats.video_packets = host->video_packets;
+  host->stats.audio_packets = host->audio_packets;
+  host->stats.bytes_sent = host->netsim.sim.stats.bytes_out;
+  host->stats.shaped_dropped = host->netsim.sim.stats.lost + host->netsim.sim.stats.queue_dropped;
+  host->stats.idr_requests = host->idr_requests;
+  host->stats.data_messages_in = host->stream.data_messages_in;
+  host->stats.mac_errors = host->stream.mac_errors;
+  host->stats.heartbeats_in = host->heartbeats_in;
+  host->stats_streaming = host->streaming;
+  pthread_mutex_unlock(&host->stats_mutex);
+}
+
+static void host_apply_scenario(StandinHost *host, uint64_t now_us) {
+  const NetsimScenario *scenario = host->config.scenario;
+  if (!scenario)
+    return;
+  if (!host->scenario_start_us)
+    host->scenario_start_us = now_us;
+  size_t phase = netsim_scenario_phase_at(scenario, now_us - host->scenario_start_us);
+  if (phase != host->scenario_phase) {
+    netsim_set_params(&host->netsim.sim, &scenario->phases[phase].params);
+    host->scenario_phase = phase;
+    CHIAKI_LOGI(host->config.log, "Stand-in scenario phase %zu", phase);
+  }
+}
+
+static void *host_udp_thread(void *user) {
+  StandinHost *host = user;
+  for (;;) {
+    uint64_t now_us = chiaki_time_now_monotonic_us();
+    standin_takion_poll_in(&host->stream, now_us);
+    if (host->streaming && !host_pump_av(host, now_us)) {
+      host_send_disconnect(host, now_us, "Server shutting down");
+      host_stream_end(host);
+    }
+    host_apply_scenario(host, now_us);
+    uint64_t next_us = netsim_udp_flush(&host->netsim, now_us);
+    if (host->streaming) {
+      if (host->next_video_us < next_us)
+        next_us = host->next_video_us;
+      if (host->next_audio_us < next_us)
+        next_us = host->next_audio_us;
+    }
+    host_publish_stats(host);
+
+    uint64_t wait_us = next_us > now_us ? next_us - now_us : 0;
+    if (wait_us > UDP_POLL_MAX_US)
+      wait_us = UDP_POLL_MAX_US;
+    struct timespec timeout = {(time_t)(wait_us / 1000000), (long)(wait_us % 1000000) * 1000};
+    struct pollfd pfds[2] = {{host->stop_pipe[0], POLLIN, 0}, {host->stream.fd, POLLIN, 0}};
+    if (ppoll(pfds, 2, &timeout, NULL) < 0 && errno != EINTR)
+      break;
+    if (pfds[0].revents)
+      break;
+  }
+  if (host->streaming)
+    host_send_disconnect(host, chiaki_time_now_monotonic_us(), "Server shutting down");
+  host_stream_end(host);
+  host_publish_stats(host);
+  return NULL;
+}
+
+/* ---- lifecycle ----------------------------------------------------------- */
+
+StandinHost *standin_host_new(const StandinConfig *config) {
+  StandinHost *host = calloc(1, sizeof(StandinHost));
+  if (!host)
+    return NULL;
+  host->config = *config;
+  if (!host->config.bind_addr)
+    host->config.bind_addr = "127.0.0.1";
+  if (!host->config.fps)
+    host->config.fps = 60;
+  /* jerasure works on whole words; keep units a multiple of 16 bytes */
+  host->config.unit_size &= ~(unsigned)0xf;
+  if (host->config.unit_size < 64 || host->config.unit_size + AV_VIDEO_HEADER_SIZE > STANDIN_PACKET_MAX)
+    host->config.unit_size = 1184;
+  if (host->config.audio_fec > 15)
+    host->config.audio_fec = 15;
+  host->listen_fd = -1;
+  host->ctrl_fd = -1;
+  host->stop_pipe[0] = host->stop_pipe[1] = -1;
+  host->stream.fd = -1;
+  pthread_mutex_init(&host->session_mutex, NULL);
+  pthread_mutex_init(&host->stats_mutex, NULL);
+
+  host->fec_stride = (host->config.unit_size + 0xf) & ~(size_t)0xf;
+  host->fec_buf = malloc(VIDEO_UNITS_MAX * host->fec_stride);
+  if (!host->fec_buf || !standin_media_load(&host->media, &host->config))
+    goto error;
+  const NetsimScenario *scenario = host->config.scenario;
+  if (scenario && !scenario->phases_count)
+    goto error;
+  if (!netsim_udp_init(&host->netsim, scenario ? &scenario->phases[0].params : &host->config.shape,
+                       scenario ? scenario->seed : host->config.seed, STANDIN_NETSIM_CAPACITY))
+    goto error;
+
+  StandinTakionCallbacks cb = {host_takion_data, NULL, host};
+  if (!standin_takion_init(&host->stream, host->config.bind_addr, STANDIN_STREAM_PORT, &host->netsim,
+                           host->config.log, &cb))
+    goto error;
+
+  host->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (host->listen_fd < 0)
+    goto error;
+  int one = 1;
+  setsockopt(host->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(STANDIN_SESSION_PORT);
+  if (inet_pton(AF_INET, host->config.bind_addr, &addr.sin_addr) != 1 ||
+      bind(host->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(host->listen_fd, 4) < 0) {
+    CHIAKI_LOGE(host->config.log, "Stand-in failed to listen on TCP %s:%u: %s", host->config.bind_addr,
+                (unsigned)STANDIN_SESSION_PORT, strerror(errno));
+    goto error;
+  }
+  if (pipe(host->stop_pipe) < 0)
+    goto error;
+  return host;
+
+error:
+  standin_host_free(host);
+  return NULL;
+}
+
+bool standin_host_start(StandinHost *host) {
+  if (host->threads_running)
+    return true;
+  if (pthread_create(&host->tcp_thread, NULL, host_tcp_thread, host) != 0)
+    return false;
+  if (pthread_create(&host->udp_thread, NULL, host_udp_thread, host) != 0) {
+    if (write(host->stop_pipe[1], "x", 1) < 0)
+      CHIAKI_LOGW(host->config.log, "Stand-in failed to signal stop");
+    pthread_join(host->tcp_thread, NULL);
+    return false;
+  }
+  host->threads_running = true;
+  return true;
+}
+
+void standin_host_stop(StandinHost *host) {
+  if (!host->threads_running)
+    return;
+  if (write(host->stop_pipe[1], "x", 1) < 0)
+    CHIAKI_LOGW(host->config.log, "Stand-in failed to signal stop");
+  pthread_join(host->tcp_thread, NULL);
+  pthread_join(host->udp_thread, NULL);
+  host->threads_running = false;
+}
+
+void standin_host_free(StandinHost *host) {
+  if (!host)
+    return;
+  standin_host_stop(host);
+  standin_takion_fini(&host->stream);
+  if (host->listen_fd >= 0)
+    close(host->listen_fd);
+  if (host->stop_pipe[0] >= 0) {
+    close(host->stop_pipe[0]);
+    close(host->stop_pipe[1]);
+  }
+  netsim_udp_fini(&host->netsim);
+  standin_media_fini(&host->media);
+  free(host->fec_buf);
+  pthread_mutex_destroy(&host->session_mutex);
+  pthread_mutex_destroy(&host->stats_mutex);
+  free(host);
+}
+
+void standin_host_stats(StandinHost *host, StandinStats *stats) {
+  pthread_mutex_lock(&host->stats_mutex);
+  *stats = host->stats;
+  pthread_mutex_unlock(&host->stats_mutex);
+}
+
+bool standin_host_streaming(StandinHost *host) {
+  pthread_mutex_lock(&host->stats_mutex);
+  bool streaming = host->stats_streaming;
+  pthread_mutex_unlock(&host->stats_mutex);
+  return streaming;
+}
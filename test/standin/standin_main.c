@@ -0,0 +1,156 @@
+/*
+ * standin_main.c — Command line front end of the stand-in host (vitarps5_standin).
+ *
+ * Serves one client at a time until interrupted or --seconds elapse, printing
+ * a "STANDIN" stats line every second.
+ *
+ * Usage: vitarps5_standin [--bind ADDR] [--ps4] [--morning HEX32]
+ *                         [--video FILE.h264] [--audio FILE.opus] [--no-loop]
+ *                         [--fps N] [--kbps N] [--fec-ratio F] [--audio-fec N]
+ *                         [--shape SPEC] [--scenario FILE] [--seed N]
+ *                         [--seconds N] [--verbose]
+ *
+ * SPEC is a comma separated key=value list, see netsim_params_parse(); FILE
+ * is a netsim scenario and replaces --shape and --seed.
+ */
+
+#define _GNU_SOURCE
+
+#include "standin.h"
+
+#include <chiaki/common.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t interrupted;
+
+static void on_signal(int sig) {
+  (void)sig;
+  interrupted = 1;
+}
+
+static bool parse_hex(uint8_t *out, size_t size, const char *hex) {
+  if (strlen(hex) != size * 2)
+    return false;
+  for (size_t i = 0; i < size; i++) {
+    unsigned v;
+    if (sscanf(hex + 2 * i, "%2x", &v) != 1)
+      return false;
+    out[i] = (uint8_t)v;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  StandinConfig config;
+  standin_config_defaults(&config);
+  NetsimScenario scenario;
+  double seconds = 0.0;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--ps4") == 0) {
+      config.ps5 = false;
+      continue;
+    }
+    if (strcmp(arg, "--no-loop") == 0) {
+      config.loop = false;
+      continue;
+    }
+    if (strcmp(arg, "--verbose") == 0) {
+      verbose = true;
+      continue;
+    }
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    if (strcmp(arg, "--bind") == 0)
+      config.bind_addr = val;
+    else if (strcmp(arg, "--morning") == 0) {
+      if (!parse_hex(config.morning, sizeof(config.morning), val)) {
+        fprintf(stderr, "--morning takes %zu hex bytes\n", sizeof(config.morning));
+        return 2;
+      }
+    } else if (strcmp(arg, "--video") == 0)
+      config.video_path = val;
+    else if (strcmp(arg, "--audio") == 0)
+      config.audio_path = val;
+    else if (strcmp(arg, "--fps") == 0)
+      config.fps = (unsigned)atoi(val);
+    else if (strcmp(arg, "--kbps") == 0)
+      config.synth_kbps = (unsigned)atoi(val);
+    else if (strcmp(arg, "--fec-ratio") == 0)
+      config.fec_ratio = atof(val);
+    else if (strcmp(arg, "--audio-fec") == 0)
+      config.audio_fec = (unsigned)atoi(val);
+    else if (strcmp(arg, "--shape") == 0) {
+      if (!netsim_params_parse(&config.shape, val)) {
+        fprintf(stderr, "invalid --shape %s\n", val);
+        return 2;
+      }
+    } else if (strcmp(arg, "--scenario") == 0) {
+      char err[128];
+      if (!netsim_scenario_load(&scenario, val, err, sizeof(err))) {
+        fprintf(stderr, "invalid --scenario: %s\n", err);
+        return 2;
+      }
+      config.scenario = &scenario;
+    } else if (strcmp(arg, "--seed") == 0)
+      config.seed = strtoull(val, NULL, 0);
+    else if (strcmp(arg, "--seconds") == 0)
+      seconds = atof(val);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+  if (!config.fps || config.fec_ratio < 0.0) {
+    fprintf(stderr, "invalid options\n");
+    return 2;
+  }
+
+  if (chiaki_lib_init() != CHIAKI_ERR_SUCCESS) {
+    fprintf(stderr, "chiaki_lib_init failed\n");
+    return 1;
+  }
+  ChiakiLog log;
+  chiaki_log_init(&log, verbose ? CHIAKI_LOG_ALL : CHIAKI_LOG_ALL & ~(CHIAKI_LOG_DEBUG | CHIAKI_LOG_VERBOSE),
+                  chiaki_log_cb_print, NULL);
+  config.log = &log;
+
+  StandinHost *host = standin_host_new(&config);
+  if (!host || !standin_host_start(host)) {
+    fprintf(stderr, "failed to start the stand-in host\n");
+    standin_host_free(host);
+    return 1;
+  }
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  printf("STANDIN listening on %s (%s)\n", config.bind_addr, config.ps5 ? "PS5" : "PS4");
+  fflush(stdout);
+
+  for (unsigned s = 0; !interrupted && (seconds <= 0.0 || s < seconds); s++) {
+    sleep(1);
+    StandinStats st;
+    standin_host_stats(host, &st);
+    printf("STANDIN t=%u streaming=%d sessions=%llu video_frames=%llu video_packets=%llu audio_packets=%llu "
+           "bytes=%llu shaped_dropped=%llu idr_requests=%llu data_in=%llu mac_errors=%llu\n",
+           s + 1, standin_host_streaming(host), (unsigned long long)st.sessions,
+           (unsigned long long)st.video_frames, (unsigned long long)st.video_packets,
+           (unsigned long long)st.audio_packets, (unsigned long long)st.bytes_sent,
+           (unsigned long long)st.shaped_dropped, (unsigned long long)st.idr_requests,
+           (unsigned long long)st.data_messages_in, (unsigned long long)st.mac_errors);
+    fflush(stdout);
+  }
+
+  standin_host_free(host);
+  return 0;
+}
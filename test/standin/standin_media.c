@@ -0,0 +1,394 @@
+/*
+ * standin_media.c — Prerecorded or synthetic media for the stand-in host.
+ *
+ * Video is an H.264 Annex-B elementary stream. The first SPS and PPS become
+ * the STREAMINFO video header; AUD, SEI and repeated parameter sets are
+ * dropped and every access unit is sent as one frame starting with its first
+ * slice, which is what the console sends and what ChiakiBitstream expects.
+ *
+ * Audio is a sequence of Opus packets, each prefixed with a big-endian 16-bit
+ * length, one packet per 10 ms (480 samples at 48 kHz, stereo). Takion audio
+ * units have a fixed size, so shorter packets are zero-padded to the largest
+ * one; use a CBR encode to avoid that.
+ *
+ * Without files, a synthetic stream with valid SPS/PPS and slice headers and
+ * random slice data is generated so that the client-side bitstream parsing
+ * and reference tracking see realistic input.
+ */
+
+#include "standin_priv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SYNTH_AUDIO_UNIT_SIZE 120
+#define SYNTH_AUDIO_PACKETS 100
+#define SYNTH_GOPS 4
+
+static bool read_file(const char *path, uint8_t **out, size_t *out_size) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  size_t cap = 1 << 20, size = 0;
+  uint8_t *buf = malloc(cap);
+  while (buf) {
+    size_t n = fread(buf + size, 1, cap - size, f);
+    size += n;
+    if (size < cap)
+      break;
+    cap *= 2;
+    uint8_t *nb = realloc(buf, cap);
+    if (!nb)
+      free(buf);
+    buf = nb;
+  }
+  fclose(f);
+  if (!buf)
+    return false;
+  *out = buf;
+  *out_size = size;
+  return true;
+}
+
+static bool frame_append(StandinFrame *frame, const uint8_t *nal, size_t nal_size) {
+  uint8_t *data = realloc(frame->data, frame->size + 4 + nal_size);
+  if (!data)
+    return false;
+  static const uint8_t start_code[4] = {0, 0, 0, 1};
+  memcpy(data + frame->size, start_code, 4);
+  memcpy(data + frame->size + 4, nal, nal_size);
+  frame->data = data;
+  frame->size += 4 + nal_size;
+  return true;
+}
+
+static bool media_push_frame(StandinMedia *media, size_t *cap) {
+  if (media->frames_count == *cap) {
+    size_t ncap = *cap ? *cap * 2 : 256;
+    StandinFrame *nf = realloc(media->frames, ncap * sizeof(StandinFrame));
+    if (!nf)
+      return false;
+    media->frames = nf;
+    *cap = ncap;
+  }
+  memset(&media->frames[media->frames_count++], 0, sizeof(StandinFrame));
+  return true;
+}
+
+/* Returns the offset of the next NAL payload after a start code at or after pos. */
+static size_t next_nal(const uint8_t *buf, size_t size, size_t pos, size_t *start_code_pos) {
+  for (size_t i = pos; i + 3 <= size; i++) {
+    if (buf[i] == 0 && buf[i + 1] == 0 && buf[i + 2] == 1) {
+      *start_code_pos = (i > pos && buf[i - 1] == 0) ? i - 1 : i;
+      return i + 3;
+    }
+  }
+  *start_code_pos = size;
+  return size;
+}
+
+static bool media_load_h264(StandinMedia *media, const uint8_t *buf, size_t size) {
+  StandinFrame header = {0};
+  bool have_sps = false, have_pps = false, au_open = false;
+  size_t cap = 0, sc;
+  size_t nal = next_nal(buf, size, 0, &sc);
+  while (nal < size) {
+    size_t nal_end;
+    size_t next = next_nal(buf, size, nal, &nal_end);
+    size_t nal_size = nal_end - nal;
+    while (nal_size && buf[nal + nal_size - 1] == 0) /* trailing_zero_8bits */
+      nal_size--;
+    if (nal_size) {
+      unsigned type = buf[nal] & 0x1f;
+      if (type == 7 && !have_sps) {
+        have_sps = frame_append(&header, buf + nal, nal_size);
+      } else if (type == 8 && !have_pps) {
+        have_pps = frame_append(&header, buf + nal, nal_size);
+      } else if (type == 9) {
+        au_open = false;
+      } else if (type == 1 || type == 5) {
+        bool first_slice = nal_size > 1 && (buf[nal + 1] & 0x80); /* first_mb_in_slice == 0 */
+        if (!au_open || first_slice) {
+          if (!media_push_frame(media, &cap))
+            return false;
+          au_open = true;
+        }
+        StandinFrame *frame = &media->frames[media->frames_count - 1];
+        if (!frame_append(frame, buf + nal, nal_size))
+          return false;
+        frame->idr |= type == 5;
+      }
+    }
+    nal = next;
+  }
+  media->header = header.data;
+  media->header_size = header.size;
+  return have_sps && have_pps && media->frames_count > 0;
+}
+
+static bool media_load_audio(StandinMedia *media, const uint8_t *buf, size_t size) {
+  size_t count = 0, max = 0;
+  for (size_t pos = 0; pos + 2 <= size;) {
+    size_t len = ((size_t)buf[pos] << 8) | buf[pos + 1];
+    if (!len || pos + 2 + len > size)
+      return false;
+    if (len > max)
+      max = len;
+    count++;
+    pos += 2 + len;
+  }
+  if (!count || max > 0xff)
+    return false;
+  media->audio = calloc(count, sizeof(uint8_t *));
+  if (!media->audio)
+    return false;
+  media->audio_unit_size = max;
+  for (size_t pos = 0; media->audio_count < count;) {
+    size_t len = ((size_t)buf[pos] << 8) | buf[pos + 1];
+    uint8_t *p = calloc(1, max);
+    if (!p)
+      return false;
+    memcpy(p, buf + pos + 2, len);
+    media->audio[media->audio_count++] = p;
+    pos += 2 + len;
+  }
+  return true;
+}
+
+/* ---- synthetic stream ---------------------------------------------------- */
+
+typedef struct {
+  uint8_t buf[64];
+  size_t bits;
+} BitWriter;
+
+static void bw_u(BitWriter *w, unsigned n, uint32_t v) {
+  for (unsigned i = n; i-- > 0;) {
+    if ((v >> i) & 1)
+      w->buf[w->bits / 8] |= (uint8_t)(0x80 >> (w->bits % 8));
+    w->bits++;
+  }
+}
+
+static void bw_ue(BitWriter *w, uint32_t v) {
+  uint32_t x = v + 1;
+  unsigned len = 0;
+  while ((x >> len) > 1)
+    len++;
+  bw_u(w, len, 0);
+  bw_u(w, len + 1, x);
+}
+
+static void bw_trailing(BitWriter *w) {
+  bw_u(w, 1, 1);
+  while (w->bits % 8)
+    bw_u(w, 1, 0);
+}
+
+/* Appends rbsp to frame as a NAL with emulation prevention applied. */
+static bool append_nal_rbsp(StandinFrame *frame, uint8_t nal_header, const uint8_t *rbsp, size_t size) {
+  uint8_t *nal = malloc(1 + size + size / 2 + 1);
+  if (!nal)
+    return false;
+  size_t n = 0;
+  unsigned zeros = 0;
+  nal[n++] = nal_header;
+  for (size_t i = 0; i < size; i++) {
+    if (zeros >= 2 && rbsp[i] <= 3) {
+      nal[n++] = 3;
+      zeros = 0;
+    }
+    nal[n++] = rbsp[i];
+    zeros = rbsp[i] ? 0 : zeros + 1;
+  }
+  bool ok = frame_append(frame, nal, n);
+  free(nal);
+  return ok;
+}
+
+static uint64_t synth_rand(uint64_t *s) {
+  uint64_t x = *s;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *s = x;
+  return x;
+}
+
+static bool media_synth_video(StandinMedia *media, const StandinConfig *config) {
+  unsigned mbs_w = (config->width + 15) / 16, mbs_h = (config->height + 15) / 16;
+  StandinFrame header = {0};
+
+  BitWriter sps = {{0}, 0};
+  bw_u(&sps, 8, 66);   /* profile_idc: baseline */
+  bw_u(&sps, 8, 0xc0); /* constraint_set0/1, reserved_zero */
+  bw_u(&sps, 8, 42);   /* level_idc */
+  bw_ue(&sps, 0);      /* seq_parameter_set_id */
+  bw_ue(&sps, 0);      /* log2_max_frame_num_minus4 */
+  bw_ue(&sps, 2);      /* pic_order_cnt_type */
+  bw_ue(&sps, 1);      /* max_num_ref_frames */
+  bw_u(&sps, 1, 0);    /* gaps_in_frame_num_value_allowed_flag */
+  bw_ue(&sps, mbs_w - 1);
+  bw_ue(&sps, mbs_h - 1);
+  bw_u(&sps, 1, 1); /* frame_mbs_only_flag */
+  bw_u(&sps, 1, 1); /* direct_8x8_inference_flag */
+  unsigned crop_bottom = (mbs_h * 16 - config->height) / 2, crop_right = (mbs_w * 16 - config->width) / 2;
+  bw_u(&sps, 1, crop_bottom || crop_right);
+  if (crop_bottom || crop_right) {
+    bw_ue(&sps, 0);
+    bw_ue(&sps, crop_right);
+    bw_ue(&sps, 0);
+    bw_ue(&sps, crop_bottom);
+  }
+  bw_u(&sps, 1, 0); /* vui_parameters_present_flag */
+  bw_trailing(&sps);
+
+  BitWriter pps = {{0}, 0};
+  bw_ue(&pps, 0);   /* pic_parameter_set_id */
+  bw_ue(&pps, 0);   /* seq_parameter_set_id */
+  bw_u(&pps, 1, 0); /* entropy_coding_mode_flag */
+  bw_u(&pps, 1, 0); /* bottom_field_pic_order_in_frame_present_flag */
+  bw_ue(&pps, 0);   /* num_slice_groups_minus1 */
+  bw_ue(&pps, 0);   /* num_ref_idx_l0_default_active_minus1 */
+  bw_ue(&pps, 0);   /* num_ref_idx_l1_default_active_minus1 */
+  bw_u(&pps, 1, 0); /* weighted_pred_flag */
+  bw_u(&pps, 2, 0); /* weighted_bipred_idc */
+  bw_ue(&pps, 0);   /* pic_init_qp_minus26 (se 0) */
+  bw_ue(&pps, 0);   /* pic_init_qs_minus26 */
+  bw_ue(&pps, 0);   /* chroma_qp_index_offset */
+  bw_u(&pps, 1, 1); /* deblocking_filter_control_present_flag */
+  bw_u(&pps, 1, 0); /* constrained_intra_pred_flag */
+  bw_u(&pps, 1, 0); /* redundant_pic_cnt_present_flag */
+  bw_trailing(&pps);
+
+  if (!append_nal_rbsp(&header, 0x67, sps.buf, sps.bits / 8) || !append_nal_rbsp(&header, 0x68, pps.buf, pps.bits / 8))
+    return false;
+  media->header = header.data;
+  media->header_size = header.size;
+
+  unsigned gop = config->synth_gop ? config->synth_gop : 120;
+  size_t avg = (size_t)config->synth_kbps * 1000 / 8 / config->fps;
+  size_t count = (size_t)gop * SYNTH_GOPS, cap = 0;
+  uint64_t rng = config->seed ? config->seed : 1;
+  uint8_t *rbsp = malloc(avg * 4 + 64);
+  if (!rbsp)
+    return false;
+  for (size_t i = 0; i < count; i++) {
+    bool idr = i % gop == 0;
+    if (!media_push_frame(media, &cap)) {
+      free(rbsp);
+      return false;
+    }
+    StandinFrame *frame = &media->frames[media->frames_count - 1];
+    frame->idr = idr;
+
+    BitWriter sh = {{0}, 0};
+    bw_ue(&sh, 0);                   /* first_mb_in_slice */
+    bw_ue(&sh, idr ? 7 : 5);         /* slice_type: I or P, all slices */
+    bw_ue(&sh, 0);                   /* pic_parameter_set_id */
+    bw_u(&sh, 4, (uint32_t)(i % gop) & 0xf); /* frame_num */
+    if (idr) {
+      bw_ue(&sh, 0);    /* idr_pic_id */
+      bw_u(&sh, 1, 0);  /* no_output_of_prior_pics_flag */
+      bw_u(&sh, 1, 0);  /* long_term_reference_flag */
+    } else {
+      bw_u(&sh, 1, 0);  /* num_ref_idx_active_override_flag */
+      bw_u(&sh, 1, 0);  /* ref_pic_list_modification_flag_l0 */
+      bw_u(&sh, 1, 0);  /* adaptive_ref_pic_marking_mode_flag */
+    }
+    bw_ue(&sh, 0); /* slice_qp_delta (se 0) */
+    bw_ue(&sh, 1); /* disable_deblocking_filter_idc */
+    while (sh.bits % 8)
+      bw_u(&sh, 1, 1);
+
+    size_t body = idr ? avg * 4 : avg - avg / 4 + (size_t)(synth_rand(&rng) % (avg / 2 + 1));
+    memcpy(rbsp, sh.buf, sh.bits / 8);
+    for (size_t j = 0; j < body; j++)
+      rbsp[sh.bits / 8 + j] = (uint8_t)(synth_rand(&rng) | 1);
+    if (!append_nal_rbsp(frame, idr ? 0x65 : 0x41, rbsp, sh.bits / 8 + body)) {
+      free(rbsp);
+      return false;
+    }
+  }
+  free(rbsp);
+  return true;
+}
+
+static bool media_synth_audio(StandinMedia *media) {
+  media->audio = calloc(SYNTH_AUDIO_PACKETS, sizeof(uint8_t *));
+  if (!media->audio)
+    return false;
+  media->audio_unit_size = SYNTH_AUDIO_UNIT_SIZE;
+  for (size_t i = 0; i < SYNTH_AUDIO_PACKETS; i++) {
+    uint8_t *p = calloc(1, SYNTH_AUDIO_UNIT_SIZE);
+    if (!p)
+      return false;
+    p[0] = 0xf4; /* TOC: CELT fullband 10 ms, stereo, one frame */
+    media->audio[media->audio_count++] = p;
+  }
+  return true;
+}
+
+bool standin_media_load(StandinMedia *media, const StandinConfig *config) {
+  memset(media, 0, sizeof(*media));
+  bool ok;
+  if (config->video_path) {
+    uint8_t *buf;
+    size_t size;
+    ok = read_file(config->video_path, &buf, &size);
+    if (ok) {
+      ok = media_load_h264(media, buf, size);
+      free(buf);
+    }
+    if (!ok)
+      CHIAKI_LOGE(config->log, "Stand-in failed to load H.264 stream %s", config->video_path);
+  } else {
+    ok = media_synth_video(media, config);
+  }
+  if (!ok)
+    goto fail;
+
+  if (config->audio_path) {
+    uint8_t *buf;
+    size_t size;
+    ok = read_file(config->audio_path, &buf, &size);
+    if (ok) {
+      ok = media_load_audio(media, buf, size);
+      free(buf);
+    }
+    if (!ok)
+      CHIAKI_LOGE(config->log, "Stand-in failed to load Opus packets %s", config->audio_path);
+  } else {
+    ok = media_synth_audio(media);
+  }
+  if (!ok)
+    goto fail;
+
+  CHIAKI_LOGI(config->log, "Stand-in media: %zu video frames, %zu audio packets of %zu bytes", media->frames_count,
+              media->audio_count, media->audio_unit_size);
+  return true;
+fail:
+  standin_media_fini(media);
+  return false;
+}
+
+void standin_media_fini(StandinMedia *media) {
+  for (size_t i = 0; i < media->frames_count; i++)
+    free(media->frames[i].data);
+  free(media->frames);
+  for (size_t i = 0; i < media->audio_count; i++)
+    free(media->audio[i]);
+  free(media->audio);
+  free(media->header);
+  memset(media, 0, sizeof(*media));
+}
+
+size_t standin_media_next_idr(const StandinMedia *media, size_t index) {
+  for (size_t i = 0; i < media->frames_count; i++) {
+    size_t j = (index + i) % media->frames_count;
+    if (media->frames[j].idr)
+      return j;
+  }
+  return index % media->frames_count;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+/* Internal pieces of the stand-in host, shared between its translation units. */
+
+#include "standin.h"
+
+#include <chiaki/gkcrypt.h>
+#include <chiaki/takion.h>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define STANDIN_SESSION_PORT 9295
+#define STANDIN_STREAM_PORT 9296
+
+#define STANDIN_PACKET_MAX 1500
+
+/* Datagrams the impairment can hold in flight. */
+#define STANDIN_NETSIM_CAPACITY 8192
+
+/* ---- media (standin_media.c) ---------------------------------------------- */
+
+typedef struct {
+  uint8_t *data;
+  size_t size;
+  bool idr;
+} StandinFrame;
+
+typedef struct {
+  uint8_t *header; /* SPS + PPS with start codes, sent in STREAMINFO */
+  size_t header_size;
+  StandinFrame *frames;
+  size_t frames_count;
+  uint8_t **audio;
+  size_t audio_count;
+  size_t audio_unit_size; /* every audio packet is padded to this size */
+} StandinMedia;
+
+bool standin_media_load(StandinMedia *media, const StandinConfig *config);
+void standin_media_fini(StandinMedia *media);
+/* Index of the first IDR at or after index, wrapping around. */
+size_t standin_media_next_idr(const StandinMedia *media, size_t index);
+
+/* ---- takion endpoint (standin_takion.c) ----------------------------------- */
+
+typedef struct standin_takion_t StandinTakion;
+
+typedef struct {
+  /* A complete (possibly reassembled) data message. */
+  void (*data)(StandinTakion *takion, uint8_t data_type, const uint8_t *buf, size_t size, void *user);
+  void (*connected)(StandinTakion *takion, void *user);
+  void *user;
+} StandinTakionCallbacks;
+
+struct standin_takion_t {
+  int fd;
+  uint16_t port;
+  ChiakiLog *log;
+  NetsimUdp *netsim;
+  StandinTakionCallbacks cb;
+
+  bool connected;
+  struct sockaddr_storage peer;
+  socklen_t peer_len;
+  uint32_t tag_local;
+  uint32_t tag_remote;
+  uint32_t seq_local;
+  uint64_t key_pos_local;
+  ChiakiKeyState key_state_remote;
+  ChiakiGKCrypt *gkcrypt_local;
+  ChiakiGKCrypt *gkcrypt_remote;
+  uint8_t cookie[0x20];
+
+  uint8_t recv_buf[0x10000];
+  uint8_t *reassembly;
+  size_t reassembly_size;
+  size_t reassembly_cap;
+  uint8_t reassembly_type;
+  bool reassembling;
+
+  uint64_t data_messages_in;
+  uint64_t mac_errors;
+};
+
+bool standin_takion_init(StandinTakion *takion, const char *bind_addr, uint16_t port, NetsimUdp *netsim,
+                         ChiakiLog *log, const StandinTakionCallbacks *cb);
+void standin_takion_fini(StandinTakion *takion);
+/* Forgets the current peer and crypt so a new client can connect. */
+void standin_takion_reset(StandinTakion *takion);
+/* Reads and dispatches every pending datagram. */
+void standin_takion_poll_in(StandinTakion *takion, uint64_t now_us);
+void standin_takion_set_crypt(StandinTakion *takion, ChiakiGKCrypt *local, ChiakiGKCrypt *remote);
+bool standin_takion_send_data(StandinTakion *takion, uint64_t now_us, uint16_t channel, uint8_t data_type,
+                              const uint8_t *buf, size_t size);
+/* Sends an already formatted AV packet, reserving key_pos for its payload,
+ * encrypting payload_offset..size and filling in the MAC. */
+bool standin_takion_send_av(StandinTakion *takion, uint64_t now_us, uint8_t *packet, size_t size,
+                            size_t payload_offset);
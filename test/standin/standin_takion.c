@@ -0,0 +1,333 @@
+/*
+ * standin_takion.c — Console side of a Takion connection.
+ *
+ * Mirrors lib/src/takion.c from the other end: answers INIT with INIT_ACK and
+ * COOKIE with COOKIE_ACK, acknowledges and reassembles incoming data
+ * messages, and sends data messages and AV packets with the host's key_pos
+ * and GMAC once crypt is up. Only one peer is served; a new INIT replaces it.
+ */
+
+#include "standin_priv.h"
+
+#include <chiaki/random.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TAKION_PACKET_TYPE_CONTROL 0
+#define TAKION_MESSAGE_HEADER_SIZE 0x10
+#define TAKION_CHUNK_TYPE_DATA 0
+#define TAKION_CHUNK_TYPE_INIT 1
+#define TAKION_CHUNK_TYPE_INIT_ACK 2
+#define TAKION_CHUNK_TYPE_DATA_ACK 3
+#define TAKION_CHUNK_TYPE_COOKIE 0xa
+#define TAKION_CHUNK_TYPE_COOKIE_ACK 0xb
+#define TAKION_STREAMS 0x64
+#define TAKION_A_RWND 0x19000
+
+static void put_be16(uint8_t *p, uint16_t v) {
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+static uint32_t get_be32(const uint8_t *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t get_be16(const uint8_t *p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/* Same rounding as chiaki_takion_crypt_advance_key_pos(). */
+static uint64_t takion_reserve_key_pos(StandinTakion *takion, size_t data_size) {
+  if (!takion->gkcrypt_local)
+    return 0;
+  data_size += data_size % CHIAKI_GKCRYPT_BLOCK_SIZE;
+  uint64_t key_pos = takion->key_pos_local;
+  takion->key_pos_local += data_size;
+  return key_pos;
+}
+
+static void write_message_header(uint8_t *buf, uint32_t tag, uint64_t key_pos, uint8_t chunk_type,
+                                 uint8_t chunk_flags, size_t payload_size) {
+  put_be32(buf, tag);
+  memset(buf + 4, 0, CHIAKI_GKCRYPT_GMAC_SIZE);
+  put_be32(buf + 8, (uint32_t)key_pos);
+  buf[0xc] = chunk_type;
+  buf[0xd] = chunk_flags;
+  put_be16(buf + 0xe, (uint16_t)(payload_size + 4));
+}
+
+static void takion_send(StandinTakion *takion, uint64_t now_us, uint8_t *buf, size_t size, uint64_t key_pos) {
+  chiaki_takion_packet_mac(takion->gkcrypt_local, buf, size, key_pos, NULL, NULL);
+  netsim_udp_sendto(takion->netsim, now_us, takion->fd, (struct sockaddr *)&takion->peer, takion->peer_len, buf,
+                    size);
+}
+
+bool standin_takion_init(StandinTakion *takion, const char *bind_addr, uint16_t port, NetsimUdp *netsim,
+                         ChiakiLog *log, const StandinTakionCallbacks *cb) {
+  memset(takion, 0, sizeof(*takion));
+  takion->port = port;
+  takion->netsim = netsim;
+  takion->log = log;
+  takion->cb = *cb;
+  chiaki_key_state_init(&takion->key_state_remote);
+
+  takion->fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (takion->fd < 0)
+    return false;
+  int one = 1;
+  setsockopt(takion->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  int sndbuf = 4 << 20;
+  setsockopt(takion->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, bind_addr, &addr.sin_addr) != 1 ||
+      bind(takion->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    CHIAKI_LOGE(log, "Stand-in failed to bind UDP %s:%u: %s", bind_addr, (unsigned)port, strerror(errno));
+    close(takion->fd);
+    takion->fd = -1;
+    return false;
+  }
+  return true;
+}
+
+void standin_takion_fini(StandinTakion *takion) {
+  if (takion->fd >= 0)
+    close(takion->fd);
+  takion->fd = -1;
+  standin_takion_reset(takion);
+}
+
+void standin_takion_reset(StandinTakion *takion) {
+  takion->connected = false;
+  takion->peer_len = 0;
+  takion->key_pos_local = 0;
+  chiaki_key_state_init(&takion->key_state_remote);
+  chiaki_gkcrypt_free(takion->gkcrypt_local);
+  chiaki_gkcrypt_free(takion->gkcrypt_remote);
+  takion->gkcrypt_local = NULL;
+  takion->gkcrypt_remote = NULL;
+  free(takion->reassembly);
+  takion->reassembly = NULL;
+  takion->reassembly_size = 0;
+  takion->reassembly_cap = 0;
+  takion->reassembling = false;
+}
+
+void standin_takion_set_crypt(StandinTakion *takion, ChiakiGKCrypt *local, ChiakiGKCrypt *remote) {
+  chiaki_gkcrypt_free(takion->gkcrypt_local);
+  chiaki_gkcrypt_free(takion->gkcrypt_remote);
+  takion->gkcrypt_local = local;
+  takion->gkcrypt_remote = remote;
+}
+
+static void takion_handle_init(StandinTakion *takion, uint64_t now_us, const uint8_t *payload, size_t size,
+                               const struct sockaddr_storage *from, socklen_t from_len) {
+  if (size < 0x10)
+    return;
+  standin_takion_reset(takion);
+  memcpy(&takion->peer, from, from_len);
+  takion->peer_len = from_len;
+  takion->tag_remote = get_be32(payload);
+  do
+    takion->tag_local = chiaki_random_32();
+  while (!takion->tag_local);
+  takion->seq_local = takion->tag_local;
+  chiaki_random_bytes_crypt(takion->cookie, sizeof(takion->cookie));
+
+  uint8_t buf[1 + TAKION_MESSAGE_HEADER_SIZE + 0x10 + sizeof(takion->cookie)];
+  buf[0] = TAKION_PACKET_TYPE_CONTROL;
+  write_message_header(buf + 1, takion->tag_remote, 0, TAKION_CHUNK_TYPE_INIT_ACK, 0, 0x10 + sizeof(takion->cookie));
+  uint8_t *pl = buf + 1 + TAKION_MESSAGE_HEADER_SIZE;
+  put_be32(pl, takion->tag_local);
+  put_be32(pl + 4, TAKION_A_RWND);
+  put_be16(pl + 8, TAKION_STREAMS);
+  put_be16(pl + 0xa, TAKION_STREAMS);
+  put_be32(pl + 0xc, takion->tag_local);
+  memcpy(pl + 0x10, takion->cookie, sizeof(takion->cookie));
+  takion_send(takion, now_us, buf, sizeof(buf), 0);
+}
+
+static void takion_handle_cookie(StandinTakion *takion, uint64_t now_us, const uint8_t *payload, size_t size) {
+  if (size != sizeof(takion->cookie) || memcmp(payload, takion->cookie, size) != 0) {
+    CHIAKI_LOGW(takion->log, "Stand-in Takion %u received unexpected cookie", (unsigned)takion->port);
+    return;
+  }
+  uint8_t buf[1 + TAKION_MESSAGE_HEADER_SIZE];
+  buf[0] = TAKION_PACKET_TYPE_CONTROL;
+  write_message_header(buf + 1, takion->tag_remote, 0, TAKION_CHUNK_TYPE_COOKIE_ACK, 0, 0);
+  takion_send(takion, now_us, buf, sizeof(buf), 0);
+  if (!takion->connected) {
+    takion->connected = true;
+    if (takion->cb.connected)
+      takion->cb.connected(takion, takion->cb.user);
+  }
+}
+
+static void takion_send_data_ack(StandinTakion *takion, uint64_t now_us, uint32_t seq) {
+  uint8_t buf[1 + TAKION_MESSAGE_HEADER_SIZE + 0xc];
+  buf[0] = TAKION_PACKET_TYPE_CONTROL;
+  uint64_t key_pos = takion_reserve_key_pos(takion, sizeof(buf));
+  write_message_header(buf + 1, takion->tag_remote, key_pos, TAKION_CHUNK_TYPE_DATA_ACK, 0, 0xc);
+  uint8_t *pl = buf + 1 + TAKION_MESSAGE_HEADER_SIZE;
+  put_be32(pl, seq);
+  put_be32(pl + 4, TAKION_A_RWND);
+  put_be16(pl + 8, 0);
+  put_be16(pl + 0xa, 0);
+  takion_send(takion, now_us, buf, sizeof(buf), key_pos);
+}
+
+static bool reassembly_append(StandinTakion *takion, const uint8_t *buf, size_t size) {
+  if (takion->reassembly_size + size > takion->reassembly_cap) {
+    size_t cap = takion->reassembly_cap ? takion->reassembly_cap : 2048;
+    while (cap < takion->reassembly_size + size)
+      cap *= 2;
+    uint8_t *nb = realloc(takion->reassembly, cap);
+    if (!nb)
+      return false;
+    takion->reassembly = nb;
+    takion->reassembly_cap = cap;
+  }
+  memcpy(takion->reassembly + takion->reassembly_size, buf, size);
+  takion->reassembly_size += size;
+  return true;
+}
+
+/*
+ * The client splits large messages (BIG) into a first chunk carrying the
+ * data_type byte with flags 0, continuation chunks without it, and a final
+ * chunk with flags 1. Unfragmented messages are a single first chunk with
+ * flags 1.
+ */
+static void takion_handle_data(StandinTakion *takion, uint64_t now_us, uint8_t flags, const uint8_t *payload,
+                               size_t size) {
+  if (size < 8)
+    return;
+  uint32_t seq = get_be32(payload);
+  takion_send_data_ack(takion, now_us, seq);
+
+  if (!takion->reassembling) {
+    if (size < 9)
+      return;
+    takion->reassembly_type = payload[8];
+    takion->reassembly_size = 0;
+    payload += 9;
+    size -= 9;
+  } else {
+    payload += 8;
+    size -= 8;
+  }
+  if (!reassembly_append(takion, payload, size)) {
+    takion->reassembling = false;
+    return;
+  }
+  takion->reassembling = flags != 1;
+  if (takion->reassembling)
+    return;
+
+  takion->data_messages_in++;
+  if (takion->cb.data)
+    takion->cb.data(takion, takion->reassembly_type, takion->reassembly, takion->reassembly_size, takion->cb.user);
+}
+
+static void takion_verify_mac(StandinTakion *takion, uint8_t *buf, size_t size) {
+  if (!takion->gkcrypt_remote || size < 1 + TAKION_MESSAGE_HEADER_SIZE)
+    return;
+  uint64_t key_pos = chiaki_key_state_request_pos(&takion->key_state_remote, get_be32(buf + 9), false);
+  uint8_t mac[CHIAKI_GKCRYPT_GMAC_SIZE], mac_expected[CHIAKI_GKCRYPT_GMAC_SIZE];
+  if (chiaki_takion_packet_mac(takion->gkcrypt_remote, buf, size, key_pos, mac_expected, mac) != CHIAKI_ERR_SUCCESS)
+    return;
+  if (memcmp(mac, mac_expected, sizeof(mac)) != 0)
+    takion->mac_errors++;
+  else
+    chiaki_key_state_commit(&takion->key_state_remote, key_pos);
+}
+
+static void takion_handle_packet(StandinTakion *takion, uint64_t now_us, uint8_t *buf, size_t size,
+                                 const struct sockaddr_storage *from, socklen_t from_len) {
+  /* Feedback, congestion and mic packets are of no interest to the host. */
+  if (size < 1 + TAKION_MESSAGE_HEADER_SIZE || (buf[0] & 0xf) != TAKION_PACKET_TYPE_CONTROL)
+    return;
+  uint8_t *msg = buf + 1;
+  uint8_t chunk_type = msg[0xc];
+  uint8_t chunk_flags = msg[0xd];
+  size_t payload_size = get_be16(msg + 0xe);
+  if (payload_size < 4 || size - 1 != payload_size + 0xc)
+    return;
+  payload_size -= 4;
+  const uint8_t *payload = msg + TAKION_MESSAGE_HEADER_SIZE;
+
+  if (chunk_type == TAKION_CHUNK_TYPE_INIT) {
+    takion_handle_init(takion, now_us, payload, payload_size, from, from_len);
+    return;
+  }
+  if (!takion->peer_len || get_be32(msg) != takion->tag_local)
+    return;
+
+  switch (chunk_type) {
+  case TAKION_CHUNK_TYPE_COOKIE:
+    takion_handle_cookie(takion, now_us, payload, payload_size);
+    break;
+  case TAKION_CHUNK_TYPE_DATA:
+    takion_verify_mac(takion, buf, size);
+    takion_handle_data(takion, now_us, chunk_flags, payload, payload_size);
+    break;
+  default:
+    break;
+  }
+}
+
+void standin_takion_poll_in(StandinTakion *takion, uint64_t now_us) {
+  for (;;) {
+    struct sockaddr_storage from;
+    socklen_t from_len = sizeof(from);
+    ssize_t n = recvfrom(takion->fd, takion->recv_buf, sizeof(takion->recv_buf), MSG_DONTWAIT,
+                         (struct sockaddr *)&from, &from_len);
+    if (n <= 0)
+      return;
+    takion_handle_packet(takion, now_us, takion->recv_buf, (size_t)n, &from, from_len);
+  }
+}
+
+bool standin_takion_send_data(StandinTakion *takion, uint64_t now_us, uint16_t channel, uint8_t data_type,
+                              const uint8_t *buf, size_t size) {
+  uint8_t packet[STANDIN_PACKET_MAX];
+  size_t packet_size = 1 + TAKION_MESSAGE_HEADER_SIZE + 9 + size;
+  if (!takion->connected || packet_size > sizeof(packet))
+    return false;
+  uint64_t key_pos = takion_reserve_key_pos(takion, size);
+  packet[0] = TAKION_PACKET_TYPE_CONTROL;
+  write_message_header(packet + 1, takion->tag_remote, key_pos, TAKION_CHUNK_TYPE_DATA, 1, 9 + size);
+  uint8_t *pl = packet + 1 + TAKION_MESSAGE_HEADER_SIZE;
+  put_be32(pl, takion->seq_local++);
+  put_be16(pl + 4, channel);
+  put_be16(pl + 6, 0);
+  pl[8] = data_type;
+  memcpy(pl + 9, buf, size);
+  takion_send(takion, now_us, packet, packet_size, key_pos);
+  return true;
+}
+
+bool standin_takion_send_av(StandinTakion *takion, uint64_t now_us, uint8_t *packet, size_t size,
+                            size_t payload_offset) {
+  if (!takion->connected || !takion->gkcrypt_local || payload_offset > size)
+    return false;
+  uint64_t key_pos = takion_reserve_key_pos(takion, size - payload_offset);
+  put_be32(packet + 0xe, (uint32_t)key_pos);
+  chiaki_gkcrypt_encrypt(takion->gkcrypt_local, key_pos + CHIAKI_GKCRYPT_BLOCK_SIZE, packet + payload_offset,
+                         size - payload_offset);
+  takion_send(takion, now_us, packet, size, key_pos);
+  return true;
+}
@@ -0,0 +1,377 @@
+/*
+ * wake_bench.c — ChiakiWakeOrchestrator against a stand-in console in rest
+ * mode (vitarps5_wake).
+ *
+ * First checks the orchestrator end to end over discovery and TCP on
+ * loopback, failing with a non-zero exit status if any check does not hold:
+ *
+ *   awake     a console that is already up is connected after one probe
+ *   lost      a lost WAKEUP is resent and the console still boots
+ *   services  a session port that refuses for a while after the console
+ *             reported ready is retried until it accepts
+ *   cancel    canceling while the console does not wake up returns at once
+ *   timeout   a console that never wakes up times out
+ *
+ * Then wakes the stand-in (booting in --boot +-25%, the same boot times for
+ * both modes, session port up --services later, answers held for --rtt) and
+ * connects, in two modes:
+ *
+ *   fixed        what the client did before: one WAKEUP, a discovery round
+ *                every 500 ms, a refused session tried again on the next round
+ *   orchestrated the defaults of chiaki_wake_config_defaults()
+ *
+ *   BENCH wake mode=.. runs=.. boot_ms=.. services_ms=.. wake_ms=..
+ *         boot_step_ms=.. connect_ms=.. total_ms=.. probes=.. wakeups=..
+ *         connects=..
+ *
+ * wake_ms until the console first answered, boot_step_ms from there until it
+ * reported ready, connect_ms from there until the session request went
+ * through, all means over the runs.
+ *
+ * Usage: vitarps5_wake [--runs N] [--boot MS] [--services MS] [--rtt MS] [--verbose]
+ */
+
+#define _GNU_SOURCE
+
+#include "wake_standin.h"
+
+#include <chiaki/log.h>
+#include <chiaki/thread.h>
+#include <chiaki/time.h>
+#include <chiaki/wakeorchestrator.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CREDENTIAL 0x1234abcdull
+#define LEGACY_PING_MS 500 /* discovery service interval of the Vita client */
+
+/* ChiakiWakeConnectFunc standing in for the session request. */
+static ChiakiErrorCode session_request(void *user, const ChiakiDiscoveryHost *host) {
+  (void)user;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return CHIAKI_ERR_NETWORK;
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(host->host_request_port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ChiakiErrorCode err = CHIAKI_ERR_NETWORK;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    if (errno == ECONNREFUSED)
+      err = CHIAKI_ERR_CONNECTION_REFUSED;
+    goto out;
+  }
+  static const char request[] = "GET /sie/ps5/rp/sess/init HTTP/1.1\r\n"
+                                "Host: 127.0.0.1:9295\r\n"
+                                "\r\n";
+  if (send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) != (ssize_t)sizeof(request) - 1)
+    goto out;
+  char response[256];
+  struct pollfd pfd = {fd, POLLIN, 0};
+  ssize_t n = poll(&pfd, 1, 2000) > 0 ? recv(fd, response, sizeof(response) - 1, 0) : -1;
+  if (n <= 0)
+    goto out;
+  response[n] = '\0';
+  err = strncmp(response, "HTTP/1.1 200", 12) == 0 ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_HTTP_NONOK;
+
+out:
+  close(fd);
+  return err;
+}
+
+static void wake_config(ChiakiWakeConfig *config, WakeStandin *standin) {
+  chiaki_wake_config_defaults(config);
+  config->host = "127.0.0.1";
+  config->port = wake_standin_discovery_port(standin);
+  config->ps5 = true;
+  config->user_credential = CREDENTIAL;
+  config->connect = session_request;
+}
+
+static void legacy_config(ChiakiWakeConfig *config) {
+  config->probe_min_ms = config->probe_max_ms = LEGACY_PING_MS;
+  config->wakeup_retry_min_ms = config->wakeup_retry_max_ms = UINT32_MAX;
+  config->connect_retry_min_ms = config->connect_retry_max_ms = LEGACY_PING_MS;
+  config->connect_attempts = 1000;
+}
+
+static WakeStandin *standin_new(bool awake, uint32_t silent_ms, uint32_t boot_ms, uint32_t services_ms,
+                                uint32_t reply_delay_us, unsigned drop_wakeups) {
+  WakeStandinConfig config;
+  wake_standin_config_defaults(&config);
+  config.credential = CREDENTIAL;
+  config.awake = awake;
+  config.silent_ms = silent_ms;
+  config.boot_ms = boot_ms;
+  config.services_ms = services_ms;
+  config.reply_delay_us = reply_delay_us;
+  config.drop_wakeups = drop_wakeups;
+  WakeStandin *standin = wake_standin_new(&config);
+  if (!standin)
+    fprintf(stderr, "failed to start the wake stand-in\n");
+  return standin;
+}
+
+static ChiakiErrorCode run(const ChiakiWakeConfig *config, ChiakiLog *log, ChiakiWakeTimeline *timeline) {
+  ChiakiWakeOrchestrator orchestrator;
+  ChiakiErrorCode err = chiaki_wake_orchestrator_init(&orchestrator, log, config);
+  if (err != CHIAKI_ERR_SUCCESS)
+    return err;
+  err = chiaki_wake_orchestrator_run(&orchestrator, timeline);
+  chiaki_wake_orchestrator_fini(&orchestrator);
+  return err;
+}
+
+#define CHECK(cond)                                                          \
+  do {                                                                       \
+    if (!(cond)) {                                                           \
+      fprintf(stderr, "wake check failed: %s (line %d)\n", #cond, __LINE__); \
+      ok = false;                                                            \
+      goto out;                                                              \
+    }                                                                        \
+  } while (0)
+
+static bool check_awake(ChiakiLog *log) {
+  bool ok = true;
+  ChiakiWakeConfig config;
+  ChiakiWakeTimeline timeline;
+  WakeStandinStats s;
+  WakeStandin *standin = standin_new(true, 0, 0, 0, 0, 0);
+  CHECK(standin);
+
+  wake_config(&config, standin);
+  CHECK(run(&config, log, &timeline) == CHIAKI_ERR_SUCCESS);
+  CHECK(timeline.was_ready);
+  CHECK(timeline.steps[CHIAKI_WAKE_STEP_WAKE].attempts == 1);
+  CHECK(timeline.steps[CHIAKI_WAKE_STEP_CONNECT].done && timeline.steps[CHIAKI_WAKE_STEP_CONNECT].attempts == 1);
+  wake_standin_stats(standin, &s);
+  CHECK(s.session_requests == 1 && s.answers_standby == 0);
+
+out:
+  wake_standin_free(standin);
+  printf("CHECK wake awake=%s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static bool check_lost_wakeup(ChiakiLog *log) {
+  bool ok = true;
+  ChiakiWakeConfig config;
+  ChiakiWakeTimeline timeline;
+  WakeStandinStats s;
+  WakeStandin *standin = standin_new(false, 0, 200, 0, 0, 1);
+  CHECK(standin);
+
+  wake_config(&config, standin);
+  config.wakeup_retry_min_ms = 100;
+  CHECK(run(&config, log, &timeline) == CHIAKI_ERR_SUCCESS);
+  CHECK(!timeline.was_ready && timeline.wakeups >= 2);
+  CHECK(timeline.steps[CHIAKI_WAKE_STEP_BOOT].done);
+  wake_standin_stats(standin, &s);
+  CHECK(s.wakeups_dropped == 1 && s.answers_standby >= 1 && s.session_requests == 1);
+
+out:
+  wake_standin_free(standin);
+  printf("CHECK wake lost=%s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static bool check_services(ChiakiLog *log) {
+  bool ok = true;
+  ChiakiWakeConfig config;
+  ChiakiWakeTimeline timeline;
+  WakeStandinStats s;
+  WakeStandin *standin = standin_new(false, 50, 100, 300, 0, 0);
+  CHECK(standin);
+
+  wake_config(&config, standin);
+  CHECK(run(&config, log, &timeline) == CHIAKI_ERR_SUCCESS);
+  CHECK(timeline.steps[CHIAKI_WAKE_STEP_CONNECT].attempts > 1);
+  CHECK(timeline.steps[CHIAKI_WAKE_STEP_CONNECT].duration_ms >= 200);
+  wake_standin_stats(standin, &s);
+  CHECK(s.session_requests == 1);
+
+  /* out of attempts before the services are up */
+  wake_standin_free(standin);
+  standin = standin_new(false, 0, 0, 5000, 0, 0);
+  CHECK(standin);
+  wake_config(&config, standin);
+  config.connect_attempts = 2;
+  CHECK(run(&config, log, &timeline) == CHIAKI_ERR_CONNECTION_REFUSED);
+  CHECK(!timeline.steps[CHIAKI_WAKE_STEP_CONNECT].done && timeline.steps[CHIAKI_WAKE_STEP_CONNECT].attempts == 2);
+
+out:
+  wake_standin_free(standin);
+  printf("CHECK wake services=%s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static void *cancel_thread_func(void *user) {
+  struct timespec ts = {0, 150 * 1000000L};
+  nanosleep(&ts, NULL);
+  chiaki_wake_orchestrator_cancel(user);
+  return NULL;
+}
+
+static bool check_cancel(ChiakiLog *log) {
+  bool ok = true;
+  ChiakiWakeConfig config;
+  ChiakiWakeTimeline timeline;
+  ChiakiWakeOrchestrator orchestrator;
+  bool initialized = false;
+  WakeStandin *standin = standin_new(false, 0, 0, 0, 0, 0);
+  CHECK(standin);
+
+  /* the wrong credential, so the console stays in standby */
+  wake_config(&config, standin);
+  config.user_credential = CREDENTIAL + 1;
+  CHECK(chiaki_wake_orchestrator_init(&orchestrator, log, &config) == CHIAKI_ERR_SUCCESS);
+  initialized = true;
+  ChiakiThread thread;
+  CHECK(chiaki_thread_create(&thread, cancel_thread_func, &orchestrator) == CHIAKI_ERR_SUCCESS);
+  ChiakiErrorCode err = chiaki_wake_orchestrator_run(&orchestrator, &timeline);
+  chiaki_thread_join(&thread, NULL);
+  CHECK(err == CHIAKI_ERR_CANCELED);
+  CHECK(timeline.total_ms < 1000);
+  CHECK(chiaki_wake_orchestrator_step(&orchestrator) == CHIAKI_WAKE_STEP_BOOT);
+  CHECK(!timeline.steps[CHIAKI_WAKE_STEP_BOOT].done && timeline.steps[CHIAKI_WAKE_STEP_BOOT].attempts > 0);
+
+out:
+  if (initialized)
+    chiaki_wake_orchestrator_fini(&orchestrator);
+  wake_standin_free(standin);
+  printf("CHECK wake cancel=%s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static bool check_timeout(ChiakiLog *log) {
+  bool ok = true;
+  ChiakiWakeConfig config;
+  ChiakiWakeTimeline timeline;
+  WakeStandinStats s;
+  WakeStandin *standin = standin_new(false, 0, 0, 0, 0, 0);
+  CHECK(standin);
+
+  wake_config(&config, standin);
+  config.user_credential = CREDENTIAL + 1;
+  config.timeout_ms = 300;
+  config.wakeup_retry_min_ms = 100;
+  CHECK(run(&config, log, &timeline) == CHIAKI_ERR_TIMEOUT);
+  CHECK(timeline.total_ms >= 300 && timeline.total_ms < 1000);
+  CHECK(timeline.steps[CHIAKI_WAKE_STEP_CONNECT].attempts == 0);
+  wake_standin_stats(standin, &s);
+  CHECK(s.wakeups_rejected >= 2 && s.session_requests == 0);
+
+out:
+  wake_standin_free(standin);
+  printf("CHECK wake timeout=%s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+#undef CHECK
+
+typedef enum { MODE_FIXED, MODE_ORCHESTRATED } BenchMode;
+
+static const char *const mode_names[] = {"fixed", "orchestrated"};
+
+static bool bench_mode(BenchMode mode, unsigned runs, uint32_t boot_ms, uint32_t services_ms, double rtt_ms,
+                       ChiakiLog *log) {
+  uint64_t wake_ms = 0, boot_step_ms = 0, connect_ms = 0, total_ms = 0;
+  unsigned probes = 0, wakeups = 0, connects = 0;
+  unsigned seed = 1; /* the same boot times for both modes */
+  for (unsigned r = 0; r < runs; r++) {
+    uint32_t run_boot_ms = boot_ms - boot_ms / 4 + (uint32_t)rand_r(&seed) % (boot_ms / 2 + 1);
+    WakeStandin *standin =
+        standin_new(false, run_boot_ms / 5, run_boot_ms, services_ms, (uint32_t)(rtt_ms * 1000.0), 0);
+    if (!standin)
+      return false;
+    ChiakiWakeConfig config;
+    wake_config(&config, standin);
+    if (mode == MODE_FIXED)
+      legacy_config(&config);
+    ChiakiWakeTimeline timeline;
+    ChiakiErrorCode err = run(&config, log, &timeline);
+    wake_standin_free(standin);
+    if (err != CHIAKI_ERR_SUCCESS) {
+      fprintf(stderr, "wake failed: %s\n", chiaki_error_string(err));
+      return false;
+    }
+    wake_ms += timeline.steps[CHIAKI_WAKE_STEP_WAKE].duration_ms;
+    boot_step_ms += timeline.steps[CHIAKI_WAKE_STEP_BOOT].duration_ms;
+    connect_ms += timeline.steps[CHIAKI_WAKE_STEP_CONNECT].duration_ms;
+    total_ms += timeline.total_ms;
+    probes += timeline.steps[CHIAKI_WAKE_STEP_WAKE].attempts + timeline.steps[CHIAKI_WAKE_STEP_BOOT].attempts;
+    wakeups += timeline.wakeups;
+    connects += timeline.steps[CHIAKI_WAKE_STEP_CONNECT].attempts;
+  }
+  printf("BENCH wake mode=%s runs=%u boot_ms=%u services_ms=%u wake_ms=%.1f boot_step_ms=%.1f connect_ms=%.1f "
+         "total_ms=%.1f probes=%.1f wakeups=%.1f connects=%.1f\n",
+         mode_names[mode], runs, boot_ms, services_ms, (double)wake_ms / runs, (double)boot_step_ms / runs,
+         (double)connect_ms / runs, (double)total_ms / runs, (double)probes / runs, (double)wakeups / runs,
+         (double)connects / runs);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned runs = 8;
+  uint32_t boot_ms = 1650;
+  uint32_t services_ms = 300;
+  double rtt_ms = 2.0;
+  bool verbose = false;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--verbose") == 0) {
+      verbose = true;
+      continue;
+    }
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!val) {
+      fprintf(stderr, "missing value for %s\n", arg);
+      return 2;
+    }
+    if (strcmp(arg, "--runs") == 0)
+      runs = (unsigned)atoi(val);
+    else if (strcmp(arg, "--boot") == 0)
+      boot_ms = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--services") == 0)
+      services_ms = (uint32_t)atoi(val);
+    else if (strcmp(arg, "--rtt") == 0)
+      rtt_ms = atof(val);
+    else {
+      fprintf(stderr, "unknown option %s\n", arg);
+      return 2;
+    }
+    i++;
+  }
+  if (!runs || rtt_ms < 0.0) {
+    fprintf(stderr, "invalid options\n");
+    return 2;
+  }
+
+  ChiakiLog log;
+  chiaki_log_init(&log, verbose ? CHIAKI_LOG_ALL : CHIAKI_LOG_ERROR, chiaki_log_cb_print, NULL);
+
+  bool ok = check_awake(&log);
+  ok = check_lost_wakeup(&log) && ok;
+  ok = check_services(&log) && ok;
+  ok = check_cancel(&log) && ok;
+  ok = check_timeout(&log) && ok;
+
+  for (BenchMode mode = MODE_FIXED; mode <= MODE_ORCHESTRATED; mode++) {
+    if (!bench_mode(mode, runs, boot_ms, services_ms, rtt_ms, &log)) {
+      fprintf(stderr, "bench mode %s failed\n", mode_names[mode]);
+      ok = false;
+    }
+  }
+  return ok ? 0 : 1;
+}
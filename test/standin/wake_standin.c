@@ -0,0 +1,380 @@
+/*
+ * wake_standin.c — Stand-in console in rest mode, see wake_standin.h.
+ *
+ * One thread answers discovery and pings, opens the session port once
+ * services are up and serves session requests. Boot progress is derived from the time the
+ * WAKEUP was accepted, so nothing has to be scheduled besides held answers.
+ */
+
+#define _GNU_SOURCE
+
+#include "wake_standin.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WAKE_STANDIN_MSG_MAX 512
+#define WAKE_STANDIN_PENDING_MAX 32
+
+typedef struct {
+  uint64_t due_us;
+  struct sockaddr_in to;
+  char msg[WAKE_STANDIN_MSG_MAX];
+  size_t len;
+} WakeStandinReply;
+
+struct wake_standin_t {
+  WakeStandinConfig config;
+  int udp_fd;
+  int session_fd;
+  bool session_listening;
+  uint16_t discovery_port;
+  uint16_t session_port;
+  int stop_pipe[2];
+  pthread_t thread;
+  bool started;
+
+  pthread_mutex_t mutex; /* stats */
+  WakeStandinStats stats;
+
+  /* only touched by the stand-in thread */
+  bool woken;
+  uint64_t woken_us;
+  unsigned wakeups_seen;
+  WakeStandinReply pending[WAKE_STANDIN_PENDING_MAX];
+  size_t pending_count;
+};
+
+typedef enum { PHASE_REST, PHASE_SILENT, PHASE_BOOTING, PHASE_READY } WakeStandinPhase;
+
+static uint64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static WakeStandinPhase phase_at(WakeStandin *standin, uint64_t now) {
+  if (standin->config.awake)
+    return PHASE_READY;
+  if (!standin->woken)
+    return PHASE_REST;
+  uint64_t elapsed_ms = (now - standin->woken_us) / 1000;
+  if (elapsed_ms < standin->config.silent_ms)
+    return PHASE_SILENT;
+  if (elapsed_ms < standin->config.boot_ms)
+    return PHASE_BOOTING;
+  return PHASE_READY;
+}
+
+/* When the session port opens, UINT64_MAX while the console is not woken yet. */
+static uint64_t services_due_us(WakeStandin *standin) {
+  if (standin->config.awake)
+    return 0;
+  if (!standin->woken)
+    return UINT64_MAX;
+  return standin->woken_us + ((uint64_t)standin->config.boot_ms + standin->config.services_ms) * 1000;
+}
+
+static void count(WakeStandin *standin, uint64_t *stat) {
+  pthread_mutex_lock(&standin->mutex);
+  (*stat)++;
+  pthread_mutex_unlock(&standin->mutex);
+}
+
+/* Hold msg back for reply_delay_us. False if it does not fit. */
+static bool queue_reply(WakeStandin *standin, const struct sockaddr_in *to, const char *msg, int n) {
+  if (standin->pending_count == WAKE_STANDIN_PENDING_MAX || n <= 0 || (size_t)n >= WAKE_STANDIN_MSG_MAX)
+    return false;
+  WakeStandinReply *reply = &standin->pending[standin->pending_count];
+  memcpy(reply->msg, msg, (size_t)n);
+  reply->len = (size_t)n;
+  reply->to = *to;
+  reply->due_us = now_us() + standin->config.reply_delay_us;
+  standin->pending_count++;
+  return true;
+}
+
+static void queue_answer(WakeStandin *standin, bool ready, const struct sockaddr_in *to) {
+  char msg[WAKE_STANDIN_MSG_MAX];
+  const char *system_version = standin->config.system_version;
+  if (!system_version)
+    system_version = standin->config.ps5 ? "07200005" : "09000000";
+  int n = snprintf(msg, sizeof(msg),
+                   "HTTP/1.1 %s\n"
+                   "host-id:0123456789AB\n"
+                   "host-type:%s\n"
+                   "host-name:Standin\n"
+                   "host-request-port:%u\n"
+                   "device-discovery-protocol-version:%s\n"
+                   "system-version:%s\n",
+                   ready ? "200 Ok" : "620 Server Standby", standin->config.ps5 ? "PS5" : "PS4",
+                   (unsigned)standin->session_port, standin->config.ps5 ? "00030010" : "00020020",
+                   system_version);
+  if (queue_reply(standin, to, msg, n))
+    count(standin, ready ? &standin->stats.answers_ready : &standin->stats.answers_standby);
+}
+
+static void handle_wakeup(WakeStandin *standin, const char *msg) {
+  count(standin, &standin->stats.wakeups);
+  const char *cred = strstr(msg, "user-credential:");
+  if (!cred || strtoull(cred + strlen("user-credential:"), NULL, 10) != standin->config.credential) {
+    count(standin, &standin->stats.wakeups_rejected);
+    return;
+  }
+  if (standin->wakeups_seen++ < standin->config.drop_wakeups) {
+    count(standin, &standin->stats.wakeups_dropped);
+    return;
+  }
+  if (!standin->woken && !standin->config.awake) {
+    standin->woken = true;
+    standin->woken_us = now_us();
+  }
+}
+
+static void receive_packet(WakeStandin *standin) {
+  char msg[WAKE_STANDIN_MSG_MAX];
+  struct sockaddr_in from;
+  socklen_t from_len = sizeof(from);
+  ssize_t n = recvfrom(standin->udp_fd, msg, sizeof(msg) - 1, 0, (struct sockaddr *)&from, &from_len);
+  if (n <= 0)
+    return;
+  msg[n] = '\0';
+
+  if (strncmp(msg, "WAKEUP ", 7) == 0) {
+    handle_wakeup(standin, msg);
+    return;
+  }
+  if (strncmp(msg, "PING ", 5) == 0) {
+    msg[1] = 'O';
+    if (queue_reply(standin, &from, msg, (int)n))
+      count(standin, &standin->stats.pings);
+    return;
+  }
+  if (strncmp(msg, "SRCH ", 5) != 0)
+    return;
+  count(standin, &standin->stats.srch);
+  WakeStandinPhase phase = phase_at(standin, now_us());
+  if (phase != PHASE_SILENT)
+    queue_answer(standin, phase == PHASE_READY, &from);
+}
+
+static void send_due(WakeStandin *standin) {
+  uint64_t now = now_us();
+  size_t kept = 0;
+  for (size_t i = 0; i < standin->pending_count; i++) {
+    WakeStandinReply *r = &standin->pending[i];
+    if (r->due_us <= now) {
+      sendto(standin->udp_fd, r->msg, r->len, 0, (struct sockaddr *)&r->to, sizeof(r->to));
+      continue;
+    }
+    if (kept != i)
+      standin->pending[kept] = *r;
+    kept++;
+  }
+  standin->pending_count = kept;
+}
+
+/* Whether the request carries the RP-Version the console requires. */
+static bool rp_version_matches(WakeStandin *standin, const char *request) {
+  if (!standin->config.rp_version)
+    return true;
+  const char *v = strcasestr(request, "\nRP-Version:");
+  if (!v)
+    return false;
+  v += strlen("\nRP-Version:");
+  while (*v == ' ')
+    v++;
+  size_t len = strcspn(v, "\r\n");
+  return len == strlen(standin->config.rp_version) && !strncmp(v, standin->config.rp_version, len);
+}
+
+static void serve_session(WakeStandin *standin) {
+  int fd = accept(standin->session_fd, NULL, NULL);
+  if (fd < 0)
+    return;
+  char request[1024];
+  struct pollfd pfd = {fd, POLLIN, 0};
+  ssize_t n;
+  if (poll(&pfd, 1, 1000) > 0 && (n = recv(fd, request, sizeof(request) - 1, 0)) > 0) {
+    request[n] = '\0';
+    char response[256];
+    int len;
+    bool match = rp_version_matches(standin, request);
+    if (match)
+      len = snprintf(response, sizeof(response),
+                     "HTTP/1.1 200 OK\r\n"
+                     "RP-Nonce: AAAAAAAAAAAAAAAAAAAAAA==\r\n"
+                     "Content-Length: 0\r\n"
+                     "\r\n");
+    else
+      len = snprintf(response, sizeof(response),
+                     "HTTP/1.1 403 Forbidden\r\n"
+                     "RP-Application-Reason: 80108b11\r\n"
+                     "RP-Version: %s\r\n"
+                     "Content-Length: 0\r\n"
+                     "\r\n",
+                     standin->config.rp_version);
+    /* the session port is served in line, holding the answer holds everything else */
+    if (standin->config.reply_delay_us)
+      usleep(standin->config.reply_delay_us);
+    /* counted before answering, the client may read the stats right after */
+    count(standin, match ? &standin->stats.session_requests : &standin->stats.session_mismatches);
+    if (send(fd, response, (size_t)len, MSG_NOSIGNAL) != (ssize_t)len)
+      fprintf(stderr, "wake_standin: failed to answer the session request\n");
+  }
+  close(fd);
+}
+
+static int next_timeout_ms(WakeStandin *standin) {
+  uint64_t next = UINT64_MAX;
+  for (size_t i = 0; i < standin->pending_count; i++) {
+    if (standin->pending[i].due_us < next)
+      next = standin->pending[i].due_us;
+  }
+  if (!standin->session_listening && services_due_us(standin) < next)
+    next = services_due_us(standin);
+  if (next == UINT64_MAX)
+    return -1;
+  uint64_t now = now_us();
+  if (next <= now)
+    return 0;
+  return (int)((next - now + 999) / 1000);
+}
+
+static void *standin_thread(void *arg) {
+  WakeStandin *standin = arg;
+  for (;;) {
+    if (!standin->session_listening && now_us() >= services_due_us(standin)) {
+      if (listen(standin->session_fd, 8) < 0) {
+        fprintf(stderr, "wake_standin: failed to listen on the session port: %s\n", strerror(errno));
+        break;
+      }
+      standin->session_listening = true;
+    }
+
+    struct pollfd pfds[3] = {
+        {standin->udp_fd, POLLIN, 0},
+        {standin->stop_pipe[0], POLLIN, 0},
+        {standin->session_listening ? standin->session_fd : -1, POLLIN, 0},
+    };
+    int r = poll(pfds, 3, next_timeout_ms(standin));
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r < 0 || (pfds[1].revents & POLLIN))
+      break;
+    if (pfds[0].revents & POLLIN)
+      receive_packet(standin);
+    if (pfds[2].revents & POLLIN)
+      serve_session(standin);
+    send_due(standin);
+  }
+  return NULL;
+}
+
+void wake_standin_config_defaults(WakeStandinConfig *config) {
+  memset(config, 0, sizeof(*config));
+  config->credential = 0x1234abcd;
+  config->ps5 = true;
+  config->silent_ms = 300;
+  config->boot_ms = 1500;
+  config->services_ms = 200;
+}
+
+static int bind_loopback(const char *bind_addr, int type, uint16_t *port) {
+  int fd = socket(AF_INET, type, 0);
+  if (fd < 0)
+    return -1;
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(*port);
+  if (inet_pton(AF_INET, bind_addr ? bind_addr : "127.0.0.1", &addr.sin_addr) != 1) {
+    close(fd);
+    return -1;
+  }
+  /* a stand-in restarted on the same port, e.g. after a firmware update */
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  socklen_t addr_len = sizeof(addr);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      getsockname(fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+    close(fd);
+    return -1;
+  }
+  *port = ntohs(addr.sin_port);
+  return fd;
+}
+
+WakeStandin *wake_standin_new(const WakeStandinConfig *config) {
+  WakeStandin *standin = calloc(1, sizeof(*standin));
+  if (!standin)
+    return NULL;
+  standin->config = *config;
+  standin->stop_pipe[0] = standin->stop_pipe[1] = -1;
+  pthread_mutex_init(&standin->mutex, NULL);
+
+  /* A bound TCP socket that is not listening yet refuses connects, like a
+   * console whose session service has not started */
+  standin->discovery_port = config->discovery_port;
+  standin->session_port = config->session_port;
+  standin->udp_fd = bind_loopback(config->bind_addr, SOCK_DGRAM, &standin->discovery_port);
+  standin->session_fd = bind_loopback(config->bind_addr, SOCK_STREAM, &standin->session_port);
+  if (standin->udp_fd < 0 || standin->session_fd < 0 || pipe(standin->stop_pipe) < 0)
+    goto error;
+  /* awake from the start, connects right after this returns must not be refused */
+  if (config->awake) {
+    if (listen(standin->session_fd, 8) < 0)
+      goto error;
+    standin->session_listening = true;
+  }
+  if (pthread_create(&standin->thread, NULL, standin_thread, standin) != 0)
+    goto error;
+  standin->started = true;
+  return standin;
+
+error:
+  wake_standin_free(standin);
+  return NULL;
+}
+
+uint16_t wake_standin_discovery_port(WakeStandin *standin) {
+  return standin->discovery_port;
+}
+
+uint16_t wake_standin_session_port(WakeStandin *standin) {
+  return standin->session_port;
+}
+
+void wake_standin_stats(WakeStandin *standin, WakeStandinStats *stats) {
+  pthread_mutex_lock(&standin->mutex);
+  *stats = standin->stats;
+  pthread_mutex_unlock(&standin->mutex);
+}
+
+void wake_standin_free(WakeStandin *standin) {
+  if (!standin)
+    return;
+  if (standin->stop_pipe[1] >= 0 && write(standin->stop_pipe[1], "x", 1) != 1)
+    fprintf(stderr, "wake_standin: failed to signal stop\n");
+  if (standin->started)
+    pthread_join(standin->thread, NULL);
+  if (standin->udp_fd >= 0)
+    close(standin->udp_fd);
+  if (standin->session_fd >= 0)
+    close(standin->session_fd);
+  if (standin->stop_pipe[0] >= 0)
+    close(standin->stop_pipe[0]);
+  if (standin->stop_pipe[1] >= 0)
+    close(standin->stop_pipe[1]);
+  pthread_mutex_destroy(&standin->mutex);
+  free(standin);
+}
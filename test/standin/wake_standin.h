@@ -0,0 +1,70 @@
+#pragma once
+
+/*
+ * Stand-in console in rest mode for the wake orchestrator checks and
+ * benchmark (Linux only).
+ *
+ * Answers SRCH on a UDP discovery port the way a console does and boots when
+ * it gets a WAKEUP with the right user-credential. From the moment it accepts
+ * the WAKEUP:
+ *
+ *   0 .. silent_ms           no answers at all, the network comes back up
+ *   silent_ms .. boot_ms     620 Server Standby
+ *   boot_ms ..               200 Ok, reporting host-request-port
+ *   boot_ms + services_ms .. the session port accepts connections, before
+ *                            that connects are refused
+ *
+ * Each answer is held back for reply_delay_us. The first drop_wakeups WAKEUP
+ * packets are ignored as if lost on the way. A stand-in created awake skips
+ * all of it and is ready right away.
+ *
+ * The session port answers one HTTP request per connection and closes it,
+ * standing in for the session request. With rp_version set, a request whose
+ * RP-Version differs is answered 403 with the console's RP-Version, the way a
+ * console reports a version mismatch, otherwise with 200.
+ *
+ * "PING <n>" on the discovery port is answered "PONG <n>", held back like
+ * the discovery answers, for a stand-in of the Senkusha round trips.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+  const char *bind_addr; /* default 127.0.0.1 */
+  uint16_t discovery_port; /* 0 for any free one */
+  uint16_t session_port;   /* 0 for any free one */
+  uint64_t credential; /* WAKEUP user-credential to accept */
+  bool ps5;
+  const char *system_version; /* reported by discovery, NULL for a default */
+  const char *rp_version;     /* required in session requests, NULL to accept any */
+  bool awake;
+  uint32_t silent_ms;
+  uint32_t boot_ms;
+  uint32_t services_ms;
+  uint32_t reply_delay_us;
+  unsigned drop_wakeups;
+} WakeStandinConfig;
+
+typedef struct {
+  uint64_t srch;
+  uint64_t wakeups;
+  uint64_t wakeups_dropped;
+  uint64_t wakeups_rejected; /* wrong credential */
+  uint64_t answers_standby;
+  uint64_t answers_ready;
+  uint64_t session_requests;
+  uint64_t session_mismatches; /* answered 403 for the wrong RP-Version */
+  uint64_t pings;
+} WakeStandinStats;
+
+typedef struct wake_standin_t WakeStandin;
+
+void wake_standin_config_defaults(WakeStandinConfig *config);
+
+/* Binds both ports on bind_addr and starts the stand-in thread. Returns NULL on failure. */
+WakeStandin *wake_standin_new(const WakeStandinConfig *config);
+uint16_t wake_standin_discovery_port(WakeStandin *standin);
+uint16_t wake_standin_session_port(WakeStandin *standin);
+void wake_standin_stats(WakeStandin *standin, WakeStandinStats *stats);
+void wake_standin_free(WakeStandin *standin);
@@ -0,0 +1,318 @@
+/*
+ * startup_tests.c — Unit tests for ChiakiStartupProf (lib/src/startupprof.c)
+ * and ChiakiLazyInit (lib/src/lazyinit.c).
+ *
+ * The profiler runs on a fake clock, so nesting and the binary trace are
+ * checked against exact times. The lazy init tests log the order units
+ * initialize in and check it against their dependencies, on the calling
+ * thread and on the background thread. test/bench/startup_bench.c measures
+ * what profiling and scheduling cost.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <chiaki/lazyinit.h>
+#include <chiaki/startupprof.h>
+#include <chiaki/thread.h>
+
+static uint64_t fake_now_us(void *user) {
+  return *(uint64_t *)user;
+}
+
+static ChiakiStartupProf *new_prof(uint64_t *now, size_t capacity) {
+  ChiakiStartupProfConfig config;
+  chiaki_startup_prof_config_defaults(&config);
+  config.capacity = capacity;
+  config.now_us = fake_now_us;
+  config.now_user = now;
+  ChiakiStartupProf *prof = chiaki_startup_prof_new(&config);
+  assert(prof);
+  return prof;
+}
+
+static void test_prof_nesting(void) {
+  uint64_t now = 5000;
+  ChiakiStartupProf *prof = new_prof(&now, 8);
+
+  uint16_t launch = chiaki_startup_prof_begin(prof, "launch");
+  now += 100;
+  CHIAKI_STARTUP_SCOPE(prof, "config") {
+    now += 40;
+    CHIAKI_STARTUP_SCOPE(prof, "token_decrypt")
+      now += 25;
+  }
+  now += 10;
+  uint16_t ui = chiaki_startup_prof_begin(prof, "ui");
+  now += 300;
+  chiaki_startup_prof_end(prof, ui);
+  now += 5;
+  chiaki_startup_prof_mark(prof, "interactive");
+  chiaki_startup_prof_end(prof, launch);
+  // ended twice: the first end counts
+  now += 1000;
+  chiaki_startup_prof_end(prof, ui);
+
+  ChiakiStartupSpan spans[8];
+  assert(chiaki_startup_prof_spans(prof, spans, 8) == 5);
+  assert(!strcmp(spans[0].name, "launch") && spans[0].start_us == 0 && spans[0].duration_us == 480);
+  assert(spans[0].parent == CHIAKI_STARTUP_SPAN_NONE);
+  assert(!strcmp(spans[1].name, "config") && spans[1].start_us == 100 && spans[1].duration_us == 65);
+  assert(spans[1].parent == 0);
+  assert(!strcmp(spans[2].name, "token_decrypt") && spans[2].start_us == 140 && spans[2].duration_us == 25);
+  assert(spans[2].parent == 1);
+  assert(spans[3].duration_us == 300 && spans[3].parent == 0);
+  assert(!strcmp(spans[4].name, "interactive") && spans[4].duration_us == 0 && spans[4].start_us == 480);
+  assert(spans[4].parent == 0);
+  assert(spans[0].lane == CHIAKI_THREAD_ROLE_DEFAULT);
+
+  // Full: dropped, and ending a dropped span is harmless.
+  for (int i = 0; i < 4; i++)
+    chiaki_startup_prof_end(prof, chiaki_startup_prof_begin(prof, "filler"));
+  assert(chiaki_startup_prof_dropped(prof) == 1);
+
+  // Without a profiler every call is a no-op.
+  assert(chiaki_startup_prof_begin(NULL, "x") == CHIAKI_STARTUP_SPAN_NONE);
+  chiaki_startup_prof_end(NULL, 0);
+  CHIAKI_STARTUP_SCOPE(NULL, "x") {}
+  chiaki_startup_prof_free(prof);
+}
+
+static void test_prof_trace(void) {
+  uint64_t now = 0;
+  ChiakiStartupProf *prof = new_prof(&now, 4);
+  uint16_t outer = chiaki_startup_prof_begin(prof, "outer");
+  uint16_t inner = chiaki_startup_prof_begin(prof, "a name longer than the thirty-one characters kept");
+  now += 7;
+  chiaki_startup_prof_end(prof, inner);
+  now += 3;
+  chiaki_startup_prof_begin(prof, "still_open");
+  chiaki_startup_prof_end(prof, outer);
+  chiaki_startup_prof_begin(prof, "x");
+  chiaki_startup_prof_begin(prof, "dropped");
+
+  uint8_t buf[256];
+  size_t size = 8;
+  assert(chiaki_startup_prof_write_trace(prof, buf, &size) == CHIAKI_ERR_BUF_TOO_SMALL);
+  size_t needed = size;
+  assert(needed == CHIAKI_STARTUP_TRACE_HEADER_SIZE + 4 * CHIAKI_STARTUP_TRACE_SPAN_SIZE + 5 + 31 + 10 + 1);
+  size = sizeof(buf);
+  assert(chiaki_startup_prof_write_trace(prof, buf, &size) == CHIAKI_ERR_SUCCESS && size == needed);
+  assert(!memcmp(buf, "CKST", 4) && buf[4] == CHIAKI_STARTUP_TRACE_VERSION && buf[5] == 0);
+  assert(buf[6] == 4 && buf[8] == 1);
+
+  ChiakiStartupSpan spans[4];
+  size_t count = 2;
+  assert(chiaki_startup_trace_read(buf, size, spans, &count, NULL) == CHIAKI_ERR_BUF_TOO_SMALL && count == 4);
+  uint32_t dropped = 0;
+  assert(chiaki_startup_trace_read(buf, size, spans, &count, &dropped) == CHIAKI_ERR_SUCCESS);
+  assert(count == 4 && dropped == 1);
+  assert(!strcmp(spans[0].name, "outer") && spans[0].duration_us == 10);
+  assert(spans[1].parent == 0 && spans[1].start_us == 0 && spans[1].duration_us == 7);
+  assert(strlen(spans[1].name) == CHIAKI_STARTUP_NAME_SIZE - 1);
+  // outer ended before still_open did
+  assert(spans[2].duration_us == CHIAKI_STARTUP_DURATION_OPEN && spans[2].parent == CHIAKI_STARTUP_SPAN_NONE);
+  // An open span encloses whatever began after it.
+  assert(spans[3].parent == 2);
+
+  // Truncated or foreign data is refused.
+  count = 4;
+  assert(chiaki_startup_trace_read(buf, size - 1, spans, &count, NULL) == CHIAKI_ERR_INVALID_DATA);
+  buf[0] = 'X';
+  assert(chiaki_startup_trace_read(buf, size, spans, &count, NULL) == CHIAKI_ERR_INVALID_DATA);
+  chiaki_startup_prof_free(prof);
+}
+
+/* ---- lazy init ------------------------------------------------------------ */
+
+typedef struct {
+  ChiakiMutex mutex;
+  unsigned order[CHIAKI_LAZY_INIT_UNITS_MAX];
+  size_t count;
+  unsigned fini_order[CHIAKI_LAZY_INIT_UNITS_MAX];
+  size_t fini_count;
+  ChiakiThreadRole roles[CHIAKI_LAZY_INIT_UNITS_MAX];
+  ChiakiErrorCode fail[CHIAKI_LAZY_INIT_UNITS_MAX];
+  ChiakiBoolPredCond gate; // held closed by the test, see test_lazy_background
+  bool gate_used[CHIAKI_LAZY_INIT_UNITS_MAX];
+} InitLog;
+
+typedef struct {
+  InitLog *log;
+  unsigned id;
+} UnitUser;
+
+static UnitUser unit_users[CHIAKI_LAZY_INIT_UNITS_MAX];
+
+static ChiakiErrorCode log_init(void *user) {
+  UnitUser *u = user;
+  InitLog *log = u->log;
+  if (log->gate_used[u->id]) {
+    chiaki_bool_pred_cond_lock(&log->gate);
+    chiaki_bool_pred_cond_wait(&log->gate);
+    chiaki_bool_pred_cond_unlock(&log->gate);
+  }
+  chiaki_mutex_lock(&log->mutex);
+  log->order[log->count++] = u->id;
+  log->roles[u->id] = chiaki_thread_current_role();
+  chiaki_mutex_unlock(&log->mutex);
+  return log->fail[u->id];
+}
+
+static void log_fini(void *user) {
+  UnitUser *u = user;
+  u->log->fini_order[u->log->fini_count++] = u->id;
+}
+
+static void log_init_new(InitLog *log) {
+  memset(log, 0, sizeof(*log));
+  assert(chiaki_mutex_init(&log->mutex, false) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_bool_pred_cond_init(&log->gate) == CHIAKI_ERR_SUCCESS);
+}
+
+static void log_fini_free(InitLog *log) {
+  chiaki_bool_pred_cond_fini(&log->gate);
+  chiaki_mutex_fini(&log->mutex);
+}
+
+static unsigned add(ChiakiLazyInit *li, InitLog *log, const char *name, ChiakiLazyInitMode mode, uint32_t deps) {
+  unsigned id = (unsigned)li->units_count;
+  unit_users[id].log = log;
+  unit_users[id].id = id;
+  ChiakiLazyUnit unit = {name, mode, deps, log_init, log_fini, &unit_users[id]};
+  unsigned got;
+  assert(chiaki_lazy_init_add(li, &unit, &got) == CHIAKI_ERR_SUCCESS);
+  assert(got == id);
+  return id;
+}
+
+static size_t position(const InitLog *log, unsigned id) {
+  for (size_t i = 0; i < log->count; i++) {
+    if (log->order[i] == id)
+      return i;
+  }
+  return SIZE_MAX;
+}
+
+static void test_lazy_on_demand(void) {
+  InitLog log;
+  log_init_new(&log);
+  ChiakiLazyInit li;
+  assert(chiaki_lazy_init_init(&li, NULL) == CHIAKI_ERR_SUCCESS);
+
+  unsigned config = add(&li, &log, "config", CHIAKI_LAZY_INIT_ON_DEMAND, 0);
+  unsigned fonts = add(&li, &log, "fonts", CHIAKI_LAZY_INIT_ON_DEMAND, 0);
+  unsigned atlas = add(&li, &log, "atlas", CHIAKI_LAZY_INIT_ON_DEMAND, CHIAKI_LAZY_INIT_DEP(fonts));
+  unsigned ui = add(&li, &log, "ui", CHIAKI_LAZY_INIT_ON_DEMAND,
+                    CHIAKI_LAZY_INIT_DEP(config) | CHIAKI_LAZY_INIT_DEP(atlas));
+  unsigned unused = add(&li, &log, "unused", CHIAKI_LAZY_INIT_ON_DEMAND, 0);
+
+  // Forward dependencies and BACKGROUND on IDLE are refused.
+  ChiakiLazyUnit bad = {"bad", CHIAKI_LAZY_INIT_ON_DEMAND, CHIAKI_LAZY_INIT_DEP(7), log_init, NULL, NULL};
+  assert(chiaki_lazy_init_add(&li, &bad, NULL) == CHIAKI_ERR_INVALID_DATA);
+  bad.init = NULL;
+  bad.deps = 0;
+  assert(chiaki_lazy_init_add(&li, &bad, NULL) == CHIAKI_ERR_INVALID_DATA);
+
+  assert(chiaki_lazy_init_require(&li, ui) == CHIAKI_ERR_SUCCESS);
+  assert(log.count == 4);
+  assert(position(&log, fonts) < position(&log, atlas));
+  assert(position(&log, atlas) < position(&log, ui) && position(&log, config) < position(&log, ui));
+  assert(chiaki_lazy_init_state(&li, unused) == CHIAKI_LAZY_UNIT_PENDING);
+
+  // Exactly once.
+  assert(chiaki_lazy_init_require(&li, atlas) == CHIAKI_ERR_SUCCESS);
+  assert(log.count == 4);
+  assert(chiaki_lazy_init_require(&li, 99) == CHIAKI_ERR_INVALID_DATA);
+
+  // fini in reverse order of init, only what was initialized.
+  chiaki_lazy_init_fini(&li);
+  assert(log.fini_count == 4);
+  for (size_t i = 0; i < 4; i++)
+    assert(log.fini_order[i] == log.order[3 - i]);
+  log_fini_free(&log);
+}
+
+static void test_lazy_failure(void) {
+  InitLog log;
+  log_init_new(&log);
+  ChiakiLazyInit li;
+  assert(chiaki_lazy_init_init(&li, NULL) == CHIAKI_ERR_SUCCESS);
+  unsigned net = add(&li, &log, "net", CHIAKI_LAZY_INIT_ON_DEMAND, 0);
+  unsigned dns = add(&li, &log, "dns", CHIAKI_LAZY_INIT_ON_DEMAND, CHIAKI_LAZY_INIT_DEP(net));
+  unsigned psn = add(&li, &log, "psn", CHIAKI_LAZY_INIT_ON_DEMAND, CHIAKI_LAZY_INIT_DEP(dns));
+  log.fail[net] = CHIAKI_ERR_NETWORK;
+
+  assert(chiaki_lazy_init_require(&li, psn) == CHIAKI_ERR_NETWORK);
+  assert(chiaki_lazy_init_state(&li, psn) == CHIAKI_LAZY_UNIT_FAILED);
+  assert(chiaki_lazy_init_state(&li, dns) == CHIAKI_LAZY_UNIT_FAILED);
+  // Neither dependent ran, and a failed unit is not retried.
+  assert(log.count == 1);
+  assert(chiaki_lazy_init_require(&li, dns) == CHIAKI_ERR_NETWORK && log.count == 1);
+  chiaki_lazy_init_fini(&li);
+  assert(log.fini_count == 0);
+  log_fini_free(&log);
+}
+
+static void test_lazy_background(void) {
+  InitLog log;
+  log_init_new(&log);
+  uint64_t now = 0;
+  ChiakiStartupProf *prof = new_prof(&now, 16);
+  ChiakiLazyInit li;
+  assert(chiaki_lazy_init_init(&li, prof) == CHIAKI_ERR_SUCCESS);
+
+  unsigned base = add(&li, &log, "base", CHIAKI_LAZY_INIT_ON_DEMAND, 0);
+  unsigned dns = add(&li, &log, "dns", CHIAKI_LAZY_INIT_BACKGROUND, CHIAKI_LAZY_INIT_DEP(base));
+  unsigned slow = add(&li, &log, "slow", CHIAKI_LAZY_INIT_BACKGROUND, 0);
+  unsigned idle = add(&li, &log, "psn_hosts", CHIAKI_LAZY_INIT_IDLE, CHIAKI_LAZY_INIT_DEP(slow));
+  unsigned later = add(&li, &log, "later", CHIAKI_LAZY_INIT_IDLE, 0);
+  unsigned demand = add(&li, &log, "demand", CHIAKI_LAZY_INIT_ON_DEMAND, 0);
+  ChiakiLazyUnit bad = {"bad", CHIAKI_LAZY_INIT_BACKGROUND, CHIAKI_LAZY_INIT_DEP(idle), log_init, NULL, NULL};
+  assert(chiaki_lazy_init_add(&li, &bad, NULL) == CHIAKI_ERR_INVALID_DATA);
+
+  // "slow" blocks until the gate opens, so the IDLE unit below has to wait for it.
+  log.gate_used[slow] = true;
+  assert(chiaki_lazy_init_start(&li) == CHIAKI_ERR_SUCCESS);
+  while (chiaki_lazy_init_state(&li, slow) != CHIAKI_LAZY_UNIT_RUNNING)
+    ;
+  assert(chiaki_lazy_init_state(&li, dns) == CHIAKI_LAZY_UNIT_DONE);
+  assert(position(&log, base) < position(&log, dns));
+  assert(log.roles[base] == CHIAKI_THREAD_ROLE_HOUSEKEEPING);
+
+  chiaki_bool_pred_cond_broadcast(&log.gate);
+  // One IDLE unit per call, on this thread, after its background dependency.
+  assert(chiaki_lazy_init_run_idle(&li));
+  assert(chiaki_lazy_init_state(&li, idle) == CHIAKI_LAZY_UNIT_DONE);
+  assert(chiaki_lazy_init_state(&li, later) == CHIAKI_LAZY_UNIT_PENDING);
+  assert(position(&log, slow) < position(&log, idle));
+  assert(log.roles[idle] == CHIAKI_THREAD_ROLE_DEFAULT);
+  assert(chiaki_lazy_init_run_idle(&li));
+  assert(!chiaki_lazy_init_run_idle(&li));
+
+  chiaki_lazy_init_wait(&li);
+  assert(chiaki_lazy_init_state(&li, demand) == CHIAKI_LAZY_UNIT_PENDING);
+
+  // One span per init, on the lane of the thread that ran it.
+  ChiakiStartupSpan spans[16];
+  size_t count = chiaki_startup_prof_spans(prof, spans, 16);
+  assert(count == 5);
+  for (size_t i = 0; i < count; i++) {
+    bool background = !strcmp(spans[i].name, "base") || !strcmp(spans[i].name, "dns") ||
+                      !strcmp(spans[i].name, "slow");
+    assert(spans[i].lane == (background ? CHIAKI_THREAD_ROLE_HOUSEKEEPING : CHIAKI_THREAD_ROLE_DEFAULT));
+  }
+  chiaki_lazy_init_fini(&li);
+  chiaki_startup_prof_free(prof);
+  log_fini_free(&log);
+}
+
+void run_startup_tests(void) {
+  test_prof_nesting();
+  test_prof_trace();
+  test_lazy_on_demand();
+  test_lazy_failure();
+  test_lazy_background();
+}
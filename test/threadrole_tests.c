@@ -0,0 +1,134 @@
+/*
+ * threadrole_tests.c — Unit tests for the chiaki-lib thread role registry
+ * (chiaki_thread_create_role / chiaki_thread_apply_role in lib/src/thread.c).
+ *
+ * The policy table and role bookkeeping are checked on every platform.
+ * Readback of the applied nice value and affinity is Linux-only.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <chiaki/thread.h>
+
+typedef struct {
+  ChiakiThreadRole role_seen;
+  ChiakiThreadSchedInfo info;
+  ChiakiErrorCode info_err;
+} RoleProbe;
+
+static void *role_probe_thread(void *user) {
+  RoleProbe *probe = user;
+  probe->role_seen = chiaki_thread_current_role();
+  probe->info_err = chiaki_thread_sched_info_self(&probe->info);
+  return NULL;
+}
+
+static void test_policy_table_defaults(void) {
+  ChiakiThreadPolicyTable table;
+  chiaki_thread_policy_table_init(&table);
+  for (int i = 0; i < CHIAKI_THREAD_ROLE_COUNT; i++) {
+    assert(table.roles[i].priority == CHIAKI_THREAD_PRIORITY_INHERIT);
+    assert(table.roles[i].core_mask == CHIAKI_THREAD_CORE_MASK_ANY);
+    assert(table.roles[i].stack_size == 0);
+  }
+
+  chiaki_thread_policy_table_set(NULL);
+  ChiakiThreadPolicy policy;
+  chiaki_thread_policy_get(CHIAKI_THREAD_ROLE_NETWORK, &policy);
+  assert(policy.priority == CHIAKI_THREAD_PRIORITY_INHERIT);
+
+  // Out of range roles fall back to the defaults instead of reading past the table.
+  chiaki_thread_policy_get((ChiakiThreadRole)CHIAKI_THREAD_ROLE_COUNT, &policy);
+  assert(policy.core_mask == CHIAKI_THREAD_CORE_MASK_ANY);
+}
+
+static void test_policy_table_set_copies(void) {
+  ChiakiThreadPolicyTable table;
+  chiaki_thread_policy_table_init(&table);
+  table.roles[CHIAKI_THREAD_ROLE_AUDIO].priority = 7;
+  table.roles[CHIAKI_THREAD_ROLE_AUDIO].core_mask = 1u << 2;
+  chiaki_thread_policy_table_set(&table);
+
+  // Later edits of the caller's table must not leak into the installed one.
+  table.roles[CHIAKI_THREAD_ROLE_AUDIO].priority = 9;
+  ChiakiThreadPolicy policy;
+  chiaki_thread_policy_get(CHIAKI_THREAD_ROLE_AUDIO, &policy);
+  assert(policy.priority == 7);
+  assert(policy.core_mask == (1u << 2));
+
+  chiaki_thread_policy_table_set(NULL);
+}
+
+static void test_role_strings(void) {
+  assert(strcmp(chiaki_thread_role_string(CHIAKI_THREAD_ROLE_NETWORK), "network") == 0);
+  assert(strcmp(chiaki_thread_role_string(CHIAKI_THREAD_ROLE_HOUSEKEEPING), "housekeeping") == 0);
+  assert(strcmp(chiaki_thread_role_string((ChiakiThreadRole)99), "unknown") == 0);
+}
+
+static void test_create_role_reports_role(void) {
+  chiaki_thread_policy_table_set(NULL);
+  RoleProbe probe = {0};
+  ChiakiThread thread;
+  assert(chiaki_thread_create_role(&thread, CHIAKI_THREAD_ROLE_CRYPTO, role_probe_thread, &probe) ==
+         CHIAKI_ERR_SUCCESS);
+  assert(chiaki_thread_join(&thread, NULL) == CHIAKI_ERR_SUCCESS);
+  assert(probe.role_seen == CHIAKI_THREAD_ROLE_CRYPTO);
+  assert(probe.info_err == CHIAKI_ERR_SUCCESS);
+  assert(probe.info.role == CHIAKI_THREAD_ROLE_CRYPTO);
+
+  // Plain chiaki_thread_create() threads carry the default role.
+  memset(&probe, 0, sizeof(probe));
+  probe.role_seen = CHIAKI_THREAD_ROLE_AUDIO;
+  assert(chiaki_thread_create(&thread, role_probe_thread, &probe) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_thread_join(&thread, NULL) == CHIAKI_ERR_SUCCESS);
+  assert(probe.role_seen == CHIAKI_THREAD_ROLE_DEFAULT);
+}
+
+#if defined(__linux__) && !defined(__PSVITA__)
+static void test_linux_policy_applied(void) {
+  ChiakiThreadSchedInfo self;
+  assert(chiaki_thread_sched_info_self(&self) == CHIAKI_ERR_SUCCESS);
+  // Pin to the lowest core we are currently allowed on so the test works in restricted cpusets.
+  uint32_t first_core = 0;
+  if (self.core_mask) {
+    while (!(self.core_mask & (1u << first_core)))
+      first_core++;
+  }
+
+  ChiakiThreadPolicyTable table;
+  chiaki_thread_policy_table_init(&table);
+  // Raising the nice value never needs privileges.
+  int32_t nice_target = self.priority == CHIAKI_THREAD_PRIORITY_INHERIT ? 5 : self.priority + 5;
+  if (nice_target > 19)
+    nice_target = 19;
+  table.roles[CHIAKI_THREAD_ROLE_HOUSEKEEPING].priority = nice_target;
+  table.roles[CHIAKI_THREAD_ROLE_HOUSEKEEPING].core_mask = 1u << first_core;
+  table.roles[CHIAKI_THREAD_ROLE_HOUSEKEEPING].stack_size = 256 * 1024;
+  chiaki_thread_policy_table_set(&table);
+
+  RoleProbe probe = {0};
+  ChiakiThread thread;
+  assert(chiaki_thread_create_role(&thread, CHIAKI_THREAD_ROLE_HOUSEKEEPING, role_probe_thread, &probe) ==
+         CHIAKI_ERR_SUCCESS);
+  assert(chiaki_thread_join(&thread, NULL) == CHIAKI_ERR_SUCCESS);
+  assert(probe.info_err == CHIAKI_ERR_SUCCESS);
+  assert(probe.info.priority == nice_target);
+  assert(probe.info.core_mask == (1u << first_core));
+  assert(probe.info.cpu == (int32_t)first_core);
+
+  chiaki_thread_policy_table_set(NULL);
+}
+#endif
+
+void run_threadrole_tests(void) {
+  test_policy_table_defaults();
+  test_policy_table_set_copies();
+  test_role_strings();
+  test_create_role_reports_role();
+#if defined(__linux__) && !defined(__PSVITA__)
+  test_linux_policy_applied();
+#endif
+}
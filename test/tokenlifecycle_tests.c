@@ -0,0 +1,543 @@
+/*
+ * tokenlifecycle_tests.c — Unit tests for ChiakiTokenLifecycle
+ * (lib/src/tokenlifecycle.c).
+ *
+ * A fake token endpoint hands out numbered tokens and the lifecycle runs on
+ * fake monotonic and wall clocks, so scheduled refreshes, retry backoff and
+ * clock skew are stepped through without sleeping. Refreshes can be held at a
+ * gate to check that concurrent callers share one refresh.
+ * test/standin/oauth_bench.c repeats expiry, failure and skew against an
+ * HTTPS token endpoint on loopback.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <chiaki/thread.h>
+#include <chiaki/tokenlifecycle.h>
+
+#define WAIT_MS 2000
+#define START_UNIX 1700000000ULL
+
+static void sleep_ms(uint32_t ms) {
+#ifdef _WIN32
+  Sleep(ms);
+#else
+  struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+#endif
+}
+
+typedef struct {
+  ChiakiMutex mutex;
+  ChiakiCond cond;
+  uint64_t now_ms;
+  uint64_t now_unix;
+  int64_t server_skew_sec; /* server clock - now_unix, 0: no Date header */
+  uint32_t random;
+  uint32_t expires_in_sec;
+  bool rotate;             /* hand out a new refresh token with every refresh */
+  ChiakiErrorCode fail;    /* returned for every refresh when set */
+  bool gate_closed;
+  int calls;
+  int in_flight;
+  int issued;
+  char last_refresh_token[32]; /* what the last refresh presented */
+
+  int persists;
+  char persisted_access[32];
+  char persisted_refresh[32];
+  uint64_t persisted_expires_at;
+} FakeOAuth;
+
+static ChiakiErrorCode fake_refresh(void *user, const char *refresh_token, ChiakiTokenGrant *grant) {
+  FakeOAuth *oauth = user;
+  chiaki_mutex_lock(&oauth->mutex);
+  oauth->calls++;
+  oauth->in_flight++;
+  snprintf(oauth->last_refresh_token, sizeof(oauth->last_refresh_token), "%s", refresh_token);
+  chiaki_cond_broadcast(&oauth->cond);
+  while (oauth->gate_closed)
+    chiaki_cond_wait(&oauth->cond, &oauth->mutex);
+
+  ChiakiErrorCode err = oauth->fail;
+  if (err == CHIAKI_ERR_SUCCESS) {
+    char token[32];
+    oauth->issued++;
+    snprintf(token, sizeof(token), "access-%d", oauth->issued);
+    grant->access_token = strdup(token);
+    if (oauth->rotate) {
+      snprintf(token, sizeof(token), "refresh-%d", oauth->issued);
+      grant->refresh_token = strdup(token);
+    }
+    grant->expires_in_sec = oauth->expires_in_sec;
+    if (oauth->server_skew_sec)
+      grant->server_time_unix = (uint64_t)((int64_t)oauth->now_unix + oauth->server_skew_sec);
+  }
+  oauth->in_flight--;
+  chiaki_cond_broadcast(&oauth->cond);
+  chiaki_mutex_unlock(&oauth->mutex);
+  return err;
+}
+
+static void fake_persist(void *user, const ChiakiTokenSet *tokens) {
+  FakeOAuth *oauth = user;
+  chiaki_mutex_lock(&oauth->mutex);
+  oauth->persists++;
+  snprintf(oauth->persisted_access, sizeof(oauth->persisted_access), "%s", tokens->access_token);
+  snprintf(oauth->persisted_refresh, sizeof(oauth->persisted_refresh), "%s", tokens->refresh_token);
+  oauth->persisted_expires_at = tokens->expires_at_unix;
+  chiaki_mutex_unlock(&oauth->mutex);
+}
+
+static uint64_t fake_now_ms(void *user) {
+  FakeOAuth *oauth = user;
+  chiaki_mutex_lock(&oauth->mutex);
+  uint64_t now = oauth->now_ms;
+  chiaki_mutex_unlock(&oauth->mutex);
+  return now;
+}
+
+static uint64_t fake_now_unix(void *user) {
+  FakeOAuth *oauth = user;
+  chiaki_mutex_lock(&oauth->mutex);
+  uint64_t now = oauth->now_unix;
+  chiaki_mutex_unlock(&oauth->mutex);
+  return now;
+}
+
+static uint32_t fake_random(void *user) {
+  FakeOAuth *oauth = user;
+  return oauth->random;
+}
+
+static void fake_init(FakeOAuth *oauth) {
+  memset(oauth, 0, sizeof(*oauth));
+  assert(chiaki_mutex_init(&oauth->mutex, false) == CHIAKI_ERR_SUCCESS);
+  assert(chiaki_cond_init(&oauth->cond, &oauth->mutex) == CHIAKI_ERR_SUCCESS);
+  oauth->now_ms = 1000000;
+  oauth->now_unix = START_UNIX;
+  oauth->expires_in_sec = 3600;
+  oauth->rotate = true;
+}
+
+static void fake_fini(FakeOAuth *oauth) {
+  chiaki_cond_fini(&oauth->cond);
+  chiaki_mutex_fini(&oauth->mutex);
+}
+
+/* Both clocks move together unless a test skews the wall clock on purpose. */
+static void fake_advance(FakeOAuth *oauth, uint64_t ms) {
+  chiaki_mutex_lock(&oauth->mutex);
+  oauth->now_ms += ms;
+  oauth->now_unix += ms / 1000;
+  chiaki_mutex_unlock(&oauth->mutex);
+}
+
+static void fake_set_gate(FakeOAuth *oauth, bool closed) {
+  chiaki_mutex_lock(&oauth->mutex);
+  oauth->gate_closed = closed;
+  chiaki_cond_broadcast(&oauth->cond);
+  chiaki_mutex_unlock(&oauth->mutex);
+}
+
+static void fake_set_fail(FakeOAuth *oauth, ChiakiErrorCode fail) {
+  chiaki_mutex_lock(&oauth->mutex);
+  oauth->fail = fail;
+  chiaki_mutex_unlock(&oauth->mutex);
+}
+
+static void fake_wait_in_flight(FakeOAuth *oauth, int n) {
+  chiaki_mutex_lock(&oauth->mutex);
+  while (oauth->in_flight < n)
+    assert(chiaki_cond_timedwait(&oauth->cond, &oauth->mutex, WAIT_MS) == CHIAKI_ERR_SUCCESS);
+  chiaki_mutex_unlock(&oauth->mutex);
+}
+
+static int fake_calls(FakeOAuth *oauth) {
+  chiaki_mutex_lock(&oauth->mutex);
+  int n = oauth->calls;
+  chiaki_mutex_unlock(&oauth->mutex);
+  return n;
+}
+
+static ChiakiTokenLifecycle *lifecycle_new(FakeOAuth *oauth) {
+  ChiakiTokenLifecycleConfig config;
+  chiaki_token_lifecycle_config_defaults(&config);
+  config.refresh = fake_refresh;
+  config.refresh_user = oauth;
+  config.persist = fake_persist;
+  config.persist_user = oauth;
+  config.now_ms = fake_now_ms;
+  config.now_unix = fake_now_unix;
+  config.random = fake_random;
+  config.clock_user = oauth;
+  ChiakiTokenLifecycle *lifecycle = chiaki_token_lifecycle_new(&config);
+  assert(lifecycle);
+  return lifecycle;
+}
+
+/* Wait until the lifecycle has finished n refresh attempts, failed or not. */
+static void lifecycle_wait_attempts(ChiakiTokenLifecycle *lifecycle, uint64_t n) {
+  ChiakiTokenLifecycleStats stats;
+  for (int i = 0; i < WAIT_MS; i++) {
+    chiaki_token_lifecycle_stats(lifecycle, &stats);
+    if (stats.refreshes + stats.failures + stats.dropped >= n)
+      return;
+    sleep_ms(1);
+  }
+  assert(!"refresh did not complete");
+}
+
+static void lifecycle_wait_persists(FakeOAuth *oauth, int n) {
+  for (int i = 0; i < WAIT_MS; i++) {
+    chiaki_mutex_lock(&oauth->mutex);
+    int persists = oauth->persists;
+    chiaki_mutex_unlock(&oauth->mutex);
+    if (persists >= n)
+      return;
+    sleep_ms(1);
+  }
+  assert(!"tokens were not persisted");
+}
+
+static void assert_access_token(ChiakiTokenLifecycle *lifecycle, const char *expected) {
+  char *token = NULL;
+  assert(chiaki_token_lifecycle_access_token(lifecycle, &token) == CHIAKI_ERR_SUCCESS);
+  assert(!strcmp(token, expected));
+  free(token);
+}
+
+static void test_schedule_jitter(void) {
+  FakeOAuth oauth;
+  fake_init(&oauth);
+  oauth.random = 60000;
+  ChiakiTokenLifecycle *lifecycle = lifecycle_new(&oauth);
+  assert(chiaki_token_lifecycle_set(lifecycle, "access-0", "refresh-0", START_UNIX + 3600) ==
+         CHIAKI_ERR_SUCCESS);
+
+  /* 5 min margin and 60 s of the 2 min jitter ahead of the hour */
+  ChiakiTokenStatus status;
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.freshness == CHIAKI_TOKEN_FRESH);
+  assert(status.valid_ms == 3600000);
+  assert(status.refresh_scheduled);
+  assert(status.refresh_in_ms == 3600000 - 300000 - 60000);
+
+  fake_advance(&oauth, 3600000 - 300000 - 60000 - 1000);
+  chiaki_token_lifecycle_kick(lifecycle);
+  sleep_ms(20);
+  assert(fake_calls(&oauth) == 0);
+
+  /* inside the margin the token is due, but still served as is */
+  fake_advance(&oauth, 61000);
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.freshness == CHIAKI_TOKEN_REFRESH_DUE);
+
+  chiaki_token_lifecycle_kick(lifecycle);
+  lifecycle_wait_attempts(lifecycle, 1);
+  lifecycle_wait_persists(&oauth, 1);
+  assert(fake_calls(&oauth) == 1);
+  assert(!strcmp(oauth.last_refresh_token, "refresh-0"));
+  assert_access_token(lifecycle, "access-1");
+  assert(!strcmp(oauth.persisted_access, "access-1"));
+  assert(!strcmp(oauth.persisted_refresh, "refresh-1"));
+  assert(oauth.persisted_expires_at == START_UNIX + 3300 + 3600);
+
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.freshness == CHIAKI_TOKEN_FRESH);
+  assert(status.refresh_in_ms == 3600000 - 300000 - 60000);
+
+  ChiakiTokenLifecycleStats stats;
+  chiaki_token_lifecycle_stats(lifecycle, &stats);
+  assert(stats.scheduled == 1);
+  assert(stats.on_demand == 0);
+  assert(stats.persists == 1);
+  chiaki_token_lifecycle_free(lifecycle);
+
+  /* other draws spread the refresh over the jitter window */
+  oauth.random = 0;
+  lifecycle = lifecycle_new(&oauth);
+  chiaki_token_lifecycle_set(lifecycle, "a", "r", oauth.now_unix + 3600);
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.refresh_in_ms == 3600000 - 300000);
+  oauth.random = 120000;
+  chiaki_token_lifecycle_set(lifecycle, "a", "r", oauth.now_unix + 3600);
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.refresh_in_ms == 3600000 - 300000 - 120000);
+
+  /* a short-lived token: margin is half, jitter at most a quarter of its lifetime */
+  oauth.random = 1000000;
+  chiaki_token_lifecycle_set(lifecycle, "a", "r", oauth.now_unix + 60);
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.refresh_in_ms == 60000 - 30000 - 1000000 % 15001);
+  chiaki_token_lifecycle_free(lifecycle);
+  fake_fini(&oauth);
+}
+
+typedef struct {
+  ChiakiTokenLifecycle *lifecycle;
+  ChiakiErrorCode err;
+} EnsureArgs;
+
+static void *ensure_thread_func(void *user) {
+  EnsureArgs *args = user;
+  args->err = chiaki_token_lifecycle_ensure_fresh(args->lifecycle, 60, WAIT_MS);
+  return NULL;
+}
+
+static void test_single_flight(void) {
+  FakeOAuth oauth;
+  fake_init(&oauth);
+  ChiakiTokenLifecycle *lifecycle = lifecycle_new(&oauth);
+
+  /* a fresh token needs no refresh */
+  chiaki_token_lifecycle_set(lifecycle, "access-0", "refresh-0", START_UNIX + 3600);
+  assert(chiaki_token_lifecycle_ensure_fresh(lifecycle, 60, WAIT_MS) == CHIAKI_ERR_SUCCESS);
+  assert(fake_calls(&oauth) == 0);
+
+  /* an expired one is refreshed right away, connects join that refresh */
+  fake_set_gate(&oauth, true);
+  chiaki_token_lifecycle_set(lifecycle, "access-0", "refresh-0", START_UNIX - 10);
+  fake_wait_in_flight(&oauth, 1);
+  ChiakiTokenStatus status;
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.freshness == CHIAKI_TOKEN_EXPIRED);
+  assert(status.refreshing);
+
+  ChiakiThread threads[4];
+  EnsureArgs args[4];
+  for (int i = 0; i < 4; i++) {
+    args[i].lifecycle = lifecycle;
+    args[i].err = CHIAKI_ERR_UNKNOWN;
+    assert(chiaki_thread_create(&threads[i], ensure_thread_func, &args[i]) == CHIAKI_ERR_SUCCESS);
+  }
+  ChiakiTokenLifecycleStats stats;
+  for (int i = 0; i < WAIT_MS; i++) {
+    chiaki_token_lifecycle_stats(lifecycle, &stats);
+    if (stats.waits == 4)
+      break;
+    sleep_ms(1);
+  }
+  fake_set_gate(&oauth, false);
+  for (int i = 0; i < 4; i++) {
+    assert(chiaki_thread_join(&threads[i], NULL) == CHIAKI_ERR_SUCCESS);
+    assert(args[i].err == CHIAKI_ERR_SUCCESS);
+  }
+  assert(fake_calls(&oauth) == 1);
+  assert_access_token(lifecycle, "access-1");
+  chiaki_token_lifecycle_stats(lifecycle, &stats);
+  assert(stats.waits == 4);
+  assert(stats.coalesced == 4);
+  assert(stats.scheduled == 1);
+
+  /* a forced refresh always goes to the endpoint */
+  assert(chiaki_token_lifecycle_refresh(lifecycle, WAIT_MS) == CHIAKI_ERR_SUCCESS);
+  assert(fake_calls(&oauth) == 2);
+  assert(!strcmp(oauth.last_refresh_token, "refresh-1"));
+  assert_access_token(lifecycle, "access-2");
+
+  /* a slow endpoint times the caller out, not the refresh */
+  fake_set_gate(&oauth, true);
+  assert(chiaki_token_lifecycle_refresh(lifecycle, 20) == CHIAKI_ERR_TIMEOUT);
+  fake_set_gate(&oauth, false);
+  lifecycle_wait_attempts(lifecycle, 3);
+  assert_access_token(lifecycle, "access-3");
+
+  chiaki_token_lifecycle_clear(lifecycle);
+  assert(chiaki_token_lifecycle_ensure_fresh(lifecycle, 60, WAIT_MS) == CHIAKI_ERR_UNINITIALIZED);
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.freshness == CHIAKI_TOKEN_NONE);
+  assert(!status.refresh_scheduled);
+  chiaki_token_lifecycle_free(lifecycle);
+  fake_fini(&oauth);
+}
+
+static void test_refresh_failure(void) {
+  FakeOAuth oauth;
+  fake_init(&oauth);
+  ChiakiTokenLifecycle *lifecycle = lifecycle_new(&oauth);
+  fake_set_fail(&oauth, CHIAKI_ERR_NETWORK);
+  chiaki_token_lifecycle_set(lifecycle, "access-0", "refresh-0", START_UNIX - 10);
+  lifecycle_wait_attempts(lifecycle, 1);
+
+  /* retried after 5 s, then 10 s */
+  ChiakiTokenStatus status;
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.freshness == CHIAKI_TOKEN_EXPIRED);
+  assert(status.failures == 1);
+  assert(status.last_err == CHIAKI_ERR_NETWORK);
+  assert(status.refresh_in_ms == 5000);
+  fake_advance(&oauth, 5000);
+  chiaki_token_lifecycle_kick(lifecycle);
+  lifecycle_wait_attempts(lifecycle, 2);
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.failures == 2);
+  assert(status.refresh_in_ms == 10000);
+
+  /* a connect does not wait out the backoff */
+  assert(chiaki_token_lifecycle_ensure_fresh(lifecycle, 60, WAIT_MS) == CHIAKI_ERR_NETWORK);
+  assert(fake_calls(&oauth) == 3);
+
+  fake_set_fail(&oauth, CHIAKI_ERR_SUCCESS);
+  fake_advance(&oauth, 40000);
+  chiaki_token_lifecycle_kick(lifecycle);
+  lifecycle_wait_attempts(lifecycle, 4);
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.freshness == CHIAKI_TOKEN_FRESH);
+  assert(status.failures == 0);
+  assert_access_token(lifecycle, "access-1");
+
+  /* the endpoint turns the refresh token down: no more retries until a new login */
+  fake_set_fail(&oauth, CHIAKI_ERR_HTTP_NONOK);
+  assert(chiaki_token_lifecycle_refresh(lifecycle, WAIT_MS) == CHIAKI_ERR_HTTP_NONOK);
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.freshness == CHIAKI_TOKEN_FRESH); /* the access token is still good */
+  assert(!status.refresh_scheduled);
+  fake_advance(&oauth, 3600000);
+  chiaki_token_lifecycle_kick(lifecycle);
+  sleep_ms(20);
+  assert(fake_calls(&oauth) == 5);
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.freshness == CHIAKI_TOKEN_REJECTED);
+  assert(chiaki_token_lifecycle_ensure_fresh(lifecycle, 60, WAIT_MS) == CHIAKI_ERR_HTTP_NONOK);
+  assert(fake_calls(&oauth) == 5);
+
+  fake_set_fail(&oauth, CHIAKI_ERR_SUCCESS);
+  chiaki_token_lifecycle_set(lifecycle, "access-login", "refresh-login", oauth.now_unix + 3600);
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.freshness == CHIAKI_TOKEN_FRESH);
+  assert(status.refresh_scheduled);
+
+  ChiakiTokenLifecycleStats stats;
+  chiaki_token_lifecycle_stats(lifecycle, &stats);
+  assert(stats.failures == 4);
+  assert(stats.rejections == 1);
+  assert(stats.refreshes == 1);
+  chiaki_token_lifecycle_free(lifecycle);
+  fake_fini(&oauth);
+}
+
+static void test_hold(void) {
+  FakeOAuth oauth;
+  fake_init(&oauth);
+  ChiakiTokenLifecycle *lifecycle = lifecycle_new(&oauth);
+  chiaki_token_lifecycle_hold(lifecycle, true);
+  chiaki_token_lifecycle_set(lifecycle, "access-0", "refresh-0", START_UNIX + 3600);
+  fake_advance(&oauth, 3500000);
+  chiaki_token_lifecycle_kick(lifecycle);
+  sleep_ms(20);
+  assert(fake_calls(&oauth) == 0);
+
+  /* a caller that needs the token still gets it refreshed */
+  assert(chiaki_token_lifecycle_ensure_fresh(lifecycle, 600, WAIT_MS) == CHIAKI_ERR_SUCCESS);
+  assert(fake_calls(&oauth) == 1);
+
+  fake_advance(&oauth, 3500000);
+  chiaki_token_lifecycle_hold(lifecycle, false);
+  lifecycle_wait_attempts(lifecycle, 2);
+  assert(fake_calls(&oauth) == 2);
+  chiaki_token_lifecycle_free(lifecycle);
+  fake_fini(&oauth);
+}
+
+static void test_clock_skew(void) {
+  FakeOAuth oauth;
+  fake_init(&oauth);
+  oauth.server_skew_sec = 7200;
+  oauth.expires_in_sec = 600;
+  ChiakiTokenLifecycle *lifecycle = lifecycle_new(&oauth);
+  chiaki_token_lifecycle_set(lifecycle, NULL, "refresh-0", 0);
+  lifecycle_wait_attempts(lifecycle, 1);
+  lifecycle_wait_persists(&oauth, 1);
+
+  /* expires_in is relative: a server two hours ahead changes nothing */
+  ChiakiTokenStatus status;
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.clock_skew_sec == 7200);
+  assert(status.freshness == CHIAKI_TOKEN_FRESH);
+  assert(status.valid_ms == 600000);
+  assert(oauth.persisted_expires_at == START_UNIX + 600);
+
+  /* the wall clock jumps a day (RTC sync); expiry follows the monotonic clock */
+  chiaki_mutex_lock(&oauth.mutex);
+  oauth.now_unix += 86400;
+  chiaki_mutex_unlock(&oauth.mutex);
+  fake_advance(&oauth, 1000);
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.freshness == CHIAKI_TOKEN_FRESH);
+  assert(status.valid_ms == 599000);
+  assert(chiaki_token_lifecycle_ensure_fresh(lifecycle, 60, WAIT_MS) == CHIAKI_ERR_SUCCESS);
+  assert(fake_calls(&oauth) == 1);
+
+  /* tokens loaded while the wall clock is unset are refreshed right away */
+  chiaki_mutex_lock(&oauth.mutex);
+  oauth.now_unix = 0;
+  chiaki_mutex_unlock(&oauth.mutex);
+  chiaki_token_lifecycle_set(lifecycle, "access-saved", "refresh-saved", START_UNIX + 3600);
+  lifecycle_wait_attempts(lifecycle, 2);
+  assert(!strcmp(oauth.last_refresh_token, "refresh-saved"));
+
+  /* a saved expiry that trusted a slow clock: the server rejects the token early */
+  chiaki_mutex_lock(&oauth.mutex);
+  oauth.now_unix = START_UNIX;
+  chiaki_mutex_unlock(&oauth.mutex);
+  chiaki_token_lifecycle_set(lifecycle, "access-saved", "refresh-saved", START_UNIX + 3000);
+  chiaki_token_lifecycle_invalidate(lifecycle);
+  lifecycle_wait_attempts(lifecycle, 3);
+  assert(fake_calls(&oauth) == 3);
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.freshness == CHIAKI_TOKEN_FRESH);
+  assert(status.valid_ms == 600000);
+  chiaki_token_lifecycle_free(lifecycle);
+  fake_fini(&oauth);
+}
+
+static void test_replaced_during_refresh(void) {
+  FakeOAuth oauth;
+  fake_init(&oauth);
+  ChiakiTokenLifecycle *lifecycle = lifecycle_new(&oauth);
+  fake_set_gate(&oauth, true);
+  chiaki_token_lifecycle_set(lifecycle, "access-0", "refresh-0", START_UNIX - 10);
+  fake_wait_in_flight(&oauth, 1);
+
+  /* a new login lands while the old tokens are being refreshed */
+  chiaki_token_lifecycle_set(lifecycle, "access-login", "refresh-login", START_UNIX + 3600);
+  fake_set_gate(&oauth, false);
+  lifecycle_wait_attempts(lifecycle, 1);
+  assert_access_token(lifecycle, "access-login");
+  sleep_ms(20);
+  assert(oauth.persists == 0);
+
+  ChiakiTokenStatus status;
+  chiaki_token_lifecycle_status(lifecycle, &status);
+  assert(status.freshness == CHIAKI_TOKEN_FRESH);
+  assert(status.valid_ms == 3600000);
+
+  /* an endpoint that does not rotate keeps the refresh token we have */
+  oauth.rotate = false;
+  assert(chiaki_token_lifecycle_refresh(lifecycle, WAIT_MS) == CHIAKI_ERR_SUCCESS);
+  lifecycle_wait_persists(&oauth, 1);
+  assert(!strcmp(oauth.persisted_refresh, "refresh-login"));
+  chiaki_token_lifecycle_free(lifecycle);
+  fake_fini(&oauth);
+}
+
+void run_tokenlifecycle_tests(void) {
+  test_schedule_jitter();
+  test_single_flight();
+  test_refresh_failure();
+  test_hold();
+  test_clock_skew();
+  test_replaced_during_refresh();
+}
@@ -0,0 +1,183 @@
+/*
+ * workerpool_tests.c — Unit tests for the shared worker pool
+ * (lib/src/workerpool.c).
+ *
+ * Covers jobs of many owners all running and being charged to their own
+ * account, submitting a queued job coalescing, submitting a running job
+ * running it once more, a job resubmitting itself until it is done, and
+ * cancel taking a job out of the queue or waiting for it to finish.
+ * test/standin/multisession_bench.c runs it with real sessions.
+ */
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <chiaki/thread.h>
+#include <chiaki/workerpool.h>
+
+#define OWNERS 32
+
+static void sleep_ms(uint32_t ms) {
+#ifdef _WIN32
+  Sleep(ms);
+#else
+  struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+  nanosleep(&ts, NULL);
+#endif
+}
+
+typedef struct {
+  ChiakiWorkerPool *pool;
+  ChiakiWorkerJob job;
+  ChiakiWorkerAccount account;
+  atomic_int runs;
+  int runs_wanted; // resubmits itself until reached
+  atomic_bool block; // spins while set
+  atomic_bool running;
+} Owner;
+
+static void owner_job(void *user) {
+  Owner *o = user;
+  atomic_store(&o->running, true);
+  while (atomic_load(&o->block))
+    sleep_ms(1);
+  int runs = atomic_fetch_add(&o->runs, 1) + 1;
+  atomic_store(&o->running, false);
+  if (runs < o->runs_wanted)
+    chiaki_worker_pool_submit(o->pool, &o->job);
+}
+
+static void owner_init(Owner *o, ChiakiWorkerPool *pool) {
+  memset(o, 0, sizeof(*o));
+  o->pool = pool;
+  chiaki_worker_job_init(&o->job, owner_job, o, &o->account);
+}
+
+static void wait_runs(Owner *o, int runs) {
+  for (int i = 0; i < 5000 && atomic_load(&o->runs) < runs; i++)
+    sleep_ms(1);
+  assert(atomic_load(&o->runs) >= runs);
+}
+
+static void wait_running(Owner *o) {
+  for (int i = 0; i < 5000 && !atomic_load(&o->running); i++)
+    sleep_ms(1);
+  assert(atomic_load(&o->running));
+}
+
+static void test_many_owners(void) {
+  ChiakiWorkerPool *pool = chiaki_worker_pool_new(4, CHIAKI_THREAD_ROLE_CRYPTO, NULL);
+  assert(pool);
+  static Owner owners[OWNERS];
+  for (int i = 0; i < OWNERS; i++) {
+    owner_init(&owners[i], pool);
+    owners[i].runs_wanted = 1 + i % 4;
+    chiaki_worker_pool_submit(pool, &owners[i].job);
+  }
+  uint64_t jobs = 0;
+  for (int i = 0; i < OWNERS; i++) {
+    wait_runs(&owners[i], owners[i].runs_wanted);
+    chiaki_worker_pool_cancel(pool, &owners[i].job);
+    assert(atomic_load(&owners[i].runs) == owners[i].runs_wanted);
+    ChiakiWorkerAccount account;
+    chiaki_worker_pool_account(pool, &owners[i].account, &account);
+    assert(account.jobs == (uint64_t)owners[i].runs_wanted);
+    assert(account.wait_max_us <= account.wait_us);
+    jobs += account.jobs;
+  }
+  ChiakiWorkerAccount total;
+  chiaki_worker_pool_account(pool, &pool->total, &total);
+  assert(total.jobs == jobs);
+  assert(!pool->queued && !pool->queue_head && !pool->queue_tail);
+  chiaki_worker_pool_free(pool);
+}
+
+static void test_coalesce_and_rerun(void) {
+  ChiakiWorkerPool *pool = chiaki_worker_pool_new(1, CHIAKI_THREAD_ROLE_DEFAULT, NULL);
+  assert(pool);
+  Owner blocker, o;
+  owner_init(&blocker, pool);
+  owner_init(&o, pool);
+
+  // the only worker is busy, so o stays queued and further submits coalesce
+  atomic_store(&blocker.block, true);
+  chiaki_worker_pool_submit(pool, &blocker.job);
+  wait_running(&blocker);
+  for (int i = 0; i < 10; i++)
+    chiaki_worker_pool_submit(pool, &o.job);
+  assert(pool->queued == 1);
+  atomic_store(&blocker.block, false);
+  wait_runs(&o, 1);
+  chiaki_worker_pool_cancel(pool, &o.job);
+  assert(atomic_load(&o.runs) == 1);
+
+  // submits while running add exactly one more run
+  atomic_store(&o.block, true);
+  chiaki_worker_pool_submit(pool, &o.job);
+  wait_running(&o);
+  chiaki_worker_pool_submit(pool, &o.job);
+  chiaki_worker_pool_submit(pool, &o.job);
+  atomic_store(&o.block, false);
+  wait_runs(&o, 3);
+  chiaki_worker_pool_cancel(pool, &o.job);
+  sleep_ms(20);
+  assert(atomic_load(&o.runs) == 3);
+  assert(o.job.state == CHIAKI_WORKER_JOB_IDLE);
+  chiaki_worker_pool_free(pool);
+}
+
+static void test_cancel(void) {
+  ChiakiWorkerPool *pool = chiaki_worker_pool_new(1, CHIAKI_THREAD_ROLE_DEFAULT, NULL);
+  assert(pool);
+  Owner blocker, a, b, c;
+  owner_init(&blocker, pool);
+  owner_init(&a, pool);
+  owner_init(&b, pool);
+  owner_init(&c, pool);
+
+  // queued jobs are taken out from the head, middle and tail
+  atomic_store(&blocker.block, true);
+  chiaki_worker_pool_submit(pool, &blocker.job);
+  wait_running(&blocker);
+  chiaki_worker_pool_submit(pool, &a.job);
+  chiaki_worker_pool_submit(pool, &b.job);
+  chiaki_worker_pool_submit(pool, &c.job);
+  chiaki_worker_pool_cancel(pool, &b.job);
+  chiaki_worker_pool_cancel(pool, &c.job);
+  assert(pool->queued == 1 && pool->queue_head == &a.job && pool->queue_tail == &a.job);
+  chiaki_worker_pool_cancel(pool, &a.job);
+  assert(!pool->queued && !pool->queue_head && !pool->queue_tail);
+  chiaki_worker_pool_submit(pool, &c.job);
+  assert(pool->queue_head == &c.job && pool->queue_tail == &c.job);
+  atomic_store(&blocker.block, false);
+  wait_runs(&c, 1);
+  assert(!atomic_load(&a.runs) && !atomic_load(&b.runs));
+
+  // cancel of a running job that keeps resubmitting itself waits for it and stops it
+  a.runs_wanted = 1000000;
+  chiaki_worker_pool_submit(pool, &a.job);
+  wait_runs(&a, 10);
+  chiaki_worker_pool_cancel(pool, &a.job);
+  int runs = atomic_load(&a.runs);
+  assert(a.job.state == CHIAKI_WORKER_JOB_IDLE);
+  sleep_ms(20);
+  assert(atomic_load(&a.runs) == runs);
+
+  chiaki_worker_pool_cancel(pool, &b.job); // idle, returns right away
+  chiaki_worker_pool_free(pool);
+}
+
+void run_workerpool_tests(void) {
+  test_many_owners();
+  test_coalesce_and_rerun();
+  test_cancel();
+}
@@ -0,0 +1,46 @@
+#ifndef VITA2D_FONT_CACHE_H
+#define VITA2D_FONT_CACHE_H
+
+/*
+ * VitaRPS5 patch: glyph atlas persistence hooks for the vendored
+ * vita2d_font.c. See third-party/libvita2d/VITARPS5_PATCHES.md.
+ */
+
+#include "vita2d.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Glyphs are rasterized into the atlas at this multiple of the point size. */
+#define VITARPS5_FONT_SUPERSAMPLE 2
+
+typedef struct vita2d_font_glyph {
+	unsigned int glyph_index;
+	int glyph_size;
+	unsigned int width;
+	unsigned int height;
+	int bitmap_left;
+	int bitmap_top;
+	int advance_x;
+	int advance_y;
+	const unsigned char *coverage; /* width * height bytes, row-major */
+} vita2d_font_glyph;
+
+/* Called after FreeType rasterized a glyph into the font's atlas. */
+typedef void (*vita2d_font_glyph_callback)(void *user, const vita2d_font_glyph *glyph);
+
+void vita2d_font_set_glyph_callback(vita2d_font *font, vita2d_font_glyph_callback callback, void *user);
+
+/*
+ * Insert an already rasterized glyph into the font's atlas, so drawing it
+ * does not go through FreeType. A glyph already in the atlas is left alone.
+ * Returns 0 if the atlas is full.
+ */
+int vita2d_font_preload_glyph(vita2d_font *font, const vita2d_font_glyph *glyph);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -6,6 +6,10 @@
  * LINEAR filtering, giving a true 2:1 bilinear minification. Atlas
  * filter selection lives in texture_atlas.c.
  *
+ * VitaRPS5 patch: glyphs can be preloaded into the atlas and newly
+ * rasterized ones are reported, for the persisted glyph atlas
+ * (vita2d_font_cache.h).
+ *
  * See third-party/libvita2d/VITARPS5_PATCHES.md for full rationale.
  */
 
@@ -18,6 +22,7 @@
 #include FT_CACHE_H
 #include FT_FREETYPE_H
 #include "vita2d.h"
+#include "vita2d_font_cache.h"
 #include "texture_atlas.h"
 #include "bin_packing_2d.h"
 #include "utils.h"
@@ -26,9 +31,6 @@
 #define ATLAS_DEFAULT_W 1024
 #define ATLAS_DEFAULT_H 1024
 
-/* VitaRPS5 patch: see VITARPS5_PATCHES.md (active patch — 2x supersample). */
-#define VITARPS5_FONT_SUPERSAMPLE 2
-
 typedef enum {
 	VITA2D_LOAD_FONT_FROM_FILE,
 	VITA2D_LOAD_FONT_FROM_MEM
@@ -48,6 +50,9 @@ typedef struct vita2d_font {
 	FTC_CMapCache cmapcache;
 	FTC_ImageCache imagecache;
 	texture_atlas *atlas;
+	/* VitaRPS5 patch: see vita2d_font_cache.h. */
+	vita2d_font_glyph_callback glyph_callback;
+	void *glyph_callback_user;
 } vita2d_font;
 
 static FT_Error ftc_face_requester(FTC_FaceID face_id, FT_Library library,
@@ -113,6 +118,9 @@ vita2d_font *vita2d_load_font_file(const char *filename)
 	font->atlas = texture_atlas_create(ATLAS_DEFAULT_W, ATLAS_DEFAULT_H,
 		SCE_GXM_TEXTURE_FORMAT_U8_R111);
 
+	font->glyph_callback = NULL;
+	font->glyph_callback_user = NULL;
+
 	return font;
 }
 
@@ -156,6 +164,9 @@ vita2d_font *vita2d_load_font_mem(const void *buffer, unsigned int size)
 	font->atlas = texture_atlas_create(ATLAS_DEFAULT_W, ATLAS_DEFAULT_H,
 		SCE_GXM_TEXTURE_FORMAT_U8_R111);
 
+	font->glyph_callback = NULL;
+	font->glyph_callback_user = NULL;
+
 	return font;
 }
 
@@ -173,37 +184,63 @@ void vita2d_free_font(vita2d_font *font)
 	}
 }
 
-static int atlas_add_glyph(texture_atlas *atlas, unsigned int glyph_index,
-			   const FT_BitmapGlyph bitmap_glyph, int glyph_size)
+/* Insert a glyph's coverage bitmap into the atlas and its texture. */
+static int atlas_insert_coverage(texture_atlas *atlas, const vita2d_font_glyph *glyph)
 {
-	int ret;
-	int i, j;
+	int i;
 	bp2d_position position;
 	void *texture_data;
 	unsigned int tex_width;
-	const FT_Bitmap *bitmap = &bitmap_glyph->bitmap;
-	unsigned int w = bitmap->width;
-	unsigned int h = bitmap->rows;
-	unsigned char buffer[w * h];
 
 	bp2d_size size = {
-		bitmap->width,
-		bitmap->rows
+		glyph->width,
+		glyph->height
 	};
 
 	texture_atlas_entry_data data = {
+		glyph->bitmap_left,
+		glyph->bitmap_top,
+		glyph->advance_x,
+		glyph->advance_y,
+		glyph->glyph_size
+	};
+
+	if (!texture_atlas_insert(atlas, glyph->glyph_index, &size, &data,
+				  &position))
+		return 0;
+
+	texture_data = vita2d_texture_get_datap(atlas->texture);
+	tex_width = vita2d_texture_get_width(atlas->texture);
+
+	for (i = 0; i < size.h; i++) {
+		memcpy(texture_data + (position.x + (position.y + i) * tex_width),
+		       glyph->coverage + i * size.w, size.w);
+	}
+
+	return 1;
+}
+
+static int atlas_add_glyph(vita2d_font *font, unsigned int glyph_index,
+			   const FT_BitmapGlyph bitmap_glyph, int glyph_size)
+{
+	int i, j;
+	const FT_Bitmap *bitmap = &bitmap_glyph->bitmap;
+	unsigned int w = bitmap->width;
+	unsigned int h = bitmap->rows;
+	unsigned char buffer[w * h];
+
+	vita2d_font_glyph glyph = {
+		glyph_index,
+		glyph_size,
+		w,
+		h,
 		bitmap_glyph->left,
 		bitmap_glyph->top,
 		bitmap_glyph->root.advance.x,
 		bitmap_glyph->root.advance.y,
-		glyph_size
+		buffer
 	};
 
-	ret = texture_atlas_insert(atlas, glyph_index, &size, &data,
-				  &position);
-	if (!ret)
-		return 0;
-
 	for (i = 0; i < h; i++) {
 		for (j = 0; j < w; j++) {
 			if (bitmap->pixel_mode == FT_PIXEL_MODE_MONO) {
@@ -216,17 +253,28 @@ static int atlas_add_glyph(texture_atlas *atlas, unsigned int glyph_index,
 		}
 	}
 
-	texture_data = vita2d_texture_get_datap(atlas->texture);
-	tex_width = vita2d_texture_get_width(atlas->texture);
+	if (!atlas_insert_coverage(font->atlas, &glyph))
+		return 0;
 
-	for (i = 0; i < size.h; i++) {
-		memcpy(texture_data + (position.x + (position.y + i) * tex_width),
-		       buffer + i * size.w, size.w);
-	}
+	if (font->glyph_callback)
+		font->glyph_callback(font->glyph_callback_user, &glyph);
 
 	return 1;
 }
 
+void vita2d_font_set_glyph_callback(vita2d_font *font, vita2d_font_glyph_callback callback, void *user)
+{
+	font->glyph_callback = callback;
+	font->glyph_callback_user = user;
+}
+
+int vita2d_font_preload_glyph(vita2d_font *font, const vita2d_font_glyph *glyph)
+{
+	if (texture_atlas_exists(font->atlas, glyph->glyph_index))
+		return 1;
+	return atlas_insert_coverage(font->atlas, glyph);
+}
+
 static int generic_font_draw_text(vita2d_font *font, int draw,
 				   int *height, int x, int y, float linespace,
 				   unsigned int color,
@@ -300,7 +348,7 @@ static int generic_font_draw_text(vita2d_font *font, int draw,
 						    &glyph,
 						    NULL);
 
-			if (!atlas_add_glyph(font->atlas, glyph_index,
+			if (!atlas_add_glyph(font, glyph_index,
 					     (FT_BitmapGlyph)glyph, atlas_size)) {
 				sceClibPrintf("[WARN] vita2d_font: atlas overflow — "
 					      "glyph %u at %upt (atlas %upt) did not fit\n",
@@ -51,6 +51,8 @@ typedef uint8_t MacAddr[6];
 void host_free(VitaChiakiHost *host);
 int host_register(VitaChiakiHost *host, int pin);
 int host_wakeup(VitaChiakiHost *host);
+/** Wake the console and block until it reports ready. Canceled by host_cancel_stream_request(). */
+int host_wake_and_wait(VitaChiakiHost *host);
 int host_stream(VitaChiakiHost *host);
 void host_cancel_stream_request(void);
 void host_finalize_deferred_session(void);
@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+#include <chiaki/launchhints.h>
+
 #include "config.h"
 
 typedef struct {
@@ -18,4 +20,6 @@ uint32_t host_clamp_u32(uint32_t value, uint32_t min_value, uint32_t max_value);
 uint32_t host_saturating_add_u32_report(uint32_t lhs, uint32_t rhs, const char *counter_name,
                                         uint32_t counter_mask_bit);
 LossDetectionProfile host_loss_profile_for_mode(VitaChiakiLatencyMode mode);
+/* How the LaunchSpec network hints are derived from the measured link, see chiaki/launchhints.h. */
+ChiakiLaunchHintsPolicy host_launch_hints_policy_for_mode(VitaChiakiLatencyMode mode);
 void host_adjust_loss_profile_with_metrics(LossDetectionProfile *profile);
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <chiaki/session.h>
+
+#include "host.h"
+
+/* Per-console connection profiles for hot reconnects, see chiaki/connprofile.h.
+ * Kept in memory for the lifetime of the app. */
+bool host_profile_init(void);
+void host_profile_fini(void);
+
+/* Hand what the last good connect to host found out to connect_info, right before
+ * chiaki_session_init(). Remembers what was applied for the calls below. */
+void host_profile_apply(VitaChiakiHost *host, bool psn_remote, ChiakiConnectInfo *connect_info);
+
+/* The session got to its first frame: record what it found out, and start
+ * observing its early-stream loss and throughput for the link history. */
+void host_profile_record(ChiakiSession *session);
+
+/* Once the early-stream window is over, merge what it showed into the link history
+ * and log it next to the LaunchSpec hints. Called with the metrics update. */
+void host_profile_observe(uint64_t now_us);
+
+/* The session quit before streaming: drop what was applied to it. */
+void host_profile_failed(void);
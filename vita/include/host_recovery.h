@@ -3,6 +3,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+bool host_recovery_request_bitrate_reduction(const char *source, uint32_t bitrate_kbps,
+                                             uint64_t now_us);
 void host_recovery_handle_post_reconnect_degraded_mode(bool av_diag_progressed,
                                                        uint32_t incoming_fps, uint32_t target_fps,
                                                        bool low_fps_window, uint64_t now_us);
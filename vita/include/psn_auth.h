@@ -3,6 +3,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <chiaki/tokenlifecycle.h>
+
 typedef enum {
   PSN_AUTH_STATE_DISABLED = 0,
   PSN_AUTH_STATE_LOGGED_OUT,
@@ -16,8 +18,13 @@ typedef enum {
 bool psn_auth_enabled(void);
 bool psn_auth_has_tokens(void);
 bool psn_auth_token_is_valid(uint64_t now_unix);
-const char *psn_auth_access_token(void);
+/* malloc()ed copy of the current access token, NULL if there is none. The
+ * token can be rotated in the background, so callers must not keep a pointer
+ * into the config. */
+char *psn_auth_dup_access_token(void);
 void psn_auth_clear_tokens(void);
+/* How usable the access token is right now, and for how many more seconds. */
+ChiakiTokenFreshness psn_auth_token_freshness(uint64_t now_unix, uint64_t *valid_sec);
 
 PsnAuthState psn_auth_state(uint64_t now_unix);
 const char *psn_auth_state_label(void);
@@ -33,3 +40,11 @@ const char *psn_auth_device_user_code(void);
 const char *psn_auth_device_verification_url(void);
 
 bool psn_auth_refresh_token_if_needed(uint64_t now_unix, bool force);
+
+/* Keep the token fresh in the background once the config is loaded. Without
+ * it every refresh runs synchronously in psn_auth_refresh_token_if_needed(). */
+bool psn_auth_lifecycle_start(void);
+void psn_auth_lifecycle_stop(void);
+/* Called once per UI frame: moves rotated tokens into the config (and marks it
+ * for persisting) and holds scheduled refreshes back while streaming. */
+void psn_auth_poll(void);
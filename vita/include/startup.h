@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <chiaki/startupprof.h>
+
+/* Subsystems that initialize lazily, see chiaki/lazyinit.h. */
+typedef enum {
+  VITA_STARTUP_DNS,            // resolver cache and PSN/STUN prefetch, background
+  VITA_STARTUP_HOST_PROFILES,  // connection profiles, background
+  VITA_STARTUP_PSN_HOSTS,      // PSN device list refresh, on the UI thread after the first frame
+  VITA_STARTUP_UNIT_COUNT
+} VitaStartupUnit;
+
+/* Start the launch profile. First thing in main(), before anything worth timing. */
+void vita_startup_begin(void);
+
+/* Register the lazy units and start the background ones. Needs the context. */
+void vita_startup_start_units(void);
+
+/* The launch profile for CHIAKI_STARTUP_SCOPE(), NULL once it was written out. */
+ChiakiStartupProf *vita_startup_prof(void);
+
+/* Make sure unit is initialized before using it, from any thread. */
+bool vita_startup_require(VitaStartupUnit unit);
+
+/* Once per UI frame after buffers were swapped: the first call marks the app interactive,
+ * later ones run the pending UI-thread units one per frame. When none is left, the launch
+ * profile is written to STARTUP_TRACE_PATH and summarized in the log. */
+void vita_startup_frame_done(void);
+
+void vita_startup_fini(void);
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <chiaki/avsync.h>
+#include <chiaki/decodegov.h>
+#include <chiaki/nalcheck.h>
 #include <chiaki/session.h>
 #include <chiaki/opusdecoder.h>
 #include <chiaki/thread.h>
+#include <chiaki/wakeorchestrator.h>
 
 #include "controller.h"
 
@@ -49,6 +53,14 @@ typedef struct vita_chiaki_stream_t {
   uint32_t fps_window_frame_count;  // frames counted within the window
   uint64_t pacing_accumulator;      // Bresenham-style pacing accumulator
   ChiakiOpusDecoder opus_decoder;
+  ChiakiAvSync *av_sync;  // audio-master A/V sync, NULL if it could not be created
+  ChiakiDecodeGovernor decode_governor;  // Takion-thread-only; sheds frames under decode pressure
+  ChiakiDecodePressure decode_pressure_logged;  // Last pressure level logged as PIPE/DECODE_GOV
+  int32_t shed_frames_lost;  // Takion-thread-only; losses reported with shed frames, for the next decode
+  bool shed_frame_recovered;  // Takion-thread-only; a shed frame was recovered, same
+  ChiakiNalCheck nal_check;  // Takion-thread-only; access units are checked before decode
+  uint64_t nal_check_logged_us;  // Last PIPE/NAL_CHECK log, rate-limited
+  uint64_t nal_check_resync_us;  // Last decoder resync requested for a bad access unit
   ChiakiThread input_thread;
   volatile bool input_thread_should_exit;  // Signal for clean thread exit (volatile prevents CPU
                                            // caching on ARM)
@@ -145,6 +157,11 @@ typedef struct vita_chiaki_stream_t {
                              // consumed and cleared at the top of host_stream().
   char psn_selected_addr[PSN_SELECTED_ADDR_SIZE];  // Resolved PSN-path IP written by holepunch;
                                                    // consumed by host_stream
+  bool wake_before_connect;  // Set by UI for a console in standby; host_stream() wakes it and
+                             // waits until it is ready. Consumed and cleared there.
+  bool wake_canceled;        // Set by host_cancel_stream_request(), cleared by UI with the above
+  ChiakiWakeOrchestrator *wake;  // Non-NULL while host_stream() waits for the console to wake;
+                                 // guarded by finalization_mutex
 
   // --- Diagnostic instrumentation (D1: Decode Time) ---
   volatile uint32_t
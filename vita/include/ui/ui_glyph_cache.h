@@ -0,0 +1,165 @@
+/**
+ * @file ui_glyph_cache.h
+ * @brief Persisted glyph atlas for VitaRPS5 UI fonts
+ *
+ * Keeps the rasterized coverage bitmaps and metrics of every glyph a font's
+ * atlas holds, so the next launch can bulk-load them into the atlas instead
+ * of running FreeType and the prewarm uploads again.
+ *
+ * A cache belongs to one font file and one glyph set (prewarm sizes, charset,
+ * supersample factor); both are folded into the GlyphCacheKey. A file written
+ * for another key is discarded as a whole.
+ *
+ * File format (little-endian):
+ *   header, 32 bytes:
+ *     [0..3]   magic "VGAC"
+ *     [4..5]   version (GLYPH_CACHE_VERSION)
+ *     [6..7]   reserved, 0
+ *     [8..15]  font_hash
+ *     [16..23] glyph_set_hash
+ *     [24..27] FNV-1a 32 of bytes 0..23
+ *     [28..31] reserved, 0
+ *   then one record per glyph, in atlas insertion order:
+ *     [0..3]   glyph_index
+ *     [4..5]   glyph_size      [6..7]   width       [8..9]  height
+ *     [10..11] bitmap_left     [12..13] bitmap_top  [14..15] reserved, 0
+ *     [16..19] advance_x       [20..23] advance_y
+ *     [24..27] FNV-1a 32 of bytes 0..23 and the coverage
+ *     [28..]   width * height coverage bytes, row-major
+ *
+ * Records carry their own checksum so newly seen glyphs can be appended
+ * without touching the header. Loading stops at the first record that is
+ * truncated or fails validation and keeps everything before it; the next
+ * flush then rewrites the file instead of appending after the damage.
+ *
+ * No vita2d or SCE dependency, so it builds and is tested on the host.
+ * Not thread-safe; the UI uses it from the render thread only.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GLYPH_CACHE_VERSION 1
+#define GLYPH_CACHE_HEADER_SIZE 32
+#define GLYPH_CACHE_RECORD_HEADER_SIZE 28
+
+/* Larger bitmaps are rejected on load; a 40 pt glyph at 2x supersample is well under this. */
+#define GLYPH_CACHE_MAX_GLYPH_DIM 256
+
+/* Seed for glyph_cache_hash(), the 64 bit FNV-1a offset basis. */
+#define GLYPH_CACHE_HASH_SEED 0xcbf29ce484222325ULL
+
+typedef struct {
+  uint64_t font_hash;      /* glyph_cache_hash() of the font file contents */
+  uint64_t glyph_set_hash; /* glyph_cache_hash() of what decides which glyphs get rasterized how */
+} GlyphCacheKey;
+
+/* One atlas entry, mirroring texture_atlas_entry_data plus the bitmap. */
+typedef struct {
+  uint32_t glyph_index;
+  uint16_t glyph_size;
+  uint16_t width;
+  uint16_t height;
+  int16_t bitmap_left;
+  int16_t bitmap_top;
+  int32_t advance_x;
+  int32_t advance_y;
+  const uint8_t *coverage; /* width * height bytes */
+} GlyphCacheEntry;
+
+typedef struct GlyphCache GlyphCache;
+
+/**
+ * glyph_cache_hash() - Continue a 64 bit FNV-1a style hash over data.
+ * @h: GLYPH_CACHE_HASH_SEED to start, or the result of a previous call.
+ *
+ * Steps over native-endian 64 bit words, so a hash is only comparable on the
+ * machine that computed it, and split calls only match a single call when
+ * the splits fall on multiples of 8 bytes.  Keys never leave the device.
+ */
+uint64_t glyph_cache_hash(uint64_t h, const void *data, size_t size);
+
+/**
+ * glyph_cache_hash_file() - Hash a file's contents for GlyphCacheKey.font_hash.
+ *
+ * Returns false if the file cannot be read.
+ */
+bool glyph_cache_hash_file(const char *path, uint64_t *hash);
+
+/**
+ * glyph_cache_new() - Create an empty cache for key.
+ *
+ * Returns NULL when out of memory.
+ */
+GlyphCache *glyph_cache_new(const GlyphCacheKey *key);
+
+void glyph_cache_free(GlyphCache *cache);
+
+/**
+ * glyph_cache_load() - Adopt the records of a serialized cache.
+ * @cache: Empty cache, as returned by glyph_cache_new().
+ * @buf:   Whole file contents, allocated with malloc(). Ownership passes to
+ *         the cache on every return path: the loaded entries point into it.
+ * @size:  Size of buf.
+ *
+ * Returns the number of glyphs loaded. 0 for a header of another key or
+ * version, in which case the next flush writes a fresh file.
+ */
+size_t glyph_cache_load(GlyphCache *cache, uint8_t *buf, size_t size);
+
+/**
+ * glyph_cache_load_file() - Bulk-load path with a single read and glyph_cache_load() it.
+ *
+ * A missing file loads nothing; the first flush creates it.
+ */
+size_t glyph_cache_load_file(GlyphCache *cache, const char *path);
+
+/**
+ * glyph_cache_add() - Record a glyph that was newly rasterized into the atlas.
+ *
+ * The coverage is copied. A glyph_index already in the cache is ignored,
+ * the atlas keeps the first rasterization of a glyph too.
+ *
+ * Returns false for an oversized glyph or when out of memory.
+ */
+bool glyph_cache_add(GlyphCache *cache, const GlyphCacheEntry *entry);
+
+/**
+ * glyph_cache_find() - Look up a glyph by index, NULL if it is not cached.
+ */
+const GlyphCacheEntry *glyph_cache_find(const GlyphCache *cache, uint32_t glyph_index);
+
+size_t glyph_cache_count(const GlyphCache *cache);
+
+/**
+ * glyph_cache_entry() - The i-th glyph in atlas insertion order.
+ *
+ * Preloading in this order packs the atlas exactly as the run that wrote it.
+ */
+const GlyphCacheEntry *glyph_cache_entry(const GlyphCache *cache, size_t i);
+
+/**
+ * glyph_cache_pending() - Number of glyphs added since the last flush.
+ */
+size_t glyph_cache_pending(const GlyphCache *cache);
+
+/**
+ * glyph_cache_serialize() - Write the whole cache to buf.
+ *
+ * With buf NULL only computes the size. Returns the serialized size, or 0 if
+ * it does not fit into buf_size.
+ */
+size_t glyph_cache_serialize(const GlyphCache *cache, uint8_t *buf, size_t buf_size);
+
+/**
+ * glyph_cache_flush_file() - Persist the pending glyphs to path.
+ *
+ * Appends their records when the file on disk is a valid prefix of the cache,
+ * rewrites it otherwise. A no-op when nothing is pending.
+ *
+ * Returns false if writing failed; the glyphs stay pending.
+ */
+bool glyph_cache_flush_file(GlyphCache *cache, const char *path);
@@ -22,6 +22,10 @@
  * Lifecycle: there is no explicit deinit. Reloading fonts at runtime requires
  * calling ui_text_init() again followed by ui_text_prewarm() on the next
  * render pass.
+ *
+ * Glyph atlas persistence: after ui_text_set_font_files(), ui_text_prewarm()
+ * preloads each font's atlas from ux0:/data/vita-chiaki/ (ui_glyph_cache.h)
+ * and glyphs rasterized later are appended by ui_text_flush_glyph_cache().
  */
 
 #pragma once
@@ -56,6 +60,24 @@ void ui_text_init(vita2d_font *regular, vita2d_font *mono);
  */
 int ui_text_needs_prewarm(void);
 
+/**
+ * ui_text_set_font_files() - Name the files the fonts were loaded from.
+ * @regular_path: File of the regular font passed to ui_text_init().
+ * @mono_path:    File of the mono font.
+ *
+ * Enables the persisted glyph atlas, keyed by a hash of these files.  Call
+ * before the first ui_text_prewarm().  Both strings are borrowed.
+ */
+void ui_text_set_font_files(const char *regular_path, const char *mono_path);
+
+/**
+ * ui_text_flush_glyph_cache() - Append newly rasterized glyphs to the cache files.
+ *
+ * A no-op unless a glyph outside the prewarm set was drawn since the last
+ * call, so the UI loop calls it once per idle frame.
+ */
+void ui_text_flush_glyph_cache(void);
+
 /**
  * ui_text_prewarm() - Force-rasterize all (codepoint, pt_size) pairs.
  *
@@ -5,7 +5,18 @@
 #include <curl/curl.h>
 #include "vita_resolve.h"
 
-/* Resolve hostname using sceNetResolverStartNtoa (Sony's native resolver).
+/* Start the resolver cache that vita_curl_add_resolve() and vita_resolve_sin()
+ * go through. Needs sceNet and the context log. Without it every call resolves
+ * synchronously. */
+bool vita_dns_init(void);
+
+/* Resolve the PSN and STUN names of a remote connect in the background. */
+void vita_dns_prefetch_known_hosts(void);
+
+void vita_dns_fini(void);
+
+/* Resolve hostname using sceNetResolverStartNtoa (Sony's native resolver),
+ * through the cache once vita_dns_init() has run.
  * On success, appends "hostname:port:dotted_ip" to *list and returns true.
  * *list may be NULL on entry.  Caller must pass the list to CURLOPT_RESOLVE
  * before curl_easy_perform, then free it with curl_slist_free_all() after. */
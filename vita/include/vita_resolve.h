@@ -5,7 +5,8 @@
 #include <stdint.h>
 #include <netinet/in.h>
 
-/* Resolve hostname to AF_INET sockaddr_in via Sony's native resolver.
+/* Resolve hostname to AF_INET sockaddr_in via Sony's native resolver and the
+ * cache from vita_dns_init().
  * Fills out->sin_family, out->sin_port (network byte order), and out->sin_addr.
  * Returns true on success. */
 bool vita_resolve_sin(const char *hostname, uint16_t port, struct sockaddr_in *out);
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <psp2/audioout.h>
 #include <psp2/kernel/threadmgr.h>
+#include <chiaki/avsync.h>
 
 #include "audio.h"
 #include "context.h"
@@ -35,6 +36,14 @@ size_t write_frame_offset;
 size_t device_buffer_offset;
 int write_read_framediff;
 
+// A/V sync: every incoming frame is resampled at the ratio the sync engine asks
+// for into resample_buffer, and whole frames are moved from there into buffer.
+static ChiakiAvResampler resampler;
+static int16_t *resample_buffer;
+static size_t resample_buffer_capacity;  // # of samples
+static size_t resample_buffer_fill;      // # of samples waiting for a whole frame
+static double resample_ratio = 1.0;
+
 // Audio buffer monitoring for detecting lag accumulation
 static uint64_t audio_catchup_count = 0;
 static uint64_t audio_frames_processed = 0;
@@ -122,6 +131,19 @@ static void init_buffer() {
   device_buffer_offset = 0;
   write_read_framediff = 0;
 
+  // the ratio stays within 0.5%, so one frame of carry plus one resampled frame fits
+  resample_buffer_capacity = frame_size * 2 + 2;
+  resample_buffer = (int16_t *)malloc(resample_buffer_capacity * sample_bytes);
+  if (resample_buffer == NULL) {
+    LOGD("VITA AUDIO :: failed to allocate resample buffer");
+    free(buffer);
+    buffer = NULL;
+    return;
+  }
+  resample_buffer_fill = 0;
+  resample_ratio = 1.0;
+  chiaki_av_resampler_init(&resampler, channels);
+
   LOGD(
       "VITA AUDIO :: buffer init: buffer_frames %d, buffer_samples %d, buffer_bytes %d, frame_size "
       "%d, sample_bytes %d",
@@ -134,6 +156,17 @@ static void log_audio_session_stats(void) {
   float catchup_rate = (float)audio_catchup_count / (float)audio_frames_processed * 100.0f;
   LOGD("VITA AUDIO :: Session stats - Frames: %lu, Catchups: %lu (%.2f%%)", audio_frames_processed,
        audio_catchup_count, catchup_rate);
+  if (context.stream.av_sync) {
+    ChiakiAvSyncStats stats;
+    chiaki_av_sync_stats(context.stream.av_sync, &stats);
+    LOGD(
+        "VITA AUDIO :: A/V sync - drift %.1f ppm, ratio %.4f, buffer %llu us (target %llu us), "
+        "sync error avg %llu us max %llu us, held %llu late %llu of %llu presents",
+        stats.drift_ppm, stats.resample_ratio, (unsigned long long)stats.audio_buffer_us,
+        (unsigned long long)stats.audio_target_us, (unsigned long long)stats.sync_error_avg_us,
+        (unsigned long long)stats.sync_error_max_us, (unsigned long long)stats.held,
+        (unsigned long long)stats.late, (unsigned long long)stats.presents);
+  }
 }
 
 void vita_audio_cleanup() {
@@ -143,16 +176,36 @@ void vita_audio_cleanup() {
   log_audio_session_stats();
   free(buffer);
   buffer = NULL;
+  free(resample_buffer);
+  resample_buffer = NULL;
   did_secondary_init = false;
   audio_catchup_count = 0;
   audio_frames_processed = 0;
 }
 
+// Moves one frame from resample_buffer into buffer and outputs when a device buffer is due.
+static void audio_write_frame(void) {
+  memcpy(buffer + write_frame_offset * frame_size * sample_steps, resample_buffer,
+         frame_size * sample_bytes);
+  resample_buffer_fill -= frame_size;
+  memmove(resample_buffer, resample_buffer + frame_size * sample_steps,
+          resample_buffer_fill * sample_bytes);
+  write_frame_offset = (write_frame_offset + 1) % buffer_frames;
+  write_read_framediff++;
+
+  if (write_read_framediff < device_buffer_frames)
+    return;
+  if (!audio_should_output_now())
+    return;
+
+  sceAudioOutOutput(port, buffer + device_buffer_offset * device_buffer_samples * sample_steps);
+  device_buffer_offset = (device_buffer_offset + 1) % DEVICE_BUFFERS;
+  write_read_framediff -= device_buffer_frames;
+}
+
 void vita_audio_cb(int16_t *buf_in, size_t samples_count, void *user) {
   if (!did_secondary_init) {
-    // Set audio thread priority for low latency
-    sceKernelChangeThreadPriority(SCE_KERNEL_THREAD_ID_SELF, 64);
-    sceKernelChangeThreadCpuAffinityMask(SCE_KERNEL_THREAD_ID_SELF, SCE_KERNEL_CPU_MASK_USER_2);
+    // Runs on the takion thread, which keeps its NETWORK scheduling
 
     frame_size = samples_count;
 
@@ -162,6 +215,15 @@ void vita_audio_cb(int16_t *buf_in, size_t samples_count, void *user) {
 
     sceAudioOutSetConfig(port, device_buffer_samples, rate, audio_port_format());
 
+    if (context.stream.av_sync) {
+      // two device buffers in flight, never less than one plus a unit, at most the whole ring
+      uint64_t device_buffer_us = (uint64_t)device_buffer_samples * 1000000 / rate;
+      uint64_t frame_us = (uint64_t)frame_size * 1000000 / rate;
+      chiaki_av_sync_set_audio_target(context.stream.av_sync, device_buffer_us * 2,
+                                      device_buffer_us + frame_us,
+                                      (uint64_t)buffer_samples * 1000000 / rate);
+    }
+
     did_secondary_init = true;
     LOGD("VITA AUDIO :: secondary init complete");
   }
@@ -172,18 +234,27 @@ void vita_audio_cb(int16_t *buf_in, size_t samples_count, void *user) {
     return;
   }
 
-  memcpy(buffer + write_frame_offset * frame_size * sample_steps, buf_in,
-         frame_size * sample_bytes);
-  write_frame_offset = (write_frame_offset + 1) % buffer_frames;
-  write_read_framediff++;
+  ChiakiAvSync *av_sync = context.stream.av_sync;
+  if (av_sync) {
+    // runs inside the audio receiver, which has just taken this unit's index
+    chiaki_av_sync_audio_frame(
+        av_sync, context.stream.session.stream_connection.audio_receiver->frame_index_prev,
+        (uint64_t)frame_size * 1000000 / rate, sceKernelGetProcessTimeWide());
+  }
+
+  resample_buffer_fill += chiaki_av_resampler_process(
+      &resampler, resample_ratio, buf_in, frame_size,
+      resample_buffer + resample_buffer_fill * sample_steps,
+      resample_buffer_capacity - resample_buffer_fill);
   audio_frames_processed++;
 
-  if (write_read_framediff < device_buffer_frames)
-    return;
-  if (!audio_should_output_now())
-    return;
+  while (resample_buffer_fill >= frame_size)
+    audio_write_frame();
 
-  sceAudioOutOutput(port, buffer + device_buffer_offset * device_buffer_samples * sample_steps);
-  device_buffer_offset = (device_buffer_offset + 1) % DEVICE_BUFFERS;
-  write_read_framediff -= device_buffer_frames;
+  if (av_sync) {
+    uint64_t buffered_samples = (uint64_t)write_read_framediff * frame_size + resample_buffer_fill +
+                                sceAudioOutGetRestSample(port);
+    resample_ratio = chiaki_av_sync_audio_playout(
+        av_sync, buffered_samples * 1000000 / rate, sceKernelGetProcessTimeWide());
+  }
 }
@@ -4,7 +4,10 @@
 #include "host.h"
 #include "host_input.h"
 #include "host_feedback.h"
+#include "host_loss_profile.h"
 #include "host_metrics.h"
+#include "host_profile.h"
+#include "startup.h"
 #include "host_lifecycle.h"
 #include "host_callbacks.h"
 #include "host_constants.h"
@@ -25,6 +28,8 @@ static void request_stream_stop(const char *reason);
 // Credential mismatch requires user action (re-pair), so keep the hint visible
 // longer than transient link-wait messages.
 #define HINT_DURATION_CREDENTIAL_US (7 * 1000 * 1000ULL)
+// How long a refused session request is retried after waking the console.
+#define HOST_WAKE_SESSION_RETRY_MS 5000
 
 static bool host_mac_is_zero(const uint8_t mac[6]) {
   if (!mac)
@@ -133,6 +138,11 @@ static void request_stream_stop(const char *reason) {
 }
 
 void host_cancel_stream_request(void) {
+  chiaki_mutex_lock(&context.stream.finalization_mutex);
+  context.stream.wake_canceled = true;
+  if (context.stream.wake)
+    chiaki_wake_orchestrator_cancel(context.stream.wake);
+  chiaki_mutex_unlock(&context.stream.finalization_mutex);
   request_stream_stop("user cancel");
 }
 
@@ -148,6 +158,8 @@ int host_stream(VitaChiakiHost *host) {
   bool psn_remote =
       (host && host->source == VITA_HOST_SOURCE_PSN_REMOTE) || context.stream.force_psn_holepunch;
   context.stream.force_psn_holepunch = false;
+  bool wake_before_connect = context.stream.wake_before_connect;
+  context.stream.wake_before_connect = false;
   context.stream.psn_selected_addr[0] = '\0';
   LOGD("host_stream target: host_ptr=%p source=%d type=0x%x hostname=%s psn_remote=%d uid_zero=%d",
        (void *)host, host ? host->source : -1, host ? host->type : 0,
@@ -227,6 +239,15 @@ int host_stream(VitaChiakiHost *host) {
     LOGD("Applying packet-loss fallback bitrate: %u kbps", profile.bitrate);
     context.stream.loss_retry_active = false;
   }
+  if (wake_before_connect) {
+    ui_connection_set_stage(UI_CONNECTION_STAGE_WAKING);
+    if (host_wake_and_wait(host) != 0) {
+      if (!context.stream.wake_canceled)
+        host_set_hint(host, "Console did not wake up. Check pairing and network.", true,
+                      HINT_DURATION_CREDENTIAL_US);
+      goto cleanup;
+    }
+  }
 #if CHIAKI_CAN_USE_HOLEPUNCH
   ChiakiHolepunchSession holepunch_session = NULL;
 #endif
@@ -245,6 +266,18 @@ int host_stream(VitaChiakiHost *host) {
       goto cleanup;
     }
     uint64_t now_unix = (uint64_t)time(NULL);
+    /* Normally the token lifecycle has refreshed ahead of expiry and this
+     * costs nothing; an expired token waits for the one refresh in flight. */
+    uint64_t token_valid_sec = 0;
+    ChiakiTokenFreshness token_freshness = psn_auth_token_freshness(now_unix, &token_valid_sec);
+    LOGD("PSN OAuth token %s, valid for %llu s", chiaki_token_freshness_string(token_freshness),
+         (unsigned long long)token_valid_sec);
+    if (token_freshness == CHIAKI_TOKEN_REJECTED) {
+      LOGE("PSN OAuth refresh token was rejected; skipping internet remote play");
+      host_set_hint(host, "PSN session expired. Re-authenticate in Profile.", true,
+                    HINT_DURATION_CREDENTIAL_US);
+      goto cleanup;
+    }
     if (!psn_auth_token_is_valid(now_unix) && !psn_auth_refresh_token_if_needed(now_unix, false)) {
       LOGE("PSN OAuth token expired and refresh failed for internet remote play");
       host_set_hint(host, "PSN session expired. Re-authenticate in Profile.", true,
@@ -297,6 +330,15 @@ int host_stream(VitaChiakiHost *host) {
   chiaki_connect_info.video_profile_auto_downgrade = true;
   chiaki_connect_info.send_actual_start_bitrate = context.config.send_actual_start_bitrate;
   chiaki_connect_info.ps5 = chiaki_target_is_ps5(host->target);
+  /* Just woken: the session port opens a moment after discovery reports ready. */
+  if (wake_before_connect && !psn_remote)
+    chiaki_connect_info.session_request_retry_ms = HOST_WAKE_SESSION_RETRY_MS;
+  chiaki_connect_info.launch_hints_policy =
+      host_launch_hints_policy_for_mode(context.config.latency_mode);
+  /* Reconnect with what the last session to this console found out: its RP version,
+   * the Senkusha results, the link history and the downgraded video profile. */
+  if (vita_startup_require(VITA_STARTUP_HOST_PROFILES))
+    host_profile_apply(host, psn_remote, &chiaki_connect_info);
 #if CHIAKI_CAN_USE_HOLEPUNCH
   if (psn_remote) {
     if (!context.config.psn_account_id || !context.config.psn_account_id[0]) {
@@ -391,6 +433,24 @@ int host_stream(VitaChiakiHost *host) {
   context.stream.fps_window_frame_count = 0;
   context.stream.pacing_accumulator = 0;
   LOGD("Chiaki session initialized successfully, starting media pipeline");
+  ChiakiAvSyncConfig av_sync_config;
+  chiaki_av_sync_config_defaults(&av_sync_config);
+  av_sync_config.video_fps = negotiated;
+  chiaki_av_sync_free(context.stream.av_sync);
+  context.stream.av_sync = chiaki_av_sync_new(&av_sync_config);
+  if (!context.stream.av_sync)
+    LOGE("Failed to create A/V sync, presenting frames as they decode");
+  ChiakiDecodeGovernorConfig decode_governor_config;
+  chiaki_decode_governor_config_defaults(&decode_governor_config);
+  decode_governor_config.fps = negotiated;
+  chiaki_decode_governor_init(&context.stream.decode_governor, &decode_governor_config);
+  context.stream.decode_pressure_logged = CHIAKI_DECODE_PRESSURE_NONE;
+  context.stream.shed_frames_lost = 0;
+  context.stream.shed_frame_recovered = false;
+  // sceAvcdec decodes H.264 only
+  chiaki_nal_check_init(&context.stream.nal_check, CHIAKI_CODEC_H264);
+  context.stream.nal_check_logged_us = 0;
+  context.stream.nal_check_resync_us = 0;
   ChiakiAudioSink audio_sink;
   chiaki_opus_decoder_init(&context.stream.opus_decoder, &context.log);
   chiaki_opus_decoder_set_cb(&context.stream.opus_decoder, vita_audio_init, vita_audio_cb, NULL);
@@ -422,7 +482,7 @@ int host_stream(VitaChiakiHost *host) {
   }
 
   context.stream.input_thread_should_exit = false;
-  err = chiaki_thread_create(&context.stream.input_thread, host_input_thread_func, &context.stream);
+  err = chiaki_thread_create_role(&context.stream.input_thread, CHIAKI_THREAD_ROLE_INPUT, host_input_thread_func, &context.stream);
   if (err != CHIAKI_ERR_SUCCESS) {
     LOGE("Failed to create input thread");
   }
@@ -1,6 +1,7 @@
 #include "context.h"
 #include "host_feedback.h"
 #include "host_metrics.h"
+#include "host_profile.h"
 #include "host_quit.h"
 #include "host_callbacks.h"
 #include "ui.h"
@@ -59,7 +60,7 @@ void host_event_cb(ChiakiEvent *event, void *user) {
 }
 
 bool host_video_cb(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool frame_recovered,
-                   void *user) {
+                   const ChiakiVideoSampleInfo *info, void *user) {
   if (context.stream.stop_requested)
     return false;
   if (!context.stream.video_first_frame_logged) {
@@ -69,6 +70,7 @@ bool host_video_cb(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool fram
     LOGD("VIDEO CALLBACK: First frame received (size=%zu)", buf_size);
     LOGD("PIPE/TIME_TO_FIRST_FRAME us=%llu", (unsigned long long)delta_us);
     context.stream.video_first_frame_logged = true;
+    host_profile_record(&context.stream.session);
 
     if (ui_connection_overlay_active()) {
       ui_connection_complete();
@@ -84,13 +86,46 @@ bool host_video_cb(uint8_t *buf, size_t buf_size, int32_t frames_lost, bool fram
   if (context.stream.reconnect_overlay_active)
     context.stream.reconnect_overlay_active = false;
 
+  /* Decode pressure is the one exception to decoding every frame: frames
+   * nothing refers to are shed, which leaves the DPB reference chain intact.
+   * Parameter sets always reach the decoder. The losses reported with a shed
+   * frame still mark the next decoded one as corrupt. */
+  if (!info->header && chiaki_decode_governor_frame(&context.stream.decode_governor,
+                                                    info->non_reference,
+                                                    sceKernelGetProcessTimeWide())) {
+    context.stream.shed_frames_lost += frames_lost;
+    context.stream.shed_frame_recovered |= frame_recovered;
+    host_handle_decode_pressure();
+    return true;
+  }
   /* Pass frame quality with the decode call so the corruption flag and the
    * last-good snapshot are updated atomically under the decode mutex —
    * keeping them consistent with the pixels written to frame_texture.
-   * Decode always runs unconditionally to keep the HW decoder DPB reference
+   * Decode otherwise always runs to keep the HW decoder DPB reference
    * chain in sync. */
   bool frame_corrupt = (frames_lost > 0) || frame_recovered;
-  int err = vita_h264_decode_frame(buf, buf_size, frame_corrupt);
+  if (!info->header) {
+    frame_corrupt |= (context.stream.shed_frames_lost > 0) || context.stream.shed_frame_recovered;
+    context.stream.shed_frames_lost = 0;
+    context.stream.shed_frame_recovered = false;
+  }
+  /* An access unit the decoder would fail on is caught before it gets there:
+   * a malformed one is not submitted, a damaged one only up to the damage,
+   * leaving the rest of the picture to concealment. */
+  ChiakiNalCheckResult nal_check;
+  chiaki_nal_check(&context.stream.nal_check, buf, buf_size, &nal_check);
+  host_handle_nal_check(&nal_check);
+  if (nal_check.verdict == CHIAKI_NAL_CHECK_MALFORMED)
+    return false;
+  if (nal_check.verdict == CHIAKI_NAL_CHECK_DAMAGED) {
+    buf_size = nal_check.valid_size;
+    frame_corrupt = true;
+  }
+  if (context.stream.av_sync && !info->header)
+    chiaki_av_sync_video_frame(context.stream.av_sync, info->frame_index,
+                               sceKernelGetProcessTimeWide());
+  int err = vita_h264_decode_frame(buf, buf_size, frame_corrupt, info->frame_index);
+  host_handle_decode_pressure();
   if (err != 0) {
     LOGE("Error during video decode: %d", err);
     return false;
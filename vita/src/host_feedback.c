@@ -2,6 +2,7 @@
 #include "host_constants.h"
 #include "host_feedback.h"
 #include "host_loss_profile.h"
+#include "host_recovery.h"
 #include "video.h"
 
 #include <psp2/kernel/processmgr.h>
@@ -12,6 +13,8 @@
 #define UNRECOVERED_FRAME_THRESHOLD 3
 #define LOSS_COUNTER_SATURATED_WINDOW_FRAMES (1u << 0)
 #define LOSS_COUNTER_SATURATED_BURST_FRAMES (1u << 1)
+#define NAL_CHECK_LOG_INTERVAL_US (1000 * 1000ULL)
+#define NAL_CHECK_RESYNC_HOLDOFF_US (1000 * 1000ULL)
 
 void host_set_hint(VitaChiakiHost *host, const char *msg, bool is_error, uint64_t duration_us) {
   if (!host)
@@ -197,3 +200,69 @@ void host_handle_loss_event(int32_t frames_lost, bool frame_recovered) {
   host_request_decoder_resync("packet-loss follow-up");
   context.stream.loss_recovery_gate_hits = 1;
 }
+
+void host_handle_decode_pressure(void) {
+  ChiakiDecodeGovernor *governor = &context.stream.decode_governor;
+  if (governor->pressure != context.stream.decode_pressure_logged) {
+    LOGD("PIPE/DECODE_GOV pressure=%s load=%.2f backlog_us=%llu shed=%llu missed=%llu",
+         chiaki_decode_pressure_string(governor->pressure), chiaki_decode_governor_load(governor),
+         (unsigned long long)governor->backlog_us, (unsigned long long)governor->shed,
+         (unsigned long long)governor->shed_missed);
+    context.stream.decode_pressure_logged = governor->pressure;
+  }
+
+  if (!chiaki_decode_governor_take_escalation(governor))
+    return;
+  if (context.stream.stop_requested || context.stream.fast_restart_active)
+    return;
+
+  // Shedding non-reference frames did not relieve the decoder; only a lower
+  // bitrate will. The PS5 ignores loss reports, so this takes a soft restart.
+  uint32_t bitrate_kbps = context.stream.session.connect_info.video_profile.bitrate;
+  uint32_t target_kbps = chiaki_decode_governor_target_kbps(governor, bitrate_kbps);
+  if (target_kbps >= bitrate_kbps) {
+    LOGD("PIPE/DECODE_GOV action=escalate_skipped bitrate=%u reason=at_minimum", bitrate_kbps);
+    return;
+  }
+  uint64_t now_us = sceKernelGetProcessTimeWide();
+  bool ok = host_recovery_request_bitrate_reduction("decode_pressure", target_kbps, now_us);
+  LOGD("PIPE/DECODE_GOV action=escalate bitrate=%u target=%u load=%.2f ok=%d", bitrate_kbps,
+       target_kbps, chiaki_decode_governor_load(governor), ok ? 1 : 0);
+  if (ok) {
+    chiaki_decode_governor_reset(governor);
+    context.stream.decode_pressure_logged = CHIAKI_DECODE_PRESSURE_NONE;
+    if (context.active_host) {
+      host_set_hint(context.active_host, "Decoder overloaded - lowering bitrate", false,
+                    HINT_DURATION_RECOVERY_US);
+    }
+  }
+}
+
+void host_handle_nal_check(const ChiakiNalCheckResult *result) {
+  if (result->verdict == CHIAKI_NAL_CHECK_OK)
+    return;
+  ChiakiNalCheck *check = &context.stream.nal_check;
+  uint64_t now_us = sceKernelGetProcessTimeWide();
+  if (!context.stream.nal_check_logged_us ||
+      now_us - context.stream.nal_check_logged_us >= NAL_CHECK_LOG_INTERVAL_US) {
+    LOGD("PIPE/NAL_CHECK verdict=%s error=%s offset=%zu valid=%zu slices=%u mbs=%u/%u "
+         "damaged=%llu malformed=%llu",
+         chiaki_nal_check_verdict_string(result->verdict),
+         chiaki_nal_check_error_string(result->error), result->error_offset, result->valid_size,
+         result->slices, result->pic_size_valid, result->pic_size,
+         (unsigned long long)check->verdicts[CHIAKI_NAL_CHECK_DAMAGED],
+         (unsigned long long)check->verdicts[CHIAKI_NAL_CHECK_MALFORMED]);
+    context.stream.nal_check_logged_us = now_us;
+  }
+
+  // Whatever of the picture is missing, later frames refer to it until the next IDR.
+  if (context.stream.stop_requested || context.stream.fast_restart_active)
+    return;
+  if (context.stream.nal_check_resync_us &&
+      now_us - context.stream.nal_check_resync_us < NAL_CHECK_RESYNC_HOLDOFF_US)
+    return;
+  context.stream.nal_check_resync_us = now_us;
+  host_request_decoder_resync(result->verdict == CHIAKI_NAL_CHECK_MALFORMED
+                                  ? "malformed access unit"
+                                  : "damaged access unit");
+}
@@ -22,6 +22,8 @@ void host_shutdown_media_pipeline(void) {
   chiaki_opus_decoder_fini(&context.stream.opus_decoder);
   vita_h264_cleanup();
   vita_audio_cleanup();
+  chiaki_av_sync_free(context.stream.av_sync);
+  context.stream.av_sync = NULL;
   context.stream.media_initialized = false;
   context.stream.inputs_ready = false;
   context.stream.fast_restart_active = false;
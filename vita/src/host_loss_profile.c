@@ -113,6 +113,57 @@ LossDetectionProfile host_loss_profile_for_mode(VitaChiakiLatencyMode mode) {
   return profile;
 }
 
+/* Lower latency modes claim less of a lossy link's throughput and report its loss
+ * higher, so the encoder starts below the queueing point. Higher ones trade that for
+ * picture quality and pad the rtt for the deeper buffers they run with. */
+ChiakiLaunchHintsPolicy host_launch_hints_policy_for_mode(VitaChiakiLatencyMode mode) {
+  ChiakiLaunchHintsPolicy policy;
+  chiaki_launch_hints_policy_defaults(&policy);
+
+  switch (mode) {
+    case VITA_LATENCY_MODE_ULTRA_LOW:
+      policy.bw_headroom = 0.8;
+      policy.loss_cap_threshold = 0.01;
+      policy.bw_min_kbps = 800;
+      policy.loss_scale = 2.0;
+      policy.loss_min = 0.002;
+      policy.loss_max = 0.08;
+      break;
+    case VITA_LATENCY_MODE_LOW:
+      policy.bw_headroom = 0.85;
+      policy.loss_cap_threshold = 0.015;
+      policy.bw_min_kbps = 1000;
+      policy.loss_scale = 1.75;
+      policy.loss_min = 0.0015;
+      policy.loss_max = 0.06;
+      break;
+    case VITA_LATENCY_MODE_BALANCED:
+    default:
+      policy.bw_headroom = 0.9;
+      policy.loss_cap_threshold = 0.02;
+      policy.bw_min_kbps = 1200;
+      break;
+    case VITA_LATENCY_MODE_HIGH:
+      policy.bw_headroom = 0.95;
+      policy.loss_cap_threshold = 0.03;
+      policy.bw_min_kbps = 1500;
+      policy.loss_scale = 1.25;
+      policy.loss_max = 0.04;
+      policy.rtt_margin_ms = 5;
+      break;
+    case VITA_LATENCY_MODE_MAX:
+      policy.bw_headroom = 1.0;
+      policy.loss_cap_threshold = 0.04;
+      policy.bw_min_kbps = 1800;
+      policy.loss_scale = 1.0;
+      policy.loss_max = 0.03;
+      policy.rtt_margin_ms = 10;
+      break;
+  }
+
+  return policy;
+}
+
 void host_adjust_loss_profile_with_metrics(LossDetectionProfile *profile) {
   if (!profile)
     return;
@@ -1,6 +1,7 @@
 #include "context.h"
 #include "host_metrics.h"
 #include "host_feedback.h"
+#include "host_profile.h"
 #include "host_recovery.h"
 #include "audio.h"
 #include "video.h"
@@ -167,6 +168,7 @@ void host_metrics_update_latency(void) {
   ChiakiVideoReceiver *receiver = stream_connection->video_receiver;
   if (!receiver)
     return;
+  host_profile_observe(sceKernelGetProcessTimeWide());
 
   uint32_t takion_drop_events = context.stream.takion_drop_events;
   uint32_t takion_drop_packets = context.stream.takion_drop_packets;
@@ -387,6 +389,18 @@ void host_metrics_update_latency(void) {
         context.stream.freeze_engaged_count, context.stream.wifi_rssi, context.stream.display_fps,
         context.stream.stuck_bitrate_low_fps_streak, (int)context.stream.stuck_bitrate_restart_used,
         context.stream.cascade_alarm_streak, (int)context.stream.cascade_alarm_restart_used);
+    if (context.stream.av_sync) {
+      ChiakiAvSyncStats av;
+      chiaki_av_sync_stats(context.stream.av_sync, &av);
+      LOGD(
+          "PIPE/AVSYNC error_us=%lld error_avg_us=%llu audio_latency_us=%lld drift_ppm=%.1f "
+          "ratio=%.4f buffer_us=%llu target_us=%llu jitter_us=%llu held=%llu late=%llu",
+          (long long)av.sync_error_us, (unsigned long long)av.sync_error_avg_us,
+          (long long)av.audio_latency_us, av.drift_ppm, av.resample_ratio,
+          (unsigned long long)av.audio_buffer_us, (unsigned long long)av.audio_target_us,
+          (unsigned long long)av.audio_jitter_us, (unsigned long long)av.held,
+          (unsigned long long)av.late);
+    }
     last_log_us = now_us;
   }
 
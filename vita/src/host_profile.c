@@ -0,0 +1,186 @@
+#include "context.h"
+#include "host_profile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chiaki/connprofile.h>
+
+/* Early-stream window observed for the link history: the first seconds, while the
+ * encoder still runs on what the LaunchSpec told it. */
+#define LAUNCH_OBSERVE_WINDOW_US (10 * 1000 * 1000ULL)
+
+static ChiakiConnProfileStore *profile_store;
+
+/* The connect in flight, set by host_profile_apply() before its session starts. */
+static struct {
+  bool active;
+  char key[CHIAKI_CONN_PROFILE_KEY_SIZE];
+  char system_version[CHIAKI_CONN_PROFILE_VERSION_SIZE];
+  char addr[CHIAKI_CONN_PROFILE_ADDR_SIZE];
+  bool psn_remote;
+  uint32_t applied;
+  ChiakiConnectVideoProfile video_requested;
+} pending;
+
+/* The session that got to its first frame, until its early-stream window closed. */
+static struct {
+  bool active;
+  char key[CHIAKI_CONN_PROFILE_KEY_SIZE];
+  uint64_t start_us;
+  uint32_t received;
+  uint32_t lost;
+  uint64_t bytes;
+} observe;
+
+static bool bytes_are_zero(const uint8_t *bytes, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    if (bytes[i])
+      return false;
+  }
+  return true;
+}
+
+static void hex_key(char *out, size_t out_size, const char *prefix, const uint8_t *bytes,
+                    size_t size) {
+  size_t pos = (size_t)snprintf(out, out_size, "%s", prefix);
+  for (size_t i = 0; i < size && pos + 2 < out_size; i++, pos += 2)
+    snprintf(out + pos, out_size - pos, "%02x", bytes[i]);
+}
+
+/* The MAC for LAN consoles, the device uid for PSN ones, the hostname for manual
+ * hosts that were never discovered. */
+static bool host_profile_key(VitaChiakiHost *host, bool psn_remote, char *out, size_t out_size) {
+  out[0] = '\0';
+  if (!psn_remote && !bytes_are_zero(host->server_mac, sizeof(host->server_mac)))
+    hex_key(out, out_size, "", host->server_mac, sizeof(host->server_mac));
+  else if (psn_remote && !bytes_are_zero(host->psn_device_uid, sizeof(host->psn_device_uid)))
+    hex_key(out, out_size, "psn:", host->psn_device_uid, sizeof(host->psn_device_uid));
+  else if (host->hostname && host->hostname[0])
+    snprintf(out, out_size, "host:%s", host->hostname);
+  return out[0] != '\0';
+}
+
+bool host_profile_init(void) {
+  if (profile_store)
+    return true;
+  ChiakiConnProfileStoreConfig config;
+  chiaki_conn_profile_store_config_defaults(&config);
+  profile_store = chiaki_conn_profile_store_new(&config);
+  if (!profile_store) {
+    LOGE("host_profile: store init failed, every connect goes the full way");
+    return false;
+  }
+  return true;
+}
+
+void host_profile_fini(void) {
+  if (!profile_store)
+    return;
+  ChiakiConnProfileStoreStats stats;
+  chiaki_conn_profile_store_stats(profile_store, &stats);
+  LOGD("host_profile: lookups=%llu hot=%llu mismatches=%llu records=%llu",
+       (unsigned long long)stats.lookups, (unsigned long long)stats.hot,
+       (unsigned long long)stats.mismatches, (unsigned long long)stats.records);
+  chiaki_conn_profile_store_free(profile_store);
+  profile_store = NULL;
+}
+
+void host_profile_apply(VitaChiakiHost *host, bool psn_remote, ChiakiConnectInfo *connect_info) {
+  memset(&pending, 0, sizeof(pending));
+  observe.active = false;
+  if (!profile_store || !host_profile_key(host, psn_remote, pending.key, sizeof(pending.key)))
+    return;
+  pending.active = true;
+  pending.psn_remote = psn_remote;
+  pending.video_requested = connect_info->video_profile;
+  if (connect_info->host)
+    snprintf(pending.addr, sizeof(pending.addr), "%s", connect_info->host);
+  if (host->discovery_state && host->discovery_state->system_version)
+    snprintf(pending.system_version, sizeof(pending.system_version), "%s",
+             host->discovery_state->system_version);
+
+  ChiakiConnProfile profile;
+  uint32_t valid = chiaki_conn_profile_store_lookup(profile_store, pending.key,
+                                                    pending.system_version, pending.addr, &profile);
+  if (!valid)
+    return;
+  pending.applied = chiaki_conn_profile_apply(&profile, connect_info);
+  LOGD("host_profile: hot connect to %s (target=%d, link=%d, video=%d, history=%u)", pending.key,
+       (pending.applied & CHIAKI_CONN_PROFILE_PART_TARGET) ? (int)profile.target : -1,
+       (pending.applied & CHIAKI_CONN_PROFILE_PART_LINK) ? 1 : 0,
+       (pending.applied & CHIAKI_CONN_PROFILE_PART_VIDEO) ? 1 : 0,
+       (pending.applied & CHIAKI_CONN_PROFILE_PART_HISTORY) ? profile.history.sessions : 0);
+}
+
+void host_profile_record(ChiakiSession *session) {
+  if (!profile_store || !pending.active)
+    return;
+  pending.active = false;
+  ChiakiConnProfile profile;
+  memset(&profile, 0, sizeof(profile));
+  snprintf(profile.key, sizeof(profile.key), "%s", pending.key);
+  memcpy(profile.system_version, pending.system_version, sizeof(profile.system_version));
+  chiaki_conn_profile_from_session(&profile, session, &pending.video_requested);
+  if (pending.addr[0]) {
+    memcpy(profile.addr, pending.addr, sizeof(profile.addr));
+    profile.parts |= CHIAKI_CONN_PROFILE_PART_ADDR;
+  }
+  /* recorded for diagnostics, holepunch still negotiates: NAT mappings don't outlive a session */
+  if (pending.psn_remote && context.stream.psn_selected_addr[0]) {
+    snprintf(profile.remote_addr, sizeof(profile.remote_addr), "%s",
+             context.stream.psn_selected_addr);
+    profile.parts |= CHIAKI_CONN_PROFILE_PART_REMOTE;
+  }
+  chiaki_conn_profile_store_record(profile_store, &profile);
+
+  ChiakiStreamConnection *stream_connection = &session->stream_connection;
+  observe.active = stream_connection->video_receiver != NULL;
+  if (!observe.active)
+    return;
+  memcpy(observe.key, pending.key, sizeof(observe.key));
+  observe.start_us = sceKernelGetProcessTimeWide();
+  observe.received = stream_connection->congestion_control.received_total;
+  observe.lost = stream_connection->congestion_control.lost_total;
+  observe.bytes = stream_connection->video_receiver->frame_processor.stream_stats.bytes_total;
+}
+
+void host_profile_observe(uint64_t now_us) {
+  if (!profile_store || !observe.active || now_us - observe.start_us < LAUNCH_OBSERVE_WINDOW_US)
+    return;
+  observe.active = false;
+  ChiakiSession *session = &context.stream.session;
+  ChiakiStreamConnection *stream_connection = &session->stream_connection;
+  if (!stream_connection->video_receiver)
+    return;
+  uint64_t bytes_total = stream_connection->video_receiver->frame_processor.stream_stats.bytes_total;
+  /* the stream restarted within the window, its counters started over */
+  if (bytes_total < observe.bytes)
+    return;
+  uint64_t bytes = bytes_total - observe.bytes;
+  uint32_t received = stream_connection->congestion_control.received_total - observe.received;
+  uint32_t lost = stream_connection->congestion_control.lost_total - observe.lost;
+  if (received + lost == 0)
+    return;
+  double loss = (double)lost / (double)(received + lost);
+  uint32_t throughput_kbps = (uint32_t)(bytes * 8 * 1000 / (now_us - observe.start_us));
+  chiaki_conn_profile_store_observe(profile_store, observe.key, loss, throughput_kbps);
+
+  const ChiakiLaunchHints *hints = &session->launch_hints;
+  LOGD(
+      "PIPE/LAUNCH key=%s hint_kbps=%u hint_loss=%.4f hint_mtu=%u hint_rtt_ms=%u sources=0x%x "
+      "requested_kbps=%u observed_kbps=%u observed_loss=%.4f received=%u lost=%u",
+      observe.key, hints->bw_kbps, hints->bw_loss, hints->mtu, hints->rtt_ms,
+      (unsigned int)hints->sources, session->connect_info.video_profile.bitrate,
+      (unsigned int)throughput_kbps, loss, (unsigned int)received, (unsigned int)lost);
+}
+
+void host_profile_failed(void) {
+  if (!profile_store || !pending.active)
+    return;
+  pending.active = false;
+  if (!pending.applied)
+    return;
+  LOGD("host_profile: hot connect to %s failed, dropping its hints", pending.key);
+  chiaki_conn_profile_store_mismatch(profile_store, pending.key, pending.applied);
+}
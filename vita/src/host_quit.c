@@ -5,6 +5,7 @@
 #include "host_feedback.h"
 #include "host_lifecycle.h"
 #include "host_metrics.h"
+#include "host_profile.h"
 #include "host_quit.h"
 
 #include <psp2/kernel/processmgr.h>
@@ -41,6 +42,8 @@ void host_handle_quit_event(ChiakiEvent *event) {
          context.stream.session_generation, context.stream.session_generation - 1);
     context.stream.session_generation--;
   }
+  if (!context.stream.is_streaming && !user_stop_requested)
+    host_profile_failed();
   ui_connection_cancel();
   bool restart_failed = context.stream.fast_restart_active;
   bool retry_pending = context.stream.loss_retry_pending;
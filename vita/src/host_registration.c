@@ -106,31 +106,38 @@ int host_register(VitaChiakiHost *host, int pin) {
   return 0;
 }
 
-int host_wakeup(VitaChiakiHost *host) {
+static bool host_wake_credential(VitaChiakiHost *host, uint64_t *credential) {
   if (!host) {
     LOGE("Missing host. Cannot send wakeup signal.");
-    return 1;
+    return false;
   }
   if (!host->hostname) {
     LOGE("Missing hostname. Cannot send wakeup signal.");
-    return 1;
+    return false;
   }
   if (!host->registered_state) {
     LOGE("Missing registered host state for %s. Cannot send wakeup signal.", host->hostname);
-    return 1;
+    return false;
   }
   if (!host->registered_state->rp_regist_key[0]) {
     LOGE("Missing registration credential for %s. Cannot send wakeup signal.", host->hostname);
-    return 1;
+    return false;
   }
 
   char *parse_end = NULL;
-  uint64_t credential = (uint64_t)strtoull(host->registered_state->rp_regist_key, &parse_end, 16);
+  *credential = (uint64_t)strtoull(host->registered_state->rp_regist_key, &parse_end, 16);
   if (parse_end == host->registered_state->rp_regist_key || *parse_end != '\0') {
     LOGE("Invalid wake credential format for %s: \"%s\"", host->hostname,
          host->registered_state->rp_regist_key);
-    return 1;
+    return false;
   }
+  return true;
+}
+
+int host_wakeup(VitaChiakiHost *host) {
+  uint64_t credential;
+  if (!host_wake_credential(host, &credential))
+    return 1;
 
   bool is_ps5 = chiaki_target_is_ps5(host->target);
   LOGD("Attempting wake signal to %s (target=%s, discovery_enabled=%d)", host->hostname,
@@ -147,3 +154,45 @@ int host_wakeup(VitaChiakiHost *host) {
   LOGD("Wake signal sent successfully to %s", host->hostname);
   return 0;
 }
+
+int host_wake_and_wait(VitaChiakiHost *host) {
+  uint64_t credential;
+  if (!host_wake_credential(host, &credential))
+    return 1;
+
+  ChiakiWakeConfig config;
+  chiaki_wake_config_defaults(&config);
+  config.host = host->hostname;
+  config.ps5 = chiaki_target_is_ps5(host->target);
+  config.user_credential = credential;
+
+  ChiakiWakeOrchestrator wake;
+  ChiakiErrorCode err = chiaki_wake_orchestrator_init(&wake, &context.log, &config);
+  if (err != CHIAKI_ERR_SUCCESS) {
+    LOGE("Failed to set up wake for %s: %s", host->hostname, chiaki_error_string(err));
+    return 1;
+  }
+
+  // Published for host_cancel_stream_request(), which may already have run
+  chiaki_mutex_lock(&context.stream.finalization_mutex);
+  context.stream.wake = &wake;
+  if (context.stream.wake_canceled)
+    chiaki_wake_orchestrator_cancel(&wake);
+  chiaki_mutex_unlock(&context.stream.finalization_mutex);
+
+  ChiakiWakeTimeline timeline;
+  err = chiaki_wake_orchestrator_run(&wake, &timeline);
+
+  chiaki_mutex_lock(&context.stream.finalization_mutex);
+  context.stream.wake = NULL;
+  chiaki_mutex_unlock(&context.stream.finalization_mutex);
+  chiaki_wake_orchestrator_fini(&wake);
+
+  if (err != CHIAKI_ERR_SUCCESS) {
+    LOGE("Waking %s failed: %s", host->hostname, chiaki_error_string(err));
+    return 1;
+  }
+  LOGD("Console %s ready %llu ms after wake (%u wake signals)", host->hostname,
+       (unsigned long long)timeline.total_ms, timeline.wakeups);
+  return 0;
+}
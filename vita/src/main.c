@@ -41,12 +41,30 @@
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <chiaki/thread.h>
 // #include <debugnet.h>
 
 #include "context.h"
 #include "discovery.h"
 #include "ui.h"
 #include "ui/ui_controller_diagram.h"
+#include "psn_auth.h"
+#include "startup.h"
+
+// Scheduling of all stream threads. H.264 decode (sceAvcdecDecode) and audio
+// output (vita_audio_cb) both run synchronously on the takion thread, so
+// NETWORK and DECODE share USER_0 and audio follows them there. USER_2 stays
+// reserved for a thread of its own with the AUDIO role, input floats on any
+// core at a lower priority.
+static void vita_install_thread_policies(void) {
+  ChiakiThreadPolicyTable table;
+  chiaki_thread_policy_table_init(&table);
+  table.roles[CHIAKI_THREAD_ROLE_NETWORK] = (ChiakiThreadPolicy){ 64, 1u << 0, 0 };
+  table.roles[CHIAKI_THREAD_ROLE_DECODE] = (ChiakiThreadPolicy){ 64, 1u << 0, 0 };
+  table.roles[CHIAKI_THREAD_ROLE_AUDIO] = (ChiakiThreadPolicy){ 64, 1u << 2, 0 };
+  table.roles[CHIAKI_THREAD_ROLE_INPUT] = (ChiakiThreadPolicy){ 96, CHIAKI_THREAD_CORE_MASK_ANY, 0 };
+  chiaki_thread_policy_table_set(&table);
+}
 
 static int vita_init() {
   // Overclock various aspects of the vita
@@ -59,6 +77,7 @@ static int vita_init() {
   sceKernelGetRandomNumber(random_seed, sizeof(random_seed));
   RAND_seed(random_seed, sizeof(random_seed));
   OpenSSL_add_all_algorithms();
+  vita_install_thread_policies();
 
   LOGD("Vita Chiaki %s", CHIAKI_VERSION);
 #if CHIAKI_CAN_USE_HOLEPUNCH
@@ -136,17 +155,29 @@ static int vita_init() {
 unsigned int _newlib_heap_size_user = 64 * 1024 * 1024;
 
 int main(int argc, char *argv[]) {
-  vita_init();
+  vita_startup_begin();
+  CHIAKI_STARTUP_SCOPE(vita_startup_prof(), "vita_init")
+    vita_init();
 
   // Note: Power management is configured in vita_init() (scePowerSet* calls)
   // Note: Input thread is created per-stream in host.c when streaming starts
 
   sceIoMkdir("ux0:/data/vita-chiaki", 0777);
 
-  vita_chiaki_init_context();
+  CHIAKI_STARTUP_SCOPE(vita_startup_prof(), "context")
+    vita_chiaki_init_context();
+
+  // The resolver cache (prefetching the PSN and STUN names) and the connection
+  // profiles come up in the background while the UI does, see startup.c.
+  vita_startup_start_units();
+  // Refresh the PSN token ahead of its expiry from here on, not when the user connects.
+  psn_auth_lifecycle_start();
+
   if (context.config.auto_discovery) {
     LOGD("Starting discovery");
-    ChiakiErrorCode err = start_discovery(NULL, NULL);
+    ChiakiErrorCode err;
+    CHIAKI_STARTUP_SCOPE(vita_startup_prof(), "discovery")
+      err = start_discovery(NULL, NULL);
     if (err != CHIAKI_ERR_SUCCESS) {
       LOGD("Failed to start discovery: %d\n", err);
       sceKernelExitProcess(err);
@@ -157,6 +188,8 @@ int main(int argc, char *argv[]) {
   draw_ui();
 
   // Cleanup
+  psn_auth_lifecycle_stop();
+  vita_startup_fini();
   // Controller diagram now uses procedural rendering - no textures to free
   if (context.mlog) {
     free(context.mlog);
@@ -1,4 +1,3 @@
-#include <assert.h>
 #include <ctype.h>
 #include <curl/curl.h>
 #include <errno.h>
@@ -7,10 +6,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <chiaki/jsonscan.h>
 #include <chiaki/remote/holepunch.h>
+#include <chiaki/thread.h>
+#include <chiaki/tokenlifecycle.h>
 
 #include "config.h"
 #include "context.h"
@@ -44,6 +47,8 @@
 #endif
 
 #define TOKEN_EXPIRY_SKEW_SEC 90ULL
+/* Longer than the 15 s curl timeout of one refresh request. */
+#define TOKEN_REFRESH_WAIT_MS 20000
 #define RESPONSE_CAP_BYTES (16 * 1024)
 #define AUTH_VERIFICATION_URL_MAX 1536
 #define PSN_CA_BUNDLE_PATH "app0:/assets/psn-ca-bundle.pem"
@@ -59,12 +64,6 @@ typedef struct {
   uint32_t poll_interval_sec;
 } PsnAuthRuntime;
 
-typedef struct {
-  char *data;
-  size_t len;
-  bool truncated;
-} HttpBuffer;
-
 #ifdef VITARPS5_DEBUG_OAUTH
 typedef struct {
   const char *url;
@@ -76,6 +75,23 @@ static PsnAuthRuntime g_psn_auth = {
     .poll_interval_sec = 5,
 };
 
+/* The token lifecycle refreshes on its own thread. Rotated tokens and refresh
+ * errors are parked here and applied by psn_auth_poll() on the UI thread, so
+ * context.config and g_psn_auth keep a single writer. */
+typedef struct {
+  ChiakiMutex mutex;
+  bool tokens_pending;
+  char *access_token;
+  char *refresh_token;
+  uint64_t expires_at_unix;
+  bool rejected_pending;
+  char error_desc[160];
+} PsnAuthHandoff;
+
+static ChiakiTokenLifecycle *g_token_lifecycle;
+static PsnAuthHandoff g_handoff;
+static bool g_token_refresh_held;
+
 static bool has_text(const char *s) {
   return s && s[0];
 }
@@ -131,16 +147,54 @@ bool psn_auth_has_tokens(void) {
          has_text(context.config.psn_oauth_refresh_token);
 }
 
+ChiakiTokenFreshness psn_auth_token_freshness(uint64_t now_unix, uint64_t *valid_sec) {
+  if (valid_sec)
+    *valid_sec = 0;
+  if (g_token_lifecycle) {
+    /* Counts on the monotonic clock from when the token arrived, so a Vita
+     * clock that is off does not make a good token look expired. */
+    ChiakiTokenStatus status;
+    chiaki_token_lifecycle_status(g_token_lifecycle, &status);
+    if (valid_sec)
+      *valid_sec = status.valid_ms / 1000;
+    return status.freshness;
+  }
+  if (!has_text(context.config.psn_oauth_access_token))
+    return CHIAKI_TOKEN_NONE;
+  if (context.config.psn_oauth_expires_at_unix <= now_unix)
+    return CHIAKI_TOKEN_EXPIRED;
+  if (valid_sec)
+    *valid_sec = context.config.psn_oauth_expires_at_unix - now_unix;
+  return now_unix + TOKEN_EXPIRY_SKEW_SEC < context.config.psn_oauth_expires_at_unix
+             ? CHIAKI_TOKEN_FRESH
+             : CHIAKI_TOKEN_REFRESH_DUE;
+}
+
 bool psn_auth_token_is_valid(uint64_t now_unix) {
-  if (!psn_auth_enabled() || !has_text(context.config.psn_oauth_access_token) ||
+  if (!psn_auth_enabled())
+    return false;
+  if (g_token_lifecycle) {
+    uint64_t valid_sec = 0;
+    psn_auth_token_freshness(now_unix, &valid_sec);
+    return valid_sec > TOKEN_EXPIRY_SKEW_SEC;
+  }
+  if (!has_text(context.config.psn_oauth_access_token) ||
       context.config.psn_oauth_expires_at_unix == 0) {
     return false;
   }
   return now_unix + TOKEN_EXPIRY_SKEW_SEC < context.config.psn_oauth_expires_at_unix;
 }
 
-const char *psn_auth_access_token(void) {
-  return context.config.psn_oauth_access_token;
+char *psn_auth_dup_access_token(void) {
+  char *token = NULL;
+  if (g_token_lifecycle) {
+    if (chiaki_token_lifecycle_access_token(g_token_lifecycle, &token) != CHIAKI_ERR_SUCCESS)
+      return NULL;
+    return token;
+  }
+  if (has_text(context.config.psn_oauth_access_token))
+    token = strdup(context.config.psn_oauth_access_token);
+  return token;
 }
 
 static void psn_auth_clear_error(void) {
@@ -180,39 +234,45 @@ static bool ensure_client_duid(void) {
   return true;
 }
 
+/* Drops tokens a refresh parked before the tokens were replaced. Call after
+ * chiaki_token_lifecycle_set()/_clear(), which wait for a persist in progress. */
+static void handoff_drop_tokens(void) {
+  if (!g_token_lifecycle)
+    return;
+  chiaki_mutex_lock(&g_handoff.mutex);
+  free(g_handoff.access_token);
+  free(g_handoff.refresh_token);
+  g_handoff.access_token = NULL;
+  g_handoff.refresh_token = NULL;
+  g_handoff.tokens_pending = false;
+  g_handoff.rejected_pending = false;
+  chiaki_mutex_unlock(&g_handoff.mutex);
+}
+
 void psn_auth_clear_tokens(void) {
   set_config_string(&context.config.psn_oauth_access_token, NULL);
   set_config_string(&context.config.psn_oauth_refresh_token, NULL);
   context.config.psn_oauth_expires_at_unix = 0;
+  if (g_token_lifecycle)
+    chiaki_token_lifecycle_clear(g_token_lifecycle);
+  handoff_drop_tokens();
   psn_auth_cancel_device_login();
 }
 
-static void *auth_realloc(void *ptr, size_t new_size) {
-  if (new_size > RESPONSE_CAP_BYTES)
-    return NULL;
-  return realloc(ptr, new_size);
-}
-
+/* Responses land in one RESPONSE_CAP_BYTES buffer allocated up front; the feed
+ * copies each curl chunk in place and drops whatever does not fit. */
 static size_t auth_write_cb(void *contents, size_t size, size_t nmemb, void *userp) {
   size_t append = size * nmemb;
-  HttpBuffer *buf = (HttpBuffer *)userp;
-  if (!buf || append == 0)
+  ChiakiJsonFeed *feed = (ChiakiJsonFeed *)userp;
+  if (!feed || append == 0)
     return 0;
-  size_t next_len = buf->len + append;
-  char *next = auth_realloc(buf->data, next_len + 1);
-  if (!next) {
-    if (!buf->truncated) {
-      buf->truncated = true;
-      LOGE("PSN auth HTTP response exceeded %u bytes; truncating", (unsigned)RESPONSE_CAP_BYTES);
-    }
-    /* Return full chunk size so libcurl does not abort with CURLE_WRITE_ERROR.
-     * Overflow bytes are intentionally discarded. */
-    return append;
-  }
-  buf->data = next;
-  memcpy(buf->data + buf->len, contents, append);
-  buf->len = next_len;
-  buf->data[buf->len] = '\0';
+  bool was_truncated = feed->truncated;
+  if (chiaki_json_feed_append(feed, contents, append) == CHIAKI_ERR_BUF_TOO_SMALL &&
+      !was_truncated) {
+    LOGE("PSN auth HTTP response exceeded %u bytes; truncating", (unsigned)RESPONSE_CAP_BYTES);
+  }
+  /* Return full chunk size so libcurl does not abort with CURLE_WRITE_ERROR.
+   * Overflow bytes are intentionally discarded. */
   return append;
 }
 
@@ -374,15 +434,34 @@ static int oauth_curl_debug_cb(CURL *handle, curl_infotype type, char *data, siz
 }
 #endif /* VITARPS5_DEBUG_OAUTH */
 
+/* Picks the server's clock out of the Date header, the token lifecycle
+ * compares it with ours. */
+static size_t auth_header_cb(char *buffer, size_t size, size_t nitems, void *userp) {
+  size_t len = size * nitems;
+  uint64_t *server_time = (uint64_t *)userp;
+  if (len > 5 && strncasecmp(buffer, "Date:", 5) == 0) {
+    char value[64];
+    size_t value_len = len - 5 < sizeof(value) - 1 ? len - 5 : sizeof(value) - 1;
+    memcpy(value, buffer + 5, value_len);
+    value[value_len] = '\0';
+    time_t t = curl_getdate(value, NULL);
+    if (t > 0)
+      *server_time = (uint64_t)t;
+  }
+  return len;
+}
+
 static bool oauth_post_form(const char *url, const char *form_data, const char *basic_user,
-                            const char *basic_pass, long *http_code_out, char **response_out) {
+                            const char *basic_pass, long *http_code_out, char **response_out,
+                            size_t *response_len_out, uint64_t *server_time_out) {
   if (!has_text(url) || !has_text(form_data))
     return false;
 
   bool ok = false;
   CURL *curl = curl_easy_init();
   struct curl_slist *headers = NULL;
-  HttpBuffer response = {.data = NULL, .len = 0};
+  char *response_buf = NULL;
+  ChiakiJsonFeed response;
 #ifdef VITARPS5_DEBUG_OAUTH
   CurlDebugContext debug_ctx = {.url = url};
 #endif /* VITARPS5_DEBUG_OAUTH */
@@ -404,6 +483,12 @@ static bool oauth_post_form(const char *url, const char *form_data, const char *
     LOGE("PSN auth HTTP init failed for %s", url ? url : "<null>");
     goto cleanup;
   }
+  response_buf = malloc(RESPONSE_CAP_BYTES + 1);
+  if (!response_buf) {
+    LOGE("PSN auth HTTP response buffer allocation failed for %s", url);
+    goto cleanup;
+  }
+  chiaki_json_feed_init(&response, response_buf, RESPONSE_CAP_BYTES + 1);
 
   headers = curl_slist_append(headers, "Content-Type: application/x-www-form-urlencoded");
   headers = curl_slist_append(headers, "Accept: application/json");
@@ -452,6 +537,11 @@ static bool oauth_post_form(const char *url, const char *form_data, const char *
   }
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, auth_write_cb);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+  if (server_time_out) {
+    *server_time_out = 0;
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, auth_header_cb);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, server_time_out);
+  }
 
   LOGD("PSN auth HTTP POST url=%s cafile=%s basic_user=%s basic_pass_present=%s form_len=%u", url,
        PSN_CA_BUNDLE_PATH, has_text(basic_user) ? basic_user : "<none>",
@@ -491,17 +581,19 @@ static bool oauth_post_form(const char *url, const char *form_data, const char *
 
   LOGD(
       "PSN auth HTTP response url=%s effective_url=%s primary_ip=%s primary_port=%ld local_ip=%s "
-      "local_port=%ld status=%ld response_len=%u truncated=%s",
+      "local_port=%ld status=%ld response_len=%u truncated=%s json_complete=%s",
       url, effective_url ? effective_url : "<none>", primary_ip ? primary_ip : "<none>",
       primary_port, local_ip ? local_ip : "<none>", local_port, http_code, (unsigned)response.len,
-      response.truncated ? "true" : "false");
+      response.truncated ? "true" : "false", chiaki_json_feed_complete(&response) ? "true" : "false");
 
   if (http_code_out)
     *http_code_out = http_code;
   if (response_out) {
-    *response_out = response.data;
-    response.data = NULL;
+    *response_out = response_buf;
+    response_buf = NULL;
   }
+  if (response_len_out)
+    *response_len_out = response.len;
   ok = true;
 
 cleanup:
@@ -512,282 +604,33 @@ cleanup:
   curl_slist_free_all(resolve_list);
 #endif /* __PSVITA__ */
   curl_easy_cleanup(curl);
-  free(response.data);
+  free(response_buf);
   return ok;
 }
 
-static const char *json_find_key_value(const char *json, const char *key) {
-  if (!json || !key)
+/* Copies a string value out of the response into a fresh allocation.
+ * Returns NULL for a missing or non-string value or a broken escape. */
+static char *json_dup_string(const ChiakiJsonValue *value, size_t *out_len) {
+  if (value->type != CHIAKI_JSON_TYPE_STRING)
     return NULL;
-  char key_expr[96];
-  if (snprintf(key_expr, sizeof(key_expr), "\"%s\"", key) <= 0)
+  char *s = malloc(value->len + 1);
+  if (!s)
     return NULL;
-
-  const char *p = strstr(json, key_expr);
-  if (!p)
-    return NULL;
-  p += strlen(key_expr);
-  while (*p && isspace((unsigned char)*p))
-    p++;
-  if (*p != ':')
+  if (chiaki_json_unescape(value, s, value->len + 1, out_len) != CHIAKI_ERR_SUCCESS) {
+    free(s);
     return NULL;
-  p++;
-  while (*p && isspace((unsigned char)*p))
-    p++;
-  return p;
-}
-
-/* ---------------------------------------------------------------------------
- * Internal UTF-8 / \uXXXX helpers shared by json_get_string_len and
- * json_get_string.  All three are file-scope only.
- * --------------------------------------------------------------------------- */
-
-/* Parses exactly 4 hexadecimal characters starting at *pp into *out_val.
- * Advances *pp by 4 on success.  Returns false (without advancing) if any
- * of the four characters is not a valid hex digit. */
-static bool json_parse_hex4(const char **pp, unsigned int *out_val) {
-  const char *p = *pp;
-  unsigned int v = 0;
-  int i;
-  for (i = 0; i < 4; i++) {
-    unsigned char c = (unsigned char)p[i];
-    unsigned int digit;
-    if (c >= '0' && c <= '9')
-      digit = c - '0';
-    else if (c >= 'a' && c <= 'f')
-      digit = 10 + (c - 'a');
-    else if (c >= 'A' && c <= 'F')
-      digit = 10 + (c - 'A');
-    else
-      return false;
-    v = (v << 4) | digit;
-  }
-  *out_val = v;
-  *pp = p + 4;
-  return true;
-}
-
-/* Returns the number of UTF-8 bytes needed to encode Unicode codepoint cp.
- * cp must be a valid Unicode scalar value (U+0000..U+10FFFF, excluding
- * surrogates); the caller is responsible for that precondition.  Violations
- * are caught by assert() in debug builds (stripped under NDEBUG). */
-static int json_utf8_len(unsigned long cp) {
-  assert(cp <= 0x10FFFFu);
-  assert(cp < 0xD800u || cp > 0xDFFFu);
-  if (cp <= 0x7FUL)
-    return 1;
-  if (cp <= 0x7FFUL)
-    return 2;
-  if (cp <= 0xFFFFUL)
-    return 3;
-  return 4;
-}
-
-/* Encodes Unicode codepoint cp into buf (which must have at least 4 bytes).
- * Returns the number of bytes written.  Same precondition as json_utf8_len. */
-static int json_utf8_encode(unsigned long cp, unsigned char *buf) {
-  assert(cp <= 0x10FFFFu);
-  assert(cp < 0xD800u || cp > 0xDFFFu);
-  if (cp <= 0x7FUL) {
-    buf[0] = (unsigned char)cp;
-    return 1;
-  }
-  if (cp <= 0x7FFUL) {
-    buf[0] = (unsigned char)(0xC0u | (cp >> 6));
-    buf[1] = (unsigned char)(0x80u | (cp & 0x3Fu));
-    return 2;
-  }
-  if (cp <= 0xFFFFUL) {
-    buf[0] = (unsigned char)(0xE0u | (cp >> 12));
-    buf[1] = (unsigned char)(0x80u | ((cp >> 6) & 0x3Fu));
-    buf[2] = (unsigned char)(0x80u | (cp & 0x3Fu));
-    return 3;
-  }
-  buf[0] = (unsigned char)(0xF0u | (cp >> 18));
-  buf[1] = (unsigned char)(0x80u | ((cp >> 12) & 0x3Fu));
-  buf[2] = (unsigned char)(0x80u | ((cp >> 6) & 0x3Fu));
-  buf[3] = (unsigned char)(0x80u | (cp & 0x3Fu));
-  return 4;
-}
-
-/* Consumes a \uXXXX escape (the leading backslash and 'u' have already been
- * consumed by the caller; *pp points to the first hex digit).  Handles UTF-16
- * surrogate pairs by peeking ahead for a following \uXXXX low-surrogate.
- *
- * On success, advances *pp past all consumed characters and stores the decoded
- * Unicode codepoint in *out_cp.  Returns false on malformed input (non-hex
- * digits, lone high surrogate, unexpected low surrogate without a preceding
- * high surrogate). */
-static bool json_decode_unicode_escape(const char **pp, unsigned long *out_cp) {
-  unsigned int hi;
-  if (!json_parse_hex4(pp, &hi))
-    return false;
-
-  /* High surrogate: must be followed immediately by \uDC00-\uDFFF. */
-  if (hi >= 0xD800u && hi <= 0xDBFFu) {
-    if ((*pp)[0] != '\\' || (*pp)[1] != 'u')
-      return false; /* lone high surrogate — reject */
-    *pp += 2;       /* consume the '\' and 'u' of the low surrogate escape */
-    unsigned int lo;
-    if (!json_parse_hex4(pp, &lo))
-      return false;
-    if (lo < 0xDC00u || lo > 0xDFFFu)
-      return false; /* second escape is not a valid low surrogate */
-    /* RFC 2781 surrogate-pair reassembly → supplementary codepoint */
-    *out_cp = 0x10000UL + (((unsigned long)(hi - 0xD800u)) << 10) + (unsigned long)(lo - 0xDC00u);
-    return true;
-  }
-
-  /* Low surrogate without a preceding high surrogate: reject. */
-  if (hi >= 0xDC00u && hi <= 0xDFFFu)
-    return false;
-
-  *out_cp = (unsigned long)hi;
-  return true;
-}
-
-/* ---------------------------------------------------------------------------
- * JSON string helpers
- * --------------------------------------------------------------------------- */
-
-/* Returns the byte length (excluding null terminator) of the decoded JSON
- * string value for `key`.  Mirrors the escape-handling logic of
- * json_get_string exactly so that json_get_string_len(...) + 1 is always the
- * correct allocation size for json_get_string.
- *
- * \uXXXX escapes are decoded to UTF-8; surrogate pairs are combined into a
- * single supplementary codepoint before encoding.  Sets *out_len and returns
- * true on success; returns false if the key is not found, the value is not a
- * quoted string, the closing quote is missing, or a \uXXXX escape is
- * malformed (non-hex digits, lone surrogate, etc.). */
-static bool json_get_string_len(const char *json, const char *key, size_t *out_len) {
-  if (!out_len)
-    return false;
-  *out_len = 0;
-  const char *p = json_find_key_value(json, key);
-  if (!p || *p != '"')
-    return false;
-
-  p++;
-  size_t len = 0;
-  while (*p && *p != '"') {
-    if (*p == '\\') {
-      p++;
-      if (!*p)
-        return false; /* truncated escape — parse failure */
-      if (*p == 'u') {
-        /* \uXXXX — may be a surrogate pair spanning two \uXXXX sequences. */
-        p++;
-        unsigned long cp;
-        if (!json_decode_unicode_escape(&p, &cp))
-          return false;
-        len += (size_t)json_utf8_len(cp);
-      } else {
-        /* All other single-character escapes decode to exactly one byte:
-         * \" \\ \/ \b \f \n \r \t and any other char (liberal). */
-        len++;
-        p++;
-      }
-      continue;
-    }
-    len++;
-    p++;
   }
-  if (*p != '"')
-    return false;
-  *out_len = len;
-  return true;
+  return s;
 }
 
-static bool json_get_string(const char *json, const char *key, char *out, size_t out_size) {
-  if (!out || out_size == 0)
-    return false;
-  out[0] = '\0';
-  const char *p = json_find_key_value(json, key);
-  if (!p || *p != '"')
-    return false;
-
-  p++;
-  size_t o = 0;
-  while (*p && *p != '"') {
-    if (*p == '\\') {
-      p++;
-      if (!*p)
-        return false; /* truncated escape — parse failure */
-      if (*p == 'u') {
-        /* \uXXXX — decode to UTF-8, possibly via a surrogate pair. */
-        p++;
-        unsigned long cp;
-        if (!json_decode_unicode_escape(&p, &cp))
-          return false;
-        unsigned char utf8[4];
-        int nb = json_utf8_encode(cp, utf8);
-        int i;
-        /* Emit UTF-8 bytes; fail if they would not fit.  Unlike the
-         * single-char and plain-ASCII overflow paths (which break with p
-         * still pointing at the unwritten character so *p != '"'), here p
-         * has already been advanced past the full \uXXXX sequence by
-         * json_decode_unicode_escape.  A break would leave p after the
-         * escape, causing *p == '"' to report success despite silent
-         * truncation — so return false instead. */
-        if (o + (size_t)nb + 1 > out_size)
-          return false;
-        for (i = 0; i < nb; i++)
-          out[o++] = (char)utf8[i];
-        continue;
-      }
-      /* Single-character escapes. */
-      if (o + 1 >= out_size)
-        break;
-      switch (*p) {
-        case '"':
-        case '\\':
-        case '/':
-          out[o++] = *p;
-          break;
-        case 'b':
-          out[o++] = '\b';
-          break;
-        case 'f':
-          out[o++] = '\f';
-          break;
-        case 'n':
-          out[o++] = '\n';
-          break;
-        case 'r':
-          out[o++] = '\r';
-          break;
-        case 't':
-          out[o++] = '\t';
-          break;
-        default:
-          out[o++] = *p;
-          break;
-      }
-      p++;
-      continue;
-    }
-    if (o + 1 >= out_size)
-      break;
-    out[o++] = *p++;
-  }
-  out[o] = '\0';
-  return *p == '"';
-}
-
-static bool json_get_uint64(const char *json, const char *key, uint64_t *out) {
-  if (!out)
-    return false;
-  const char *p = json_find_key_value(json, key);
-  if (!p || !isdigit((unsigned char)*p))
+static bool json_get_error_description(const char *response, size_t response_len, char *out,
+                                       size_t out_size) {
+  static const char *const paths[] = {"error_description"};
+  ChiakiJsonValue value;
+  if (!response ||
+      chiaki_json_scan(response, response_len, paths, &value, 1) != CHIAKI_ERR_SUCCESS)
     return false;
-  uint64_t v = 0;
-  while (*p && isdigit((unsigned char)*p)) {
-    v = (v * 10ULL) + (uint64_t)(*p - '0');
-    p++;
-  }
-  *out = v;
-  return true;
+  return chiaki_json_unescape(&value, out, out_size, NULL) == CHIAKI_ERR_SUCCESS;
 }
 
 static void clear_device_flow_fields(void) {
@@ -799,71 +642,100 @@ static void clear_device_flow_fields(void) {
   g_psn_auth.poll_interval_sec = 5;
 }
 
-static bool apply_token_response(const char *response, uint64_t now_unix) {
+enum {
+  TOKEN_FIELD_ACCESS_TOKEN,
+  TOKEN_FIELD_REFRESH_TOKEN,
+  TOKEN_FIELD_EXPIRES_IN,
+  TOKEN_FIELD_COUNT
+};
+
+/* Pulls the tokens out of a token endpoint response into grant (malloc()ed
+ * strings). refresh_token stays NULL if the endpoint did not rotate it. */
+static bool parse_token_response(const char *response, size_t response_len,
+                                 ChiakiTokenGrant *grant) {
+  /* One pass over the body for every field we need. */
+  static const char *const paths[TOKEN_FIELD_COUNT] = {"access_token", "refresh_token",
+                                                        "expires_in"};
+  ChiakiJsonValue fields[TOKEN_FIELD_COUNT];
+  if (!response ||
+      chiaki_json_scan(response, response_len, paths, fields, TOKEN_FIELD_COUNT) !=
+          CHIAKI_ERR_SUCCESS) {
+    LOGE("PSN auth: token response is not valid JSON");
+    return false;
+  }
+
   size_t access_len = 0;
   size_t refresh_len = 0;
-  if (!json_get_string_len(response, "access_token", &access_len) || access_len == 0) {
+  const ChiakiJsonValue *access = &fields[TOKEN_FIELD_ACCESS_TOKEN];
+  if (access->type != CHIAKI_JSON_TYPE_STRING || access->len == 0) {
     LOGE("PSN auth: access_token missing from token response");
     return false;
   }
-  if (access_len >= 8192) {
-    LOGE("PSN auth: access_token length %zu exceeds 8192-byte cap", access_len);
-    return false;
-  }
-  char *access_token = malloc(access_len + 1);
+  char *access_token = json_dup_string(access, &access_len);
   if (!access_token)
     return false;
-  if (!json_get_string(response, "access_token", access_token, access_len + 1)) {
+  if (access_len >= 8192) {
+    LOGE("PSN auth: access_token length %zu exceeds 8192-byte cap", access_len);
     free(access_token);
     return false;
   }
 
   char *refresh_token = NULL;
-  if (json_get_string_len(response, "refresh_token", &refresh_len) && refresh_len > 0) {
-    if (refresh_len >= 8192) {
-      LOGE("PSN auth: refresh_token length %zu exceeds 8192-byte cap", refresh_len);
-      free(access_token);
-      return false;
-    }
-    refresh_token = malloc(refresh_len + 1);
+  const ChiakiJsonValue *refresh = &fields[TOKEN_FIELD_REFRESH_TOKEN];
+  if (refresh->type == CHIAKI_JSON_TYPE_STRING && refresh->len > 0) {
+    refresh_token = json_dup_string(refresh, &refresh_len);
     if (!refresh_token) {
       free(access_token);
       return false;
     }
-    if (!json_get_string(response, "refresh_token", refresh_token, refresh_len + 1)) {
+    if (refresh_len >= 8192) {
+      LOGE("PSN auth: refresh_token length %zu exceeds 8192-byte cap", refresh_len);
       free(access_token);
       free(refresh_token);
       return false;
     }
-  } else if (has_text(context.config.psn_oauth_refresh_token)) {
-    refresh_token = strdup(context.config.psn_oauth_refresh_token);
-    if (!refresh_token) {
-      free(access_token);
-      return false;
-    }
-  } else {
-    refresh_token = strdup("");
-    if (!refresh_token) {
-      free(access_token);
-      return false;
-    }
   }
 
-  uint64_t expires_in = 0;
-  if (!json_get_uint64(response, "expires_in", &expires_in) || expires_in == 0) {
+  int64_t expires_in = 0;
+  if (chiaki_json_value_int64(&fields[TOKEN_FIELD_EXPIRES_IN], &expires_in) != CHIAKI_ERR_SUCCESS ||
+      expires_in <= 0 || expires_in > UINT32_MAX) {
     expires_in = 3600;
   }
 
-  /* set_config_string calls strdup internally — safe to free our copies after. */
+  grant->access_token = access_token;
+  grant->refresh_token = refresh_token;
+  grant->expires_in_sec = (uint32_t)expires_in;
+  return true;
+}
+
+/* Stores tokens in the config and marks it for persisting. A NULL or empty
+ * refresh_token keeps the one already stored. */
+static void apply_tokens(const char *access_token, const char *refresh_token,
+                         uint64_t expires_at_unix) {
   set_config_string(&context.config.psn_oauth_access_token, access_token);
-  set_config_string(&context.config.psn_oauth_refresh_token, refresh_token);
-  free(access_token);
-  free(refresh_token);
-  context.config.psn_oauth_expires_at_unix = now_unix + expires_in;
+  if (has_text(refresh_token))
+    set_config_string(&context.config.psn_oauth_refresh_token, refresh_token);
+  context.config.psn_oauth_expires_at_unix = expires_at_unix;
+  context.config_persist_pending = true;
+}
+
+static bool apply_token_response(const char *response, size_t response_len, uint64_t now_unix) {
+  ChiakiTokenGrant grant = {0};
+  if (!parse_token_response(response, response_len, &grant))
+    return false;
+
+  apply_tokens(grant.access_token, grant.refresh_token, now_unix + grant.expires_in_sec);
+  free(grant.access_token);
+  free(grant.refresh_token);
+  if (g_token_lifecycle) {
+    chiaki_token_lifecycle_set(g_token_lifecycle, context.config.psn_oauth_access_token,
+                               context.config.psn_oauth_refresh_token,
+                               context.config.psn_oauth_expires_at_unix);
+    handoff_drop_tokens();
+  }
   clear_device_flow_fields();
   g_psn_auth.state = PSN_AUTH_STATE_TOKEN_VALID;
   psn_auth_clear_error();
-  context.config_persist_pending = true;
   return true;
 }
 
@@ -892,6 +764,13 @@ PsnAuthState psn_auth_state(uint64_t now_unix) {
   if (psn_auth_token_is_valid(now_unix))
     return PSN_AUTH_STATE_TOKEN_VALID;
 
+  if (g_token_lifecycle) {
+    ChiakiTokenStatus status;
+    chiaki_token_lifecycle_status(g_token_lifecycle, &status);
+    if (status.refreshing)
+      return PSN_AUTH_STATE_TOKEN_REFRESHING;
+  }
+
   if (has_text(context.config.psn_oauth_access_token) ||
       has_text(context.config.psn_oauth_refresh_token))
     return PSN_AUTH_STATE_LOGGED_OUT;
@@ -1167,26 +1046,25 @@ bool psn_auth_submit_authorization_response(const char *input, uint64_t now_unix
 
   long http_code = 0;
   char *response = NULL;
+  size_t response_len = 0;
   LOGD("PSN auth token exchange url=%s redirect_uri=%s client_id=%s form_len=%u", oauth_token_url(),
        oauth_redirect_uri(), oauth_client_id(), (unsigned)strlen(form));
   if (!oauth_post_form(oauth_token_url(), form, oauth_client_id(), oauth_client_secret(),
-                       &http_code, &response)) {
+                       &http_code, &response, &response_len, NULL)) {
     g_psn_auth.state = PSN_AUTH_STATE_DEVICE_LOGIN_PENDING;
     psn_auth_set_error("Authorization code exchange failed");
     return false;
   }
 
   bool ok = false;
-  if (http_code == 200 && apply_token_response(response, now_unix)) {
-    LOGD("PSN auth token exchange succeeded response_len=%u",
-         (unsigned)(response ? strlen(response) : 0));
+  if (http_code == 200 && apply_token_response(response, response_len, now_unix)) {
+    LOGD("PSN auth token exchange succeeded response_len=%u", (unsigned)response_len);
     ok = true;
   } else {
     LOGE("PSN auth token exchange rejected status=%ld response_len=%u", http_code,
-         (unsigned)(response ? strlen(response) : 0));
+         (unsigned)response_len);
     char error_desc[160];
-    if (response &&
-        json_get_string(response, "error_description", error_desc, sizeof(error_desc))) {
+    if (json_get_error_description(response, response_len, error_desc, sizeof(error_desc))) {
       psn_auth_set_error(error_desc);
     } else {
       psn_auth_set_error("Authorization code was rejected");
@@ -1198,65 +1076,253 @@ bool psn_auth_submit_authorization_response(const char *input, uint64_t now_unix
   return ok;
 }
 
-bool psn_auth_refresh_token_if_needed(uint64_t now_unix, bool force) {
-  if (!psn_auth_enabled())
-    return false;
-  if (!force && psn_auth_token_is_valid(now_unix))
-    return true;
-  if (!has_text(context.config.psn_oauth_refresh_token))
-    return false;
-  if (!oauth_configured_for_refresh()) {
-    psn_auth_set_error("OAuth refresh endpoint not configured in this build");
-    return false;
-  }
+/* One refresh_token grant against the token endpoint. Only reads the config,
+ * so it can run on the lifecycle thread. The server's error description, if
+ * any, lands in error_desc. */
+static ChiakiErrorCode oauth_refresh_grant(const char *refresh_token, ChiakiTokenGrant *grant,
+                                           char *error_desc, size_t error_desc_size) {
+  error_desc[0] = '\0';
+  if (!oauth_configured_for_refresh())
+    return CHIAKI_ERR_UNINITIALIZED;
 
   CURL *curl = curl_easy_init();
-  if (!curl) {
-    psn_auth_set_error("Failed to initialize token refresh client");
-    return false;
-  }
-
-  g_psn_auth.state = PSN_AUTH_STATE_TOKEN_REFRESHING;
+  if (!curl)
+    return CHIAKI_ERR_MEMORY;
   char form[1400];
   size_t off = 0;
   bool form_ok =
       append_form_kv(curl, form, sizeof(form), &off, "grant_type", "refresh_token") &&
-      append_form_kv(curl, form, sizeof(form), &off, "refresh_token",
-                     context.config.psn_oauth_refresh_token) &&
+      append_form_kv(curl, form, sizeof(form), &off, "refresh_token", refresh_token) &&
       append_form_kv(curl, form, sizeof(form), &off, "scope", oauth_scope()) &&
       append_form_kv(curl, form, sizeof(form), &off, "redirect_uri", oauth_redirect_uri());
   curl_easy_cleanup(curl);
   if (!form_ok) {
-    psn_auth_set_error("Failed to build refresh request");
-    return false;
+    snprintf(error_desc, error_desc_size, "Failed to build refresh request");
+    return CHIAKI_ERR_BUF_TOO_SMALL;
   }
 
   long http_code = 0;
   char *response = NULL;
+  size_t response_len = 0;
+  uint64_t server_time = 0;
   LOGD("PSN auth refresh exchange url=%s redirect_uri=%s client_id=%s form_len=%u",
        oauth_token_url(), oauth_redirect_uri(), oauth_client_id(), (unsigned)strlen(form));
   if (!oauth_post_form(oauth_token_url(), form, oauth_client_id(), oauth_client_secret(),
-                       &http_code, &response)) {
-    psn_auth_set_error("Token refresh request failed");
-    return false;
+                       &http_code, &response, &response_len, &server_time)) {
+    snprintf(error_desc, error_desc_size, "Token refresh request failed");
+    return CHIAKI_ERR_NETWORK;
   }
 
-  bool refreshed = false;
-  if (http_code == 200 && apply_token_response(response, now_unix)) {
-    LOGD("PSN auth refresh succeeded response_len=%u", (unsigned)(response ? strlen(response) : 0));
-    refreshed = true;
+  ChiakiErrorCode err = CHIAKI_ERR_SUCCESS;
+  if (http_code == 200 && parse_token_response(response, response_len, grant)) {
+    grant->server_time_unix = server_time;
+    LOGD("PSN auth refresh succeeded response_len=%u", (unsigned)response_len);
   } else {
     LOGE("PSN auth refresh rejected status=%ld response_len=%u", http_code,
-         (unsigned)(response ? strlen(response) : 0));
-    char error_desc[160];
-    if (response &&
-        json_get_string(response, "error_description", error_desc, sizeof(error_desc))) {
-      psn_auth_set_error(error_desc);
-    } else {
-      psn_auth_set_error("Token refresh failed");
-    }
+         (unsigned)response_len);
+    /* 400/401 is the endpoint turning the refresh token down (invalid_grant),
+     * anything else may go away on a retry. */
+    err = http_code == 400 || http_code == 401 ? CHIAKI_ERR_HTTP_NONOK
+                                               : CHIAKI_ERR_INVALID_RESPONSE;
+    if (!json_get_error_description(response, response_len, error_desc, error_desc_size))
+      snprintf(error_desc, error_desc_size, "Token refresh failed");
   }
 
   free(response);
-  return refreshed;
+  return err;
+}
+
+/* ChiakiTokenRefreshFunc, on the lifecycle thread. */
+static ChiakiErrorCode lifecycle_refresh_cb(void *user, const char *refresh_token,
+                                            ChiakiTokenGrant *grant) {
+  PsnAuthHandoff *handoff = (PsnAuthHandoff *)user;
+  char error_desc[sizeof(handoff->error_desc)];
+  ChiakiErrorCode err = oauth_refresh_grant(refresh_token, grant, error_desc, sizeof(error_desc));
+  if (err != CHIAKI_ERR_SUCCESS) {
+    chiaki_mutex_lock(&handoff->mutex);
+    snprintf(handoff->error_desc, sizeof(handoff->error_desc), "%s", error_desc);
+    if (err == CHIAKI_ERR_HTTP_NONOK)
+      handoff->rejected_pending = true;
+    chiaki_mutex_unlock(&handoff->mutex);
+  }
+  return err;
+}
+
+static void refresh_failed(ChiakiErrorCode err, const char *error_desc) {
+  if (err == CHIAKI_ERR_TIMEOUT) {
+    psn_auth_set_error("Token refresh request failed");
+    return;
+  }
+  psn_auth_set_error(has_text(error_desc) ? error_desc : "Token refresh failed");
+}
+
+bool psn_auth_refresh_token_if_needed(uint64_t now_unix, bool force) {
+  if (!psn_auth_enabled())
+    return false;
+  if (!force && psn_auth_token_is_valid(now_unix))
+    return true;
+  if (!has_text(context.config.psn_oauth_refresh_token))
+    return false;
+  if (!oauth_configured_for_refresh()) {
+    psn_auth_set_error("OAuth refresh endpoint not configured in this build");
+    return false;
+  }
+
+  if (g_token_lifecycle) {
+    /* Joins the refresh the lifecycle may already be running; the new tokens
+     * reach the config through psn_auth_poll(). */
+    ChiakiErrorCode err =
+        force ? chiaki_token_lifecycle_refresh(g_token_lifecycle, TOKEN_REFRESH_WAIT_MS)
+              : chiaki_token_lifecycle_ensure_fresh(g_token_lifecycle,
+                                                    (uint32_t)TOKEN_EXPIRY_SKEW_SEC + 1,
+                                                    TOKEN_REFRESH_WAIT_MS);
+    if (err != CHIAKI_ERR_SUCCESS) {
+      char error_desc[sizeof(g_handoff.error_desc)];
+      chiaki_mutex_lock(&g_handoff.mutex);
+      snprintf(error_desc, sizeof(error_desc), "%s", g_handoff.error_desc);
+      chiaki_mutex_unlock(&g_handoff.mutex);
+      refresh_failed(err, error_desc);
+      return false;
+    }
+    return true;
+  }
+
+  g_psn_auth.state = PSN_AUTH_STATE_TOKEN_REFRESHING;
+  ChiakiTokenGrant grant = {0};
+  char error_desc[sizeof(g_handoff.error_desc)];
+  ChiakiErrorCode err = oauth_refresh_grant(context.config.psn_oauth_refresh_token, &grant,
+                                            error_desc, sizeof(error_desc));
+  if (err != CHIAKI_ERR_SUCCESS) {
+    refresh_failed(err, error_desc);
+    return false;
+  }
+  apply_tokens(grant.access_token, grant.refresh_token, now_unix + grant.expires_in_sec);
+  free(grant.access_token);
+  free(grant.refresh_token);
+  g_psn_auth.state = PSN_AUTH_STATE_TOKEN_VALID;
+  psn_auth_clear_error();
+  return true;
+}
+
+/* Lifecycle thread: park the rotated tokens for psn_auth_poll(). */
+static void lifecycle_persist_cb(void *user, const ChiakiTokenSet *tokens) {
+  (void)user;
+  char *access_token = strdup(tokens->access_token);
+  char *refresh_token = strdup(tokens->refresh_token);
+  if (!access_token || !refresh_token) {
+    LOGE("PSN auth: out of memory handing over refreshed tokens");
+    free(access_token);
+    free(refresh_token);
+    return;
+  }
+  chiaki_mutex_lock(&g_handoff.mutex);
+  free(g_handoff.access_token);
+  free(g_handoff.refresh_token);
+  g_handoff.access_token = access_token;
+  g_handoff.refresh_token = refresh_token;
+  g_handoff.expires_at_unix = tokens->expires_at_unix;
+  g_handoff.tokens_pending = true;
+  g_handoff.rejected_pending = false;
+  chiaki_mutex_unlock(&g_handoff.mutex);
+}
+
+bool psn_auth_lifecycle_start(void) {
+  if (g_token_lifecycle)
+    return true;
+  if (!oauth_configured_for_refresh())
+    return false;
+  if (chiaki_mutex_init(&g_handoff.mutex, false) != CHIAKI_ERR_SUCCESS)
+    return false;
+
+  ChiakiTokenLifecycleConfig config;
+  chiaki_token_lifecycle_config_defaults(&config);
+  config.refresh = lifecycle_refresh_cb;
+  config.refresh_user = &g_handoff;
+  config.persist = lifecycle_persist_cb;
+  config.log = &context.log;
+  ChiakiTokenLifecycle *lifecycle = chiaki_token_lifecycle_new(&config);
+  if (!lifecycle) {
+    LOGE("PSN auth: failed to start token lifecycle, refreshing on demand only");
+    chiaki_mutex_fini(&g_handoff.mutex);
+    return false;
+  }
+  /* Nothing runs in the background until psn_auth_poll() says so. */
+  g_token_refresh_held = true;
+  chiaki_token_lifecycle_hold(lifecycle, true);
+  if (has_text(context.config.psn_oauth_refresh_token) ||
+      has_text(context.config.psn_oauth_access_token)) {
+    chiaki_token_lifecycle_set(lifecycle, context.config.psn_oauth_access_token,
+                               context.config.psn_oauth_refresh_token,
+                               context.config.psn_oauth_expires_at_unix);
+  }
+  g_token_lifecycle = lifecycle;
+  return true;
+}
+
+void psn_auth_lifecycle_stop(void) {
+  if (!g_token_lifecycle)
+    return;
+  ChiakiTokenLifecycleStats stats;
+  chiaki_token_lifecycle_stats(g_token_lifecycle, &stats);
+  LOGD("PSN auth token lifecycle: refreshes=%llu scheduled=%llu on_demand=%llu waits=%llu "
+       "failures=%llu",
+       (unsigned long long)stats.refreshes, (unsigned long long)stats.scheduled,
+       (unsigned long long)stats.on_demand, (unsigned long long)stats.waits,
+       (unsigned long long)stats.failures);
+  chiaki_token_lifecycle_free(g_token_lifecycle);
+  g_token_lifecycle = NULL;
+  free(g_handoff.access_token);
+  free(g_handoff.refresh_token);
+  chiaki_mutex_fini(&g_handoff.mutex);
+  memset(&g_handoff, 0, sizeof(g_handoff));
+}
+
+void psn_auth_poll(void) {
+  if (!g_token_lifecycle)
+    return;
+
+  /* Keep refresh traffic off the media path, and off entirely while PSN
+   * mode is disabled. A connect that needs a token still gets one. */
+  bool hold = context.stream.is_streaming || !psn_auth_enabled();
+  if (hold != g_token_refresh_held) {
+    g_token_refresh_held = hold;
+    chiaki_token_lifecycle_hold(g_token_lifecycle, hold);
+  }
+
+  char *access_token = NULL;
+  char *refresh_token = NULL;
+  uint64_t expires_at_unix = 0;
+  bool rejected = false;
+  char error_desc[sizeof(g_handoff.error_desc)];
+  chiaki_mutex_lock(&g_handoff.mutex);
+  if (g_handoff.tokens_pending) {
+    access_token = g_handoff.access_token;
+    refresh_token = g_handoff.refresh_token;
+    expires_at_unix = g_handoff.expires_at_unix;
+    g_handoff.access_token = NULL;
+    g_handoff.refresh_token = NULL;
+    g_handoff.tokens_pending = false;
+  }
+  if (g_handoff.rejected_pending) {
+    rejected = true;
+    snprintf(error_desc, sizeof(error_desc), "%s", g_handoff.error_desc);
+    g_handoff.rejected_pending = false;
+  }
+  chiaki_mutex_unlock(&g_handoff.mutex);
+
+  if (access_token) {
+    /* config_persist_pending is drained by the UI loop, which writes the
+     * tokens through the encrypted config path. */
+    apply_tokens(access_token, refresh_token, expires_at_unix);
+    if (g_psn_auth.state == PSN_AUTH_STATE_ERROR ||
+        g_psn_auth.state == PSN_AUTH_STATE_TOKEN_REFRESHING ||
+        g_psn_auth.state == PSN_AUTH_STATE_LOGGED_OUT) {
+      g_psn_auth.state = PSN_AUTH_STATE_TOKEN_VALID;
+      psn_auth_clear_error();
+    }
+  }
+  free(access_token);
+  free(refresh_token);
+  if (rejected)
+    psn_auth_set_error(error_desc[0] ? error_desc : "Token refresh failed");
 }
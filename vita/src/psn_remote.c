@@ -239,32 +239,41 @@ int psn_remote_prepare_connect_host(VitaChiakiHost *host
     psn_remote_set_error("PSN session expired. Re-authenticate in Profile.");
     return 1;
   }
-  const char *token = psn_auth_access_token();
+  char *token = psn_auth_dup_access_token();
   if (!token || !token[0]) {
     LOGE("PSN remote prepare failed: missing OAuth access token");
     psn_remote_set_error("Missing PSN access token. Re-authenticate in Profile.");
+    free(token);
     return 1;
   }
 
   ChiakiHolepunchSession session = chiaki_holepunch_session_init(token, &context.log);
+  free(token);
   if (!session) {
     LOGE("PSN remote prepare failed: chiaki_holepunch_session_init failed");
     psn_remote_set_error("Failed to initialize PSN remote session.");
     return 1;
   }
 
-  ChiakiErrorCode err = chiaki_holepunch_upnp_discover(session);
-  if (err != CHIAKI_ERR_SUCCESS) {
+  // UPnP discovery, session creation, offer and session start run as one dependency graph,
+  // so candidate gathering overlaps with the PSN round trips.
+  ChiakiHolepunchConsoleType console_type = chiaki_target_is_ps5(host->target)
+                                                ? CHIAKI_HOLEPUNCH_CONSOLE_TYPE_PS5
+                                                : CHIAKI_HOLEPUNCH_CONSOLE_TYPE_PS4;
+  ChiakiHolepunchPrepareStage failed_stage = CHIAKI_HOLEPUNCH_PREPARE_STAGE_NONE;
+  ChiakiErrorCode err = chiaki_holepunch_session_prepare(session, host->psn_device_uid,
+                                                         console_type, &failed_stage);
+  if (err != CHIAKI_ERR_SUCCESS && failed_stage == CHIAKI_HOLEPUNCH_PREPARE_STAGE_UPNP) {
     LOGE("PSN remote prepare failed: upnp_discover: %s", chiaki_error_string(err));
     char msg[160];
     snprintf(msg, sizeof(msg), "UPnP discovery failed: %s", chiaki_error_string(err));
     psn_remote_set_error(msg);
-    chiaki_holepunch_session_discard(session);
+    // Session creation ran alongside UPnP discovery
+    chiaki_holepunch_session_fini(session);
     return 1;
   }
 
-  err = chiaki_holepunch_session_create(session);
-  if (err != CHIAKI_ERR_SUCCESS) {
+  if (err != CHIAKI_ERR_SUCCESS && failed_stage == CHIAKI_HOLEPUNCH_PREPARE_STAGE_CREATE) {
     long ws_http_code = 0;
     long retry_interval_min = 0;
     long retry_interval_max = 0;
@@ -287,22 +296,17 @@ int psn_remote_prepare_connect_host(VitaChiakiHost *host
     } else {
       psn_remote_set_error("Failed to create PSN remote session.");
     }
-    chiaki_holepunch_session_discard(session);
+    chiaki_holepunch_session_fini(session);
     return 1;
   }
 
-  err = chiaki_holepunch_session_create_offer(session);
-  if (err != CHIAKI_ERR_SUCCESS) {
+  if (err != CHIAKI_ERR_SUCCESS && failed_stage == CHIAKI_HOLEPUNCH_PREPARE_STAGE_OFFER) {
     LOGE("PSN remote prepare failed: create_offer: %s", chiaki_error_string(err));
     psn_remote_set_error("Failed to prepare PSN remote connection.");
     chiaki_holepunch_session_fini(session);
     return 1;
   }
 
-  ChiakiHolepunchConsoleType console_type = chiaki_target_is_ps5(host->target)
-                                                ? CHIAKI_HOLEPUNCH_CONSOLE_TYPE_PS5
-                                                : CHIAKI_HOLEPUNCH_CONSOLE_TYPE_PS4;
-  err = chiaki_holepunch_session_start(session, host->psn_device_uid, console_type);
   if (err != CHIAKI_ERR_SUCCESS) {
     LOGE("PSN remote prepare failed: session_start: %s", chiaki_error_string(err));
     psn_remote_set_error("Failed to start PSN remote session.");
@@ -355,20 +359,22 @@ int psn_remote_refresh_hosts(void) {
     LOGD("PSN host refresh skipped: OAuth token invalid and refresh failed");
     return 1;
   }
-  const char *token = psn_auth_access_token();
-  if (!token || !token[0]) {
-    LOGD("PSN host refresh skipped: missing OAuth access token");
-    return 1;
-  }
   if (ui_state_connection_thread_active()) {
     LOGD("PSN host refresh deferred: connection thread active");
     return 1;
   }
+  char *token = psn_auth_dup_access_token();
+  if (!token || !token[0]) {
+    LOGD("PSN host refresh skipped: missing OAuth access token");
+    free(token);
+    return 1;
+  }
 
   ChiakiHolepunchDeviceInfo *devices = NULL;
   size_t device_count = 0;
   ChiakiErrorCode err = chiaki_holepunch_list_devices(token, CHIAKI_HOLEPUNCH_CONSOLE_TYPE_PS5,
                                                       &devices, &device_count, &context.log);
+  free(token);
   if (err != CHIAKI_ERR_SUCCESS) {
     LOGE("Failed to fetch PSN remote hosts: %s", chiaki_error_string(err));
     return 1;
@@ -0,0 +1,176 @@
+#include "context.h"
+#include "host_profile.h"
+#include "psn_remote.h"
+#include "startup.h"
+#include "vita_dns.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <chiaki/lazyinit.h>
+
+#define STARTUP_TRACE_PATH "ux0:/data/vita-chiaki/startup.trace"
+#define STARTUP_PROF_CAPACITY 64
+
+static ChiakiStartupProf *startup_prof;
+static uint16_t launch_span = CHIAKI_STARTUP_SPAN_NONE;
+static ChiakiLazyInit lazy;
+static bool lazy_ready;
+static unsigned unit_ids[VITA_STARTUP_UNIT_COUNT];
+static bool interactive;
+static bool idle_done; // and the trace written, later spans are not recorded
+
+static ChiakiErrorCode dns_init(void *user) {
+  (void)user;
+  vita_dns_init();
+  // Without a PSN login there is nothing to connect to.
+  if (context.config.psn_oauth_refresh_token || context.config.psn_oauth_access_token)
+    vita_dns_prefetch_known_hosts();
+  return CHIAKI_ERR_SUCCESS;
+}
+
+static void dns_fini(void *user) {
+  (void)user;
+  vita_dns_fini();
+}
+
+static ChiakiErrorCode host_profiles_init(void *user) {
+  (void)user;
+  return host_profile_init() ? CHIAKI_ERR_SUCCESS : CHIAKI_ERR_MEMORY;
+}
+
+static void host_profiles_fini(void *user) {
+  (void)user;
+  host_profile_fini();
+}
+
+/* psn_remote_refresh_hosts() refreshes the OAuth token, fetches the PSN device list and
+ * persists the config, a no-op when PSN internet mode is disabled. Doing it once at startup
+ * means the user does not have to go to Profile -> Connection to see their PS5/PS4, doing
+ * it after the first frame keeps its round trips out of the launch. A refreshed token that
+ * didn't persist is drained by the UI loop. */
+static ChiakiErrorCode psn_hosts_init(void *user) {
+  (void)user;
+  if (time(NULL) == (time_t)-1) {
+    CHIAKI_LOGW(&(context.log), "PSN auth: skipping startup host refresh — system clock not set");
+    return CHIAKI_ERR_SUCCESS;
+  }
+  psn_remote_refresh_hosts();
+  return CHIAKI_ERR_SUCCESS;
+}
+
+static const struct {
+  VitaStartupUnit unit;
+  const char *name;
+  ChiakiLazyInitMode mode;
+  ChiakiLazyInitFunc init;
+  ChiakiLazyFiniFunc fini;
+} units[VITA_STARTUP_UNIT_COUNT] = {
+    {VITA_STARTUP_DNS, "dns", CHIAKI_LAZY_INIT_BACKGROUND, dns_init, dns_fini},
+    {VITA_STARTUP_HOST_PROFILES, "host_profiles", CHIAKI_LAZY_INIT_BACKGROUND, host_profiles_init,
+     host_profiles_fini},
+    {VITA_STARTUP_PSN_HOSTS, "psn_hosts", CHIAKI_LAZY_INIT_IDLE, psn_hosts_init, NULL},
+};
+
+static uint32_t unit_deps(VitaStartupUnit unit) {
+  switch (unit) {
+    case VITA_STARTUP_PSN_HOSTS:
+      return CHIAKI_LAZY_INIT_DEP(unit_ids[VITA_STARTUP_DNS]);
+    default:
+      return 0;
+  }
+}
+
+void vita_startup_begin(void) {
+  ChiakiStartupProfConfig config;
+  chiaki_startup_prof_config_defaults(&config);
+  config.capacity = STARTUP_PROF_CAPACITY;
+  startup_prof = chiaki_startup_prof_new(&config);
+  launch_span = chiaki_startup_prof_begin(startup_prof, "launch");
+}
+
+ChiakiStartupProf *vita_startup_prof(void) {
+  return idle_done ? NULL : startup_prof;
+}
+
+void vita_startup_start_units(void) {
+  if (chiaki_lazy_init_init(&lazy, startup_prof) != CHIAKI_ERR_SUCCESS) {
+    LOGE("startup: lazy init unavailable, initializing everything now");
+    dns_init(NULL);
+    host_profiles_init(NULL);
+    return;
+  }
+  lazy_ready = true;
+  for (size_t i = 0; i < VITA_STARTUP_UNIT_COUNT; i++) {
+    ChiakiLazyUnit unit = {units[i].name, units[i].mode, unit_deps(units[i].unit), units[i].init,
+                           units[i].fini, NULL};
+    ChiakiErrorCode err = chiaki_lazy_init_add(&lazy, &unit, &unit_ids[units[i].unit]);
+    if (err != CHIAKI_ERR_SUCCESS)
+      LOGE("startup: failed to add unit %s: %s", units[i].name, chiaki_error_string(err));
+  }
+  ChiakiErrorCode err = chiaki_lazy_init_start(&lazy);
+  if (err != CHIAKI_ERR_SUCCESS) {
+    // everything is still initialized on first use
+    LOGE("startup: background init thread failed: %s", chiaki_error_string(err));
+  }
+}
+
+bool vita_startup_require(VitaStartupUnit unit) {
+  if (!lazy_ready)
+    return true;
+  return chiaki_lazy_init_require(&lazy, unit_ids[unit]) == CHIAKI_ERR_SUCCESS;
+}
+
+static void startup_write_trace(void) {
+  ChiakiStartupSpan spans[STARTUP_PROF_CAPACITY];
+  size_t count = chiaki_startup_prof_spans(startup_prof, spans, STARTUP_PROF_CAPACITY);
+  if (count > STARTUP_PROF_CAPACITY)
+    count = STARTUP_PROF_CAPACITY;
+  for (size_t i = 0; i < count; i++) {
+    if (spans[i].duration_us == CHIAKI_STARTUP_DURATION_OPEN)
+      continue;
+    LOGD("PIPE/STARTUP span=%s start_us=%llu us=%u lane=%s", spans[i].name,
+         (unsigned long long)spans[i].start_us, spans[i].duration_us,
+         chiaki_thread_role_string((ChiakiThreadRole)spans[i].lane));
+  }
+
+  size_t size = 0;
+  chiaki_startup_prof_write_trace(startup_prof, NULL, &size);
+  uint8_t *buf = malloc(size);
+  if (!buf)
+    return;
+  FILE *fp = NULL;
+  if (chiaki_startup_prof_write_trace(startup_prof, buf, &size) == CHIAKI_ERR_SUCCESS &&
+      (fp = fopen(STARTUP_TRACE_PATH, "wb"))) {
+    if (fwrite(buf, 1, size, fp) != size)
+      LOGE("startup: failed to write %s", STARTUP_TRACE_PATH);
+    fclose(fp);
+  }
+  free(buf);
+}
+
+void vita_startup_frame_done(void) {
+  if (idle_done)
+    return;
+  if (!interactive) {
+    interactive = true;
+    chiaki_startup_prof_mark(startup_prof, "interactive");
+    return;
+  }
+  if (lazy_ready && chiaki_lazy_init_run_idle(&lazy))
+    return;
+  idle_done = true;
+  chiaki_startup_prof_end(startup_prof, launch_span);
+  startup_write_trace();
+}
+
+void vita_startup_fini(void) {
+  // the lazy units may still record into the profile, free it after them
+  if (lazy_ready) {
+    chiaki_lazy_init_fini(&lazy);
+    lazy_ready = false;
+  }
+  chiaki_startup_prof_free(startup_prof);
+  startup_prof = NULL;
+}
@@ -49,7 +49,7 @@
 #include "video.h"
 #include "host_metrics.h"
 #include "psn_auth.h"
-#include "psn_remote.h"
+#include "startup.h"
 #include "ui/ui_graphics.h"
 #include "ui/ui_animation.h"
 #include "ui/ui_input.h"
@@ -61,6 +61,10 @@
 #include "ui/ui_controller_diagram.h"
 #include "ui/ui_text.h"
 
+// Also the keys of the persisted glyph atlases, see ui_text_set_font_files()
+#define UI_FONT_REGULAR_PATH "app0:/assets/fonts/Roboto-Regular.ttf"
+#define UI_FONT_MONO_PATH "app0:/assets/fonts/RobotoMono-Regular.ttf"
+
 vita2d_font *font;
 vita2d_font *font_mono;
 vita2d_texture *img_ps4, *img_ps4_off, *img_ps4_rest, *img_ps5, *img_ps5_off, *img_ps5_rest,
@@ -387,6 +391,9 @@ bool ui_reload_psn_account_id(void) {
  * Must be called before draw_ui() main loop.
  */
 void init_ui() {
+  // GPU resources belong to this thread, so these are timed but not deferred
+  ChiakiStartupProf *prof = vita_startup_prof();
+  uint16_t span = chiaki_startup_prof_begin(prof, "vita2d");
   int vita2d_init_ret =
       vita2d_init_advanced_with_msaa(SCE_GXM_DEFAULT_PARAMETER_BUFFER_SIZE, SCE_GXM_MULTISAMPLE_4X);
   if (vita2d_init_ret < 0) {
@@ -395,15 +402,21 @@ void init_ui() {
     vita2d_init();
   }
   vita2d_set_clear_color(RGBA8(0x40, 0x40, 0x40, 0xFF));
-  load_textures();
-  ui_particles_init();  // Initialize VitaRPS5 particle background
-  ui_cards_init();      // Initialize console card system
-  font = vita2d_load_font_file("app0:/assets/fonts/Roboto-Regular.ttf");
-  font_mono = vita2d_load_font_file("app0:/assets/fonts/RobotoMono-Regular.ttf");
-
-  /* Initialize text helper: measures per-size metrics from the loaded fonts.
-   * Must happen after font load and before the first draw_ui() frame. */
-  ui_text_init(font, font_mono);
+  chiaki_startup_prof_end(prof, span);
+  CHIAKI_STARTUP_SCOPE(prof, "textures") {
+    load_textures();
+    ui_particles_init();  // Initialize VitaRPS5 particle background
+    ui_cards_init();      // Initialize console card system
+  }
+  CHIAKI_STARTUP_SCOPE(prof, "fonts") {
+    font = vita2d_load_font_file(UI_FONT_REGULAR_PATH);
+    font_mono = vita2d_load_font_file(UI_FONT_MONO_PATH);
+
+    /* Initialize text helper: measures per-size metrics from the loaded fonts.
+     * Must happen after font load and before the first draw_ui() frame. */
+    ui_text_init(font, font_mono);
+    ui_text_set_font_files(UI_FONT_REGULAR_PATH, UI_FONT_MONO_PATH);
+  }
 
   vita2d_set_vblank_wait(true);
 
@@ -419,11 +432,13 @@ void init_ui() {
   cancel_btn_str = context.config.circle_btn_confirm ? "Cross" : "Circle";
 
   // Initialize UI modules
+  span = chiaki_startup_prof_begin(prof, "ui_modules");
   ui_input_init();
   ui_screens_init();
   ui_state_init();
   ui_nav_init();    // Initialize navigation module
   ui_focus_init();  // Initialize centralized focus manager (Phase 1)
+  chiaki_startup_prof_end(prof, span);
 
   // Get pointers to input state for direct manipulation (legacy compatibility)
   button_block_mask = ui_input_get_button_block_mask_ptr();
@@ -460,26 +475,10 @@ void draw_ui() {
   context.ui_state.error_popup_modal_pushed = false;
   context.ui_state.register_host_modal_pushed = false;
 
-  load_psn_id_if_needed();
-  time_t startup_t = time(NULL);
-  uint64_t startup_unix = 0;
-  if (startup_t != (time_t)-1) {
-    startup_unix = (uint64_t)startup_t;
-    /* psn_remote_refresh_hosts() refreshes the OAuth token, fetches the PSN
-     * device list, and persists the config. It is a no-op when PSN internet
-     * mode is disabled. Doing this at startup means the user does not have to
-     * navigate to Profile -> Connection card and press X to see their PS5/PS4. */
-    psn_remote_refresh_hosts();
-    /* Drain any token refresh that happened but didn't persist (e.g. host
-     * fetch failed after a successful token refresh). */
-    if (context.config_persist_pending) {
-      if (!config_serialize(&context.config))
-        CHIAKI_LOGW(&(context.log), "PSN auth: failed to persist refreshed token at startup");
-      context.config_persist_pending = false;
-    }
-  } else {
-    CHIAKI_LOGW(&(context.log), "PSN auth: skipping startup host refresh — system clock not set");
-  }
+  CHIAKI_STARTUP_SCOPE(vita_startup_prof(), "psn_id")
+    load_psn_id_if_needed();
+  /* The startup PSN device list refresh runs after the first frame, see
+   * VITA_STARTUP_PSN_HOSTS. vita_startup_frame_done() below drives it. */
 
   /*
    * Glyph atlas warm-up flag: set once here so the first main-loop iteration
@@ -507,22 +506,10 @@ void draw_ui() {
       context.config_persist_pending = false;
     }
 
-    /* Proactively refresh PSN token once per minute while idle so it never
-     * expires unnoticed between user actions. Skip during streaming to avoid
-     * network contention with the media path. */
-    if (!context.stream.is_streaming) {
-      static uint64_t last_token_check_unix = 0;
-      time_t t = time(NULL);
-      if (t != (time_t)-1) {
-        uint64_t now_unix = (uint64_t)t;
-        if (last_token_check_unix == 0)
-          last_token_check_unix = startup_unix;
-        if (now_unix - last_token_check_unix >= 60) {
-          last_token_check_unix = now_unix;
-          psn_auth_refresh_token_if_needed(now_unix, false);
-        }
-      }
-    }
+    /* The token lifecycle refreshes the PSN token ahead of expiry on its own
+     * thread (held back while streaming); pick up what it rotated so the
+     * drain above persists it. */
+    psn_auth_poll();
 
     // Always read controller input - input thread uses Ext2 variant to access controller
     // independently
@@ -594,7 +581,8 @@ void draw_ui() {
        * so they produce no visible output even on the first rendered frame.
        */
       if (ui_text_prewarm_pending) {
-        ui_text_prewarm();
+        CHIAKI_STARTUP_SCOPE(vita_startup_prof(), "text_prewarm")
+          ui_text_prewarm();
         ui_text_prewarm_pending = 0;
         LOGD("PIPE/UI_PREWARM_DONE us=%llu", (unsigned long long)sceKernelGetProcessTimeWide());
       }
@@ -704,6 +692,8 @@ void draw_ui() {
       vita2d_end_drawing();
       vita2d_common_dialog_update();
       vita2d_swap_buffers();
+      vita_startup_frame_done();
+      ui_text_flush_glyph_cache();
     } else {
       // Streaming active — render decoded frames from the UI thread.
       // This decouples GPU display from the Takion network receive thread,
@@ -0,0 +1,380 @@
+/**
+ * @file ui_glyph_cache.c
+ * @brief Persisted glyph atlas for VitaRPS5 UI fonts
+ *
+ * Loaded records are not copied: the file is read with one fread and the
+ * entries point into that buffer. Glyphs added later own a copy of their
+ * coverage. A small open-addressing table maps glyph_index to entry.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ui/ui_glyph_cache.h"
+
+static const uint8_t GLYPH_CACHE_MAGIC[4] = {'V', 'G', 'A', 'C'};
+
+/* Buffer size for glyph_cache_hash_file() reads. */
+#define GLYPH_CACHE_HASH_CHUNK 4096
+
+/* Initial glyph capacity, covers the prewarm charset of one font. */
+#define GLYPH_CACHE_INITIAL_CAPACITY 128
+
+struct GlyphCache {
+  GlyphCacheKey key;
+  uint8_t *blob; /* loaded file, entries [0, blob_count) point into it */
+  size_t blob_count;
+  GlyphCacheEntry *entries;
+  size_t count;
+  size_t capacity;
+  uint32_t *index; /* entry + 1 per slot, 0 when empty */
+  size_t index_size;
+  size_t persisted; /* entries [0, persisted) are in the file on disk */
+  bool rewrite;     /* the file on disk is not a valid prefix of the cache */
+};
+
+/* ============================================================================
+ * Encoding
+ * ============================================================================ */
+
+static void put_le(uint8_t *p, uint64_t v, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *p, size_t n) {
+  uint64_t v = 0;
+  for (size_t i = 0; i < n; i++)
+    v |= (uint64_t)p[i] << (8 * i);
+  return v;
+}
+
+static uint32_t fnv1a32(uint32_t h, const uint8_t *data, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    h ^= data[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+#define FNV1A32_SEED 2166136261u
+
+/* FNV-1a steps over whole 64 bit words, then the tail bytewise: a font is
+ * hashed on every launch and a multiply per byte is most of that. */
+uint64_t glyph_cache_hash(uint64_t h, const void *data, size_t size) {
+  const uint8_t *p = data;
+  size_t i = 0;
+  for (; size - i >= sizeof(uint64_t); i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, p + i, sizeof(word));
+    h ^= word;
+    h *= 0x100000001b3ULL;
+  }
+  for (; i < size; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+bool glyph_cache_hash_file(const char *path, uint64_t *hash) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    return false;
+  uint8_t chunk[GLYPH_CACHE_HASH_CHUNK];
+  uint64_t h = GLYPH_CACHE_HASH_SEED;
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+    h = glyph_cache_hash(h, chunk, n);
+  bool ok = !ferror(fp);
+  fclose(fp);
+  if (ok)
+    *hash = h;
+  return ok;
+}
+
+static void write_header(const GlyphCacheKey *key, uint8_t *p) {
+  memset(p, 0, GLYPH_CACHE_HEADER_SIZE);
+  memcpy(p, GLYPH_CACHE_MAGIC, sizeof(GLYPH_CACHE_MAGIC));
+  put_le(p + 4, GLYPH_CACHE_VERSION, 2);
+  put_le(p + 8, key->font_hash, 8);
+  put_le(p + 16, key->glyph_set_hash, 8);
+  put_le(p + 24, fnv1a32(FNV1A32_SEED, p, 24), 4);
+}
+
+static size_t record_size(const GlyphCacheEntry *e) {
+  return GLYPH_CACHE_RECORD_HEADER_SIZE + (size_t)e->width * e->height;
+}
+
+static void write_record(const GlyphCacheEntry *e, uint8_t *p) {
+  size_t coverage_size = (size_t)e->width * e->height;
+  put_le(p, e->glyph_index, 4);
+  put_le(p + 4, e->glyph_size, 2);
+  put_le(p + 6, e->width, 2);
+  put_le(p + 8, e->height, 2);
+  put_le(p + 10, (uint16_t)e->bitmap_left, 2);
+  put_le(p + 12, (uint16_t)e->bitmap_top, 2);
+  put_le(p + 14, 0, 2);
+  put_le(p + 16, (uint32_t)e->advance_x, 4);
+  put_le(p + 20, (uint32_t)e->advance_y, 4);
+  uint32_t sum = fnv1a32(FNV1A32_SEED, p, 24);
+  sum = fnv1a32(sum, e->coverage, coverage_size);
+  put_le(p + 24, sum, 4);
+  if (coverage_size)
+    memcpy(p + GLYPH_CACHE_RECORD_HEADER_SIZE, e->coverage, coverage_size);
+}
+
+/* ============================================================================
+ * Index
+ * ============================================================================ */
+
+static size_t index_slot(uint32_t glyph_index, size_t index_size) {
+  return (size_t)(glyph_index * 2654435761u) & (index_size - 1);
+}
+
+static void index_put(GlyphCache *cache, size_t entry) {
+  size_t slot = index_slot(cache->entries[entry].glyph_index, cache->index_size);
+  while (cache->index[slot])
+    slot = (slot + 1) & (cache->index_size - 1);
+  cache->index[slot] = (uint32_t)entry + 1;
+}
+
+/* Keep the table at most half full so probes stay short. */
+static bool index_reserve(GlyphCache *cache, size_t count) {
+  if (count * 2 <= cache->index_size)
+    return true;
+  size_t size = cache->index_size;
+  while (count * 2 > size)
+    size *= 2;
+  uint32_t *index = calloc(size, sizeof(*index));
+  if (!index)
+    return false;
+  free(cache->index);
+  cache->index = index;
+  cache->index_size = size;
+  for (size_t i = 0; i < cache->count; i++)
+    index_put(cache, i);
+  return true;
+}
+
+static bool entries_reserve(GlyphCache *cache, size_t count) {
+  if (!index_reserve(cache, count))
+    return false;
+  if (count <= cache->capacity)
+    return true;
+  size_t capacity = cache->capacity * 2;
+  while (capacity < count)
+    capacity *= 2;
+  GlyphCacheEntry *entries = realloc(cache->entries, capacity * sizeof(*entries));
+  if (!entries)
+    return false;
+  cache->entries = entries;
+  cache->capacity = capacity;
+  return true;
+}
+
+/* ============================================================================
+ * Public API
+ * ============================================================================ */
+
+GlyphCache *glyph_cache_new(const GlyphCacheKey *key) {
+  GlyphCache *cache = calloc(1, sizeof(*cache));
+  if (!cache)
+    return NULL;
+  cache->key = *key;
+  cache->capacity = GLYPH_CACHE_INITIAL_CAPACITY;
+  cache->entries = malloc(cache->capacity * sizeof(*cache->entries));
+  cache->index_size = GLYPH_CACHE_INITIAL_CAPACITY * 2;
+  cache->index = calloc(cache->index_size, sizeof(*cache->index));
+  if (!cache->entries || !cache->index) {
+    glyph_cache_free(cache);
+    return NULL;
+  }
+  /* there is no file yet */
+  cache->rewrite = true;
+  return cache;
+}
+
+void glyph_cache_free(GlyphCache *cache) {
+  if (!cache)
+    return;
+  for (size_t i = cache->blob_count; i < cache->count; i++)
+    free((void *)cache->entries[i].coverage);
+  free(cache->entries);
+  free(cache->index);
+  free(cache->blob);
+  free(cache);
+}
+
+size_t glyph_cache_load(GlyphCache *cache, uint8_t *buf, size_t size) {
+  if (cache->count || cache->blob) {
+    free(buf);
+    return 0;
+  }
+  uint8_t expected[GLYPH_CACHE_HEADER_SIZE];
+  write_header(&cache->key, expected);
+  if (!buf || size < GLYPH_CACHE_HEADER_SIZE || memcmp(buf, expected, GLYPH_CACHE_HEADER_SIZE) != 0) {
+    free(buf);
+    return 0;
+  }
+  cache->blob = buf;
+
+  size_t pos = GLYPH_CACHE_HEADER_SIZE;
+  while (size - pos >= GLYPH_CACHE_RECORD_HEADER_SIZE) {
+    const uint8_t *p = buf + pos;
+    GlyphCacheEntry e;
+    e.glyph_index = (uint32_t)get_le(p, 4);
+    e.glyph_size = (uint16_t)get_le(p + 4, 2);
+    e.width = (uint16_t)get_le(p + 6, 2);
+    e.height = (uint16_t)get_le(p + 8, 2);
+    e.bitmap_left = (int16_t)get_le(p + 10, 2);
+    e.bitmap_top = (int16_t)get_le(p + 12, 2);
+    e.advance_x = (int32_t)get_le(p + 16, 4);
+    e.advance_y = (int32_t)get_le(p + 20, 4);
+    e.coverage = p + GLYPH_CACHE_RECORD_HEADER_SIZE;
+    if (!e.glyph_size || e.width > GLYPH_CACHE_MAX_GLYPH_DIM || e.height > GLYPH_CACHE_MAX_GLYPH_DIM)
+      break;
+    size_t rsize = record_size(&e);
+    if (size - pos < rsize)
+      break;
+    uint32_t sum = fnv1a32(FNV1A32_SEED, p, 24);
+    sum = fnv1a32(sum, e.coverage, rsize - GLYPH_CACHE_RECORD_HEADER_SIZE);
+    if (sum != (uint32_t)get_le(p + 24, 4))
+      break;
+    if (glyph_cache_find(cache, e.glyph_index) || !entries_reserve(cache, cache->count + 1))
+      break;
+    cache->entries[cache->count] = e;
+    index_put(cache, cache->count);
+    cache->count++;
+    pos += rsize;
+  }
+
+  cache->blob_count = cache->count;
+  cache->persisted = cache->count;
+  cache->rewrite = pos != size;
+  return cache->count;
+}
+
+size_t glyph_cache_load_file(GlyphCache *cache, const char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    return 0;
+  uint8_t *buf = NULL;
+  long size = -1;
+  if (fseek(fp, 0, SEEK_END) == 0)
+    size = ftell(fp);
+  if (size > 0 && fseek(fp, 0, SEEK_SET) == 0) {
+    buf = malloc((size_t)size);
+    if (buf && fread(buf, 1, (size_t)size, fp) != (size_t)size) {
+      free(buf);
+      buf = NULL;
+    }
+  }
+  fclose(fp);
+  if (!buf)
+    return 0;
+  return glyph_cache_load(cache, buf, (size_t)size);
+}
+
+bool glyph_cache_add(GlyphCache *cache, const GlyphCacheEntry *entry) {
+  if (!entry->glyph_size || entry->width > GLYPH_CACHE_MAX_GLYPH_DIM ||
+      entry->height > GLYPH_CACHE_MAX_GLYPH_DIM)
+    return false;
+  if (glyph_cache_find(cache, entry->glyph_index))
+    return true;
+  if (!entries_reserve(cache, cache->count + 1))
+    return false;
+  size_t coverage_size = (size_t)entry->width * entry->height;
+  /* always allocate, so entries past blob_count can be freed unconditionally */
+  uint8_t *coverage = malloc(coverage_size ? coverage_size : 1);
+  if (!coverage)
+    return false;
+  if (coverage_size)
+    memcpy(coverage, entry->coverage, coverage_size);
+  cache->entries[cache->count] = *entry;
+  cache->entries[cache->count].coverage = coverage;
+  index_put(cache, cache->count);
+  cache->count++;
+  return true;
+}
+
+const GlyphCacheEntry *glyph_cache_find(const GlyphCache *cache, uint32_t glyph_index) {
+  size_t slot = index_slot(glyph_index, cache->index_size);
+  uint32_t entry;
+  while ((entry = cache->index[slot])) {
+    if (cache->entries[entry - 1].glyph_index == glyph_index)
+      return &cache->entries[entry - 1];
+    slot = (slot + 1) & (cache->index_size - 1);
+  }
+  return NULL;
+}
+
+size_t glyph_cache_count(const GlyphCache *cache) {
+  return cache->count;
+}
+
+const GlyphCacheEntry *glyph_cache_entry(const GlyphCache *cache, size_t i) {
+  return i < cache->count ? &cache->entries[i] : NULL;
+}
+
+size_t glyph_cache_pending(const GlyphCache *cache) {
+  return cache->count - cache->persisted;
+}
+
+static size_t records_size(const GlyphCache *cache, size_t from) {
+  size_t size = 0;
+  for (size_t i = from; i < cache->count; i++)
+    size += record_size(&cache->entries[i]);
+  return size;
+}
+
+static void write_records(const GlyphCache *cache, size_t from, uint8_t *p) {
+  for (size_t i = from; i < cache->count; i++) {
+    write_record(&cache->entries[i], p);
+    p += record_size(&cache->entries[i]);
+  }
+}
+
+size_t glyph_cache_serialize(const GlyphCache *cache, uint8_t *buf, size_t buf_size) {
+  size_t size = GLYPH_CACHE_HEADER_SIZE + records_size(cache, 0);
+  if (!buf)
+    return size;
+  if (buf_size < size)
+    return 0;
+  write_header(&cache->key, buf);
+  write_records(cache, 0, buf + GLYPH_CACHE_HEADER_SIZE);
+  return size;
+}
+
+bool glyph_cache_flush_file(GlyphCache *cache, const char *path) {
+  if (cache->rewrite ? !cache->count : !glyph_cache_pending(cache))
+    return true;
+
+  size_t from = cache->rewrite ? 0 : cache->persisted;
+  size_t size = records_size(cache, from) + (cache->rewrite ? GLYPH_CACHE_HEADER_SIZE : 0);
+  uint8_t *buf = malloc(size);
+  if (!buf)
+    return false;
+  if (cache->rewrite)
+    glyph_cache_serialize(cache, buf, size);
+  else
+    write_records(cache, from, buf);
+
+  bool ok = false;
+  FILE *fp = fopen(path, cache->rewrite ? "wb" : "ab");
+  if (fp) {
+    ok = fwrite(buf, 1, size, fp) == size;
+    ok = fclose(fp) == 0 && ok;
+  }
+  free(buf);
+
+  if (ok) {
+    cache->persisted = cache->count;
+    cache->rewrite = false;
+  } else {
+    /* a partial append would leave a bad record that hides everything after it */
+    cache->rewrite = true;
+  }
+  return ok;
+}
@@ -182,6 +182,21 @@ static bool request_host_wakeup_with_feedback(VitaChiakiHost *host, const char *
   return true;
 }
 
+/* Start the connection thread for a console in standby. host_stream() wakes it
+ * and starts the session as soon as it reports ready. */
+static bool start_wake_and_connect(VitaChiakiHost *host) {
+  context.stream.wake_before_connect = true;
+  context.stream.wake_canceled = false;
+  ui_connection_begin(UI_CONNECTION_STAGE_WAKING);
+  if (!start_connection_thread(host)) {
+    context.stream.wake_before_connect = false;
+    ui_connection_cancel();
+    return false;
+  }
+  ui_state_set_waking_wait_for_stream_us(sceKernelGetProcessTimeWide());
+  return true;
+}
+
 static bool open_url_in_vita_browser(const char *url) {
   if (!url || !url[0]) {
     LOGE("Browser launch skipped: empty URL");
@@ -626,11 +641,9 @@ static UIScreenType handle_vitarps5_touch_input(int num_hosts) {
             return UI_SCREEN_TYPE_REGISTER_HOST;
           } else if (at_rest) {
             LOGD("Touch wake gesture on dormant console");
-            ui_connection_begin(UI_CONNECTION_STAGE_WAKING);
-            if (request_host_wakeup_with_feedback(context.active_host, "touch-standby", false))
-              return UI_SCREEN_TYPE_WAKING;
-            ui_connection_cancel();
-            return UI_SCREEN_TYPE_MAIN;
+            if (!start_wake_and_connect(context.active_host))
+              return UI_SCREEN_TYPE_MAIN;
+            return UI_SCREEN_TYPE_WAKING;
           } else if (registered) {
             /* Touch always connects via LAN — long-press popup is controller-only by design. */
             ui_connection_begin(UI_CONNECTION_STAGE_CONNECTING);
@@ -669,8 +682,7 @@ static void main_menu_move_selection(int delta, int num_hosts) {
 static UIScreenType main_menu_activate_selected_card(void) {
   /* Capture and clear force_psn_holepunch so early-return paths never leak the
    * flag into a future LAN attempt. Restored only where start_connection_thread
-   * is invoked — including the standby-wake path, where ui_screen_draw_waking()
-   * defers the actual thread start. */
+   * is invoked, including the standby-wake path. */
   bool saved_force_psn = context.stream.force_psn_holepunch;
   context.stream.force_psn_holepunch = false;
 
@@ -698,16 +710,14 @@ static UIScreenType main_menu_activate_selected_card(void) {
     return UI_SCREEN_TYPE_REGISTER_HOST;
   if (at_rest) {
     LOGD("Waking dormant console...");
-    ui_connection_begin(UI_CONNECTION_STAGE_WAKING);
-    if (request_host_wakeup_with_feedback(context.active_host, "cross-standby", false)) {
-      /* Restore the flag so ui_screen_draw_waking()'s deferred
-       * start_connection_thread() honours the user's Internet choice. */
-      context.stream.force_psn_holepunch = saved_force_psn;
-      return UI_SCREEN_TYPE_WAKING;
+    /* Restore the flag so host_stream() honours the user's Internet choice
+     * once the console is awake. */
+    context.stream.force_psn_holepunch = saved_force_psn;
+    if (!start_wake_and_connect(context.active_host)) {
+      context.stream.force_psn_holepunch = false;
+      return UI_SCREEN_TYPE_MAIN;
     }
-    /* Wake request failed — connection will not proceed; leave flag cleared. */
-    ui_connection_cancel();
-    return UI_SCREEN_TYPE_MAIN;
+    return UI_SCREEN_TYPE_WAKING;
   }
 
   if (added) {
@@ -3551,8 +3561,10 @@ UIScreenType ui_screen_draw_waking(void) {
   // Get current time for animations
   uint32_t current_time = sceKernelGetProcessTimeLow() / 1000;
 
-  // If we're in the wake stage, poll discovery state until the console is ready
-  if (ui_connection_stage() == UI_CONNECTION_STAGE_WAKING && context.active_host) {
+  // If we're in the wake stage without a connection thread doing the wake,
+  // poll discovery state until the console is ready
+  if (ui_connection_stage() == UI_CONNECTION_STAGE_WAKING && context.active_host &&
+      !ui_state_connection_thread_active()) {
     bool ready =
         (context.active_host->type & REGISTERED) &&
         !(context.active_host->discovery_state &&
@@ -7,16 +7,20 @@
  *     pairs used by the UI before the first visible frame.
  *  2. Caching ascent and line-height once per pt size via a probe string, so
  *     all call sites share identical, metrics-derived baseline offsets.
+ *  3. Persisting each font's atlas (ui_glyph_cache.h) so later launches
+ *     bulk-load the rasterized glyphs instead of running FreeType again.
  *
  * Phase 2 will migrate the 114 existing vita2d_font_draw_text call sites to
  * use ui_text_draw() / ui_text_draw_centered_v().
  */
 
 #include <vita2d.h>
+#include <vita2d_font_cache.h>
 #include <psp2/kernel/clib.h>
 
 #include "ui/ui_text.h"
 #include "ui/ui_constants.h"
+#include "ui/ui_glyph_cache.h"
 
 /* ============================================================================
  * Named Constants — no magic numbers below this section
@@ -146,6 +150,13 @@ static const char UI_FONT_METRIC_PROBE[] = "Ag|";
  */
 #define UI_FONT_UTF8_SEQ_BUFFER_BYTES 8
 
+/*
+ * Persisted atlas of each font, see ui_glyph_cache.h.  A file is rewritten
+ * when the font file, the prewarm tables or the supersample factor change.
+ */
+#define UI_GLYPH_CACHE_REGULAR_PATH "ux0:/data/vita-chiaki/glyphs-regular.bin"
+#define UI_GLYPH_CACHE_MONO_PATH "ux0:/data/vita-chiaki/glyphs-mono.bin"
+
 /* ============================================================================
  * Per-size metric cache
  * ============================================================================ */
@@ -169,6 +180,16 @@ static vita2d_font *s_font_regular = NULL;
 static vita2d_font *s_font_mono = NULL;
 static int s_prewarm_needed = 0; /* armed to 1 only after a successful ui_text_init() */
 
+/* Persisted atlas of one font. */
+typedef struct {
+  const char *font_path; /* borrowed, NULL until ui_text_set_font_files() */
+  const char *cache_path;
+  GlyphCache *cache; /* NULL until ui_text_prewarm() opened it */
+} FontGlyphCache;
+
+static FontGlyphCache s_glyph_cache_regular = {NULL, UI_GLYPH_CACHE_REGULAR_PATH, NULL};
+static FontGlyphCache s_glyph_cache_mono = {NULL, UI_GLYPH_CACHE_MONO_PATH, NULL};
+
 /* ============================================================================
  * Internal Helpers
  * ============================================================================ */
@@ -334,6 +355,90 @@ static int utf8_extract(const char **pp, char *out_buf) {
   return seq_len;
 }
 
+/**
+ * on_glyph_rasterized() - vita2d_font callback, record a new atlas glyph.
+ * @user:  The font's FontGlyphCache.
+ * @glyph: Coverage and metrics as inserted into the atlas.
+ *
+ * The record reaches the file on the next ui_text_flush_glyph_cache().
+ */
+static void on_glyph_rasterized(void *user, const vita2d_font_glyph *glyph) {
+  FontGlyphCache *fc = user;
+  if (!fc->cache)
+    return;
+  GlyphCacheEntry e = {glyph->glyph_index, (uint16_t)glyph->glyph_size,
+                       (uint16_t)glyph->width, (uint16_t)glyph->height,
+                       (int16_t)glyph->bitmap_left, (int16_t)glyph->bitmap_top,
+                       glyph->advance_x, glyph->advance_y, glyph->coverage};
+  glyph_cache_add(fc->cache, &e);
+}
+
+/**
+ * glyph_cache_close() - Flush and drop a font's persisted atlas.
+ * @fc: Cache to close; a no-op if it was never opened.
+ */
+static void glyph_cache_close(FontGlyphCache *fc) {
+  if (!fc->cache)
+    return;
+  glyph_cache_flush_file(fc->cache, fc->cache_path);
+  glyph_cache_free(fc->cache);
+  fc->cache = NULL;
+}
+
+/**
+ * glyph_cache_open() - Load a font's persisted atlas into its vita2d atlas.
+ * @fc:         Cache of @f.
+ * @f:          Font whose atlas receives the glyphs.
+ * @sizes:      Prewarm size table of @f, part of the cache key.
+ * @size_count: Number of entries in @sizes.
+ *
+ * Returns the number of glyphs preloaded, 0 when there was no usable cache
+ * file (first launch, font or prewarm tables changed).  Glyphs FreeType
+ * rasterizes from now on are recorded for the next flush.
+ */
+static size_t glyph_cache_open(FontGlyphCache *fc, vita2d_font *f, const int *sizes,
+                               int size_count) {
+  int supersample = VITARPS5_FONT_SUPERSAMPLE;
+  GlyphCacheKey key;
+  size_t preloaded = 0;
+  size_t i;
+
+  glyph_cache_close(fc);
+  if (!fc->font_path)
+    return 0;
+  if (!glyph_cache_hash_file(fc->font_path, &key.font_hash)) {
+    sceClibPrintf("[WARN] ui_text: cannot read %s, glyph cache disabled\n", fc->font_path);
+    return 0;
+  }
+  /* Everything that decides which glyphs get rasterized at which size. */
+  key.glyph_set_hash = glyph_cache_hash(GLYPH_CACHE_HASH_SEED, UI_FONT_PREWARM_CHARSET,
+                                        sizeof(UI_FONT_PREWARM_CHARSET));
+  key.glyph_set_hash = glyph_cache_hash(key.glyph_set_hash, sizes, (size_t)size_count * sizeof(*sizes));
+  key.glyph_set_hash = glyph_cache_hash(key.glyph_set_hash, &supersample, sizeof(supersample));
+
+  fc->cache = glyph_cache_new(&key);
+  if (!fc->cache)
+    return 0;
+  glyph_cache_load_file(fc->cache, fc->cache_path);
+
+  /* In recorded order, which packs the atlas as the run that wrote the file. */
+  for (i = 0; i < glyph_cache_count(fc->cache); i++) {
+    const GlyphCacheEntry *e = glyph_cache_entry(fc->cache, i);
+    vita2d_font_glyph glyph = {e->glyph_index, e->glyph_size, e->width, e->height,
+                               e->bitmap_left, e->bitmap_top, e->advance_x, e->advance_y,
+                               e->coverage};
+    if (!vita2d_font_preload_glyph(f, &glyph))
+      break;
+    preloaded++;
+  }
+  vita2d_font_set_glyph_callback(f, on_glyph_rasterized, fc);
+#ifndef NDEBUG
+  sceClibPrintf("[ui_text] glyph cache %s: %u glyphs preloaded\n", fc->cache_path,
+                (unsigned)preloaded);
+#endif
+  return preloaded;
+}
+
 /* ============================================================================
  * Public API
  * ============================================================================ */
@@ -353,6 +458,9 @@ static int utf8_extract(const char **pp, char *out_buf) {
  * Both pointers are borrowed — ownership remains with the caller.
  */
 void ui_text_init(vita2d_font *regular, vita2d_font *mono) {
+  /* Fonts are (re)loaded, the persisted atlases are reopened by the next prewarm. */
+  glyph_cache_close(&s_glyph_cache_regular);
+  glyph_cache_close(&s_glyph_cache_mono);
   s_font_regular = regular;
   s_font_mono = mono;
 
@@ -374,18 +482,47 @@ int ui_text_needs_prewarm(void) {
   return s_prewarm_needed;
 }
 
+/**
+ * ui_text_set_font_files() - Enable the persisted glyph atlas.
+ *
+ * The paths are hashed into the cache key by ui_text_prewarm(); both are
+ * borrowed and must outlive the fonts.
+ */
+void ui_text_set_font_files(const char *regular_path, const char *mono_path) {
+  s_glyph_cache_regular.font_path = regular_path;
+  s_glyph_cache_mono.font_path = mono_path;
+}
+
+/**
+ * ui_text_flush_glyph_cache() - Persist glyphs rasterized since the last flush.
+ *
+ * Cheap when nothing is pending, so it can run every idle frame.
+ */
+void ui_text_flush_glyph_cache(void) {
+  if (s_glyph_cache_regular.cache && glyph_cache_pending(s_glyph_cache_regular.cache))
+    glyph_cache_flush_file(s_glyph_cache_regular.cache, s_glyph_cache_regular.cache_path);
+  if (s_glyph_cache_mono.cache && glyph_cache_pending(s_glyph_cache_mono.cache))
+    glyph_cache_flush_file(s_glyph_cache_mono.cache, s_glyph_cache_mono.cache_path);
+}
+
 /**
  * prewarm_one_font() - Bake all charset glyphs for one font across a set of sizes.
  * @f:          Font to draw with.
  * @sizes:      Array of point sizes to iterate.
  * @size_count: Number of entries in @sizes.
  *
+ * @draw:       0 to only measure, see below.
+ *
  * Walks UI_FONT_PREWARM_CHARSET via utf8_extract(), issuing a
  * vita2d_font_draw_text call per glyph at fully transparent, off-screen
  * coordinates.  This forces FreeType rasterization and GXM atlas upload
  * without producing any visible output.
+ *
+ * When the atlas was preloaded from the glyph cache, each glyph is measured
+ * instead of drawn: measuring still rasterizes a glyph the cache missed, but
+ * skips the ~1000 off-screen draws for glyphs that are already there.
  */
-static void prewarm_one_font(vita2d_font *f, const int *sizes, int size_count) {
+static void prewarm_one_font(vita2d_font *f, const int *sizes, int size_count, int draw) {
   char glyph_buf[UI_FONT_UTF8_SEQ_BUFFER_BYTES];
   int size_idx;
 
@@ -398,8 +535,11 @@ static void prewarm_one_font(vita2d_font *f, const int *sizes, int size_count) {
       if (extracted < 0)
         continue;
 
-      vita2d_font_draw_text(f, UI_FONT_PREWARM_OFFSCREEN_X, UI_FONT_PREWARM_OFFSCREEN_Y,
-                            UI_FONT_PREWARM_COLOR, (unsigned int)pt, glyph_buf);
+      if (draw)
+        vita2d_font_draw_text(f, UI_FONT_PREWARM_OFFSCREEN_X, UI_FONT_PREWARM_OFFSCREEN_Y,
+                              UI_FONT_PREWARM_COLOR, (unsigned int)pt, glyph_buf);
+      else
+        vita2d_font_text_width(f, (unsigned int)pt, glyph_buf);
     }
   }
 }
@@ -422,8 +562,14 @@ static void prewarm_one_font(vita2d_font *f, const int *sizes, int size_count) {
  *
  * Each multibyte UTF-8 sequence is drawn as a single call so vita2d's internal
  * UTF-8 decoder sees the full codepoint.
+ *
+ * With ui_text_set_font_files() called, each font's persisted atlas is
+ * preloaded first and whatever FreeType still had to rasterize is written
+ * back before returning.
  */
 void ui_text_prewarm(void) {
+  size_t preloaded_regular;
+  size_t preloaded_mono;
   int i;
 
   if (!s_font_regular || !s_font_mono) {
@@ -431,6 +577,12 @@ void ui_text_prewarm(void) {
     return;
   }
 
+  /* Before the metrics, whose probe string is rasterized too. */
+  preloaded_regular = glyph_cache_open(&s_glyph_cache_regular, s_font_regular,
+                                       UI_FONT_PREWARM_SIZES, UI_FONT_PREWARM_SIZE_COUNT);
+  preloaded_mono = glyph_cache_open(&s_glyph_cache_mono, s_font_mono, UI_FONT_PREWARM_MONO_SIZES,
+                                    UI_FONT_PREWARM_MONO_SIZE_COUNT);
+
   /*
    * Measure ascent and line-height here rather than in ui_text_init() because
    * some FreeType/GXM code paths rasterize internally and require an active
@@ -447,11 +599,14 @@ void ui_text_prewarm(void) {
   }
 
   /* --- Bake regular font: all six prewarm sizes --- */
-  prewarm_one_font(s_font_regular, UI_FONT_PREWARM_SIZES, UI_FONT_PREWARM_SIZE_COUNT);
+  prewarm_one_font(s_font_regular, UI_FONT_PREWARM_SIZES, UI_FONT_PREWARM_SIZE_COUNT,
+                   preloaded_regular == 0);
 
   /* --- Bake mono font: body and small sizes only --- */
-  prewarm_one_font(s_font_mono, UI_FONT_PREWARM_MONO_SIZES, UI_FONT_PREWARM_MONO_SIZE_COUNT);
+  prewarm_one_font(s_font_mono, UI_FONT_PREWARM_MONO_SIZES, UI_FONT_PREWARM_MONO_SIZE_COUNT,
+                   preloaded_mono == 0);
 
+  ui_text_flush_glyph_cache();
   s_prewarm_needed = 0;
 }
 
@@ -72,6 +72,8 @@ SceAvcdecQueryDecoderInfo *decoder_info = NULL;
 
 static bool active_video_thread = true;
 static volatile bool frame_ready_for_display = false;
+/* Takion frame index of the frame behind frame_ready_for_display, for the A/V sync holds. */
+static volatile uint16_t frame_ready_index = 0;
 
 /* --- Freeze-on-corrupt: last-good frame texture and presentation state --- */
 
@@ -222,8 +224,6 @@ void update_scaling_settings(int width, int height) {
 
 ChiakiMutex mtx;
 
-bool threadSetupComplete = false;
-
 typedef struct SceVideodecMemInfo {
   SceUInt32 memSize;
 
@@ -477,7 +477,6 @@ void vita_h264_cleanup() {
 
   if (video_status == INIT_GS) {
     // gs_sps_stop();
-    threadSetupComplete = false;
     video_status--;
   }
 }
@@ -540,7 +539,8 @@ cleanup:
   return ret;
 }
 
-int vita_h264_decode_frame(uint8_t *buf, size_t buf_size, bool frame_corrupt) {
+int vita_h264_decode_frame(uint8_t *buf, size_t buf_size, bool frame_corrupt,
+                           uint16_t frame_index) {
   // Early validation to detect corrupted frames before decoding
   if (buf == NULL || buf_size == 0) {
     LOGD("VIDEO: Invalid frame (NULL or zero size), skipping");
@@ -554,14 +554,11 @@ int vita_h264_decode_frame(uint8_t *buf, size_t buf_size, bool frame_corrupt) {
   }
 
   chiaki_mutex_lock(&mtx);
-  /* NOTE: takion.c now pins this thread to USER_0/prio-64 at startup, so
-   * the priority + affinity set below is redundant. Kept as a safety net
-   * in case the decode work is ever moved to its own thread. */
-  if (!threadSetupComplete) {
-    sceKernelChangeThreadPriority(SCE_KERNEL_THREAD_ID_SELF, 64);
-    sceKernelChangeThreadCpuAffinityMask(SCE_KERNEL_THREAD_ID_SELF, SCE_KERNEL_CPU_MASK_USER_0);
-    threadSetupComplete = true;
-  }
+  /* Decode normally runs on the takion thread, which is already scheduled
+   * by its NETWORK role policy. Only a thread without a role (decode moved
+   * elsewhere) needs the DECODE policy applied here. */
+  if (chiaki_thread_current_role() == CHIAKI_THREAD_ROLE_DEFAULT)
+    chiaki_thread_apply_role(CHIAKI_THREAD_ROLE_DECODE);
   if (buf_size > sceAvcdecDecodeAvailableSize(decoder)) {
     sceClibPrintf("Video decode buffer too small\n");
     chiaki_mutex_unlock(&mtx);
@@ -576,6 +573,8 @@ int vita_h264_decode_frame(uint8_t *buf, size_t buf_size, bool frame_corrupt) {
   uint64_t decode_end_us = sceKernelGetProcessTimeWide();
   uint32_t decode_elapsed_us = (uint32_t)(decode_end_us - decode_start_us);
   record_decode_timing_sample(decode_elapsed_us);
+  chiaki_decode_governor_decoded(&context.stream.decode_governor, decode_elapsed_us,
+                                 decode_end_us);
   if (context.stream.first_decode_frame_count < 30) {
     context.stream.first_decode_frame_count++;
     LOGD("PIPE/DECODE n=%u us=%u", context.stream.first_decode_frame_count, decode_elapsed_us);
@@ -606,6 +605,7 @@ int vita_h264_decode_frame(uint8_t *buf, size_t buf_size, bool frame_corrupt) {
     // D5: Count frames overwritten before display consumed them
     if (frame_ready_for_display)
       context.stream.frame_overwrite_count++;
+    frame_ready_index = frame_index;
     frame_ready_for_display = true;
   } else {
     LOGD("inactive video thread");
@@ -649,6 +649,14 @@ bool vita_video_render_latest_frame(void) {
   if (!frame_ready_for_display)
     return false;
 
+  /* A frame ahead of the audio stays ready until the sync engine releases it.
+   * The hold is bounded below a frame interval, so the next decode never has to
+   * overwrite a held frame. */
+  uint16_t frame_index = frame_ready_index;
+  ChiakiAvSync *av_sync = context.stream.av_sync;
+  if (av_sync && chiaki_av_sync_video_hold(av_sync, frame_index, sceKernelGetProcessTimeWide()) > 0)
+    return false;
+
   frame_ready_for_display = false;
 
   bool drop_frame = should_drop_frame_for_pacing();
@@ -711,6 +719,9 @@ bool vita_video_render_latest_frame(void) {
     present_texture = frame_texture;
   }
 
+  if (av_sync)
+    chiaki_av_sync_video_presented(av_sync, frame_index, sceKernelGetProcessTimeWide());
+
   vita2d_start_drawing();
 
   draw_streaming(present_texture);
@@ -5,13 +5,29 @@
 #include <stdio.h>
 #include <string.h>
 
+#include <chiaki/dnscache.h>
 #include <curl/curl.h>
 
 #include "context.h"
+#include "startup.h"
 #include "vita_dns.h"
 
 #define VITA_DNS_TIMEOUT_US (5 * 1000 * 1000)
 #define VITA_DNS_RETRY 3
+/* covers every try of the native resolver, a lookup never gives up before it does */
+#define VITA_DNS_LOOKUP_TIMEOUT_MS ((VITA_DNS_TIMEOUT_US / 1000) * (VITA_DNS_RETRY + 1))
+
+static ChiakiDnsCache *dns_cache;
+
+/* Names every remote connect resolves, the STUN ones as listed in lib/src/remote/stun.h.
+ * The websocket host comes from the push server lookup and is cached on first use. */
+static const char *const known_hosts[] = {
+    "web.np.playstation.com",
+    "mobile-pushcl.np.communication.playstation.net",
+    "asm.np.community.playstation.net",
+    "stun.moonlight-stream.org",
+    "stun.l.google.com",
+};
 
 static bool vita_dns_resolve_inaddr(const char *hostname, SceNetInAddr *out) {
   int rid = sceNetResolverCreate("vita_dns", NULL, 0);
@@ -28,12 +44,85 @@ static bool vita_dns_resolve_inaddr(const char *hostname, SceNetInAddr *out) {
   return true;
 }
 
+/* ChiakiDnsResolveFunc on the native resolver, which only makes A queries and reports no TTL. */
+static ChiakiErrorCode vita_dns_backend_resolve(void *user, const char *host, ChiakiDnsFamily family,
+                                                ChiakiDnsAddr *addrs, size_t *count, uint32_t *ttl_sec) {
+  (void)user;
+  (void)ttl_sec;
+  size_t addrs_size = *count;
+  *count = 0;
+  if (family != CHIAKI_DNS_FAMILY_IPV4 || !addrs_size)
+    return CHIAKI_ERR_SUCCESS;
+  SceNetInAddr addr;
+  if (!vita_dns_resolve_inaddr(host, &addr))
+    return CHIAKI_ERR_NETWORK;
+  memset(&addrs[0], 0, sizeof(addrs[0]));
+  addrs[0].family = CHIAKI_DNS_FAMILY_IPV4;
+  memcpy(addrs[0].addr, &addr, 4);
+  *count = 1;
+  return CHIAKI_ERR_SUCCESS;
+}
+
+bool vita_dns_init(void) {
+  if (dns_cache)
+    return true;
+  ChiakiDnsCacheConfig config;
+  chiaki_dns_cache_config_defaults(&config);
+  config.backend.resolve = vita_dns_backend_resolve;
+  config.backend.user = NULL;
+  config.log = &context.log;
+  dns_cache = chiaki_dns_cache_new(&config);
+  if (!dns_cache) {
+    LOGE("vita_dns: cache init failed, resolving on every call");
+    return false;
+  }
+  return true;
+}
+
+void vita_dns_prefetch_known_hosts(void) {
+  if (!dns_cache)
+    return;
+  for (size_t i = 0; i < sizeof(known_hosts) / sizeof(known_hosts[0]); i++)
+    chiaki_dns_cache_prefetch(dns_cache, known_hosts[i], CHIAKI_DNS_FAMILY_IPV4);
+  LOGD("vita_dns: prefetching %u known hosts", (unsigned)(sizeof(known_hosts) / sizeof(known_hosts[0])));
+}
+
+void vita_dns_fini(void) {
+  if (!dns_cache)
+    return;
+  ChiakiDnsCacheStats stats;
+  chiaki_dns_cache_stats(dns_cache, &stats);
+  LOGD("vita_dns: lookups=%llu hits=%llu waits=%llu stale=%llu queries=%llu failures=%llu",
+       (unsigned long long)stats.lookups, (unsigned long long)stats.hits, (unsigned long long)stats.waits,
+       (unsigned long long)stats.stale_served, (unsigned long long)stats.queries,
+       (unsigned long long)stats.failures);
+  chiaki_dns_cache_free(dns_cache);
+  dns_cache = NULL;
+}
+
+static bool vita_dns_lookup_inaddr(const char *hostname, SceNetInAddr *out) {
+  // the cache comes up in the background at launch, wait for it rather than bypass it
+  vita_startup_require(VITA_STARTUP_DNS);
+  if (!dns_cache)
+    return vita_dns_resolve_inaddr(hostname, out);
+  ChiakiDnsAddr addr;
+  size_t count = 1;
+  ChiakiErrorCode err = chiaki_dns_cache_lookup(dns_cache, hostname, CHIAKI_DNS_FAMILY_IPV4, &addr, &count,
+                                                VITA_DNS_LOOKUP_TIMEOUT_MS);
+  if (err != CHIAKI_ERR_SUCCESS) {
+    LOGE("vita_dns: lookup failed host=%s err=%s", hostname, chiaki_error_string(err));
+    return false;
+  }
+  memcpy(out, addr.addr, 4);
+  return true;
+}
+
 bool vita_curl_add_resolve(const char *hostname, int port, struct curl_slist **list) {
   if (!hostname || !list)
     return false;
 
   SceNetInAddr addr;
-  if (!vita_dns_resolve_inaddr(hostname, &addr))
+  if (!vita_dns_lookup_inaddr(hostname, &addr))
     return false;
 
   char ip_str[INET_ADDRSTRLEN];
@@ -56,7 +145,7 @@ bool vita_resolve_sin(const char *hostname, uint16_t port, struct sockaddr_in *o
     return false;
 
   SceNetInAddr addr;
-  if (!vita_dns_resolve_inaddr(hostname, &addr))
+  if (!vita_dns_lookup_inaddr(hostname, &addr))
     return false;
 
   /* diagnostic only; sockaddr is already fully populated above */